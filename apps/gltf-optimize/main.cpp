@@ -0,0 +1,278 @@
+#include "model_optimizer.hpp"
+#include "pvs_baker.hpp"
+#include "vat_baker.hpp"
+
+#include "utils/filesystem.hpp"
+#include "utils/gltf.hpp"
+#include "utils/headless_context.hpp"
+#include "utils/job_system.hpp"
+#include "utils/mesh_compression.hpp"
+#include "utils/scene_cache.hpp"
+#include "utils/vertex_animations.hpp"
+#include "utils/vertex_normals.hpp"
+
+#include <args.hxx>
+#include <glad/glad.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+namespace
+{
+
+bool loadModel(const fs::path &path, tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers)
+{
+  std::string err;
+  std::string warn;
+  ParallelImageDecoder imageDecoder;
+  auto ret = readGltfFile(path, model, buffers, err, warn, &imageDecoder);
+  if (ret) {
+    ret = imageDecoder.decode(
+        model, getJobSystem().threadCount(), err, warn);
+  }
+  if (ret) {
+    ret = decodeCompressedBufferViews(model, buffers, err, warn);
+  }
+  if (!warn.empty()) {
+    std::cerr << "Warning: " << warn << std::endl;
+  }
+  if (!err.empty()) {
+    std::cerr << "Error: " << err << std::endl;
+  }
+  if (!ret) {
+    std::cerr << "Failed to parse glTF file" << std::endl;
+    return false;
+  }
+  if (model.defaultScene < 0 && !model.scenes.empty()) {
+    model.defaultScene = 0;
+  }
+  if (const auto normalCount = generateMissingNormals(model, buffers)) {
+    std::clog << "Generated normals of " << normalCount << " primitives"
+              << std::endl;
+  }
+  return true;
+}
+
+// Bake the vertex animations of the file at inputPath into outputPath, next
+// to it if empty
+int bakeVertexAnimationFile(
+    const fs::path &inputPath, fs::path outputPath, float frameRate)
+{
+  if (outputPath.empty()) {
+    outputPath = getVertexAnimationsPath(inputPath);
+  }
+  if (!(frameRate > 0.f)) {
+    std::cerr << "Error: the frame rate of --vat must be positive"
+              << std::endl;
+    return -1;
+  }
+  const auto startTime = std::chrono::steady_clock::now();
+  tinygltf::Model model;
+  std::vector<BufferSpan> buffers;
+  if (!loadModel(inputPath, model, buffers)) {
+    return -1;
+  }
+  VatBakeOptions options;
+  options.frameRate = frameRate;
+  VertexAnimations animations;
+  std::string err;
+  // Keyed by the source file, as the scene cache
+  if (!bakeVertexAnimations(model, buffers, options, animations, err) ||
+      !animations.write(outputPath, computeSceneCacheKey(inputPath), err)) {
+    std::cerr << "Error: " << err << std::endl;
+    return -1;
+  }
+  std::clog << "Wrote " << animations.clips().size() << " clips ("
+            << (animations.data().size() * sizeof(uint32_t) >> 10)
+            << " KB) to " << outputPath << " in "
+            << std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - startTime)
+                   .count()
+            << " s" << std::endl;
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  args::ArgumentParser parser{
+      "Optimize the default scene of a static glTF file for the viewer."};
+  args::HelpFlag help{parser, "help", "Display this help menu", {'h', "help"}};
+  args::Positional<std::string> file{
+      parser, "file", "Path to the glTF file", args::Options::Required};
+  args::ValueFlag<std::string> output{parser, "output",
+      "Output path: a .glb file or a scene cache (.gltfcache), read by the "
+      "viewer with --cache when it opens file. Default: the scene cache read "
+      "by the viewer without --cache-dir.",
+      {'o', "output"}};
+  args::Flag noMerge{parser, "no-merge",
+      "Keep one node per mesh instead of merging the primitives of the "
+      "meshes used once",
+      {"no-merge"}};
+  args::Flag noIndexOptimization{parser, "no-index-optimization",
+      "Keep the order of triangles and vertices",
+      {"no-index-optimization"}};
+  args::Flag quantize{parser, "quantize",
+      "Quantize normals, tangents and texture coordinates "
+      "(KHR_mesh_quantization)",
+      {"quantize"}};
+  args::Flag noLods{parser, "no-lods",
+      "Do not store levels of detail in the scene cache", {"no-lods"}};
+  args::Flag noMeshlets{parser, "no-meshlets",
+      "Do not store meshlets in the scene cache", {"no-meshlets"}};
+  args::ValueFlag<std::string> compression{parser, "compression",
+      "Compression of the scene cache: none, lz4 (default) or lz4hc, "
+      "smaller and slower to write for archives",
+      {"compression"}};
+  args::ValueFlag<float> pvs{parser, "cell-size",
+      "Bake the potentially visible sets of cubic cells of this size (in "
+      "scene units) in the scene cache, for static interiors. Needs an "
+      "OpenGL 4.4 GPU.",
+      {"pvs"}};
+  args::ValueFlag<float> vat{parser, "frame-rate",
+      "Instead of optimizing the scene, bake the animations of its skinned "
+      "meshes at this frame rate into vertex animations, played by the "
+      "instances of the viewer with --vertex-animations. Default output: "
+      "the file name with .vat appended.",
+      {"vat"}};
+  args::ValueFlag<size_t> threads{parser, "threads",
+      "Threads of the job system, default: one per hardware thread",
+      {"threads"}};
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch (const args::Help &) {
+    std::cout << parser;
+    return 0;
+  } catch (const args::Error &e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return -1;
+  }
+
+  if (threads) {
+    setJobSystemThreadCount(args::get(threads));
+  }
+  auto cacheCompression = SceneCacheCompression::Lz4;
+  if (compression) {
+    const auto &name = args::get(compression);
+    if (name == "none") {
+      cacheCompression = SceneCacheCompression::None;
+    } else if (name == "lz4hc") {
+      cacheCompression = SceneCacheCompression::Lz4High;
+    } else if (name != "lz4") {
+      std::cerr << "Error: invalid --compression " << name << std::endl;
+      return -1;
+    }
+  }
+  OptimizerOptions options;
+  options.mergePrimitives = !noMerge;
+  options.optimizeIndices = !noIndexOptimization;
+  options.quantizeAttributes = quantize;
+  options.generateLods = !noLods;
+  options.meshlets = !noMeshlets;
+
+  const fs::path inputPath = args::get(file);
+  if (vat) {
+    return bakeVertexAnimationFile(
+        inputPath, output ? fs::path{args::get(output)} : fs::path{},
+        args::get(vat));
+  }
+  const auto outputPath = output ? fs::path{args::get(output)}
+                                 : getSceneCachePath(
+                                       computeSceneCacheKey(inputPath), {});
+  const auto isGlb = outputPath.extension() == ".glb";
+  if (!isGlb && outputPath.extension() != ".gltfcache") {
+    std::cerr << "Error: the output must be a .glb or .gltfcache file"
+              << std::endl;
+    return -1;
+  }
+  if (options.quantizeAttributes && !isGlb) {
+    // The viewer quantizes the vertices it uploads with --quantize
+    std::cerr << "Warning: the scene cache stores float attributes, "
+                 "--quantize is ignored"
+              << std::endl;
+    options.quantizeAttributes = false;
+  }
+  if (pvs && isGlb) {
+    std::cerr << "Warning: potentially visible sets are only stored in "
+                 "scene caches, --pvs is ignored"
+              << std::endl;
+  }
+
+  const auto startTime = std::chrono::steady_clock::now();
+  tinygltf::Model model;
+  std::vector<BufferSpan> buffers;
+  if (!loadModel(inputPath, model, buffers)) {
+    return -1;
+  }
+  if (!canOptimizeModel(model)) {
+    std::cerr << "Error: only static scenes can be optimized (no animations, "
+                 "skins, morph targets or primitive extensions)"
+              << std::endl;
+    return -1;
+  }
+
+  tinygltf::Model optimized;
+  optimizeModel(model, buffers, options, optimized);
+  model = tinygltf::Model();
+  const auto optimizedBuffers = getBufferSpans(optimized);
+
+  std::string err;
+  if (isGlb) {
+    if (!writeOptimizedGlb(outputPath, optimized, err)) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+  } else {
+    if (!canWriteSceneCache(optimized)) {
+      std::cerr << "Error: the scene cannot be stored in a scene cache (e.g. "
+                   "it has lights)"
+                << std::endl;
+      return -1;
+    }
+    glm::vec3 bboxMin, bboxMax;
+    computeSceneBounds(optimized, optimizedBuffers, bboxMin, bboxMax, true);
+    auto derived =
+        buildOptimizedGeometry(optimized, optimizedBuffers, options);
+    if (pvs) {
+      std::unique_ptr<HeadlessGLContext> pContext;
+      try {
+        pContext = std::make_unique<HeadlessGLContext>();
+      } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+      }
+      if (!gladLoadGLLoader(HeadlessGLContext::getProcAddress)) {
+        std::cerr << "Error: unable to init OpenGL" << std::endl;
+        return -1;
+      }
+      PvsBakeOptions pvsOptions;
+      pvsOptions.cellSize = args::get(pvs);
+      // Next to the executable, as the shaders of the viewer
+      const auto shaderDirectory =
+          fs::path{argv[0]}.parent_path() / "shaders" / "gltf-optimize";
+      if (!bakePotentiallyVisibleSets(optimized, optimizedBuffers,
+              shaderDirectory, pvsOptions, derived.pvs, err)) {
+        std::cerr << "Error: " << err << std::endl;
+        return -1;
+      }
+    }
+    // Keyed by the source file, so that the viewer reads the cache instead
+    if (!writeSceneCache(outputPath, computeSceneCacheKey(inputPath),
+            optimized, optimizedBuffers, bboxMin, bboxMax, derived, err,
+            cacheCompression)) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+  }
+  std::clog << "Wrote " << outputPath << " in "
+            << std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - startTime)
+                   .count()
+            << " s" << std::endl;
+  return 0;
+}
@@ -0,0 +1,1014 @@
+#include "model_optimizer.hpp"
+
+#include "utils/hash.hpp"
+#include "utils/index_optimizer.hpp"
+#include "utils/job_system.hpp"
+#include "utils/png.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <set>
+#include <unordered_map>
+
+namespace
+{
+
+const char *const QUANTIZATION_EXTENSION = "KHR_mesh_quantization";
+
+// Extensions of the source that the rebuilt buffers no longer use
+const char *const DECODED_EXTENSIONS[] = {
+    "EXT_meshopt_compression", "KHR_draco_mesh_compression"};
+
+// Elements of accessor tightly packed, empty if the accessor is sparse, has
+// no bufferView or does not fit in its buffer
+std::vector<unsigned char> readAccessorBytes(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const tinygltf::Accessor &accessor)
+{
+  const auto componentSize =
+      tinygltf::GetComponentSizeInBytes(uint32_t(accessor.componentType));
+  const auto componentCount = tinygltf::GetNumComponentsInType(accessor.type);
+  if (accessor.sparse.isSparse || accessor.bufferView < 0 ||
+      componentSize <= 0 || componentCount <= 0 || !accessor.count) {
+    return {};
+  }
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  const auto &buffer = buffers[bufferView.buffer];
+  const auto elementSize = size_t(componentSize) * size_t(componentCount);
+  const auto byteStride =
+      bufferView.byteStride ? bufferView.byteStride : elementSize;
+  const auto byteOffset = bufferView.byteOffset + accessor.byteOffset;
+  if (!buffer.data ||
+      byteOffset + (accessor.count - 1) * byteStride + elementSize >
+          buffer.size) {
+    return {};
+  }
+  std::vector<unsigned char> bytes(accessor.count * elementSize);
+  for (size_t i = 0; i < accessor.count; ++i) {
+    std::memcpy(bytes.data() + i * elementSize,
+        buffer.data + byteOffset + i * byteStride, elementSize);
+  }
+  return bytes;
+}
+
+// Replace the accessors referenced by the primitives of meshes by the first
+// accessor with the same content. Return the number of accessors replaced.
+size_t mergeDuplicateAccessors(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    std::vector<tinygltf::Mesh> &meshes)
+{
+  std::vector<int> remap(model.accessors.size());
+  std::vector<std::vector<unsigned char>> contents(model.accessors.size());
+  std::unordered_multimap<uint64_t, int> firstAccessors; // By content hash
+  size_t mergedCount = 0;
+  for (size_t i = 0; i < model.accessors.size(); ++i) {
+    const auto &accessor = model.accessors[i];
+    remap[i] = int(i);
+    contents[i] = readAccessorBytes(model, buffers, accessor);
+    if (contents[i].empty()) {
+      continue;
+    }
+    auto hash = fnv1a64(contents[i].data(), contents[i].size());
+    hash = fnv1a64(&accessor.componentType, sizeof(int), hash);
+    hash = fnv1a64(&accessor.type, sizeof(int), hash);
+    hash = fnv1a64(&accessor.normalized, sizeof(bool), hash);
+    const auto range = firstAccessors.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      const auto &first = model.accessors[it->second];
+      if (first.componentType == accessor.componentType &&
+          first.type == accessor.type &&
+          first.normalized == accessor.normalized &&
+          contents[it->second] == contents[i]) {
+        remap[i] = it->second;
+        break;
+      }
+    }
+    if (remap[i] == int(i)) {
+      firstAccessors.emplace(hash, int(i));
+    } else {
+      contents[i] = {};
+      ++mergedCount;
+    }
+  }
+
+  for (auto &mesh : meshes) {
+    for (auto &primitive : mesh.primitives) {
+      for (auto &attribute : primitive.attributes) {
+        attribute.second = remap[attribute.second];
+      }
+      if (primitive.indices >= 0) {
+        primitive.indices = remap[primitive.indices];
+      }
+    }
+  }
+  return mergedCount;
+}
+
+// meshRemap[i] is the first mesh with the same primitives as meshes[i]
+std::vector<int> findDuplicateMeshes(const std::vector<tinygltf::Mesh> &meshes)
+{
+  std::vector<int> meshRemap(meshes.size());
+  std::unordered_multimap<uint64_t, int> firstMeshes;
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    meshRemap[i] = int(i);
+    uint64_t hash = fnv1a64(nullptr, 0);
+    for (const auto &primitive : meshes[i].primitives) {
+      for (const auto &attribute : primitive.attributes) {
+        hash = fnv1a64(attribute.first.data(), attribute.first.size(), hash);
+        hash = fnv1a64(&attribute.second, sizeof(int), hash);
+      }
+      hash = fnv1a64(&primitive.indices, sizeof(int), hash);
+      hash = fnv1a64(&primitive.material, sizeof(int), hash);
+      hash = fnv1a64(&primitive.mode, sizeof(int), hash);
+    }
+    const auto range = firstMeshes.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (meshes[it->second].primitives == meshes[i].primitives) {
+        meshRemap[i] = it->second;
+        break;
+      }
+    }
+    if (meshRemap[i] == int(i)) {
+      firstMeshes.emplace(hash, int(i));
+    }
+  }
+  return meshRemap;
+}
+
+// Primitives of the default scene, placed in world space by their matrix,
+// merged in a single primitive
+struct PrimitiveGroup
+{
+  int material = -1;
+  int mode = TINYGLTF_MODE_TRIANGLES;
+  std::vector<std::string> attributes; // Names, shared by every primitive
+  int instancedMesh = -1; // Source mesh of primitives in object space
+  std::vector<std::pair<const tinygltf::Primitive *, glm::mat4>> primitives;
+};
+
+// Vertex attribute decoded to floats
+struct VertexStream
+{
+  std::string name;
+  size_t componentCount = 0;
+  std::vector<float> values;
+};
+
+// Geometry of a PrimitiveGroup, always indexed
+struct GroupGeometry
+{
+  std::vector<VertexStream> streams;
+  size_t vertexCount = 0;
+  std::vector<uint32_t> indices;
+  float acmrBefore = 0.f;
+  float acmrAfter = 0.f;
+};
+
+void transformStream(VertexStream &stream, size_t firstVertex,
+    const glm::mat4 &matrix, const glm::mat3 &normalMatrix, float handedness)
+{
+  auto *values = stream.values.data() + firstVertex * stream.componentCount;
+  const auto vertexCount =
+      stream.values.size() / stream.componentCount - firstVertex;
+  for (size_t i = 0; i < vertexCount; ++i) {
+    auto *v = values + i * stream.componentCount;
+    glm::vec3 result;
+    if (stream.name == "POSITION") {
+      result = glm::vec3(matrix * glm::vec4(v[0], v[1], v[2], 1.f));
+    } else if (stream.name == "NORMAL") {
+      result = normalMatrix * glm::vec3(v[0], v[1], v[2]);
+      const auto length = glm::length(result);
+      result = length > 0.f ? result / length : result;
+    } else {
+      result = glm::mat3(matrix) * glm::vec3(v[0], v[1], v[2]);
+      const auto length = glm::length(result);
+      result = length > 0.f ? result / length : result;
+      v[3] *= handedness;
+    }
+    v[0] = result.x;
+    v[1] = result.y;
+    v[2] = result.z;
+  }
+}
+
+GroupGeometry buildGroupGeometry(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const PrimitiveGroup &group,
+    const OptimizerOptions &options)
+{
+  GroupGeometry geometry;
+  for (const auto &name : group.attributes) {
+    VertexStream stream;
+    stream.name = name;
+    const auto &accessor =
+        model.accessors[group.primitives[0].first->attributes.at(name)];
+    stream.componentCount =
+        size_t(tinygltf::GetNumComponentsInType(accessor.type));
+    geometry.streams.push_back(std::move(stream));
+  }
+
+  std::vector<uint32_t> indices;
+  for (const auto &placedPrimitive : group.primitives) {
+    const auto &primitive = *placedPrimitive.first;
+    const auto &matrix = placedPrimitive.second;
+    const auto vertexCount =
+        model.accessors[primitive.attributes.at("POSITION")].count;
+    if (primitive.indices >= 0) {
+      const auto &indexAccessor = model.accessors[primitive.indices];
+      indices.resize(indexAccessor.count);
+      readAccessorAsUints(model, buffers, indexAccessor, indices.data());
+    } else {
+      indices.resize(vertexCount);
+      std::iota(begin(indices), end(indices), 0);
+    }
+    const auto hasInvalidCount = std::any_of(begin(group.attributes),
+        end(group.attributes), [&](const std::string &name) {
+          return model.accessors[primitive.attributes.at(name)].count !=
+                 vertexCount;
+        });
+    if (hasInvalidCount ||
+        std::any_of(begin(indices), end(indices),
+            [&](uint32_t index) { return index >= vertexCount; })) {
+      std::cerr << "Warning: skipped a primitive with invalid indices or "
+                   "attribute counts"
+                << std::endl;
+      continue;
+    }
+
+    const auto firstVertex = geometry.vertexCount;
+    for (auto &stream : geometry.streams) {
+      const auto &accessor =
+          model.accessors[primitive.attributes.at(stream.name)];
+      stream.values.resize((firstVertex + vertexCount) * stream.componentCount);
+      readAccessorAsFloats(model, buffers, accessor, stream.componentCount,
+          stream.values.data() + firstVertex * stream.componentCount);
+    }
+    geometry.vertexCount += vertexCount;
+
+    // Mirroring matrices flip the winding of triangles and the bitangents
+    const auto isMirrored = glm::determinant(glm::mat3(matrix)) < 0.f;
+    if (matrix != glm::mat4(1)) {
+      const auto normalMatrix = glm::inverseTranspose(glm::mat3(matrix));
+      for (auto &stream : geometry.streams) {
+        if (stream.name == "POSITION" || stream.name == "NORMAL" ||
+            (stream.name == "TANGENT" && stream.componentCount == 4)) {
+          transformStream(stream, firstVertex, matrix, normalMatrix,
+              isMirrored ? -1.f : 1.f);
+        }
+      }
+    }
+    if (group.mode == TINYGLTF_MODE_TRIANGLES) {
+      indices.resize(indices.size() - indices.size() % 3);
+      if (isMirrored) {
+        for (size_t i = 0; i < indices.size(); i += 3) {
+          std::swap(indices[i + 1], indices[i + 2]);
+        }
+      }
+    }
+    for (const auto index : indices) {
+      geometry.indices.push_back(uint32_t(firstVertex) + index);
+    }
+  }
+
+  if (group.mode != TINYGLTF_MODE_TRIANGLES || !options.optimizeIndices ||
+      geometry.indices.empty()) {
+    return geometry;
+  }
+  const auto &positions = std::find_if(begin(geometry.streams),
+      end(geometry.streams), [](const VertexStream &stream) {
+        return stream.name == "POSITION";
+      })->values;
+  auto &groupIndices = geometry.indices;
+  geometry.acmrBefore = computeAcmr(
+      groupIndices.data(), groupIndices.size(), geometry.vertexCount);
+  optimizeVertexCache(
+      groupIndices.data(), groupIndices.size(), geometry.vertexCount);
+  optimizeOverdraw(groupIndices.data(), groupIndices.size(), positions.data(),
+      geometry.vertexCount);
+  const auto vertexRemap = optimizeVertexFetch(
+      groupIndices.data(), groupIndices.size(), geometry.vertexCount);
+  geometry.acmrAfter = computeAcmr(
+      groupIndices.data(), groupIndices.size(), geometry.vertexCount);
+
+  // Unused vertices are numbered last, they are dropped
+  const auto usedVertexCount =
+      size_t(*std::max_element(begin(groupIndices), end(groupIndices))) + 1;
+  for (auto &stream : geometry.streams) {
+    const auto componentCount = stream.componentCount;
+    std::vector<float> values(usedVertexCount * componentCount);
+    for (size_t v = 0; v < geometry.vertexCount; ++v) {
+      if (vertexRemap[v] < usedVertexCount) {
+        std::copy_n(stream.values.data() + v * componentCount, componentCount,
+            values.data() + vertexRemap[v] * componentCount);
+      }
+    }
+    stream.values = std::move(values);
+  }
+  geometry.vertexCount = usedVertexCount;
+  return geometry;
+}
+
+// Append size bytes of data to the buffer of out in a new bufferView aligned
+// on 4 bytes. Return the index of the bufferView.
+int addBufferView(tinygltf::Model &out, const void *data, size_t size,
+    size_t byteStride = 0, int target = 0)
+{
+  auto &buffer = out.buffers[0].data;
+  buffer.resize((buffer.size() + 3) & ~size_t(3));
+  tinygltf::BufferView bufferView;
+  bufferView.buffer = 0;
+  bufferView.byteOffset = buffer.size();
+  bufferView.byteLength = size;
+  bufferView.byteStride = byteStride;
+  bufferView.target = target;
+  const auto *bytes = static_cast<const unsigned char *>(data);
+  buffer.insert(end(buffer), bytes, bytes + size);
+  out.bufferViews.push_back(std::move(bufferView));
+  return int(out.bufferViews.size() - 1);
+}
+
+int addAccessor(tinygltf::Model &out, int bufferView, int componentType,
+    bool normalized, size_t count, int type)
+{
+  tinygltf::Accessor accessor;
+  accessor.bufferView = bufferView;
+  accessor.componentType = componentType;
+  accessor.normalized = normalized;
+  accessor.count = count;
+  accessor.type = type;
+  out.accessors.push_back(std::move(accessor));
+  return int(out.accessors.size() - 1);
+}
+
+template <typename T>
+std::vector<T> quantizeValues(const std::vector<float> &values,
+    size_t componentCount, size_t paddedComponentCount, float scale)
+{
+  const auto count = values.size() / componentCount;
+  std::vector<T> quantized(count * paddedComponentCount);
+  for (size_t i = 0; i < count; ++i) {
+    for (size_t c = 0; c < componentCount; ++c) {
+      quantized[i * paddedComponentCount + c] =
+          T(std::round(values[i * componentCount + c] * scale));
+    }
+  }
+  return quantized;
+}
+
+// Add the accessor of a vertex attribute of stream to out, quantized if
+// possible with quantize. Return the index of the accessor.
+int addAttribute(
+    tinygltf::Model &out, const VertexStream &stream, bool quantize)
+{
+  const auto componentCount = stream.componentCount;
+  const auto count = componentCount ? stream.values.size() / componentCount : 0;
+  const auto type = componentCount == 1
+                        ? TINYGLTF_TYPE_SCALAR
+                        : TINYGLTF_TYPE_VEC2 + int(componentCount) - 2;
+  const auto isInRange = [&](float min, float max) {
+    return std::all_of(begin(stream.values), end(stream.values),
+        [&](float value) { return value >= min && value <= max; });
+  };
+
+  if (quantize && (stream.name == "NORMAL" || stream.name == "TANGENT") &&
+      isInRange(-1.f, 1.f)) {
+    // Vertex attributes are aligned on 4 bytes
+    const auto quantized =
+        quantizeValues<int8_t>(stream.values, componentCount, 4, 127.f);
+    const auto bufferView = addBufferView(out, quantized.data(),
+        quantized.size(), 4, TINYGLTF_TARGET_ARRAY_BUFFER);
+    return addAccessor(
+        out, bufferView, TINYGLTF_COMPONENT_TYPE_BYTE, true, count, type);
+  }
+  if (quantize && stream.name.compare(0, 9, "TEXCOORD_") == 0 &&
+      componentCount == 2 && isInRange(0.f, 1.f)) {
+    const auto quantized = quantizeValues<uint16_t>(
+        stream.values, componentCount, componentCount, 65535.f);
+    const auto bufferView = addBufferView(out, quantized.data(),
+        quantized.size() * sizeof(uint16_t), 0, TINYGLTF_TARGET_ARRAY_BUFFER);
+    return addAccessor(out, bufferView,
+        TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, true, count, type);
+  }
+
+  const auto bufferView = addBufferView(out, stream.values.data(),
+      stream.values.size() * sizeof(float), 0, TINYGLTF_TARGET_ARRAY_BUFFER);
+  const auto accessorIdx = addAccessor(
+      out, bufferView, TINYGLTF_COMPONENT_TYPE_FLOAT, false, count, type);
+  if (stream.name == "POSITION" && count) {
+    auto &accessor = out.accessors[accessorIdx];
+    accessor.minValues.assign(componentCount, HUGE_VAL);
+    accessor.maxValues.assign(componentCount, -HUGE_VAL);
+    for (size_t i = 0; i < stream.values.size(); ++i) {
+      auto &min = accessor.minValues[i % componentCount];
+      auto &max = accessor.maxValues[i % componentCount];
+      min = std::min(min, double(stream.values[i]));
+      max = std::max(max, double(stream.values[i]));
+    }
+  }
+  return accessorIdx;
+}
+
+tinygltf::Primitive addPrimitive(tinygltf::Model &out,
+    const PrimitiveGroup &group, const GroupGeometry &geometry,
+    bool quantize)
+{
+  tinygltf::Primitive primitive;
+  primitive.material = group.material;
+  primitive.mode = group.mode;
+  for (const auto &stream : geometry.streams) {
+    primitive.attributes[stream.name] = addAttribute(out, stream, quantize);
+  }
+  const auto &indices = geometry.indices;
+  if (geometry.vertexCount <= 0xffff) {
+    const std::vector<uint16_t> shortIndices(begin(indices), end(indices));
+    const auto bufferView = addBufferView(out, shortIndices.data(),
+        shortIndices.size() * sizeof(uint16_t), 0,
+        TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+    primitive.indices = addAccessor(out, bufferView,
+        TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, false, indices.size(),
+        TINYGLTF_TYPE_SCALAR);
+  } else {
+    const auto bufferView = addBufferView(out, indices.data(),
+        indices.size() * sizeof(uint32_t), 0,
+        TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+    primitive.indices =
+        addAccessor(out, bufferView, TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT,
+            false, indices.size(), TINYGLTF_TYPE_SCALAR);
+  }
+  return primitive;
+}
+
+// Mesh instances and other nodes of the tree of nodeIdx, in world space
+struct SceneNodes
+{
+  std::vector<std::pair<int, glm::mat4>> meshInstances;
+  std::vector<tinygltf::Node> otherNodes; // Cameras and lights
+};
+
+void collectNodes(const tinygltf::Model &model, int nodeIdx,
+    const glm::mat4 &parentMatrix, SceneNodes &nodes)
+{
+  const auto &node = model.nodes[nodeIdx];
+  const auto matrix = getLocalToWorldMatrix(node, parentMatrix);
+  if (node.mesh >= 0) {
+    nodes.meshInstances.emplace_back(node.mesh, matrix);
+  }
+  if (node.camera >= 0 || !node.extensions.empty()) {
+    tinygltf::Node otherNode;
+    otherNode.name = node.name;
+    otherNode.camera = node.camera;
+    otherNode.extensions = node.extensions;
+    otherNode.matrix.assign(&matrix[0][0], &matrix[0][0] + 16);
+    nodes.otherNodes.push_back(std::move(otherNode));
+  }
+  for (const auto childIdx : node.children) {
+    collectNodes(model, childIdx, matrix, nodes);
+  }
+}
+
+// Call f(int &) on each index stored in the members of value named key,
+// recursively: glTF extensions reference textures with textureInfo objects
+// whose key ends with "Texture", and images with a "source" member.
+template <typename Function>
+void forEachIndexIn(tinygltf::Value &value, bool isIndexObject,
+    const char *key, const Function &f)
+{
+  if (value.IsArray()) {
+    for (auto &element : value.Get<tinygltf::Value::Array>()) {
+      forEachIndexIn(element, false, key, f);
+    }
+    return;
+  }
+  if (!value.IsObject()) {
+    return;
+  }
+  for (auto &member : value.Get<tinygltf::Value::Object>()) {
+    if (isIndexObject && member.first == key && member.second.IsNumber()) {
+      auto index = int(member.second.GetNumberAsInt());
+      f(index);
+      member.second = tinygltf::Value(index);
+    } else {
+      const auto &name = member.first;
+      const auto isTextureInfo =
+          name.size() > 7 &&
+          name.compare(name.size() - 7, 7, "Texture") == 0;
+      forEachIndexIn(member.second,
+          std::strcmp(key, "source") == 0 || isTextureInfo, key, f);
+    }
+  }
+}
+
+template <typename Function>
+void forEachTextureIndex(tinygltf::Material &material, const Function &f)
+{
+  const auto apply = [&](int &index) {
+    if (index >= 0) {
+      f(index);
+    }
+  };
+  auto &pbr = material.pbrMetallicRoughness;
+  apply(pbr.baseColorTexture.index);
+  apply(pbr.metallicRoughnessTexture.index);
+  apply(material.normalTexture.index);
+  apply(material.occlusionTexture.index);
+  apply(material.emissiveTexture.index);
+  for (auto &extension : material.extensions) {
+    forEachIndexIn(extension.second, false, "index", apply);
+  }
+}
+
+template <typename Function>
+void forEachImageIndex(tinygltf::Texture &texture, const Function &f)
+{
+  if (texture.source >= 0) {
+    f(texture.source);
+  }
+  // KHR_texture_basisu and the like
+  for (auto &extension : texture.extensions) {
+    forEachIndexIn(extension.second, true, "source", f);
+  }
+}
+
+// remap[i] is the first element of elements equal to element i
+template <typename T, typename Equal>
+std::vector<int> findDuplicates(
+    const std::vector<T> &elements, const Equal &isEqual)
+{
+  std::vector<int> remap(elements.size());
+  for (size_t i = 0; i < elements.size(); ++i) {
+    remap[i] = int(i);
+    for (size_t j = 0; j < i; ++j) {
+      if (remap[j] == int(j) && isEqual(elements[j], elements[i])) {
+        remap[i] = int(j);
+        break;
+      }
+    }
+  }
+  return remap;
+}
+
+// Erase the elements not in isUsed, return the new index of each element, -1
+// for erased ones
+template <typename T>
+std::vector<int> eraseUnused(
+    std::vector<T> &elements, const std::vector<bool> &isUsed)
+{
+  std::vector<int> remap(elements.size(), -1);
+  size_t usedCount = 0;
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (isUsed[i]) {
+      remap[i] = int(usedCount);
+      if (usedCount != i) {
+        elements[usedCount] = std::move(elements[i]);
+      }
+      ++usedCount;
+    }
+  }
+  elements.resize(usedCount);
+  return remap;
+}
+
+// Merge equal images, samplers, textures and materials of model and drop those
+// the primitives do not use
+void deduplicateResources(tinygltf::Model &model)
+{
+  const auto forEachPrimitive = [&](const auto &f) {
+    for (auto &mesh : model.meshes) {
+      for (auto &primitive : mesh.primitives) {
+        f(primitive);
+      }
+    }
+  };
+  const auto materialCount = model.materials.size();
+  const auto textureCount = model.textures.size();
+  const auto imageCount = model.images.size();
+  const auto samplerCount = model.samplers.size();
+
+  std::vector<uint64_t> imageHashes;
+  for (const auto &image : model.images) {
+    imageHashes.push_back(fnv1a64(image.image.data(), image.image.size()));
+  }
+  const auto imageRemap = findDuplicates(model.images,
+      [&](const tinygltf::Image &lhs, const tinygltf::Image &rhs) {
+        return imageHashes[&lhs - model.images.data()] ==
+                   imageHashes[&rhs - model.images.data()] &&
+               lhs.width == rhs.width && lhs.height == rhs.height &&
+               lhs.component == rhs.component && lhs.bits == rhs.bits &&
+               lhs.as_is == rhs.as_is && !lhs.image.empty() &&
+               lhs.image == rhs.image;
+      });
+  const auto samplerRemap = findDuplicates(model.samplers,
+      [](tinygltf::Sampler lhs, const tinygltf::Sampler &rhs) {
+        lhs.name = rhs.name;
+        return lhs == rhs;
+      });
+  for (auto &texture : model.textures) {
+    forEachImageIndex(texture, [&](int &index) {
+      if (size_t(index) < imageCount) {
+        index = imageRemap[index];
+      }
+    });
+    if (texture.sampler >= 0 && size_t(texture.sampler) < samplerCount) {
+      texture.sampler = samplerRemap[texture.sampler];
+    }
+  }
+  const auto textureRemap = findDuplicates(model.textures,
+      [](tinygltf::Texture lhs, const tinygltf::Texture &rhs) {
+        lhs.name = rhs.name;
+        return lhs == rhs;
+      });
+  for (auto &material : model.materials) {
+    forEachTextureIndex(material, [&](int &index) {
+      if (size_t(index) < textureCount) {
+        index = textureRemap[index];
+      }
+    });
+  }
+  const auto materialRemap = findDuplicates(model.materials,
+      [](tinygltf::Material lhs, const tinygltf::Material &rhs) {
+        lhs.name = rhs.name;
+        return lhs == rhs;
+      });
+
+  // Drop what is not used, from the primitives down to the images
+  std::vector<bool> isMaterialUsed(materialCount, false);
+  forEachPrimitive([&](tinygltf::Primitive &primitive) {
+    if (primitive.material >= 0 && size_t(primitive.material) < materialCount) {
+      primitive.material = materialRemap[primitive.material];
+      isMaterialUsed[primitive.material] = true;
+    }
+  });
+  const auto usedMaterials = eraseUnused(model.materials, isMaterialUsed);
+  forEachPrimitive([&](tinygltf::Primitive &primitive) {
+    if (primitive.material >= 0 && size_t(primitive.material) < materialCount) {
+      primitive.material = usedMaterials[primitive.material];
+    }
+  });
+
+  std::vector<bool> isTextureUsed(textureCount, false);
+  for (auto &material : model.materials) {
+    forEachTextureIndex(material, [&](int &index) {
+      if (size_t(index) < textureCount) {
+        isTextureUsed[index] = true;
+      }
+    });
+  }
+  const auto usedTextures = eraseUnused(model.textures, isTextureUsed);
+  for (auto &material : model.materials) {
+    forEachTextureIndex(material, [&](int &index) {
+      if (size_t(index) < textureCount) {
+        index = usedTextures[index];
+      }
+    });
+  }
+
+  std::vector<bool> isImageUsed(imageCount, false);
+  std::vector<bool> isSamplerUsed(samplerCount, false);
+  for (auto &texture : model.textures) {
+    forEachImageIndex(texture, [&](int &index) {
+      if (size_t(index) < imageCount) {
+        isImageUsed[index] = true;
+      }
+    });
+    if (texture.sampler >= 0 && size_t(texture.sampler) < samplerCount) {
+      isSamplerUsed[texture.sampler] = true;
+    }
+  }
+  const auto usedImages = eraseUnused(model.images, isImageUsed);
+  const auto usedSamplers = eraseUnused(model.samplers, isSamplerUsed);
+  for (auto &texture : model.textures) {
+    forEachImageIndex(texture, [&](int &index) {
+      if (size_t(index) < imageCount) {
+        index = usedImages[index];
+      }
+    });
+    if (texture.sampler >= 0 && size_t(texture.sampler) < samplerCount) {
+      texture.sampler = usedSamplers[texture.sampler];
+    }
+  }
+
+  std::clog << "Kept " << model.materials.size() << " of " << materialCount
+            << " materials, " << model.textures.size() << " of "
+            << textureCount << " textures, " << model.images.size() << " of "
+            << imageCount << " images" << std::endl;
+}
+
+bool hasExtension(const std::vector<std::string> &extensions, const char *name)
+{
+  return std::find(begin(extensions), end(extensions), name) !=
+         end(extensions);
+}
+
+void removeExtension(std::vector<std::string> &extensions, const char *name)
+{
+  extensions.erase(std::remove(begin(extensions), end(extensions), name),
+      end(extensions));
+}
+
+} // namespace
+
+bool canOptimizeModel(const tinygltf::Model &model)
+{
+  if (model.defaultScene < 0 || !model.animations.empty() ||
+      !model.skins.empty()) {
+    return false;
+  }
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      // Primitive extensions (e.g. material variants) would not survive the
+      // merge, but for Draco whose fallback is read (see
+      // decodeCompressedBufferViews)
+      if (!primitive.targets.empty() ||
+          primitive.extensions.size() >
+              primitive.extensions.count(DECODED_EXTENSIONS[1])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void optimizeModel(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const OptimizerOptions &options,
+    tinygltf::Model &out)
+{
+  auto meshes = model.meshes;
+  const auto mergedAccessorCount =
+      mergeDuplicateAccessors(model, buffers, meshes);
+  const auto meshRemap = findDuplicateMeshes(meshes);
+
+  SceneNodes nodes;
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    collectNodes(model, nodeIdx, glm::mat4(1), nodes);
+  }
+  std::vector<size_t> meshUseCounts(meshes.size(), 0);
+  for (auto &instance : nodes.meshInstances) {
+    instance.first = meshRemap[instance.first];
+    ++meshUseCounts[instance.first];
+  }
+
+  // Primitives of meshes used once are merged in world space, those of
+  // instanced meshes are built once in object space
+  const auto isMergedMesh = [&](int meshIdx) {
+    return options.mergePrimitives && meshUseCounts[meshIdx] == 1;
+  };
+  std::vector<PrimitiveGroup> groups;
+  std::map<std::string, size_t> mergedGroups; // By material, mode, attributes
+  std::set<int> instancedMeshes;
+  for (const auto &instance : nodes.meshInstances) {
+    const auto meshIdx = instance.first;
+    const auto isMerged = isMergedMesh(meshIdx);
+    if (!isMerged && !instancedMeshes.insert(meshIdx).second) {
+      continue;
+    }
+    for (const auto &primitive : meshes[meshIdx].primitives) {
+      if (!primitive.attributes.count("POSITION")) {
+        continue;
+      }
+      PrimitiveGroup group;
+      group.material = primitive.material;
+      group.mode = primitive.mode;
+      group.instancedMesh = isMerged ? -1 : meshIdx;
+      auto key = std::to_string(primitive.material) + ' ' +
+                 std::to_string(primitive.mode);
+      for (const auto &attribute : primitive.attributes) {
+        const auto &accessor = model.accessors[attribute.second];
+        group.attributes.push_back(attribute.first);
+        key += ' ' + attribute.first + ':' +
+               std::to_string(tinygltf::GetNumComponentsInType(accessor.type));
+      }
+      // Strips, loops and fans cannot be concatenated
+      const auto canMerge = primitive.mode == TINYGLTF_MODE_POINTS ||
+                            primitive.mode == TINYGLTF_MODE_LINE ||
+                            primitive.mode == TINYGLTF_MODE_TRIANGLES;
+      if (isMerged && canMerge) {
+        const auto it = mergedGroups.emplace(key, groups.size()).first;
+        if (it->second == groups.size()) {
+          groups.push_back(std::move(group));
+        }
+        groups[it->second].primitives.emplace_back(&primitive, instance.second);
+      } else {
+        group.primitives.emplace_back(
+            &primitive, isMerged ? instance.second : glm::mat4(1));
+        groups.push_back(std::move(group));
+      }
+    }
+  }
+
+  std::vector<GroupGeometry> geometries(groups.size());
+  getJobSystem().parallelFor(
+      groups.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+        for (auto i = beginIdx; i < endIdx; ++i) {
+          geometries[i] =
+              buildGroupGeometry(model, buffers, groups[i], options);
+        }
+      });
+
+  out = tinygltf::Model();
+  out.asset = model.asset;
+  out.asset.generator = "gltf-optimize";
+  out.materials = model.materials;
+  for (auto &material : out.materials) {
+    // Legacy copies of the texture indices, not written
+    material.values.clear();
+    material.additionalValues.clear();
+  }
+  out.textures = model.textures;
+  out.images = model.images;
+  out.samplers = model.samplers;
+  out.cameras = model.cameras;
+  out.lights = model.lights;
+  out.extensionsUsed = model.extensionsUsed;
+  out.extensionsRequired = model.extensionsRequired;
+  for (const auto extension : DECODED_EXTENSIONS) {
+    removeExtension(out.extensionsUsed, extension);
+    removeExtension(out.extensionsRequired, extension);
+  }
+  out.buffers.resize(1);
+  out.defaultScene = 0;
+  out.scenes.resize(1);
+  auto &sceneNodes = out.scenes[0].nodes;
+
+  tinygltf::Mesh mergedMesh;
+  mergedMesh.name = "merged";
+  std::map<int, int> outMeshes; // Of instanced meshes
+  double missesBefore = 0.;
+  double missesAfter = 0.;
+  size_t triangleCount = 0;
+  for (size_t i = 0; i < groups.size(); ++i) {
+    const auto &group = groups[i];
+    const auto &geometry = geometries[i];
+    if (geometry.indices.empty()) {
+      continue;
+    }
+    if (geometry.acmrAfter > 0.f) {
+      const auto count = geometry.indices.size() / 3;
+      missesBefore += double(geometry.acmrBefore) * count;
+      missesAfter += double(geometry.acmrAfter) * count;
+      triangleCount += count;
+    }
+    auto primitive =
+        addPrimitive(out, group, geometry, options.quantizeAttributes);
+    if (group.instancedMesh < 0) {
+      mergedMesh.primitives.push_back(std::move(primitive));
+      continue;
+    }
+    const auto it =
+        outMeshes.emplace(group.instancedMesh, int(out.meshes.size())).first;
+    if (it->second == int(out.meshes.size())) {
+      out.meshes.emplace_back();
+      out.meshes.back().name = meshes[group.instancedMesh].name;
+    }
+    out.meshes[it->second].primitives.push_back(std::move(primitive));
+  }
+
+  const auto addNode = [&](tinygltf::Node node) {
+    sceneNodes.push_back(int(out.nodes.size()));
+    out.nodes.push_back(std::move(node));
+  };
+  const auto mergedPrimitiveCount = mergedMesh.primitives.size();
+  if (mergedPrimitiveCount) {
+    tinygltf::Node node;
+    node.name = mergedMesh.name;
+    node.mesh = int(out.meshes.size());
+    out.meshes.push_back(std::move(mergedMesh));
+    addNode(std::move(node));
+  }
+  size_t instanceCount = 0;
+  for (const auto &instance : nodes.meshInstances) {
+    const auto it = outMeshes.find(instance.first);
+    if (it == end(outMeshes)) {
+      continue;
+    }
+    tinygltf::Node node;
+    node.mesh = it->second;
+    if (instance.second != glm::mat4(1)) {
+      node.matrix.assign(&instance.second[0][0], &instance.second[0][0] + 16);
+    }
+    addNode(std::move(node));
+    ++instanceCount;
+  }
+  for (auto &node : nodes.otherNodes) {
+    addNode(std::move(node));
+  }
+
+  const auto usesQuantization = std::any_of(begin(out.accessors),
+      end(out.accessors), [](const tinygltf::Accessor &accessor) {
+        return accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT &&
+               accessor.type != TINYGLTF_TYPE_SCALAR;
+      });
+  if (usesQuantization) {
+    if (!hasExtension(out.extensionsUsed, QUANTIZATION_EXTENSION)) {
+      out.extensionsUsed.push_back(QUANTIZATION_EXTENSION);
+    }
+    if (!hasExtension(out.extensionsRequired, QUANTIZATION_EXTENSION)) {
+      out.extensionsRequired.push_back(QUANTIZATION_EXTENSION);
+    }
+  }
+
+  deduplicateResources(out);
+
+  size_t primitiveCount = 0;
+  for (const auto &mesh : model.meshes) {
+    primitiveCount += mesh.primitives.size();
+  }
+  std::clog << "Merged " << mergedAccessorCount << " duplicate accessors, "
+            << primitiveCount << " primitives in " << mergedPrimitiveCount
+            << " merged primitives and " << outMeshes.size()
+            << " meshes drawn by " << instanceCount << " instances"
+            << std::endl;
+  if (triangleCount) {
+    std::clog << "Average cache miss ratio " << missesBefore / triangleCount
+              << " -> " << missesAfter / triangleCount << std::endl;
+  }
+}
+
+DerivedGeometry buildOptimizedGeometry(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const OptimizerOptions &options)
+{
+  DerivedGeometry derived;
+  if (options.optimizeIndices) {
+    derived.optimizedIndices = optimizeModelIndices(model, buffers);
+  }
+  if (options.generateLods) {
+    derived.lods = buildModelLods(model, buffers);
+  }
+  if (options.meshlets) {
+    derived.meshlets =
+        buildModelMeshlets(model, buffers, derived.optimizedIndices);
+  }
+
+  // Levels index the reordered vertices, as in the viewer
+  auto &lods = derived.lods;
+  if (lods.size() == derived.optimizedIndices.size()) {
+    getJobSystem().parallelFor(
+        lods.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+          for (auto i = beginIdx; i < endIdx; ++i) {
+            const auto &vertexRemap = derived.optimizedIndices[i].vertexRemap;
+            if (vertexRemap.empty()) {
+              continue;
+            }
+            for (auto &lod : lods[i]) {
+              for (auto &index : lod.indices) {
+                index = vertexRemap[index];
+              }
+              optimizeVertexCache(
+                  lod.indices.data(), lod.indices.size(), vertexRemap.size());
+            }
+          }
+        });
+  }
+  return derived;
+}
+
+bool writeOptimizedGlb(
+    const fs::path &path, tinygltf::Model &model, std::string &err)
+{
+  if (model.buffers.empty()) {
+    model.buffers.resize(1);
+  }
+  for (auto &image : model.images) {
+    std::vector<unsigned char> bytes;
+    if (image.as_is) {
+      bytes = std::move(image.image);
+      image.mimeType = "image/ktx2";
+    } else if (image.bits == 8 || image.bits == 16) {
+      // PNG images are encoded in 8 bits, 16-bit components keep their most
+      // significant byte (little endian)
+      const auto pixelCount =
+          size_t(image.width) * size_t(image.height) * size_t(image.component);
+      if (image.bits == 16) {
+        for (size_t i = 0; i < pixelCount; ++i) {
+          image.image[i] = image.image[2 * i + 1];
+        }
+      }
+      bytes = encodePng(size_t(image.width), size_t(image.height),
+          size_t(image.component), image.image.data());
+      image.mimeType = "image/png";
+    } else {
+      err = "Unsupported " + std::to_string(image.bits) + "-bit image " +
+            image.name;
+      return false;
+    }
+    image.bufferView = addBufferView(model, bytes.data(), bytes.size());
+    image.uri.clear();
+    image.image = {};
+  }
+
+  tinygltf::TinyGLTF writer;
+  // Images are already stored in bufferViews
+  writer.SetImageWriter(
+      [](const std::string *, const std::string *, tinygltf::Image *, bool,
+          void *) { return true; },
+      nullptr);
+  if (!writer.WriteGltfSceneToFile(&model, path.string(), false, true, false,
+          true)) {
+    err = "Failed to write " + path.string();
+    return false;
+  }
+  return true;
+}
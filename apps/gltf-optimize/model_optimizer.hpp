@@ -0,0 +1,61 @@
+#pragma once
+
+#include "utils/filesystem.hpp"
+#include "utils/gltf.hpp"
+#include "utils/scene_cache.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Offline optimization of the default scene of a static glTF model, run once
+// by gltf-optimize instead of at each load by the viewer.
+//
+// The scene is rebuilt in a new model whose geometry is stored in a single
+// buffer:
+// - accessors with the same content are merged, then meshes with the same
+// primitives, so that copies of a mesh are found as instances,
+// - meshes used by a single node are flattened: their vertices are
+// transformed to world space and the primitives sharing a material, a mode
+// and a set of attributes are merged in one primitive, which cuts draw calls.
+// Meshes used by several nodes keep one node per instance,
+// - triangles are reordered for the vertex cache and overdraw, vertices in
+// the order of their first use (see index_optimizer.hpp),
+// - normals, tangents and texture coordinates can be quantized
+// (KHR_mesh_quantization),
+// - images, samplers, textures and materials are deduplicated and those the
+// scene does not use are dropped.
+// Levels of detail and meshlets are part of the scene cache only (see
+// buildOptimizedGeometry), glTF has no place for them, as are the
+// potentially visible sets baked by gltf-optimize --pvs (see pvs_baker.hpp).
+struct OptimizerOptions
+{
+  bool mergePrimitives = true; // Flatten meshes used by a single node
+  bool optimizeIndices = true;
+  bool quantizeAttributes = false;
+  bool generateLods = true; // Scene cache only
+  bool meshlets = true; // Scene cache only
+};
+
+// Return false if the default scene of model cannot be flattened: animated,
+// skinned and morphed models are not supported
+bool canOptimizeModel(const tinygltf::Model &model);
+
+// Rebuild the default scene of model, read through buffers, in out (see
+// above). Images keep their decoded pixels, as in models read by the viewer.
+void optimizeModel(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const OptimizerOptions &options,
+    tinygltf::Model &out);
+
+// Geometry the viewer derives from the primitives of an optimized model at
+// import (see ViewerApplication::buildDerivedGeometry), for writeSceneCache
+DerivedGeometry buildOptimizedGeometry(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const OptimizerOptions &options);
+
+// Write model, built by optimizeModel, as a .glb file: images are encoded in
+// PNG (KTX2 images are stored as they are) in its buffer. Return false and
+// fill err on failure.
+bool writeOptimizedGlb(
+    const fs::path &path, tinygltf::Model &model, std::string &err);
@@ -0,0 +1,399 @@
+#include "pvs_baker.hpp"
+
+#include "utils/gl_objects.hpp"
+#include "utils/scene_hierarchy.hpp"
+#include "utils/shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <string>
+
+namespace
+{
+
+// Vertex of pvs_sample.vs.glsl, in world space
+struct SampleVertex
+{
+  glm::vec3 position;
+  GLuint draw;
+};
+
+// Triangles of the draws of a scene, opaque single-sided ones first, then
+// opaque double-sided ones, then the others
+struct SceneTriangles
+{
+  std::vector<SampleVertex> vertices;
+  size_t singleSidedCount = 0; // Vertices
+  size_t opaqueCount = 0; // Same
+  std::vector<glm::vec3> drawMins;
+  std::vector<glm::vec3> drawMaxs;
+  // Draws that are not triangle lists, which are never culled
+  std::vector<uint8_t> isAlwaysVisible;
+};
+
+SceneTriangles buildSceneTriangles(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers)
+{
+  const SceneHierarchy hierarchy{model, buffers};
+  SceneTriangles triangles;
+  std::vector<SampleVertex> doubleSided, others;
+  std::vector<float> positions;
+  std::vector<uint32_t> indices;
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    const auto &worldMatrix = hierarchy.worldMatrix(flatIdx);
+    // Mirroring matrices flip the winding of the triangles
+    const auto isMirrored = glm::determinant(glm::mat3(worldMatrix)) < 0.f;
+    const auto &mesh = model.meshes[hierarchy.mesh(flatIdx)];
+    for (const auto &primitive : mesh.primitives) {
+      const auto draw = GLuint(triangles.drawMins.size());
+      triangles.drawMins.push_back(
+          glm::vec3(std::numeric_limits<float>::max()));
+      triangles.drawMaxs.push_back(
+          glm::vec3(std::numeric_limits<float>::lowest()));
+      triangles.isAlwaysVisible.push_back(1);
+      const auto position = primitive.attributes.find("POSITION");
+      if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+          position == end(primitive.attributes)) {
+        continue;
+      }
+      triangles.isAlwaysVisible.back() = 0;
+
+      const auto &positionAccessor = model.accessors[position->second];
+      positions.resize(positionAccessor.count * 3);
+      readAccessorAsFloats(
+          model, buffers, positionAccessor, 3, positions.data());
+      if (primitive.indices >= 0) {
+        const auto &indexAccessor = model.accessors[primitive.indices];
+        indices.resize(indexAccessor.count);
+        readAccessorAsUints(model, buffers, indexAccessor, indices.data());
+      } else {
+        indices.resize(positionAccessor.count);
+        std::iota(begin(indices), end(indices), 0);
+      }
+
+      auto isOpaque = true, isDoubleSided = false;
+      if (primitive.material >= 0) {
+        const auto &material = model.materials[primitive.material];
+        isOpaque = material.alphaMode == "OPAQUE";
+        isDoubleSided = material.doubleSided;
+      }
+      auto &out = !isOpaque       ? others
+                  : isDoubleSided ? doubleSided
+                                  : triangles.vertices;
+      for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        if (std::max({indices[i], indices[i + 1], indices[i + 2]}) >=
+            positionAccessor.count) {
+          continue;
+        }
+        for (size_t v = 0; v < 3; ++v) {
+          const auto index = indices[i + (isMirrored && v ? 3 - v : v)];
+          const auto local =
+              glm::make_vec3(positions.data() + 3 * size_t(index));
+          const auto p = glm::vec3(worldMatrix * glm::vec4(local, 1));
+          triangles.drawMins[draw] = glm::min(triangles.drawMins[draw], p);
+          triangles.drawMaxs[draw] = glm::max(triangles.drawMaxs[draw], p);
+          out.push_back({p, draw});
+        }
+      }
+    }
+  }
+  triangles.singleSidedCount = triangles.vertices.size();
+  triangles.vertices.insert(
+      end(triangles.vertices), begin(doubleSided), end(doubleSided));
+  triangles.opaqueCount = triangles.vertices.size();
+  triangles.vertices.insert(
+      end(triangles.vertices), begin(others), end(others));
+  return triangles;
+}
+
+// Flags of the cells crossed by opaque triangles, x first then y then z
+std::vector<uint8_t> voxelizeSolidCells(const SceneTriangles &triangles,
+    const PotentiallyVisibleSets::Grid &grid)
+{
+  const auto cellCount = size_t(grid.cellCounts.x) * grid.cellCounts.y *
+                         grid.cellCounts.z;
+  std::vector<uint8_t> isSolid(cellCount, 0);
+  const auto halfSize = glm::vec3(0.5f * grid.cellSize);
+  const auto maxCell = glm::ivec3(grid.cellCounts) - 1;
+  const auto getCell = [&](const glm::vec3 &p) {
+    const auto cell = glm::floor((p - grid.origin) / grid.cellSize);
+    return glm::clamp(glm::ivec3(cell), glm::ivec3(0), maxCell);
+  };
+  for (size_t i = 0; i + 2 < triangles.opaqueCount; i += 3) {
+    const auto &p0 = triangles.vertices[i].position;
+    const auto &p1 = triangles.vertices[i + 1].position;
+    const auto &p2 = triangles.vertices[i + 2].position;
+    const auto normal = glm::cross(p1 - p0, p2 - p0);
+    if (normal == glm::vec3(0)) {
+      continue;
+    }
+    const auto cellMin = getCell(glm::min(p0, glm::min(p1, p2)));
+    const auto cellMax = getCell(glm::max(p0, glm::max(p1, p2)));
+    for (auto z = cellMin.z; z <= cellMax.z; ++z) {
+      for (auto y = cellMin.y; y <= cellMax.y; ++y) {
+        for (auto x = cellMin.x; x <= cellMax.x; ++x) {
+          // The plane of the triangle crosses the cell if the distance of
+          // its center is within the projected radius of the cell
+          const auto center =
+              grid.origin + (glm::vec3(x, y, z) + 0.5f) * grid.cellSize;
+          const auto radius = glm::dot(halfSize, glm::abs(normal));
+          if (std::abs(glm::dot(normal, center - p0)) <= radius) {
+            isSolid[size_t(x) +
+                    grid.cellCounts.x *
+                        (size_t(y) + grid.cellCounts.y * size_t(z))] = 1;
+          }
+        }
+      }
+    }
+  }
+  return isSolid;
+}
+
+// Return true if the cell is empty or next to an empty cell
+bool isNavigable(const std::vector<uint8_t> &isSolid,
+    const PotentiallyVisibleSets::Grid &grid, const glm::ivec3 &cell)
+{
+  const auto counts = glm::ivec3(grid.cellCounts);
+  const auto isEmpty = [&](const glm::ivec3 &c) {
+    return glm::all(glm::greaterThanEqual(c, glm::ivec3(0))) &&
+           glm::all(glm::lessThan(c, counts)) &&
+           !isSolid[size_t(c.x) +
+                    size_t(counts.x) * (size_t(c.y) + size_t(counts.y) * c.z)];
+  };
+  if (isEmpty(cell)) {
+    return true;
+  }
+  for (glm::length_t axis = 0; axis < 3; ++axis) {
+    for (const auto step : {-1, 1}) {
+      auto neighbour = cell;
+      neighbour[axis] += step;
+      if (isEmpty(neighbour)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+bool bakePotentiallyVisibleSets(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const fs::path &shaderDirectory,
+    const PvsBakeOptions &options, PotentiallyVisibleSets &pvs,
+    std::string &err)
+{
+  const auto triangles = buildSceneTriangles(model, buffers);
+  const auto drawCount = triangles.drawMins.size();
+  if (options.cellSize <= 0.f) {
+    err = "The cells of the visible sets must have a positive size";
+    return false;
+  }
+  if (triangles.opaqueCount == 0) {
+    err = "The scene has no opaque triangles to bake visibility from";
+    return false;
+  }
+
+  // Grid of the bounds of the triangles, grown by a cell so that the walls
+  // at the boundary have empty cells on both sides
+  auto sceneMin = glm::vec3(std::numeric_limits<float>::max());
+  auto sceneMax = glm::vec3(std::numeric_limits<float>::lowest());
+  for (const auto &vertex : triangles.vertices) {
+    sceneMin = glm::min(sceneMin, vertex.position);
+    sceneMax = glm::max(sceneMax, vertex.position);
+  }
+  PotentiallyVisibleSets::Grid grid;
+  grid.cellSize = options.cellSize;
+  grid.origin = sceneMin - options.cellSize;
+  const auto extent =
+      glm::ceil((sceneMax - sceneMin) / options.cellSize) + 2.f;
+  if (double(extent.x) * extent.y * extent.z > double(options.maxCellCount)) {
+    err = "The grid of the visible sets would have more than " +
+          std::to_string(options.maxCellCount) +
+          " cells, use larger cells";
+    return false;
+  }
+  grid.cellCounts = glm::uvec3(extent);
+  const auto cellCount = size_t(grid.cellCounts.x) * grid.cellCounts.y *
+                         grid.cellCounts.z;
+  const auto isSolid = voxelizeSolidCells(triangles, grid);
+
+  GLProgram program;
+  try {
+    program = buildProgram({loadShader(shaderDirectory / "pvs_sample.vs.glsl"),
+        loadShader(shaderDirectory / "pvs_sample.fs.glsl")});
+  } catch (const std::exception &e) {
+    err = e.what();
+    return false;
+  }
+  const auto faceSize = GLsizei(options.faceSize);
+  // The 6 faces side by side, all sampled before the next point
+  GLRenderbuffer depthBuffer(GL_DEPTH_COMPONENT32F, 6 * faceSize, faceSize);
+  auto framebuffer = GLFramebuffer::create();
+  framebuffer.attachRenderbuffer(GL_DEPTH_ATTACHMENT, depthBuffer.glId());
+  framebuffer.setDrawBuffer(GL_NONE);
+  if (framebuffer.status() != GL_FRAMEBUFFER_COMPLETE) {
+    err = "Incomplete visibility sampling framebuffer";
+    return false;
+  }
+
+  GLBuffer vertexBuffer(triangles.vertices.size() * sizeof(SampleVertex),
+      triangles.vertices.data(), 0);
+  auto vertexArray = GLVertexArray::create();
+  vertexArray.bind();
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer.glId());
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SampleVertex),
+      (const GLvoid *)offsetof(SampleVertex, position));
+  glEnableVertexAttribArray(1);
+  glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(SampleVertex),
+      (const GLvoid *)offsetof(SampleVertex, draw));
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  // One flag per draw, cleared for each cell
+  GLBuffer visibleBuffer(drawCount * sizeof(GLuint), nullptr, 0);
+  std::vector<GLuint> visibleDraws(drawCount);
+
+  // Cube faces looking along +X, -X, +Y, -Y, +Z and -Z
+  const std::array<std::pair<glm::vec3, glm::vec3>, 6> faces = {{
+      {{1, 0, 0}, {0, -1, 0}},
+      {{-1, 0, 0}, {0, -1, 0}},
+      {{0, 1, 0}, {0, 0, 1}},
+      {{0, -1, 0}, {0, 0, -1}},
+      {{0, 0, 1}, {0, -1, 0}},
+      {{0, 0, -1}, {0, -1, 0}},
+  }};
+  const auto nearDistance = 0.05f * options.cellSize;
+  const auto farDistance =
+      2.f * glm::length(glm::vec3(grid.cellCounts)) * options.cellSize;
+  const auto projMatrix = glm::perspective(
+      glm::half_pi<float>(), 1.f, nearDistance, farDistance);
+
+  program.use();
+  const auto viewProjUniform =
+      program.getUniform<glm::mat4>("uViewProjMatrix");
+  const auto flagsUniform = program.getUniform<GLint>("uFlagsDraws");
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer.glId());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, visibleBuffer.glId());
+  glEnable(GL_DEPTH_TEST);
+  glFrontFace(GL_CCW);
+  glCullFace(GL_BACK);
+
+  const auto drawFaces = [&](const glm::vec3 &eye, GLint first,
+                             size_t count) {
+    for (size_t face = 0; face < faces.size(); ++face) {
+      glViewport(GLint(face) * faceSize, 0, faceSize, faceSize);
+      viewProjUniform.set(projMatrix *
+                          glm::lookAt(eye, eye + faces[face].first,
+                              faces[face].second));
+      glDrawArrays(GL_TRIANGLES, first, GLsizei(count));
+    }
+  };
+
+  std::vector<PotentiallyVisibleSets::CellSet> cellSets(cellCount);
+  std::vector<uint8_t> data;
+  // Cells with the same set share it. Sets are keyed by strings of their
+  // bytes: the three-way comparison of vectors of bytes makes GCC warn of a
+  // memcmp overread (-Wstringop-overread) in C++20.
+  std::map<std::string, PotentiallyVisibleSets::CellSet> sets;
+  std::vector<uint8_t> isVisible(drawCount);
+  size_t bakedCount = 0, nextProgress = cellCount / 10;
+  for (size_t cellIdx = 0; cellIdx < cellCount; ++cellIdx) {
+    if (cellIdx >= nextProgress) {
+      std::clog << "Baking visibility: " << 100 * cellIdx / cellCount
+                << "% of the cells" << std::endl;
+      nextProgress += std::max<size_t>(cellCount / 10, 1);
+    }
+    const auto cell = glm::ivec3(cellIdx % grid.cellCounts.x,
+        cellIdx / grid.cellCounts.x % grid.cellCounts.y,
+        cellIdx / (size_t(grid.cellCounts.x) * grid.cellCounts.y));
+    if (!isNavigable(isSolid, grid, cell)) {
+      continue;
+    }
+    const auto cellMin = grid.origin + glm::vec3(cell) * options.cellSize;
+    const auto center = cellMin + 0.5f * options.cellSize;
+
+    const GLuint zero = 0;
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+        GL_UNSIGNED_INT, &zero);
+    for (size_t sample = 0; sample < 9; ++sample) {
+      // The center, then the corners pulled inward by a tenth of the cell
+      auto eye = center;
+      if (sample) {
+        const auto corner = glm::vec3((sample - 1) & 1, (sample - 1) >> 1 & 1,
+                                (sample - 1) >> 2 & 1) *
+                                2.f -
+                            1.f;
+        eye += 0.4f * options.cellSize * corner;
+      }
+      glDepthMask(GL_TRUE);
+      glDepthFunc(GL_LESS);
+      glClear(GL_DEPTH_BUFFER_BIT);
+      flagsUniform.set(0);
+      glEnable(GL_CULL_FACE);
+      drawFaces(eye, 0, triangles.singleSidedCount);
+      glDisable(GL_CULL_FACE);
+      drawFaces(eye, GLint(triangles.singleSidedCount),
+          triangles.opaqueCount - triangles.singleSidedCount);
+      // Back faces are flagged too, which only keeps more draws
+      glDepthMask(GL_FALSE);
+      glDepthFunc(GL_LEQUAL);
+      flagsUniform.set(1);
+      drawFaces(eye, 0, triangles.vertices.size());
+    }
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+        visibleDraws.size() * sizeof(GLuint), visibleDraws.data());
+
+    // Draws near the cell can be nearer than the near plane
+    const auto grownMin = cellMin - 0.5f * options.cellSize;
+    const auto grownMax = cellMin + 1.5f * options.cellSize;
+    for (size_t drawIdx = 0; drawIdx < drawCount; ++drawIdx) {
+      const auto &drawMin = triangles.drawMins[drawIdx];
+      const auto &drawMax = triangles.drawMaxs[drawIdx];
+      isVisible[drawIdx] =
+          visibleDraws[drawIdx] || triangles.isAlwaysVisible[drawIdx] ||
+          (glm::all(glm::lessThanEqual(drawMin, grownMax)) &&
+              glm::all(glm::greaterThanEqual(drawMax, grownMin)));
+    }
+    const auto encoded = PotentiallyVisibleSets::encodeSet(isVisible);
+    auto key = std::string(begin(encoded), end(encoded));
+    auto it = sets.find(key);
+    if (it == end(sets)) {
+      if (data.size() + encoded.size() >
+          std::numeric_limits<uint32_t>::max()) {
+        err = "The visible sets do not fit in 4 GB, use larger cells";
+        return false;
+      }
+      const PotentiallyVisibleSets::CellSet set{
+          uint32_t(data.size()), uint32_t(encoded.size())};
+      data.insert(end(data), begin(encoded), end(encoded));
+      it = sets.emplace(std::move(key), set).first;
+    }
+    cellSets[cellIdx] = it->second;
+    ++bakedCount;
+  }
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBindVertexArray(0);
+  glDepthMask(GL_TRUE);
+  glDepthFunc(GL_LESS);
+
+  std::clog << "Baked the visible sets of " << bakedCount << " of "
+            << cellCount << " cells (" << sets.size() << " distinct sets, "
+            << data.size() << " bytes)" << std::endl;
+  pvs = PotentiallyVisibleSets(
+      grid, drawCount, std::move(cellSets), std::move(data));
+  return true;
+}
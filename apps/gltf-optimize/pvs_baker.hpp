@@ -0,0 +1,46 @@
+#pragma once
+
+#include "utils/filesystem.hpp"
+#include "utils/gltf.hpp"
+#include "utils/pvs.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Offline bake of the potentially visible sets of the default scene of a
+// static model (see PotentiallyVisibleSets), for walkthroughs of interiors
+// where walls hide most of the scene:
+// - the scene bounds are split in cubic cells, and the cells crossed by
+// opaque triangles are voxelized as solid (by the overlap of the cell with
+// the plane and the bounds of each triangle, which keeps a few more),
+// - the navigable cells are the empty ones and the solid ones next to them,
+// whose space in front of the walls can hold the camera. Cells buried in
+// geometry get no set: every draw stays potentially visible there,
+// - the visibility of each navigable cell is sampled on the GPU from its
+// center and its corners pulled inward, rendering the 6 faces of a cube:
+// the depth of opaque triangles first, then every triangle whose fragments
+// pass the depth test flags its draw. Back faces of single-sided triangles
+// and blended or masked triangles do not occlude, and draws whose bounds
+// overlap the cell grown by half a cell are always kept (they can be nearer
+// than the near plane).
+// Sets are conservative up to the sampling: a draw only seen through a gap
+// smaller than a pixel of the faces, or from between the samples, can be
+// missed.
+struct PvsBakeOptions
+{
+  float cellSize = 1.f; // In scene units
+  size_t faceSize = 128; // Pixels of the side of the cube faces
+  size_t maxCellCount = size_t(1) << 20;
+};
+
+// Bake the sets of the draws of model, in the order of the viewer (the
+// primitives of each node of SceneHierarchy::meshNodes()). shaderDirectory
+// contains pvs_sample.*.glsl. An OpenGL 4.4 context must be current. Return
+// false and set err on failure.
+bool bakePotentiallyVisibleSets(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const fs::path &shaderDirectory,
+    const PvsBakeOptions &options, PotentiallyVisibleSets &pvs,
+    std::string &err);
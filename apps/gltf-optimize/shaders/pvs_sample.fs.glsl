@@ -0,0 +1,24 @@
+#version 430
+
+// Visibility sampling of bakePotentiallyVisibleSets (see pvs_baker.hpp). The
+// first pass only writes the depth of the occluders, the second one draws
+// every triangle with GL_LEQUAL and flags the draws of the fragments that
+// pass the depth test, which early fragment tests guarantee to run first.
+
+layout(early_fragment_tests) in;
+
+layout(std430, binding = 0) buffer VisibleDraws
+{
+    uint uVisibleDraws[];
+};
+
+uniform bool uFlagsDraws;
+
+flat in uint vDraw;
+
+void main()
+{
+    if (uFlagsDraws) {
+        uVisibleDraws[vDraw] = 1u;
+    }
+}
@@ -0,0 +1,21 @@
+#version 430
+
+// Visibility sampling of bakePotentiallyVisibleSets (see pvs_baker.hpp):
+// world space triangles of every draw, tagged with the index of their draw.
+// Both passes use this shader, so that the second one finds the depths of
+// the first.
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in uint aDraw;
+
+uniform mat4 uViewProjMatrix;
+
+flat out uint vDraw;
+
+invariant gl_Position;
+
+void main()
+{
+    vDraw = aDraw;
+    gl_Position = uViewProjMatrix * vec4(aPosition, 1);
+}
@@ -0,0 +1,216 @@
+#include "vat_baker.hpp"
+
+#include "utils/animation.hpp"
+#include "utils/scene_hierarchy.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace
+{
+
+// Skinned primitive of a mesh, in the bind pose
+struct SkinnedPrimitive
+{
+  uint32_t mesh;
+  uint32_t primitive; // In the mesh
+  uint32_t flatIdx; // Node posing the mesh
+  int skin;
+  std::vector<float> positions;
+  std::vector<float> normals;
+  std::vector<float> joints; // 4 per vertex, read exactly as floats
+  std::vector<float> weights;
+};
+
+std::vector<SkinnedPrimitive> findSkinnedPrimitives(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers,
+    const SceneHierarchy &hierarchy)
+{
+  std::vector<SkinnedPrimitive> skinned;
+  std::vector<bool> isMeshPosed(model.meshes.size(), false);
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    const auto meshIdx = hierarchy.mesh(flatIdx);
+    const auto skin = model.nodes[hierarchy.node(flatIdx)].skin;
+    if (skin < 0 || size_t(skin) >= model.skins.size() ||
+        isMeshPosed[meshIdx]) {
+      continue;
+    }
+    isMeshPosed[meshIdx] = true;
+    const auto &mesh = model.meshes[meshIdx];
+    for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+      const auto &attributes = mesh.primitives[pIdx].attributes;
+      const auto position = attributes.find("POSITION");
+      const auto joints = attributes.find("JOINTS_0");
+      const auto weights = attributes.find("WEIGHTS_0");
+      if (position == end(attributes) || joints == end(attributes) ||
+          weights == end(attributes)) {
+        continue;
+      }
+      const auto &positionAccessor = model.accessors[position->second];
+      const auto vertexCount = positionAccessor.count;
+      if (model.accessors[joints->second].count != vertexCount ||
+          model.accessors[weights->second].count != vertexCount) {
+        continue;
+      }
+      SkinnedPrimitive primitive{uint32_t(meshIdx), uint32_t(pIdx), flatIdx,
+          skin, std::vector<float>(3 * vertexCount),
+          std::vector<float>(3 * vertexCount, 0.f),
+          std::vector<float>(4 * vertexCount),
+          std::vector<float>(4 * vertexCount)};
+      readAccessorAsFloats(model, buffers, positionAccessor, 3,
+          primitive.positions.data());
+      const auto normal = attributes.find("NORMAL");
+      if (normal != end(attributes) &&
+          model.accessors[normal->second].count == vertexCount) {
+        readAccessorAsFloats(model, buffers,
+            model.accessors[normal->second], 3, primitive.normals.data());
+      }
+      readAccessorAsFloats(model, buffers, model.accessors[joints->second], 4,
+          primitive.joints.data());
+      readAccessorAsFloats(model, buffers, model.accessors[weights->second],
+          4, primitive.weights.data());
+      skinned.push_back(std::move(primitive));
+    }
+  }
+  return skinned;
+}
+
+// Inverse bind matrices and flat joints of each skin, as SceneSkins
+struct Skin
+{
+  std::vector<int> joints;
+  std::vector<glm::mat4> inverseBindMatrices;
+};
+
+std::vector<Skin> readSkins(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const SceneHierarchy &hierarchy)
+{
+  std::vector<Skin> skins;
+  for (const auto &gltfSkin : model.skins) {
+    Skin skin;
+    skin.inverseBindMatrices.assign(gltfSkin.joints.size(), glm::mat4(1));
+    if (gltfSkin.inverseBindMatrices >= 0 && !gltfSkin.joints.empty()) {
+      const auto &accessor = model.accessors[gltfSkin.inverseBindMatrices];
+      if (accessor.count == gltfSkin.joints.size()) {
+        readAccessorAsFloats(model, buffers, accessor, 16,
+            &skin.inverseBindMatrices.front()[0][0]);
+      }
+    }
+    for (const auto joint : gltfSkin.joints) {
+      skin.joints.push_back(hierarchy.findNode(joint));
+    }
+    skins.push_back(std::move(skin));
+  }
+  return skins;
+}
+
+} // namespace
+
+bool bakeVertexAnimations(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const VatBakeOptions &options,
+    VertexAnimations &animations, std::string &err)
+{
+  const SceneHierarchy bindPose{model, buffers};
+  const auto skinned = findSkinnedPrimitives(model, buffers, bindPose);
+  if (skinned.empty()) {
+    err = "the default scene has no skinned mesh";
+    return false;
+  }
+  const auto skins = readSkins(model, buffers, bindPose);
+  if (model.animations.empty()) {
+    err = "the model has no animation";
+    return false;
+  }
+
+  animations = VertexAnimations();
+  std::vector<std::vector<float>> positions(skinned.size());
+  std::vector<std::vector<float>> normals(skinned.size());
+  std::vector<glm::mat4> palette;
+  MorphWeights weights;
+  SceneAnimations sceneAnimations{model, buffers, bindPose};
+  for (size_t animationIdx = 0; animationIdx < model.animations.size();
+       ++animationIdx) {
+    // Each animation starts from the bind pose
+    auto hierarchy = bindPose;
+    const auto duration = sceneAnimations.duration(animationIdx);
+    const auto frameCount = std::clamp(
+        size_t(std::ceil(double(duration) * options.frameRate)), size_t(1),
+        std::max(options.maxFrameCount, size_t(1)));
+    for (size_t i = 0; i < skinned.size(); ++i) {
+      positions[i].resize(frameCount * skinned[i].positions.size());
+      normals[i].resize(frameCount * skinned[i].normals.size());
+    }
+
+    for (size_t frame = 0; frame < frameCount; ++frame) {
+      // The last frame blends into the first one, the animation loops
+      sceneAnimations.apply(animationIdx,
+          double(duration) * double(frame) / double(frameCount), hierarchy,
+          weights);
+      hierarchy.update();
+      for (size_t i = 0; i < skinned.size(); ++i) {
+        const auto &primitive = skinned[i];
+        const auto &skin = skins[primitive.skin];
+        // Joint matrices in the space of the posing node, whose matrix
+        // places the instances
+        const auto toNode =
+            glm::inverse(hierarchy.worldMatrix(primitive.flatIdx));
+        palette.resize(skin.joints.size());
+        for (size_t j = 0; j < skin.joints.size(); ++j) {
+          palette[j] = skin.joints[j] >= 0
+                           ? toNode * hierarchy.worldMatrix(skin.joints[j]) *
+                                 skin.inverseBindMatrices[j]
+                           : toNode; // Outside of the scene, as SceneSkins
+        }
+
+        const auto vertexCount = primitive.positions.size() / 3;
+        auto *outPositions =
+            positions[i].data() + frame * primitive.positions.size();
+        auto *outNormals = normals[i].data() + frame * primitive.normals.size();
+        for (size_t v = 0; v < vertexCount; ++v) {
+          // Vertices with null weights are not skinned, as in skinning.glsl
+          auto skinMatrix = glm::mat4(0);
+          auto weightSum = 0.f;
+          for (size_t c = 0; c < 4; ++c) {
+            const auto weight = primitive.weights[4 * v + c];
+            const auto joint = size_t(primitive.joints[4 * v + c]);
+            if (weight != 0.f && joint < palette.size()) {
+              skinMatrix += weight * palette[joint];
+              weightSum += weight;
+            }
+          }
+          if (weightSum <= 0.f) {
+            skinMatrix = glm::mat4(1);
+          }
+          const auto p = skinMatrix *
+                         glm::vec4(primitive.positions[3 * v],
+                             primitive.positions[3 * v + 1],
+                             primitive.positions[3 * v + 2], 1.f);
+          const auto n = glm::mat3(skinMatrix) *
+                         glm::vec3(primitive.normals[3 * v],
+                             primitive.normals[3 * v + 1],
+                             primitive.normals[3 * v + 2]);
+          const auto length = glm::length(n);
+          for (glm::length_t c = 0; c < 3; ++c) {
+            outPositions[3 * v + c] = p[c];
+            outNormals[3 * v + c] = length > 0.f ? n[c] / length : 0.f;
+          }
+        }
+      }
+    }
+
+    for (size_t i = 0; i < skinned.size(); ++i) {
+      VertexAnimations::Clip clip;
+      clip.mesh = skinned[i].mesh;
+      clip.primitive = skinned[i].primitive;
+      clip.animation = uint32_t(animationIdx);
+      clip.vertexCount = uint32_t(skinned[i].positions.size() / 3);
+      clip.frameCount = uint32_t(frameCount);
+      clip.duration = duration;
+      animations.addClip(clip, positions[i], normals[i]);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "utils/gltf.hpp"
+#include "utils/vertex_animations.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Offline bake of the animations of the skinned meshes of the default scene
+// of a model into vertex animations (see VertexAnimations), played by the
+// instances of the viewer with --vertex-animations:
+// - each mesh is posed by the first node of the scene skinning it, its
+// clips are in the space of that node,
+// - for each animation, the scene is posed at frameRate frames per second
+// over the duration of the animation (at most maxFrameCount frames), and
+// the vertices of the primitives with joints and weights are skinned on the
+// CPU as skinning.glsl does. Morph targets are ignored.
+struct VatBakeOptions
+{
+  float frameRate = 30.f;
+  size_t maxFrameCount = 1024;
+};
+
+// Bake the clips of every animation of the skinned meshes of model. Return
+// false and set err if it has none.
+bool bakeVertexAnimations(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const VatBakeOptions &options,
+    VertexAnimations &animations, std::string &err);
@@ -0,0 +1,88 @@
+#include "GltfRenderer.hpp"
+#include "ViewerApplication.hpp"
+#include "utils/images.hpp"
+
+namespace
+{
+
+ViewerOptions getViewerOptions(const GltfRenderer::Options &options)
+{
+  ViewerOptions viewerOptions;
+  viewerOptions.headless = true;
+  viewerOptions.gpuDevice = options.gpuDevice;
+  viewerOptions.modelCacheSize = options.modelCacheSize;
+  viewerOptions.outputSamples = options.samples;
+  return viewerOptions;
+}
+
+} // namespace
+
+struct GltfRenderer::Impl
+{
+  explicit Impl(const Options &options) :
+      // Shaders are found next to the application path
+      application{fs::path{options.resourceDirectory} / "gltf-viewer", 1, 1,
+          {}, {}, options.vertexShader, options.fragmentShader, {},
+          getViewerOptions(options)}
+  {
+  }
+
+  ViewerApplication application;
+  std::vector<float> lookat; // Default camera if empty
+  Stats stats;
+};
+
+GltfRenderer::GltfRenderer() : GltfRenderer(Options{}) {}
+
+GltfRenderer::GltfRenderer(const Options &options) :
+    m_pImpl(std::make_unique<Impl>(options))
+{
+}
+
+GltfRenderer::~GltfRenderer() = default;
+
+bool GltfRenderer::load(const std::string &path, std::string &err)
+{
+  m_pImpl->lookat.clear();
+  return m_pImpl->application.loadRenderedModel(
+      path, m_pImpl->stats.loadTime, err);
+}
+
+void GltfRenderer::setCamera(const std::array<float, 3> &eye,
+    const std::array<float, 3> &center, const std::array<float, 3> &up)
+{
+  m_pImpl->lookat = {eye[0], eye[1], eye[2], center[0], center[1], center[2],
+      up[0], up[1], up[2]};
+}
+
+void GltfRenderer::resetCamera() { m_pImpl->lookat.clear(); }
+
+bool GltfRenderer::render(size_t width, size_t height, size_t numComponents,
+    unsigned char *pixels, std::string &err)
+{
+  auto &stats = m_pImpl->stats;
+  if (!m_pImpl->application.renderModelImage(m_pImpl->lookat, width, height,
+          numComponents, pixels, stats.gpuTime, stats.drawCount, err)) {
+    return false;
+  }
+  // Read bottom row first
+  flipImageYAxis(width, height, numComponents, pixels);
+  return true;
+}
+
+bool GltfRenderer::render(size_t width, size_t height, size_t numComponents,
+    std::vector<unsigned char> &pixels, std::string &err)
+{
+  pixels.resize(width * height * numComponents);
+  return render(width, height, numComponents, pixels.data(), err);
+}
+
+GltfRenderer::Stats GltfRenderer::stats() const
+{
+  auto stats = m_pImpl->stats;
+  const auto modelStats = m_pImpl->application.getRenderedModelStats();
+  stats.modelCount = modelStats.modelCount;
+  stats.gpuBytes = modelStats.gpuBytes;
+  stats.hostBytes = modelStats.hostBytes;
+  return stats;
+}
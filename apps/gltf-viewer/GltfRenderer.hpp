@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Offline renderer of glTF models, the batch and server rendering of
+// gltf-viewer as a library (gltf-render target) for services rendering in
+// process: the GL context, the programs and the models loaded last are kept
+// from one image to the next, without a process per request.
+//
+// This header is the stable API of the library: it only uses standard types
+// and hides the renderer behind a pointer, so that the viewer code can
+// change without breaking its users. A renderer owns a headless GL context
+// (see HeadlessGLContext) current on the thread that created it, which must
+// make every call. Images are drawn as `gltf-viewer batch` draws them.
+class GltfRenderer
+{
+public:
+  struct Options
+  {
+    // Directory containing shaders/gltf-viewer, i.e. the install directory
+    // of gltf-viewer
+    std::string resourceDirectory = ".";
+    // Shaders of shaders/gltf-viewer, those of gltf-viewer if empty
+    std::string vertexShader;
+    std::string fragmentShader;
+    // EGL GPU device (see `gltf-viewer batch --device`), any if negative
+    int gpuDevice = -1;
+    // Models kept loaded, 0 for no limit
+    size_t modelCacheSize = 4;
+    // Samples per pixel, 0 for the default anti-aliasing of gltf-viewer
+    size_t samples = 0;
+  };
+
+  // Measures of the last calls, times in milliseconds
+  struct Stats
+  {
+    double loadTime = 0.; // Of the last load(), 0 if the model was cached
+    double gpuTime = 0.; // Of the last render()
+    size_t drawCount = 0; // Of the last render()
+    // Models kept loaded and their memory
+    size_t modelCount = 0;
+    size_t gpuBytes = 0;
+    size_t hostBytes = 0;
+  };
+
+  // Create the GL context, the shaders are compiled by the first load().
+  // Throw std::runtime_error if there is no GL 4.4 context.
+  GltfRenderer();
+  explicit GltfRenderer(const Options &options);
+
+  ~GltfRenderer();
+
+  GltfRenderer(const GltfRenderer &) = delete;
+  GltfRenderer &operator=(const GltfRenderer &) = delete;
+
+  // Make the glTF file of path the rendered model, loading it unless it is
+  // kept loaded and unmodified. Resets the camera to the default one of the
+  // model. Return false and set err on failure.
+  bool load(const std::string &path, std::string &err);
+
+  // Camera of the next images, looking from eye at center
+  void setCamera(const std::array<float, 3> &eye,
+      const std::array<float, 3> &center, const std::array<float, 3> &up);
+
+  // Frame the whole model, as gltf-viewer does by default
+  void resetCamera();
+
+  // Render the model in width x height pixels of numComponents (3 for RGB,
+  // 4 for RGBA) 8-bit components, top row first. pixels must hold width *
+  // height * numComponents bytes. Return false and set err on failure.
+  bool render(size_t width, size_t height, size_t numComponents,
+      unsigned char *pixels, std::string &err);
+
+  // Same as render(), in a vector resized to the image
+  bool render(size_t width, size_t height, size_t numComponents,
+      std::vector<unsigned char> &pixels, std::string &err);
+
+  Stats stats() const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_pImpl;
+};
@@ -1,154 +1,7084 @@
 #include "ViewerApplication.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <list>
+#include <map>
+#include <memory>
 #include <numeric>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/io.hpp>
 
-#include "utils/cameras.hpp"
+#include "utils/camera_prediction.hpp"
+#include "utils/cameras.hpp"
+#include "utils/exr.hpp"
+#include "utils/file_watcher.hpp"
+#include "utils/frustum.hpp"
+#include "utils/gl_extensions.hpp"
+#include "utils/gltf.hpp"
+#include "utils/images.hpp"
+#include "utils/import_pass.hpp"
+#include "utils/job_system.hpp"
+#include "utils/mesh_compression.hpp"
+#include "utils/png.hpp"
+#include "utils/remote_file.hpp"
+#include "utils/render_server.hpp"
+#include "utils/tcp_socket.hpp"
+#include "utils/scene_cache.hpp"
+#include "utils/scene_hierarchy.hpp"
+#include "utils/shared_cache.hpp"
+#include "utils/shared_context.hpp"
+#include "utils/sync_watchdog.hpp"
+#include "utils/texture_compression.hpp"
+#include "utils/transform_kernels.hpp"
+
+#include <tiny_gltf.h>
+
+namespace
+{
+
+// Layout of the DrawUniforms block of forward.vs.glsl
+struct DrawUniforms
+{
+  glm::mat4 modelMatrix; // Relative to the eye of CameraUniforms
+  glm::mat4 normalMatrix;
+  glm::mat4 previousModelMatrix; // Of the previous frame
+};
+
+// Layout of the CameraUniforms block of camera.glsl
+struct CameraUniforms
+{
+  glm::mat4 viewMatrix;
+  glm::mat4 projMatrix;
+  glm::mat4 viewProjMatrix;
+  glm::mat4 inverseViewMatrix;
+  glm::mat4 inverseProjMatrix;
+  glm::mat4 previousViewProjMatrix; // Of the previous frame
+  glm::mat4 eyeViewMatrix;
+  glm::mat4 eyeViewProjMatrix;
+  glm::vec4 eye;
+  glm::vec4 jitter;
+};
+
+// Uniforms of a view whose view matrix is a rotation about eye (as
+// Camera::getViewMatrix), draws being given relative to eye. Passes drawing
+// absolute world matrices give an identity view matrix, a zero eye and
+// their view projection matrix as projMatrix.
+CameraUniforms getCameraUniforms(const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, const glm::mat4 &previousViewProjMatrix,
+    const glm::vec3 &eye)
+{
+  CameraUniforms uniforms;
+  uniforms.viewMatrix = viewMatrix;
+  uniforms.projMatrix = projMatrix;
+  uniforms.viewProjMatrix = projMatrix * viewMatrix;
+  uniforms.inverseViewMatrix = glm::inverse(viewMatrix);
+  uniforms.inverseProjMatrix = glm::inverse(projMatrix);
+  uniforms.previousViewProjMatrix = previousViewProjMatrix;
+  uniforms.eyeViewMatrix = glm::mat4(glm::mat3(viewMatrix));
+  uniforms.eyeViewProjMatrix = projMatrix * uniforms.eyeViewMatrix;
+  uniforms.eye = glm::vec4(eye, 1);
+  // See getJitteredProjection: the offset is scaled by w, proportional to z
+  // with perspective projections
+  const auto jitter = projMatrix[2][3] != 0.f
+                          ? glm::vec2(projMatrix[2]) / projMatrix[2][3]
+                          : glm::vec2(projMatrix[3]);
+  uniforms.jitter = glm::vec4(jitter, 0, 0);
+  return uniforms;
+}
+
+const GLuint DRAW_UNIFORMS_BINDING = 0;
+const GLuint CAMERA_UNIFORMS_BINDING = 1;
+
+// Vertical field of view given to glm::perspective. It has always been given
+// in degrees while glm expects radians, it is kept for images to stay the
+// same.
+const float FIELD_OF_VIEW = 70.f;
+
+// True if the material of index materialIdx of model is blended
+bool isTransparentMaterial(const CompactModel &model, int materialIdx)
+{
+  return model.alphaMode(materialIdx) == AlphaMode::Blend;
+}
+
+// Texture arrays of MaterialBuffer are bound to the first units
+void bindMaterialTextureArrays(const GLProgram &program)
+{
+  GLint units[MaterialBuffer::MAX_TEXTURE_ARRAYS];
+  for (size_t i = 0; i < MaterialBuffer::MAX_TEXTURE_ARRAYS; ++i) {
+    units[i] = GLint(i);
+  }
+  const auto location = program.getUniformLocation("uTextureArrays");
+  if (location >= 0) {
+    glProgramUniform1iv(program.glId(), location,
+        GLsizei(MaterialBuffer::MAX_TEXTURE_ARRAYS), units);
+  }
+  // Page caches of VirtualTextures, with VIRTUAL_TEXTURES
+  const auto cacheLocation = program.getUniformLocation("uPageCaches");
+  if (cacheLocation >= 0) {
+    glProgramUniform1iv(program.glId(), cacheLocation,
+        GLsizei(VirtualTextures::MAX_PAGE_CACHES), units);
+  }
+}
+
+// Every scene program shares the lights, their clusters, shadows, environment
+// and ambient occlusion. Return true if program reads the clusters.
+bool bindLights(const GLProgram &program)
+{
+  program.bindUniformBlock("ShadowUniforms",
+      CascadedShadowMaps::UNIFORMS_BINDING,
+      sizeof(CascadedShadowMaps::Uniforms));
+  program.bindUniformBlock("EnvironmentUniforms",
+      EnvironmentLighting::UNIFORMS_BINDING,
+      sizeof(EnvironmentLighting::Uniforms));
+  program.bindUniformBlock("AmbientOcclusionUniforms",
+      AmbientOcclusion::UNIFORMS_BINDING, sizeof(AmbientOcclusion::Uniforms));
+  return program.bindUniformBlock("ClusterUniforms",
+      LightClusters::UNIFORMS_BINDING, sizeof(LightClusters::Uniforms));
+}
+
+// Programs drawing transparent fragments in TransparencyBuffer
+bool bindTransparency(const GLProgram &program)
+{
+  return program.bindUniformBlock("TransparencyUniforms",
+      TransparencyBuffer::UNIFORMS_BINDING,
+      sizeof(TransparencyBuffer::Uniforms));
+}
+
+// Programs drawing nodes one by one, with the per draw matrices of
+// DrawUniforms and the view of CameraUniforms. Return false if program lacks
+// one of these blocks.
+bool bindDrawUniforms(const GLProgram &program)
+{
+  const auto hasDrawUniforms = program.bindUniformBlock(
+      "DrawUniforms", DRAW_UNIFORMS_BINDING, sizeof(DrawUniforms));
+  return program.bindUniformBlock("CameraUniforms", CAMERA_UNIFORMS_BINDING,
+             sizeof(CameraUniforms)) &&
+         hasDrawUniforms;
+}
+
+// renderScene keys programs in RenderQueue::PROGRAM_BITS bits: forward,
+// skinned, then the material permutations
+const size_t MAX_MATERIAL_PERMUTATIONS =
+    (size_t(1) << RenderQueue::PROGRAM_BITS) - 2;
+
+// Nodes queued by each job of renderScene, at least
+const size_t MIN_QUEUED_NODES_PER_JOB = 1024;
+
+// Near and far planes and camera speed of scenes without bounds
+const float DEFAULT_NEAR = 0.5f;
+const float DEFAULT_FAR = 750.f;
+const float DEFAULT_CAMERA_SPEED = 250.f;
+
+// Bytes uploaded at once by uploadMeshes through the staging ring, which
+// holds RingBuffer::FRAME_COUNT chunks in flight
+const size_t STAGING_CHUNK_SIZE = size_t(16) << 20;
+
+// Smallest glTF buffer pinned with ViewerOptions::pinnedUploads, smaller
+// ones are not worth the pinning
+const size_t MIN_PINNED_BUFFER_SIZE = size_t(1) << 20;
+
+// Fragment shaders of the debug views the GUI switches to, also usable with
+// --fs
+struct DebugView
+{
+  const char *name;
+  const char *fragmentShader;
+  // Drawn after debug_triangles.gs.glsl, which gives the area of triangles
+  bool measuresTriangles;
+  // The main pass adds up its fragments, without depth test
+  bool isAdditive;
+};
+const DebugView DEBUG_VIEWS[] = {
+    {"Overdraw", "overdraw.fs.glsl", false, true},
+    {"Quad overdraw", "quad_overdraw.fs.glsl", true, true},
+    {"Triangle density", "triangle_density.fs.glsl", true, false},
+    {"Mip level", "mip_level.fs.glsl", false, false},
+    {"GPU cost heat map", "heat_map.fs.glsl", false, false},
+};
+
+const DebugView *findDebugView(const std::string &fragmentShader)
+{
+  for (const auto &view : DEBUG_VIEWS) {
+    if (fragmentShader == view.fragmentShader) {
+      return &view;
+    }
+  }
+  return nullptr;
+}
+
+// Shaders of a scene program, with the geometry shader of the debug views
+// measuring triangles
+std::vector<fs::path> getSceneShaderPaths(const fs::path &shadersPath,
+    const std::string &vertexShader, const std::string &fragmentShader)
+{
+  std::vector<fs::path> paths{shadersPath / vertexShader};
+  const auto *view = findDebugView(fragmentShader);
+  if (view && view->measuresTriangles) {
+    paths.push_back(shadersPath / "debug_triangles.gs.glsl");
+  }
+  paths.push_back(shadersPath / fragmentShader);
+  return paths;
+}
+
+// Path of frame frameIdx of a sequence of pattern (see
+// ViewerOptions::outputFrameCount)
+fs::path getSequenceFramePath(const fs::path &pattern, size_t frameIdx)
+{
+  auto filename = pattern.filename().string();
+  const auto last = filename.find_last_of('#');
+  if (last == std::string::npos) {
+    return getSequenceFramePath(
+        pattern.parent_path() / (pattern.stem().string() + "_####" +
+                                    pattern.extension().string()),
+        frameIdx);
+  }
+  // npos + 1 is 0 if the filename starts with the run
+  const auto first = filename.find_last_not_of('#', last) + 1;
+  const auto digitCount = last + 1 - first;
+  auto number = std::to_string(frameIdx);
+  if (number.size() < digitCount) {
+    number.insert(0, digitCount - number.size(), '0');
+  }
+  filename.replace(first, digitCount, number);
+  return pattern.parent_path() / filename;
+}
+
+// Printed by runBatch and runServer at exit, to tune the budgets of the
+// model cache
+void printModelCacheStats(const ModelCacheStats &stats)
+{
+  std::clog << "Model cache: " << stats.hits << " hits, " << stats.misses
+            << " misses, " << stats.evictions << " evictions, "
+            << stats.modelCount << " models kept ("
+            << (stats.gpuBytes >> 20) << " MB of GPU memory, "
+            << (stats.hostBytes >> 20) << " MB of host memory)" << std::endl;
+}
+
+} // namespace
+
+void keyCallback(
+    GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+  if (key == GLFW_KEY_ESCAPE && action == GLFW_RELEASE) {
+    glfwSetWindowShouldClose(window, 1);
+  }
+}
+
+int ViewerApplication::run()
+{
+  // Parsing and image decoding run on a loader thread, started by the
+  // constructor with m_options.loadAtStartup, in parallel with the rest of
+  // the startup otherwise. The scene must not be accessed until the future
+  // is ready (declared after the scene so that its destructor waits for the
+  // thread before the scene is destroyed).
+  const auto isStartupScene = bool(m_pStartupScene);
+  auto pScene =
+      isStartupScene ? std::move(m_pStartupScene) : std::make_unique<Scene>();
+  auto &scene = *pScene;
+  auto &upload = scene.upload;
+  const auto loadingStartTime =
+      glfwGetTime() - (isStartupScene ? std::chrono::duration<double>(
+                                            std::chrono::steady_clock::now() -
+                                            m_startTime)
+                                            .count()
+                                      : 0.);
+  if (m_pLoadReport && !isStartupScene) {
+    m_pLoadReport->start();
+  }
+  auto loading = isStartupScene
+                     ? std::move(m_startupLoading)
+                     : std::async(std::launch::async, [&]() {
+                         TRACE_THREAD_NAME("Loader");
+                         BackgroundJobScope background;
+                         return loadViewedScene(scene);
+                       });
+
+  // Loader shaders
+  auto programs = std::move(
+      compileScenePrograms({{m_vertexShader, m_fragmentShader}}).front());
+  // With m_options.watchShaders, the programs are compiled again when a
+  // shader changes, the scene and its GPU resources are kept
+  FileWatcher shaderWatcher;
+  if (m_options.watchShaders) {
+    shaderWatcher = FileWatcher(m_ShadersRootPath);
+  }
+  loadEnvironment();
+
+  // The projection and the speed of the camera follow the scene bounds, the
+  // default camera is set when they are known
+  const auto aspectRatio = float(m_nWindowWidth) / m_nWindowHeight;
+  // The window is split in viewCount viewports, the camera looks at the
+  // middle of them. Changed by resizeWindow.
+  const auto viewCount = getViewCount();
+  auto viewAspectRatio = aspectRatio / float(viewCount);
+  // Every cursor position and key event reaches the controller, even when
+  // several arrive between frames or frames wait for events
+  InputQueue inputQueue(m_GLFWHandle.window());
+  // The camera of the frame is the one of cameraController, the trackball
+  // follows it while it is not used
+  FirstPersonCameraController cameraController{DEFAULT_CAMERA_SPEED};
+  TrackballCameraController trackballController;
+  auto useTrackball = m_options.trackballCamera;
+  const auto setCamera = [&](const Camera &camera) {
+    cameraController.setCamera(camera);
+    trackballController.setCamera(camera);
+  };
+  if (m_hasUserCamera) {
+    setCamera(m_userCamera);
+  } else {
+    setCamera(
+        Camera{glm::vec3(0, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)});
+  }
+
+  CameraPath cameraPath;
+  if (!m_options.cameraPath.empty()) {
+    std::string err;
+    if (!cameraPath.load(m_options.cameraPath, err)) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+  }
+
+  // Created on this thread, made current on the loader thread
+  std::unique_ptr<SharedGLContext> loaderContext;
+  if (m_options.useLoaderContext && m_options.asyncLoading &&
+      m_OutputPath.empty()) {
+    try {
+      loaderContext = std::make_unique<SharedGLContext>(m_GLFWHandle);
+    } catch (const std::exception &e) {
+      std::cerr << "Warning: " << e.what()
+                << " Uploading the scene from the main thread." << std::endl;
+    }
+  }
+
+  // Upload of the scene by the loader context, returning a fence after its
+  // commands. Same as loading, the scene must not be accessed until ready.
+  std::future<GLsync> uploading;
+  auto isModelLoaded = false;
+  // Evaluates the animations of the scene on its own thread when
+  // m_options.asyncAnimation is set (destroyed before the scene)
+  std::unique_ptr<PoseSimulation> poseSimulation;
+  // Reloaded models keep the camera of the first one
+  auto isCameraSet = false;
+  const auto showScene = [&]() {
+    isModelLoaded = true;
+    compileMaterialPermutations(scene, programs);
+    if (m_options.asyncAnimation && m_OutputPath.empty() &&
+        !scene.animations.empty() && !m_options.useIndirectDraws) {
+      poseSimulation = std::make_unique<PoseSimulation>(scene.hierarchy,
+          scene.animations, scene.skins, scene.morphs.weights());
+    }
+    if (isCameraSet) {
+      return;
+    }
+    isCameraSet = true;
+    glm::vec3 bboxMin, bboxMax;
+    if (getSceneBounds(scene, bboxMin, bboxMax)) {
+      cameraController.setSpeed(0.5f * glm::length(bboxMax - bboxMin));
+    }
+    if (!m_hasUserCamera) {
+      setCamera(getDefaultCamera(scene, viewAspectRatio));
+    }
+  };
+  const auto finishLoading = [&]() {
+    if (!loading.get()) {
+      return false;
+    }
+    // The loader context uploads the whole scene at once
+    beginSceneUpload(scene, m_options.streamTextures && m_OutputPath.empty(),
+        m_options.coarseFirstUpload && m_options.asyncLoading &&
+            !loaderContext);
+    if (!loaderContext) {
+      showScene();
+      return true;
+    }
+    // Vertex arrays are not shared, the arena is allocated here and the
+    // loader context waits for it before filling its buffers
+    const auto allocated = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    uploading = std::async(std::launch::async, [&, allocated]() {
+      TRACE_THREAD_NAME("Loader");
+      BackgroundJobScope background;
+      loaderContext->makeCurrent();
+      glWaitSync(allocated, 0, GL_TIMEOUT_IGNORED);
+      glDeleteSync(allocated);
+      uploadMeshes(scene, std::numeric_limits<size_t>::max());
+      const auto uploaded = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      glFlush();
+      loaderContext->doneCurrent();
+      return uploaded;
+    });
+    return true;
+  };
+  // Once uploaded, picking is the only reader of the buffers
+  const auto releaseBuffers = [&]() {
+    if (!m_options.releaseCpuBuffers || scene.isReadFromCache) {
+      return;
+    }
+    const auto releasedBytes = releaseModelBuffers(m_localGltfFilePath,
+        scene.model, scene.bufferMappings, scene.buffers);
+    std::clog << "Released " << (releasedBytes >> 20)
+              << " MiB of glTF buffers" << std::endl;
+  };
+  if (!m_options.asyncLoading) {
+    if (!finishLoading()) {
+      return -1;
+    }
+    uploadMeshes(scene, std::numeric_limits<size_t>::max());
+    releaseBuffers();
+    finishLoadReport(scene);
+  }
+
+  // With m_options.watchModel, a new version of the file is loaded in
+  // reloadedScene by a task on the job system, then swapped with scene on
+  // this thread. reloadedScene then keeps the previous version, whose
+  // unchanged meshes are copied to the new one, until the new one is
+  // uploaded.
+  FileWatcher modelWatcher;
+  if (m_options.watchModel && m_OutputPath.empty()) {
+    modelWatcher = FileWatcher(m_localGltfFilePath);
+  }
+  std::unique_ptr<Scene> reloadedScene;
+  std::optional<Task<>> reloading; // Finished before the loop returns
+  const auto swapReloadedScene = [&]() {
+    // GUI state of the scene
+    const auto animation = scene.animation;
+    const auto variant = scene.variants.selected();
+    const auto depthPrepass = scene.depthPrepass;
+    const auto shadows = scene.shadows;
+    const auto localShadows = scene.localShadows;
+    poseSimulation.reset();
+    std::swap(scene, *reloadedScene);
+    beginSceneUpload(scene, m_options.streamTextures);
+    reuseSceneResources(scene, *reloadedScene);
+    if (variant < int(scene.variants.variantCount())) {
+      scene.variants.select(variant, scene.compact, scene.upload.primitives);
+    }
+    if (animation >= 0 &&
+        size_t(animation) < scene.animations.animationCount()) {
+      scene.animation = animation;
+    }
+    scene.depthPrepass = depthPrepass;
+    scene.shadows = shadows;
+    scene.localShadows = localShadows;
+    showScene();
+  };
+
+  // Setup OpenGL state for rendering
+  setupDepthTest();
+
+  // The window is drawn with temporal anti-aliasing instead of MSAA if the
+  // scene programs write motion vectors
+  std::unique_ptr<TemporalAntiAliasing> temporalAA;
+  if (programs.writesMotionVectors) {
+    temporalAA = std::make_unique<TemporalAntiAliasing>(
+        m_nWindowWidth, m_nWindowHeight, m_options.reversedZ);
+  }
+
+  // Groups of draws of the window hidden in the previous frame are skipped
+  std::unique_ptr<OcclusionQueries> occlusionQueries;
+  if (m_options.occlusionQueries && canDrawDepthPrepass()) {
+    occlusionQueries = std::make_unique<OcclusionQueries>();
+  }
+
+  // The GPU time of the window is attributed to buckets of draws, one per
+  // frame, when drawn one by one
+  std::unique_ptr<GpuCostAttribution> costAttribution;
+  if (m_options.costAttribution != CostBuckets::None &&
+      m_OutputPath.empty()) {
+    costAttribution = std::make_unique<GpuCostAttribution>();
+  }
+
+  // Otherwise the scene may be drawn at a lower resolution and upscaled
+  std::unique_ptr<DynamicResolution> dynamicResolution;
+  if (!temporalAA && m_options.targetFrameTime > 0.f) {
+    dynamicResolution = std::make_unique<DynamicResolution>(m_nWindowWidth,
+        m_nWindowHeight,
+        m_options.reversedZ ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24,
+        m_options.targetFrameTime);
+  }
+
+  // Otherwise the window may converge to many samples per pixel while
+  // nothing changes
+  std::unique_ptr<ProgressiveAccumulation> accumulation;
+  if (!temporalAA && !dynamicResolution && programs.accumulate.glId()) {
+    accumulation = std::make_unique<ProgressiveAccumulation>(m_nWindowWidth,
+        m_nWindowHeight,
+        m_options.reversedZ ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24,
+        m_options.accumulationFrameCount);
+  }
+  // Transient textures of the frame graphs of the window, kept from frame
+  // to frame
+  TexturePool texturePool;
+  // Otherwise the window may be drawn in HDR and post-processed
+  std::unique_ptr<PostProcessing> postProcessing;
+  if (!temporalAA && !dynamicResolution && !accumulation &&
+      programs.postProcessing.toneMapping.glId()) {
+    postProcessing = std::make_unique<PostProcessing>(m_nWindowWidth,
+        m_nWindowHeight,
+        m_options.reversedZ ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24);
+  }
+  // Set by any change of the frame, which restarts accumulation
+  auto hasFrameChanged = true;
+
+  // Lambda function to draw the scene
+  size_t drawnPrimitiveCount = 0;
+  const auto drawScene = [&](const Camera &camera,
+                             const glm::mat4 &projMatrix,
+                             Profiler *passProfiler = nullptr) {
+    if (dynamicResolution) {
+      const auto size = dynamicResolution->viewportSize();
+      glViewport(0, 0, size.x, size.y);
+    } else {
+      glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
+    }
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (temporalAA) {
+      temporalAA->clearMotionVectors();
+    }
+    if (isModelLoaded) {
+      drawnPrimitiveCount = renderScene(scene, programs, camera, projMatrix,
+          passProfiler, nullptr, 0, occlusionQueries.get(),
+          costAttribution.get());
+    }
+  };
+
+  // Views of camera with viewCount > 1, from left to right: the eyes of a
+  // stereo rig, or cameras panned by the horizontal field of view of a
+  // viewport so that the views join into a panorama. masks are the views of
+  // each draw (see cullViews), empty until the model is loaded.
+  struct Views
+  {
+    std::vector<Camera> cameras;
+    std::vector<glm::mat4> projMatrices;
+    std::vector<uint32_t> masks;
+  };
+  const auto getViews = [&](const Camera &camera) {
+    Views views;
+    if (m_options.stereo) {
+      const auto rig = getStereoRig(
+          camera, m_options.interpupillaryDistance, m_options.convergence);
+      for (size_t eye = 0; eye < 2; ++eye) {
+        views.cameras.push_back(rig.eyes[eye]);
+        views.projMatrices.push_back(rig.projMatrix(
+            eye, getProjMatrix(scene, rig.eyes[eye], viewAspectRatio)));
+      }
+    } else {
+      const auto fieldOfView =
+          2.f * std::atan(std::tan(0.5f * FIELD_OF_VIEW) * viewAspectRatio);
+      for (size_t i = 0; i < viewCount; ++i) {
+        auto viewCamera = camera;
+        viewCamera.panLeft(
+            (0.5f * float(viewCount - 1) - float(i)) * fieldOfView);
+        views.cameras.push_back(viewCamera);
+        views.projMatrices.push_back(
+            getProjMatrix(scene, viewCamera, viewAspectRatio));
+      }
+    }
+    if (isModelLoaded) {
+      std::vector<glm::mat4> viewProjMatrices;
+      for (size_t i = 0; i < views.cameras.size(); ++i) {
+        viewProjMatrices.push_back(
+            views.projMatrices[i] * views.cameras[i].getViewMatrix());
+      }
+      views.masks = cullViews(scene, viewProjMatrices);
+    }
+    return views;
+  };
+
+  // Lambda function to draw the views in their viewports, with the draws
+  // culled once for all of them
+  const auto drawViews = [&](const Views &views) {
+    glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawnPrimitiveCount = 0;
+    if (!isModelLoaded) {
+      return;
+    }
+    const auto count = views.cameras.size();
+    for (size_t i = 0; i < count; ++i) {
+      const auto x0 = GLint(i * m_nWindowWidth / count);
+      const auto x1 = GLint((i + 1) * m_nWindowWidth / count);
+      glViewport(x0, 0, x1 - x0, m_nWindowHeight);
+      drawnPrimitiveCount += renderScene(scene, programs, views.cameras[i],
+          views.projMatrices[i], nullptr, &views.masks, i);
+    }
+  };
+
+  Profiler profiler;
+
+  if (!m_OutputPath.empty()) {
+    // Offline rendering of a single image, the scene must be complete
+    if (!isModelLoaded && !finishLoading()) {
+      return -1;
+    }
+    uploadMeshes(scene, std::numeric_limits<size_t>::max());
+    finishLoadReport(scene);
+    updateScenePose(scene, programs, 0.);
+    if (m_options.useIndirectDraws) {
+      buildIndirectDraws(scene);
+    }
+    if (programs.readsMaterials) {
+      buildMaterials(scene);
+    }
+
+    // Camera turned by angle radians around its target
+    const auto turnCamera = [](const Camera &camera, float angle) {
+      const auto center = camera.center();
+      const auto offset = glm::rotate(glm::mat4(1), angle, camera.up()) *
+                          glm::vec4(camera.eye() - center, 0);
+      return Camera{center + glm::vec3(offset), center, camera.up()};
+    };
+
+    if (m_options.thumbnailCount) {
+      // Each tile has the output size, so the aspect ratio of the window
+      const auto count = viewCount;
+      const auto columns = size_t(std::ceil(std::sqrt(double(count))));
+      const auto rows = (count + columns - 1) / columns;
+      const auto width = columns * m_nWindowWidth;
+      const auto height = rows * m_nWindowHeight;
+      if (isExrPath(m_OutputPath)) {
+        std::cerr << "Error: thumbnail atlases are written as PNG images"
+                  << std::endl;
+        return -1;
+      }
+      if (getOutputTileSize(width, height)) {
+        std::cerr << "Error: thumbnail atlases are not rendered in tiles, "
+                     "their size must be at most the tile size"
+                  << std::endl;
+        return -1;
+      }
+      Views views;
+      std::vector<glm::mat4> viewProjMatrices;
+      for (size_t i = 0; i < count; ++i) {
+        views.cameras.push_back(turnCamera(cameraController.getCamera(),
+            float(2. * glm::pi<double>() * double(i) / double(count))));
+        views.projMatrices.push_back(
+            getProjMatrix(scene, views.cameras.back(), aspectRatio));
+        viewProjMatrices.push_back(views.projMatrices.back() *
+                                   views.cameras.back().getViewMatrix());
+      }
+      views.masks = cullViews(scene, viewProjMatrices);
+
+      const auto numComponents = 3;
+      std::vector<unsigned char> pixels(width * height * numComponents);
+      {
+        Profiler::CPUScope scope{profiler, "Render and readback"};
+        renderToImage(width, height, numComponents, pixels.data(),
+            [&]() {
+              glViewport(0, 0, GLsizei(width), GLsizei(height));
+              glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+              // Rows are bottom up in GL, the first tile is at the top left
+              for (size_t i = 0; i < count; ++i) {
+                glViewport(GLint((i % columns) * m_nWindowWidth),
+                    GLint((rows - 1 - i / columns) * m_nWindowHeight),
+                    GLsizei(m_nWindowWidth), GLsizei(m_nWindowHeight));
+                renderScene(scene, programs, views.cameras[i],
+                    views.projMatrices[i], nullptr, &views.masks, i);
+              }
+            },
+            getOutputSamples(), loadFxaaProgram());
+      }
+      std::clog << "Rendered " << count << " thumbnails in " << m_OutputPath
+                << " in " << profiler.getCPUTime("Render and readback")
+                << " ms" << std::endl;
+      std::string err;
+      if (!writePng(m_OutputPath, width, height, numComponents,
+              pixels.data(), true, err)) {
+        std::cerr << "Error: " << err << std::endl;
+        return -1;
+      }
+      return 0;
+    }
+
+    if (m_options.outputFrameCount) {
+      const auto getTurntableCamera = [&](double time) {
+        const auto &camera = cameraController.getCamera();
+        if (m_options.turntablePeriod <= 0.) {
+          return camera;
+        }
+        return turnCamera(camera,
+            float(2. * glm::pi<double>() *
+                  std::fmod(time, m_options.turntablePeriod) /
+                  m_options.turntablePeriod));
+      };
+      return writeImageSequence([&](double time) {
+        updateScenePose(scene, programs, time);
+        const auto camera = cameraPath.empty() ? getTurntableCamera(time)
+                                               : cameraPath.evaluate(time);
+        if (viewCount > 1) {
+          drawViews(getViews(camera));
+        } else {
+          drawScene(camera, getProjMatrix(scene, camera, viewAspectRatio));
+        }
+      });
+    }
+
+    const auto &camera = cameraController.getCamera();
+    const auto projMatrix = getProjMatrix(scene, camera, viewAspectRatio);
+    const auto tileSize = getOutputTileSize(m_nWindowWidth, m_nWindowHeight);
+    if (tileSize && viewCount > 1) {
+      std::cerr << "Error: stereo images are not rendered in tiles, their "
+                   "size must be at most the tile size"
+                << std::endl;
+      return -1;
+    }
+    // Tiles are streamed to the PNG encoder only
+    const auto isHdr = isExrPath(m_OutputPath);
+    if (tileSize && isHdr) {
+      std::cerr << "Error: EXR images are not rendered in tiles, their size "
+                   "must be at most the tile size"
+                << std::endl;
+      return -1;
+    }
+    if (tileSize) {
+      auto success = false;
+      {
+        Profiler::CPUScope scope{profiler, "Render and readback"};
+        success = writeTiledImage(scene, programs, camera, projMatrix,
+            m_nWindowWidth, m_nWindowHeight, tileSize, m_OutputPath);
+      }
+      if (!success) {
+        return -1;
+      }
+      std::clog << "Rendered " << m_OutputPath << " in "
+                << profiler.getCPUTime("Render and readback") << " ms ("
+                << tileSize << "x" << tileSize << " tiles)" << std::endl;
+      return 0;
+    }
+
+    // HDR images are read as half floats, unclamped
+    const auto numComponents = 3;
+    const auto pixelType = isHdr ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE;
+    const auto pixelCount = size_t(m_nWindowWidth) * m_nWindowHeight;
+    std::vector<unsigned char> pixels(
+        pixelCount * numComponents * (isHdr ? sizeof(uint16_t) : 1));
+    {
+      Profiler::CPUScope scope{profiler, "Render and readback"};
+      renderToImage(m_nWindowWidth, m_nWindowHeight, numComponents,
+          pixels.data(),
+          [&]() {
+            if (viewCount > 1) {
+              drawViews(getViews(camera));
+            } else {
+              drawScene(camera, projMatrix);
+            }
+          },
+          getOutputSamples(), loadFxaaProgram(), pixelType);
+    }
+    std::clog << "Rendered " << m_OutputPath << " in "
+              << profiler.getCPUTime("Render and readback") << " ms"
+              << std::endl;
+
+    // Pixels are read bottom row first
+    std::string err;
+    const auto isWritten =
+        isHdr ? writeExr(m_OutputPath, m_nWindowWidth, m_nWindowHeight,
+                    numComponents, (const uint16_t *)pixels.data(), true, err)
+              : writePng(m_OutputPath, m_nWindowWidth, m_nWindowHeight,
+                    numComponents, pixels.data(), true, err);
+    if (!isWritten) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+
+    return 0;
+  }
+
+  // The window has no floating point depth buffer, the scene is rendered
+  // offscreen then copied to the window (the framebuffers of temporalAA,
+  // dynamicResolution, accumulation and postProcessing have one)
+  std::unique_ptr<RenderTarget> sceneTarget;
+  if (m_options.reversedZ && !temporalAA && !dynamicResolution &&
+      !accumulation && !postProcessing) {
+    sceneTarget = std::make_unique<RenderTarget>(
+        m_nWindowWidth, m_nWindowHeight, GL_DEPTH_COMPONENT32F);
+  }
+
+  // Lambda function to follow a resize of the window to width x height
+  // pixels. temporalAA, the G-buffer and the depth pyramid keep their
+  // textures while they fit (see getTargetCapacity), the other targets of
+  // the window are created again.
+  const auto resizeWindow = [&](GLsizei width, GLsizei height) {
+    m_nWindowWidth = width;
+    m_nWindowHeight = height;
+    viewAspectRatio = float(width) / float(height) / float(viewCount);
+    const auto depthFormat =
+        m_options.reversedZ ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24;
+    if (temporalAA) {
+      temporalAA->resize(size_t(width), size_t(height));
+    }
+    if (dynamicResolution) {
+      dynamicResolution = std::make_unique<DynamicResolution>(width, height,
+          depthFormat, dynamicResolution->targetTime());
+    }
+    if (accumulation) {
+      accumulation = std::make_unique<ProgressiveAccumulation>(
+          width, height, depthFormat, m_options.accumulationFrameCount);
+    }
+    if (postProcessing) {
+      postProcessing =
+          std::make_unique<PostProcessing>(width, height, depthFormat);
+    }
+    if (sceneTarget) {
+      sceneTarget = std::make_unique<RenderTarget>(
+          width, height, GL_DEPTH_COMPONENT32F);
+    }
+  };
+
+  // With m_options.renderOnDemand, number of frames to draw before waiting
+  // for events. ImGui needs a few frames to settle after an input, and
+  // temporalAA a full jitter cycle.
+  const auto settleFrameCount =
+      temporalAA ? int(TemporalAntiAliasing::JITTER_PHASE_COUNT) : 3;
+  auto framesToDraw = settleFrameCount;
+  // The GUI is built for settleFrameCount frames after an input, and at
+  // m_options.guiRefreshRate otherwise: other frames draw the last one again
+  auto isGuiVisible = !m_options.hideGui;
+  auto guiFramesToBuild = settleFrameCount;
+  auto lastGuiBuildTime = 0.;
+  SceneTreePanel sceneTree;
+  auto isolatedNode = -1; // Of scene.isolatedDraws
+
+  // Primitive picked with the right mouse button, in scene.drawBoundsMin/Max
+  // order
+  auto pickedDrawIdx = -1;
+  auto pickedDistance = 0.f;
+  // Picks are drawn on the GPU and read back a frame later when the pick
+  // programs are available, else the ray through the cursor is cast on the
+  // CPU. pickMatrix inverts the projection of the pending pick.
+  GpuPicker picker;
+  glm::mat4 pickMatrix(1);
+  glm::vec3 pickEye(0);
+  auto wasRightButtonPressed = false;
+
+  // Screenshots requested with F12 or the GUI are taken once the frame is
+  // drawn, before the GUI, and written by workers a few frames later
+  ScreenshotCapture screenshots{getOutputSamples(), loadFxaaProgram()};
+  auto isScreenshotRequested = false;
+  auto screenshotScale = m_options.screenshotScale;
+  size_t screenshotIdx = 0; // Next number tried
+  const auto takeScreenshot = [&](const Camera &camera,
+                                  const glm::mat4 &projMatrix) {
+    // Earlier screenshots are kept
+    auto path = getSequenceFramePath(m_options.screenshotPath, screenshotIdx);
+    std::error_code ec;
+    while (fs::exists(path, ec)) {
+      path = getSequenceFramePath(m_options.screenshotPath, ++screenshotIdx);
+    }
+    // Several views are only drawn in the window
+    auto isCaptured = false;
+    if (screenshotScale == 1.f || viewCount > 1) {
+      isCaptured = screenshots.captureWindow(
+          size_t(m_nWindowWidth), size_t(m_nWindowHeight), path);
+    } else {
+      const auto maxSize = getMaxTileSize(std::numeric_limits<size_t>::max());
+      const auto getSize = [&](GLsizei windowSize) {
+        return std::clamp(size_t(std::lround(screenshotScale * windowSize)),
+            size_t(1), maxSize);
+      };
+      const auto width = getSize(m_nWindowWidth);
+      const auto height = getSize(m_nWindowHeight);
+      isCaptured = screenshots.captureRender(width, height,
+          [&]() {
+            glViewport(0, 0, GLsizei(width), GLsizei(height));
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            if (isModelLoaded) {
+              renderScene(scene, programs, camera, projMatrix);
+            }
+          },
+          path);
+      glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
+    }
+    if (!isCaptured) {
+      std::cerr << "Warning: screenshot skipped, "
+                << screenshots.pendingCount() << " are still pending"
+                << std::endl;
+      return;
+    }
+    ++screenshotIdx;
+  };
+
+  // Sampled on its own thread, drawn with the profiler
+  const auto telemetry = createGpuTelemetry();
+
+  // Bounds of the picked primitive, false if none or unknown
+  const auto getPickedBounds = [&](glm::vec3 &bboxMin, glm::vec3 &bboxMax) {
+    if (pickedDrawIdx < 0 ||
+        size_t(pickedDrawIdx) >= scene.drawBoundsMax.size() ||
+        scene.drawBoundsMax[pickedDrawIdx].x >=
+            std::numeric_limits<float>::max()) {
+      return false;
+    }
+    bboxMin = scene.drawBoundsMin[pickedDrawIdx];
+    bboxMax = scene.drawBoundsMax[pickedDrawIdx];
+    return true;
+  };
+  // The trackball moves to the framing camera smoothly
+  const auto frameBounds = [&](const glm::vec3 &bboxMin,
+                               const glm::vec3 &bboxMax,
+                               const glm::mat4 &projMatrix) {
+    if (useTrackball) {
+      trackballController.frame(bboxMin, bboxMax, projMatrix);
+      return;
+    }
+    const auto &camera = cameraController.getCamera();
+    setCamera(getFramingCamera(
+        bboxMin, bboxMax, projMatrix, camera.front(), camera.up()));
+  };
+
+  // Time of the played animation, advanced by the duration of frames
+  auto animationTime = 0.;
+  auto isAnimationPlaying = true;
+  auto animationSpeed = 1.f;
+  auto previousFrameTime = glfwGetTime();
+
+  // Whole frames, written to m_options.statsOutput when the window closes
+  FrameTimeline frameTimeline;
+  // Without frame pacing, only measures the latency
+  FramePacer framePacer(
+      m_options.framePacing ? m_options.maxFramesInFlight : 0,
+      m_options.maxFrameRate);
+  if (m_options.framePacing) {
+    m_GLFWHandle.enableVSync(true);
+  }
+
+  // Camera path playback, and recording from the GUI
+  auto isPlayingCameraPath = !cameraPath.empty();
+  auto cameraPathTime = 0.;
+  auto isRecordingCameraPath = false;
+  CameraPath recordedCameraPath;
+  // Cameras of the coming seconds, whose textures are prefetched
+  CameraPredictor cameraPredictor;
+  std::vector<Camera> predictedCameras;
+
+  // Replace the programs by those of m_fragmentShader, unless they fail to
+  // build, whose log has been printed by ProgramBuilder, or change the
+  // outputs of the frame. Return true if they were replaced.
+  const auto reloadPrograms = [&]() {
+    try {
+      auto reloaded = std::move(
+          compileScenePrograms({{m_vertexShader, m_fragmentShader}}).front());
+      // Render targets of the window were chosen for the first programs
+      if (reloaded.writesMotionVectors != programs.writesMotionVectors ||
+          !reloaded.accumulate.glId() != !programs.accumulate.glId() ||
+          !reloaded.postProcessing.toneMapping.glId() !=
+              !programs.postProcessing.toneMapping.glId()) {
+        std::cerr << "Warning: the reloaded shaders change the outputs of "
+                     "the frame, restart the viewer to apply them"
+                  << std::endl;
+        return false;
+      }
+      programs = std::move(reloaded);
+      if (isModelLoaded) {
+        compileMaterialPermutations(scene, programs);
+      }
+      framesToDraw = settleFrameCount;
+      hasFrameChanged = true;
+      return true;
+    } catch (const std::exception &) {
+      std::cerr << "Warning: keeping the previous shaders" << std::endl;
+    }
+    return false;
+  };
+  // The GUI switches between render paths, between the fragment shader
+  // given at startup, the shading models and the debug views, at the start
+  // of the next frame. Skins keep the path the scene was loaded with: they
+  // are drawn in their bind pose by the paths that ignore them.
+  const auto startupFragmentShader = m_fragmentShader;
+  std::string requestedFragmentShader;
+  auto requestedRenderPath = getRenderPath();
+
+  // See reloadedScene
+  const auto reloadScene = [&]() -> Task<> {
+    co_await resumeOnJobSystem();
+    const auto isLoaded = loadViewedScene(*reloadedScene);
+    co_await m_glTasks.schedule();
+    if (!isLoaded) {
+      std::cerr << "Warning: keeping the previous version of "
+                << m_gltfFilePath << std::endl;
+      reloadedScene.reset();
+      co_return;
+    }
+    swapReloadedScene();
+    pickedDrawIdx = -1;
+    framesToDraw = settleFrameCount;
+    hasFrameChanged = true;
+  };
+
+  // Loop until the user closes the window
+  for (auto iterationCount = 0u; !m_GLFWHandle.shouldClose();
+       ++iterationCount) {
+    // Meshes are uploaded every frame, so only wait once they are done, and
+    // accumulation has converged
+    if (m_options.renderOnDemand && framesToDraw == 0 &&
+        (!accumulation || accumulation->isConverged()) &&
+        (!isModelLoaded ||
+            (upload.done() &&
+                !scene.textureStreamer.stats().pendingLevelCount &&
+                !scene.virtualTextures.stats().pendingPageCount))) {
+      if (isModelLoaded && !m_options.watchShaders && !reloading) {
+        glfwWaitEvents();
+      } else {
+        // The loaders and the shader files post no event, wake up to show
+        // the progress of the former and poll the latter
+        glfwWaitEventsTimeout(0.1);
+      }
+      // Any event may change the GUI or start moving the camera
+      framesToDraw = settleFrameCount;
+    }
+    framePacer.waitForFrame();
+
+    // Measured after waiting so that the camera does not jump afterwards
+    const auto seconds = glfwGetTime();
+    const auto frameDuration = seconds - previousFrameTime;
+    // Camera paths play at a fixed time step, whatever the frame rate
+    const auto timeStep =
+        isPlayingCameraPath ? m_options.fixedTimeStep : frameDuration;
+    previousFrameTime = seconds;
+    TRACE_ZONE("Frame");
+    profiler.beginFrame();
+    frameTimeline.beginFrame();
+    if (isTracing()) {
+      collectGPUTraceZones();
+    }
+
+    if (shaderWatcher.poll(seconds) && reloadPrograms()) {
+      std::clog << "Reloaded shaders" << std::endl;
+    }
+    if (!requestedFragmentShader.empty()) {
+      const auto previousFragmentShader = m_fragmentShader;
+      m_fragmentShader = requestedFragmentShader;
+      requestedFragmentShader.clear();
+      if (!reloadPrograms()) {
+        m_fragmentShader = previousFragmentShader;
+      }
+    }
+    if (requestedRenderPath != getRenderPath()) {
+      const auto previousRenderPath = getRenderPath();
+      setRenderPath(requestedRenderPath);
+      const auto switchStart = glfwGetTime();
+      if (!reloadPrograms()) {
+        setRenderPath(previousRenderPath);
+        requestedRenderPath = previousRenderPath;
+      } else if (isModelLoaded) {
+        // Indirect draws are built again once all meshes are uploaded
+        scene.hasIndirectDraws = false;
+        if (m_options.useInstancing) {
+          buildInstancedDraws(scene);
+          if (scene.hasMaterialTextures && scene.impostors.empty() &&
+              m_options.impostorPixelSize > 0.f &&
+              !m_options.deferredShading) {
+            bakeImpostors(scene);
+          }
+        }
+        programs.shadowMaps.invalidate();
+        programs.shadowAtlas.invalidate();
+        std::clog << "Switched render path in "
+                  << (glfwGetTime() - switchStart) * 1e3 << " ms"
+                  << std::endl;
+      }
+    }
+    if (loading.valid() && loading.wait_for(std::chrono::seconds(0)) ==
+                               std::future_status::ready) {
+      if (!finishLoading()) {
+        return -1;
+      }
+    }
+    if (uploading.valid() && uploading.wait_for(std::chrono::seconds(0)) ==
+                                 std::future_status::ready) {
+      const auto uploaded = uploading.get();
+      glWaitSync(uploaded, 0, GL_TIMEOUT_IGNORED);
+      glDeleteSync(uploaded);
+      showScene();
+      releaseBuffers();
+      finishLoadReport(scene);
+    }
+    if (reloadedScene && !reloading && upload.done()) {
+      reloadedScene.reset();
+    }
+    // Only a complete scene is replaced
+    if (isModelLoaded && upload.done() && !reloadedScene &&
+        modelWatcher.poll(seconds)) {
+      std::clog << "Reloading " << m_gltfFilePath << std::endl;
+      reloadedScene = std::make_unique<Scene>();
+      reloading.emplace(reloadScene());
+      reloading->start();
+    }
+    m_glTasks.drain(m_options.glTaskSecondsPerFrame);
+    if (reloading && reloading->isReady()) {
+      reloading.reset();
+    }
+    if (isModelLoaded) {
+      Profiler::CPUScope scope{profiler, "Transforms"};
+      if (scene.animation >= 0 && isAnimationPlaying) {
+        animationTime += timeStep * animationSpeed;
+      }
+      // The simulation computes the pose of the next frame while this one
+      // is drawn, assuming it lasts as long as this one
+      const auto hasMoved =
+          poseSimulation
+              ? updateScenePose(scene, programs, *poseSimulation)
+              : updateScenePose(scene, programs, animationTime);
+      if (hasMoved) {
+        framesToDraw = settleFrameCount;
+        hasFrameChanged = true;
+      }
+      if (poseSimulation && scene.animation >= 0) {
+        const auto nextTime =
+            animationTime +
+            (isAnimationPlaying ? timeStep * animationSpeed : 0.);
+        poseSimulation->request(size_t(scene.animation), nextTime);
+      }
+    }
+    if (isModelLoaded && !upload.done()) {
+      Profiler::Scope scope{profiler, "Upload"};
+      if (uploadMeshes(scene, m_options.uploadBytesPerFrame)) {
+        releaseBuffers();
+        finishLoadReport(scene);
+      }
+    }
+    // Meshes are drawn one by one while they stream in
+    if (m_options.useIndirectDraws && !scene.hasIndirectDraws &&
+        isModelLoaded && upload.done()) {
+      buildIndirectDraws(scene);
+    }
+    // Materials get their textures once every image is uploaded
+    if (programs.readsMaterials && isModelLoaded &&
+        (!scene.hasMaterials ||
+            (!scene.hasMaterialTextures && upload.done()))) {
+      buildMaterials(scene);
+    }
+
+    // Input is read as late as possible before drawing, so that the camera
+    // of the frame is not one frame behind it
+    glfwPollEvents(); // Poll for and process events
+    framePacer.sampleInput();
+    const auto guiHasFocus =
+        isGuiVisible && (ImGui::GetIO().WantCaptureMouse ||
+                            ImGui::GetIO().WantCaptureKeyboard);
+    // Both controllers track the held keys and buttons
+    const auto inputEvents = inputQueue.takeEvents();
+    // F1 shows or hides the GUI, unless it is typed in a text field
+    if (!(isGuiVisible && ImGui::GetIO().WantTextInput) &&
+        std::any_of(begin(inputEvents), end(inputEvents),
+            [](const InputEvent &event) {
+              return event.type == InputEvent::Type::Key &&
+                     event.code == GLFW_KEY_F1 &&
+                     event.action == GLFW_PRESS;
+            })) {
+      isGuiVisible = !isGuiVisible;
+      hasFrameChanged = true;
+    }
+    // F12 takes a screenshot of this frame
+    if (!(isGuiVisible && ImGui::GetIO().WantTextInput) &&
+        std::any_of(begin(inputEvents), end(inputEvents),
+            [](const InputEvent &event) {
+              return event.type == InputEvent::Type::Key &&
+                     event.code == GLFW_KEY_F12 &&
+                     event.action == GLFW_PRESS;
+            })) {
+      isScreenshotRequested = true;
+    }
+    if (!inputEvents.empty()) {
+      guiFramesToBuild = settleFrameCount;
+    }
+    // The window follows the last size of its framebuffer, once per frame
+    // however many sizes a drag-resize went through. A minimized window
+    // has an empty framebuffer and keeps its size.
+    const auto lastResize = std::find_if(rbegin(inputEvents),
+        rend(inputEvents), [](const InputEvent &event) {
+          return event.type == InputEvent::Type::FramebufferSize;
+        });
+    if (lastResize != rend(inputEvents)) {
+      const auto size = lastResize->framebufferSize;
+      if (size.x > 0 && size.y > 0 &&
+          (size.x != m_nWindowWidth || size.y != m_nWindowHeight)) {
+        resizeWindow(size.x, size.y);
+        framesToDraw = settleFrameCount;
+        hasFrameChanged = true;
+      }
+    }
+    const auto inputTime = glfwGetTime();
+    const auto ignoreInput = guiHasFocus || isPlayingCameraPath;
+    const auto hasCameraMoved =
+        useTrackball
+            ? trackballController.update(inputEvents, inputTime, ignoreInput)
+            : cameraController.update(inputEvents, inputTime, ignoreInput);
+    if (useTrackball) {
+      cameraController.update(inputEvents, inputTime, true);
+      if (hasCameraMoved) {
+        cameraController.setCamera(trackballController.getCamera());
+      }
+    } else {
+      trackballController.update(inputEvents, inputTime, true);
+      if (hasCameraMoved) {
+        trackballController.setCamera(cameraController.getCamera());
+      }
+    }
+    // F frames the picked primitive, or the scene
+    const auto isFramingRequested =
+        !ignoreInput &&
+        std::any_of(begin(inputEvents), end(inputEvents),
+            [](const InputEvent &event) {
+              return event.type == InputEvent::Type::Key &&
+                     event.code == GLFW_KEY_F && event.action == GLFW_PRESS;
+            });
+    if (isPlayingCameraPath) {
+      setCamera(cameraPath.evaluate(cameraPathTime));
+    } else if (hasCameraMoved) {
+      framesToDraw = settleFrameCount;
+      hasFrameChanged = true;
+    }
+    const auto camera = cameraController.getCamera();
+    if (isRecordingCameraPath) {
+      recordedCameraPath.add(recordedCameraPath.empty()
+                                 ? 0.
+                                 : recordedCameraPath.duration() + timeStep,
+          camera);
+    }
+    // The path played is known ahead, the motion of the user is extrapolated
+    predictedCameras.clear();
+    if (isPlayingCameraPath) {
+      cameraPredictor.clear();
+      for (const auto step : CAMERA_PREDICTION_STEPS) {
+        if (m_options.prefetchSeconds > 0.f) {
+          predictedCameras.push_back(cameraPath.evaluate(
+              cameraPathTime + step * m_options.prefetchSeconds));
+        }
+      }
+    } else {
+      cameraPredictor.add(glfwGetTime(), camera);
+      cameraPredictor.predict(m_options.prefetchSeconds, predictedCameras);
+    }
+    const auto projMatrix = getProjMatrix(scene, camera, viewAspectRatio);
+    glm::vec3 framedMin, framedMax;
+    if (isFramingRequested && isModelLoaded &&
+        (getPickedBounds(framedMin, framedMax) ||
+            getSceneBounds(scene, framedMin, framedMax))) {
+      frameBounds(framedMin, framedMax, projMatrix);
+      framesToDraw = settleFrameCount;
+      hasFrameChanged = true;
+    }
+    const auto views = viewCount > 1 ? getViews(camera) : Views{};
+    if (isModelLoaded && scene.textureStreamer.imageCount()) {
+      Profiler::Scope scope{profiler, "Texture streaming"};
+      streamTextures(scene, camera, projMatrix,
+          views.masks.empty() ? nullptr : &views.masks, predictedCameras);
+    }
+    if (isModelLoaded && !scene.virtualTextures.empty()) {
+      Profiler::Scope scope{profiler, "Virtual textures"};
+      scene.virtualTextures.update(m_options.uploadBytesPerFrame,
+          size_t(m_nWindowWidth), size_t(m_nWindowHeight));
+    }
+    // The scene tree shows the costs of the subtrees of the hierarchy and
+    // draws the one it isolates alone
+    if (isModelLoaded && sceneTree.isOutdated(scene.hierarchy)) {
+      const auto &hierarchy = scene.hierarchy;
+      std::vector<uint32_t> drawCounts(hierarchy.size(), 0);
+      std::vector<uint64_t> triangleCounts(hierarchy.size(), 0);
+      for (const auto flatIdx : hierarchy.meshNodes()) {
+        const auto &range = upload.meshToPrimitives[hierarchy.mesh(flatIdx)];
+        drawCounts[flatIdx] = uint32_t(range.count);
+        for (size_t pIdx = 0; pIdx < range.count; ++pIdx) {
+          const auto &primitive = upload.primitives[range.begin + pIdx];
+          const auto count = primitive.indexCount ? primitive.indexCount
+                                                  : primitive.vertexCount;
+          if (primitive.mode == GL_TRIANGLES) {
+            triangleCounts[flatIdx] += count / 3;
+          } else if ((primitive.mode == GL_TRIANGLE_STRIP ||
+                         primitive.mode == GL_TRIANGLE_FAN) &&
+                     count >= 3) {
+            triangleCounts[flatIdx] += count - 2;
+          }
+        }
+      }
+      sceneTree.reset(hierarchy, drawCounts, triangleCounts);
+      isolatedNode = -1;
+      scene.isolatedDraws.clear();
+    }
+    if (isModelLoaded && sceneTree.isolated() != isolatedNode) {
+      isolatedNode = sceneTree.isolated();
+      scene.isolatedDraws.clear();
+      if (isolatedNode >= 0) {
+        std::vector<uint8_t> isInSubtree;
+        sceneTree.getSubtree(size_t(isolatedNode), isInSubtree);
+        const auto &hierarchy = scene.hierarchy;
+        scene.isolatedDraws.reserve(scene.drawBoundsMin.size());
+        for (const auto flatIdx : hierarchy.meshNodes()) {
+          const auto &range =
+              upload.meshToPrimitives[hierarchy.mesh(flatIdx)];
+          scene.isolatedDraws.insert(
+              end(scene.isolatedDraws), range.count, isInSubtree[flatIdx]);
+        }
+      }
+      framesToDraw = settleFrameCount;
+      hasFrameChanged = true;
+    }
+    // Sampled frames are drawn whatever the input, as are the frames timing
+    // the buckets of costAttribution
+    if (sceneTree.isSampling() || (costAttribution && isModelLoaded)) {
+      framesToDraw = std::max(framesToDraw, 1);
+      hasFrameChanged = true;
+    }
+    // Frames differ while the scene streams in
+    if (!isModelLoaded || !upload.done() ||
+        scene.textureStreamer.stats().pendingLevelCount ||
+        scene.virtualTextures.stats().pendingPageCount) {
+      hasFrameChanged = true;
+    }
+    if (accumulation && hasFrameChanged) {
+      accumulation->reset();
+      hasFrameChanged = false;
+    }
+    // With the depth pre-pass, renderScene measures the GPU time of each
+    // pass instead (GPU scopes cannot be nested), unless it draws several
+    // views
+    const auto timePasses = isModelLoaded && viewCount == 1 &&
+                            scene.depthPrepass && programs.hasDepthPrepass;
+    {
+      Profiler::CPUScope cpuScope{profiler, "Scene"};
+      std::unique_ptr<Profiler::GPUScope> gpuScope;
+      if (!timePasses) {
+        gpuScope = std::make_unique<Profiler::GPUScope>(profiler, "Scene");
+      }
+      if (temporalAA) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, temporalAA->framebuffer());
+      } else if (dynamicResolution) {
+        glBindFramebuffer(
+            GL_DRAW_FRAMEBUFFER, dynamicResolution->framebuffer());
+      } else if (accumulation) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, accumulation->framebuffer());
+      } else if (postProcessing) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, postProcessing->framebuffer());
+      } else if (sceneTarget) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, sceneTarget->framebuffer());
+      }
+      const auto frameProjMatrix =
+          temporalAA     ? temporalAA->jitter(projMatrix)
+          : accumulation ? accumulation->jitter(projMatrix)
+                         : projMatrix;
+      // The converged average is presented as is
+      if (viewCount > 1) {
+        drawViews(views);
+      } else if (!accumulation || !accumulation->isConverged()) {
+        drawScene(camera, frameProjMatrix, &profiler);
+      }
+      if (temporalAA) {
+        temporalAA->resolve(programs.resolveTemporalAA,
+            frameProjMatrix * camera.getViewMatrix());
+      } else if (dynamicResolution) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        dynamicResolution->upscale();
+      } else if (accumulation) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        if (accumulation->isConverged()) {
+          accumulation->present();
+        } else {
+          accumulation->accumulate(programs.accumulate);
+        }
+      } else if (sceneTarget) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        sceneTarget->blitColor();
+      }
+    }
+    // Measured by step, outside of the scene scope
+    if (postProcessing) {
+      Profiler::CPUScope cpuScope{profiler, "Post-processing"};
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+      postProcessing->process(programs.postProcessing,
+          m_options.postProcessingSettings,
+          framePacer.frameTime() * 1e-3f, profiler, texturePool);
+    }
+    if (isScreenshotRequested) {
+      isScreenshotRequested = false;
+      takeScreenshot(camera, projMatrix);
+    }
+    // The rates of the next frame follow this one, as displayed
+    if (m_options.variableRateShading) {
+      const auto &settings = m_options.shadingRateSettings;
+      {
+        Profiler::Scope scope{profiler, "Shading rate"};
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        programs.shadingRate.update(programs.updateShadingRate,
+            size_t(m_nWindowWidth), size_t(m_nWindowHeight),
+            settings.varianceThreshold);
+      }
+      if (settings.showRates) {
+        programs.shadingRate.drawRates(programs.showShadingRate);
+      }
+    }
+    texturePool.endFrame();
+    // The passes are measured separately with the depth pre-pass
+    const auto sceneGpuTime =
+        timePasses ? std::max(profiler.getGPUTime("Depth pre-pass"), 0.f) +
+                         profiler.getGPUTime("Main pass")
+                   : profiler.getGPUTime("Scene");
+    if (dynamicResolution) {
+      dynamicResolution->update(sceneGpuTime);
+    }
+    if (sceneTree.isSampling()) {
+      sceneTree.addGpuSample(sceneGpuTime);
+    }
+
+    // GUI code:
+    const auto guiTime = glfwGetTime();
+    const auto buildGui =
+        isGuiVisible &&
+        (guiFramesToBuild > 0 || m_options.guiRefreshRate <= 0.f ||
+            guiTime - lastGuiBuildTime >= 1. / m_options.guiRefreshRate);
+    if (buildGui) {
+      imguiNewFrame();
+      guiFramesToBuild = std::max(guiFramesToBuild - 1, 0);
+      lastGuiBuildTime = guiTime;
+
+      ImGui::Begin("GUI");
+      if (framePacer.latency() >= 0.f) {
+        ImGui::Text("Frame %.2f ms, input to GPU latency %.2f ms",
+            framePacer.frameTime(), framePacer.latency());
+      } else {
+        ImGui::Text("Frame %.2f ms", framePacer.frameTime());
+      }
+      if (reloading) {
+        ImGui::Text("Reloading %s", m_gltfFilePath.filename().string().c_str());
+      }
+      if (uploading.valid()) {
+        ImGui::Text("Uploading %s from the loader thread (%.1f s)",
+            m_gltfFilePath.filename().string().c_str(),
+            glfwGetTime() - loadingStartTime);
+        ImGui::ProgressBar(0.f, ImVec2(-1, 0), "Uploading");
+      } else if (!isModelLoaded) {
+        ImGui::Text("Parsing %s (%.1f s)",
+            m_gltfFilePath.filename().string().c_str(),
+            glfwGetTime() - loadingStartTime);
+        ImGui::ProgressBar(0.f, ImVec2(-1, 0), "Parsing");
+      } else if (!upload.done()) {
+        if (upload.nextMeshIdx < upload.meshToPrimitives.size()) {
+          ImGui::Text("Uploading meshes %zu / %zu", upload.nextMeshIdx,
+              upload.meshToPrimitives.size());
+        } else if (upload.nextRefinedMeshIdx <
+                   upload.meshToPrimitives.size()) {
+          ImGui::Text("Refining meshes %zu / %zu", upload.nextRefinedMeshIdx,
+              upload.meshToPrimitives.size());
+        } else {
+          ImGui::Text("Uploading images %zu / %zu", upload.nextImageIdx,
+              upload.imagesToUpload.size());
+        }
+        ImGui::ProgressBar(upload.totalBytes
+                               ? float(upload.uploadedBytes) / upload.totalBytes
+                               : 0.f);
+      }
+      if (isModelLoaded) {
+        ImGui::Text("Visible primitives: %zu / %zu", drawnPrimitiveCount,
+            scene.drawBoundsMin.size());
+        ImGui::Text("BVH: %zu nodes, built in %.1f ms", scene.bvh.nodeCount(),
+            scene.bvhBuildTime);
+        if (!upload.imagesToUpload.empty()) {
+          size_t textureBytes = 0, compressedCount = 0;
+          for (const auto &texture : upload.images) {
+            textureBytes += texture.byteSize();
+            compressedCount += texture.isCompressed() ? 1 : 0;
+          }
+          ImGui::Text("Textures: %zu images (%zu compressed), %.1f MiB",
+              upload.imagesToUpload.size(), compressedCount,
+              textureBytes / (1024. * 1024.));
+        }
+        if (scene.textureStreamer.imageCount()) {
+          const auto &streamer = scene.textureStreamer;
+          const auto &stats = streamer.stats();
+          ImGui::Text("Streamed textures: %.1f / %.1f MiB",
+              stats.residentBytes / (1024. * 1024.),
+              streamer.budget() / (1024. * 1024.));
+          ImGui::ProgressBar(
+              streamer.budget() ? float(stats.residentBytes) / streamer.budget()
+                                : 0.f);
+          ImGui::Text("Resident levels: %zu / %zu, %zu / %zu images complete",
+              stats.residentLevelCount, stats.levelCount,
+              stats.fullyResidentCount, streamer.imageCount());
+          ImGui::Text("Visible images: %zu, %zu levels pending, %zu evicted",
+              stats.requestedCount, stats.pendingLevelCount,
+              stats.evictedLevelCount);
+        }
+        if (!scene.virtualTextures.empty()) {
+          const auto &virtualTextures = scene.virtualTextures;
+          const auto &stats = virtualTextures.stats();
+          ImGui::Text("Virtual textures: %zu in %zu caches, %.1f / %.1f MiB",
+              virtualTextures.textureCount(), virtualTextures.cacheCount(),
+              stats.cacheBytes / (1024. * 1024.),
+              virtualTextures.budget() / (1024. * 1024.));
+          ImGui::ProgressBar(stats.slotCount ? float(stats.residentPageCount) /
+                                                   stats.slotCount
+                                             : 0.f);
+          ImGui::Text("Resident pages: %zu / %zu slots, %zu pages",
+              stats.residentPageCount, stats.slotCount, stats.pageCount);
+          ImGui::Text("Requested pages: %zu, %zu pending, %zu loaded, "
+                      "%zu evicted",
+              stats.requestedPageCount, stats.pendingPageCount,
+              stats.loadedPageCount, stats.evictedPageCount);
+        }
+        if (scene.hasMaterials) {
+          const auto &materials = scene.materials;
+          if (materials.isBindless()) {
+            ImGui::Text("Materials: %zu, %zu bindless textures",
+                materials.materialCount(), materials.textureCount());
+          } else {
+            ImGui::Text("Materials: %zu, %zu textures in %zu arrays",
+                materials.materialCount(), materials.textureCount(),
+                materials.arrayCount());
+            if (materials.downscaledTextureCount()) {
+              ImGui::Text("Downscaled textures: %zu",
+                  materials.downscaledTextureCount());
+            }
+          }
+          ImGui::Text("Samplers: %zu", materials.samplerCount());
+        }
+        if (!scene.skins.empty()) {
+          ImGui::Text("Skins: %zu, %zu joints, skinned by the %s",
+              scene.skins.skinCount(), scene.skins.jointCount(),
+              programs.hasSkinningPrepass ? "pre-pass" : "vertex shader");
+        }
+        if (!scene.lights.empty()) {
+          ImGui::Text("Lights: %zu (%zu directional), %ux%ux%u clusters",
+              scene.lights.lightCount(), scene.lights.directionalCount(),
+              LightClusters::GRID_WIDTH, LightClusters::GRID_HEIGHT,
+              LightClusters::GRID_DEPTH);
+        }
+        if (!scene.morphs.empty()) {
+          ImGui::Text("Morphed meshes: %zu, %zu deltas, %zu blended",
+              scene.morphs.meshCount(), scene.morphs.deltaCount(),
+              scene.morphs.blendedMeshCount());
+        }
+        if (m_options.optimizeIndices) {
+          ImGui::Text("Vertex cache ACMR: %.3f before, %.3f after",
+              scene.acmrBefore, scene.acmrAfter);
+        }
+        if (pickedDrawIdx >= 0) {
+          ImGui::Text("Picked primitive %d at distance %.3f", pickedDrawIdx,
+              pickedDistance);
+          // Draws follow the primitives of the mesh nodes
+          const auto &compact = scene.compact;
+          auto drawIdx = size_t(pickedDrawIdx);
+          for (const auto flatIdx : scene.hierarchy.meshNodes()) {
+            const auto meshIdx = scene.hierarchy.mesh(flatIdx);
+            const auto &mesh = compact.mesh(meshIdx);
+            if (drawIdx < mesh.primitiveCount) {
+              const auto material = compact.material(
+                  compact.primitive(meshIdx, drawIdx).material);
+              ImGui::Text("Mesh \"%s\", material \"%s\"",
+                  compact.string(mesh.name),
+                  compact.string(
+                      material ? material->name : StringInterner::EMPTY));
+              break;
+            }
+            drawIdx -= mesh.primitiveCount;
+          }
+        } else {
+          ImGui::Text("Right click to pick a primitive");
+        }
+      }
+      if (dynamicResolution) {
+        auto targetTime = dynamicResolution->targetTime();
+        if (ImGui::SliderFloat("Target scene ms", &targetTime, 1.f, 50.f)) {
+          dynamicResolution->setTargetTime(targetTime);
+        }
+        const auto size = dynamicResolution->viewportSize();
+        ImGui::Text("Scene resolution: %dx%d (%.0f%%)", size.x, size.y,
+            100.f * dynamicResolution->scale());
+      }
+      if (accumulation) {
+        ImGui::Text("Accumulated frames: %zu / %zu",
+            accumulation->accumulatedCount(), accumulation->frameCount());
+      }
+      if (postProcessing && ImGui::CollapsingHeader("Post-processing")) {
+        auto &settings = m_options.postProcessingSettings;
+        ImGui::Checkbox("Auto-exposure", &settings.autoExposure);
+        ImGui::SliderFloat(
+            "Exposure compensation", &settings.exposureCompensation, -4.f, 4.f);
+        ImGui::SliderFloat(
+            "Bloom threshold", &settings.bloomThreshold, 0.f, 4.f);
+        ImGui::SliderFloat("Bloom", &settings.bloomIntensity, 0.f, 0.5f);
+        ImGui::SliderFloat("Saturation", &settings.saturation, 0.f, 2.f);
+        ImGui::SliderFloat("Contrast", &settings.contrast, 0.5f, 1.5f);
+        const auto &frameGraph = postProcessing->frameGraph();
+        ImGui::Text("Passes: %zu, %zu culled", frameGraph.executedPassCount(),
+            frameGraph.culledPassCount());
+        ImGui::Text("Transient textures: %.1f MB peak, %.1f MB pooled",
+            frameGraph.peakBytes() / (1024. * 1024.),
+            texturePool.byteCount() / (1024. * 1024.));
+      }
+      if (m_options.variableRateShading &&
+          ImGui::CollapsingHeader("Variable rate shading")) {
+        auto &settings = m_options.shadingRateSettings;
+        ImGui::Checkbox("Coarse shading", &settings.enabled);
+        ImGui::SliderFloat("Variance threshold", &settings.varianceThreshold,
+            1e-5f, 1e-2f, "%.5f", 3.f);
+        ImGui::Checkbox("Show shading rates", &settings.showRates);
+        ImGui::Text("Scene: %.2f ms, shading rate: %.2f ms", sceneGpuTime,
+            profiler.getGPUTime("Shading rate"));
+      }
+      if (!m_environment.empty()) {
+        ImGui::SliderFloat(
+            "Environment", &m_options.environmentIntensity, 0.f, 4.f);
+      }
+      if (programs.hasPointClouds && !scene.pointClouds.empty() &&
+          ImGui::CollapsingHeader("Point clouds")) {
+        const auto &pointClouds = scene.pointClouds;
+        // In millions of points
+        auto pointBudget = 1e-6f * float(m_options.pointBudget);
+        if (ImGui::SliderFloat(
+                "Point budget (M)", &pointBudget, 0.1f, 100.f, "%.1f", 2.f)) {
+          m_options.pointBudget = size_t(1e6f * pointBudget);
+        }
+        ImGui::SliderFloat(
+            "Max point size", &m_options.maxPointSize, 1.f, 32.f);
+        ImGui::SliderFloat("Line width", &m_options.lineWidth, 1.f, 16.f);
+        ImGui::Text("Points: %zu / %zu drawn, %zu nodes",
+            pointClouds.drawnPointCount(), pointClouds.pointCount(),
+            pointClouds.drawnNodeCount());
+        ImGui::Text("Segments: %zu / %zu drawn",
+            pointClouds.drawnSegmentCount(), pointClouds.segmentCount());
+      }
+      if (scene.hasIndirectDraws) {
+        ImGui::Text("Indirect draws: %zu commands, %zu calls%s%s",
+            scene.indirectDraws.drawCount(), scene.indirectDraws.batchCount(),
+            scene.indirectDraws.isVertexPulling() ? ", vertex pulling" : "",
+            usesVisibilityBuffer() ? ", visibility buffer" : "");
+      } else if (isModelLoaded && m_options.useInstancing) {
+        ImGui::Text("Instanced draws: %zu draws, %zu calls",
+            scene.instancedDraws.drawCount(),
+            scene.instancedDraws.batchCount());
+        if (programs.hasImpostors && !scene.impostors.empty()) {
+          ImGui::SliderFloat(
+              "Impostor pixels", &m_options.impostorPixelSize, 1.f, 256.f);
+          ImGui::Text("Impostors: %zu primitives, %zu instances drawn",
+              scene.impostors.size(), programs.impostorInstanceCount);
+        }
+        if (!scene.vertexAnimations.empty()) {
+          ImGui::Text("Vertex animations: %zu clips",
+              scene.vertexAnimations.clips().size());
+        }
+      } else if (isModelLoaded) {
+        if (programs.hasDepthPrepass) {
+          ImGui::Checkbox("Depth pre-pass", &scene.depthPrepass);
+          if (scene.lights.directionalCount() && programs.readsLights) {
+            const auto &shadowMaps = programs.shadowMaps;
+            ImGui::Checkbox("Shadows", &scene.shadows);
+            ImGui::Text("Shadow cascades drawn: %zu / %zu, %zu in total",
+                shadowMaps.drawnCascadeCount(),
+                CascadedShadowMaps::CASCADE_COUNT,
+                shadowMaps.totalDrawnCascadeCount());
+          }
+          if (scene.lights.lightCount() > scene.lights.directionalCount() &&
+              programs.readsLights) {
+            const auto &shadowAtlas = programs.shadowAtlas;
+            ImGui::Checkbox("Local shadows", &scene.localShadows);
+            auto budget = int(m_options.localShadowBudget);
+            if (ImGui::SliderInt("Shadow views per frame", &budget, 0, 36)) {
+              m_options.localShadowBudget = size_t(budget);
+            }
+            ImGui::Text("Local shadows: %zu lights, %zu views drawn, %zu in "
+                        "total",
+                shadowAtlas.shadowedLightCount(),
+                shadowAtlas.drawnViewCount(),
+                shadowAtlas.totalDrawnViewCount());
+          }
+          if (programs.hasAmbientOcclusion && scene.depthPrepass) {
+            ImGui::SliderFloat("Occlusion radius",
+                &m_options.ambientOcclusionRadius, 0.01f, 5.f, "%.2f", 2.f);
+            ImGui::Text("Ambient occlusion: %zu accumulated frames",
+                programs.ambientOcclusion.accumulatedFrameCount());
+          }
+          if (timePasses) {
+            ImGui::Text("Depth pre-pass %.3f ms, main pass %.3f ms",
+                profiler.getGPUTime("Depth pre-pass"),
+                profiler.getGPUTime("Main pass"));
+          } else {
+            ImGui::Text("Scene %.3f ms", profiler.getGPUTime("Scene"));
+          }
+        }
+        ImGui::Text("State changes: %zu per frame", programs.stateChangeCount);
+        ImGui::Text("Triangles: %zu (%zu saved by LODs)",
+            programs.triangleCount, programs.lodSavedTriangleCount);
+        if (occlusionQueries) {
+          ImGui::Text("Occlusion queries: %zu of %zu groups tested",
+              occlusionQueries->testedGroupCount(),
+              occlusionQueries->groupCount());
+        }
+      }
+      if (isModelLoaded) {
+        const auto &frameData = programs.frameData;
+        ImGui::Text("Frame data: %.1f / %.1f KiB, %zu stalls",
+            frameData.frameSize() / 1024.f, frameData.regionSize() / 1024.f,
+            frameData.stallCount());
+      }
+      if (ImGui::CollapsingHeader("Render path")) {
+        const char *pathNames[] = {"Per draw", "Instanced", "Indirect"};
+        // Animations are played with indirect draws only if the scene was
+        // loaded with them and gpuTransforms
+        const auto canSwitchToIndirect =
+            isModelLoaded && scene.animations.empty();
+        if (ImGui::BeginCombo(
+                "Draws", pathNames[size_t(requestedRenderPath)])) {
+          for (size_t i = 0; i < 3; ++i) {
+            const auto path = RenderPath(i);
+            const auto flags =
+                path == RenderPath::Indirect && !canSwitchToIndirect &&
+                        getRenderPath() != RenderPath::Indirect
+                    ? ImGuiSelectableFlags_Disabled
+                    : ImGuiSelectableFlags_None;
+            if (ImGui::Selectable(
+                    pathNames[i], path == requestedRenderPath, flags)) {
+              requestedRenderPath = path;
+            }
+          }
+          ImGui::EndCombo();
+        }
+      }
+      // The G-buffer replaces the fragment shaders with deferred shading
+      if (!m_options.deferredShading &&
+          ImGui::CollapsingHeader("Shading and debug views")) {
+        std::vector<std::string> shadingShaders = {startupFragmentShader};
+        for (const auto *shader : {"materials.fs.glsl", "normals.fs.glsl"}) {
+          if (shader != startupFragmentShader) {
+            shadingShaders.emplace_back(shader);
+          }
+        }
+        for (const auto &shader : shadingShaders) {
+          if (ImGui::RadioButton(
+                  shader.c_str(), m_fragmentShader == shader)) {
+            requestedFragmentShader = shader;
+          }
+        }
+        ImGui::Separator();
+        for (const auto &view : DEBUG_VIEWS) {
+          // The heat map needs costs to show
+          if (!costAttribution &&
+              std::string(view.fragmentShader) == "heat_map.fs.glsl") {
+            continue;
+          }
+          if (ImGui::RadioButton(
+                  view.name, m_fragmentShader == view.fragmentShader)) {
+            requestedFragmentShader = view.fragmentShader;
+          }
+        }
+      }
+      if (ImGui::CollapsingHeader("Camera", ImGuiTreeNodeFlags_DefaultOpen)) {
+        if (ImGui::RadioButton("First person", !useTrackball)) {
+          useTrackball = false;
+        }
+        ImGui::SameLine();
+        if (ImGui::RadioButton("Trackball", useTrackball)) {
+          useTrackball = true;
+        }
+        ImGui::Text("eye: %.3f %.3f %.3f", camera.eye().x, camera.eye().y,
+            camera.eye().z);
+        ImGui::Text("center: %.3f %.3f %.3f", camera.center().x,
+            camera.center().y, camera.center().z);
+        ImGui::Text(
+            "up: %.3f %.3f %.3f", camera.up().x, camera.up().y, camera.up().z);
+
+        ImGui::Text("front: %.3f %.3f %.3f", camera.front().x, camera.front().y,
+            camera.front().z);
+        ImGui::Text("left: %.3f %.3f %.3f", camera.left().x, camera.left().y,
+            camera.left().z);
+
+        if (ImGui::Button("CLI camera args to clipboard")) {
+          std::stringstream ss;
+          ss << "--lookat " << camera.eye().x << "," << camera.eye().y << ","
+             << camera.eye().z << "," << camera.center().x << ","
+             << camera.center().y << "," << camera.center().z << ","
+             << camera.up().x << "," << camera.up().y << "," << camera.up().z;
+          const auto str = ss.str();
+          glfwSetClipboardString(m_GLFWHandle.window(), str.c_str());
+        }
+
+        if (!cameraPath.empty()) {
+          ImGui::Checkbox("Play camera path", &isPlayingCameraPath);
+          ImGui::SameLine();
+          ImGui::Text(
+              "%.2f / %.2f s", cameraPathTime, cameraPath.duration());
+        }
+        if (!isRecordingCameraPath) {
+          if (ImGui::Button("Record camera path")) {
+            recordedCameraPath = CameraPath{};
+            isRecordingCameraPath = true;
+          }
+        } else if (ImGui::Button("Stop recording and save")) {
+          isRecordingCameraPath = false;
+          std::string err;
+          if (recordedCameraPath.write(m_options.recordedCameraPath, err)) {
+            std::clog << "Wrote camera path " << m_options.recordedCameraPath
+                      << std::endl;
+          } else {
+            std::cerr << "Error: " << err << std::endl;
+          }
+        }
+
+        // Taken at the start of the next frame
+        if (ImGui::Button("Take screenshot (F12)")) {
+          isScreenshotRequested = true;
+          framesToDraw = std::max(framesToDraw, settleFrameCount);
+        }
+        ImGui::SliderFloat(
+            "Screenshot scale", &screenshotScale, 0.5f, 4.f, "%.2fx");
+        if (screenshots.pendingCount()) {
+          ImGui::Text("Screenshots pending: %zu", screenshots.pendingCount());
+        }
+
+        // Frame the bounds of the scene or of the picked primitive (F)
+        glm::vec3 bboxMin, bboxMax;
+        if (isModelLoaded && getSceneBounds(scene, bboxMin, bboxMax) &&
+            ImGui::Button("Frame scene")) {
+          frameBounds(bboxMin, bboxMax, projMatrix);
+        }
+        if (getPickedBounds(bboxMin, bboxMax) &&
+            ImGui::Button("Frame picked primitive")) {
+          frameBounds(bboxMin, bboxMax, projMatrix);
+        }
+      }
+      if (isModelLoaded && scene.model.scenes.size() > 1 &&
+          ImGui::CollapsingHeader("Scenes")) {
+        const auto &scenes = scene.model.scenes;
+        const auto getSceneName = [&](int sceneIdx) {
+          return scenes[sceneIdx].name.empty()
+                     ? "Scene " + std::to_string(sceneIdx)
+                     : scenes[sceneIdx].name;
+        };
+        const auto canSwitch = upload.done() && !reloadedScene &&
+                               scene.skins.empty() && scene.morphs.empty();
+        const auto current = scene.model.defaultScene;
+        if (canSwitch &&
+            ImGui::BeginCombo("Scene", getSceneName(current).c_str())) {
+          for (size_t i = 0; i < scenes.size(); ++i) {
+            if (ImGui::Selectable(getSceneName(int(i)).c_str(),
+                    int(i) == current) &&
+                int(i) != current) {
+              // The simulation reads the hierarchy, showScene restarts it
+              poseSimulation.reset();
+              if (switchScene(scene, int(i))) {
+                pickedDrawIdx = -1;
+                if (occlusionQueries) {
+                  occlusionQueries = std::make_unique<OcclusionQueries>();
+                }
+                programs.shadowMaps.invalidate();
+                programs.shadowAtlas.invalidate();
+                framesToDraw = settleFrameCount;
+                hasFrameChanged = true;
+              }
+              showScene();
+            }
+          }
+          ImGui::EndCombo();
+        }
+        if (!scene.skins.empty() || !scene.morphs.empty()) {
+          ImGui::Text("Skinned and morphed models keep their scene");
+        } else if (scene.switchTime > 0.) {
+          ImGui::Text("Switched in %.3f ms", scene.switchTime);
+        }
+      }
+      if (isModelLoaded && !scene.variants.empty() &&
+          ImGui::CollapsingHeader("Material variants")) {
+        auto &variants = scene.variants;
+        const auto getVariantName = [&](int variantIdx) {
+          return variantIdx >= 0 ? variants.name(size_t(variantIdx)).c_str()
+                                 : "None";
+        };
+        if (ImGui::BeginCombo(
+                "Variant", getVariantName(variants.selected()))) {
+          for (auto i = -1; i < int(variants.variantCount()); ++i) {
+            if (ImGui::Selectable(
+                    getVariantName(i), i == variants.selected()) &&
+                variants.select(i, scene.compact, upload.primitives)) {
+              // Indirect draws are grouped by alpha mode, and meshlets
+              // culled by the sides of their material
+              scene.hasIndirectDraws = false;
+              programs.shadowMaps.invalidate();
+              programs.shadowAtlas.invalidate();
+              framesToDraw = settleFrameCount;
+              hasFrameChanged = true;
+            }
+          }
+          ImGui::EndCombo();
+        }
+        ImGui::Text("%zu primitives mapped", variants.mappedPrimitiveCount());
+      }
+      if (isModelLoaded && !scene.animations.empty() &&
+          (!m_options.useIndirectDraws || m_options.gpuTransforms) &&
+          ImGui::CollapsingHeader(
+              "Animation", ImGuiTreeNodeFlags_DefaultOpen)) {
+        const auto &animations = scene.animations;
+        const auto selected = size_t(std::max(scene.animation, 0));
+        if (ImGui::BeginCombo(
+                "Animation", animations.name(selected).c_str())) {
+          for (size_t i = 0; i < animations.animationCount(); ++i) {
+            if (ImGui::Selectable(animations.name(i).c_str(),
+                    int(i) == scene.animation)) {
+              scene.animation = int(i);
+              scene.animationTime = -1.;
+              animationTime = 0.;
+            }
+          }
+          ImGui::EndCombo();
+        }
+        auto isPlaying = scene.animation >= 0 && isAnimationPlaying;
+        if (ImGui::Checkbox("Play", &isPlaying)) {
+          isAnimationPlaying = isPlaying;
+          scene.animation = int(selected);
+        }
+        ImGui::SliderFloat("Speed", &animationSpeed, 0.f, 4.f);
+        if (scene.animation >= 0) {
+          const auto duration = animations.duration(selected);
+          ImGui::Text("Time: %.2f / %.2f s",
+              duration > 0.f ? std::fmod(animationTime, double(duration)) : 0.,
+              duration);
+        }
+        if (poseSimulation) {
+          ImGui::Text("Evaluated on a thread in %.3f ms",
+              poseSimulation->poseTime());
+        }
+      }
+      if (ImGui::CollapsingHeader("Frame times")) {
+        frameTimeline.drawGUI();
+      }
+      if (m_pLoadReport && m_pLoadReport->isFinished() &&
+          ImGui::CollapsingHeader("Load report")) {
+        m_pLoadReport->drawGUI(m_pPreviousLoadReport.get());
+      }
+      if (ImGui::CollapsingHeader("Memory")) {
+        const auto usage = getGLMemoryUsage();
+        const auto modelHeapBytes = getModelHeapBytes(scene.model);
+        drawGLMemoryGUI(usage, modelHeapBytes);
+        const auto &deduplicated = scene.deduplicated;
+        if (deduplicated.meshCount || deduplicated.imageCount) {
+          ImGui::Text("Deduplicated: %zu meshes, %zu images, %.1f MiB",
+              deduplicated.meshCount, deduplicated.imageCount,
+              float(deduplicated.byteCount) / (1 << 20));
+        }
+        if (ImGui::Button("Write memory report")) {
+          std::string err;
+          if (writeMemoryReport(
+                  m_options.memoryReport, usage, modelHeapBytes, err)) {
+            std::clog << "Wrote memory report " << m_options.memoryReport
+                      << std::endl;
+          } else {
+            std::cerr << "Error: " << err << std::endl;
+          }
+        }
+      }
+      if (ImGui::CollapsingHeader("Profiler")) {
+        profiler.drawGUI();
+        if (telemetry) {
+          ImGui::Separator();
+          telemetry->drawGUI();
+        }
+      }
+      if ((m_options.glDebugOutput == GLDebugOutputMode::Performance ||
+              m_options.glDebugOutput == GLDebugOutputMode::Full) &&
+          ImGui::CollapsingHeader("GL performance warnings")) {
+        const auto warnings = getGLPerformanceWarnings();
+        if (warnings.empty()) {
+          ImGui::Text("None reported by the driver");
+        }
+        for (const auto &warning : warnings) {
+          ImGui::TextWrapped("%ux [id=%u] %s", warning.count, warning.id,
+              warning.message.c_str());
+        }
+        if (const auto dropped = getDroppedGLPerformanceWarningCount()) {
+          ImGui::Text("%zu more not recorded", dropped);
+        }
+      }
+      if (costAttribution && costAttribution->bucketCount() &&
+          ImGui::CollapsingHeader("GPU cost attribution")) {
+        // The most expensive buckets measured so far
+        std::vector<size_t> buckets(costAttribution->bucketCount());
+        std::iota(begin(buckets), end(buckets), size_t(0));
+        const auto shownCount = std::min(buckets.size(), size_t(16));
+        std::partial_sort(begin(buckets), begin(buckets) + shownCount,
+            end(buckets), [&](size_t lhs, size_t rhs) {
+              return costAttribution->bucketTime(lhs) >
+                     costAttribution->bucketTime(rhs);
+            });
+        const auto isByNode =
+            costAttribution->buckets() == CostBuckets::TopLevelNodes;
+        ImGui::Text("%zu buckets, one timed per frame", buckets.size());
+        for (size_t i = 0; i < shownCount; ++i) {
+          const auto time = costAttribution->bucketTime(buckets[i]);
+          if (time < 0.f) {
+            break;
+          }
+          const auto key = costAttribution->bucketKey(buckets[i]);
+          if (isByNode) {
+            const auto nodeIdx = scene.hierarchy.node(key);
+            ImGui::Text("%.3f ms: node %d %s", time, nodeIdx,
+                scene.model.nodes[nodeIdx].name.c_str());
+          } else if (key == 0) {
+            ImGui::Text("%.3f ms: default material", time);
+          } else {
+            ImGui::Text("%.3f ms: material %u %s", time, key - 1,
+                scene.model.materials[key - 1].name.c_str());
+          }
+        }
+      }
+      if (isModelLoaded && !scene.hierarchy.empty() &&
+          ImGui::CollapsingHeader("Scene tree")) {
+        ImGui::Text("%zu nodes, F1 hides the GUI", scene.hierarchy.size());
+        // Indirect draws are culled on the GPU, whatever the isolation
+        sceneTree.drawGUI(scene.hierarchy, scene.model,
+            !scene.hasIndirectDraws, costAttribution.get());
+        const auto isolated = sceneTree.isolated();
+        if (isolated >= 0 && size_t(isolated) < scene.hierarchy.size()) {
+          const auto &origin = scene.hierarchy.worldOrigin(size_t(isolated));
+          ImGui::Text("Isolated node %d at %.3f %.3f %.3f",
+              scene.hierarchy.node(size_t(isolated)), origin.x, origin.y,
+              origin.z);
+        }
+      }
+      ImGui::End();
+    }
+
+    if (isGuiVisible) {
+      Profiler::Scope scope{profiler, "ImGui"};
+      if (buildGui) {
+        imguiRenderFrame();
+      } else {
+        imguiDrawFrame();
+      }
+    }
+
+    if (isPlayingCameraPath) {
+      cameraPathTime += m_options.fixedTimeStep;
+      if (cameraPathTime > cameraPath.duration()) {
+        cameraPathTime = 0.;
+      }
+      framesToDraw = settleFrameCount;
+      hasFrameChanged = true;
+    }
+    // Any option of the GUI may change the frame
+    if (buildGui && ImGui::IsAnyItemActive()) {
+      hasFrameChanged = true;
+    }
+
+    const auto isRightButtonPressed =
+        glfwGetMouseButton(m_GLFWHandle.window(), GLFW_MOUSE_BUTTON_RIGHT) ==
+        GLFW_PRESS;
+    GLuint pickedId = GpuPicker::NO_DRAW;
+    auto pickedDepth = 0.f;
+    if (picker.poll(pickedId, pickedDepth)) {
+      // Draws may have changed with a reload since the pick
+      pickedDrawIdx = pickedId == GpuPicker::NO_DRAW ||
+                              pickedId > scene.drawBoundsMin.size()
+                          ? -1
+                          : int(pickedId - 1);
+      // Nearest fragment at the center of the pixel
+      const auto ndcDepth =
+          m_options.reversedZ ? pickedDepth : 2.f * pickedDepth - 1.f;
+      const auto point = pickMatrix * glm::vec4(0, 0, ndcDepth, 1);
+      pickedDistance = glm::distance(glm::vec3(point) / point.w, pickEye);
+      // The trackball orbits around the picked point
+      if (useTrackball && pickedDrawIdx >= 0) {
+        trackballController.setPivot(glm::vec3(point) / point.w);
+      }
+    }
+    if (isModelLoaded && !guiHasFocus && isRightButtonPressed &&
+        !wasRightButtonPressed && !picker.isPending()) {
+      glm::dvec2 cursor;
+      glfwGetCursorPos(m_GLFWHandle.window(), &cursor.x, &cursor.y);
+      int width = 0, height = 0;
+      glfwGetWindowSize(m_GLFWHandle.window(), &width, &height);
+      // Through the view under the cursor
+      auto x = cursor.x / std::max(width, 1);
+      auto pickCamera = camera;
+      auto pickProjMatrix = projMatrix;
+      if (viewCount > 1) {
+        const auto viewIdx = std::min(size_t(x * viewCount), viewCount - 1);
+        x = x * viewCount - double(viewIdx);
+        pickCamera = views.cameras[viewIdx];
+        pickProjMatrix = views.projMatrices[viewIdx];
+      }
+      const auto y = 1. - cursor.y / std::max(height, 1);
+      const auto viewWidth = std::max(m_nWindowWidth / viewCount, size_t(1));
+      const auto pixelMatrix = GpuPicker::getPixelMatrix(x * viewWidth,
+          y * m_nWindowHeight, viewWidth, m_nWindowHeight);
+      if (renderPickPass(scene, programs, pickCamera, pickProjMatrix,
+              pixelMatrix, picker)) {
+        pickMatrix = glm::inverse(
+            pixelMatrix * pickProjMatrix * pickCamera.getViewMatrix());
+        pickEye = pickCamera.eye();
+        // Frames are drawn until the result is read
+        framesToDraw = std::max(framesToDraw, settleFrameCount);
+      } else {
+        // Ray from the eye through the cursor
+        const auto ndc = glm::vec2(2. * x - 1., 2. * y - 1.);
+        const auto farPoint =
+            glm::inverse(pickProjMatrix * pickCamera.getViewMatrix()) *
+            glm::vec4(ndc, 1, 1);
+        const auto origin = pickCamera.eye();
+        const auto direction =
+            glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+        pickedDrawIdx =
+            pickPrimitive(scene, origin, direction, pickedDistance);
+        if (useTrackball && pickedDrawIdx >= 0) {
+          trackballController.setPivot(origin + pickedDistance * direction);
+        }
+      }
+    }
+    wasRightButtonPressed = isRightButtonPressed;
+
+    // Frames are drawn until the screenshots are read
+    screenshots.poll();
+    if (screenshots.pendingCount()) {
+      framesToDraw = std::max(framesToDraw, 1);
+    }
+
+    m_GLFWHandle.swapBuffers(); // Swap front and back buffers
+    framePacer.endFrame();
+    frameTimeline.endFrame();
+    if (framesToDraw > 0) {
+      --framesToDraw;
+    }
+  }
+  if (reloading) {
+    m_glTasks.drainUntilReady(*reloading);
+  }
+
+  if (!m_options.statsOutput.empty()) {
+    std::string err;
+    if (!frameTimeline.write(m_options.statsOutput, err)) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+    std::clog << "Wrote frame timeline " << m_options.statsOutput << " ("
+              << std::min(frameTimeline.frameCount(), FrameTimeline::CAPACITY)
+              << " frames)" << std::endl;
+  }
+
+  return 0;
+}
+
+size_t ViewerApplication::compressImages(tinygltf::Model &model) const
+{
+  if (!m_options.compressTextures) {
+    return 0;
+  }
+  const auto startTime = std::chrono::steady_clock::now();
+  const auto compressedCount =
+      compressModelImages(model, getImageUsages(model));
+  if (compressedCount) {
+    std::clog << "Compressed " << compressedCount << " images in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - startTime)
+                     .count()
+              << " ms" << std::endl;
+  }
+  return compressedCount;
+}
+
+bool ViewerApplication::loadViewedScene(Scene &scene)
+{
+  if (isRemoteUri(m_gltfFilePath.string())) {
+    TRACE_ZONE("Fetch remote file");
+    const auto startTime = std::chrono::steady_clock::now();
+    RemoteFetchStats stats;
+    std::string err;
+    {
+      LoadReport::Scope scope{m_pLoadReport.get(), LoadPhase::FileIo};
+      if (!fetchRemoteGlb(m_gltfFilePath.string(), m_localGltfFilePath,
+              m_options.remoteConnectionCount, stats, err)) {
+        std::cerr << "Unable to fetch " << m_gltfFilePath << ": " << err
+                  << std::endl;
+        return false;
+      }
+    }
+    if (m_pLoadReport) {
+      m_pLoadReport->addBytesRead(LoadPhase::FileIo, stats.fetchedBytes);
+    }
+    std::clog << "Fetched " << (stats.fetchedBytes >> 10) << " KiB of "
+              << m_gltfFilePath << " in " << stats.requestCount
+              << " requests, "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - startTime)
+                     .count()
+              << " ms (default scene: " << (stats.neededBytes >> 10)
+              << " KiB of " << (stats.fileSize >> 10) << " KiB)"
+              << std::endl;
+  }
+  if (!loadGltfFile(m_localGltfFilePath, scene)) {
+    return false;
+  }
+  if (m_options.watchModel) {
+    scene.contentHashes = computeContentHashes(scene.model, scene.buffers);
+  }
+  return true;
+}
+
+bool ViewerApplication::loadGltfFile(const fs::path &path, Scene &scene)
+{
+  TRACE_ZONE("Load glTF file");
+  auto &model = scene.model;
+  auto &buffers = scene.buffers;
+  const auto startTime = std::chrono::steady_clock::now();
+  const auto getEllapsedTime = [&]() {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime)
+        .count();
+  };
+
+  scene.deferred = DeferredResources();
+  scene.deduplicated = DeduplicatedContent();
+  scene.isReadFromCache = false;
+  uint64_t cacheKey = 0;
+  fs::path cachePath;
+  // Held until the cache is written
+  std::unique_ptr<CacheEntryLock> pCacheLock;
+  const auto report = m_pLoadReport.get();
+  const auto readCache = [&]() {
+    {
+      // Decompressing the cache counts as reading it
+      LoadReport::Scope scope{report, LoadPhase::FileIo};
+      if (!readSceneCache(cachePath, cacheKey, model, scene.mapping, buffers,
+              scene.bboxMin, scene.bboxMax, scene.derived)) {
+        return false;
+      }
+    }
+    if (report) {
+      report->addBytesRead(LoadPhase::FileIo, scene.mapping.size());
+      report->setCacheResult(LoadCacheResult::Hit);
+    }
+    std::clog << "Loaded scene cache " << cachePath << std::endl;
+    scene.isReadFromCache = true;
+    scene.parseTime = getEllapsedTime();
+    scene.hierarchy = SceneHierarchy{model, buffers};
+    scene.compact = CompactModel{model};
+    scene.materialPermutations = MaterialPermutations{scene.compact};
+    scene.variants = MaterialVariants{model};
+    scene.pointClouds = PointClouds();
+    if (m_options.pointClouds) {
+      scene.pointClouds.build(model, buffers);
+      scene.pointClouds.setInstances(scene.hierarchy);
+    }
+    const auto compressedCount = compressImages(model);
+    if (buildDerivedGeometry(scene) || compressedCount) {
+      // The cache lacked some derived geometry or compressed images, the
+      // new one reads the model from the mapping of the previous one
+      std::string cacheErr;
+      if (writeSceneCache(cachePath, cacheKey, model, buffers,
+              scene.bboxMin, scene.bboxMax, scene.derived, cacheErr,
+              m_options.sceneCacheCompression)) {
+        std::clog << "Wrote scene cache " << cachePath << std::endl;
+      } else {
+        std::cerr << "Warning: " << cacheErr << std::endl;
+      }
+    }
+    return true;
+  };
+  if (m_options.useSceneCache) {
+    cacheKey = computeSceneCacheKey(path);
+    cachePath = getSceneCachePath(cacheKey, m_options.sceneCacheDirectory);
+    scene.cachePath = cachePath;
+    scene.cacheKey = cacheKey;
+    if (readCache()) {
+      return true;
+    }
+    // Another viewer may be writing the cache: wait for it rather than
+    // parsing the file too
+    pCacheLock = std::make_unique<CacheEntryLock>(cachePath);
+    if (readCache()) {
+      return true;
+    }
+    if (report) {
+      report->setCacheResult(LoadCacheResult::Miss);
+    }
+  }
+
+  std::string err;
+  std::string warn;
+
+  // 0 decodes images with the jobs of the job system, the background ones on
+  // loader threads
+  const auto imageThreads = m_options.imageDecodingThreads;
+  ParallelImageDecoder imageDecoder;
+  const auto pImageDecoder =
+      (imageThreads ? imageThreads : getJobSystem().threadCount()) > 1
+          ? &imageDecoder
+          : nullptr;
+
+  bool ret = false;
+  {
+    // The files read while parsing count as file I/O
+    LoadReport::Scope scope{report, LoadPhase::JsonParse};
+    if (m_options.useMemoryMappedGlb && path.extension() == ".glb") {
+      ret = loadMappedGlbFile(path, model, scene.mapping, buffers, err, warn,
+          pImageDecoder, report);
+    } else {
+      ret = readGltfFile(path, model, buffers, err, warn, pImageDecoder,
+          m_options.deferUnusedResources ? &scene.deferred : nullptr,
+          m_options.prefetchedFileCount, report);
+    }
+  }
+  scene.parseTime = getEllapsedTime();
+  if (ret && pImageDecoder) {
+    LoadReport::Scope scope{report, LoadPhase::ImageDecode};
+    ret = pImageDecoder->decode(model, imageThreads, err, warn);
+    scene.decodeTime = getEllapsedTime() - scene.parseTime;
+  }
+  if (ret && report) {
+    uint64_t imageBytes = 0;
+    for (const auto &image : model.images) {
+      imageBytes += image.image.size();
+    }
+    // Images decoded by tinygltf are too, in the time of the parse
+    report->addBytesDecoded(
+        pImageDecoder ? LoadPhase::ImageDecode : LoadPhase::JsonParse,
+        imageBytes);
+  }
+  if (ret) {
+    LoadReport::Scope scope{report, LoadPhase::BufferDecode};
+    const auto getBufferBytes = [&]() {
+      uint64_t byteCount = 0;
+      for (const auto &buffer : buffers) {
+        byteCount += buffer.size;
+      }
+      return byteCount;
+    };
+    const auto encodedBytes = getBufferBytes();
+    ret = decodeCompressedBufferViews(model, buffers, err, warn);
+    if (report) {
+      report->addBytesDecoded(
+          LoadPhase::BufferDecode, getBufferBytes() - encodedBytes);
+    }
+  }
+
+  if (!warn.empty()) {
+    std::cerr << "Warning: " << warn << std::endl;
+  }
+
+  if (!err.empty()) {
+    std::cerr << "Error: " << err << std::endl;
+  }
+
+  if (!ret) {
+    std::cerr << "Failed to parse glTF file" << std::endl;
+    return false;
+  }
+  if (scene.deferred.deferredBufferCount || scene.deferred.deferredImageCount) {
+    std::clog << "Deferred " << scene.deferred.deferredBufferCount
+              << " buffers and " << scene.deferred.deferredImageCount
+              << " images not used by the default scene" << std::endl;
+  }
+
+  if (model.defaultScene < 0 && !model.scenes.empty()) {
+    model.defaultScene = 0;
+  }
+  ImportPassOptions importOptions;
+  importOptions.hashContent = m_options.deduplicateContent;
+  const auto imported = runImportPass(model, buffers, importOptions);
+  std::clog << "Imported " << imported.vertexCount << " vertices and "
+            << imported.triangleCount << " triangles" << std::endl;
+  if (imported.degenerateTriangleCount) {
+    std::clog << "Removed " << imported.degenerateTriangleCount
+              << " degenerate triangles" << std::endl;
+  }
+  if (imported.boundedAccessorCount) {
+    std::clog << "Computed the bounds of " << imported.boundedAccessorCount
+              << " position accessors" << std::endl;
+  }
+  if (imported.normalCount) {
+    std::clog << "Generated normals of " << imported.normalCount
+              << " primitives" << std::endl;
+  }
+  if (m_options.deduplicateContent) {
+    scene.deduplicated = deduplicateModel(model, imported.hashes);
+    const auto &deduplicated = scene.deduplicated;
+    if (deduplicated.meshCount || deduplicated.imageCount) {
+      std::clog << "Merged " << deduplicated.meshCount << " meshes and "
+                << deduplicated.imageCount << " images with a copy ("
+                << (deduplicated.byteCount >> 10) << " KB)" << std::endl;
+    }
+  }
+  if (m_options.staticBatching) {
+    // Instanced draws are ignored with indirect draws
+    const auto batches = batchStaticNodes(model, buffers,
+        m_options.useInstancing && !m_options.useIndirectDraws);
+    if (batches.nodeCount) {
+      std::clog << "Batched " << batches.primitiveCount
+                << " primitives of " << batches.nodeCount
+                << " static nodes in " << batches.batchCount << " draws"
+                << std::endl;
+    }
+  }
+  compressImages(model);
+
+  scene.hierarchy = SceneHierarchy{model, buffers};
+  scene.compact = CompactModel{model};
+  scene.materialPermutations = MaterialPermutations{scene.compact};
+  scene.variants = MaterialVariants{model};
+  // scene is new: vertexAnimations and pointClouds hold GL objects, which the
+  // loader thread must not destroy
+  if (m_options.pointClouds) {
+    scene.pointClouds.build(model, buffers);
+    scene.pointClouds.setInstances(scene.hierarchy);
+  }
+  // Scene caches have no skins, the clips are only read with the file
+  if (m_options.vertexAnimations && m_options.useInstancing &&
+      !m_options.useIndirectDraws && !model.skins.empty()) {
+    const auto animationsPath = getVertexAnimationsPath(path);
+    std::string animationsErr;
+    if (scene.vertexAnimations.read(
+            animationsPath, computeSceneCacheKey(path), animationsErr)) {
+      std::clog << "Loaded " << scene.vertexAnimations.clips().size()
+                << " vertex animation clips from " << animationsPath
+                << std::endl;
+    } else if (!animationsErr.empty()) {
+      std::cerr << "Warning: " << animationsErr << std::endl;
+    } else {
+      std::cerr << "Warning: no vertex animations up to date in "
+                << animationsPath << ", bake them with gltf-optimize --vat"
+                << std::endl;
+    }
+  }
+  {
+    LoadReport::Scope scope{report, LoadPhase::Bounds};
+    computeSceneBounds(model, buffers, scene.bboxMin, scene.bboxMax,
+        m_options.exactSceneBounds);
+  }
+  scene.derived = {};
+  buildDerivedGeometry(scene);
+
+  if (m_options.useSceneCache && canWriteSceneCache(model)) {
+    // The cache stores every image
+    for (size_t imageIdx = 0; imageIdx < model.images.size(); ++imageIdx) {
+      resolveDeferredImage(scene, imageIdx);
+    }
+    std::string cacheErr;
+    if (writeSceneCache(cachePath, cacheKey, model, buffers, scene.bboxMin,
+            scene.bboxMax, scene.derived, cacheErr,
+            m_options.sceneCacheCompression)) {
+      std::clog << "Wrote scene cache " << cachePath << std::endl;
+    } else {
+      std::cerr << "Warning: " << cacheErr << std::endl;
+    }
+  }
+
+  return true;
+}
+
+int ViewerApplication::runBatch(const std::vector<BatchJob> &jobs)
+{
+  TRACE_ZONE("Batch");
+  setupDepthTest();
+
+  // Programs of every shader pair are compiled once, all at once
+  using ShaderPair = std::pair<std::string, std::string>;
+  const auto getShaderPair = [&](const BatchJob &job) {
+    return std::make_pair(
+        job.vertexShader.empty() ? m_vertexShader : job.vertexShader,
+        job.fragmentShader.empty() ? m_fragmentShader : job.fragmentShader);
+  };
+  std::map<ShaderPair, size_t> shaderPairToPrograms;
+  std::vector<ShaderPair> shaderPairs;
+  for (const auto &job : jobs) {
+    const auto shaderPair = getShaderPair(job);
+    if (shaderPairToPrograms.emplace(shaderPair, shaderPairs.size()).second) {
+      shaderPairs.emplace_back(shaderPair);
+    }
+  }
+  const auto programs = compileScenePrograms(shaderPairs);
+  loadEnvironment();
+
+  // Jobs of the same model are rendered together so that each model is
+  // loaded once
+  std::vector<size_t> order(jobs.size());
+  std::iota(begin(order), end(order), 0);
+  std::stable_sort(begin(order), end(order), [&](size_t lhs, size_t rhs) {
+    return jobs[lhs].model < jobs[rhs].model;
+  });
+
+  // Images are read back one job late: the GPU renders an image while the
+  // previous one is read back. Images are then encoded, and compared with
+  // their reference, on other threads while the next ones are rendered.
+  const size_t numComponents = 3;
+  const size_t maxPendingEncodings = 2;
+  const auto *fxaaProgram = loadFxaaProgram();
+  std::unique_ptr<ImageRenderer> renderer;
+  std::deque<size_t> pendingJobs;
+  std::deque<std::future<bool>> pendingEncodings;
+  // The GPU time of an image is read with its pixels, once it is finished
+  std::vector<BatchJobResult> results(jobs.size());
+  std::vector<GLuint> timeQueries(jobs.size());
+  glGenQueries(GLsizei(timeQueries.size()), timeQueries.data());
+  const auto tolerance = m_options.referenceTolerance;
+  const auto maxDifferingPixels = m_options.referenceMaxDifferingPixels;
+  auto failureCount = 0;
+  const auto finishOldestEncoding = [&]() {
+    if (!pendingEncodings.front().get()) {
+      ++failureCount;
+    }
+    pendingEncodings.pop_front();
+  };
+  const auto writeOldestImage = [&]() {
+    const auto jobIdx = pendingJobs.front();
+    const auto &job = jobs[jobIdx];
+    auto &result = results[jobIdx];
+    pendingJobs.pop_front();
+    auto pixels = std::make_shared<std::vector<unsigned char>>(
+        renderer->pendingImageSize());
+    renderer->readPixels(pixels->data());
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(timeQueries[jobIdx], GL_QUERY_RESULT, &nanoseconds);
+    result.gpuTime = double(nanoseconds) * 1e-6;
+    if (pendingEncodings.size() == maxPendingEncodings) {
+      finishOldestEncoding();
+    }
+    pendingEncodings.emplace_back(std::async(std::launch::async,
+        [&job, &result, pixels, numComponents, tolerance,
+            maxDifferingPixels]() {
+          std::string err;
+          if (!writePng(job.output, job.width, job.height, numComponents,
+                  pixels->data(), true, err)) {
+            std::cerr << "Error: " << err << std::endl;
+            return false;
+          }
+          result.isRendered = true;
+          if (job.reference.empty()) {
+            return true;
+          }
+          if (!compareWithReference(job, numComponents, pixels->data(), true,
+                  tolerance, maxDifferingPixels, result, err)) {
+            std::cerr << "Error: " << err << std::endl;
+            return false;
+          }
+          return true;
+        }));
+  };
+
+  auto scenes = createModelCache();
+  const auto loadScene = [&](const fs::path &path) {
+    return scenes.get(path, [&](size_t &gpuBytes, size_t &hostBytes) {
+      return loadOfflineScene(path, programs, gpuBytes, hostBytes);
+    });
+  };
+  for (const auto jobIdx : order) {
+    const auto &job = jobs[jobIdx];
+
+    const auto loadStartTime = std::chrono::steady_clock::now();
+    const auto *scene = loadScene(job.model);
+    results[jobIdx].loadTime = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - loadStartTime)
+                                   .count();
+    if (!scene) {
+      std::cerr << "Error: skipping " << job.output << ", unable to load "
+                << job.model << std::endl;
+      ++failureCount;
+      continue;
+    }
+
+    const auto &jobPrograms =
+        programs[shaderPairToPrograms[getShaderPair(job)]];
+
+    // Same projection and default camera as the interactive viewer
+    const auto aspectRatio = float(job.width) / job.height;
+    const auto camera = getOfflineCamera(*scene, job.lookat, aspectRatio);
+    const auto projMatrix = getProjMatrix(*scene, camera, aspectRatio);
+
+    // Large images are streamed to their file, synchronously
+    const auto tileSize = getOutputTileSize(job.width, job.height);
+    if (tileSize) {
+      if (!writeTiledImage(*scene, jobPrograms, camera, projMatrix, job.width,
+              job.height, tileSize, job.output)) {
+        ++failureCount;
+      } else if (!job.reference.empty()) {
+        std::cerr << "Warning: " << job.output
+                  << " is written by tiles and not compared with its "
+                     "reference"
+                  << std::endl;
+      }
+      results[jobIdx].isRendered = true;
+      continue;
+    }
+
+    // Pending images keep their size, jobs of another size only
+    // reallocate the targets
+    if (!renderer) {
+      renderer = std::make_unique<ImageRenderer>(job.width, job.height,
+          numComponents, 2, getOutputSamples(), fxaaProgram);
+    }
+    renderer->resize(job.width, job.height);
+    if (renderer->pendingImageCount() == renderer->maxPendingImageCount()) {
+      writeOldestImage();
+    }
+
+    renderer->render([&]() {
+      glBeginQuery(GL_TIME_ELAPSED, timeQueries[jobIdx]);
+      glViewport(0, 0, GLsizei(job.width), GLsizei(job.height));
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      renderScene(*scene, jobPrograms, camera, projMatrix);
+      glEndQuery(GL_TIME_ELAPSED);
+    });
+    pendingJobs.push_back(jobIdx);
+  }
+  while (!pendingJobs.empty()) {
+    writeOldestImage();
+  }
+  while (!pendingEncodings.empty()) {
+    finishOldestEncoding();
+  }
+  glDeleteQueries(GLsizei(timeQueries.size()), timeQueries.data());
+
+  const auto renderedCount = std::count_if(begin(results), end(results),
+      [](const BatchJobResult &result) { return result.isRendered; });
+  const auto comparedCount = std::count_if(begin(results), end(results),
+      [](const BatchJobResult &result) { return result.hasReference; });
+  std::clog << "Rendered " << renderedCount << " / " << jobs.size()
+            << " images";
+  if (comparedCount) {
+    const auto matchingCount = std::count_if(begin(results), end(results),
+        [](const BatchJobResult &result) { return result.isMatching; });
+    std::clog << ", " << matchingCount << " / " << comparedCount
+              << " matching their reference";
+  }
+  std::clog << std::endl;
+  printModelCacheStats(scenes.stats());
+  if (!m_options.batchReport.empty()) {
+    std::string err;
+    if (!writeBatchResults(m_options.batchReport, jobs, results, err)) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+    std::clog << "Wrote batch results " << m_options.batchReport
+              << std::endl;
+  }
+  return failureCount ? -1 : 0;
+}
+
+int ViewerApplication::runServer(
+    std::istream &requests, std::ostream &responses)
+{
+  TRACE_ZONE("Server");
+  setupDepthTest();
+  const auto programs =
+      compileScenePrograms({{m_vertexShader, m_fragmentShader}});
+  loadEnvironment();
+
+  auto scenes = createModelCache();
+  const auto loadScene = [&](const fs::path &path) {
+    return scenes.get(path, [&](size_t &gpuBytes, size_t &hostBytes) {
+      return loadOfflineScene(path, programs, gpuBytes, hostBytes);
+    });
+  };
+
+  // Same pipeline as runBatch, encodings give the responses
+  const size_t numComponents = 3;
+  const size_t maxPendingEncodings = 2;
+  const auto *fxaaProgram = loadFxaaProgram();
+  std::unique_ptr<ImageRenderer> renderer;
+  std::deque<RenderRequest> pendingRequests;
+  std::deque<std::future<std::string>> pendingEncodings;
+  auto *pResponses = &responses;
+  const auto respond = [&](const std::string &response) {
+    *pResponses << response << std::endl;
+  };
+  const auto finishOldestEncoding = [&]() {
+    respond(pendingEncodings.front().get());
+    pendingEncodings.pop_front();
+  };
+  const auto readOldestImage = [&]() {
+    auto request = std::move(pendingRequests.front());
+    pendingRequests.pop_front();
+    auto pixels = std::make_shared<std::vector<unsigned char>>(
+        renderer->pendingImageSize());
+    renderer->readPixels(pixels->data());
+    if (pendingEncodings.size() == maxPendingEncodings) {
+      finishOldestEncoding();
+    }
+    pendingEncodings.emplace_back(std::async(std::launch::async,
+        [request = std::move(request), pixels, numComponents]() {
+          const auto &job = request.job;
+          if (job.output.empty()) {
+            return formatRenderResponse(request.id, {}, {},
+                encodePng(job.width, job.height, numComponents,
+                    pixels->data(), true));
+          }
+          std::string err;
+          if (!writePng(job.output, job.width, job.height, numComponents,
+                  pixels->data(), true, err)) {
+            return formatRenderResponse(request.id, err);
+          }
+          return formatRenderResponse(request.id, {}, job.output);
+        }));
+  };
+
+  // The requests of each connection in turn with m_options.serverPort,
+  // else those of requests
+  auto listener = -1;
+  if (m_options.serverPort) {
+    std::string err;
+    listener = listenTcp(m_options.serverPort, err);
+    if (listener < 0) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+    std::clog << "Listening on port " << m_options.serverPort << std::endl;
+  }
+  size_t requestCount = 0;
+  for (;;) {
+    std::unique_ptr<SocketStream> connection;
+    if (listener >= 0) {
+      const auto socket = acceptTcp(listener);
+      if (socket < 0) {
+        break;
+      }
+      connection = std::make_unique<SocketStream>(socket);
+      pResponses = connection.get();
+    }
+    LineReader reader{connection ? *connection : requests};
+    std::string line;
+    for (;;) {
+      // Without waiting requests, the pending images are finished one at
+      // a time (a request may come in between) before waiting for the next
+      // one, so that no client waits for a request that has not come
+      const auto idle = pendingRequests.empty() && pendingEncodings.empty();
+      if (!reader.pop(line, idle)) {
+        if (idle) {
+          break;
+        }
+        if (!pendingRequests.empty()) {
+          readOldestImage();
+        } else {
+          finishOldestEncoding();
+        }
+        continue;
+      }
+
+      ++requestCount;
+      RenderRequest request;
+      std::string err;
+      if (!parseRenderRequest(
+              line, m_nWindowWidth, m_nWindowHeight, request, err)) {
+        respond(formatRenderResponse(request.id, err));
+        continue;
+      }
+      if (request.stats) {
+        respond(formatModelCacheResponse(request.id, scenes.stats()));
+        continue;
+      }
+      const auto &job = request.job;
+      const auto *scene = loadScene(job.model);
+      if (!scene) {
+        respond(formatRenderResponse(
+            request.id, "unable to load " + job.model.string()));
+        continue;
+      }
+
+      const auto aspectRatio = float(job.width) / job.height;
+      const auto camera = getOfflineCamera(*scene, job.lookat, aspectRatio);
+      const auto projMatrix = getProjMatrix(*scene, camera, aspectRatio);
+
+      // Large images are streamed to their file, synchronously
+      const auto tileSize = getOutputTileSize(job.width, job.height);
+      if (tileSize) {
+        if (job.output.empty()) {
+          respond(formatRenderResponse(
+              request.id, "image too large to be returned, give an output"));
+        } else if (!writeTiledImage(*scene, programs.front(), camera,
+                       projMatrix, job.width, job.height, tileSize,
+                       job.output)) {
+          respond(formatRenderResponse(
+              request.id, "unable to write " + job.output.string()));
+        } else {
+          respond(formatRenderResponse(request.id, {}, job.output));
+        }
+        continue;
+      }
+
+      if (!renderer) {
+        renderer = std::make_unique<ImageRenderer>(job.width, job.height,
+            numComponents, 2, getOutputSamples(), fxaaProgram);
+      }
+      renderer->resize(job.width, job.height);
+      if (renderer->pendingImageCount() == renderer->maxPendingImageCount()) {
+        readOldestImage();
+      }
+
+      renderer->render([&]() {
+        glViewport(0, 0, GLsizei(job.width), GLsizei(job.height));
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderScene(*scene, programs.front(), camera, projMatrix);
+      });
+      pendingRequests.push_back(std::move(request));
+    }
+    if (listener < 0) {
+      break;
+    }
+  }
+  if (listener >= 0) {
+    closeSocket(listener);
+  }
+
+  std::clog << "Served " << requestCount << " requests" << std::endl;
+  printModelCacheStats(scenes.stats());
+  return 0;
+}
+
+struct ViewerApplication::RenderingState
+{
+  RenderingState(std::vector<ScenePrograms> programs,
+      const ViewerApplication &application) :
+      programs(std::move(programs)), scenes(application.createModelCache())
+  {
+    glGenQueries(1, &timeQuery);
+  }
+
+  ~RenderingState() { glDeleteQueries(1, &timeQuery); }
+
+  std::vector<ScenePrograms> programs;
+  ModelCache<Scene> scenes;
+  const Scene *pScene = nullptr; // Kept by scenes until the next load
+  std::unique_ptr<ImageRenderer> renderer;
+  size_t numComponents = 0; // Of renderer
+  GLuint timeQuery = 0;
+};
+
+bool ViewerApplication::loadRenderedModel(
+    const fs::path &path, double &loadTime, std::string &err)
+{
+  if (!m_pRendering) {
+    setupDepthTest();
+    m_pRendering = std::make_unique<RenderingState>(
+        compileScenePrograms({{m_vertexShader, m_fragmentShader}}), *this);
+    loadEnvironment();
+  }
+  auto &state = *m_pRendering;
+  const auto missCount = state.scenes.stats().misses;
+  const auto loadStartTime = std::chrono::steady_clock::now();
+  state.pScene =
+      state.scenes.get(path, [&](size_t &gpuBytes, size_t &hostBytes) {
+        return loadOfflineScene(path, state.programs, gpuBytes, hostBytes);
+      });
+  loadTime = state.scenes.stats().misses == missCount
+                 ? 0.
+                 : std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - loadStartTime)
+                       .count();
+  if (!state.pScene) {
+    err = "unable to load " + path.string();
+    return false;
+  }
+  return true;
+}
+
+bool ViewerApplication::renderModelImage(const std::vector<float> &lookat,
+    size_t width, size_t height, size_t numComponents, unsigned char *pixels,
+    double &gpuTime, size_t &drawCount, std::string &err)
+{
+  if (!m_pRendering || !m_pRendering->pScene) {
+    err = "no model loaded";
+    return false;
+  }
+  if (!width || !height || (numComponents != 3 && numComponents != 4)) {
+    err = "invalid image format";
+    return false;
+  }
+  if (getOutputTileSize(width, height)) {
+    err = "image too large to be rendered in one pass";
+    return false;
+  }
+  auto &state = *m_pRendering;
+  const auto &scene = *state.pScene;
+  const auto aspectRatio = float(width) / height;
+  const auto camera = getOfflineCamera(scene, lookat, aspectRatio);
+  const auto projMatrix = getProjMatrix(scene, camera, aspectRatio);
+
+  // The caller waits for its image, nothing is read back late
+  if (!state.renderer || state.numComponents != numComponents) {
+    state.renderer = std::make_unique<ImageRenderer>(width, height,
+        numComponents, 1, getOutputSamples(), loadFxaaProgram());
+    state.numComponents = numComponents;
+  }
+  state.renderer->resize(width, height);
+  state.renderer->render([&]() {
+    glBeginQuery(GL_TIME_ELAPSED, state.timeQuery);
+    glViewport(0, 0, GLsizei(width), GLsizei(height));
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawCount = renderScene(scene, state.programs.front(), camera, projMatrix);
+    glEndQuery(GL_TIME_ELAPSED);
+  });
+  state.renderer->readPixels(pixels);
+  GLuint64 nanoseconds = 0;
+  glGetQueryObjectui64v(state.timeQuery, GL_QUERY_RESULT, &nanoseconds);
+  gpuTime = double(nanoseconds) * 1e-6;
+  return true;
+}
+
+ModelCacheStats ViewerApplication::getRenderedModelStats() const
+{
+  return m_pRendering ? m_pRendering->scenes.stats() : ModelCacheStats{};
+}
+
+int ViewerApplication::runTileset()
+{
+  Tileset tileset;
+  std::string err;
+  if (!tileset.load(m_gltfFilePath, err)) {
+    std::cerr << "Error: " << err << std::endl;
+    return -1;
+  }
+  std::clog << "Loaded tileset " << m_gltfFilePath << " ("
+            << tileset.tileCount() << " tiles)" << std::endl;
+
+  // Tiles upload their own textures
+  if (m_options.virtualTextures) {
+    std::cerr << "Warning: virtual textures are not used by tilesets"
+              << std::endl;
+    m_options.virtualTextures = false;
+  }
+  auto programs = std::move(
+      compileScenePrograms({{m_vertexShader, m_fragmentShader}}).front());
+  loadEnvironment();
+  setupDepthTest();
+
+  // Tilesets are z-up, the default camera looks down at the root tile
+  const auto aspectRatio = float(m_nWindowWidth) / m_nWindowHeight;
+  const auto &bboxMin = tileset.bboxMin();
+  const auto &bboxMax = tileset.bboxMax();
+  InputQueue inputQueue(m_GLFWHandle.window());
+  FirstPersonCameraController cameraController{
+      0.5f * glm::length(bboxMax - bboxMin), glm::vec3(0, 0, 1)};
+  cameraController.setCamera(m_hasUserCamera
+                                 ? m_userCamera
+                                 : getFramingCamera(bboxMin, bboxMax,
+                                       glm::perspective(FIELD_OF_VIEW,
+                                           aspectRatio, DEFAULT_NEAR,
+                                           DEFAULT_FAR),
+                                       glm::normalize(glm::vec3(0, 1, -1)),
+                                       glm::vec3(0, 0, 1)));
+
+  // Vertices of the contents, owned by their tile: contents come and go
+  // with the camera, a shared heap keeps their buffers from fragmenting
+  // video memory. Declared first so that it outlives the contents. Without
+  // a budget, contents beyond 1 GiB get buffers of their own.
+  GeometryHeap geometryHeap(m_options.tilesetGpuBudget
+                                ? m_options.tilesetGpuBudget
+                                : size_t(1) << 30);
+  std::vector<uint64_t> movedTiles;
+
+  // Content of each tile once loaded. Contents are parsed on the job system,
+  // then uploaded by this thread in slices of the upload budget of a frame,
+  // as long as the GL tasks of the frame have time left.
+  std::vector<std::unique_ptr<Scene>> contents(tileset.tileCount());
+  struct ContentLoad
+  {
+    uint32_t tile;
+    std::unique_ptr<Scene> scene;
+    Task<bool> loading; // False if the content could not be parsed
+  };
+  std::list<ContentLoad> loads;
+  // Pose an uploaded content in the frame of its tile
+  const auto finishLoad = [&](uint32_t tileIdx, Scene &scene) {
+    const auto &tile = tileset.tile(tileIdx);
+    updateScenePose(scene, programs, 0.);
+    if (tile.contentMatrix != glm::mat4(1)) {
+      auto worldMatrices = scene.hierarchy.worldMatrices();
+      for (auto &worldMatrix : worldMatrices) {
+        worldMatrix = tile.contentMatrix * worldMatrix;
+      }
+      scene.hierarchy.setWorldMatrices(worldMatrices);
+      updateDrawBounds(scene);
+      // Bounds reduced on the GPU in the frame of the content are dropped
+      if (scene.hasGpuBounds) {
+        scene.hasGpuBounds = false;
+        updateSceneVertices(scene, programs, false);
+      }
+    }
+    if (m_options.useIndirectDraws) {
+      buildIndirectDraws(scene);
+    }
+    if (programs.readsMaterials) {
+      buildMaterials(scene);
+    }
+    if (m_options.releaseCpuBuffers) {
+      releaseModelBuffers(
+          tile.content, scene.model, scene.bufferMappings, scene.buffers);
+    }
+  };
+  const auto loadContent = [&](uint32_t tileIdx, fs::path path,
+                               Scene &scene) -> Task<bool> {
+    co_await resumeOnJobSystem();
+    const auto isParsed = loadGltfFile(path, scene);
+    co_await m_glTasks.schedule();
+    if (!isParsed) {
+      co_return false;
+    }
+    scene.upload.arena.setHeap(&geometryHeap, tileIdx);
+    beginSceneUpload(scene);
+    while (!uploadMeshes(scene, m_options.uploadBytesPerFrame)) {
+      co_await m_glTasks.schedule();
+    }
+    finishLoad(tileIdx, scene);
+    co_return true;
+  };
+  const auto startLoad = [&](uint32_t tileIdx) {
+    tileset.setLoading(tileIdx);
+    auto scene = std::make_unique<Scene>();
+    auto loading =
+        loadContent(tileIdx, tileset.tile(tileIdx).content, *scene);
+    loads.push_back({tileIdx, std::move(scene), std::move(loading)});
+    loads.back().loading.start();
+  };
+  // Resume the loads for seconds, keep the uploaded contents. If wait is
+  // true, until every load is finished.
+  const auto updateLoads = [&](double seconds, bool wait) {
+    m_glTasks.drain(seconds);
+    for (auto it = begin(loads); it != end(loads);) {
+      auto &load = *it;
+      if (wait) {
+        m_glTasks.drainUntilReady(load.loading);
+      } else if (!load.loading.isReady()) {
+        ++it;
+        continue;
+      }
+      if (load.loading.get()) {
+        tileset.setLoaded(load.tile, load.scene->upload.totalBytes,
+            getSceneHostBytes(*load.scene));
+        contents[load.tile] = std::move(load.scene);
+      } else {
+        std::cerr << "Warning: unable to load tile "
+                  << tileset.tile(load.tile).content << std::endl;
+        tileset.setFailed(load.tile);
+      }
+      it = loads.erase(it);
+    }
+  };
+
+  // Select the tiles of camera, prefetch those of the predicted cameras,
+  // start the loads of the missing ones and evict the contents beyond the
+  // budgets
+  const auto pixelsPerUnit =
+      getPixelsPerUnit(FIELD_OF_VIEW, size_t(m_nWindowHeight));
+  auto pixelError = m_options.tilesetPixelError;
+  Tileset::Selection selection;
+  CameraPredictor cameraPredictor;
+  std::vector<Camera> predictedCameras;
+  const auto selectTiles = [&](const Camera &camera,
+                               const glm::mat4 &projMatrix) {
+    tileset.select(projMatrix * camera.getViewMatrix(), camera.eye(),
+        pixelsPerUnit, pixelError, selection);
+    for (const auto &predictedCamera : predictedCameras) {
+      tileset.prefetch(projMatrix * predictedCamera.getViewMatrix(),
+          predictedCamera.eye(), pixelsPerUnit, pixelError, selection);
+    }
+    for (const auto tiles : {&selection.requests, &selection.prefetches}) {
+      for (const auto tileIdx : *tiles) {
+        if (loads.size() >= m_options.tilesetLoadCount) {
+          break;
+        }
+        startLoad(tileIdx);
+      }
+    }
+    for (const auto tileIdx : tileset.evict(
+             m_options.tilesetGpuBudget, m_options.tilesetHostBudget)) {
+      contents[tileIdx].reset();
+      tileset.setUnloaded(tileIdx);
+    }
+  };
+  // Fill the holes left by evicted contents within the upload budget, the
+  // moved contents, loaded or still uploading, rebind their vertices
+  const auto defragmentHeap = [&]() {
+    movedTiles.clear();
+    geometryHeap.defragment(m_options.uploadBytesPerFrame, movedTiles);
+    for (const auto tileIdx : movedTiles) {
+      auto scene = contents[tileIdx].get();
+      for (auto it = begin(loads); !scene && it != end(loads); ++it) {
+        if (it->tile == tileIdx) {
+          scene = it->scene.get();
+        }
+      }
+      if (scene) {
+        scene->upload.arena.updateHeapRanges();
+      }
+    }
+  };
+  // Every tile shares the projection of the tileset bounds, hence the depth
+  // buffer. Return the number of primitives drawn.
+  const auto drawTiles = [&](const Camera &camera,
+                             const glm::mat4 &projMatrix) {
+    glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    size_t drawCount = 0;
+    for (const auto tileIdx : selection.draws) {
+      drawCount +=
+          renderScene(*contents[tileIdx], programs, camera, projMatrix);
+    }
+    return drawCount;
+  };
+
+  if (!m_OutputPath.empty()) {
+    if (getOutputTileSize(m_nWindowWidth, m_nWindowHeight)) {
+      std::cerr << "Error: tilesets are not rendered in tiles, the image "
+                   "size must be at most the tile size"
+                << std::endl;
+      return -1;
+    }
+    // Each pass loads the tiles refining the previous ones, failed tiles
+    // are not requested again
+    const auto camera = cameraController.getCamera();
+    const auto projMatrix =
+        getProjMatrix(bboxMin, bboxMax, camera, aspectRatio);
+    const auto startTime = glfwGetTime();
+    for (selectTiles(camera, projMatrix); !selection.requests.empty();
+         selectTiles(camera, projMatrix)) {
+      updateLoads(0., true);
+    }
+    std::clog << "Loaded " << tileset.memoryUsage().contentCount
+              << " tiles in " << glfwGetTime() - startTime << " s"
+              << std::endl;
+
+    const auto numComponents = 3;
+    std::vector<unsigned char> pixels(
+        size_t(m_nWindowWidth) * m_nWindowHeight * numComponents);
+    renderToImage(m_nWindowWidth, m_nWindowHeight, numComponents,
+        pixels.data(), [&]() { drawTiles(camera, projMatrix); },
+        getOutputSamples(), loadFxaaProgram());
+    // Pixels are read bottom row first
+    if (!writePng(m_OutputPath, m_nWindowWidth, m_nWindowHeight,
+            numComponents, pixels.data(), true, err)) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  while (!m_GLFWHandle.shouldClose()) {
+    TRACE_ZONE("Frame");
+    const auto camera = cameraController.getCamera();
+    const auto projMatrix =
+        getProjMatrix(bboxMin, bboxMax, camera, aspectRatio);
+    cameraPredictor.add(glfwGetTime(), camera);
+    predictedCameras.clear();
+    cameraPredictor.predict(m_options.prefetchSeconds, predictedCameras);
+    // Contents loaded by this frame are drawn by the next one
+    selectTiles(camera, projMatrix);
+    updateLoads(m_options.glTaskSecondsPerFrame, false);
+    defragmentHeap();
+    const auto drawCount = drawTiles(camera, projMatrix);
+
+    if (!m_options.hideGui) {
+      imguiNewFrame();
+      ImGui::Begin("GUI");
+      ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
+          1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+      const auto &usage = tileset.memoryUsage();
+      ImGui::Text("Tiles drawn: %zu (%zu primitives)", selection.draws.size(),
+          drawCount);
+      ImGui::Text("Tiles loaded: %zu, loading: %zu, requested: %zu, "
+                  "prefetched: %zu",
+          usage.contentCount, loads.size(), selection.requests.size(),
+          selection.prefetches.size());
+      ImGui::Text("GPU memory: %zu MiB (budget %zu MiB)",
+          usage.gpuBytes >> 20, m_options.tilesetGpuBudget >> 20);
+      ImGui::Text("Host memory: %zu MiB", usage.hostBytes >> 20);
+      const auto heapStats = geometryHeap.stats();
+      ImGui::Text("Vertex heap (%s): %zu MiB in %zu MiB, %zu holes, "
+                  "%zu MiB moved",
+          geometryHeap.isSparse() ? "sparse" : "blocks",
+          heapStats.allocatedBytes >> 20, heapStats.residentBytes >> 20,
+          heapStats.freeRangeCount, heapStats.movedBytes >> 20);
+      ImGui::SliderFloat("Pixel error", &pixelError, 1.f, 64.f);
+      ImGui::End();
+      imguiRenderFrame();
+    }
+
+    glfwPollEvents(); // Poll for and process events
+
+    const auto guiHasFocus =
+        !m_options.hideGui && (ImGui::GetIO().WantCaptureMouse ||
+                                  ImGui::GetIO().WantCaptureKeyboard);
+    cameraController.update(
+        inputQueue.takeEvents(), glfwGetTime(), guiHasFocus);
+    m_GLFWHandle.swapBuffers(); // Swap front and back buffers
+  }
+  for (const auto &load : loads) {
+    m_glTasks.drainUntilReady(load.loading);
+  }
+  return 0;
+}
+
+int ViewerApplication::runBenchmark(
+    const std::vector<fs::path> &models, size_t frameCount)
+{
+  TRACE_ZONE("Benchmark");
+  // A camera path gives the frames, one per time step
+  CameraPath cameraPath;
+  if (!m_options.cameraPath.empty()) {
+    std::string err;
+    if (!cameraPath.load(m_options.cameraPath, err)) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+    frameCount =
+        size_t(cameraPath.duration() / m_options.fixedTimeStep) + 1;
+  }
+
+  setupDepthTest();
+  const auto programs = std::move(
+      compileScenePrograms({{m_vertexShader, m_fragmentShader}}).front());
+  loadEnvironment();
+
+  // Frames are drawn offscreen, the window is hidden by the output path
+  const auto width = size_t(m_nWindowWidth);
+  const auto height = size_t(m_nWindowHeight);
+  const auto aspectRatio = float(width) / height;
+  RenderTarget target(width, height,
+      m_options.reversedZ ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24);
+  // Drawn before the measured frames, which then find the driver and the
+  // caches of the scene warm
+  const size_t warmupFrameCount = 10;
+  std::vector<GLuint> queries(frameCount);
+  glGenQueries(GLsizei(queries.size()), queries.data());
+
+  const auto getEllapsedTime =
+      [](const std::chrono::steady_clock::time_point &startTime) {
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - startTime)
+            .count();
+      };
+
+  const auto telemetry = createGpuTelemetry();
+
+  std::vector<BenchmarkResult> results;
+  auto failureCount = 0;
+  for (const auto &path : models) {
+    results.emplace_back();
+    auto &result = results.back();
+    result.model = path;
+
+    const auto availableVideoMemory = getAvailableVideoMemoryBytes();
+    // Released before the next model is loaded
+    auto scene = std::make_unique<Scene>();
+    if (!loadGltfFile(path, *scene)) {
+      std::cerr << "Error: unable to load " << path << std::endl;
+      ++failureCount;
+      continue;
+    }
+    result.isLoaded = true;
+    result.parseTime = scene->parseTime;
+    result.decodeTime = scene->decodeTime;
+
+    const auto uploadStartTime = std::chrono::steady_clock::now();
+    beginSceneUpload(*scene);
+    uploadMeshes(*scene, std::numeric_limits<size_t>::max());
+    updateScenePose(*scene, programs, 0.);
+    if (m_options.useIndirectDraws) {
+      buildIndirectDraws(*scene);
+    }
+    if (programs.readsMaterials) {
+      buildMaterials(*scene);
+    }
+    glFinish();
+    result.uploadTime = getEllapsedTime(uploadStartTime);
+    result.residentBytes = getResidentMemoryBytes();
+    result.peakResidentBytes = getPeakResidentMemoryBytes();
+    result.sceneGpuBytes = scene->upload.totalBytes;
+    if (availableVideoMemory >= 0) {
+      result.videoMemoryBytes =
+          availableVideoMemory - getAvailableVideoMemoryBytes();
+    }
+
+    // Without camera path, the camera turns around the target of the
+    // default camera. Frames advance by the fixed time step of camera paths.
+    const auto defaultCamera = getDefaultCamera(*scene, aspectRatio);
+    const auto getCamera = [&](size_t frameIdx, size_t pathFrameCount) {
+      if (!cameraPath.empty()) {
+        return cameraPath.evaluate(
+            double(frameIdx) * m_options.fixedTimeStep);
+      }
+      const auto angle = 2.f * glm::pi<float>() * float(frameIdx) /
+                         float(std::max(pathFrameCount, size_t(1)));
+      const auto center = defaultCamera.center();
+      const auto offset = glm::rotate(glm::mat4(1), angle, defaultCamera.up()) *
+                          glm::vec4(defaultCamera.eye() - center, 0);
+      return Camera{center + glm::vec3(offset), center, defaultCamera.up()};
+    };
+    const auto drawFrame = [&](size_t frameIdx, size_t pathFrameCount) {
+      const auto camera = getCamera(frameIdx, pathFrameCount);
+      updateScenePose(
+          *scene, programs, double(frameIdx) * m_options.fixedTimeStep);
+      glViewport(0, 0, GLsizei(width), GLsizei(height));
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      renderScene(*scene, programs, camera,
+          getProjMatrix(*scene, camera, aspectRatio));
+    };
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.framebuffer());
+    for (size_t frameIdx = 0; frameIdx < warmupFrameCount; ++frameIdx) {
+      drawFrame(frameIdx, warmupFrameCount);
+    }
+    std::vector<double> cpuTimes;
+    cpuTimes.reserve(frameCount);
+    AllocationCounts allocations;
+    if (telemetry) {
+      telemetry->beginStats();
+    }
+    for (size_t frameIdx = 0; frameIdx < frameCount; ++frameIdx) {
+      const auto frameStartTime = std::chrono::steady_clock::now();
+      const auto frameStartAllocations = getThreadAllocations();
+      glBeginQuery(GL_TIME_ELAPSED, queries[frameIdx]);
+      drawFrame(frameIdx, frameCount);
+      glEndQuery(GL_TIME_ELAPSED);
+      const auto frameAllocations = getThreadAllocations();
+      cpuTimes.push_back(getEllapsedTime(frameStartTime));
+      const auto frameAllocationCount =
+          frameAllocations.count - frameStartAllocations.count;
+      allocations.count += frameAllocationCount;
+      allocations.bytes += frameAllocations.bytes - frameStartAllocations.bytes;
+      result.maxFrameAllocations =
+          std::max(result.maxFrameAllocations, frameAllocationCount);
+    }
+    result.meanFrameAllocations =
+        double(allocations.count) / double(frameCount);
+    result.meanFrameAllocatedBytes =
+        double(allocations.bytes) / double(frameCount);
+    // Queries are only read once every frame is drawn, so that reading them
+    // does not stall the measured frames
+    glFinish();
+    if (telemetry) {
+      result.gpuTelemetry = telemetry->stats();
+    }
+    std::vector<double> gpuTimes;
+    for (const auto query : queries) {
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+      gpuTimes.push_back(double(nanoseconds) * 1e-6);
+    }
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    result.frameCount = frameCount;
+    result.cpuFrameTime = computeFrameTimeStats(std::move(cpuTimes));
+    result.gpuFrameTime = computeFrameTimeStats(std::move(gpuTimes));
+
+    std::clog << path << ": loaded in "
+              << result.parseTime + result.decodeTime + result.uploadTime
+              << " ms, median frame " << result.cpuFrameTime.median
+              << " ms CPU, " << result.gpuFrameTime.median << " ms GPU"
+              << std::endl;
+    if (m_options.maxFrameAllocations >= 0 &&
+        result.maxFrameAllocations >
+            uint64_t(m_options.maxFrameAllocations)) {
+      std::cerr << "Error: " << path << ": a frame made "
+                << result.maxFrameAllocations << " heap allocations, over "
+                << m_options.maxFrameAllocations << std::endl;
+      ++failureCount;
+    }
+  }
+  glDeleteQueries(GLsizei(queries.size()), queries.data());
+
+  std::string err;
+  if (!writeBenchmarkResults(m_OutputPath, results, err)) {
+    std::cerr << "Error: " << err << std::endl;
+    return -1;
+  }
+  std::clog << "Wrote benchmark results " << m_OutputPath << std::endl;
+  return failureCount ? -1 : 0;
+}
+
+std::vector<ViewerApplication::ScenePrograms>
+ViewerApplication::compileScenePrograms(
+    const std::vector<std::pair<std::string, std::string>> &shaders) const
+{
+  TRACE_ZONE("Compile scene programs");
+  LoadReport::Scope reportScope{m_pLoadReport.get(), LoadPhase::ShaderCompile};
+  const auto shadersPath = m_ShadersRootPath / m_AppName;
+
+  // All variants are submitted at once so that the driver compiles them in
+  // parallel
+  ShaderDefines cullDefines;
+  if (getGLExtensions().indirectParameters) {
+    cullDefines["COMPACT_DRAWS"] = "";
+  }
+  ShaderDefines copyDepthDefines{{"COPY_DEPTH", ""}};
+  ShaderDefines downsampleDefines{{"DOWNSAMPLE", ""}};
+  ShaderDefines reduceDepthDefines;
+  if (m_options.occlusionCulling) {
+    cullDefines["OCCLUSION_CULLING"] = "";
+    if (m_options.reversedZ) {
+      cullDefines["REVERSED_Z"] = "";
+    }
+  }
+  if (m_options.reversedZ) {
+    reduceDepthDefines["REVERSED_Z"] = "";
+  }
+  auto sceneDefines = m_options.shaderDefines;
+  if (m_options.quantizeVertices) {
+    sceneDefines["QUANTIZED_VERTICES"] = "";
+  }
+  if (usesVirtualTextures()) {
+    sceneDefines["VIRTUAL_TEXTURES"] = "";
+  } else if (m_options.bindlessTextures &&
+             getGLExtensions().bindlessTexture) {
+    sceneDefines["BINDLESS_TEXTURES"] = "";
+  }
+  const auto useOit =
+      m_options.oit != OitMode::None && !m_options.deferredShading;
+  ShaderDefines resolveDefines;
+  if (useOit) {
+    sceneDefines["OIT"] = "";
+    resolveDefines[m_options.oit == OitMode::WeightedBlended
+                       ? "WEIGHTED_BLENDED"
+                       : "LINKED_LIST"] = "";
+  }
+  // Only the window is resolved temporally, offline images are single
+  // frames
+  const auto useTaa = m_options.temporalAntiAliasing &&
+                      !m_options.deferredShading && m_OutputPath.empty();
+  if (useTaa) {
+    sceneDefines["TAA"] = "";
+  }
+  const auto useAccumulation =
+      m_options.accumulationFrameCount && m_OutputPath.empty();
+  const auto usePostProcessing =
+      m_options.postProcessing && m_OutputPath.empty();
+  // The rates follow the previous frame of the window
+  const auto useVariableRateShading =
+      m_options.variableRateShading && m_OutputPath.empty();
+  // Picks of the window draw like the depth pre-pass
+  const auto usePickPass = canDrawDepthPrepass() && m_OutputPath.empty();
+  const auto useImpostors = m_options.useInstancing &&
+                            m_options.impostorPixelSize > 0.f &&
+                            !m_options.deferredShading;
+  const auto usePointClouds =
+      m_options.pointClouds && !m_options.deferredShading;
+  const auto useAtomicInt64 = usePointClouds && PointClouds::hasAtomicInt64();
+  ShaderDefines pointDefines;
+  if (m_options.reversedZ) {
+    pointDefines["REVERSED_Z"] = "";
+  }
+  auto rasterizeDefines = pointDefines;
+  if (useAtomicInt64) {
+    rasterizeDefines["ATOMIC_INT64"] = "";
+  }
+  auto rasterizeColorDefines = pointDefines;
+  rasterizeColorDefines["COLOR_PASS"] = "";
+  const auto useAmbientOcclusion = m_options.ambientOcclusion &&
+                                   canDrawDepthPrepass() &&
+                                   !m_options.deferredShading;
+  const auto useDepthPyramid =
+      m_options.occlusionCulling || useAmbientOcclusion;
+  ProgramBuilder builder;
+  ShaderDefines lightingDefines;
+  if (m_options.reversedZ) {
+    lightingDefines["REVERSED_Z"] = "";
+  }
+  for (const auto &shader : shaders) {
+    // Deferred shading draws every scene program in the G-buffer
+    const auto fragmentShader = m_options.deferredShading
+                                    ? std::string("gbuffer.fs.glsl")
+                                    : shader.second;
+    builder.add(
+        getSceneShaderPaths(shadersPath, shader.first, fragmentShader),
+        sceneDefines);
+    if (canDrawSkins() && !m_options.skinningPrepass) {
+      auto skinnedDefines = sceneDefines;
+      skinnedDefines["SKINNED"] = "";
+      builder.add(
+          getSceneShaderPaths(shadersPath, shader.first, fragmentShader),
+          skinnedDefines);
+    }
+    if (canDrawSkins() && m_options.skinningPrepass) {
+      builder.add({shadersPath / "skin_vertices.cs.glsl"});
+    }
+    if (canBlendMorphs()) {
+      builder.add({shadersPath / "morph_targets.cs.glsl"});
+    }
+    if (m_options.deferredShading) {
+      builder.add(
+          {shadersPath / "deferred_lighting.cs.glsl"}, lightingDefines);
+    } else {
+      builder.add({shadersPath / "assign_lights.cs.glsl"});
+    }
+    if (canDrawDepthPrepass()) {
+      builder.add(
+          {shadersPath / "depth.vs.glsl", shadersPath / "depth.fs.glsl"},
+          sceneDefines);
+      if (canDrawSkins() && !m_options.skinningPrepass) {
+        auto skinnedDefines = sceneDefines;
+        skinnedDefines["SKINNED"] = "";
+        builder.add(
+            {shadersPath / "depth.vs.glsl", shadersPath / "depth.fs.glsl"},
+            skinnedDefines);
+      }
+      auto maskedDefines = sceneDefines;
+      maskedDefines["ALPHA_MASK"] = "";
+      builder.add(
+          {shadersPath / "depth.vs.glsl", shadersPath / "depth.fs.glsl"},
+          maskedDefines);
+    }
+    if (usePickPass) {
+      builder.add(
+          {shadersPath / "depth.vs.glsl", shadersPath / "pick.fs.glsl"},
+          sceneDefines);
+      if (canDrawSkins() && !m_options.skinningPrepass) {
+        auto skinnedDefines = sceneDefines;
+        skinnedDefines["SKINNED"] = "";
+        builder.add(
+            {shadersPath / "depth.vs.glsl", shadersPath / "pick.fs.glsl"},
+            skinnedDefines);
+      }
+    }
+    if (m_options.useInstancing) {
+      auto instancedDefines = sceneDefines;
+      instancedDefines["INSTANCED"] = "";
+      if (m_options.vertexAnimations) {
+        instancedDefines["VERTEX_ANIMATIONS"] = "";
+      }
+      builder.add(getSceneShaderPaths(
+                      shadersPath, "forward.vs.glsl", fragmentShader),
+          instancedDefines);
+    }
+    if (useImpostors) {
+      builder.add({shadersPath / "impostor.vs.glsl",
+                      shadersPath / "impostor.fs.glsl"},
+          sceneDefines);
+    }
+    if (usePointClouds) {
+      builder.add(
+          {shadersPath / "rasterize_points.cs.glsl"}, rasterizeDefines);
+      if (!useAtomicInt64) {
+        builder.add(
+            {shadersPath / "rasterize_points.cs.glsl"}, rasterizeColorDefines);
+      }
+      builder.add({shadersPath / "fullscreen.vs.glsl",
+                      shadersPath / "resolve_points.fs.glsl"},
+          pointDefines);
+      builder.add({shadersPath / "thick_lines.vs.glsl",
+                      shadersPath / "thick_lines.fs.glsl"});
+    }
+    // Program of the indirect path, matrices are read from a storage buffer
+    if (m_options.useIndirectDraws) {
+      auto indirectDefines = sceneDefines;
+      if (usesVertexPulling()) {
+        indirectDefines["VERTEX_PULLING"] = "";
+      }
+      if (usesVisibilityBuffer()) {
+        indirectDefines["VISIBILITY_BUFFER"] = "";
+        builder.add({shadersPath / "forward_indirect.vs.glsl",
+                        shadersPath / "visibility.fs.glsl"},
+            indirectDefines);
+      } else {
+        builder.add(getSceneShaderPaths(shadersPath,
+                        "forward_indirect.vs.glsl", fragmentShader),
+            indirectDefines);
+      }
+      // Compiled once, but linked in each ScenePrograms
+      builder.add({shadersPath / "cull_draws.cs.glsl"}, cullDefines);
+      if (usesTriangleCulling()) {
+        auto triangleDefines = cullDefines;
+        if (m_options.quantizeVertices) {
+          triangleDefines["QUANTIZED_VERTICES"] = "";
+        }
+        builder.add(
+            {shadersPath / "cull_triangles.cs.glsl"}, triangleDefines);
+      }
+      if (usesVisibilityBuffer()) {
+        builder.add({shadersPath / "fullscreen.vs.glsl",
+                        shadersPath / "visibility_resolve.fs.glsl"},
+            sceneDefines);
+      }
+    }
+    if (m_options.gpuTransforms) {
+      builder.add({shadersPath / "propagate_transforms.cs.glsl"});
+      builder.add({shadersPath / "update_draw_transforms.cs.glsl"});
+    }
+    if (m_options.gpuBounds) {
+      ShaderDefines boundsDefines;
+      if (m_options.quantizeVertices) {
+        boundsDefines["QUANTIZED_VERTICES"] = "";
+      }
+      if (getGLExtensions().shaderSubgroupArithmetic) {
+        boundsDefines["SUBGROUP_ARITHMETIC"] = "";
+      }
+      builder.add({shadersPath / "reduce_bounds.cs.glsl"}, boundsDefines);
+    }
+    if (m_options.occlusionQueries && canDrawDepthPrepass()) {
+      builder.add({shadersPath / "occlusion_box.vs.glsl",
+          shadersPath / "depth.fs.glsl"});
+    }
+    if (useDepthPyramid) {
+      builder.add({shadersPath / "depth_pyramid.cs.glsl"}, copyDepthDefines);
+      builder.add({shadersPath / "depth_pyramid.cs.glsl"}, reduceDepthDefines);
+    }
+    if (useAmbientOcclusion) {
+      builder.add(
+          {shadersPath / "ambient_occlusion.cs.glsl"}, lightingDefines);
+    }
+    if (useOit) {
+      builder.add({shadersPath / "fullscreen.vs.glsl",
+                      shadersPath / "transparency_resolve.fs.glsl"},
+          resolveDefines);
+    }
+    if (useTaa) {
+      builder.add({shadersPath / "fullscreen.vs.glsl",
+          shadersPath / "taa_resolve.fs.glsl"});
+    }
+    if (useAccumulation) {
+      builder.add({shadersPath / "fullscreen.vs.glsl",
+          shadersPath / "accumulate.fs.glsl"});
+    }
+    if (usePostProcessing) {
+      builder.add({shadersPath / "exposure.cs.glsl"});
+      builder.add({shadersPath / "bloom.cs.glsl"}, downsampleDefines);
+      builder.add({shadersPath / "bloom.cs.glsl"});
+      builder.add({shadersPath / "tone_mapping.cs.glsl"});
+    }
+    if (useVariableRateShading) {
+      builder.add({shadersPath / "shading_rate.cs.glsl"},
+          ShadingRateImage::getShaderDefines());
+      builder.add({shadersPath / "fullscreen.vs.glsl",
+          shadersPath / "shading_rate.fs.glsl"});
+    }
+  }
+  auto builtPrograms = builder.build();
+
+  std::vector<ScenePrograms> scenePrograms(shaders.size());
+  auto nextProgram = begin(builtPrograms);
+  for (size_t shaderIdx = 0; shaderIdx < shaders.size(); ++shaderIdx) {
+    auto &programs = scenePrograms[shaderIdx];
+    const auto &shader = shaders[shaderIdx];
+    if (!m_options.deferredShading) {
+      programs.forwardShaders =
+          getSceneShaderPaths(shadersPath, shader.first, shader.second);
+      programs.forwardDefines = sceneDefines;
+      programs.writesCoverage =
+          fs::path(shader.second).filename() == "materials.fs.glsl";
+      const auto *debugView = findDebugView(shader.second);
+      programs.isAdditive = debugView && debugView->isAdditive;
+    }
+    // renderScene is called for each view of a frame, each call takes a
+    // region of frameData
+    programs.frameData = RingBuffer(RingBuffer::FRAME_COUNT * getViewCount());
+    programs.forward = std::move(*nextProgram++);
+    programs.readsMaterials =
+        glGetProgramResourceIndex(programs.forward.glId(),
+            GL_SHADER_STORAGE_BLOCK, "Materials") != GL_INVALID_INDEX;
+    bindMaterialTextureArrays(programs.forward);
+    programs.readsLights = bindLights(programs.forward);
+    programs.hasDrawUniformBlock = bindDrawUniforms(programs.forward);
+    if (!programs.hasDrawUniformBlock) {
+      programs.modelViewProjMatrix =
+          programs.forward.getUniform<glm::mat4>("uModelViewProjMatrix");
+      programs.modelViewMatrix =
+          programs.forward.getUniform<glm::mat4>("uModelViewMatrix");
+      programs.normalMatrix =
+          programs.forward.getUniform<glm::mat4>("uNormalMatrix");
+    }
+    programs.heat = programs.forward.getUniform<float>("uHeat");
+
+    if (canDrawSkins() && !m_options.skinningPrepass) {
+      programs.skinned = std::move(*nextProgram++);
+      programs.hasSkinnedProgram =
+          programs.hasDrawUniformBlock &&
+          glGetProgramResourceIndex(programs.skinned.glId(),
+              GL_SHADER_STORAGE_BLOCK, "JointMatrices") != GL_INVALID_INDEX;
+      if (programs.hasSkinnedProgram) {
+        bindMaterialTextureArrays(programs.skinned);
+        bindLights(programs.skinned);
+        bindDrawUniforms(programs.skinned);
+      }
+    }
+    if (canDrawSkins() && m_options.skinningPrepass) {
+      programs.skinVertices = std::move(*nextProgram++);
+      programs.hasSkinningPrepass = true;
+    }
+    if (canBlendMorphs()) {
+      programs.blendMorphs = std::move(*nextProgram++);
+      programs.hasMorphPrepass = true;
+    }
+    auto &lightingProgram = m_options.deferredShading
+                                ? programs.deferredLighting
+                                : programs.assignLights;
+    lightingProgram = std::move(*nextProgram++);
+    programs.readsLights = programs.readsLights && bindLights(lightingProgram);
+    if (canDrawDepthPrepass()) {
+      programs.depth = std::move(*nextProgram++);
+      programs.hasDepthPrepass =
+          programs.hasDrawUniformBlock && bindDrawUniforms(programs.depth);
+      if (canDrawSkins() && !m_options.skinningPrepass) {
+        programs.depthSkinned = std::move(*nextProgram++);
+        // Skinned draws need the skinned depth program if they are drawn
+        programs.hasDepthPrepass = programs.hasDepthPrepass &&
+                                   (!programs.hasSkinnedProgram ||
+                                       bindDrawUniforms(programs.depthSkinned));
+      }
+      programs.depthMasked = std::move(*nextProgram++);
+      bindMaterialTextureArrays(programs.depthMasked);
+      programs.hasMaskedDepthPrepass =
+          programs.hasDepthPrepass && programs.readsMaterials &&
+          bindDrawUniforms(programs.depthMasked);
+    }
+
+    if (usePickPass) {
+      programs.pick = std::move(*nextProgram++);
+      programs.pickDrawId = programs.pick.getUniform<GLuint>("uDrawID");
+      programs.hasPickPass = bindDrawUniforms(programs.pick);
+      if (canDrawSkins() && !m_options.skinningPrepass) {
+        programs.pickSkinned = std::move(*nextProgram++);
+        programs.pickSkinnedDrawId =
+            programs.pickSkinned.getUniform<GLuint>("uDrawID");
+        programs.hasPickPass = programs.hasPickPass &&
+                               (!programs.hasSkinnedProgram ||
+                                   bindDrawUniforms(programs.pickSkinned));
+      }
+    }
+    if (m_options.useInstancing) {
+      programs.instanced = std::move(*nextProgram++);
+      bindMaterialTextureArrays(programs.instanced);
+      bindLights(programs.instanced);
+      programs.instanced.bindUniformBlock(
+          "CameraUniforms", CAMERA_UNIFORMS_BINDING, sizeof(CameraUniforms));
+    }
+    if (useImpostors) {
+      programs.impostors = std::move(*nextProgram++);
+      bindLights(programs.impostors);
+      // Impostors replace lit instances only
+      programs.hasImpostors =
+          programs.readsLights &&
+          programs.impostors.bindUniformBlock("CameraUniforms",
+              CAMERA_UNIFORMS_BINDING, sizeof(CameraUniforms));
+    }
+    if (usePointClouds) {
+      auto &pointPrograms = programs.pointClouds;
+      pointPrograms.rasterize = std::move(*nextProgram++);
+      pointPrograms.atomicInt64 = useAtomicInt64;
+      if (!useAtomicInt64) {
+        pointPrograms.rasterizeColors = std::move(*nextProgram++);
+      }
+      pointPrograms.resolve = std::move(*nextProgram++);
+      pointPrograms.lines = std::move(*nextProgram++);
+      programs.hasPointClouds = true;
+    }
+    if (m_options.useIndirectDraws) {
+      programs.indirect = std::move(*nextProgram++);
+      bindMaterialTextureArrays(programs.indirect);
+      bindLights(programs.indirect);
+      programs.indirect.bindUniformBlock(
+          "CameraUniforms", CAMERA_UNIFORMS_BINDING, sizeof(CameraUniforms));
+      programs.cullDraws = std::move(*nextProgram++);
+      if (usesTriangleCulling()) {
+        programs.cullTriangles = std::move(*nextProgram++);
+      }
+      if (usesVisibilityBuffer()) {
+        programs.resolveVisibility = std::move(*nextProgram++);
+        bindMaterialTextureArrays(programs.resolveVisibility);
+        bindLights(programs.resolveVisibility);
+        programs.resolveVisibility.bindUniformBlock(
+            "CameraUniforms", CAMERA_UNIFORMS_BINDING, sizeof(CameraUniforms));
+      }
+    }
+    if (m_options.gpuTransforms) {
+      programs.propagateTransforms = std::move(*nextProgram++);
+      programs.updateDrawTransforms = std::move(*nextProgram++);
+    }
+    if (m_options.gpuBounds) {
+      programs.reduceBounds = std::move(*nextProgram++);
+    }
+    if (m_options.occlusionQueries && canDrawDepthPrepass()) {
+      programs.occlusionBoxes = std::move(*nextProgram++);
+    }
+    if (useDepthPyramid) {
+      programs.copyDepth = std::move(*nextProgram++);
+      programs.reduceDepth = std::move(*nextProgram++);
+    }
+    if (useAmbientOcclusion) {
+      programs.computeAmbientOcclusion = std::move(*nextProgram++);
+      // Computed from the depth pre-pass, for the fragment shaders
+      // including ambient_occlusion.glsl
+      programs.hasAmbientOcclusion =
+          programs.hasDepthPrepass &&
+          programs.forward.bindUniformBlock("AmbientOcclusionUniforms",
+              AmbientOcclusion::UNIFORMS_BINDING,
+              sizeof(AmbientOcclusion::Uniforms));
+    }
+    if (useOit) {
+      programs.resolveTransparency = std::move(*nextProgram++);
+      // Scene programs share the fragment shader of forward
+      programs.hasTransparentPass = bindTransparency(programs.forward);
+      if (programs.hasTransparentPass) {
+        bindTransparency(programs.skinned);
+        bindTransparency(programs.instanced);
+        bindTransparency(programs.indirect);
+        bindTransparency(programs.resolveTransparency);
+      }
+    }
+    if (useTaa) {
+      programs.resolveTemporalAA = std::move(*nextProgram++);
+      programs.writesMotionVectors =
+          glGetFragDataLocation(programs.forward.glId(), "fMotionVector") ==
+          GLint(TemporalAntiAliasing::MOTION_VECTORS_LOCATION);
+      if (!programs.writesMotionVectors) {
+        std::cerr << "Warning: the fragment shader writes no motion "
+                     "vectors, temporal anti-aliasing is disabled"
+                  << std::endl;
+      }
+    }
+    if (useAccumulation) {
+      programs.accumulate = std::move(*nextProgram++);
+    }
+    if (usePostProcessing) {
+      auto &postProcessing = programs.postProcessing;
+      postProcessing.exposure = std::move(*nextProgram++);
+      postProcessing.downsampleBloom = std::move(*nextProgram++);
+      postProcessing.upsampleBloom = std::move(*nextProgram++);
+      postProcessing.toneMapping = std::move(*nextProgram++);
+    }
+    if (useVariableRateShading) {
+      programs.updateShadingRate = std::move(*nextProgram++);
+      programs.showShadingRate = std::move(*nextProgram++);
+    }
+  }
+  return scenePrograms;
+}
+
+void ViewerApplication::compileMaterialPermutations(
+    const Scene &scene, const ScenePrograms &programs) const
+{
+  if (!m_options.materialPermutations || programs.forwardShaders.empty() ||
+      !programs.readsMaterials || !programs.hasDrawUniformBlock) {
+    return;
+  }
+  TRACE_ZONE("Compile material permutations");
+  LoadReport::Scope reportScope{m_pLoadReport.get(), LoadPhase::ShaderCompile};
+  auto &keys = programs.permutationKeys;
+  ProgramBuilder builder;
+  std::vector<uint32_t> newKeys;
+  for (const auto key : scene.materialPermutations.keys) {
+    if (std::find(begin(keys), end(keys), key) != end(keys)) {
+      continue;
+    }
+    // Masked materials also get the variant of multisampled targets
+    std::vector<uint32_t> variants{key};
+    if ((key & MATERIAL_ALPHA_MASK) && programs.writesCoverage) {
+      variants.push_back(key | MATERIAL_ALPHA_TO_COVERAGE);
+    }
+    if (keys.size() + newKeys.size() + variants.size() >
+        MAX_MATERIAL_PERMUTATIONS) {
+      std::cerr << "Warning: too many material permutations, the others are "
+                   "drawn with the forward program"
+                << std::endl;
+      break;
+    }
+    for (const auto variant : variants) {
+      auto defines = programs.forwardDefines;
+      const auto permutationDefines = getMaterialPermutationDefines(variant);
+      defines.insert(begin(permutationDefines), end(permutationDefines));
+      builder.add(programs.forwardShaders, std::move(defines));
+      newKeys.push_back(variant);
+    }
+  }
+  if (newKeys.empty()) {
+    return;
+  }
+  // Their materials keep the forward program if they fail to build, whose
+  // log has been printed by ProgramBuilder
+  std::vector<GLProgram> built;
+  try {
+    built = builder.build();
+  } catch (const std::exception &) {
+    std::cerr << "Warning: material permutations failed to build"
+              << std::endl;
+    return;
+  }
+  for (auto &program : built) {
+    bindMaterialTextureArrays(program);
+    bindLights(program);
+    bindDrawUniforms(program);
+    if (programs.hasTransparentPass) {
+      bindTransparency(program);
+    }
+    programs.permutations.push_back(std::move(program));
+  }
+  keys.insert(end(keys), begin(newKeys), end(newKeys));
+  std::clog << "Compiled " << newKeys.size() << " material permutations"
+            << std::endl;
+}
+
+void ViewerApplication::streamTextures(Scene &scene, const Camera &camera,
+    const glm::mat4 &projMatrix, const std::vector<uint32_t> *viewMasks,
+    const std::vector<Camera> &predictedCameras) const
+{
+  TRACE_ZONE("Texture streaming");
+  const auto &model = scene.compact;
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+  auto &streamer = scene.textureStreamer;
+
+  // Without texture coordinates to go by, a texture is assumed to span the
+  // bounds of the draws that sample it: their diagonal at their distance
+  // covers diagonal * pixelsPerUnit / distance pixels
+  const auto pixelsPerUnit = 0.5f * projMatrix[1][1] * float(m_nWindowHeight);
+  const auto requestTexture = [&](int textureIdx, float pixelSize) {
+    if (textureIdx >= 0 && size_t(textureIdx) < upload.textureImages.size() &&
+        upload.textureImages[textureIdx] >= 0) {
+      streamer.request(size_t(upload.textureImages[textureIdx]), pixelSize);
+    }
+  };
+
+  std::vector<uint8_t> isDrawVisible(scene.drawBoundsMin.size(), 0);
+  const auto requestDraws = [&](const glm::vec3 &eye) {
+    const auto &meshNodes = hierarchy.meshNodes();
+    for (size_t i = 0, drawIdx = 0; i < meshNodes.size(); ++i) {
+      const auto meshIdx = hierarchy.mesh(meshNodes[i]);
+      const auto primitiveCount = model.mesh(meshIdx).primitiveCount;
+      for (size_t pIdx = 0; pIdx < primitiveCount; ++pIdx, ++drawIdx) {
+        const auto material =
+            model.material(model.primitive(meshIdx, pIdx).material);
+        if (!isDrawVisible[drawIdx] || !material) {
+          continue;
+        }
+        // Unbounded draws ask for every level
+        auto pixelSize = std::numeric_limits<float>::max();
+        const auto &bboxMin = scene.drawBoundsMin[drawIdx];
+        const auto &bboxMax = scene.drawBoundsMax[drawIdx];
+        if (bboxMax.x < std::numeric_limits<float>::max()) {
+          const auto distance = glm::length(
+              glm::max(glm::max(bboxMin - eye, eye - bboxMax), glm::vec3(0)));
+          const auto diagonal = glm::length(bboxMax - bboxMin);
+          pixelSize = distance > 0.f ? diagonal * pixelsPerUnit / distance
+                                     : std::numeric_limits<float>::max();
+        }
+        requestTexture(material->baseColorTexture, pixelSize);
+        requestTexture(material->metallicRoughnessTexture, pixelSize);
+        requestTexture(material->normalTexture, pixelSize);
+        requestTexture(material->occlusionTexture, pixelSize);
+        requestTexture(material->emissiveTexture, pixelSize);
+      }
+    }
+  };
+  const auto requestFrustum = [&](const Camera &camera) {
+    std::fill(begin(isDrawVisible), end(isDrawVisible), uint8_t(0));
+    scene.bvh.forEachInFrustum(
+        extractFrustum(projMatrix * camera.getViewMatrix()),
+        [&](size_t drawIdx) { isDrawVisible[drawIdx] = 1; });
+    requestDraws(camera.eye());
+  };
+
+  if (viewMasks) {
+    for (size_t drawIdx = 0; drawIdx < viewMasks->size(); ++drawIdx) {
+      isDrawVisible[drawIdx] = (*viewMasks)[drawIdx] != 0;
+    }
+    requestDraws(camera.eye());
+  } else {
+    requestFrustum(camera);
+  }
+  // The largest request of the frame wins: a texture that will be seen up
+  // close is streamed before it is
+  for (const auto &predictedCamera : predictedCameras) {
+    requestFrustum(predictedCamera);
+  }
+
+  streamer.update(m_options.uploadBytesPerFrame);
+}
+
+size_t ViewerApplication::getViewCount() const
+{
+  if (!m_OutputPath.empty() && m_options.thumbnailCount) {
+    return m_options.thumbnailCount;
+  }
+  if (m_options.stereo) {
+    return 2;
+  }
+  return m_OutputPath.empty() ? std::max(m_options.viewCount, size_t(1)) : 1;
+}
+
+std::vector<uint32_t> ViewerApplication::cullViews(
+    const Scene &scene, const std::vector<glm::mat4> &viewProjMatrices) const
+{
+  TRACE_ZONE("Cull views");
+  std::vector<Frustum> frusta;
+  frusta.reserve(viewProjMatrices.size());
+  for (const auto &viewProjMatrix : viewProjMatrices) {
+    frusta.push_back(extractFrustum(viewProjMatrix));
+  }
+  std::vector<uint32_t> viewMasks(scene.drawBoundsMin.size(), 0);
+  scene.bvh.forEachInFrusta(frusta.data(), frusta.size(),
+      [&](size_t drawIdx, uint32_t mask) { viewMasks[drawIdx] = mask; });
+  return viewMasks;
+}
+
+bool ViewerApplication::switchScene(Scene &scene, int sceneIdx) const
+{
+  TRACE_ZONE("Switch scene");
+  auto &model = scene.model;
+  if (sceneIdx < 0 || size_t(sceneIdx) >= model.scenes.size() ||
+      !scene.skins.empty() || !scene.morphs.empty()) {
+    return false;
+  }
+  const auto startTime = std::chrono::steady_clock::now();
+  model.defaultScene = sceneIdx;
+  scene.hierarchy = SceneHierarchy{model, scene.buffers};
+  scene.animations = SceneAnimations{model, scene.buffers, scene.hierarchy};
+  scene.lights = SceneLights{model, scene.hierarchy};
+  scene.pointClouds.setInstances(scene.hierarchy);
+  if (size_t(scene.animation) >= scene.animations.animationCount()) {
+    scene.animation = -1;
+  }
+  scene.animationTime = -1.;
+  scene.previousWorldMatrices.clear();
+
+  // Built again rather than refitted, even with as many primitives
+  scene.bvh = BoundingVolumeHierarchy();
+  scene.hasGpuBounds = false;
+  updateDrawBounds(scene);
+  if (m_options.useInstancing) {
+    buildInstancedDraws(scene);
+  }
+  scene.hasIndirectDraws = false;
+  // The bounds of the file are those of its default scene
+  scene.bboxMin = glm::vec3(std::numeric_limits<float>::max());
+  scene.bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+  for (size_t drawIdx = 0; drawIdx < scene.drawBoundsMin.size(); ++drawIdx) {
+    if (scene.drawBoundsMin[drawIdx].x <= scene.drawBoundsMax[drawIdx].x &&
+        scene.drawBoundsMax[drawIdx].x < std::numeric_limits<float>::max()) {
+      scene.bboxMin = glm::min(scene.bboxMin, scene.drawBoundsMin[drawIdx]);
+      scene.bboxMax = glm::max(scene.bboxMax, scene.drawBoundsMax[drawIdx]);
+    }
+  }
+  ++scene.poseVersion;
+  scene.switchTime = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - startTime)
+                         .count();
+  std::clog << "Switched to scene " << sceneIdx << " ("
+            << scene.drawBoundsMin.size() << " draws) in " << scene.switchTime
+            << " ms" << std::endl;
+  return true;
+}
+
+void ViewerApplication::buildGpuBounds(
+    Scene &scene, const std::vector<GLuint> *indirectDraws) const
+{
+  TRACE_ZONE("Build GPU bounds");
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+
+  std::vector<GpuBounds::Range> ranges;
+  scene.gpuBoundedDraws.clear();
+  size_t drawIdx = 0; // In scene.drawBoundsMin/Max
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    const auto &range = upload.meshToPrimitives[hierarchy.mesh(flatIdx)];
+    const auto isSkinned =
+        !scene.skins.empty() && scene.skins.nodeSkin(flatIdx) >= 0;
+    const auto isMorphed = scene.morphs.weights().weightCount(flatIdx) > 0;
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx, ++drawIdx) {
+      const auto primitiveIdx = range.begin + pIdx;
+      const auto &primitive = upload.primitives[primitiveIdx];
+      const auto hasBounds =
+          glm::all(glm::lessThanEqual(upload.primitiveBoundsMin[primitiveIdx],
+              upload.primitiveBoundsMax[primitiveIdx]));
+      // Skinned in the vertex shader, the arena holds the bind pose
+      if ((isSkinned && !m_options.skinningPrepass) ||
+          (hasBounds && !isSkinned && !isMorphed) ||
+          !primitive.vertexCount) {
+        continue;
+      }
+      ranges.push_back({GLuint(primitive.baseVertex), primitive.vertexCount,
+          indirectDraws ? (*indirectDraws)[drawIdx] : GpuBounds::NO_DRAW});
+      scene.gpuBoundedDraws.push_back(
+          {drawIdx, uint32_t(flatIdx), uint32_t(primitiveIdx)});
+    }
+  }
+  scene.gpuBounds.build(ranges);
+  scene.gpuDrawBoundsMin.clear();
+  scene.gpuDrawBoundsMax.clear();
+  scene.hasGpuBounds = true;
+}
+
+void ViewerApplication::reduceDrawBounds(
+    Scene &scene, const ScenePrograms &programs) const
+{
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+  // Skinned vertices are in world space
+  std::vector<glm::mat4> matrices;
+  matrices.reserve(scene.gpuBoundedDraws.size());
+  for (const auto &draw : scene.gpuBoundedDraws) {
+    const auto isSkinned =
+        !scene.skins.empty() && scene.skins.nodeSkin(draw.flatIdx) >= 0;
+    matrices.push_back(
+        isSkinned ? glm::mat4(1)
+                  : hierarchy.worldMatrix(draw.flatIdx) *
+                        upload.primitives[draw.primitiveIdx].positionMatrix());
+  }
+  const auto isFirstReduction = !scene.gpuBounds.hasReduced();
+  scene.gpuBounds.reduce(programs.reduceBounds, upload.arena, matrices,
+      scene.hasIndirectDraws ? scene.indirectDraws.boundsBuffer() : 0);
+  // Indirect draws are culled on the GPU, the CPU only needs the scene
+  // bounds once
+  if (getRenderPath() != RenderPath::Indirect || isFirstReduction) {
+    scene.gpuBounds.requestReadback();
+  }
+}
+
+void ViewerApplication::updateDrawBounds(Scene &scene) const
+{
+  TRACE_ZONE("Update draw bounds");
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+
+  auto &drawBoundsMin = scene.drawBoundsMin;
+  auto &drawBoundsMax = scene.drawBoundsMax;
+  drawBoundsMin.clear();
+  drawBoundsMax.clear();
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    const auto &range = upload.meshToPrimitives[hierarchy.mesh(flatIdx)];
+    const auto isSkinned =
+        (!scene.skins.empty() && scene.skins.nodeSkin(flatIdx) >= 0) ||
+        scene.morphs.weights().weightCount(flatIdx) > 0;
+    const auto *localMins = upload.primitiveBoundsMin.data() + range.begin;
+    const auto *localMaxs = upload.primitiveBoundsMax.data() + range.begin;
+    const auto firstDraw = drawBoundsMin.size();
+    drawBoundsMin.resize(firstDraw + range.count);
+    drawBoundsMax.resize(firstDraw + range.count);
+    // Boxes of the primitives of the node in one batch, those that have none
+    // give garbage replaced below
+    transformBoxes(hierarchy.worldMatrix(flatIdx), localMins, localMaxs,
+        range.count, drawBoundsMin.data() + firstDraw,
+        drawBoundsMax.data() + firstDraw);
+    for (size_t i = 0; i < range.count; ++i) {
+      // Primitives without bounds are never culled, nor skinned or morphed
+      // ones whose bounds follow their joints and weights
+      if (isSkinned ||
+          !glm::all(glm::lessThanEqual(localMins[i], localMaxs[i]))) {
+        drawBoundsMin[firstDraw + i] =
+            glm::vec3(-std::numeric_limits<float>::max());
+        drawBoundsMax[firstDraw + i] =
+            glm::vec3(std::numeric_limits<float>::max());
+      }
+    }
+  }
+  // Boxes reduced on the GPU, in the pose of their reduction
+  if (scene.gpuDrawBoundsMin.size() == scene.gpuBoundedDraws.size()) {
+    for (size_t i = 0; i < scene.gpuBoundedDraws.size(); ++i) {
+      const auto drawIdx = scene.gpuBoundedDraws[i].drawIdx;
+      if (glm::all(glm::lessThanEqual(
+              scene.gpuDrawBoundsMin[i], scene.gpuDrawBoundsMax[i]))) {
+        drawBoundsMin[drawIdx] = scene.gpuDrawBoundsMin[i];
+        drawBoundsMax[drawIdx] = scene.gpuDrawBoundsMax[i];
+      }
+    }
+  }
+
+  // The primitives of a scene never change, only their transforms
+  if (scene.bvh.primitiveCount() == scene.drawBoundsMin.size()) {
+    scene.bvh.refit(scene.drawBoundsMin, scene.drawBoundsMax);
+  } else {
+    const auto startTime = std::chrono::steady_clock::now();
+    scene.bvh.build(scene.drawBoundsMin, scene.drawBoundsMax);
+    scene.bvhBuildTime = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime)
+                             .count();
+  }
+}
+
+bool ViewerApplication::updateScenePose(
+    Scene &scene, const ScenePrograms &programs, double time) const
+{
+  TRACE_ZONE("Update scene pose");
+  if (programs.writesMotionVectors) {
+    scene.previousWorldMatrices = scene.hierarchy.worldMatrices();
+  }
+  if (scene.animation >= 0 && time != scene.animationTime) {
+    scene.animations.apply(size_t(scene.animation), time, scene.hierarchy,
+        scene.morphs.weights());
+    scene.animationTime = time;
+  }
+  const auto hasMoved = scene.hierarchy.update();
+  if (hasMoved) {
+    scene.skins.updatePalettes(scene.hierarchy);
+  }
+  return updateSceneVertices(scene, programs, hasMoved);
+}
+
+bool ViewerApplication::updateScenePose(Scene &scene,
+    const ScenePrograms &programs, PoseSimulation &simulation) const
+{
+  TRACE_ZONE("Update scene pose");
+  auto hasMoved = false;
+  if (programs.writesMotionVectors) {
+    scene.previousWorldMatrices = scene.hierarchy.worldMatrices();
+  }
+  if (simulation.acquire()) {
+    const auto &pose = simulation.pose();
+    scene.hierarchy.setWorldMatrices(pose.worldMatrices, &pose.worldOrigins);
+    scene.skins.setPalettes(pose.palettes);
+    scene.morphs.weights().setValues(pose.weights);
+    scene.animationTime = pose.time;
+    hasMoved = true;
+  }
+  return updateSceneVertices(scene, programs, hasMoved);
+}
+
+bool ViewerApplication::updateSceneVertices(
+    Scene &scene, const ScenePrograms &programs, bool hasMoved) const
+{
+  glm::vec3 sceneMin, sceneMax;
+  const auto hasGpuBounds = scene.gpuBounds.poll(scene.gpuDrawBoundsMin,
+      scene.gpuDrawBoundsMax, sceneMin, sceneMax);
+  if (hasGpuBounds && sceneMin.x <= sceneMax.x) {
+    // The scene bounds grow to hold the posed vertices
+    scene.bboxMin = glm::min(scene.bboxMin, sceneMin);
+    scene.bboxMax = glm::max(scene.bboxMax, sceneMax);
+  }
+  if (hasMoved || hasGpuBounds) {
+    updateDrawBounds(scene);
+  }
+  if (hasMoved && scene.hasIndirectDraws && !scene.gpuTransforms.empty()) {
+    scene.gpuTransforms.update(scene.hierarchy, programs.propagateTransforms);
+    scene.indirectDraws.updateTransforms(programs.updateDrawTransforms,
+        scene.gpuTransforms.worldMatrixBuffer(),
+        scene.gpuTransforms.updatedNodes());
+  }
+  // Morphed meshes that are skinned by the pre-pass are blended into its
+  // bind pose, then skinned again
+  auto hasMorphed = false;
+  if (programs.hasMorphPrepass && !scene.morphs.empty() &&
+      scene.upload.done()) {
+    hasMorphed = scene.morphs.blendVertices(scene.upload.arena,
+        programs.blendMorphs,
+        programs.hasSkinningPrepass ? &scene.skins : nullptr);
+  }
+  // The pre-pass reads the bind pose from the arena the first time
+  if (programs.hasSkinningPrepass && !scene.skins.empty() &&
+      scene.upload.done() &&
+      (hasMoved || hasMorphed || !scene.hasSkinnedVertices)) {
+    scene.skins.skinVertices(scene.upload.arena, programs.skinVertices);
+    scene.hasSkinnedVertices = true;
+  }
+  if (m_options.gpuBounds && scene.upload.done()) {
+    if (!scene.hasGpuBounds) {
+      buildGpuBounds(scene);
+    }
+    if (!scene.gpuBounds.empty() &&
+        (hasMoved || hasMorphed || !scene.gpuBounds.hasReduced())) {
+      reduceDrawBounds(scene, programs);
+    }
+  }
+  if (hasMoved || hasMorphed) {
+    ++scene.poseVersion;
+  }
+  return hasMoved || hasMorphed;
+}
+
+int ViewerApplication::pickPrimitive(const Scene &scene,
+    const glm::vec3 &origin, const glm::vec3 &direction,
+    float &distance) const
+{
+  const auto &model = scene.model;
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+
+  // Node and glTF primitive of each draw
+  std::vector<std::pair<uint32_t, uint32_t>> draws;
+  draws.reserve(scene.drawBoundsMin.size());
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    const auto &range = upload.meshToPrimitives[hierarchy.mesh(flatIdx)];
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx) {
+      draws.emplace_back(flatIdx, uint32_t(pIdx));
+    }
+  }
+
+  // Triangles are tested in the local space of their node, where the ray
+  // keeps the same parametrization
+  std::vector<float> positions;
+  std::vector<uint32_t> indices;
+  const auto intersectPrimitive = [&](size_t drawIdx, float &tMax) {
+    const auto flatIdx = draws[drawIdx].first;
+    const auto &primitive = scene.compact.primitive(
+        hierarchy.mesh(flatIdx), draws[drawIdx].second);
+    const auto position = primitive.attribute(VertexAttribute::Position);
+    if (primitive.mode != TINYGLTF_MODE_TRIANGLES || position < 0) {
+      return false;
+    }
+    const auto &positionAccessor = model.accessors[position];
+    positions.resize(positionAccessor.count * 3);
+    readAccessorAsFloats(
+        model, scene.buffers, positionAccessor, 3, positions.data());
+    if (primitive.indices >= 0) {
+      const auto &indexAccessor = model.accessors[primitive.indices];
+      indices.resize(indexAccessor.count);
+      readAccessorAsUints(model, scene.buffers, indexAccessor, indices.data());
+    } else {
+      indices.resize(positionAccessor.count);
+      std::iota(begin(indices), end(indices), 0);
+    }
+
+    const auto worldToLocal = glm::inverse(hierarchy.worldMatrix(flatIdx));
+    const auto o = glm::vec3(worldToLocal * glm::vec4(origin, 1));
+    const auto d = glm::vec3(worldToLocal * glm::vec4(direction, 0));
+    const auto getPosition = [&](uint32_t index) {
+      return glm::make_vec3(positions.data() + 3 * size_t(index));
+    };
+    auto hit = false;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      if (std::max({indices[i], indices[i + 1], indices[i + 2]}) >=
+          positionAccessor.count) {
+        continue;
+      }
+      // Moller-Trumbore, both faces are hit
+      const auto p0 = getPosition(indices[i]);
+      const auto e1 = getPosition(indices[i + 1]) - p0;
+      const auto e2 = getPosition(indices[i + 2]) - p0;
+      const auto p = glm::cross(d, e2);
+      const auto det = glm::dot(e1, p);
+      if (det == 0.f) {
+        continue;
+      }
+      const auto invDet = 1.f / det;
+      const auto s = o - p0;
+      const auto u = glm::dot(s, p) * invDet;
+      const auto q = glm::cross(s, e1);
+      const auto v = glm::dot(d, q) * invDet;
+      const auto t = glm::dot(e2, q) * invDet;
+      if (u >= 0.f && v >= 0.f && u + v <= 1.f && t >= 0.f && t < tMax) {
+        tMax = t;
+        hit = true;
+      }
+    }
+    return hit;
+  };
+
+  distance = std::numeric_limits<float>::max();
+  return scene.bvh.intersectRay(
+      origin, direction, distance, intersectPrimitive);
+}
+
+bool ViewerApplication::getSceneBounds(
+    const Scene &scene, glm::vec3 &bboxMin, glm::vec3 &bboxMax) const
+{
+  // The BVH misses primitives without accessor bounds
+  if (scene.bvh.getBounds(bboxMin, bboxMax)) {
+    return true;
+  }
+  bboxMin = scene.bboxMin;
+  bboxMax = scene.bboxMax;
+  return glm::all(glm::lessThanEqual(bboxMin, bboxMax));
+}
+
+glm::mat4 ViewerApplication::getProjMatrix(
+    const Scene &scene, const Camera &camera, float aspectRatio) const
+{
+  glm::vec3 bboxMin, bboxMax;
+  if (!getSceneBounds(scene, bboxMin, bboxMax)) {
+    // Default planes
+    bboxMin = glm::vec3(1);
+    bboxMax = glm::vec3(0);
+  }
+  return getProjMatrix(bboxMin, bboxMax, camera, aspectRatio);
+}
+
+glm::mat4 ViewerApplication::getProjMatrix(const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax, const Camera &camera, float aspectRatio) const
+{
+  // Reversed-Z keeps its precision with a much closer near plane
+  const auto minNearRatio = m_options.reversedZ ? 1e-7f : 1e-4f;
+  auto zNear = DEFAULT_NEAR;
+  auto zFar = DEFAULT_FAR;
+  if (glm::all(glm::lessThanEqual(bboxMin, bboxMax))) {
+    getNearFarPlanes(camera, bboxMin, bboxMax, zNear, zFar, minNearRatio);
+  }
+  if (m_options.reversedZ) {
+    return getReversedZPerspective(FIELD_OF_VIEW, aspectRatio, zNear);
+  }
+  return glm::perspective(FIELD_OF_VIEW, aspectRatio, zNear, zFar);
+}
+
+Camera ViewerApplication::getDefaultCamera(
+    const Scene &scene, float aspectRatio) const
+{
+  glm::vec3 bboxMin, bboxMax;
+  if (!getSceneBounds(scene, bboxMin, bboxMax)) {
+    return Camera{glm::vec3(0, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)};
+  }
+  return getFramingCamera(bboxMin, bboxMax,
+      glm::perspective(FIELD_OF_VIEW, aspectRatio, DEFAULT_NEAR, DEFAULT_FAR),
+      glm::vec3(0, 0, -1));
+}
+
+void ViewerApplication::setupDepthTest() const
+{
+  glEnable(GL_DEPTH_TEST);
+  if (m_options.reversedZ) {
+    getGLExtensions().setClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+    glDepthFunc(GL_GREATER);
+    glClearDepth(0.);
+  }
+}
+
+void ViewerApplication::trimCaches() const
+{
+  if (!m_options.cacheSizeLimit) {
+    return;
+  }
+  // Environment caches are named after their map, not content-addressed, so
+  // they are left alone
+  const std::pair<const fs::path *, std::vector<std::string>> caches[] = {
+      {&m_options.sceneCacheDirectory, {".gltfcache"}},
+      {&m_options.programCacheDirectory, {".glprogram"}}};
+  for (const auto &cache : caches) {
+    if (cache.first->empty()) {
+      continue;
+    }
+    const auto removedBytes = collectCacheGarbage(
+        *cache.first, cache.second, m_options.cacheSizeLimit);
+    if (removedBytes) {
+      std::clog << "Removed " << (removedBytes >> 10)
+                << " KB of least recently used entries from "
+                << *cache.first << std::endl;
+    }
+  }
+}
+
+void ViewerApplication::loadEnvironment()
+{
+  TRACE_ZONE("Load environment");
+  const auto &path = m_options.environmentMap;
+  if (path.empty()) {
+    return;
+  }
+  const auto startTime = glfwGetTime();
+  const auto &cacheDirectory = m_options.sceneCacheDirectory;
+  if (m_environment.readCache(path, cacheDirectory)) {
+    std::clog << "Read environment cache of " << path << " in "
+              << 1000. * (glfwGetTime() - startTime) << " ms" << std::endl;
+    return;
+  }
+
+  const auto shadersPath = m_ShadersRootPath / m_AppName;
+  const auto shader = shadersPath / "ibl_prefilter.cs.glsl";
+  ProgramBuilder builder;
+  builder.add({shader}, {{"IRRADIANCE", ""}});
+  builder.add({shader}, {{"SPECULAR", ""}});
+  builder.add({shader}, {{"BRDF_LUT", ""}});
+  auto builtPrograms = builder.build();
+  EnvironmentLighting::Programs programs;
+  programs.irradiance = std::move(builtPrograms[0]);
+  programs.specular = std::move(builtPrograms[1]);
+  programs.brdfLut = std::move(builtPrograms[2]);
+
+  std::string err;
+  if (!m_environment.compute(path, programs, err)) {
+    std::cerr << "Warning: " << err << std::endl;
+    m_environment = EnvironmentLighting();
+    return;
+  }
+  {
+    SyncScope sync{"ViewerApplication::loadEnvironment"};
+    glFinish();
+  }
+  std::clog << "Computed environment lighting of " << path << " in "
+            << 1000. * (glfwGetTime() - startTime) << " ms" << std::endl;
+  if (m_environment.writeCache(path, cacheDirectory, err)) {
+    std::clog << "Wrote environment cache of " << path << std::endl;
+  } else {
+    std::cerr << "Warning: " << err << std::endl;
+  }
+}
+
+size_t ViewerApplication::getOutputTileSize(size_t width, size_t height) const
+{
+  const auto tileSize = getMaxTileSize(m_options.tileSize);
+  return width > tileSize || height > tileSize ? tileSize : 0;
+}
+
+size_t ViewerApplication::getOutputSamples() const
+{
+  // The lit G-buffer is blitted to the framebuffer of the image, which
+  // cannot be multisampled
+  return m_options.deferredShading ? 0 : m_options.outputSamples;
+}
+
+std::unique_ptr<GpuTelemetry> ViewerApplication::createGpuTelemetry() const
+{
+  if (!m_options.gpuTelemetry) {
+    return nullptr;
+  }
+  const auto *renderer = glGetString(GL_RENDERER);
+  auto telemetry = std::make_unique<GpuTelemetry>(
+      renderer ? reinterpret_cast<const char *>(renderer) : "");
+  if (!telemetry->isAvailable()) {
+    std::cerr << "Warning: no GPU telemetry, neither NVML nor amdgpu was "
+                 "found"
+              << std::endl;
+    return nullptr;
+  }
+  std::clog << "GPU telemetry of " << telemetry->deviceName() << " from "
+            << telemetry->sourceName() << std::endl;
+  return telemetry;
+}
+
+const GLProgram *ViewerApplication::loadFxaaProgram()
+{
+  if (!m_options.outputFxaa) {
+    return nullptr;
+  }
+  const auto shadersPath = m_ShadersRootPath / m_AppName;
+  ProgramBuilder builder;
+  builder.add(
+      {shadersPath / "fullscreen.vs.glsl", shadersPath / "fxaa.fs.glsl"});
+  m_fxaaProgram = std::move(builder.build().front());
+  return &m_fxaaProgram;
+}
+
+const GLProgram *ViewerApplication::loadYuvProgram()
+{
+  if (!m_options.outputYuv) {
+    return nullptr;
+  }
+  if (!m_yuvProgram.glId()) {
+    const auto shadersPath = m_ShadersRootPath / m_AppName;
+    ProgramBuilder builder;
+    builder.add({shadersPath / "rgb_to_yuv.cs.glsl"});
+    m_yuvProgram = std::move(builder.build().front());
+  }
+  return &m_yuvProgram;
+}
+
+const GLProgram *ViewerApplication::loadMipmapProgram()
+{
+  if (!m_options.gpuMipmaps) {
+    return nullptr;
+  }
+  if (!m_mipmapProgram.glId()) {
+    const auto shadersPath = m_ShadersRootPath / m_AppName;
+    ProgramBuilder builder;
+    builder.add({shadersPath / "downsample_texture.cs.glsl"});
+    m_mipmapProgram = std::move(builder.build().front());
+  }
+  return &m_mipmapProgram;
+}
+
+std::unique_ptr<ViewerApplication::Scene> ViewerApplication::loadOfflineScene(
+    const fs::path &path, const std::vector<ScenePrograms> &programs,
+    size_t &gpuBytes, size_t &hostBytes)
+{
+  // Nothing else allocates GL memory during the load
+  const auto gpuBytesBefore = getGLMemoryUsage().totalBytes();
+  auto scene = std::make_unique<Scene>();
+  if (!loadGltfFile(path, *scene)) {
+    return nullptr;
+  }
+  beginSceneUpload(*scene);
+  uploadMeshes(*scene, std::numeric_limits<size_t>::max());
+  updateScenePose(*scene, programs.front(), 0.);
+  if (m_options.useIndirectDraws) {
+    buildIndirectDraws(*scene);
+  }
+  if (std::any_of(begin(programs), end(programs),
+          [](const ScenePrograms &programs) {
+            return programs.readsMaterials;
+          })) {
+    buildMaterials(*scene);
+  }
+  for (const auto &scenePrograms : programs) {
+    compileMaterialPermutations(*scene, scenePrograms);
+  }
+  gpuBytes = getGLMemoryUsage().totalBytes() - gpuBytesBefore;
+  hostBytes = getSceneHostBytes(*scene);
+  return scene;
+}
+
+size_t ViewerApplication::getSceneHostBytes(const Scene &scene)
+{
+  // The buffers and images left after the upload dominate, memory mapped
+  // files are left to the page cache
+  auto hostBytes = (scene.drawBoundsMin.size() + scene.drawBoundsMax.size()) *
+                   sizeof(glm::vec3);
+  for (const auto &buffer : scene.model.buffers) {
+    hostBytes += buffer.data.size();
+  }
+  for (const auto &image : scene.model.images) {
+    hostBytes += image.image.size();
+  }
+  return hostBytes;
+}
+
+ModelCache<ViewerApplication::Scene>
+ViewerApplication::createModelCache() const
+{
+  return {m_options.modelCacheSize, m_options.modelCacheGpuBudget,
+      m_options.modelCacheHostBudget};
+}
+
+Camera ViewerApplication::getOfflineCamera(const Scene &scene,
+    const std::vector<float> &lookat, float aspectRatio) const
+{
+  // Same default camera as the interactive viewer
+  if (lookat.size() != 9) {
+    return getDefaultCamera(scene, aspectRatio);
+  }
+  return Camera{glm::vec3(lookat[0], lookat[1], lookat[2]),
+      glm::vec3(lookat[3], lookat[4], lookat[5]),
+      glm::vec3(lookat[6], lookat[7], lookat[8])};
+}
+
+int ViewerApplication::writeImageSequence(
+    const std::function<void(double)> &drawFrame)
+{
+  const auto width = size_t(m_nWindowWidth);
+  const auto height = size_t(m_nWindowHeight);
+  if (getOutputTileSize(width, height)) {
+    std::cerr << "Error: sequences are not rendered in tiles, their size "
+                 "must be at most the tile size"
+              << std::endl;
+    return -1;
+  }
+  const auto toStandardOutput = m_OutputPath == "-";
+  const auto isYuv = toStandardOutput && m_options.outputYuv;
+  if (isYuv && (width % 2 || height % 2)) {
+    std::cerr << "Error: I420 frames must have an even width and height"
+              << std::endl;
+    return -1;
+  }
+  if (!toStandardOutput && m_options.outputYuv) {
+    std::cerr << "Warning: I420 frames are only written on the standard "
+                 "output, writing image files"
+              << std::endl;
+  }
+#ifdef _WIN32
+  if (toStandardOutput) {
+    _setmode(_fileno(stdout), _O_BINARY);
+  }
+#endif
+
+  // Raw frames are written in order by one thread at a time, PNG frames are
+  // encoded by several (each with the parallel encoder of writePng), as EXR
+  // frames, read as half floats. I420 frames are read top row first.
+  const auto isHdr = !toStandardOutput && isExrPath(m_OutputPath);
+  const size_t numComponents = 3;
+  const size_t maxPendingImages = 3;
+  const size_t maxPendingWrites = toStandardOutput ? 1 : 4;
+  ImageRenderer renderer(width, height, numComponents, maxPendingImages,
+      getOutputSamples(), loadFxaaProgram(),
+      isHdr ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE,
+      isYuv ? loadYuvProgram() : nullptr);
+  std::deque<std::future<bool>> pendingWrites;
+  size_t failureCount = 0;
+  size_t readFrameCount = 0;
+  const auto finishOldestWrite = [&]() {
+    if (!pendingWrites.front().get()) {
+      ++failureCount;
+    }
+    pendingWrites.pop_front();
+  };
+  const auto writeOldestFrame = [&]() {
+    const auto frameIdx = readFrameCount++;
+    auto pixels = std::make_shared<std::vector<unsigned char>>(
+        renderer.imageSize());
+    renderer.readPixels(pixels->data());
+    if (pendingWrites.size() == maxPendingWrites) {
+      finishOldestWrite();
+    }
+    pendingWrites.emplace_back(std::async(std::launch::async,
+        [this, toStandardOutput, isHdr, isYuv, width, height, numComponents,
+            frameIdx, pixels]() {
+          if (isYuv) {
+            if (std::fwrite(pixels->data(), 1, pixels->size(), stdout) !=
+                pixels->size()) {
+              std::cerr << "Error: unable to write frame " << frameIdx
+                        << " on the standard output" << std::endl;
+              return false;
+            }
+            return true;
+          }
+          if (toStandardOutput) {
+            // Pixels are read bottom row first
+            const auto rowSize = width * numComponents;
+            for (size_t y = height; y-- > 0;) {
+              if (std::fwrite(pixels->data() + y * rowSize, 1, rowSize,
+                      stdout) != rowSize) {
+                std::cerr << "Error: unable to write frame " << frameIdx
+                          << " on the standard output" << std::endl;
+                return false;
+              }
+            }
+            return true;
+          }
+          const auto path = getSequenceFramePath(m_OutputPath, frameIdx);
+          std::string err;
+          const auto isWritten =
+              isHdr ? writeExr(path, width, height, numComponents,
+                          (const uint16_t *)pixels->data(), true, err)
+                    : writePng(path, width, height, numComponents,
+                          pixels->data(), true, err);
+          if (!isWritten) {
+            std::cerr << "Error: " << err << std::endl;
+            return false;
+          }
+          return true;
+        }));
+  };
+
+  const auto frameCount = m_options.outputFrameCount;
+  const auto startTime = std::chrono::steady_clock::now();
+  for (size_t frameIdx = 0; frameIdx < frameCount; ++frameIdx) {
+    if (renderer.pendingImageCount() == renderer.maxPendingImageCount()) {
+      writeOldestFrame();
+    }
+    renderer.render(
+        [&]() { drawFrame(double(frameIdx) * m_options.fixedTimeStep); });
+  }
+  while (renderer.pendingImageCount()) {
+    writeOldestFrame();
+  }
+  while (!pendingWrites.empty()) {
+    finishOldestWrite();
+  }
+  if (toStandardOutput) {
+    std::fflush(stdout);
+  }
+
+  const auto time = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - startTime)
+                        .count();
+  std::clog << "Rendered " << frameCount - failureCount << " / "
+            << frameCount << " frames in " << 1000. * time << " ms ("
+            << double(frameCount) / time << " frames per second)"
+            << std::endl;
+  return failureCount ? -1 : 0;
+}
+
+bool ViewerApplication::writeTiledImage(const Scene &scene,
+    const ScenePrograms &programs, const Camera &camera,
+    const glm::mat4 &projMatrix, size_t width, size_t height, size_t tileSize,
+    const fs::path &output) const
+{
+  const size_t numComponents = 3;
+  PngWriter writer;
+  std::string err;
+  if (!writer.open(output, width, height, numComponents, err)) {
+    std::cerr << "Error: " << err << std::endl;
+    return false;
+  }
+  auto success = true;
+  renderTiledImage(width, height, numComponents, tileSize,
+      [&](const glm::mat4 &tileMatrix) {
+        glViewport(0, 0, GLsizei(tileSize), GLsizei(tileSize));
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderScene(scene, programs, camera, tileMatrix * projMatrix);
+      },
+      [&](const unsigned char *pixels, size_t rowCount) {
+        // Skip remaining rows after an error
+        success = success && writer.writeRows(pixels, rowCount, true, err);
+      },
+      getOutputSamples());
+  if (!success || !writer.close(err)) {
+    std::cerr << "Error: " << err << std::endl;
+    return false;
+  }
+  return true;
+}
+
+size_t ViewerApplication::renderScene(const Scene &scene,
+    const ScenePrograms &programs, const Camera &camera,
+    const glm::mat4 &projMatrix, Profiler *profiler,
+    const std::vector<uint32_t> *viewMasks, size_t viewIdx,
+    OcclusionQueries *occlusionQueries,
+    GpuCostAttribution *costAttribution) const
+{
+  TRACE_ZONE("Render scene");
+  TRACE_GPU_ZONE("Render scene");
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+  const auto viewMatrix = camera.getViewMatrix();
+  const auto useInstancing = m_options.useInstancing;
+  // GPU times are measured per pass only with the depth pre-pass, the
+  // caller measures the whole scene otherwise
+  const auto timePasses =
+      profiler && scene.depthPrepass && programs.hasDepthPrepass;
+
+  // Uniform blocks and instance transforms of this call are written to the
+  // next region of the ring buffer, fenced once the call is submitted
+  auto &frameData = programs.frameData;
+  frameData.beginFrame();
+  // Memory of the vectors of the previous call
+  auto &frameArena = programs.frameArena;
+  frameArena.reset();
+  const ArenaAllocator<uint8_t> frameAllocator(frameArena);
+
+  // Every path reads the materials from the same buffer, drawn primitives
+  // only give their material ID
+  if (scene.hasMaterials) {
+    scene.materials.bind();
+    if (!scene.virtualTextures.empty()) {
+      scene.virtualTextures.bind();
+    }
+  }
+  // Lights are clustered over the depth range of the scene, deferred shading
+  // culls them per tile in its lighting pass instead
+  const auto isDeferred = m_options.deferredShading && programs.readsLights;
+  if (programs.readsLights) {
+    auto zNear = DEFAULT_NEAR;
+    auto zFar = DEFAULT_FAR;
+    glm::vec3 bboxMin, bboxMax;
+    const auto hasBounds = getSceneBounds(scene, bboxMin, bboxMax);
+    if (hasBounds) {
+      getNearFarPlanes(camera, bboxMin, bboxMax, zNear, zFar, 0.f);
+    }
+    // Shadows are drawn with the depth programs of primitives drawn one by
+    // one
+    const auto castsShadows = scene.shadows && programs.hasDepthPrepass &&
+                              scene.lights.directionalCount() > 0 && hasBounds;
+    const auto castsLocalShadows =
+        scene.localShadows && programs.hasDepthPrepass &&
+        scene.lights.lightCount() > scene.lights.directionalCount() &&
+        hasBounds;
+    if (castsShadows || castsLocalShadows) {
+      std::unique_ptr<Profiler::GPUScope> timer;
+      if (timePasses) {
+        timer = std::make_unique<Profiler::GPUScope>(*profiler, "Shadows");
+      }
+      std::unique_ptr<Profiler::StatisticsScope> statistics;
+      if (profiler) {
+        statistics =
+            std::make_unique<Profiler::StatisticsScope>(*profiler, "Shadows");
+      }
+      if (castsShadows) {
+        renderShadowMaps(
+            scene, programs, viewMatrix, projMatrix, zNear, zFar);
+      }
+      if (castsLocalShadows) {
+        renderLocalShadows(scene, programs, viewMatrix, projMatrix);
+      }
+    }
+    programs.shadowMaps.bind(viewMatrix, castsShadows, frameData);
+    programs.shadowAtlas.bind(viewMatrix, castsLocalShadows, frameData);
+    auto &environmentUniforms = programs.environmentUniforms;
+    environmentUniforms.reset(sizeof(EnvironmentLighting::Uniforms), 1);
+    environmentUniforms.block<EnvironmentLighting::Uniforms>(0) =
+        m_environment.getUniforms(
+            viewMatrix, m_options.environmentIntensity);
+    environmentUniforms.upload(frameData);
+    environmentUniforms.bind(EnvironmentLighting::UNIFORMS_BINDING, 0);
+    m_environment.bind();
+    programs.lightClusters.update(scene.lights, hierarchy, viewMatrix,
+        projMatrix, zNear, zFar,
+        isDeferred ? nullptr : &programs.assignLights, frameData);
+    // Bound again once computed, by the paths drawing the depth pre-pass
+    programs.ambientOcclusion.bind(false, frameData);
+  }
+  // Pipeline statistics of the main pass, from its first draw to the end of
+  // the call (transparent pass and deferred lighting included). The
+  // additive debug views draw it without depth test until endFrame, which
+  // also ends the variable rate shading of the pass.
+  std::unique_ptr<Profiler::StatisticsScope> mainPassStatistics;
+  auto isAdditivePass = false;
+  auto isShadingRateBound = false;
+  const auto beginMainPass = [&]() {
+    if (profiler) {
+      mainPassStatistics =
+          std::make_unique<Profiler::StatisticsScope>(*profiler, "Main pass");
+    }
+    if (programs.isAdditive) {
+      isAdditivePass = true;
+      glDisable(GL_DEPTH_TEST);
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_ONE, GL_ONE);
+    } else if (m_options.variableRateShading &&
+               m_options.shadingRateSettings.enabled) {
+      // Only binds at the size of the window, not in dynamic resolution
+      // targets nor in the views of a split window
+      isShadingRateBound = programs.shadingRate.bind();
+    }
+  };
+  // The indirect draws only write triangle ids, resolved into the G-buffer
+  // before deferred lighting
+  const auto isVisibilityPass =
+      isDeferred && scene.hasIndirectDraws && usesVisibilityBuffer();
+  if (isDeferred) {
+    programs.gbuffer.begin();
+    if (isVisibilityPass) {
+      programs.gbuffer.beginVisibility();
+    }
+  }
+  // With OIT, transparent draws are left out of the main pass and drawn by
+  // drawTransparentPass after it
+  const auto oit =
+      programs.hasTransparentPass ? m_options.oit : OitMode::None;
+  if (oit != OitMode::None) {
+    programs.transparency.bindOpaquePass(frameData);
+  }
+  // Points and lines are drawn once after the opaque draws, by whichever
+  // of drawTransparentPass and endFrame comes first
+  auto hasDrawnPointClouds = !programs.hasPointClouds;
+  const auto drawPointClouds = [&]() {
+    if (hasDrawnPointClouds) {
+      return;
+    }
+    hasDrawnPointClouds = true;
+    PointClouds::Settings settings;
+    settings.pointBudget = m_options.pointBudget;
+    settings.maxPointSize = m_options.maxPointSize;
+    settings.lineWidth = m_options.lineWidth;
+    scene.pointClouds.draw(programs.pointClouds, hierarchy, viewMatrix,
+        projMatrix, settings, frameData);
+  };
+  const auto drawTransparentPass = [&](const auto &draw) {
+    drawPointClouds();
+    programs.transparency.begin(oit, m_options.reversedZ, frameData);
+    draw();
+    programs.transparency.resolve(programs.resolveTransparency);
+  };
+  const auto endFrame = [&]() {
+    if (isAdditivePass) {
+      glDisable(GL_BLEND);
+      glEnable(GL_DEPTH_TEST);
+    }
+    if (isShadingRateBound) {
+      programs.shadingRate.bind(false);
+    }
+    if (isVisibilityPass) {
+      programs.resolveVisibility.use();
+      programs.resolveVisibility.getUniform<GLuint>("uShortIndices")
+          .set(GLuint(upload.arena.indexType() == GL_UNSIGNED_SHORT));
+      scene.indirectDraws.bindVisibilityResolve(upload.arena);
+      programs.gbuffer.resolveVisibility(programs.resolveVisibility);
+      scene.indirectDraws.bindVisibilityResolve(upload.arena, false);
+    }
+    drawPointClouds();
+    if (isDeferred) {
+      programs.gbuffer.shade(programs.deferredLighting, projMatrix);
+    }
+    if (scene.hasMaterials) {
+      if (!scene.virtualTextures.empty()) {
+        scene.virtualTextures.unbind();
+      }
+      scene.materials.unbind();
+    }
+    if (programs.readsLights) {
+      programs.lightClusters.unbind();
+      programs.shadowMaps.unbind();
+      programs.shadowAtlas.unbind();
+      m_environment.unbind();
+      programs.ambientOcclusion.unbind();
+    }
+    glBindBufferBase(
+        GL_SHADER_STORAGE_BUFFER, SceneSkins::JOINT_MATRICES_BINDING, 0);
+    frameData.endFrame();
+    programs.previousViewProjMatrix = projMatrix * viewMatrix;
+    programs.hasPreviousFrame = true;
+  };
+  // Motion vectors start from the matrices of the previous frame, or of
+  // this one for the first frame
+  const auto previousViewProjMatrix = programs.hasPreviousFrame
+                                          ? programs.previousViewProjMatrix
+                                          : projMatrix * viewMatrix;
+
+  // Uploaded once, bound for every program of the view
+  auto &cameraUniforms = programs.cameraUniforms;
+  cameraUniforms.reset(sizeof(CameraUniforms), 1);
+  cameraUniforms.block<CameraUniforms>(0) = getCameraUniforms(
+      viewMatrix, projMatrix, previousViewProjMatrix, camera.eye());
+  cameraUniforms.upload(frameData);
+  cameraUniforms.bind(CAMERA_UNIFORMS_BINDING, 0);
+  using CullPhase = IndirectDrawList::CullPhase;
+  if (scene.hasIndirectDraws) {
+    beginMainPass();
+    const auto viewProjMatrix = projMatrix * viewMatrix;
+    const auto cameraPosition = glm::vec3(glm::inverse(viewMatrix)[3]);
+    const auto &draws = scene.indirectDraws;
+    using DrawSet = IndirectDrawList::DrawSet;
+    const auto mainSet = oit != OitMode::None ? DrawSet::Opaque : DrawSet::All;
+    const auto cullTriangles = [&](CullPhase phase) {
+      if (usesTriangleCulling()) {
+        draws.cullTriangles(
+            programs.cullTriangles, upload.arena, viewProjMatrix, phase);
+      }
+    };
+    if (profiler && usesTriangleCulling()) {
+      profiler->setCulledTriangles("Main pass", draws.culledTriangleCount());
+    }
+    // Captured as the main pass draws it, before culling
+    if (!m_options.frameCapturePath.empty() && !m_isFrameCaptured) {
+      m_isFrameCaptured = true;
+      FrameCapture capture;
+      captureFramePassState(capture);
+      draws.capture(upload.arena, capture, mainSet);
+      const auto &uniforms = cameraUniforms.block<CameraUniforms>(0);
+      const auto bytes = reinterpret_cast<const uint8_t *>(&uniforms);
+      capture.cameraUniforms.assign(bytes, bytes + sizeof(uniforms));
+      if (upload.arena.vertexFormat() ==
+          GeometryArena::VertexFormat::Quantized) {
+        capture.vertexDefines["QUANTIZED_VERTICES"] = "";
+      }
+      std::string err;
+      if (writeFrameCapture(m_options.frameCapturePath, capture, err)) {
+        std::clog << "Captured " << draws.drawCount() << " draws in "
+                  << m_options.frameCapturePath.string() << std::endl;
+      } else {
+        std::cerr << "Error: " << err << std::endl;
+      }
+    }
+    if (!m_options.occlusionCulling) {
+      draws.cull(programs.cullDraws, viewProjMatrix, cameraPosition);
+      cullTriangles(CullPhase::Frustum);
+      programs.indirect.use();
+      draws.drawCulled(upload.arena, CullPhase::Frustum, mainSet);
+      if (oit != OitMode::None) {
+        drawTransparentPass([&]() {
+          programs.indirect.use();
+          draws.drawCulled(
+              upload.arena, CullPhase::Frustum, DrawSet::Transparent);
+        });
+      }
+      endFrame();
+      return draws.drawCount();
+    }
+
+    // Draws visible in the previous frame fill the depth buffer, the others
+    // are tested against it
+    draws.cull(programs.cullDraws, viewProjMatrix, cameraPosition,
+        CullPhase::PreviouslyVisible);
+    cullTriangles(CullPhase::PreviouslyVisible);
+    programs.indirect.use();
+    draws.drawCulled(upload.arena, CullPhase::PreviouslyVisible, mainSet);
+    programs.depthPyramid.build(programs.copyDepth, programs.reduceDepth);
+    draws.cull(programs.cullDraws, viewProjMatrix, cameraPosition,
+        CullPhase::NewlyVisible, &programs.depthPyramid);
+    cullTriangles(CullPhase::NewlyVisible);
+    programs.indirect.use();
+    draws.drawCulled(upload.arena, CullPhase::NewlyVisible, mainSet);
+    if (oit != OitMode::None) {
+      drawTransparentPass([&]() {
+        programs.indirect.use();
+        draws.drawCulled(upload.arena, CullPhase::PreviouslyVisible,
+            DrawSet::Transparent);
+        draws.drawCulled(
+            upload.arena, CullPhase::NewlyVisible, DrawSet::Transparent);
+      });
+    }
+    endFrame();
+    return draws.drawCount();
+  }
+
+  // Visible primitives, in scene.drawBoundsMin/Max order. Nodes without
+  // visible primitives are skipped.
+  const auto &meshNodes = hierarchy.meshNodes();
+  auto &isDrawVisible = programs.isDrawVisible;
+  isDrawVisible.assign(scene.drawBoundsMin.size(), 0);
+  if (viewMasks) {
+    const auto viewBit = uint32_t(1) << viewIdx;
+    for (size_t drawIdx = 0; drawIdx < viewMasks->size(); ++drawIdx) {
+      isDrawVisible[drawIdx] = ((*viewMasks)[drawIdx] & viewBit) != 0;
+    }
+  } else {
+    const auto frustum = extractFrustum(projMatrix * viewMatrix);
+    // With a potentially visible set for the cell of the camera, only its
+    // draws are tested against the frustum instead of the hierarchy
+    const auto &pvs = scene.derived.pvs;
+    const auto *pvsDraws =
+        m_options.potentiallyVisibleSets &&
+                pvs.drawCount() == scene.drawBoundsMin.size()
+            ? pvs.findVisibleDraws(camera.eye())
+            : nullptr;
+    if (pvsDraws) {
+      for (const auto drawIdx : *pvsDraws) {
+        isDrawVisible[drawIdx] = intersectsBox(frustum,
+            scene.drawBoundsMin[drawIdx], scene.drawBoundsMax[drawIdx]);
+      }
+    } else {
+      scene.bvh.forEachInFrustum(
+          frustum, [&](size_t drawIdx) { isDrawVisible[drawIdx] = 1; });
+    }
+  }
+  ArenaVector<uint8_t> isNodeVisible(meshNodes.size(), 0, frameAllocator);
+  size_t visibleCount = 0;
+  // With OIT, the visible transparent draws move to their own list
+  auto &isTransparentDrawVisible = programs.isTransparentDrawVisible;
+  isTransparentDrawVisible.clear();
+  if (oit != OitMode::None && useInstancing) {
+    isTransparentDrawVisible.resize(isDrawVisible.size(), 0);
+  }
+  for (size_t i = 0, drawIdx = 0; i < meshNodes.size(); ++i) {
+    const auto meshIdx = hierarchy.mesh(meshNodes[i]);
+    const auto &range = upload.meshToPrimitives[meshIdx];
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx, ++drawIdx) {
+      if (!upload.isMeshReady[meshIdx] ||
+          (drawIdx < scene.isolatedDraws.size() &&
+              !scene.isolatedDraws[drawIdx])) {
+        isDrawVisible[drawIdx] = 0;
+      } else if (isDrawVisible[drawIdx]) {
+        isNodeVisible[i] = 1;
+        ++visibleCount;
+        if (!isTransparentDrawVisible.empty() &&
+            isTransparentMaterial(scene.compact,
+                scene.compact.primitive(meshIdx, pIdx).material)) {
+          isTransparentDrawVisible[drawIdx] = 1;
+          isDrawVisible[drawIdx] = 0;
+        }
+      }
+    }
+  }
+
+  if (useInstancing) {
+    beginMainPass();
+    // Instances whose bounds cover fewer than impostorPixelSize pixels move
+    // to the impostors of their primitive: a diagonal at distance d covers
+    // diagonal * pixelsPerUnit / d pixels, as with levels of detail
+    auto &isImpostorVisible = programs.isImpostorVisible;
+    isImpostorVisible.clear();
+    programs.impostorInstanceCount = 0;
+    if (programs.hasImpostors && !scene.impostors.empty()) {
+      GLint viewport[4];
+      glGetIntegerv(GL_VIEWPORT, viewport);
+      const auto pixelsPerUnit =
+          0.5f * projMatrix[1][1] * float(viewport[3]);
+      const auto eye = camera.eye();
+      isImpostorVisible.resize(isDrawVisible.size(), 0);
+      for (size_t i = 0, drawIdx = 0; i < meshNodes.size(); ++i) {
+        const auto &range =
+            upload.meshToPrimitives[hierarchy.mesh(meshNodes[i])];
+        for (size_t pIdx = 0; pIdx < range.count; ++pIdx, ++drawIdx) {
+          if (!isDrawVisible[drawIdx] ||
+              scene.impostors.layer(uint32_t(range.begin + pIdx)) < 0) {
+            continue;
+          }
+          const auto &bboxMin = scene.drawBoundsMin[drawIdx];
+          const auto &bboxMax = scene.drawBoundsMax[drawIdx];
+          const auto distance = glm::length(glm::max(
+              glm::max(bboxMin - eye, eye - bboxMax), glm::vec3(0)));
+          if (glm::distance(bboxMin, bboxMax) * pixelsPerUnit <
+              m_options.impostorPixelSize * distance) {
+            isImpostorVisible[drawIdx] = 1;
+            isDrawVisible[drawIdx] = 0;
+            ++programs.impostorInstanceCount;
+          }
+        }
+      }
+    }
+    // Instances of animated primitives play the clip of the animation of
+    // the scene
+    const auto &vertexAnimations = scene.vertexAnimations;
+    const auto setPrimitiveAnimation = [&](uint32_t primitiveIdx) {
+      vertexAnimations.setPrimitive(programs.instanced, primitiveIdx,
+          upload.primitives[primitiveIdx], scene.animation,
+          std::max(scene.animationTime, 0.));
+    };
+    // A std::function of the lambda itself would allocate its captures
+    std::function<void(uint32_t)> setVertexAnimation;
+    if (!vertexAnimations.empty()) {
+      setVertexAnimation = std::ref(setPrimitiveAnimation);
+      vertexAnimations.bind();
+    }
+    programs.instanced.use();
+    scene.instancedDraws.draw(upload.arena, upload.primitives,
+        hierarchy.worldMatrices(), hierarchy.normalMatrices(), isDrawVisible,
+        frameData, setVertexAnimation);
+    if (programs.impostorInstanceCount) {
+      programs.impostors.use();
+      scene.impostors.bind(programs.impostors);
+      scene.instancedDraws.drawImpostors(upload.arena, scene.impostors,
+          hierarchy.worldMatrices(), hierarchy.normalMatrices(),
+          isImpostorVisible, frameData);
+      scene.impostors.unbind();
+    }
+    if (!isTransparentDrawVisible.empty()) {
+      drawTransparentPass([&]() {
+        programs.instanced.use();
+        scene.instancedDraws.draw(upload.arena, upload.primitives,
+            hierarchy.worldMatrices(), hierarchy.normalMatrices(),
+            isTransparentDrawVisible, frameData, setVertexAnimation);
+      });
+    }
+    if (!vertexAnimations.empty()) {
+      vertexAnimations.unbind();
+    }
+    endFrame();
+    return visibleCount;
+  }
+
+  // Skinned vertices are in world space once skinned by the pre-pass or by
+  // the skinned program, their nodes are then drawn with an identity model
+  // matrix. The skinned program reads the palette of the skin of each draw.
+  const auto &skins = scene.skins;
+  const auto useSkinnedProgram = !skins.empty() &&
+                                 !scene.hasSkinnedVertices &&
+                                 programs.hasSkinnedProgram;
+  const auto isNodeSkinned = [&](size_t flatIdx) {
+    return (scene.hasSkinnedVertices || useSkinnedProgram) &&
+           skins.nodeSkin(flatIdx) >= 0;
+  };
+  auto &paletteRanges = programs.paletteRanges;
+  if (useSkinnedProgram) {
+    skins.uploadPalettes(frameData, paletteRanges);
+  }
+
+  // Matrices of every visible node, uploaded at once in the uniform buffer
+  auto &drawUniforms = programs.drawUniforms;
+  // Primitives of a mesh share their position transform (see
+  // GeometryArena::computePositionQuantization)
+  // Skinned vertices are in world space, their previous pose is not kept
+  const auto &previousWorldMatrices = scene.previousWorldMatrices;
+  // Model translations are computed relative to the eye in double precision
+  // (see camera.glsl): float world translations of models far from the
+  // origin (e.g. georeferenced ones) would make their vertices jitter
+  const auto eyeOrigin = glm::dvec3(camera.eye());
+  const auto computeDrawUniforms = [&](size_t flatIdx) {
+    const auto isSkinned = isNodeSkinned(flatIdx);
+    auto modelMatrix = glm::translate(glm::mat4(1), -camera.eye());
+    auto normalMatrix = glm::mat3(1);
+    auto previousWorldMatrix = glm::mat4(1);
+    if (!isSkinned) {
+      modelMatrix = hierarchy.worldMatrix(flatIdx);
+      modelMatrix[3] = glm::vec4(
+          glm::vec3(hierarchy.worldOrigin(flatIdx) - eyeOrigin), 1);
+      // The 3x3 part of the world matrix transforms normals if it scales
+      // uniformly
+      normalMatrix = hierarchy.hasUniformScale(flatIdx)
+                         ? glm::mat3(modelMatrix)
+                         : hierarchy.normalMatrix(flatIdx);
+      previousWorldMatrix = flatIdx < previousWorldMatrices.size()
+                                ? previousWorldMatrices[flatIdx]
+                                : hierarchy.worldMatrix(flatIdx);
+    }
+    const auto &range = upload.meshToPrimitives[hierarchy.mesh(flatIdx)];
+    const auto positionMatrix =
+        range.count ? upload.primitives[range.begin].positionMatrix()
+                    : glm::mat4(1);
+    return DrawUniforms{modelMatrix * positionMatrix, glm::mat4(normalMatrix),
+        previousWorldMatrix * positionMatrix};
+  };
+  if (programs.hasDrawUniformBlock) {
+    drawUniforms.reset(sizeof(DrawUniforms), meshNodes.size());
+    for (size_t i = 0; i < meshNodes.size(); ++i) {
+      if (isNodeVisible[i]) {
+        drawUniforms.block<DrawUniforms>(i) = computeDrawUniforms(meshNodes[i]);
+      }
+    }
+    drawUniforms.upload(frameData);
+  }
+
+  // Levels of detail are chosen from their error projected at the distance
+  // of the bounds of the draw: a world space length l at distance d covers
+  // l * pixelsPerUnit / d pixels (the viewport is a tile of the projection
+  // when rendering in tiles, so this holds for the full image)
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const auto pixelsPerUnit = 0.5f * projMatrix[1][1] * float(viewport[3]);
+  const auto eye = camera.eye();
+  const auto selectLod = [&](size_t drawIdx, size_t flatIdx,
+                             size_t primitiveIdx) -> const ArenaLod * {
+    const auto &lods = upload.primitiveToLods[primitiveIdx];
+    // Meshes streaming in coarse first only have their coarsest level
+    if (lods.count && !upload.isMeshRefined[hierarchy.mesh(flatIdx)]) {
+      return &upload.lods[lods.begin + lods.count - 1];
+    }
+    const auto &bboxMin = scene.drawBoundsMin[drawIdx];
+    const auto &bboxMax = scene.drawBoundsMax[drawIdx];
+    if (!lods.count || bboxMax.x == std::numeric_limits<float>::max()) {
+      return nullptr;
+    }
+    const auto distance = glm::length(
+        glm::max(glm::max(bboxMin - eye, eye - bboxMax), glm::vec3(0)));
+    const auto &worldMatrix = hierarchy.worldMatrix(flatIdx);
+    const auto maxScale = std::sqrt(std::max(
+        {glm::dot(glm::vec3(worldMatrix[0]), glm::vec3(worldMatrix[0])),
+            glm::dot(glm::vec3(worldMatrix[1]), glm::vec3(worldMatrix[1])),
+            glm::dot(glm::vec3(worldMatrix[2]), glm::vec3(worldMatrix[2]))}));
+    const ArenaLod *selected = nullptr;
+    for (size_t lodIdx = 0; lodIdx < lods.count; ++lodIdx) {
+      const auto &lod = upload.lods[lods.begin + lodIdx];
+      // Errors grow along the chain
+      if (lod.error * maxScale * pixelsPerUnit >
+          m_options.lodPixelError * distance) {
+        break;
+      }
+      selected = &lod;
+    }
+    return selected;
+  };
+
+  // Visible draws in traversal order, or sorted by state then depth. Draws
+  // keep the index of their node in meshNodes and the indices they draw.
+  struct QueuedDraw
+  {
+    uint32_t node;
+    uint32_t draw; // In scene.drawBoundsMin/Max order
+    uint32_t primitive;
+    GLuint firstIndex;
+    GLuint indexCount;
+    // Drawn by the depth pre-pass: opaque, or masked with depthMasked
+    bool isOccluder;
+    int occlusionGroup; // See OcclusionQueries::group
+  };
+  const auto &model = scene.compact;
+  auto &queue = programs.renderQueue;
+  queue.clear();
+  // Programs of the keys: forward, skinned, then the material permutations
+  // compiled for the materials of the scene (indexed by material + 1)
+  const auto SKINNED_PROGRAM = 1u;
+  const auto &permutations = scene.materialPermutations;
+  ArenaVector<uint32_t> materialPrograms(
+      programs.permutations.empty() ? 0
+                                    : permutations.materialPermutations.size(),
+      0u, frameAllocator);
+  // On multisampled targets, masked materials take their alpha-to-coverage
+  // variant if compiled
+  GLint sampleBuffers = 0;
+  glGetIntegerv(GL_SAMPLE_BUFFERS, &sampleBuffers);
+  const auto alphaToCoverage =
+      sampleBuffers > 0 && programs.writesCoverage && !programs.isAdditive;
+  for (size_t i = 0; i < materialPrograms.size(); ++i) {
+    const auto key = permutations.keys[permutations.materialPermutations[i]];
+    const auto &keys = programs.permutationKeys;
+    auto it = end(keys);
+    if (alphaToCoverage && (key & MATERIAL_ALPHA_MASK)) {
+      it = std::find(begin(keys), end(keys), key | MATERIAL_ALPHA_TO_COVERAGE);
+    }
+    if (it == end(keys)) {
+      it = std::find(begin(keys), end(keys), key);
+    }
+    if (it != end(keys)) {
+      materialPrograms[i] = uint32_t(2 + (it - begin(keys)));
+    }
+  }
+  const auto getProgram = [&](uint32_t program) -> const GLProgram & {
+    return program == 0 ? programs.forward
+           : program == SKINNED_PROGRAM
+               ? programs.skinned
+               : programs.permutations[program - 2];
+  };
+  ArenaVector<QueuedDraw> draws(frameAllocator);
+  if (occlusionQueries) {
+    if (!occlusionQueries->isBuiltFor(
+            hierarchy.size(), scene.drawBoundsMin.size())) {
+      std::vector<uint32_t> drawNodes;
+      for (const auto flatIdx : meshNodes) {
+        const auto &range = upload.meshToPrimitives[hierarchy.mesh(flatIdx)];
+        drawNodes.insert(drawNodes.end(), range.count, flatIdx);
+      }
+      occlusionQueries->build(hierarchy, drawNodes);
+    }
+    occlusionQueries->beginFrame(scene.drawBoundsMin, scene.drawBoundsMax);
+  }
+  if (costAttribution) {
+    if (!costAttribution->isBuiltFor(
+            hierarchy.size(), scene.drawBoundsMin.size())) {
+      std::vector<uint32_t> drawNodes, drawMaterials;
+      for (const auto flatIdx : meshNodes) {
+        const auto meshIdx = hierarchy.mesh(flatIdx);
+        const auto &range = upload.meshToPrimitives[meshIdx];
+        drawNodes.insert(drawNodes.end(), range.count, flatIdx);
+        for (size_t pIdx = 0; pIdx < range.count; ++pIdx) {
+          drawMaterials.push_back(
+              uint32_t(model.primitive(meshIdx, pIdx).material + 1));
+        }
+      }
+      costAttribution->build(m_options.costAttribution, hierarchy, drawNodes,
+          drawMaterials);
+    }
+    costAttribution->beginFrame();
+  }
+  // Draws are queued in parallel by ranges of nodes, each range filling its
+  // own bucket, then the buckets are appended in traversal order. Scenes
+  // with fewer than MIN_QUEUED_NODES_PER_JOB nodes are queued by this thread.
+  // The draws of a bucket are written from the first draw of its nodes in
+  // bucketDraws, which has room for every draw.
+  ArenaVector<size_t> nodeFirstDraws(meshNodes.size() + 1, 0, frameAllocator);
+  for (size_t i = 0; i < meshNodes.size(); ++i) {
+    nodeFirstDraws[i + 1] =
+        nodeFirstDraws[i] +
+        upload.meshToPrimitives[hierarchy.mesh(meshNodes[i])].count;
+  }
+  auto &jobSystem = getJobSystem();
+  const auto nodesPerBucket =
+      jobSystem.getGrainSize(meshNodes.size(), MIN_QUEUED_NODES_PER_JOB);
+  const auto bucketCount =
+      (meshNodes.size() + nodesPerBucket - 1) / nodesPerBucket;
+  auto &bucketQueues = programs.bucketQueues;
+  if (bucketQueues.size() < bucketCount) {
+    bucketQueues.resize(bucketCount);
+  }
+  ArenaVector<QueuedDraw> bucketDraws(
+      nodeFirstDraws.back(), QueuedDraw{}, frameAllocator);
+  ArenaVector<size_t> bucketDrawCounts(bucketCount, 0, frameAllocator);
+  const auto queueDraws = [&](size_t firstNode, size_t lastNode,
+                              size_t bucketIdx) {
+    auto &bucketQueue = bucketQueues[bucketIdx];
+    bucketQueue.clear();
+    auto *bucketFirstDraw = bucketDraws.data() + nodeFirstDraws[firstNode];
+    auto &bucketDrawCount = bucketDrawCounts[bucketIdx];
+    for (auto i = firstNode, drawIdx = nodeFirstDraws[firstNode]; i < lastNode;
+         ++i) {
+      const auto meshIdx = hierarchy.mesh(meshNodes[i]);
+      const auto &range = upload.meshToPrimitives[meshIdx];
+      for (size_t pIdx = 0; pIdx < range.count; ++pIdx, ++drawIdx) {
+        if (!isDrawVisible[drawIdx]) {
+          continue;
+        }
+        const auto materialIdx = model.primitive(meshIdx, pIdx).material;
+        const auto alphaMode = model.alphaMode(materialIdx);
+        auto pass = RenderQueue::Pass::Opaque;
+        if (alphaMode == AlphaMode::Mask) {
+          pass = RenderQueue::Pass::Masked;
+        } else if (alphaMode == AlphaMode::Blend) {
+          pass = RenderQueue::Pass::Transparent;
+        }
+        // Transparent draws blended with OIT need no back to front order,
+        // they are only sorted by state
+        auto viewDepth = 0.f; // Unbounded draws come first
+        const auto &bboxMin = scene.drawBoundsMin[drawIdx];
+        const auto &bboxMax = scene.drawBoundsMax[drawIdx];
+        if (bboxMax.x < std::numeric_limits<float>::max() &&
+            (pass != RenderQueue::Pass::Transparent || oit == OitMode::None)) {
+          const auto center = 0.5f * (bboxMin + bboxMax);
+          viewDepth = -(viewMatrix * glm::vec4(center, 1)).z;
+        }
+        auto program = 0u;
+        if (useSkinnedProgram && isNodeSkinned(meshNodes[i])) {
+          program = SKINNED_PROGRAM;
+        } else if (size_t(materialIdx + 1) < materialPrograms.size()) {
+          program = materialPrograms[materialIdx + 1];
+        }
+        bucketQueue.push(
+            RenderQueue::makeKey(pass, program, uint32_t(materialIdx + 1),
+                uint32_t(range.begin + pIdx), viewDepth),
+            uint32_t(bucketDrawCount));
+        const auto &primitive = upload.primitives[range.begin + pIdx];
+        QueuedDraw draw{uint32_t(i), uint32_t(drawIdx),
+            uint32_t(range.begin + pIdx),
+            primitive.firstIndex, primitive.indexCount,
+            alphaMode == AlphaMode::Opaque ||
+                (alphaMode == AlphaMode::Mask &&
+                    programs.hasMaskedDepthPrepass &&
+                    program != SKINNED_PROGRAM),
+            occlusionQueries ? occlusionQueries->group(drawIdx) : -1};
+        if (const auto lod = selectLod(drawIdx, meshNodes[i], draw.primitive)) {
+          draw.firstIndex = lod->firstIndex;
+          draw.indexCount = lod->indexCount;
+        }
+        bucketFirstDraw[bucketDrawCount++] = draw;
+      }
+    }
+  };
+  jobSystem.parallelFor(bucketCount, 1, [&](size_t begin, size_t end) {
+    for (auto bucketIdx = begin; bucketIdx < end; ++bucketIdx) {
+      queueDraws(bucketIdx * nodesPerBucket,
+          std::min(meshNodes.size(), (bucketIdx + 1) * nodesPerBucket),
+          bucketIdx);
+    }
+  });
+  draws.reserve(nodeFirstDraws.back());
+  for (size_t bucketIdx = 0; bucketIdx < bucketCount; ++bucketIdx) {
+    queue.append(bucketQueues[bucketIdx], uint32_t(draws.size()));
+    const auto firstDraw =
+        bucketDraws.begin() +
+        ptrdiff_t(nodeFirstDraws[bucketIdx * nodesPerBucket]);
+    draws.insert(draws.end(), firstDraw,
+        firstDraw + ptrdiff_t(bucketDrawCounts[bucketIdx]));
+  }
+  if (m_options.sortDraws) {
+    queue.sort(jobSystem);
+  }
+
+  // Node state shared by both passes: the palette of the skin of the node
+  // with the skinned programs, and its matrices
+  auto currentNode = std::numeric_limits<uint32_t>::max();
+  auto currentSkin = -1;
+  const auto bindNode = [&](uint32_t i, uint32_t program) {
+    currentNode = i;
+    const auto skin =
+        program == SKINNED_PROGRAM ? skins.nodeSkin(meshNodes[i]) : -1;
+    if (skin >= 0 && skin != currentSkin) {
+      currentSkin = skin;
+      paletteRanges[skin].bind();
+    }
+    if (programs.hasDrawUniformBlock) {
+      drawUniforms.bind(DRAW_UNIFORMS_BINDING, i);
+    } else {
+      // The view matrix is rigid, so its rotation part transforms normals
+      const auto uniforms = computeDrawUniforms(meshNodes[i]);
+      const auto &view = cameraUniforms.block<CameraUniforms>(0);
+      const auto mvMatrix = view.eyeViewMatrix * uniforms.modelMatrix;
+      programs.modelViewProjMatrix.set(view.projMatrix * mvMatrix);
+      programs.modelViewMatrix.set(mvMatrix);
+      programs.normalMatrix.set(view.eyeViewMatrix * uniforms.normalMatrix);
+    }
+  };
+  size_t stateChangeCount = 0;
+
+  // The depth pre-pass fills the depth buffer with the occluders, whose
+  // fragments the main pass then shades at most once each
+  const auto depthPrepass = scene.depthPrepass && programs.hasDepthPrepass;
+  if (depthPrepass) {
+    std::unique_ptr<Profiler::GPUScope> timer;
+    if (timePasses) {
+      timer = std::make_unique<Profiler::GPUScope>(*profiler, "Depth pre-pass");
+    }
+    std::unique_ptr<Profiler::StatisticsScope> statistics;
+    if (profiler) {
+      statistics = std::make_unique<Profiler::StatisticsScope>(
+          *profiler, "Depth pre-pass");
+    }
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    upload.arena.bindPositions();
+    // Masked draws come after the opaque ones once sorted, their program
+    // reads the material and texture coordinates of the whole arena
+    auto currentProgram = std::numeric_limits<uint32_t>::max();
+    auto currentMaterial = std::numeric_limits<uint32_t>::max();
+    auto isMaskedProgram = false;
+    for (const auto &item : queue.items()) {
+      const auto &draw = draws[item.index];
+      if (!draw.isOccluder) {
+        continue;
+      }
+      const auto isMasked =
+          RenderQueue::getPass(item.key) == RenderQueue::Pass::Masked;
+      if (isMasked != isMaskedProgram) {
+        isMaskedProgram = isMasked;
+        currentProgram = std::numeric_limits<uint32_t>::max();
+        if (isMasked) {
+          upload.arena.bind();
+          programs.depthMasked.use();
+        } else {
+          upload.arena.bindPositions();
+        }
+        ++stateChangeCount;
+      }
+      if (isMasked) {
+        const auto material = RenderQueue::getMaterial(item.key);
+        if (material != currentMaterial) {
+          currentMaterial = material;
+          GeometryArena::setMaterialId(material);
+          ++stateChangeCount;
+        }
+      }
+      // Material permutations share the depth program
+      const auto program = RenderQueue::getProgram(item.key) ==
+                                   SKINNED_PROGRAM
+                               ? SKINNED_PROGRAM
+                               : 0u;
+      if (!isMasked && program != currentProgram) {
+        currentProgram = program;
+        (program ? programs.depthSkinned : programs.depth).use();
+        ++stateChangeCount;
+      }
+      if (draw.node != currentNode) {
+        bindNode(draw.node, program);
+        ++stateChangeCount;
+      }
+      if (occlusionQueries) {
+        occlusionQueries->setGroup(draw.occlusionGroup);
+      }
+      // Levels of detail have no position indices
+      const auto &primitive = upload.primitives[draw.primitive];
+      const auto firstIndex =
+          draw.firstIndex == primitive.firstIndex && !isMasked
+              ? primitive.positionFirstIndex
+              : draw.firstIndex;
+      glDrawElementsBaseVertex(primitive.mode, GLsizei(draw.indexCount),
+          upload.arena.indexType(), upload.arena.indexOffset(firstIndex),
+          primitive.baseVertex);
+    }
+    if (occlusionQueries) {
+      occlusionQueries->setGroup(-1);
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    currentNode = std::numeric_limits<uint32_t>::max();
+  }
+  // Ambient occlusion of the occluders, read by the main pass
+  if (depthPrepass && programs.hasAmbientOcclusion) {
+    std::unique_ptr<Profiler::GPUScope> timer;
+    if (timePasses) {
+      timer =
+          std::make_unique<Profiler::GPUScope>(*profiler, "Ambient occlusion");
+    }
+    programs.depthPyramid.build(programs.copyDepth, programs.reduceDepth);
+    programs.ambientOcclusion.compute(programs.computeAmbientOcclusion,
+        programs.depthPyramid, viewMatrix, projMatrix, scene.poseVersion,
+        m_options.ambientOcclusionDivisor, m_options.ambientOcclusionRadius);
+    programs.ambientOcclusion.bind(true, frameData);
+  }
+
+  // Only state that differs from the previous draw is set. Occluders are
+  // drawn without depth writes after the pre-pass, at their own depth.
+  std::unique_ptr<Profiler::GPUScope> timer;
+  if (timePasses) {
+    timer = std::make_unique<Profiler::GPUScope>(*profiler, "Main pass");
+  }
+  beginMainPass();
+  const auto depthFunc = m_options.reversedZ ? GL_GREATER : GL_LESS;
+  const auto prepassDepthFunc = m_options.reversedZ ? GL_GEQUAL : GL_LEQUAL;
+  auto isDepthWritten = true;
+  programs.forward.use();
+  upload.arena.bind();
+  ++stateChangeCount; // The program
+  size_t triangleCount = 0;
+  size_t lodSavedTriangleCount = 0;
+  auto currentPass = RenderQueue::Pass::Opaque;
+  auto currentMaterial = std::numeric_limits<uint32_t>::max();
+  auto currentProgram = 0u;
+  auto currentHeat = -1.f;
+  // Alpha to coverage is enabled for the programs of the alpha-to-coverage
+  // permutations alone, whose alpha then becomes 1
+  auto isCoverageEnabled = false;
+  const auto enableCoverage = [&](bool enable) {
+    if (enable) {
+      glEnable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+      glEnable(GL_SAMPLE_ALPHA_TO_ONE);
+    } else {
+      glDisable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+      glDisable(GL_SAMPLE_ALPHA_TO_ONE);
+    }
+    isCoverageEnabled = enable;
+  };
+  const auto drawItem = [&](const RenderQueue::Item &item) {
+    const auto program = RenderQueue::getProgram(item.key);
+    if (program != currentProgram) {
+      currentProgram = program;
+      getProgram(program).use();
+      ++stateChangeCount;
+      const auto writesCoverage =
+          alphaToCoverage && program > SKINNED_PROGRAM &&
+          (programs.permutationKeys[program - 2] &
+              MATERIAL_ALPHA_TO_COVERAGE) != 0;
+      if (writesCoverage != isCoverageEnabled) {
+        enableCoverage(writesCoverage);
+        ++stateChangeCount;
+      }
+    }
+    // Without OIT, the transparent pass is not blended. Materials only set
+    // the material ID attribute.
+    const auto pass = RenderQueue::getPass(item.key);
+    if (pass != currentPass) {
+      currentPass = pass;
+      ++stateChangeCount;
+    }
+    const auto material = RenderQueue::getMaterial(item.key);
+    if (material != currentMaterial) {
+      currentMaterial = material;
+      GeometryArena::setMaterialId(material);
+      ++stateChangeCount;
+    }
+    const auto &draw = draws[item.index];
+    if (depthPrepass && draw.isOccluder == isDepthWritten) {
+      isDepthWritten = !draw.isOccluder;
+      glDepthFunc(isDepthWritten ? depthFunc : prepassDepthFunc);
+      glDepthMask(isDepthWritten ? GL_TRUE : GL_FALSE);
+      ++stateChangeCount;
+    }
+    if (draw.node != currentNode) {
+      bindNode(draw.node, program);
+      ++stateChangeCount;
+    }
+    if (occlusionQueries) {
+      occlusionQueries->setGroup(draw.occlusionGroup);
+    }
+    if (costAttribution) {
+      const auto heat = costAttribution->heat(draw.draw);
+      if (heat != currentHeat) {
+        currentHeat = heat;
+        programs.heat.set(heat);
+      }
+    }
+
+    const auto &primitive = upload.primitives[draw.primitive];
+    glDrawElementsBaseVertex(primitive.mode, GLsizei(draw.indexCount),
+        upload.arena.indexType(), upload.arena.indexOffset(draw.firstIndex),
+        primitive.baseVertex);
+    if (primitive.mode == GL_TRIANGLES) {
+      triangleCount += draw.indexCount / 3;
+      lodSavedTriangleCount += (primitive.indexCount - draw.indexCount) / 3;
+    }
+  };
+  // The opaque and masked draws of the bucket timed by costAttribution are
+  // drawn together, before the first transparent draw
+  ArenaVector<const RenderQueue::Item *> transparentItems(frameAllocator);
+  ArenaVector<const RenderQueue::Item *> timedItems(frameAllocator);
+  auto areTimedItemsDrawn = costAttribution == nullptr;
+  const auto drawTimedItems = [&]() {
+    costAttribution->beginQuery();
+    for (const auto *item : timedItems) {
+      drawItem(*item);
+    }
+    costAttribution->endQuery();
+    areTimedItemsDrawn = true;
+  };
+  for (const auto &item : queue.items()) {
+    const auto pass = RenderQueue::getPass(item.key);
+    if (!areTimedItemsDrawn && pass != RenderQueue::Pass::Transparent &&
+        costAttribution->isTimed(draws[item.index].draw)) {
+      timedItems.push_back(&item);
+      continue;
+    }
+    if (!areTimedItemsDrawn && pass == RenderQueue::Pass::Transparent) {
+      drawTimedItems();
+    }
+    if (oit != OitMode::None && pass == RenderQueue::Pass::Transparent) {
+      transparentItems.push_back(&item);
+    } else {
+      drawItem(item);
+    }
+  }
+  if (!areTimedItemsDrawn) {
+    drawTimedItems();
+  }
+  // Conditional rendering would also skip the copies of the transparent pass
+  if (occlusionQueries) {
+    occlusionQueries->setGroup(-1);
+  }
+  if (!transparentItems.empty()) {
+    drawTransparentPass([&]() {
+      for (const auto *item : transparentItems) {
+        drawItem(*item);
+      }
+      if (occlusionQueries) {
+        occlusionQueries->setGroup(-1);
+      }
+    });
+  }
+  if (!isDepthWritten) {
+    glDepthFunc(depthFunc);
+    glDepthMask(GL_TRUE);
+  }
+  if (isCoverageEnabled) {
+    enableCoverage(false);
+  }
+  // The boxes are tested against the depth of this frame for the next one
+  if (occlusionQueries) {
+    occlusionQueries->drawBoxes(programs.occlusionBoxes, viewMatrix,
+        projMatrix, m_options.reversedZ);
+  }
+  glBindVertexArray(0);
+  endFrame();
+  programs.stateChangeCount = stateChangeCount;
+  programs.triangleCount = triangleCount;
+  programs.lodSavedTriangleCount = lodSavedTriangleCount;
+  return visibleCount;
+}
+
+void ViewerApplication::renderShadowMaps(const Scene &scene,
+    const ScenePrograms &programs, const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, float zNear, float zFar) const
+{
+  TRACE_ZONE("Render shadow maps");
+  auto &shadowMaps = programs.shadowMaps;
+  glm::vec3 bboxMin, bboxMax;
+  getSceneBounds(scene, bboxMin, bboxMax);
+  shadowMaps.update(scene.lights.getDirection(scene.hierarchy, 0), viewMatrix,
+      projMatrix, zNear, zFar, bboxMin, bboxMax, m_options.reversedZ);
+
+  ShadowCasters casters;
+  findShadowCasters(scene, programs, casters);
+  shadowMaps.invalidateChangedDraws(scene.drawBoundsMin,
+      scene.drawBoundsMax, casters.isDrawReady, scene.poseVersion);
+  for (size_t c = 0; c < CascadedShadowMaps::CASCADE_COUNT; ++c) {
+    if (!shadowMaps.isStale(c)) {
+      continue;
+    }
+    shadowMaps.beginCascade(c);
+    drawShadowCasters(scene, programs, casters,
+        shadowMaps.lightViewProjMatrix(c), nullptr,
+        shadowMaps.texelsPerUnit(c));
+    shadowMaps.endCascade();
+  }
+}
+
+void ViewerApplication::renderLocalShadows(const Scene &scene,
+    const ScenePrograms &programs, const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix) const
+{
+  TRACE_ZONE("Render local shadows");
+  auto &shadowAtlas = programs.shadowAtlas;
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  shadowAtlas.update(scene.lights, scene.hierarchy, viewMatrix, projMatrix,
+      float(viewport[3]), m_options.reversedZ);
+
+  ShadowCasters casters;
+  findShadowCasters(scene, programs, casters);
+  shadowAtlas.invalidateChangedDraws(scene.drawBoundsMin,
+      scene.drawBoundsMax, casters.isDrawReady, scene.poseVersion);
+  for (const auto light :
+      shadowAtlas.scheduleUpdates(m_options.localShadowBudget)) {
+    if (!shadowAtlas.allocate(light)) {
+      continue;
+    }
+    for (size_t view = 0; view < shadowAtlas.viewCount(light); ++view) {
+      shadowAtlas.beginView(light, view);
+      drawShadowCasters(scene, programs, casters,
+          shadowAtlas.lightViewProjMatrix(light, view),
+          &shadowAtlas.lightPosition(light),
+          shadowAtlas.texelsPerUnit(light));
+      shadowAtlas.endView();
+    }
+  }
+}
+
+void ViewerApplication::findShadowCasters(const Scene &scene,
+    const ScenePrograms &programs, ShadowCasters &casters) const
+{
+  // Shadows are cast by the opaque primitives of uploaded meshes
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+  const auto &meshNodes = hierarchy.meshNodes();
+  const auto &model = scene.compact;
+  casters.isDrawReady.assign(scene.drawBoundsMin.size(), 0);
+  casters.isDrawCaster.assign(scene.drawBoundsMin.size(), 0);
+  for (size_t i = 0, drawIdx = 0; i < meshNodes.size(); ++i) {
+    const auto meshIdx = hierarchy.mesh(meshNodes[i]);
+    const auto &range = upload.meshToPrimitives[meshIdx];
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx, ++drawIdx) {
+      if (!upload.isMeshReady[meshIdx]) {
+        continue;
+      }
+      casters.isDrawReady[drawIdx] = upload.isMeshRefined[meshIdx] ? 2 : 1;
+      casters.isDrawCaster[drawIdx] =
+          model.alphaMode(model.primitive(meshIdx, pIdx).material) ==
+          AlphaMode::Opaque;
+    }
+  }
+  // Skinned nodes are drawn as in renderScene
+  casters.useSkinnedProgram = !scene.skins.empty() &&
+                              !scene.hasSkinnedVertices &&
+                              programs.hasSkinnedProgram;
+}
+
+void ViewerApplication::drawShadowCasters(const Scene &scene,
+    const ScenePrograms &programs, ShadowCasters &casters,
+    const glm::mat4 &lightViewProjMatrix, const glm::vec3 *lodEye,
+    float texelsPerUnit) const
+{
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+  const auto &meshNodes = hierarchy.meshNodes();
+  const auto &skins = scene.skins;
+  const auto isNodeSkinned = [&](size_t flatIdx) {
+    return (scene.hasSkinnedVertices || casters.useSkinnedProgram) &&
+           skins.nodeSkin(flatIdx) >= 0;
+  };
+  auto &drawUniforms = programs.shadowDrawUniforms;
+  auto &cameraUniforms = programs.shadowCameraUniforms;
+  // The draw uniforms are shared by the views of the pass
+  if (!casters.isUploaded) {
+    casters.isUploaded = true;
+    if (casters.useSkinnedProgram) {
+      skins.uploadPalettes(programs.frameData, casters.paletteRanges);
+    }
+    drawUniforms.reset(sizeof(DrawUniforms), meshNodes.size());
+    for (size_t i = 0; i < meshNodes.size(); ++i) {
+      const auto modelMatrix = isNodeSkinned(meshNodes[i])
+                                   ? glm::mat4(1)
+                                   : hierarchy.worldMatrix(meshNodes[i]);
+      const auto &range =
+          upload.meshToPrimitives[hierarchy.mesh(meshNodes[i])];
+      const auto positionMatrix =
+          range.count
+              ? modelMatrix * upload.primitives[range.begin].positionMatrix()
+              : modelMatrix;
+      drawUniforms.block<DrawUniforms>(i) = {
+          positionMatrix, glm::mat4(1), positionMatrix};
+    }
+    drawUniforms.upload(programs.frameData);
+  }
+  // World matrices are absolute, projected by the light
+  cameraUniforms.reset(sizeof(CameraUniforms), 1);
+  cameraUniforms.block<CameraUniforms>(0) = getCameraUniforms(glm::mat4(1),
+      lightViewProjMatrix, lightViewProjMatrix, glm::vec3(0));
+  cameraUniforms.upload(programs.frameData);
+
+  std::vector<uint8_t> isDrawVisible(scene.drawBoundsMin.size(), 0);
+  scene.bvh.forEachInFrustum(extractFrustum(lightViewProjMatrix),
+      [&](size_t drawIdx) { isDrawVisible[drawIdx] = 1; });
+
+  // Coarsest level within m_options.lodPixelError texels of the primitive,
+  // as selectLod of renderScene: shadow maps have far fewer texels than the
+  // screen has pixels, so their casters are simplified much sooner
+  const auto selectLod = [&](size_t drawIdx, size_t flatIdx,
+                             size_t primitiveIdx) -> const ArenaLod * {
+    const auto &lods = upload.primitiveToLods[primitiveIdx];
+    // Meshes streaming in coarse first only have their coarsest level
+    if (lods.count && !upload.isMeshRefined[hierarchy.mesh(flatIdx)]) {
+      return &upload.lods[lods.begin + lods.count - 1];
+    }
+    const auto &bboxMin = scene.drawBoundsMin[drawIdx];
+    const auto &bboxMax = scene.drawBoundsMax[drawIdx];
+    if (!lods.count || bboxMax.x == std::numeric_limits<float>::max()) {
+      return nullptr;
+    }
+    const auto distance =
+        lodEye ? glm::length(glm::max(
+                     glm::max(bboxMin - *lodEye, *lodEye - bboxMax),
+                     glm::vec3(0)))
+               : 1.f;
+    const auto &worldMatrix = hierarchy.worldMatrix(flatIdx);
+    const auto maxScale = std::sqrt(std::max(
+        {glm::dot(glm::vec3(worldMatrix[0]), glm::vec3(worldMatrix[0])),
+            glm::dot(glm::vec3(worldMatrix[1]), glm::vec3(worldMatrix[1])),
+            glm::dot(glm::vec3(worldMatrix[2]), glm::vec3(worldMatrix[2]))}));
+    const ArenaLod *selected = nullptr;
+    for (size_t lodIdx = 0; lodIdx < lods.count; ++lodIdx) {
+      const auto &lod = upload.lods[lods.begin + lodIdx];
+      if (lod.error * maxScale * texelsPerUnit >
+          m_options.lodPixelError * distance) {
+        break;
+      }
+      selected = &lod;
+    }
+    return selected;
+  };
+
+  cameraUniforms.bind(CAMERA_UNIFORMS_BINDING, 0);
+  upload.arena.bindPositions();
+  auto currentProgram = std::numeric_limits<uint32_t>::max();
+  auto currentSkin = -1;
+  for (size_t i = 0, drawIdx = 0; i < meshNodes.size(); ++i) {
+    const auto &range = upload.meshToPrimitives[hierarchy.mesh(meshNodes[i])];
+    const auto program =
+        casters.useSkinnedProgram && isNodeSkinned(meshNodes[i]) ? 1u : 0u;
+    auto isNodeBound = false;
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx, ++drawIdx) {
+      if (!isDrawVisible[drawIdx] || !casters.isDrawReady[drawIdx] ||
+          !casters.isDrawCaster[drawIdx]) {
+        continue;
+      }
+      if (program != currentProgram) {
+        currentProgram = program;
+        (program ? programs.depthSkinned : programs.depth).use();
+      }
+      if (!isNodeBound) {
+        isNodeBound = true;
+        const auto skin = program ? skins.nodeSkin(meshNodes[i]) : -1;
+        if (skin >= 0 && skin != currentSkin) {
+          currentSkin = skin;
+          casters.paletteRanges[skin].bind();
+        }
+        drawUniforms.bind(DRAW_UNIFORMS_BINDING, i);
+      }
+      // Levels of detail have no position indices
+      const auto &primitive = upload.primitives[range.begin + pIdx];
+      const auto lod = selectLod(drawIdx, meshNodes[i], range.begin + pIdx);
+      glDrawElementsBaseVertex(primitive.mode,
+          GLsizei(lod ? lod->indexCount : primitive.indexCount),
+          upload.arena.indexType(),
+          upload.arena.indexOffset(
+              lod ? lod->firstIndex : primitive.positionFirstIndex),
+          primitive.baseVertex);
+    }
+  }
+  glBindVertexArray(0);
+}
+
+bool ViewerApplication::renderPickPass(const Scene &scene,
+    const ScenePrograms &programs, const Camera &camera,
+    const glm::mat4 &projMatrix, const glm::mat4 &pixelMatrix,
+    GpuPicker &picker) const
+{
+  if (!programs.hasPickPass) {
+    return false;
+  }
+  TRACE_ZONE("Render pick pass");
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+  const auto &meshNodes = hierarchy.meshNodes();
+  const auto viewProjMatrix = pixelMatrix * projMatrix * camera.getViewMatrix();
+
+  // Only the few draws crossing the pixel are drawn
+  std::vector<uint8_t> isDrawVisible(scene.drawBoundsMin.size(), 0);
+  scene.bvh.forEachInFrustum(extractFrustum(viewProjMatrix),
+      [&](size_t drawIdx) { isDrawVisible[drawIdx] = 1; });
+
+  // Skinned nodes are drawn as in renderScene
+  const auto &skins = scene.skins;
+  const auto useSkinnedProgram = !skins.empty() &&
+                                 !scene.hasSkinnedVertices &&
+                                 programs.hasSkinnedProgram;
+  const auto isNodeSkinned = [&](size_t flatIdx) {
+    return (scene.hasSkinnedVertices || useSkinnedProgram) &&
+           skins.nodeSkin(flatIdx) >= 0;
+  };
+  auto &frameData = programs.frameData;
+  frameData.beginFrame();
+  std::vector<SceneSkins::PaletteRange> paletteRanges;
+  if (useSkinnedProgram) {
+    skins.uploadPalettes(frameData, paletteRanges);
+  }
+  auto &drawUniforms = programs.pickDrawUniforms;
+  drawUniforms.reset(sizeof(DrawUniforms), meshNodes.size());
+  for (size_t i = 0; i < meshNodes.size(); ++i) {
+    const auto modelMatrix = isNodeSkinned(meshNodes[i])
+                                 ? glm::mat4(1)
+                                 : hierarchy.worldMatrix(meshNodes[i]);
+    const auto &range = upload.meshToPrimitives[hierarchy.mesh(meshNodes[i])];
+    const auto positionMatrix =
+        range.count
+            ? modelMatrix * upload.primitives[range.begin].positionMatrix()
+            : modelMatrix;
+    drawUniforms.block<DrawUniforms>(i) = {
+        positionMatrix, glm::mat4(1), positionMatrix};
+  }
+  drawUniforms.upload(frameData);
+  // World matrices are absolute, as in renderShadowMaps
+  auto &cameraUniforms = programs.pickCameraUniforms;
+  cameraUniforms.reset(sizeof(CameraUniforms), 1);
+  cameraUniforms.block<CameraUniforms>(0) = getCameraUniforms(
+      glm::mat4(1), viewProjMatrix, viewProjMatrix, glm::vec3(0));
+  cameraUniforms.upload(frameData);
 
-#include <stb_image_write.h>
-#include <tiny_gltf.h>
+  picker.begin();
+  cameraUniforms.bind(CAMERA_UNIFORMS_BINDING, 0);
+  upload.arena.bindPositions();
+  auto currentProgram = std::numeric_limits<uint32_t>::max();
+  auto currentSkin = -1;
+  for (size_t i = 0, drawIdx = 0; i < meshNodes.size(); ++i) {
+    const auto meshIdx = hierarchy.mesh(meshNodes[i]);
+    const auto &range = upload.meshToPrimitives[meshIdx];
+    const auto program =
+        useSkinnedProgram && isNodeSkinned(meshNodes[i]) ? 1u : 0u;
+    auto isNodeBound = false;
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx, ++drawIdx) {
+      if (!isDrawVisible[drawIdx] || !upload.isMeshReady[meshIdx]) {
+        continue;
+      }
+      if (program != currentProgram) {
+        currentProgram = program;
+        (program ? programs.pickSkinned : programs.pick).use();
+      }
+      if (!isNodeBound) {
+        isNodeBound = true;
+        const auto skin = program ? skins.nodeSkin(meshNodes[i]) : -1;
+        if (skin >= 0 && skin != currentSkin) {
+          currentSkin = skin;
+          paletteRanges[skin].bind();
+        }
+        drawUniforms.bind(DRAW_UNIFORMS_BINDING, i);
+      }
+      (program ? programs.pickSkinnedDrawId : programs.pickDrawId)
+          .set(GLuint(drawIdx + 1));
+      const auto &primitive = upload.primitives[range.begin + pIdx];
+      // Meshes streaming in coarse first only have their coarsest level
+      const auto &lods = upload.primitiveToLods[range.begin + pIdx];
+      const auto *lod = lods.count && !upload.isMeshRefined[meshIdx]
+                            ? &upload.lods[lods.begin + lods.count - 1]
+                            : nullptr;
+      glDrawElementsBaseVertex(primitive.mode,
+          GLsizei(lod ? lod->indexCount : primitive.indexCount),
+          upload.arena.indexType(),
+          upload.arena.indexOffset(
+              lod ? lod->firstIndex : primitive.positionFirstIndex),
+          primitive.baseVertex);
+    }
+  }
+  glBindVertexArray(0);
+  picker.end();
+  frameData.endFrame();
+  return true;
+}
 
-void keyCallback(
-    GLFWwindow *window, int key, int scancode, int action, int mods)
+bool ViewerApplication::buildDerivedGeometry(Scene &scene) const
 {
-  if (key == GLFW_KEY_ESCAPE && action == GLFW_RELEASE) {
-    glfwSetWindowShouldClose(window, 1);
+  TRACE_ZONE("Build derived geometry");
+  const auto &model = scene.model;
+  auto &derived = scene.derived;
+  auto &lods = derived.lods;
+  auto &optimizedIndices = derived.optimizedIndices;
+  auto &meshlets = derived.meshlets;
+
+  // Levels of detail read from a cache keep the vertex order they index
+  auto hasNewIndices = false;
+  if (!m_options.optimizeIndices && (!m_options.generateLods || lods.empty())) {
+    hasNewIndices = !optimizedIndices.empty();
+    optimizedIndices.clear();
+  }
+  if (!m_options.generateLods) {
+    lods.clear();
+  }
+
+  auto hasNewGeometry = false;
+  if (m_options.optimizeIndices && optimizedIndices.empty()) {
+    optimizedIndices = optimizeModelIndices(model, scene.buffers);
+    hasNewGeometry = true;
+    hasNewIndices = true;
+  }
+  if (m_options.generateLods && lods.empty()) {
+    lods = buildModelLods(model, scene.buffers);
+    hasNewGeometry = true;
+  }
+  // Meshlets are ranges of the indices the arena stores
+  if (!m_options.meshlets || hasNewIndices) {
+    meshlets.clear();
+  }
+  if (m_options.meshlets && meshlets.empty()) {
+    meshlets = buildModelMeshlets(model, scene.buffers, optimizedIndices);
+    hasNewGeometry = true;
+  }
+
+  // New levels, or levels of a cache without optimized indices, index the
+  // original vertices
+  if (hasNewGeometry && lods.size() == optimizedIndices.size()) {
+    getJobSystem().parallelFor(
+        lods.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+          for (auto i = beginIdx; i < endIdx; ++i) {
+            const auto &vertexRemap = optimizedIndices[i].vertexRemap;
+            if (vertexRemap.empty()) {
+              continue;
+            }
+            for (auto &lod : lods[i]) {
+              for (auto &index : lod.indices) {
+                index = vertexRemap[index];
+              }
+              optimizeVertexCache(
+                  lod.indices.data(), lod.indices.size(), vertexRemap.size());
+            }
+          }
+        });
+  }
+
+  double missesBefore = 0.;
+  double missesAfter = 0.;
+  size_t triangleCount = 0;
+  for (const auto &optimized : optimizedIndices) {
+    const auto count = optimized.indices.size() / 3;
+    missesBefore += double(optimized.acmrBefore) * count;
+    missesAfter += double(optimized.acmrAfter) * count;
+    triangleCount += count;
   }
+  scene.acmrBefore = triangleCount ? float(missesBefore / triangleCount) : 0.f;
+  scene.acmrAfter = triangleCount ? float(missesAfter / triangleCount) : 0.f;
+
+  return hasNewGeometry;
 }
 
-int ViewerApplication::run()
+void ViewerApplication::resolveDeferredImage(Scene &scene, size_t imageIdx)
 {
-  // Loader shaders
-  const auto glslProgram =
-      compileProgram({m_ShadersRootPath / m_AppName / m_vertexShader,
-          m_ShadersRootPath / m_AppName / m_fragmentShader});
-
-  const auto modelViewProjMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uModelViewProjMatrix");
-  const auto modelViewMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uModelViewMatrix");
-  const auto normalMatrixLocation =
-      glGetUniformLocation(glslProgram.glId(), "uNormalMatrix");
-
-  // Build projection matrix
-  auto maxDistance = 500.f; // TODO use scene bounds instead to compute this
-  maxDistance = maxDistance > 0.f ? maxDistance : 100.f;
-  const auto projMatrix =
-      glm::perspective(70.f, float(m_nWindowWidth) / m_nWindowHeight,
-          0.001f * maxDistance, 1.5f * maxDistance);
-
-  // TODO Implement a new CameraController model and use it instead. Propose the
-  // choice from the GUI
-  FirstPersonCameraController cameraController{
-      m_GLFWHandle.window(), 0.5f * maxDistance};
-  if (m_hasUserCamera) {
-    cameraController.setCamera(m_userCamera);
-  } else {
-    // TODO Use scene bounds to compute a better default camera
-    cameraController.setCamera(
-        Camera{glm::vec3(0, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)});
+  std::string err;
+  std::string warn;
+  if (!loadDeferredImage(scene.model, scene.deferred, imageIdx, err, warn)) {
+    std::cerr << "Image " << imageIdx << ": " << err << std::endl;
   }
+  if (!warn.empty()) {
+    std::cerr << "Warning: " << warn << std::endl;
+  }
+}
 
-  tinygltf::Model model;
-  // TODO Loading the glTF file
+void ViewerApplication::beginSceneUpload(
+    Scene &scene, bool streamTextures, bool coarseFirst)
+{
+  TRACE_ZONE("Begin scene upload");
+  LoadReport::Scope reportScope{m_pLoadReport.get(), LoadPhase::Upload};
+  const auto &model = scene.model;
+  auto &upload = scene.upload;
 
-  // TODO Creation of Buffer Objects
+  std::vector<size_t> meshToFirstPrimitive;
+  upload.primitives =
+      GeometryArena::layoutPrimitives(model, meshToFirstPrimitive,
+          m_options.pointClouds, m_options.positionIndices);
 
-  // TODO Creation of Vertex Array Objects
+  // Levels of detail follow the indices of the primitives
+  GLuint lodIndexCount = 0;
+  GLuint firstLodIndex = 0;
+  if (!upload.primitives.empty()) {
+    const auto &lastPrimitive = upload.primitives.back();
+    firstLodIndex =
+        lastPrimitive.firstIndex + lastPrimitive.storedIndexCount();
+  }
+  upload.lods.clear();
+  upload.primitiveToLods.assign(upload.primitives.size(), {0, 0});
+  const auto &lods = scene.derived.lods;
+  for (size_t i = 0; i < lods.size() && i < upload.primitives.size(); ++i) {
+    upload.primitiveToLods[i] = {upload.lods.size(), lods[i].size()};
+    for (const auto &lod : lods[i]) {
+      upload.lods.push_back({firstLodIndex + lodIndexCount,
+          GLuint(lod.indices.size()), lod.error});
+      lodIndexCount += GLuint(lod.indices.size());
+    }
+  }
+  const auto vertexFormat = m_options.quantizeVertices
+                                ? GeometryArena::VertexFormat::Quantized
+                                : GeometryArena::VertexFormat::Float;
+  if (m_options.quantizeVertices) {
+    GeometryArena::computePositionQuantization(
+        model, scene.buffers, meshToFirstPrimitive, upload.primitives);
+  }
+  const auto hasMorphTargets = std::any_of(
+      begin(model.meshes), end(model.meshes), [](const tinygltf::Mesh &mesh) {
+        return std::any_of(begin(mesh.primitives), end(mesh.primitives),
+            [](const tinygltf::Primitive &primitive) {
+              return !primitive.targets.empty();
+            });
+      });
+  // The pre-passes writing posed vertices and vertex pulling read the
+  // streams as storage buffers
+  const auto hasSkinningPrepass =
+      !model.skins.empty() && canDrawSkins() && m_options.skinningPrepass;
+  const auto canInterleave = !m_options.vertexPulling &&
+                             !hasSkinningPrepass &&
+                             !(hasMorphTargets && canBlendMorphs());
+  if (m_options.interleaveVertices && !canInterleave) {
+    std::cerr << "Warning: vertices are not interleaved with vertex pulling, "
+                 "the skinning pre-pass or morph targets"
+              << std::endl;
+  }
+  const auto vertexLayout = m_options.interleaveVertices && canInterleave
+                                ? GeometryArena::VertexLayout::Interleaved
+                                : GeometryArena::VertexLayout::Separate;
+  upload.arena.allocate(
+      upload.primitives, lodIndexCount, vertexFormat, vertexLayout);
+  upload.pins.clear();
+  if (m_options.pinnedUploads) {
+    for (const auto &buffer : scene.buffers) {
+      if (buffer.size >= MIN_PINNED_BUFFER_SIZE) {
+        upload.pins.emplace_back(buffer.data, buffer.size);
+      }
+    }
+  }
 
-  // Setup OpenGL state for rendering
-  glEnable(GL_DEPTH_TEST);
-  glslProgram.use();
+  upload.meshToPrimitives.resize(model.meshes.size());
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    auto &range = upload.meshToPrimitives[meshIdx];
+    range.begin = meshToFirstPrimitive[meshIdx];
+    range.count = model.meshes[meshIdx].primitives.size();
+  }
 
-  // Lambda function to draw the scene
-  const auto drawScene = [&](const Camera &camera) {
-    glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  // Points and lines have no geometry in the arena
+  scene.pointClouds.upload();
+
+  // Skinned draws are unbounded in updateDrawBounds
+  scene.skins = SceneSkins();
+  scene.hasSkinnedVertices = false;
+  scene.hasGpuBounds = false;
+  scene.depthPrepass = m_options.depthPrepass;
+  scene.shadows = m_options.shadows;
+  scene.localShadows = m_options.localShadows;
+  if (!model.skins.empty() && canDrawSkins()) {
+    scene.skins.build(model, scene.buffers, scene.hierarchy, upload.primitives,
+        meshToFirstPrimitive, upload.arena.vertexCount());
+    scene.skins.updatePalettes(scene.hierarchy);
+    upload.arena.bindSkinBuffer(scene.skins.vertexBuffer());
+  } else if (!model.skins.empty() && scene.vertexAnimations.empty()) {
+    std::cerr << "Warning: skins are drawn in their bind pose with indirect "
+                 "draws, instancing or quantized vertices"
+              << std::endl;
+  }
+  if (!scene.vertexAnimations.empty()) {
+    const auto clipCount = scene.vertexAnimations.allocate(
+        upload.primitives, meshToFirstPrimitive);
+    if (clipCount < scene.vertexAnimations.clips().size()) {
+      std::cerr << "Warning: "
+                << scene.vertexAnimations.clips().size() - clipCount
+                << " vertex animation clips do not match the vertices of "
+                   "their primitive"
+                << std::endl;
+    }
+  }
+  // Morphed draws are unbounded in updateDrawBounds too
+  scene.morphs = SceneMorphs();
+  if (hasMorphTargets && canBlendMorphs()) {
+    scene.morphs.build(
+        model, scene.hierarchy, upload.primitives, meshToFirstPrimitive);
+  } else if (hasMorphTargets) {
+    std::cerr << "Warning: morph targets are ignored with quantized vertices"
+              << std::endl;
+  }
+  scene.animations = SceneAnimations{model, scene.buffers, scene.hierarchy};
+  scene.lights = SceneLights{model, scene.hierarchy};
+  scene.animation = -1;
+  scene.animationTime = -1.;
+  if (m_options.animation >= 0 &&
+      (!m_options.useIndirectDraws || m_options.gpuTransforms)) {
+    if (size_t(m_options.animation) < scene.animations.animationCount()) {
+      scene.animation = m_options.animation;
+    } else {
+      std::cerr << "Warning: the model has no animation "
+                << m_options.animation << std::endl;
+    }
+  }
 
-    const auto viewMatrix = camera.getViewMatrix();
+  upload.primitiveBoundsMin.assign(upload.primitives.size(), glm::vec3(1));
+  upload.primitiveBoundsMax.assign(upload.primitives.size(), glm::vec3(-1));
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    const auto firstPrimitive = upload.meshToPrimitives[meshIdx].begin;
+    for (size_t pIdx = 0; pIdx < upload.meshToPrimitives[meshIdx].count;
+         ++pIdx) {
+      const auto position = scene.compact.primitive(meshIdx, pIdx).attribute(
+          VertexAttribute::Position);
+      if (position < 0) {
+        continue;
+      }
+      const auto &accessor = model.accessors[position];
+      if (accessor.minValues.size() == 3 && accessor.maxValues.size() == 3) {
+        const auto &minValues = accessor.minValues;
+        const auto &maxValues = accessor.maxValues;
+        upload.primitiveBoundsMin[firstPrimitive + pIdx] =
+            glm::vec3(minValues[0], minValues[1], minValues[2]);
+        upload.primitiveBoundsMax[firstPrimitive + pIdx] =
+            glm::vec3(maxValues[0], maxValues[1], maxValues[2]);
+      }
+    }
+  }
+  // Instances of animated primitives are bounded by every frame of their
+  // clips
+  scene.vertexAnimations.growPrimitiveBounds(
+      upload.primitiveBoundsMin, upload.primitiveBoundsMax);
+  updateDrawBounds(scene);
+  if (m_options.useInstancing) {
+    buildInstancedDraws(scene);
+  }
 
-    // The recursive function that should draw a node
-    // We use a std::function because a simple lambda cannot be recursive
-    const std::function<void(int, const glm::mat4 &)> drawNode =
-        [&](int nodeIdx, const glm::mat4 &parentMatrix) {
-          // TODO The drawNode function
-        };
+  // Resolve the image of each texture, GPU-compressed KTX2 images first
+  upload.textureImages.assign(model.textures.size(), -1);
+  std::vector<bool> isImageUsed(model.images.size(), false);
+  for (size_t textureIdx = 0; textureIdx < model.textures.size();
+       ++textureIdx) {
+    const auto &texture = model.textures[textureIdx];
+    auto imageIdx = texture.source;
+    const auto basisu = texture.extensions.find("KHR_texture_basisu");
+    if (basisu != end(texture.extensions) && basisu->second.Has("source")) {
+      const auto source = int(basisu->second.Get("source").GetNumberAsInt());
+      if (source >= 0) {
+        resolveDeferredImage(scene, size_t(source));
+      }
+      if (source >= 0 && size_t(source) < model.images.size() &&
+          canUploadKtx2Image(model.images[source])) {
+        imageIdx = source;
+      } else {
+        std::cerr << "Texture " << textureIdx
+                  << ": KTX2 image cannot be uploaded, using its fallback"
+                  << std::endl;
+      }
+    }
+    if (imageIdx >= 0 && size_t(imageIdx) < model.images.size()) {
+      upload.textureImages[textureIdx] = imageIdx;
+      isImageUsed[imageIdx] = true;
+    }
+  }
+  upload.images.clear();
+  upload.images.resize(model.images.size());
+  upload.imageUsages = getImageUsages(model);
+  upload.imagesToUpload.clear();
+  for (size_t imageIdx = 0; imageIdx < model.images.size(); ++imageIdx) {
+    if (isImageUsed[imageIdx] && !scene.deferred.isImageDeferred(imageIdx)) {
+      upload.imagesToUpload.push_back(imageIdx);
+    }
+  }
+  // Read when uploadMeshes reaches them, once the default scene is complete
+  for (size_t imageIdx = 0; imageIdx < model.images.size(); ++imageIdx) {
+    if (isImageUsed[imageIdx] && scene.deferred.isImageDeferred(imageIdx)) {
+      upload.imagesToUpload.push_back(imageIdx);
+    }
+  }
+  scene.textureStreamer.release();
+  scene.virtualTextures.release();
+  if (usesVirtualTextures()) {
+    // Pages are read from the images for the lifetime of the scene
+    for (const auto imageIdx : upload.imagesToUpload) {
+      resolveDeferredImage(scene, imageIdx);
+    }
+    std::string err;
+    scene.virtualTextures.reset(model, upload.imagesToUpload,
+        upload.imageUsages, m_options.virtualTextureBudget, err);
+    if (!err.empty()) {
+      std::cerr << "Warning: " << err << std::endl;
+    }
+    upload.imagesToUpload.clear();
+  } else if (streamTextures) {
+    // The streamer reads the levels of every image upfront
+    for (const auto imageIdx : upload.imagesToUpload) {
+      resolveDeferredImage(scene, imageIdx);
+    }
+    std::string err;
+    scene.textureStreamer.reset(
+        model, upload.imagesToUpload, m_options.textureBudget, err);
+    if (!err.empty()) {
+      std::cerr << "Warning: " << err << std::endl;
+    }
+    upload.imagesToUpload.clear();
+  }
+
+  upload.isMeshReady.assign(model.meshes.size(), false);
+  upload.isMeshRefined.assign(model.meshes.size(), false);
+  upload.previous = nullptr;
+  upload.reusedMeshes.clear();
+  upload.nextMeshIdx = 0;
+  // Without levels, meshes are refined as they are uploaded
+  upload.nextRefinedMeshIdx =
+      coarseFirst && !upload.lods.empty() ? 0 : model.meshes.size();
+  upload.nextImageIdx = 0;
+  upload.uploadedBytes = 0;
+  upload.totalBytes = 0;
+  for (const auto &primitive : upload.primitives) {
+    upload.totalBytes +=
+        primitive.vertexCount * GeometryArena::getVertexSize(vertexFormat) +
+        primitive.storedIndexCount() * upload.arena.indexSize();
+  }
+  upload.totalBytes += lodIndexCount * upload.arena.indexSize();
+  if (!scene.skins.empty()) {
+    upload.totalBytes +=
+        upload.arena.vertexCount() * sizeof(SceneSkins::SkinVertex);
+  }
+  for (const auto imageIdx : upload.imagesToUpload) {
+    upload.totalBytes += model.images[imageIdx].image.size();
+  }
+}
+
+void ViewerApplication::reuseSceneResources(
+    Scene &scene, Scene &previous) const
+{
+  TRACE_ZONE("Reuse scene resources");
+  const auto &model = scene.model;
+  auto &upload = scene.upload;
+  auto &previousUpload = previous.upload;
 
-    // Draw the scene referenced by gltf file
-    if (model.defaultScene >= 0) {
-      // TODO Draw all nodes
+  // The pre-passes write posed vertices over the bind pose ones
+  const auto isAnimated = [&](size_t meshIdx) {
+    const auto &primitives = model.meshes[meshIdx].primitives;
+    return std::any_of(begin(primitives), end(primitives),
+        [](const tinygltf::Primitive &primitive) {
+          return !primitive.targets.empty() ||
+                 primitive.attributes.count("JOINTS_0");
+        });
+  };
+  const auto isSameLayout = [&](const PrimitiveRange &range,
+                                const PrimitiveRange &previousRange) {
+    if (range.count != previousRange.count) {
+      return false;
+    }
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx) {
+      const auto primitiveIdx = range.begin + pIdx;
+      const auto previousPrimitiveIdx = previousRange.begin + pIdx;
+      const auto &primitive = upload.primitives[primitiveIdx];
+      const auto &previousPrimitive =
+          previousUpload.primitives[previousPrimitiveIdx];
+      const auto &lods = upload.primitiveToLods[primitiveIdx];
+      const auto &previousLods =
+          previousUpload.primitiveToLods[previousPrimitiveIdx];
+      if (primitive.vertexCount != previousPrimitive.vertexCount ||
+          primitive.storedIndexCount() !=
+              previousPrimitive.storedIndexCount() ||
+          lods.count != previousLods.count) {
+        return false;
+      }
+      for (size_t lodIdx = 0; lodIdx < lods.count; ++lodIdx) {
+        if (upload.lods[lods.begin + lodIdx].indexCount !=
+            previousUpload.lods[previousLods.begin + lodIdx].indexCount) {
+          return false;
+        }
+      }
     }
+    return true;
   };
 
-  // Loop until the user closes the window
-  for (auto iterationCount = 0u; !m_GLFWHandle.shouldClose();
-       ++iterationCount) {
-    const auto seconds = glfwGetTime();
+  const auto meshMatches = matchContentHashes(
+      scene.contentHashes.meshes, previous.contentHashes.meshes);
+  upload.reusedMeshes.assign(model.meshes.size(), -1);
+  size_t reusedMeshCount = 0;
+  const auto isSameFormat =
+      upload.arena.vertexFormat() == previousUpload.arena.vertexFormat() &&
+      upload.arena.vertexLayout() == previousUpload.arena.vertexLayout() &&
+      upload.arena.indexType() == previousUpload.arena.indexType();
+  for (size_t meshIdx = 0; isSameFormat && meshIdx < meshMatches.size();
+       ++meshIdx) {
+    const auto previousMeshIdx = meshMatches[meshIdx];
+    if (previousMeshIdx >= 0 && previousUpload.isMeshReady[previousMeshIdx] &&
+        !isAnimated(meshIdx) &&
+        isSameLayout(upload.meshToPrimitives[meshIdx],
+            previousUpload.meshToPrimitives[previousMeshIdx])) {
+      upload.reusedMeshes[meshIdx] = previousMeshIdx;
+      ++reusedMeshCount;
+    }
+  }
+  if (reusedMeshCount) {
+    upload.previous = &previousUpload;
+  }
 
-    const auto camera = cameraController.getCamera();
-    drawScene(camera);
+  // Textures of unchanged images are moved as they are
+  const auto imageMatches = matchContentHashes(
+      scene.contentHashes.images, previous.contentHashes.images);
+  size_t reusedImageCount = 0;
+  auto &imagesToUpload = upload.imagesToUpload;
+  imagesToUpload.erase(
+      std::remove_if(begin(imagesToUpload), end(imagesToUpload),
+          [&](size_t imageIdx) {
+            const auto previousImageIdx = imageMatches[imageIdx];
+            if (previousImageIdx < 0 ||
+                size_t(previousImageIdx) >= previousUpload.images.size() ||
+                !previousUpload.images[previousImageIdx].texture()) {
+              return false;
+            }
+            upload.images[imageIdx] =
+                std::move(previousUpload.images[previousImageIdx]);
+            auto &image = scene.model.images[imageIdx];
+            upload.totalBytes -= image.image.size();
+            std::vector<unsigned char>{}.swap(image.image);
+            ++reusedImageCount;
+            return true;
+          }),
+      end(imagesToUpload));
 
-    // GUI code:
-    imguiNewFrame();
+  std::clog << "Reused " << reusedMeshCount << " / " << model.meshes.size()
+            << " meshes and " << reusedImageCount << " / "
+            << model.images.size() << " images" << std::endl;
+}
 
-    {
-      ImGui::Begin("GUI");
-      ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
-          1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
-      if (ImGui::CollapsingHeader("Camera", ImGuiTreeNodeFlags_DefaultOpen)) {
-        ImGui::Text("eye: %.3f %.3f %.3f", camera.eye().x, camera.eye().y,
-            camera.eye().z);
-        ImGui::Text("center: %.3f %.3f %.3f", camera.center().x,
-            camera.center().y, camera.center().z);
-        ImGui::Text(
-            "up: %.3f %.3f %.3f", camera.up().x, camera.up().y, camera.up().z);
+bool ViewerApplication::uploadMeshes(Scene &scene, size_t byteBudget)
+{
+  TRACE_ZONE("Upload meshes");
+  LoadReport::Scope reportScope{m_pLoadReport.get(), LoadPhase::Upload};
+  auto &model = scene.model;
+  auto &upload = scene.upload;
 
-        ImGui::Text("front: %.3f %.3f %.3f", camera.front().x, camera.front().y,
-            camera.front().z);
-        ImGui::Text("left: %.3f %.3f %.3f", camera.left().x, camera.left().y,
-            camera.left().z);
+  auto &optimizedIndices = scene.derived.optimizedIndices;
+  auto &lodChains = scene.derived.lods;
+  auto &jobSystem = getJobSystem();
 
-        if (ImGui::Button("CLI camera args to clipboard")) {
-          std::stringstream ss;
-          ss << "--lookat " << camera.eye().x << "," << camera.eye().y << ","
-             << camera.eye().z << "," << camera.center().x << ","
-             << camera.center().y << "," << camera.center().z << ","
-             << camera.up().x << "," << camera.up().y << "," << camera.up().z;
-          const auto str = ss.str();
-          glfwSetClipboardString(m_GLFWHandle.window(), str.c_str());
+  // Data of a chunk decoded by workers into the staging ring, then copied by
+  // the GPU. Larger data is uploaded from CPU memory, primitives stored as
+  // is in pinned buffers are copied from them.
+  struct StagedData
+  {
+    size_t index; // Of the primitive or of the image
+    size_t meshIdx; // Of the primitive
+    RingBuffer::Allocation allocation; // Buffer 0 if not staged
+    bool isPinned = false; // Copied by the GPU from upload.pins
+  };
+  std::vector<StagedData> chunk;
+  const auto allocateStaging = [&](size_t byteSize, size_t alignment) {
+    return byteSize <= STAGING_CHUNK_SIZE
+               ? upload.staging.allocate(byteSize, alignment)
+               : RingBuffer::Allocation{0, 0, nullptr};
+  };
+  upload.staging.reserve(STAGING_CHUNK_SIZE);
+
+  // Meshes unchanged since the previous version of the model are copied
+  // from its arena by the GPU, return the number of bytes copied
+  const auto copyReusedMesh = [&](size_t meshIdx) {
+    const auto &previous = *upload.previous;
+    const auto &range = upload.meshToPrimitives[meshIdx];
+    const auto &previousRange =
+        previous.meshToPrimitives[upload.reusedMeshes[meshIdx]];
+    size_t byteSize = 0;
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx) {
+      const auto primitiveIdx = range.begin + pIdx;
+      const auto previousPrimitiveIdx = previousRange.begin + pIdx;
+      const auto &arenaPrimitive = upload.primitives[primitiveIdx];
+      upload.arena.copyPrimitive(previous.arena,
+          previous.primitives[previousPrimitiveIdx], arenaPrimitive);
+      byteSize += upload.arena.getPrimitiveByteSize(arenaPrimitive);
+      const auto &lods = upload.primitiveToLods[primitiveIdx];
+      const auto &previousLods = previous.primitiveToLods[previousPrimitiveIdx];
+      for (size_t lodIdx = 0; lodIdx < lods.count; ++lodIdx) {
+        const auto &lod = upload.lods[lods.begin + lodIdx];
+        const auto &previousLod = previous.lods[previousLods.begin + lodIdx];
+        upload.arena.copyIndices(previous.arena.indexBuffer(),
+            previousLod.firstIndex * previous.arena.indexSize(),
+            lod.firstIndex, lod.indexCount);
+        byteSize += lod.indexCount * upload.arena.indexSize();
+      }
+      if (primitiveIdx < optimizedIndices.size()) {
+        optimizedIndices[primitiveIdx] = {};
+      }
+      if (primitiveIdx < lodChains.size()) {
+        MeshLodChain{}.swap(lodChains[primitiveIdx]);
+      }
+    }
+    return byteSize;
+  };
+
+  // With coarse-first uploads (nextRefinedMeshIdx is then behind), the
+  // primitives with levels only get their vertices and coarsest level from
+  // the first pass over the meshes, their indices and finer levels from the
+  // second one
+  const auto meshCount = upload.meshToPrimitives.size();
+  const auto isCoarseFirst = upload.nextRefinedMeshIdx < meshCount;
+  const auto isDeferred = [&](size_t primitiveIdx) {
+    return isCoarseFirst && upload.primitiveToLods[primitiveIdx].count;
+  };
+  const auto isMeshDeferred = [&](size_t meshIdx) {
+    const auto &range = upload.meshToPrimitives[meshIdx];
+    if (upload.previous && upload.reusedMeshes[meshIdx] >= 0) {
+      return false;
+    }
+    for (auto i = range.begin; i < range.begin + range.count; ++i) {
+      if (isDeferred(i)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  // Parts of a primitive uploaded by a pass, with a range of its levels
+  struct UploadedParts
+  {
+    GeometryArena::PrimitiveParts parts;
+    size_t firstLod; // In the levels of the primitive
+    size_t lodCount;
+  };
+  const auto getUploadedParts = [&](size_t primitiveIdx, bool isRefining) {
+    const auto lodCount = upload.primitiveToLods[primitiveIdx].count;
+    if (!isDeferred(primitiveIdx)) {
+      return UploadedParts{GeometryArena::PrimitiveParts::All, 0, lodCount};
+    }
+    return isRefining
+               ? UploadedParts{GeometryArena::PrimitiveParts::Indices, 0,
+                     lodCount - 1}
+               : UploadedParts{
+                     GeometryArena::PrimitiveParts::Vertices, lodCount - 1, 1};
+  };
+
+  size_t uploadedBytes = 0;
+  while ((upload.nextMeshIdx < meshCount ||
+             upload.nextRefinedMeshIdx < meshCount) &&
+         uploadedBytes < byteBudget) {
+    TRACE_ZONE("Upload mesh chunk");
+    // Meshes are refined once all of them are ready
+    const auto isRefining = upload.nextMeshIdx >= meshCount;
+    auto &nextMeshIdx =
+        isRefining ? upload.nextRefinedMeshIdx : upload.nextMeshIdx;
+    const auto chunkBudget =
+        std::min(STAGING_CHUNK_SIZE, byteBudget - uploadedBytes);
+    const auto firstMeshIdx = nextMeshIdx;
+    size_t chunkBytes = 0;
+    chunk.clear();
+    upload.staging.beginFrame();
+    for (; nextMeshIdx < meshCount && chunkBytes < chunkBudget;
+         ++nextMeshIdx) {
+      const auto &range = upload.meshToPrimitives[nextMeshIdx];
+      if (upload.previous && upload.reusedMeshes[nextMeshIdx] >= 0) {
+        if (!isRefining) {
+          chunkBytes += copyReusedMesh(nextMeshIdx);
         }
+        continue;
+      }
+      for (auto primitiveIdx = range.begin;
+           primitiveIdx < range.begin + range.count; ++primitiveIdx) {
+        if (isRefining && !isDeferred(primitiveIdx)) {
+          continue;
+        }
+        // Levels of detail follow the indices of the primitive
+        const auto uploaded = getUploadedParts(primitiveIdx, isRefining);
+        auto byteSize = upload.arena.getPrimitiveByteSize(
+            upload.primitives[primitiveIdx], uploaded.parts);
+        const auto &lods = upload.primitiveToLods[primitiveIdx];
+        for (size_t lodIdx = uploaded.firstLod;
+             lodIdx < uploaded.firstLod + uploaded.lodCount; ++lodIdx) {
+          byteSize += upload.lods[lods.begin + lodIdx].indexCount *
+                      upload.arena.indexSize();
+        }
+        chunkBytes += byteSize;
+        const auto isOptimized =
+            primitiveIdx < optimizedIndices.size() &&
+            !optimizedIndices[primitiveIdx].indices.empty();
+        if (!upload.pins.empty() && !isOptimized && !lods.count &&
+            upload.arena.copyPinnedPrimitive(model, scene.buffers,
+                upload.pins,
+                model.meshes[nextMeshIdx]
+                    .primitives[primitiveIdx - range.begin],
+                upload.primitives[primitiveIdx])) {
+          chunk.push_back({primitiveIdx, nextMeshIdx,
+              RingBuffer::Allocation{0, 0, nullptr}, true});
+          continue;
+        }
+        chunk.push_back(
+            {primitiveIdx, nextMeshIdx, allocateStaging(byteSize, 4)});
       }
-      ImGui::End();
     }
 
-    imguiRenderFrame();
+    const auto getPrimitive = [&](const StagedData &staged,
+                                  const std::vector<uint32_t> *&indices,
+                                  const std::vector<uint32_t> *&vertexRemap)
+        -> const tinygltf::Primitive & {
+      const auto primitiveIdx = staged.index;
+      indices = nullptr;
+      vertexRemap = nullptr;
+      if (primitiveIdx < optimizedIndices.size() &&
+          !optimizedIndices[primitiveIdx].indices.empty()) {
+        indices = &optimizedIndices[primitiveIdx].indices;
+        vertexRemap = &optimizedIndices[primitiveIdx].vertexRemap;
+      }
+      return model.meshes[staged.meshIdx].primitives[primitiveIdx -
+          upload.meshToPrimitives[staged.meshIdx].begin];
+    };
 
-    glfwPollEvents(); // Poll for and process events
+    // Workers decode the primitives straight into the mapping
+    jobSystem.parallelFor(chunk.size(), 1, [&](size_t begin, size_t end) {
+      for (auto i = begin; i < end; ++i) {
+        const auto &staged = chunk[i];
+        if (!staged.allocation.buffer) {
+          continue;
+        }
+        TRACE_ZONE("Decode primitive");
+        const std::vector<uint32_t> *indices;
+        const std::vector<uint32_t> *vertexRemap;
+        const auto &primitive = getPrimitive(staged, indices, vertexRemap);
+        const auto &arenaPrimitive = upload.primitives[staged.index];
+        const auto uploaded = getUploadedParts(staged.index, isRefining);
+        upload.arena.decodePrimitive(model, scene.buffers, primitive,
+            arenaPrimitive, indices, vertexRemap, staged.allocation.data,
+            uploaded.parts);
+        auto lodData =
+            static_cast<unsigned char *>(staged.allocation.data) +
+            upload.arena.getPrimitiveByteSize(arenaPrimitive, uploaded.parts);
+        for (auto lodIdx = uploaded.firstLod;
+             lodIdx < uploaded.firstLod + uploaded.lodCount; ++lodIdx) {
+          const auto &lodIndices = lodChains[staged.index][lodIdx].indices;
+          lodData += upload.arena.encodeIndices(
+              lodIndices.data(), lodIndices.size(), lodData);
+        }
+      }
+    });
+
+    // The GPU copies staged data while this thread goes on
+    for (const auto &staged : chunk) {
+      const auto primitiveIdx = staged.index;
+      const std::vector<uint32_t> *indices;
+      const std::vector<uint32_t> *vertexRemap;
+      const auto &primitive = getPrimitive(staged, indices, vertexRemap);
+      const auto &arenaPrimitive = upload.primitives[primitiveIdx];
+      const auto &lods = upload.primitiveToLods[primitiveIdx];
+      const auto uploaded = getUploadedParts(primitiveIdx, isRefining);
+      const auto lodEnd = uploaded.firstLod + uploaded.lodCount;
+      const auto &allocation = staged.allocation;
+      if (allocation.buffer) {
+        upload.arena.copyPrimitive(allocation.buffer, allocation.offset,
+            arenaPrimitive, uploaded.parts);
+        auto lodOffset =
+            allocation.offset +
+            upload.arena.getPrimitiveByteSize(arenaPrimitive, uploaded.parts);
+        for (auto lodIdx = uploaded.firstLod; lodIdx < lodEnd; ++lodIdx) {
+          const auto &lod = upload.lods[lods.begin + lodIdx];
+          upload.arena.copyIndices(
+              allocation.buffer, lodOffset, lod.firstIndex, lod.indexCount);
+          lodOffset += lod.indexCount * upload.arena.indexSize();
+        }
+      } else if (!staged.isPinned) {
+        upload.arena.uploadPrimitive(model, scene.buffers, primitive,
+            arenaPrimitive, indices, vertexRemap, uploaded.parts);
+        for (auto lodIdx = uploaded.firstLod; lodIdx < lodEnd; ++lodIdx) {
+          const auto &lod = upload.lods[lods.begin + lodIdx];
+          upload.arena.uploadIndices(
+              lod.firstIndex, lodChains[primitiveIdx][lodIdx].indices);
+        }
+      }
+      // Skins and morphs follow the vertices, the derived geometry is
+      // released with the last indices
+      if (uploaded.parts != GeometryArena::PrimitiveParts::Indices) {
+        uploadedBytes += scene.skins.uploadPrimitive(
+            model, scene.buffers, primitive, arenaPrimitive, vertexRemap);
+        uploadedBytes += scene.vertexAnimations.uploadPrimitive(
+            uint32_t(primitiveIdx), vertexRemap);
+        scene.morphs.decodePrimitive(model, scene.buffers, staged.meshIdx,
+            primitive, arenaPrimitive, vertexRemap);
+      }
+      if (uploaded.parts == GeometryArena::PrimitiveParts::Vertices) {
+        continue;
+      }
+      if (primitiveIdx < optimizedIndices.size()) {
+        optimizedIndices[primitiveIdx] = {};
+      }
+      if (primitiveIdx < lodChains.size()) {
+        MeshLodChain{}.swap(lodChains[primitiveIdx]);
+      }
+    }
+    upload.staging.endFrame();
+    for (auto i = firstMeshIdx; i < nextMeshIdx; ++i) {
+      upload.isMeshReady[i] = true;
+      upload.isMeshRefined[i] = isRefining || !isMeshDeferred(i);
+    }
+    uploadedBytes += chunkBytes;
+  }
+  // The copies of the last meshes are the last to read the pinned buffers
+  if (upload.nextMeshIdx >= upload.meshToPrimitives.size()) {
+    upload.pins.clear();
+  }
 
-    auto ellapsedTime = glfwGetTime() - seconds;
-    auto guiHasFocus =
-        ImGui::GetIO().WantCaptureMouse || ImGui::GetIO().WantCaptureKeyboard;
-    if (!guiHasFocus) {
-      cameraController.update(float(ellapsedTime));
+  while (upload.nextMeshIdx >= meshCount &&
+         upload.nextRefinedMeshIdx >= meshCount &&
+         upload.nextImageIdx < upload.imagesToUpload.size() &&
+         uploadedBytes < byteBudget) {
+    TRACE_ZONE("Upload image chunk");
+    const auto chunkBudget =
+        std::min(STAGING_CHUNK_SIZE, byteBudget - uploadedBytes);
+    size_t chunkBytes = 0;
+    chunk.clear();
+    upload.staging.beginFrame();
+    for (; upload.nextImageIdx < upload.imagesToUpload.size() &&
+           chunkBytes < chunkBudget;
+         ++upload.nextImageIdx) {
+      const auto imageIdx = upload.imagesToUpload[upload.nextImageIdx];
+      const auto &image = model.images[imageIdx];
+      if (scene.deferred.isImageDeferred(imageIdx)) {
+        resolveDeferredImage(scene, imageIdx);
+        upload.totalBytes += image.image.size();
+      }
+      // Offsets of 16-bit pixels and compressed blocks stay aligned
+      chunk.push_back(
+          {imageIdx, 0, allocateStaging(image.image.size(), 16)});
+      chunkBytes += image.image.size();
     }
 
-    m_GLFWHandle.swapBuffers(); // Swap front and back buffers
+    jobSystem.parallelFor(chunk.size(), 1, [&](size_t begin, size_t end) {
+      for (auto i = begin; i < end; ++i) {
+        const auto &image = model.images[chunk[i].index];
+        if (chunk[i].allocation.buffer) {
+          std::memcpy(chunk[i].allocation.data, image.image.data(),
+              image.image.size());
+        }
+      }
+    });
+
+    const auto *mipmapProgram = loadMipmapProgram();
+    for (const auto &staged : chunk) {
+      auto &image = model.images[staged.index];
+      std::string err;
+      if (!upload.images[staged.index].create(image, err,
+              staged.allocation.buffer, staged.allocation.offset,
+              upload.imageUsages[staged.index], mipmapProgram)) {
+        std::cerr << "Image " << staged.index << ": " << err << std::endl;
+      }
+      // The pixels or KTX2 levels now live in the texture
+      std::vector<unsigned char>{}.swap(image.image);
+    }
+    upload.staging.endFrame();
+    uploadedBytes += chunkBytes;
   }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  upload.uploadedBytes += uploadedBytes;
+  return upload.done();
+}
 
-  // TODO clean up allocated GL data
+void ViewerApplication::buildIndirectDraws(Scene &scene)
+{
+  TRACE_ZONE("Build indirect draws");
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+  auto &draws = scene.indirectDraws;
 
-  return 0;
+  const auto &meshlets = scene.derived.meshlets;
+  draws.clear();
+  auto &gpuTransforms = scene.gpuTransforms;
+  if (m_options.gpuTransforms && !scene.animations.empty()) {
+    gpuTransforms.build(hierarchy, scene.animations.animatedNodes());
+  } else {
+    gpuTransforms.clear();
+  }
+  // Index in draws of each draw added by add(), for buildGpuBounds
+  std::vector<GLuint> addedDraws;
+  addedDraws.reserve(scene.drawBoundsMin.size());
+  size_t drawIdx = 0; // In scene.drawBoundsMin/Max
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    const auto &range = upload.meshToPrimitives[hierarchy.mesh(flatIdx)];
+    // Skinned and morphed draws keep the pose they are uploaded with
+    const auto isMoving =
+        !gpuTransforms.empty() && gpuTransforms.isMoving(flatIdx) &&
+        (scene.skins.empty() || scene.skins.nodeSkin(flatIdx) < 0) &&
+        scene.morphs.weights().weightCount(flatIdx) == 0;
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx, ++drawIdx) {
+      const auto primitiveIdx = range.begin + pIdx;
+      const auto materialIdx =
+          scene.compact.primitive(hierarchy.mesh(flatIdx), pIdx).material;
+      const auto isTransparent =
+          isTransparentMaterial(scene.compact, materialIdx);
+      if (primitiveIdx < meshlets.size() && !meshlets[primitiveIdx].empty()) {
+        // The default material is single-sided
+        const auto material = scene.compact.material(materialIdx);
+        draws.addMeshlets(upload.primitives[primitiveIdx],
+            meshlets[primitiveIdx], hierarchy.worldMatrix(flatIdx),
+            isTransparent, !material || !material->doubleSided,
+            isMoving ? int(flatIdx) : -1);
+        addedDraws.push_back(GpuBounds::NO_DRAW);
+        continue;
+      }
+      const IndirectDrawList::MovingNode movingNode = {flatIdx,
+          upload.primitiveBoundsMin[primitiveIdx],
+          upload.primitiveBoundsMax[primitiveIdx]};
+      const auto addedIdx = draws.drawCount();
+      draws.add(upload.primitives[primitiveIdx],
+          hierarchy.worldMatrix(flatIdx), scene.drawBoundsMin[drawIdx],
+          scene.drawBoundsMax[drawIdx], isTransparent,
+          isMoving ? &movingNode : nullptr);
+      addedDraws.push_back(draws.drawCount() > addedIdx ? GLuint(addedIdx)
+                                                        : GpuBounds::NO_DRAW);
+    }
+  }
+  draws.setTriangleCulling(usesTriangleCulling());
+  draws.upload();
+  if (m_options.gpuBounds && upload.done()) {
+    for (auto &draw : addedDraws) {
+      if (draw != GpuBounds::NO_DRAW) {
+        draw = draws.uploadedDrawIndex(draw);
+      }
+    }
+    buildGpuBounds(scene, &addedDraws);
+  }
+  draws.setVertexPulling(usesVertexPulling());
+  if (m_options.vertexPulling && !usesVertexPulling()) {
+    std::cerr << "Warning: vertex pulling requires "
+                 "GL_ARB_shader_draw_parameters, vertices are fetched by the "
+                 "VAO"
+              << std::endl;
+  }
+  scene.hasIndirectDraws = true;
+}
+
+void ViewerApplication::buildMaterials(Scene &scene) const
+{
+  TRACE_ZONE("Build materials");
+  const auto &model = scene.model;
+  const auto &upload = scene.upload;
+
+  std::vector<GLuint> textures(model.textures.size(), 0);
+  if (upload.done()) {
+    for (size_t textureIdx = 0; textureIdx < textures.size(); ++textureIdx) {
+      const auto imageIdx = textureIdx < upload.textureImages.size()
+                                ? upload.textureImages[textureIdx]
+                                : -1;
+      if (imageIdx >= 0 && size_t(imageIdx) < upload.images.size()) {
+        textures[textureIdx] = upload.images[imageIdx].texture();
+      }
+    }
+  }
+  SamplerSettings samplerSettings;
+  samplerSettings.maxAnisotropy = m_options.maxAnisotropy;
+  samplerSettings.lodBias = m_options.textureLodBias;
+  if (usesVirtualTextures()) {
+    // Pages are sampled with the filtering of the page caches
+    scene.materials.buildVirtual(model,
+        scene.virtualTextures.getTextureRefs(model, upload.textureImages));
+  } else {
+    scene.materials.build(model, textures,
+        m_options.bindlessTextures && getGLExtensions().bindlessTexture,
+        samplerSettings);
+  }
+  scene.hasMaterials = true;
+  scene.hasMaterialTextures = upload.done();
+  if (scene.hasMaterialTextures && m_options.useInstancing &&
+      m_options.impostorPixelSize > 0.f && !m_options.deferredShading) {
+    bakeImpostors(scene);
+  }
+}
+
+void ViewerApplication::bakeImpostors(Scene &scene) const
+{
+  TRACE_ZONE("Bake impostors");
+  const auto &upload = scene.upload;
+  const auto &draws = scene.instancedDraws;
+
+  // Primitives of the batches with the most instances first, drawn opaque
+  // (BLEND materials have no coverage to bake) with bounds
+  std::vector<size_t> batches;
+  for (size_t batchIdx = 0; batchIdx < draws.batchCount(); ++batchIdx) {
+    const auto primitiveIdx = draws.batchPrimitive(batchIdx);
+    const auto &primitive = upload.primitives[primitiveIdx];
+    const auto &bboxMax = upload.primitiveBoundsMax[primitiveIdx];
+    const auto material = primitive.materialID
+                              ? int(primitive.materialID) - 1
+                              : -1;
+    if (draws.batchDrawCount(batchIdx) >= ImpostorAtlas::MIN_INSTANCES &&
+        primitive.mode == GL_TRIANGLES && primitive.indexCount &&
+        bboxMax.x >= upload.primitiveBoundsMin[primitiveIdx].x &&
+        !isTransparentMaterial(scene.compact, material)) {
+      batches.push_back(batchIdx);
+    }
+  }
+  std::stable_sort(begin(batches), end(batches), [&](size_t lhs, size_t rhs) {
+    return draws.batchDrawCount(lhs) > draws.batchDrawCount(rhs);
+  });
+  std::vector<uint32_t> primitives;
+  batches.resize(
+      std::min(batches.size(), size_t(ImpostorAtlas::MAX_IMPOSTORS)));
+  for (const auto batchIdx : batches) {
+    primitives.push_back(draws.batchPrimitive(batchIdx));
+  }
+  if (primitives.empty()) {
+    return;
+  }
+
+  auto cachePath = scene.cachePath;
+  if (!cachePath.empty()) {
+    cachePath += ".impostors";
+    if (scene.impostors.readCache(cachePath, scene.cacheKey, primitives)) {
+      std::clog << "Loaded impostor cache " << cachePath << std::endl;
+      return;
+    }
+  }
+
+  const auto shadersPath = m_ShadersRootPath / m_AppName;
+  ShaderDefines defines;
+  if (m_options.quantizeVertices) {
+    defines["QUANTIZED_VERTICES"] = "";
+  }
+  if (usesVirtualTextures()) {
+    defines["VIRTUAL_TEXTURES"] = "";
+  } else if (m_options.bindlessTextures &&
+             getGLExtensions().bindlessTexture) {
+    defines["BINDLESS_TEXTURES"] = "";
+  }
+  ProgramBuilder builder;
+  builder.add({shadersPath / "impostor_bake.vs.glsl",
+                  shadersPath / "impostor_bake.fs.glsl"},
+      defines);
+  const auto program = std::move(builder.build().front());
+  bindMaterialTextureArrays(program);
+
+  const auto startTime = glfwGetTime();
+  scene.materials.bind();
+  if (!scene.virtualTextures.empty()) {
+    scene.virtualTextures.bind();
+  }
+  scene.impostors.bake(program, upload.arena, upload.primitives,
+      upload.primitiveBoundsMin, upload.primitiveBoundsMax, primitives);
+  if (!scene.virtualTextures.empty()) {
+    scene.virtualTextures.unbind();
+  }
+  scene.materials.unbind();
+  {
+    SyncScope sync{"ViewerApplication::bakeImpostors"};
+    glFinish();
+  }
+  std::clog << "Baked " << scene.impostors.size() << " impostors in "
+            << 1000. * (glfwGetTime() - startTime) << " ms" << std::endl;
+  if (!cachePath.empty()) {
+    std::string err;
+    if (scene.impostors.writeCache(cachePath, scene.cacheKey, err)) {
+      std::clog << "Wrote impostor cache " << cachePath << std::endl;
+    } else {
+      std::cerr << "Warning: " << err << std::endl;
+    }
+  }
+}
+
+void ViewerApplication::buildInstancedDraws(Scene &scene) const
+{
+  TRACE_ZONE("Build instanced draws");
+  const auto &hierarchy = scene.hierarchy;
+  const auto &upload = scene.upload;
+
+  std::vector<uint32_t> drawPrimitives, drawMatrices;
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    const auto &range = upload.meshToPrimitives[hierarchy.mesh(flatIdx)];
+    for (size_t pIdx = 0; pIdx < range.count; ++pIdx) {
+      drawPrimitives.push_back(uint32_t(range.begin + pIdx));
+      drawMatrices.push_back(flatIdx);
+    }
+  }
+  scene.instancedDraws.build(drawPrimitives, drawMatrices);
 }
 
 ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
     uint32_t height, const fs::path &gltfFile,
     const std::vector<float> &lookatArgs, const std::string &vertexShader,
-    const std::string &fragmentShader, const fs::path &output) :
+    const std::string &fragmentShader, const fs::path &output,
+    const ViewerOptions &options) :
     m_nWindowWidth(width),
     m_nWindowHeight(height),
     m_AppPath{appPath},
@@ -156,7 +7086,9 @@ ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
     m_ImGuiIniFilename{m_AppName + ".imgui.ini"},
     m_ShadersRootPath{m_AppPath.parent_path() / "shaders"},
     m_gltfFilePath{gltfFile},
-    m_OutputPath{output}
+    m_localGltfFilePath{gltfFile},
+    m_OutputPath{output},
+    m_options{options}
 {
   if (!lookatArgs.empty()) {
     m_hasUserCamera = true;
@@ -174,11 +7106,152 @@ ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
     m_fragmentShader = fragmentShader;
   }
 
-  ImGui::GetIO().IniFilename =
-      m_ImGuiIniFilename.c_str(); // At exit, ImGUI will store its windows
-                                  // positions in this file
+  // Offline renders display nothing, their handle has no GUI
+  if (m_GLFWHandle.hasGui()) {
+    ImGui::GetIO().IniFilename =
+        m_ImGuiIniFilename.c_str(); // At exit, ImGUI will store its windows
+                                    // positions in this file
+    glfwSetKeyCallback(m_GLFWHandle.window(), keyCallback);
+    printGLVersion();
+  }
+
+  // The startup load already runs: the options adjusted to the context are
+  // only read on this thread, none by the load of the scene
+  if (m_options.reversedZ && !getGLExtensions().clipControl) {
+    std::cerr << "Warning: reversed-Z requires glClipControl (OpenGL 4.5 or "
+                 "GL_ARB_clip_control), using standard depth"
+              << std::endl;
+    m_options.reversedZ = false;
+  }
+
+  if (!m_options.frameCapturePath.empty() &&
+      (!m_options.useIndirectDraws || usesVertexPulling())) {
+    std::cerr << "Warning: frame captures require indirect draws without "
+                 "vertex pulling, no frame is captured"
+              << std::endl;
+    m_options.frameCapturePath.clear();
+  }
+
+  if (m_options.variableRateShading && !getGLExtensions().shadingRateImage) {
+    std::cerr << "Warning: variable rate shading requires "
+                 "GL_NV_shading_rate_image, shading at full rate"
+              << std::endl;
+    m_options.variableRateShading = false;
+  }
+
+  if (m_options.pinnedUploads && !getGLExtensions().pinnedMemory) {
+    std::cerr << "Warning: pinned uploads require GL_AMD_pinned_memory, "
+                 "uploading through staging"
+              << std::endl;
+    m_options.pinnedUploads = false;
+  }
+
+  if (!m_OutputPath.empty()) {
+    std::clog << "Started in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - m_startTime)
+                     .count()
+              << " ms" << std::endl;
+  }
+}
+
+std::future<bool> ViewerApplication::beginStartup()
+{
+  if (!m_options.traceOutput.empty()) {
+    if (isTracingCompiled()) {
+      startTracing();
+    } else {
+      std::cerr << "Warning: built without GLMLV_ENABLE_TRACING, no trace is "
+                   "written"
+                << std::endl;
+    }
+  }
+  TRACE_THREAD_NAME("Main");
+  setJobSystemOptions({m_options.threadCount,
+      m_options.backgroundThreadCount, m_options.threadPinning});
+  setProgramCacheDirectory(m_options.programCacheDirectory);
+  // Of the remote copies and the load reports, which are not written next
+  // to the viewed file
+  auto cacheDirectory = m_options.sceneCacheDirectory;
+  if (cacheDirectory.empty()) {
+    std::error_code errorCode;
+    cacheDirectory = fs::temp_directory_path(errorCode) / "gltf-viewer";
+  }
+  // Before the startup load, which reads the local copy
+  if (isRemoteUri(m_gltfFilePath.string())) {
+    m_localGltfFilePath =
+        getRemoteCachePath(m_gltfFilePath.string(), cacheDirectory);
+    if (m_options.watchModel) {
+      std::cerr << "Warning: remote files are not watched" << std::endl;
+      m_options.watchModel = false;
+    }
+  }
+
+  if (m_options.coarseFirstUpload &&
+      (!m_options.generateLods || m_options.useInstancing)) {
+    std::cerr << "Warning: coarse-first uploads require levels of detail "
+                 "without instancing, meshes are uploaded whole"
+              << std::endl;
+    m_options.coarseFirstUpload = false;
+  }
+
+  if (m_options.profileLoad) {
+    m_loadReportPath =
+        getLoadReportPath(m_localGltfFilePath, cacheDirectory);
+    m_pLoadReport = std::make_unique<LoadReport>();
+    auto previous = std::make_unique<LoadReport>();
+    std::string err;
+    if (previous->read(m_loadReportPath, err)) {
+      m_pPreviousLoadReport = std::move(previous);
+    }
+    m_pLoadReport->start();
+  }
+  if (!m_options.loadAtStartup) {
+    return {};
+  }
+  // Scene only holds GL objects once uploaded, constructing and loading it
+  // requires no context
+  m_pStartupScene = std::make_unique<Scene>();
+  return std::async(std::launch::async, [this]() {
+    TRACE_THREAD_NAME("Loader");
+    BackgroundJobScope background;
+    return loadViewedScene(*m_pStartupScene);
+  });
+}
 
-  glfwSetKeyCallback(m_GLFWHandle.window(), keyCallback);
+void ViewerApplication::finishLoadReport(const Scene &scene)
+{
+  if (!m_pLoadReport || m_pLoadReport->isFinished()) {
+    return;
+  }
+  m_pLoadReport->addBytesUploaded(
+      LoadPhase::Upload, scene.upload.uploadedBytes);
+  m_pLoadReport->finish();
+  m_pLoadReport->print(std::clog, m_pPreviousLoadReport.get());
+  std::string err;
+  if (m_pLoadReport->write(m_loadReportPath, err)) {
+    std::clog << "Wrote load report " << m_loadReportPath << std::endl;
+  } else {
+    std::cerr << "Warning: " << err << std::endl;
+  }
+}
 
-  printGLVersion();
+ViewerApplication::~ViewerApplication()
+{
+  // Not taken by run(), destroyed while the context exists
+  if (m_startupLoading.valid()) {
+    m_startupLoading.wait();
+  }
+  m_pStartupScene.reset();
+  trimCaches();
+  if (!isTracing()) {
+    return;
+  }
+  // GPU zones are read while the GL context still exists
+  std::string err;
+  if (writeTrace(m_options.traceOutput, err)) {
+    std::clog << "Wrote trace " << m_options.traceOutput << std::endl;
+  } else {
+    std::cerr << "Error: " << err << std::endl;
+  }
 }
\ No newline at end of file
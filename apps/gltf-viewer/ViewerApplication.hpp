@@ -1,9 +1,528 @@
 #pragma once
 
 #include "utils/GLFWHandle.hpp"
+#include "utils/allocation_counter.hpp"
+#include "utils/ambient_occlusion.hpp"
+#include "utils/animation.hpp"
+#include "utils/batch_jobs.hpp"
+#include "utils/benchmark.hpp"
+#include "utils/bvh.hpp"
+#include "utils/camera_path.hpp"
 #include "utils/cameras.hpp"
+#include "utils/compact_model.hpp"
+#include "utils/content_hashes.hpp"
+#include "utils/depth_pyramid.hpp"
+#include "utils/dynamic_resolution.hpp"
+#include "utils/environment_lighting.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/frame_pacer.hpp"
+#include "utils/frame_timeline.hpp"
+#include "utils/gbuffer.hpp"
+#include "utils/geometry_arena.hpp"
+#include "utils/gl_extensions.hpp"
+#include "utils/gl_memory.hpp"
+#include "utils/gltf.hpp"
+#include "utils/gpu_bounds.hpp"
+#include "utils/gpu_cost_attribution.hpp"
+#include "utils/gpu_picker.hpp"
+#include "utils/gpu_telemetry.hpp"
+#include "utils/impostors.hpp"
+#include "utils/indirect_draws.hpp"
+#include "utils/instanced_draws.hpp"
+#include "utils/lights.hpp"
+#include "utils/load_report.hpp"
+#include "utils/mapped_file.hpp"
+#include "utils/material_buffer.hpp"
+#include "utils/material_permutations.hpp"
+#include "utils/material_variants.hpp"
+#include "utils/mesh_lods.hpp"
+#include "utils/monotonic_arena.hpp"
+#include "utils/model_cache.hpp"
+#include "utils/morphing.hpp"
+#include "utils/occlusion_queries.hpp"
+#include "utils/point_clouds.hpp"
+#include "utils/pose_simulation.hpp"
+#include "utils/post_processing.hpp"
+#include "utils/profiler.hpp"
+#include "utils/progressive_accumulation.hpp"
+#include "utils/scene_cache.hpp"
+#include "utils/render_queue.hpp"
+#include "utils/scene_hierarchy.hpp"
+#include "utils/scene_tree_panel.hpp"
+#include "utils/screenshots.hpp"
 #include "utils/shaders.hpp"
+#include "utils/shading_rate_image.hpp"
+#include "utils/shadow_atlas.hpp"
+#include "utils/shadow_maps.hpp"
+#include "utils/skinning.hpp"
+#include "utils/static_batching.hpp"
+#include "utils/tasks.hpp"
+#include "utils/texture_streamer.hpp"
+#include "utils/tileset.hpp"
+#include "utils/textures.hpp"
+#include "utils/thread_affinity.hpp"
+#include "utils/tracing.hpp"
+#include "utils/temporal_antialiasing.hpp"
+#include "utils/transform_hierarchy.hpp"
+#include "utils/transparency.hpp"
+#include "utils/uniform_buffer.hpp"
+#include "utils/vertex_animations.hpp"
+#include "utils/virtual_textures.hpp"
+
+#include <chrono>
+#include <future>
+#include <memory>
+
+// Options of the viewer that are not required by the basic rendering path
+struct ViewerOptions
+{
+  // Memory map .glb files instead of reading them in memory (see
+  // loadMappedGlbFile)
+  bool useMemoryMappedGlb = true;
+  // Copy the primitives stored in the glTF buffers as the arena stores them
+  // straight from the buffers pinned in host memory, without staging, with
+  // GL_AMD_pinned_memory (see GeometryArena::copyPinnedPrimitive)
+  bool pinnedUploads = false;
+  // Load the scene from its .gltfcache if up to date, write it otherwise
+  bool useSceneCache = false;
+  // Directory of cache files. If empty, scene caches are in "gltf-viewer" of
+  // the temporary directory and environment caches next to their map.
+  fs::path sceneCacheDirectory;
+  // Of the data of the scene caches written, read whatever their compression
+  SceneCacheCompression sceneCacheCompression = SceneCacheCompression::Lz4;
+  // Parallel connections fetching a remote .glb (see fetchRemoteGlb), kept
+  // in sceneCacheDirectory or in a temporary directory without one
+  size_t remoteConnectionCount = 4;
+  // Number of threads of the job system running scene-wide CPU passes
+  // (bounds, transforms), 0 means one per hardware thread
+  size_t threadCount = 0;
+  // Additional job system threads running the jobs of loader threads, at a
+  // lower priority, 0 runs them on the threads above
+  size_t backgroundThreadCount = 0;
+  // Placement of the job system threads, see ThreadPinning
+  ThreadPinning threadPinning = ThreadPinning::None;
+  // Number of threads decoding images after parsing, 0 means the job system
+  // threads (background ones when loading in the background) and 1 lets
+  // tinygltf decode them while parsing
+  size_t imageDecodingThreads = 0;
+  // External buffers and images of .gltf files read at the same time while
+  // parsing (see FilePrefetcher), 0 reads them one by one
+  size_t prefetchedFileCount = 16;
+  // Parse the glTF on a loader thread while the GUI keeps running
+  bool asyncLoading = true;
+  // Start parsing the glTF of run() when the application is constructed,
+  // before the window and its context are created, so that reading and
+  // parsing the file overlap them and the compilation of the shaders
+  bool loadAtStartup = false;
+  // With asyncLoading, the loader thread also uploads the whole scene in a
+  // context shared with the window one (see SharedGLContext) instead of the
+  // window uploading uploadBytesPerFrame bytes per frame
+  bool useLoaderContext = false;
+  // Load the glTF file again when it changes, keeping the camera and
+  // uploading only the meshes and images that changed (see
+  // ModelContentHashes)
+  bool watchModel = false;
+  // Once the window has uploaded the scene, release the buffers of the model
+  // that can be memory mapped from their file instead (see
+  // releaseModelBuffers)
+  bool releaseCpuBuffers = false;
+  // Only read the external buffers and images of .gltf files used by the
+  // default scene, others are memory mapped or read when first needed (see
+  // DeferredResources)
+  bool deferUnusedResources = false;
+  // Maximum number of bytes uploaded per frame while meshes stream in
+  size_t uploadBytesPerFrame = size_t(64) << 20;
+  // Time per frame resuming the loading tasks on the GL thread (see
+  // GLTaskQueue), in seconds
+  double glTaskSecondsPerFrame = 0.002;
+  // Measure the phases of the load of the viewed file, until it is
+  // uploaded, then print the report with its changes since the previous
+  // load of the file and write it in sceneCacheDirectory, or in the
+  // temporary directory of the remote copies without one (see LoadReport)
+  bool profileLoad = false;
+  // Stream the mip levels of images from the coarsest one as visible draws
+  // need them, keeping at most textureBudget bytes of textures (see
+  // TextureStreamer). Offline rendering uploads every level.
+  bool streamTextures = false;
+  size_t textureBudget = size_t(512) << 20;
+  // Prefetch the textures and tiles the camera will see within
+  // prefetchSeconds, extrapolating its recent motion or reading ahead in the
+  // camera path played (see CameraPredictor), 0 only streams what is visible
+  float prefetchSeconds = 2.f;
+  // Page the images in page caches of virtualTextureBudget bytes, loading the
+  // pages the frames sample (see VirtualTextures), instead of uploading or
+  // streaming them. Only sampled by the shaders reading materials (see
+  // ScenePrograms::readsMaterials). Window only, not used by tilesets.
+  bool virtualTextures = false;
+  size_t virtualTextureBudget = size_t(256) << 20;
+  // Generate the mipmaps of RGBA8 textures with a compute shader filtering
+  // them according to their ImageUsage instead of glGenerateMipmap
+  bool gpuMipmaps = false;
+  // Compress decoded images when loading them, normal maps in BC5 and others
+  // in BC7 with all their mipmaps (see compressModelImages). Scene caches
+  // keep them compressed.
+  bool compressTextures = false;
+  // Overrides of every material sampler: maximum anisotropy (1 disables
+  // anisotropic filtering) and bias added to the level of detail
+  float maxAnisotropy = 1.f;
+  float textureLodBias = 0.f;
+  // Wait for events instead of redrawing continuously when neither the
+  // camera, the GUI nor the scene change
+  bool renderOnDemand = false;
+  // Start with the GUI hidden (F1 toggles it): no ImGui frame is built nor
+  // drawn. A visible GUI is built for a few frames after each input and
+  // guiRefreshRate times per second otherwise, the frames in between draw
+  // the last one again. 0 builds it every frame.
+  bool hideGui = false;
+  float guiRefreshRate = 10.f;
+  // Start with the trackball camera controller, orbiting around the scene,
+  // instead of the first person one (both can be chosen in the GUI)
+  bool trackballCamera = false;
+  // Swap buffers with adaptive vsync and keep the CPU at most
+  // maxFramesInFlight frames ahead of the GPU (see FramePacer)
+  bool framePacing = false;
+  size_t maxFramesInFlight = 2;
+  // Sleep until the deadline of each frame not to exceed this frame rate,
+  // 0 for no limit
+  float maxFrameRate = 0.f;
+  // Camera path played in a loop instead of the camera controller (see
+  // CameraPath), by runBenchmark too. Frames and the animation then advance
+  // by fixedTimeStep instead of the duration of frames.
+  fs::path cameraPath;
+  // Time between frames of camera path playback and benchmarks, in seconds
+  double fixedTimeStep = 1. / 60.;
+  // File the camera path recorded from the GUI is written to
+  fs::path recordedCameraPath = "camera_path.json";
+  // File the timeline of the frames of the window is written to when it
+  // closes (see FrameTimeline::write), none if empty
+  fs::path statsOutput;
+  // File the memory report (see writeMemoryReport) is written to from the
+  // GUI
+  fs::path memoryReport = "memory.json";
+  // Sample the state of the GPU (see GpuTelemetry), plotted in the profiler
+  // panel and summarized in the results of runBenchmark
+  bool gpuTelemetry = false;
+  // runBenchmark fails if a measured frame makes more heap allocations on
+  // the render thread, unchecked if negative. Requires a build with
+  // GLMLV_COUNT_ALLOCATIONS.
+  int64_t maxFrameAllocations = -1;
+  // Files the screenshots of the window (F12 or the GUI) are written to,
+  // numbered in the last run of '#' as image sequences, from the first free
+  // number
+  fs::path screenshotPath = "screenshot_####.png";
+  // Size of the screenshots relative to the window. At 1 the back buffer is
+  // copied as presented, otherwise the scene is rendered again offscreen,
+  // without post-processing (see ScreenshotCapture).
+  float screenshotScale = 1.f;
+  // Debug context and messages of the GL debug output (see
+  // GLDebugOutputMode). Performance warnings are listed in the GUI.
+  GLDebugOutputMode glDebugOutput = GLDebugOutputMode::Full;
+  // EGL GPU device of the headless context of offline rendering (see
+  // HeadlessGLContext::getDeviceCount()), any device if negative
+  int gpuDevice = -1;
+  // Create no window even without output path, for GltfRenderer
+  bool headless = false;
+  // Chrome trace of the trace zones written when the application is
+  // destroyed (see tracing.hpp), none if empty. Requires a build with
+  // GLMLV_ENABLE_TRACING.
+  fs::path traceOutput;
+  // Write the draw stream of the main pass of the first frame drawn with
+  // indirect draws to this file (see FrameCapture), none if empty. Requires
+  // useIndirectDraws, not with vertexPulling.
+  fs::path frameCapturePath;
+  // Draw the scene with glMultiDrawElementsIndirect once all meshes are
+  // uploaded, instead of one draw call per primitive
+  bool useIndirectDraws = false;
+  // Cull indirect draws against a depth pyramid of the scene in two phases
+  // (see IndirectDrawList::CullPhase), requires useIndirectDraws
+  bool occlusionCulling = false;
+  // Split the large triangle primitives in meshlets drawn and culled as
+  // separate indirect draws, also culled when facing away from the camera
+  // (see buildModelMeshlets), or read them from the scene cache. Requires
+  // useIndirectDraws.
+  bool meshlets = false;
+  // Cull the triangles of the meshlets facing away from the camera or
+  // covering no pixel center in a compute pass after the culling of the
+  // draws (see IndirectDrawList::cullTriangles). Requires meshlets, ignored
+  // with the visibility buffer.
+  bool triangleCulling = false;
+  // Fetch the vertices of indirect draws from the streams of the
+  // GeometryArena in the vertex shader (see
+  // IndirectDrawList::setVertexPulling), so that their VAO only holds the
+  // index buffer. Ignored without GL_ARB_shader_draw_parameters. Requires
+  // useIndirectDraws.
+  bool vertexPulling = false;
+  // Draw the indirect draws in a visibility buffer of draw and triangle
+  // ids, then rebuild the G-buffer from it in one full screen pass (see
+  // GBuffer::beginVisibility), so that the materials are sampled once per
+  // pixel whatever the overdraw. Requires deferredShading and vertexPulling.
+  bool visibilityBuffer = false;
+  // Play animations with useIndirectDraws: the local transforms of the
+  // animated nodes are uploaded each frame, their world matrices propagated
+  // on the GPU (see GpuTransformHierarchy) and written in the per draw
+  // matrices and bounds (see IndirectDrawList::updateTransforms)
+  bool gpuTransforms = false;
+  // Draw the draws of each primitive (e.g. of a mesh used by many nodes)
+  // with one instanced draw call (see InstancedDrawList), ignored with
+  // useIndirectDraws
+  bool useInstancing = false;
+  // Merge the triangle primitives of the nodes that never move into world
+  // space batches by material when parsing the model (see
+  // batchStaticNodes), so that thousands of small static nodes cost a few
+  // draws. With useInstancing, meshes used by several nodes are left to
+  // instanced draws. Scene caches store the batched model.
+  bool staticBatching = false;
+  // Merge the meshes and images equal to a previous one when parsing the
+  // model (see deduplicateModel), before static batching: exporters often
+  // write copies of them, each uploaded on its own otherwise
+  bool deduplicateContent = false;
+  // Draw the instances of the primitives drawn by many instances as their
+  // impostor (see ImpostorAtlas) once the diagonal of their bounds covers
+  // fewer pixels than this, 0 to never. Impostors are baked once the
+  // materials have their textures, and cached next to the scene cache.
+  // Requires useInstancing, not drawn with deferredShading.
+  float impostorPixelSize = 0.f;
+  // Animate the instances of skinned meshes with the clips baked next to
+  // the model by gltf-optimize --vat (see VertexAnimations) instead of
+  // drawing their bind pose. Requires useInstancing.
+  bool vertexAnimations = false;
+  // Draw the POINTS and LINES primitives apart from the triangle paths (see
+  // PointClouds): points are rasterized by a compute pass from an octree
+  // refined within pointBudget points a frame, each at most maxPointSize
+  // pixels wide, and line segments are drawn as quads lineWidth pixels wide.
+  // Unlit and not picked nor shadowed, not drawn with deferredShading.
+  bool pointClouds = false;
+  size_t pointBudget = 10000000;
+  float maxPointSize = 8.f;
+  float lineWidth = 2.f;
+  // Give the triangle primitives position indices welding their vertices
+  // split by normal or texture seams, used by the depth pre-pass, the shadow
+  // maps and the pick pass, which only read positions (see
+  // GeometryArena::layoutPrimitives). Costs up to twice the index memory.
+  bool positionIndices = false;
+  // Sort the draws submitted one by one by state then depth (see
+  // RenderQueue): opaque primitives front to back, then primitives with a
+  // BLEND material back to front (only by state with oit)
+  bool sortDraws = false;
+  // Draw the primitives submitted one by one with variants of the forward
+  // program compiled for the permutation key of their material (see
+  // MaterialPermutations), when it reads materials. The keys of a scene are
+  // compiled when it is loaded. Not used with deferredShading.
+  bool materialPermutations = false;
+  // Sample the textures of the MaterialBuffer through bindless handles when
+  // GL_ARB_bindless_texture is available, through texture arrays otherwise
+  bool bindlessTextures = true;
+  // Simplify meshes into levels of detail (see buildModelLods) when loading
+  // them, or read them from the scene cache. Primitives drawn one by one use
+  // the coarsest level within lodPixelError pixels of the primitive.
+  bool generateLods = false;
+  float lodPixelError = 1.f;
+  // With generateLods, the window uploads the meshes in two passes: the
+  // vertices and the coarsest level of every primitive, drawn at that level,
+  // then its indices and finer levels (see SceneUpload::isMeshRefined), so
+  // that the whole scene shows early. Not with useInstancing, whose draws
+  // have no levels.
+  bool coarseFirstUpload = false;
+  // Reorder the indices and vertices of triangle primitives for the vertex
+  // cache, overdraw and vertex fetches (see optimizeModelIndices) when loading
+  // them, or read them from the scene cache
+  bool optimizeIndices = false;
+  // Store vertices in 16 bytes instead of 32 (see
+  // GeometryArena::VertexFormat::Quantized): 16-bit positions relative to the
+  // bounds of their mesh, octahedral normals and half float texcoords
+  bool quantizeVertices = false;
+  // Interleave the normals and texture coordinates of the arena in one
+  // buffer, positions staying alone for the depth-only passes (see
+  // GeometryArena::VertexLayout::Interleaved). Not with vertexPulling, the
+  // skinning pre-pass nor morph targets, which read the streams as storage
+  // buffers.
+  bool interleaveVertices = false;
+  // Render with reversed-Z: 32F depth buffer cleared to 0, GL_GREATER depth
+  // test, [0, 1] clip space depth and an infinite far plane (see
+  // getReversedZPerspective). Requires GLExtensions::clipControl.
+  bool reversedZ = false;
+  // Animation played once the model is loaded, -1 for none (the GUI can
+  // start one). Offline images show its first frame. Not played with
+  // useIndirectDraws, whose transforms are uploaded once, unless
+  // gpuTransforms is set.
+  int animation = -1;
+  // Skin vertices once per frame with a compute pre-pass writing them in the
+  // arena (see SceneSkins::skinVertices), instead of in the vertex shader of
+  // each draw. Skins are drawn in their bind pose with useIndirectDraws,
+  // useInstancing or quantizeVertices.
+  bool skinningPrepass = false;
+  // Bound the draws of skinned and morphed meshes, and of primitives without
+  // POSITION bounds, from their vertices in the arena with a compute pass
+  // (see GpuBounds) instead of never culling them. Indirect draws are culled
+  // with the bounds of the frame, draws culled on the CPU with those read
+  // back a frame or two later.
+  bool gpuBounds = false;
+  // Cull the draws culled on the CPU to the potentially visible set of the
+  // cell of the camera when the scene cache has one (see gltf-optimize
+  // --pvs), before frustum culling
+  bool potentiallyVisibleSets = true;
+  // Evaluate animations on a dedicated thread one frame ahead of rendering
+  // (see PoseSimulation), instead of on the render thread. Only in the
+  // viewer, offline images and batches are posed on the render thread.
+  bool asyncAnimation = true;
+  // Fill the depth buffer with the opaque draws before shading them, so that
+  // each of their pixels is shaded once. Only when drawing primitives one by
+  // one (neither useIndirectDraws nor useInstancing), the GUI can toggle it.
+  bool depthPrepass = false;
+  // Skip the groups of draws of the window hidden in the previous frame,
+  // tested by occlusion queries (see OcclusionQueries). Only when drawing
+  // primitives one by one, as depthPrepass.
+  bool occlusionQueries = false;
+  // Attribute the GPU time of the main pass of the window to buckets of
+  // draws, timing one bucket per frame (see GpuCostAttribution), shown in
+  // the GUI and with the heat_map.fs.glsl fragment shader. Only when drawing
+  // primitives one by one, as depthPrepass.
+  CostBuckets costAttribution = CostBuckets::None;
+  // Darken the ambient lighting of the opaque draws with screen-space
+  // ambient occlusion of the depth pre-pass (see AmbientOcclusion), computed
+  // at 1 / ambientOcclusionDivisor of the resolution, within
+  // ambientOcclusionRadius world units. Only drawn with the depth pre-pass,
+  // not with deferredShading.
+  bool ambientOcclusion = false;
+  size_t ambientOcclusionDivisor = 2;
+  float ambientOcclusionRadius = 0.5f;
+  // Draw the surfaces of the scene in a G-buffer, then light each pixel once
+  // in a tiled compute pass (see GBuffer). The fragment shaders are replaced
+  // by gbuffer.fs.glsl.
+  bool deferredShading = false;
+  // Shadow the first directional light of the scene with cascaded shadow
+  // maps, drawn again only when the camera or the scene around them changes
+  // (see CascadedShadowMaps). Only when drawing primitives one by one, the
+  // GUI can toggle it.
+  bool shadows = false;
+  // Shadow the spot and point lights of the scene with the tiles of a shadow
+  // atlas sized by their screen coverage and cached between frames (see
+  // ShadowAtlas), drawing at most localShadowBudget stale views (a spot
+  // light has one, a point light 6) per frame. Same conditions as shadows,
+  // the GUI can toggle it.
+  bool localShadows = false;
+  size_t localShadowBudget = 8;
+  // Equirectangular HDR environment map (.hdr) lighting the scene with
+  // image-based lighting (see EnvironmentLighting), scaled by
+  // environmentIntensity. Its precomputed maps are cached in
+  // sceneCacheDirectory (next to the map if empty).
+  fs::path environmentMap;
+  float environmentIntensity = 1.f;
+  // Blend the draws of BLEND materials in any order with order-independent
+  // transparency, after the opaque draws (see TransparencyBuffer). Not with
+  // deferredShading, or with fragment shaders other than materials.fs.glsl.
+  OitMode oit = OitMode::None;
+  // Anti-alias the window with TAA instead of 4x MSAA: jittered projections
+  // blended with the history of the previous frames, reprojected by motion
+  // vectors (see TemporalAntiAliasing). Not with deferredShading, or with
+  // fragment shaders not writing motion vectors (see motion_vectors.glsl).
+  bool temporalAntiAliasing = false;
+  // GPU time of the scene in the window, in milliseconds, that dynamic
+  // resolution scaling aims for (see DynamicResolution), 0 to draw it at the
+  // window resolution. The window then has no MSAA. Not with
+  // temporalAntiAliasing.
+  float targetFrameTime = 0.f;
+  // Number of jittered frames the window averages while nothing changes
+  // (see ProgressiveAccumulation), 0 to draw every frame alone. The window
+  // then has no MSAA. Not with temporalAntiAliasing or targetFrameTime.
+  size_t accumulationFrameCount = 0;
+  // Draw the window in a multisampled HDR target post-processed by compute
+  // passes (see PostProcessing): auto-exposure, bloom, tone mapping and
+  // grading, with postProcessingSettings. The window then has no MSAA. Not
+  // with temporalAntiAliasing, targetFrameTime or accumulationFrameCount,
+  // ignored by offline images.
+  bool postProcessing = false;
+  PostProcessing::Settings postProcessingSettings;
+  // Shade the main pass of the window per 2x2 or 4x4 pixels where the
+  // previous frame varies little (see ShadingRateImage), with
+  // shadingRateSettings. Requires GL_NV_shading_rate_image, only applies
+  // while the scene is drawn at the window size, ignored by offline images.
+  bool variableRateShading = false;
+  ShadingRateImage::Settings shadingRateSettings;
+  // Split the window in this many viewports side by side (at most 32), each
+  // showing the view of the camera panned by the horizontal field of view of
+  // a viewport: the views form a panorama around the camera, e.g. for the
+  // screens of a video wall. The views share the uploaded scene and a single
+  // culling pass (see cullViews). Not with temporalAntiAliasing,
+  // targetFrameTime or accumulationFrameCount, ignored by offline images.
+  size_t viewCount = 1;
+  // Draw the left and right eyes of a stereo rig at the camera side by side
+  // (see StereoRig), in the window and in offline images, instead of the
+  // views of viewCount. Same restrictions as viewCount.
+  bool stereo = false;
+  // Distance between the eyes of the stereo rig, in scene units (meters for
+  // glTF)
+  float interpupillaryDistance = 0.064f;
+  // Distance of the zero parallax plane of the stereo rig, 0 for the
+  // distance of the camera center
+  float convergence = 0.f;
+  // Compute scene bounds from every vertex instead of accessors min/max
+  bool exactSceneBounds = false;
+  // Offline images larger than this (or than GL limits) are rendered in
+  // tiles streamed to the PNG encoder
+  size_t tileSize = 4096;
+  // Samples per pixel of offline images, resolved on the GPU before the
+  // readback (see ImageRenderer), 0 for none. Ignored with deferredShading.
+  size_t outputSamples = 0;
+  // Filter offline images with FXAA after the resolve, except tiled ones
+  bool outputFxaa = false;
+  // Render this many offline frames instead of a single image, frame i
+  // showing the camera path (or the camera) and the animation at time i *
+  // fixedTimeStep. The output path is "-" for raw RGB frames on the
+  // standard output, top row first (ffmpeg -f rawvideo -pix_fmt rgb24), or a
+  // PNG path whose last run of '#' is replaced by the zero padded frame
+  // index (frame_####.png), "_####" being appended to its stem if it has
+  // none.
+  size_t outputFrameCount = 0;
+  // Write the raw frames of sequences as I420 (ffmpeg -f rawvideo -pix_fmt
+  // yuv420p), converted on the GPU, instead of RGB: half the bytes are read
+  // back and piped, and the encoder has no conversion left
+  bool outputYuv = false;
+  // Without camera path, the camera of sequences turns around its target in
+  // this many seconds, 0 for a fixed camera
+  double turntablePeriod = 0.;
+  // Render the offline image as an atlas of this many thumbnails (at most
+  // 32), the views of the camera turned around its target by equal angles
+  // in row-major tiles from the top left, each of the output size. The
+  // views are culled in one traversal (see cullViews) and drawn in the
+  // tiles of a single target read back at once. Replaces outputFrameCount.
+  size_t thumbnailCount = 0;
+  // Budgets of the models kept loaded by runBatch and runServer (see
+  // ModelCache): number of models, and bytes of GPU and host memory, 0
+  // meaning no limit
+  size_t modelCacheSize = 4;
+  size_t modelCacheGpuBudget = 0;
+  size_t modelCacheHostBudget = 0;
+  // Outputs of runBatch with a reference image match it if at most
+  // referenceMaxDifferingPixels of their pixels differ by more than
+  // referenceTolerance levels (see compareImages). The results of the jobs
+  // are written to batchReport if not empty (see writeBatchResults).
+  size_t referenceTolerance = 8;
+  float referenceMaxDifferingPixels = 0.001f;
+  fs::path batchReport;
+  // TCP port runServer listens on, serving one connection at a time with the
+  // same models kept loaded (see RenderWorkerPool::connect), instead of its
+  // streams if not 0
+  uint16_t serverPort = 0;
+  // Tilesets (see runTileset): tiles are refined until their geometric error
+  // projects to at most tilesetPixelError pixels, tilesetLoadCount contents
+  // load at once and the loaded ones are evicted beyond the budgets of GPU
+  // and host memory, in bytes, 0 meaning no limit
+  float tilesetPixelError = 16.f;
+  size_t tilesetLoadCount = 4;
+  size_t tilesetGpuBudget = size_t(1) << 30;
+  size_t tilesetHostBudget = 0;
+  // Compile the programs again when a file of the shader directory changes
+  bool watchShaders = false;
+  // Directory of linked program binaries (see compileProgram), no cache if
+  // empty
+  fs::path programCacheDirectory;
+  // Size in bytes beyond which the least recently used entries of the scene
+  // and program cache directories are removed at exit, 0 means unbounded
+  uintmax_t cacheSizeLimit = 0;
+  // Defines of the variant of every scene shader (see loadShaderSource)
+  ShaderDefines shaderDefines;
+};
 
 class ViewerApplication
 {
@@ -11,18 +530,807 @@ public:
   ViewerApplication(const fs::path &appPath, uint32_t width, uint32_t height,
       const fs::path &gltfFile, const std::vector<float> &lookatArgs,
       const std::string &vertexShader, const std::string &fragmentShader,
-      const fs::path &output);
+      const fs::path &output, const ViewerOptions &options = {});
+
+  ~ViewerApplication();
 
   int run();
 
+  // Render each job in an image, reusing the GL context, programs and models
+  // between jobs. The constructor arguments give the default shaders.
+  int runBatch(const std::vector<BatchJob> &jobs);
+
+  // Render the requests read from requests until its end (see
+  // render_server.hpp), writing a response line per request in responses.
+  // Images have the window size by default. The models requested last stay
+  // loaded (see ViewerOptions::modelCacheSize). With
+  // ViewerOptions::serverPort, requests and responses go through the
+  // connections accepted on that port instead. Images are read back one
+  // request late as in runBatch while more requests are waiting.
+  int runServer(std::istream &requests, std::ostream &responses);
+
+  // View the tileset of the file given to the constructor (see Tileset),
+  // whose contents are loaded by loader threads as the camera needs them and
+  // evicted beyond the memory budgets of m_options. Each content is drawn as
+  // a scene, without animations, GUI options or picking. With an output
+  // path, contents are loaded until the camera needs no more before
+  // rendering the image.
+  int runTileset();
+
+  // Load each model then draw frameCount frames of it offscreen at the
+  // window size, along one turn around the default camera target or along
+  // m_options.cameraPath, and write the measures in the output path (see
+  // writeBenchmarkResults)
+  int runBenchmark(const std::vector<fs::path> &models, size_t frameCount);
+
+  // In-process rendering of single images for GltfRenderer, with the
+  // pipeline of runServer kept between calls: the models loaded last stay
+  // loaded (see ViewerOptions::modelCacheSize). Load the model of path as
+  // the rendered one and set the time it took in milliseconds, 0 if it was
+  // cached. Return false and set err on failure.
+  bool loadRenderedModel(
+      const fs::path &path, double &loadTime, std::string &err);
+
+  // Render the model of loadRenderedModel in width x height pixels of
+  // numComponents (3 or 4) components, bottom row first, with lookat (see
+  // BatchJob::lookat) or the default camera if empty. Set the GPU time in
+  // milliseconds and the number of draws. Return false and set err if no
+  // model is loaded or the image needs tiles (see getOutputTileSize).
+  bool renderModelImage(const std::vector<float> &lookat, size_t width,
+      size_t height, size_t numComponents, unsigned char *pixels,
+      double &gpuTime, size_t &drawCount, std::string &err);
+
+  // Of the models of loadRenderedModel
+  ModelCacheStats getRenderedModelStats() const;
+
 private:
-  // A range of indices in a vector containing Vertex Array Objects
-  struct VaoRange
+  // Programs, models and renderer of loadRenderedModel
+  struct RenderingState;
+
+  // A range of primitives in SceneUpload::primitives
+  struct PrimitiveRange
+  {
+    size_t begin; // Index of first element in primitives
+    size_t count; // Number of elements in range
+  };
+
+  // Level of detail of a primitive in the index buffer of a GeometryArena,
+  // drawn with the base vertex of its primitive
+  struct ArenaLod
+  {
+    GLuint firstIndex;
+    GLuint indexCount;
+    float error; // See MeshLod
+  };
+
+  // Geometry of a model in a GeometryArena, allocated for the whole model and
+  // then filled a few meshes at a time by uploadMeshes() so that the render
+  // loop keeps running. The images of the textures follow the meshes.
+  struct SceneUpload
+  {
+    GeometryArena arena;
+    std::vector<ArenaPrimitive> primitives; // In mesh order
+    std::vector<PrimitiveRange> meshToPrimitives;
+    std::vector<bool> isMeshReady; // True when the mesh can be drawn
+    // False while a ready mesh only has the vertices and the coarsest level
+    // of its primitives with levels, which must then be drawn at that level.
+    // Meshes are refined by a second pass of uploadMeshes, from
+    // nextRefinedMeshIdx, after every mesh is ready (see
+    // ViewerOptions::coarseFirstUpload).
+    std::vector<bool> isMeshRefined;
+    // Levels of detail of each primitive, from the finest to the coarsest
+    std::vector<ArenaLod> lods;
+    std::vector<PrimitiveRange> primitiveToLods;
+    // Local bounds of each primitive, from its POSITION accessor min/max
+    // (min > max if unknown)
+    std::vector<glm::vec3> primitiveBoundsMin;
+    std::vector<glm::vec3> primitiveBoundsMax;
+    // Image of each glTF texture: its KHR_texture_basisu source if it can be
+    // uploaded as is, else its source (-1 if none)
+    std::vector<int> textureImages;
+    std::vector<ImageTexture> images; // One per model image, 0 if unused
+    std::vector<ImageUsage> imageUsages; // One per model image
+    std::vector<size_t> imagesToUpload; // Referenced by textureImages
+    size_t nextMeshIdx = 0;
+    size_t nextRefinedMeshIdx = 0;
+    size_t nextImageIdx = 0; // In imagesToUpload
+    size_t uploadedBytes = 0;
+    size_t totalBytes = 0; // Size of the arena geometry and images
+    // Persistently mapped memory that workers decode meshes and copy images
+    // into, copied to the arena and textures by the GPU (see uploadMeshes)
+    RingBuffer staging;
+    // Buffers of the model pinned with m_options.pinnedUploads, that the
+    // GPU copies primitives stored as is from instead of staging (see
+    // GeometryArena::copyPinnedPrimitive), released once the meshes are
+    // uploaded
+    std::vector<PinnedMemory> pins;
+    // Upload of the previous version of a reloaded model, which must outlive
+    // this one until done(). Mesh i is copied from mesh reusedMeshes[i] of its
+    // arena if not -1 (see reuseSceneResources).
+    const SceneUpload *previous = nullptr;
+    std::vector<int> reusedMeshes;
+
+    bool done() const
+    {
+      return nextMeshIdx >= meshToPrimitives.size() &&
+             nextRefinedMeshIdx >= meshToPrimitives.size() &&
+             nextImageIdx >= imagesToUpload.size();
+    }
+  };
+
+  // A model loaded from a glTF file with its GPU resources
+  struct Scene
+  {
+    tinygltf::Model model;
+    MappedFile mapping; // Must outlive buffers
+    // Of the buffers released once uploaded (see releaseModelBuffers)
+    std::vector<MappedFile> bufferMappings;
+    // Resources not used by the default scene if
+    // m_options.deferUnusedResources is set, must outlive buffers
+    DeferredResources deferred;
+    std::vector<BufferSpan> buffers;
+    // Requested by m_options (see buildDerivedGeometry), released once
+    // uploaded
+    DerivedGeometry derived;
+    // ACMR of the primitives of derived.optimizedIndices before and after
+    // optimization, averaged over their triangles
+    float acmrBefore = 0.f;
+    float acmrAfter = 0.f;
+    SceneHierarchy hierarchy; // Flattened scene model.defaultScene
+    // Meshes and materials of model read every frame
+    CompactModel compact;
+    // Of the materials of compact, built with it
+    MaterialPermutations materialPermutations;
+    // Built with compact, whose materials the selected variant sets
+    MaterialVariants variants;
+    // Computed after loading if m_options.watchModel is set, before uploads
+    // release the images
+    ModelContentHashes contentHashes;
+    // Merged by loadGltfFile if m_options.deduplicateContent is set
+    DeduplicatedContent deduplicated;
+    // Scene cache of the file and its key (see computeSceneCacheKey) if
+    // m_options.useSceneCache is set, cachePath is empty otherwise
+    fs::path cachePath;
+    uint64_t cacheKey = 0;
+    bool isReadFromCache = false; // Buffers are not those of the glTF file
+    // Time of loadGltfFile reading the file (with the scene cache, or image
+    // decoding without parallel decoders) and decoding images, in
+    // milliseconds
+    double parseTime = 0.;
+    double decodeTime = 0.;
+    glm::vec3 bboxMin = glm::vec3(0);
+    glm::vec3 bboxMax = glm::vec3(0);
+    SceneUpload upload;
+    // World bounds of each primitive of each node of hierarchy.meshNodes(),
+    // in that order (see updateDrawBounds)
+    std::vector<glm::vec3> drawBoundsMin;
+    std::vector<glm::vec3> drawBoundsMax;
+    // Over drawBoundsMin/Max, built once then refitted by updateDrawBounds
+    BoundingVolumeHierarchy bvh;
+    double bvhBuildTime = 0.; // In milliseconds
+    double switchTime = 0.; // Of the last switchScene, in milliseconds
+    IndirectDrawList indirectDraws;
+    // Built with indirectDraws if m_options.gpuTransforms is set and the
+    // model has animations
+    GpuTransformHierarchy gpuTransforms;
+    bool hasIndirectDraws = false; // True once indirectDraws is built
+    // Flags of the draws (in drawBoundsMin/Max order) of the subtree isolated
+    // by the scene tree, empty to draw them all. Not used by indirect draws.
+    std::vector<uint8_t> isolatedDraws;
+    // Built by beginSceneUpload if m_options.useInstancing is set
+    InstancedDrawList instancedDraws;
+    // Baked by buildMaterials if m_options.impostorPixelSize is set
+    ImpostorAtlas impostors;
+    // Read by beginSceneUpload if m_options.vertexAnimations is set and the
+    // model has skins
+    VertexAnimations vertexAnimations;
+    // Built by loadGltfFile if m_options.pointClouds is set, uploaded by
+    // beginSceneUpload
+    PointClouds pointClouds;
+    // Textures of the images of upload.textureImages when they are streamed,
+    // instead of upload.images
+    TextureStreamer textureStreamer;
+    // Pages of the images of upload.textureImages with virtual textures,
+    // instead of upload.images
+    VirtualTextures virtualTextures;
+    // Built if the scene shaders read materials (see
+    // ScenePrograms::readsMaterials), without textures until every image is
+    // uploaded. Streamed textures are not referenced.
+    MaterialBuffer materials;
+    bool hasMaterials = false;
+    bool hasMaterialTextures = false;
+    SceneAnimations animations;
+    int animation = -1; // Played animation, -1 if none
+    // Time of the pose set by the last updateScenePose, negative to set it
+    // again
+    double animationTime = -1.;
+    // Built by beginSceneUpload if the model has skins and they can be drawn
+    SceneSkins skins;
+    // True once the skinning pre-pass has written skinned vertices in the
+    // arena
+    bool hasSkinnedVertices = false;
+    // Draw of a range of gpuBounds
+    struct GpuBoundedDraw
+    {
+      size_t drawIdx; // In drawBoundsMin/Max
+      uint32_t flatIdx; // Node of the draw
+      uint32_t primitiveIdx; // In upload.primitives
+    };
+    // Built by buildGpuBounds if m_options.gpuBounds is set, with the
+    // indices of indirectDraws by buildIndirectDraws
+    GpuBounds gpuBounds;
+    std::vector<GpuBoundedDraw> gpuBoundedDraws;
+    bool hasGpuBounds = false;
+    // Boxes of gpuBoundedDraws read back last, empty before the first
+    // readback, replacing their infinite bounds in updateDrawBounds
+    std::vector<glm::vec3> gpuDrawBoundsMin;
+    std::vector<glm::vec3> gpuDrawBoundsMax;
+    // Built by beginSceneUpload if the model has morph targets and the
+    // vertices are floats
+    SceneMorphs morphs;
+    // Punctual lights of the nodes of hierarchy
+    SceneLights lights;
+    // Draw the depth pre-pass (see ViewerOptions::depthPrepass)
+    bool depthPrepass = false;
+    // Shadow the first directional light (see ViewerOptions::shadows)
+    bool shadows = false;
+    // Shadow the local lights (see ViewerOptions::localShadows)
+    bool localShadows = false;
+    // Incremented by updateSceneVertices when the pose changes, so that
+    // caches of the skinned and morphed draws, whose bounds do not follow
+    // them, can tell when they change
+    size_t poseVersion = 0;
+    // World matrices of hierarchy before the last updateScenePose, for the
+    // motion vectors of ScenePrograms::writesMotionVectors
+    std::vector<glm::mat4> previousWorldMatrices;
+  };
+
+  // Programs drawing scenes and their uniform locations
+  struct ScenePrograms
+  {
+    GLProgram forward;
+    // The per draw matrices are read from drawUniforms if the vertex shader
+    // declares the DrawUniforms block of forward.vs.glsl with the
+    // CameraUniforms block of camera.glsl, and set as plain uniforms
+    // otherwise
+    bool hasDrawUniformBlock = false;
+    GLUniform<glm::mat4> modelViewProjMatrix;
+    GLUniform<glm::mat4> modelViewMatrix;
+    GLUniform<glm::mat4> normalMatrix;
+    // Set for each draw with a GpuCostAttribution if the fragment shader
+    // declares it (see heat_map.fs.glsl)
+    GLUniform<float> heat;
+    // True if the fragment shader is a debug view adding up the fragments of
+    // each pixel (see DEBUG_VIEWS in ViewerApplication.cpp)
+    bool isAdditive = false;
+    // True if the fragment shader reads the Materials buffer of
+    // materials.glsl
+    bool readsMaterials = false;
+    // True if the fragment shader reads the lights of lights.glsl, which
+    // assignLights assigns to lightClusters before each renderScene call
+    bool readsLights = false;
+    GLProgram assignLights;
+    mutable LightClusters lightClusters;
+    // Replace assignLights if m_options.deferredShading is set, the
+    // fragment shaders then write gbuffer
+    GLProgram deferredLighting;
+    mutable GBuffer gbuffer;
+    // Drawn with the depth programs (see hasDepthPrepass) when the scene
+    // has a directional light, read with the lights
+    mutable CascadedShadowMaps shadowMaps;
+    // Same for the local lights
+    mutable ShadowAtlas shadowAtlas;
+    mutable UniformBuffer shadowDrawUniforms;
+    mutable UniformBuffer shadowCameraUniforms;
+    // Uniforms of m_environment, read with the lights
+    mutable UniformBuffer environmentUniforms;
+    // If m_options.oit is set and the fragment shader declares the
+    // TransparencyUniforms block of transparency.glsl, transparent draws are
+    // drawn in transparency then composited by resolveTransparency
+    bool hasTransparentPass = false;
+    mutable TransparencyBuffer transparency;
+    GLProgram resolveTransparency;
+    // If m_options.temporalAntiAliasing is set and the fragment shader
+    // writes the motion vectors of motion_vectors.glsl, from the matrices of
+    // the previous renderScene call. Frames are then resolved by
+    // resolveTemporalAA (see TemporalAntiAliasing).
+    bool writesMotionVectors = false;
+    mutable glm::mat4 previousViewProjMatrix{1};
+    mutable bool hasPreviousFrame = false;
+    GLProgram resolveTemporalAA;
+    // If m_options.accumulationFrameCount is set, averages the frames of
+    // the window (see ProgressiveAccumulation)
+    GLProgram accumulate;
+    // If m_options.postProcessing is set, the steps of PostProcessing
+    PostProcessing::Programs postProcessing;
+    // If m_options.variableRateShading is set, computes the rates of the
+    // window from its last frame and draws them (see ShadingRateImage)
+    GLProgram updateShadingRate;
+    GLProgram showShadingRate;
+    mutable ShadingRateImage shadingRate;
+    // Shaders and defines of forward, empty with m_options.deferredShading
+    std::vector<fs::path> forwardShaders;
+    ShaderDefines forwardDefines;
+    // True if forward is materials.fs.glsl, the only fragment shader whose
+    // masked permutations are also compiled with MATERIAL_ALPHA_TO_COVERAGE
+    bool writesCoverage = false;
+    // forward with the defines of each permutation key compiled so far, in
+    // permutationKeys, by compileMaterialPermutations if
+    // m_options.materialPermutations is set. Used by renderScene when
+    // forward declares the DrawUniforms block.
+    mutable std::vector<GLProgram> permutations;
+    mutable std::vector<uint32_t> permutationKeys;
+    // forward with SKINNED, drawing skinned nodes when the skinning pre-pass
+    // is off. Only used if its vertex shader reads the JointMatrices buffer
+    // of skinning.glsl and declares the DrawUniforms block.
+    GLProgram skinned;
+    bool hasSkinnedProgram = false;
+    // Only compiled if m_options.skinningPrepass is set and skins can be
+    // drawn (see canDrawSkins)
+    GLProgram skinVertices;
+    bool hasSkinningPrepass = false;
+    // Only compiled if morph targets can be blended (see canBlendMorphs)
+    GLProgram blendMorphs;
+    bool hasMorphPrepass = false;
+    // Only compiled if primitives are drawn one by one, depth.vs.glsl
+    // without and with SKINNED (if skins can be drawn without the skinning
+    // pre-pass). Only used if their vertex shaders declare the DrawUniforms
+    // block.
+    GLProgram depth;
+    GLProgram depthSkinned;
+    bool hasDepthPrepass = false;
+    // Same with ALPHA_MASK, alpha testing the masked draws that are not
+    // skinned so that they join the occluders of the pre-pass
+    GLProgram depthMasked;
+    bool hasMaskedDepthPrepass = false;
+    // Only compiled for the window if primitives are drawn one by one,
+    // depth.vs.glsl with pick.fs.glsl, without and with SKINNED as depth.
+    // Used by renderPickPass if their vertex shaders declare the
+    // DrawUniforms block.
+    GLProgram pick;
+    GLProgram pickSkinned;
+    GLUniform<GLuint> pickDrawId;
+    GLUniform<GLuint> pickSkinnedDrawId;
+    bool hasPickPass = false;
+    mutable UniformBuffer pickDrawUniforms;
+    mutable UniformBuffer pickCameraUniforms;
+    // Only compiled if m_options.useIndirectDraws is set
+    GLProgram indirect;
+    GLProgram cullDraws; // See IndirectDrawList::cull
+    // Only compiled if usesTriangleCulling()
+    GLProgram cullTriangles; // See IndirectDrawList::cullTriangles
+    // Only compiled if usesVisibilityBuffer(), programs.indirect then draws
+    // the visibility buffer
+    GLProgram resolveVisibility; // See GBuffer::resolveVisibility
+    // Only compiled if m_options.gpuTransforms is set, see
+    // GpuTransformHierarchy::update and IndirectDrawList::updateTransforms
+    GLProgram propagateTransforms;
+    GLProgram updateDrawTransforms;
+    // Only compiled if m_options.gpuBounds is set, see GpuBounds::reduce
+    GLProgram reduceBounds;
+    // Only compiled if m_options.useInstancing is set, forward.vs.glsl with
+    // INSTANCED
+    GLProgram instanced;
+    // Only compiled if m_options.impostorPixelSize is set with
+    // m_options.useInstancing, impostor.vs.glsl with impostor.fs.glsl
+    GLProgram impostors;
+    bool hasImpostors = false;
+    // Instances drawn as impostors by the last renderScene call
+    mutable size_t impostorInstanceCount = 0;
+    // Only compiled if m_options.pointClouds is set, without
+    // m_options.deferredShading
+    PointClouds::Programs pointClouds;
+    bool hasPointClouds = false;
+    // Only compiled if m_options.occlusionQueries is set and primitives are
+    // drawn one by one, occlusion_box.vs.glsl with depth.fs.glsl
+    GLProgram occlusionBoxes;
+    // Only compiled if m_options.occlusionCulling or
+    // m_options.ambientOcclusion is set
+    GLProgram copyDepth;
+    GLProgram reduceDepth;
+    mutable DepthPyramid depthPyramid;
+    // Only compiled if m_options.ambientOcclusion is set and the depth
+    // pre-pass can be drawn, ambient_occlusion.cs.glsl
+    GLProgram computeAmbientOcclusion;
+    bool hasAmbientOcclusion = false;
+    mutable AmbientOcclusion ambientOcclusion;
+    // Refilled by each renderScene call
+    mutable RingBuffer frameData; // A region per renderScene call
+    mutable UniformBuffer drawUniforms;
+    // Shared by the programs of the view, see camera.glsl
+    mutable UniformBuffer cameraUniforms;
+    mutable RenderQueue renderQueue;
+    // Transient data of renderScene, kept from one call to the next so that
+    // drawing a frame does not allocate once they have grown: the arena is
+    // reset by each call, the vectors keep their capacity
+    mutable MonotonicArena frameArena;
+    mutable std::vector<uint8_t> isDrawVisible;
+    mutable std::vector<uint8_t> isTransparentDrawVisible;
+    mutable std::vector<uint8_t> isImpostorVisible;
+    mutable std::vector<SceneSkins::PaletteRange> paletteRanges;
+    mutable std::vector<RenderQueue> bucketQueues; // Filled in parallel
+    // Program, pass, material and transform changes of the last renderScene
+    // call drawing primitives one by one
+    mutable size_t stateChangeCount = 0;
+    // Triangles drawn by the same call, and those saved by levels of detail
+    mutable size_t triangleCount = 0;
+    mutable size_t lodSavedTriangleCount = 0;
+  };
+
+  // Skins are drawn in their bind pose by the paths whose transforms ignore
+  // them, and with quantized positions
+  bool canDrawSkins() const
+  {
+    return !m_options.useIndirectDraws && !m_options.useInstancing &&
+           !m_options.quantizeVertices;
+  }
+
+  // Pages are loaded from the feedback of the frames drawn in the window
+  bool usesVirtualTextures() const
+  {
+    return m_options.virtualTextures && m_OutputPath.empty();
+  }
+
+  bool usesVertexPulling() const
+  {
+    return m_options.useIndirectDraws && m_options.vertexPulling &&
+           getGLExtensions().shaderDrawParameters;
+  }
+
+  bool usesVisibilityBuffer() const
   {
-    GLsizei begin; // Index of first element in vertexArrayObjects
-    GLsizei count; // Number of elements in range
+    return m_options.deferredShading && m_options.visibilityBuffer &&
+           usesVertexPulling();
+  }
+
+  bool usesTriangleCulling() const
+  {
+    return m_options.useIndirectDraws && m_options.meshlets &&
+           m_options.triangleCulling && !usesVisibilityBuffer();
+  }
+
+  // Morph targets are blended into float vertices only, quantized ones are
+  // drawn without them
+  bool canBlendMorphs() const { return !m_options.quantizeVertices; }
+
+  // Paths drawing the primitives of scenes, chosen by
+  // m_options.useIndirectDraws and m_options.useInstancing. They share the
+  // uploaded scene, the GUI switches between them (see setRenderPath).
+  enum class RenderPath
+  {
+    PerDraw,
+    Instanced,
+    Indirect
   };
 
+  RenderPath getRenderPath() const
+  {
+    return m_options.useIndirectDraws ? RenderPath::Indirect
+           : m_options.useInstancing  ? RenderPath::Instanced
+                                      : RenderPath::PerDraw;
+  }
+
+  // Set the options of path. The scene programs must be compiled again, and
+  // the draw lists of path built for the loaded scene: the instanced ones
+  // by buildInstancedDraws, the indirect ones once scene.hasIndirectDraws
+  // is reset.
+  void setRenderPath(RenderPath path)
+  {
+    m_options.useIndirectDraws = path == RenderPath::Indirect;
+    m_options.useInstancing = path == RenderPath::Instanced;
+  }
+
+  // The depth pre-pass only applies to primitives drawn one by one
+  bool canDrawDepthPrepass() const
+  {
+    return !m_options.useIndirectDraws && !m_options.useInstancing;
+  }
+
+  // Programs of each (vertex shader, fragment shader) pair
+  std::vector<ScenePrograms> compileScenePrograms(
+      const std::vector<std::pair<std::string, std::string>> &shaders) const;
+
+  // Compile the programs of the permutation keys of the materials of scene
+  // that programs lack, at once (see ProgramBuilder). Does nothing unless
+  // m_options.materialPermutations is set and programs read materials.
+  void compileMaterialPermutations(
+      const Scene &scene, const ScenePrograms &programs) const;
+
+  // Load a glTF file in scene, a new one, up to the scene hierarchy and
+  // bounds. The GPU resources are not created, nor destroyed: it does not
+  // require a GL context so it can run on a loader thread.
+  bool loadGltfFile(const fs::path &path, Scene &scene);
+
+  // loadGltfFile of m_gltfFilePath, plus the content hashes compared by the
+  // reloads of m_options.watchModel
+  bool loadViewedScene(Scene &scene);
+
+  // Set up the tracing and the job system, then, with
+  // m_options.loadAtStartup, start loading m_gltfFilePath in
+  // m_pStartupScene on a loader thread. Called before m_GLFWHandle is
+  // initialized: only the members declared before it are.
+  std::future<bool> beginStartup();
+
+  // Finish m_pLoadReport once the viewed scene is uploaded, print it and
+  // write it to m_loadReportPath. Nothing if it is null or finished.
+  void finishLoadReport(const Scene &scene);
+
+  // Compress the decoded images of model if ViewerOptions::compressTextures
+  // is set (see compressModelImages), return their number
+  size_t compressImages(tinygltf::Model &model) const;
+
+  // Compute the derived geometry requested by m_options that scene.derived
+  // lacks and drop the one that is not requested. Return true if some was
+  // computed.
+  bool buildDerivedGeometry(Scene &scene) const;
+
+  // Read image imageIdx of scene if its loading was deferred (see
+  // loadDeferredImage), errors are printed
+  static void resolveDeferredImage(Scene &scene, size_t imageIdx);
+
+  // Compute the arena layout of the model and allocate its storage. Images
+  // are handed to scene.textureStreamer instead of being uploaded if
+  // streamTextures is true, or to scene.virtualTextures if
+  // usesVirtualTextures(). Deferred images are uploaded last. With
+  // coarseFirst, uploadMeshes refines the meshes in a second pass (see
+  // ViewerOptions::coarseFirstUpload).
+  void beginSceneUpload(
+      Scene &scene, bool streamTextures = false, bool coarseFirst = false);
+
+  // After beginSceneUpload of scene, a new version of the model of previous,
+  // take the textures of previous whose images are unchanged and set the
+  // unchanged meshes to be copied from its arena (see
+  // SceneUpload::previous). Skinned and morphed meshes, whose vertices the
+  // pre-passes overwrite, are uploaded again.
+  void reuseSceneResources(Scene &scene, Scene &previous) const;
+
+  // Decode and upload the geometry of the next meshes, then the next images,
+  // until byteBudget bytes have been uploaded. Return true when all meshes
+  // and images are ready.
+  //
+  // Data goes through upload.staging in chunks: job system workers decode
+  // the primitives of a chunk into the mapping (or copy its images), then
+  // the GPU copies them to the arena (or unpacks them to textures). Neither
+  // this thread nor the driver wait for the copies, which are fenced by the
+  // ring. Skins and morph targets are still uploaded by this thread.
+  bool uploadMeshes(Scene &scene, size_t byteBudget);
+
+  // Fill scene.indirectDraws with a draw per primitive of each mesh node and
+  // upload them
+  void buildIndirectDraws(Scene &scene);
+
+  // Fill scene.materials, with the textures of the images uploaded so far.
+  // Once they are all uploaded, bake scene.impostors if
+  // m_options.impostorPixelSize is set.
+  void buildMaterials(Scene &scene) const;
+
+  // Read scene.impostors from the cache next to the scene cache, or bake
+  // them with the materials of the scene and cache them
+  void bakeImpostors(Scene &scene) const;
+
+  // Group the draws of scene.drawBoundsMin/Max by primitive in
+  // scene.instancedDraws
+  void buildInstancedDraws(Scene &scene) const;
+
+  // Request the levels of the images sampled by the visible draws of scene
+  // from the pixels covered by their bounds, then update the streamed
+  // textures within m_options.uploadBytesPerFrame. If viewMasks is not null,
+  // the visible draws are those of any view (see cullViews), seen from the
+  // eye of camera. The draws visible from predictedCameras are requested
+  // too, with the pixels they will cover.
+  void streamTextures(Scene &scene, const Camera &camera,
+      const glm::mat4 &projMatrix, const std::vector<uint32_t> *viewMasks,
+      const std::vector<Camera> &predictedCameras) const;
+
+  // Transform the local bounds of the primitives of the scene with the world
+  // matrices of their nodes, must be called when the hierarchy changes
+  void updateDrawBounds(Scene &scene) const;
+
+  // Fill scene.gpuBounds with the draws whose bounds are reduced on the GPU:
+  // those of skinned (by the pre-pass) and morphed nodes, and those of
+  // primitives without bounds. indirectDraws gives the index in
+  // scene.indirectDraws of each draw (in scene.drawBoundsMin/Max order),
+  // GpuBounds::NO_DRAW for those without DrawBounds of their own.
+  void buildGpuBounds(Scene &scene,
+      const std::vector<GLuint> *indirectDraws = nullptr) const;
+
+  // Reduce the bounds of scene.gpuBoundedDraws in their current pose, read
+  // them back if draws are culled on the CPU or for the first reduction
+  void reduceDrawBounds(Scene &scene, const ScenePrograms &programs) const;
+
+  // Draw scene sceneIdx of the model instead: its meshes are already in the
+  // arena, only the hierarchy and what is indexed by its nodes and draws are
+  // rebuilt. Return false if sceneIdx is not a scene, or if the model is
+  // skinned or morphed, whose pre-passes write the vertices of the arena.
+  bool switchScene(Scene &scene, int sceneIdx) const;
+
+  // Set the local transforms and morph target weights of scene.animation at
+  // time seconds, then update the world matrices, draw bounds and joint
+  // matrices of the scene. Once every mesh is uploaded, blend the morph
+  // targets whose weights changed then skin the vertices with the pre-passes
+  // of programs if enabled. Return true if the scene moved or was morphed.
+  bool updateScenePose(
+      Scene &scene, const ScenePrograms &programs, double time) const;
+
+  // Same as above with the last pose published by simulation, if it
+  // published one since the last call
+  bool updateScenePose(Scene &scene, const ScenePrograms &programs,
+      PoseSimulation &simulation) const;
+
+  // Second half of updateScenePose, once the world matrices, joint matrices
+  // and morph target weights of scene are set: update the draw bounds if
+  // hasMoved or new bounds were read back from the GPU, run the pre-passes
+  // then reduce the bounds of the posed draws with m_options.gpuBounds.
+  // Return true if the scene moved or was morphed.
+  bool updateSceneVertices(
+      Scene &scene, const ScenePrograms &programs, bool hasMoved) const;
+
+  // Return the index (in scene.drawBoundsMin/Max order) of the primitive
+  // whose triangles are hit first by the world space ray origin + t *
+  // direction, -1 if none. distance is set to the t of the hit.
+  int pickPrimitive(const Scene &scene, const glm::vec3 &origin,
+      const glm::vec3 &direction, float &distance) const;
+
+  // Draw the meshes of scene that are ready in the current framebuffer
+  // (viewport and clear are left to the caller). Primitives outside of the
+  // view frustum are skipped (see Scene::bvh). Return the number of
+  // primitives drawn, which is every draw with indirect draws since they are
+  // culled on the GPU. If profiler is not null, it counts the pipeline
+  // statistics of the "Shadows", "Depth pre-pass" and "Main pass" passes,
+  // and measures their GPU times with the depth pre-pass.
+  // If viewMasks is not null, the draws are culled by cullViews instead and
+  // drawn if bit viewIdx of their mask is set (ignored by indirect draws).
+  // If occlusionQueries is not null, primitives drawn one by one are also
+  // culled by it (it must be used by a single view). costAttribution, if not
+  // null, times a bucket of the primitives drawn one by one (likewise).
+  size_t renderScene(const Scene &scene, const ScenePrograms &programs,
+      const Camera &camera, const glm::mat4 &projMatrix,
+      Profiler *profiler = nullptr,
+      const std::vector<uint32_t> *viewMasks = nullptr, size_t viewIdx = 0,
+      OcclusionQueries *occlusionQueries = nullptr,
+      GpuCostAttribution *costAttribution = nullptr) const;
+
+  // Number of viewports of the window or of the offline image:
+  // m_options.thumbnailCount for offline images, else 2 with
+  // m_options.stereo, else m_options.viewCount for the window
+  size_t getViewCount() const;
+
+  // Masks of the draws of scene (in scene.drawBoundsMin/Max order) whose bit
+  // i is set if the draw intersects the frustum of viewProjMatrices[i], for
+  // at most 32 views. All views are culled in one traversal of Scene::bvh.
+  std::vector<uint32_t> cullViews(const Scene &scene,
+      const std::vector<glm::mat4> &viewProjMatrices) const;
+
+  // Draw the identifiers of the draws of scene seen through the pixel of
+  // pixelMatrix (see GpuPicker::getPixelMatrix) in picker, with the pick
+  // programs. Return false if programs has none, pickPrimitive is then the
+  // way to pick.
+  bool renderPickPass(const Scene &scene, const ScenePrograms &programs,
+      const Camera &camera, const glm::mat4 &projMatrix,
+      const glm::mat4 &pixelMatrix, GpuPicker &picker) const;
+
+  // Fit the shadow maps of programs to the view frustum of viewMatrix and
+  // projMatrix between view depths zNear and zFar, then draw the cascades
+  // that are stale with the opaque primitives of scene
+  void renderShadowMaps(const Scene &scene, const ScenePrograms &programs,
+      const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix, float zNear,
+      float zFar) const;
+
+  // Fit the shadow atlas of programs to the view of viewMatrix and
+  // projMatrix, then draw the views of the stale local lights scheduled
+  // within m_options.localShadowBudget
+  void renderLocalShadows(const Scene &scene, const ScenePrograms &programs,
+      const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix) const;
+
+  // Draws casting shadows, shared by the views of a shadow pass
+  struct ShadowCasters
+  {
+    // 1 while the mesh of the draw only has its coarsest level, 2 once it is
+    // refined, so that cached shadows are drawn again (see
+    // SceneUpload::isMeshRefined)
+    std::vector<uint8_t> isDrawReady;
+    std::vector<uint8_t> isDrawCaster; // Ready and opaque
+    bool useSkinnedProgram = false;
+    // Uploaded with programs.shadowDrawUniforms by the first
+    // drawShadowCasters call
+    bool isUploaded = false;
+    std::vector<SceneSkins::PaletteRange> paletteRanges;
+  };
+
+  void findShadowCasters(const Scene &scene, const ScenePrograms &programs,
+      ShadowCasters &casters) const;
+
+  // Draw the casters of scene seen by lightViewProjMatrix, with the depth
+  // programs, in the bound depth framebuffer. Levels of detail are selected
+  // as in renderScene, with texelsPerUnit texels of the shadow map per world
+  // unit at distance 1 from lodEye, or at any distance if lodEye is null
+  // (orthographic projections).
+  void drawShadowCasters(const Scene &scene, const ScenePrograms &programs,
+      ShadowCasters &casters, const glm::mat4 &lightViewProjMatrix,
+      const glm::vec3 *lodEye, float texelsPerUnit) const;
+
+  // Bounds of the scene following node transforms (see Scene::bvh), return
+  // false if the scene is empty
+  bool getSceneBounds(
+      const Scene &scene, glm::vec3 &bboxMin, glm::vec3 &bboxMax) const;
+
+  // Perspective projection of camera, its near and far planes enclose the
+  // scene bounds
+  glm::mat4 getProjMatrix(
+      const Scene &scene, const Camera &camera, float aspectRatio) const;
+
+  // Same for the bounds [bboxMin, bboxMax], default planes if bboxMin >
+  // bboxMax
+  glm::mat4 getProjMatrix(const glm::vec3 &bboxMin, const glm::vec3 &bboxMax,
+      const Camera &camera, float aspectRatio) const;
+
+  // Camera looking at the whole scene along -Z, used if none is given
+  Camera getDefaultCamera(const Scene &scene, float aspectRatio) const;
+
+  // Enable the depth test for m_options.reversedZ or standard depths
+  void setupDepthTest() const;
+
+  // Read the image-based lighting of m_options.environmentMap from its
+  // cache, or compute and cache it. m_environment stays empty on failure.
+  void loadEnvironment();
+
+  // Remove the least recently used entries of the cache directories beyond
+  // m_options.cacheSizeLimit
+  void trimCaches() const;
+
+  // Tile size of offline images of this size, 0 if they fit in a single
+  // framebuffer
+  size_t getOutputTileSize(size_t width, size_t height) const;
+
+  // Samples per pixel of offline images, see ViewerOptions::outputSamples
+  size_t getOutputSamples() const;
+
+  // Start sampling the GPU if ViewerOptions::gpuTelemetry is set, return
+  // nullptr otherwise or if it has no telemetry
+  std::unique_ptr<GpuTelemetry> createGpuTelemetry() const;
+
+  // Compile m_fxaaProgram if ViewerOptions::outputFxaa is set, return it or
+  // nullptr for ImageRenderer
+  const GLProgram *loadFxaaProgram();
+
+  // Compile m_yuvProgram once if ViewerOptions::outputYuv is set, return it
+  // or nullptr for ImageRenderer
+  const GLProgram *loadYuvProgram();
+
+  // Compile m_mipmapProgram once if ViewerOptions::gpuMipmaps is set, return
+  // it or nullptr for ImageTexture::create
+  const GLProgram *loadMipmapProgram();
+
+  // Load the model of path with every GPU resource of programs, posed at
+  // time 0, for offline images. Return nullptr if it can't be loaded, else
+  // set the GPU memory it allocated and an estimate of its host memory.
+  std::unique_ptr<Scene> loadOfflineScene(const fs::path &path,
+      const std::vector<ScenePrograms> &programs, size_t &gpuBytes,
+      size_t &hostBytes);
+
+  // Estimate of the host memory of scene once uploaded
+  static size_t getSceneHostBytes(const Scene &scene);
+
+  // Models of runBatch and runServer
+  ModelCache<Scene> createModelCache() const;
+
+  // Camera of an offline image: lookat (see BatchJob::lookat) or the default
+  // camera of scene
+  Camera getOfflineCamera(const Scene &scene, const std::vector<float> &lookat,
+      float aspectRatio) const;
+
+  // Render the m_options.outputFrameCount frames of a sequence at the
+  // window size in the output path, frame i being drawn by drawFrame(i *
+  // m_options.fixedTimeStep) in the bound framebuffer. Frames are read back
+  // through several pixel buffers and written by other threads, so that the
+  // GPU sets the pace.
+  int writeImageSequence(const std::function<void(double)> &drawFrame);
+
+  // Render scene in a width x height PNG file in tiles (see renderTiledImage)
+  bool writeTiledImage(const Scene &scene, const ScenePrograms &programs,
+      const Camera &camera, const glm::mat4 &projMatrix, size_t width,
+      size_t height, size_t tileSize, const fs::path &output) const;
+
   GLsizei m_nWindowWidth = 1280;
   GLsizei m_nWindowHeight = 720;
 
@@ -31,6 +1339,8 @@ private:
   const fs::path m_ShadersRootPath;
 
   fs::path m_gltfFilePath;
+  // m_gltfFilePath, or its local copy if it is a remote URI
+  fs::path m_localGltfFilePath;
   std::string m_vertexShader = "forward.vs.glsl";
   std::string m_fragmentShader = "normals.fs.glsl";
 
@@ -39,12 +1349,43 @@ private:
 
   fs::path m_OutputPath;
 
+  ViewerOptions m_options;
+
+  // Set once m_options.frameCapturePath is written, by renderScene
+  mutable bool m_isFrameCaptured = false;
+
+  // Before the creation of the context, to measure the startup
+  const std::chrono::steady_clock::time_point m_startTime =
+      std::chrono::steady_clock::now();
+
+  // With m_options.profileLoad, the load of the viewed file, and the one read
+  // from m_loadReportPath if any. Set by beginStartup.
+  std::unique_ptr<LoadReport> m_pLoadReport;
+  std::unique_ptr<LoadReport> m_pPreviousLoadReport;
+  fs::path m_loadReportPath;
+
+  // Loaded by m_startupLoading for run(), which takes both. Its GL resources
+  // are created by run(), on the context of m_GLFWHandle.
+  std::unique_ptr<Scene> m_pStartupScene;
+  std::future<bool> m_startupLoading = beginStartup();
+
+  // Loading tasks continuing on the GL thread, drained by the loops of
+  // run() and runTileset() within m_options.glTaskSecondsPerFrame
+  GLTaskQueue m_glTasks;
+
   // Order is important here, see comment below
   const std::string m_ImGuiIniFilename;
-  // Last to be initialized, first to be destroyed:
+  // Initialized after the members above, destroyed before them:
   GLFWHandle m_GLFWHandle{int(m_nWindowWidth), int(m_nWindowHeight),
       "glTF Viewer",
-      m_OutputPath.empty()}; // show the window only if m_OutputPath is empty
+      // show the window only if m_OutputPath is empty, headless EGL context
+      // otherwise if available
+      m_OutputPath.empty() && !m_options.headless,
+      m_options.temporalAntiAliasing || m_options.targetFrameTime > 0.f ||
+              m_options.accumulationFrameCount || m_options.postProcessing
+          ? 0
+          : 4,
+      m_options.glDebugOutput, m_options.gpuDevice};
   /*
     ! THE ORDER OF DECLARATION OF MEMBER VARIABLES IS IMPORTANT !
     - m_ImGuiIniFilename.c_str() will be used by ImGUI in ImGui::Shutdown, which
@@ -56,4 +1397,11 @@ private:
     the creation of a GLFW windows and thus a GL context which must exists
     before most of OpenGL function calls.
   */
+
+  // Shared by every scene, read by the lights of scene programs
+  EnvironmentLighting m_environment;
+  GLProgram m_fxaaProgram; // See loadFxaaProgram
+  GLProgram m_yuvProgram; // See loadYuvProgram
+  GLProgram m_mipmapProgram; // See loadMipmapProgram
+  std::unique_ptr<RenderingState> m_pRendering; // See loadRenderedModel
 };
\ No newline at end of file
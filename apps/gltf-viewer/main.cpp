@@ -1,12 +1,38 @@
 #include "ViewerApplication.hpp"
 #include "utils/GLFWHandle.hpp"
+#include "utils/allocation_counter.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/frame_capture.hpp"
+#include "utils/indirect_draws.hpp"
+#include "utils/job_system.hpp"
+#include "utils/log.hpp"
+#include "utils/microbenchmark.hpp"
+#include "utils/render_workers.hpp"
+#include "utils/scene_report.hpp"
+#include "utils/sync_watchdog.hpp"
 
 #include <args.hxx>
 
+#include <algorithm>
+#include <fstream>
+
 std::vector<std::string> split(
     const std::string &str, const std::string &delim);
 
+ShaderDefines parseShaderDefines(const std::vector<std::string> &args);
+
+OitMode parseOitMode(const std::string &arg);
+
+CostBuckets parseCostBuckets(const std::string &arg);
+
+GLDebugOutputMode parseGLDebugOutputMode(const std::string &arg);
+
+LogLevel parseLogLevel(const std::string &arg);
+
+ThreadPinning parseThreadPinning(const std::string &arg);
+
+SceneCacheCompression parseSceneCacheCompression(const std::string &arg);
+
 int main(int argc, char **argv)
 {
   auto returnCode = 0;
@@ -21,10 +47,69 @@ int main(int argc, char **argv)
         GLFWHandle handle{1, 1, "", false};
         printGLVersion();
       }};
+  args::Command report{commands, "report",
+      "Report the counts, memory and performance issues of a glTF file as "
+      "JSON",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> file{
+            parser, "file", "Path to the glTF file", args::Options::Required};
+        args::ValueFlag<std::string> output{parser, "output",
+            "Write the report in this file instead of the standard output",
+            {"o", "output"}};
+        args::ValueFlag<uint32_t> maxImageSize{parser, "max-image-size",
+            "Images larger than this in either dimension are huge (default: "
+            "4096)",
+            {"max-image-size"}};
+        args::ValueFlag<size_t> maxDepth{parser, "max-depth",
+            "Node trees deeper than this are deep (default: 32)",
+            {"max-depth"}};
+        args::ValueFlag<size_t> maxDraws{parser, "max-draws",
+            "Default scenes with more draws than this have too many "
+            "(default: 4096)",
+            {"max-draws"}};
+        args::Flag strict{parser, "strict",
+            "Exit with code 2 if the model has issues", {"strict"}};
+        parser.Parse();
+
+        SceneReportLimits limits;
+        if (maxImageSize) {
+          limits.maxImageSize = args::get(maxImageSize);
+        }
+        if (maxDepth) {
+          limits.maxHierarchyDepth = args::get(maxDepth);
+        }
+        if (maxDraws) {
+          limits.maxDrawCount = args::get(maxDraws);
+        }
+        SceneReport sceneReport;
+        std::string err;
+        if (!buildSceneReport(args::get(file), limits, sceneReport, err)) {
+          std::cerr << "Error: " << err << std::endl;
+          returnCode = 1;
+          return;
+        }
+        if (output) {
+          std::ofstream out{args::get(output)};
+          writeSceneReport(out, sceneReport);
+          if (!out) {
+            std::cerr << "Error: unable to write " << args::get(output)
+                      << std::endl;
+            returnCode = 1;
+            return;
+          }
+        } else {
+          writeSceneReport(std::cout, sceneReport);
+        }
+        if (strict && !sceneReport.issues.empty()) {
+          returnCode = 2;
+        }
+      }};
   args::Command interactive{
       commands, "viewer", "Run glTF viewer", [&](args::Subparser &parser) {
-        args::Positional<std::string> file{
-            parser, "file", "Path to file", args::Options::Required};
+        args::Positional<std::string> file{parser, "file",
+            "Path to file, a glTF file or a tileset (json), or http://, "
+            "https:// or s3:// URI of a .glb fetched with range requests",
+            args::Options::Required};
         args::ValueFlag<std::string> lookat{parser, "lookat",
             "Look at parameters for the Camera with format "
             "eye_x,eye_y,eye_z,center_x,center_y,center_z,up_x,up_y,up_z",
@@ -33,6 +118,10 @@ int main(int argc, char **argv)
             parser, "vs", "Vertex shader to use", {"vs"}};
         args::ValueFlag<std::string> fragmentShader{
             parser, "fs", "Fragment shader to use", {"fs"}};
+        args::Flag deferred{parser, "deferred",
+            "Shade with a G-buffer and a tiled lighting pass instead of the "
+            "fragment shader",
+            {"deferred"}};
         args::ValueFlag<int32_t> imageWidth{parser, "width",
             "Width of window or output image if -b is specified",
             {"w", "width"}};
@@ -41,9 +130,460 @@ int main(int argc, char **argv)
             {"h", "height"}};
         args::ValueFlag<std::string> output{parser, "output",
             "Output path to render the image. If specified no window is shown. "
-            "Only png is supported.",
+            "png, or exr for half float HDR images.",
             {"o", "output"}};
+        args::Flag noMmap{parser, "no-mmap",
+            "Read .glb files in memory with tinygltf instead of memory "
+            "mapping them",
+            {"no-mmap"}};
+        args::Flag pinnedUploads{parser, "pinned-uploads",
+            "Copy the vertices and indices stored as is in glTF buffers "
+            "straight from host memory with GL_AMD_pinned_memory",
+            {"pinned-uploads"}};
+        args::Flag syncLoad{parser, "sync-load",
+            "Load and upload the whole scene before the first frame",
+            {"sync-load"}};
+        args::Flag loaderContext{parser, "loader-context",
+            "Upload the scene from the loader thread with a GL context shared "
+            "with the window one",
+            {"loader-context"}};
+        args::Flag watchModel{parser, "watch",
+            "Load the glTF file again when it changes, uploading only the "
+            "meshes and images that changed",
+            {"watch"}};
+        args::Flag profileLoad{parser, "profile-load",
+            "Report the time, CPU use and bytes of each phase of the load of "
+            "the glTF file, compared with its previous load, kept in "
+            "--cache-dir or in the temporary directory (not for tilesets)",
+            {"profile-load"}};
+        args::Flag releaseBuffers{parser, "release-buffers",
+            "Release the CPU copies of the glTF buffers once the scene is "
+            "uploaded, reading them again from their files when needed",
+            {"release-buffers"}};
+        args::Flag lazyResources{parser, "lazy-resources",
+            "Only read the external buffers and images used by the default "
+            "scene, others are read when first needed",
+            {"lazy-resources"}};
+        args::Flag onDemand{parser, "on-demand",
+            "Only redraw when the camera, the GUI or the scene change",
+            {"on-demand"}};
+        args::Flag hideGui{parser, "hide-gui",
+            "Start with the GUI hidden, F1 shows it", {"hide-gui"}};
+        args::ValueFlag<float> guiRefreshRate{parser, "gui-refresh-rate",
+            "Rate at which the GUI is rebuilt without input, in Hz, 0 for "
+            "every frame (default: 10)",
+            {"gui-refresh-rate"}};
+        args::Flag trackball{parser, "trackball",
+            "Orbit around the scene with the trackball camera controller",
+            {"trackball"}};
+        args::Flag framePacing{parser, "frame-pacing",
+            "Swap buffers with adaptive vsync and keep the CPU at most "
+            "--max-frames-in-flight frames ahead of the GPU",
+            {"frame-pacing"}};
+        args::ValueFlag<size_t> maxFramesInFlight{parser,
+            "max-frames-in-flight",
+            "Frames queued ahead of the GPU with --frame-pacing (default: 2)",
+            {"max-frames-in-flight"}};
+        args::ValueFlag<float> maxFps{parser, "max-fps",
+            "Sleep between frames not to exceed this frame rate",
+            {"max-fps"}};
+        args::ValueFlag<std::string> cameraPath{parser, "camera-path",
+            "Play this camera path (json) in a loop instead of the camera "
+            "controller, at a fixed time step",
+            {"camera-path"}};
+        args::ValueFlag<double> timeStep{parser, "time-step",
+            "Time step of camera path playback, in seconds (default: 1/60)",
+            {"time-step"}};
+        args::ValueFlag<std::string> recordPath{parser, "record-path",
+            "File the camera path recorded from the GUI is written to "
+            "(default: camera_path.json)",
+            {"record-path"}};
+        args::ValueFlag<std::string> statsOut{parser, "stats-out",
+            "Write the frame times of the window to this file when it "
+            "closes: csv if its extension is .csv, Chrome trace json "
+            "otherwise",
+            {"stats-out"}};
+        args::ValueFlag<std::string> memoryReport{parser, "memory-report",
+            "File the memory report (json) is written to from the GUI "
+            "(default: memory.json)",
+            {"memory-report"}};
+        args::ValueFlag<std::string> screenshotPath{parser, "screenshot-path",
+            "Files the screenshots taken with F12 or the GUI are written to, "
+            "numbered in the last run of # (default: screenshot_####.png)",
+            {"screenshot-path"}};
+        args::ValueFlag<float> screenshotScale{parser, "scale",
+            "Size of the screenshots relative to the window: other than 1, "
+            "the scene is rendered again at that size, without "
+            "post-processing (default: 1)",
+            {"screenshot-scale"}};
+        args::ValueFlag<int32_t> threads{parser, "threads",
+            "Number of threads of scene-wide CPU passes (default: one per "
+            "hardware thread)",
+            {"threads"}};
+        args::ValueFlag<int32_t> backgroundThreads{parser,
+            "background-threads",
+            "Number of additional lower priority threads running the CPU "
+            "passes of scene loading (default: 0, loading uses --threads)",
+            {"background-threads"}};
+        args::ValueFlag<std::string> pinThreads{parser, "pin-threads",
+            "Pin the threads of CPU passes: none (default), cores (one CPU "
+            "each) or numa (one NUMA node each)",
+            {"pin-threads"}};
+        args::ValueFlag<int32_t> imageThreads{parser, "image-threads",
+            "Number of threads decoding images (default: --threads, 1 "
+            "decodes while parsing)",
+            {"image-threads"}};
+        args::Flag sceneCache{parser, "cache",
+            "Load the scene from a .gltfcache file if up to date, create it "
+            "otherwise",
+            {"cache"}};
+        args::ValueFlag<std::string> sceneCacheDir{parser, "cache-dir",
+            "Directory of .gltfcache files (default: gltf-viewer in the "
+            "temporary directory)",
+            {"cache-dir"}};
+        args::ValueFlag<std::string> cacheCompression{parser, "compression",
+            "Compression of the .gltfcache files written: none, lz4 "
+            "(default) or lz4hc, smaller and slower to write",
+            {"cache-compression"}};
+        args::ValueFlag<int32_t> remoteConnections{parser, "connections",
+            "Parallel connections fetching a remote file (default: 4), "
+            "copied in --cache-dir or in a temporary directory",
+            {"remote-connections"}};
+        args::Flag indirectDraws{parser, "indirect",
+            "Draw the scene with multi-draw indirect instead of one draw call "
+            "per primitive",
+            {"indirect"}};
+        args::Flag occlusionCulling{parser, "occlusion-culling",
+            "Also cull indirect draws hidden behind the depth of the scene "
+            "(implies --indirect)",
+            {"occlusion-culling"}};
+        args::Flag meshlets{parser, "meshlets",
+            "Split large meshes in meshlets culled separately, also when "
+            "facing away from the camera (implies --indirect)",
+            {"meshlets"}};
+        args::Flag cullTriangles{parser, "cull-triangles",
+            "Also cull the triangles of meshlets facing away from the camera "
+            "or covering no pixel center in a compute pass (implies "
+            "--meshlets)",
+            {"cull-triangles"}};
+        args::Flag vertexPulling{parser, "vertex-pulling",
+            "Fetch the vertices of indirect draws from storage buffers in the "
+            "vertex shader, with GL_ARB_shader_draw_parameters (implies "
+            "--indirect)",
+            {"vertex-pulling"}};
+        args::Flag visibilityBuffer{parser, "visibility-buffer",
+            "Draw the triangle ids of indirect draws in a visibility buffer, "
+            "then shade each pixel once from its triangle (implies "
+            "--deferred and --vertex-pulling)",
+            {"visibility-buffer"}};
+        args::Flag gpuTransforms{parser, "gpu-transforms",
+            "Play animations with indirect draws, propagating the node "
+            "transforms on the GPU (implies --indirect)",
+            {"gpu-transforms"}};
+        args::Flag instancing{parser, "instancing",
+            "Draw the primitives of meshes used several times with one "
+            "instanced draw call (ignored with --indirect)",
+            {"instancing"}};
+        args::Flag vertexAnimations{parser, "vertex-animations",
+            "Animate the instances of skinned meshes with the vertex "
+            "animations baked by gltf-optimize --vat (implies --instancing)",
+            {"vertex-animations"}};
+        args::Flag staticBatching{parser, "static-batching",
+            "Merge the primitives of the nodes that never move by material "
+            "when loading the model",
+            {"static-batching"}};
+        args::Flag deduplicate{parser, "deduplicate",
+            "Merge the meshes and images of the model equal to another one "
+            "when loading it",
+            {"deduplicate"}};
+        args::ValueFlag<float> impostors{parser, "pixels",
+            "Draw the instances of primitives used many times as baked "
+            "impostors once they cover fewer pixels than this (requires "
+            "--instancing)",
+            {"impostors"}};
+        args::Flag pointClouds{parser, "point-clouds",
+            "Draw the points and lines of the model with an octree of points "
+            "rasterized by a compute pass and thick lines",
+            {"point-clouds"}};
+        args::Flag positionIndices{parser, "position-indices",
+            "Draw the depth-only passes with indices welding the vertices "
+            "split by normal or texture seams",
+            {"position-indices"}};
+        args::ValueFlag<size_t> pointBudget{parser, "count",
+            "Points drawn per frame with --point-clouds (default 10000000)",
+            {"point-budget"}};
+        args::ValueFlag<float> lineWidth{parser, "pixels",
+            "Width of the lines drawn with --point-clouds (default 2)",
+            {"line-width"}};
+        args::Flag sortDraws{parser, "sort-draws",
+            "Sort draws by state, then front to back (back to front for "
+            "transparent materials)",
+            {"sort-draws"}};
+        args::Flag materialPermutations{parser, "material-permutations",
+            "Draw primitives with shader variants compiled for the features "
+            "of their material when the model is loaded",
+            {"material-permutations"}};
+        args::Flag lods{parser, "lods",
+            "Generate levels of detail of meshes and draw the coarsest one "
+            "within --lod-error pixels (drawing one primitive at a time)",
+            {"lods"}};
+        args::ValueFlag<float> lodError{parser, "lod-error",
+            "Maximum screen space error of levels of detail, in pixels "
+            "(default: 1)",
+            {"lod-error"}};
+        args::Flag coarseFirst{parser, "coarse-first",
+            "With --lods, upload the coarsest level of every mesh first and "
+            "refine them once the whole scene shows",
+            {"coarse-first"}};
+        args::Flag optimizeIndices{parser, "optimize-indices",
+            "Reorder triangles and vertices of meshes for the vertex cache, "
+            "overdraw and vertex fetches when loading them",
+            {"optimize-indices"}};
+        args::Flag quantize{parser, "quantize",
+            "Store vertices with 16-bit positions, octahedral normals and "
+            "half float texture coordinates",
+            {"quantize"}};
+        args::Flag interleave{parser, "interleave",
+            "Interleave the normals and texture coordinates of the vertices "
+            "in one buffer",
+            {"interleave-vertices"}};
+        args::ValueFlag<int32_t> animation{parser, "animation",
+            "Index of the glTF animation to play (the first frame for "
+            "output images)",
+            {"animation"}};
+        args::Flag skinningPrepass{parser, "skinning-prepass",
+            "Skin vertices once per frame with a compute shader instead of "
+            "in the vertex shader of each draw",
+            {"skinning-prepass"}};
+        args::Flag gpuBounds{parser, "gpu-bounds",
+            "Bound skinned and morphed draws, and primitives without "
+            "bounds, from their vertices with a compute shader so that they "
+            "are culled",
+            {"gpu-bounds"}};
+        args::Flag noPvs{parser, "no-pvs",
+            "Ignore the potentially visible sets of the scene cache",
+            {"no-pvs"}};
+        args::Flag syncAnimation{parser, "sync-animation",
+            "Evaluate animations on the render thread instead of a "
+            "dedicated one",
+            {"sync-animation"}};
+        args::Flag depthPrepass{parser, "depth-prepass",
+            "Draw the depth of opaque primitives before shading them",
+            {"depth-prepass"}};
+        args::ValueFlag<size_t> ssao{parser, "divisor",
+            "Darken the ambient lighting with screen-space ambient "
+            "occlusion, computed at 1 / divisor of the resolution (2 or 4, "
+            "implies --depth-prepass)",
+            {"ssao"}};
+        args::ValueFlag<float> ssaoRadius{parser, "radius",
+            "Radius of the ambient occlusion in world units",
+            {"ssao-radius"}};
+        args::Flag occlusionQueries{parser, "occlusion-queries",
+            "Skip the groups of primitives hidden in the previous frame, "
+            "tested with occlusion queries (ignored with --indirect)",
+            {"occlusion-queries"}};
+        args::ValueFlag<std::string> costAttribution{parser, "buckets",
+            "Attribute the GPU time of the window to its top-level nodes or "
+            "materials, timing one per frame: nodes or materials (ignored "
+            "with --indirect or --instancing, see heat_map.fs.glsl)",
+            {"cost-attribution"}};
+        args::Flag shadows{parser, "shadows",
+            "Shadow the first directional light with cached cascaded shadow "
+            "maps",
+            {"shadows"}};
+        args::Flag localShadows{parser, "local-shadows",
+            "Shadow the spot and point lights with a cached shadow atlas",
+            {"local-shadows"}};
+        args::ValueFlag<size_t> shadowBudget{parser, "views",
+            "Stale local light shadow views drawn per frame (default: 8)",
+            {"shadow-budget"}};
+        args::ValueFlag<std::string> environmentMap{parser, "env",
+            "Light the scene with this equirectangular .hdr environment map",
+            {"env"}};
+        args::ValueFlag<float> environmentIntensity{parser,
+            "env-intensity", "Scale of the environment lighting (default: 1)",
+            {"env-intensity"}};
+        args::ValueFlag<std::string> oit{parser, "oit",
+            "Blend transparent materials with order-independent "
+            "transparency: weighted or linked-list",
+            {"oit"}};
+        args::Flag taa{parser, "taa",
+            "Anti-alias the window with temporal anti-aliasing instead of "
+            "4x MSAA",
+            {"taa"}};
+        args::ValueFlag<float> targetFrameTime{parser, "target-frame-time",
+            "Scale the resolution of the scene so that the GPU draws it in "
+            "this many milliseconds",
+            {"target-frame-time"}};
+        args::ValueFlag<size_t> accumulate{parser, "accumulate",
+            "Average this many jittered frames in the window while nothing "
+            "changes",
+            {"accumulate"}};
+        args::Flag postProcess{parser, "post-process",
+            "Draw the window in HDR, with auto-exposure, bloom and tone "
+            "mapping",
+            {"post-process"}};
+        args::ValueFlag<float> exposure{parser, "stops",
+            "Exposure compensation of --post-process, in stops",
+            {"exposure"}};
+        args::ValueFlag<float> bloom{parser, "bloom",
+            "Bloom intensity of --post-process",
+            {"bloom"}};
+        args::Flag vrs{parser, "vrs",
+            "Shade the main pass per 2x2 or 4x4 pixels where the previous "
+            "frame varies little (GL_NV_shading_rate_image)",
+            {"vrs"}};
+        args::ValueFlag<float> vrsThreshold{parser, "variance",
+            "Luminance variance of a 16 x 16 tile below which --vrs shades "
+            "it coarsely (default: 0.001)",
+            {"vrs-threshold"}};
+        args::ValueFlag<int32_t> views{parser, "views",
+            "Split the window in this many views side by side, panned to form "
+            "a panorama (at most 32)",
+            {"views"}};
+        args::Flag stereo{parser, "stereo",
+            "Draw the left and right eyes of a stereo camera side by side",
+            {"stereo"}};
+        args::ValueFlag<float> ipd{parser, "ipd",
+            "Distance between the eyes of the stereo camera, in scene units "
+            "(default: 0.064)",
+            {"ipd"}};
+        args::ValueFlag<float> convergence{parser, "convergence",
+            "Distance of the zero parallax plane of the stereo camera "
+            "(default: distance of the camera center)",
+            {"convergence"}};
+        args::Flag reversedZ{parser, "reversed-z",
+            "Render with a reversed 32-bit float depth buffer and an infinite "
+            "far plane",
+            {"reversed-z"}};
+        args::Flag streamTextures{parser, "stream-textures",
+            "Stream the mip levels of textures as visible draws need them",
+            {"stream-textures"}};
+        args::ValueFlag<int32_t> textureBudget{parser, "texture-budget",
+            "Memory of streamed textures, in MiB (default: 512)",
+            {"texture-budget"}};
+        args::ValueFlag<float> prefetchSeconds{parser, "seconds",
+            "Prefetch the streamed textures and tiles the camera will see "
+            "within this time, predicted from its motion or the camera path "
+            "(default: 2, 0 to disable)",
+            {"prefetch-seconds"}};
+        args::Flag virtualTextures{parser, "virtual-textures",
+            "Page textures in fixed page caches, loading the pages frames "
+            "sample",
+            {"virtual-textures"}};
+        args::ValueFlag<int32_t> virtualTextureBudget{parser,
+            "virtual-texture-budget",
+            "Memory of the page caches of virtual textures, in MiB (default: "
+            "256)",
+            {"virtual-texture-budget"}};
+        args::Flag gpuMipmaps{parser, "gpu-mipmaps",
+            "Generate texture mipmaps with a compute shader averaging colors "
+            "in linear space and renormalizing normal maps",
+            {"gpu-mipmaps"}};
+        args::Flag compressTextures{parser, "compress-textures",
+            "Compress decoded textures in BC7, normal maps in BC5, when "
+            "loading them",
+            {"compress-textures"}};
+        args::ValueFlag<float> anisotropy{parser, "anisotropy",
+            "Maximum anisotropy of texture filtering (default: 1, disabled)",
+            {"anisotropy"}};
+        args::ValueFlag<float> textureLodBias{parser, "texture-lod-bias",
+            "Bias added to the level of detail of material textures",
+            {"texture-lod-bias"}};
+        args::Flag noBindless{parser, "no-bindless",
+            "Sample material textures from texture arrays even if bindless "
+            "textures are available",
+            {"no-bindless"}};
+        args::Flag exactBounds{parser, "exact-bounds",
+            "Compute scene bounds from all vertices instead of accessors "
+            "min/max",
+            {"exact-bounds"}};
+        args::ValueFlag<int32_t> tileSize{parser, "tile-size",
+            "Render output images larger than this in tiles (default: 4096)",
+            {"tile-size"}};
+        args::ValueFlag<int32_t> samples{parser, "samples",
+            "Samples per pixel of output images, resolved on the GPU",
+            {"samples"}};
+        args::Flag fxaa{parser, "fxaa",
+            "Filter output images with FXAA (except tiled ones)", {"fxaa"}};
+        args::ValueFlag<int32_t> frames{parser, "frames",
+            "Render this many frames of the camera path and the animation to "
+            "the output, frame_####.png files or raw RGB frames if it is -",
+            {"frames"}};
+        args::Flag yuv{parser, "yuv",
+            "Write the raw frames of --frames as I420 (yuv420p) converted on "
+            "the GPU instead of RGB",
+            {"yuv"}};
+        args::ValueFlag<double> turntable{parser, "seconds",
+            "Without --camera-path, turn the camera of --frames around its "
+            "target once in this many seconds",
+            {"turntable"}};
+        args::ValueFlag<int32_t> thumbnails{parser, "count",
+            "Render the output as an atlas of this many thumbnails (at most "
+            "32) of the camera turned around its target, each of the output "
+            "size",
+            {"thumbnails"}};
+        args::ValueFlag<float> tileError{parser, "tile-error",
+            "Screen space error in pixels above which tiles of a tileset are "
+            "refined (default: 16)",
+            {"tile-error"}};
+        args::ValueFlag<int32_t> tileLoads{parser, "tile-loads",
+            "Number of tiles of a tileset loaded at once (default: 4)",
+            {"tile-loads"}};
+        args::ValueFlag<int32_t> tileGpuBudget{parser, "tile-gpu-mb",
+            "MB of GPU memory of the loaded tiles of a tileset (default: "
+            "1024, 0 for no limit)",
+            {"tile-gpu-mb"}};
+        args::ValueFlag<int32_t> tileHostBudget{parser, "tile-ram-mb",
+            "MB of host memory of the loaded tiles of a tileset (default: "
+            "no limit)",
+            {"tile-ram-mb"}};
+        args::Flag watchShaders{parser, "watch-shaders",
+            "Compile the shaders again when their files change",
+            {"watch-shaders"}};
+        args::ValueFlag<std::string> programCacheDir{parser, "program-cache",
+            "Directory where linked shader programs are cached",
+            {"program-cache"}};
+        args::ValueFlag<int> cacheSizeLimit{parser, "MiB",
+            "Size beyond which the least recently used entries of the cache "
+            "directories are removed at exit (default: unbounded)",
+            {"cache-size-limit"}};
+        args::ValueFlagList<std::string> defines{parser, "NAME[=VALUE]",
+            "Define added to every shader, to compile their variants",
+            {"define"}};
+        args::ValueFlag<std::string> traceOut{parser, "trace-out",
+            "Write the trace zones to this Chrome trace (json) at exit, "
+            "requires a build with GLMLV_ENABLE_TRACING",
+            {"trace-out"}};
+        args::ValueFlag<std::string> captureFrame{parser, "capture-frame",
+            "Write the draws of the first frame drawn with indirect draws "
+            "to this file, for the replay command",
+            {"capture-frame"}};
+        args::ValueFlag<std::string> glDebug{parser, "gl-debug",
+            "GL debug output: full (debug context, default with a window), "
+            "performance (only count performance warnings), off (default "
+            "with --output) or no-error (GL_KHR_no_error context if "
+            "supported)",
+            {"gl-debug"}};
+        args::ValueFlag<std::string> logLevel{parser, "log-level",
+            "Lowest level of the messages logged: debug, info (default), "
+            "warning or error",
+            {"log-level"}};
+        args::ValueFlag<float> syncStallMs{parser, "ms",
+            "Log the waits of the CPU for the GPU longer than this, in "
+            "milliseconds (default: 10)",
+            {"sync-stall-ms"}};
+        args::Flag gpuTelemetry{parser, "gpu-telemetry",
+            "Sample the clocks, temperature, power and utilization of the GPU "
+            "(NVML or amdgpu) on a background thread",
+            {"gpu-telemetry"}};
         parser.Parse();
+        if (logLevel) {
+          setLogLevel(parseLogLevel(args::get(logLevel)));
+        }
+        if (syncStallMs) {
+          setSyncStallThreshold(std::max(args::get(syncStallMs), 0.f));
+        }
 
         std::vector<float> lookatParams;
         if (lookat) {
@@ -62,10 +602,1166 @@ int main(int argc, char **argv)
         uint32_t width = imageWidth ? args::get(imageWidth) : 1280;
         uint32_t height = imageHeight ? args::get(imageHeight) : 720;
 
+        ViewerOptions options;
+        options.useMemoryMappedGlb = !noMmap;
+        options.pinnedUploads = pinnedUploads;
+        options.asyncLoading = !syncLoad && !output;
+        options.useLoaderContext = loaderContext;
+        options.watchModel = watchModel;
+        options.profileLoad = profileLoad;
+        options.releaseCpuBuffers = releaseBuffers;
+        options.deferUnusedResources = lazyResources;
+        options.renderOnDemand = onDemand;
+        options.hideGui = hideGui;
+        if (guiRefreshRate) {
+          options.guiRefreshRate = std::max(args::get(guiRefreshRate), 0.f);
+        }
+        options.trackballCamera = trackball;
+        options.framePacing = framePacing;
+        if (maxFramesInFlight) {
+          options.maxFramesInFlight = std::max(
+              args::get(maxFramesInFlight), size_t(1));
+        }
+        if (maxFps) {
+          options.maxFrameRate = std::max(args::get(maxFps), 0.f);
+        }
+        options.cameraPath = args::get(cameraPath);
+        if (timeStep) {
+          options.fixedTimeStep = std::max(args::get(timeStep), 1e-4);
+        }
+        if (recordPath) {
+          options.recordedCameraPath = args::get(recordPath);
+        }
+        options.statsOutput = args::get(statsOut);
+        if (memoryReport) {
+          options.memoryReport = args::get(memoryReport);
+        }
+        options.gpuTelemetry = gpuTelemetry;
+        if (screenshotPath) {
+          options.screenshotPath = args::get(screenshotPath);
+        }
+        if (screenshotScale) {
+          options.screenshotScale = std::max(args::get(screenshotScale), 0.1f);
+        }
+        options.traceOutput = args::get(traceOut);
+        options.frameCapturePath = args::get(captureFrame);
+        // Offline renders skip the debug context, nothing is displayed
+        if (glDebug) {
+          options.glDebugOutput = parseGLDebugOutputMode(args::get(glDebug));
+        } else if (output) {
+          options.glDebugOutput = GLDebugOutputMode::Off;
+        }
+        options.useSceneCache = sceneCache || sceneCacheDir;
+        options.sceneCacheDirectory = args::get(sceneCacheDir);
+        if (cacheCompression) {
+          options.sceneCacheCompression =
+              parseSceneCacheCompression(args::get(cacheCompression));
+        }
+        if (remoteConnections) {
+          options.remoteConnectionCount =
+              size_t(std::max(args::get(remoteConnections), 1));
+        }
+        options.useIndirectDraws =
+            indirectDraws || occlusionCulling || meshlets || cullTriangles ||
+            gpuTransforms || vertexPulling || visibilityBuffer;
+        options.occlusionCulling = occlusionCulling;
+        options.meshlets = meshlets || cullTriangles;
+        options.triangleCulling = cullTriangles;
+        options.vertexPulling = vertexPulling || visibilityBuffer;
+        options.visibilityBuffer = visibilityBuffer;
+        options.gpuTransforms = gpuTransforms;
+        options.useInstancing = instancing || vertexAnimations;
+        options.vertexAnimations = vertexAnimations;
+        options.staticBatching = staticBatching;
+        options.deduplicateContent = deduplicate;
+        if (impostors) {
+          options.impostorPixelSize = std::max(args::get(impostors), 0.f);
+        }
+        options.pointClouds = pointClouds;
+        options.positionIndices = positionIndices;
+        if (pointBudget) {
+          options.pointBudget = args::get(pointBudget);
+        }
+        if (lineWidth) {
+          options.lineWidth = std::max(args::get(lineWidth), 1.f);
+        }
+        options.sortDraws = sortDraws;
+        options.materialPermutations = materialPermutations;
+        options.generateLods = lods;
+        options.optimizeIndices = optimizeIndices;
+        options.quantizeVertices = quantize;
+        options.interleaveVertices = interleave;
+        if (lodError) {
+          options.lodPixelError = std::max(args::get(lodError), 0.f);
+        }
+        options.coarseFirstUpload = coarseFirst;
+        if (animation) {
+          options.animation = std::max(args::get(animation), -1);
+        }
+        options.skinningPrepass = skinningPrepass;
+        options.gpuBounds = gpuBounds;
+        options.potentiallyVisibleSets = !noPvs;
+        options.asyncAnimation = !syncAnimation;
+        options.reversedZ = reversedZ;
+        options.variableRateShading = vrs;
+        if (vrsThreshold) {
+          options.shadingRateSettings.varianceThreshold =
+              std::max(args::get(vrsThreshold), 0.f);
+        }
+        options.depthPrepass = depthPrepass || ssao;
+        if (ssao) {
+          options.ambientOcclusion = true;
+          options.ambientOcclusionDivisor =
+              std::max(args::get(ssao), size_t(1));
+        }
+        if (ssaoRadius) {
+          options.ambientOcclusionRadius =
+              std::max(args::get(ssaoRadius), 1e-3f);
+        }
+        options.occlusionQueries = occlusionQueries;
+        if (costAttribution) {
+          options.costAttribution =
+              parseCostBuckets(args::get(costAttribution));
+        }
+        options.shadows = shadows;
+        options.localShadows = localShadows;
+        if (shadowBudget) {
+          options.localShadowBudget = args::get(shadowBudget);
+        }
+        options.environmentMap = args::get(environmentMap);
+        if (oit) {
+          options.oit = parseOitMode(args::get(oit));
+        }
+        options.temporalAntiAliasing = taa;
+        if (targetFrameTime) {
+          options.targetFrameTime = std::max(args::get(targetFrameTime), 0.f);
+        }
+        if (accumulate) {
+          options.accumulationFrameCount = args::get(accumulate);
+        }
+        options.postProcessing = postProcess;
+        if (exposure) {
+          options.postProcessingSettings.exposureCompensation =
+              args::get(exposure);
+        }
+        if (bloom) {
+          options.postProcessingSettings.bloomIntensity =
+              std::max(args::get(bloom), 0.f);
+        }
+        if (options.postProcessing &&
+            (options.temporalAntiAliasing || options.targetFrameTime > 0.f ||
+                options.accumulationFrameCount)) {
+          std::cerr << "Warning: --post-process is ignored with --taa, "
+                       "--target-frame-time and --accumulate"
+                    << std::endl;
+          options.postProcessing = false;
+        }
+        if (views) {
+          options.viewCount =
+              size_t(std::min(std::max(args::get(views), 1), 32));
+        }
+        options.stereo = stereo;
+        if (ipd) {
+          options.interpupillaryDistance = std::max(args::get(ipd), 0.f);
+        }
+        if (convergence) {
+          options.convergence = std::max(args::get(convergence), 0.f);
+        }
+        if ((options.viewCount > 1 || options.stereo) &&
+            (options.temporalAntiAliasing || options.targetFrameTime > 0.f ||
+                options.accumulationFrameCount)) {
+          std::cerr << "Warning: --taa, --target-frame-time and --accumulate "
+                       "are ignored with --views and --stereo"
+                    << std::endl;
+          options.temporalAntiAliasing = false;
+          options.targetFrameTime = 0.f;
+          options.accumulationFrameCount = 0;
+        }
+        if (environmentIntensity) {
+          options.environmentIntensity =
+              std::max(args::get(environmentIntensity), 0.f);
+        }
+        options.deferredShading = deferred || visibilityBuffer;
+        options.streamTextures = streamTextures || textureBudget;
+        if (textureBudget) {
+          options.textureBudget = size_t(std::max(args::get(textureBudget), 1))
+                                  << 20;
+        }
+        if (prefetchSeconds) {
+          options.prefetchSeconds = std::max(args::get(prefetchSeconds), 0.f);
+        }
+        options.virtualTextures = virtualTextures || virtualTextureBudget;
+        if (virtualTextureBudget) {
+          options.virtualTextureBudget =
+              size_t(std::max(args::get(virtualTextureBudget), 1)) << 20;
+        }
+        options.gpuMipmaps = gpuMipmaps;
+        options.compressTextures = compressTextures;
+        if (anisotropy) {
+          options.maxAnisotropy = std::max(args::get(anisotropy), 1.f);
+        }
+        if (textureLodBias) {
+          options.textureLodBias = args::get(textureLodBias);
+        }
+        options.bindlessTextures = !noBindless;
+        options.exactSceneBounds = exactBounds;
+        if (tileSize) {
+          options.tileSize = size_t(std::max(args::get(tileSize), 1));
+        }
+        if (samples) {
+          options.outputSamples = size_t(std::max(args::get(samples), 0));
+        }
+        options.outputFxaa = fxaa;
+        if (frames) {
+          options.outputFrameCount = size_t(std::max(args::get(frames), 0));
+        }
+        options.outputYuv = yuv;
+        if (turntable) {
+          options.turntablePeriod = std::max(args::get(turntable), 0.);
+        }
+        if (thumbnails) {
+          options.thumbnailCount =
+              size_t(std::min(std::max(args::get(thumbnails), 0), 32));
+        }
+        if (tileError) {
+          options.tilesetPixelError = std::max(args::get(tileError), 0.f);
+        }
+        if (tileLoads) {
+          options.tilesetLoadCount = size_t(std::max(args::get(tileLoads), 1));
+        }
+        if (tileGpuBudget) {
+          options.tilesetGpuBudget =
+              size_t(std::max(args::get(tileGpuBudget), 0)) << 20;
+        }
+        if (tileHostBudget) {
+          options.tilesetHostBudget =
+              size_t(std::max(args::get(tileHostBudget), 0)) << 20;
+        }
+        options.watchShaders = watchShaders;
+        options.programCacheDirectory = args::get(programCacheDir);
+        if (cacheSizeLimit) {
+          options.cacheSizeLimit =
+              uintmax_t(std::max(args::get(cacheSizeLimit), 0)) << 20;
+        }
+        options.shaderDefines = parseShaderDefines(args::get(defines));
+        if (threads) {
+          options.threadCount = size_t(std::max(args::get(threads), 1));
+        }
+        if (backgroundThreads) {
+          options.backgroundThreadCount =
+              size_t(std::max(args::get(backgroundThreads), 0));
+        }
+        if (pinThreads) {
+          options.threadPinning = parseThreadPinning(args::get(pinThreads));
+        }
+        if (imageThreads) {
+          options.imageDecodingThreads =
+              size_t(std::max(args::get(imageThreads), 1));
+        }
+
+        const auto isTileset = fs::path{args::get(file)}.extension() == ".json";
+        // The file is parsed while the window is created
+        options.loadAtStartup = !isTileset;
+        if (isTileset && profileLoad) {
+          std::cerr << "Warning: the loads of tilesets are not reported"
+                    << std::endl;
+          options.profileLoad = false;
+        }
         ViewerApplication app{fs::path{argv[0]}, width, height, args::get(file),
             lookatParams, args::get(vertexShader), args::get(fragmentShader),
-            args::get(output)};
-        returnCode = app.run();
+            args::get(output), options};
+        returnCode = isTileset ? app.runTileset() : app.run();
+      }};
+
+  args::Command batch{commands, "batch",
+      "Render a list of images (json or csv job file) in a single process",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> jobFile{
+            parser, "jobs", "Path to job file (required without --serve)"};
+        args::Flag serve{parser, "serve",
+            "Keep running and render the requests read from the standard "
+            "input (one json job per line), answering each on the standard "
+            "output",
+            {"serve"}};
+        args::ValueFlag<int32_t> gpus{parser, "count",
+            "Render on this many EGL GPU devices (0 for all of them), with "
+            "one worker process per GPU taking jobs or requests as its load "
+            "allows",
+            {"gpus"}};
+        args::ValueFlag<int32_t> device{parser, "index",
+            "EGL GPU device to render on (default: the first display that "
+            "works)",
+            {"device"}};
+        args::ValueFlag<int32_t> listen{parser, "port",
+            "With --serve, read the requests of the connections accepted on "
+            "this TCP port, one at a time, instead of the standard input",
+            {"listen"}};
+        args::ValueFlagList<std::string> servers{parser, "host:port",
+            "Render on the servers listening at this address (see --listen), "
+            "the jobs of a model going to the few servers that keep it "
+            "loaded, images being returned to this machine",
+            {"servers"}};
+        args::ValueFlag<int32_t> retries{parser, "count",
+            "Times a job failed or lost by a server or a GPU is sent again "
+            "(default: 2)",
+            {"retries"}};
+        args::ValueFlag<int32_t> maxModels{parser, "max-models",
+            "Number of models kept loaded between jobs (default: 4, 0 for "
+            "no limit)",
+            {"max-models"}};
+        args::ValueFlag<int32_t> modelGpuBudget{parser, "model-gpu-mb",
+            "MB of GPU memory of the models kept loaded between jobs "
+            "(default: no limit)",
+            {"model-gpu-mb"}};
+        args::ValueFlag<int32_t> modelHostBudget{parser, "model-ram-mb",
+            "MB of host memory of the models kept loaded between jobs "
+            "(default: no limit)",
+            {"model-ram-mb"}};
+        args::ValueFlag<std::string> report{parser, "report",
+            "Write the load and GPU times of the jobs, and their differences "
+            "with their reference image, to this json or csv file",
+            {"report"}};
+        args::ValueFlag<int32_t> referenceTolerance{parser, "levels",
+            "Differences of components with the reference images ignored "
+            "(default: 8)",
+            {"reference-tolerance"}};
+        args::ValueFlag<float> referenceMaxDiffering{parser, "fraction",
+            "Fraction of pixels allowed to differ from the reference image "
+            "(default: 0.001)",
+            {"reference-max-differing"}};
+        args::ValueFlag<std::string> vertexShader{
+            parser, "vs", "Default vertex shader", {"vs"}};
+        args::ValueFlag<std::string> fragmentShader{
+            parser, "fs", "Default fragment shader", {"fs"}};
+        args::Flag deferred{parser, "deferred",
+            "Shade with a G-buffer and a tiled lighting pass instead of the "
+            "fragment shaders",
+            {"deferred"}};
+        args::ValueFlag<int32_t> imageWidth{
+            parser, "width", "Default width of images", {"w", "width"}};
+        args::ValueFlag<int32_t> imageHeight{
+            parser, "height", "Default height of images", {"h", "height"}};
+        args::Flag noMmap{parser, "no-mmap",
+            "Read .glb files in memory with tinygltf instead of memory "
+            "mapping them",
+            {"no-mmap"}};
+        args::Flag pinnedUploads{parser, "pinned-uploads",
+            "Copy the vertices and indices stored as is in glTF buffers "
+            "straight from host memory with GL_AMD_pinned_memory",
+            {"pinned-uploads"}};
+        args::Flag sceneCache{parser, "cache",
+            "Load scenes from .gltfcache files if up to date, create them "
+            "otherwise",
+            {"cache"}};
+        args::ValueFlag<std::string> sceneCacheDir{parser, "cache-dir",
+            "Directory of .gltfcache files (default: gltf-viewer in the "
+            "temporary directory)",
+            {"cache-dir"}};
+        args::ValueFlag<std::string> cacheCompression{parser, "compression",
+            "Compression of the .gltfcache files written: none, lz4 "
+            "(default) or lz4hc, smaller and slower to write",
+            {"cache-compression"}};
+        args::ValueFlag<int32_t> threads{parser, "threads",
+            "Number of threads of scene-wide CPU passes (default: one per "
+            "hardware thread)",
+            {"threads"}};
+        args::ValueFlag<int32_t> backgroundThreads{parser,
+            "background-threads",
+            "Number of additional lower priority threads running the CPU "
+            "passes of scene loading (default: 0, loading uses --threads)",
+            {"background-threads"}};
+        args::ValueFlag<std::string> pinThreads{parser, "pin-threads",
+            "Pin the threads of CPU passes: none (default), cores (one CPU "
+            "each) or numa (one NUMA node each)",
+            {"pin-threads"}};
+        args::Flag indirectDraws{parser, "indirect",
+            "Draw scenes with multi-draw indirect instead of one draw call "
+            "per primitive",
+            {"indirect"}};
+        args::Flag occlusionCulling{parser, "occlusion-culling",
+            "Also cull indirect draws hidden behind the depth of the scene "
+            "(implies --indirect)",
+            {"occlusion-culling"}};
+        args::Flag meshlets{parser, "meshlets",
+            "Split large meshes in meshlets culled separately, also when "
+            "facing away from the camera (implies --indirect)",
+            {"meshlets"}};
+        args::Flag cullTriangles{parser, "cull-triangles",
+            "Also cull the triangles of meshlets facing away from the camera "
+            "or covering no pixel center in a compute pass (implies "
+            "--meshlets)",
+            {"cull-triangles"}};
+        args::Flag vertexPulling{parser, "vertex-pulling",
+            "Fetch the vertices of indirect draws from storage buffers in the "
+            "vertex shader, with GL_ARB_shader_draw_parameters (implies "
+            "--indirect)",
+            {"vertex-pulling"}};
+        args::Flag visibilityBuffer{parser, "visibility-buffer",
+            "Draw the triangle ids of indirect draws in a visibility buffer, "
+            "then shade each pixel once from its triangle (implies "
+            "--deferred and --vertex-pulling)",
+            {"visibility-buffer"}};
+        args::Flag gpuTransforms{parser, "gpu-transforms",
+            "Play animations with indirect draws, propagating the node "
+            "transforms on the GPU (implies --indirect)",
+            {"gpu-transforms"}};
+        args::Flag instancing{parser, "instancing",
+            "Draw the primitives of meshes used several times with one "
+            "instanced draw call (ignored with --indirect)",
+            {"instancing"}};
+        args::Flag vertexAnimations{parser, "vertex-animations",
+            "Animate the instances of skinned meshes with the vertex "
+            "animations baked by gltf-optimize --vat (implies --instancing)",
+            {"vertex-animations"}};
+        args::Flag staticBatching{parser, "static-batching",
+            "Merge the primitives of the nodes that never move by material "
+            "when loading the model",
+            {"static-batching"}};
+        args::Flag deduplicate{parser, "deduplicate",
+            "Merge the meshes and images of the model equal to another one "
+            "when loading it",
+            {"deduplicate"}};
+        args::ValueFlag<float> impostors{parser, "pixels",
+            "Draw the instances of primitives used many times as baked "
+            "impostors once they cover fewer pixels than this (requires "
+            "--instancing)",
+            {"impostors"}};
+        args::Flag pointClouds{parser, "point-clouds",
+            "Draw the points and lines of the model with an octree of points "
+            "rasterized by a compute pass and thick lines",
+            {"point-clouds"}};
+        args::Flag positionIndices{parser, "position-indices",
+            "Draw the depth-only passes with indices welding the vertices "
+            "split by normal or texture seams",
+            {"position-indices"}};
+        args::ValueFlag<size_t> pointBudget{parser, "count",
+            "Points drawn per frame with --point-clouds (default 10000000)",
+            {"point-budget"}};
+        args::ValueFlag<float> lineWidth{parser, "pixels",
+            "Width of the lines drawn with --point-clouds (default 2)",
+            {"line-width"}};
+        args::Flag sortDraws{parser, "sort-draws",
+            "Sort draws by state, then front to back (back to front for "
+            "transparent materials)",
+            {"sort-draws"}};
+        args::Flag materialPermutations{parser, "material-permutations",
+            "Draw primitives with shader variants compiled for the features "
+            "of their material when the model is loaded",
+            {"material-permutations"}};
+        args::Flag lods{parser, "lods",
+            "Generate levels of detail of meshes and draw the coarsest one "
+            "within --lod-error pixels (drawing one primitive at a time)",
+            {"lods"}};
+        args::ValueFlag<float> lodError{parser, "lod-error",
+            "Maximum screen space error of levels of detail, in pixels "
+            "(default: 1)",
+            {"lod-error"}};
+        args::Flag optimizeIndices{parser, "optimize-indices",
+            "Reorder triangles and vertices of meshes for the vertex cache, "
+            "overdraw and vertex fetches when loading them",
+            {"optimize-indices"}};
+        args::Flag quantize{parser, "quantize",
+            "Store vertices with 16-bit positions, octahedral normals and "
+            "half float texture coordinates",
+            {"quantize"}};
+        args::Flag interleave{parser, "interleave",
+            "Interleave the normals and texture coordinates of the vertices "
+            "in one buffer",
+            {"interleave-vertices"}};
+        args::ValueFlag<int32_t> animation{parser, "animation",
+            "Index of the glTF animation to play (the first frame for "
+            "output images)",
+            {"animation"}};
+        args::Flag skinningPrepass{parser, "skinning-prepass",
+            "Skin vertices once per frame with a compute shader instead of "
+            "in the vertex shader of each draw",
+            {"skinning-prepass"}};
+        args::Flag gpuBounds{parser, "gpu-bounds",
+            "Bound skinned and morphed draws, and primitives without "
+            "bounds, from their vertices with a compute shader so that they "
+            "are culled",
+            {"gpu-bounds"}};
+        args::Flag noPvs{parser, "no-pvs",
+            "Ignore the potentially visible sets of the scene cache",
+            {"no-pvs"}};
+        args::Flag depthPrepass{parser, "depth-prepass",
+            "Draw the depth of opaque primitives before shading them",
+            {"depth-prepass"}};
+        args::ValueFlag<size_t> ssao{parser, "divisor",
+            "Darken the ambient lighting with screen-space ambient "
+            "occlusion, computed at 1 / divisor of the resolution (2 or 4, "
+            "implies --depth-prepass)",
+            {"ssao"}};
+        args::ValueFlag<float> ssaoRadius{parser, "radius",
+            "Radius of the ambient occlusion in world units",
+            {"ssao-radius"}};
+        args::Flag shadows{parser, "shadows",
+            "Shadow the first directional light with cached cascaded shadow "
+            "maps",
+            {"shadows"}};
+        args::Flag localShadows{parser, "local-shadows",
+            "Shadow the spot and point lights with a cached shadow atlas",
+            {"local-shadows"}};
+        args::ValueFlag<size_t> shadowBudget{parser, "views",
+            "Stale local light shadow views drawn per frame (default: 8)",
+            {"shadow-budget"}};
+        args::ValueFlag<std::string> environmentMap{parser, "env",
+            "Light the scene with this equirectangular .hdr environment map",
+            {"env"}};
+        args::ValueFlag<float> environmentIntensity{parser,
+            "env-intensity", "Scale of the environment lighting (default: 1)",
+            {"env-intensity"}};
+        args::ValueFlag<std::string> oit{parser, "oit",
+            "Blend transparent materials with order-independent "
+            "transparency: weighted or linked-list",
+            {"oit"}};
+        args::Flag reversedZ{parser, "reversed-z",
+            "Render with a reversed 32-bit float depth buffer and an infinite "
+            "far plane",
+            {"reversed-z"}};
+        args::ValueFlag<int32_t> tileSize{parser, "tile-size",
+            "Render images larger than this in tiles (default: 4096)",
+            {"tile-size"}};
+        args::ValueFlag<int32_t> samples{parser, "samples",
+            "Samples per pixel of output images, resolved on the GPU",
+            {"samples"}};
+        args::Flag fxaa{parser, "fxaa",
+            "Filter output images with FXAA (except tiled ones)", {"fxaa"}};
+        args::Flag gpuMipmaps{parser, "gpu-mipmaps",
+            "Generate texture mipmaps with a compute shader averaging colors "
+            "in linear space and renormalizing normal maps",
+            {"gpu-mipmaps"}};
+        args::Flag compressTextures{parser, "compress-textures",
+            "Compress decoded textures in BC7, normal maps in BC5, when "
+            "loading them",
+            {"compress-textures"}};
+        args::ValueFlag<float> anisotropy{parser, "anisotropy",
+            "Maximum anisotropy of texture filtering (default: 1, disabled)",
+            {"anisotropy"}};
+        args::ValueFlag<float> textureLodBias{parser, "texture-lod-bias",
+            "Bias added to the level of detail of material textures",
+            {"texture-lod-bias"}};
+        args::ValueFlag<std::string> programCacheDir{parser, "program-cache",
+            "Directory where linked shader programs are cached",
+            {"program-cache"}};
+        args::ValueFlag<int> cacheSizeLimit{parser, "MiB",
+            "Size beyond which the least recently used entries of the cache "
+            "directories are removed at exit (default: unbounded)",
+            {"cache-size-limit"}};
+        args::ValueFlagList<std::string> defines{parser, "NAME[=VALUE]",
+            "Define added to every shader, to compile their variants",
+            {"define"}};
+        args::ValueFlag<std::string> traceOut{parser, "trace-out",
+            "Write the trace zones to this Chrome trace (json) at exit, "
+            "requires a build with GLMLV_ENABLE_TRACING",
+            {"trace-out"}};
+        args::ValueFlag<std::string> glDebug{parser, "gl-debug",
+            "GL debug output: full (debug context), performance (only count "
+            "performance warnings), off (default) or no-error "
+            "(GL_KHR_no_error context if supported)",
+            {"gl-debug"}};
+        args::ValueFlag<std::string> logLevel{parser, "log-level",
+            "Lowest level of the messages logged: debug, info (default), "
+            "warning or error",
+            {"log-level"}};
+        args::ValueFlag<float> syncStallMs{parser, "ms",
+            "Log the waits of the CPU for the GPU longer than this, in "
+            "milliseconds (default: 10)",
+            {"sync-stall-ms"}};
+        parser.Parse();
+        if (logLevel) {
+          setLogLevel(parseLogLevel(args::get(logLevel)));
+        }
+        if (syncStallMs) {
+          setSyncStallThreshold(std::max(args::get(syncStallMs), 0.f));
+        }
+
+        const size_t width = imageWidth ? args::get(imageWidth) : 1280;
+        const size_t height = imageHeight ? args::get(imageHeight) : 720;
+        std::vector<BatchJob> jobs;
+        if (!serve) {
+          if (!jobFile) {
+            throw args::ValidationError("Job file required without --serve");
+          }
+          std::string err;
+          if (!loadBatchJobs(args::get(jobFile), width, height, jobs, err)) {
+            throw args::ValidationError(err);
+          }
+          if (jobs.empty()) {
+            return;
+          }
+        }
+
+        ViewerOptions options;
+        options.useMemoryMappedGlb = !noMmap;
+        options.pinnedUploads = pinnedUploads;
+        options.asyncLoading = false;
+        options.traceOutput = args::get(traceOut);
+        options.glDebugOutput = glDebug
+                                    ? parseGLDebugOutputMode(args::get(glDebug))
+                                    : GLDebugOutputMode::Off;
+        options.useSceneCache = sceneCache || sceneCacheDir;
+        options.sceneCacheDirectory = args::get(sceneCacheDir);
+        if (cacheCompression) {
+          options.sceneCacheCompression =
+              parseSceneCacheCompression(args::get(cacheCompression));
+        }
+        options.useIndirectDraws =
+            indirectDraws || occlusionCulling || meshlets || cullTriangles ||
+            gpuTransforms || vertexPulling || visibilityBuffer;
+        options.occlusionCulling = occlusionCulling;
+        options.meshlets = meshlets || cullTriangles;
+        options.triangleCulling = cullTriangles;
+        options.vertexPulling = vertexPulling || visibilityBuffer;
+        options.visibilityBuffer = visibilityBuffer;
+        options.gpuTransforms = gpuTransforms;
+        options.useInstancing = instancing || vertexAnimations;
+        options.vertexAnimations = vertexAnimations;
+        options.staticBatching = staticBatching;
+        options.deduplicateContent = deduplicate;
+        if (impostors) {
+          options.impostorPixelSize = std::max(args::get(impostors), 0.f);
+        }
+        options.pointClouds = pointClouds;
+        options.positionIndices = positionIndices;
+        if (pointBudget) {
+          options.pointBudget = args::get(pointBudget);
+        }
+        if (lineWidth) {
+          options.lineWidth = std::max(args::get(lineWidth), 1.f);
+        }
+        options.sortDraws = sortDraws;
+        options.materialPermutations = materialPermutations;
+        options.generateLods = lods;
+        options.optimizeIndices = optimizeIndices;
+        options.quantizeVertices = quantize;
+        options.interleaveVertices = interleave;
+        if (lodError) {
+          options.lodPixelError = std::max(args::get(lodError), 0.f);
+        }
+        if (animation) {
+          options.animation = std::max(args::get(animation), -1);
+        }
+        options.skinningPrepass = skinningPrepass;
+        options.gpuBounds = gpuBounds;
+        options.potentiallyVisibleSets = !noPvs;
+        options.reversedZ = reversedZ;
+        options.gpuMipmaps = gpuMipmaps;
+        options.compressTextures = compressTextures;
+        if (anisotropy) {
+          options.maxAnisotropy = std::max(args::get(anisotropy), 1.f);
+        }
+        if (textureLodBias) {
+          options.textureLodBias = args::get(textureLodBias);
+        }
+        options.depthPrepass = depthPrepass || ssao;
+        if (ssao) {
+          options.ambientOcclusion = true;
+          options.ambientOcclusionDivisor =
+              std::max(args::get(ssao), size_t(1));
+        }
+        if (ssaoRadius) {
+          options.ambientOcclusionRadius =
+              std::max(args::get(ssaoRadius), 1e-3f);
+        }
+        options.shadows = shadows;
+        options.localShadows = localShadows;
+        if (shadowBudget) {
+          options.localShadowBudget = args::get(shadowBudget);
+        }
+        options.environmentMap = args::get(environmentMap);
+        if (oit) {
+          options.oit = parseOitMode(args::get(oit));
+        }
+        if (environmentIntensity) {
+          options.environmentIntensity =
+              std::max(args::get(environmentIntensity), 0.f);
+        }
+        options.deferredShading = deferred || visibilityBuffer;
+        if (tileSize) {
+          options.tileSize = size_t(std::max(args::get(tileSize), 1));
+        }
+        if (samples) {
+          options.outputSamples = size_t(std::max(args::get(samples), 0));
+        }
+        options.outputFxaa = fxaa;
+        options.programCacheDirectory = args::get(programCacheDir);
+        if (cacheSizeLimit) {
+          options.cacheSizeLimit =
+              uintmax_t(std::max(args::get(cacheSizeLimit), 0)) << 20;
+        }
+        options.shaderDefines = parseShaderDefines(args::get(defines));
+        if (threads) {
+          options.threadCount = size_t(std::max(args::get(threads), 1));
+        }
+        if (backgroundThreads) {
+          options.backgroundThreadCount =
+              size_t(std::max(args::get(backgroundThreads), 0));
+        }
+        if (pinThreads) {
+          options.threadPinning = parseThreadPinning(args::get(pinThreads));
+        }
+        if (maxModels) {
+          options.modelCacheSize = size_t(std::max(args::get(maxModels), 0));
+        }
+        if (modelGpuBudget) {
+          options.modelCacheGpuBudget =
+              size_t(std::max(args::get(modelGpuBudget), 0)) << 20;
+        }
+        if (modelHostBudget) {
+          options.modelCacheHostBudget =
+              size_t(std::max(args::get(modelHostBudget), 0)) << 20;
+        }
+        options.batchReport = args::get(report);
+        if (referenceTolerance) {
+          options.referenceTolerance =
+              size_t(std::max(args::get(referenceTolerance), 0));
+        }
+        if (referenceMaxDiffering) {
+          options.referenceMaxDifferingPixels =
+              std::max(args::get(referenceMaxDiffering), 0.f);
+        }
+
+        if (device) {
+          options.gpuDevice = std::max(args::get(device), 0);
+        }
+        if (listen) {
+          options.serverPort =
+              uint16_t(std::min(std::max(args::get(listen), 0), 65535));
+        }
+
+        const auto deviceCount = HeadlessGLContext::getDeviceCount();
+        const auto gpuCount =
+            gpus && args::get(gpus) > 0
+                ? std::min(size_t(args::get(gpus)), deviceCount)
+                : deviceCount;
+        if (servers || (gpus && gpuCount > 1)) {
+          WorkerBatchOptions batchOptions;
+          batchOptions.referenceTolerance = options.referenceTolerance;
+          batchOptions.referenceMaxDifferingPixels =
+              options.referenceMaxDifferingPixels;
+          batchOptions.report = options.batchReport;
+          if (retries) {
+            batchOptions.retryCount = size_t(std::max(args::get(retries), 0));
+          }
+          batchOptions.inlineImages = bool(servers);
+          try {
+            std::unique_ptr<RenderWorkerPool> workers;
+            if (servers) {
+              workers = RenderWorkerPool::connect(args::get(servers));
+            } else {
+              // Workers get the same options, as servers: the job file,
+              // the report and the options of the coordinator are handled
+              // here
+              const std::vector<std::string> skippedOptions = {"--gpus",
+                  "--report", "--listen", "--retries"};
+              std::vector<std::string> arguments{"batch", "--serve"};
+              const auto first = std::find(argv + 1, argv + argc,
+                                     std::string("batch")) + 1;
+              auto isJobFileSkipped = !jobFile;
+              for (auto arg = first; arg < argv + argc; ++arg) {
+                const std::string argument = *arg;
+                const auto isSkipped = std::any_of(begin(skippedOptions),
+                    end(skippedOptions), [&](const std::string &option) {
+                      return argument.rfind(option + "=", 0) == 0;
+                    });
+                if (std::find(begin(skippedOptions), end(skippedOptions),
+                        argument) != end(skippedOptions)) {
+                  ++arg;
+                } else if (!isJobFileSkipped &&
+                           argument == args::get(jobFile)) {
+                  isJobFileSkipped = true;
+                } else if (argument != "--serve" && !isSkipped) {
+                  arguments.push_back(argument);
+                }
+              }
+              workers = std::make_unique<RenderWorkerPool>(
+                  getDeviceWorkerCommands(argv[0], arguments, gpuCount));
+            }
+            returnCode =
+                serve ? serveOnWorkers(
+                            *workers, std::cin, std::cout, width, height)
+                      : runBatchOnWorkers(*workers, jobs, batchOptions);
+          } catch (const std::runtime_error &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            returnCode = -1;
+          }
+          return;
+        }
+
+        if (serve) {
+          // A non empty output path hides the window, its size is the
+          // default size of images
+          ViewerApplication app{fs::path{argv[0]}, uint32_t(width),
+              uint32_t(height), {}, {}, args::get(vertexShader),
+              args::get(fragmentShader), fs::path{"-"}, options};
+          returnCode = app.runServer(std::cin, std::cout);
+          return;
+        }
+
+        // A non empty output path hides the window, the size of the default
+        // framebuffer is not used
+        ViewerApplication app{fs::path{argv[0]}, 1, 1, jobs.front().model, {},
+            args::get(vertexShader), args::get(fragmentShader),
+            jobs.front().output, options};
+        returnCode = app.runBatch(jobs);
+      }};
+
+  args::Command bench{commands, "bench",
+      "Measure loading and drawing times of models, written to a json or "
+      "csv file",
+      [&](args::Subparser &parser) {
+        args::PositionalList<std::string> models{parser, "models",
+            "Paths to glTF files, or directories searched for them",
+            args::Options::Required};
+        args::ValueFlag<std::string> output{parser, "output",
+            "Path of the results, csv if its extension is .csv, json "
+            "otherwise",
+            {"o", "output"}, args::Options::Required};
+        args::ValueFlag<int32_t> frames{parser, "frames",
+            "Number of frames measured per model (default: 240)",
+            {"frames"}};
+        args::ValueFlag<std::string> cameraPath{parser, "camera-path",
+            "Camera path (json) giving the measured frames instead of a "
+            "turn around the scene",
+            {"camera-path"}};
+        args::ValueFlag<double> timeStep{parser, "time-step",
+            "Time step between frames, in seconds (default: 1/60)",
+            {"time-step"}};
+        args::ValueFlag<std::string> vertexShader{
+            parser, "vs", "Vertex shader to use", {"vs"}};
+        args::ValueFlag<std::string> fragmentShader{
+            parser, "fs", "Fragment shader to use", {"fs"}};
+        args::Flag deferred{parser, "deferred",
+            "Shade with a G-buffer and a tiled lighting pass instead of the "
+            "fragment shader",
+            {"deferred"}};
+        args::ValueFlag<int32_t> imageWidth{
+            parser, "width", "Width of frames", {"w", "width"}};
+        args::ValueFlag<int32_t> imageHeight{
+            parser, "height", "Height of frames", {"h", "height"}};
+        args::Flag sceneCache{parser, "cache",
+            "Load scenes from .gltfcache files if up to date, create them "
+            "otherwise",
+            {"cache"}};
+        args::ValueFlag<int32_t> threads{parser, "threads",
+            "Number of threads of scene-wide CPU passes (default: one per "
+            "hardware thread)",
+            {"threads"}};
+        args::ValueFlag<int32_t> backgroundThreads{parser,
+            "background-threads",
+            "Number of additional lower priority threads running the CPU "
+            "passes of scene loading (default: 0, loading uses --threads)",
+            {"background-threads"}};
+        args::ValueFlag<std::string> pinThreads{parser, "pin-threads",
+            "Pin the threads of CPU passes: none (default), cores (one CPU "
+            "each) or numa (one NUMA node each)",
+            {"pin-threads"}};
+        args::Flag indirectDraws{parser, "indirect",
+            "Draw scenes with multi-draw indirect instead of one draw call "
+            "per primitive",
+            {"indirect"}};
+        args::Flag occlusionCulling{parser, "occlusion-culling",
+            "Also cull indirect draws hidden behind the depth of the scene "
+            "(implies --indirect)",
+            {"occlusion-culling"}};
+        args::Flag meshlets{parser, "meshlets",
+            "Split large meshes in meshlets culled separately, also when "
+            "facing away from the camera (implies --indirect)",
+            {"meshlets"}};
+        args::Flag cullTriangles{parser, "cull-triangles",
+            "Also cull the triangles of meshlets facing away from the camera "
+            "or covering no pixel center in a compute pass (implies "
+            "--meshlets)",
+            {"cull-triangles"}};
+        args::Flag vertexPulling{parser, "vertex-pulling",
+            "Fetch the vertices of indirect draws from storage buffers in the "
+            "vertex shader, with GL_ARB_shader_draw_parameters (implies "
+            "--indirect)",
+            {"vertex-pulling"}};
+        args::Flag visibilityBuffer{parser, "visibility-buffer",
+            "Draw the triangle ids of indirect draws in a visibility buffer, "
+            "then shade each pixel once from its triangle (implies "
+            "--deferred and --vertex-pulling)",
+            {"visibility-buffer"}};
+        args::Flag instancing{parser, "instancing",
+            "Draw the primitives of meshes used several times with one "
+            "instanced draw call (ignored with --indirect)",
+            {"instancing"}};
+        args::Flag vertexAnimations{parser, "vertex-animations",
+            "Animate the instances of skinned meshes with the vertex "
+            "animations baked by gltf-optimize --vat (implies --instancing)",
+            {"vertex-animations"}};
+        args::Flag staticBatching{parser, "static-batching",
+            "Merge the primitives of the nodes that never move by material "
+            "when loading the model",
+            {"static-batching"}};
+        args::Flag deduplicate{parser, "deduplicate",
+            "Merge the meshes and images of the model equal to another one "
+            "when loading it",
+            {"deduplicate"}};
+        args::Flag depthPrepass{parser, "depth-prepass",
+            "Draw the depth of opaque primitives before shading them",
+            {"depth-prepass"}};
+        args::ValueFlag<size_t> ssao{parser, "divisor",
+            "Darken the ambient lighting with screen-space ambient "
+            "occlusion, computed at 1 / divisor of the resolution (2 or 4, "
+            "implies --depth-prepass)",
+            {"ssao"}};
+        args::ValueFlag<float> ssaoRadius{parser, "radius",
+            "Radius of the ambient occlusion in world units",
+            {"ssao-radius"}};
+        args::Flag shadows{parser, "shadows",
+            "Shadow the first directional light with cached cascaded shadow "
+            "maps",
+            {"shadows"}};
+        args::Flag localShadows{parser, "local-shadows",
+            "Shadow the spot and point lights with a cached shadow atlas",
+            {"local-shadows"}};
+        args::ValueFlag<size_t> shadowBudget{parser, "views",
+            "Stale local light shadow views drawn per frame (default: 8)",
+            {"shadow-budget"}};
+        args::Flag vrs{parser, "vrs",
+            "Shade the main pass per 2x2 or 4x4 pixels where the previous "
+            "frame varies little (GL_NV_shading_rate_image)",
+            {"vrs"}};
+        args::ValueFlag<float> vrsThreshold{parser, "variance",
+            "Luminance variance of a 16 x 16 tile below which --vrs shades "
+            "it coarsely (default: 0.001)",
+            {"vrs-threshold"}};
+        args::Flag reversedZ{parser, "reversed-z",
+            "Render with a reversed 32-bit float depth buffer and an infinite "
+            "far plane",
+            {"reversed-z"}};
+        args::ValueFlagList<std::string> defines{parser, "NAME[=VALUE]",
+            "Define added to every shader, to compile their variants",
+            {"define"}};
+        args::ValueFlag<std::string> traceOut{parser, "trace-out",
+            "Write the trace zones to this Chrome trace (json) at exit, "
+            "requires a build with GLMLV_ENABLE_TRACING",
+            {"trace-out"}};
+        args::ValueFlag<std::string> captureFrame{parser, "capture-frame",
+            "Write the draws of the first frame drawn with indirect draws "
+            "to this file, for the replay command",
+            {"capture-frame"}};
+        args::ValueFlag<std::string> glDebug{parser, "gl-debug",
+            "GL debug output: full (debug context), performance (only count "
+            "performance warnings, default), off or no-error "
+            "(GL_KHR_no_error context if supported)",
+            {"gl-debug"}};
+        args::ValueFlag<std::string> logLevel{parser, "log-level",
+            "Lowest level of the messages logged: debug, info (default), "
+            "warning or error",
+            {"log-level"}};
+        args::ValueFlag<float> syncStallMs{parser, "ms",
+            "Log the waits of the CPU for the GPU longer than this, in "
+            "milliseconds (default: 10)",
+            {"sync-stall-ms"}};
+        args::Flag gpuTelemetry{parser, "gpu-telemetry",
+            "Sample the clocks, temperature, power and utilization of the GPU "
+            "(NVML or amdgpu) on a background thread",
+            {"gpu-telemetry"}};
+        args::ValueFlag<int64_t> maxFrameAllocations{parser, "count",
+            "Fail if a measured frame makes more heap allocations on the "
+            "render thread, requires a build with GLMLV_COUNT_ALLOCATIONS",
+            {"max-frame-allocations"}};
+        parser.Parse();
+        if (logLevel) {
+          setLogLevel(parseLogLevel(args::get(logLevel)));
+        }
+        if (syncStallMs) {
+          setSyncStallThreshold(std::max(args::get(syncStallMs), 0.f));
+        }
+        if (maxFrameAllocations && !isAllocationCountingCompiled()) {
+          std::cerr << "Warning: --max-frame-allocations is ignored, "
+                       "allocations are not counted in this build"
+                    << std::endl;
+        }
+
+        std::vector<fs::path> paths;
+        for (const auto &model : args::get(models)) {
+          paths.emplace_back(model);
+        }
+        const auto modelPaths = findBenchmarkModels(paths);
+        if (modelPaths.empty()) {
+          throw args::ValidationError("No glTF file found");
+        }
+
+        const uint32_t width = imageWidth ? args::get(imageWidth) : 1280;
+        const uint32_t height = imageHeight ? args::get(imageHeight) : 720;
+        const auto frameCount =
+            frames ? size_t(std::max(args::get(frames), 1)) : 240;
+
+        ViewerOptions options;
+        options.asyncLoading = false;
+        options.traceOutput = args::get(traceOut);
+        options.frameCapturePath = args::get(captureFrame);
+        options.gpuTelemetry = gpuTelemetry;
+        if (maxFrameAllocations && isAllocationCountingCompiled()) {
+          options.maxFrameAllocations =
+              std::max(args::get(maxFrameAllocations), int64_t(0));
+        }
+        // Measured frames must not pay for a debug context by default
+        options.glDebugOutput = glDebug
+                                    ? parseGLDebugOutputMode(args::get(glDebug))
+                                    : GLDebugOutputMode::Performance;
+        options.cameraPath = args::get(cameraPath);
+        if (timeStep) {
+          options.fixedTimeStep = std::max(args::get(timeStep), 1e-4);
+        }
+        options.useSceneCache = sceneCache;
+        options.useIndirectDraws =
+            indirectDraws || occlusionCulling || meshlets || cullTriangles ||
+            vertexPulling || visibilityBuffer;
+        options.occlusionCulling = occlusionCulling;
+        options.meshlets = meshlets || cullTriangles;
+        options.triangleCulling = cullTriangles;
+        options.vertexPulling = vertexPulling || visibilityBuffer;
+        options.visibilityBuffer = visibilityBuffer;
+        options.useInstancing = instancing || vertexAnimations;
+        options.vertexAnimations = vertexAnimations;
+        options.staticBatching = staticBatching;
+        options.deduplicateContent = deduplicate;
+        options.depthPrepass = depthPrepass || ssao;
+        if (ssao) {
+          options.ambientOcclusion = true;
+          options.ambientOcclusionDivisor =
+              std::max(args::get(ssao), size_t(1));
+        }
+        if (ssaoRadius) {
+          options.ambientOcclusionRadius =
+              std::max(args::get(ssaoRadius), 1e-3f);
+        }
+        options.shadows = shadows;
+        options.localShadows = localShadows;
+        if (shadowBudget) {
+          options.localShadowBudget = args::get(shadowBudget);
+        }
+        options.reversedZ = reversedZ;
+        options.variableRateShading = vrs;
+        if (vrsThreshold) {
+          options.shadingRateSettings.varianceThreshold =
+              std::max(args::get(vrsThreshold), 0.f);
+        }
+        options.deferredShading = deferred || visibilityBuffer;
+        options.shaderDefines = parseShaderDefines(args::get(defines));
+        if (threads) {
+          options.threadCount = size_t(std::max(args::get(threads), 1));
+        }
+        if (backgroundThreads) {
+          options.backgroundThreadCount =
+              size_t(std::max(args::get(backgroundThreads), 0));
+        }
+        if (pinThreads) {
+          options.threadPinning = parseThreadPinning(args::get(pinThreads));
+        }
+
+        // The output path hides the window
+        ViewerApplication app{fs::path{argv[0]}, width, height,
+            modelPaths.front(), {}, args::get(vertexShader),
+            args::get(fragmentShader), args::get(output), options};
+        returnCode = app.runBenchmark(modelPaths, frameCount);
+      }};
+  args::Command replay{commands, "replay",
+      "Draw a frame captured with --capture-frame again and again, and "
+      "report its GPU time",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> file{parser, "file",
+            "Path to the frame capture", args::Options::Required};
+        args::ValueFlag<int32_t> frames{parser, "frames",
+            "Number of frames measured (default: 100)", {"frames"}};
+        args::ValueFlag<int32_t> warmup{parser, "warmup",
+            "Number of frames drawn before measuring (default: 10)",
+            {"warmup"}};
+        args::ValueFlag<std::string> fragmentShader{parser, "fs",
+            "Fragment shader reading the outputs of "
+            "forward_indirect.vs.glsl (default: normals.fs.glsl)",
+            {"fs"}};
+        parser.Parse();
+
+        FrameCapture capture;
+        std::string err;
+        if (!readFrameCapture(args::get(file), capture, err)) {
+          std::cerr << "Error: " << err << std::endl;
+          returnCode = 1;
+          return;
+        }
+        // Measured frames must not pay for a debug context
+        GLFWHandle handle{1, 1, "", false, 0, GLDebugOutputMode::Off};
+        const fs::path appPath{argv[0]};
+        const auto shadersPath =
+            appPath.parent_path() / "shaders" / appPath.stem();
+        const auto frameCount =
+            frames ? size_t(std::max(args::get(frames), 1)) : 100;
+        const auto warmupCount =
+            warmup ? size_t(std::max(args::get(warmup), 0)) : 10;
+        FrameReplayTimes times;
+        if (!replayFrameCapture(capture, shadersPath,
+                fragmentShader ? fs::path{args::get(fragmentShader)}
+                               : shadersPath / "normals.fs.glsl",
+                warmupCount, frameCount, times, err)) {
+          std::cerr << "Error: " << err << std::endl;
+          returnCode = 1;
+          return;
+        }
+        const auto commandCount =
+            capture.commands.size() / sizeof(DrawElementsIndirectCommand);
+        std::cout << commandCount << " draws in " << capture.batches.size()
+                  << " batches, " << capture.width << "x" << capture.height
+                  << ", " << capture.samples << " samples" << std::endl;
+        std::cout << "GPU ms over " << times.frameCount
+                  << " frames: min " << times.minMs << ", median "
+                  << times.medianMs << ", mean " << times.meanMs << ", max "
+                  << times.maxMs << std::endl;
+      }};
+  args::Command microbench{commands, "microbench",
+      "Time the CPU kernels of the viewer on synthetic fixtures and on a "
+      "model",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> model{
+            parser, "model", "Optional glTF file used as a fixture"};
+        args::ValueFlag<double> minTime{parser, "min-time",
+            "Minimum duration of a timed run, in seconds (default: 0.2)",
+            {"min-time"}};
+        args::ValueFlag<std::string> filter{parser, "filter",
+            "Only run the benchmarks whose name contains this string",
+            {"filter"}};
+        args::ValueFlag<int32_t> threads{parser, "threads",
+            "Number of threads of multi-threaded variants (default: one "
+            "per hardware thread)",
+            {"threads"}};
+        args::ValueFlag<std::string> pinThreads{parser, "pin-threads",
+            "Pin the threads of multi-threaded variants: none (default), "
+            "cores or numa",
+            {"pin-threads"}};
+        parser.Parse();
+
+        JobSystem::Options jobOptions;
+        if (threads) {
+          jobOptions.threadCount = size_t(std::max(args::get(threads), 1));
+        }
+        if (pinThreads) {
+          jobOptions.pinning = parseThreadPinning(args::get(pinThreads));
+        }
+        setJobSystemOptions(jobOptions);
+        Microbenchmarks benchmarks{
+            minTime ? std::max(args::get(minTime), 1e-3) : 0.2,
+            args::get(filter)};
+        std::string err;
+        if (!runKernelMicrobenchmarks(benchmarks, args::get(model), err)) {
+          std::cerr << "Error: " << err << std::endl;
+          returnCode = 1;
+        }
+
+        // Lookat arguments of 100 cameras
+        std::string lookatArgs;
+        for (size_t i = 0; i < 900; ++i) {
+          lookatArgs += std::to_string(0.5f * float(i)) + ",";
+        }
+        benchmarks.run("split/lookat-900",
+            [&]() { doNotOptimize(split(lookatArgs, ",")); },
+            lookatArgs.size());
+        benchmarks.print(std::cout);
       }};
 
   try {
@@ -90,6 +1786,7 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  flushLog();
   return returnCode;
 }
 
@@ -107,4 +1804,101 @@ std::vector<std::string> split(const std::string &str, const std::string &delim)
     prev = pos + delim.length();
   } while (pos < str.length() && prev < str.length());
   return tokens;
-}
\ No newline at end of file
+}
+ShaderDefines parseShaderDefines(const std::vector<std::string> &args)
+{
+  ShaderDefines defines;
+  for (const auto &arg : args) {
+    const auto equal = arg.find('=');
+    if (equal == 0 || arg.empty()) {
+      throw args::ValidationError("Invalid --define " + arg);
+    }
+    defines[arg.substr(0, equal)] =
+        equal == std::string::npos ? "" : arg.substr(equal + 1);
+  }
+  return defines;
+}
+
+OitMode parseOitMode(const std::string &arg)
+{
+  if (arg == "weighted") {
+    return OitMode::WeightedBlended;
+  }
+  if (arg == "linked-list") {
+    return OitMode::LinkedList;
+  }
+  throw args::ValidationError("Invalid --oit " + arg);
+}
+
+CostBuckets parseCostBuckets(const std::string &arg)
+{
+  if (arg == "nodes") {
+    return CostBuckets::TopLevelNodes;
+  }
+  if (arg == "materials") {
+    return CostBuckets::Materials;
+  }
+  throw args::ValidationError("Invalid --cost-attribution " + arg);
+}
+
+GLDebugOutputMode parseGLDebugOutputMode(const std::string &arg)
+{
+  if (arg == "full") {
+    return GLDebugOutputMode::Full;
+  }
+  if (arg == "performance") {
+    return GLDebugOutputMode::Performance;
+  }
+  if (arg == "off") {
+    return GLDebugOutputMode::Off;
+  }
+  if (arg == "no-error") {
+    return GLDebugOutputMode::NoError;
+  }
+  throw args::ValidationError("Invalid --gl-debug " + arg);
+}
+
+LogLevel parseLogLevel(const std::string &arg)
+{
+  if (arg == "debug") {
+    return LogLevel::Debug;
+  }
+  if (arg == "info") {
+    return LogLevel::Info;
+  }
+  if (arg == "warning") {
+    return LogLevel::Warning;
+  }
+  if (arg == "error") {
+    return LogLevel::Error;
+  }
+  throw args::ValidationError("Invalid --log-level " + arg);
+}
+
+ThreadPinning parseThreadPinning(const std::string &arg)
+{
+  if (arg == "none") {
+    return ThreadPinning::None;
+  }
+  if (arg == "cores") {
+    return ThreadPinning::Cores;
+  }
+  if (arg == "numa") {
+    return ThreadPinning::NumaNodes;
+  }
+  throw args::ValidationError("Invalid --pin-threads " + arg);
+}
+
+SceneCacheCompression parseSceneCacheCompression(const std::string &arg)
+{
+  if (arg == "none") {
+    return SceneCacheCompression::None;
+  }
+  if (arg == "lz4") {
+    return SceneCacheCompression::Lz4;
+  }
+  if (arg == "lz4hc") {
+    return SceneCacheCompression::Lz4High;
+  }
+  throw args::ValidationError("Invalid --cache-compression " + arg);
+}
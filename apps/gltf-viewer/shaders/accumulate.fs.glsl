@@ -0,0 +1,13 @@
+#version 430
+
+// Pass of ProgressiveAccumulation: the frame, blended with the average of
+// the previous ones by a constant alpha of 1 / (frame count).
+
+layout(binding = 0) uniform sampler2D uFrame;
+
+out vec4 fColor;
+
+void main()
+{
+    fColor = vec4(texelFetch(uFrame, ivec2(gl_FragCoord.xy), 0).rgb, 1);
+}
@@ -0,0 +1,120 @@
+#version 430
+
+// Screen-space ambient occlusion, see AmbientOcclusion. One invocation per
+// texel of the occlusion, at 1 / uDivisor of the resolution of the depths
+// copied by the depth pre-pass. Writes the occlusion, blended with the
+// previous ones of the same view, and the view depth of the texel for the
+// depth-aware upsample of ambient_occlusion.glsl. With REVERSED_Z the depths
+// are reversed.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(rg16f, binding = 0) uniform writeonly image2D uDestination;
+
+layout(binding = 0) uniform sampler2D uDepth; // Level 0 of a DepthPyramid
+layout(binding = 1) uniform sampler2D uHistory; // Previous destination
+
+uniform mat4 uInvProjMatrix;
+uniform vec2 uDepthSize; // Used texels of uDepth, which may be larger
+uniform float uPixelsPerUnit; // Along y, at unit distance
+uniform float uRadius; // View space
+uniform int uDivisor;
+uniform uint uFrameIndex;
+uniform float uHistoryWeight;
+
+const int SAMPLE_COUNT = 12;
+const float GOLDEN_ANGLE = 2.39996323;
+// Ignore the occluders almost in the tangent plane, which are the
+// neighbours of the texel on flat surfaces tessellated with depth errors
+const float ANGLE_BIAS = 0.1;
+
+bool isBackground(float depth)
+{
+#ifdef REVERSED_Z
+    return depth <= 0.0;
+#else
+    return depth >= 1.0;
+#endif
+}
+
+vec3 getViewPosition(vec2 pixel, float depth)
+{
+#ifdef REVERSED_Z
+    float ndcZ = depth;
+#else
+    float ndcZ = 2.0 * depth - 1.0;
+#endif
+    vec2 ndcXY = 2.0 * pixel / uDepthSize - 1.0;
+    vec4 position = uInvProjMatrix * vec4(ndcXY, ndcZ, 1);
+    return position.xyz / position.w;
+}
+
+vec3 getViewPosition(ivec2 pixel)
+{
+    pixel = clamp(pixel, ivec2(0), ivec2(uDepthSize) - 1);
+    return getViewPosition(vec2(pixel) + 0.5, texelFetch(uDepth, pixel, 0).r);
+}
+
+// Per-pixel rotation of the samples, see "Next Generation Post Processing in
+// Call of Duty: Advanced Warfare" by Jorge Jimenez
+float interleavedGradientNoise(vec2 pixel)
+{
+    return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+
+float computeOcclusion(ivec2 pixel, vec3 position)
+{
+    // Differences with the neighbours on the same surface, the ones with the
+    // smallest depth difference
+    vec3 left = position - getViewPosition(pixel - ivec2(1, 0));
+    vec3 right = getViewPosition(pixel + ivec2(1, 0)) - position;
+    vec3 down = position - getViewPosition(pixel - ivec2(0, 1));
+    vec3 up = getViewPosition(pixel + ivec2(0, 1)) - position;
+    vec3 dx = abs(left.z) < abs(right.z) ? left : right;
+    vec3 dy = abs(down.z) < abs(up.z) ? down : up;
+    vec3 normal = normalize(cross(dx, dy));
+
+    // Spiral of samples within the projected radius, rotated per pixel and
+    // per frame so that accumulated frames sample other directions
+    float pixelRadius = uRadius * uPixelsPerUnit / -position.z;
+    float rotation = 6.28318531 * interleavedGradientNoise(vec2(pixel) / float(uDivisor)) +
+        GOLDEN_ANGLE * float(uFrameIndex);
+    float occlusion = 0.0;
+    for (int i = 0; i < SAMPLE_COUNT; ++i) {
+        float t = (float(i) + 0.5) / float(SAMPLE_COUNT);
+        float angle = rotation + GOLDEN_ANGLE * float(i);
+        vec2 offset = t * pixelRadius * vec2(cos(angle), sin(angle));
+        ivec2 samplePixel = ivec2(vec2(pixel) + 0.5 + offset);
+        vec3 v = getViewPosition(samplePixel) - position;
+        float distance2 = dot(v, v);
+        float cosine = dot(v, normal) * inversesqrt(max(distance2, 1e-8));
+        // Occluders beyond the radius fade out, so that the silhouettes of
+        // the foreground do not darken the background
+        float falloff = max(0.0, 1.0 - distance2 / (uRadius * uRadius));
+        occlusion += max(0.0, cosine - ANGLE_BIAS) * falloff;
+    }
+    return clamp(1.0 - occlusion / float(SAMPLE_COUNT), 0.0, 1.0);
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(uDestination);
+    if (any(greaterThanEqual(texel, size))) {
+        return;
+    }
+
+    // Center of the texel in the depths
+    ivec2 pixel = min(texel * uDivisor + uDivisor / 2, ivec2(uDepthSize) - 1);
+    float depth = texelFetch(uDepth, pixel, 0).r;
+    if (isBackground(depth)) {
+        imageStore(uDestination, texel, vec4(1, 0, 0, 0));
+        return;
+    }
+    vec3 position = getViewPosition(vec2(pixel) + 0.5, depth);
+    float occlusion = computeOcclusion(pixel, position);
+    if (uHistoryWeight > 0.0) {
+        occlusion = mix(occlusion, texelFetch(uHistory, texel, 0).r, uHistoryWeight);
+    }
+    imageStore(uDestination, texel, vec4(occlusion, -position.z, 0, 0));
+}
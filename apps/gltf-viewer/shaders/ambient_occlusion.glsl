@@ -0,0 +1,49 @@
+// Screen-space ambient occlusion computed by ambient_occlusion.cs.glsl before
+// the main pass, see AmbientOcclusion.
+
+// AmbientOcclusion::Uniforms
+layout(std140) uniform AmbientOcclusionUniforms
+{
+    vec4 uAmbientOcclusionViewport; // Origin in pixels, then inverse size
+    uvec4 uAmbientOcclusionInfo; // x: 1 if the occlusion is computed
+};
+
+// Occlusion and view depth, at a fraction of the resolution of the viewport
+layout(binding = 22) uniform sampler2D uAmbientOcclusion;
+
+// Occlusion of the fragment at fragCoord (window coordinates) of view depth
+// viewDepth, 1 without occlusion. The 4 texels around the fragment are
+// weighted by their bilinear weights and the similarity of their depth to
+// the one of the fragment, so that the edges of the foreground do not get the
+// occlusion of the background, and the other way around.
+float getAmbientOcclusion(vec2 fragCoord, float viewDepth)
+{
+    if (uAmbientOcclusionInfo.x == 0u) {
+        return 1.0;
+    }
+    ivec2 size = textureSize(uAmbientOcclusion, 0);
+    vec2 uv = (fragCoord - uAmbientOcclusionViewport.xy) * uAmbientOcclusionViewport.zw;
+    vec2 position = uv * vec2(size) - 0.5;
+    ivec2 first = ivec2(floor(position));
+    vec2 f = position - vec2(first);
+    float occlusion = 0.0;
+    float totalWeight = 0.0;
+    for (int y = 0; y < 2; ++y) {
+        for (int x = 0; x < 2; ++x) {
+            ivec2 texel = clamp(first + ivec2(x, y), ivec2(0), size - 1);
+            vec2 texelOcclusion = texelFetch(uAmbientOcclusion, texel, 0).rg;
+            float bilinear = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y);
+            // Relative, so that the tolerance grows with the depth precision
+            float depthWeight = 1.0 / (1e-3 + abs(texelOcclusion.g - viewDepth) / viewDepth);
+            float weight = bilinear * depthWeight;
+            occlusion += texelOcclusion.r * weight;
+            totalWeight += weight;
+        }
+    }
+    // No texel at the depth of the fragment, such as the transparent
+    // fragments, missing from the depth pre-pass
+    if (totalWeight < 10.0) {
+        return 1.0;
+    }
+    return occlusion / totalWeight;
+}
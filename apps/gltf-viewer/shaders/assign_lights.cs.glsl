@@ -0,0 +1,83 @@
+#version 430
+
+// Light assignment of clustered lighting (see LightClusters::update), one
+// invocation per cluster: list the local lights whose sphere of influence
+// overlaps the view space bounds of the cluster. The lights are read in
+// batches shared by the invocations of a group.
+
+#define ASSIGN_LIGHTS
+#include "lights.glsl"
+
+#define GROUP_SIZE 64
+
+layout(local_size_x = GROUP_SIZE) in;
+
+shared vec4 sLightSpheres[GROUP_SIZE];
+
+// View depth of the near plane of a slice, the first slice starts at the eye
+// and the last one ends at the far depth
+float getSliceDepth(uint slice)
+{
+    if (slice == 0u) {
+        return 0.0;
+    }
+    if (slice >= uClusterGrid.z) {
+        return uClusterDepths.w;
+    }
+    return exp((float(slice) - uClusterDepths.y) / uClusterDepths.x);
+}
+
+void main()
+{
+    uint clusterCount = uClusterGrid.x * uClusterGrid.y * uClusterGrid.z;
+    uint clusterIdx = gl_GlobalInvocationID.x;
+    // Invocations past the last cluster still load lights for their group
+    bool isCluster = clusterIdx < clusterCount;
+
+    // Bounds of the cluster: its tile spans a rectangle of NDC, whose view
+    // positions at depth d are d times those at depth 1
+    uvec3 cell = uvec3(clusterIdx % uClusterGrid.x,
+        (clusterIdx / uClusterGrid.x) % uClusterGrid.y,
+        clusterIdx / (uClusterGrid.x * uClusterGrid.y));
+    vec2 ndcMin = vec2(cell.xy) / vec2(uClusterGrid.xy) * 2.0 - 1.0;
+    vec2 ndcMax = vec2(cell.xy + 1u) / vec2(uClusterGrid.xy) * 2.0 - 1.0;
+    vec2 viewMin = ndcMin * uNdcToView.xy + uNdcToView.zw;
+    vec2 viewMax = ndcMax * uNdcToView.xy + uNdcToView.zw;
+    float nearDepth = getSliceDepth(cell.z);
+    float farDepth = getSliceDepth(cell.z + 1u);
+    vec3 boundsMin = vec3(min(min(viewMin * nearDepth, viewMin * farDepth),
+                              min(viewMax * nearDepth, viewMax * farDepth)),
+        -farDepth);
+    vec3 boundsMax = vec3(max(max(viewMin * nearDepth, viewMin * farDepth),
+                              max(viewMax * nearDepth, viewMax * farDepth)),
+        -nearDepth);
+
+    uint firstLight = uLightCounts.x;
+    uint localCount = uLightCounts.y;
+    uint base = clusterIdx * getClusterStride();
+    uint count = 0u;
+    for (uint batch = 0u; batch < localCount; batch += GROUP_SIZE) {
+        uint loadIdx = batch + gl_LocalInvocationIndex;
+        if (loadIdx < localCount) {
+            Light light = uLights[firstLight + loadIdx];
+            sLightSpheres[gl_LocalInvocationIndex] = vec4(light.position, light.range);
+        }
+        memoryBarrierShared();
+        barrier();
+
+        uint batchCount = min(uint(GROUP_SIZE), localCount - batch);
+        for (uint i = 0u; isCluster && i < batchCount; ++i) {
+            vec4 sphere = sLightSpheres[i];
+            vec3 closest = clamp(sphere.xyz, boundsMin, boundsMax);
+            vec3 offset = closest - sphere.xyz;
+            if (dot(offset, offset) <= sphere.w * sphere.w && count < uClusterGrid.w) {
+                uClusterLights[base + 1u + count] = firstLight + batch + i;
+                ++count;
+            }
+        }
+        barrier();
+    }
+    if (isCluster) {
+        uClusterLights[base] = count;
+    }
+}
@@ -0,0 +1,76 @@
+#version 430
+
+// Bloom of PostProcessing, one invocation per texel of level uSourceLevel + 1
+// (DOWNSAMPLE) or uSourceLevel - 1 of the mip chain of the bloom. With
+// DOWNSAMPLE, level 0 keeps the part of the exposed HDR frame above
+// uThreshold (uSourceLevel -1), then each level is filtered down from the
+// one above it. Otherwise each level adds the one below it, upsampled with a
+// tent filter, so that level 0 ends up with the sum of the blurs of every
+// level.
+
+#ifdef DOWNSAMPLE
+#include "exposure.glsl"
+#endif
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+#ifdef DOWNSAMPLE
+layout(rgba16f, binding = 0) uniform writeonly image2D uDestination;
+#else
+layout(rgba16f, binding = 0) uniform image2D uDestination;
+#endif
+
+uniform sampler2D uSource; // HDR frame or the bloom itself, bilinear
+uniform int uSourceLevel;
+#ifdef DOWNSAMPLE
+uniform float uThreshold;
+#endif
+
+vec3 sampleSource(vec2 uv)
+{
+    return textureLod(uSource, uv, float(max(uSourceLevel, 0))).rgb;
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(uDestination);
+    if (any(greaterThanEqual(texel, size))) {
+        return;
+    }
+    vec2 uv = (vec2(texel) + 0.5) / vec2(size);
+    vec2 sourceTexel = 1.0 / vec2(textureSize(uSource, max(uSourceLevel, 0)));
+
+#ifdef DOWNSAMPLE
+    // The 4 x 4 source texels around the texel, by bilinear samples of
+    // 2 x 2 texels, weighted towards the center
+    vec3 color = 0.5 * sampleSource(uv) +
+        0.125 * (sampleSource(uv + vec2(-1, -1) * sourceTexel) +
+                 sampleSource(uv + vec2(1, -1) * sourceTexel) +
+                 sampleSource(uv + vec2(-1, 1) * sourceTexel) +
+                 sampleSource(uv + vec2(1, 1) * sourceTexel));
+    if (uSourceLevel < 0) {
+        // Soft threshold, so that bright pixels do not pop in
+        color *= getExposure();
+        float brightness = max(color.r, max(color.g, color.b));
+        float knee = 0.5 * uThreshold;
+        float soft = clamp(brightness - uThreshold + knee, 0.0, 2.0 * knee);
+        soft = soft * soft / (4.0 * knee + 1e-4);
+        color *= max(soft, brightness - uThreshold) / max(brightness, 1e-4);
+    }
+    imageStore(uDestination, texel, vec4(color, 1));
+#else
+    // 3 x 3 tent around the texel
+    vec3 color = 4.0 * sampleSource(uv);
+    color += 2.0 * (sampleSource(uv + vec2(-1, 0) * sourceTexel) +
+                    sampleSource(uv + vec2(1, 0) * sourceTexel) +
+                    sampleSource(uv + vec2(0, -1) * sourceTexel) +
+                    sampleSource(uv + vec2(0, 1) * sourceTexel));
+    color += sampleSource(uv + vec2(-1, -1) * sourceTexel) +
+        sampleSource(uv + vec2(1, -1) * sourceTexel) +
+        sampleSource(uv + vec2(-1, 1) * sourceTexel) +
+        sampleSource(uv + vec2(1, 1) * sourceTexel);
+    color /= 16.0;
+    imageStore(uDestination, texel, imageLoad(uDestination, texel) + vec4(color, 0));
+#endif
+}
@@ -0,0 +1,22 @@
+// Matrices of the view, uploaded once per renderScene call (see
+// ViewerApplication::renderScene) and shared by the scene programs with
+// #include "camera.glsl"
+
+// The model matrices of the draws (see DrawUniforms in forward.vs.glsl) are
+// relative to the eye, so that scenes far from the origin keep their float
+// precision: uEyeViewMatrix and uEyeViewProjMatrix transform them.
+layout(std140) uniform CameraUniforms
+{
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    mat4 uViewProjMatrix;
+    mat4 uInverseViewMatrix;
+    mat4 uInverseProjMatrix;
+    mat4 uPreviousViewProjMatrix; // Of the previous frame
+    mat4 uEyeViewMatrix; // Rotation part of uViewMatrix
+    mat4 uEyeViewProjMatrix; // uProjMatrix * uEyeViewMatrix
+    vec4 uEye; // World space position of the camera, w = 1
+    // Offset of uProjMatrix in normalized device coordinates (xy): the sub
+    // pixel jitter of the temporal anti-aliasing, or that of a tile
+    vec4 uJitter;
+};
@@ -0,0 +1,194 @@
+#version 430
+
+// Frustum, normal cone and occlusion culling of the draws of an
+// IndirectDrawList, one invocation per draw (see IndirectDrawList::cull).
+// Draws with a normal cone (meshlets, see Meshlet) are culled when every
+// triangle faces away from uCameraPosition.
+//
+// With COMPACT_DRAWS the visible commands of each batch are packed at the
+// beginning of the batch range and counted in uDrawCounts, to be drawn with
+// glMultiDrawElementsIndirectCount. Otherwise every command is copied in
+// place with an instanceCount of 0 if it is culled.
+//
+// With OCCLUSION_CULLING, uPhase selects a phase of two-phase occlusion
+// culling (see IndirectDrawList::CullPhase): phase 1 keeps the draws that
+// were visible in the previous frame, phase 2 tests every draw against the
+// depth pyramid built after phase 1, updates uVisibility for the next frame
+// and keeps the visible draws that phase 1 skipped. REVERSED_Z must be
+// defined if depths are reversed, with a [0, 1] clip space depth.
+
+layout(local_size_x = 64) in;
+
+struct DrawElementsIndirectCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+struct DrawBounds
+{
+    vec3 bboxMin; // World space box of the draw
+    uint batch; // Index of the batch of the draw
+    vec3 bboxMax;
+    uint batchBegin; // Index of the first command of the batch
+    vec4 cone; // World space normal cone axis and cutoff, never culls if > 1
+};
+
+layout(std430, binding = 1) readonly buffer Commands
+{
+    DrawElementsIndirectCommand uCommands[];
+};
+
+layout(std430, binding = 2) readonly buffer Bounds
+{
+    DrawBounds uBounds[];
+};
+
+layout(std430, binding = 3) writeonly buffer CulledCommands
+{
+    DrawElementsIndirectCommand uCulledCommands[];
+};
+
+layout(std430, binding = 4) buffer DrawCounts
+{
+    uint uDrawCounts[]; // One per batch, cleared before the dispatch
+};
+
+uniform uint uDrawCount;
+uniform vec4 uFrustumPlanes[6]; // See extractFrustum
+uniform vec3 uCameraPosition; // World space
+
+#ifdef OCCLUSION_CULLING
+layout(std430, binding = 5) buffer Visibility
+{
+    uint uVisibility[]; // Per draw, 1 if visible in the previous frame
+};
+
+uniform uint uPhase; // 0 is frustum culling only
+uniform mat4 uViewProjMatrix;
+uniform sampler2D uDepthPyramid; // See DepthPyramid
+// Used texels of level 0 and levels of uDepthPyramid, which may be larger
+uniform vec2 uDepthPyramidSize;
+uniform int uDepthPyramidLevelCount;
+
+// Return true if the box is behind the depths of uDepthPyramid
+bool isOccluded(vec3 bboxMin, vec3 bboxMax)
+{
+    // Screen rectangle and nearest depth of the box
+    vec3 ndcMin = vec3(1);
+    vec3 ndcMax = vec3(-1);
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+        vec4 clip = uViewProjMatrix * vec4(mix(bboxMin, bboxMax, corner), 1);
+        if (clip.w <= 0) {
+            return false; // Crosses the camera plane
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+    vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0, 1);
+    vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0, 1);
+#ifdef REVERSED_Z
+    float nearestDepth = ndcMax.z;
+#else
+    float nearestDepth = ndcMin.z * 0.5 + 0.5;
+#endif
+
+    // Level where the rectangle covers at most 2x2 texels
+    vec2 extent = (uvMax - uvMin) * uDepthPyramidSize;
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1)))), 0,
+        uDepthPyramidLevelCount - 1);
+
+    ivec2 size = max(ivec2(uDepthPyramidSize) >> level, ivec2(1));
+    ivec2 texelMin = clamp(ivec2(uvMin * vec2(size)), ivec2(0), size - 1);
+    ivec2 texelMax = clamp(ivec2(uvMax * vec2(size)), ivec2(0), size - 1);
+#ifdef REVERSED_Z
+    float farthestDepth = 1;
+    for (int y = texelMin.y; y <= texelMax.y; ++y) {
+        for (int x = texelMin.x; x <= texelMax.x; ++x) {
+            farthestDepth = min(farthestDepth,
+                texelFetch(uDepthPyramid, ivec2(x, y), level).r);
+        }
+    }
+    return nearestDepth < farthestDepth;
+#else
+    float farthestDepth = 0;
+    for (int y = texelMin.y; y <= texelMax.y; ++y) {
+        for (int x = texelMin.x; x <= texelMax.x; ++x) {
+            farthestDepth = max(farthestDepth,
+                texelFetch(uDepthPyramid, ivec2(x, y), level).r);
+        }
+    }
+    return nearestDepth > farthestDepth;
+#endif
+}
+#endif
+
+bool intersectsFrustum(vec3 bboxMin, vec3 bboxMax)
+{
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = uFrustumPlanes[i];
+        // Corner of the box the furthest along the plane normal
+        vec3 corner = mix(bboxMin, bboxMax, greaterThanEqual(plane.xyz, vec3(0)));
+        if (dot(plane.xyz, corner) + plane.w < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Return true if the triangles of the box, with the normal cone, all face
+// away from the camera (the test of Meshlet, with the sphere of the box)
+bool isBackFacing(vec3 bboxMin, vec3 bboxMax, vec4 cone)
+{
+    if (cone.w > 1) {
+        return false;
+    }
+    vec3 center = 0.5 * (bboxMin + bboxMax);
+    float radius = 0.5 * length(bboxMax - bboxMin);
+    vec3 toCenter = center - uCameraPosition;
+    return dot(toCenter, cone.xyz) >=
+        cone.w * (length(toCenter) + radius) + radius;
+}
+
+void main()
+{
+    uint drawIdx = gl_GlobalInvocationID.x;
+    if (drawIdx >= uDrawCount) {
+        return;
+    }
+
+    DrawBounds bounds = uBounds[drawIdx];
+    DrawElementsIndirectCommand command = uCommands[drawIdx];
+    bool isVisible = intersectsFrustum(bounds.bboxMin, bounds.bboxMax) &&
+        !isBackFacing(bounds.bboxMin, bounds.bboxMax, bounds.cone);
+
+#ifdef OCCLUSION_CULLING
+    if (uPhase == 1u) {
+        isVisible = isVisible && uVisibility[drawIdx] != 0u;
+    } else if (uPhase == 2u) {
+        isVisible = isVisible && !isOccluded(bounds.bboxMin, bounds.bboxMax);
+        bool wasVisible = uVisibility[drawIdx] != 0u;
+        uVisibility[drawIdx] = isVisible ? 1u : 0u;
+        // Draws visible in the previous frame and in the frustum were drawn
+        // by phase 1
+        isVisible = isVisible && !wasVisible;
+    }
+#endif
+
+#ifdef COMPACT_DRAWS
+    if (isVisible) {
+        uint slot = atomicAdd(uDrawCounts[bounds.batch], 1u);
+        uCulledCommands[bounds.batchBegin + slot] = command;
+    }
+#else
+    if (!isVisible) {
+        command.instanceCount = 0;
+    }
+    uCulledCommands[drawIdx] = command;
+#endif
+}
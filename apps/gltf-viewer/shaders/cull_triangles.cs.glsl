@@ -0,0 +1,218 @@
+#version 430
+
+// Triangle culling of the meshlet draws kept by cull_draws.cs.glsl, one work
+// group per command of the culled command buffer (see
+// IndirectDrawList::cullTriangles). Triangles facing away from the camera
+// (for single-sided materials) and triangles whose screen bounds contain no
+// sample are removed before rasterization: the kept ones are copied in order
+// to the range of the draw in uCulledIndices, and the command is rewritten
+// to draw them from there.
+//
+// COMPACT_DRAWS must be defined as for cull_draws.cs.glsl, and
+// QUANTIZED_VERTICES as for the vertex shaders (see vertex_pulling.glsl).
+
+#define GROUP_SIZE 128
+
+layout(local_size_x = GROUP_SIZE) in;
+
+struct DrawElementsIndirectCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+// Same as in forward_indirect.vs.glsl
+struct DrawTransform
+{
+    mat4 modelMatrix;
+    mat4 normalMatrix;
+};
+
+// Same as in cull_draws.cs.glsl
+struct DrawBounds
+{
+    vec3 bboxMin;
+    uint batch;
+    vec3 bboxMax;
+    uint batchBegin;
+    vec4 cone;
+};
+
+struct TriangleDraw
+{
+    uint firstIndex; // In uCulledIndices, NO_TRIANGLES if not culled
+    uint isSingleSided; // 1 if back faces can be culled
+};
+
+#define NO_TRIANGLES 0xffffffffu
+
+layout(std430, binding = 0) readonly buffer DrawTransforms
+{
+    DrawTransform uDrawTransforms[];
+};
+
+layout(std430, binding = 1) readonly buffer TriangleDraws
+{
+    TriangleDraw uTriangleDraws[]; // Per draw
+};
+
+layout(std430, binding = 2) readonly buffer Bounds
+{
+    DrawBounds uBounds[];
+};
+
+layout(std430, binding = 3) buffer CulledCommands
+{
+    DrawElementsIndirectCommand uCulledCommands[];
+};
+
+layout(std430, binding = 4) readonly buffer DrawCounts
+{
+    uint uDrawCounts[]; // One per batch, written by cull_draws.cs.glsl
+};
+
+layout(std430, binding = 5) writeonly buffer CulledIndices
+{
+    uint uCulledIndices[];
+};
+
+layout(std430, binding = 6) buffer CulledTriangleCount
+{
+    uint uCulledTriangleCount;
+};
+
+// GeometryArena::INDEX_STORAGE_BINDING
+layout(std430, binding = 12) readonly buffer Indices
+{
+    uint uIndices[];
+};
+
+#include "vertex_pulling.glsl"
+
+uniform uint uDrawCount; // Dispatched groups may be more, in rows
+uniform mat4 uViewProjMatrix;
+uniform vec2 uViewportSize;
+// False when the target has several samples per pixel, which are not at
+// the pixel centers the small triangle test assumes
+uniform bool uPixelCenterSamples;
+uniform bool uShortIndices;
+
+shared uint sOffsets[GROUP_SIZE];
+
+uint fetchIndex(uint i)
+{
+    if (uShortIndices) {
+        uint word = uIndices[i >> 1u];
+        return (i & 1u) == 0u ? word & 0xffffu : word >> 16u;
+    }
+    return uIndices[i];
+}
+
+// Return true if the triangle of clip space vertices may cover a sample of a
+// front face
+bool isTriangleVisible(vec4 c0, vec4 c1, vec4 c2, bool isSingleSided)
+{
+    if (c0.w <= 0 || c1.w <= 0 || c2.w <= 0) {
+        return true; // Crosses the camera plane, clipped by the rasterizer
+    }
+    vec2 p0 = (c0.xy / c0.w * 0.5 + 0.5) * uViewportSize;
+    vec2 p1 = (c1.xy / c1.w * 0.5 + 0.5) * uViewportSize;
+    vec2 p2 = (c2.xy / c2.w * 0.5 + 0.5) * uViewportSize;
+
+    // Counter-clockwise front faces have a positive area, a zero area covers
+    // no sample whatever the sides
+    vec2 e1 = p1 - p0;
+    vec2 e2 = p2 - p0;
+    float area = e1.x * e2.y - e1.y * e2.x;
+    if (area == 0 || (isSingleSided && area < 0)) {
+        return false;
+    }
+
+    if (uPixelCenterSamples) {
+        // Pixel centers are at half integers: none is inside the bounds if
+        // they lie between two of them on an axis. The margin covers the
+        // snapping of the rasterizer to its sub-pixel grid.
+        const float margin = 1.0 / 256.0;
+        vec2 boundsMin = min(min(p0, p1), p2) - 0.5 - margin;
+        vec2 boundsMax = max(max(p0, p1), p2) - 0.5 + margin;
+        if (any(lessThan(floor(boundsMax), ceil(boundsMin)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// TriangleDraw of the command in slot, with a NO_TRIANGLES firstIndex if the
+// slot holds no command to cull
+TriangleDraw getTriangleDraw(uint slot, DrawElementsIndirectCommand command)
+{
+    TriangleDraw none = TriangleDraw(NO_TRIANGLES, 0u);
+    if (slot >= uDrawCount) {
+        return none;
+    }
+#ifdef COMPACT_DRAWS
+    // Slots past the count of their batch hold stale commands
+    DrawBounds bounds = uBounds[slot];
+    if (slot - bounds.batchBegin >= uDrawCounts[bounds.batch]) {
+        return none;
+    }
+#else
+    if (command.instanceCount == 0u) {
+        return none;
+    }
+#endif
+    return uTriangleDraws[command.baseInstance];
+}
+
+void main()
+{
+    // Work groups without a command go through the barriers with no triangle
+    uint slot = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    DrawElementsIndirectCommand command =
+        uCulledCommands[min(slot, uDrawCount - 1u)];
+    TriangleDraw draw = getTriangleDraw(slot, command);
+    uint triangleCount = draw.firstIndex != NO_TRIANGLES
+        ? min(command.count / 3u, uint(GROUP_SIZE))
+        : 0u;
+    uint drawIdx = command.baseInstance;
+
+    uint triangle = gl_LocalInvocationID.x;
+    uvec3 indices = uvec3(0);
+    bool isKept = false;
+    if (triangle < triangleCount) {
+        uint first = command.firstIndex + 3u * triangle;
+        indices = uvec3(fetchIndex(first), fetchIndex(first + 1u),
+            fetchIndex(first + 2u));
+        mat4 matrix = uViewProjMatrix * uDrawTransforms[drawIdx].modelMatrix;
+        vec4 c0 = matrix * vec4(pullPosition(int(indices.x) + command.baseVertex), 1);
+        vec4 c1 = matrix * vec4(pullPosition(int(indices.y) + command.baseVertex), 1);
+        vec4 c2 = matrix * vec4(pullPosition(int(indices.z) + command.baseVertex), 1);
+        isKept = isTriangleVisible(c0, c1, c2, draw.isSingleSided != 0u);
+    }
+
+    // Inclusive prefix sum of the kept triangles, their order is kept
+    sOffsets[triangle] = isKept ? 1u : 0u;
+    barrier();
+    for (uint stride = 1u; stride < uint(GROUP_SIZE); stride *= 2u) {
+        uint value = triangle >= stride ? sOffsets[triangle - stride] : 0u;
+        barrier();
+        sOffsets[triangle] += value;
+        barrier();
+    }
+
+    if (isKept) {
+        uint i = draw.firstIndex + 3u * (sOffsets[triangle] - 1u);
+        uCulledIndices[i] = indices.x;
+        uCulledIndices[i + 1u] = indices.y;
+        uCulledIndices[i + 2u] = indices.z;
+    }
+    if (triangle == 0u && draw.firstIndex != NO_TRIANGLES) {
+        uint keptCount = sOffsets[GROUP_SIZE - 1];
+        uCulledCommands[slot].count = 3u * keptCount;
+        uCulledCommands[slot].firstIndex = draw.firstIndex;
+        atomicAdd(uCulledTriangleCount, triangleCount - keptCount);
+    }
+}
@@ -0,0 +1,48 @@
+#version 430
+
+// Geometry shader of the debug views measuring triangles (see DEBUG_VIEWS in
+// ViewerApplication.cpp): passes the attributes of the vertex shader through
+// and adds the area of the triangle in normalized device coordinates, which
+// the fragment shader converts to pixels with the derivatives of gNdcPosition
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec3 vViewSpacePosition[];
+in vec3 vViewSpaceNormal[];
+in vec2 vTexCoords[];
+flat in uint vMaterialID[];
+
+out vec3 gViewSpacePosition;
+out vec3 gViewSpaceNormal;
+out vec2 gTexCoords;
+flat out uint gMaterialID;
+noperspective out vec2 gNdcPosition;
+flat out float gNdcArea;
+
+void main()
+{
+   // Triangles crossing the eye plane have no meaningful area, they count
+   // as large
+   vec2 ndc[3];
+   bool isInFront = true;
+   for (int i = 0; i < 3; ++i) {
+      isInFront = isInFront && gl_in[i].gl_Position.w > 0;
+      ndc[i] = gl_in[i].gl_Position.xy / max(abs(gl_in[i].gl_Position.w), 1e-8);
+   }
+   vec2 e1 = ndc[1] - ndc[0];
+   vec2 e2 = ndc[2] - ndc[0];
+   float area = isInFront ? 0.5 * abs(e1.x * e2.y - e1.y * e2.x) : 4.0;
+
+   for (int i = 0; i < 3; ++i) {
+      gl_Position = gl_in[i].gl_Position;
+      gViewSpacePosition = vViewSpacePosition[i];
+      gViewSpaceNormal = vViewSpaceNormal[i];
+      gTexCoords = vTexCoords[i];
+      gMaterialID = vMaterialID[i];
+      gNdcPosition = ndc[i];
+      gNdcArea = area;
+      EmitVertex();
+   }
+   EndPrimitive();
+}
@@ -0,0 +1,125 @@
+#version 430
+
+// Lighting pass of deferred shading (see GBuffer::shade), one invocation per
+// pixel in tiles of TILE_SIZE x TILE_SIZE pixels: the invocations of a tile
+// find the depth range of its pixels, list the local lights whose sphere of
+// influence overlaps the view space bounds of the tile, then each shades its
+// pixel with the directional lights and the lights of the list. With
+// REVERSED_Z the depth buffer is in [0, 1] and 0 is the farthest.
+
+#include "lights.glsl"
+#include "gbuffer.glsl"
+
+#define TILE_SIZE 16
+#define MAX_TILE_LIGHTS 256
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+layout(binding = 0) uniform sampler2D uBaseColorMetallic;
+layout(binding = 1) uniform sampler2D uNormalRoughness;
+layout(binding = 2) uniform sampler2D uRadiance;
+layout(binding = 3) uniform sampler2D uDepth;
+
+layout(rgba8, binding = 0) uniform writeonly image2D uOutput;
+
+uniform mat4 uInvProjMatrix;
+uniform vec2 uSize; // Of the viewport, the G-buffer may be larger
+
+// View depths as uint, which keeps the order of positive floats
+shared uint sMinDepth;
+shared uint sMaxDepth;
+shared uint sLightCount;
+shared uint sLights[MAX_TILE_LIGHTS];
+
+void main()
+{
+    ivec2 size = ivec2(uSize);
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    // Invocations past the edges still take part in the light culling
+    bool isInside = all(lessThan(pixel, size));
+    ivec2 texel = min(pixel, size - 1);
+    if (gl_LocalInvocationIndex == 0u) {
+        sMinDepth = 0xffffffffu;
+        sMaxDepth = 0u;
+        sLightCount = 0u;
+    }
+    barrier();
+
+    float depth = texelFetch(uDepth, texel, 0).r;
+#ifdef REVERSED_Z
+    bool isBackground = depth == 0.0;
+    float ndcDepth = depth;
+#else
+    bool isBackground = depth == 1.0;
+    float ndcDepth = depth * 2.0 - 1.0;
+#endif
+    vec2 ndc = (vec2(texel) + 0.5) / vec2(size) * 2.0 - 1.0;
+    vec4 position = uInvProjMatrix * vec4(ndc, ndcDepth, 1);
+    vec3 viewPosition = position.xyz / position.w;
+    if (isInside && !isBackground) {
+        atomicMin(sMinDepth, floatBitsToUint(-viewPosition.z));
+        atomicMax(sMaxDepth, floatBitsToUint(-viewPosition.z));
+    }
+    barrier();
+
+    // Same for every invocation of the group
+    uint firstLight = uLightCounts.x;
+    uint localCount = uLightCounts.y;
+    if (localCount > 0u && sMinDepth <= sMaxDepth) {
+        // The tile spans a rectangle of NDC, whose view positions at depth d
+        // are d times those at depth 1
+        vec2 ndcMin = vec2(gl_WorkGroupID.xy * TILE_SIZE) / vec2(size) * 2.0 - 1.0;
+        vec2 ndcMax = vec2((gl_WorkGroupID.xy + 1u) * TILE_SIZE) / vec2(size) * 2.0 - 1.0;
+        vec2 viewMin = ndcMin * uNdcToView.xy + uNdcToView.zw;
+        vec2 viewMax = ndcMax * uNdcToView.xy + uNdcToView.zw;
+        float nearDepth = uintBitsToFloat(sMinDepth);
+        float farDepth = uintBitsToFloat(sMaxDepth);
+        vec3 boundsMin = vec3(min(min(viewMin * nearDepth, viewMin * farDepth),
+                                  min(viewMax * nearDepth, viewMax * farDepth)),
+            -farDepth);
+        vec3 boundsMax = vec3(max(max(viewMin * nearDepth, viewMin * farDepth),
+                                  max(viewMax * nearDepth, viewMax * farDepth)),
+            -nearDepth);
+        for (uint i = gl_LocalInvocationIndex; i < localCount; i += TILE_SIZE * TILE_SIZE) {
+            Light light = uLights[firstLight + i];
+            vec3 offset = clamp(light.position, boundsMin, boundsMax) - light.position;
+            if (dot(offset, offset) <= light.range * light.range) {
+                uint slot = atomicAdd(sLightCount, 1u);
+                if (slot < MAX_TILE_LIGHTS) {
+                    sLights[slot] = firstLight + i;
+                }
+            }
+        }
+    }
+    barrier();
+
+    if (!isInside) {
+        return;
+    }
+    vec3 color = texelFetch(uRadiance, texel, 0).rgb;
+    if (!isBackground && firstLight + localCount > 0u) {
+        vec4 baseColorMetallic = texelFetch(uBaseColorMetallic, texel, 0);
+        vec4 normalRoughness = texelFetch(uNormalRoughness, texel, 0);
+        vec3 baseColor = baseColorMetallic.rgb;
+        float metallic = baseColorMetallic.a;
+        vec3 normal = decodeOctahedral(normalRoughness.xy);
+        float roughness = normalRoughness.z;
+        vec3 viewDir = normalize(-viewPosition);
+        for (uint i = 0u; i < firstLight; ++i) {
+            vec3 lightDir;
+            vec3 radiance = getLightRadiance(uLights[i], true, viewPosition, lightDir);
+            if (i == 0u) {
+                radiance *= getShadow(viewPosition, normal);
+            }
+            color += shadeLight(radiance, lightDir, viewDir, normal, baseColor, metallic, roughness);
+        }
+        uint count = min(sLightCount, uint(MAX_TILE_LIGHTS));
+        for (uint i = 0u; i < count; ++i) {
+            vec3 lightDir;
+            vec3 radiance = getLightRadiance(uLights[sLights[i]], false, viewPosition, lightDir);
+            radiance *= getLocalShadow(sLights[i], viewPosition, normal);
+            color += shadeLight(radiance, lightDir, viewDir, normal, baseColor, metallic, roughness);
+        }
+    }
+    imageStore(uOutput, pixel, vec4(color, 1));
+}
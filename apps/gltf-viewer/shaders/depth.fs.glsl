@@ -0,0 +1,24 @@
+#version 430
+
+// Depth pre-pass, color writes are masked. Compiled with ALPHA_MASK for the
+// masked materials alone, so that opaque ones are drawn by a program that
+// never discards and keeps the depth test early.
+
+#ifdef ALPHA_MASK
+#include "materials.glsl"
+
+in vec2 vTexCoords;
+flat in uint vMaterialID;
+#endif
+
+void main()
+{
+#ifdef ALPHA_MASK
+    Material material = uMaterials[vMaterialID];
+    float alpha = material.baseColorFactor.a *
+        sampleMaterialTexture(material, BASE_COLOR_TEXTURE, vTexCoords, vec4(1)).a;
+    if (alpha < material.alphaCutoff) {
+        discard;
+    }
+#endif
+}
@@ -0,0 +1,48 @@
+#version 430
+
+// Depth pre-pass (see ViewerApplication::renderScene): positions only, read
+// from GeometryArena::bindPositions, transformed exactly as forward.vs.glsl
+// does so that the main pass finds the same depths. With ALPHA_MASK, masked
+// materials are alpha tested by depth.fs.glsl: their vertices are read from
+// GeometryArena::bind instead, with their texture coordinates.
+
+#ifdef ALPHA_MASK
+#include "vertex_attributes.glsl"
+
+out vec2 vTexCoords;
+flat out uint vMaterialID;
+#else
+layout(location = 0) in vec3 aPosition;
+#endif
+
+#ifdef SKINNED
+#include "skinning.glsl"
+layout(location = 13) in uvec4 aJoints;
+layout(location = 14) in vec4 aWeights;
+#endif
+
+// Same block as forward.vs.glsl
+layout(std140) uniform DrawUniforms
+{
+    mat4 uModelMatrix;
+    mat4 uNormalMatrix;
+    mat4 uPreviousModelMatrix;
+};
+
+#include "camera.glsl"
+
+invariant gl_Position;
+
+void main()
+{
+#ifdef SKINNED
+    vec4 position = getSkinMatrix(aJoints, aWeights) * vec4(aPosition, 1);
+#else
+    vec4 position = vec4(aPosition, 1);
+#endif
+    gl_Position = uEyeViewProjMatrix * (uModelMatrix * position);
+#ifdef ALPHA_MASK
+    vTexCoords = aTexCoords;
+    vMaterialID = aMaterialID;
+#endif
+}
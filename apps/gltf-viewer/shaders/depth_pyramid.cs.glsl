@@ -0,0 +1,58 @@
+#version 430
+
+// Build the levels of a DepthPyramid, one invocation per texel of the written
+// level. With COPY_DEPTH level 0 is copied from the depth texture, otherwise
+// level uSourceLevel + 1 is reduced from level uSourceLevel. With REVERSED_Z
+// the farthest depth is the smallest one.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(r32f, binding = 0) uniform writeonly image2D uDestination;
+
+uniform sampler2D uSource; // Depth texture or the pyramid itself
+uniform int uSourceLevel;
+// Used texels of the written and the source levels, the textures may be
+// larger
+uniform vec2 uSize;
+uniform vec2 uSourceSize;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = ivec2(uSize);
+    if (any(greaterThanEqual(texel, size))) {
+        return;
+    }
+
+#ifdef COPY_DEPTH
+    float depth = texelFetch(uSource, texel, 0).r;
+#else
+    // 2x2 texels, plus the last row or column of odd sized levels so that
+    // no source texel is skipped
+    ivec2 sourceSize = ivec2(uSourceSize);
+    ivec2 first = 2 * texel;
+    ivec2 last = min(first + ivec2(1), sourceSize - 1);
+    if (texel.x == size.x - 1) {
+        last.x = sourceSize.x - 1;
+    }
+    if (texel.y == size.y - 1) {
+        last.y = sourceSize.y - 1;
+    }
+#ifdef REVERSED_Z
+    float depth = 1;
+#else
+    float depth = 0;
+#endif
+    for (int y = first.y; y <= last.y; ++y) {
+        for (int x = first.x; x <= last.x; ++x) {
+            float sourceDepth = texelFetch(uSource, ivec2(x, y), uSourceLevel).r;
+#ifdef REVERSED_Z
+            depth = min(depth, sourceDepth);
+#else
+            depth = max(depth, sourceDepth);
+#endif
+        }
+    }
+#endif
+    imageStore(uDestination, texel, vec4(depth));
+}
@@ -0,0 +1,72 @@
+#version 430
+
+// Mipmaps of an RGBA8 ImageTexture: level uSourceLevel + 1 is filtered from
+// level uSourceLevel, one invocation per texel of the written level (see
+// ImageTexture::create). Texels are averaged according to the ImageUsage of
+// the image: as they are (uUsage 0), as sRGB colors in linear space (1) or as
+// tangent space normals renormalized (2). downsampleImage filters the same
+// way on the CPU.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(rgba8, binding = 0) uniform writeonly image2D uDestination;
+
+uniform sampler2D uSource; // The texture itself
+uniform int uSourceLevel;
+uniform int uUsage;
+
+vec3 srgbToLinear(vec3 color)
+{
+    return mix(color / 12.92, pow((color + 0.055) / 1.055, vec3(2.4)),
+        greaterThan(color, vec3(0.04045)));
+}
+
+vec3 linearToSrgb(vec3 color)
+{
+    return mix(color * 12.92, 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055,
+        greaterThan(color, vec3(0.0031308)));
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(uDestination);
+    if (any(greaterThanEqual(texel, size))) {
+        return;
+    }
+
+    // 2x2 texels, plus the last row or column of odd sized levels so that
+    // no source texel is skipped
+    ivec2 sourceSize = textureSize(uSource, uSourceLevel);
+    ivec2 first = 2 * texel;
+    ivec2 last = min(first + ivec2(1), sourceSize - 1);
+    if (texel.x == size.x - 1) {
+        last.x = sourceSize.x - 1;
+    }
+    if (texel.y == size.y - 1) {
+        last.y = sourceSize.y - 1;
+    }
+    vec4 sum = vec4(0);
+    for (int y = first.y; y <= last.y; ++y) {
+        for (int x = first.x; x <= last.x; ++x) {
+            vec4 value = texelFetch(uSource, ivec2(x, y), uSourceLevel);
+            if (uUsage == 1) {
+                value.rgb = srgbToLinear(value.rgb);
+            } else if (uUsage == 2) {
+                value.xyz = value.xyz * 2.0 - 1.0;
+            }
+            sum += value;
+        }
+    }
+    ivec2 count = last - first + 1;
+    vec4 average = sum / float(count.x * count.y);
+    if (uUsage == 1) {
+        average.rgb = linearToSrgb(average.rgb);
+    } else if (uUsage == 2) {
+        float normalLength = length(average.xyz);
+        vec3 normal =
+            normalLength > 0.0 ? average.xyz / normalLength : vec3(0, 0, 1);
+        average.xyz = normal * 0.5 + 0.5;
+    }
+    imageStore(uDestination, texel, average);
+}
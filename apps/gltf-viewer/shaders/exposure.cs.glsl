@@ -0,0 +1,92 @@
+#version 430
+
+// Auto-exposure of PostProcessing in a single dispatch: each work group adds
+// the luminance histogram of its 32 x 32 pixels to the one of the frame,
+// then the last group to finish reduces it to the average log luminance of
+// the frame, which uAverageLogLuminance moves towards by uAdaptation, and
+// clears it for the next frame. The first bin counts the pixels too dark to
+// be exposed for, such as the background.
+
+#include "exposure.glsl"
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+uniform sampler2D uColor; // HDR frame
+uniform float uAdaptation; // 1 to jump to the frame
+
+shared uint sHistogram[BIN_COUNT];
+shared bool sIsLastGroup;
+
+uint getBin(float luminance)
+{
+    float logLuminance = log2(max(luminance, 1e-10));
+    if (logLuminance < MIN_LOG_LUMINANCE) {
+        return 0u;
+    }
+    float t = (logLuminance - MIN_LOG_LUMINANCE) / (MAX_LOG_LUMINANCE - MIN_LOG_LUMINANCE);
+    return 1u + min(uint(t * float(BIN_COUNT - 1u)), BIN_COUNT - 2u);
+}
+
+float getBinLogLuminance(uint bin)
+{
+    float t = (float(bin - 1u) + 0.5) / float(BIN_COUNT - 1u);
+    return mix(MIN_LOG_LUMINANCE, MAX_LOG_LUMINANCE, t);
+}
+
+void main()
+{
+    uint index = gl_LocalInvocationIndex;
+    if (index < BIN_COUNT) {
+        sHistogram[index] = 0u;
+    }
+    barrier();
+
+    ivec2 size = textureSize(uColor, 0);
+    ivec2 first = 2 * ivec2(gl_GlobalInvocationID.xy);
+    for (int y = 0; y < 2; ++y) {
+        for (int x = 0; x < 2; ++x) {
+            ivec2 pixel = first + ivec2(x, y);
+            if (all(lessThan(pixel, size))) {
+                vec3 color = texelFetch(uColor, pixel, 0).rgb;
+                atomicAdd(sHistogram[getBin(getLuminance(color))], 1u);
+            }
+        }
+    }
+    barrier();
+
+    if (index < BIN_COUNT && sHistogram[index] > 0u) {
+        atomicAdd(uHistogram[index], sHistogram[index]);
+    }
+    // The counts of the group are visible to the last group once it
+    // increments the count of finished groups
+    memoryBarrierBuffer();
+    barrier();
+    if (index == 0u) {
+        uint groupCount = gl_NumWorkGroups.x * gl_NumWorkGroups.y;
+        sIsLastGroup = atomicAdd(uFinishedGroupCount, 1u) == groupCount - 1u;
+    }
+    barrier();
+    if (!sIsLastGroup) {
+        return;
+    }
+
+    if (index < BIN_COUNT) {
+        sHistogram[index] = atomicExchange(uHistogram[index], 0u);
+    }
+    barrier();
+    if (index != 0u) {
+        return;
+    }
+    float sum = 0.0;
+    uint count = 0u;
+    for (uint bin = 1u; bin < BIN_COUNT; ++bin) {
+        sum += float(sHistogram[bin]) * getBinLogLuminance(bin);
+        count += sHistogram[bin];
+    }
+    // Black frames keep the previous exposure
+    if (count > 0u) {
+        float logLuminance = sum / float(count);
+        uAverageLogLuminance = mix(uAverageLogLuminance, logLuminance, uAdaptation);
+    }
+    uFinishedGroupCount = 0u;
+}
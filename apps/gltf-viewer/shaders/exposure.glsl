@@ -0,0 +1,35 @@
+// Exposure of the HDR frames of PostProcessing, adapted by exposure.cs.glsl
+
+#define BIN_COUNT 64u // PostProcessing::HISTOGRAM_BIN_COUNT
+// Range of the bins after the first one, which counts darker pixels
+#define MIN_LOG_LUMINANCE -10.0
+#define MAX_LOG_LUMINANCE 6.0
+// Luminance exposed to middle gray
+#define MIDDLE_GRAY 0.18
+
+// PostProcessing::ExposureData
+layout(std430, binding = 0) coherent buffer Exposure
+{
+    float uAverageLogLuminance; // Adapted, log2
+    uint uFinishedGroupCount;
+    uint uExposurePadding[2];
+    uint uHistogram[BIN_COUNT];
+};
+
+uniform bool uAutoExposure;
+uniform float uExposureCompensation; // In stops
+
+float getLuminance(vec3 color)
+{
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Scale of the HDR colors of the frame
+float getExposure()
+{
+    float exposure = exp2(uExposureCompensation);
+    if (uAutoExposure) {
+        exposure *= MIDDLE_GRAY / exp2(uAverageLogLuminance);
+    }
+    return exposure;
+}
@@ -1,21 +1,134 @@
-#version 330
+#version 430
 
-layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
-layout(location = 2) in vec2 aTexCoords;
+#include "vertex_attributes.glsl"
 
 out vec3 vViewSpacePosition;
 out vec3 vViewSpaceNormal;
 out vec2 vTexCoords;
+flat out uint vMaterialID;
+#ifdef TAA
+// See motion_vectors.glsl
+out vec4 vClipPosition;
+out vec4 vPreviousClipPosition;
+#endif
 
-uniform mat4 uModelViewProjMatrix;
-uniform mat4 uModelViewMatrix;
-uniform mat4 uNormalMatrix;
+#ifdef INSTANCED
+// Per instance matrices, see InstancedDrawList
+layout(location = 4) in mat4 aModelMatrix;
+// World space normal matrix, its last column holds the phase of the vertex
+// animation of the instance in x
+layout(location = 8) in mat4 aNormalMatrix;
+
+#ifdef VERTEX_ANIMATIONS
+// Frames of the clips of the arena primitives (see VertexAnimations), 3 words
+// per vertex: normalized position in the bounds of the clip and octahedral
+// normal, 16 bits per component
+layout(std430, binding = 24) readonly buffer VertexAnimationFrames
+{
+    uint uVertexAnimationFrames[];
+};
+
+// Clip of the drawn primitive, see VertexAnimations::setPrimitive
+uniform uint uVertexAnimationOffset; // First word of the first frame
+uniform int uVertexAnimationBaseVertex;
+uniform uint uVertexAnimationVertexCount;
+uniform uint uVertexAnimationFrameCount; // 0 draws the vertices of the arena
+uniform float uVertexAnimationFrame; // Of the instances of phase 0
+// Positions of the arena from the normalized positions of the clip
+uniform vec3 uVertexAnimationScale;
+uniform vec3 uVertexAnimationBias;
+
+void fetchAnimatedVertex(uint frame, out vec3 position, out vec3 normal)
+{
+    uint vertex = uint(gl_VertexID - uVertexAnimationBaseVertex);
+    uint i = uVertexAnimationOffset + 3u * (frame * uVertexAnimationVertexCount + vertex);
+    position = vec3(unpackUnorm2x16(uVertexAnimationFrames[i]),
+        unpackUnorm2x16(uVertexAnimationFrames[i + 1u]).x);
+    position = position * uVertexAnimationScale + uVertexAnimationBias;
+    vec2 e = unpackSnorm2x16(uVertexAnimationFrames[i + 2u]);
+    normal = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    // Unfold the lower hemisphere
+    float t = max(-normal.z, 0.0);
+    normal.xy += vec2(normal.x >= 0.0 ? -t : t, normal.y >= 0.0 ? -t : t);
+}
+#endif
+#else
+#ifdef SKINNED
+// Joints and weights of the vertex (see GeometryArena::bindSkinBuffer), its
+// skinning matrix is the world matrix and the model matrix is the identity
+#include "skinning.glsl"
+layout(location = 13) in uvec4 aJoints;
+layout(location = 14) in vec4 aWeights;
+#endif
+
+// Per draw matrices, one range of a uniform buffer per draw (see
+// ViewerApplication::renderScene)
+layout(std140) uniform DrawUniforms
+{
+    mat4 uModelMatrix; // World matrix relative to uEye
+    mat4 uNormalMatrix; // World space normal matrix
+    mat4 uPreviousModelMatrix; // World matrix of the previous frame
+};
+#endif
+
+// Per frame matrices
+#include "camera.glsl"
+
+// The depth pre-pass computes the same positions (see depth.vs.glsl)
+invariant gl_Position;
 
 void main()
 {
-    vViewSpacePosition = vec3(uModelViewMatrix * vec4(aPosition, 1));
-	vViewSpaceNormal = normalize(vec3(uNormalMatrix * vec4(aNormal, 0)));
-	vTexCoords = aTexCoords;
-    gl_Position =  uModelViewProjMatrix * vec4(aPosition, 1);
+    vMaterialID = aMaterialID;
+#ifdef INSTANCED
+    vec3 position = aPosition;
+    vec3 normal = aNormal;
+#ifdef VERTEX_ANIMATIONS
+    if (uVertexAnimationFrameCount != 0u) {
+        // Blend the two frames around the time of the instance, the last
+        // one loops to the first one
+        float frameCount = float(uVertexAnimationFrameCount);
+        float frame = mod(uVertexAnimationFrame + aNormalMatrix[3].x * frameCount, frameCount);
+        uint frame0 = min(uint(frame), uVertexAnimationFrameCount - 1u);
+        uint frame1 = (frame0 + 1u) % uVertexAnimationFrameCount;
+        vec3 position0, normal0, position1, normal1;
+        fetchAnimatedVertex(frame0, position0, normal0);
+        fetchAnimatedVertex(frame1, position1, normal1);
+        float t = clamp(frame - float(frame0), 0.0, 1.0);
+        position = mix(position0, position1, t);
+        normal = mix(normal0, normal1, t);
+    }
+#endif
+    vec4 worldSpacePosition = aModelMatrix * vec4(position, 1);
+    vec4 viewSpacePosition = uViewMatrix * worldSpacePosition;
+    vViewSpacePosition = vec3(viewSpacePosition);
+    // The view matrix is rigid so its normal matrix is its rotation part
+    vViewSpaceNormal = normalize(mat3(uViewMatrix) * mat3(aNormalMatrix) * normal);
+    vTexCoords = aTexCoords;
+    gl_Position = uProjMatrix * viewSpacePosition;
+#ifdef TAA
+    // Instances are assumed still (vertex animations included), only the
+    // camera moves
+    vClipPosition = gl_Position;
+    vPreviousClipPosition = uPreviousViewProjMatrix * worldSpacePosition;
+#endif
+#else
+#ifdef SKINNED
+    mat4 skinMatrix = getSkinMatrix(aJoints, aWeights);
+    vec4 position = skinMatrix * vec4(aPosition, 1);
+    vec3 normal = mat3(skinMatrix) * aNormal;
+#else
+    vec4 position = vec4(aPosition, 1);
+    vec3 normal = aNormal;
+#endif
+    vec4 eyeSpacePosition = uModelMatrix * position;
+    vViewSpacePosition = vec3(uEyeViewMatrix * eyeSpacePosition);
+    vViewSpaceNormal = normalize(mat3(uViewMatrix) * mat3(uNormalMatrix) * normal);
+    vTexCoords = aTexCoords;
+    gl_Position = uEyeViewProjMatrix * eyeSpacePosition;
+#ifdef TAA
+    vClipPosition = gl_Position;
+    vPreviousClipPosition = uPreviousViewProjMatrix * uPreviousModelMatrix * position;
+#endif
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+#version 430
+
+#include "vertex_attributes.glsl"
+#ifdef VERTEX_PULLING
+#define aDrawID gl_BaseInstanceARB // See IndirectDrawList::setVertexPulling
+#else
+layout(location = 3) in uint aDrawID; // Instanced attribute, see IndirectDrawList
+#endif
+
+out vec3 vViewSpacePosition;
+out vec3 vViewSpaceNormal;
+out vec2 vTexCoords;
+flat out uint vMaterialID;
+#ifdef VISIBILITY_BUFFER
+flat out uint vDrawID; // See visibility.fs.glsl
+#endif
+#ifdef TAA
+// See motion_vectors.glsl
+out vec4 vClipPosition;
+out vec4 vPreviousClipPosition;
+#endif
+
+struct DrawTransform
+{
+    mat4 modelMatrix;
+    mat4 normalMatrix; // World space normal matrix
+};
+
+layout(std430, binding = 0) readonly buffer DrawTransforms
+{
+    DrawTransform uDrawTransforms[];
+};
+
+#include "camera.glsl"
+
+void main()
+{
+    DrawTransform drawTransform = uDrawTransforms[aDrawID];
+    vMaterialID = aMaterialID;
+#ifdef VISIBILITY_BUFFER
+    vDrawID = uint(aDrawID);
+#endif
+    vec4 worldSpacePosition = drawTransform.modelMatrix * vec4(aPosition, 1);
+    vec4 viewSpacePosition = uViewMatrix * worldSpacePosition;
+    vViewSpacePosition = vec3(viewSpacePosition);
+    // The view matrix is rigid so its normal matrix is its rotation part
+    vViewSpaceNormal = normalize(mat3(uViewMatrix) * mat3(drawTransform.normalMatrix) * aNormal);
+    vTexCoords = aTexCoords;
+    gl_Position = uProjMatrix * viewSpacePosition;
+#ifdef TAA
+    // Only the camera motion is followed, not that of the draws moved by
+    // IndirectDrawList::updateTransforms
+    vClipPosition = gl_Position;
+    vPreviousClipPosition = uPreviousViewProjMatrix * worldSpacePosition;
+#endif
+}
@@ -0,0 +1,8 @@
+#version 430
+
+// Triangle covering the viewport, drawn without vertex attributes
+void main()
+{
+    vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+    gl_Position = vec4(position, 0, 1);
+}
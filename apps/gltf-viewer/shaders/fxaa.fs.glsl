@@ -0,0 +1,46 @@
+#version 430
+
+// FXAA of the images of ImageRenderer, drawn over the whole image by
+// fullscreen.vs.glsl. Each pixel is blended along the edge found from the
+// luma gradient of its neighbors, the cheap variant of Lottes, "FXAA", 2009.
+
+layout(binding = 0) uniform sampler2D uImage; // Linear filtering
+
+out vec4 fColor;
+
+// Minimum and relative reduction of the gradient, longest blur in pixels
+#define FXAA_REDUCE_MIN (1.0 / 128.0)
+#define FXAA_REDUCE_MUL (1.0 / 8.0)
+#define FXAA_SPAN_MAX 8.0
+
+float getLuma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+void main()
+{
+    vec2 texelSize = 1.0 / vec2(textureSize(uImage, 0));
+    vec2 uv = gl_FragCoord.xy * texelSize;
+    vec4 center = texture(uImage, uv);
+    float lumaM = getLuma(center.rgb);
+    float lumaNW = getLuma(textureOffset(uImage, uv, ivec2(-1, 1)).rgb);
+    float lumaNE = getLuma(textureOffset(uImage, uv, ivec2(1, 1)).rgb);
+    float lumaSW = getLuma(textureOffset(uImage, uv, ivec2(-1, -1)).rgb);
+    float lumaSE = getLuma(textureOffset(uImage, uv, ivec2(1, -1)).rgb);
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+    // Along the edge, orthogonal to the gradient
+    vec2 direction = vec2(lumaSW + lumaSE - lumaNW - lumaNE, lumaNW + lumaSW - lumaNE - lumaSE);
+    float reduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * FXAA_REDUCE_MUL, FXAA_REDUCE_MIN);
+    float scale = 1.0 / (min(abs(direction.x), abs(direction.y)) + reduce);
+    direction = clamp(direction * scale, -FXAA_SPAN_MAX, FXAA_SPAN_MAX) * texelSize;
+
+    vec3 colorA = 0.5 * (texture(uImage, uv - direction / 6.0).rgb + texture(uImage, uv + direction / 6.0).rgb);
+    vec3 colorB = 0.5 * colorA + 0.25 * (texture(uImage, uv - direction * 0.5).rgb + texture(uImage, uv + direction * 0.5).rgb);
+    // The wider blur crossed another edge
+    float lumaB = getLuma(colorB);
+    vec3 color = lumaB < lumaMin || lumaB > lumaMax ? colorA : colorB;
+    fColor = vec4(color, center.a);
+}
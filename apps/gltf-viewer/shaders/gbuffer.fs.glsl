@@ -0,0 +1,54 @@
+#version 430
+
+#include "materials.glsl"
+#include "lights.glsl"
+#include "gbuffer.glsl"
+
+// Geometry pass of deferred shading (see GBuffer): the surface of the
+// material of the draw, lit later by deferred_lighting.cs.glsl. Without
+// punctual lights nor environment map, the radiance is the final color lit by
+// a light at the eye like materials.fs.glsl.
+
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+flat in uint vMaterialID;
+
+layout(location = 0) out vec4 fBaseColorMetallic;
+layout(location = 1) out vec4 fNormalRoughness;
+layout(location = 2) out vec3 fRadiance;
+
+void main()
+{
+    Material material = uMaterials[vMaterialID];
+    vec4 baseColor = material.baseColorFactor *
+        sampleMaterialTexture(material, BASE_COLOR_TEXTURE, vTexCoords, vec4(1));
+    vec3 emissive = material.emissiveFactor *
+        sampleMaterialTexture(material, EMISSIVE_TEXTURE, vTexCoords, vec4(1)).rgb;
+    float occlusion = sampleMaterialTexture(material, OCCLUSION_TEXTURE, vTexCoords, vec4(1)).r;
+    vec4 metallicRoughness = sampleMaterialTexture(material, METALLIC_ROUGHNESS_TEXTURE, vTexCoords, vec4(1));
+    if (baseColor.a < material.alphaCutoff) {
+        discard;
+    }
+    occlusion = mix(1.0, occlusion, material.occlusionStrength);
+
+    vec3 viewSpaceNormal = normalize(vViewSpaceNormal);
+    vec3 viewDir = normalize(-vViewSpacePosition);
+    float facing = dot(viewSpaceNormal, viewDir);
+    // Back faces are lit as front faces
+    if (facing < 0.0) {
+        viewSpaceNormal = -viewSpaceNormal;
+    }
+    float metallic = clamp(material.metallicFactor * metallicRoughness.b, 0.0, 1.0);
+    float roughness = clamp(material.roughnessFactor * metallicRoughness.g, 0.05, 1.0);
+
+    fBaseColorMetallic = vec4(baseColor.rgb, metallic);
+    fNormalRoughness = vec4(encodeOctahedral(viewSpaceNormal), roughness, 0);
+    vec3 ambient;
+    if (hasEnvironment()) {
+        ambient = shadeEnvironment(viewDir, viewSpaceNormal, baseColor.rgb, metallic, roughness);
+    } else {
+        ambient = baseColor.rgb * (uLightCounts.x + uLightCounts.y == 0u ? abs(facing) : AMBIENT_LIGHT);
+    }
+    fRadiance = ambient * occlusion + emissive;
+}
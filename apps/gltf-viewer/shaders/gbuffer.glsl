@@ -0,0 +1,29 @@
+// Encodings of the attachments of a GBuffer, written by gbuffer.fs.glsl and
+// read by deferred_lighting.cs.glsl
+
+// Attachment 0: base color, metallic (RGBA8)
+// Attachment 1: octahedral normal, roughness (RGB10_A2)
+// Attachment 2: radiance not coming from punctual lights (R11F_G11F_B10F)
+
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Unit vector folded on the octahedron then unfolded on [0, 1]^2
+vec2 encodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return folded * 0.5 + 0.5;
+}
+
+vec3 decodeOctahedral(vec2 encoded)
+{
+    vec2 folded = encoded * 2.0 - 1.0;
+    vec3 n = vec3(folded, 1.0 - abs(folded.x) - abs(folded.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    }
+    return normalize(n);
+}
@@ -0,0 +1,24 @@
+#version 330
+
+#include "motion_vectors.glsl"
+
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+
+// GPU cost of the bucket of the draw over the cost of the most expensive one
+// (see GpuCostAttribution), 0 until measured
+uniform float uHeat;
+
+layout(location = 0) out vec3 fColor;
+
+void main()
+{
+   writeMotionVector();
+   // Need another normalization because interpolation of vertex attributes does not maintain unit length
+   vec3 viewSpaceNormal = normalize(vViewSpaceNormal);
+   // Blue to green to red, shaded by the normal so that shapes stay readable
+   float heat = clamp(uHeat, 0, 1);
+   vec3 color = heat < 0.5 ? mix(vec3(0, 0, 1), vec3(0, 1, 0), 2 * heat) : mix(vec3(0, 1, 0), vec3(1, 0, 0), 2 * heat - 1);
+   fColor = color * (0.4 + 0.6 * abs(viewSpaceNormal.z));
+}
@@ -0,0 +1,159 @@
+#version 430
+
+// Precomputation of the image-based lighting of EnvironmentLighting, one
+// invocation per texel:
+// - IRRADIANCE: cosine weighted average of the environment around the
+// direction of each texel of a cube map (irradiance over PI),
+// - SPECULAR: environment filtered by the GGX lobe of uRoughness around the
+// direction of each texel of a level of a cube map, assuming the normal, view
+// and reflection directions are the same,
+// - BRDF_LUT: scale and bias of F0 in the split sum approximation of the
+// specular BRDF of lights.glsl, for NdotV in x and the roughness in y.
+// Samples are importance sampled along a Hammersley sequence and read from
+// the level of the mipmapped environment whose texels match their solid
+// angle (filtered importance sampling), so that a few of them suffice.
+
+#define GROUP_SIZE 8
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+const float PI = 3.14159265359;
+
+#if defined(IRRADIANCE) || defined(SPECULAR)
+layout(rgba16f, binding = 0) uniform writeonly imageCube uOutput;
+// Equirectangular, with every mip level
+layout(binding = 0) uniform sampler2D uEnvironment;
+#else
+layout(rg16f, binding = 0) uniform writeonly image2D uOutput;
+#endif
+
+uniform float uRoughness;
+uniform uint uSampleCount;
+
+vec2 hammersley(uint i, uint count)
+{
+    return vec2(float(i) / float(count), float(bitfieldReverse(i)) * 2.3283064365386963e-10);
+}
+
+// Orthonormal basis around n, mapping z to n
+mat3 getTangentFrame(vec3 n)
+{
+    vec3 up = abs(n.z) < 0.999 ? vec3(0, 0, 1) : vec3(1, 0, 0);
+    vec3 tangent = normalize(cross(up, n));
+    return mat3(tangent, cross(n, tangent), n);
+}
+
+// Half vector of GGX with alpha = roughness^2 around z
+vec3 sampleGGX(vec2 xi, float alpha)
+{
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    float phi = 2.0 * PI * xi.x;
+    return vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+}
+
+#if defined(IRRADIANCE) || defined(SPECULAR)
+vec3 sampleEnvironment(vec3 direction, float lod)
+{
+    vec2 uv = vec2(atan(direction.z, direction.x) / (2.0 * PI) + 0.5,
+        acos(clamp(direction.y, -1.0, 1.0)) / PI);
+    return textureLod(uEnvironment, uv, lod).rgb;
+}
+
+// Level of the environment whose texels cover the solid angle of a sample of
+// probability density pdf
+float getSampleLod(float pdf)
+{
+    vec2 size = vec2(textureSize(uEnvironment, 0));
+    float texelSolidAngle = 4.0 * PI / (size.x * size.y);
+    float sampleSolidAngle = 1.0 / (float(uSampleCount) * pdf + 1e-6);
+    return max(0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0, 0.0);
+}
+
+// Direction of the center of a texel of a face of a cube map of size
+vec3 getCubeDirection(uvec3 texel, int size)
+{
+    vec2 uv = (vec2(texel.xy) + 0.5) / float(size) * 2.0 - 1.0;
+    switch (texel.z) {
+    case 0u: return normalize(vec3(1, -uv.y, -uv.x));
+    case 1u: return normalize(vec3(-1, -uv.y, uv.x));
+    case 2u: return normalize(vec3(uv.x, 1, uv.y));
+    case 3u: return normalize(vec3(uv.x, -1, -uv.y));
+    case 4u: return normalize(vec3(uv.x, -uv.y, 1));
+    default: return normalize(vec3(-uv.x, -uv.y, -1));
+    }
+}
+#endif
+
+void main()
+{
+    int size = imageSize(uOutput).x;
+    uvec3 texel = gl_GlobalInvocationID;
+    if (texel.x >= uint(size) || texel.y >= uint(size)) {
+        return;
+    }
+
+#if defined(IRRADIANCE)
+    vec3 normal = getCubeDirection(texel, size);
+    mat3 frame = getTangentFrame(normal);
+    vec3 sum = vec3(0);
+    for (uint i = 0u; i < uSampleCount; ++i) {
+        // Cosine weighted hemisphere
+        vec2 xi = hammersley(i, uSampleCount);
+        float cosTheta = sqrt(1.0 - xi.y);
+        float sinTheta = sqrt(xi.y);
+        float phi = 2.0 * PI * xi.x;
+        vec3 direction = frame * vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+        sum += sampleEnvironment(direction, getSampleLod(cosTheta / PI));
+    }
+    imageStore(uOutput, ivec3(texel), vec4(sum / float(uSampleCount), 1));
+#elif defined(SPECULAR)
+    vec3 normal = getCubeDirection(texel, size);
+    if (uRoughness == 0.0) {
+        imageStore(uOutput, ivec3(texel), vec4(sampleEnvironment(normal, 0.0), 1));
+        return;
+    }
+    mat3 frame = getTangentFrame(normal);
+    float alpha = uRoughness * uRoughness;
+    vec3 sum = vec3(0);
+    float weight = 0.0;
+    for (uint i = 0u; i < uSampleCount; ++i) {
+        vec3 halfway = sampleGGX(hammersley(i, uSampleCount), alpha);
+        vec3 direction = frame * (2.0 * halfway.z * halfway - vec3(0, 0, 1));
+        float NdotL = dot(direction, normal);
+        if (NdotL > 0.0) {
+            // With N = V, the pdf of the reflected direction is D / 4
+            float NdotH = halfway.z;
+            float d = NdotH * NdotH * (alpha * alpha - 1.0) + 1.0;
+            float pdf = alpha * alpha / (4.0 * PI * d * d);
+            sum += sampleEnvironment(direction, getSampleLod(pdf)) * NdotL;
+            weight += NdotL;
+        }
+    }
+    imageStore(uOutput, ivec3(texel), vec4(sum / max(weight, 1e-6), 1));
+#else
+    float NdotV = (float(texel.x) + 0.5) / float(size);
+    float roughness = (float(texel.y) + 0.5) / float(size);
+    float alpha = roughness * roughness;
+    float alpha2 = alpha * alpha;
+    vec3 viewDir = vec3(sqrt(1.0 - NdotV * NdotV), 0, NdotV);
+    vec2 sum = vec2(0);
+    for (uint i = 0u; i < uSampleCount; ++i) {
+        vec3 halfway = sampleGGX(hammersley(i, uSampleCount), alpha);
+        vec3 lightDir = 2.0 * dot(viewDir, halfway) * halfway - viewDir;
+        float NdotL = lightDir.z;
+        float NdotH = max(halfway.z, 0.0);
+        float VdotH = max(dot(viewDir, halfway), 0.0);
+        if (NdotL > 0.0) {
+            // Height correlated Smith visibility of shadeLight, divided by
+            // the pdf D * NdotH / (4 * VdotH) of the sample
+            float visibility = 0.5 / (NdotL * sqrt(NdotV * NdotV * (1.0 - alpha2) + alpha2) +
+                NdotV * sqrt(NdotL * NdotL * (1.0 - alpha2) + alpha2));
+            float weight = visibility * NdotL * 4.0 * VdotH / max(NdotH, 1e-6);
+            float fresnel = pow(1.0 - VdotH, 5.0);
+            sum += vec2(1.0 - fresnel, fresnel) * weight;
+        }
+    }
+    imageStore(uOutput, ivec2(texel.xy), vec4(sum / float(uSampleCount), 0, 0));
+#endif
+}
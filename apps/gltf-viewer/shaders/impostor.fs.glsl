@@ -0,0 +1,62 @@
+#version 430
+
+#include "lights.glsl"
+#include "motion_vectors.glsl"
+
+in vec3 vViewSpacePosition;
+in vec3 vTexCoords;
+flat in mat3 vNormalMatrix;
+
+// Layers of ImpostorAtlas, ImpostorAtlas::COLOR_UNIT and NORMAL_UNIT
+layout(binding = 20) uniform sampler2DArray uImpostorColors;
+layout(binding = 21) uniform sampler2DArray uImpostorNormals;
+
+layout(location = 0) out vec4 fColor;
+
+// Base color of the impostor lit as materials.fs.glsl lights a rough
+// dielectric. Texels are premultiplied by their coverage, cut at one half.
+void main()
+{
+    writeMotionVector();
+    vec4 colorTexel = texture(uImpostorColors, vTexCoords);
+    vec4 normalTexel = texture(uImpostorNormals, vTexCoords);
+    if (colorTexel.a < 0.5) {
+        discard;
+    }
+    vec3 baseColor = colorTexel.rgb / colorTexel.a;
+    vec3 objectSpaceNormal = normalTexel.rgb / normalTexel.a * 2.0 - 1.0;
+    vec3 viewSpaceNormal = normalize(vNormalMatrix * objectSpaceNormal);
+    vec3 viewDir = normalize(-vViewSpacePosition);
+    if (uLightCounts.x + uLightCounts.y == 0u && !hasEnvironment()) {
+        fColor = vec4(baseColor * abs(dot(viewSpaceNormal, viewDir)), 1);
+        return;
+    }
+
+    const float metallic = 0.0;
+    const float roughness = 1.0;
+    vec3 color = hasEnvironment() ?
+        shadeEnvironment(viewDir, viewSpaceNormal, baseColor, metallic, roughness) :
+        AMBIENT_LIGHT * baseColor;
+    for (uint i = 0u; i < uLightCounts.x; ++i) {
+        vec3 lightDir;
+        vec3 radiance = getLightRadiance(uLights[i], true, vViewSpacePosition, lightDir);
+        if (i == 0u) {
+            radiance *= getShadow(vViewSpacePosition, viewSpaceNormal);
+        }
+        color += shadeLight(radiance, lightDir, viewDir, viewSpaceNormal,
+            baseColor, metallic, roughness);
+    }
+    if (uLightCounts.y > 0u) {
+        uint cluster = getClusterIndex(gl_FragCoord.xy, -vViewSpacePosition.z) * getClusterStride();
+        uint count = uClusterLights[cluster];
+        for (uint i = 0u; i < count; ++i) {
+            uint lightIdx = uClusterLights[cluster + 1u + i];
+            vec3 lightDir;
+            vec3 radiance = getLightRadiance(uLights[lightIdx], false, vViewSpacePosition, lightDir);
+            radiance *= getLocalShadow(lightIdx, vViewSpacePosition, viewSpaceNormal);
+            color += shadeLight(radiance, lightDir, viewDir, viewSpaceNormal,
+                baseColor, metallic, roughness);
+        }
+    }
+    fColor = vec4(color, 1);
+}
@@ -0,0 +1,90 @@
+#version 430
+
+// Instances drawn as the impostor of their primitive (see ImpostorAtlas and
+// InstancedDrawList::drawImpostors): a quad of 4 vertices drawn as a
+// triangle strip without vertex attributes, facing the view of the impostor
+// whose direction is the closest to the camera. Drawn with
+// impostor.fs.glsl.
+
+// Per instance matrices, see InstancedDrawList
+layout(location = 4) in mat4 aModelMatrix; // World matrix
+layout(location = 8) in mat4 aNormalMatrix; // World space normal matrix
+
+// Layer of the impostor, set in place of the material of the draw (see
+// GeometryArena::MATERIAL_ID_LOCATION)
+layout(location = 12) in uint aImpostorLayer;
+
+#include "camera.glsl"
+
+// Object space bounding sphere of the primitive of each layer (see
+// ImpostorAtlas::MAX_IMPOSTORS): center and radius
+uniform vec4 uImpostorSpheres[64];
+
+// Views per side of a layer, ImpostorAtlas::GRID_SIZE
+const float GRID_SIZE = 8.0;
+
+out vec3 vViewSpacePosition;
+out vec3 vTexCoords; // Layer in z
+// Object space normals of the impostor to view space
+flat out mat3 vNormalMatrix;
+#ifdef TAA
+// See motion_vectors.glsl
+out vec4 vClipPosition;
+out vec4 vPreviousClipPosition;
+#endif
+
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Unit vector to [-1, 1]^2 on the octahedral map of the sphere
+vec2 encodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
+}
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    }
+    return normalize(n);
+}
+
+// Axes of the image of the view along direction, as baked by
+// ImpostorAtlas::bake
+void getImpostorFrame(vec3 direction, out vec3 right, out vec3 up)
+{
+    vec3 reference = abs(direction.y) < 0.999 ? vec3(0, 1, 0) : vec3(0, 0, 1);
+    right = normalize(cross(reference, direction));
+    up = cross(direction, right);
+}
+
+void main()
+{
+    vec4 sphere = uImpostorSpheres[aImpostorLayer];
+    mat3 modelMatrix = mat3(aModelMatrix);
+    vec3 center = vec3(aModelMatrix * vec4(sphere.xyz, 1));
+    vec3 direction = normalize(inverse(modelMatrix) * (uEye.xyz - center));
+    vec2 view = clamp(floor((encodeOctahedral(direction) * 0.5 + 0.5) * GRID_SIZE),
+        0.0, GRID_SIZE - 1.0);
+    vec3 right, up;
+    getImpostorFrame(decodeOctahedral((view + 0.5) / GRID_SIZE * 2.0 - 1.0), right, up);
+
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 offset = (corner * 2.0 - 1.0) * sphere.w;
+    vec4 worldSpacePosition = vec4(center + modelMatrix * (right * offset.x + up * offset.y), 1);
+    vec4 viewSpacePosition = uViewMatrix * worldSpacePosition;
+    vViewSpacePosition = vec3(viewSpacePosition);
+    vTexCoords = vec3((view + corner) / GRID_SIZE, float(aImpostorLayer));
+    vNormalMatrix = mat3(uViewMatrix) * mat3(aNormalMatrix);
+    gl_Position = uProjMatrix * viewSpacePosition;
+#ifdef TAA
+    // Instances are assumed still, only the camera moves
+    vClipPosition = gl_Position;
+    vPreviousClipPosition = uPreviousViewProjMatrix * worldSpacePosition;
+#endif
+}
@@ -0,0 +1,31 @@
+#version 430
+
+#include "materials.glsl"
+
+in vec3 vNormal;
+in vec2 vTexCoords;
+flat in uint vMaterialID;
+
+uniform vec3 uViewDirection; // Object space, toward the camera of the view
+
+// Layers of ImpostorAtlas, covered texels have an alpha of 1
+layout(location = 0) out vec4 fColor;
+layout(location = 1) out vec4 fNormal;
+
+// Base color and object space normal of the primitive, facing the camera.
+// Texels discarded by the alpha cutoff of the material stay uncovered.
+void main()
+{
+    Material material = uMaterials[vMaterialID];
+    vec4 baseColor = material.baseColorFactor *
+        sampleMaterialTexture(material, BASE_COLOR_TEXTURE, vTexCoords, vec4(1));
+    if (baseColor.a < material.alphaCutoff) {
+        discard;
+    }
+    vec3 normal = normalize(vNormal);
+    if (dot(normal, uViewDirection) < 0.0) {
+        normal = -normal;
+    }
+    fColor = vec4(baseColor.rgb, 1);
+    fNormal = vec4(normal * 0.5 + 0.5, 1);
+}
@@ -0,0 +1,22 @@
+#version 430
+
+// A view of a primitive baked in its impostor (see ImpostorAtlas::bake),
+// drawn with impostor_bake.fs.glsl. Normals stay in object space.
+
+#include "vertex_attributes.glsl"
+
+// Orthographic view of the bounding sphere of the primitive, times its
+// position matrix
+uniform mat4 uViewProjMatrix;
+
+out vec3 vNormal;
+out vec2 vTexCoords;
+flat out uint vMaterialID;
+
+void main()
+{
+    vNormal = aNormal;
+    vTexCoords = aTexCoords;
+    vMaterialID = aMaterialID;
+    gl_Position = uViewProjMatrix * vec4(aPosition, 1);
+}
@@ -0,0 +1,228 @@
+// Punctual lights of the scene assigned to the clusters of the view frustum,
+// see LightClusters. assign_lights.cs.glsl defines ASSIGN_LIGHTS to write
+// the clusters, fragment shaders read them with getClusterIndex(). The first
+// directional light may cast shadows, see getShadow(), and local lights too,
+// see getLocalShadow(). An environment map may light the scene, see
+// shadeEnvironment().
+
+// SceneLights::ViewLight, in view space: directional lights first, then
+// local ones
+struct Light
+{
+    vec3 position;
+    float range;
+    vec3 direction;
+    float spotScale;
+    vec3 color;
+    float spotOffset;
+};
+
+// LightClusters::Uniforms
+layout(std140) uniform ClusterUniforms
+{
+    uvec4 uClusterGrid; // Cluster counts, then max lights per cluster
+    uvec4 uLightCounts; // Directional, then local lights
+    vec4 uClusterViewport; // Origin in pixels, then clusters per pixel
+    vec4 uClusterDepths; // Slice scale and bias, near and far depths
+    vec4 uNdcToView; // View position at depth 1 of NDC xy: xy * xy + zw
+};
+
+layout(std430, binding = 15) readonly buffer Lights
+{
+    Light uLights[];
+};
+
+// Per cluster, its light count then uClusterGrid.w indices in uLights
+#ifdef ASSIGN_LIGHTS
+layout(std430, binding = 16) writeonly buffer ClusterLights
+#else
+layout(std430, binding = 16) readonly buffer ClusterLights
+#endif
+{
+    uint uClusterLights[];
+};
+
+uint getClusterStride()
+{
+    return uClusterGrid.w + 1u;
+}
+
+#ifndef ASSIGN_LIGHTS
+// Cluster of a fragment at a (positive) view depth
+uint getClusterIndex(vec2 fragCoord, float viewDepth)
+{
+    uvec2 tile = uvec2(clamp(
+        (fragCoord - uClusterViewport.xy) * uClusterViewport.zw,
+        vec2(0), vec2(uClusterGrid.xy - 1u)));
+    float slice = log(max(viewDepth, 1e-6)) * uClusterDepths.x + uClusterDepths.y;
+    uint sliceIdx = uint(clamp(slice, 0.0, float(uClusterGrid.z - 1u)));
+    return (sliceIdx * uClusterGrid.y + tile.y) * uClusterGrid.x + tile.x;
+}
+
+// Radiance reaching a view space position from a light, with the direction
+// toward the light in lightDir
+vec3 getLightRadiance(Light light, bool isDirectional, vec3 position, out vec3 lightDir)
+{
+    if (isDirectional) {
+        lightDir = -light.direction;
+        return light.color;
+    }
+    vec3 toLight = light.position - position;
+    float distance2 = max(dot(toLight, toLight), 1e-8);
+    lightDir = toLight * inversesqrt(distance2);
+    // Inverse square falloff windowed to 0 at the range, as recommended by
+    // KHR_lights_punctual
+    float ratio2 = distance2 / (light.range * light.range);
+    float window = clamp(1.0 - ratio2 * ratio2, 0.0, 1.0);
+    float spot = clamp(dot(-lightDir, light.direction) * light.spotScale + light.spotOffset, 0.0, 1.0);
+    return light.color * (window * window * spot * spot / distance2);
+}
+
+// CascadedShadowMaps::Uniforms, the cascades of the first directional light
+layout(std140) uniform ShadowUniforms
+{
+    mat4 uViewToShadow[4]; // View space to texture coordinates and depth
+    vec4 uCascadeDepths; // Far view depth of each cascade
+    vec4 uCascadeTexelSizes; // World size of a texel of each cascade
+    uvec4 uShadowInfo; // x: 1 if the first directional light is shadowed
+};
+
+layout(binding = 16) uniform sampler2DArrayShadow uShadowMaps;
+
+// Visibility of the first directional light from a view space position, in
+// [0, 1]. The position is pushed along the normal by about a texel of its
+// cascade against self shadowing, and 4 bilinear comparisons soften the
+// edges.
+float getShadow(vec3 position, vec3 normal)
+{
+    float depth = -position.z;
+    if (uShadowInfo.x == 0u || depth > uCascadeDepths.w) {
+        return 1.0;
+    }
+    uint cascade = 0u;
+    while (cascade < 3u && depth > uCascadeDepths[cascade]) {
+        ++cascade;
+    }
+    vec3 offsetPosition = position + normal * 1.5 * uCascadeTexelSizes[cascade];
+    vec3 coords = (uViewToShadow[cascade] * vec4(offsetPosition, 1)).xyz;
+    float texel = 1.0 / float(textureSize(uShadowMaps, 0).x);
+    float visibility = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        vec2 offset = vec2(i & 1, i >> 1) - 0.5;
+        visibility += texture(uShadowMaps, vec4(coords.xy + offset * texel, float(cascade), coords.z));
+    }
+    return 0.25 * visibility;
+}
+
+// ShadowAtlas::GpuView, a view of a local light in a tile of the atlas
+struct ShadowView
+{
+    mat4 viewToShadow; // View space to atlas texture coordinates and depth
+    vec4 rect; // Min and max texture coordinates of the tile
+    vec4 texel; // x: world size of a texel at distance 1 from the light
+};
+
+// Per light in uLights, its first view in uShadowViews and its view count,
+// 0 if it casts no shadow
+layout(std430, binding = 22) readonly buffer LightShadows
+{
+    uvec2 uLightShadowViews[];
+};
+
+layout(std430, binding = 23) readonly buffer ShadowViews
+{
+    ShadowView uShadowViews[];
+};
+
+layout(binding = 23) uniform sampler2DShadow uShadowAtlas;
+
+// Visibility of the local light lightIdx from a view space position, in
+// [0, 1], with the first of its views (one for spot lights, a cube for
+// point lights) whose tile holds the position. The position is pushed
+// along the normal by about a texel at its distance from the light.
+float getLocalShadow(uint lightIdx, vec3 position, vec3 normal)
+{
+    uvec2 views = uLightShadowViews[lightIdx];
+    if (views.y == 0u) {
+        return 1.0;
+    }
+    float distance = length(uLights[lightIdx].position - position);
+    for (uint i = 0u; i < views.y; ++i) {
+        ShadowView view = uShadowViews[views.x + i];
+        vec3 offsetPosition = position + normal * 1.5 * view.texel.x * distance;
+        vec4 coords = view.viewToShadow * vec4(offsetPosition, 1);
+        if (coords.w <= 0.0) {
+            continue;
+        }
+        coords.xyz /= coords.w;
+        if (all(greaterThanEqual(coords.xy, view.rect.xy)) &&
+            all(lessThanEqual(coords.xy, view.rect.zw)) && coords.z <= 1.0) {
+            return texture(uShadowAtlas, coords.xyz);
+        }
+    }
+    return 1.0;
+}
+
+const float PI = 3.14159265359;
+// Ambient light of scenes with punctual lights, scaled by occlusion
+const float AMBIENT_LIGHT = 0.03;
+
+// Metallic-roughness BRDF of glTF times the cosine term: Lambert diffuse, GGX
+// specular with the Smith height correlated visibility and Schlick Fresnel
+vec3 shadeLight(vec3 radiance, vec3 lightDir, vec3 viewDir, vec3 normal,
+    vec3 baseColor, float metallic, float roughness)
+{
+    float NdotL = dot(normal, lightDir);
+    if (NdotL <= 0.0) {
+        return vec3(0);
+    }
+    vec3 halfway = normalize(lightDir + viewDir);
+    float NdotV = max(dot(normal, viewDir), 1e-4);
+    float NdotH = max(dot(normal, halfway), 0.0);
+    float VdotH = max(dot(viewDir, halfway), 0.0);
+
+    float alpha = roughness * roughness;
+    float alpha2 = alpha * alpha;
+    float d = NdotH * NdotH * (alpha2 - 1.0) + 1.0;
+    float distribution = alpha2 / (PI * d * d);
+    float visibility = 0.5 / (NdotL * sqrt(NdotV * NdotV * (1.0 - alpha2) + alpha2) +
+        NdotV * sqrt(NdotL * NdotL * (1.0 - alpha2) + alpha2));
+    vec3 f0 = mix(vec3(0.04), baseColor, metallic);
+    vec3 fresnel = f0 + (1.0 - f0) * pow(1.0 - VdotH, 5.0);
+
+    vec3 diffuse = (1.0 - fresnel) * (1.0 - metallic) * baseColor / PI;
+    return (diffuse + fresnel * distribution * visibility) * radiance * NdotL;
+}
+
+// EnvironmentLighting::Uniforms
+layout(std140) uniform EnvironmentUniforms
+{
+    mat4 uViewToWorld;
+    vec4 uEnvironmentInfo; // x: 1 if there is one, y: last specular level, z: intensity
+};
+
+layout(binding = 17) uniform samplerCube uIrradianceMap;
+layout(binding = 18) uniform samplerCube uSpecularMap;
+layout(binding = 19) uniform sampler2D uBrdfLut;
+
+bool hasEnvironment()
+{
+    return uEnvironmentInfo.x != 0.0;
+}
+
+// Light of the environment reflected by the BRDF of shadeLight toward
+// viewDir, with the split sum approximation: the prefiltered specular map
+// times the scale and bias of F0 from the BRDF lookup table
+vec3 shadeEnvironment(vec3 viewDir, vec3 normal, vec3 baseColor, float metallic, float roughness)
+{
+    float NdotV = max(dot(normal, viewDir), 1e-4);
+    vec3 worldNormal = mat3(uViewToWorld) * normal;
+    vec3 reflected = mat3(uViewToWorld) * reflect(-viewDir, normal);
+    vec3 f0 = mix(vec3(0.04), baseColor, metallic);
+    vec2 brdf = texture(uBrdfLut, vec2(NdotV, roughness)).rg;
+    vec3 diffuse = texture(uIrradianceMap, worldNormal).rgb * (1.0 - metallic) * baseColor;
+    vec3 specular = textureLod(uSpecularMap, reflected, roughness * uEnvironmentInfo.y).rgb *
+        (f0 * brdf.x + brdf.y);
+    return (diffuse + specular) * uEnvironmentInfo.z;
+}
+#endif
@@ -0,0 +1,132 @@
+#version 430
+
+#include "materials.glsl"
+#include "lights.glsl"
+#include "motion_vectors.glsl"
+#include "ambient_occlusion.glsl"
+#ifdef OIT
+#include "transparency.glsl"
+#endif
+
+// Variants compiled for the permutation key of a set of materials only keep
+// the features it defines (see MaterialPermutations), the others branch on
+// the material of each fragment
+#ifndef MATERIAL_PERMUTATION
+#define ALPHA_MASK
+#define HAS_BASE_COLOR_TEXTURE
+#define HAS_METALLIC_ROUGHNESS_TEXTURE
+#define HAS_OCCLUSION_TEXTURE
+#define HAS_EMISSIVE_TEXTURE
+#endif
+
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+flat in uint vMaterialID;
+
+layout(location = 0) out vec4 fColor;
+#ifdef OIT
+layout(location = 1) out float fRevealage;
+#endif
+
+// Alpha of opaque fragments, the coverage of masked ones with
+// ALPHA_TO_COVERAGE (converted to a sample mask, then to 1, see
+// ViewerApplication::renderScene)
+float opaqueAlpha = 1.0;
+
+// Opaque color, or transparent fragment during the transparent pass
+void writeColor(vec3 color, float alpha)
+{
+#ifdef OIT
+    if (isTransparentPass()) {
+        fColor = shadeTransparentFragment(color, alpha, -vViewSpacePosition.z, fRevealage);
+        return;
+    }
+#endif
+    fColor = vec4(color, opaqueAlpha);
+}
+
+// Base color of the material of the draw lit by the punctual lights of the
+// scene (see LightClusters) and the environment map, or by a light at the eye
+// if it has neither, to check the materials and textures of a scene. With
+// OIT, the draws of BLEND materials are only drawn in the transparent pass
+// (see TransparencyBuffer), blended by their base color alpha.
+void main()
+{
+    writeMotionVector();
+    Material material = uMaterials[vMaterialID];
+    vec4 baseColor = material.baseColorFactor;
+#ifdef HAS_BASE_COLOR_TEXTURE
+    baseColor *= sampleMaterialTexture(material, BASE_COLOR_TEXTURE, vTexCoords, vec4(1));
+#endif
+    vec3 emissive = material.emissiveFactor;
+#ifdef HAS_EMISSIVE_TEXTURE
+    emissive *= sampleMaterialTexture(material, EMISSIVE_TEXTURE, vTexCoords, vec4(1)).rgb;
+#endif
+    float occlusion = 1.0;
+#ifdef HAS_OCCLUSION_TEXTURE
+    occlusion = sampleMaterialTexture(material, OCCLUSION_TEXTURE, vTexCoords, vec4(1)).r;
+#endif
+    vec4 metallicRoughness = vec4(1);
+#ifdef HAS_METALLIC_ROUGHNESS_TEXTURE
+    metallicRoughness = sampleMaterialTexture(material, METALLIC_ROUGHNESS_TEXTURE, vTexCoords, vec4(1));
+#endif
+#if defined(ALPHA_TO_COVERAGE)
+    // No discard, so that the depth test stays early. Alpha is sharpened to
+    // a ramp about a pixel wide around the cutoff, for crisp edges.
+    opaqueAlpha = clamp((baseColor.a - material.alphaCutoff) /
+        max(fwidth(baseColor.a), 1e-4) + 0.5, 0.0, 1.0);
+#elif defined(ALPHA_MASK)
+    if (baseColor.a < material.alphaCutoff) {
+        discard;
+    }
+#endif
+#ifdef UNLIT
+    writeColor(baseColor.rgb, baseColor.a);
+    return;
+#endif
+    occlusion = mix(1.0, occlusion, material.occlusionStrength);
+    occlusion *= getAmbientOcclusion(gl_FragCoord.xy, -vViewSpacePosition.z);
+
+    // Need another normalization because interpolation of vertex attributes does not maintain unit length
+    vec3 viewSpaceNormal = normalize(vViewSpaceNormal);
+    vec3 viewDir = normalize(-vViewSpacePosition);
+    if (uLightCounts.x + uLightCounts.y == 0u && !hasEnvironment()) {
+        float lighting = abs(dot(viewSpaceNormal, viewDir));
+        writeColor(baseColor.rgb * occlusion * lighting + emissive, baseColor.a);
+        return;
+    }
+
+    // Back faces are lit as front faces
+    if (dot(viewSpaceNormal, viewDir) < 0.0) {
+        viewSpaceNormal = -viewSpaceNormal;
+    }
+    float metallic = clamp(material.metallicFactor * metallicRoughness.b, 0.0, 1.0);
+    float roughness = clamp(material.roughnessFactor * metallicRoughness.g, 0.05, 1.0);
+    vec3 ambient = hasEnvironment() ?
+        shadeEnvironment(viewDir, viewSpaceNormal, baseColor.rgb, metallic, roughness) :
+        AMBIENT_LIGHT * baseColor.rgb;
+    vec3 color = ambient * occlusion + emissive;
+    for (uint i = 0u; i < uLightCounts.x; ++i) {
+        vec3 lightDir;
+        vec3 radiance = getLightRadiance(uLights[i], true, vViewSpacePosition, lightDir);
+        if (i == 0u) {
+            radiance *= getShadow(vViewSpacePosition, viewSpaceNormal);
+        }
+        color += shadeLight(radiance, lightDir, viewDir, viewSpaceNormal,
+            baseColor.rgb, metallic, roughness);
+    }
+    if (uLightCounts.y > 0u) {
+        uint cluster = getClusterIndex(gl_FragCoord.xy, -vViewSpacePosition.z) * getClusterStride();
+        uint count = uClusterLights[cluster];
+        for (uint i = 0u; i < count; ++i) {
+            uint lightIdx = uClusterLights[cluster + 1u + i];
+            vec3 lightDir;
+            vec3 radiance = getLightRadiance(uLights[lightIdx], false, vViewSpacePosition, lightDir);
+            radiance *= getLocalShadow(lightIdx, vViewSpacePosition, viewSpaceNormal);
+            color += shadeLight(radiance, lightDir, viewDir, viewSpaceNormal,
+                baseColor.rgb, metallic, roughness);
+        }
+    }
+    writeColor(color, baseColor.a);
+}
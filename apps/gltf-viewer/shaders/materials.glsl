@@ -0,0 +1,219 @@
+// Materials of the scene, see MaterialBuffer. Must be included before any
+// declaration since it may enable GL_ARB_bindless_texture: textures are read
+// from handles with BINDLESS_TEXTURES defined, from the page caches of
+// VirtualTextures with VIRTUAL_TEXTURES defined, from texture arrays
+// otherwise.
+
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
+
+// Texture slots, see MaterialBuffer::TextureSlot
+#define BASE_COLOR_TEXTURE 0
+#define METALLIC_ROUGHNESS_TEXTURE 1
+#define NORMAL_TEXTURE 2
+#define OCCLUSION_TEXTURE 3
+#define EMISSIVE_TEXTURE 4
+
+struct Material
+{
+    vec4 baseColorFactor;
+    vec3 emissiveFactor;
+    float alphaCutoff; // 0 unless alphaMode is MASK
+    float metallicFactor;
+    float roughnessFactor;
+    float normalScale;
+    float occlusionStrength;
+    // Bindless handle, texture array index plus one and layer, or virtual
+    // texture plus one and wrap modes, (0, 0) if none
+    uvec2 textures[5];
+    uvec2 padding;
+};
+
+layout(std430, binding = 6) readonly buffer Materials
+{
+    Material uMaterials[]; // uMaterials[0] is the default material
+};
+
+#if defined(VIRTUAL_TEXTURES)
+// See VirtualTextures::GpuTexture
+struct VirtualTexture
+{
+    uint firstPage; // Entry of page (0, 0) of level 0 in uPageTable
+    uint width;
+    uint height;
+    uint tailLevel;
+    uint cache;
+    uint slotsPerRow;
+    uint padding0;
+    uint padding1;
+};
+
+layout(std430, binding = 19) readonly buffer VirtualTextures
+{
+    VirtualTexture uVirtualTextures[];
+};
+
+// Slot (low 24 bits) and level of the finest resident page covering each
+// page
+layout(std430, binding = 20) readonly buffer PageTable
+{
+    uint uPageTable[];
+};
+
+// Pages wanted by one pixel per block of 8x8 pixels, for one texture slot
+layout(std430, binding = 21) buffer PageFeedback
+{
+    uvec2 uFeedbackOffset;
+    uvec2 uFeedbackSize;
+    uint uFeedbackSlot;
+    uint uFeedbackPadding[3];
+    uint uFeedbackPages[];
+};
+
+// Bound to units 0 to 3, see VirtualTextures::MAX_PAGE_CACHES
+uniform sampler2D uPageCaches[4];
+
+// See VirtualTextures::PAGE_SIZE, PAGE_BORDER and SLOT_SIZE
+const uint PAGE_SIZE = 128u;
+const uint PAGE_BORDER = 4u;
+const uint SLOT_SIZE = 136u;
+
+// Wrap mode 0 is REPEAT, 1 CLAMP_TO_EDGE and 2 MIRRORED_REPEAT
+float wrapCoordinate(float coord, uint mode)
+{
+    if (mode == 1u) {
+        return clamp(coord, 0.0, 1.0);
+    }
+    if (mode == 2u) {
+        float period = mod(coord, 2.0);
+        return period > 1.0 ? 2.0 - period : period;
+    }
+    return fract(coord);
+}
+
+// Pages of level of texture along each axis
+uvec2 getVirtualPageCount(VirtualTexture virtualTexture, uint level)
+{
+    uvec2 size = max(uvec2(virtualTexture.width, virtualTexture.height) >> level, uvec2(1));
+    return (size + PAGE_SIZE - 1u) / PAGE_SIZE;
+}
+
+// Entry of the page of level covering texCoords (wrapped) in uPageTable
+uint getVirtualPage(VirtualTexture virtualTexture, vec2 texCoords, uint level)
+{
+    uint page = virtualTexture.firstPage;
+    for (uint l = 0u; l < level; ++l) {
+        uvec2 pageCount = getVirtualPageCount(virtualTexture, l);
+        page += pageCount.x * pageCount.y;
+    }
+    uvec2 pageCount = getVirtualPageCount(virtualTexture, level);
+    uvec2 size = max(uvec2(virtualTexture.width, virtualTexture.height) >> level, uvec2(1));
+    uvec2 pageCoords = min(uvec2(texCoords * vec2(size)) / PAGE_SIZE, pageCount - 1u);
+    return page + pageCoords.y * pageCount.x + pageCoords.x;
+}
+
+vec4 sampleVirtualTexture(uvec2 ref, int slot, vec2 texCoords, vec2 dx, vec2 dy, vec4 defaultValue)
+{
+    VirtualTexture virtualTexture = uVirtualTextures[ref.x - 1u];
+    vec2 uv = vec2(wrapCoordinate(texCoords.x, ref.y & 3u), wrapCoordinate(texCoords.y, ref.y >> 2u));
+
+    // Level of the footprint of the pixel
+    vec2 size = vec2(virtualTexture.width, virtualTexture.height);
+    float lod = 0.5 * log2(max(max(dot(dx * size, dx * size), dot(dy * size, dy * size)), 1e-8));
+    uint level = uint(clamp(lod + 0.5, 0.0, float(virtualTexture.tailLevel)));
+
+    uint page = getVirtualPage(virtualTexture, uv, level);
+    uvec2 pixel = uvec2(gl_FragCoord.xy);
+    uvec2 cell = pixel / 8u;
+    if (uint(slot) == uFeedbackSlot && pixel % 8u == uFeedbackOffset && all(lessThan(cell, uFeedbackSize))) {
+        uFeedbackPages[cell.y * uFeedbackSize.x + cell.x] = page;
+    }
+
+    // Finest resident page covering the wanted one
+    uint entry = uPageTable[page];
+    uint slotIdx = entry & 0xFFFFFFu;
+    uint residentLevel = entry >> 24u;
+    vec2 levelSize = vec2(max(uvec2(virtualTexture.width, virtualTexture.height) >> residentLevel, uvec2(1)));
+    vec2 texel = min(uv * levelSize, levelSize);
+    vec2 pageCoords = min(floor(texel / float(PAGE_SIZE)), floor((levelSize - 1.0) / float(PAGE_SIZE)));
+    vec2 inPage = texel - pageCoords * float(PAGE_SIZE);
+    vec2 slotCoords = vec2(slotIdx % virtualTexture.slotsPerRow, slotIdx / virtualTexture.slotsPerRow);
+    vec2 cacheCoords = (slotCoords * float(SLOT_SIZE) + float(PAGE_BORDER) + inPage) / float(virtualTexture.slotsPerRow * SLOT_SIZE);
+
+    // Arrays are only indexed by constant expressions
+    vec4 value = defaultValue;
+    for (int i = 0; i < 4; ++i) {
+        if (uint(i) == virtualTexture.cache) {
+            value = textureLod(uPageCaches[i], cacheCoords, 0.0);
+        }
+    }
+    return value;
+}
+#elif !defined(BINDLESS_TEXTURES)
+// Bound to units 0 to 15, see MaterialBuffer::MAX_TEXTURE_ARRAYS
+uniform sampler2DArray uTextureArrays[16];
+#endif
+
+// Texel of the texture of material in slot, defaultValue if it has none,
+// filtered for the footprint of texture coordinates dx and dy from the
+// pixel to its right and top neighbors
+vec4 sampleMaterialTextureGrad(Material material, int slot, vec2 texCoords, vec2 dx, vec2 dy, vec4 defaultValue)
+{
+    uvec2 ref = material.textures[slot];
+    if (ref == uvec2(0)) {
+        return defaultValue;
+    }
+#if defined(VIRTUAL_TEXTURES)
+    return sampleVirtualTexture(ref, slot, texCoords, dx, dy, defaultValue);
+#elif defined(BINDLESS_TEXTURES)
+    return textureGrad(sampler2D(ref), texCoords, dx, dy);
+#else
+    // Arrays are only indexed by constant expressions
+    vec4 value = defaultValue;
+    for (int i = 0; i < 16; ++i) {
+        if (uint(i + 1) == ref.x) {
+            value = textureGrad(uTextureArrays[i], vec3(texCoords, float(ref.y)), dx, dy);
+        }
+    }
+    return value;
+#endif
+}
+
+// Same as sampleMaterialTextureGrad with the derivatives of texCoords. Must
+// be called from uniform control flow (derivatives are computed here).
+vec4 sampleMaterialTexture(Material material, int slot, vec2 texCoords, vec4 defaultValue)
+{
+    vec2 dx = dFdx(texCoords);
+    vec2 dy = dFdy(texCoords);
+    return sampleMaterialTextureGrad(material, slot, texCoords, dx, dy, defaultValue);
+}
+
+// Level of detail of the texture of material in slot at texCoords, before
+// clamping to its levels, and false if it has none (see mip_level.fs.glsl).
+// Must be called from uniform control flow.
+bool getMaterialTextureLod(Material material, int slot, vec2 texCoords, out float lod)
+{
+    vec2 dx = dFdx(texCoords);
+    vec2 dy = dFdy(texCoords);
+    lod = 0.0;
+    uvec2 ref = material.textures[slot];
+    if (ref == uvec2(0)) {
+        return false;
+    }
+#if defined(VIRTUAL_TEXTURES)
+    VirtualTexture virtualTexture = uVirtualTextures[ref.x - 1u];
+    vec2 size = vec2(virtualTexture.width, virtualTexture.height);
+#elif defined(BINDLESS_TEXTURES)
+    vec2 size = vec2(textureSize(sampler2D(ref), 0));
+#else
+    vec2 size = vec2(1);
+    for (int i = 0; i < 16; ++i) {
+        if (uint(i + 1) == ref.x) {
+            size = vec2(textureSize(uTextureArrays[i], 0).xy);
+        }
+    }
+#endif
+    lod = 0.5 * log2(max(max(dot(dx * size, dx * size), dot(dy * size, dy * size)), 1e-8));
+    return true;
+}
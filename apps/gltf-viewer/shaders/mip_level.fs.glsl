@@ -0,0 +1,33 @@
+#version 430
+
+#include "materials.glsl"
+#include "motion_vectors.glsl"
+
+// Debug view of the level of the base color texture sampled by each pixel:
+// blue for level 0, then cyan, green, yellow, orange and red from level 5,
+// darkened where the texture is magnified (fewer texels than pixels). Gray
+// without base color texture.
+
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+flat in uint vMaterialID;
+
+layout(location = 0) out vec3 fColor;
+
+const vec3 LEVEL_COLORS[6] = vec3[6](vec3(0, 0, 1), vec3(0, 1, 1), vec3(0, 1, 0), vec3(1, 1, 0), vec3(1, 0.5, 0), vec3(1, 0, 0));
+
+void main()
+{
+    writeMotionVector();
+    Material material = uMaterials[vMaterialID];
+    float lod;
+    if (!getMaterialTextureLod(material, BASE_COLOR_TEXTURE, vTexCoords, lod)) {
+        fColor = vec3(0.5);
+        return;
+    }
+    int level = int(clamp(floor(lod + 0.5), 0.0, 5.0));
+    // Magnified by up to 4x, from full to half intensity
+    float magnification = clamp(-lod / 2.0, 0.0, 1.0);
+    fColor = LEVEL_COLORS[level] * (1.0 - 0.5 * magnification);
+}
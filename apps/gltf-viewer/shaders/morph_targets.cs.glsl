@@ -0,0 +1,86 @@
+#version 430
+
+// Morph target pre-pass (see SceneMorphs::blendVertices), one invocation per
+// vertex of a mesh: add the weighted deltas of its targets to its base
+// position and normal and write them in the POSITION and NORMAL streams of
+// the GeometryArena (or in the bind pose of a skinned mesh).
+
+layout(local_size_x = 64) in;
+
+// Float vertices, three floats per position or normal
+layout(std430, binding = 8) readonly buffer BasePositions
+{
+    float uBasePositions[];
+};
+
+layout(std430, binding = 9) readonly buffer BaseNormals
+{
+    float uBaseNormals[];
+};
+
+// First delta and delta count of each base vertex
+layout(std430, binding = 10) readonly buffer VertexDeltas
+{
+    uvec2 uVertexDeltas[];
+};
+
+// Two vec4 per delta: position delta and target index (as float bits), then
+// normal delta
+layout(std430, binding = 11) readonly buffer Deltas
+{
+    vec4 uDeltas[];
+};
+
+layout(std430, binding = 12) readonly buffer Weights
+{
+    float uWeights[];
+};
+
+layout(std430, binding = 13) writeonly buffer Positions
+{
+    float uPositions[];
+};
+
+layout(std430, binding = 14) writeonly buffer Normals
+{
+    float uNormals[];
+};
+
+uniform uint uVertexCount;
+uniform uint uFirstBaseVertex; // In BasePositions, BaseNormals, VertexDeltas
+uniform uint uFirstWeight; // Weight of target 0 of the mesh in Weights
+uniform uint uFirstOutputVertex; // In Positions and Normals
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uVertexCount) {
+        return;
+    }
+    uint baseVertex = uFirstBaseVertex + i;
+
+    uint src = 3 * baseVertex;
+    vec3 position = vec3(uBasePositions[src], uBasePositions[src + 1],
+        uBasePositions[src + 2]);
+    vec3 normal = vec3(uBaseNormals[src], uBaseNormals[src + 1],
+        uBaseNormals[src + 2]);
+
+    uvec2 deltas = uVertexDeltas[baseVertex];
+    for (uint d = deltas.x; d < deltas.x + deltas.y; ++d) {
+        vec4 positionDelta = uDeltas[2 * d];
+        uint target = floatBitsToUint(positionDelta.w);
+        float weight = uWeights[uFirstWeight + target];
+        position += weight * positionDelta.xyz;
+        normal += weight * uDeltas[2 * d + 1].xyz;
+    }
+    // Missing normals stay null
+    if (dot(normal, normal) > 0.0) {
+        normal = normalize(normal);
+    }
+
+    uint dst = 3 * (uFirstOutputVertex + i);
+    for (uint c = 0; c < 3; ++c) {
+        uPositions[dst + c] = position[c];
+        uNormals[dst + c] = normal[c];
+    }
+}
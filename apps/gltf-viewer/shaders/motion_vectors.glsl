@@ -0,0 +1,21 @@
+// Motion vectors of the temporal anti-aliasing (see TemporalAntiAliasing),
+// written by the fragment shaders of scene programs compiled with TAA. The
+// vertex shaders output the clip space position of the vertex in this frame
+// and in the previous one.
+
+#ifdef TAA
+in vec4 vClipPosition;
+in vec4 vPreviousClipPosition;
+
+// TemporalAntiAliasing::MOTION_VECTORS_LOCATION
+layout(location = 2) out vec2 fMotionVector;
+#endif
+
+// From the previous position of the fragment to the current one, in texture
+// coordinates
+void writeMotionVector()
+{
+#ifdef TAA
+    fMotionVector = 0.5 * (vClipPosition.xy / vClipPosition.w - vPreviousClipPosition.xy / vPreviousClipPosition.w);
+#endif
+}
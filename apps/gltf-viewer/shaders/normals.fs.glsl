@@ -1,13 +1,16 @@
 #version 330
 
+#include "motion_vectors.glsl"
+
 in vec3 vViewSpacePosition;
 in vec3 vViewSpaceNormal;
 in vec2 vTexCoords;
 
-out vec3 fColor;
+layout(location = 0) out vec3 fColor;
 
 void main()
 {
+   writeMotionVector();
    // Need another normalization because interpolation of vertex attributes does not maintain unit length
    vec3 viewSpaceNormal = normalize(vViewSpaceNormal);
    fColor = viewSpaceNormal;
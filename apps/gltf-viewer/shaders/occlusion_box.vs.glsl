@@ -0,0 +1,22 @@
+#version 430
+
+// Bounding box of a group of draws tested by an occlusion query (see
+// OcclusionQueries::drawBoxes), 36 vertices drawn without vertex attributes.
+// Drawn with depth.fs.glsl.
+
+uniform mat4 uViewProjMatrix; // Without the translation of the view
+uniform vec3 uBboxMin; // Relative to the eye
+uniform vec3 uBboxMax;
+
+// Corners of the 12 triangles of the box, bits 0, 1 and 2 select the
+// maximum x, y and z
+const int CORNERS[36] = int[36](0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3, 0, 4, 5,
+    0, 5, 1, 2, 3, 7, 2, 7, 6, 0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5);
+
+void main()
+{
+    int corner = CORNERS[gl_VertexID];
+    vec3 position = mix(uBboxMin, uBboxMax,
+        vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1));
+    gl_Position = uViewProjMatrix * vec4(position, 1);
+}
@@ -0,0 +1,19 @@
+#version 330
+
+#include "motion_vectors.glsl"
+
+// Debug view of the fragments shaded per pixel, drawn with additive blending
+// without depth test (see DEBUG_VIEWS in ViewerApplication.cpp): 16 layers
+// saturate the pixel
+
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+
+layout(location = 0) out vec3 fColor;
+
+void main()
+{
+   writeMotionVector();
+   fColor = vec3(1.0 / 16.0, 1.0 / 32.0, 1.0 / 64.0);
+}
@@ -0,0 +1,13 @@
+#version 330
+
+// Picking pass (see GpuPicker), drawn with depth.vs.glsl: the identifier of
+// the draw, its index + 1
+
+uniform uint uDrawID;
+
+out uint fDrawID;
+
+void main()
+{
+    fDrawID = uDrawID;
+}
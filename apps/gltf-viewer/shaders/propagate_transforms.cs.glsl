@@ -0,0 +1,86 @@
+#version 430
+
+// World matrices of a GpuTransformHierarchy, one invocation per node (see
+// GpuTransformHierarchy::update). uPass 0 writes the local matrices of the
+// dynamic nodes from their translation, rotation and scale. uPass 1 computes
+// the world matrices of the nodes uNodes[uFirstNode, uFirstNode + uNodeCount)
+// of a depth level, whose parents are in the previous level, already
+// computed.
+
+layout(local_size_x = 64) in;
+
+struct NodeTransform
+{
+    vec3 translation;
+    uint node;
+    vec4 rotation; // Quaternion as x, y, z, w
+    vec3 scale;
+    float padding;
+};
+
+layout(std430, binding = 1) readonly buffer Transforms
+{
+    NodeTransform uTransforms[];
+};
+
+layout(std430, binding = 2) readonly buffer Parents
+{
+    int uParents[]; // -1 for roots
+};
+
+layout(std430, binding = 3) buffer LocalMatrices
+{
+    mat4 uLocalMatrices[];
+};
+
+layout(std430, binding = 4) buffer WorldMatrices
+{
+    mat4 uWorldMatrices[];
+};
+
+layout(std430, binding = 5) readonly buffer Nodes
+{
+    uint uNodes[]; // Only read by pass 1
+};
+
+uniform uint uPass;
+uniform uint uFirstNode; // In uNodes, only read by pass 1
+uniform uint uNodeCount;
+
+// T * R * S, as SceneHierarchy computes it
+mat4 composeTransform(NodeTransform transform)
+{
+    vec4 q = transform.rotation;
+    mat3 rotation = mat3(
+        1 - 2 * (q.y * q.y + q.z * q.z), 2 * (q.x * q.y + q.w * q.z),
+        2 * (q.x * q.z - q.w * q.y),
+        2 * (q.x * q.y - q.w * q.z), 1 - 2 * (q.x * q.x + q.z * q.z),
+        2 * (q.y * q.z + q.w * q.x),
+        2 * (q.x * q.z + q.w * q.y), 2 * (q.y * q.z - q.w * q.x),
+        1 - 2 * (q.x * q.x + q.y * q.y));
+    return mat4(vec4(rotation[0] * transform.scale.x, 0),
+        vec4(rotation[1] * transform.scale.y, 0),
+        vec4(rotation[2] * transform.scale.z, 0),
+        vec4(transform.translation, 1));
+}
+
+void main()
+{
+    uint idx = gl_GlobalInvocationID.x;
+    if (idx >= uNodeCount) {
+        return;
+    }
+
+    if (uPass == 0u) {
+        NodeTransform transform = uTransforms[idx];
+        uLocalMatrices[transform.node] = composeTransform(transform);
+        return;
+    }
+
+    uint node = uNodes[uFirstNode + idx];
+    int parent = uParents[node];
+    mat4 localMatrix = uLocalMatrices[node];
+    uWorldMatrices[node] = parent >= 0
+        ? uWorldMatrices[parent] * localMatrix
+        : localMatrix;
+}
@@ -0,0 +1,33 @@
+#version 430
+
+// Debug view of the fragment shader invocations per pixel, drawn with
+// debug_triangles.gs.glsl and additive blending without depth test (see
+// DEBUG_VIEWS in ViewerApplication.cpp). Fragments are shaded by 2x2 quads,
+// so a triangle of a pixels touching about q quads runs 4q invocations for
+// a pixels: each fragment adds 4q / a invocations, estimated for a compact
+// triangle with q = (sqrt(a) / 2 + 1)^2. Tiny triangles run up to 4
+// invocations per pixel they cover, and overlap.
+
+in vec3 gViewSpaceNormal;
+noperspective in vec2 gNdcPosition;
+flat in float gNdcArea;
+
+layout(location = 0) out vec3 fColor;
+#ifdef TAA
+// The debug views do not reproject (see motion_vectors.glsl)
+layout(location = 2) out vec2 fMotionVector;
+#endif
+
+// Color added per invocation, 16 invocations saturate the pixel
+const vec3 INVOCATION_COLOR = vec3(1.0 / 16.0, 1.0 / 32.0, 1.0 / 64.0);
+
+void main()
+{
+#ifdef TAA
+   fMotionVector = vec2(0);
+#endif
+   vec2 pixelSize = vec2(abs(dFdx(gNdcPosition.x)), abs(dFdy(gNdcPosition.y)));
+   float area = max(gNdcArea / max(pixelSize.x * pixelSize.y, 1e-12), 1.0);
+   float quads = pow(0.5 * sqrt(area) + 1.0, 2.0);
+   fColor = min(4.0 * quads / area, 4.0) * INVOCATION_COLOR;
+}
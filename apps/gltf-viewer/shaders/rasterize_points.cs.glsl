@@ -0,0 +1,140 @@
+#version 430
+
+// Point rasterization of PointClouds, one invocation per point of the
+// octree nodes selected by PointClouds::drawPoints. Each point covers a
+// square of pixels as wide as the spacing of its node on screen, at most
+// uMaxPointSize pixels, and keeps the closest one of each pixel: uPixels
+// holds a (color, depth) pair of uints per pixel, depths being the window
+// depth of the points as uints that are smaller for closer points.
+//
+// With ATOMIC_INT64 a pair is a single 64-bit value, depth in the high bits,
+// so that one atomicMin keeps the color of the closest point. Otherwise the
+// program runs twice: a first pass keeps the closest depth of each pixel,
+// and a second pass compiled with COLOR_PASS writes the color of the points
+// at that depth. REVERSED_Z must be defined if depths are reversed, with a
+// [0, 1] clip space depth.
+
+#ifdef ATOMIC_INT64
+#extension GL_ARB_gpu_shader_int64 : require
+#extension GL_NV_shader_atomic_int64 : require
+#endif
+
+layout(local_size_x = 256) in;
+
+struct Point
+{
+    vec3 position; // Object space
+    uint color; // Linear RGBA8
+};
+
+// Range of points of an octree node (see PointClouds::OctreeNode), sorted by
+// firstInvocation
+struct Node
+{
+    uint firstPoint;
+    uint pointCount;
+    uint firstInvocation;
+    uint instance; // Index in uModelViewProjMatrices
+    float spacing; // Between the points of the node, in object space
+};
+
+layout(std430, binding = 0) readonly buffer Points
+{
+    Point uPoints[];
+};
+
+layout(std430, binding = 1) readonly buffer Nodes
+{
+    Node uNodes[];
+};
+
+layout(std430, binding = 2) readonly buffer Instances
+{
+    mat4 uModelViewProjMatrices[];
+};
+
+#ifdef ATOMIC_INT64
+layout(std430, binding = 3) buffer Pixels
+{
+    uint64_t uPixels[];
+};
+#else
+layout(std430, binding = 3) buffer Pixels
+{
+    uint uPixels[];
+};
+#endif
+
+uniform uint uNodeCount;
+uniform uint uInvocationCount;
+uniform vec2 uViewportSize;
+// Pixels covered by a length of one at a distance of one
+uniform float uPixelsPerUnit;
+uniform float uMaxPointSize;
+
+void writePixel(uint pixel, uint depth, uint color)
+{
+#if defined(ATOMIC_INT64)
+    atomicMin(uPixels[pixel], (uint64_t(depth) << 32) | uint64_t(color));
+#elif defined(COLOR_PASS)
+    if (uPixels[2u * pixel + 1u] == depth) {
+        uPixels[2u * pixel] = color;
+    }
+#else
+    atomicMin(uPixels[2u * pixel + 1u], depth);
+#endif
+}
+
+void main()
+{
+    // Workgroups are laid out in rows (see PointClouds::drawPoints)
+    uint invocation = (gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x) *
+        gl_WorkGroupSize.x + gl_LocalInvocationIndex;
+    if (invocation >= uInvocationCount) {
+        return;
+    }
+    // Last node starting at or before the invocation
+    uint first = 0u;
+    uint last = uNodeCount - 1u;
+    while (first < last) {
+        uint middle = (first + last + 1u) / 2u;
+        if (uNodes[middle].firstInvocation <= invocation) {
+            first = middle;
+        } else {
+            last = middle - 1u;
+        }
+    }
+    Node node = uNodes[first];
+    Point point = uPoints[node.firstPoint + invocation - node.firstInvocation];
+
+    vec4 clipPosition = uModelViewProjMatrices[node.instance] * vec4(point.position, 1);
+    if (clipPosition.w <= 0.0 || any(greaterThan(abs(clipPosition.xy), vec2(clipPosition.w)))) {
+        return;
+    }
+#ifdef REVERSED_Z
+    if (clipPosition.z < 0.0 || clipPosition.z > clipPosition.w) {
+        return;
+    }
+#else
+    if (abs(clipPosition.z) > clipPosition.w) {
+        return;
+    }
+#endif
+    vec2 window = (clipPosition.xy / clipPosition.w * 0.5 + 0.5) * uViewportSize;
+    float size = clamp(node.spacing * uPixelsPerUnit / clipPosition.w, 1.0, uMaxPointSize);
+    int radius = int(0.5 * (size - 1.0) + 0.5);
+    ivec2 center = ivec2(window);
+    ivec2 viewportSize = ivec2(uViewportSize);
+    // Positive floats compare as their bits, whose complement is smaller for
+    // greater depths
+#ifdef REVERSED_Z
+    uint depth = ~floatBitsToUint(clipPosition.z / clipPosition.w);
+#else
+    uint depth = floatBitsToUint(clipPosition.z / clipPosition.w * 0.5 + 0.5);
+#endif
+    for (int y = max(center.y - radius, 0); y <= min(center.y + radius, viewportSize.y - 1); ++y) {
+        for (int x = max(center.x - radius, 0); x <= min(center.x + radius, viewportSize.x - 1); ++x) {
+            writePixel(uint(y * viewportSize.x + x), depth, point.color);
+        }
+    }
+}
@@ -0,0 +1,165 @@
+#version 430
+
+// World space bounds of ranges of vertices of a GeometryArena (see
+// GpuBounds::reduce), one work group per range: each invocation bounds a
+// strided part of the vertices, then the group reduces the boxes of its
+// invocations. With SUBGROUP_ARITHMETIC the boxes of each subgroup are
+// reduced by subgroupMin and subgroupMax, leaving one box per subgroup to
+// reduce in shared memory, otherwise the whole group is reduced in shared
+// memory.
+//
+// The box of each range is written to uRangeBounds and, if the range has a
+// draw, to the DrawBounds of the draw read by cull_draws.cs.glsl. The box
+// of all ranges is accumulated in uSceneBounds by atomics on floats mapped
+// to ordered uints. QUANTIZED_VERTICES must be defined if the arena stores
+// quantized vertices.
+
+#ifdef SUBGROUP_ARITHMETIC
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+#endif
+
+#define GROUP_SIZE 256
+
+layout(local_size_x = GROUP_SIZE) in;
+
+// See GpuBounds::GpuRange
+struct Range
+{
+    uint firstVertex;
+    uint vertexCount;
+    uint draw; // Index in uDrawBounds, 0xFFFFFFFF if none
+    uint padding;
+    mat4 matrix; // To world space, position transform included
+};
+
+struct DrawBounds
+{
+    vec3 bboxMin;
+    uint batch;
+    vec3 bboxMax;
+    uint batchBegin;
+    vec4 cone;
+};
+
+#ifdef QUANTIZED_VERTICES
+// Four normalized 16-bit unsigned integers per position
+layout(std430, binding = 8) readonly buffer Positions
+{
+    uvec2 uPositions[];
+};
+#else
+layout(std430, binding = 8) readonly buffer Positions
+{
+    float uPositions[];
+};
+#endif
+
+layout(std430, binding = 2) buffer Bounds
+{
+    DrawBounds uDrawBounds[];
+};
+
+layout(std430, binding = 14) readonly buffer Ranges
+{
+    Range uRanges[];
+};
+
+// Ordered uints of the scene box, min then max, cleared before the dispatch,
+// followed by the box of each range
+layout(std430, binding = 15) buffer Results
+{
+    uint uSceneBounds[8];
+    vec4 uRangeBounds[]; // Min then max per range
+};
+
+uniform bool uWritesDrawBounds;
+
+#ifdef SUBGROUP_ARITHMETIC
+// Enough for subgroups of 4 invocations or more
+shared vec3 sBoundsMin[GROUP_SIZE / 4];
+shared vec3 sBoundsMax[GROUP_SIZE / 4];
+#else
+shared vec3 sBoundsMin[GROUP_SIZE];
+shared vec3 sBoundsMax[GROUP_SIZE];
+#endif
+
+vec3 getPosition(uint vertex)
+{
+#ifdef QUANTIZED_VERTICES
+    uvec2 stored = uPositions[vertex];
+    return vec3(unpackUnorm2x16(stored.x), unpackUnorm2x16(stored.y).x);
+#else
+    uint i = 3 * vertex;
+    return vec3(uPositions[i], uPositions[i + 1], uPositions[i + 2]);
+#endif
+}
+
+// Flip the bits of negative floats, and the sign of positive ones, so that
+// their uints compare like them
+uint toOrderedUint(float value)
+{
+    uint bits = floatBitsToUint(value);
+    return (bits & 0x80000000u) != 0u ? ~bits : bits | 0x80000000u;
+}
+
+void main()
+{
+    Range range = uRanges[gl_WorkGroupID.x];
+    vec3 bboxMin = vec3(3.402823e38);
+    vec3 bboxMax = vec3(-3.402823e38);
+    for (uint i = gl_LocalInvocationID.x; i < range.vertexCount;
+         i += GROUP_SIZE) {
+        vec3 position =
+            vec3(range.matrix * vec4(getPosition(range.firstVertex + i), 1));
+        bboxMin = min(bboxMin, position);
+        bboxMax = max(bboxMax, position);
+    }
+
+#ifdef SUBGROUP_ARITHMETIC
+    bboxMin = subgroupMin(bboxMin);
+    bboxMax = subgroupMax(bboxMax);
+    if (subgroupElect()) {
+        sBoundsMin[gl_SubgroupID] = bboxMin;
+        sBoundsMax[gl_SubgroupID] = bboxMax;
+    }
+    barrier();
+    if (gl_LocalInvocationID.x != 0) {
+        return;
+    }
+    for (uint s = 1; s < gl_NumSubgroups; ++s) {
+        bboxMin = min(bboxMin, sBoundsMin[s]);
+        bboxMax = max(bboxMax, sBoundsMax[s]);
+    }
+#else
+    uint i = gl_LocalInvocationID.x;
+    sBoundsMin[i] = bboxMin;
+    sBoundsMax[i] = bboxMax;
+    for (uint stride = GROUP_SIZE / 2; stride > 0; stride /= 2) {
+        barrier();
+        if (i < stride) {
+            sBoundsMin[i] = min(sBoundsMin[i], sBoundsMin[i + stride]);
+            sBoundsMax[i] = max(sBoundsMax[i], sBoundsMax[i + stride]);
+        }
+    }
+    if (i != 0) {
+        return;
+    }
+    bboxMin = sBoundsMin[0];
+    bboxMax = sBoundsMax[0];
+#endif
+
+    // Empty ranges keep an empty box (min > max)
+    uRangeBounds[2 * gl_WorkGroupID.x] = vec4(bboxMin, 0);
+    uRangeBounds[2 * gl_WorkGroupID.x + 1] = vec4(bboxMax, 0);
+    if (uWritesDrawBounds && range.draw != 0xFFFFFFFFu) {
+        uDrawBounds[range.draw].bboxMin = bboxMin;
+        uDrawBounds[range.draw].bboxMax = bboxMax;
+    }
+    if (range.vertexCount > 0) {
+        for (int c = 0; c < 3; ++c) {
+            atomicMin(uSceneBounds[c], toOrderedUint(bboxMin[c]));
+            atomicMax(uSceneBounds[4 + c], toOrderedUint(bboxMax[c]));
+        }
+    }
+}
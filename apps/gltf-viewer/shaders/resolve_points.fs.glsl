@@ -0,0 +1,31 @@
+#version 430
+
+// Resolve pass of PointClouds: write the closest point of each pixel
+// rasterized by rasterize_points.cs.glsl with its depth, so that the points
+// are depth tested against the triangles of the scene. REVERSED_Z must be
+// defined if depths are reversed, with a [0, 1] clip space depth.
+
+layout(std430, binding = 3) readonly buffer Pixels
+{
+    uint uPixels[]; // (color, depth) pairs
+};
+
+uniform vec4 uViewport; // Origin and size, in pixels
+
+layout(location = 0) out vec4 fColor;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy - uViewport.xy);
+    uint index = uint(pixel.y * int(uViewport.z) + pixel.x);
+    uint depth = uPixels[2u * index + 1u];
+    if (depth == 0xFFFFFFFFu) {
+        discard;
+    }
+#ifdef REVERSED_Z
+    gl_FragDepth = uintBitsToFloat(~depth);
+#else
+    gl_FragDepth = uintBitsToFloat(depth);
+#endif
+    fColor = vec4(unpackUnorm4x8(uPixels[2u * index]).rgb, 1);
+}
@@ -0,0 +1,70 @@
+#version 430
+
+// I420 frames of ImageRenderer, written straight into the pixel buffer they
+// are read back from: the Y plane, then the U and V planes at half the
+// resolution, top row first, as ffmpeg -f rawvideo -pix_fmt yuv420p expects.
+// One invocation per 4 consecutive bytes of the frame, packed in a uint.
+// Colors are converted with BT.709 coefficients in limited range (16-235 for
+// Y, 16-240 for U and V).
+
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) writeonly buffer Frame
+{
+    uint bFrame[];
+};
+
+layout(binding = 0) uniform sampler2D uImage; // Bottom row first
+
+// Even
+uniform int uWidth;
+uniform int uHeight;
+
+vec3 fetchColor(int x, int y)
+{
+    return texelFetch(uImage, ivec2(x, uHeight - 1 - y), 0).rgb;
+}
+
+float getLuma(vec3 color)
+{
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Byte of the frame at offset
+uint getByte(int offset)
+{
+    int lumaSize = uWidth * uHeight;
+    if (offset < lumaSize) {
+        vec3 color = fetchColor(offset % uWidth, offset / uWidth);
+        return uint(round(16.0 + 219.0 * getLuma(color)));
+    }
+    int chromaWidth = uWidth / 2;
+    int chromaSize = chromaWidth * (uHeight / 2);
+    int chromaOffset = offset - lumaSize;
+    int plane = chromaOffset / chromaSize; // U then V
+    if (plane > 1) {
+        return 0u; // Padding of the last uint
+    }
+    int x = 2 * ((chromaOffset % chromaSize) % chromaWidth);
+    int y = 2 * ((chromaOffset % chromaSize) / chromaWidth);
+    vec3 color = 0.25 * (fetchColor(x, y) + fetchColor(x + 1, y) +
+                            fetchColor(x, y + 1) + fetchColor(x + 1, y + 1));
+    float luma = getLuma(color);
+    float chroma = plane == 0 ? (color.b - luma) / 1.8556
+                              : (color.r - luma) / 1.5748;
+    return uint(round(128.0 + 224.0 * chroma));
+}
+
+void main()
+{
+    int wordCount = (uWidth * uHeight * 3 / 2 + 3) / 4;
+    int wordIdx = int(gl_GlobalInvocationID.x);
+    if (wordIdx >= wordCount) {
+        return;
+    }
+    uint word = 0u;
+    for (int i = 0; i < 4; ++i) {
+        word |= clamp(getByte(4 * wordIdx + i), 0u, 255u) << (8 * i);
+    }
+    bFrame[wordIdx] = word;
+}
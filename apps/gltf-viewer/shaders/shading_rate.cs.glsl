@@ -0,0 +1,67 @@
+#version 430
+
+// Rates of ShadingRateImage: a work group per tile of the shading rate image,
+// an invocation per pixel of the tile, reduces the mean and the variance of
+// the luminance of the previous frame over the tile. Tiles of low variance
+// are shaded per 2x2 pixels, per 4x4 pixels below a quarter of the threshold.
+// Pixels past the edges of the frame are not counted.
+
+#ifndef TILE_WIDTH
+#define TILE_WIDTH 16
+#endif
+#ifndef TILE_HEIGHT
+#define TILE_HEIGHT 16
+#endif
+
+// Values of ShadingRateImage::Rate
+#define FULL_RATE 0u
+#define HALF_RATE 1u
+#define QUARTER_RATE 2u
+
+#define INVOCATION_COUNT (TILE_WIDTH * TILE_HEIGHT)
+
+layout(local_size_x = TILE_WIDTH, local_size_y = TILE_HEIGHT) in;
+
+layout(binding = 0) uniform sampler2D uFrame; // Previous frame, displayed
+layout(r8ui, binding = 0) uniform writeonly uimage2D uRates;
+
+uniform float uVarianceThreshold;
+
+// Sum of the luminances, of their squares and count of the pixels
+shared vec3 sMoments[INVOCATION_COUNT];
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    uint index = gl_LocalInvocationIndex;
+    vec3 moments = vec3(0);
+    if (all(lessThan(pixel, textureSize(uFrame, 0)))) {
+        vec3 color = texelFetch(uFrame, pixel, 0).rgb;
+        float luminance = dot(color, vec3(0.2126, 0.7152, 0.0722));
+        moments = vec3(luminance, luminance * luminance, 1);
+    }
+    sMoments[index] = moments;
+    barrier();
+
+    // Tree reduction, INVOCATION_COUNT is not always a power of two
+    for (uint stride = 1u; stride < uint(INVOCATION_COUNT); stride *= 2u) {
+        if (index % (2u * stride) == 0u &&
+            index + stride < uint(INVOCATION_COUNT)) {
+            sMoments[index] += sMoments[index + stride];
+        }
+        barrier();
+    }
+
+    if (index == 0u) {
+        vec3 total = sMoments[0];
+        float mean = total.x / max(total.z, 1.0);
+        float variance = max(total.y / max(total.z, 1.0) - mean * mean, 0.0);
+        uint rate = FULL_RATE;
+        if (variance < 0.25 * uVarianceThreshold) {
+            rate = QUARTER_RATE;
+        } else if (variance < uVarianceThreshold) {
+            rate = HALF_RATE;
+        }
+        imageStore(uRates, ivec2(gl_WorkGroupID.xy), uvec4(rate));
+    }
+}
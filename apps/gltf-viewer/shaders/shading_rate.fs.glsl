@@ -0,0 +1,23 @@
+#version 430
+
+// Debug view of ShadingRateImage, blended over the frame: tiles shaded per
+// 2x2 pixels are tinted yellow, per 4x4 pixels red, full rate tiles are left
+// as is.
+
+layout(binding = 0) uniform usampler2D uRates;
+
+uniform vec2 uTileSize; // In pixels
+
+out vec4 fColor;
+
+void main()
+{
+    uint rate = texelFetch(uRates, ivec2(gl_FragCoord.xy / uTileSize), 0).r;
+    if (rate == 1u) {
+        fColor = vec4(1, 1, 0, 0.35);
+    } else if (rate == 2u) {
+        fColor = vec4(1, 0, 0, 0.35);
+    } else {
+        fColor = vec4(0);
+    }
+}
@@ -0,0 +1,77 @@
+#version 430
+
+// Skinning pre-pass (see SceneSkins::skinVertices), one invocation per vertex
+// of a mesh: skin its bind pose position and normal and write them in the
+// POSITION and NORMAL streams of the GeometryArena, which then hold world
+// space vertices for every draw of the frame.
+
+layout(local_size_x = 64) in;
+
+#include "skinning.glsl"
+
+// Float vertices, three floats per position or normal
+layout(std430, binding = 8) readonly buffer BindPositions
+{
+    float uBindPositions[];
+};
+
+layout(std430, binding = 9) readonly buffer BindNormals
+{
+    float uBindNormals[];
+};
+
+// SceneSkins::SkinVertex: four 16-bit joints, then four normalized 16-bit
+// weights
+layout(std430, binding = 10) readonly buffer SkinVertices
+{
+    uvec4 uSkinVertices[];
+};
+
+layout(std430, binding = 11) writeonly buffer Positions
+{
+    float uPositions[];
+};
+
+layout(std430, binding = 12) writeonly buffer Normals
+{
+    float uNormals[];
+};
+
+uniform uint uFirstVertex; // In the arena
+uniform uint uVertexCount;
+uniform uint uFirstBindPoseVertex; // In BindPositions and BindNormals
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uVertexCount) {
+        return;
+    }
+    uint vertex = uFirstVertex + i;
+    uint bindPoseVertex = uFirstBindPoseVertex + i;
+
+    uvec4 skinVertex = uSkinVertices[vertex];
+    uvec4 joints = uvec4(skinVertex.x & 0xFFFFu, skinVertex.x >> 16,
+        skinVertex.y & 0xFFFFu, skinVertex.y >> 16);
+    vec4 weights = vec4(unpackUnorm2x16(skinVertex.z),
+        unpackUnorm2x16(skinVertex.w));
+    mat4 skinMatrix = getSkinMatrix(joints, weights);
+
+    uint src = 3 * bindPoseVertex;
+    vec3 position = vec3(uBindPositions[src], uBindPositions[src + 1],
+        uBindPositions[src + 2]);
+    vec3 normal = vec3(uBindNormals[src], uBindNormals[src + 1],
+        uBindNormals[src + 2]);
+    position = vec3(skinMatrix * vec4(position, 1));
+    // Missing normals stay null
+    normal = mat3(skinMatrix) * normal;
+    if (dot(normal, normal) > 0.0) {
+        normal = normalize(normal);
+    }
+
+    uint dst = 3 * vertex;
+    for (uint c = 0; c < 3; ++c) {
+        uPositions[dst + c] = position[c];
+        uNormals[dst + c] = normal[c];
+    }
+}
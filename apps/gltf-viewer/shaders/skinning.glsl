@@ -0,0 +1,21 @@
+// Joint matrices of the skin of the draw, see SceneSkins. Shared by the
+// skinned shaders with #include "skinning.glsl".
+
+// World space joint matrices, the palette of a single skin
+layout(std430, binding = 7) readonly buffer JointMatrices
+{
+    mat4 uJointMatrices[];
+};
+
+// World space skinning matrix of a vertex. Vertices with null weights are not
+// skinned and keep their position.
+mat4 getSkinMatrix(uvec4 joints, vec4 weights)
+{
+    if (weights.x + weights.y + weights.z + weights.w <= 0.0) {
+        return mat4(1.0);
+    }
+    return weights.x * uJointMatrices[joints.x] +
+        weights.y * uJointMatrices[joints.y] +
+        weights.z * uJointMatrices[joints.z] +
+        weights.w * uJointMatrices[joints.w];
+}
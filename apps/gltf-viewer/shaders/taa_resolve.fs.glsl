@@ -0,0 +1,75 @@
+#version 430
+
+// Resolve of TemporalAntiAliasing: blend the frame with the history
+// reprojected by its motion vectors and clamped to the colors around the
+// pixel, giving the next history.
+
+layout(binding = 0) uniform sampler2D uColor;
+layout(binding = 1) uniform sampler2D uMotionVectors;
+layout(binding = 2) uniform sampler2D uDepth;
+layout(binding = 3) uniform sampler2D uHistory; // Linear filtering
+
+// From the NDC of this frame to the clip space of the previous one, for the
+// pixels without motion vectors
+uniform mat4 uReprojectionMatrix;
+// Jitter of this frame minus the one of the previous frame, in texture
+// coordinates
+uniform vec2 uJitterDelta;
+// Depth to NDC z: scale then offset
+uniform vec2 uDepthToNdc;
+// Weight of the history, 0 without history
+uniform float uHistoryWeight;
+// Of the window, the textures may be larger. Texture coordinates of the
+// window times uHistoryScale are those of uHistory.
+uniform vec2 uSize;
+uniform vec2 uHistoryScale;
+
+out vec4 fColor;
+
+// TemporalAntiAliasing::NO_MOTION
+#define NO_MOTION 1e4
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec2 size = uSize;
+    vec2 uv = gl_FragCoord.xy / size;
+    vec3 color = texelFetch(uColor, pixel, 0).rgb;
+    if (uHistoryWeight == 0.0) {
+        fColor = vec4(color, 1);
+        return;
+    }
+
+    // Surfaces not drawn with motion vectors, such as the background, only
+    // move with the camera. Homogeneous coordinates keep the infinite far
+    // plane of reversed-Z.
+    vec2 motion = texelFetch(uMotionVectors, pixel, 0).xy;
+    if (motion.x >= NO_MOTION) {
+        float depth = texelFetch(uDepth, pixel, 0).r;
+        vec4 ndc = vec4(uv * 2.0 - 1.0, depth * uDepthToNdc.x + uDepthToNdc.y, 1);
+        vec4 previous = uReprojectionMatrix * ndc;
+        motion = uv - (previous.xy / previous.w * 0.5 + 0.5);
+    }
+    vec2 historyUv = uv - motion + uJitterDelta;
+    if (any(lessThan(historyUv, vec2(0))) || any(greaterThan(historyUv, vec2(1)))) {
+        fColor = vec4(color, 1);
+        return;
+    }
+
+    // Colors the history may take without ghosting
+    vec3 minColor = color;
+    vec3 maxColor = color;
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            ivec2 neighbor = clamp(pixel + ivec2(x, y), ivec2(0), ivec2(size) - 1);
+            vec3 neighborColor = texelFetch(uColor, neighbor, 0).rgb;
+            minColor = min(minColor, neighborColor);
+            maxColor = max(maxColor, neighborColor);
+        }
+    }
+    // Not filtered with the texels past the edges of the window
+    historyUv = clamp(historyUv, 0.5 / size, 1.0 - 0.5 / size);
+    vec3 history = clamp(texture(uHistory, historyUv * uHistoryScale).rgb,
+                         minColor, maxColor);
+    fColor = vec4(mix(color, history, uHistoryWeight), 1);
+}
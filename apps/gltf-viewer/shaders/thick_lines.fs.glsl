@@ -0,0 +1,10 @@
+#version 430
+
+in vec4 vColor;
+
+layout(location = 0) out vec4 fColor;
+
+void main()
+{
+    fColor = vec4(vColor.rgb, 1);
+}
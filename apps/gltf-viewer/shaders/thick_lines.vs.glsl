@@ -0,0 +1,58 @@
+#version 430
+
+// Segments of the LINES primitives of PointClouds, each drawn as an instance
+// of a quad of 4 vertices drawn as a triangle strip without vertex
+// attributes, uLineWidth pixels wide on screen. Drawn with
+// thick_lines.fs.glsl.
+
+struct LineVertex
+{
+    vec3 position; // Object space
+    uint color; // Linear RGBA8
+};
+
+// Two vertices per segment
+layout(std430, binding = 4) readonly buffer LineVertices
+{
+    LineVertex uLineVertices[];
+};
+
+uniform mat4 uModelViewProjMatrix;
+uniform uint uFirstSegment;
+uniform vec2 uViewportSize;
+uniform float uLineWidth;
+
+out vec4 vColor;
+
+void main()
+{
+    uint segment = uFirstSegment + uint(gl_InstanceID);
+    LineVertex a = uLineVertices[2u * segment];
+    LineVertex b = uLineVertices[2u * segment + 1u];
+    vec4 clipA = uModelViewProjMatrix * vec4(a.position, 1);
+    vec4 clipB = uModelViewProjMatrix * vec4(b.position, 1);
+    // Segments crossing the plane of the eye are cut in front of it, so
+    // that their direction on screen is defined
+    const float minW = 1e-5;
+    if (clipA.w < minW && clipB.w < minW) {
+        gl_Position = vec4(0);
+        vColor = vec4(0);
+        return;
+    }
+    if (clipA.w < minW) {
+        clipA = mix(clipA, clipB, (minW - clipA.w) / (clipB.w - clipA.w));
+    } else if (clipB.w < minW) {
+        clipB = mix(clipB, clipA, (minW - clipB.w) / (clipA.w - clipB.w));
+    }
+
+    vec2 direction = (clipB.xy / clipB.w - clipA.xy / clipA.w) * uViewportSize;
+    direction = dot(direction, direction) > 0.0 ? normalize(direction) : vec2(1, 0);
+    // Half the width on each side, in normalized device coordinates
+    vec2 offset = vec2(-direction.y, direction.x) * uLineWidth / uViewportSize;
+    bool isB = gl_VertexID >= 2;
+    vec4 clipPosition = isB ? clipB : clipA;
+    float side = (gl_VertexID & 1) == 0 ? -1.0 : 1.0;
+    clipPosition.xy += side * offset * clipPosition.w;
+    gl_Position = clipPosition;
+    vColor = unpackUnorm4x8(isB ? b.color : a.color);
+}
@@ -0,0 +1,51 @@
+#version 430
+
+// Last step of PostProcessing, one invocation per pixel: exposes the HDR
+// frame, adds the bloom, maps it to [0, 1] with the ACES filmic curve,
+// grades it by uSaturation and uContrast and writes it in sRGB.
+
+#include "exposure.glsl"
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(rgba8, binding = 0) uniform writeonly image2D uDestination;
+
+layout(binding = 0) uniform sampler2D uColor; // HDR frame
+layout(binding = 1) uniform sampler2D uBloom; // Level 0 is the sum of levels
+
+uniform float uBloomIntensity;
+uniform float uSaturation;
+uniform float uContrast;
+
+// Fit of the ACES reference rendering transform by Krzysztof Narkowicz
+vec3 toneMapAces(vec3 color)
+{
+    color *= 0.6;
+    return clamp((color * (2.51 * color + 0.03)) / (color * (2.43 * color + 0.59) + 0.14), 0.0, 1.0);
+}
+
+vec3 linearToSrgb(vec3 color)
+{
+    return mix(color * 12.92, 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055,
+        step(0.0031308, color));
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(uDestination);
+    if (any(greaterThanEqual(texel, size))) {
+        return;
+    }
+    vec2 uv = (vec2(texel) + 0.5) / vec2(size);
+    // The bloom is exposed already
+    vec3 color = texelFetch(uColor, texel, 0).rgb * getExposure() +
+        uBloomIntensity * textureLod(uBloom, uv, 0.0).rgb;
+    color = toneMapAces(color);
+
+    color = max(mix(vec3(getLuminance(color)), color, uSaturation), 0.0);
+    color = linearToSrgb(color);
+    // Around middle gray, in the perceptual space of sRGB
+    color = clamp((color - 0.5) * uContrast + 0.5, 0.0, 1.0);
+    imageStore(uDestination, texel, vec4(color, 1));
+}
@@ -0,0 +1,61 @@
+// Order-independent transparency, see TransparencyBuffer. Scene programs
+// compiled with OIT draw the transparent draws of a frame in a second pass
+// where isTransparentPass() is true, writing their fragments with
+// shadeTransparentFragment() in any order. transparency_resolve.fs.glsl then
+// composites them over the opaque draws.
+
+// OitMode
+#define OIT_WEIGHTED_BLENDED 1u
+#define OIT_LINKED_LIST 2u
+
+// TransparencyBuffer::Uniforms
+layout(std140) uniform TransparencyUniforms
+{
+    // x: OitMode of the transparent pass, 0 during the opaque one, y: node
+    // capacity, z: width of the heads, w: 1 with reversed depths
+    uvec4 uTransparencyInfo;
+    ivec4 uTransparencyViewport; // Origin of the viewport of the caller
+};
+
+// Linked lists: the first node of the list of each pixel, ~0u if empty
+layout(std430, binding = 17) coherent buffer TransparencyHeads
+{
+    uint uHeads[];
+};
+
+// Linked lists: color and alpha as 4 halfs, window depth, next node
+layout(std430, binding = 18) coherent buffer TransparencyNodes
+{
+    uint uNodeCount; // Allocated nodes, may exceed the capacity
+    uint uNodePadding[3];
+    uvec4 uNodes[];
+};
+
+bool isTransparentPass()
+{
+    return uTransparencyInfo.x != 0u;
+}
+
+// Fragment of a transparent draw of color and coverage alpha, at a
+// (positive) view depth. With OIT_WEIGHTED_BLENDED, return the accumulated
+// color and set revealage (outputs 0 and 1). With OIT_LINKED_LIST, append the
+// fragment to the list of its pixel, the outputs are not drawn.
+vec4 shadeTransparentFragment(vec3 color, float alpha, float viewDepth, out float revealage)
+{
+    revealage = alpha;
+    if (uTransparencyInfo.x == OIT_WEIGHTED_BLENDED) {
+        // Weight decreasing with depth, equation 10 of McGuire and Bavoil,
+        // "Weighted Blended Order-Independent Transparency", 2013
+        float z = viewDepth;
+        float weight = alpha * clamp(10.0 / (1e-5 + pow(z / 5.0, 2.0) + pow(z / 200.0, 6.0)), 1e-2, 3e3);
+        return vec4(color * alpha, alpha) * weight;
+    }
+    uint node = atomicAdd(uNodeCount, 1u);
+    if (node < uTransparencyInfo.y) {
+        uvec2 pixel = uvec2(gl_FragCoord.xy);
+        uint next = atomicExchange(uHeads[pixel.y * uTransparencyInfo.z + pixel.x], node);
+        uNodes[node] = uvec4(packHalf2x16(color.rg), packHalf2x16(vec2(color.b, alpha)),
+            floatBitsToUint(gl_FragCoord.z), next);
+    }
+    return vec4(0);
+}
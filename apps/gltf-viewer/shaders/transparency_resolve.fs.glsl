@@ -0,0 +1,76 @@
+#version 430
+
+// Resolve pass of TransparencyBuffer: composite the transparent fragments of
+// a pixel over the opaque draws, compiled with WEIGHTED_BLENDED or
+// LINKED_LIST. The output is blended with (GL_ONE, GL_SRC_ALPHA): the color
+// of the fragments then the transmittance through them.
+
+#include "transparency.glsl"
+
+out vec4 fColor;
+
+#ifdef WEIGHTED_BLENDED
+layout(binding = 0) uniform sampler2D uAccumulation;
+layout(binding = 1) uniform sampler2D uRevealage;
+#else
+// Nearest fragments blended per pixel, farther ones are dropped
+#define MAX_RESOLVED_FRAGMENTS 16
+// Depth of the opaque draws, in window space
+layout(binding = 2) uniform sampler2D uOpaqueDepth;
+#endif
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy) - uTransparencyViewport.xy;
+#ifdef WEIGHTED_BLENDED
+    float revealage = texelFetch(uRevealage, pixel, 0).r;
+    if (revealage >= 1.0) {
+        discard;
+    }
+    vec4 accumulation = texelFetch(uAccumulation, pixel, 0);
+    vec3 average = accumulation.rgb / max(accumulation.a, 1e-5);
+    fColor = vec4(average * (1.0 - revealage), revealage);
+#else
+    uint node = uHeads[pixel.y * int(uTransparencyInfo.z) + pixel.x];
+    if (node == ~0u) {
+        discard;
+    }
+    // Fragments in front of the opaque draws, sorted nearest first by
+    // insertion: lists are short
+    bool isReversed = uTransparencyInfo.w != 0u;
+    float opaqueDepth = texelFetch(uOpaqueDepth, pixel, 0).r;
+    uvec4 fragments[MAX_RESOLVED_FRAGMENTS];
+    int count = 0;
+    for (; node != ~0u; node = uNodes[node].w) {
+        uvec4 fragment = uNodes[node];
+        float depth = uintBitsToFloat(fragment.z);
+        if (isReversed ? depth <= opaqueDepth : depth >= opaqueDepth) {
+            continue;
+        }
+        // Past the capacity, the farthest fragment is replaced
+        int i = count < MAX_RESOLVED_FRAGMENTS ? count++ : MAX_RESOLVED_FRAGMENTS;
+        for (; i > 0; --i) {
+            float previousDepth = uintBitsToFloat(fragments[i - 1].z);
+            if (isReversed ? previousDepth >= depth : previousDepth <= depth) {
+                break;
+            }
+            if (i < MAX_RESOLVED_FRAGMENTS) {
+                fragments[i] = fragments[i - 1];
+            }
+        }
+        if (i < MAX_RESOLVED_FRAGMENTS) {
+            fragments[i] = fragment;
+        }
+    }
+
+    vec3 color = vec3(0);
+    float transmittance = 1.0;
+    for (int i = 0; i < count; ++i) {
+        vec2 rg = unpackHalf2x16(fragments[i].x);
+        vec2 ba = unpackHalf2x16(fragments[i].y);
+        color += transmittance * ba.y * vec3(rg, ba.x);
+        transmittance *= 1.0 - ba.y;
+    }
+    fColor = vec4(color, transmittance);
+#endif
+}
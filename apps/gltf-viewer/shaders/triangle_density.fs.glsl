@@ -0,0 +1,34 @@
+#version 430
+
+// Debug view coloring each triangle by its area in pixels: red below a
+// pixel, yellow around 16 pixels and green from 256 pixels. Drawn with
+// debug_triangles.gs.glsl.
+
+in vec3 gViewSpaceNormal;
+noperspective in vec2 gNdcPosition;
+flat in float gNdcArea;
+
+layout(location = 0) out vec3 fColor;
+#ifdef TAA
+// The debug views do not reproject (see motion_vectors.glsl)
+layout(location = 2) out vec2 fMotionVector;
+#endif
+
+// Area of the triangle in pixels, from the size of a pixel in normalized
+// device coordinates
+float getPixelArea()
+{
+   vec2 pixelSize = vec2(abs(dFdx(gNdcPosition.x)), abs(dFdy(gNdcPosition.y)));
+   return gNdcArea / max(pixelSize.x * pixelSize.y, 1e-12);
+}
+
+void main()
+{
+#ifdef TAA
+   fMotionVector = vec2(0);
+#endif
+   float density = clamp(log2(max(getPixelArea(), 1.0)) / 8.0, 0.0, 1.0);
+   vec3 color = density < 0.5 ? mix(vec3(1, 0, 0), vec3(1, 1, 0), 2.0 * density) : mix(vec3(1, 1, 0), vec3(0, 1, 0), 2.0 * density - 1.0);
+   vec3 viewSpaceNormal = normalize(gViewSpaceNormal);
+   fColor = color * (0.4 + 0.6 * abs(viewSpaceNormal.z));
+}
@@ -0,0 +1,91 @@
+#version 430
+
+// Per draw matrices and bounds of the moving draws of an IndirectDrawList,
+// from the world matrices of a GpuTransformHierarchy, one invocation per
+// moving draw whose node moved, listed in uSourceIndices (see
+// IndirectDrawList::updateTransforms). The normal matrix is computed here
+// rather than per draw on the CPU.
+
+layout(local_size_x = 64) in;
+
+struct DrawTransform
+{
+    mat4 modelMatrix;
+    mat4 normalMatrix;
+};
+
+struct DrawSource
+{
+    vec3 bboxMin; // Object space, empty if greater than bboxMax
+    uint node; // In uWorldMatrices
+    vec3 bboxMax;
+    uint draw; // In uDrawTransforms and uBounds
+    vec4 positionScale; // See ArenaPrimitive::positionMatrix
+    vec4 positionOffset;
+};
+
+struct DrawBounds
+{
+    vec3 bboxMin;
+    uint batch;
+    vec3 bboxMax;
+    uint batchBegin;
+    vec4 cone;
+};
+
+layout(std430, binding = 0) writeonly buffer DrawTransforms
+{
+    DrawTransform uDrawTransforms[];
+};
+
+layout(std430, binding = 1) readonly buffer DrawSources
+{
+    DrawSource uSources[];
+};
+
+layout(std430, binding = 2) buffer Bounds
+{
+    DrawBounds uBounds[];
+};
+
+layout(std430, binding = 3) readonly buffer WorldMatrices
+{
+    mat4 uWorldMatrices[];
+};
+
+layout(std430, binding = 4) readonly buffer SourceIndices
+{
+    uint uSourceIndices[];
+};
+
+uniform uint uSourceCount; // In uSourceIndices
+
+void main()
+{
+    uint idx = gl_GlobalInvocationID.x;
+    if (idx >= uSourceCount) {
+        return;
+    }
+
+    DrawSource source = uSources[uSourceIndices[idx]];
+    mat4 worldMatrix = uWorldMatrices[source.node];
+    mat4 positionMatrix = mat4(vec4(source.positionScale.x, 0, 0, 0),
+        vec4(0, source.positionScale.y, 0, 0),
+        vec4(0, 0, source.positionScale.z, 0),
+        vec4(source.positionOffset.xyz, 1));
+    uDrawTransforms[source.draw] = DrawTransform(worldMatrix * positionMatrix,
+        transpose(inverse(worldMatrix)));
+
+    // Draws without bounds keep infinite ones
+    if (any(greaterThan(source.bboxMin, source.bboxMax))) {
+        return;
+    }
+    vec3 center = 0.5 * (source.bboxMin + source.bboxMax);
+    vec3 extent = 0.5 * (source.bboxMax - source.bboxMin);
+    vec3 worldCenter = vec3(worldMatrix * vec4(center, 1));
+    mat3 absMatrix = mat3(abs(worldMatrix[0].xyz), abs(worldMatrix[1].xyz),
+        abs(worldMatrix[2].xyz));
+    vec3 worldExtent = absMatrix * extent;
+    uBounds[source.draw].bboxMin = worldCenter - worldExtent;
+    uBounds[source.draw].bboxMax = worldCenter + worldExtent;
+}
@@ -0,0 +1,53 @@
+// Vertex attributes of the primitives stored in a GeometryArena, shared by
+// the vertex shaders with #include "vertex_attributes.glsl"
+//
+// With VERTEX_PULLING, the attributes are fetched from the streams of the
+// arena at gl_VertexID, which includes the base vertex of the draw (see
+// vertex_pulling.glsl), and the material from the buffer of the draws at
+// gl_BaseInstanceARB (see IndirectDrawList::setVertexPulling). Only indexed
+// indirect draws set it.
+
+#ifdef VERTEX_PULLING
+#extension GL_ARB_shader_draw_parameters : require
+
+#include "vertex_pulling.glsl"
+
+#define aPosition pullPosition(gl_VertexID)
+#define aNormal pullNormal(gl_VertexID)
+#define aTexCoords pullTexCoords(gl_VertexID)
+
+// GeometryArena::MATERIAL_ID_STORAGE_BINDING, one per draw
+layout(std430, binding = 11) readonly buffer DrawMaterialIds
+{
+    uint uDrawMaterialIds[];
+};
+
+#define aMaterialID uDrawMaterialIds[gl_BaseInstanceARB]
+#else
+#ifdef QUANTIZED_VERTICES
+// Normalized in the bounds of the mesh, the model matrices dequantize them
+// (see ArenaPrimitive::positionMatrix)
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec2 aOctahedralNormal;
+layout(location = 2) in vec2 aTexCoords; // Half floats
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    // Unfold the lower hemisphere
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+#define aNormal decodeOctahedral(aOctahedralNormal)
+#else
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+#endif
+
+// Material of the draw, in the buffer of MaterialBuffer (see
+// GeometryArena::MATERIAL_ID_LOCATION)
+layout(location = 12) in uint aMaterialID;
+#endif
@@ -0,0 +1,78 @@
+// Vertices of the primitives stored in a GeometryArena, fetched from its
+// streams bound as storage buffers (see GeometryArena::bindVertexStorage) by
+// vertex index, base vertex included. Shared by the vertex shaders pulling
+// their attributes (see vertex_attributes.glsl) and by the resolve of the
+// visibility buffer with #include "vertex_pulling.glsl"
+
+#ifdef QUANTIZED_VERTICES
+// GeometryArena::VERTEX_STORAGE_BINDING + stream, 16-bit components packed
+// in words: positions padded to 4 components, normals octahedral encoded,
+// texture coordinates as half floats
+layout(std430, binding = 8) readonly buffer Positions
+{
+    uvec2 uPositions[];
+};
+layout(std430, binding = 9) readonly buffer Normals
+{
+    uint uNormals[];
+};
+layout(std430, binding = 10) readonly buffer TexCoords
+{
+    uint uTexCoords[];
+};
+
+// Normalized in the bounds of the mesh, the model matrices dequantize them
+// (see ArenaPrimitive::positionMatrix)
+vec3 pullPosition(int vertex)
+{
+    uvec2 position = uPositions[vertex];
+    return vec3(unpackUnorm2x16(position.x), unpackUnorm2x16(position.y).x);
+}
+
+vec3 pullNormal(int vertex)
+{
+    vec2 e = unpackSnorm2x16(uNormals[vertex]);
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    // Unfold the lower hemisphere
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+vec2 pullTexCoords(int vertex)
+{
+    return unpackHalf2x16(uTexCoords[vertex]);
+}
+#else
+// GeometryArena::VERTEX_STORAGE_BINDING + stream, tightly packed floats
+layout(std430, binding = 8) readonly buffer Positions
+{
+    float uPositions[];
+};
+layout(std430, binding = 9) readonly buffer Normals
+{
+    float uNormals[];
+};
+layout(std430, binding = 10) readonly buffer TexCoords
+{
+    float uTexCoords[];
+};
+
+vec3 pullPosition(int vertex)
+{
+    int i = 3 * vertex;
+    return vec3(uPositions[i], uPositions[i + 1], uPositions[i + 2]);
+}
+
+vec3 pullNormal(int vertex)
+{
+    int i = 3 * vertex;
+    return vec3(uNormals[i], uNormals[i + 1], uNormals[i + 2]);
+}
+
+vec2 pullTexCoords(int vertex)
+{
+    int i = 2 * vertex;
+    return vec2(uTexCoords[i], uTexCoords[i + 1]);
+}
+#endif
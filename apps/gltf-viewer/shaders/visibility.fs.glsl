@@ -0,0 +1,28 @@
+#version 430
+
+#include "materials.glsl"
+
+// Geometry pass of visibility buffer rendering (see
+// GBuffer::beginVisibility): the draw index and the triangle index of the
+// surface seen by each pixel, the surface is reconstructed and shaded once
+// per pixel by visibility_resolve.fs.glsl. Only masked materials sample a
+// texture, for their alpha test. Drawn with forward_indirect.vs.glsl compiled
+// with VISIBILITY_BUFFER.
+
+in vec2 vTexCoords;
+flat in uint vMaterialID;
+flat in uint vDrawID;
+
+layout(location = 0) out uvec2 fVisibility;
+
+void main()
+{
+    Material material = uMaterials[vMaterialID];
+    // Sampled in uniform control flow, only used by masked materials
+    float alpha = material.baseColorFactor.a *
+        sampleMaterialTexture(material, BASE_COLOR_TEXTURE, vTexCoords, vec4(1)).a;
+    if (material.alphaCutoff > 0.0 && alpha < material.alphaCutoff) {
+        discard;
+    }
+    fVisibility = uvec2(vDrawID, uint(gl_PrimitiveID));
+}
@@ -0,0 +1,195 @@
+#version 430
+
+#include "materials.glsl"
+#include "lights.glsl"
+#include "gbuffer.glsl"
+#include "camera.glsl"
+#include "vertex_pulling.glsl"
+
+// Resolve of visibility buffer rendering (see GBuffer::resolveVisibility),
+// drawn over the viewport with fullscreen.vs.glsl: the triangle seen by each
+// pixel is fetched from the index buffer and the vertex streams of the
+// GeometryArena, its attributes are interpolated at the pixel with
+// barycentric coordinates computed here, and the material is written in
+// the G-buffer as gbuffer.fs.glsl does. Texture filtering uses analytic
+// derivatives of the barycentric coordinates, since neighbor pixels may see
+// other triangles. Points and lines take the attributes of their first
+// vertex.
+
+// Draw index and primitive index of each pixel, NO_DRAW for the background
+layout(rg32ui, binding = 0) uniform readonly uimage2D uVisibility;
+
+uniform vec2 uSize; // Of the viewport, the G-buffer may be larger
+// Indices are GL_UNSIGNED_SHORT, GL_UNSIGNED_INT otherwise (see
+// GeometryArena::indexType)
+uniform bool uShortIndices;
+
+#define NO_DRAW 0xffffffffu
+
+// Same as in forward_indirect.vs.glsl
+struct DrawTransform
+{
+    mat4 modelMatrix;
+    mat4 normalMatrix; // World space normal matrix
+};
+
+layout(std430, binding = 0) readonly buffer DrawTransforms
+{
+    DrawTransform uDrawTransforms[];
+};
+
+// See IndirectDrawList::DrawGeometry
+struct DrawGeometry
+{
+    uint firstIndex;
+    int baseVertex;
+    uint materialID;
+    uint mode;
+};
+
+layout(std430, binding = 13) readonly buffer DrawGeometries
+{
+    DrawGeometry uDrawGeometries[];
+};
+
+// GeometryArena::INDEX_STORAGE_BINDING, 16-bit indices are packed by two
+layout(std430, binding = 12) readonly buffer Indices
+{
+    uint uIndices[];
+};
+
+layout(location = 0) out vec4 fBaseColorMetallic;
+layout(location = 1) out vec4 fNormalRoughness;
+layout(location = 2) out vec3 fRadiance;
+
+uint fetchIndex(uint i)
+{
+    if (uShortIndices) {
+        uint word = uIndices[i >> 1u];
+        return (i & 1u) == 0u ? word & 0xffffu : word >> 16u;
+    }
+    return uIndices[i];
+}
+
+bool isTriangleMode(uint mode)
+{
+    // GL_TRIANGLES, GL_TRIANGLE_STRIP and GL_TRIANGLE_FAN
+    return mode >= 0x0004u && mode <= 0x0006u;
+}
+
+// Elements of the vertices of primitive in a draw of mode, only the first
+// one is read for points and lines
+uvec3 getPrimitiveElements(uint mode, uint primitive)
+{
+    switch (mode) {
+    case 0x0004u: // GL_TRIANGLES
+        return 3u * primitive + uvec3(0, 1, 2);
+    case 0x0005u: // GL_TRIANGLE_STRIP
+        return primitive + uvec3(0, 1, 2);
+    case 0x0006u: // GL_TRIANGLE_FAN
+        return uvec3(0u, primitive + 1u, primitive + 2u);
+    case 0x0001u: // GL_LINES
+        return uvec3(2u * primitive);
+    default: // GL_POINTS, GL_LINE_STRIP and GL_LINE_LOOP
+        return uvec3(primitive);
+    }
+}
+
+// Perspective correct barycentric coordinates of the point of normalized
+// device coordinates ndc in the triangle of clip space positions c0, c1 and
+// c2, and their differences with those of the pixels to its right (ddx)
+// and top (ddy). The screen space barycentric coordinates divided by w are
+// linear in screen space, so are their derivatives, see "The Visibility
+// Buffer: A Cache-Friendly Approach to Deferred Shading" (Burns and Hunt).
+vec3 getBarycentrics(vec4 c0, vec4 c1, vec4 c2, vec2 ndc, out vec3 ddx, out vec3 ddy)
+{
+    vec3 invW = 1.0 / vec3(c0.w, c1.w, c2.w);
+    vec2 p0 = c0.xy * invW.x;
+    vec2 p1 = c1.xy * invW.y;
+    vec2 p2 = c2.xy * invW.z;
+    float invDet = 1.0 / determinant(mat2(p2 - p1, p0 - p1));
+    // Derivatives of the coordinates over w along x and y in NDC
+    vec3 dx = vec3(p1.y - p2.y, p2.y - p0.y, p0.y - p1.y) * invDet * invW;
+    vec3 dy = vec3(p2.x - p1.x, p0.x - p2.x, p1.x - p0.x) * invDet * invW;
+    float dxSum = dx.x + dx.y + dx.z;
+    float dySum = dy.x + dy.y + dy.z;
+
+    vec2 delta = ndc - p0;
+    vec3 lambdaOverW = vec3(invW.x, 0, 0) + delta.x * dx + delta.y * dy;
+    float interpolatedInvW = invW.x + delta.x * dxSum + delta.y * dySum;
+    vec3 lambda = lambdaOverW / interpolatedInvW;
+
+    // A pixel spans 2 / uSize in NDC
+    vec2 pixel = 2.0 / uSize;
+    ddx = (lambdaOverW + dx * pixel.x) / (interpolatedInvW + dxSum * pixel.x) - lambda;
+    ddy = (lambdaOverW + dy * pixel.y) / (interpolatedInvW + dySum * pixel.y) - lambda;
+    return lambda;
+}
+
+void main()
+{
+    uvec2 visibility = imageLoad(uVisibility, ivec2(gl_FragCoord.xy)).xy;
+    if (visibility.x == NO_DRAW) {
+        discard;
+    }
+    DrawGeometry draw = uDrawGeometries[visibility.x];
+    DrawTransform drawTransform = uDrawTransforms[visibility.x];
+    uvec3 elements = getPrimitiveElements(draw.mode, visibility.y);
+
+    vec3 viewSpacePositions[3];
+    vec4 clipPositions[3];
+    vec3 normals[3];
+    vec2 texCoords[3];
+    for (int i = 0; i < 3; ++i) {
+        int vertex = int(fetchIndex(draw.firstIndex + elements[i])) + draw.baseVertex;
+        vec4 viewSpacePosition = uViewMatrix * drawTransform.modelMatrix * vec4(pullPosition(vertex), 1);
+        viewSpacePositions[i] = vec3(viewSpacePosition);
+        clipPositions[i] = uProjMatrix * viewSpacePosition;
+        normals[i] = pullNormal(vertex);
+        texCoords[i] = pullTexCoords(vertex);
+    }
+
+    vec3 lambda = vec3(1, 0, 0);
+    vec3 ddx = vec3(0);
+    vec3 ddy = vec3(0);
+    if (isTriangleMode(draw.mode)) {
+        vec2 ndc = gl_FragCoord.xy / uSize * 2.0 - 1.0;
+        lambda = getBarycentrics(clipPositions[0], clipPositions[1], clipPositions[2], ndc, ddx, ddy);
+    }
+    vec3 viewSpacePosition = mat3(viewSpacePositions[0], viewSpacePositions[1], viewSpacePositions[2]) * lambda;
+    vec3 normal = mat3(normals[0], normals[1], normals[2]) * lambda;
+    mat3x2 texCoordMatrix = mat3x2(texCoords[0], texCoords[1], texCoords[2]);
+    vec2 uv = texCoordMatrix * lambda;
+    vec2 uvDx = texCoordMatrix * ddx;
+    vec2 uvDy = texCoordMatrix * ddy;
+
+    Material material = uMaterials[draw.materialID];
+    vec4 baseColor = material.baseColorFactor *
+        sampleMaterialTextureGrad(material, BASE_COLOR_TEXTURE, uv, uvDx, uvDy, vec4(1));
+    vec3 emissive = material.emissiveFactor *
+        sampleMaterialTextureGrad(material, EMISSIVE_TEXTURE, uv, uvDx, uvDy, vec4(1)).rgb;
+    float occlusion = sampleMaterialTextureGrad(material, OCCLUSION_TEXTURE, uv, uvDx, uvDy, vec4(1)).r;
+    vec4 metallicRoughness = sampleMaterialTextureGrad(material, METALLIC_ROUGHNESS_TEXTURE, uv, uvDx, uvDy, vec4(1));
+    occlusion = mix(1.0, occlusion, material.occlusionStrength);
+
+    // The view matrix is rigid so its normal matrix is its rotation part
+    vec3 viewSpaceNormal = normalize(mat3(uViewMatrix) * mat3(drawTransform.normalMatrix) * normal);
+    vec3 viewDir = normalize(-viewSpacePosition);
+    float facing = dot(viewSpaceNormal, viewDir);
+    // Back faces are lit as front faces
+    if (facing < 0.0) {
+        viewSpaceNormal = -viewSpaceNormal;
+    }
+    float metallic = clamp(material.metallicFactor * metallicRoughness.b, 0.0, 1.0);
+    float roughness = clamp(material.roughnessFactor * metallicRoughness.g, 0.05, 1.0);
+
+    fBaseColorMetallic = vec4(baseColor.rgb, metallic);
+    fNormalRoughness = vec4(encodeOctahedral(viewSpaceNormal), roughness, 0);
+    vec3 ambient;
+    if (hasEnvironment()) {
+        ambient = shadeEnvironment(viewDir, viewSpaceNormal, baseColor.rgb, metallic, roughness);
+    } else {
+        ambient = baseColor.rgb * (uLightCounts.x + uLightCounts.y == 0u ? abs(facing) : AMBIENT_LIGHT);
+    }
+    fRadiance = ambient * occlusion + emissive;
+}
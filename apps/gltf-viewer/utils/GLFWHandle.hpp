@@ -1,7 +1,9 @@
 #pragma once
 
 #include "gl_debug_output.hpp"
+#include "gl_extensions.hpp"
 #include "glfw.hpp"
+#include "headless_context.hpp"
 #include <glm/glm.hpp>
 
 #include <imgui.h>
@@ -9,15 +11,50 @@
 #include <imgui_impl_opengl3.h>
 
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 
 // Class responsible for initializing GLFW, creating a window, initializing
-// OpenGL function pointers with GLAD library and initializing ImGUI
+// OpenGL function pointers with GLAD library and initializing ImGUI.
+// An invisible handle uses a HeadlessGLContext when EGL is available instead
+// of a hidden window, so that it works without display server. Such handle
+// has no window nor default framebuffer. Invisible handles, which only
+// render offline, do not initialize ImGUI, to start faster.
 class GLFWHandle
 {
 public:
-  GLFWHandle(int width, int height, const char *title, bool visible = true)
+  // The default framebuffer of the window has samples samples per pixel.
+  // debugOutput is also the mode of the contexts created afterwards. An
+  // invisible handle is created on the EGL GPU device of HeadlessGLContext
+  // if device is not negative, and then throws std::runtime_error rather
+  // than falling back to a window.
+  GLFWHandle(int width, int height, const char *title, bool visible = true,
+      int samples = 4,
+      GLDebugOutputMode debugOutput = GLDebugOutputMode::Full,
+      int device = -1) :
+      m_framebufferSize(width, height)
   {
+    setGLDebugOutputMode(debugOutput);
+    if (!visible && device >= 0) {
+      m_pHeadlessContext = std::make_unique<HeadlessGLContext>(device);
+    } else if (!visible && HeadlessGLContext::isAvailable()) {
+      try {
+        m_pHeadlessContext = std::make_unique<HeadlessGLContext>();
+      } catch (const std::exception &e) {
+        std::clog << e.what() << " Falling back to an invisible window.\n";
+      }
+    }
+
+    if (m_pHeadlessContext) {
+      if (!gladLoadGLLoader(HeadlessGLContext::getProcAddress)) {
+        std::cerr << "Unable to init OpenGL.\n";
+        throw std::runtime_error("Unable to init OpenGL.\n");
+      }
+      initGLDebugOutput();
+      loadGLExtensions(HeadlessGLContext::getProcAddress);
+      return;
+    }
+
     if (!glfwInit()) {
       std::cerr << "Unable to init GLFW.\n";
       throw std::runtime_error("Unable to init GLFW.\n");
@@ -30,9 +67,14 @@ public:
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT,
+        debugOutput == GLDebugOutputMode::Full ? GL_TRUE : GL_FALSE);
+    // Ignored by GLFW if the driver does not support GL_KHR_no_error
+    glfwWindowHint(GLFW_CONTEXT_NO_ERROR,
+        debugOutput == GLDebugOutputMode::NoError ? GL_TRUE : GL_FALSE);
+    // Resizes reach the application as InputEvent::Type::FramebufferSize
+    glfwWindowHint(GLFW_RESIZABLE, visible ? GLFW_TRUE : GLFW_FALSE);
+    glfwWindowHint(GLFW_SAMPLES, samples);
 
     m_pWindow =
         glfwCreateWindow(int(width), int(height), title, nullptr, nullptr);
@@ -52,8 +94,13 @@ public:
     }
 
     initGLDebugOutput();
+    loadGLExtensions((GLADloadproc)glfwGetProcAddress);
+    if (!visible) {
+      return;
+    }
 
     // Setup ImGui
+    m_hasGui = true;
     ImGui::CreateContext();
     ImGui_ImplGlfw_InitForOpenGL(m_pWindow, true);
     const char *glsl_version = "#version 130";
@@ -62,9 +109,15 @@ public:
 
   ~GLFWHandle()
   {
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
+    if (m_pHeadlessContext) {
+      return; // m_pHeadlessContext destroys the context
+    }
+
+    if (m_hasGui) {
+      ImGui_ImplOpenGL3_Shutdown();
+      ImGui_ImplGlfw_Shutdown();
+      ImGui::DestroyContext();
+    }
 
     glfwDestroyWindow(m_pWindow);
     glfwTerminate();
@@ -74,21 +127,62 @@ public:
   GLFWHandle(const GLFWHandle &) = delete;
   GLFWHandle &operator=(const GLFWHandle &) = delete;
 
-  bool shouldClose() const { return glfwWindowShouldClose(m_pWindow); }
+  bool isHeadless() const { return m_pHeadlessContext != nullptr; }
+
+  // True if ImGUI is initialized, for visible handles only
+  bool hasGui() const { return m_hasGui; }
+
+  bool shouldClose() const
+  {
+    return !m_pWindow || glfwWindowShouldClose(m_pWindow);
+  }
 
   glm::ivec2 framebufferSize() const
   {
+    if (!m_pWindow) {
+      return m_framebufferSize;
+    }
     int displayWidth, displayHeight;
     glfwGetFramebufferSize(m_pWindow, &displayWidth, &displayHeight);
     return glm::ivec2(displayWidth, displayHeight);
   }
 
-  void swapBuffers() const { glfwSwapBuffers(m_pWindow); }
+  void swapBuffers() const
+  {
+    if (m_pWindow) {
+      glfwSwapBuffers(m_pWindow);
+    }
+  }
+
+  // Synchronize buffer swaps with the refresh of the display. With adaptive
+  // vsync (WGL_EXT_swap_control_tear or GLX_EXT_swap_control_tear), frames
+  // late for a refresh are swapped at once, tearing rather than waiting for
+  // the next one.
+  void enableVSync(bool adaptive) const
+  {
+    if (!m_pWindow) {
+      return;
+    }
+    const auto canTear =
+        glfwExtensionSupported("WGL_EXT_swap_control_tear") ||
+        glfwExtensionSupported("GLX_EXT_swap_control_tear");
+    glfwSwapInterval(adaptive && canTear ? -1 : 1);
+  }
 
+  // Null for headless handles
   GLFWwindow *window() { return m_pWindow; }
 
+  // Null for handles with a window
+  const HeadlessGLContext *headlessContext() const
+  {
+    return m_pHeadlessContext.get();
+  }
+
 private:
+  glm::ivec2 m_framebufferSize;
+  std::unique_ptr<HeadlessGLContext> m_pHeadlessContext;
   GLFWwindow *m_pWindow = nullptr;
+  bool m_hasGui = false;
 };
 
 inline void imguiNewFrame()
@@ -104,6 +198,15 @@ inline void imguiRenderFrame()
   ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+// Draw the GUI of the last imguiRenderFrame() call again, without building
+// a new frame
+inline void imguiDrawFrame()
+{
+  if (const auto drawData = ImGui::GetDrawData()) {
+    ImGui_ImplOpenGL3_RenderDrawData(drawData);
+  }
+}
+
 inline void printGLVersion()
 {
   GLint glVersion[2];
@@ -0,0 +1,43 @@
+#include "allocation_counter.hpp"
+
+#include <atomic>
+
+namespace
+{
+
+// Zero initialized, so that operator new may use them before any dynamic
+// initialization and on threads being torn down
+thread_local uint64_t threadAllocationCount = 0;
+thread_local uint64_t threadAllocationBytes = 0;
+std::atomic<uint64_t> processAllocationCount{0};
+std::atomic<uint64_t> processAllocationBytes{0};
+
+} // namespace
+
+bool isAllocationCountingCompiled()
+{
+#ifdef GLMLV_COUNT_ALLOCATIONS
+  return true;
+#else
+  return false;
+#endif
+}
+
+void countAllocation(std::size_t size)
+{
+  ++threadAllocationCount;
+  threadAllocationBytes += size;
+  processAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  processAllocationBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+AllocationCounts getThreadAllocations()
+{
+  return {threadAllocationCount, threadAllocationBytes};
+}
+
+AllocationCounts getProcessAllocations()
+{
+  return {processAllocationCount.load(std::memory_order_relaxed),
+      processAllocationBytes.load(std::memory_order_relaxed)};
+}
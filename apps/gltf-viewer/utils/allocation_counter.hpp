@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Heap allocations of the process, to keep the frames of the render thread
+// free of them: each one costs a lock or a cache miss in the allocator and
+// they add up unnoticed as features land.
+//
+// With the GLMLV_COUNT_ALLOCATIONS CMake option, the global operator new and
+// delete of the apps are replaced by versions counting the allocations of
+// each thread and of the process (allocation_hooks.cpp), at the cost of a
+// thread local and an atomic increment. gltf-render only holds the counts:
+// executables embedding it keep their allocator. Memory from malloc (C
+// libraries, stb_image) is not counted: the code of the viewer allocates
+// with new, through the standard containers. Counts stay 0 otherwise.
+struct AllocationCounts
+{
+  uint64_t count = 0;
+  uint64_t bytes = 0; // Requested, freed memory is not subtracted
+};
+
+// True if the apps of this build count allocations
+bool isAllocationCountingCompiled();
+
+// Count an allocation of size bytes by the calling thread, from operator new
+void countAllocation(std::size_t size);
+
+// Of the calling thread since it started, subtract two of them to count the
+// allocations of a scope
+AllocationCounts getThreadAllocations();
+
+// Of every thread since the process started
+AllocationCounts getProcessAllocations();
@@ -0,0 +1,168 @@
+#include "allocation_counter.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Global operator new and delete counting the allocations (see
+// allocation_counter.hpp). Compiled in the apps with GLMLV_COUNT_ALLOCATIONS,
+// never in gltf-render: the executables embedding it keep their allocator.
+
+namespace
+{
+
+void *allocate(std::size_t size)
+{
+  countAllocation(size);
+  // malloc(0) may return null, new never does
+  while (true) {
+    if (auto *pointer = std::malloc(size ? size : 1)) {
+      return pointer;
+    }
+    const auto handler = std::get_new_handler();
+    if (!handler) {
+      return nullptr;
+    }
+    handler();
+  }
+}
+
+void *allocateAligned(std::size_t size, std::align_val_t alignment)
+{
+  countAllocation(size);
+  const auto align = static_cast<std::size_t>(alignment);
+  // aligned_alloc wants a multiple of the alignment. Windows has none,
+  // memory of _aligned_malloc is released by _aligned_free.
+  const auto alignedSize = (std::max<std::size_t>(size, 1) + align - 1) /
+                           align * align;
+  while (true) {
+#ifdef _WIN32
+    auto *pointer = _aligned_malloc(alignedSize, align);
+#else
+    auto *pointer = std::aligned_alloc(align, alignedSize);
+#endif
+    if (pointer) {
+      return pointer;
+    }
+    const auto handler = std::get_new_handler();
+    if (!handler) {
+      return nullptr;
+    }
+    handler();
+  }
+}
+
+void freeAligned(void *pointer)
+{
+#ifdef _WIN32
+  _aligned_free(pointer);
+#else
+  std::free(pointer);
+#endif
+}
+} // namespace
+
+void *operator new(std::size_t size)
+{
+  if (auto *pointer = allocate(size)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+  if (auto *pointer = allocateAligned(size, alignment)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+  return operator new(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment,
+    const std::nothrow_t &) noexcept
+{
+  return allocateAligned(size, alignment);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment,
+    const std::nothrow_t &) noexcept
+{
+  return allocateAligned(size, alignment);
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete[](void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept
+{
+  freeAligned(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept
+{
+  freeAligned(pointer);
+}
+
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept
+{
+  freeAligned(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept
+{
+  freeAligned(pointer);
+}
+
+void operator delete(
+    void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+  freeAligned(pointer);
+}
+
+void operator delete[](
+    void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+  freeAligned(pointer);
+}
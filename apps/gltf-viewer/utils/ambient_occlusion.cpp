@@ -0,0 +1,149 @@
+#include "ambient_occlusion.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+GLuint getDispatchSize(size_t size)
+{
+  const size_t groupSize = 8; // local_size of ambient_occlusion.cs.glsl
+  return GLuint((size + groupSize - 1) / groupSize);
+}
+
+// Sub-pixel jitters of temporal anti-aliasing offset the projection along
+// x and y in proportion to z, they do not move the camera
+glm::mat4 removeJitter(glm::mat4 projMatrix)
+{
+  projMatrix[2][0] = 0.f;
+  projMatrix[2][1] = 0.f;
+  return projMatrix;
+}
+
+} // namespace
+
+AmbientOcclusion &AmbientOcclusion::operator=(AmbientOcclusion &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_textures, rvalue.m_textures);
+    std::swap(m_nCurrent, rvalue.m_nCurrent);
+    std::swap(m_nWidth, rvalue.m_nWidth);
+    std::swap(m_nHeight, rvalue.m_nHeight);
+    std::swap(m_viewport, rvalue.m_viewport);
+    std::swap(m_uniforms, rvalue.m_uniforms);
+    std::swap(m_viewMatrix, rvalue.m_viewMatrix);
+    std::swap(m_projMatrix, rvalue.m_projMatrix);
+    std::swap(m_nSceneVersion, rvalue.m_nSceneVersion);
+    std::swap(m_radius, rvalue.m_radius);
+    std::swap(m_nAccumulated, rvalue.m_nAccumulated);
+    std::swap(m_nFrameIndex, rvalue.m_nFrameIndex);
+  }
+  return *this;
+}
+
+void AmbientOcclusion::compute(const GLProgram &program,
+    const DepthPyramid &depth, const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, size_t sceneVersion, size_t divisor,
+    float radius)
+{
+  glGetIntegerv(GL_VIEWPORT, m_viewport);
+  divisor = std::max(divisor, size_t(1));
+  const auto width = (depth.width() + divisor - 1) / divisor;
+  const auto height = (depth.height() + divisor - 1) / divisor;
+  const auto hasResized = width != m_nWidth || height != m_nHeight;
+  if (hasResized) {
+    release();
+    m_nWidth = width;
+    m_nHeight = height;
+    for (auto &texture : m_textures) {
+      texture = GLTexture(1, GL_RG16F, GLsizei(width), GLsizei(height));
+      // Only read with texelFetch
+      texture.setParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      texture.setParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+  }
+  const auto jitterFreeProjMatrix = removeJitter(projMatrix);
+  const auto isSameView = !hasResized && viewMatrix == m_viewMatrix &&
+                          jitterFreeProjMatrix == m_projMatrix &&
+                          sceneVersion == m_nSceneVersion &&
+                          radius == m_radius;
+  m_nAccumulated =
+      isSameView ? std::min(m_nAccumulated + 1, MAX_ACCUMULATED_FRAMES - 1)
+                 : 0;
+  m_viewMatrix = viewMatrix;
+  m_projMatrix = jitterFreeProjMatrix;
+  m_nSceneVersion = sceneVersion;
+  m_radius = radius;
+  ++m_nFrameIndex;
+
+  const auto &history = m_textures[m_nCurrent];
+  m_nCurrent = 1 - m_nCurrent;
+  GLint texture0 = 0, texture1 = 0;
+  glActiveTexture(GL_TEXTURE1);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture1);
+  glBindTexture(GL_TEXTURE_2D, history.glId());
+  glActiveTexture(GL_TEXTURE0);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture0);
+  glBindTexture(GL_TEXTURE_2D, depth.texture());
+  glBindImageTexture(0, m_textures[m_nCurrent].glId(), 0, GL_FALSE, 0,
+      GL_WRITE_ONLY, GL_RG16F);
+
+  program.use();
+  program.getUniform<glm::mat4>("uInvProjMatrix")
+      .set(glm::inverse(projMatrix));
+  program.getUniform<glm::vec2>("uDepthSize")
+      .set(glm::vec2(float(depth.width()), float(depth.height())));
+  // Pixels covered by a unit length at unit distance
+  program.getUniform<float>("uPixelsPerUnit")
+      .set(0.5f * projMatrix[1][1] * float(depth.height()));
+  program.getUniform<float>("uRadius").set(radius);
+  program.getUniform<GLint>("uDivisor").set(GLint(divisor));
+  program.getUniform<GLuint>("uFrameIndex").set(GLuint(m_nFrameIndex));
+  // A running average over the computations of the same view
+  program.getUniform<float>("uHistoryWeight")
+      .set(float(m_nAccumulated) / float(m_nAccumulated + 1));
+  glDispatchCompute(getDispatchSize(width), getDispatchSize(height), 1);
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+  glBindTexture(GL_TEXTURE_2D, GLuint(texture0));
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, GLuint(texture1));
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void AmbientOcclusion::bind(bool isEnabled, RingBuffer &ring)
+{
+  const auto isComputed = isEnabled && m_nWidth > 0;
+  m_uniforms.reset(sizeof(Uniforms), 1);
+  auto &uniforms = m_uniforms.block<Uniforms>(0);
+  uniforms.viewport = glm::vec4(float(m_viewport[0]), float(m_viewport[1]),
+      1.f / float(std::max(m_viewport[2], 1)),
+      1.f / float(std::max(m_viewport[3], 1)));
+  uniforms.info = glm::uvec4(isComputed ? 1 : 0, 0, 0, 0);
+  m_uniforms.upload(ring);
+  m_uniforms.bind(UNIFORMS_BINDING, 0);
+
+  glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+  glBindTexture(
+      GL_TEXTURE_2D, isComputed ? m_textures[m_nCurrent].glId() : 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void AmbientOcclusion::unbind() const
+{
+  glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORMS_BINDING, 0);
+  glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void AmbientOcclusion::release()
+{
+  for (auto &texture : m_textures) {
+    texture = GLTexture();
+  }
+  m_nWidth = m_nHeight = 0;
+  m_nAccumulated = 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "depth_pyramid.hpp"
+#include "gl_objects.hpp"
+#include "ring_buffer.hpp"
+#include "shaders.hpp"
+#include "uniform_buffer.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <utility>
+
+// Screen-space ambient occlusion of the depth buffer filled by the depth
+// pre-pass, computed by ambient_occlusion.cs.glsl at 1 / divisor of the
+// resolution of the viewport, and read by the fragment shaders of the main
+// pass through ambient_occlusion.glsl, whose depth-aware upsample keeps the
+// occlusion of the background off the edges of the foreground.
+//
+// The occlusion of a texel is estimated from SAMPLE_COUNT depths around it,
+// within a world space radius, rotated each frame. While the view and the
+// scene stay the same, each computation is blended with the previous ones,
+// up to MAX_ACCUMULATED_FRAMES, so that the noise of the few samples fades
+// when the camera is idle.
+class AmbientOcclusion
+{
+public:
+  static const GLuint UNIFORMS_BINDING = 6; // AmbientOcclusionUniforms block
+  // After ImpostorAtlas::NORMAL_UNIT
+  static const GLuint TEXTURE_UNIT = 22;
+  static const size_t MAX_ACCUMULATED_FRAMES = 16;
+
+  // AmbientOcclusionUniforms block of ambient_occlusion.glsl, std140 layout
+  struct Uniforms
+  {
+    glm::vec4 viewport; // Origin in pixels, then inverse size
+    glm::uvec4 info; // x: 1 if the occlusion is computed
+  };
+
+  AmbientOcclusion() = default;
+
+  ~AmbientOcclusion() { release(); }
+
+  // Non-copyable class:
+  AmbientOcclusion(const AmbientOcclusion &) = delete;
+  AmbientOcclusion &operator=(const AmbientOcclusion &) = delete;
+
+  AmbientOcclusion(AmbientOcclusion &&rvalue) { *this = std::move(rvalue); }
+  AmbientOcclusion &operator=(AmbientOcclusion &&rvalue);
+
+  // Compute the occlusion of the depths copied in level 0 of depth (see
+  // DepthPyramid::build) for the current viewport, at 1 / divisor of its
+  // resolution. program is ambient_occlusion.cs.glsl, compiled with
+  // REVERSED_Z for reversed-Z depth buffers. radius is in world units.
+  // Results are accumulated while viewMatrix, projMatrix (but for the
+  // jitter of temporal anti-aliasing), sceneVersion and radius stay the
+  // same. GL
+  // bindings are restored, except the program.
+  void compute(const GLProgram &program, const DepthPyramid &depth,
+      const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix,
+      size_t sceneVersion, size_t divisor, float radius);
+
+  // Upload the uniforms to the current frame region of ring and bind them
+  // with the occlusion of the last compute(). Without isEnabled, shaders
+  // see no occlusion.
+  void bind(bool isEnabled, RingBuffer &ring);
+
+  // Unbind what bind() bound
+  void unbind() const;
+
+  // Computations blended in the occlusion of the last compute()
+  size_t accumulatedFrameCount() const { return m_nAccumulated + 1; }
+
+private:
+  void release();
+
+  GLTexture m_textures[2]; // RG16F: occlusion and view depth, ping-ponged
+  size_t m_nCurrent = 0; // Written by the last compute()
+  size_t m_nWidth = 0;
+  size_t m_nHeight = 0;
+  GLint m_viewport[4] = {};
+  UniformBuffer m_uniforms;
+
+  // Of the last compute(), to tell when to accumulate
+  glm::mat4 m_viewMatrix = glm::mat4(0);
+  glm::mat4 m_projMatrix = glm::mat4(0);
+  size_t m_nSceneVersion = 0;
+  float m_radius = 0.f;
+  size_t m_nAccumulated = 0; // Previous computations in the history
+  size_t m_nFrameIndex = 0; // Rotates the samples
+};
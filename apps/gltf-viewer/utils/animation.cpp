@@ -0,0 +1,463 @@
+#include "animation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GLTF_VIEWER_ANIMATION_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GLTF_VIEWER_ANIMATION_NEON
+#endif
+
+namespace
+{
+
+// Minimal 4 wide float vector, one implementation per instruction set (see
+// bounds.cpp)
+#if defined(GLTF_VIEWER_ANIMATION_SSE2)
+
+struct Float4
+{
+  __m128 v;
+};
+
+Float4 set1(float x) { return {_mm_set1_ps(x)}; }
+Float4 set(float a, float b, float c, float d)
+{
+  return {_mm_setr_ps(a, b, c, d)};
+}
+Float4 operator+(Float4 a, Float4 b) { return {_mm_add_ps(a.v, b.v)}; }
+Float4 operator-(Float4 a, Float4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+Float4 operator*(Float4 a, Float4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+Float4 abs(Float4 a) { return {_mm_andnot_ps(_mm_set1_ps(-0.f), a.v)}; }
+// a with its sign flipped where sign is negative
+Float4 flipSign(Float4 a, Float4 sign)
+{
+  return {_mm_xor_ps(a.v, _mm_and_ps(sign.v, _mm_set1_ps(-0.f)))};
+}
+// 1 / sqrt(a), the estimate refined by a Newton step
+Float4 rsqrt(Float4 a)
+{
+  const auto y = _mm_rsqrt_ps(a.v);
+  const auto ayy = _mm_mul_ps(_mm_mul_ps(a.v, y), y);
+  return {_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y),
+      _mm_sub_ps(_mm_set1_ps(3.f), ayy))};
+}
+void store(float *out, Float4 a) { _mm_storeu_ps(out, a.v); }
+
+#elif defined(GLTF_VIEWER_ANIMATION_NEON)
+
+struct Float4
+{
+  float32x4_t v;
+};
+
+Float4 set1(float x) { return {vdupq_n_f32(x)}; }
+Float4 set(float a, float b, float c, float d)
+{
+  const float values[4] = {a, b, c, d};
+  return {vld1q_f32(values)};
+}
+Float4 operator+(Float4 a, Float4 b) { return {vaddq_f32(a.v, b.v)}; }
+Float4 operator-(Float4 a, Float4 b) { return {vsubq_f32(a.v, b.v)}; }
+Float4 operator*(Float4 a, Float4 b) { return {vmulq_f32(a.v, b.v)}; }
+Float4 abs(Float4 a) { return {vabsq_f32(a.v)}; }
+Float4 flipSign(Float4 a, Float4 sign)
+{
+  const auto signBit = vandq_u32(
+      vreinterpretq_u32_f32(sign.v), vdupq_n_u32(0x80000000u));
+  return {vreinterpretq_f32_u32(
+      veorq_u32(vreinterpretq_u32_f32(a.v), signBit))};
+}
+Float4 rsqrt(Float4 a)
+{
+  const auto y = vrsqrteq_f32(a.v);
+  return {vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(a.v, y), y))};
+}
+void store(float *out, Float4 a) { vst1q_f32(out, a.v); }
+
+#else
+
+struct Float4
+{
+  float v[4];
+};
+
+Float4 set1(float x) { return {{x, x, x, x}}; }
+Float4 set(float a, float b, float c, float d) { return {{a, b, c, d}}; }
+template <typename F> Float4 apply(Float4 a, Float4 b, F f)
+{
+  return {{f(a.v[0], b.v[0]), f(a.v[1], b.v[1]), f(a.v[2], b.v[2]),
+      f(a.v[3], b.v[3])}};
+}
+Float4 operator+(Float4 a, Float4 b)
+{
+  return apply(a, b, [](float x, float y) { return x + y; });
+}
+Float4 operator-(Float4 a, Float4 b)
+{
+  return apply(a, b, [](float x, float y) { return x - y; });
+}
+Float4 operator*(Float4 a, Float4 b)
+{
+  return apply(a, b, [](float x, float y) { return x * y; });
+}
+Float4 abs(Float4 a)
+{
+  return apply(a, a, [](float x, float) { return std::abs(x); });
+}
+Float4 flipSign(Float4 a, Float4 sign)
+{
+  return apply(a, sign, [](float x, float s) { return s < 0.f ? -x : x; });
+}
+Float4 rsqrt(Float4 a)
+{
+  return apply(a, a, [](float x, float) { return 1.f / std::sqrt(x); });
+}
+void store(float *out, Float4 a) { std::memcpy(out, a.v, sizeof(a.v)); }
+
+#endif
+
+// Interpolate four pairs of unit quaternions (a[i], b[i]) in SoA form (a[c]
+// holds component c of the four quaternions) by t along the shortest arc.
+// The normalized lerp parameter is corrected with a polynomial fit of slerp
+// in the cosine of the angle between the quaternions (see
+// https://zeux.io/2015/07/23/approximating-slerp/).
+void slerp4(const Float4 a[4], const Float4 b[4], Float4 t, Float4 out[4])
+{
+  const auto cosAngle = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+  const auto d = abs(cosAngle);
+  const auto A =
+      set1(1.0904f) +
+      d * (set1(-3.2452f) + d * (set1(3.55645f) - d * set1(1.43519f)));
+  const auto B =
+      set1(0.848013f) + d * (set1(-1.06021f) + d * set1(0.215638f));
+  const auto u = t - set1(0.5f);
+  const auto k = A * u * u + B;
+  const auto correctedT = t + t * u * (t - set1(1.f)) * k;
+
+  // b is negated when the quaternions are more than half a turn apart
+  const auto weightA = set1(1.f) - correctedT;
+  const auto weightB = flipSign(correctedT, cosAngle);
+  Float4 q[4];
+  for (size_t c = 0; c < 4; ++c) {
+    q[c] = a[c] * weightA + b[c] * weightB;
+  }
+  const auto invLength =
+      rsqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  for (size_t c = 0; c < 4; ++c) {
+    out[c] = q[c] * invLength;
+  }
+}
+
+} // namespace
+
+SceneAnimations::SceneAnimations(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const SceneHierarchy &hierarchy)
+{
+  std::vector<float> values;
+  for (size_t animationIdx = 0; animationIdx < model.animations.size();
+       ++animationIdx) {
+    const auto &gltfAnimation = model.animations[animationIdx];
+    Animation animation;
+    animation.name = gltfAnimation.name.empty()
+                         ? "Animation " + std::to_string(animationIdx)
+                         : gltfAnimation.name;
+    animation.firstChannel = m_channels.size();
+
+    for (const auto &gltfChannel : gltfAnimation.channels) {
+      const auto &target = gltfChannel.target_path;
+      const auto node = hierarchy.findNode(gltfChannel.target_node);
+      if (node < 0 || gltfChannel.sampler < 0 ||
+          size_t(gltfChannel.sampler) >= gltfAnimation.samplers.size() ||
+          (target != "translation" && target != "rotation" &&
+              target != "scale" && target != "weights")) {
+        continue;
+      }
+      const auto &sampler = gltfAnimation.samplers[gltfChannel.sampler];
+      if (sampler.input < 0 || sampler.output < 0) {
+        continue;
+      }
+      const auto &input = model.accessors[sampler.input];
+      const auto &output = model.accessors[sampler.output];
+
+      Channel channel;
+      channel.node = uint32_t(node);
+      channel.path = Path::Scale;
+      if (target == "translation") {
+        channel.path = Path::Translation;
+      } else if (target == "rotation") {
+        channel.path = Path::Rotation;
+      } else if (target == "weights") {
+        channel.path = Path::Weights;
+      }
+      channel.interpolation = Interpolation::Linear;
+      if (sampler.interpolation == "STEP") {
+        channel.interpolation = Interpolation::Step;
+      } else if (sampler.interpolation == "CUBICSPLINE") {
+        channel.interpolation = Interpolation::CubicSpline;
+      }
+      channel.firstKey = uint32_t(m_times.size());
+      channel.keyCount = uint32_t(input.count);
+      channel.firstValue = uint32_t(m_values[0].size());
+      const auto valueCount =
+          input.count *
+          (channel.interpolation == Interpolation::CubicSpline ? 3 : 1);
+      // A weights value holds one weight per morph target
+      auto outputCount = valueCount;
+      if (channel.path == Path::Weights && valueCount) {
+        channel.firstValue = uint32_t(m_weightValues.size());
+        channel.weightCount = uint32_t(output.count / valueCount);
+        outputCount = valueCount * channel.weightCount;
+      }
+      if (!input.count || !output.count || output.count != outputCount) {
+        std::cerr << "Warning: animation " << animationIdx
+                  << " has a channel with " << input.count << " keys and "
+                  << output.count << " values, it is ignored" << std::endl;
+        continue;
+      }
+
+      m_times.resize(m_times.size() + input.count);
+      readAccessorAsFloats(
+          model, buffers, input, 1, m_times.data() + channel.firstKey);
+      animation.duration = std::max(animation.duration, m_times.back());
+
+      if (channel.path == Path::Weights) {
+        m_weightValues.resize(m_weightValues.size() + output.count);
+        readAccessorAsFloats(model, buffers, output, 1,
+            m_weightValues.data() + channel.firstValue);
+        m_channels.push_back(channel);
+        continue;
+      }
+
+      // Translations and scales leave their fourth component at 0
+      values.resize(valueCount * 4);
+      readAccessorAsFloats(model, buffers, output, 4, values.data());
+      for (size_t c = 0; c < 4; ++c) {
+        auto &componentValues = m_values[c];
+        for (size_t i = 0; i < valueCount; ++i) {
+          componentValues.push_back(values[i * 4 + c]);
+        }
+      }
+      m_channels.push_back(channel);
+    }
+
+    animation.channelCount = m_channels.size() - animation.firstChannel;
+    m_animations.push_back(std::move(animation));
+  }
+}
+
+void SceneAnimations::apply(size_t animationIdx, double time,
+    SceneHierarchy &hierarchy, MorphWeights &weights)
+{
+  const auto &animation = m_animations[animationIdx];
+  const auto localTime =
+      animation.duration > 0.f
+          ? float(std::fmod(std::max(time, 0.), double(animation.duration)))
+          : 0.f;
+
+  const auto readValue = [&](size_t valueIdx, glm::vec4 &value) {
+    for (glm::length_t c = 0; c < 4; ++c) {
+      value[c] = m_values[c][valueIdx];
+    }
+  };
+
+  m_rotationChannels.clear();
+  for (size_t i = 0; i < animation.channelCount; ++i) {
+    const auto channelIdx = animation.firstChannel + i;
+    auto &channel = m_channels[channelIdx];
+    if (channel.path == Path::Rotation &&
+        channel.interpolation == Interpolation::Linear) {
+      m_rotationChannels.push_back(uint32_t(channelIdx));
+      continue;
+    }
+
+    uint32_t key = 0;
+    float t = 0.f;
+    findKey(channel, localTime, key, t);
+    if (channel.path == Path::Weights) {
+      sampleWeights(channel, key, t, m_sampledWeights);
+      weights.set(
+          channel.node, m_sampledWeights.data(), m_sampledWeights.size());
+      continue;
+    }
+    const auto nextKey = std::min(key + 1, channel.keyCount - 1);
+    glm::vec4 value;
+    switch (channel.interpolation) {
+    case Interpolation::Step:
+      readValue(channel.firstValue + key, value);
+      break;
+    case Interpolation::Linear: {
+      glm::vec4 next;
+      readValue(channel.firstValue + key, value);
+      readValue(channel.firstValue + nextKey, next);
+      value += t * (next - value);
+      break;
+    }
+    case Interpolation::CubicSpline: {
+      // Keys store (in tangent, value, out tangent), tangents are scaled by
+      // the duration between the keys
+      const auto *times = m_times.data() + channel.firstKey;
+      const auto keyDuration = times[nextKey] - times[key];
+      glm::vec4 nextValue, outTangent, inTangent;
+      readValue(channel.firstValue + 3 * key + 1, value);
+      readValue(channel.firstValue + 3 * key + 2, outTangent);
+      readValue(channel.firstValue + 3 * nextKey, inTangent);
+      readValue(channel.firstValue + 3 * nextKey + 1, nextValue);
+      const auto t2 = t * t;
+      const auto t3 = t2 * t;
+      value = (2 * t3 - 3 * t2 + 1) * value +
+              keyDuration * (t3 - 2 * t2 + t) * outTangent +
+              (-2 * t3 + 3 * t2) * nextValue +
+              keyDuration * (t3 - t2) * inTangent;
+      break;
+    }
+    }
+
+    switch (channel.path) {
+    case Path::Translation:
+      hierarchy.setTranslation(channel.node, glm::vec3(value));
+      break;
+    case Path::Rotation: {
+      const auto length = glm::length(value);
+      if (length > 0.f) {
+        value /= length;
+      }
+      // glTF stores quaternions as (x, y, z, w)
+      hierarchy.setRotation(
+          channel.node, glm::quat(value.w, value.x, value.y, value.z));
+      break;
+    }
+    case Path::Scale:
+      hierarchy.setScale(channel.node, glm::vec3(value));
+      break;
+    case Path::Weights:
+      break;
+    }
+  }
+
+  // Four rotation channels per batch, the last batch repeats its first
+  // channel in its unused lanes
+  const auto rotationCount = m_rotationChannels.size();
+  for (size_t batch = 0; batch < rotationCount; batch += 4) {
+    uint32_t first[4], second[4];
+    float t[4];
+    for (size_t lane = 0; lane < 4; ++lane) {
+      auto &channel = m_channels[m_rotationChannels[
+          batch + lane < rotationCount ? batch + lane : batch]];
+      uint32_t key = 0;
+      findKey(channel, localTime, key, t[lane]);
+      first[lane] = channel.firstValue + key;
+      second[lane] =
+          channel.firstValue + std::min(key + 1, channel.keyCount - 1);
+    }
+    Float4 a[4], b[4], q[4];
+    for (size_t c = 0; c < 4; ++c) {
+      const auto &values = m_values[c];
+      a[c] = set(values[first[0]], values[first[1]], values[first[2]],
+          values[first[3]]);
+      b[c] = set(values[second[0]], values[second[1]], values[second[2]],
+          values[second[3]]);
+    }
+    slerp4(a, b, set(t[0], t[1], t[2], t[3]), q);
+
+    float rotations[4][4];
+    for (size_t c = 0; c < 4; ++c) {
+      store(rotations[c], q[c]);
+    }
+    for (size_t lane = 0; lane < 4 && batch + lane < rotationCount; ++lane) {
+      const auto &channel = m_channels[m_rotationChannels[batch + lane]];
+      hierarchy.setRotation(channel.node,
+          glm::quat(rotations[3][lane], rotations[0][lane],
+              rotations[1][lane], rotations[2][lane]));
+    }
+  }
+}
+
+std::vector<uint32_t> SceneAnimations::animatedNodes() const
+{
+  std::vector<uint32_t> nodes;
+  for (const auto &channel : m_channels) {
+    if (channel.path != Path::Weights) {
+      nodes.push_back(channel.node);
+    }
+  }
+  std::sort(begin(nodes), end(nodes));
+  nodes.erase(std::unique(begin(nodes), end(nodes)), end(nodes));
+  return nodes;
+}
+
+void SceneAnimations::findKey(
+    Channel &channel, float time, uint32_t &key, float &t) const
+{
+  const auto *times = m_times.data() + channel.firstKey;
+  const auto last = channel.keyCount - 1;
+  t = 0.f;
+  if (last == 0 || time <= times[0]) {
+    key = channel.cursor = 0;
+    return;
+  }
+  if (time >= times[last]) {
+    key = channel.cursor = last;
+    return;
+  }
+
+  // times[0] < time < times[last]: the key is in [0, last)
+  auto k = channel.cursor;
+  if (k >= last || time < times[k] || time >= times[k + 1]) {
+    if (k + 1 < last && times[k + 1] <= time && time < times[k + 2]) {
+      ++k;
+    } else {
+      k = uint32_t(std::upper_bound(times, times + last, time) - times) - 1;
+    }
+  }
+  key = channel.cursor = k;
+  const auto keyDuration = times[k + 1] - times[k];
+  t = keyDuration > 0.f ? (time - times[k]) / keyDuration : 0.f;
+}
+
+void SceneAnimations::sampleWeights(const Channel &channel, uint32_t key,
+    float t, std::vector<float> &weights) const
+{
+  const auto count = size_t(channel.weightCount);
+  const auto nextKey = std::min(key + 1, channel.keyCount - 1);
+  const auto *values = m_weightValues.data() + channel.firstValue;
+  weights.resize(count);
+  switch (channel.interpolation) {
+  case Interpolation::Step:
+    std::copy(values + key * count, values + (key + 1) * count,
+        weights.begin());
+    break;
+  case Interpolation::Linear: {
+    const auto *value = values + key * count;
+    const auto *next = values + nextKey * count;
+    for (size_t i = 0; i < count; ++i) {
+      weights[i] = value[i] + t * (next[i] - value[i]);
+    }
+    break;
+  }
+  case Interpolation::CubicSpline: {
+    // Same spline as the other paths (see apply), weight by weight
+    const auto *times = m_times.data() + channel.firstKey;
+    const auto keyDuration = times[nextKey] - times[key];
+    const auto *value = values + (3 * key + 1) * count;
+    const auto *outTangent = values + (3 * key + 2) * count;
+    const auto *inTangent = values + 3 * nextKey * count;
+    const auto *nextValue = values + (3 * nextKey + 1) * count;
+    const auto t2 = t * t;
+    const auto t3 = t2 * t;
+    for (size_t i = 0; i < count; ++i) {
+      weights[i] = (2 * t3 - 3 * t2 + 1) * value[i] +
+                   keyDuration * (t3 - 2 * t2 + t) * outTangent[i] +
+                   (-2 * t3 + 3 * t2) * nextValue[i] +
+                   keyDuration * (t3 - t2) * inTangent[i];
+    }
+    break;
+  }
+  }
+}
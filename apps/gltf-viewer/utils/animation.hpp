@@ -0,0 +1,118 @@
+#pragma once
+
+#include "gltf.hpp"
+#include "morphing.hpp"
+#include "scene_hierarchy.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Animations of a glTF model, sampled into the local transforms of the nodes
+// of a SceneHierarchy and their morph target weights.
+//
+// Keyframes are decoded once at load time in flat arrays shared by every
+// channel: the times of all channels, then their values as one float array
+// per component (SoA). A channel remembers the key found by the previous
+// sample (its cursor): playing forward, the next sample finds its key there
+// or at the next key, and only falls back to a binary search on jumps.
+//
+// Linear rotation channels are interpolated four at a time with SSE2 or
+// NEON, each lane interpolating one channel, with a normalized lerp whose
+// parameter is corrected to match slerp within 1e-3 radians. Translations,
+// scales, weights, step and cubic spline channels are interpolated one by
+// one. Weights are stored apart, all the weights of a key together.
+class SceneAnimations
+{
+public:
+  SceneAnimations() = default;
+
+  // Decode the channels of the animations of model targeting the nodes of
+  // hierarchy
+  SceneAnimations(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers, const SceneHierarchy &hierarchy);
+
+  size_t animationCount() const { return m_animations.size(); }
+
+  bool empty() const { return m_animations.empty(); }
+
+  const std::string &name(size_t animationIdx) const
+  {
+    return m_animations[animationIdx].name;
+  }
+
+  // Time of the last keyframe of the animation, in seconds
+  float duration(size_t animationIdx) const
+  {
+    return m_animations[animationIdx].duration;
+  }
+
+  // Set the local transforms and morph target weights targeted by an
+  // animation to their value at time seconds, looping over its duration.
+  // They take effect on the next SceneHierarchy::update() and
+  // SceneMorphs::blendVertices().
+  void apply(size_t animationIdx, double time, SceneHierarchy &hierarchy,
+      MorphWeights &weights);
+
+  // Flat indices of the nodes whose translation, rotation or scale is
+  // targeted by any animation, in increasing order
+  std::vector<uint32_t> animatedNodes() const;
+
+private:
+  enum class Path : uint8_t
+  {
+    Translation,
+    Rotation,
+    Scale,
+    Weights
+  };
+
+  enum class Interpolation : uint8_t
+  {
+    Linear,
+    Step,
+    CubicSpline
+  };
+
+  struct Channel
+  {
+    uint32_t node; // Flat index in the hierarchy
+    Path path;
+    Interpolation interpolation;
+    uint32_t firstKey; // In m_times
+    uint32_t keyCount;
+    // In m_values (m_weightValues for weights), keyCount values or (in
+    // tangent, value, out tangent) triplets for cubic splines
+    uint32_t firstValue;
+    uint32_t weightCount = 0; // Weights per value of weights channels
+    uint32_t cursor = 0; // Key of the previous sample
+  };
+
+  struct Animation
+  {
+    std::string name;
+    float duration = 0.f;
+    size_t firstChannel; // In m_channels
+    size_t channelCount;
+  };
+
+  // Key k such that times[k] <= time < times[k + 1] (clamped to the first and
+  // last keys) and the interpolation factor of time between them
+  void findKey(Channel &channel, float time, uint32_t &key, float &t) const;
+
+  // Interpolate the weights of a weights channel at key and t (see findKey)
+  void sampleWeights(const Channel &channel, uint32_t key, float t,
+      std::vector<float> &weights) const;
+
+  std::vector<float> m_times;
+  std::vector<float> m_values[4];
+  std::vector<float> m_weightValues;
+  std::vector<Channel> m_channels;
+  std::vector<Animation> m_animations;
+  // Rotation channels of the animation being applied, in batches of four
+  std::vector<uint32_t> m_rotationChannels;
+  std::vector<float> m_sampledWeights;
+};
@@ -0,0 +1,170 @@
+#include "aws_signature.hpp"
+
+#include <cstdlib>
+
+#ifdef GLMLV_USE_OPENSSL
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#endif
+
+namespace
+{
+
+// SHA-256 of the empty payload of GET requests
+const char *const EMPTY_PAYLOAD_HASH =
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+
+std::string getEnvironment(const char *name)
+{
+  const auto value = std::getenv(name);
+  return value ? value : "";
+}
+
+#ifdef GLMLV_USE_OPENSSL
+
+std::string toHex(const std::string &bytes)
+{
+  const char digits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(2 * bytes.size());
+  for (const auto byte : bytes) {
+    hex += digits[(unsigned char)byte >> 4];
+    hex += digits[(unsigned char)byte & 15];
+  }
+  return hex;
+}
+
+std::string sha256(const std::string &data)
+{
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+  EVP_Digest(data.data(), data.size(), digest, &size, EVP_sha256(), nullptr);
+  return std::string(reinterpret_cast<const char *>(digest), size);
+}
+
+std::string hmacSha256(const std::string &key, const std::string &data)
+{
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+  HMAC(EVP_sha256(), key.data(), int(key.size()),
+      reinterpret_cast<const unsigned char *>(data.data()), data.size(),
+      digest, &size);
+  return std::string(reinterpret_cast<const char *>(digest), size);
+}
+
+#endif
+
+} // namespace
+
+bool isAwsSigningSupported()
+{
+#ifdef GLMLV_USE_OPENSSL
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool getAwsEnvironmentCredentials(AwsCredentials &credentials)
+{
+  credentials.accessKeyId = getEnvironment("AWS_ACCESS_KEY_ID");
+  credentials.secretAccessKey = getEnvironment("AWS_SECRET_ACCESS_KEY");
+  credentials.sessionToken = getEnvironment("AWS_SESSION_TOKEN");
+  return !credentials.accessKeyId.empty() &&
+         !credentials.secretAccessKey.empty();
+}
+
+std::string getAwsEnvironmentRegion()
+{
+  for (const auto name : {"AWS_REGION", "AWS_DEFAULT_REGION"}) {
+    const auto region = getEnvironment(name);
+    if (!region.empty()) {
+      return region;
+    }
+  }
+  return "us-east-1";
+}
+
+std::string encodeAwsUri(const std::string &str, bool keepSlashes)
+{
+  const char digits[] = "0123456789ABCDEF";
+  std::string encoded;
+  for (const auto c : str) {
+    const auto byte = (unsigned char)c;
+    if ((byte >= 'A' && byte <= 'Z') || (byte >= 'a' && byte <= 'z') ||
+        (byte >= '0' && byte <= '9') || byte == '-' || byte == '_' ||
+        byte == '.' || byte == '~' || (byte == '/' && keepSlashes)) {
+      encoded += c;
+    } else {
+      encoded += '%';
+      encoded += digits[byte >> 4];
+      encoded += digits[byte & 15];
+    }
+  }
+  return encoded;
+}
+
+#ifdef GLMLV_USE_OPENSSL
+
+bool signAwsGetRequest(const AwsCredentials &credentials,
+    const std::string &region, const std::string &service,
+    const std::string &path, std::time_t time,
+    std::map<std::string, std::string> &headers, std::string &err)
+{
+  if (!headers.count("host")) {
+    err = "no host header to sign";
+    return false;
+  }
+  std::tm utc = {};
+#ifdef _WIN32
+  gmtime_s(&utc, &time);
+#else
+  gmtime_r(&time, &utc);
+#endif
+  char dateTime[17]; // YYYYMMDDTHHMMSSZ
+  std::strftime(dateTime, sizeof(dateTime), "%Y%m%dT%H%M%SZ", &utc);
+  const auto date = std::string(dateTime, 8);
+
+  headers["x-amz-date"] = dateTime;
+  headers["x-amz-content-sha256"] = EMPTY_PAYLOAD_HASH;
+  if (!credentials.sessionToken.empty()) {
+    headers["x-amz-security-token"] = credentials.sessionToken;
+  }
+  std::string canonicalHeaders;
+  std::string signedHeaders;
+  for (const auto &header : headers) {
+    canonicalHeaders += header.first + ":" + header.second + "\n";
+    signedHeaders += (signedHeaders.empty() ? "" : ";") + header.first;
+  }
+  // No query string
+  const auto canonicalRequest = "GET\n" + path + "\n\n" + canonicalHeaders +
+                                "\n" + signedHeaders + "\n" +
+                                EMPTY_PAYLOAD_HASH;
+
+  const auto scope = date + "/" + region + "/" + service + "/aws4_request";
+  const auto stringToSign = std::string("AWS4-HMAC-SHA256\n") + dateTime +
+                            "\n" + scope + "\n" +
+                            toHex(sha256(canonicalRequest));
+  auto key = hmacSha256("AWS4" + credentials.secretAccessKey, date);
+  for (const auto &part : {region, service, std::string("aws4_request")}) {
+    key = hmacSha256(key, part);
+  }
+  headers["authorization"] =
+      "AWS4-HMAC-SHA256 Credential=" + credentials.accessKeyId + "/" +
+      scope + ", SignedHeaders=" + signedHeaders +
+      ", Signature=" + toHex(hmacSha256(key, stringToSign));
+  return true;
+}
+
+#else
+
+bool signAwsGetRequest(const AwsCredentials &, const std::string &,
+    const std::string &, const std::string &, std::time_t,
+    std::map<std::string, std::string> &, std::string &err)
+{
+  err = "signing requests needs a viewer built with OpenSSL "
+        "(GLMLV_USE_OPENSSL)";
+  return false;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <string>
+
+// AWS Signature Version 4 of the requests of s3:// remote files
+// (https://docs.aws.amazon.com/IAM/latest/UserGuide/reference_sigv.html).
+// The hashes are computed with OpenSSL if the viewer is built with it
+// (GLMLV_USE_OPENSSL), signing fails otherwise.
+
+struct AwsCredentials
+{
+  std::string accessKeyId;
+  std::string secretAccessKey;
+  std::string sessionToken; // Of temporary credentials, empty otherwise
+};
+
+// Whether signing is compiled in
+bool isAwsSigningSupported();
+
+// Credentials of the AWS_ACCESS_KEY_ID, AWS_SECRET_ACCESS_KEY and
+// AWS_SESSION_TOKEN environment variables. False without the first two:
+// requests are anonymous.
+bool getAwsEnvironmentCredentials(AwsCredentials &credentials);
+
+// Region of the AWS_REGION or AWS_DEFAULT_REGION environment variables,
+// us-east-1 without them
+std::string getAwsEnvironmentRegion();
+
+// Percent-encoding of AWS signatures: every byte but the unreserved
+// characters, and slashes if keepSlashes is true (object keys in paths)
+std::string encodeAwsUri(const std::string &str, bool keepSlashes);
+
+// Sign a GET request of path, already encoded (see encodeAwsUri), to service
+// in region at time. headers, by lower-case name, must hold "host" and are
+// all signed. x-amz-date, x-amz-content-sha256, x-amz-security-token with a
+// session token, and authorization are added. Return false and fill err on
+// failure.
+bool signAwsGetRequest(const AwsCredentials &credentials,
+    const std::string &region, const std::string &service,
+    const std::string &path, std::time_t time,
+    std::map<std::string, std::string> &headers, std::string &err);
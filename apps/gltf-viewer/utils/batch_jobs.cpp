@@ -0,0 +1,248 @@
+#include "batch_jobs.hpp"
+
+#include <json.hpp>
+
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+
+std::vector<std::string> splitCsvLine(const std::string &line)
+{
+  std::vector<std::string> fields;
+  std::stringstream stream{line};
+  std::string field;
+  while (std::getline(stream, field, ',')) {
+    const auto first = field.find_first_not_of(" \t\r");
+    const auto last = field.find_last_not_of(" \t\r");
+    fields.push_back(first == std::string::npos
+                         ? std::string()
+                         : field.substr(first, last - first + 1));
+  }
+  return fields;
+}
+
+bool parseJsonJobs(const std::string &content, std::vector<BatchJob> &jobs,
+    std::string &err)
+{
+  nlohmann::json document;
+  try {
+    document = nlohmann::json::parse(content);
+  } catch (const std::exception &e) {
+    err = std::string("invalid JSON: ") + e.what();
+    return false;
+  }
+  if (document.is_object() && document.count("jobs")) {
+    document = document["jobs"];
+  }
+  if (!document.is_array()) {
+    err = "expected an array of jobs";
+    return false;
+  }
+
+  try {
+    for (const auto &entry : document) {
+      BatchJob job;
+      if (!entry.count("model") || !entry.count("output")) {
+        err = "job without model or output";
+        return false;
+      }
+      job.model = entry["model"].get<std::string>();
+      job.output = entry["output"].get<std::string>();
+      if (entry.count("width")) {
+        job.width = entry["width"].get<size_t>();
+      }
+      if (entry.count("height")) {
+        job.height = entry["height"].get<size_t>();
+      }
+      if (entry.count("lookat")) {
+        job.lookat = entry["lookat"].get<std::vector<float>>();
+        if (job.lookat.size() != 9) {
+          err = "lookat of " + job.output.string() + " must have 9 numbers";
+          return false;
+        }
+      }
+      if (entry.count("vs")) {
+        job.vertexShader = entry["vs"].get<std::string>();
+      }
+      if (entry.count("fs")) {
+        job.fragmentShader = entry["fs"].get<std::string>();
+      }
+      if (entry.count("reference")) {
+        job.reference = entry["reference"].get<std::string>();
+      }
+      jobs.push_back(job);
+    }
+  } catch (const std::exception &e) {
+    err = std::string("invalid job: ") + e.what();
+    return false;
+  }
+  return true;
+}
+
+bool parseCsvJobs(const std::string &content, std::vector<BatchJob> &jobs,
+    std::string &err)
+{
+  std::stringstream stream{content};
+  std::string line;
+  for (size_t lineNumber = 1; std::getline(stream, line); ++lineNumber) {
+    const auto fields = splitCsvLine(line);
+    if (fields.empty() || fields[0].empty() || fields[0][0] == '#') {
+      continue;
+    }
+    const auto lineErr = "line " + std::to_string(lineNumber) + ": ";
+    if (fields.size() < 2 || fields.size() == 3 ||
+        (fields.size() > 4 && fields.size() < 13) || fields.size() > 16) {
+      err = lineErr + "unexpected number of fields";
+      return false;
+    }
+
+    BatchJob job;
+    job.model = fields[0];
+    job.output = fields[1];
+    try {
+      if (fields.size() >= 4) {
+        job.width = std::stoul(fields[2]);
+        job.height = std::stoul(fields[3]);
+      }
+      for (size_t i = 4; i < 13 && i < fields.size(); ++i) {
+        job.lookat.push_back(std::stof(fields[i]));
+      }
+    } catch (const std::exception &) {
+      err = lineErr + "invalid number";
+      return false;
+    }
+    if (fields.size() >= 14) {
+      job.vertexShader = fields[13];
+    }
+    if (fields.size() >= 15) {
+      job.fragmentShader = fields[14];
+    }
+    if (fields.size() >= 16) {
+      job.reference = fields[15];
+    }
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+} // namespace
+
+bool loadBatchJobs(const fs::path &path, size_t defaultWidth,
+    size_t defaultHeight, std::vector<BatchJob> &jobs, std::string &err)
+{
+  std::ifstream file{path.string(), std::ios::binary};
+  if (!file) {
+    err = "unable to open " + path.string();
+    return false;
+  }
+  std::stringstream content;
+  content << file.rdbuf();
+
+  std::vector<BatchJob> loadedJobs;
+  const auto ok = path.extension() == ".csv"
+                      ? parseCsvJobs(content.str(), loadedJobs, err)
+                      : parseJsonJobs(content.str(), loadedJobs, err);
+  if (!ok) {
+    err = path.string() + ": " + err;
+    return false;
+  }
+
+  const auto directory = path.parent_path();
+  for (auto &job : loadedJobs) {
+    if (job.model.is_relative()) {
+      job.model = directory / job.model;
+    }
+    if (job.output.is_relative()) {
+      job.output = directory / job.output;
+    }
+    if (!job.reference.empty() && job.reference.is_relative()) {
+      job.reference = directory / job.reference;
+    }
+    job.width = job.width ? job.width : defaultWidth;
+    job.height = job.height ? job.height : defaultHeight;
+  }
+  jobs.insert(end(jobs), begin(loadedJobs), end(loadedJobs));
+  return true;
+}
+
+bool compareWithReference(const BatchJob &job, size_t numComponents,
+    const unsigned char *pixels, bool flipY, size_t tolerance,
+    float maxDifferingPixels, BatchJobResult &result, std::string &err)
+{
+  size_t width = 0, height = 0;
+  std::vector<unsigned char> reference;
+  if (!readPng(job.reference, numComponents, width, height, reference, err)) {
+    return false;
+  }
+  if (width != job.width || height != job.height) {
+    err = job.output.string() + " is " + std::to_string(job.width) + "x" +
+          std::to_string(job.height) + ", its reference " +
+          job.reference.string() + " is " + std::to_string(width) + "x" +
+          std::to_string(height);
+    return false;
+  }
+  result.hasReference = true;
+  result.diff = compareImages(
+      width, height, numComponents, pixels, reference.data(), flipY, tolerance);
+  result.isMatching = double(result.diff.differingPixels) <=
+                      maxDifferingPixels * double(width * height);
+  if (!result.isMatching) {
+    err = job.output.string() + " differs from " + job.reference.string() +
+          " (" + std::to_string(result.diff.differingPixels) +
+          " pixels, max difference " +
+          std::to_string(result.diff.maxDifference) + ")";
+  }
+  return result.isMatching;
+}
+
+bool writeBatchResults(const fs::path &path, const std::vector<BatchJob> &jobs,
+    const std::vector<BatchJobResult> &results, std::string &err)
+{
+  std::ofstream file(path);
+  if (!file) {
+    err = "Unable to open " + path.string();
+    return false;
+  }
+
+  if (path.extension() == ".csv") {
+    file << "output,model,rendered,load_ms,gpu_ms,reference,matching,"
+            "differing_pixels,max_difference,mean_difference\n";
+    for (size_t i = 0; i < jobs.size() && i < results.size(); ++i) {
+      const auto &result = results[i];
+      // Quoted, paths may contain commas
+      file << "\"" << jobs[i].output.generic_string() << "\",\""
+           << jobs[i].model.generic_string() << "\"," << result.isRendered
+           << "," << result.loadTime << "," << result.gpuTime << ",\""
+           << jobs[i].reference.generic_string() << "\","
+           << result.isMatching << "," << result.diff.differingPixels << ","
+           << result.diff.maxDifference << "," << result.diff.meanDifference
+           << "\n";
+    }
+  } else {
+    auto document = nlohmann::json::array();
+    for (size_t i = 0; i < jobs.size() && i < results.size(); ++i) {
+      const auto &result = results[i];
+      nlohmann::json entry = {{"output", jobs[i].output.generic_string()},
+          {"model", jobs[i].model.generic_string()},
+          {"rendered", result.isRendered}, {"loadMs", result.loadTime},
+          {"gpuMs", result.gpuTime}};
+      if (result.hasReference) {
+        entry["reference"] = jobs[i].reference.generic_string();
+        entry["matching"] = result.isMatching;
+        entry["differingPixels"] = result.diff.differingPixels;
+        entry["maxDifference"] = result.diff.maxDifference;
+        entry["meanDifference"] = result.diff.meanDifference;
+      }
+      document.push_back(entry);
+    }
+    file << document.dump(2) << "\n";
+  }
+
+  if (!file) {
+    err = "Unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
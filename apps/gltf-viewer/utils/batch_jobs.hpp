@@ -0,0 +1,66 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "image_diff.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// An image to render in batch mode
+struct BatchJob
+{
+  fs::path model;
+  fs::path output; // png file
+  size_t width = 0;
+  size_t height = 0;
+  // Camera with the format of --lookat (eye, center, up), default camera if
+  // empty
+  std::vector<float> lookat;
+  // Shaders, the application defaults are used if empty
+  std::string vertexShader;
+  std::string fragmentShader;
+  // Golden image the output is compared with (see compareImages), none if
+  // empty
+  fs::path reference;
+};
+
+// Outcome of a BatchJob, times in milliseconds
+struct BatchJobResult
+{
+  bool isRendered = false; // Nothing else is measured if false
+  // Of the model, 0 if it was kept loaded by a previous job
+  double loadTime = 0.;
+  double gpuTime = 0.; // Drawing of the image
+  bool hasReference = false; // diff and isMatching are set if true
+  ImageDiff diff;
+  bool isMatching = false;
+};
+
+// Load a job list from a .json or .csv file. Relative paths are relative to
+// the directory of the job file. Jobs without size get defaultWidth x
+// defaultHeight.
+//
+// JSON: an array of objects (or an object with a "jobs" array) with keys
+// "model", "output", and optionally "width", "height", "lookat" (array of 9
+// numbers), "vs", "fs" and "reference".
+//
+// CSV: one job per line, empty lines and lines starting with '#' are ignored:
+//   model,output[,width,height[,eye_x,eye_y,eye_z,center_x,center_y,center_z,
+//   up_x,up_y,up_z[,vs[,fs[,reference]]]]]
+bool loadBatchJobs(const fs::path &path, size_t defaultWidth,
+    size_t defaultHeight, std::vector<BatchJob> &jobs, std::string &err);
+
+// Compare the image of job, job.width x job.height pixels of numComponents
+// components bottom row first if flipY is true, with job.reference and set
+// the reference fields of result. Return false and fill err if the reference
+// cannot be read or does not match: more than maxDifferingPixels, a fraction
+// of the pixels, differ (see compareImages).
+bool compareWithReference(const BatchJob &job, size_t numComponents,
+    const unsigned char *pixels, bool flipY, size_t tolerance,
+    float maxDifferingPixels, BatchJobResult &result, std::string &err);
+
+// Write the results of jobs in a .csv file, one line per job, or a .json
+// file (any other extension), an array of one object per job
+bool writeBatchResults(const fs::path &path, const std::vector<BatchJob> &jobs,
+    const std::vector<BatchJobResult> &results, std::string &err);
@@ -0,0 +1,218 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+
+#include <json.hpp>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+nlohmann::json toJson(const FrameTimeStats &stats)
+{
+  return {{"mean", stats.mean}, {"median", stats.median}, {"p95", stats.p95},
+      {"max", stats.max}};
+}
+
+nlohmann::json toJson(const GpuTelemetryStats &stats)
+{
+  return {{"samples", stats.sampleCount},
+      {"meanClockMHz", stats.meanGraphicsClock},
+      {"minClockMHz", stats.minGraphicsClock},
+      {"meanTemperatureC", stats.meanTemperature},
+      {"maxTemperatureC", stats.maxTemperature},
+      {"meanPowerW", stats.meanPower}, {"maxPowerW", stats.maxPower},
+      {"meanUtilization", stats.meanUtilization},
+      {"maxMemoryUsedBytes", stats.maxMemoryUsedBytes},
+      {"throttleReasons", getThrottleReasonNames(stats.throttleReasons)}};
+}
+
+} // namespace
+
+FrameTimeStats computeFrameTimeStats(std::vector<double> times)
+{
+  FrameTimeStats stats;
+  if (times.empty()) {
+    return stats;
+  }
+  std::sort(begin(times), end(times));
+  const auto getPercentile = [&](double percentile) {
+    return times[std::min(times.size() - 1,
+        size_t(std::ceil(percentile * double(times.size()))) - 1)];
+  };
+  stats.mean =
+      std::accumulate(begin(times), end(times), 0.) / double(times.size());
+  stats.median = getPercentile(0.5);
+  stats.p95 = getPercentile(0.95);
+  stats.max = times.back();
+  return stats;
+}
+
+std::vector<fs::path> findBenchmarkModels(const std::vector<fs::path> &paths)
+{
+  const auto isModel = [](const fs::path &path) {
+    const auto extension = path.extension();
+    return extension == ".gltf" || extension == ".glb";
+  };
+  std::vector<fs::path> models;
+  for (const auto &path : paths) {
+    std::error_code errorCode;
+    if (!fs::is_directory(path, errorCode)) {
+      models.emplace_back(path);
+      continue;
+    }
+    std::vector<fs::path> directoryModels;
+    for (const auto &entry :
+        fs::recursive_directory_iterator(path, errorCode)) {
+      if (fs::is_regular_file(entry.path(), errorCode) &&
+          isModel(entry.path())) {
+        directoryModels.emplace_back(entry.path());
+      }
+    }
+    // Directory iteration order is unspecified
+    std::sort(begin(directoryModels), end(directoryModels));
+    models.insert(end(models), begin(directoryModels), end(directoryModels));
+  }
+  return models;
+}
+
+#ifdef _WIN32
+
+size_t getResidentMemoryBytes()
+{
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!K32GetProcessMemoryInfo(
+          GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.WorkingSetSize;
+}
+
+size_t getPeakResidentMemoryBytes()
+{
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!K32GetProcessMemoryInfo(
+          GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+}
+
+#else
+
+size_t getResidentMemoryBytes()
+{
+  // Only Linux has /proc/self/statm: size then resident pages
+  std::ifstream statm("/proc/self/statm");
+  size_t pageCount = 0;
+  size_t residentPageCount = 0;
+  if (!(statm >> pageCount >> residentPageCount)) {
+    return 0;
+  }
+  return residentPageCount * size_t(sysconf(_SC_PAGESIZE));
+}
+
+size_t getPeakResidentMemoryBytes()
+{
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return size_t(usage.ru_maxrss);
+#else
+  return size_t(usage.ru_maxrss) * 1024; // In kilobytes
+#endif
+}
+
+#endif
+
+bool writeBenchmarkResults(const fs::path &path,
+    const std::vector<BenchmarkResult> &results, std::string &err)
+{
+  std::ofstream file(path);
+  if (!file) {
+    err = "Unable to open " + path.string();
+    return false;
+  }
+
+  if (path.extension() == ".csv") {
+    file << "model,loaded,parse_ms,decode_ms,upload_ms,resident_bytes,"
+            "peak_resident_bytes,scene_gpu_bytes,video_memory_bytes,frames";
+    for (const auto *prefix : {"cpu", "gpu"}) {
+      for (const auto *stat : {"mean", "median", "p95", "max"}) {
+        file << "," << prefix << "_" << stat << "_ms";
+      }
+    }
+    file << ",frame_allocations_mean,frame_allocations_max,"
+            "frame_allocated_bytes_mean";
+    file << ",gpu_samples,gpu_mean_clock_mhz,gpu_min_clock_mhz,"
+            "gpu_mean_temperature_c,gpu_max_temperature_c,gpu_mean_power_w,"
+            "gpu_max_power_w,gpu_mean_utilization,gpu_max_memory_used_bytes,"
+            "gpu_throttle_reasons\n";
+    for (const auto &result : results) {
+      // Quoted, paths may contain commas
+      file << "\"" << result.model.generic_string() << "\","
+           << result.isLoaded << "," << result.parseTime << ","
+           << result.decodeTime << "," << result.uploadTime << ","
+           << result.residentBytes << "," << result.peakResidentBytes << ","
+           << result.sceneGpuBytes << "," << result.videoMemoryBytes << ","
+           << result.frameCount;
+      for (const auto *stats : {&result.cpuFrameTime, &result.gpuFrameTime}) {
+        file << "," << stats->mean << "," << stats->median << ","
+             << stats->p95 << "," << stats->max;
+      }
+      file << "," << result.meanFrameAllocations << ","
+           << result.maxFrameAllocations << ","
+           << result.meanFrameAllocatedBytes;
+      const auto &telemetry = result.gpuTelemetry;
+      file << "," << telemetry.sampleCount << ","
+           << telemetry.meanGraphicsClock << "," << telemetry.minGraphicsClock
+           << "," << telemetry.meanTemperature << ","
+           << telemetry.maxTemperature << "," << telemetry.meanPower << ","
+           << telemetry.maxPower << "," << telemetry.meanUtilization << ","
+           << telemetry.maxMemoryUsedBytes << ",\""
+           << getThrottleReasonNames(telemetry.throttleReasons) << "\"\n";
+    }
+  } else {
+    auto document = nlohmann::json::array();
+    for (const auto &result : results) {
+      document.push_back({{"model", result.model.generic_string()},
+          {"loaded", result.isLoaded}, {"parseMs", result.parseTime},
+          {"decodeMs", result.decodeTime}, {"uploadMs", result.uploadTime},
+          {"residentBytes", result.residentBytes},
+          {"peakResidentBytes", result.peakResidentBytes},
+          {"sceneGpuBytes", result.sceneGpuBytes},
+          {"videoMemoryBytes", result.videoMemoryBytes},
+          {"frames", result.frameCount},
+          {"cpuFrameMs", toJson(result.cpuFrameTime)},
+          {"gpuFrameMs", toJson(result.gpuFrameTime)},
+          {"frameAllocations",
+              {{"mean", result.meanFrameAllocations},
+                  {"max", result.maxFrameAllocations},
+                  {"meanBytes", result.meanFrameAllocatedBytes}}}});
+      if (result.gpuTelemetry.sampleCount) {
+        document.back()["gpuTelemetry"] = toJson(result.gpuTelemetry);
+      }
+    }
+    file << document.dump(2) << "\n";
+  }
+
+  if (!file) {
+    err = "Unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "gpu_telemetry.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Statistics of the frame times of a benchmark, in milliseconds
+struct FrameTimeStats
+{
+  double mean = 0.;
+  double median = 0.;
+  double p95 = 0.; // 95th percentile
+  double max = 0.;
+};
+
+FrameTimeStats computeFrameTimeStats(std::vector<double> times);
+
+// Measures of a model by ViewerApplication::runBenchmark. Times are in
+// milliseconds.
+struct BenchmarkResult
+{
+  fs::path model;
+  bool isLoaded = false; // Nothing else is measured if false
+  // Reading and parsing of the glTF file, including image decoding when it
+  // is not done by parallel decoders
+  double parseTime = 0.;
+  double decodeTime = 0.; // Images, by parallel decoders
+  // Creation of the GPU resources, until the GPU is done with them
+  double uploadTime = 0.;
+  // Of the process after the upload, the peak is the one since the process
+  // started (0 if unknown)
+  size_t residentBytes = 0;
+  size_t peakResidentBytes = 0;
+  size_t sceneGpuBytes = 0; // Geometry and images uploaded
+  // Video memory the driver reports as used by the model, -1 if unknown
+  int64_t videoMemoryBytes = -1;
+  size_t frameCount = 0;
+  FrameTimeStats cpuFrameTime; // Submission of the draws
+  FrameTimeStats gpuFrameTime;
+  // State of the GPU over the measured frames, no sample without telemetry
+  GpuTelemetryStats gpuTelemetry;
+  // Heap allocations of the render thread per measured frame, 0 unless
+  // allocations are counted (see allocation_counter.hpp)
+  double meanFrameAllocations = 0.;
+  uint64_t maxFrameAllocations = 0;
+  double meanFrameAllocatedBytes = 0.;
+};
+
+// Paths of the .gltf and .glb files among paths, directories being searched
+// recursively, sorted by directory
+std::vector<fs::path> findBenchmarkModels(const std::vector<fs::path> &paths);
+
+// Resident memory of the process, 0 if unknown
+size_t getResidentMemoryBytes();
+size_t getPeakResidentMemoryBytes();
+
+// Write results in a .csv file, one line per model, or a .json file (any
+// other extension), an array of one object per model
+bool writeBenchmarkResults(const fs::path &path,
+    const std::vector<BenchmarkResult> &results, std::string &err);
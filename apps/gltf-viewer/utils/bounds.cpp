@@ -0,0 +1,101 @@
+#include "bounds.hpp"
+#include "float4.hpp"
+
+#include <cstring>
+
+namespace
+{
+
+using namespace simd;
+
+float loadFloat(const unsigned char *ptr)
+{
+  float value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+float horizontalMin(Float4 a)
+{
+  float values[4];
+  store(values, a);
+  return glm::min(
+      glm::min(values[0], values[1]), glm::min(values[2], values[3]));
+}
+
+float horizontalMax(Float4 a)
+{
+  float values[4];
+  store(values, a);
+  return glm::max(
+      glm::max(values[0], values[1]), glm::max(values[2], values[3]));
+}
+
+} // namespace
+
+void extendBoundsWithPositions(const unsigned char *data, size_t count,
+    size_t byteStride, const glm::mat4 &matrix, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax)
+{
+  // Rows of the affine part of the matrix, broadcasted (glm is column major)
+  Float4 m[3][4];
+  for (size_t row = 0; row < 3; ++row) {
+    for (size_t col = 0; col < 4; ++col) {
+      m[row][col] = set1(matrix[col][row]);
+    }
+  }
+
+  Float4 minimum[3], maximum[3];
+  for (size_t i = 0; i < 3; ++i) {
+    minimum[i] = set1(bboxMin[i]);
+    maximum[i] = set1(bboxMax[i]);
+  }
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    // Gather 4 positions in SoA form
+    const unsigned char *p[4] = {data + i * byteStride,
+        data + (i + 1) * byteStride, data + (i + 2) * byteStride,
+        data + (i + 3) * byteStride};
+    Float4 position[3];
+    for (size_t c = 0; c < 3; ++c) {
+      const auto offset = c * sizeof(float);
+      position[c] = set(loadFloat(p[0] + offset), loadFloat(p[1] + offset),
+          loadFloat(p[2] + offset), loadFloat(p[3] + offset));
+    }
+
+    for (size_t row = 0; row < 3; ++row) {
+      const auto world = m[row][0] * position[0] + m[row][1] * position[1] +
+                         m[row][2] * position[2] + m[row][3];
+      minimum[row] = min(minimum[row], world);
+      maximum[row] = max(maximum[row], world);
+    }
+  }
+
+  for (size_t c = 0; c < 3; ++c) {
+    bboxMin[c] = horizontalMin(minimum[c]);
+    bboxMax[c] = horizontalMax(maximum[c]);
+  }
+
+  for (; i < count; ++i) {
+    const auto p = data + i * byteStride;
+    const auto world = glm::vec3(
+        matrix * glm::vec4(loadFloat(p), loadFloat(p + sizeof(float)),
+                     loadFloat(p + 2 * sizeof(float)), 1.f));
+    bboxMin = glm::min(bboxMin, world);
+    bboxMax = glm::max(bboxMax, world);
+  }
+}
+
+void extendBoundsWithBox(const glm::vec3 &localMin, const glm::vec3 &localMax,
+    const glm::mat4 &matrix, glm::vec3 &bboxMin, glm::vec3 &bboxMax)
+{
+  for (size_t corner = 0; corner < 8; ++corner) {
+    const auto localCorner = glm::vec3(corner & 1 ? localMax.x : localMin.x,
+        corner & 2 ? localMax.y : localMin.y,
+        corner & 4 ? localMax.z : localMin.z);
+    const auto world = glm::vec3(matrix * glm::vec4(localCorner, 1.f));
+    bboxMin = glm::min(bboxMin, world);
+    bboxMax = glm::max(bboxMax, world);
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Kernels extending an axis aligned bounding box [bboxMin, bboxMax] with
+// transformed points. They are vectorized with SSE2 or NEON when available
+// (see float4.hpp) and processed four points at a time.
+
+// Extend the box with count vec3 float positions read from data, byteStride
+// bytes apart (12 for tightly packed positions), transformed by matrix.
+// data does not need to be aligned.
+void extendBoundsWithPositions(const unsigned char *data, size_t count,
+    size_t byteStride, const glm::mat4 &matrix, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax);
+
+// Extend the box with the 8 corners of the local box [localMin, localMax]
+// transformed by matrix. The result contains the transformed box but is
+// larger than the transformed points it encloses if matrix has a rotation.
+void extendBoundsWithBox(const glm::vec3 &localMin, const glm::vec3 &localMax,
+    const glm::mat4 &matrix, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
@@ -0,0 +1,294 @@
+#include "bvh.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+namespace
+{
+
+const size_t BIN_COUNT = 16;
+// Nodes with at most MIN_LEAF_SIZE primitives are leaves, nodes with more
+// than MAX_LEAF_SIZE are always split
+const size_t MIN_LEAF_SIZE = 4;
+const size_t MAX_LEAF_SIZE = 8;
+// Cost of visiting a node relative to testing a primitive box
+const float TRAVERSAL_COST = 1.f;
+// Subtrees with more primitives are built by another job
+const size_t PARALLEL_BUILD_MIN_SIZE = 4096;
+
+bool isBounded(const glm::vec3 &bboxMin, const glm::vec3 &bboxMax)
+{
+  const auto maxValue = std::numeric_limits<float>::max();
+  return glm::all(glm::lessThanEqual(bboxMin, bboxMax)) &&
+         glm::all(glm::greaterThan(bboxMin, glm::vec3(-maxValue))) &&
+         glm::all(glm::lessThan(bboxMax, glm::vec3(maxValue)));
+}
+
+// Half of the surface area of the box, enough to compare costs
+float getHalfArea(const glm::vec3 &bboxMin, const glm::vec3 &bboxMax)
+{
+  const auto d = glm::max(bboxMax - bboxMin, glm::vec3(0));
+  return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// Box and number of primitives of a bin or of a node
+struct Bounds
+{
+  glm::vec3 bboxMin = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+  size_t count = 0;
+
+  void extend(const glm::vec3 &otherMin, const glm::vec3 &otherMax)
+  {
+    bboxMin = glm::min(bboxMin, otherMin);
+    bboxMax = glm::max(bboxMax, otherMax);
+    ++count;
+  }
+
+  void extend(const Bounds &other)
+  {
+    bboxMin = glm::min(bboxMin, other.bboxMin);
+    bboxMax = glm::max(bboxMax, other.bboxMax);
+    count += other.count;
+  }
+
+  // Surface area heuristic cost of the primitives (up to the node area)
+  float getCost() const
+  {
+    return count ? getHalfArea(bboxMin, bboxMax) * count : 0.f;
+  }
+};
+
+// Primitives are sorted in place during the build, with a copy of their box
+// so that each node reads its primitives sequentially
+struct BuildPrimitive
+{
+  glm::vec3 bboxMin;
+  uint32_t index;
+  glm::vec3 bboxMax;
+  glm::vec3 centroid;
+};
+
+} // namespace
+
+struct BoundingVolumeHierarchy::BuildContext
+{
+  JobSystem &jobs;
+  JobSystem::JobCounter counter;
+  std::vector<BuildPrimitive> primitives;
+  std::atomic<uint32_t> nodeCount{1};
+};
+
+void BoundingVolumeHierarchy::build(const std::vector<glm::vec3> &boxesMin,
+    const std::vector<glm::vec3> &boxesMax)
+{
+  clear();
+  m_primitivesMin = boxesMin;
+  m_primitivesMax = boxesMax;
+
+  BuildContext context{getJobSystem()};
+  auto &primitives = context.primitives;
+  primitives.reserve(boxesMin.size());
+  Bounds bounds, centroidBounds;
+  for (size_t i = 0; i < boxesMin.size(); ++i) {
+    if (isBounded(boxesMin[i], boxesMax[i])) {
+      const auto centroid = 0.5f * (boxesMin[i] + boxesMax[i]);
+      primitives.push_back({boxesMin[i], uint32_t(i), boxesMax[i], centroid});
+      bounds.extend(boxesMin[i], boxesMax[i]);
+      centroidBounds.extend(centroid, centroid);
+    } else {
+      m_unboundedPrimitives.push_back(uint32_t(i));
+    }
+  }
+  if (primitives.empty()) {
+    return;
+  }
+
+  // A binary tree with n leaves has 2n - 1 nodes
+  m_nodes.resize(2 * primitives.size() - 1);
+  m_nodes[0].bboxMin = bounds.bboxMin;
+  m_nodes[0].bboxMax = bounds.bboxMax;
+  buildNode(context, 0, 0, uint32_t(primitives.size()), centroidBounds.bboxMin,
+      centroidBounds.bboxMax, 0);
+  context.jobs.wait(context.counter);
+  m_nodes.resize(context.nodeCount);
+
+  m_primitiveIndices.resize(primitives.size());
+  for (size_t i = 0; i < primitives.size(); ++i) {
+    m_primitiveIndices[i] = primitives[i].index;
+  }
+}
+
+void BoundingVolumeHierarchy::buildNode(BuildContext &context,
+    uint32_t nodeIdx, uint32_t begin, uint32_t end,
+    const glm::vec3 &centroidMin, const glm::vec3 &centroidMax, size_t depth)
+{
+  const auto primitives = context.primitives.data();
+  auto &node = m_nodes[nodeIdx];
+  const auto count = size_t(end - begin);
+
+  const auto makeLeaf = [&]() {
+    node.first = begin;
+    node.primitiveCount = uint32_t(count);
+  };
+  if (count <= MIN_LEAF_SIZE || depth + 1 >= MAX_DEPTH) {
+    makeLeaf();
+    return;
+  }
+
+  // Bin the centroids along each axis and find the split between bins of
+  // lowest cost. Small nodes use less bins, their cost is dominated by the
+  // sweep over the bins.
+  const auto binCount = std::min(BIN_COUNT, std::max(count / 2, size_t(4)));
+  const auto centroidExtent = centroidMax - centroidMin;
+  const auto binScale = glm::vec3(float(binCount)) /
+                        glm::max(centroidExtent, glm::vec3(1e-30f));
+  const auto getBins = [&](const glm::vec3 &centroid) {
+    return glm::min(glm::uvec3((centroid - centroidMin) * binScale),
+        glm::uvec3(uint32_t(binCount - 1)));
+  };
+  // Scratch bins of the thread, only used before recursing. Resetting the
+  // used bins is much faster than constructing them all for small nodes.
+  thread_local Bounds bins[3][BIN_COUNT];
+  for (auto &axisBins : bins) {
+    std::fill(axisBins, axisBins + binCount, Bounds{});
+  }
+  for (auto i = begin; i < end; ++i) {
+    const auto &primitive = primitives[i];
+    const auto primitiveBins = getBins(primitive.centroid);
+    for (int axis = 0; axis < 3; ++axis) {
+      bins[axis][primitiveBins[axis]].extend(
+          primitive.bboxMin, primitive.bboxMax);
+    }
+  }
+
+  auto bestCost = std::numeric_limits<float>::max();
+  auto bestAxis = -1;
+  uint32_t bestSplit = 0; // Bins [0, bestSplit) go to the left child
+  for (int axis = 0; axis < 3; ++axis) {
+    if (centroidExtent[axis] <= 0.f) {
+      continue;
+    }
+    // Cost of the right side of each split, then sweep the left side
+    float rightCosts[BIN_COUNT];
+    Bounds right;
+    for (auto split = binCount - 1; split > 0; --split) {
+      right.extend(bins[axis][split]);
+      rightCosts[split] = right.getCost();
+    }
+    Bounds left;
+    for (size_t split = 1; split < binCount; ++split) {
+      left.extend(bins[axis][split - 1]);
+      if (!left.count || left.count == count) {
+        continue;
+      }
+      const auto cost = left.getCost() + rightCosts[split];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = uint32_t(split);
+      }
+    }
+  }
+
+  const auto nodeArea = getHalfArea(node.bboxMin, node.bboxMax);
+  const auto leafCost = nodeArea * count;
+  const auto splitCost = nodeArea * TRAVERSAL_COST + bestCost;
+  if (count <= MAX_LEAF_SIZE && (bestAxis < 0 || leafCost <= splitCost)) {
+    makeLeaf();
+    return;
+  }
+
+  // Partition the primitives and compute the bounds of the children in the
+  // same pass. If all centroids are equal, any split is as good.
+  Bounds leftBounds, leftCentroids, rightBounds, rightCentroids;
+  const auto isLeft = [&](const BuildPrimitive &primitive, size_t i) {
+    return bestAxis >= 0 ? getBins(primitive.centroid)[bestAxis] < bestSplit
+                         : i < begin + count / 2;
+  };
+  auto i = begin;
+  auto j = end;
+  while (true) {
+    while (i < j && isLeft(primitives[i], i)) {
+      leftBounds.extend(primitives[i].bboxMin, primitives[i].bboxMax);
+      leftCentroids.extend(primitives[i].centroid, primitives[i].centroid);
+      ++i;
+    }
+    while (i < j && !isLeft(primitives[j - 1], j - 1)) {
+      --j;
+      rightBounds.extend(primitives[j].bboxMin, primitives[j].bboxMax);
+      rightCentroids.extend(primitives[j].centroid, primitives[j].centroid);
+    }
+    if (i >= j) {
+      break;
+    }
+    std::swap(primitives[i], primitives[j - 1]);
+  }
+  const auto middle = i;
+
+  const auto children = context.nodeCount.fetch_add(2);
+  node.first = children;
+  node.primitiveCount = 0;
+  m_nodes[children].bboxMin = leftBounds.bboxMin;
+  m_nodes[children].bboxMax = leftBounds.bboxMax;
+  m_nodes[children + 1].bboxMin = rightBounds.bboxMin;
+  m_nodes[children + 1].bboxMax = rightBounds.bboxMax;
+  const auto buildRight = [=, this, &context]() {
+    buildNode(context, children + 1, middle, end, rightCentroids.bboxMin,
+        rightCentroids.bboxMax, depth + 1);
+  };
+  if (end - middle >= PARALLEL_BUILD_MIN_SIZE) {
+    context.jobs.run(context.counter, buildRight);
+  } else {
+    buildRight();
+  }
+  buildNode(context, children, begin, middle, leftCentroids.bboxMin,
+      leftCentroids.bboxMax, depth + 1);
+}
+
+void BoundingVolumeHierarchy::refit(const std::vector<glm::vec3> &boxesMin,
+    const std::vector<glm::vec3> &boxesMax)
+{
+  m_primitivesMin = boxesMin;
+  m_primitivesMax = boxesMax;
+  // Children come after their parent
+  for (auto nodeIdx = m_nodes.size(); nodeIdx-- > 0;) {
+    auto &node = m_nodes[nodeIdx];
+    if (!node.primitiveCount) {
+      const auto &left = m_nodes[node.first];
+      const auto &right = m_nodes[node.first + 1];
+      node.bboxMin = glm::min(left.bboxMin, right.bboxMin);
+      node.bboxMax = glm::max(left.bboxMax, right.bboxMax);
+      continue;
+    }
+    node.bboxMin = glm::vec3(std::numeric_limits<float>::max());
+    node.bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for (auto i = node.first; i < node.first + node.primitiveCount; ++i) {
+      const auto primitiveIdx = m_primitiveIndices[i];
+      node.bboxMin = glm::min(node.bboxMin, m_primitivesMin[primitiveIdx]);
+      node.bboxMax = glm::max(node.bboxMax, m_primitivesMax[primitiveIdx]);
+    }
+  }
+}
+
+void BoundingVolumeHierarchy::clear()
+{
+  m_nodes.clear();
+  m_primitiveIndices.clear();
+  m_unboundedPrimitives.clear();
+  m_primitivesMin.clear();
+  m_primitivesMax.clear();
+}
+
+bool BoundingVolumeHierarchy::getBounds(
+    glm::vec3 &bboxMin, glm::vec3 &bboxMax) const
+{
+  if (m_nodes.empty()) {
+    return false;
+  }
+  bboxMin = m_nodes[0].bboxMin;
+  bboxMax = m_nodes[0].bboxMax;
+  return true;
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include "frustum.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the axis aligned boxes of primitives (e.g.
+// the world bounds of the draws of a scene), for spatial queries on the CPU.
+//
+// build() splits nodes with the surface area heuristic evaluated on a few
+// bins of primitive centroids, large subtrees are built in parallel with the
+// job system. refit() recomputes the boxes of the nodes without changing the
+// tree, which is much faster than a build when primitives move a bit (e.g.
+// animated nodes) but degrades the tree when they move a lot.
+//
+// Primitives with an unbounded box (a component of the min at -FLT_MAX, of
+// the max at FLT_MAX, or min > max) are kept out of the tree and returned by
+// every query.
+class BoundingVolumeHierarchy
+{
+public:
+  // Build the tree over primitive boxes [boxesMin[i], boxesMax[i]]
+  void build(const std::vector<glm::vec3> &boxesMin,
+      const std::vector<glm::vec3> &boxesMax);
+
+  // Update the boxes of the primitives given to the last build(), in the
+  // same order
+  void refit(const std::vector<glm::vec3> &boxesMin,
+      const std::vector<glm::vec3> &boxesMax);
+
+  void clear();
+
+  size_t primitiveCount() const { return m_primitivesMin.size(); }
+
+  size_t nodeCount() const { return m_nodes.size(); }
+
+  // Bounds of the bounded primitives, return false if there are none
+  bool getBounds(glm::vec3 &bboxMin, glm::vec3 &bboxMax) const;
+
+  // Call f(primitiveIdx) for each primitive whose box intersects the frustum
+  // (see intersectsBox), in no particular order
+  template <typename Function>
+  void forEachInFrustum(const Frustum &frustum, Function &&f) const
+  {
+    for (const auto primitiveIdx : m_unboundedPrimitives) {
+      f(size_t(primitiveIdx));
+    }
+    if (m_nodes.empty()) {
+      return;
+    }
+    uint32_t stack[MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize) {
+      const auto &node = m_nodes[stack[--stackSize]];
+      if (!intersectsBox(frustum, node.bboxMin, node.bboxMax)) {
+        continue;
+      }
+      if (!node.primitiveCount) {
+        stack[stackSize++] = node.first;
+        stack[stackSize++] = node.first + 1;
+        continue;
+      }
+      for (auto i = node.first; i < node.first + node.primitiveCount; ++i) {
+        const auto primitiveIdx = m_primitiveIndices[i];
+        if (intersectsBox(frustum, m_primitivesMin[primitiveIdx],
+                m_primitivesMax[primitiveIdx])) {
+          f(size_t(primitiveIdx));
+        }
+      }
+    }
+  }
+
+  // Call f(primitiveIdx, mask) for each primitive whose box intersects at
+  // least one of the frusta, bit i of mask being set if it intersects
+  // frusta[i]. A single traversal serves all the views: a node is only
+  // tested against the frusta that intersect its parent. At most 32 frusta.
+  template <typename Function>
+  void forEachInFrusta(
+      const Frustum *frusta, size_t frustumCount, Function &&f) const
+  {
+    const auto allFrusta =
+        frustumCount >= 32 ? ~uint32_t(0) : (uint32_t(1) << frustumCount) - 1;
+    for (const auto primitiveIdx : m_unboundedPrimitives) {
+      f(size_t(primitiveIdx), allFrusta);
+    }
+    if (m_nodes.empty() || !allFrusta) {
+      return;
+    }
+    const auto intersectedFrusta = [&](uint32_t mask, const glm::vec3 &bboxMin,
+                                       const glm::vec3 &bboxMax) {
+      for (size_t i = 0; i < frustumCount && i < 32; ++i) {
+        const auto bit = uint32_t(1) << i;
+        if ((mask & bit) && !intersectsBox(frusta[i], bboxMin, bboxMax)) {
+          mask &= ~bit;
+        }
+      }
+      return mask;
+    };
+    uint32_t stack[MAX_DEPTH];
+    uint32_t stackMasks[MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize] = 0;
+    stackMasks[stackSize++] = allFrusta;
+    while (stackSize) {
+      --stackSize;
+      const auto &node = m_nodes[stack[stackSize]];
+      const auto mask = intersectedFrusta(
+          stackMasks[stackSize], node.bboxMin, node.bboxMax);
+      if (!mask) {
+        continue;
+      }
+      if (!node.primitiveCount) {
+        stack[stackSize] = node.first;
+        stackMasks[stackSize++] = mask;
+        stack[stackSize] = node.first + 1;
+        stackMasks[stackSize++] = mask;
+        continue;
+      }
+      for (auto i = node.first; i < node.first + node.primitiveCount; ++i) {
+        const auto primitiveIdx = m_primitiveIndices[i];
+        const auto primitiveMask = intersectedFrusta(mask,
+            m_primitivesMin[primitiveIdx], m_primitivesMax[primitiveIdx]);
+        if (primitiveMask) {
+          f(size_t(primitiveIdx), primitiveMask);
+        }
+      }
+    }
+  }
+
+  // Find the nearest hit of the ray origin + t * direction for t in [0,
+  // tMax]. intersect(primitiveIdx, tMax) is called for primitives whose box
+  // is hit before tMax, roughly from near to far: it must return true and
+  // lower tMax if the primitive itself is hit before tMax. Return the index
+  // of the nearest hit primitive (tMax is its distance), -1 if none.
+  template <typename Function>
+  int intersectRay(const glm::vec3 &origin, const glm::vec3 &direction,
+      float &tMax, Function &&intersect) const
+  {
+    auto hitIdx = -1;
+    for (const auto primitiveIdx : m_unboundedPrimitives) {
+      if (intersect(size_t(primitiveIdx), tMax)) {
+        hitIdx = int(primitiveIdx);
+      }
+    }
+    if (m_nodes.empty()) {
+      return hitIdx;
+    }
+    const auto invDirection = 1.f / direction;
+    uint32_t stack[MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize) {
+      const auto &node = m_nodes[stack[--stackSize]];
+      float tNode;
+      if (!intersectsRay(node, origin, invDirection, tMax, tNode)) {
+        continue;
+      }
+      if (!node.primitiveCount) {
+        // Push the farthest child first so that the nearest one is visited
+        // first and lowers tMax early
+        float tLeft, tRight;
+        const auto &left = m_nodes[node.first];
+        const auto &right = m_nodes[node.first + 1];
+        const auto hitsLeft =
+            intersectsRay(left, origin, invDirection, tMax, tLeft);
+        const auto hitsRight =
+            intersectsRay(right, origin, invDirection, tMax, tRight);
+        if (hitsLeft && hitsRight) {
+          const auto leftFirst = tLeft <= tRight;
+          stack[stackSize++] = node.first + (leftFirst ? 1 : 0);
+          stack[stackSize++] = node.first + (leftFirst ? 0 : 1);
+        } else if (hitsLeft || hitsRight) {
+          stack[stackSize++] = node.first + (hitsLeft ? 0 : 1);
+        }
+        continue;
+      }
+      for (auto i = node.first; i < node.first + node.primitiveCount; ++i) {
+        const auto primitiveIdx = m_primitiveIndices[i];
+        if (intersect(size_t(primitiveIdx), tMax)) {
+          hitIdx = int(primitiveIdx);
+        }
+      }
+    }
+    return hitIdx;
+  }
+
+private:
+  // Interior nodes have primitiveCount == 0 and children first and first + 1,
+  // leaves have the primitives m_primitiveIndices[first : first +
+  // primitiveCount]. Children always come after their parent.
+  struct Node
+  {
+    glm::vec3 bboxMin;
+    uint32_t first;
+    glm::vec3 bboxMax;
+    uint32_t primitiveCount;
+  };
+
+  // Bounds the traversal stacks: build() stops splitting at this depth
+  static const size_t MAX_DEPTH = 64;
+
+  // Return true if the ray enters the box of node before tMax, at tEnter
+  static bool intersectsRay(const Node &node, const glm::vec3 &origin,
+      const glm::vec3 &invDirection, float tMax, float &tEnter)
+  {
+    const auto t0 = (node.bboxMin - origin) * invDirection;
+    const auto t1 = (node.bboxMax - origin) * invDirection;
+    const auto tNear = glm::min(t0, t1);
+    const auto tFar = glm::max(t0, t1);
+    tEnter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.f));
+    const auto tExit =
+        glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, tMax));
+    return tEnter <= tExit;
+  }
+
+  struct BuildContext;
+
+  // Split the primitives [begin, end) of the node, whose box must be set.
+  // centroidMin/Max are the bounds of the centroids of the primitives.
+  void buildNode(BuildContext &context, uint32_t nodeIdx, uint32_t begin,
+      uint32_t end, const glm::vec3 &centroidMin, const glm::vec3 &centroidMax,
+      size_t depth);
+
+  std::vector<Node> m_nodes; // m_nodes[0] is the root
+  std::vector<uint32_t> m_primitiveIndices; // Sorted by leaf
+  std::vector<uint32_t> m_unboundedPrimitives;
+  std::vector<glm::vec3> m_primitivesMin;
+  std::vector<glm::vec3> m_primitivesMax;
+};
@@ -0,0 +1,93 @@
+#include "camera_path.hpp"
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <fstream>
+
+void CameraPath::add(double time, const Camera &camera)
+{
+  if (m_keyframes.empty() || time > m_keyframes.back().time) {
+    m_keyframes.push_back({time, camera});
+  }
+}
+
+Camera CameraPath::evaluate(double time) const
+{
+  if (m_keyframes.empty()) {
+    return Camera{glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)};
+  }
+  const auto next = std::upper_bound(begin(m_keyframes), end(m_keyframes),
+      time, [](double time, const Keyframe &keyframe) {
+        return time < keyframe.time;
+      });
+  if (next == begin(m_keyframes)) {
+    return m_keyframes.front().camera;
+  }
+  if (next == end(m_keyframes)) {
+    return m_keyframes.back().camera;
+  }
+  const auto &from = *(next - 1);
+  const auto &to = *next;
+  const auto t = float((time - from.time) / (to.time - from.time));
+  return Camera{glm::mix(from.camera.eye(), to.camera.eye(), t),
+      glm::mix(from.camera.center(), to.camera.center(), t),
+      glm::normalize(glm::mix(from.camera.up(), to.camera.up(), t))};
+}
+
+bool CameraPath::load(const fs::path &path, std::string &err)
+{
+  std::ifstream file{path.string(), std::ios::binary};
+  if (!file) {
+    err = "unable to open " + path.string();
+    return false;
+  }
+
+  std::vector<Keyframe> keyframes;
+  try {
+    nlohmann::json document;
+    file >> document;
+    for (const auto &entry : document.at("keyframes")) {
+      const auto time = entry.at("time").get<double>();
+      const auto lookat = entry.at("lookat").get<std::vector<float>>();
+      if (lookat.size() != 9) {
+        err = "lookat of keyframes must have 9 numbers";
+        return false;
+      }
+      if (!keyframes.empty() && time <= keyframes.back().time) {
+        err = "keyframes must be sorted by increasing time";
+        return false;
+      }
+      keyframes.push_back({time,
+          Camera{glm::vec3(lookat[0], lookat[1], lookat[2]),
+              glm::vec3(lookat[3], lookat[4], lookat[5]),
+              glm::vec3(lookat[6], lookat[7], lookat[8])}});
+    }
+  } catch (const std::exception &e) {
+    err = std::string("invalid camera path: ") + e.what();
+    return false;
+  }
+  m_keyframes = std::move(keyframes);
+  return true;
+}
+
+bool CameraPath::write(const fs::path &path, std::string &err) const
+{
+  auto keyframes = nlohmann::json::array();
+  for (const auto &keyframe : m_keyframes) {
+    const auto &camera = keyframe.camera;
+    keyframes.push_back({{"time", keyframe.time},
+        {"lookat", {camera.eye().x, camera.eye().y, camera.eye().z,
+                       camera.center().x, camera.center().y,
+                       camera.center().z, camera.up().x, camera.up().y,
+                       camera.up().z}}});
+  }
+
+  std::ofstream file{path.string()};
+  file << nlohmann::json{{"keyframes", keyframes}}.dump(2) << "\n";
+  if (!file) {
+    err = "unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "cameras.hpp"
+#include "filesystem.hpp"
+
+#include <string>
+#include <vector>
+
+// Keyframes of a camera over time, played back at a fixed time step so that
+// every run sees the same frames.
+//
+// File format (JSON), lookat having the format of --lookat (eye, center, up):
+//   {"keyframes": [{"time": 0, "lookat": [0, 0, 5, 0, 0, 0, 0, 1, 0]}, ...]}
+class CameraPath
+{
+public:
+  struct Keyframe
+  {
+    double time; // In seconds
+    Camera camera;
+  };
+
+  bool empty() const { return m_keyframes.empty(); }
+
+  // Time of the last keyframe
+  double duration() const
+  {
+    return m_keyframes.empty() ? 0. : m_keyframes.back().time;
+  }
+
+  const std::vector<Keyframe> &keyframes() const { return m_keyframes; }
+
+  // Append a keyframe, ignored unless time is after the last one
+  void add(double time, const Camera &camera);
+
+  // Camera at time, clamped to [0, duration()]: eye and center are
+  // interpolated linearly between keyframes, up vectors are normalized
+  // linear interpolations
+  Camera evaluate(double time) const;
+
+  bool load(const fs::path &path, std::string &err);
+  bool write(const fs::path &path, std::string &err) const;
+
+private:
+  std::vector<Keyframe> m_keyframes; // By increasing time
+};
@@ -0,0 +1,64 @@
+#include "camera_prediction.hpp"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+void CameraPredictor::add(double time, const Camera &camera)
+{
+  if (!m_samples.empty() && time <= m_samples.back().time) {
+    m_samples.back().camera = camera;
+    return;
+  }
+  m_samples.push_back({time, camera});
+  // Two samples are kept whatever the frame time
+  while (m_samples.size() > 2 &&
+         m_samples[1].time <= time - HISTORY_SECONDS) {
+    m_samples.pop_front();
+  }
+}
+
+void CameraPredictor::predict(
+    float horizon, std::vector<Camera> &cameras) const
+{
+  if (m_samples.size() < 2 || horizon <= 0.f) {
+    return;
+  }
+  const auto &first = m_samples.front();
+  const auto &last = m_samples.back();
+  const auto duration = float(last.time - first.time);
+  const auto velocity = (last.camera.eye() - first.camera.eye()) / duration;
+
+  const auto lastFront = last.camera.center() - last.camera.eye();
+  const auto firstDirection =
+      glm::normalize(first.camera.center() - first.camera.eye());
+  const auto lastDirection = glm::normalize(lastFront);
+  auto axis = glm::cross(firstDirection, lastDirection);
+  const auto sinAngle = glm::length(axis);
+  const auto angularVelocity =
+      std::atan2(sinAngle, glm::dot(firstDirection, lastDirection)) /
+      duration;
+  const auto isTurning = sinAngle > 1e-5f;
+  if (isTurning) {
+    axis /= sinAngle;
+  }
+  if (velocity == glm::vec3(0) && !isTurning) {
+    return;
+  }
+
+  for (const auto step : CAMERA_PREDICTION_STEPS) {
+    const auto seconds = step * horizon;
+    const auto eye = last.camera.eye() + seconds * velocity;
+    auto front = lastFront;
+    auto up = last.camera.up();
+    if (isTurning) {
+      // At most half a turn, spinning further looks back at what was seen
+      const auto rotation = glm::rotate(glm::mat4(1),
+          std::min(seconds * angularVelocity, glm::pi<float>()), axis);
+      front = glm::vec3(rotation * glm::vec4(front, 0.f));
+      up = glm::vec3(rotation * glm::vec4(up, 0.f));
+    }
+    cameras.emplace_back(eye, eye + front, up);
+  }
+}
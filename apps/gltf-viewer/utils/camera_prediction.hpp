@@ -0,0 +1,38 @@
+#pragma once
+
+#include "cameras.hpp"
+
+#include <deque>
+#include <vector>
+
+// Fractions of the prediction horizon at which cameras are predicted, the
+// nearest first so that what is needed sooner is requested first
+const float CAMERA_PREDICTION_STEPS[] = {0.25f, 0.5f, 1.f};
+
+// Extrapolates the path of a camera from its recent motion, whatever moves
+// it (camera controllers, picking, framing), so that the streamers prefetch
+// the content the next frames will see: the eye keeps its velocity and the
+// view direction its angular velocity over the last HISTORY_SECONDS.
+class CameraPredictor
+{
+public:
+  static constexpr double HISTORY_SECONDS = 0.25;
+
+  // Add the camera of the frame at time, in seconds
+  void add(double time, const Camera &camera);
+
+  void clear() { m_samples.clear(); }
+
+  // Append the cameras predicted at the CAMERA_PREDICTION_STEPS of horizon
+  // seconds past the last camera added, none if it does not move
+  void predict(float horizon, std::vector<Camera> &cameras) const;
+
+private:
+  struct Sample
+  {
+    double time;
+    Camera camera;
+  };
+
+  std::deque<Sample> m_samples; // By increasing time
+};
@@ -1,7 +1,12 @@
 #include "cameras.hpp"
 #include "glfw.hpp"
 
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 
 // Good reference here to map camera movements to lookAt calls
 // http://learnwebgl.brown37.net/07_cameras/camera_movement.html
@@ -26,70 +31,162 @@ ViewFrame fromViewToWorldMatrix(const mat4 &viewToWorldMatrix)
       -vec3(viewToWorldMatrix[2]), vec3(viewToWorldMatrix[3])};
 }
 
-bool FirstPersonCameraController::update(float elapsedTime)
+Camera getFramingCamera(const vec3 &bboxMin, const vec3 &bboxMax,
+    const mat4 &projMatrix, const vec3 &front, const vec3 &up)
 {
-  if (glfwGetMouseButton(m_pWindow, GLFW_MOUSE_BUTTON_LEFT) &&
-      !m_LeftButtonPressed) {
-    m_LeftButtonPressed = true;
-    glfwGetCursorPos(
-        m_pWindow, &m_LastCursorPosition.x, &m_LastCursorPosition.y);
-  } else if (!glfwGetMouseButton(m_pWindow, GLFW_MOUSE_BUTTON_LEFT) &&
-             m_LeftButtonPressed) {
-    m_LeftButtonPressed = false;
-  }
-
-  const auto cursorDelta = ([&]() {
-    if (m_LeftButtonPressed) {
-      dvec2 cursorPosition;
-      glfwGetCursorPos(m_pWindow, &cursorPosition.x, &cursorPosition.y);
-      const auto delta = cursorPosition - m_LastCursorPosition;
-      m_LastCursorPosition = cursorPosition;
-      return delta;
-    }
-    return dvec2(0);
-  })();
+  const auto center = 0.5f * (bboxMin + bboxMax);
+  auto radius = 0.5f * length(bboxMax - bboxMin);
+  radius = radius > 0.f ? radius : 1.f;
+  // Tangents of the half field of view are 1 / projMatrix[1][1] vertically
+  // and 1 / projMatrix[0][0] horizontally
+  const auto tanHalfFov =
+      1.f / max(std::abs(projMatrix[0][0]), std::abs(projMatrix[1][1]));
+  const auto distance = radius / sin(atan(tanHalfFov));
 
-  float truckLeft = 0.f;
-  float pedestalUp = 0.f;
-  float dollyIn = 0.f;
-  float rollRightAngle = 0.f;
-
-  if (glfwGetKey(m_pWindow, GLFW_KEY_W)) {
-    dollyIn += m_fSpeed * elapsedTime;
+  const auto direction = normalize(front);
+  // Any up vector not colinear with front
+  auto cameraUp = up;
+  if (length(cross(direction, cameraUp)) < 1e-3f) {
+    cameraUp = std::abs(direction.y) < 0.9f ? vec3(0, 1, 0) : vec3(0, 0, 1);
   }
+  return Camera{center - distance * direction, center, cameraUp};
+}
 
-  // Truck left
-  if (glfwGetKey(m_pWindow, GLFW_KEY_A)) {
-    truckLeft += m_fSpeed * elapsedTime;
+bool getNearFarPlanes(const Camera &camera, const vec3 &bboxMin,
+    const vec3 &bboxMax, float &zNear, float &zFar, float minNearRatio)
+{
+  // Depths of the corners of the box, the camera looks at -z in view space
+  const auto viewMatrix = camera.getViewMatrix();
+  auto minDepth = std::numeric_limits<float>::max();
+  auto maxDepth = std::numeric_limits<float>::lowest();
+  for (int i = 0; i < 8; ++i) {
+    const auto corner = vec3(i & 1 ? bboxMax.x : bboxMin.x,
+        i & 2 ? bboxMax.y : bboxMin.y, i & 4 ? bboxMax.z : bboxMin.z);
+    const auto depth = -(viewMatrix * vec4(corner, 1)).z;
+    minDepth = std::min(minDepth, depth);
+    maxDepth = std::max(maxDepth, depth);
   }
-
-  // Pedestal up
-  if (glfwGetKey(m_pWindow, GLFW_KEY_UP)) {
-    pedestalUp += m_fSpeed * elapsedTime;
+  if (maxDepth <= 0.f) {
+    return false;
   }
 
-  // Dolly out
-  if (glfwGetKey(m_pWindow, GLFW_KEY_S)) {
-    dollyIn -= m_fSpeed * elapsedTime;
-  }
+  // A small margin so that the faces of the box are not clipped
+  zFar = 1.01f * maxDepth;
+  zNear = std::max(0.99f * minDepth, minNearRatio * zFar);
+  return true;
+}
 
-  // Truck right
-  if (glfwGetKey(m_pWindow, GLFW_KEY_D)) {
-    truckLeft -= m_fSpeed * elapsedTime;
-  }
+mat4 getReversedZPerspective(float fovY, float aspectRatio, float zNear)
+{
+  const auto f = 1.f / std::tan(0.5f * fovY);
+  auto projMatrix = mat4(0);
+  projMatrix[0][0] = f / aspectRatio;
+  projMatrix[1][1] = f;
+  projMatrix[2][3] = -1.f; // w = -z
+  projMatrix[3][2] = zNear; // z = zNear, so depth = zNear / -z
+  return projMatrix;
+}
 
-  // Pedestal down
-  if (glfwGetKey(m_pWindow, GLFW_KEY_DOWN)) {
-    pedestalUp -= m_fSpeed * elapsedTime;
-  }
+StereoRig getStereoRig(const Camera &camera, float ipd, float convergence)
+{
+  const auto offset = 0.5f * ipd * camera.left();
+  StereoRig rig;
+  rig.eyes[0] =
+      Camera{camera.eye() + offset, camera.center() + offset, camera.up()};
+  rig.eyes[1] =
+      Camera{camera.eye() - offset, camera.center() - offset, camera.up()};
+  // Left is -x in view space
+  rig.eyeOffsets[0] = -0.5f * ipd;
+  rig.eyeOffsets[1] = 0.5f * ipd;
+  rig.convergence =
+      convergence > 0.f ? convergence : length(camera.front(false));
+  return rig;
+}
+
+bool FirstPersonCameraController::update(
+    const std::vector<InputEvent> &events, double time, bool ignoreInput)
+{
+  const auto getMotion = [](int key) {
+    switch (key) {
+    case GLFW_KEY_W:
+      return DOLLY_IN;
+    case GLFW_KEY_S:
+      return DOLLY_OUT;
+    case GLFW_KEY_A:
+      return TRUCK_LEFT;
+    case GLFW_KEY_D:
+      return TRUCK_RIGHT;
+    case GLFW_KEY_UP:
+      return PEDESTAL_UP;
+    case GLFW_KEY_DOWN:
+      return PEDESTAL_DOWN;
+    case GLFW_KEY_Q:
+      return ROLL_LEFT;
+    case GLFW_KEY_E:
+      return ROLL_RIGHT;
+    }
+    return MOTION_COUNT;
+  };
 
-  if (glfwGetKey(m_pWindow, GLFW_KEY_Q)) {
-    rollRightAngle -= 0.001f;
+  // Seconds each motion key was held since the last update
+  const auto lastUpdateTime = m_lastUpdateTime < 0. ? time : m_lastUpdateTime;
+  const auto getHeldTime = [&](double pressTime, double releaseTime) {
+    return std::max(releaseTime - std::max(pressTime, lastUpdateTime), 0.);
+  };
+  std::array<double, MOTION_COUNT> heldTimes = {};
+  // Every cursor position counts, not only the last one
+  auto cursorDelta = dvec2(0);
+  for (const auto &event : events) {
+    switch (event.type) {
+    case InputEvent::Type::Key: {
+      const auto motion = getMotion(event.code);
+      if (motion == MOTION_COUNT) {
+        break;
+      }
+      auto &pressTime = m_keyPressTimes[motion];
+      if (event.action == GLFW_PRESS && pressTime < 0.) {
+        pressTime = event.time;
+      } else if (event.action == GLFW_RELEASE && pressTime >= 0.) {
+        heldTimes[motion] += getHeldTime(pressTime, event.time);
+        pressTime = -1.;
+      }
+      break;
+    }
+    case InputEvent::Type::MouseButton:
+      if (event.code == GLFW_MOUSE_BUTTON_LEFT) {
+        m_LeftButtonPressed = event.action == GLFW_PRESS;
+        m_LastCursorPosition = event.cursorPosition;
+      }
+      break;
+    case InputEvent::Type::CursorPosition:
+      if (m_LeftButtonPressed) {
+        cursorDelta += event.cursorPosition - m_LastCursorPosition;
+        m_LastCursorPosition = event.cursorPosition;
+      }
+      break;
+    case InputEvent::Type::Scroll:
+    case InputEvent::Type::FramebufferSize:
+      break;
+    }
   }
-  if (glfwGetKey(m_pWindow, GLFW_KEY_E)) {
-    rollRightAngle += 0.001f;
+  for (size_t motion = 0; motion < MOTION_COUNT; ++motion) {
+    if (m_keyPressTimes[motion] >= 0.) {
+      heldTimes[motion] += getHeldTime(m_keyPressTimes[motion], time);
+    }
+  }
+  m_lastUpdateTime = time;
+  if (ignoreInput) {
+    return false;
   }
 
+  const auto getAxis = [&](Motion positive, Motion negative) {
+    return float(heldTimes[positive] - heldTimes[negative]);
+  };
+  const auto dollyIn = m_fSpeed * getAxis(DOLLY_IN, DOLLY_OUT);
+  const auto truckLeft = m_fSpeed * getAxis(TRUCK_LEFT, TRUCK_RIGHT);
+  const auto pedestalUp = m_fSpeed * getAxis(PEDESTAL_UP, PEDESTAL_DOWN);
+  const auto rollRightAngle = ROLL_SPEED * getAxis(ROLL_RIGHT, ROLL_LEFT);
+
   // cursor going right, so minus because we want pan left angle:
   const float panLeftAngle = -0.01f * float(cursorDelta.x);
   const float tiltDownAngle = 0.01f * float(cursorDelta.y);
@@ -107,4 +204,151 @@ bool FirstPersonCameraController::update(float elapsedTime)
   return true;
 }
 
-bool TrackballCameraController::update(float elapsedTime) { return false; }
\ No newline at end of file
+void TrackballCameraController::getYawAxes(vec3 &front, vec3 &left) const
+{
+  const auto up = normalize(m_worldUpAxis);
+  // Any axis not colinear with up
+  const auto reference =
+      std::abs(up.z) < 0.9f ? vec3(0, 0, -1) : vec3(0, 1, 0);
+  left = normalize(cross(up, reference));
+  front = cross(left, up);
+}
+
+TrackballCameraController::Orbit TrackballCameraController::getOrbit(
+    const vec3 &eye, const vec3 &pivot) const
+{
+  vec3 yawFront, yawLeft;
+  getYawAxes(yawFront, yawLeft);
+  Orbit orbit;
+  orbit.pivot = pivot;
+  orbit.distance = std::max(length(pivot - eye), 1e-6f);
+  const auto front = (pivot - eye) / orbit.distance;
+  orbit.yaw = std::atan2(dot(front, yawLeft), dot(front, yawFront));
+  orbit.pitch =
+      std::asin(clamp(dot(front, normalize(m_worldUpAxis)), -1.f, 1.f));
+  return orbit;
+}
+
+Camera TrackballCameraController::getOrbitCamera(const Orbit &orbit) const
+{
+  vec3 yawFront, yawLeft;
+  getYawAxes(yawFront, yawLeft);
+  const auto up = normalize(m_worldUpAxis);
+  const auto horizontal =
+      std::cos(orbit.yaw) * yawFront + std::sin(orbit.yaw) * yawLeft;
+  const auto front =
+      std::cos(orbit.pitch) * horizontal + std::sin(orbit.pitch) * up;
+  return Camera{orbit.pivot - orbit.distance * front, orbit.pivot, up};
+}
+
+void TrackballCameraController::setCamera(const Camera &camera)
+{
+  m_current = getOrbit(camera.eye(), camera.center());
+  m_goal = m_current;
+  m_camera = getOrbitCamera(m_current);
+  m_isMoving = false;
+}
+
+void TrackballCameraController::setPivot(const vec3 &point)
+{
+  m_goal = getOrbit(m_camera.eye(), point);
+  // A point above or below the eye would look along the up axis
+  m_goal.pitch = clamp(m_goal.pitch, -MAX_PITCH, MAX_PITCH);
+  // The shortest turn to the new yaw
+  const auto turns =
+      std::round((m_goal.yaw - m_current.yaw) / glm::two_pi<float>());
+  m_goal.yaw -= turns * glm::two_pi<float>();
+  m_isMoving = true;
+}
+
+void TrackballCameraController::frame(
+    const vec3 &bboxMin, const vec3 &bboxMax, const mat4 &projMatrix)
+{
+  const auto framing = getFramingCamera(
+      bboxMin, bboxMax, projMatrix, m_camera.front(), m_worldUpAxis);
+  m_goal.pivot = framing.center();
+  m_goal.distance = length(framing.center() - framing.eye());
+  m_isMoving = true;
+}
+
+bool TrackballCameraController::update(
+    const std::vector<InputEvent> &events, double time, bool ignoreInput)
+{
+  const auto elapsedTime =
+      m_lastUpdateTime < 0. ? 0. : std::max(time - m_lastUpdateTime, 0.);
+  m_lastUpdateTime = time;
+
+  auto orbitDelta = dvec2(0);
+  auto panDelta = dvec2(0);
+  auto scrollSteps = 0.;
+  for (const auto &event : events) {
+    switch (event.type) {
+    case InputEvent::Type::Key:
+      if (event.code == GLFW_KEY_LEFT_SHIFT ||
+          event.code == GLFW_KEY_RIGHT_SHIFT) {
+        m_isShiftPressed = event.action != GLFW_RELEASE;
+      }
+      break;
+    case InputEvent::Type::MouseButton:
+      if (event.code == GLFW_MOUSE_BUTTON_LEFT) {
+        m_LeftButtonPressed = event.action == GLFW_PRESS;
+      } else if (event.code == GLFW_MOUSE_BUTTON_MIDDLE) {
+        m_MiddleButtonPressed = event.action == GLFW_PRESS;
+      }
+      m_LastCursorPosition = event.cursorPosition;
+      break;
+    case InputEvent::Type::CursorPosition: {
+      const auto delta = event.cursorPosition - m_LastCursorPosition;
+      m_LastCursorPosition = event.cursorPosition;
+      if (m_MiddleButtonPressed ||
+          (m_LeftButtonPressed && m_isShiftPressed)) {
+        panDelta += delta;
+      } else if (m_LeftButtonPressed) {
+        orbitDelta += delta;
+      }
+      break;
+    }
+    case InputEvent::Type::Scroll:
+      scrollSteps += event.scrollOffset.y;
+      break;
+    case InputEvent::Type::FramebufferSize:
+      break;
+    }
+  }
+
+  if (!ignoreInput &&
+      (orbitDelta != dvec2(0) || panDelta != dvec2(0) || scrollSteps)) {
+    // Dragging right turns the model right, so the camera left
+    m_goal.yaw -= ORBIT_SPEED * float(orbitDelta.x);
+    m_goal.pitch = clamp(m_goal.pitch - ORBIT_SPEED * float(orbitDelta.y),
+        -MAX_PITCH, MAX_PITCH);
+    // The pivot follows the cursor
+    const auto panScale = PAN_SPEED * m_goal.distance;
+    m_goal.pivot += panScale * (float(panDelta.x) * m_camera.left() +
+                                   float(panDelta.y) * m_camera.up());
+    m_goal.distance *= std::pow(ZOOM_FACTOR, float(scrollSteps));
+    m_isMoving = true;
+  }
+  if (!m_isMoving) {
+    return false;
+  }
+
+  // Exponential approach, the distance in log space so that zooming has
+  // the same pace from any distance
+  const auto alpha = 1.f - std::exp(-float(elapsedTime) / DAMPING_TIME);
+  m_current.pivot = mix(m_current.pivot, m_goal.pivot, alpha);
+  m_current.distance *= std::pow(m_goal.distance / m_current.distance, alpha);
+  m_current.yaw = mix(m_current.yaw, m_goal.yaw, alpha);
+  m_current.pitch = mix(m_current.pitch, m_goal.pitch, alpha);
+
+  const auto epsilon = 1e-4f;
+  if (length(m_current.pivot - m_goal.pivot) < epsilon * m_goal.distance &&
+      std::abs(std::log(m_current.distance / m_goal.distance)) < epsilon &&
+      std::abs(m_current.yaw - m_goal.yaw) < epsilon &&
+      std::abs(m_current.pitch - m_goal.pitch) < epsilon) {
+    m_current = m_goal;
+    m_isMoving = false;
+  }
+  m_camera = getOrbitCamera(m_current);
+  return true;
+}
@@ -1,9 +1,13 @@
 #pragma once
 
+#include "input_queue.hpp"
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-struct GLFWwindow;
+#include <array>
+#include <cstddef>
+#include <vector>
 
 // Camera defined by an eye position, a center position and an up vector
 class Camera
@@ -143,12 +147,67 @@ private:
   glm::vec3 m_up;
 };
 
+// Camera looking at the center of the box [bboxMin, bboxMax] along front,
+// far enough for the bounding sphere of the box to fit in the field of view
+// of the perspective projMatrix
+Camera getFramingCamera(const glm::vec3 &bboxMin, const glm::vec3 &bboxMax,
+    const glm::mat4 &projMatrix, const glm::vec3 &front,
+    const glm::vec3 &up = glm::vec3(0, 1, 0));
+
+// Near and far planes of a perspective projection for camera enclosing the
+// box [bboxMin, bboxMax] as tightly as possible. zNear is at least zFar *
+// minNearRatio, to bound the loss of depth precision when the eye is inside
+// the box. Return false, leaving the planes unchanged, if the box is behind
+// the camera.
+bool getNearFarPlanes(const Camera &camera, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax, float &zNear, float &zFar,
+    float minNearRatio = 1e-4f);
+
+// Perspective projection with an infinite far plane and reversed depth: 1 at
+// the near plane, decreasing to 0 at infinity. It requires a [0, 1] clip
+// space depth (see GLExtensions::setClipControl) and a GL_GREATER depth
+// test. With a floating point depth buffer, the precision is about the same
+// at every distance.
+glm::mat4 getReversedZPerspective(float fovY, float aspectRatio, float zNear);
+
+// Eyes of a viewer standing at the eye of a camera, separated by the
+// interpupillary distance along its left axis and looking parallel to its
+// front. Their off-axis projections (see projMatrix()) coincide at the
+// convergence distance: points at that depth have no parallax, nearer ones
+// appear in front of the screen.
+struct StereoRig
+{
+  Camera eyes[2]; // Left and right
+  float eyeOffsets[2]; // View space x of each eye relative to the camera
+  float convergence;
+
+  // projMatrix of the camera sheared for eye (0 left, 1 right). Clip
+  // coordinates are divided by -z, so the shear works for any perspective,
+  // including getReversedZPerspective.
+  glm::mat4 projMatrix(size_t eye, const glm::mat4 &projMatrix) const
+  {
+    auto eyeProjMatrix = projMatrix;
+    eyeProjMatrix[2][0] -= projMatrix[0][0] * eyeOffsets[eye] / convergence;
+    return eyeProjMatrix;
+  }
+};
+
+// Stereo rig at camera, converging at the distance of the camera center if
+// convergence is not positive
+StereoRig getStereoRig(const Camera &camera, float ipd, float convergence);
+
+// Moves the camera with W, A, S, D, the up and down arrows, rolls it with Q
+// and E, and rotates it by dragging the mouse with the left button. The
+// camera moves by speed units per second that keys are held, whatever the
+// frame rate.
 class FirstPersonCameraController
 {
 public:
-  FirstPersonCameraController(GLFWwindow *window, float speed = 1.f,
+  // Radians per second of roll
+  static constexpr float ROLL_SPEED = 1.f;
+
+  FirstPersonCameraController(float speed = 1.f,
       const glm::vec3 &worldUpAxis = glm::vec3(0, 1, 0)) :
-      m_pWindow(window),
       m_fSpeed(speed),
       m_worldUpAxis(worldUpAxis),
       m_camera{glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)}
@@ -173,9 +232,12 @@ public:
     m_worldUpAxis = worldUpAxis;
   }
 
-  // Update the view matrix based on input events and elapsed time
+  // Apply the events of an InputQueue received since the last update, time
+  // being glfwGetTime() when they were taken. With ignoreInput (when the GUI
+  // has the focus), events only track the held keys and buttons.
   // Return true if the view matrix has been modified
-  bool update(float elapsedTime);
+  bool update(const std::vector<InputEvent> &events, double time,
+      bool ignoreInput = false);
 
   // Get the view matrix
   const Camera &getCamera() const { return m_camera; }
@@ -183,40 +245,62 @@ public:
   void setCamera(const Camera &camera) { m_camera = camera; }
 
 private:
-  GLFWwindow *m_pWindow = nullptr;
+  // Motions of the camera held by a key
+  enum Motion
+  {
+    DOLLY_IN,
+    DOLLY_OUT,
+    TRUCK_LEFT,
+    TRUCK_RIGHT,
+    PEDESTAL_UP,
+    PEDESTAL_DOWN,
+    ROLL_LEFT,
+    ROLL_RIGHT,
+    MOTION_COUNT
+  };
+
   float m_fSpeed = 0.f;
   glm::vec3 m_worldUpAxis;
 
   // Input event state
   bool m_LeftButtonPressed = false;
   glm::dvec2 m_LastCursorPosition;
+  // Time each motion key was pressed, negative if it is released
+  std::array<double, MOTION_COUNT> m_keyPressTimes = {
+      -1., -1., -1., -1., -1., -1., -1., -1.};
+  double m_lastUpdateTime = -1.;
 
   // Current camera
   Camera m_camera;
 };
 
-// todo Blender like camera
+// Orbits around a pivot point, for models inspected from the outside.
+// Dragging with the left button orbits around the world up axis and the left
+// axis of the camera, with the middle button (or shift and the left button)
+// pans, and the mouse wheel zooms toward the pivot. Input sets a goal that
+// the camera reaches exponentially with the time constant DAMPING_TIME,
+// whatever the frame rate, and snaps to once close enough so that update()
+// reports no motion anymore.
 class TrackballCameraController
 {
 public:
-  TrackballCameraController(GLFWwindow *window, float speed = 1.f,
+  // Seconds for the camera to cover 63% of the way to its goal
+  static constexpr float DAMPING_TIME = 0.08f;
+  // Radians of orbit per pixel of cursor motion
+  static constexpr float ORBIT_SPEED = 0.005f;
+  // Pan per pixel of cursor motion, relative to the distance to the pivot
+  static constexpr float PAN_SPEED = 0.0015f;
+  // Scale of the distance to the pivot per step of the mouse wheel
+  static constexpr float ZOOM_FACTOR = 0.85f;
+  // Radians of pitch, 0.01 short of the up axis: the view direction is never
+  // parallel to it, which would make the lookAt degenerate
+  static constexpr float MAX_PITCH = 1.5607963f;
+
+  TrackballCameraController(
       const glm::vec3 &worldUpAxis = glm::vec3(0, 1, 0)) :
-      m_pWindow(window),
-      m_fSpeed(speed),
-      m_worldUpAxis(worldUpAxis),
-      m_camera{glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)}
-  {
-  }
-
-  // Controller attributes, if put in a GUI, should be adapted
-  void setSpeed(float speed) { m_fSpeed = speed; }
-
-  float getSpeed() const { return m_fSpeed; }
-
-  void increaseSpeed(float delta)
+      m_worldUpAxis(worldUpAxis)
   {
-    m_fSpeed += delta;
-    m_fSpeed = glm::max(m_fSpeed, 0.f);
+    setCamera(Camera{glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)});
   }
 
   const glm::vec3 &getWorldUpAxis() const { return m_worldUpAxis; }
@@ -224,25 +308,62 @@ public:
   void setWorldUpAxis(const glm::vec3 &worldUpAxis)
   {
     m_worldUpAxis = worldUpAxis;
+    setCamera(m_camera);
   }
 
-  // Update the view matrix based on input events and elapsed time
+  // Update the view matrix based on input events, as
+  // FirstPersonCameraController::update, and move it toward its goal
   // Return true if the view matrix has been modified
-  bool update(float elapsedTime);
+  bool update(const std::vector<InputEvent> &events, double time,
+      bool ignoreInput = false);
 
   // Get the view matrix
   const Camera &getCamera() const { return m_camera; }
 
-  void setCamera(const Camera &camera) { m_camera = camera; }
+  // Move the camera at once, orbiting around its center. Its roll is lost.
+  void setCamera(const Camera &camera);
+
+  // Turn toward point and orbit around it from now on
+  void setPivot(const glm::vec3 &point);
+
+  // Orbit around the center of the box [bboxMin, bboxMax] from the
+  // distance of getFramingCamera, keeping the direction of the camera
+  void frame(const glm::vec3 &bboxMin, const glm::vec3 &bboxMax,
+      const glm::mat4 &projMatrix);
+
+  // True until the camera reaches its goal
+  bool isMoving() const { return m_isMoving; }
 
 private:
-  GLFWwindow *m_pWindow = nullptr;
-  float m_fSpeed = 0.f;
+  // Camera looking at pivot from distance, yaw turning around the world up
+  // axis and pitch tilting toward it
+  struct Orbit
+  {
+    glm::vec3 pivot = glm::vec3(0);
+    float distance = 1.f;
+    float yaw = 0.f;
+    float pitch = 0.f;
+  };
+
+  // Axes of zero yaw and of positive yaw, orthogonal to the world up axis
+  void getYawAxes(glm::vec3 &front, glm::vec3 &left) const;
+
+  Orbit getOrbit(const glm::vec3 &eye, const glm::vec3 &pivot) const;
+
+  Camera getOrbitCamera(const Orbit &orbit) const;
+
   glm::vec3 m_worldUpAxis;
 
   // Input event state
+  bool m_LeftButtonPressed = false;
   bool m_MiddleButtonPressed = false;
+  bool m_isShiftPressed = false;
   glm::dvec2 m_LastCursorPosition;
+  double m_lastUpdateTime = -1.;
+
+  Orbit m_goal;
+  Orbit m_current;
+  bool m_isMoving = false;
 
   // Current camera
   Camera m_camera;
@@ -0,0 +1,81 @@
+#include "compact_model.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+
+const char *VERTEX_ATTRIBUTE_NAMES[] = {"POSITION", "NORMAL", "TANGENT",
+    "TEXCOORD_0", "TEXCOORD_1", "COLOR_0", "JOINTS_0", "WEIGHTS_0"};
+
+static_assert(sizeof(VERTEX_ATTRIBUTE_NAMES) / sizeof(const char *) ==
+                  VERTEX_ATTRIBUTE_COUNT,
+    "One name per vertex attribute");
+
+AlphaMode parseAlphaMode(const std::string &alphaMode)
+{
+  if (alphaMode == "BLEND") {
+    return AlphaMode::Blend;
+  }
+  return alphaMode == "MASK" ? AlphaMode::Mask : AlphaMode::Opaque;
+}
+
+} // namespace
+
+const char *getVertexAttributeName(VertexAttribute attribute)
+{
+  return VERTEX_ATTRIBUTE_NAMES[size_t(attribute)];
+}
+
+CompactModel::CompactModel(const tinygltf::Model &model) :
+    // Primitives take 44 bytes, most models fit in a few blocks
+    m_arena(size_t(256) << 10)
+{
+  m_nMeshCount = model.meshes.size();
+  for (const auto &mesh : model.meshes) {
+    m_nPrimitiveCount += mesh.primitives.size();
+  }
+  m_nMaterialCount = model.materials.size();
+  m_pMeshes = m_arena.allocateArray<CompactMesh>(m_nMeshCount);
+  m_pPrimitives = m_arena.allocateArray<CompactPrimitive>(m_nPrimitiveCount);
+  m_pMaterials = m_arena.allocateArray<CompactMaterial>(m_nMaterialCount);
+
+  uint32_t primitiveIdx = 0;
+  for (size_t meshIdx = 0; meshIdx < m_nMeshCount; ++meshIdx) {
+    const auto &mesh = model.meshes[meshIdx];
+    m_pMeshes[meshIdx] = {primitiveIdx, uint32_t(mesh.primitives.size()),
+        m_strings.intern(mesh.name)};
+    for (const auto &primitive : mesh.primitives) {
+      auto &compact = m_pPrimitives[primitiveIdx++];
+      std::fill(std::begin(compact.attributes), std::end(compact.attributes),
+          -1);
+      // Attributes are few, sorted by name in the map
+      for (const auto &attribute : primitive.attributes) {
+        for (size_t i = 0; i < VERTEX_ATTRIBUTE_COUNT; ++i) {
+          if (attribute.first == VERTEX_ATTRIBUTE_NAMES[i]) {
+            compact.attributes[i] = attribute.second;
+            break;
+          }
+        }
+      }
+      compact.indices = primitive.indices;
+      compact.material = primitive.material;
+      compact.mode = primitive.mode < 0 ? TINYGLTF_MODE_TRIANGLES
+                                        : primitive.mode;
+    }
+  }
+
+  for (size_t materialIdx = 0; materialIdx < m_nMaterialCount;
+       ++materialIdx) {
+    const auto &material = model.materials[materialIdx];
+    const auto &pbr = material.pbrMetallicRoughness;
+    m_pMaterials[materialIdx] = {parseAlphaMode(material.alphaMode),
+        material.doubleSided,
+        material.extensions.count("KHR_materials_unlit") != 0,
+        float(material.alphaCutoff),
+        pbr.baseColorTexture.index, pbr.metallicRoughnessTexture.index,
+        material.normalTexture.index, material.occlusionTexture.index,
+        material.emissiveTexture.index, m_strings.intern(material.name)};
+  }
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "monotonic_arena.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Meshes and materials of a tinygltf::Model as the renderer reads them every
+// frame, built once after import. tinygltf stores each primitive and
+// material in many small std::map, std::string and std::vector allocations
+// looked up by name (primitive.attributes.find("POSITION"), alphaMode ==
+// "BLEND"...). Here they are flat arrays in a MonotonicArena, destroyed all
+// at once: attributes are indexed by VertexAttribute, alpha modes are enums
+// and names are interned.
+
+enum class VertexAttribute : uint8_t
+{
+  Position,
+  Normal,
+  Tangent,
+  Texcoord0,
+  Texcoord1,
+  Color0,
+  Joints0,
+  Weights0,
+  Count
+};
+
+const size_t VERTEX_ATTRIBUTE_COUNT = size_t(VertexAttribute::Count);
+
+// glTF semantic of attribute, e.g. "TEXCOORD_0"
+const char *getVertexAttributeName(VertexAttribute attribute);
+
+enum class AlphaMode : uint8_t
+{
+  Opaque,
+  Mask,
+  Blend
+};
+
+struct CompactPrimitive
+{
+  // Accessor of each attribute, -1 if the primitive has none. Other
+  // attributes (TEXCOORD_2...) are not read by the renderer.
+  int32_t attributes[VERTEX_ATTRIBUTE_COUNT];
+  int32_t indices; // Accessor, -1 if not indexed
+  int32_t material; // -1 for the default material
+  int32_t mode; // TINYGLTF_MODE_*
+
+  int32_t attribute(VertexAttribute attribute) const
+  {
+    return attributes[size_t(attribute)];
+  }
+};
+
+struct CompactMesh
+{
+  uint32_t firstPrimitive;
+  uint32_t primitiveCount;
+  uint32_t name; // In CompactModel::string()
+};
+
+struct CompactMaterial
+{
+  AlphaMode alphaMode;
+  bool doubleSided;
+  bool unlit; // KHR_materials_unlit
+  float alphaCutoff;
+  // Textures of the material, -1 if it has none
+  int32_t baseColorTexture;
+  int32_t metallicRoughnessTexture;
+  int32_t normalTexture;
+  int32_t occlusionTexture;
+  int32_t emissiveTexture;
+  uint32_t name; // In CompactModel::string()
+};
+
+class CompactModel
+{
+public:
+  CompactModel() = default;
+
+  explicit CompactModel(const tinygltf::Model &model);
+
+  // Non-copyable class:
+  CompactModel(const CompactModel &) = delete;
+  CompactModel &operator=(const CompactModel &) = delete;
+
+  CompactModel(CompactModel &&rvalue) { *this = std::move(rvalue); }
+
+  CompactModel &operator=(CompactModel &&rvalue)
+  {
+    std::swap(m_arena, rvalue.m_arena);
+    std::swap(m_strings, rvalue.m_strings);
+    std::swap(m_pMeshes, rvalue.m_pMeshes);
+    std::swap(m_nMeshCount, rvalue.m_nMeshCount);
+    std::swap(m_pPrimitives, rvalue.m_pPrimitives);
+    std::swap(m_nPrimitiveCount, rvalue.m_nPrimitiveCount);
+    std::swap(m_pMaterials, rvalue.m_pMaterials);
+    std::swap(m_nMaterialCount, rvalue.m_nMaterialCount);
+    return *this;
+  }
+
+  size_t meshCount() const { return m_nMeshCount; }
+
+  const CompactMesh &mesh(size_t meshIdx) const { return m_pMeshes[meshIdx]; }
+
+  // Primitives of all meshes, in mesh order
+  size_t primitiveCount() const { return m_nPrimitiveCount; }
+
+  const CompactPrimitive &primitive(size_t meshIdx, size_t pIdx) const
+  {
+    return m_pPrimitives[m_pMeshes[meshIdx].firstPrimitive + pIdx];
+  }
+
+  // Set the material of primitive primitiveIdx, in mesh order (see
+  // MaterialVariants)
+  void setMaterial(size_t primitiveIdx, int32_t materialIdx)
+  {
+    m_pPrimitives[primitiveIdx].material = materialIdx;
+  }
+
+  size_t materialCount() const { return m_nMaterialCount; }
+
+  // Material of index materialIdx, nullptr for the default material (-1)
+  // or an invalid index
+  const CompactMaterial *material(int materialIdx) const
+  {
+    return materialIdx >= 0 && size_t(materialIdx) < m_nMaterialCount
+               ? m_pMaterials + materialIdx
+               : nullptr;
+  }
+
+  // Alpha mode of the material of index materialIdx, opaque for the default
+  // material
+  AlphaMode alphaMode(int materialIdx) const
+  {
+    const auto pMaterial = material(materialIdx);
+    return pMaterial ? pMaterial->alphaMode : AlphaMode::Opaque;
+  }
+
+  // Interned name, e.g. of CompactMesh::name
+  const char *string(uint32_t id) const { return m_strings.get(id); }
+
+  // Bytes of the arrays and strings
+  size_t capacity() const
+  {
+    return m_arena.capacity() + m_strings.capacity();
+  }
+
+private:
+  MonotonicArena m_arena;
+  StringInterner m_strings;
+  CompactMesh *m_pMeshes = nullptr;
+  size_t m_nMeshCount = 0;
+  CompactPrimitive *m_pPrimitives = nullptr;
+  size_t m_nPrimitiveCount = 0;
+  CompactMaterial *m_pMaterials = nullptr;
+  size_t m_nMaterialCount = 0;
+};
@@ -0,0 +1,314 @@
+#include "content_hashes.hpp"
+#include "hash.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace
+{
+
+template <typename T> uint64_t hashValue(const T &value, uint64_t hash)
+{
+  return fnv1a64(&value, sizeof(value), hash);
+}
+
+// Hash count elements of elementSize bytes every stride bytes from
+// byteOffset in buffers[bufferIdx], return false if they are out of bounds
+bool hashBufferRange(const std::vector<BufferSpan> &buffers, int bufferIdx,
+    size_t byteOffset, size_t count, size_t elementSize, size_t stride,
+    uint64_t &hash)
+{
+  if (bufferIdx < 0 || size_t(bufferIdx) >= buffers.size()) {
+    return false;
+  }
+  if (!count) {
+    return true;
+  }
+  const auto &buffer = buffers[bufferIdx];
+  const auto byteEnd = byteOffset + (count - 1) * stride + elementSize;
+  if (!buffer.data || byteEnd > buffer.size) {
+    return false;
+  }
+  if (stride == elementSize) {
+    hash = fnv1a64(buffer.data + byteOffset, count * elementSize, hash);
+    return true;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    hash = fnv1a64(buffer.data + byteOffset + i * stride, elementSize, hash);
+  }
+  return true;
+}
+
+bool hashAccessor(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, int accessorIdx, uint64_t &hash)
+{
+  if (accessorIdx < 0 || size_t(accessorIdx) >= model.accessors.size()) {
+    return false;
+  }
+  const auto &accessor = model.accessors[accessorIdx];
+  hash = hashValue(accessor.componentType, hash);
+  hash = hashValue(accessor.type, hash);
+  hash = hashValue(accessor.count, hash);
+  hash = hashValue(accessor.normalized, hash);
+  const auto componentSize =
+      tinygltf::GetComponentSizeInBytes(uint32_t(accessor.componentType));
+  const auto componentCount =
+      tinygltf::GetNumComponentsInType(uint32_t(accessor.type));
+  if (componentSize <= 0 || componentCount <= 0) {
+    return false;
+  }
+  const auto elementSize = size_t(componentSize * componentCount);
+  if (accessor.bufferView >= 0) {
+    if (size_t(accessor.bufferView) >= model.bufferViews.size()) {
+      return false;
+    }
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto stride =
+        bufferView.byteStride ? bufferView.byteStride : elementSize;
+    if (!hashBufferRange(buffers, bufferView.buffer,
+            bufferView.byteOffset + accessor.byteOffset, accessor.count,
+            elementSize, stride, hash)) {
+      return false;
+    }
+  }
+  if (!accessor.sparse.isSparse) {
+    return true;
+  }
+  const auto &sparse = accessor.sparse;
+  hash = hashValue(sparse.count, hash);
+  for (const auto &part : {std::make_pair(sparse.indices.bufferView,
+                               sparse.indices.byteOffset),
+           std::make_pair(sparse.values.bufferView,
+               sparse.values.byteOffset)}) {
+    if (part.first < 0 || size_t(part.first) >= model.bufferViews.size() ||
+        part.second < 0 ||
+        size_t(part.second) > model.bufferViews[part.first].byteLength) {
+      return false;
+    }
+    const auto &bufferView = model.bufferViews[part.first];
+    const auto byteSize = bufferView.byteLength - size_t(part.second);
+    if (!hashBufferRange(buffers, bufferView.buffer,
+            bufferView.byteOffset + part.second, 1, byteSize, byteSize,
+            hash)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Bytes of the elements of an accessor
+size_t getAccessorByteSize(const tinygltf::Accessor &accessor)
+{
+  const auto componentSize =
+      tinygltf::GetComponentSizeInBytes(uint32_t(accessor.componentType));
+  const auto componentCount =
+      tinygltf::GetNumComponentsInType(uint32_t(accessor.type));
+  return componentSize > 0 && componentCount > 0
+             ? accessor.count * size_t(componentSize * componentCount)
+             : 0;
+}
+
+// True if the primitives of lhs and rhs, whose content hashes are equal, are
+// drawn the same way
+bool haveSameMaterials(const tinygltf::Mesh &lhs, const tinygltf::Mesh &rhs)
+{
+  if (lhs.weights != rhs.weights || lhs.extensions != rhs.extensions ||
+      lhs.primitives.size() != rhs.primitives.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs.primitives.size(); ++i) {
+    // Material variants are primitive extensions
+    if (lhs.primitives[i].material != rhs.primitives[i].material ||
+        lhs.primitives[i].extensions != rhs.primitives[i].extensions) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// First element equal to each element, whose hash is not 0, -1 for the others
+template <typename T, typename Equal>
+std::vector<int> findDuplicates(const std::vector<T> &elements,
+    const std::vector<uint64_t> &hashes, const Equal &isEqual)
+{
+  std::unordered_multimap<uint64_t, int> firstIndices;
+  std::vector<int> duplicates(elements.size(), -1);
+  for (size_t i = 0; i < elements.size() && i < hashes.size(); ++i) {
+    if (!hashes[i]) {
+      continue;
+    }
+    const auto range = firstIndices.equal_range(hashes[i]);
+    const auto match = std::find_if(range.first, range.second,
+        [&](const auto &first) {
+          return isEqual(elements[first.second], elements[i]);
+        });
+    if (match != range.second) {
+      duplicates[i] = match->second;
+    } else {
+      firstIndices.emplace(hashes[i], int(i));
+    }
+  }
+  return duplicates;
+}
+
+} // namespace
+
+uint64_t computeMeshContentHash(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const tinygltf::Mesh &mesh)
+{
+  auto hash = hashValue(mesh.primitives.size(), fnv1a64(nullptr, 0));
+  for (const auto &primitive : mesh.primitives) {
+    hash = hashValue(primitive.mode, hash);
+    hash = hashValue(primitive.targets.size(), hash);
+    for (const auto &attribute : primitive.attributes) {
+      hash = fnv1a64(
+          attribute.first.data(), attribute.first.size() + 1, hash);
+      if (!hashAccessor(model, buffers, attribute.second, hash)) {
+        return 0;
+      }
+    }
+    if (primitive.indices >= 0 &&
+        !hashAccessor(model, buffers, primitive.indices, hash)) {
+      return 0;
+    }
+    for (const auto &target : primitive.targets) {
+      for (const auto &attribute : target) {
+        hash = fnv1a64(
+            attribute.first.data(), attribute.first.size() + 1, hash);
+        if (!hashAccessor(model, buffers, attribute.second, hash)) {
+          return 0;
+        }
+      }
+    }
+  }
+  return hash ? hash : 1;
+}
+
+uint64_t computeImageContentHash(const tinygltf::Image &image)
+{
+  if (image.image.empty()) {
+    return 0;
+  }
+  auto hash = hashValue(image.width, fnv1a64(nullptr, 0));
+  hash = hashValue(image.height, hash);
+  hash = hashValue(image.component, hash);
+  hash = hashValue(image.bits, hash);
+  hash = hashValue(image.pixel_type, hash);
+  hash = fnv1a64(image.mimeType.data(), image.mimeType.size() + 1, hash);
+  hash = fnv1a64(image.image.data(), image.image.size(), hash);
+  return hash ? hash : 1;
+}
+
+ModelContentHashes computeContentHashes(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers)
+{
+  ModelContentHashes hashes;
+  hashes.meshes.resize(model.meshes.size());
+  hashes.images.resize(model.images.size());
+  auto &jobSystem = getJobSystem();
+  jobSystem.parallelFor(model.meshes.size(), 1, [&](size_t begin, size_t end) {
+    for (auto i = begin; i < end; ++i) {
+      hashes.meshes[i] =
+          computeMeshContentHash(model, buffers, model.meshes[i]);
+    }
+  });
+  jobSystem.parallelFor(model.images.size(), 1, [&](size_t begin, size_t end) {
+    for (auto i = begin; i < end; ++i) {
+      hashes.images[i] = computeImageContentHash(model.images[i]);
+    }
+  });
+  return hashes;
+}
+
+std::vector<int> matchContentHashes(const std::vector<uint64_t> &current,
+    const std::vector<uint64_t> &previous)
+{
+  std::unordered_map<uint64_t, int> previousIndices;
+  for (size_t i = 0; i < previous.size(); ++i) {
+    if (previous[i]) {
+      previousIndices.emplace(previous[i], int(i));
+    }
+  }
+  std::vector<int> matches(current.size(), -1);
+  for (size_t i = 0; i < current.size(); ++i) {
+    const auto match = previousIndices.find(current[i]);
+    if (current[i] && match != end(previousIndices)) {
+      matches[i] = match->second;
+    }
+  }
+  return matches;
+}
+
+DeduplicatedContent deduplicateModel(
+    tinygltf::Model &model, const ModelContentHashes &hashes)
+{
+  DeduplicatedContent result;
+
+  const auto meshDuplicates =
+      findDuplicates(model.meshes, hashes.meshes, haveSameMaterials);
+  for (auto &node : model.nodes) {
+    if (node.mesh >= 0 && size_t(node.mesh) < meshDuplicates.size() &&
+        meshDuplicates[node.mesh] >= 0) {
+      node.mesh = meshDuplicates[node.mesh];
+    }
+  }
+  for (size_t meshIdx = 0; meshIdx < meshDuplicates.size(); ++meshIdx) {
+    if (meshDuplicates[meshIdx] < 0) {
+      continue;
+    }
+    ++result.meshCount;
+    for (const auto &primitive : model.meshes[meshIdx].primitives) {
+      for (const auto &attribute : primitive.attributes) {
+        result.byteCount +=
+            getAccessorByteSize(model.accessors[attribute.second]);
+      }
+      if (primitive.indices >= 0) {
+        result.byteCount +=
+            getAccessorByteSize(model.accessors[primitive.indices]);
+      }
+    }
+  }
+  if (result.meshCount) {
+    removeUnusedMeshes(model);
+  }
+
+  // Pixels are compared too, they are at hand
+  const auto imageDuplicates = findDuplicates(model.images, hashes.images,
+      [](const tinygltf::Image &lhs, const tinygltf::Image &rhs) {
+        return lhs.width == rhs.width && lhs.height == rhs.height &&
+               lhs.component == rhs.component && lhs.bits == rhs.bits &&
+               lhs.pixel_type == rhs.pixel_type &&
+               lhs.mimeType == rhs.mimeType && lhs.image == rhs.image;
+      });
+  const auto remapImage = [&](int imageIdx) {
+    return imageIdx >= 0 && size_t(imageIdx) < imageDuplicates.size() &&
+                   imageDuplicates[imageIdx] >= 0
+               ? imageDuplicates[imageIdx]
+               : imageIdx;
+  };
+  for (auto &texture : model.textures) {
+    texture.source = remapImage(texture.source);
+    // KHR_texture_basisu and the like reference their image by "source"
+    for (auto &extension : texture.extensions) {
+      if (!extension.second.IsObject()) {
+        continue;
+      }
+      auto &members = extension.second.Get<tinygltf::Value::Object>();
+      const auto source = members.find("source");
+      if (source != end(members) && source->second.IsNumber()) {
+        source->second = tinygltf::Value(
+            remapImage(int(source->second.GetNumberAsInt())));
+      }
+    }
+  }
+  for (size_t imageIdx = 0; imageIdx < imageDuplicates.size(); ++imageIdx) {
+    if (imageDuplicates[imageIdx] >= 0) {
+      auto &image = model.images[imageIdx];
+      ++result.imageCount;
+      result.byteCount += image.image.size();
+      std::vector<unsigned char>{}.swap(image.image);
+    }
+  }
+  return result;
+}
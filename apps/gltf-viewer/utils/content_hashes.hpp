@@ -0,0 +1,56 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Hashes of the content of the meshes and images of a model, to find what a
+// new version of a glTF file shares with the loaded one and only upload the
+// rest. Meshes are hashed from the bytes of the accessors of their
+// primitives rather than per buffer, so that re-exporting a .glb whose single
+// buffer changed keeps its untouched meshes.
+struct ModelContentHashes
+{
+  // Hash of each mesh, 0 if some of its data is not loaded (it then matches
+  // nothing)
+  std::vector<uint64_t> meshes;
+  // Hash of each image from its decoded pixels or KTX2 container, 0 if they
+  // are not loaded
+  std::vector<uint64_t> images;
+};
+
+// Hash of mesh, as in ModelContentHashes::meshes
+uint64_t computeMeshContentHash(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const tinygltf::Mesh &mesh);
+
+// Hash of image, as in ModelContentHashes::images
+uint64_t computeImageContentHash(const tinygltf::Image &image);
+
+// Hash every mesh and image of model, on the job system
+ModelContentHashes computeContentHashes(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers);
+
+// For each hash of current, index of an equal hash in previous or -1
+std::vector<int> matchContentHashes(const std::vector<uint64_t> &current,
+    const std::vector<uint64_t> &previous);
+
+// Duplicates merged by deduplicateModel
+struct DeduplicatedContent
+{
+  size_t meshCount = 0;
+  size_t imageCount = 0;
+  // Of the accessors of the merged meshes and the pixels of the merged images,
+  // no longer uploaded
+  size_t byteCount = 0;
+};
+
+// Merge the meshes and images of model equal to a previous one, found by
+// hashes (see computeContentHashes). Nodes and textures then reference the
+// first copy: duplicated meshes are removed and draw as instances of it, and
+// the pixels of duplicated images are released, since no texture uploads
+// them. Meshes must also have the same materials and extensions.
+DeduplicatedContent deduplicateModel(
+    tinygltf::Model &model, const ModelContentHashes &hashes);
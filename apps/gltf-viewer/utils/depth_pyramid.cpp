@@ -0,0 +1,135 @@
+#include "depth_pyramid.hpp"
+#include "target_capacity.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+GLuint getDispatchSize(size_t size)
+{
+  const size_t groupSize = 8; // local_size of depth_pyramid.cs.glsl
+  return GLuint((size + groupSize - 1) / groupSize);
+}
+
+// Of a full mipmap chain
+size_t getLevelCount(size_t width, size_t height)
+{
+  size_t levelCount = 1;
+  while ((std::max(width, height) >> levelCount) > 0) {
+    ++levelCount;
+  }
+  return levelCount;
+}
+
+} // namespace
+
+DepthPyramid &DepthPyramid::operator=(DepthPyramid &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_nWidth, rvalue.m_nWidth);
+    std::swap(m_nHeight, rvalue.m_nHeight);
+    std::swap(m_nLevels, rvalue.m_nLevels);
+    std::swap(m_nCapacityWidth, rvalue.m_nCapacityWidth);
+    std::swap(m_nCapacityHeight, rvalue.m_nCapacityHeight);
+    std::swap(m_depthFormat, rvalue.m_depthFormat);
+    m_depthTexture = std::move(rvalue.m_depthTexture);
+    m_depthFramebuffer = std::move(rvalue.m_depthFramebuffer);
+    m_pyramidTexture = std::move(rvalue.m_pyramidTexture);
+  }
+  return *this;
+}
+
+void DepthPyramid::build(
+    const GLProgram &copyProgram, const GLProgram &reduceProgram)
+{
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const auto width = size_t(std::max(viewport[2], 1));
+  const auto height = size_t(std::max(viewport[3], 1));
+  GLint drawFramebuffer = 0, texture = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+  const auto depthFormat =
+      GLFramebuffer::getDrawDepthFormat(GLuint(drawFramebuffer));
+  const auto capacityWidth = getTargetCapacity(width, m_nCapacityWidth);
+  const auto capacityHeight = getTargetCapacity(height, m_nCapacityHeight);
+  if (capacityWidth != m_nCapacityWidth ||
+      capacityHeight != m_nCapacityHeight || depthFormat != m_depthFormat) {
+    allocate(capacityWidth, capacityHeight, depthFormat);
+  }
+  m_nWidth = width;
+  m_nHeight = height;
+  m_nLevels = getLevelCount(width, height);
+
+  // Also resolves multisampled depth buffers
+  const auto x1 = viewport[0] + GLint(width);
+  const auto y1 = viewport[1] + GLint(height);
+  GLFramebuffer::blit(GLuint(drawFramebuffer), m_depthFramebuffer.glId(),
+      viewport[0], viewport[1], x1, y1, 0, 0, GLint(width), GLint(height),
+      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+  copyProgram.use();
+  copyProgram.getUniform<glm::vec2>("uSize").set(
+      glm::vec2(float(width), float(height)));
+  glBindTexture(GL_TEXTURE_2D, m_depthTexture.glId());
+  glBindImageTexture(
+      0, m_pyramidTexture.glId(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  glDispatchCompute(getDispatchSize(width), getDispatchSize(height), 1);
+
+  reduceProgram.use();
+  const auto sourceLevel = reduceProgram.getUniform<GLint>("uSourceLevel");
+  const auto sourceSize = reduceProgram.getUniform<glm::vec2>("uSourceSize");
+  const auto size = reduceProgram.getUniform<glm::vec2>("uSize");
+  glBindTexture(GL_TEXTURE_2D, m_pyramidTexture.glId());
+  for (size_t level = 1; level < m_nLevels; ++level) {
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    const auto levelWidth = std::max(width >> level, size_t(1));
+    const auto levelHeight = std::max(height >> level, size_t(1));
+    sourceLevel.set(GLint(level - 1));
+    sourceSize.set(glm::vec2(float(std::max(width >> (level - 1), size_t(1))),
+        float(std::max(height >> (level - 1), size_t(1)))));
+    size.set(glm::vec2(float(levelWidth), float(levelHeight)));
+    glBindImageTexture(0, m_pyramidTexture.glId(), GLint(level), GL_FALSE, 0,
+        GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute(
+        getDispatchSize(levelWidth), getDispatchSize(levelHeight), 1);
+  }
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void DepthPyramid::allocate(size_t width, size_t height, GLenum depthFormat)
+{
+  release();
+  m_nCapacityWidth = width;
+  m_nCapacityHeight = height;
+  m_depthFormat = depthFormat;
+
+  m_depthTexture = GLTexture(1, depthFormat, GLsizei(width), GLsizei(height));
+  m_pyramidTexture = GLTexture(GLsizei(getLevelCount(width, height)), GL_R32F,
+      GLsizei(width), GLsizei(height));
+  // Only read with texelFetch
+  m_pyramidTexture.setParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  m_pyramidTexture.setParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  const auto attachment =
+      depthFormat == GL_DEPTH24_STENCIL8 || depthFormat == GL_DEPTH32F_STENCIL8
+          ? GL_DEPTH_STENCIL_ATTACHMENT
+          : GL_DEPTH_ATTACHMENT;
+  m_depthFramebuffer = GLFramebuffer::create();
+  m_depthFramebuffer.attachTexture(attachment, m_depthTexture.glId());
+  m_depthFramebuffer.setDrawBuffer(GL_NONE);
+}
+
+void DepthPyramid::release()
+{
+  m_depthFramebuffer = GLFramebuffer();
+  m_depthTexture = GLTexture();
+  m_pyramidTexture = GLTexture();
+  m_nWidth = m_nHeight = m_nLevels = 0;
+  m_nCapacityWidth = m_nCapacityHeight = 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <utility>
+
+// Hierarchical depth buffer (Hi-Z) used for occlusion culling: an R32F
+// texture whose level 0 is a copy of a depth buffer and each texel of level
+// n + 1 is the farthest depth of the texels of level n it covers. A box whose
+// nearest depth is farther than the texels covering its screen rectangle, at
+// the level where the rectangle spans 2x2 texels, is hidden.
+class DepthPyramid
+{
+public:
+  DepthPyramid() = default;
+
+  ~DepthPyramid() { release(); }
+
+  // Non-copyable class:
+  DepthPyramid(const DepthPyramid &) = delete;
+  DepthPyramid &operator=(const DepthPyramid &) = delete;
+
+  DepthPyramid(DepthPyramid &&rvalue) { *this = std::move(rvalue); }
+
+  DepthPyramid &operator=(DepthPyramid &&rvalue);
+
+  // Copy the depth buffer of the bound draw framebuffer, in the current
+  // viewport, and build the levels of the pyramid. copyProgram and
+  // reduceProgram are depth_pyramid.cs.glsl compiled with and without
+  // COPY_DEPTH. GL bindings are restored, except the program.
+  void build(const GLProgram &copyProgram, const GLProgram &reduceProgram);
+
+  // R32F texture whose lower left width() x height() texels, divided by 2
+  // at each of levelCount() levels, are valid after build(). The texture is
+  // reallocated when the viewport outgrows it, in the growth buckets of
+  // getTargetCapacity, so it may be larger.
+  GLuint texture() const { return m_pyramidTexture.glId(); }
+
+  // Of the viewport of the last build()
+  size_t width() const { return m_nWidth; }
+
+  size_t height() const { return m_nHeight; }
+
+  size_t levelCount() const { return m_nLevels; }
+
+private:
+  // Create width x height textures for a depth buffer of format depthFormat
+  void allocate(size_t width, size_t height, GLenum depthFormat);
+
+  void release();
+
+  size_t m_nWidth = 0;
+  size_t m_nHeight = 0;
+  size_t m_nLevels = 0;
+  // Of the textures
+  size_t m_nCapacityWidth = 0;
+  size_t m_nCapacityHeight = 0;
+  GLenum m_depthFormat = 0;
+
+  GLTexture m_depthTexture; // Same format as the copied depth buffer
+  GLFramebuffer m_depthFramebuffer; // Blit destination
+  GLTexture m_pyramidTexture;
+};
@@ -0,0 +1,54 @@
+#include "dynamic_resolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// Part of the way to the scale hitting the target covered by each update
+const float SCALE_SMOOTHING = 0.2f;
+
+} // namespace
+
+DynamicResolution::DynamicResolution(size_t width, size_t height,
+    GLenum depthFormat, float targetMilliseconds) :
+    m_nWidth(width),
+    m_nHeight(height),
+    m_targetMilliseconds(std::max(targetMilliseconds, 0.1f)),
+    m_target(width, height, depthFormat)
+{
+}
+
+glm::ivec2 DynamicResolution::viewportSize() const
+{
+  const auto getSize = [&](size_t size) {
+    const auto scaled = size_t(m_scale * float(size));
+    return int(std::min(size,
+        std::max(scaled / SIZE_GRANULARITY * SIZE_GRANULARITY,
+            SIZE_GRANULARITY)));
+  };
+  return {getSize(m_nWidth), getSize(m_nHeight)};
+}
+
+void DynamicResolution::setTargetTime(float milliseconds)
+{
+  m_targetMilliseconds = std::max(milliseconds, 0.1f);
+}
+
+void DynamicResolution::update(float gpuMilliseconds)
+{
+  if (gpuMilliseconds <= 0.f) {
+    return;
+  }
+  const auto targetScale =
+      m_scale * std::sqrt(m_targetMilliseconds / gpuMilliseconds);
+  m_scale = glm::clamp(m_scale + SCALE_SMOOTHING * (targetScale - m_scale),
+      MIN_SCALE, MAX_SCALE);
+}
+
+void DynamicResolution::upscale(GLuint drawFramebuffer) const
+{
+  const auto size = viewportSize();
+  m_target.upscaleColor(size_t(size.x), size_t(size.y), drawFramebuffer);
+}
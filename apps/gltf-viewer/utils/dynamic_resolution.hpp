@@ -0,0 +1,58 @@
+#pragma once
+
+#include "images.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Dynamic resolution scaling of the window: the scene is drawn in the lower
+// left part of an offscreen RenderTarget of the window size, whose size is
+// adjusted every frame so that the GPU time of the scene approaches a
+// target, then upscaled to the window. Changing the resolution allocates
+// nothing.
+//
+// The GPU time is assumed proportional to the number of pixels, so the
+// scale of each side follows the square root of the ratio of the target to
+// the measured time. Measures come from Profiler queries a few frames old,
+// so the scale only moves part of the way each frame.
+class DynamicResolution
+{
+public:
+  // Of each side of the viewport
+  static constexpr float MIN_SCALE = 0.5f;
+  static constexpr float MAX_SCALE = 1.f;
+  // The viewport size is a multiple of this, so that small variations of
+  // the GPU time do not resize it
+  static constexpr size_t SIZE_GRANULARITY = 8;
+
+  // For a width x height window, drawn with a depth buffer of depthFormat
+  DynamicResolution(size_t width, size_t height, GLenum depthFormat,
+      float targetMilliseconds);
+
+  GLuint framebuffer() const { return m_target.framebuffer(); }
+
+  // Size of the viewport the scene must be drawn in
+  glm::ivec2 viewportSize() const;
+
+  float scale() const { return m_scale; }
+
+  float targetTime() const { return m_targetMilliseconds; }
+
+  void setTargetTime(float milliseconds);
+
+  // Adjust the scale from the GPU time of a recent frame, ignored if
+  // negative (not measured yet)
+  void update(float gpuMilliseconds);
+
+  // Upscale the viewport to drawFramebuffer, of the window size
+  void upscale(GLuint drawFramebuffer = 0) const;
+
+private:
+  size_t m_nWidth;
+  size_t m_nHeight;
+  float m_targetMilliseconds;
+  float m_scale = MAX_SCALE;
+  RenderTarget m_target;
+};
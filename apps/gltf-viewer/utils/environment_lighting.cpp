@@ -0,0 +1,361 @@
+#include "environment_lighting.hpp"
+#include "gl_objects.hpp"
+#include "hash.hpp"
+#include "ktx2.hpp"
+#include "mapped_file.hpp"
+#include "sync_watchdog.hpp"
+#include "tracing.hpp"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+
+// Samples per texel of each map, importance sampled (see
+// ibl_prefilter.cs.glsl). The first specular level is a plain copy.
+const GLuint IRRADIANCE_SAMPLES = 256;
+const GLuint SPECULAR_SAMPLES = 64;
+const GLuint BRDF_LUT_SAMPLES = 256;
+
+// Increment when ibl_prefilter.cs.glsl changes its results
+const uint32_t ENVIRONMENT_CACHE_VERSION = 1;
+
+// Key/value entry of the cache files holding their key
+const char *CACHE_KEY = "GltfViewerEnvironmentKey";
+
+// local_size of ibl_prefilter.cs.glsl
+const GLsizei PREFILTER_GROUP_SIZE = 8;
+
+GLuint getDispatchSize(GLsizei size)
+{
+  return GLuint((size + PREFILTER_GROUP_SIZE - 1) / PREFILTER_GROUP_SIZE);
+}
+
+// Hash of the environment map and of the parameters of the maps, as a string
+bool computeCacheKey(const fs::path &path, std::string &key)
+{
+  MappedFile file;
+  try {
+    file = MappedFile(path);
+  } catch (const std::exception &) {
+    return false;
+  }
+  const uint32_t parameters[] = {ENVIRONMENT_CACHE_VERSION,
+      EnvironmentLighting::IRRADIANCE_SIZE, EnvironmentLighting::SPECULAR_SIZE,
+      EnvironmentLighting::SPECULAR_LEVEL_COUNT,
+      EnvironmentLighting::BRDF_LUT_SIZE, IRRADIANCE_SAMPLES,
+      SPECULAR_SAMPLES, BRDF_LUT_SAMPLES};
+  const auto hash = fnv1a64(
+      file.data(), file.size(), fnv1a64(parameters, sizeof(parameters)));
+  char chars[17];
+  std::snprintf(chars, sizeof(chars), "%016llx", (unsigned long long)hash);
+  key = chars;
+  return true;
+}
+
+// A map and its cache file
+struct CachedMap
+{
+  const char *suffix;
+  uint32_t vkFormat;
+  GLsizei size;
+  GLsizei levelCount;
+  uint32_t faceCount;
+};
+
+const CachedMap CACHED_MAPS[] = {
+    {".irradiance.ktx2", VK_FORMAT_R16G16B16A16_SFLOAT,
+        EnvironmentLighting::IRRADIANCE_SIZE, 1, 6},
+    {".specular.ktx2", VK_FORMAT_R16G16B16A16_SFLOAT,
+        EnvironmentLighting::SPECULAR_SIZE,
+        EnvironmentLighting::SPECULAR_LEVEL_COUNT, 6},
+    {".brdf.ktx2", VK_FORMAT_R16G16_SFLOAT,
+        EnvironmentLighting::BRDF_LUT_SIZE, 1, 1}};
+
+fs::path getCachePath(const fs::path &sourcePath,
+    const fs::path &cacheDirectory, const CachedMap &map)
+{
+  const auto filename = sourcePath.filename().string() + map.suffix;
+  return cacheDirectory.empty() ? sourcePath.parent_path() / filename
+                                : cacheDirectory / filename;
+}
+
+// Pixel format of the half float levels of map, and bytes per texel
+void getPixelFormat(const CachedMap &map, GLenum &format, size_t &texelSize)
+{
+  const auto isRG = map.vkFormat == VK_FORMAT_R16G16_SFLOAT;
+  format = isRG ? GL_RG : GL_RGBA;
+  texelSize = isRG ? 4 : 8;
+}
+
+} // namespace
+
+EnvironmentLighting &EnvironmentLighting::operator=(
+    EnvironmentLighting &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_irradiance, rvalue.m_irradiance);
+    std::swap(m_specular, rvalue.m_specular);
+    std::swap(m_brdfLut, rvalue.m_brdfLut);
+    std::swap(m_memory, rvalue.m_memory);
+  }
+  return *this;
+}
+
+bool EnvironmentLighting::readCache(
+    const fs::path &path, const fs::path &cacheDirectory)
+{
+  TRACE_ZONE("Read environment cache");
+  std::string key;
+  if (!computeCacheKey(path, key)) {
+    return false;
+  }
+
+  // Every file is checked before any texture is created
+  const auto mapCount = sizeof(CACHED_MAPS) / sizeof(CACHED_MAPS[0]);
+  MappedFile files[mapCount];
+  Ktx2Image images[mapCount];
+  for (size_t i = 0; i < mapCount; ++i) {
+    const auto &map = CACHED_MAPS[i];
+    const auto cachePath = getCachePath(path, cacheDirectory, map);
+    std::error_code errorCode;
+    if (!fs::exists(cachePath, errorCode)) {
+      return false;
+    }
+    try {
+      files[i] = MappedFile(cachePath);
+    } catch (const std::exception &) {
+      return false;
+    }
+    auto &image = images[i];
+    std::string err;
+    if (!parseKtx2(files[i].data(), files[i].size(), image, err, true) ||
+        image.vkFormat != map.vkFormat || image.width != GLuint(map.size) ||
+        image.faceCount != map.faceCount ||
+        image.levels.size() != size_t(map.levelCount) ||
+        image.supercompression != Ktx2Image::Supercompression::None) {
+      return false;
+    }
+    const auto keyValue = std::find(begin(image.keyValues),
+        end(image.keyValues), std::make_pair(std::string(CACHE_KEY), key));
+    if (keyValue == end(image.keyValues)) {
+      return false;
+    }
+  }
+
+  allocate();
+  const GLuint textures[] = {m_irradiance, m_specular, m_brdfLut};
+  for (size_t i = 0; i < mapCount; ++i) {
+    const auto &map = CACHED_MAPS[i];
+    GLenum format;
+    size_t texelSize;
+    getPixelFormat(map, format, texelSize);
+    const auto isCubeMap = map.faceCount == 6;
+    const auto target = isCubeMap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    glBindTexture(target, textures[i]);
+    for (size_t level = 0; level < images[i].levels.size(); ++level) {
+      const auto size = std::max(map.size >> level, 1);
+      const auto faceSize = size_t(size) * size * texelSize;
+      for (uint32_t face = 0; face < map.faceCount; ++face) {
+        glTexSubImage2D(
+            isCubeMap ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target,
+            GLint(level), 0, 0, size, size, format, GL_HALF_FLOAT,
+            images[i].levels[level].data + face * faceSize);
+      }
+    }
+    glBindTexture(target, 0);
+  }
+  return true;
+}
+
+bool EnvironmentLighting::compute(
+    const fs::path &path, const Programs &programs, std::string &err)
+{
+  TRACE_ZONE("Compute environment lighting");
+  int width = 0, height = 0, channels = 0;
+  auto *pixels =
+      stbi_loadf(path.string().c_str(), &width, &height, &channels, 3);
+  if (!pixels) {
+    err = "Cannot read environment map " + path.string() + ": " +
+          stbi_failure_reason();
+    return false;
+  }
+  // Every level is read by filtered importance sampling
+  const auto levelCount =
+      GLsizei(std::floor(std::log2(std::max(width, height)))) + 1;
+  GLTexture environment{levelCount, GL_RGB16F, width, height};
+  glBindTexture(GL_TEXTURE_2D, environment.glId());
+  glTexSubImage2D(
+      GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_FLOAT, pixels);
+  stbi_image_free(pixels);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  environment.setParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  environment.setParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  environment.setParameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
+  environment.setParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  allocate();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, environment.glId());
+
+  programs.irradiance.use();
+  programs.irradiance.getUniform<GLuint>("uSampleCount")
+      .set(IRRADIANCE_SAMPLES);
+  glBindImageTexture(
+      0, m_irradiance, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+  glDispatchCompute(getDispatchSize(IRRADIANCE_SIZE),
+      getDispatchSize(IRRADIANCE_SIZE), 6);
+
+  // Level l is filtered for the roughness l / (SPECULAR_LEVEL_COUNT - 1)
+  programs.specular.use();
+  const auto roughness = programs.specular.getUniform<float>("uRoughness");
+  const auto sampleCount =
+      programs.specular.getUniform<GLuint>("uSampleCount");
+  for (GLsizei level = 0; level < SPECULAR_LEVEL_COUNT; ++level) {
+    const auto size = std::max(SPECULAR_SIZE >> level, 1);
+    roughness.set(float(level) / (SPECULAR_LEVEL_COUNT - 1));
+    sampleCount.set(level ? SPECULAR_SAMPLES : 1u);
+    glBindImageTexture(
+        0, m_specular, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glDispatchCompute(getDispatchSize(size), getDispatchSize(size), 6);
+  }
+
+  programs.brdfLut.use();
+  programs.brdfLut.getUniform<GLuint>("uSampleCount").set(BRDF_LUT_SAMPLES);
+  glBindImageTexture(0, m_brdfLut, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+  glDispatchCompute(
+      getDispatchSize(BRDF_LUT_SIZE), getDispatchSize(BRDF_LUT_SIZE), 1);
+
+  glMemoryBarrier(
+      GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return true;
+}
+
+bool EnvironmentLighting::writeCache(const fs::path &path,
+    const fs::path &cacheDirectory, std::string &err) const
+{
+  std::string key;
+  if (empty() || !computeCacheKey(path, key)) {
+    err = "Cannot compute the cache key of environment map " + path.string();
+    return false;
+  }
+  const GLuint textures[] = {m_irradiance, m_specular, m_brdfLut};
+  for (size_t i = 0; i < sizeof(CACHED_MAPS) / sizeof(CACHED_MAPS[0]); ++i) {
+    const auto &map = CACHED_MAPS[i];
+    GLenum format;
+    size_t texelSize;
+    getPixelFormat(map, format, texelSize);
+    const auto isCubeMap = map.faceCount == 6;
+    const auto target = isCubeMap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    glBindTexture(target, textures[i]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    std::vector<std::vector<unsigned char>> levels(map.levelCount);
+    for (GLsizei level = 0; level < map.levelCount; ++level) {
+      const auto size = std::max(map.size >> level, 1);
+      const auto faceSize = size_t(size) * size * texelSize;
+      levels[level].resize(faceSize * map.faceCount);
+      for (uint32_t face = 0; face < map.faceCount; ++face) {
+        SyncScope sync{"EnvironmentLighting::writeCache"};
+        glGetTexImage(
+            isCubeMap ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target, level,
+            format, GL_HALF_FLOAT, levels[level].data() + face * faceSize);
+      }
+    }
+    glBindTexture(target, 0);
+    if (!writeKtx2(getCachePath(path, cacheDirectory, map), map.vkFormat,
+            uint32_t(map.size), uint32_t(map.size), map.faceCount, levels,
+            {{CACHE_KEY, key}}, err)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+EnvironmentLighting::Uniforms EnvironmentLighting::getUniforms(
+    const glm::mat4 &viewMatrix, float intensity) const
+{
+  return {glm::inverse(viewMatrix),
+      glm::vec4(empty() ? 0.f : 1.f, float(SPECULAR_LEVEL_COUNT - 1),
+          intensity, 0.f)};
+}
+
+void EnvironmentLighting::bind() const
+{
+  glActiveTexture(GL_TEXTURE0 + IRRADIANCE_UNIT);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, m_irradiance);
+  glActiveTexture(GL_TEXTURE0 + SPECULAR_UNIT);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, m_specular);
+  glActiveTexture(GL_TEXTURE0 + BRDF_LUT_UNIT);
+  glBindTexture(GL_TEXTURE_2D, m_brdfLut);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void EnvironmentLighting::unbind() const
+{
+  glActiveTexture(GL_TEXTURE0 + IRRADIANCE_UNIT);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  glActiveTexture(GL_TEXTURE0 + SPECULAR_UNIT);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  glActiveTexture(GL_TEXTURE0 + BRDF_LUT_UNIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void EnvironmentLighting::release()
+{
+  const GLuint textures[] = {m_irradiance, m_specular, m_brdfLut};
+  if (m_irradiance) {
+    glDeleteTextures(3, textures);
+  }
+  m_irradiance = m_specular = m_brdfLut = 0;
+  m_memory = TrackedGLMemory();
+}
+
+void EnvironmentLighting::allocate()
+{
+  release();
+  GLuint textures[3];
+  glGenTextures(3, textures);
+  m_irradiance = textures[0];
+  m_specular = textures[1];
+  m_brdfLut = textures[2];
+
+  // Filter across the faces of the cube maps, for the blurry levels
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, m_irradiance);
+  glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA16F, IRRADIANCE_SIZE,
+      IRRADIANCE_SIZE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, m_specular);
+  glTexStorage2D(GL_TEXTURE_CUBE_MAP, SPECULAR_LEVEL_COUNT, GL_RGBA16F,
+      SPECULAR_SIZE, SPECULAR_SIZE);
+  glTexParameteri(
+      GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+  glBindTexture(GL_TEXTURE_2D, m_brdfLut);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG16F, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_memory = TrackedGLMemory(GLMemoryCategory::Textures,
+      getTextureByteSize(
+          GL_RGBA16F, IRRADIANCE_SIZE, IRRADIANCE_SIZE, 1, 6) +
+          getTextureByteSize(GL_RGBA16F, SPECULAR_SIZE, SPECULAR_SIZE,
+              SPECULAR_LEVEL_COUNT, 6) +
+          getTextureByteSize(GL_RG16F, BRDF_LUT_SIZE, BRDF_LUT_SIZE));
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "gl_memory.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// Image-based lighting of an equirectangular HDR environment map (.hdr), read
+// by lights.glsl with the split sum approximation (see shadeEnvironment):
+// - an irradiance cube map of IRRADIANCE_SIZE texels per side,
+// - a specular cube map of SPECULAR_SIZE texels per side, whose
+// SPECULAR_LEVEL_COUNT levels are prefiltered for roughnesses from 0 to 1,
+// - a BRDF lookup table of BRDF_LUT_SIZE x BRDF_LUT_SIZE texels.
+//
+// They are computed by compute shaders (ibl_prefilter.cs.glsl) with a small
+// sample budget per texel, then written to KTX2 cache files holding the hash
+// of the environment map and of the precomputation parameters: later
+// launches with the same map only read them back.
+class EnvironmentLighting
+{
+public:
+  static const GLsizei IRRADIANCE_SIZE = 32;
+  static const GLsizei SPECULAR_SIZE = 128;
+  static const GLsizei SPECULAR_LEVEL_COUNT = 6;
+  static const GLsizei BRDF_LUT_SIZE = 128;
+  static const GLuint UNIFORMS_BINDING = 4; // EnvironmentUniforms block
+  // After CascadedShadowMaps::TEXTURE_UNIT
+  static const GLuint IRRADIANCE_UNIT = 17;
+  static const GLuint SPECULAR_UNIT = 18;
+  static const GLuint BRDF_LUT_UNIT = 19;
+
+  // EnvironmentUniforms block of lights.glsl, std140 layout
+  struct Uniforms
+  {
+    glm::mat4 viewToWorld;
+    // x: 1 if there is an environment, y: last specular level, z: intensity
+    glm::vec4 info;
+  };
+
+  // ibl_prefilter.cs.glsl with IRRADIANCE, SPECULAR and BRDF_LUT
+  struct Programs
+  {
+    GLProgram irradiance;
+    GLProgram specular;
+    GLProgram brdfLut;
+  };
+
+  EnvironmentLighting() = default;
+
+  ~EnvironmentLighting() { release(); }
+
+  // Non-copyable class:
+  EnvironmentLighting(const EnvironmentLighting &) = delete;
+  EnvironmentLighting &operator=(const EnvironmentLighting &) = delete;
+
+  EnvironmentLighting(EnvironmentLighting &&rvalue)
+  {
+    *this = std::move(rvalue);
+  }
+  EnvironmentLighting &operator=(EnvironmentLighting &&rvalue);
+
+  bool empty() const { return !m_irradiance; }
+
+  // Read the maps of the environment map at path from its cache files in
+  // cacheDirectory (next to the map if empty). Return false if they are
+  // missing or were computed from another map or with other parameters.
+  bool readCache(const fs::path &path, const fs::path &cacheDirectory);
+
+  // Compute the maps of the environment map at path with programs. Return
+  // false and fill err if it cannot be read.
+  bool compute(
+      const fs::path &path, const Programs &programs, std::string &err);
+
+  // Write the maps computed from the environment map at path to its cache
+  // files in cacheDirectory (next to the map if empty)
+  bool writeCache(const fs::path &path, const fs::path &cacheDirectory,
+      std::string &err) const;
+
+  // Uniforms of the environment seen with viewMatrix scaled by intensity,
+  // which tell shaders there is none if empty()
+  Uniforms getUniforms(const glm::mat4 &viewMatrix, float intensity) const;
+
+  // Bind the maps to their texture units
+  void bind() const;
+
+  void unbind() const;
+
+private:
+  void release();
+
+  // Allocate the textures of the maps
+  void allocate();
+
+  GLuint m_irradiance = 0;
+  GLuint m_specular = 0;
+  GLuint m_brdfLut = 0;
+  TrackedGLMemory m_memory; // Of the three textures
+};
@@ -0,0 +1,145 @@
+#include "exr.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+
+const uint32_t EXR_MAGIC = 20000630;
+const uint32_t EXR_VERSION = 2; // Single part scanline file
+const int32_t HALF_PIXEL_TYPE = 1;
+
+// EXR files are little-endian
+void appendU32(std::vector<unsigned char> &bytes, uint32_t value)
+{
+  for (auto shift = 0; shift < 32; shift += 8) {
+    bytes.push_back((unsigned char)(value >> shift));
+  }
+}
+
+void appendU64(std::vector<unsigned char> &bytes, uint64_t value)
+{
+  appendU32(bytes, uint32_t(value));
+  appendU32(bytes, uint32_t(value >> 32));
+}
+
+void appendFloat(std::vector<unsigned char> &bytes, float value)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  appendU32(bytes, bits);
+}
+
+void appendString(std::vector<unsigned char> &bytes, const char *str)
+{
+  bytes.insert(end(bytes), str, str + std::strlen(str) + 1);
+}
+
+// Attribute name, type and value size, the value must follow
+void appendAttribute(std::vector<unsigned char> &bytes, const char *name,
+    const char *type, size_t size)
+{
+  appendString(bytes, name);
+  appendString(bytes, type);
+  appendU32(bytes, uint32_t(size));
+}
+
+void appendBox(std::vector<unsigned char> &bytes, const char *name,
+    size_t width, size_t height)
+{
+  appendAttribute(bytes, name, "box2i", 16);
+  appendU32(bytes, 0);
+  appendU32(bytes, 0);
+  appendU32(bytes, uint32_t(width - 1));
+  appendU32(bytes, uint32_t(height - 1));
+}
+
+} // namespace
+
+bool isExrPath(const fs::path &path)
+{
+  auto extension = path.extension().string();
+  std::transform(begin(extension), end(extension), begin(extension),
+      [](char c) { return char(std::tolower((unsigned char)c)); });
+  return extension == ".exr";
+}
+
+std::vector<unsigned char> encodeExr(size_t width, size_t height,
+    size_t numComponents, const uint16_t *pixels, bool flipY)
+{
+  // Channels are stored in alphabetical order, with their component in the
+  // interleaved pixels
+  const char *channelNames[] = {"A", "B", "G", "R"};
+  const size_t rgbaComponents[] = {3, 2, 1, 0};
+  const size_t firstChannel = numComponents == 4 ? 0 : 1;
+
+  std::vector<unsigned char> bytes;
+  appendU32(bytes, EXR_MAGIC);
+  appendU32(bytes, EXR_VERSION);
+
+  const auto channelCount = 4 - firstChannel;
+  appendAttribute(bytes, "channels", "chlist", channelCount * 18 + 1);
+  for (auto c = firstChannel; c < 4; ++c) {
+    appendString(bytes, channelNames[c]);
+    appendU32(bytes, HALF_PIXEL_TYPE);
+    appendU32(bytes, 0); // pLinear and reserved bytes
+    appendU32(bytes, 1); // Sampling
+    appendU32(bytes, 1);
+  }
+  bytes.push_back(0);
+  appendAttribute(bytes, "compression", "compression", 1);
+  bytes.push_back(0); // NO_COMPRESSION
+  appendBox(bytes, "dataWindow", width, height);
+  appendBox(bytes, "displayWindow", width, height);
+  appendAttribute(bytes, "lineOrder", "lineOrder", 1);
+  bytes.push_back(0); // INCREASING_Y
+  appendAttribute(bytes, "pixelAspectRatio", "float", 4);
+  appendFloat(bytes, 1.f);
+  appendAttribute(bytes, "screenWindowCenter", "v2f", 8);
+  appendFloat(bytes, 0.f);
+  appendFloat(bytes, 0.f);
+  appendAttribute(bytes, "screenWindowWidth", "float", 4);
+  appendFloat(bytes, 1.f);
+  bytes.push_back(0); // End of the header
+
+  // One scanline per block, each block is its y, its size and its data
+  const auto blockDataSize = width * channelCount * sizeof(uint16_t);
+  const auto blockSize = 8 + blockDataSize;
+  auto offset = uint64_t(bytes.size() + height * sizeof(uint64_t));
+  for (size_t y = 0; y < height; ++y) {
+    appendU64(bytes, offset);
+    offset += blockSize;
+  }
+  bytes.reserve(bytes.size() + height * blockSize);
+  for (size_t y = 0; y < height; ++y) {
+    const auto *row =
+        pixels + (flipY ? height - 1 - y : y) * width * numComponents;
+    appendU32(bytes, uint32_t(y));
+    appendU32(bytes, uint32_t(blockDataSize));
+    for (auto c = firstChannel; c < 4; ++c) {
+      const auto component = rgbaComponents[c];
+      for (size_t x = 0; x < width; ++x) {
+        const auto value = row[x * numComponents + component];
+        bytes.push_back((unsigned char)value);
+        bytes.push_back((unsigned char)(value >> 8));
+      }
+    }
+  }
+  return bytes;
+}
+
+bool writeExr(const fs::path &path, size_t width, size_t height,
+    size_t numComponents, const uint16_t *pixels, bool flipY,
+    std::string &err)
+{
+  const auto exr = encodeExr(width, height, numComponents, pixels, flipY);
+  std::ofstream file(path.string(), std::ios::binary);
+  if (!file || !file.write((const char *)exr.data(), exr.size())) {
+    err = "unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// OpenEXR encoder for half float images, such as the HDR images read back
+// with GL_HALF_FLOAT (see ImageRenderer): uncompressed scanlines of HALF
+// channels, so that the colors of the scene are stored as rendered, without
+// 8-bit quantization.
+//
+// If flipY is true, rows are read from the last one to the first one, which
+// turns the images read with glReadPixels (bottom row first) upside up at no
+// cost.
+
+// True if path has the .exr extension, in any case
+bool isExrPath(const fs::path &path);
+
+// Encode pixels[0 : width * height * numComponents] (3 or 4 interleaved RGB
+// or RGBA components, in linear space)
+std::vector<unsigned char> encodeExr(size_t width, size_t height,
+    size_t numComponents, const uint16_t *pixels, bool flipY = false);
+
+// Encode pixels (see encodeExr) in the file path. Return false and fill err
+// on failure.
+bool writeExr(const fs::path &path, size_t width, size_t height,
+    size_t numComponents, const uint16_t *pixels, bool flipY,
+    std::string &err);
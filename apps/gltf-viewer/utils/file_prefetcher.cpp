@@ -0,0 +1,143 @@
+#include "file_prefetcher.hpp"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FilePrefetcher::FilePrefetcher(
+    std::vector<std::string> paths, size_t maxInFlight)
+{
+  m_files.reserve(paths.size());
+  for (auto &path : paths) {
+    if (m_fileIndices.emplace(path, m_files.size()).second) {
+      m_files.emplace_back();
+      m_files.back().path = std::move(path);
+    }
+  }
+  const auto threadCount = std::min(maxInFlight, m_files.size());
+  m_threads.reserve(threadCount);
+  for (size_t i = 0; i < threadCount; ++i) {
+    m_threads.emplace_back([this]() { read(); });
+  }
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_isStopping = true;
+  }
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+bool FilePrefetcher::take(
+    const std::string &path, std::vector<unsigned char> &bytes)
+{
+  const auto it = m_fileIndices.find(path);
+  if (it == end(m_fileIndices)) {
+    return false;
+  }
+  auto &file = m_files[it->second];
+  std::unique_lock<std::mutex> lock{m_mutex};
+  m_fileDone.wait(lock, [&]() { return file.isDone; });
+  if (!file.isRead) {
+    return false;
+  }
+  file.isRead = false;
+  bytes = std::move(file.bytes);
+  file.bytes = std::vector<unsigned char>();
+  return true;
+}
+
+bool FilePrefetcher::contains(const std::string &path)
+{
+  const auto it = m_fileIndices.find(path);
+  if (it == end(m_fileIndices)) {
+    return false;
+  }
+  const auto &file = m_files[it->second];
+  std::unique_lock<std::mutex> lock{m_mutex};
+  m_fileDone.wait(lock, [&]() { return file.isDone; });
+  return file.isRead;
+}
+
+void FilePrefetcher::read()
+{
+  for (;;) {
+    size_t fileIdx = 0;
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      if (m_isStopping || m_nNextFile == m_files.size()) {
+        return;
+      }
+      fileIdx = m_nNextFile++;
+    }
+    // Only this thread accesses the file until it is done
+    auto &file = m_files[fileIdx];
+    const auto isRead = readFileBytes(file.path, file.bytes);
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      file.isRead = isRead;
+      file.isDone = true;
+    }
+    m_fileDone.notify_all();
+  }
+}
+
+#ifdef _WIN32
+
+bool readFileBytes(const std::string &path, std::vector<unsigned char> &bytes)
+{
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in) {
+    return false;
+  }
+  bytes.resize(size_t(in.tellg()));
+  in.seekg(0);
+  return bool(
+      in.read(reinterpret_cast<char *>(bytes.data()), bytes.size()));
+}
+
+#else
+
+bool readFileBytes(const std::string &path, std::vector<unsigned char> &bytes)
+{
+  const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    return false;
+  }
+#ifdef __linux__
+  // Larger readahead window, the whole file is read once
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  bytes.resize(size_t(status.st_size));
+  size_t offset = 0;
+  while (offset < bytes.size()) {
+    const auto count = ::read(fd, bytes.data() + offset, bytes.size() - offset);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      break;
+    }
+    offset += size_t(count);
+  }
+  close(fd);
+  return offset == bytes.size();
+}
+
+#endif
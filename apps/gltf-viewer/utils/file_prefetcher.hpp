@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Files read in memory before they are asked for, several at a time, so that
+// loading a .gltf referencing many external files from network storage is
+// bound by the bandwidth rather than by the latency of each open and read.
+// Reads start at construction on maxInFlight threads of the prefetcher, in
+// the order of the paths, with a sequential readahead hint on Linux.
+class FilePrefetcher
+{
+public:
+  FilePrefetcher() = default;
+
+  // paths are used as given as keys of take()
+  FilePrefetcher(std::vector<std::string> paths, size_t maxInFlight);
+
+  // Wait for the reads in flight, the others are not started
+  ~FilePrefetcher();
+
+  FilePrefetcher(const FilePrefetcher &) = delete;
+  FilePrefetcher &operator=(const FilePrefetcher &) = delete;
+
+  // Move the content of path in bytes, waiting for its read, and return true.
+  // Each file is taken once. Return false if path was not prefetched or could
+  // not be read, the caller then reads it itself.
+  bool take(const std::string &path, std::vector<unsigned char> &bytes);
+
+  // Wait for the read of path and return true if it was prefetched and read,
+  // and not taken yet
+  bool contains(const std::string &path);
+
+  size_t fileCount() const { return m_files.size(); }
+
+private:
+  struct File
+  {
+    std::string path;
+    std::vector<unsigned char> bytes;
+    bool isDone = false; // Guarded by m_mutex
+    bool isRead = false; // Successfully, valid once isDone
+  };
+
+  void read();
+
+  std::vector<File> m_files;
+  std::unordered_map<std::string, size_t> m_fileIndices;
+  size_t m_nNextFile = 0; // Guarded by m_mutex
+  bool m_isStopping = false; // Guarded by m_mutex
+  std::mutex m_mutex;
+  std::condition_variable m_fileDone;
+  std::vector<std::thread> m_threads;
+};
+
+// Read the whole file at path in bytes, with a sequential readahead hint.
+// Return false on failure.
+bool readFileBytes(const std::string &path, std::vector<unsigned char> &bytes);
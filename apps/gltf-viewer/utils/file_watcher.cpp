@@ -0,0 +1,64 @@
+#include "file_watcher.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+FileWatcher::FileWatcher(fs::path path, double pollInterval) :
+    m_path(std::move(path)), m_pollInterval(pollInterval)
+{
+  m_state = scan();
+}
+
+bool FileWatcher::poll(double time)
+{
+  if (m_path.empty() || time - m_lastPollTime < m_pollInterval) {
+    return false;
+  }
+  m_lastPollTime = time;
+  const auto state = scan();
+  if (state == m_state) {
+    return false;
+  }
+  m_state = state;
+  return true;
+}
+
+uint64_t FileWatcher::scan() const
+{
+  // Files being written may vanish or fail to stat, they are hashed as they
+  // are and the next scan sees their final state
+  std::error_code errorCode;
+  std::vector<std::tuple<std::string, uint64_t, int64_t>> files;
+  const auto addFile = [&](const fs::path &path) {
+    const uint64_t size = fs::file_size(path, errorCode);
+    const int64_t writeTime =
+        fs::last_write_time(path, errorCode).time_since_epoch().count();
+    files.emplace_back(path.string(), size, writeTime);
+  };
+  if (fs::is_regular_file(m_path, errorCode)) {
+    addFile(m_path);
+  } else {
+    for (const auto &entry :
+        fs::recursive_directory_iterator(m_path, errorCode)) {
+      if (fs::is_regular_file(entry.path(), errorCode)) {
+        addFile(entry.path());
+      }
+    }
+  }
+  // Directory iteration order is unspecified
+  std::sort(begin(files), end(files));
+
+  auto hash = fnv1a64(nullptr, 0);
+  for (const auto &file : files) {
+    const auto &path = std::get<0>(file);
+    hash = fnv1a64(path.data(), path.size() + 1, hash);
+    hash = fnv1a64(&std::get<1>(file), sizeof(uint64_t), hash);
+    hash = fnv1a64(&std::get<2>(file), sizeof(int64_t), hash);
+  }
+  return hash;
+}
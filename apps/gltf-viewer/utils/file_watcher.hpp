@@ -0,0 +1,34 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstdint>
+
+// Detects changes of a file, or of the files of a directory tree, by polling
+// their sizes and modification times, to reload them while the viewer runs. A
+// shader directory has a few dozen files, so scanning it a few times per
+// second is cheap and needs no platform API (inotify,
+// ReadDirectoryChangesW...).
+class FileWatcher
+{
+public:
+  FileWatcher() = default;
+
+  // Watch path if it is a regular file, else the regular files under it,
+  // scanned at most once every pollInterval seconds
+  explicit FileWatcher(fs::path path, double pollInterval = 0.5);
+
+  // Return true if a file has been added, removed or modified since the
+  // previous change, time being the current time in seconds. Editors often
+  // write a file in several steps, so a change may be reported twice.
+  bool poll(double time);
+
+private:
+  // Hash of the paths, sizes and modification times of the files
+  uint64_t scan() const;
+
+  fs::path m_path;
+  double m_pollInterval = 0.5;
+  double m_lastPollTime = 0.;
+  uint64_t m_state = 0;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GLTF_VIEWER_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GLTF_VIEWER_SIMD_NEON
+#endif
+
+// Minimal 4 wide float vector of the SIMD kernels (see bounds.hpp,
+// transform_kernels.hpp), one implementation per instruction set: SSE2, NEON
+// or a scalar fallback. Loads and stores do not need aligned pointers.
+namespace simd
+{
+
+#if defined(GLTF_VIEWER_SIMD_SSE2)
+
+struct Float4
+{
+  __m128 v;
+};
+
+inline Float4 set1(float x) { return {_mm_set1_ps(x)}; }
+inline Float4 set(float a, float b, float c, float d)
+{
+  return {_mm_setr_ps(a, b, c, d)};
+}
+inline Float4 load(const float *in) { return {_mm_loadu_ps(in)}; }
+inline Float4 operator+(Float4 a, Float4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline Float4 operator-(Float4 a, Float4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline Float4 operator*(Float4 a, Float4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline Float4 min(Float4 a, Float4 b) { return {_mm_min_ps(a.v, b.v)}; }
+inline Float4 max(Float4 a, Float4 b) { return {_mm_max_ps(a.v, b.v)}; }
+inline Float4 abs(Float4 a)
+{
+  return {_mm_andnot_ps(_mm_set1_ps(-0.f), a.v)};
+}
+inline void store(float *out, Float4 a) { _mm_storeu_ps(out, a.v); }
+
+#elif defined(GLTF_VIEWER_SIMD_NEON)
+
+struct Float4
+{
+  float32x4_t v;
+};
+
+inline Float4 set1(float x) { return {vdupq_n_f32(x)}; }
+inline Float4 set(float a, float b, float c, float d)
+{
+  const float values[4] = {a, b, c, d};
+  return {vld1q_f32(values)};
+}
+inline Float4 load(const float *in) { return {vld1q_f32(in)}; }
+inline Float4 operator+(Float4 a, Float4 b) { return {vaddq_f32(a.v, b.v)}; }
+inline Float4 operator-(Float4 a, Float4 b) { return {vsubq_f32(a.v, b.v)}; }
+inline Float4 operator*(Float4 a, Float4 b) { return {vmulq_f32(a.v, b.v)}; }
+inline Float4 min(Float4 a, Float4 b) { return {vminq_f32(a.v, b.v)}; }
+inline Float4 max(Float4 a, Float4 b) { return {vmaxq_f32(a.v, b.v)}; }
+inline Float4 abs(Float4 a) { return {vabsq_f32(a.v)}; }
+inline void store(float *out, Float4 a) { vst1q_f32(out, a.v); }
+
+#else
+
+struct Float4
+{
+  float v[4];
+};
+
+inline Float4 set1(float x) { return {{x, x, x, x}}; }
+inline Float4 set(float a, float b, float c, float d)
+{
+  return {{a, b, c, d}};
+}
+inline Float4 load(const float *in)
+{
+  Float4 a;
+  std::memcpy(a.v, in, sizeof(a.v));
+  return a;
+}
+template <typename F> Float4 apply(Float4 a, Float4 b, F f)
+{
+  return {{f(a.v[0], b.v[0]), f(a.v[1], b.v[1]), f(a.v[2], b.v[2]),
+      f(a.v[3], b.v[3])}};
+}
+inline Float4 operator+(Float4 a, Float4 b)
+{
+  return apply(a, b, [](float x, float y) { return x + y; });
+}
+inline Float4 operator-(Float4 a, Float4 b)
+{
+  return apply(a, b, [](float x, float y) { return x - y; });
+}
+inline Float4 operator*(Float4 a, Float4 b)
+{
+  return apply(a, b, [](float x, float y) { return x * y; });
+}
+inline Float4 min(Float4 a, Float4 b)
+{
+  return apply(a, b, [](float x, float y) { return y < x ? y : x; });
+}
+inline Float4 max(Float4 a, Float4 b)
+{
+  return apply(a, b, [](float x, float y) { return x < y ? y : x; });
+}
+inline Float4 abs(Float4 a)
+{
+  return {{std::fabs(a.v[0]), std::fabs(a.v[1]), std::fabs(a.v[2]),
+      std::fabs(a.v[3])}};
+}
+inline void store(float *out, Float4 a)
+{
+  std::memcpy(out, a.v, sizeof(a.v));
+}
+
+#endif
+
+} // namespace simd
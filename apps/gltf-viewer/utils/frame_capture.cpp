@@ -0,0 +1,370 @@
+#include "frame_capture.hpp"
+#include "gl_extensions.hpp"
+#include "gl_objects.hpp"
+#include "indirect_draws.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+
+namespace
+{
+
+const char FRAME_CAPTURE_MAGIC[8] = {'G', 'L', 'F', 'R', 'A', 'M', 'E', 0};
+
+// Incremented when the layout of the file changes
+const uint32_t FRAME_CAPTURE_VERSION = 1;
+
+// Binding of the CameraUniforms block in the replay program
+const GLuint CAMERA_UNIFORMS_BINDING = 1;
+
+template <typename T> void writeValue(std::ofstream &out, const T &value)
+{
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+void writeVector(std::ofstream &out, const std::vector<T> &values)
+{
+  writeValue(out, uint64_t(values.size()));
+  out.write(reinterpret_cast<const char *>(values.data()),
+      std::streamsize(values.size() * sizeof(T)));
+}
+
+void writeString(std::ofstream &out, const std::string &str)
+{
+  writeValue(out, uint64_t(str.size()));
+  out.write(str.data(), std::streamsize(str.size()));
+}
+
+// Reads the values of a file of size bytes, failing on counts larger than
+// what is left of it
+class CaptureReader
+{
+public:
+  CaptureReader(std::ifstream &in, uint64_t size) : m_in(in), m_nSize(size) {}
+
+  template <typename T> bool read(T &value)
+  {
+    return readBytes(&value, sizeof(T));
+  }
+
+  template <typename T> bool read(std::vector<T> &values)
+  {
+    uint64_t count = 0;
+    if (!read(count) || count > remaining() / sizeof(T)) {
+      return false;
+    }
+    values.resize(size_t(count));
+    return readBytes(values.data(), values.size() * sizeof(T));
+  }
+
+  bool read(std::string &str)
+  {
+    uint64_t length = 0;
+    if (!read(length) || length > remaining()) {
+      return false;
+    }
+    str.resize(size_t(length));
+    return readBytes(&str[0], str.size());
+  }
+
+private:
+  uint64_t remaining() const { return m_nSize - m_nOffset; }
+
+  bool readBytes(void *data, size_t size)
+  {
+    if (size > remaining()) {
+      return false;
+    }
+    m_in.read(reinterpret_cast<char *>(data), std::streamsize(size));
+    m_nOffset += size;
+    return bool(m_in);
+  }
+
+  std::ifstream &m_in;
+  uint64_t m_nSize;
+  uint64_t m_nOffset = 0;
+};
+
+} // namespace
+
+void captureFramePassState(FrameCapture &capture)
+{
+  GLint viewport[4] = {};
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  capture.width = uint32_t(viewport[2]);
+  capture.height = uint32_t(viewport[3]);
+  GLint samples = 0;
+  glGetIntegerv(GL_SAMPLES, &samples);
+  capture.samples = uint32_t(samples);
+  GLint drawFramebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+  capture.depthFormat =
+      GLFramebuffer::getDrawDepthFormat(GLuint(drawFramebuffer));
+  GLint depthFunc = GL_LESS;
+  glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+  capture.depthFunc = GLenum(depthFunc);
+  glGetFloatv(GL_DEPTH_CLEAR_VALUE, &capture.clearDepth);
+  capture.isCullFaceEnabled = glIsEnabled(GL_CULL_FACE);
+  capture.isClipDepthZeroToOne = 0;
+  if (getGLExtensions().clipControl) {
+    GLint depthMode = 0;
+    glGetIntegerv(GL_CLIP_DEPTH_MODE, &depthMode);
+    capture.isClipDepthZeroToOne = depthMode == GL_ZERO_TO_ONE;
+  }
+}
+
+bool writeFrameCapture(
+    const fs::path &path, const FrameCapture &capture, std::string &err)
+{
+  std::ofstream out(path.string(), std::ios::binary | std::ios::trunc);
+  if (!out) {
+    err = "Unable to open " + path.string() + " for writing";
+    return false;
+  }
+  out.write(FRAME_CAPTURE_MAGIC, sizeof(FRAME_CAPTURE_MAGIC));
+  writeValue(out, FRAME_CAPTURE_VERSION);
+  writeVector(out, capture.attributes);
+  writeValue(out, uint64_t(capture.bindings.size()));
+  for (const auto &binding : capture.bindings) {
+    writeValue(out, binding.index);
+    writeValue(out, binding.stride);
+    writeValue(out, binding.divisor);
+    writeVector(out, binding.data);
+  }
+  writeValue(out, capture.indexType);
+  writeVector(out, capture.indices);
+  writeVector(out, capture.commands);
+  writeVector(out, capture.batches);
+  writeVector(out, capture.drawTransforms);
+  writeVector(out, capture.cameraUniforms);
+  writeValue(out, uint64_t(capture.vertexDefines.size()));
+  for (const auto &define : capture.vertexDefines) {
+    writeString(out, define.first);
+    writeString(out, define.second);
+  }
+  writeValue(out, capture.width);
+  writeValue(out, capture.height);
+  writeValue(out, capture.samples);
+  writeValue(out, capture.depthFormat);
+  writeValue(out, capture.depthFunc);
+  writeValue(out, capture.clearDepth);
+  writeValue(out, capture.isCullFaceEnabled);
+  writeValue(out, capture.isClipDepthZeroToOne);
+  if (!out) {
+    err = "Unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
+
+bool readFrameCapture(
+    const fs::path &path, FrameCapture &capture, std::string &err)
+{
+  std::error_code errorCode;
+  const auto size = fs::file_size(path, errorCode);
+  std::ifstream in(path.string(), std::ios::binary);
+  if (errorCode || !in) {
+    err = "Unable to open " + path.string();
+    return false;
+  }
+  CaptureReader reader(in, size);
+  char magic[sizeof(FRAME_CAPTURE_MAGIC)] = {};
+  uint32_t version = 0;
+  if (!reader.read(magic) ||
+      std::memcmp(magic, FRAME_CAPTURE_MAGIC, sizeof(magic)) != 0 ||
+      !reader.read(version) || version != FRAME_CAPTURE_VERSION) {
+    err = path.string() + " is not a frame capture of this version";
+    return false;
+  }
+
+  capture = FrameCapture();
+  uint64_t bindingCount = 0;
+  auto isValid = reader.read(capture.attributes) && reader.read(bindingCount);
+  for (uint64_t i = 0; isValid && i < bindingCount; ++i) {
+    FrameCapture::Binding binding;
+    isValid = reader.read(binding.index) && reader.read(binding.stride) &&
+              reader.read(binding.divisor) && reader.read(binding.data);
+    capture.bindings.push_back(std::move(binding));
+  }
+  uint64_t defineCount = 0;
+  isValid = isValid && reader.read(capture.indexType) &&
+            reader.read(capture.indices) && reader.read(capture.commands) &&
+            reader.read(capture.batches) &&
+            reader.read(capture.drawTransforms) &&
+            reader.read(capture.cameraUniforms) && reader.read(defineCount);
+  for (uint64_t i = 0; isValid && i < defineCount; ++i) {
+    std::string name, value;
+    isValid = reader.read(name) && reader.read(value);
+    capture.vertexDefines[name] = value;
+  }
+  isValid = isValid && reader.read(capture.width) &&
+            reader.read(capture.height) && reader.read(capture.samples) &&
+            reader.read(capture.depthFormat) &&
+            reader.read(capture.depthFunc) &&
+            reader.read(capture.clearDepth) &&
+            reader.read(capture.isCullFaceEnabled) &&
+            reader.read(capture.isClipDepthZeroToOne);
+
+  // Commands read by the batches must be in the capture
+  const auto commandCount =
+      capture.commands.size() / sizeof(DrawElementsIndirectCommand);
+  for (const auto &batch : capture.batches) {
+    isValid = isValid && batch.begin <= commandCount &&
+              batch.count <= commandCount - batch.begin;
+  }
+  if (!isValid) {
+    err = path.string() + " is truncated or invalid";
+    return false;
+  }
+  return true;
+}
+
+bool replayFrameCapture(const FrameCapture &capture,
+    const fs::path &shadersPath, const fs::path &fragmentShader,
+    size_t warmupCount, size_t frameCount, FrameReplayTimes &times,
+    std::string &err)
+{
+  const auto &extensions = getGLExtensions();
+  if (capture.isClipDepthZeroToOne && !extensions.clipControl) {
+    err = "The capture maps depth to [0, 1], which requires glClipControl";
+    return false;
+  }
+  if (!capture.width || !capture.height) {
+    err = "The capture has an empty viewport";
+    return false;
+  }
+
+  GLProgram program;
+  try {
+    program = compileProgram(
+        {shadersPath / "forward_indirect.vs.glsl", fragmentShader},
+        capture.vertexDefines);
+  } catch (const std::exception &e) {
+    err = e.what();
+    return false;
+  }
+  if (!program.bindUniformBlock("CameraUniforms", CAMERA_UNIFORMS_BINDING,
+          GLint(capture.cameraUniforms.size()))) {
+    err = "The capture does not match the CameraUniforms of the program";
+    return false;
+  }
+
+  // Buffers of the capture are read by the GPU only
+  const auto createBuffer = [](const std::vector<uint8_t> &data) {
+    return data.empty() ? GLBuffer()
+                        : GLBuffer(data.size(), data.data(), 0);
+  };
+  std::vector<GLBuffer> vertexBuffers;
+  for (const auto &binding : capture.bindings) {
+    vertexBuffers.push_back(createBuffer(binding.data));
+  }
+  const auto indexBuffer = createBuffer(capture.indices);
+  const auto commandBuffer = createBuffer(capture.commands);
+  const auto transformBuffer = createBuffer(capture.drawTransforms);
+  const auto cameraBuffer = createBuffer(capture.cameraUniforms);
+
+  const auto vertexArray = GLVertexArray::create();
+  vertexArray.bind();
+  for (const auto &attribute : capture.attributes) {
+    glEnableVertexAttribArray(attribute.location);
+    if (attribute.isInteger) {
+      glVertexAttribIFormat(attribute.location, attribute.size,
+          attribute.type, attribute.relativeOffset);
+    } else {
+      glVertexAttribFormat(attribute.location, attribute.size, attribute.type,
+          GLboolean(attribute.isNormalized), attribute.relativeOffset);
+    }
+    glVertexAttribBinding(attribute.location, attribute.binding);
+  }
+  for (size_t i = 0; i < capture.bindings.size(); ++i) {
+    const auto &binding = capture.bindings[i];
+    glBindVertexBuffer(
+        binding.index, vertexBuffers[i].glId(), 0, GLsizei(binding.stride));
+    glVertexBindingDivisor(binding.index, binding.divisor);
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.glId());
+
+  const auto width = GLsizei(capture.width);
+  const auto height = GLsizei(capture.height);
+  const auto samples = GLsizei(capture.samples);
+  const GLRenderbuffer colorBuffer(GL_RGBA8, width, height, samples);
+  const GLRenderbuffer depthBuffer(capture.depthFormat, width, height, samples);
+  const auto framebuffer = GLFramebuffer::create();
+  framebuffer.attachRenderbuffer(GL_COLOR_ATTACHMENT0, colorBuffer.glId());
+  framebuffer.attachRenderbuffer(GL_DEPTH_ATTACHMENT, depthBuffer.glId());
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer.glId());
+  if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) !=
+      GL_FRAMEBUFFER_COMPLETE) {
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBindVertexArray(0);
+    err = "Unable to create the framebuffer of the capture";
+    return false;
+  }
+
+  glViewport(0, 0, width, height);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(capture.depthFunc);
+  glDepthMask(GL_TRUE);
+  glClearDepth(capture.clearDepth);
+  glClearColor(0.f, 0.f, 0.f, 1.f);
+  glDisable(GL_BLEND);
+  if (capture.isCullFaceEnabled) {
+    glEnable(GL_CULL_FACE);
+  } else {
+    glDisable(GL_CULL_FACE);
+  }
+  if (capture.isClipDepthZeroToOne) {
+    extensions.setClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+  }
+  program.use();
+  glBindBufferBase(
+      GL_UNIFORM_BUFFER, CAMERA_UNIFORMS_BINDING, cameraBuffer.glId());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, transformBuffer.glId());
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer.glId());
+
+  const auto drawFrame = [&]() {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    for (const auto &batch : capture.batches) {
+      const auto offset = (const GLvoid *)(size_t(batch.begin) *
+                                           sizeof(DrawElementsIndirectCommand));
+      glMultiDrawElementsIndirect(
+          batch.mode, capture.indexType, offset, GLsizei(batch.count), 0);
+    }
+  };
+  for (size_t i = 0; i < warmupCount; ++i) {
+    drawFrame();
+  }
+  // Every query is read at the end, so that no frame waits for the GPU
+  std::vector<GLuint> queries(std::max(frameCount, size_t(1)));
+  glGenQueries(GLsizei(queries.size()), queries.data());
+  for (const auto query : queries) {
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    drawFrame();
+    glEndQuery(GL_TIME_ELAPSED);
+  }
+  std::vector<double> frameTimes;
+  for (const auto query : queries) {
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    frameTimes.push_back(double(nanoseconds) * 1e-6);
+  }
+  glDeleteQueries(GLsizei(queries.size()), queries.data());
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UNIFORMS_BINDING, 0);
+  glBindVertexArray(0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+  std::sort(begin(frameTimes), end(frameTimes));
+  times.frameCount = frameTimes.size();
+  times.minMs = frameTimes.front();
+  times.medianMs = frameTimes[frameTimes.size() / 2];
+  times.meanMs = std::accumulate(begin(frameTimes), end(frameTimes), 0.) /
+                 double(frameTimes.size());
+  times.maxMs = frameTimes.back();
+  return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Frame capture (.glframe)
+//
+// A capture holds the draw stream of the main pass of one frame drawn with
+// indirect draws, as submitted to the GL: the vertex attributes of the VAO
+// of the GeometryArena with the contents of their buffers (vertex streams,
+// draw and material ids), the index buffer, the indirect commands and their
+// batches, the draw transforms, the camera uniforms and the state of the
+// pass. Every draw is kept, not only those left by the culling of the frame.
+//
+// replayFrameCapture draws it again in a context of its own, so that the
+// cost of the draw stream is measured without loading, animation nor
+// culling, on another machine than the one that captured it. Shading is not
+// captured, it would take the materials, textures and lights of the scene:
+// the replay program is forward_indirect.vs.glsl compiled with the defines
+// of the capture and a fragment shader reading its outputs only.
+struct FrameCapture
+{
+  // An enabled attribute of the VAO
+  struct Attribute
+  {
+    GLuint location;
+    GLint size;
+    GLenum type;
+    GLuint isNormalized;
+    GLuint isInteger;
+    GLuint relativeOffset;
+    GLuint binding;
+  };
+
+  // A vertex buffer binding of the VAO, its buffer is data
+  struct Binding
+  {
+    GLuint index;
+    GLuint stride;
+    GLuint divisor;
+    std::vector<uint8_t> data;
+  };
+
+  // Commands drawn by one glMultiDrawElementsIndirect
+  struct Batch
+  {
+    GLenum mode;
+    GLuint begin; // In commands
+    GLuint count;
+  };
+
+  std::vector<Attribute> attributes;
+  std::vector<Binding> bindings;
+  GLenum indexType = GL_UNSIGNED_INT;
+  std::vector<uint8_t> indices;
+  std::vector<uint8_t> commands; // DrawElementsIndirectCommand
+  std::vector<Batch> batches;
+  // Shader storage binding 0 of forward_indirect.vs.glsl
+  std::vector<uint8_t> drawTransforms;
+  std::vector<uint8_t> cameraUniforms; // Block of camera.glsl
+  ShaderDefines vertexDefines; // Of forward_indirect.vs.glsl
+  // State of the pass
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t samples = 0;
+  GLenum depthFormat = GL_DEPTH_COMPONENT32F;
+  GLenum depthFunc = GL_LESS;
+  float clearDepth = 1.f;
+  GLuint isCullFaceEnabled = 0;
+  GLuint isClipDepthZeroToOne = 0; // glClipControl of reversed-Z
+};
+
+// Fill the state of the pass from the bound draw framebuffer and the current
+// GL state, the draws are captured by IndirectDrawList::capture
+void captureFramePassState(FrameCapture &capture);
+
+// Write capture to path, return false on failure
+bool writeFrameCapture(
+    const fs::path &path, const FrameCapture &capture, std::string &err);
+
+// Read a capture written by writeFrameCapture, return false if the file
+// does not exist or is invalid
+bool readFrameCapture(
+    const fs::path &path, FrameCapture &capture, std::string &err);
+
+// GPU times of the frames of replayFrameCapture, in milliseconds
+struct FrameReplayTimes
+{
+  size_t frameCount = 0;
+  double minMs = 0.;
+  double medianMs = 0.;
+  double meanMs = 0.;
+  double maxMs = 0.;
+};
+
+// Draw capture warmupCount times, then frameCount times measuring the GPU
+// time of each frame (clear and draws) with a GL_TIME_ELAPSED query, in a
+// framebuffer of its size and samples. shadersPath is the directory of
+// forward_indirect.vs.glsl, fragmentShader a fragment shader reading its
+// outputs. Requires a current OpenGL 4.4 context.
+bool replayFrameCapture(const FrameCapture &capture,
+    const fs::path &shadersPath, const fs::path &fragmentShader,
+    size_t warmupCount, size_t frameCount, FrameReplayTimes &times,
+    std::string &err);
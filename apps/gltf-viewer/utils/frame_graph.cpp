@@ -0,0 +1,206 @@
+#include "frame_graph.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+bool operator==(
+    const TransientTextureDesc &lhs, const TransientTextureDesc &rhs)
+{
+  return lhs.internalFormat == rhs.internalFormat &&
+         lhs.width == rhs.width && lhs.height == rhs.height &&
+         lhs.levelCount == rhs.levelCount &&
+         lhs.minFilter == rhs.minFilter && lhs.magFilter == rhs.magFilter;
+}
+
+GLuint TexturePool::acquire(const TransientTextureDesc &desc)
+{
+  auto it = std::find_if(begin(m_entries), end(m_entries),
+      [&](const Entry &entry) { return !entry.isLent && entry.desc == desc; });
+  if (it == end(m_entries)) {
+    Entry entry;
+    entry.desc = desc;
+    entry.texture = GLTexture(
+        desc.levelCount, desc.internalFormat, desc.width, desc.height);
+    entry.texture.setParameter(GL_TEXTURE_MIN_FILTER, GLint(desc.minFilter));
+    entry.texture.setParameter(GL_TEXTURE_MAG_FILTER, GLint(desc.magFilter));
+    entry.texture.setParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    entry.texture.setParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    m_entries.push_back(std::move(entry));
+    it = end(m_entries) - 1;
+  }
+  it->isLent = true;
+  it->lastFrame = m_nFrame;
+  return it->texture.glId();
+}
+
+void TexturePool::release(GLuint texture)
+{
+  const auto it = std::find_if(begin(m_entries), end(m_entries),
+      [&](const Entry &entry) { return entry.texture.glId() == texture; });
+  assert(it != end(m_entries) && it->isLent);
+  if (it != end(m_entries)) {
+    it->isLent = false;
+  }
+}
+
+void TexturePool::endFrame(size_t maxUnusedFrameCount)
+{
+  m_entries.erase(std::remove_if(begin(m_entries), end(m_entries),
+                      [&](const Entry &entry) {
+                        return !entry.isLent &&
+                               m_nFrame - entry.lastFrame >=
+                                   maxUnusedFrameCount;
+                      }),
+      end(m_entries));
+  ++m_nFrame;
+}
+
+size_t TexturePool::byteCount() const
+{
+  size_t bytes = 0;
+  for (const auto &entry : m_entries) {
+    const auto &desc = entry.desc;
+    bytes += getTextureByteSize(desc.internalFormat, size_t(desc.width),
+        size_t(desc.height), size_t(desc.levelCount));
+  }
+  return bytes;
+}
+
+FrameGraph::Resource FrameGraph::Builder::create(
+    const std::string &name, const TransientTextureDesc &desc)
+{
+  ResourceNode resource;
+  resource.name = name;
+  resource.desc = desc;
+  m_graph.m_resources.push_back(resource);
+  const auto idx = m_graph.m_resources.size() - 1;
+  write(idx);
+  return idx;
+}
+
+void FrameGraph::Builder::read(Resource resource)
+{
+  assert(resource < m_graph.m_resources.size());
+  m_graph.m_passes[m_nPassIdx].reads.push_back(resource);
+}
+
+void FrameGraph::Builder::write(Resource resource)
+{
+  assert(resource < m_graph.m_resources.size());
+  m_graph.m_passes[m_nPassIdx].writes.push_back(resource);
+}
+
+void FrameGraph::Builder::keep()
+{
+  m_graph.m_passes[m_nPassIdx].isKept = true;
+}
+
+FrameGraph::Resource FrameGraph::import(
+    const std::string &name, GLuint texture)
+{
+  ResourceNode resource;
+  resource.name = name;
+  resource.texture = texture;
+  resource.isImported = true;
+  m_resources.push_back(resource);
+  return m_resources.size() - 1;
+}
+
+void FrameGraph::addPass(const std::string &name,
+    const std::function<void(Builder &)> &setup,
+    std::function<void()> execute)
+{
+  PassNode pass;
+  pass.name = name;
+  pass.execute = std::move(execute);
+  m_passes.push_back(std::move(pass));
+  Builder builder{*this, m_passes.size() - 1};
+  setup(builder);
+}
+
+void FrameGraph::execute(TexturePool &pool)
+{
+  // Passes only read what earlier passes wrote, so walking them backwards
+  // finds every resource read by a pass that is executed before its
+  // writers
+  std::vector<bool> isResourceRead(m_resources.size(), false);
+  std::vector<bool> isPassExecuted(m_passes.size(), false);
+  for (auto passIdx = m_passes.size(); passIdx-- > 0;) {
+    const auto &pass = m_passes[passIdx];
+    const auto isUsed =
+        pass.isKept || std::any_of(begin(pass.writes), end(pass.writes),
+                           [&](Resource r) { return isResourceRead[r]; });
+    if (!isUsed) {
+      continue;
+    }
+    isPassExecuted[passIdx] = true;
+    for (const auto resource : pass.reads) {
+      isResourceRead[resource] = true;
+    }
+  }
+
+  // Lifetimes of the transient textures, in executed passes
+  std::vector<bool> isResourceUsed(m_resources.size(), false);
+  for (size_t passIdx = 0; passIdx < m_passes.size(); ++passIdx) {
+    if (!isPassExecuted[passIdx]) {
+      continue;
+    }
+    const auto &pass = m_passes[passIdx];
+    for (const auto *resources : {&pass.reads, &pass.writes}) {
+      for (const auto r : *resources) {
+        auto &resource = m_resources[r];
+        if (!isResourceUsed[r]) {
+          isResourceUsed[r] = true;
+          resource.firstPassIdx = passIdx;
+        }
+        resource.lastPassIdx = passIdx;
+      }
+    }
+  }
+
+  m_nExecutedPassCount = 0;
+  m_nCulledPassCount = 0;
+  m_nPeakBytes = 0;
+  size_t bytes = 0;
+  for (size_t passIdx = 0; passIdx < m_passes.size(); ++passIdx) {
+    if (!isPassExecuted[passIdx]) {
+      ++m_nCulledPassCount;
+      continue;
+    }
+    for (size_t r = 0; r < m_resources.size(); ++r) {
+      auto &resource = m_resources[r];
+      if (isResourceUsed[r] && !resource.isImported &&
+          resource.firstPassIdx == passIdx) {
+        const auto &desc = resource.desc;
+        resource.texture = pool.acquire(desc);
+        bytes += getTextureByteSize(desc.internalFormat, size_t(desc.width),
+            size_t(desc.height), size_t(desc.levelCount));
+      }
+    }
+    m_nPeakBytes = std::max(m_nPeakBytes, bytes);
+
+    m_passes[passIdx].execute();
+    ++m_nExecutedPassCount;
+
+    for (size_t r = 0; r < m_resources.size(); ++r) {
+      auto &resource = m_resources[r];
+      if (isResourceUsed[r] && !resource.isImported &&
+          resource.lastPassIdx == passIdx) {
+        const auto &desc = resource.desc;
+        pool.release(resource.texture);
+        resource.texture = 0;
+        bytes -= getTextureByteSize(desc.internalFormat, size_t(desc.width),
+            size_t(desc.height), size_t(desc.levelCount));
+      }
+    }
+  }
+
+  m_resources.clear();
+  m_passes.clear();
+}
+
+GLuint FrameGraph::texture(Resource resource) const
+{
+  assert(resource < m_resources.size());
+  return m_resources[resource].texture;
+}
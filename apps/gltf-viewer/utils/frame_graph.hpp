@@ -0,0 +1,160 @@
+#pragma once
+
+#include "gl_objects.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Storage and sampling of a transient texture of a FrameGraph. Wrapping is
+// GL_CLAMP_TO_EDGE.
+struct TransientTextureDesc
+{
+  GLenum internalFormat = GL_RGBA8;
+  GLsizei width = 1;
+  GLsizei height = 1;
+  GLsizei levelCount = 1;
+  GLenum minFilter = GL_NEAREST;
+  GLenum magFilter = GL_NEAREST;
+};
+
+bool operator==(
+    const TransientTextureDesc &lhs, const TransientTextureDesc &rhs);
+
+// Textures lent to the passes of frame graphs, kept from frame to frame so
+// that a graph executed every frame creates none once it has run. A texture
+// is lent to one pass at a time, then to any pass asking for the same
+// description: GL has no memory aliasing between textures, the same texture
+// serves passes whose uses do not overlap instead.
+class TexturePool
+{
+public:
+  TexturePool() = default;
+
+  TexturePool(const TexturePool &) = delete;
+  TexturePool &operator=(const TexturePool &) = delete;
+
+  // A texture of desc that is not lent, created if there is none
+  GLuint acquire(const TransientTextureDesc &desc);
+
+  // Give back texture, returned by acquire
+  void release(GLuint texture);
+
+  // Delete the textures that were not lent during the last
+  // maxUnusedFrameCount frames, e.g. those of the size of the window before
+  // it was resized, and start a new frame
+  void endFrame(size_t maxUnusedFrameCount = 8);
+
+  size_t textureCount() const { return m_entries.size(); }
+
+  size_t byteCount() const;
+
+private:
+  struct Entry
+  {
+    TransientTextureDesc desc;
+    GLTexture texture;
+    bool isLent = false;
+    size_t lastFrame = 0; // When last lent
+  };
+
+  std::vector<Entry> m_entries;
+  size_t m_nFrame = 0;
+};
+
+// Passes of a frame declared with the textures they read and write, then
+// executed in declaration order:
+// - passes whose written textures are read by no later pass that is
+// executed are culled, unless they have an effect outside of the graph
+// (Builder::keep), e.g. drawing in the window or writing a buffer read by
+// the next frame,
+// - transient textures are acquired from a TexturePool before the first
+// pass that uses them and released after the last one, so that later
+// passes reuse them. The memory of a frame is that of the textures alive at
+// the same time, whatever the number of passes.
+//
+// Textures the graph does not own, such as histories, are imported.
+class FrameGraph
+{
+public:
+  using Resource = size_t;
+
+  // Declaration of the resources of a pass
+  class Builder
+  {
+  public:
+    // Transient texture first written by the pass
+    Resource create(
+        const std::string &name, const TransientTextureDesc &desc);
+
+    void read(Resource resource);
+
+    void write(Resource resource);
+
+    // The pass is never culled
+    void keep();
+
+  private:
+    friend class FrameGraph;
+
+    Builder(FrameGraph &graph, size_t passIdx) :
+        m_graph(graph), m_nPassIdx(passIdx)
+    {
+    }
+
+    FrameGraph &m_graph;
+    size_t m_nPassIdx;
+  };
+
+  // Texture owned by the caller, never released
+  Resource import(const std::string &name, GLuint texture);
+
+  // setup declares the resources of the pass, at once. execute runs it, if
+  // it is not culled, and gets its textures with texture().
+  void addPass(const std::string &name,
+      const std::function<void(Builder &)> &setup,
+      std::function<void()> execute);
+
+  // Cull passes, then execute the others with textures of pool. The graph
+  // is then empty.
+  void execute(TexturePool &pool);
+
+  // Texture of resource, while the passes using it are executed
+  GLuint texture(Resource resource) const;
+
+  // Of the last execute()
+  size_t executedPassCount() const { return m_nExecutedPassCount; }
+  size_t culledPassCount() const { return m_nCulledPassCount; }
+  // Largest storage of transient textures alive at the same time
+  size_t peakBytes() const { return m_nPeakBytes; }
+
+private:
+  struct ResourceNode
+  {
+    std::string name;
+    TransientTextureDesc desc;
+    GLuint texture = 0; // Imported or acquired
+    bool isImported = false;
+    // Of the executed passes using the resource, set by execute()
+    size_t firstPassIdx = 0;
+    size_t lastPassIdx = 0;
+  };
+
+  struct PassNode
+  {
+    std::string name;
+    std::function<void()> execute;
+    std::vector<Resource> reads;
+    std::vector<Resource> writes;
+    bool isKept = false;
+  };
+
+  std::vector<ResourceNode> m_resources;
+  std::vector<PassNode> m_passes;
+  size_t m_nExecutedPassCount = 0;
+  size_t m_nCulledPassCount = 0;
+  size_t m_nPeakBytes = 0;
+};
@@ -0,0 +1,111 @@
+#include "frame_pacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+
+// Nanoseconds waited for a fence before giving up, a lost context must not
+// hang the application
+const GLuint64 FENCE_TIMEOUT = 1000000000;
+
+float smooth(float average, float value)
+{
+  return average < 0.f ? value
+                       : average + FramePacer::SMOOTHING * (value - average);
+}
+
+} // namespace
+
+FramePacer::FramePacer(size_t maxFramesInFlight, float maxFrameRate) :
+    m_nMaxFramesInFlight(std::min(maxFramesInFlight, MAX_FRAMES_IN_FLIGHT)),
+    m_minFrameTime(maxFrameRate > 0.f ? 1. / maxFrameRate : 0.),
+    m_cpuOrigin(std::chrono::steady_clock::now())
+{
+  glGetInteger64v(GL_TIMESTAMP, &m_gpuOrigin);
+  for (auto &frame : m_frames) {
+    glGenQueries(1, &frame.query);
+  }
+}
+
+FramePacer::~FramePacer()
+{
+  for (auto &frame : m_frames) {
+    if (frame.fence) {
+      glDeleteSync(frame.fence);
+    }
+    glDeleteQueries(1, &frame.query);
+  }
+}
+
+void FramePacer::waitForFrame()
+{
+  while (m_nMaxFramesInFlight && m_nFrameCount >= m_nMaxFramesInFlight) {
+    if (!retireOldestFrame(true)) {
+      break;
+    }
+  }
+  while (m_nFrameCount && retireOldestFrame(false)) {
+  }
+
+  if (m_minFrameTime > 0.) {
+    const auto now = getCPUTime();
+    if (m_nextDeadline > now) {
+      std::this_thread::sleep_for(
+          std::chrono::duration<double>(m_nextDeadline - now));
+    }
+    m_nextDeadline = std::max(m_nextDeadline, now) + m_minFrameTime;
+  }
+
+  const auto start = getCPUTime();
+  if (m_frameStart >= 0.) {
+    m_frameTime = smooth(m_frameTime, float(1000. * (start - m_frameStart)));
+  }
+  m_frameStart = start;
+  m_inputTime = start;
+}
+
+void FramePacer::sampleInput() { m_inputTime = getCPUTime(); }
+
+void FramePacer::endFrame()
+{
+  if (m_nFrameCount == MAX_FRAMES_IN_FLIGHT) {
+    return; // Only measuring and late, skip this frame rather than stalling
+  }
+  auto &frame =
+      m_frames[(m_nFirstFrame + m_nFrameCount) % MAX_FRAMES_IN_FLIGHT];
+  glQueryCounter(frame.query, GL_TIMESTAMP);
+  frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  frame.inputTime = m_inputTime;
+  ++m_nFrameCount;
+}
+
+double FramePacer::getCPUTime() const
+{
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - m_cpuOrigin)
+      .count();
+}
+
+bool FramePacer::retireOldestFrame(bool wait)
+{
+  auto &frame = m_frames[m_nFirstFrame];
+  const auto status = glClientWaitSync(frame.fence,
+      wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? FENCE_TIMEOUT : 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    return false;
+  }
+  if (status != GL_WAIT_FAILED) {
+    // The query was issued before the fence, its result is available
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(frame.query, GL_QUERY_RESULT, &end);
+    const auto gpuEnd = double(GLint64(end) - m_gpuOrigin) * 1e-9;
+    m_latency = smooth(m_latency, float(1000. * (gpuEnd - frame.inputTime)));
+  }
+  glDeleteSync(frame.fence);
+  frame.fence = nullptr;
+  m_nFirstFrame = (m_nFirstFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  --m_nFrameCount;
+  return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <array>
+#include <chrono>
+
+// Cadence and latency of the frames of the window. A fence after each frame
+// keeps the CPU at most maxFramesInFlight frames ahead of the GPU, instead
+// of the driver queuing as many as it likes, each one adding to the
+// latency. A maximum frame rate makes waitForFrame() sleep until the
+// deadline of the next frame.
+//
+// The latency estimate goes from the sampling of the input of a frame to
+// the end of its GPU work, measured by a GL_TIMESTAMP query read once its
+// fence is signaled. Scan out by the display comes on top of it.
+class FramePacer
+{
+public:
+  static constexpr size_t MAX_FRAMES_IN_FLIGHT = 4;
+  // Weight of the last frame in the averages
+  static constexpr float SMOOTHING = 0.05f;
+
+  // maxFramesInFlight is clamped to MAX_FRAMES_IN_FLIGHT, 0 only measures
+  // the latency (frames are skipped rather than waited for when all fences
+  // are pending). maxFrameRate is in frames per second, 0 for no limit.
+  FramePacer(size_t maxFramesInFlight, float maxFrameRate);
+
+  ~FramePacer();
+
+  FramePacer(const FramePacer &) = delete;
+  FramePacer &operator=(const FramePacer &) = delete;
+
+  // Called before the first GL commands of a frame
+  void waitForFrame();
+
+  // Called when the input of the frame is read, as late as possible before
+  // drawing it
+  void sampleInput();
+
+  // Called after swapping buffers
+  void endFrame();
+
+  // Averages in milliseconds, negative until measured
+  float frameTime() const { return m_frameTime; }
+  float latency() const { return m_latency; }
+
+private:
+  struct InFlightFrame
+  {
+    GLsync fence = nullptr;
+    GLuint query = 0;
+    double inputTime = 0.;
+  };
+
+  // Seconds since the creation of the pacer
+  double getCPUTime() const;
+
+  // Measure the latency of the oldest frame in flight once its fence is
+  // signaled, waiting for it if wait is set. Return false if it is not.
+  bool retireOldestFrame(bool wait);
+
+  size_t m_nMaxFramesInFlight;
+  double m_minFrameTime; // In seconds, 0 for no limit
+  std::chrono::steady_clock::time_point m_cpuOrigin;
+  GLint64 m_gpuOrigin = 0; // GL_TIMESTAMP at creation, in nanoseconds
+  std::array<InFlightFrame, MAX_FRAMES_IN_FLIGHT> m_frames;
+  size_t m_nFirstFrame = 0; // Oldest frame in flight
+  size_t m_nFrameCount = 0; // Frames in flight
+  double m_inputTime = 0.;
+  double m_frameStart = -1.;
+  double m_nextDeadline = 0.;
+  float m_frameTime = -1.f;
+  float m_latency = -1.f;
+};
@@ -0,0 +1,231 @@
+#include "frame_timeline.hpp"
+
+#include <imgui.h>
+#include <json.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+FrameTimeline::FrameTimeline() :
+    m_frames(CAPACITY), m_cpuOrigin(std::chrono::steady_clock::now())
+{
+  glGetInteger64v(GL_TIMESTAMP, &m_gpuOrigin);
+  for (auto &query : m_queries) {
+    glGenQueries(1, &query.start);
+    glGenQueries(1, &query.end);
+  }
+}
+
+FrameTimeline::~FrameTimeline()
+{
+  for (auto &query : m_queries) {
+    glDeleteQueries(1, &query.start);
+    glDeleteQueries(1, &query.end);
+  }
+}
+
+void FrameTimeline::beginFrame()
+{
+  collectQueries();
+
+  auto &frame = m_frames[m_nFrameCount % CAPACITY];
+  frame = Frame{};
+  frame.cpuStart = getCPUTime();
+
+  auto &query = m_queries[m_nFrameCount % QUERY_LATENCY];
+  m_pCurrentQuery = nullptr;
+  if (query.isPending) {
+    return; // Results are late, skip this frame rather than stalling
+  }
+  glQueryCounter(query.start, GL_TIMESTAMP);
+  query.frameIdx = m_nFrameCount;
+  m_pCurrentQuery = &query;
+}
+
+void FrameTimeline::endFrame()
+{
+  auto &frame = m_frames[m_nFrameCount % CAPACITY];
+  frame.cpuTime = float(1000. * (getCPUTime() - frame.cpuStart));
+  if (m_pCurrentQuery) {
+    glQueryCounter(m_pCurrentQuery->end, GL_TIMESTAMP);
+    m_pCurrentQuery->isPending = true;
+    m_pCurrentQuery = nullptr;
+  }
+  ++m_nFrameCount;
+}
+
+double FrameTimeline::getCPUTime() const
+{
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - m_cpuOrigin)
+      .count();
+}
+
+void FrameTimeline::collectQueries()
+{
+  for (size_t i = 0; i < QUERY_LATENCY; ++i) {
+    auto &query = m_queries[(m_nFrameCount + i) % QUERY_LATENCY];
+    if (!query.isPending) {
+      continue;
+    }
+    GLint isAvailable = GL_FALSE;
+    glGetQueryObjectiv(query.end, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+    if (!isAvailable) {
+      break;
+    }
+    GLuint64 start = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(query.start, GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &end);
+    auto &frame = m_frames[query.frameIdx % CAPACITY];
+    frame.gpuStart = double(GLint64(start) - m_gpuOrigin) * 1e-9;
+    frame.gpuTime = float(double(end - start) * 1e-6);
+    query.isPending = false;
+  }
+}
+
+FrameTimeline::Stats FrameTimeline::computeStats(float Frame::*time) const
+{
+  std::vector<float> times;
+  times.reserve(STATS_FRAME_COUNT);
+  const auto firstIdx =
+      m_nFrameCount - std::min(m_nFrameCount, STATS_FRAME_COUNT);
+  for (auto frameIdx = firstIdx; frameIdx < m_nFrameCount; ++frameIdx) {
+    const auto value = frame(frameIdx).*time;
+    if (value >= 0.f) {
+      times.push_back(value);
+    }
+  }
+
+  Stats stats;
+  if (times.empty()) {
+    return stats;
+  }
+  std::sort(begin(times), end(times));
+  const auto getPercentile = [&](double percentile) {
+    return times[std::min(times.size() - 1,
+        size_t(std::ceil(percentile * double(times.size()))) - 1)];
+  };
+  stats.frameCount = times.size();
+  stats.p50 = getPercentile(0.5);
+  stats.p95 = getPercentile(0.95);
+  stats.p99 = getPercentile(0.99);
+  stats.max = times.back();
+  stats.hitchCount = size_t(end(times) - std::upper_bound(begin(times),
+                                             end(times),
+                                             HITCH_FACTOR * stats.p50));
+  return stats;
+}
+
+FrameTimeline::Stats FrameTimeline::getCPUStats() const
+{
+  return computeStats(&Frame::cpuTime);
+}
+
+FrameTimeline::Stats FrameTimeline::getGPUStats() const
+{
+  return computeStats(&Frame::gpuTime);
+}
+
+void FrameTimeline::drawGUI() const
+{
+  const struct
+  {
+    const char *label;
+    Stats stats;
+  } rows[] = {{"CPU", getCPUStats()}, {"GPU", getGPUStats()}};
+
+  ImGui::Text("Last %zu frames, hitches over %.0fx the median",
+      std::min(m_nFrameCount, STATS_FRAME_COUNT), HITCH_FACTOR);
+  ImGui::Columns(6, "Frame time percentiles");
+  for (const auto *header : {"ms", "p50", "p95", "p99", "max", "hitches"}) {
+    ImGui::Text("%s", header);
+    ImGui::NextColumn();
+  }
+  ImGui::Separator();
+  for (const auto &row : rows) {
+    ImGui::Text("%s", row.label);
+    ImGui::NextColumn();
+    if (!row.stats.frameCount) {
+      for (size_t i = 0; i < 5; ++i) {
+        ImGui::NextColumn();
+      }
+      continue;
+    }
+    for (const auto value :
+        {row.stats.p50, row.stats.p95, row.stats.p99, row.stats.max}) {
+      ImGui::Text("%.3f", value);
+      ImGui::NextColumn();
+    }
+    ImGui::Text("%zu", row.stats.hitchCount);
+    ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+
+  // Oldest first, unmeasured GPU times at 0
+  const auto firstIdx =
+      m_nFrameCount - std::min(m_nFrameCount, STATS_FRAME_COUNT);
+  std::vector<float> cpuTimes;
+  std::vector<float> gpuTimes;
+  for (auto frameIdx = firstIdx; frameIdx < m_nFrameCount; ++frameIdx) {
+    cpuTimes.push_back(frame(frameIdx).cpuTime);
+    gpuTimes.push_back(std::max(frame(frameIdx).gpuTime, 0.f));
+  }
+  const auto maxTime = std::max(rows[0].stats.max, rows[1].stats.max);
+  ImGui::PlotLines("CPU frames", cpuTimes.data(), int(cpuTimes.size()), 0,
+      nullptr, 0.f, std::max(maxTime, 1e-3f), ImVec2(0, 60));
+  ImGui::PlotLines("GPU frames", gpuTimes.data(), int(gpuTimes.size()), 0,
+      nullptr, 0.f, std::max(maxTime, 1e-3f), ImVec2(0, 60));
+}
+
+bool FrameTimeline::write(const fs::path &path, std::string &err) const
+{
+  std::ofstream file(path.string());
+  if (!file) {
+    err = "unable to open " + path.string();
+    return false;
+  }
+
+  const auto firstIdx = m_nFrameCount - std::min(m_nFrameCount, CAPACITY);
+  if (path.extension() == ".csv") {
+    file << "frame,cpu_start_ms,cpu_ms,gpu_start_ms,gpu_ms\n";
+    for (auto frameIdx = firstIdx; frameIdx < m_nFrameCount; ++frameIdx) {
+      const auto &current = frame(frameIdx);
+      file << frameIdx << "," << 1000. * current.cpuStart << ","
+           << current.cpuTime << ",";
+      if (current.gpuTime >= 0.f) {
+        file << 1000. * current.gpuStart << "," << current.gpuTime;
+      } else {
+        file << ",";
+      }
+      file << "\n";
+    }
+  } else {
+    // Complete events in microseconds, on one track per processor
+    auto events = nlohmann::json::array();
+    for (const auto &track : {std::make_pair(1, "CPU"), {2, "GPU"}}) {
+      events.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1},
+          {"tid", track.first}, {"args", {{"name", track.second}}}});
+    }
+    for (auto frameIdx = firstIdx; frameIdx < m_nFrameCount; ++frameIdx) {
+      const auto &current = frame(frameIdx);
+      const auto name = "Frame " + std::to_string(frameIdx);
+      events.push_back({{"name", name}, {"ph", "X"}, {"pid", 1}, {"tid", 1},
+          {"ts", 1e6 * current.cpuStart}, {"dur", 1e3 * current.cpuTime}});
+      if (current.gpuTime >= 0.f) {
+        events.push_back({{"name", name}, {"ph", "X"}, {"pid", 1},
+            {"tid", 2}, {"ts", 1e6 * current.gpuStart},
+            {"dur", 1e3 * current.gpuTime}});
+      }
+    }
+    file << nlohmann::json{{"traceEvents", events},
+        {"displayTimeUnit", "ms"}}.dump();
+  }
+
+  if (!file) {
+    err = "unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <glad/glad.h>
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Timeline of the frames of the window, for their distribution rather than
+// the average: percentiles of frame times and hitches, and an export of the
+// whole timeline.
+//
+// CPU times go from beginFrame() to endFrame(). GPU times are measured
+// between GL_TIMESTAMP queries placed by the same calls, which unlike the
+// GL_TIME_ELAPSED queries of Profiler can surround its scopes. Like for
+// Profiler, QUERY_LATENCY query pairs are used in turn and only read when
+// available, a frame being left unmeasured rather than stalling.
+//
+// Frames are kept in a ring of CAPACITY frames, written in place: recording
+// a frame never allocates.
+class FrameTimeline
+{
+public:
+  // About 18 minutes at 60 frames per second
+  static constexpr size_t CAPACITY = size_t(1) << 16;
+  static const size_t QUERY_LATENCY = 4;
+  // Number of the last frames the statistics are computed on
+  static constexpr size_t STATS_FRAME_COUNT = 600;
+  // Frames taking longer than the median times this are hitches
+  static constexpr float HITCH_FACTOR = 2.f;
+
+  struct Frame
+  {
+    // Seconds since the timeline was created, GPU ones converted to the
+    // CPU clock
+    double cpuStart = 0.;
+    double gpuStart = 0.;
+    // In milliseconds, negative if not measured
+    float cpuTime = -1.f;
+    float gpuTime = -1.f;
+  };
+
+  // Of the frame times of the last STATS_FRAME_COUNT frames, in
+  // milliseconds
+  struct Stats
+  {
+    size_t frameCount = 0; // Measured frames, 0 if none
+    float p50 = 0.f;
+    float p95 = 0.f;
+    float p99 = 0.f;
+    float max = 0.f;
+    size_t hitchCount = 0;
+  };
+
+  FrameTimeline();
+
+  ~FrameTimeline();
+
+  FrameTimeline(const FrameTimeline &) = delete;
+  FrameTimeline &operator=(const FrameTimeline &) = delete;
+
+  // Called before the first and after the last GL commands of a frame (after
+  // swapping buffers)
+  void beginFrame();
+  void endFrame();
+
+  // Number of frames recorded, the last min(frameCount(), CAPACITY) are
+  // kept
+  size_t frameCount() const { return m_nFrameCount; }
+
+  Stats getCPUStats() const;
+  Stats getGPUStats() const;
+
+  // Draw the statistics and a graph of the last frames in the current ImGui
+  // window
+  void drawGUI() const;
+
+  // Write the kept frames in a .csv file, one line per frame, or a Chrome
+  // trace .json file (any other extension) with CPU and GPU tracks, viewed
+  // with chrome://tracing or Perfetto
+  bool write(const fs::path &path, std::string &err) const;
+
+private:
+  struct QueryPair
+  {
+    GLuint start = 0;
+    GLuint end = 0;
+    size_t frameIdx = 0;
+    bool isPending = false;
+  };
+
+  const Frame &frame(size_t frameIdx) const
+  {
+    return m_frames[frameIdx % CAPACITY];
+  }
+
+  // Seconds since the creation of the timeline
+  double getCPUTime() const;
+
+  // Read the available results of query pairs, oldest first
+  void collectQueries();
+
+  Stats computeStats(float Frame::*time) const;
+
+  std::vector<Frame> m_frames;
+  size_t m_nFrameCount = 0;
+  std::chrono::steady_clock::time_point m_cpuOrigin;
+  GLint64 m_gpuOrigin = 0; // GL_TIMESTAMP at creation, in nanoseconds
+  std::array<QueryPair, QUERY_LATENCY> m_queries;
+  QueryPair *m_pCurrentQuery = nullptr; // Of the frame begun, if any
+};
@@ -0,0 +1,31 @@
+#include "frustum.hpp"
+
+Frustum extractFrustum(const glm::mat4 &viewProjMatrix)
+{
+  // Planes are combinations of the rows of the matrix (Gribb and Hartmann),
+  // -w <= x, y, z <= w in clip space
+  const auto m = glm::transpose(viewProjMatrix);
+  Frustum frustum;
+  frustum.planes[0] = m[3] + m[0];
+  frustum.planes[1] = m[3] - m[0];
+  frustum.planes[2] = m[3] + m[1];
+  frustum.planes[3] = m[3] - m[1];
+  frustum.planes[4] = m[3] + m[2];
+  frustum.planes[5] = m[3] - m[2];
+  return frustum;
+}
+
+bool intersectsBox(const Frustum &frustum, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax)
+{
+  for (const auto &plane : frustum.planes) {
+    // Corner of the box the furthest along the plane normal
+    const auto corner = glm::vec3(plane.x >= 0.f ? bboxMax.x : bboxMin.x,
+        plane.y >= 0.f ? bboxMax.y : bboxMin.y,
+        plane.z >= 0.f ? bboxMax.z : bboxMin.z);
+    if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.f) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// View frustum given by its 6 planes (left, right, bottom, top, near, far).
+// A point p is inside the frustum if dot(plane, vec4(p, 1)) >= 0 for every
+// plane.
+struct Frustum
+{
+  glm::vec4 planes[6];
+};
+
+// Frustum of the clip space box [-1, 1]^3 of viewProjMatrix, in the space
+// transformed by viewProjMatrix (eg. world space for projMatrix * viewMatrix)
+Frustum extractFrustum(const glm::mat4 &viewProjMatrix);
+
+// Return false if the box [bboxMin, bboxMax] is completely outside of one of
+// the planes of frustum. The test is conservative: boxes crossing the corner
+// of two planes can be kept while being outside.
+bool intersectsBox(const Frustum &frustum, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax);
@@ -0,0 +1,159 @@
+#include "gbuffer.hpp"
+#include "target_capacity.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+
+// local_size of deferred_lighting.cs.glsl
+const size_t LIGHTING_TILE_SIZE = 16;
+
+GLuint getDispatchSize(size_t size)
+{
+  return GLuint((size + LIGHTING_TILE_SIZE - 1) / LIGHTING_TILE_SIZE);
+}
+
+} // namespace
+
+void GBuffer::begin()
+{
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_drawFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, m_viewport);
+  const auto width = size_t(std::max(m_viewport[2], 1));
+  const auto height = size_t(std::max(m_viewport[3], 1));
+  const auto capacityWidth = getTargetCapacity(width, m_nCapacityWidth);
+  const auto capacityHeight = getTargetCapacity(height, m_nCapacityHeight);
+  if (capacityWidth != m_nCapacityWidth ||
+      capacityHeight != m_nCapacityHeight) {
+    allocate(capacityWidth, capacityHeight);
+  }
+  m_nWidth = width;
+  m_nHeight = height;
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer.glId());
+  glViewport(0, 0, GLsizei(width), GLsizei(height));
+  GLfloat clearColor[4];
+  GLfloat clearDepth = 1.f;
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+  glGetFloatv(GL_DEPTH_CLEAR_VALUE, &clearDepth);
+  const GLfloat zero[4] = {};
+  glClearBufferfv(GL_COLOR, 0, zero);
+  glClearBufferfv(GL_COLOR, 1, zero);
+  glClearBufferfv(GL_COLOR, 2, clearColor);
+  glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+}
+
+void GBuffer::shade(
+    const GLProgram &lightingProgram, const glm::mat4 &projMatrix)
+{
+  lightingProgram.use();
+  lightingProgram.getUniform<glm::mat4>("uInvProjMatrix")
+      .set(glm::inverse(projMatrix));
+  lightingProgram.getUniform<glm::vec2>("uSize").set(
+      glm::vec2(float(m_nWidth), float(m_nHeight)));
+  const GLuint textures[] = {m_baseColorMetallic.glId(),
+      m_normalRoughness.glId(), m_radiance.glId(), m_depth.glId()};
+  for (GLuint unit = 0; unit < 4; ++unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, textures[unit]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindImageTexture(
+      0, m_litImage.glId(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+  glDispatchCompute(getDispatchSize(m_nWidth), getDispatchSize(m_nHeight), 1);
+  glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+  for (GLuint unit = 0; unit < 4; ++unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  const auto x0 = m_viewport[0];
+  const auto y0 = m_viewport[1];
+  GLFramebuffer::blit(m_litFramebuffer.glId(), GLuint(m_drawFramebuffer), 0,
+      0, GLint(m_nWidth), GLint(m_nHeight), x0, y0, x0 + GLint(m_nWidth),
+      y0 + GLint(m_nHeight), GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(m_drawFramebuffer));
+  glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+}
+
+void GBuffer::beginVisibility()
+{
+  if (!m_visibility.glId()) {
+    m_visibility = GLTexture(1, GL_RG32UI, GLsizei(m_nCapacityWidth),
+        GLsizei(m_nCapacityHeight));
+    m_visibilityFramebuffer = GLFramebuffer::create();
+    m_visibilityFramebuffer.attachTexture(
+        GL_COLOR_ATTACHMENT0, m_visibility.glId());
+    m_visibilityFramebuffer.attachTexture(
+        GL_DEPTH_ATTACHMENT, m_depth.glId());
+    m_visibilityFramebuffer.setDrawBuffer(GL_COLOR_ATTACHMENT0);
+    assert(m_visibilityFramebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+    m_emptyVertexArray = GLVertexArray::create();
+  }
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_visibilityFramebuffer.glId());
+  const GLuint noDraw[4] = {~GLuint(0), ~GLuint(0), 0, 0};
+  glClearBufferuiv(GL_COLOR, 0, noDraw);
+}
+
+void GBuffer::resolveVisibility(const GLProgram &resolveProgram)
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer.glId());
+  GLboolean isDepthTested = GL_FALSE;
+  glGetBooleanv(GL_DEPTH_TEST, &isDepthTested);
+  glDisable(GL_DEPTH_TEST);
+  resolveProgram.use();
+  resolveProgram.getUniform<glm::vec2>("uSize").set(
+      glm::vec2(float(m_nWidth), float(m_nHeight)));
+  glBindImageTexture(
+      0, m_visibility.glId(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32UI);
+  m_emptyVertexArray.bind();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32UI);
+  if (isDepthTested) {
+    glEnable(GL_DEPTH_TEST);
+  }
+}
+
+void GBuffer::allocate(size_t width, size_t height)
+{
+  m_nCapacityWidth = width;
+  m_nCapacityHeight = height;
+  const auto w = GLsizei(width);
+  const auto h = GLsizei(height);
+  m_baseColorMetallic = GLTexture(1, GL_RGBA8, w, h);
+  m_normalRoughness = GLTexture(1, GL_RGB10_A2, w, h);
+  m_radiance = GLTexture(1, GL_R11F_G11F_B10F, w, h);
+  m_depth = GLTexture(1, GL_DEPTH_COMPONENT32F, w, h);
+  m_litImage = GLTexture(1, GL_RGBA8, w, h);
+  // Only read with texelFetch
+  for (const auto *texture :
+      {&m_baseColorMetallic, &m_normalRoughness, &m_radiance, &m_depth}) {
+    texture->setParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    texture->setParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+
+  m_framebuffer = GLFramebuffer::create();
+  m_framebuffer.attachTexture(
+      GL_COLOR_ATTACHMENT0, m_baseColorMetallic.glId());
+  m_framebuffer.attachTexture(GL_COLOR_ATTACHMENT1, m_normalRoughness.glId());
+  m_framebuffer.attachTexture(GL_COLOR_ATTACHMENT2, m_radiance.glId());
+  m_framebuffer.attachTexture(GL_DEPTH_ATTACHMENT, m_depth.glId());
+  const GLenum drawBuffers[] = {
+      GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+  m_framebuffer.setDrawBuffers(3, drawBuffers);
+  assert(m_framebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+
+  m_litFramebuffer = GLFramebuffer::create();
+  m_litFramebuffer.attachTexture(GL_COLOR_ATTACHMENT0, m_litImage.glId());
+  m_litFramebuffer.setReadBuffer(GL_COLOR_ATTACHMENT0);
+
+  // Reallocated at this size by the next beginVisibility
+  m_visibility = GLTexture();
+  m_visibilityFramebuffer = GLFramebuffer();
+}
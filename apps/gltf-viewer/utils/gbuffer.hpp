@@ -0,0 +1,94 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// G-buffer of deferred shading: the scene programs draw the surface seen by
+// each pixel in compact attachments (see gbuffer.glsl), then a tiled compute
+// pass (deferred_lighting.cs.glsl) lights every pixel once:
+// - GL_RGBA8: base color, metallic,
+// - GL_RGB10_A2: octahedral view space normal, roughness,
+// - GL_R11F_G11F_B10F: radiance not coming from punctual lights (emissive
+// and ambient), cleared to the clear color of the caller,
+// - GL_DEPTH_COMPONENT32F: depth, from which view positions are
+// reconstructed.
+// 16 bytes per pixel.
+//
+// The lit image is copied into the draw framebuffer that was bound before
+// begin(), which is bound again, so that callers such as renderToImage see
+// their framebuffer unchanged.
+//
+// With visibility buffer rendering, the scene programs only write the draw
+// and triangle of each pixel in a GL_RG32UI attachment sharing the depth
+// (see beginVisibility), then resolveVisibility() writes the other
+// attachments once per pixel.
+class GBuffer
+{
+public:
+  GBuffer() = default;
+
+  // Non-copyable class:
+  GBuffer(const GBuffer &) = delete;
+  GBuffer &operator=(const GBuffer &) = delete;
+
+  GBuffer(GBuffer &&) = default;
+  GBuffer &operator=(GBuffer &&) = default;
+
+  // Remember the draw framebuffer and the viewport, bind the G-buffer and
+  // clear it. The viewport moves to the origin of the G-buffer. The
+  // attachments are reallocated when the viewport outgrows them, in the
+  // growth buckets of getTargetCapacity.
+  void begin();
+
+  // Light the G-buffer with lightingProgram (deferred_lighting.cs.glsl),
+  // reading the lights bound by LightClusters::update, with the projection
+  // the scene was drawn with. The result is copied in the viewport of the
+  // framebuffer bound before begin(), which is bound again. The program and
+  // the texture bindings of units 0 to 3 are not restored.
+  void shade(const GLProgram &lightingProgram, const glm::mat4 &projMatrix);
+
+  // After begin(), bind a framebuffer of the visibility attachment and the
+  // depth of the G-buffer, and clear the attachment to ~0 (no draw). The
+  // attachment is only allocated once this is called.
+  void beginVisibility();
+
+  // Draw resolveProgram (fullscreen.vs.glsl and visibility_resolve.fs.glsl)
+  // over the viewport in the color attachments of the G-buffer, reading the
+  // visibility attachment bound to image unit 0, without depth test. The
+  // buffers of the draws must be bound (see
+  // IndirectDrawList::bindVisibilityResolve). The program is not restored.
+  void resolveVisibility(const GLProgram &resolveProgram);
+
+private:
+  // Create width x height attachments
+  void allocate(size_t width, size_t height);
+
+  // Of the viewport of begin()
+  size_t m_nWidth = 0;
+  size_t m_nHeight = 0;
+  // Of the attachments
+  size_t m_nCapacityWidth = 0;
+  size_t m_nCapacityHeight = 0;
+
+  // Saved by begin()
+  GLint m_drawFramebuffer = 0;
+  GLint m_viewport[4] = {};
+
+  GLTexture m_baseColorMetallic;
+  GLTexture m_normalRoughness;
+  GLTexture m_radiance;
+  GLTexture m_depth;
+  GLFramebuffer m_framebuffer;
+  // Written by the lighting pass, then blitted to the caller
+  GLTexture m_litImage;
+  GLFramebuffer m_litFramebuffer;
+  // Allocated by beginVisibility
+  GLTexture m_visibility;
+  GLFramebuffer m_visibilityFramebuffer;
+  GLVertexArray m_emptyVertexArray; // Of the resolve triangle
+};
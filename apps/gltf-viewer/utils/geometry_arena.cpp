@@ -0,0 +1,961 @@
+#include "geometry_arena.hpp"
+#include "hash.hpp"
+
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+
+// Columns of the two instance matrices
+const GLuint INSTANCE_MATRIX_COLUMNS = 8;
+
+// indices with each vertex replaced by the first vertex of the same position
+// (bitwise equal, -0 and 0 are distinct), in out
+void remapToFirstPositions(const float *positions, size_t vertexCount,
+    const uint32_t *indices, size_t indexCount, std::vector<uint32_t> &out)
+{
+  using Position = std::array<uint32_t, 3>;
+  struct PositionHash
+  {
+    size_t operator()(const Position &position) const
+    {
+      return size_t(fnv1a64(position.data(), sizeof(Position)));
+    }
+  };
+  std::unordered_map<Position, uint32_t, PositionHash> firstVertices;
+  firstVertices.reserve(vertexCount);
+  std::vector<uint32_t> remap(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    Position position;
+    std::memcpy(position.data(), positions + 3 * v, sizeof(Position));
+    remap[v] = firstVertices.emplace(position, uint32_t(v)).first->second;
+  }
+  out.resize(indexCount);
+  for (size_t i = 0; i < indexCount; ++i) {
+    out[i] = indices[i] < vertexCount ? remap[indices[i]] : indices[i];
+  }
+}
+
+// Attribute format of stream in a vertex format
+struct StreamFormat
+{
+  GLint size;
+  GLenum type;
+  GLboolean normalized;
+};
+
+StreamFormat getStreamFormat(
+    GeometryArena::Stream stream, GeometryArena::VertexFormat format)
+{
+  if (format == GeometryArena::VertexFormat::Float) {
+    return {GLint(GeometryArena::getStreamComponentCount(stream)), GL_FLOAT,
+        GL_FALSE};
+  }
+  switch (stream) {
+  case GeometryArena::POSITION:
+    return {3, GL_UNSIGNED_SHORT, GL_TRUE};
+  case GeometryArena::NORMAL:
+    return {2, GL_SHORT, GL_TRUE};
+  default:
+    return {2, GL_HALF_FLOAT, GL_FALSE};
+  }
+}
+
+// Position transform that maps the integers of an accessor of componentType
+// on the [0, 65535] range, return false if the type is not an integer type
+bool getIntegerPositionTransform(int componentType, bool normalized,
+    glm::vec3 &positionOffset, glm::vec3 &positionScale)
+{
+  float minValue = 0.f;
+  float maxValue = 0.f;
+  switch (componentType) {
+  case TINYGLTF_COMPONENT_TYPE_BYTE:
+    minValue = -128.f;
+    maxValue = 127.f;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    maxValue = 255.f;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_SHORT:
+    minValue = -32768.f;
+    maxValue = 32767.f;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    maxValue = 65535.f;
+    break;
+  default:
+    return false;
+  }
+  // Normalized values are the integers divided by the maximum value
+  const auto divisor = normalized ? maxValue : 1.f;
+  positionOffset = glm::vec3(minValue / divisor);
+  positionScale = glm::vec3((maxValue - minValue) / divisor);
+  return true;
+}
+
+uint16_t quantizeUnorm16(float value)
+{
+  return uint16_t(std::round(glm::clamp(value, 0.f, 1.f) * 65535.f));
+}
+
+int16_t quantizeSnorm16(float value)
+{
+  return int16_t(std::round(glm::clamp(value, -1.f, 1.f) * 32767.f));
+}
+
+// Octahedral encoding of a normal, see "A Survey of Efficient Representations
+// for Independent Unit Vectors" (Cigolle et al.)
+glm::vec2 encodeOctahedral(const glm::vec3 &normal)
+{
+  const auto l1Norm =
+      std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  if (l1Norm == 0.f) {
+    return glm::vec2(0); // Missing normals stay invalid
+  }
+  auto p = glm::vec2(normal) / l1Norm;
+  if (normal.z < 0.f) {
+    // Fold the lower hemisphere over the diagonals
+    p = (1.f - glm::abs(glm::vec2(p.y, p.x))) *
+        glm::vec2(p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f);
+  }
+  return p;
+}
+
+// Encode the vertexCount elements of stream decoded as floats in out
+void quantizeStream(GeometryArena::Stream stream, const float *values,
+    size_t vertexCount, const ArenaPrimitive &primitive, uint16_t *out)
+{
+  const auto outComponents =
+      GeometryArena::getStreamVertexSize(
+          stream, GeometryArena::VertexFormat::Quantized) /
+      sizeof(uint16_t);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    auto *element = out + v * outComponents;
+    switch (stream) {
+    case GeometryArena::POSITION: {
+      const auto p =
+          (glm::vec3(values[3 * v], values[3 * v + 1], values[3 * v + 2]) -
+              primitive.positionOffset) /
+          primitive.positionScale;
+      element[0] = quantizeUnorm16(p.x);
+      element[1] = quantizeUnorm16(p.y);
+      element[2] = quantizeUnorm16(p.z);
+      element[3] = 0;
+      break;
+    }
+    case GeometryArena::NORMAL: {
+      const auto n = encodeOctahedral(
+          glm::vec3(values[3 * v], values[3 * v + 1], values[3 * v + 2]));
+      element[0] = uint16_t(quantizeSnorm16(n.x));
+      element[1] = uint16_t(quantizeSnorm16(n.y));
+      break;
+    }
+    default:
+      element[0] = uint16_t(glm::packHalf1x16(values[2 * v]));
+      element[1] = uint16_t(glm::packHalf1x16(values[2 * v + 1]));
+      break;
+    }
+  }
+}
+
+} // namespace
+
+GeometryArena &GeometryArena::operator=(GeometryArena &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_vertexBuffers, rvalue.m_vertexBuffers);
+    std::swap(m_vertexOffsets, rvalue.m_vertexOffsets);
+    std::swap(m_heap, rvalue.m_heap);
+    std::swap(m_nHeapOwner, rvalue.m_nHeapOwner);
+    std::swap(m_heapHandles, rvalue.m_heapHandles);
+    std::swap(m_indexBuffer, rvalue.m_indexBuffer);
+    std::swap(m_memory, rvalue.m_memory);
+    std::swap(m_vertexArray, rvalue.m_vertexArray);
+    std::swap(m_positionArray, rvalue.m_positionArray);
+    std::swap(m_indexArray, rvalue.m_indexArray);
+    std::swap(m_nVertexCount, rvalue.m_nVertexCount);
+    std::swap(m_nIndexCount, rvalue.m_nIndexCount);
+    std::swap(m_vertexFormat, rvalue.m_vertexFormat);
+    std::swap(m_vertexLayout, rvalue.m_vertexLayout);
+    std::swap(m_indexType, rvalue.m_indexType);
+  }
+  return *this;
+}
+
+std::vector<ArenaPrimitive> GeometryArena::layoutPrimitives(
+    const tinygltf::Model &model, std::vector<size_t> &meshToPrimitives,
+    bool skipPointsAndLines, bool positionIndices)
+{
+  std::vector<ArenaPrimitive> primitives;
+  meshToPrimitives.clear();
+  meshToPrimitives.reserve(model.meshes.size());
+
+  GLuint vertexCount = 0;
+  GLuint indexCount = 0;
+  for (const auto &mesh : model.meshes) {
+    meshToPrimitives.push_back(primitives.size());
+    for (const auto &primitive : mesh.primitives) {
+      ArenaPrimitive arenaPrimitive;
+      arenaPrimitive.mode = GLenum(primitive.mode);
+      if (primitive.material >= 0 &&
+          size_t(primitive.material) < model.materials.size()) {
+        arenaPrimitive.materialID = GLuint(primitive.material + 1);
+      }
+
+      const auto isTriangles = arenaPrimitive.mode == GL_TRIANGLES ||
+                               arenaPrimitive.mode == GL_TRIANGLE_STRIP ||
+                               arenaPrimitive.mode == GL_TRIANGLE_FAN;
+      const auto isSkipped = skipPointsAndLines && !isTriangles;
+      const auto positionIt = primitive.attributes.find("POSITION");
+      if (!isSkipped && positionIt != end(primitive.attributes)) {
+        arenaPrimitive.vertexCount =
+            GLuint(model.accessors[(*positionIt).second].count);
+      }
+      // Non indexed primitives get sequential indices so that everything is
+      // drawn with the same kind of draw call
+      arenaPrimitive.indexCount =
+          primitive.indices >= 0 && !isSkipped
+              ? GLuint(model.accessors[primitive.indices].count)
+              : arenaPrimitive.vertexCount;
+
+      arenaPrimitive.baseVertex = GLint(vertexCount);
+      arenaPrimitive.firstIndex = indexCount;
+      arenaPrimitive.positionFirstIndex = indexCount;
+      const auto &attributes = primitive.attributes;
+      if (positionIndices && isTriangles && arenaPrimitive.indexCount &&
+          (attributes.count("NORMAL") || attributes.count("TEXCOORD_0")) &&
+          !attributes.count("JOINTS_0") && primitive.targets.empty()) {
+        arenaPrimitive.positionFirstIndex += arenaPrimitive.indexCount;
+      }
+      vertexCount += arenaPrimitive.vertexCount;
+      indexCount += arenaPrimitive.storedIndexCount();
+
+      primitives.push_back(arenaPrimitive);
+    }
+  }
+
+  return primitives;
+}
+
+void GeometryArena::computePositionQuantization(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const std::vector<size_t> &meshToPrimitives,
+    std::vector<ArenaPrimitive> &primitives)
+{
+  std::vector<float> positions;
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    const auto &mesh = model.meshes[meshIdx];
+    std::vector<const tinygltf::Accessor *> accessors;
+    for (const auto &primitive : mesh.primitives) {
+      const auto it = primitive.attributes.find("POSITION");
+      if (it != end(primitive.attributes)) {
+        accessors.push_back(&model.accessors[it->second]);
+      }
+    }
+    if (accessors.empty()) {
+      continue;
+    }
+
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+    const auto isSameType = std::all_of(
+        begin(accessors), end(accessors), [&](const tinygltf::Accessor *a) {
+          return a->componentType == accessors[0]->componentType &&
+                 a->normalized == accessors[0]->normalized;
+        });
+    if (!isSameType ||
+        !getIntegerPositionTransform(accessors[0]->componentType,
+            accessors[0]->normalized, positionOffset, positionScale)) {
+      // Bounds of the mesh, from accessors min/max if they are all known
+      auto bboxMin = glm::vec3(std::numeric_limits<float>::max());
+      auto bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+      for (const auto accessor : accessors) {
+        if (accessor->minValues.size() == 3 &&
+            accessor->maxValues.size() == 3) {
+          for (glm::length_t c = 0; c < 3; ++c) {
+            bboxMin[c] = std::min(bboxMin[c], float(accessor->minValues[c]));
+            bboxMax[c] = std::max(bboxMax[c], float(accessor->maxValues[c]));
+          }
+          continue;
+        }
+        positions.resize(3 * accessor->count);
+        readAccessorAsFloats(model, buffers, *accessor, 3, positions.data());
+        for (size_t i = 0; i < positions.size(); i += 3) {
+          const auto p = glm::make_vec3(positions.data() + i);
+          bboxMin = glm::min(bboxMin, p);
+          bboxMax = glm::max(bboxMax, p);
+        }
+      }
+      if (glm::any(glm::greaterThan(bboxMin, bboxMax))) {
+        continue; // Empty mesh
+      }
+      positionOffset = bboxMin;
+      // Flat dimensions keep a unit scale
+      positionScale = glm::max(bboxMax - bboxMin, glm::vec3(0));
+      for (glm::length_t c = 0; c < 3; ++c) {
+        if (positionScale[c] == 0.f) {
+          positionScale[c] = 1.f;
+        }
+      }
+    }
+
+    const auto firstPrimitive = meshToPrimitives[meshIdx];
+    for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+      primitives[firstPrimitive + pIdx].positionOffset = positionOffset;
+      primitives[firstPrimitive + pIdx].positionScale = positionScale;
+    }
+  }
+}
+
+GLenum GeometryArena::getIndexType(
+    const std::vector<ArenaPrimitive> &primitives)
+{
+  const auto fitsInShorts = std::all_of(begin(primitives), end(primitives),
+      [](const ArenaPrimitive &primitive) {
+        return primitive.vertexCount <= 65536;
+      });
+  return fitsInShorts ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+void GeometryArena::allocate(size_t vertexCount, size_t indexCount,
+    VertexFormat format, GLenum indexType, VertexLayout layout)
+{
+  release();
+
+  // Avoid zero sized buffers which are invalid for glBufferStorage
+  vertexCount = std::max(vertexCount, size_t(1));
+  indexCount = std::max(indexCount, size_t(1));
+
+  glGenBuffers(1, &m_indexBuffer);
+  m_vertexArray = GLVertexArray::create();
+
+  m_indexType = indexType;
+  size_t byteCount = indexCount * indexSize();
+  m_vertexArray.bind();
+  // The binding index of a buffer is the location of the stream owning it
+  for (size_t i = 0; i < STREAM_COUNT; ++i) {
+    const auto stream = Stream(i);
+    const auto vertexSize = getBufferVertexSize(stream, format, layout);
+    const auto streamFormat = getStreamFormat(stream, format);
+
+    if (vertexSize && m_heap) {
+      m_heapHandles[i] =
+          m_heap->allocate(vertexCount * vertexSize, m_nHeapOwner);
+    }
+    if (m_heapHandles[i] != GeometryHeap::NO_HANDLE) {
+      const auto range = m_heap->range(m_heapHandles[i]);
+      m_vertexBuffers[i] = range.buffer;
+      m_vertexOffsets[i] = range.offset;
+    } else if (vertexSize) {
+      glGenBuffers(1, &m_vertexBuffers[i]);
+      glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffers[i]);
+      glBufferStorage(GL_ARRAY_BUFFER, vertexCount * vertexSize, nullptr,
+          GL_DYNAMIC_STORAGE_BIT);
+      byteCount += vertexCount * vertexSize;
+    }
+
+    glEnableVertexAttribArray(GLuint(i));
+    glVertexAttribFormat(GLuint(i), streamFormat.size, streamFormat.type,
+        streamFormat.normalized,
+        GLuint(getStreamOffset(stream, format, layout)));
+    glVertexAttribBinding(GLuint(i), GLuint(getBufferStream(stream, layout)));
+  }
+
+  // The draw id buffer is bound later, only by indirect draws
+  glVertexAttribIFormat(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, 0);
+  glVertexAttribBinding(DRAW_ID_LOCATION, DRAW_ID_LOCATION);
+  glVertexBindingDivisor(DRAW_ID_LOCATION, 1);
+  // Same for the instance buffer, only bound by instanced draws. Its binding
+  // index is its first location.
+  for (GLuint i = 0; i < INSTANCE_MATRIX_COLUMNS; ++i) {
+    glVertexAttribFormat(INSTANCE_TRANSFORM_LOCATION + i, 4, GL_FLOAT,
+        GL_FALSE, i * sizeof(glm::vec4));
+    glVertexAttribBinding(
+        INSTANCE_TRANSFORM_LOCATION + i, INSTANCE_TRANSFORM_LOCATION);
+  }
+  glVertexBindingDivisor(INSTANCE_TRANSFORM_LOCATION, 1);
+  // Same for the material id buffer, only bound by indirect draws
+  glVertexAttribIFormat(MATERIAL_ID_LOCATION, 1, GL_UNSIGNED_INT, 0);
+  glVertexAttribBinding(MATERIAL_ID_LOCATION, MATERIAL_ID_LOCATION);
+  glVertexBindingDivisor(MATERIAL_ID_LOCATION, 1);
+  // Same for the skin buffer, only bound by skinned scenes. Its binding index
+  // is the joints location.
+  glVertexAttribIFormat(SKIN_JOINTS_LOCATION, 4, GL_UNSIGNED_SHORT, 0);
+  glVertexAttribBinding(SKIN_JOINTS_LOCATION, SKIN_JOINTS_LOCATION);
+  glVertexAttribFormat(SKIN_WEIGHTS_LOCATION, 4, GL_UNSIGNED_SHORT, GL_TRUE,
+      4 * sizeof(uint16_t));
+  glVertexAttribBinding(SKIN_WEIGHTS_LOCATION, SKIN_JOINTS_LOCATION);
+
+  // Whole words, so that shaders reading 16-bit indices as words stay in the
+  // buffer
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+  glBufferStorage(GL_ELEMENT_ARRAY_BUFFER,
+      (indexCount * indexSize() + 3) / 4 * 4, nullptr,
+      GL_DYNAMIC_STORAGE_BIT);
+  m_memory = TrackedGLMemory(GLMemoryCategory::Geometry, byteCount);
+
+  // Positions only, with the same skin attributes and indices
+  m_positionArray = GLVertexArray::create();
+  m_positionArray.bind();
+  const auto positionFormat = getStreamFormat(POSITION, format);
+  glEnableVertexAttribArray(POSITION);
+  glVertexAttribFormat(POSITION, positionFormat.size, positionFormat.type,
+      positionFormat.normalized, 0);
+  glVertexAttribBinding(POSITION, POSITION);
+  glVertexAttribIFormat(SKIN_JOINTS_LOCATION, 4, GL_UNSIGNED_SHORT, 0);
+  glVertexAttribBinding(SKIN_JOINTS_LOCATION, SKIN_JOINTS_LOCATION);
+  glVertexAttribFormat(SKIN_WEIGHTS_LOCATION, 4, GL_UNSIGNED_SHORT, GL_TRUE,
+      4 * sizeof(uint16_t));
+  glVertexAttribBinding(SKIN_WEIGHTS_LOCATION, SKIN_JOINTS_LOCATION);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+
+  // Indices only, vertices are pulled from the streams
+  m_indexArray = GLVertexArray::create();
+  m_indexArray.bind();
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  m_nVertexCount = vertexCount;
+  m_nIndexCount = indexCount;
+  m_vertexFormat = format;
+  m_vertexLayout = layout;
+  bindVertexBuffers();
+}
+
+void GeometryArena::updateHeapRanges()
+{
+  for (size_t i = 0; i < STREAM_COUNT; ++i) {
+    if (m_heapHandles[i] != GeometryHeap::NO_HANDLE) {
+      const auto range = m_heap->range(m_heapHandles[i]);
+      m_vertexBuffers[i] = range.buffer;
+      m_vertexOffsets[i] = range.offset;
+    }
+  }
+  bindVertexBuffers();
+}
+
+void GeometryArena::bindVertexBuffers()
+{
+  // The binding index of a buffer is the location of the stream owning it
+  m_vertexArray.bind();
+  for (size_t i = 0; i < STREAM_COUNT; ++i) {
+    if (m_vertexBuffers[i]) {
+      glBindVertexBuffer(GLuint(i), m_vertexBuffers[i],
+          GLintptr(m_vertexOffsets[i]),
+          GLsizei(bufferVertexSize(Stream(i))));
+    }
+  }
+  m_positionArray.bind();
+  glBindVertexBuffer(POSITION, m_vertexBuffers[POSITION],
+      GLintptr(m_vertexOffsets[POSITION]),
+      GLsizei(bufferVertexSize(POSITION)));
+  glBindVertexArray(0);
+}
+
+void GeometryArena::allocate(const std::vector<ArenaPrimitive> &primitives,
+    size_t extraIndexCount, VertexFormat format, VertexLayout layout)
+{
+  size_t vertexCount = 0;
+  size_t indexCount = extraIndexCount;
+  for (const auto &primitive : primitives) {
+    vertexCount += primitive.vertexCount;
+    indexCount += primitive.storedIndexCount();
+  }
+  allocate(vertexCount, indexCount, format, getIndexType(primitives), layout);
+}
+
+size_t GeometryArena::getPrimitiveByteSize(
+    const ArenaPrimitive &arenaPrimitive, PrimitiveParts parts) const
+{
+  const auto vertexBytes =
+      arenaPrimitive.vertexCount * getVertexSize(m_vertexFormat);
+  const auto indexBytes = arenaPrimitive.storedIndexCount() * indexSize();
+  switch (parts) {
+  case PrimitiveParts::Vertices:
+    return vertexBytes;
+  case PrimitiveParts::Indices:
+    return indexBytes;
+  default:
+    return vertexBytes + indexBytes;
+  }
+}
+
+void GeometryArena::decodePrimitive(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const tinygltf::Primitive &primitive, const ArenaPrimitive &arenaPrimitive,
+    const std::vector<uint32_t> *indices,
+    const std::vector<uint32_t> *vertexRemap, void *data,
+    PrimitiveParts parts) const
+{
+  // Nothing to decode for primitives skipped by layoutPrimitives
+  if (!arenaPrimitive.vertexCount && !arenaPrimitive.indexCount) {
+    return;
+  }
+  auto out = static_cast<unsigned char *>(data);
+  const auto isRemapped =
+      vertexRemap && vertexRemap->size() == arenaPrimitive.vertexCount;
+
+  const auto hasPositionIndices = arenaPrimitive.hasPositionIndices();
+  const auto writesVertices = parts != PrimitiveParts::Indices;
+  const auto writesIndices = parts != PrimitiveParts::Vertices;
+
+  std::vector<float> vertexData;
+  std::vector<float> remappedData;
+  std::vector<float> positions; // Kept for the position indices
+  // Interleaved streams are encoded apart, then written together
+  std::array<std::vector<unsigned char>, STREAM_COUNT> encodedStreams;
+  for (size_t i = 0; i < STREAM_COUNT; ++i) {
+    const auto stream = Stream(i);
+    const auto componentCount = getStreamComponentCount(stream);
+    const auto valueCount = arenaPrimitive.vertexCount * componentCount;
+    const auto isInterleaved =
+        m_vertexLayout == VertexLayout::Interleaved && stream != POSITION;
+    const auto keepsPositions =
+        stream == POSITION && hasPositionIndices && writesIndices;
+    // Without the vertices, positions are still decoded for the position
+    // indices
+    if (!writesVertices && !keepsPositions) {
+      continue;
+    }
+
+    // Floats in their final order are decoded in place, the destination is
+    // only written to since it may be write-combined memory
+    const auto isDecodedInPlace = m_vertexFormat == VertexFormat::Float &&
+                                  !isRemapped && !isInterleaved &&
+                                  !keepsPositions && writesVertices;
+    auto values = reinterpret_cast<float *>(out);
+    if (!isDecodedInPlace) {
+      vertexData.resize(valueCount);
+      values = vertexData.data();
+    }
+    // Missing attributes are filled with zeros so that every stream has one
+    // element per vertex
+    const auto it = primitive.attributes.find(getStreamAttributeName(stream));
+    if (it != end(primitive.attributes) &&
+        model.accessors[(*it).second].count == arenaPrimitive.vertexCount) {
+      readAccessorAsFloats(model, buffers, model.accessors[(*it).second],
+          componentCount, values);
+    } else {
+      std::fill(values, values + valueCount, 0.f);
+    }
+    if (isRemapped) {
+      remappedData.resize(valueCount);
+      for (size_t v = 0; v < vertexRemap->size(); ++v) {
+        std::copy_n(values + v * componentCount, componentCount,
+            remappedData.data() + (*vertexRemap)[v] * componentCount);
+      }
+      std::swap(vertexData, remappedData);
+      values = vertexData.data();
+    }
+    if (keepsPositions) {
+      positions.assign(values, values + valueCount);
+    }
+    if (!writesVertices) {
+      continue;
+    }
+
+    const auto vertexSize = getStreamVertexSize(stream, m_vertexFormat);
+    const auto byteSize = arenaPrimitive.vertexCount * vertexSize;
+    auto encoded = out;
+    if (isInterleaved) {
+      encodedStreams[i].resize(byteSize);
+      encoded = encodedStreams[i].data();
+    }
+    if (m_vertexFormat == VertexFormat::Quantized) {
+      quantizeStream(stream, values, arenaPrimitive.vertexCount,
+          arenaPrimitive, reinterpret_cast<uint16_t *>(encoded));
+    } else if (!isDecodedInPlace) {
+      std::memcpy(encoded, values, byteSize);
+    }
+    if (!isInterleaved) {
+      out += byteSize;
+    }
+  }
+  if (m_vertexLayout == VertexLayout::Interleaved && writesVertices) {
+    const auto normalSize = getStreamVertexSize(NORMAL, m_vertexFormat);
+    const auto texCoordsSize = getStreamVertexSize(TEXCOORD_0, m_vertexFormat);
+    for (size_t v = 0; v < arenaPrimitive.vertexCount; ++v) {
+      std::memcpy(out, encodedStreams[NORMAL].data() + v * normalSize,
+          normalSize);
+      out += normalSize;
+      std::memcpy(out, encodedStreams[TEXCOORD_0].data() + v * texCoordsSize,
+          texCoordsSize);
+      out += texCoordsSize;
+    }
+  }
+
+  if (!writesIndices) {
+    return;
+  }
+
+  // 32-bit indices are decoded in place, narrower ones and the ones position
+  // indices are computed from go through a copy
+  std::vector<uint32_t> decodedIndices;
+  const uint32_t *finalIndices = nullptr;
+  if (indices && indices->size() == arenaPrimitive.indexCount) {
+    out += encodeIndices(indices->data(), indices->size(), out);
+    finalIndices = indices->data();
+  } else {
+    auto outIndices = reinterpret_cast<uint32_t *>(out);
+    if (m_indexType != GL_UNSIGNED_INT || hasPositionIndices) {
+      decodedIndices.resize(arenaPrimitive.indexCount);
+      outIndices = decodedIndices.data();
+    }
+    if (primitive.indices >= 0) {
+      readAccessorAsUints(
+          model, buffers, model.accessors[primitive.indices], outIndices);
+    } else {
+      std::iota(outIndices, outIndices + arenaPrimitive.indexCount, 0);
+    }
+    if (!decodedIndices.empty()) {
+      encodeIndices(decodedIndices.data(), decodedIndices.size(), out);
+    }
+    out += arenaPrimitive.indexCount * indexSize();
+    finalIndices = outIndices;
+  }
+
+  if (hasPositionIndices) {
+    std::vector<uint32_t> positionIndices;
+    remapToFirstPositions(positions.data(), arenaPrimitive.vertexCount,
+        finalIndices, arenaPrimitive.indexCount, positionIndices);
+    encodeIndices(positionIndices.data(), positionIndices.size(), out);
+  }
+}
+
+void GeometryArena::copyPrimitive(GLuint buffer, size_t offset,
+    const ArenaPrimitive &arenaPrimitive, PrimitiveParts parts)
+{
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  for (size_t i = 0; i < STREAM_COUNT && parts != PrimitiveParts::Indices;
+       ++i) {
+    const auto vertexSize = bufferVertexSize(Stream(i));
+    const auto byteSize = arenaPrimitive.vertexCount * vertexSize;
+    if (!byteSize) {
+      continue;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_vertexBuffers[i]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+        GLintptr(offset),
+        GLintptr(m_vertexOffsets[i] + arenaPrimitive.baseVertex * vertexSize),
+        GLsizeiptr(byteSize));
+    offset += byteSize;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  // Position indices follow the other ones
+  if (parts != PrimitiveParts::Vertices) {
+    copyIndices(buffer, offset, arenaPrimitive.firstIndex,
+        arenaPrimitive.storedIndexCount());
+  }
+}
+
+void GeometryArena::copyIndices(
+    GLuint buffer, size_t offset, size_t firstIndex, size_t indexCount)
+{
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_indexBuffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+      GLintptr(offset), GLintptr(firstIndex * indexSize()),
+      GLsizeiptr(indexCount * indexSize()));
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void GeometryArena::copyPrimitive(const GeometryArena &source,
+    const ArenaPrimitive &sourcePrimitive,
+    const ArenaPrimitive &arenaPrimitive)
+{
+  for (size_t i = 0; i < STREAM_COUNT; ++i) {
+    const auto vertexSize = bufferVertexSize(Stream(i));
+    if (!vertexSize) {
+      continue;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, source.m_vertexBuffers[i]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_vertexBuffers[i]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+        GLintptr(source.m_vertexOffsets[i] +
+                 sourcePrimitive.baseVertex * vertexSize),
+        GLintptr(m_vertexOffsets[i] + arenaPrimitive.baseVertex * vertexSize),
+        GLsizeiptr(arenaPrimitive.vertexCount * vertexSize));
+  }
+  // Indices are relative to the base vertex
+  copyIndices(source.m_indexBuffer,
+      sourcePrimitive.firstIndex * source.indexSize(),
+      arenaPrimitive.firstIndex, arenaPrimitive.storedIndexCount());
+}
+
+bool GeometryArena::copyPinnedPrimitive(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const std::vector<PinnedMemory> &pins,
+    const tinygltf::Primitive &primitive, const ArenaPrimitive &arenaPrimitive)
+{
+  if (m_vertexFormat != VertexFormat::Float ||
+      m_vertexLayout != VertexLayout::Separate ||
+      arenaPrimitive.hasPositionIndices() || primitive.indices < 0 ||
+      !arenaPrimitive.vertexCount) {
+    return false;
+  }
+  const auto findPin = [&](const unsigned char *data,
+                           size_t size) -> const PinnedMemory * {
+    for (const auto &pin : pins) {
+      if (pin.contains(data, size)) {
+        return &pin;
+      }
+    }
+    return nullptr;
+  };
+
+  // Pinned memory of each stream then of the indices, null for missing
+  // streams
+  std::array<const PinnedMemory *, STREAM_COUNT + 1> sourcePins = {};
+  std::array<const unsigned char *, STREAM_COUNT + 1> sources = {};
+  for (size_t i = 0; i < STREAM_COUNT; ++i) {
+    const auto stream = Stream(i);
+    const auto it = primitive.attributes.find(getStreamAttributeName(stream));
+    if (it == end(primitive.attributes)) {
+      continue;
+    }
+    const auto &accessor = model.accessors[(*it).second];
+    const AccessorView view(model, buffers, accessor);
+    const auto vertexSize = getStreamVertexSize(stream, m_vertexFormat);
+    if (accessor.count != arenaPrimitive.vertexCount ||
+        view.componentCount() != getStreamComponentCount(stream) ||
+        !view.floatData() || view.byteStride() != vertexSize) {
+      return false;
+    }
+    sources[i] = view.floatData();
+    sourcePins[i] = findPin(sources[i], accessor.count * vertexSize);
+    if (!sourcePins[i]) {
+      return false;
+    }
+  }
+  const auto &indexAccessor = model.accessors[primitive.indices];
+  const AccessorView indexView(model, buffers, indexAccessor);
+  const auto indexComponentType = m_indexType == GL_UNSIGNED_SHORT
+                                      ? TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT
+                                      : TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+  if (indexAccessor.componentType != indexComponentType ||
+      indexAccessor.count != arenaPrimitive.indexCount ||
+      !indexView.denseData() || indexView.byteStride() != indexSize()) {
+    return false;
+  }
+  sources[STREAM_COUNT] = indexView.denseData();
+  sourcePins[STREAM_COUNT] =
+      findPin(sources[STREAM_COUNT], indexAccessor.count * indexSize());
+  if (!sourcePins[STREAM_COUNT]) {
+    return false;
+  }
+
+  for (size_t i = 0; i <= STREAM_COUNT; ++i) {
+    const auto isIndices = i == STREAM_COUNT;
+    const auto elementSize =
+        isIndices ? indexSize() : bufferVertexSize(Stream(i));
+    const auto byteSize =
+        (isIndices ? arenaPrimitive.indexCount : arenaPrimitive.vertexCount) *
+        elementSize;
+    const auto offset =
+        isIndices
+            ? arenaPrimitive.firstIndex * elementSize
+            : m_vertexOffsets[i] + arenaPrimitive.baseVertex * elementSize;
+    glBindBuffer(GL_COPY_WRITE_BUFFER,
+        isIndices ? m_indexBuffer : m_vertexBuffers[i]);
+    if (sourcePins[i]) {
+      glBindBuffer(GL_COPY_READ_BUFFER, sourcePins[i]->buffer());
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+          GLintptr(sourcePins[i]->offset(sources[i])), GLintptr(offset),
+          GLsizeiptr(byteSize));
+    } else {
+      // Zeros, as decodePrimitive fills missing attributes
+      glClearBufferSubData(GL_COPY_WRITE_BUFFER, GL_R32F, GLintptr(offset),
+          GLsizeiptr(byteSize), GL_RED, GL_FLOAT, nullptr);
+    }
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  return true;
+}
+
+size_t GeometryArena::uploadPrimitive(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const tinygltf::Primitive &primitive, const ArenaPrimitive &arenaPrimitive,
+    const std::vector<uint32_t> *indices,
+    const std::vector<uint32_t> *vertexRemap, PrimitiveParts parts)
+{
+  std::vector<unsigned char> data(getPrimitiveByteSize(arenaPrimitive, parts));
+  decodePrimitive(model, buffers, primitive, arenaPrimitive, indices,
+      vertexRemap, data.data(), parts);
+
+  size_t offset = 0;
+  for (size_t i = 0; i < STREAM_COUNT && parts != PrimitiveParts::Indices;
+       ++i) {
+    const auto vertexSize = bufferVertexSize(Stream(i));
+    const auto byteSize = arenaPrimitive.vertexCount * vertexSize;
+    if (!byteSize) {
+      continue;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_vertexBuffers[i]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+        GLintptr(m_vertexOffsets[i] + arenaPrimitive.baseVertex * vertexSize),
+        byteSize, data.data() + offset);
+    offset += byteSize;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_indexBuffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER,
+      arenaPrimitive.firstIndex * indexSize(), data.size() - offset,
+      data.data() + offset);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return data.size();
+}
+
+size_t GeometryArena::uploadIndices(
+    size_t firstIndex, const std::vector<uint32_t> &indices)
+{
+  const auto byteSize = indices.size() * indexSize();
+  const void *data = indices.data();
+  std::vector<GLushort> narrowIndices;
+  if (m_indexType != GL_UNSIGNED_INT) {
+    narrowIndices.resize(indices.size());
+    encodeIndices(indices.data(), indices.size(), narrowIndices.data());
+    data = narrowIndices.data();
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_indexBuffer);
+  glBufferSubData(
+      GL_COPY_WRITE_BUFFER, firstIndex * indexSize(), byteSize, data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return byteSize;
+}
+
+size_t GeometryArena::encodeIndices(
+    const uint32_t *indices, size_t count, void *data) const
+{
+  if (m_indexType == GL_UNSIGNED_INT) {
+    std::memcpy(data, indices, count * sizeof(GLuint));
+    return count * sizeof(GLuint);
+  }
+  // Written once in order, data may be write-combined memory
+  const auto out = static_cast<GLushort *>(data);
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = GLushort(indices[i]);
+  }
+  return count * sizeof(GLushort);
+}
+
+void GeometryArena::bindVertexStorage(bool bind) const
+{
+  for (size_t i = 0; i < STREAM_COUNT; ++i) {
+    if (bind) {
+      bindStreamStorage(VERTEX_STORAGE_BINDING + GLuint(i), Stream(i));
+    } else {
+      glBindBufferBase(
+          GL_SHADER_STORAGE_BUFFER, VERTEX_STORAGE_BINDING + GLuint(i), 0);
+    }
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDEX_STORAGE_BINDING,
+      bind ? m_indexBuffer : 0);
+}
+
+void GeometryArena::bindStreamStorage(GLuint binding, Stream stream) const
+{
+  // Vertices are indexed from the start of the range
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, m_vertexBuffers[stream],
+      GLintptr(m_vertexOffsets[stream]),
+      GLsizeiptr(m_nVertexCount * bufferVertexSize(stream)));
+}
+
+void GeometryArena::bindDrawIdBuffer(GLuint buffer) const
+{
+  m_vertexArray.bind();
+  if (buffer) {
+    glBindVertexBuffer(DRAW_ID_LOCATION, buffer, 0, sizeof(GLuint));
+    glEnableVertexAttribArray(DRAW_ID_LOCATION);
+  } else {
+    glDisableVertexAttribArray(DRAW_ID_LOCATION);
+    glBindVertexBuffer(DRAW_ID_LOCATION, 0, 0, sizeof(GLuint));
+  }
+  glBindVertexArray(0);
+}
+
+void GeometryArena::bindInstanceBuffer(GLuint buffer, size_t offset) const
+{
+  m_vertexArray.bind();
+  const auto stride = GLsizei(INSTANCE_MATRIX_COLUMNS * sizeof(glm::vec4));
+  glBindVertexBuffer(
+      INSTANCE_TRANSFORM_LOCATION, buffer, GLintptr(offset), stride);
+  for (GLuint i = 0; i < INSTANCE_MATRIX_COLUMNS; ++i) {
+    if (buffer) {
+      glEnableVertexAttribArray(INSTANCE_TRANSFORM_LOCATION + i);
+    } else {
+      glDisableVertexAttribArray(INSTANCE_TRANSFORM_LOCATION + i);
+    }
+  }
+  glBindVertexArray(0);
+}
+
+void GeometryArena::bindMaterialIdBuffer(GLuint buffer) const
+{
+  m_vertexArray.bind();
+  if (buffer) {
+    glBindVertexBuffer(MATERIAL_ID_LOCATION, buffer, 0, sizeof(GLuint));
+    glEnableVertexAttribArray(MATERIAL_ID_LOCATION);
+  } else {
+    glDisableVertexAttribArray(MATERIAL_ID_LOCATION);
+    glBindVertexBuffer(MATERIAL_ID_LOCATION, 0, 0, sizeof(GLuint));
+  }
+  glBindVertexArray(0);
+}
+
+void GeometryArena::bindSkinBuffer(GLuint buffer) const
+{
+  const auto stride = GLsizei(8 * sizeof(uint16_t));
+  for (const auto vertexArray : {&m_vertexArray, &m_positionArray}) {
+    vertexArray->bind();
+    glBindVertexBuffer(SKIN_JOINTS_LOCATION, buffer, 0, stride);
+    for (const auto location :
+        {SKIN_JOINTS_LOCATION, SKIN_WEIGHTS_LOCATION}) {
+      if (buffer) {
+        glEnableVertexAttribArray(location);
+      } else {
+        glDisableVertexAttribArray(location);
+      }
+    }
+  }
+  glBindVertexArray(0);
+}
+
+void GeometryArena::release()
+{
+  if (m_vertexArray.glId()) {
+    for (size_t i = 0; i < STREAM_COUNT; ++i) {
+      if (m_heapHandles[i] != GeometryHeap::NO_HANDLE) {
+        m_heap->free(m_heapHandles[i]);
+      } else {
+        glDeleteBuffers(1, &m_vertexBuffers[i]);
+      }
+    }
+    glDeleteBuffers(1, &m_indexBuffer);
+  }
+  m_vertexBuffers = {};
+  m_vertexOffsets = {};
+  m_heapHandles.fill(GeometryHeap::NO_HANDLE);
+  m_indexBuffer = 0;
+  m_memory = TrackedGLMemory();
+  m_vertexArray = GLVertexArray();
+  m_positionArray = GLVertexArray();
+  m_indexArray = GLVertexArray();
+  m_nVertexCount = 0;
+  m_nIndexCount = 0;
+  m_vertexFormat = VertexFormat::Float;
+  m_vertexLayout = VertexLayout::Separate;
+  m_indexType = GL_UNSIGNED_INT;
+}
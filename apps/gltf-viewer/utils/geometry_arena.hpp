@@ -0,0 +1,491 @@
+#pragma once
+
+#include "geometry_heap.hpp"
+#include "gl_objects.hpp"
+#include "gltf.hpp"
+#include "pinned_memory.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Location of the geometry of a primitive in a GeometryArena
+struct ArenaPrimitive
+{
+  GLenum mode = GL_TRIANGLES;
+  GLuint indexCount = 0;
+  // In the index buffer, in indices (see GeometryArena::indexType)
+  GLuint firstIndex = 0;
+  // First of indexCount indices stored right after the ones above, where
+  // vertices sharing a position are replaced by the first of them, for
+  // passes reading positions only (see GeometryArena::layoutPrimitives).
+  // firstIndex if the primitive has no such indices.
+  GLuint positionFirstIndex = 0;
+  GLint baseVertex = 0; // Added to each index
+  GLuint vertexCount = 0;
+  // Index of the glTF material plus one, 0 for the default material (see
+  // MaterialBuffer)
+  GLuint materialID = 0;
+  // Object space position of the stored positions p: positionOffset + p *
+  // positionScale. Stored positions are the object space ones unless the
+  // arena is quantized (see GeometryArena::computePositionQuantization).
+  glm::vec3 positionOffset = glm::vec3(0);
+  glm::vec3 positionScale = glm::vec3(1);
+
+  bool hasPositionIndices() const { return positionFirstIndex != firstIndex; }
+
+  // Indices of the primitive in the index buffer, position indices included
+  GLuint storedIndexCount() const
+  {
+    return hasPositionIndices() ? 2 * indexCount : indexCount;
+  }
+
+  // Matrix applying the transform above, to multiply model matrices with
+  // (normal matrices must be computed without it)
+  glm::mat4 positionMatrix() const
+  {
+    return glm::mat4(glm::vec4(positionScale.x, 0, 0, 0),
+        glm::vec4(0, positionScale.y, 0, 0),
+        glm::vec4(0, 0, positionScale.z, 0), glm::vec4(positionOffset, 1));
+  }
+};
+
+// Vertex and index data of every primitive of a model, sub-allocated in a few
+// large immutable buffers (one per vertex attribute stream and one for
+// indices) that share a single vertex format. A single VAO then describes the
+// whole scene, a primitive is drawn with glDrawElementsBaseVertex using its
+// ArenaPrimitive. Shaders may also pull vertices from the streams bound as
+// storage buffers, the VAO then only holds the index buffer (see
+// bindIndices).
+//
+// Vertices are stored either as floats or quantized in 16 bytes:
+// - positions as normalized 16-bit unsigned integers in the bounds of their
+// mesh (dequantized by ArenaPrimitive::positionMatrix),
+// - normals octahedral encoded in two normalized 16-bit integers,
+// - texture coordinates as half floats.
+// Shaders read quantized vertices with QUANTIZED_VERTICES defined (see
+// vertex_attributes.glsl).
+//
+// Whatever the layout of their glTF accessors (buffer views, strides,
+// padding), vertices are stored tightly packed, and only the attributes
+// shaders read are kept. The shading attributes may also be interleaved in
+// one buffer (see VertexLayout::Interleaved).
+//
+// Indices are relative to the base vertex of their primitive, so they are
+// stored in 16 bits when no primitive has more than 65536 vertices, whatever
+// their glTF type (8-bit indices are widened, 32-bit ones narrowed), and in
+// 32 bits otherwise. Every draw of the arena uses its indexType(). Triangle
+// strips and fans are drawn as they are, one draw per primitive, so they need
+// no primitive restart.
+//
+// The vertex streams may be sub-allocated in a GeometryHeap shared with other
+// arenas (see setHeap), at an offset of their buffer (see
+// vertexBufferOffset).
+class GeometryArena
+{
+public:
+  enum class VertexFormat
+  {
+    Float,
+    Quantized
+  };
+
+  // Layout of the vertex streams in the buffers of the arena
+  enum class VertexLayout
+  {
+    // One buffer per stream
+    Separate,
+    // POSITION alone, so that depth-only passes fetch nothing else (see
+    // bindPositions), NORMAL and TEXCOORD_0 interleaved in a single buffer
+    // so that shading draws fetch one more cache line per vertex rather than
+    // two. Only read through the VAO: the interleaved streams cannot be bound
+    // as storage buffers (see bindVertexStorage), nor written by the skinning
+    // and morphing pre-passes.
+    Interleaved
+  };
+
+  // Parts of a primitive written by decodePrimitive, copyPrimitive and
+  // uploadPrimitive, so that its vertices can be uploaded before its indices
+  // (e.g. to draw a level of detail first)
+  enum class PrimitiveParts
+  {
+    All,
+    Vertices,
+    Indices // Followed by the position indices
+  };
+
+  // Vertex streams, their index is the attribute location in forward.vs.glsl
+  enum Stream
+  {
+    POSITION = 0, // vec3
+    NORMAL = 1, // vec3
+    TEXCOORD_0 = 2, // vec2
+    STREAM_COUNT
+  };
+
+  // Location of the per draw index attribute (an instanced uint attribute
+  // sourced from the buffer given to bindDrawIdBuffer)
+  static const GLuint DRAW_ID_LOCATION = 3;
+
+  // First location of the per instance model and normal matrices (two
+  // instanced mat4 attributes, 8 locations, sourced from the buffer given to
+  // bindInstanceBuffer, see InstancedDrawList::InstanceTransform)
+  static const GLuint INSTANCE_TRANSFORM_LOCATION = 4;
+
+  // Location of the material of a draw (an uint attribute, instanced and
+  // sourced from the buffer given to bindMaterialIdBuffer for indirect draws,
+  // set by setMaterialId otherwise)
+  static const GLuint MATERIAL_ID_LOCATION = 12;
+
+  // Locations of the joints (uvec4) and weights (vec4) of skinned vertices,
+  // sourced from the buffer given to bindSkinBuffer (see
+  // SceneSkins::SkinVertex)
+  static const GLuint SKIN_JOINTS_LOCATION = 13;
+  static const GLuint SKIN_WEIGHTS_LOCATION = 14;
+
+  // First shader storage binding of the vertex streams, stream i is bound
+  // at VERTEX_STORAGE_BINDING + i by bindVertexStorage (see
+  // vertex_attributes.glsl with VERTEX_PULLING)
+  static const GLuint VERTEX_STORAGE_BINDING = 8;
+
+  // Shader storage binding of the material of each draw, the storage
+  // counterpart of MATERIAL_ID_LOCATION for shaders pulling their vertices
+  static const GLuint MATERIAL_ID_STORAGE_BINDING =
+      VERTEX_STORAGE_BINDING + STREAM_COUNT;
+
+  // Shader storage binding of the index buffer, for shaders fetching the
+  // vertices of a triangle (see visibility_resolve.fs.glsl). 16-bit indices
+  // are packed by two in words.
+  static const GLuint INDEX_STORAGE_BINDING = MATERIAL_ID_STORAGE_BINDING + 1;
+
+  static size_t getStreamComponentCount(Stream stream)
+  {
+    return stream == TEXCOORD_0 ? 2 : 3;
+  }
+
+  static const char *getStreamAttributeName(Stream stream)
+  {
+    static const char *names[] = {"POSITION", "NORMAL", "TEXCOORD_0"};
+    return names[stream];
+  }
+
+  // Size in bytes of one vertex of stream
+  static size_t getStreamVertexSize(Stream stream, VertexFormat format)
+  {
+    if (format == VertexFormat::Float) {
+      return getStreamComponentCount(stream) * sizeof(float);
+    }
+    // Positions are padded to 4 components to keep vertices aligned
+    return stream == POSITION ? 4 * sizeof(uint16_t) : 2 * sizeof(uint16_t);
+  }
+
+  // Stream owning the buffer stream is stored in, with layout
+  static Stream getBufferStream(Stream stream, VertexLayout layout)
+  {
+    return layout == VertexLayout::Interleaved && stream == TEXCOORD_0
+               ? NORMAL
+               : stream;
+  }
+
+  // Size in bytes of one vertex in the buffer of stream with layout, the
+  // stride of the buffer, 0 if stream is stored in the buffer of another one
+  static size_t getBufferVertexSize(
+      Stream stream, VertexFormat format, VertexLayout layout)
+  {
+    if (layout == VertexLayout::Separate || stream == POSITION) {
+      return getStreamVertexSize(stream, format);
+    }
+    return stream == NORMAL ? getStreamVertexSize(NORMAL, format) +
+                                  getStreamVertexSize(TEXCOORD_0, format)
+                            : 0;
+  }
+
+  // Offset in bytes of stream in a vertex of its buffer with layout
+  static size_t getStreamOffset(
+      Stream stream, VertexFormat format, VertexLayout layout)
+  {
+    return getBufferStream(stream, layout) != stream
+               ? getStreamVertexSize(NORMAL, format)
+               : 0;
+  }
+
+  // Size in bytes of one vertex in all streams
+  static size_t getVertexSize(VertexFormat format = VertexFormat::Float)
+  {
+    size_t size = 0;
+    for (size_t i = 0; i < STREAM_COUNT; ++i) {
+      size += getStreamVertexSize(Stream(i), format);
+    }
+    return size;
+  }
+
+  GeometryArena() = default;
+
+  ~GeometryArena() { release(); }
+
+  // Non-copyable class:
+  GeometryArena(const GeometryArena &) = delete;
+  GeometryArena &operator=(const GeometryArena &) = delete;
+
+  GeometryArena(GeometryArena &&rvalue) { *this = std::move(rvalue); }
+
+  GeometryArena &operator=(GeometryArena &&rvalue);
+
+  // Compute the location of each primitive of model in the arena, packed in
+  // mesh order. meshToPrimitives[i] receives the index of the first primitive
+  // of mesh i in the returned vector. With skipPointsAndLines, POINTS and
+  // LINES primitives get no vertex nor index (they are drawn by PointClouds),
+  // so that every draw of the arena skips them.
+  //
+  // With positionIndices, triangle primitives with normals or texture
+  // coordinates also get position indices (see
+  // ArenaPrimitive::positionFirstIndex): their vertices split at normal or
+  // texture seams are welded back, so that the post-transform cache of
+  // depth-only passes shades each position once. Skinned and morphed
+  // primitives get none, their vertices may move apart.
+  static std::vector<ArenaPrimitive> layoutPrimitives(
+      const tinygltf::Model &model, std::vector<size_t> &meshToPrimitives,
+      bool skipPointsAndLines = false, bool positionIndices = false);
+
+  // Set the position transform of primitives (see
+  // ArenaPrimitive::positionMatrix) for quantized arenas. Primitives of a
+  // mesh share the same transform so that it can be folded in the matrices of
+  // their node:
+  // - if all primitives of the mesh have integer positions of the same type
+  // (KHR_mesh_quantization), their integers are stored as they are, rescaled
+  // to 16 bits,
+  // - otherwise positions are quantized in the bounds of the mesh.
+  static void computePositionQuantization(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers,
+      const std::vector<size_t> &meshToPrimitives,
+      std::vector<ArenaPrimitive> &primitives);
+
+  // Smallest index type of primitives, GL_UNSIGNED_SHORT if none of them
+  // has more than 65536 vertices, GL_UNSIGNED_INT otherwise
+  static GLenum getIndexType(const std::vector<ArenaPrimitive> &primitives);
+
+  // Sub-allocate the vertex streams of the next allocate() in heap, which
+  // must outlive the arena, tagged with owner (see GeometryHeap::defragment).
+  // Streams that do not fit in heap get buffers of their own. Indices always
+  // do: indirect commands address them from the start of their buffer.
+  void setHeap(GeometryHeap *heap, uint64_t owner)
+  {
+    m_heap = heap;
+    m_nHeapOwner = owner;
+  }
+
+  // Fetch the ranges of the streams in the heap after
+  // GeometryHeap::defragment moved them, before any upload or draw
+  void updateHeapRanges();
+
+  // Allocate storage of the arena (previous content is released), with
+  // indices of indexType (GL_UNSIGNED_SHORT or GL_UNSIGNED_INT)
+  void allocate(size_t vertexCount, size_t indexCount,
+      VertexFormat format = VertexFormat::Float,
+      GLenum indexType = GL_UNSIGNED_INT,
+      VertexLayout layout = VertexLayout::Separate);
+
+  // Allocate storage for primitives computed by layoutPrimitives, followed by
+  // extraIndexCount indices (e.g. of levels of detail, see uploadIndices),
+  // of the type given by getIndexType
+  void allocate(const std::vector<ArenaPrimitive> &primitives,
+      size_t extraIndexCount = 0, VertexFormat format = VertexFormat::Float,
+      VertexLayout layout = VertexLayout::Separate);
+
+  // Decode a glTF primitive and write it at the location given by
+  // arenaPrimitive. Return the number of bytes uploaded.
+  //
+  // If indices is not null, it replaces the indices of the primitive and
+  // must have arenaPrimitive.indexCount elements, position indices are
+  // computed from it. If vertexRemap is not null,
+  // vertex i of the primitive is written at vertexRemap[i] (see
+  // OptimizedIndices). Only parts of the primitive are written.
+  size_t uploadPrimitive(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers,
+      const tinygltf::Primitive &primitive,
+      const ArenaPrimitive &arenaPrimitive,
+      const std::vector<uint32_t> *indices = nullptr,
+      const std::vector<uint32_t> *vertexRemap = nullptr,
+      PrimitiveParts parts = PrimitiveParts::All);
+
+  // Write indices at firstIndex in the index buffer. Return the number of
+  // bytes uploaded.
+  size_t uploadIndices(size_t firstIndex, const std::vector<uint32_t> &indices);
+
+  // Convert count indices to indexType() in data, as uploadIndices does
+  // without any GL call. Return the number of bytes written.
+  size_t encodeIndices(
+      const uint32_t *indices, size_t count, void *data) const;
+
+  // Bytes of the parts of a primitive decoded by decodePrimitive
+  size_t getPrimitiveByteSize(const ArenaPrimitive &arenaPrimitive,
+      PrimitiveParts parts = PrimitiveParts::All) const;
+
+  // Decode a glTF primitive as uploadPrimitive does, without any GL call, to
+  // data: the vertices of each buffer (see getBufferVertexSize) then the
+  // indices (followed by the position indices), tightly packed
+  // (getPrimitiveByteSize bytes, 4-byte aligned), or only parts of them.
+  // data is only written to, it can be a mapped staging buffer filled by a
+  // worker thread.
+  void decodePrimitive(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers,
+      const tinygltf::Primitive &primitive,
+      const ArenaPrimitive &arenaPrimitive,
+      const std::vector<uint32_t> *indices,
+      const std::vector<uint32_t> *vertexRemap, void *data,
+      PrimitiveParts parts = PrimitiveParts::All) const;
+
+  // Copy the parts of a primitive decoded by decodePrimitive at offset in
+  // buffer to the location given by arenaPrimitive, on the GPU
+  void copyPrimitive(GLuint buffer, size_t offset,
+      const ArenaPrimitive &arenaPrimitive,
+      PrimitiveParts parts = PrimitiveParts::All);
+
+  // Copy a glTF primitive whose accessors are already stored as the arena
+  // stores them (dense float streams of its vertex format, with
+  // VertexFormat::Float and VertexLayout::Separate, indices of indexType()
+  // and no position indices) from the memory of pins that contains them to
+  // the location given by arenaPrimitive, on the GPU. Missing streams are
+  // cleared. Return false, with nothing copied, if the primitive is not
+  // stored as is or not pinned: it must then be decoded.
+  bool copyPinnedPrimitive(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers,
+      const std::vector<PinnedMemory> &pins,
+      const tinygltf::Primitive &primitive,
+      const ArenaPrimitive &arenaPrimitive);
+
+  // Copy indexCount indices of indexType() at offset in buffer to
+  // firstIndex in the index buffer, on the GPU
+  void copyIndices(
+      GLuint buffer, size_t offset, size_t firstIndex, size_t indexCount);
+
+  // Copy sourcePrimitive of source, an arena of the same vertex format,
+  // layout and index type, to the location given by arenaPrimitive on the
+  // GPU. Both must have the same vertex and stored index counts.
+  void copyPrimitive(const GeometryArena &source,
+      const ArenaPrimitive &sourcePrimitive,
+      const ArenaPrimitive &arenaPrimitive);
+
+  // Bind the VAO describing the whole arena (and its index buffer)
+  void bind() const { m_vertexArray.bind(); }
+
+  // Bind a VAO sourcing only the POSITION stream (and the skin attributes,
+  // see bindSkinBuffer) with the same index buffer, for depth-only passes
+  // that fetch no other attribute
+  void bindPositions() const { m_positionArray.bind(); }
+
+  // Bind a VAO without any attribute, with the same index buffer, for
+  // shaders that pull their vertices from the streams (see
+  // bindVertexStorage). Its layout does not depend on the vertex format, so
+  // it never changes between draws.
+  void bindIndices() const { m_indexArray.bind(); }
+
+  // Bind the vertex streams and the index buffer as shader storage buffers,
+  // or unbind them if bind is false. Requires VertexLayout::Separate.
+  void bindVertexStorage(bool bind = true) const;
+
+  // Bind the range of stream as the shader storage buffer at binding, for
+  // the pre-passes reading or writing vertices. Requires
+  // VertexLayout::Separate.
+  void bindStreamStorage(GLuint binding, Stream stream) const;
+
+  // Source the DRAW_ID_LOCATION attribute of the VAO from buffer, with one
+  // element per instance. Disable the attribute if buffer is 0.
+  void bindDrawIdBuffer(GLuint buffer) const;
+
+  // Source the INSTANCE_TRANSFORM_LOCATION attributes of the VAO from buffer
+  // starting at offset, with one pair of matrices per instance. Disable the
+  // attributes if buffer is 0.
+  void bindInstanceBuffer(GLuint buffer, size_t offset = 0) const;
+
+  // Source the MATERIAL_ID_LOCATION attribute of the VAO from buffer, with
+  // one element per instance. Disable the attribute if buffer is 0.
+  void bindMaterialIdBuffer(GLuint buffer) const;
+
+  // Source the SKIN_JOINTS_LOCATION and SKIN_WEIGHTS_LOCATION attributes of
+  // the VAO from buffer, with one SceneSkins::SkinVertex per vertex of the
+  // arena. Disable the attributes if buffer is 0.
+  void bindSkinBuffer(GLuint buffer) const;
+
+  // Set the material of the next draws while the MATERIAL_ID_LOCATION
+  // attribute is disabled (a context state, not a VAO one)
+  static void setMaterialId(GLuint materialID)
+  {
+    glVertexAttribI1ui(MATERIAL_ID_LOCATION, materialID);
+  }
+
+  GLuint vertexArray() const { return m_vertexArray.glId(); }
+
+  // 0 if stream is stored in the buffer of another one (see
+  // getBufferStream)
+  GLuint vertexBuffer(Stream stream) const { return m_vertexBuffers[stream]; }
+
+  // Offset in bytes of the first vertex of stream in vertexBuffer(stream),
+  // not 0 if it is in a GeometryHeap
+  size_t vertexBufferOffset(Stream stream) const
+  {
+    return m_vertexOffsets[stream];
+  }
+
+  GLuint indexBuffer() const { return m_indexBuffer; }
+
+  size_t vertexCount() const { return m_nVertexCount; }
+
+  size_t indexCount() const { return m_nIndexCount; }
+
+  VertexFormat vertexFormat() const { return m_vertexFormat; }
+
+  VertexLayout vertexLayout() const { return m_vertexLayout; }
+
+  // Size in bytes of one vertex in the buffer of stream (see
+  // getBufferVertexSize)
+  size_t bufferVertexSize(Stream stream) const
+  {
+    return getBufferVertexSize(stream, m_vertexFormat, m_vertexLayout);
+  }
+
+  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, the type of every draw
+  GLenum indexType() const { return m_indexType; }
+
+  size_t indexSize() const
+  {
+    return m_indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort)
+                                            : sizeof(GLuint);
+  }
+
+  // Offset of index firstIndex in the index buffer, as given to draw calls
+  const GLvoid *indexOffset(size_t firstIndex) const
+  {
+    return (const GLvoid *)(firstIndex * indexSize());
+  }
+
+private:
+  // Keeps the heap
+  void release();
+
+  // Bind the vertex buffers at their offset in the VAOs
+  void bindVertexBuffers();
+
+  std::array<GLuint, STREAM_COUNT> m_vertexBuffers = {};
+  std::array<size_t, STREAM_COUNT> m_vertexOffsets = {};
+  GeometryHeap *m_heap = nullptr;
+  uint64_t m_nHeapOwner = 0;
+  // NO_HANDLE for the streams in buffers of their own
+  std::array<GeometryHeap::Handle, STREAM_COUNT> m_heapHandles = {
+      GeometryHeap::NO_HANDLE, GeometryHeap::NO_HANDLE,
+      GeometryHeap::NO_HANDLE};
+  GLuint m_indexBuffer = 0;
+  TrackedGLMemory m_memory; // Of the vertex and index buffers not in m_heap
+  GLVertexArray m_vertexArray;
+  GLVertexArray m_positionArray;
+  GLVertexArray m_indexArray;
+  size_t m_nVertexCount = 0;
+  size_t m_nIndexCount = 0;
+  VertexFormat m_vertexFormat = VertexFormat::Float;
+  VertexLayout m_vertexLayout = VertexLayout::Separate;
+  GLenum m_indexType = GL_UNSIGNED_INT;
+};
@@ -0,0 +1,332 @@
+#include "geometry_heap.hpp"
+#include "gl_extensions.hpp"
+
+#include <algorithm>
+
+GeometryHeap::GeometryHeap(size_t capacity, size_t blockSize) :
+    m_nCapacity(capacity), m_nBlockSize(blockSize)
+{
+  GLint storageAlignment = 0;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+  m_nAlignment = std::max(m_nAlignment, size_t(storageAlignment));
+  const auto &extensions = getGLExtensions();
+  m_isSparse = extensions.sparseBuffer;
+  // Pages and blocks are whole numbers of alignments
+  const auto roundUp = [](size_t size, size_t multiple) {
+    return (size + multiple - 1) / multiple * multiple;
+  };
+  if (m_isSparse) {
+    m_nPageSize = size_t(extensions.sparseBufferPageSize);
+    m_nCapacity = roundUp(m_nCapacity, std::max(m_nPageSize, m_nAlignment));
+  }
+  m_nBlockSize = roundUp(std::max(m_nBlockSize, size_t(1)), m_nAlignment);
+}
+
+GeometryHeap::~GeometryHeap()
+{
+  for (const auto &block : m_blocks) {
+    if (block.buffer) {
+      glDeleteBuffers(1, &block.buffer);
+    }
+  }
+}
+
+GeometryHeap::Handle GeometryHeap::allocate(size_t size, uint64_t owner)
+{
+  const auto alignedSize =
+      (std::max(size, size_t(1)) + m_nAlignment - 1) / m_nAlignment *
+      m_nAlignment;
+  if (m_isSparse && m_blocks.empty()) {
+    createBlock(m_nCapacity);
+  }
+
+  auto blockIdx = uint32_t(m_blocks.size());
+  size_t offset = 0;
+  for (uint32_t i = 0; i < m_blocks.size(); ++i) {
+    const auto &block = m_blocks[i];
+    if (!block.buffer) {
+      continue;
+    }
+    offset = findFreeRange(block, alignedSize, block.size);
+    if (offset < block.size) {
+      blockIdx = i;
+      break;
+    }
+  }
+  if (blockIdx == m_blocks.size()) {
+    if (m_isSparse ||
+        stats().residentBytes + std::max(m_nBlockSize, alignedSize) >
+            m_nCapacity) {
+      return NO_HANDLE;
+    }
+    blockIdx = createBlock(std::max(m_nBlockSize, alignedSize));
+    offset = 0;
+  }
+  reserveRange(blockIdx, offset, alignedSize);
+
+  Handle handle = NO_HANDLE;
+  if (!m_freeHandles.empty()) {
+    handle = m_freeHandles.back();
+    m_freeHandles.pop_back();
+  } else {
+    handle = Handle(m_allocations.size());
+    m_allocations.emplace_back();
+  }
+  m_allocations[handle] = {blockIdx, offset, alignedSize, size, owner, true};
+  return handle;
+}
+
+void GeometryHeap::free(Handle handle)
+{
+  auto &allocation = m_allocations[handle];
+  releaseRange(allocation.block, allocation.offset, allocation.size);
+  allocation.isLive = false;
+  m_freeHandles.push_back(handle);
+}
+
+GeometryHeap::Range GeometryHeap::range(Handle handle) const
+{
+  const auto &allocation = m_allocations[handle];
+  return {m_blocks[allocation.block].buffer, allocation.offset,
+      allocation.requestedSize};
+}
+
+size_t GeometryHeap::defragment(
+    size_t byteBudget, std::vector<uint64_t> &movedOwners)
+{
+  if (!stats().freeRangeCount) {
+    return 0;
+  }
+  std::vector<Handle> order;
+  for (Handle handle = 0; handle < m_allocations.size(); ++handle) {
+    if (m_allocations[handle].isLive) {
+      order.push_back(handle);
+    }
+  }
+  std::sort(begin(order), end(order), [&](Handle lhs, Handle rhs) {
+    const auto &l = m_allocations[lhs];
+    const auto &r = m_allocations[rhs];
+    return std::make_pair(l.block, l.offset) >
+           std::make_pair(r.block, r.offset);
+  });
+
+  size_t movedBytes = 0;
+  for (const auto handle : order) {
+    auto &allocation = m_allocations[handle];
+    if (movedBytes + allocation.size > byteBudget) {
+      break;
+    }
+    // Lowest free range fitting the allocation before it: a range of its
+    // own block never overlaps it
+    auto targetBlock = uint32_t(m_blocks.size());
+    size_t targetOffset = 0;
+    for (uint32_t i = 0; i <= allocation.block; ++i) {
+      const auto &block = m_blocks[i];
+      if (!block.buffer) {
+        continue;
+      }
+      const auto end = i == allocation.block ? allocation.offset : block.size;
+      targetOffset = findFreeRange(block, allocation.size, end);
+      if (targetOffset < block.size) {
+        targetBlock = i;
+        break;
+      }
+    }
+    if (targetBlock == m_blocks.size()) {
+      continue;
+    }
+
+    reserveRange(targetBlock, targetOffset, allocation.size);
+    glBindBuffer(GL_COPY_READ_BUFFER, m_blocks[allocation.block].buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_blocks[targetBlock].buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+        GLintptr(allocation.offset), GLintptr(targetOffset),
+        GLsizeiptr(allocation.size));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    // Deleting an emptied block waits for the copy in the driver
+    releaseRange(allocation.block, allocation.offset, allocation.size);
+    allocation.block = targetBlock;
+    allocation.offset = targetOffset;
+
+    movedBytes += allocation.size;
+    ++m_nMoveCount;
+    if (std::find(begin(movedOwners), end(movedOwners), allocation.owner) ==
+        end(movedOwners)) {
+      movedOwners.push_back(allocation.owner);
+    }
+  }
+  m_nMovedBytes += movedBytes;
+  return movedBytes;
+}
+
+GeometryHeap::Stats GeometryHeap::stats() const
+{
+  Stats stats;
+  for (const auto &allocation : m_allocations) {
+    if (allocation.isLive) {
+      ++stats.allocationCount;
+      stats.allocatedBytes += allocation.requestedSize;
+    }
+  }
+  // Free ranges followed by an allocation are holes, as well as the end of
+  // the blocks before the last one
+  size_t lastBlock = m_blocks.size();
+  for (size_t i = 0; i < m_blocks.size(); ++i) {
+    if (m_blocks[i].buffer) {
+      ++stats.blockCount;
+      stats.residentBytes += m_blocks[i].size;
+      lastBlock = i;
+    }
+  }
+  for (size_t i = 0; i < m_blocks.size(); ++i) {
+    const auto &block = m_blocks[i];
+    for (const auto &freeRange : block.freeRanges) {
+      if (freeRange.first + freeRange.second < block.size || i < lastBlock) {
+        ++stats.freeRangeCount;
+      }
+    }
+  }
+  if (m_isSparse) {
+    stats.residentBytes = m_nCommittedPageCount * m_nPageSize;
+  }
+  stats.moveCount = m_nMoveCount;
+  stats.movedBytes = m_nMovedBytes;
+  return stats;
+}
+
+size_t GeometryHeap::findFreeRange(
+    const Block &block, size_t size, size_t end) const
+{
+  for (const auto &freeRange : block.freeRanges) {
+    if (freeRange.first + size > end) {
+      break;
+    }
+    if (freeRange.second >= size) {
+      return freeRange.first;
+    }
+  }
+  return block.size;
+}
+
+void GeometryHeap::reserveRange(uint32_t blockIdx, size_t offset, size_t size)
+{
+  auto &block = m_blocks[blockIdx];
+  auto it = std::prev(block.freeRanges.upper_bound(offset));
+  const auto rangeOffset = it->first;
+  const auto rangeEnd = it->first + it->second;
+  block.freeRanges.erase(it);
+  if (rangeOffset < offset) {
+    block.freeRanges.emplace(rangeOffset, offset - rangeOffset);
+  }
+  if (offset + size < rangeEnd) {
+    block.freeRanges.emplace(offset + size, rangeEnd - offset - size);
+  }
+  ++block.allocationCount;
+  if (m_isSparse) {
+    commitPages(offset, offset + size, true);
+  }
+}
+
+void GeometryHeap::releaseRange(uint32_t blockIdx, size_t offset, size_t size)
+{
+  auto &block = m_blocks[blockIdx];
+  auto begin = offset;
+  auto end = offset + size;
+  const auto next = block.freeRanges.lower_bound(offset);
+  if (next != block.freeRanges.end() && next->first == end) {
+    end += next->second;
+    block.freeRanges.erase(next);
+  }
+  const auto after = block.freeRanges.lower_bound(offset);
+  if (after != block.freeRanges.begin()) {
+    const auto previous = std::prev(after);
+    if (previous->first + previous->second == begin) {
+      begin = previous->first;
+      block.freeRanges.erase(previous);
+    }
+  }
+  block.freeRanges.emplace(begin, end - begin);
+  --block.allocationCount;
+
+  if (m_isSparse) {
+    // Pages shared with an allocation stay committed
+    const auto firstPage = (begin + m_nPageSize - 1) / m_nPageSize;
+    const auto endPage = end / m_nPageSize;
+    if (firstPage < endPage) {
+      commitPages(firstPage * m_nPageSize, endPage * m_nPageSize, false);
+    }
+  } else if (!block.allocationCount) {
+    glDeleteBuffers(1, &block.buffer);
+    block = Block();
+    updateMemory();
+  }
+}
+
+uint32_t GeometryHeap::createBlock(size_t size)
+{
+  Block block;
+  glGenBuffers(1, &block.buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, block.buffer);
+  glBufferStorage(GL_COPY_WRITE_BUFFER, GLsizeiptr(size), nullptr,
+      GL_DYNAMIC_STORAGE_BIT | (m_isSparse ? GL_SPARSE_STORAGE_BIT_ARB : 0));
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  block.size = size;
+  block.freeRanges.emplace(0, size);
+  if (m_isSparse) {
+    m_isPageCommitted.assign(size / m_nPageSize, 0);
+  }
+
+  auto blockIdx = uint32_t(m_blocks.size());
+  for (uint32_t i = 0; i < m_blocks.size(); ++i) {
+    if (!m_blocks[i].buffer) {
+      blockIdx = i;
+      break;
+    }
+  }
+  if (blockIdx == m_blocks.size()) {
+    m_blocks.emplace_back();
+  }
+  m_blocks[blockIdx] = std::move(block);
+  updateMemory();
+  return blockIdx;
+}
+
+void GeometryHeap::commitPages(size_t begin, size_t end, bool commit)
+{
+  const auto &extensions = getGLExtensions();
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_blocks[0].buffer);
+  // Runs of pages to change are committed or released at once
+  auto page = begin / m_nPageSize;
+  const auto endPage = (end + m_nPageSize - 1) / m_nPageSize;
+  while (page < endPage) {
+    if (bool(m_isPageCommitted[page]) == commit) {
+      ++page;
+      continue;
+    }
+    auto runEnd = page;
+    while (runEnd < endPage && bool(m_isPageCommitted[runEnd]) != commit) {
+      m_isPageCommitted[runEnd] = commit;
+      ++runEnd;
+    }
+    extensions.bufferPageCommitment(GL_COPY_WRITE_BUFFER,
+        GLintptr(page * m_nPageSize), GLsizeiptr((runEnd - page) * m_nPageSize),
+        commit ? GL_TRUE : GL_FALSE);
+    if (commit) {
+      m_nCommittedPageCount += runEnd - page;
+    } else {
+      m_nCommittedPageCount -= runEnd - page;
+    }
+    page = runEnd;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  updateMemory();
+}
+
+void GeometryHeap::updateMemory()
+{
+  const auto residentBytes = stats().residentBytes;
+  if (residentBytes != m_memory.bytes()) {
+    m_memory = TrackedGLMemory(GLMemoryCategory::Geometry, residentBytes);
+  }
+}
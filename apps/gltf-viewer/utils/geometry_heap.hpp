@@ -0,0 +1,147 @@
+#pragma once
+
+#include "gl_memory.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Storage shared by the buffers of many GeometryArena, for contents loaded
+// and evicted all along a session (see GeometryArena::setHeap): creating and
+// deleting buffers of every size as they come and go fragments video memory
+// and stalls in the driver, and one large buffer would have to be copied to
+// grow.
+//
+// With GL_ARB_sparse_buffer, the heap is a single sparse buffer of its
+// capacity: only address space is reserved, the pages allocations touch are
+// committed on demand and released once free. Otherwise it is made of
+// fixed blocks of blockSize bytes, created when allocations fit in no other
+// block (larger allocations get a block of their own) and deleted once
+// empty.
+//
+// Freed ranges leave holes. defragment() moves the allocations at the end
+// of the heap into the lowest holes that fit them, with GPU copies limited
+// by a byte budget so that it can run a little every frame, and tells their
+// owners to fetch their new range.
+class GeometryHeap
+{
+public:
+  // Allocation identifier, kept when the allocation moves
+  using Handle = uint32_t;
+
+  static constexpr Handle NO_HANDLE = ~Handle(0);
+
+  static const size_t DEFAULT_BLOCK_SIZE = size_t(64) << 20;
+
+  struct Range
+  {
+    GLuint buffer = 0;
+    size_t offset = 0; // In bytes, a multiple of alignment()
+    size_t size = 0;
+  };
+
+  struct Stats
+  {
+    size_t allocationCount = 0;
+    size_t allocatedBytes = 0; // Requested, without alignment padding
+    // Memory backing the heap: committed pages of the sparse buffer or
+    // blocks
+    size_t residentBytes = 0;
+    size_t blockCount = 0;
+    size_t freeRangeCount = 0; // Holes between allocations
+    // Since the heap was created
+    size_t moveCount = 0;
+    size_t movedBytes = 0;
+  };
+
+  // A heap of at most capacity bytes, blocks of blockSize bytes without
+  // sparse buffers. Creates no GL object before the first allocation.
+  explicit GeometryHeap(
+      size_t capacity, size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+  ~GeometryHeap();
+
+  // Non-copyable and non-movable: arenas point to their heap
+  GeometryHeap(const GeometryHeap &) = delete;
+  GeometryHeap &operator=(const GeometryHeap &) = delete;
+
+  bool isSparse() const { return m_isSparse; }
+
+  // Of the offsets of the ranges, enough for vertex attributes and shader
+  // storage bindings
+  size_t alignment() const { return m_nAlignment; }
+
+  // Allocate size bytes, tagged with owner (see defragment). Return
+  // NO_HANDLE if the heap is full, the caller then allocates elsewhere.
+  Handle allocate(size_t size, uint64_t owner);
+
+  void free(Handle handle);
+
+  // Current location of an allocation, which defragment() may change
+  Range range(Handle handle) const;
+
+  // Move allocations into lower free ranges, the last ones of the heap
+  // first, copying at most byteBudget bytes on the GPU. The owners of the
+  // moved allocations are appended to movedOwners, once each: they must
+  // fetch their new range before they draw again. Return the number of
+  // bytes moved.
+  size_t defragment(size_t byteBudget, std::vector<uint64_t> &movedOwners);
+
+  Stats stats() const;
+
+private:
+  struct Block
+  {
+    GLuint buffer = 0; // 0 once released, the slot is reused
+    size_t size = 0;
+    std::map<size_t, size_t> freeRanges; // Size of each by offset
+    size_t allocationCount = 0;
+  };
+
+  struct Allocation
+  {
+    uint32_t block = 0;
+    size_t offset = 0;
+    size_t size = 0; // Aligned
+    size_t requestedSize = 0;
+    uint64_t owner = 0;
+    bool isLive = false;
+  };
+
+  // Find a free range of block fitting size bytes before end, return its
+  // offset or Block::size if none
+  size_t findFreeRange(const Block &block, size_t size, size_t end) const;
+
+  // Take [offset, offset + size) from the free ranges of block and commit
+  // its pages
+  void reserveRange(uint32_t blockIdx, size_t offset, size_t size);
+
+  // Give back [offset, offset + size) to the free ranges of block, merged
+  // with its neighbours, and release the pages left free
+  void releaseRange(uint32_t blockIdx, size_t offset, size_t size);
+
+  // Create a block of size bytes, return its index
+  uint32_t createBlock(size_t size);
+
+  // Commit or release the pages of the sparse buffer covering [begin, end)
+  void commitPages(size_t begin, size_t end, bool commit);
+
+  void updateMemory();
+
+  size_t m_nCapacity;
+  size_t m_nBlockSize;
+  bool m_isSparse = false;
+  size_t m_nPageSize = 0; // Of the sparse buffer
+  size_t m_nAlignment = 256;
+  std::vector<Block> m_blocks; // A single one for the sparse buffer
+  std::vector<uint8_t> m_isPageCommitted; // Of the sparse buffer
+  size_t m_nCommittedPageCount = 0;
+  std::vector<Allocation> m_allocations; // Indexed by handle
+  std::vector<Handle> m_freeHandles;
+  size_t m_nMoveCount = 0;
+  size_t m_nMovedBytes = 0;
+  TrackedGLMemory m_memory;
+};
@@ -1,9 +1,12 @@
 #include "gl_debug_output.hpp"
+#include "log.hpp"
+#include "sync_watchdog.hpp"
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstring>
 #include <glad/glad.h>
 #include <imgui.h>
-#include <iostream>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
@@ -60,11 +63,93 @@ static std::array<std::tuple<const char *, bool, GLenum>, 4> severitySelector =
         std::make_tuple("LOW", true, GL_DEBUG_SEVERITY_LOW),
         std::make_tuple("NOTIFICATION", false, GL_DEBUG_SEVERITY_NOTIFICATION)};
 
+namespace
+{
+
+GLDebugOutputMode debugOutputMode = GLDebugOutputMode::Full;
+
+// Open addressing hash table of the distinct performance messages, filled
+// with compare-and-swap so that the debug callback never locks nor
+// allocates. Slots are never freed.
+const size_t PERFORMANCE_WARNING_CAPACITY = 64; // Power of two
+const size_t MAX_MESSAGE_LENGTH = 256;
+
+struct PerformanceWarningSlot
+{
+  std::atomic<uint64_t> key{0}; // source << 32 | id, 0 for a free slot
+  std::atomic<uint32_t> count{0};
+  std::atomic<bool> hasMessage{false}; // Set once message is written
+  char message[MAX_MESSAGE_LENGTH];
+};
+
+std::array<PerformanceWarningSlot, PERFORMANCE_WARNING_CAPACITY>
+    performanceWarnings;
+std::atomic<size_t> droppedPerformanceWarningCount{0};
+
+void recordPerformanceWarning(
+    GLenum source, GLuint id, GLsizei length, const GLchar *message)
+{
+  watchGLPerformanceMessage(
+      message, length < 0 ? std::strlen(message) : size_t(length));
+  // Sources are never 0, neither are keys
+  const auto key = uint64_t(source) << 32 | id;
+  auto slotIdx = size_t(id * 2654435761u ^ source);
+  for (size_t i = 0; i < PERFORMANCE_WARNING_CAPACITY; ++i, ++slotIdx) {
+    auto &slot =
+        performanceWarnings[slotIdx & (PERFORMANCE_WARNING_CAPACITY - 1)];
+    auto slotKey = slot.key.load(std::memory_order_acquire);
+    if (!slotKey && slot.key.compare_exchange_strong(slotKey, key,
+                        std::memory_order_acq_rel)) {
+      const auto messageLength = std::min(
+          length < 0 ? std::strlen(message) : size_t(length),
+          MAX_MESSAGE_LENGTH - 1);
+      std::memcpy(slot.message, message, messageLength);
+      slot.message[messageLength] = '\0';
+      slot.hasMessage.store(true, std::memory_order_release);
+      slotKey = key;
+    }
+    if (slotKey == key) {
+      slot.count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  droppedPerformanceWarningCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void APIENTRY countGLPerformanceWarning(GLenum source, GLenum type, GLuint id,
+    GLenum severity, GLsizei length, const GLchar *message,
+    const void *userParam)
+{
+  recordPerformanceWarning(source, id, length, message);
+}
+
+} // namespace
+
 void logGLDebugInfo(GLenum source, GLenum type, GLuint id, GLenum severity,
     GLsizei length, const GLchar *message, GLvoid *userParam);
 
+void setGLDebugOutputMode(GLDebugOutputMode mode) { debugOutputMode = mode; }
+
+GLDebugOutputMode getGLDebugOutputMode() { return debugOutputMode; }
+
 void initGLDebugOutput()
 {
+  if (debugOutputMode == GLDebugOutputMode::Off ||
+      debugOutputMode == GLDebugOutputMode::NoError) {
+    return;
+  }
+  if (debugOutputMode == GLDebugOutputMode::Performance) {
+    // Disabled by default without a debug context. Left asynchronous, so
+    // that the driver does not stall the commands that raise messages.
+    glEnable(GL_DEBUG_OUTPUT);
+    glDebugMessageCallback(countGLPerformanceWarning, nullptr);
+    glDebugMessageControl(
+        GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+    glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PERFORMANCE,
+        GL_DONT_CARE, 0, nullptr, GL_TRUE);
+    return;
+  }
+
   glDebugMessageCallback((GLDEBUGPROCARB)logGLDebugInfo, nullptr);
   glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
 
@@ -89,7 +174,40 @@ void logGLDebugInfo(GLenum source, GLenum type, GLuint id, GLenum severity,
   const auto typeStr = findStr(type, typeEnumToString);
   const auto severityStr = findStr(severity, severityEnumToString);
 
-  std::clog << "OpenGL: " << message << " [source=" << sourceStr
-            << " type=" << typeStr << " severity=" << severityStr
-            << " id=" << id << "]\n\n";
+  // Called inside the GL calls raising the messages, it must not wait for
+  // the console. Even errors are queued, they are only reported.
+  const auto level = severity == GL_DEBUG_SEVERITY_HIGH ||
+                             severity == GL_DEBUG_SEVERITY_MEDIUM
+                         ? LogLevel::Warning
+                         : LogLevel::Info;
+  logFormat(level, "OpenGL: %.*s [source=%s type=%s severity=%s id=%u]",
+      int(length < 0 ? std::strlen(message) : size_t(length)), message,
+      sourceStr, typeStr, severityStr, id);
+
+  if (type == GL_DEBUG_TYPE_PERFORMANCE) {
+    recordPerformanceWarning(source, id, length, message);
+  }
+}
+
+std::vector<GLPerformanceWarning> getGLPerformanceWarnings()
+{
+  std::vector<GLPerformanceWarning> warnings;
+  for (const auto &slot : performanceWarnings) {
+    if (!slot.hasMessage.load(std::memory_order_acquire)) {
+      continue;
+    }
+    GLPerformanceWarning warning;
+    const auto key = slot.key.load(std::memory_order_relaxed);
+    warning.source = uint32_t(key >> 32);
+    warning.id = uint32_t(key);
+    warning.count = slot.count.load(std::memory_order_relaxed);
+    warning.message = slot.message;
+    warnings.push_back(std::move(warning));
+  }
+  return warnings;
+}
+
+size_t getDroppedGLPerformanceWarningCount()
+{
+  return droppedPerformanceWarningCount.load(std::memory_order_relaxed);
 }
@@ -1,3 +1,50 @@
 #pragma once
 
-void initGLDebugOutput();
\ No newline at end of file
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What the contexts report through the GL debug output. Debug contexts can
+// be noticeably slower on some drivers, so only Full creates one.
+enum class GLDebugOutputMode
+{
+  Off, // Regular context, no debug output
+  // Context without error checking (GL_KHR_no_error) where the driver
+  // supports it, regular context otherwise, no debug output. Errors are
+  // undefined behavior, for renders whose commands are known to be valid.
+  NoError,
+  // Regular context with only GL_DEBUG_TYPE_PERFORMANCE messages, counted
+  // asynchronously instead of logged (see getGLPerformanceWarnings()). Some
+  // drivers report fewer messages without a debug context.
+  Performance,
+  Full // Debug context, every message but notifications is logged
+};
+
+// Mode of the contexts created afterwards by GLFWHandle, HeadlessGLContext
+// and SharedGLContext, Full by default
+void setGLDebugOutputMode(GLDebugOutputMode mode);
+
+GLDebugOutputMode getGLDebugOutputMode();
+
+// Set up the debug output of the current context for the current mode
+void initGLDebugOutput();
+
+// Performance message of the driver (shader recompile, buffer stall...),
+// recorded once however many times it is received
+struct GLPerformanceWarning
+{
+  uint32_t source = 0; // GL_DEBUG_SOURCE_*
+  uint32_t id = 0;
+  uint32_t count = 0; // Times it was received
+  std::string message; // Truncated to the first 255 characters
+};
+
+// Distinct performance messages received by every context so far, in
+// Performance and Full modes. The messages are recorded without lock nor
+// allocation, from whatever thread the driver calls back on.
+std::vector<GLPerformanceWarning> getGLPerformanceWarnings();
+
+// Messages received but not recorded, the table of distinct messages being
+// full
+size_t getDroppedGLPerformanceWarningCount();
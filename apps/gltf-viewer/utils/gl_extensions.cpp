@@ -0,0 +1,179 @@
+#include "gl_extensions.hpp"
+
+#include <cstring>
+#include <type_traits>
+
+static GLExtensions extensions;
+
+void loadGLExtensions(GLADloadproc getProcAddress)
+{
+  extensions = GLExtensions{};
+
+  if (hasGLExtension("GL_KHR_parallel_shader_compile")) {
+    extensions.maxShaderCompilerThreads =
+        (decltype(extensions.maxShaderCompilerThreads))getProcAddress(
+            "glMaxShaderCompilerThreadsKHR");
+  } else if (hasGLExtension("GL_ARB_parallel_shader_compile")) {
+    extensions.maxShaderCompilerThreads =
+        (decltype(extensions.maxShaderCompilerThreads))getProcAddress(
+            "glMaxShaderCompilerThreadsARB");
+  }
+  if (extensions.maxShaderCompilerThreads) {
+    extensions.parallelShaderCompile = true;
+    // Let the driver choose the number of compiler threads
+    extensions.maxShaderCompilerThreads(0xFFFFFFFF);
+  }
+
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  if (major > 4 || (major == 4 && minor >= 6)) {
+    extensions.multiDrawElementsIndirectCount =
+        (decltype(extensions.multiDrawElementsIndirectCount))getProcAddress(
+            "glMultiDrawElementsIndirectCount");
+  } else if (hasGLExtension("GL_ARB_indirect_parameters")) {
+    extensions.multiDrawElementsIndirectCount =
+        (decltype(extensions.multiDrawElementsIndirectCount))getProcAddress(
+            "glMultiDrawElementsIndirectCountARB");
+  }
+  extensions.indirectParameters =
+      extensions.multiDrawElementsIndirectCount != nullptr;
+
+  if (major > 4 || (major == 4 && minor >= 5) ||
+      hasGLExtension("GL_ARB_clip_control")) {
+    extensions.setClipControl =
+        (decltype(extensions.setClipControl))getProcAddress("glClipControl");
+  }
+  extensions.clipControl = extensions.setClipControl != nullptr;
+
+  extensions.textureCompressionS3tc =
+      hasGLExtension("GL_EXT_texture_compression_s3tc");
+  extensions.textureCompressionS3tcSrgb =
+      extensions.textureCompressionS3tc &&
+      hasGLExtension("GL_EXT_texture_sRGB");
+  extensions.textureCompressionAstc =
+      hasGLExtension("GL_KHR_texture_compression_astc_ldr");
+
+  extensions.textureFilterAnisotropic =
+      major > 4 || (major == 4 && minor >= 6) ||
+      hasGLExtension("GL_EXT_texture_filter_anisotropic") ||
+      hasGLExtension("GL_ARB_texture_filter_anisotropic");
+  if (extensions.textureFilterAnisotropic) {
+    glGetFloatv(
+        GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &extensions.maxTextureAnisotropy);
+  }
+
+  extensions.pipelineStatisticsQuery =
+      major > 4 || (major == 4 && minor >= 6) ||
+      hasGLExtension("GL_ARB_pipeline_statistics_query");
+
+  extensions.shaderDrawParameters =
+      hasGLExtension("GL_ARB_shader_draw_parameters");
+
+  if (hasGLExtension("GL_KHR_shader_subgroup")) {
+    GLint stages = 0, features = 0;
+    glGetIntegerv(GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+    glGetIntegerv(GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+    extensions.shaderSubgroupArithmetic =
+        (stages & GL_COMPUTE_SHADER_BIT) &&
+        (features & GL_SUBGROUP_FEATURE_ARITHMETIC_BIT_KHR);
+  }
+
+  if (hasGLExtension("GL_ARB_bindless_texture")) {
+    extensions.getTextureSamplerHandle =
+        (decltype(extensions.getTextureSamplerHandle))getProcAddress(
+            "glGetTextureSamplerHandleARB");
+    extensions.makeTextureHandleResident =
+        (decltype(extensions.makeTextureHandleResident))getProcAddress(
+            "glMakeTextureHandleResidentARB");
+    extensions.makeTextureHandleNonResident =
+        (decltype(extensions.makeTextureHandleNonResident))getProcAddress(
+            "glMakeTextureHandleNonResidentARB");
+  }
+  extensions.bindlessTexture = extensions.getTextureSamplerHandle &&
+                               extensions.makeTextureHandleResident &&
+                               extensions.makeTextureHandleNonResident;
+
+  if (hasGLExtension("GL_ARB_sparse_buffer")) {
+    extensions.bufferPageCommitment =
+        (decltype(extensions.bufferPageCommitment))getProcAddress(
+            "glBufferPageCommitmentARB");
+    glGetIntegerv(
+        GL_SPARSE_BUFFER_PAGE_SIZE_ARB, &extensions.sparseBufferPageSize);
+  }
+  extensions.sparseBuffer = extensions.bufferPageCommitment &&
+                            extensions.sparseBufferPageSize > 0;
+
+  extensions.pinnedMemory = hasGLExtension("GL_AMD_pinned_memory");
+
+  if (hasGLExtension("GL_NV_shading_rate_image")) {
+    extensions.bindShadingRateImage =
+        (decltype(extensions.bindShadingRateImage))getProcAddress(
+            "glBindShadingRateImageNV");
+    extensions.shadingRateImagePalette =
+        (decltype(extensions.shadingRateImagePalette))getProcAddress(
+            "glShadingRateImagePaletteNV");
+    glGetIntegerv(GL_SHADING_RATE_IMAGE_TEXEL_WIDTH_NV,
+        &extensions.shadingRateTexelSize[0]);
+    glGetIntegerv(GL_SHADING_RATE_IMAGE_TEXEL_HEIGHT_NV,
+        &extensions.shadingRateTexelSize[1]);
+  }
+  extensions.shadingRateImage = extensions.bindShadingRateImage &&
+                                extensions.shadingRateImagePalette &&
+                                extensions.shadingRateTexelSize[0] > 0 &&
+                                extensions.shadingRateTexelSize[1] > 0;
+
+  if (major > 4 || (major == 4 && minor >= 5) ||
+      hasGLExtension("GL_ARB_direct_state_access")) {
+    // The extension has no suffix, its functions are those of OpenGL 4.5
+    const auto load = [&](auto &function, const char *name) {
+      function = (std::remove_reference_t<decltype(function)>)getProcAddress(
+          name);
+      return function != nullptr;
+    };
+    extensions.directStateAccess =
+        load(extensions.createBuffers, "glCreateBuffers") &&
+        load(extensions.namedBufferStorage, "glNamedBufferStorage") &&
+        load(extensions.mapNamedBufferRange, "glMapNamedBufferRange") &&
+        load(extensions.unmapNamedBuffer, "glUnmapNamedBuffer") &&
+        load(extensions.createTextures, "glCreateTextures") &&
+        load(extensions.textureStorage2D, "glTextureStorage2D") &&
+        load(extensions.textureParameteri, "glTextureParameteri") &&
+        load(extensions.createRenderbuffers, "glCreateRenderbuffers") &&
+        load(extensions.namedRenderbufferStorageMultisample,
+            "glNamedRenderbufferStorageMultisample") &&
+        load(extensions.createFramebuffers, "glCreateFramebuffers") &&
+        load(extensions.namedFramebufferTexture,
+            "glNamedFramebufferTexture") &&
+        load(extensions.namedFramebufferTextureLayer,
+            "glNamedFramebufferTextureLayer") &&
+        load(extensions.namedFramebufferRenderbuffer,
+            "glNamedFramebufferRenderbuffer") &&
+        load(extensions.namedFramebufferDrawBuffer,
+            "glNamedFramebufferDrawBuffer") &&
+        load(extensions.namedFramebufferDrawBuffers,
+            "glNamedFramebufferDrawBuffers") &&
+        load(extensions.namedFramebufferReadBuffer,
+            "glNamedFramebufferReadBuffer") &&
+        load(extensions.checkNamedFramebufferStatus,
+            "glCheckNamedFramebufferStatus") &&
+        load(extensions.blitNamedFramebuffer, "glBlitNamedFramebuffer") &&
+        load(extensions.createVertexArrays, "glCreateVertexArrays");
+  }
+}
+
+const GLExtensions &getGLExtensions() { return extensions; }
+
+bool hasGLExtension(const char *name)
+{
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; ++i) {
+    const auto *extension =
+        (const char *)glGetStringi(GL_EXTENSIONS, GLuint(i));
+    if (extension && std::strcmp(extension, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Our glad loader only has OpenGL 4.4 core functions: optional extensions
+// are detected and loaded here, once a context is current.
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+#ifndef GL_PARAMETER_BUFFER_ARB
+#define GL_PARAMETER_BUFFER_ARB 0x80EE
+#endif
+
+#ifndef GL_ZERO_TO_ONE
+#define GL_ZERO_TO_ONE 0x935F
+#endif
+
+#ifndef GL_CLIP_DEPTH_MODE
+#define GL_CLIP_DEPTH_MODE 0x935D
+#endif
+
+// GL_EXT_texture_compression_s3tc and GL_EXT_texture_sRGB
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// GL_EXT_texture_filter_anisotropic (core in OpenGL 4.6 without suffix)
+#ifndef GL_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT 0x84FE
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
+#endif
+
+// GL_ARB_pipeline_statistics_query (core in OpenGL 4.6 without suffix), some
+// of its query targets
+#ifndef GL_VERTICES_SUBMITTED_ARB
+#define GL_VERTICES_SUBMITTED_ARB 0x82EE
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#define GL_CLIPPING_INPUT_PRIMITIVES_ARB 0x82F6
+#define GL_CLIPPING_OUTPUT_PRIMITIVES_ARB 0x82F7
+#endif
+
+// GL_KHR_texture_compression_astc_ldr, the 14 footprints from 4x4 to 12x12
+// follow these ones
+#ifndef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+#define GL_COMPRESSED_RGBA_ASTC_4x4_KHR 0x93B0
+#define GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR 0x93D0
+#endif
+
+// GL_KHR_shader_subgroup
+#ifndef GL_SUBGROUP_SUPPORTED_STAGES_KHR
+#define GL_SUBGROUP_SUPPORTED_STAGES_KHR 0x9533
+#define GL_SUBGROUP_SUPPORTED_FEATURES_KHR 0x9534
+#define GL_SUBGROUP_FEATURE_ARITHMETIC_BIT_KHR 0x00000004
+#endif
+
+// GL_ARB_sparse_buffer
+#ifndef GL_SPARSE_STORAGE_BIT_ARB
+#define GL_SPARSE_STORAGE_BIT_ARB 0x0400
+#define GL_SPARSE_BUFFER_PAGE_SIZE_ARB 0x82F8
+#endif
+
+// GL_AMD_pinned_memory
+#ifndef GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD
+#define GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD 0x9160
+#endif
+
+// GL_NV_shading_rate_image, the rates used by ShadingRateImage
+#ifndef GL_SHADING_RATE_IMAGE_NV
+#define GL_SHADING_RATE_IMAGE_NV 0x9563
+#define GL_SHADING_RATE_1_INVOCATION_PER_PIXEL_NV 0x9565
+#define GL_SHADING_RATE_1_INVOCATION_PER_2X2_PIXELS_NV 0x9568
+#define GL_SHADING_RATE_1_INVOCATION_PER_4X4_PIXELS_NV 0x956B
+#define GL_SHADING_RATE_IMAGE_TEXEL_WIDTH_NV 0x955C
+#define GL_SHADING_RATE_IMAGE_TEXEL_HEIGHT_NV 0x955D
+#endif
+
+struct GLExtensions
+{
+  // GL_KHR_parallel_shader_compile or GL_ARB_parallel_shader_compile: the
+  // driver compiles and links on its own threads, GL_COMPLETION_STATUS_KHR
+  // can be queried without blocking
+  bool parallelShaderCompile = false;
+  void(APIENTRYP maxShaderCompilerThreads)(GLuint count) = nullptr;
+
+  // GL_ARB_indirect_parameters (core in OpenGL 4.6): the draw count of
+  // multiDrawElementsIndirectCount is read from the buffer bound to
+  // GL_PARAMETER_BUFFER_ARB
+  bool indirectParameters = false;
+  void(APIENTRYP multiDrawElementsIndirectCount)(GLenum mode, GLenum type,
+      const void *indirect, GLintptr drawCount, GLsizei maxDrawCount,
+      GLsizei stride) = nullptr;
+
+  // GL_ARB_clip_control (core in OpenGL 4.5): setClipControl(GL_LOWER_LEFT,
+  // GL_ZERO_TO_ONE) maps clip space depth to [0, 1] instead of [-1, 1], which
+  // keeps the precision of floating point depth buffers with reversed-Z
+  bool clipControl = false;
+  void(APIENTRYP setClipControl)(GLenum origin, GLenum depth) = nullptr;
+
+  // Compressed texture formats beyond the core ones (RGTC, BPTC, ETC2 and
+  // EAC): BC1 to BC3 with GL_EXT_texture_compression_s3tc (sRGB variants
+  // also need GL_EXT_texture_sRGB), ASTC with
+  // GL_KHR_texture_compression_astc_ldr
+  bool textureCompressionS3tc = false;
+  bool textureCompressionS3tcSrgb = false;
+  bool textureCompressionAstc = false;
+
+  // GL_EXT_texture_filter_anisotropic, GL_ARB_texture_filter_anisotropic or
+  // OpenGL 4.6: samplers accept GL_TEXTURE_MAX_ANISOTROPY_EXT up to
+  // maxTextureAnisotropy
+  bool textureFilterAnisotropic = false;
+  float maxTextureAnisotropy = 1.f;
+
+  // GL_ARB_pipeline_statistics_query or OpenGL 4.6: queries count the
+  // vertices, primitives and shader invocations of the commands between
+  // glBeginQuery and glEndQuery
+  bool pipelineStatisticsQuery = false;
+
+  // GL_ARB_shader_draw_parameters: vertex shaders read the baseInstance of
+  // their indirect command (gl_BaseInstanceARB) without an instanced
+  // attribute. Only the extension is checked, OpenGL 4.6 names the variable
+  // gl_BaseInstance in #version 460 shaders only.
+  bool shaderDrawParameters = false;
+
+  // GL_KHR_shader_subgroup with the arithmetic feature in compute shaders:
+  // subgroupMin, subgroupMax, etc. combine the values of the invocations of
+  // a subgroup (a warp or wavefront) without shared memory nor barrier
+  bool shaderSubgroupArithmetic = false;
+
+  // GL_ARB_bindless_texture: shaders sample textures through 64-bit handles
+  // read from buffers, handles must be made resident before use
+  bool bindlessTexture = false;
+  GLuint64(APIENTRYP getTextureSamplerHandle)(
+      GLuint texture, GLuint sampler) = nullptr;
+  void(APIENTRYP makeTextureHandleResident)(GLuint64 handle) = nullptr;
+  void(APIENTRYP makeTextureHandleNonResident)(GLuint64 handle) = nullptr;
+
+  // GL_ARB_sparse_buffer: buffers created with GL_SPARSE_STORAGE_BIT_ARB
+  // reserve address space only, bufferPageCommitment backs ranges of pages
+  // of sparseBufferPageSize bytes with memory or releases it
+  bool sparseBuffer = false;
+  GLint sparseBufferPageSize = 0;
+  void(APIENTRYP bufferPageCommitment)(GLenum target, GLintptr offset,
+      GLsizeiptr size, GLboolean commit) = nullptr;
+
+  // GL_AMD_pinned_memory: glBufferData on
+  // GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD makes a buffer of page aligned
+  // host memory in place, which the GPU reads without copy (see
+  // PinnedMemory)
+  bool pinnedMemory = false;
+
+  // GL_NV_shading_rate_image: with GL_SHADING_RATE_IMAGE_NV enabled, the
+  // GL_R8UI texture bound by bindShadingRateImage gives each tile of
+  // shadingRateTexelSize pixels an index in the palette of rates of the
+  // viewport, the fragment shader runs once per 1x1 to 4x4 pixels of the
+  // tile (see ShadingRateImage)
+  bool shadingRateImage = false;
+  GLint shadingRateTexelSize[2] = {};
+  void(APIENTRYP bindShadingRateImage)(GLuint texture) = nullptr;
+  void(APIENTRYP shadingRateImagePalette)(GLuint viewport, GLuint first,
+      GLsizei count, const GLenum *rates) = nullptr;
+
+  // GL_ARB_direct_state_access (core in OpenGL 4.5): objects are created and
+  // edited by name, without binding them. Only the functions used by the
+  // wrappers of gl_objects.hpp are loaded.
+  bool directStateAccess = false;
+  void(APIENTRYP createBuffers)(GLsizei n, GLuint *buffers) = nullptr;
+  void(APIENTRYP namedBufferStorage)(GLuint buffer, GLsizeiptr size,
+      const void *data, GLbitfield flags) = nullptr;
+  void *(APIENTRYP mapNamedBufferRange)(GLuint buffer, GLintptr offset,
+      GLsizeiptr length, GLbitfield access) = nullptr;
+  GLboolean(APIENTRYP unmapNamedBuffer)(GLuint buffer) = nullptr;
+  void(APIENTRYP createTextures)(
+      GLenum target, GLsizei n, GLuint *textures) = nullptr;
+  void(APIENTRYP textureStorage2D)(GLuint texture, GLsizei levels,
+      GLenum internalFormat, GLsizei width, GLsizei height) = nullptr;
+  void(APIENTRYP textureParameteri)(
+      GLuint texture, GLenum pname, GLint param) = nullptr;
+  void(APIENTRYP createRenderbuffers)(GLsizei n, GLuint *renderbuffers) =
+      nullptr;
+  void(APIENTRYP namedRenderbufferStorageMultisample)(GLuint renderbuffer,
+      GLsizei samples, GLenum internalFormat, GLsizei width,
+      GLsizei height) = nullptr;
+  void(APIENTRYP createFramebuffers)(GLsizei n, GLuint *framebuffers) =
+      nullptr;
+  void(APIENTRYP namedFramebufferTexture)(GLuint framebuffer,
+      GLenum attachment, GLuint texture, GLint level) = nullptr;
+  void(APIENTRYP namedFramebufferTextureLayer)(GLuint framebuffer,
+      GLenum attachment, GLuint texture, GLint level, GLint layer) = nullptr;
+  void(APIENTRYP namedFramebufferRenderbuffer)(GLuint framebuffer,
+      GLenum attachment, GLenum renderbufferTarget,
+      GLuint renderbuffer) = nullptr;
+  void(APIENTRYP namedFramebufferDrawBuffer)(
+      GLuint framebuffer, GLenum buffer) = nullptr;
+  void(APIENTRYP namedFramebufferDrawBuffers)(
+      GLuint framebuffer, GLsizei n, const GLenum *buffers) = nullptr;
+  void(APIENTRYP namedFramebufferReadBuffer)(
+      GLuint framebuffer, GLenum buffer) = nullptr;
+  GLenum(APIENTRYP checkNamedFramebufferStatus)(
+      GLuint framebuffer, GLenum target) = nullptr;
+  void(APIENTRYP blitNamedFramebuffer)(GLuint readFramebuffer,
+      GLuint drawFramebuffer, GLint srcX0, GLint srcY0, GLint srcX1,
+      GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1,
+      GLbitfield mask, GLenum filter) = nullptr;
+  void(APIENTRYP createVertexArrays)(GLsizei n, GLuint *arrays) = nullptr;
+};
+
+// Called by GLFWHandle after glad is initialized
+void loadGLExtensions(GLADloadproc getProcAddress);
+
+const GLExtensions &getGLExtensions();
+
+// Return true if the current context supports extension name
+bool hasGLExtension(const char *name);
@@ -0,0 +1,259 @@
+#include "gl_memory.hpp"
+#include "gl_extensions.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+
+#include <imgui.h>
+#include <json.hpp>
+
+namespace
+{
+
+// GL_NVX_gpu_memory_info
+const GLenum GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX = 0x9047;
+const GLenum GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX = 0x9049;
+// GL_ATI_meminfo
+const GLenum TEXTURE_FREE_MEMORY_ATI = 0x87FC;
+
+// Bytes of a block of a compressed internal format and its size in texels,
+// 0 if the format is not compressed
+size_t getCompressedBlockSize(
+    GLenum internalFormat, size_t &blockWidth, size_t &blockHeight)
+{
+  blockWidth = 4;
+  blockHeight = 4;
+  if (internalFormat >= GL_COMPRESSED_RGBA_ASTC_4x4_KHR &&
+      internalFormat < GL_COMPRESSED_RGBA_ASTC_4x4_KHR + 14) {
+    internalFormat -= GL_COMPRESSED_RGBA_ASTC_4x4_KHR;
+  } else if (internalFormat >= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR &&
+             internalFormat < GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR + 14) {
+    internalFormat -= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR;
+  } else {
+    switch (internalFormat) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RED_RGTC1:
+    case GL_COMPRESSED_SIGNED_RED_RGTC1:
+    case GL_COMPRESSED_RGB8_ETC2:
+    case GL_COMPRESSED_SRGB8_ETC2:
+    case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+    case GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+    case GL_COMPRESSED_R11_EAC:
+    case GL_COMPRESSED_SIGNED_R11_EAC:
+      return 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_RG_RGTC2:
+    case GL_COMPRESSED_SIGNED_RG_RGTC2:
+    case GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT:
+    case GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT:
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+    case GL_COMPRESSED_RGBA8_ETC2_EAC:
+    case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+    case GL_COMPRESSED_RG11_EAC:
+    case GL_COMPRESSED_SIGNED_RG11_EAC:
+      return 16;
+    default:
+      return 0;
+    }
+  }
+  // ASTC footprints, all of 16 bytes
+  static const size_t footprints[14][2] = {{4, 4}, {5, 4}, {5, 5}, {6, 5},
+      {6, 6}, {8, 5}, {8, 6}, {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10},
+      {12, 10}, {12, 12}};
+  blockWidth = footprints[internalFormat][0];
+  blockHeight = footprints[internalFormat][1];
+  return 16;
+}
+
+// Owners may be destroyed by other threads than the one of the context
+std::atomic<size_t> g_bytes[GL_MEMORY_CATEGORY_COUNT];
+std::atomic<size_t> g_objectCounts[GL_MEMORY_CATEGORY_COUNT];
+
+} // namespace
+
+const char *getGLMemoryCategoryName(GLMemoryCategory category)
+{
+  static const char *names[] = {
+      "geometry", "textures", "renderTargets", "buffers"};
+  return names[size_t(category)];
+}
+
+size_t GLMemoryUsage::totalBytes() const
+{
+  size_t total = 0;
+  for (const auto categoryBytes : bytes) {
+    total += categoryBytes;
+  }
+  return total;
+}
+
+GLMemoryUsage getGLMemoryUsage()
+{
+  GLMemoryUsage usage;
+  for (size_t i = 0; i < GL_MEMORY_CATEGORY_COUNT; ++i) {
+    usage.bytes[i] = g_bytes[i];
+    usage.objectCounts[i] = g_objectCounts[i];
+  }
+  return usage;
+}
+
+TrackedGLMemory::TrackedGLMemory(GLMemoryCategory category, size_t bytes) :
+    m_category(category), m_nBytes(bytes), m_isTracked(true)
+{
+  g_bytes[size_t(m_category)] += m_nBytes;
+  ++g_objectCounts[size_t(m_category)];
+}
+
+TrackedGLMemory::~TrackedGLMemory()
+{
+  if (m_isTracked) {
+    g_bytes[size_t(m_category)] -= m_nBytes;
+    --g_objectCounts[size_t(m_category)];
+  }
+}
+
+size_t getTexelByteSize(GLenum internalFormat)
+{
+  switch (internalFormat) {
+  case GL_R8:
+    return 1;
+  case GL_RG8:
+  case GL_R16:
+  case GL_R16F:
+  case GL_DEPTH_COMPONENT16:
+    return 2;
+  case GL_RGB8:
+    return 3;
+  case GL_RG16:
+  case GL_RG16F:
+  case GL_R32F:
+  case GL_R32UI:
+  case GL_R11F_G11F_B10F:
+  case GL_RGB10_A2:
+  case GL_DEPTH_COMPONENT24: // Padded to 32 bits
+  case GL_DEPTH_COMPONENT32:
+  case GL_DEPTH_COMPONENT32F:
+  case GL_DEPTH24_STENCIL8:
+    return 4;
+  case GL_RGB16:
+  case GL_RGB16F:
+    return 6;
+  case GL_RGBA16:
+  case GL_RGBA16F:
+  case GL_RG32F:
+  case GL_DEPTH32F_STENCIL8: // Padded to 64 bits
+    return 8;
+  case GL_RGBA32F:
+    return 16;
+  default:
+    return 4; // GL_RGBA8, GL_SRGB8_ALPHA8...
+  }
+}
+
+size_t getTextureByteSize(GLenum internalFormat, size_t width, size_t height,
+    size_t levelCount, size_t layerCount, size_t sampleCount)
+{
+  size_t blockWidth, blockHeight;
+  auto blockSize =
+      getCompressedBlockSize(internalFormat, blockWidth, blockHeight);
+  if (!blockSize) {
+    blockWidth = blockHeight = 1;
+    blockSize = getTexelByteSize(internalFormat);
+  }
+  size_t blockCount = 0;
+  for (size_t level = 0; level < levelCount; ++level) {
+    const auto levelWidth = std::max(width >> level, size_t(1));
+    const auto levelHeight = std::max(height >> level, size_t(1));
+    blockCount += (levelWidth + blockWidth - 1) / blockWidth *
+                  ((levelHeight + blockHeight - 1) / blockHeight);
+  }
+  return blockCount * layerCount * std::max(sampleCount, size_t(1)) *
+         blockSize;
+}
+
+int64_t getAvailableVideoMemoryBytes()
+{
+  // Both are in kilobytes
+  if (hasGLExtension("GL_NVX_gpu_memory_info")) {
+    GLint available = 0;
+    glGetIntegerv(GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+    return int64_t(available) * 1024;
+  }
+  if (hasGLExtension("GL_ATI_meminfo")) {
+    // Total free memory of the pool, then the largest block, then the same
+    // for auxiliary memory
+    GLint free[4] = {};
+    glGetIntegerv(TEXTURE_FREE_MEMORY_ATI, free);
+    return int64_t(free[0]) * 1024;
+  }
+  return -1;
+}
+
+int64_t getDedicatedVideoMemoryBytes()
+{
+  if (hasGLExtension("GL_NVX_gpu_memory_info")) {
+    GLint dedicated = 0; // In kilobytes
+    glGetIntegerv(GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &dedicated);
+    return int64_t(dedicated) * 1024;
+  }
+  return -1;
+}
+
+void drawGLMemoryGUI(const GLMemoryUsage &usage, size_t modelHeapBytes)
+{
+  const auto toMiB = [](size_t bytes) { return float(bytes) / (1 << 20); };
+  ImGui::Text("Model heap: %.1f MiB", toMiB(modelHeapBytes));
+  for (size_t i = 0; i < GL_MEMORY_CATEGORY_COUNT; ++i) {
+    ImGui::Text("GL %s: %.1f MiB, %zu objects",
+        getGLMemoryCategoryName(GLMemoryCategory(i)), toMiB(usage.bytes[i]),
+        usage.objectCounts[i]);
+  }
+  ImGui::Text("GL total: %.1f MiB", toMiB(usage.totalBytes()));
+
+  const auto available = getAvailableVideoMemoryBytes();
+  const auto dedicated = getDedicatedVideoMemoryBytes();
+  if (available >= 0 && dedicated >= 0) {
+    ImGui::Text("Video memory: %.0f MiB used of %.0f MiB",
+        toMiB(size_t(std::max(dedicated - available, int64_t(0)))),
+        toMiB(size_t(dedicated)));
+  } else if (available >= 0) {
+    ImGui::Text("Video memory: %.0f MiB available", toMiB(size_t(available)));
+  } else {
+    ImGui::Text("Video memory: not reported by the driver");
+  }
+}
+
+bool writeMemoryReport(const fs::path &path, const GLMemoryUsage &usage,
+    size_t modelHeapBytes, std::string &err)
+{
+  std::ofstream file(path);
+  if (!file) {
+    err = "Unable to open " + path.string();
+    return false;
+  }
+
+  auto gl = nlohmann::json::object();
+  for (size_t i = 0; i < GL_MEMORY_CATEGORY_COUNT; ++i) {
+    gl[getGLMemoryCategoryName(GLMemoryCategory(i))] = {
+        {"bytes", usage.bytes[i]}, {"objects", usage.objectCounts[i]}};
+  }
+  const nlohmann::json document = {{"modelHeapBytes", modelHeapBytes},
+      {"gl", gl}, {"glTotalBytes", usage.totalBytes()},
+      {"videoMemory",
+          {{"dedicatedBytes", getDedicatedVideoMemoryBytes()},
+              {"availableBytes", getAvailableVideoMemoryBytes()}}}};
+  file << document.dump(2) << "\n";
+  if (!file) {
+    err = "Unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
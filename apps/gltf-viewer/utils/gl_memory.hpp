@@ -0,0 +1,99 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// Accounting of the GPU memory of the application. Owners of GL objects
+// (gl_objects.hpp, ImageTexture, GeometryArena...) hold a TrackedGLMemory
+// recording the size of their storage in a category, so that the total of
+// each category is known at any time (see getGLMemoryUsage). Sizes are
+// those requested by the application, the driver may pad or compress them.
+
+enum class GLMemoryCategory
+{
+  Geometry, // Vertices and indices
+  Textures, // Images of the scene and of the environment
+  RenderTargets, // Framebuffer attachments, shadow maps, histories
+  Buffers, // Uniform, storage, indirect and staging buffers
+  Count
+};
+
+const size_t GL_MEMORY_CATEGORY_COUNT = size_t(GLMemoryCategory::Count);
+
+// Lower case name, used in the GUI and the memory report
+const char *getGLMemoryCategoryName(GLMemoryCategory category);
+
+struct GLMemoryUsage
+{
+  size_t bytes[GL_MEMORY_CATEGORY_COUNT] = {};
+  size_t objectCounts[GL_MEMORY_CATEGORY_COUNT] = {};
+
+  size_t totalBytes() const;
+};
+
+// Storage of the live TrackedGLMemory of each category
+GLMemoryUsage getGLMemoryUsage();
+
+// Size of a GL object of category, counted from construction to
+// destruction. Owners of several objects may hold a single one for all.
+class TrackedGLMemory
+{
+public:
+  TrackedGLMemory() = default;
+
+  TrackedGLMemory(GLMemoryCategory category, size_t bytes);
+
+  ~TrackedGLMemory();
+
+  TrackedGLMemory(const TrackedGLMemory &) = delete;
+
+  TrackedGLMemory &operator=(const TrackedGLMemory &) = delete;
+
+  TrackedGLMemory(TrackedGLMemory &&rvalue) { *this = std::move(rvalue); }
+
+  TrackedGLMemory &operator=(TrackedGLMemory &&rvalue)
+  {
+    std::swap(m_category, rvalue.m_category);
+    std::swap(m_nBytes, rvalue.m_nBytes);
+    std::swap(m_isTracked, rvalue.m_isTracked);
+    return *this;
+  }
+
+  size_t bytes() const { return m_nBytes; }
+
+private:
+  GLMemoryCategory m_category = GLMemoryCategory::Buffers;
+  size_t m_nBytes = 0;
+  bool m_isTracked = false;
+};
+
+// Bytes of a texel of an uncompressed internal format, 4 if unknown
+size_t getTexelByteSize(GLenum internalFormat);
+
+// Storage of a texture: levelCount mipmap levels of layerCount layers of
+// sampleCount samples per texel. Compressed formats of gl_extensions.hpp
+// are counted in blocks.
+size_t getTextureByteSize(GLenum internalFormat, size_t width, size_t height,
+    size_t levelCount = 1, size_t layerCount = 1, size_t sampleCount = 1);
+
+// Available video memory reported by GL_NVX_gpu_memory_info or
+// GL_ATI_meminfo, -1 if the current context supports neither
+int64_t getAvailableVideoMemoryBytes();
+
+// Dedicated video memory of the GPU reported by GL_NVX_gpu_memory_info, -1
+// if unknown
+int64_t getDedicatedVideoMemoryBytes();
+
+// ImGui widgets of usage, of the model heap bytes and of the video memory
+void drawGLMemoryGUI(const GLMemoryUsage &usage, size_t modelHeapBytes);
+
+// Write usage, the heap bytes of the glTF model (see getModelHeapBytes) and
+// the video memory reported by the driver in a json file
+bool writeMemoryReport(const fs::path &path, const GLMemoryUsage &usage,
+    size_t modelHeapBytes, std::string &err);
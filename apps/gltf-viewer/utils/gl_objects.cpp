@@ -0,0 +1,327 @@
+#include "gl_objects.hpp"
+#include "gl_extensions.hpp"
+
+namespace
+{
+
+// Bind object to target for the lifetime of the binder, then restore the
+// object bound before. Only used without direct state access.
+class ScopedBinding
+{
+public:
+  ScopedBinding(GLenum target, GLenum targetBinding, GLuint object,
+      void(APIENTRYP bindFunction)(GLenum, GLuint)) :
+      m_target(target), m_bindFunction(bindFunction)
+  {
+    glGetIntegerv(targetBinding, &m_previous);
+    m_bindFunction(m_target, object);
+  }
+
+  ~ScopedBinding() { m_bindFunction(m_target, GLuint(m_previous)); }
+
+  ScopedBinding(const ScopedBinding &) = delete;
+  ScopedBinding &operator=(const ScopedBinding &) = delete;
+
+private:
+  GLenum m_target;
+  void(APIENTRYP m_bindFunction)(GLenum, GLuint);
+  GLint m_previous = 0;
+};
+
+ScopedBinding bindBuffer(GLuint buffer)
+{
+  return {GL_COPY_WRITE_BUFFER, GL_COPY_WRITE_BUFFER_BINDING, buffer,
+      glBindBuffer};
+}
+
+ScopedBinding bindTexture(GLuint texture)
+{
+  return {GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D, texture, glBindTexture};
+}
+
+ScopedBinding bindFramebuffer(GLenum target, GLuint framebuffer)
+{
+  const GLenum targetBinding = target == GL_READ_FRAMEBUFFER
+                                   ? GL_READ_FRAMEBUFFER_BINDING
+                                   : GL_DRAW_FRAMEBUFFER_BINDING;
+  return {target, targetBinding, framebuffer, glBindFramebuffer};
+}
+
+} // namespace
+
+GLBuffer::GLBuffer(size_t size, const void *data, GLbitfield flags,
+    GLMemoryCategory category) :
+    m_memory(category, size)
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.createBuffers(1, &m_GLId);
+    extensions.namedBufferStorage(m_GLId, GLsizeiptr(size), data, flags);
+    return;
+  }
+  glGenBuffers(1, &m_GLId);
+  const auto binding = bindBuffer(m_GLId);
+  glBufferStorage(GL_COPY_WRITE_BUFFER, GLsizeiptr(size), data, flags);
+}
+
+GLBuffer::~GLBuffer()
+{
+  if (m_GLId) {
+    glDeleteBuffers(1, &m_GLId);
+  }
+}
+
+void *GLBuffer::map(size_t offset, size_t size, GLbitfield access) const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    return extensions.mapNamedBufferRange(
+        m_GLId, GLintptr(offset), GLsizeiptr(size), access);
+  }
+  const auto binding = bindBuffer(m_GLId);
+  return glMapBufferRange(
+      GL_COPY_WRITE_BUFFER, GLintptr(offset), GLsizeiptr(size), access);
+}
+
+void GLBuffer::unmap() const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.unmapNamedBuffer(m_GLId);
+    return;
+  }
+  const auto binding = bindBuffer(m_GLId);
+  glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+}
+
+GLTexture::GLTexture(
+    GLsizei levelCount, GLenum internalFormat, GLsizei width, GLsizei height) :
+    m_memory(GLMemoryCategory::RenderTargets,
+        getTextureByteSize(
+            internalFormat, size_t(width), size_t(height), size_t(levelCount)))
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.createTextures(GL_TEXTURE_2D, 1, &m_GLId);
+    extensions.textureStorage2D(
+        m_GLId, levelCount, internalFormat, width, height);
+    return;
+  }
+  glGenTextures(1, &m_GLId);
+  const auto binding = bindTexture(m_GLId);
+  glTexStorage2D(GL_TEXTURE_2D, levelCount, internalFormat, width, height);
+}
+
+GLTexture::~GLTexture()
+{
+  if (m_GLId) {
+    glDeleteTextures(1, &m_GLId);
+  }
+}
+
+void GLTexture::setParameter(GLenum name, GLint value) const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.textureParameteri(m_GLId, name, value);
+    return;
+  }
+  const auto binding = bindTexture(m_GLId);
+  glTexParameteri(GL_TEXTURE_2D, name, value);
+}
+
+GLRenderbuffer::GLRenderbuffer(
+    GLenum internalFormat, GLsizei width, GLsizei height, GLsizei samples) :
+    m_memory(GLMemoryCategory::RenderTargets,
+        getTextureByteSize(internalFormat, size_t(width), size_t(height), 1,
+            1, size_t(samples)))
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.createRenderbuffers(1, &m_GLId);
+    extensions.namedRenderbufferStorageMultisample(
+        m_GLId, samples, internalFormat, width, height);
+    return;
+  }
+  glGenRenderbuffers(1, &m_GLId);
+  const ScopedBinding binding{
+      GL_RENDERBUFFER, GL_RENDERBUFFER_BINDING, m_GLId, glBindRenderbuffer};
+  glRenderbufferStorageMultisample(
+      GL_RENDERBUFFER, samples, internalFormat, width, height);
+}
+
+GLRenderbuffer::~GLRenderbuffer()
+{
+  if (m_GLId) {
+    glDeleteRenderbuffers(1, &m_GLId);
+  }
+}
+
+GLFramebuffer GLFramebuffer::create()
+{
+  const auto &extensions = getGLExtensions();
+  GLuint id = 0;
+  if (extensions.directStateAccess) {
+    extensions.createFramebuffers(1, &id);
+  } else {
+    // The name only becomes a framebuffer once bound
+    glGenFramebuffers(1, &id);
+    const auto binding = bindFramebuffer(GL_DRAW_FRAMEBUFFER, id);
+  }
+  return GLFramebuffer{id};
+}
+
+GLFramebuffer::~GLFramebuffer()
+{
+  if (m_GLId) {
+    glDeleteFramebuffers(1, &m_GLId);
+  }
+}
+
+void GLFramebuffer::attachTexture(
+    GLenum attachment, GLuint texture, GLint level) const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.namedFramebufferTexture(m_GLId, attachment, texture, level);
+    return;
+  }
+  const auto binding = bindFramebuffer(GL_DRAW_FRAMEBUFFER, m_GLId);
+  glFramebufferTexture(GL_DRAW_FRAMEBUFFER, attachment, texture, level);
+}
+
+void GLFramebuffer::attachTextureLayer(
+    GLenum attachment, GLuint texture, GLint level, GLint layer) const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.namedFramebufferTextureLayer(
+        m_GLId, attachment, texture, level, layer);
+    return;
+  }
+  const auto binding = bindFramebuffer(GL_DRAW_FRAMEBUFFER, m_GLId);
+  glFramebufferTextureLayer(
+      GL_DRAW_FRAMEBUFFER, attachment, texture, level, layer);
+}
+
+void GLFramebuffer::attachRenderbuffer(
+    GLenum attachment, GLuint renderbuffer) const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.namedFramebufferRenderbuffer(
+        m_GLId, attachment, GL_RENDERBUFFER, renderbuffer);
+    return;
+  }
+  const auto binding = bindFramebuffer(GL_DRAW_FRAMEBUFFER, m_GLId);
+  glFramebufferRenderbuffer(
+      GL_DRAW_FRAMEBUFFER, attachment, GL_RENDERBUFFER, renderbuffer);
+}
+
+void GLFramebuffer::setDrawBuffer(GLenum buffer) const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.namedFramebufferDrawBuffer(m_GLId, buffer);
+    return;
+  }
+  const auto binding = bindFramebuffer(GL_DRAW_FRAMEBUFFER, m_GLId);
+  glDrawBuffer(buffer);
+}
+
+void GLFramebuffer::setDrawBuffers(GLsizei count, const GLenum *buffers) const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.namedFramebufferDrawBuffers(m_GLId, count, buffers);
+    return;
+  }
+  const auto binding = bindFramebuffer(GL_DRAW_FRAMEBUFFER, m_GLId);
+  glDrawBuffers(count, buffers);
+}
+
+void GLFramebuffer::setReadBuffer(GLenum buffer) const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.namedFramebufferReadBuffer(m_GLId, buffer);
+    return;
+  }
+  const auto binding = bindFramebuffer(GL_READ_FRAMEBUFFER, m_GLId);
+  glReadBuffer(buffer);
+}
+
+GLenum GLFramebuffer::status() const
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    return extensions.checkNamedFramebufferStatus(
+        m_GLId, GL_DRAW_FRAMEBUFFER);
+  }
+  const auto binding = bindFramebuffer(GL_DRAW_FRAMEBUFFER, m_GLId);
+  return glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+}
+
+void GLFramebuffer::blit(GLuint readFramebuffer, GLuint drawFramebuffer,
+    GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0,
+    GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter)
+{
+  const auto &extensions = getGLExtensions();
+  if (extensions.directStateAccess) {
+    extensions.blitNamedFramebuffer(readFramebuffer, drawFramebuffer, srcX0,
+        srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter);
+    return;
+  }
+  const auto readBinding =
+      bindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+  const auto drawBinding =
+      bindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+  glBlitFramebuffer(srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1,
+      mask, filter);
+}
+
+GLenum GLFramebuffer::getDrawDepthFormat(GLuint drawFramebuffer)
+{
+  const GLenum depthAttachment =
+      drawFramebuffer ? GL_DEPTH_ATTACHMENT : GL_DEPTH;
+  const GLenum stencilAttachment =
+      drawFramebuffer ? GL_DEPTH_ATTACHMENT : GL_STENCIL;
+
+  GLint depthBits = 0, stencilBits = 0, componentType = GL_NONE;
+  glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, depthAttachment,
+      GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+  glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, depthAttachment,
+      GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &componentType);
+  glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER,
+      stencilAttachment, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+
+  if (componentType == GL_FLOAT) {
+    return stencilBits ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+  }
+  if (depthBits <= 16) {
+    return GL_DEPTH_COMPONENT16;
+  }
+  if (depthBits <= 24) {
+    return stencilBits ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+  }
+  return GL_DEPTH_COMPONENT32;
+}
+
+GLVertexArray GLVertexArray::create()
+{
+  const auto &extensions = getGLExtensions();
+  GLuint id = 0;
+  if (extensions.directStateAccess) {
+    extensions.createVertexArrays(1, &id);
+  } else {
+    glGenVertexArrays(1, &id);
+  }
+  return GLVertexArray{id};
+}
+
+GLVertexArray::~GLVertexArray()
+{
+  if (m_GLId) {
+    glDeleteVertexArrays(1, &m_GLId);
+  }
+}
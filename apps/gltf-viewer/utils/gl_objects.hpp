@@ -0,0 +1,239 @@
+#pragma once
+
+#include "gl_memory.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <utility>
+
+// Owners of GL objects, like GLShader and GLProgram for shaders.
+//
+// Objects are created and edited with GL_ARB_direct_state_access when the
+// context has it (see GLExtensions::directStateAccess), so that editing them
+// neither changes the bindings of the context nor needs to query them.
+// Otherwise each edit binds the object and restores the previous binding.
+//
+// Owners without an object, default constructed or moved from, call no GL
+// function when destroyed: they may be destroyed or moved without a context,
+// e.g. on loader threads.
+//
+// The storage of buffers, textures and renderbuffers is tracked (see
+// TrackedGLMemory).
+
+// Buffer with immutable storage
+class GLBuffer
+{
+  GLuint m_GLId = 0;
+  TrackedGLMemory m_memory;
+
+public:
+  GLBuffer() = default;
+
+  // size bytes initialized from data, uninitialized if data is null. flags
+  // are those of glBufferStorage.
+  GLBuffer(size_t size, const void *data, GLbitfield flags,
+      GLMemoryCategory category = GLMemoryCategory::Buffers);
+
+  ~GLBuffer();
+
+  GLBuffer(const GLBuffer &) = delete;
+
+  GLBuffer &operator=(const GLBuffer &) = delete;
+
+  GLBuffer(GLBuffer &&rvalue) :
+      m_GLId(rvalue.m_GLId), m_memory(std::move(rvalue.m_memory))
+  {
+    rvalue.m_GLId = 0;
+  }
+
+  GLBuffer &operator=(GLBuffer &&rvalue)
+  {
+    std::swap(m_GLId, rvalue.m_GLId);
+    std::swap(m_memory, rvalue.m_memory);
+    return *this;
+  }
+
+  GLuint glId() const { return m_GLId; }
+
+  // glMapBufferRange, access must be allowed by the storage flags
+  void *map(size_t offset, size_t size, GLbitfield access) const;
+
+  void unmap() const;
+};
+
+// 2D texture with immutable storage, tracked as a render target
+class GLTexture
+{
+  GLuint m_GLId = 0;
+  TrackedGLMemory m_memory;
+
+public:
+  GLTexture() = default;
+
+  GLTexture(
+      GLsizei levelCount, GLenum internalFormat, GLsizei width, GLsizei height);
+
+  ~GLTexture();
+
+  GLTexture(const GLTexture &) = delete;
+
+  GLTexture &operator=(const GLTexture &) = delete;
+
+  GLTexture(GLTexture &&rvalue) :
+      m_GLId(rvalue.m_GLId), m_memory(std::move(rvalue.m_memory))
+  {
+    rvalue.m_GLId = 0;
+  }
+
+  GLTexture &operator=(GLTexture &&rvalue)
+  {
+    std::swap(m_GLId, rvalue.m_GLId);
+    std::swap(m_memory, rvalue.m_memory);
+    return *this;
+  }
+
+  GLuint glId() const { return m_GLId; }
+
+  void setParameter(GLenum name, GLint value) const;
+};
+
+class GLRenderbuffer
+{
+  GLuint m_GLId = 0;
+  TrackedGLMemory m_memory;
+
+public:
+  GLRenderbuffer() = default;
+
+  // Multisampled if samples > 0 (glRenderbufferStorage is the same as
+  // glRenderbufferStorageMultisample with 0 samples)
+  GLRenderbuffer(GLenum internalFormat, GLsizei width, GLsizei height,
+      GLsizei samples = 0);
+
+  ~GLRenderbuffer();
+
+  GLRenderbuffer(const GLRenderbuffer &) = delete;
+
+  GLRenderbuffer &operator=(const GLRenderbuffer &) = delete;
+
+  GLRenderbuffer(GLRenderbuffer &&rvalue) :
+      m_GLId(rvalue.m_GLId), m_memory(std::move(rvalue.m_memory))
+  {
+    rvalue.m_GLId = 0;
+  }
+
+  GLRenderbuffer &operator=(GLRenderbuffer &&rvalue)
+  {
+    std::swap(m_GLId, rvalue.m_GLId);
+    std::swap(m_memory, rvalue.m_memory);
+    return *this;
+  }
+
+  GLuint glId() const { return m_GLId; }
+};
+
+class GLFramebuffer
+{
+  GLuint m_GLId = 0;
+
+  explicit GLFramebuffer(GLuint id) : m_GLId(id) {}
+
+public:
+  GLFramebuffer() = default;
+
+  // Framebuffer without attachments
+  static GLFramebuffer create();
+
+  ~GLFramebuffer();
+
+  GLFramebuffer(const GLFramebuffer &) = delete;
+
+  GLFramebuffer &operator=(const GLFramebuffer &) = delete;
+
+  GLFramebuffer(GLFramebuffer &&rvalue) : m_GLId(rvalue.m_GLId)
+  {
+    rvalue.m_GLId = 0;
+  }
+
+  GLFramebuffer &operator=(GLFramebuffer &&rvalue)
+  {
+    std::swap(m_GLId, rvalue.m_GLId);
+    return *this;
+  }
+
+  GLuint glId() const { return m_GLId; }
+
+  void attachTexture(GLenum attachment, GLuint texture, GLint level = 0) const;
+
+  // Attach a layer of an array texture
+  void attachTextureLayer(
+      GLenum attachment, GLuint texture, GLint level, GLint layer) const;
+
+  void attachRenderbuffer(GLenum attachment, GLuint renderbuffer) const;
+
+  // Single draw buffer, GL_NONE for depth only framebuffers
+  void setDrawBuffer(GLenum buffer) const;
+
+  // Draw buffers of fragment shader outputs 0 to count - 1
+  void setDrawBuffers(GLsizei count, const GLenum *buffers) const;
+
+  void setReadBuffer(GLenum buffer) const;
+
+  // glCheckFramebufferStatus as a draw framebuffer
+  GLenum status() const;
+
+  // Blit the rectangle [x0, x1) x [y0, y1) of this framebuffer at the same
+  // place in drawFramebuffer (0 for the default framebuffer)
+  void blit(GLuint drawFramebuffer, GLint x0, GLint y0, GLint x1, GLint y1,
+      GLbitfield mask, GLenum filter) const
+  {
+    blit(m_GLId, drawFramebuffer, x0, y0, x1, y1, x0, y0, x1, y1, mask,
+        filter);
+  }
+
+  // Blit the rectangle (srcX0, srcY0, srcX1, srcY1) of readFramebuffer to the
+  // rectangle (dstX0, dstY0, dstX1, dstY1) of drawFramebuffer
+  static void blit(GLuint readFramebuffer, GLuint drawFramebuffer,
+      GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0,
+      GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+
+  // Format of the depth buffer of the bound draw framebuffer, of name
+  // drawFramebuffer (0 for the default framebuffer). Blits of depth require
+  // the same format on both sides.
+  static GLenum getDrawDepthFormat(GLuint drawFramebuffer);
+};
+
+class GLVertexArray
+{
+  GLuint m_GLId = 0;
+
+  explicit GLVertexArray(GLuint id) : m_GLId(id) {}
+
+public:
+  GLVertexArray() = default;
+
+  // Vertex array without enabled attributes
+  static GLVertexArray create();
+
+  ~GLVertexArray();
+
+  GLVertexArray(const GLVertexArray &) = delete;
+
+  GLVertexArray &operator=(const GLVertexArray &) = delete;
+
+  GLVertexArray(GLVertexArray &&rvalue) : m_GLId(rvalue.m_GLId)
+  {
+    rvalue.m_GLId = 0;
+  }
+
+  GLVertexArray &operator=(GLVertexArray &&rvalue)
+  {
+    std::swap(m_GLId, rvalue.m_GLId);
+    return *this;
+  }
+
+  GLuint glId() const { return m_GLId; }
+
+  void bind() const { glBindVertexArray(m_GLId); }
+};
@@ -1,9 +1,1423 @@
 #include "gltf.hpp"
+#include "bounds.hpp"
+#include "file_prefetcher.hpp"
+#include "gltf_sax.hpp"
+#include "job_system.hpp"
+#include "ktx2.hpp"
+#include "parallel.hpp"
+#include "scene_hierarchy.hpp"
+#include "tracing.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <json.hpp>
+
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+
+std::vector<BufferSpan> getBufferSpans(const tinygltf::Model &model)
+{
+  std::vector<BufferSpan> buffers;
+  buffers.reserve(model.buffers.size());
+  for (const auto &buffer : model.buffers) {
+    buffers.push_back({buffer.data.data(), buffer.data.size()});
+  }
+  return buffers;
+}
+
+size_t getModelHeapBytes(const tinygltf::Model &model)
+{
+  size_t byteCount = 0;
+  for (const auto &buffer : model.buffers) {
+    byteCount += buffer.data.capacity();
+  }
+  for (const auto &image : model.images) {
+    byteCount += image.image.capacity();
+  }
+  return byteCount;
+}
+
+namespace
+{
+
+// https://github.com/KhronosGroup/glTF/tree/master/specification/2.0#binary-gltf-layout
+const uint32_t GLB_MAGIC = 0x46546C67; // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4E4F534A; // "JSON"
+const uint32_t GLB_CHUNK_BIN = 0x004E4942; // "BIN\0"
+
+uint32_t readUint32(const unsigned char *bytes)
+{
+  uint32_t value;
+  std::memcpy(&value, bytes, sizeof(value)); // GLB is little endian
+  return value;
+}
+
+void writeUint32(unsigned char *bytes, uint32_t value)
+{
+  std::memcpy(bytes, &value, sizeof(value));
+}
+
+// URIs we substitute in the JSON chunk so that tinygltf asks our FsCallbacks
+// for the data instead of copying the BIN chunk
+const std::string GLB_BIN_CHUNK_URI = "glb-bin-chunk.bin";
+const std::string GLB_BUFFER_VIEW_URI_PREFIX = "glb-buffer-view-";
+
+struct MappedGlbFsContext
+{
+  BufferSpan binChunk;
+  // (offset, length) in the BIN chunk of each bufferView referenced by an
+  // image
+  std::unordered_map<std::string, std::pair<size_t, size_t>> imageRanges;
+  LoadReport *report = nullptr; // Of the external files, if not null
+};
+
+bool endsWith(const std::string &str, const std::string &suffix)
+{
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+const std::pair<size_t, size_t> *findImageRange(
+    const MappedGlbFsContext &context, const std::string &path)
+{
+  const auto pos = path.find(GLB_BUFFER_VIEW_URI_PREFIX);
+  if (pos == std::string::npos) {
+    return nullptr;
+  }
+  const auto it = context.imageRanges.find(path.substr(pos));
+  return it == end(context.imageRanges) ? nullptr : &(*it).second;
+}
+
+bool mappedGlbFileExists(const std::string &path, void *userData)
+{
+  const auto &context = *static_cast<const MappedGlbFsContext *>(userData);
+  if (endsWith(path, GLB_BIN_CHUNK_URI) || findImageRange(context, path)) {
+    return true;
+  }
+  return tinygltf::FileExists(path, nullptr);
+}
+
+bool mappedGlbReadWholeFile(std::vector<unsigned char> *out, std::string *err,
+    const std::string &path, void *userData)
+{
+  const auto &context = *static_cast<const MappedGlbFsContext *>(userData);
+  if (endsWith(path, GLB_BIN_CHUNK_URI)) {
+    // The buffer byteLength has been replaced by 1 in the JSON, so tinygltf
+    // only stores this placeholder byte. Actual data is read from the mapping
+    out->assign(1, 0);
+    return true;
+  }
+  if (const auto range = findImageRange(context, path)) {
+    // Encoded image bytes, only alive during decoding
+    const auto begin = context.binChunk.data + range->first;
+    out->assign(begin, begin + range->second);
+    return true;
+  }
+  LoadReport::Scope scope{context.report, LoadPhase::FileIo};
+  if (!tinygltf::ReadWholeFile(out, err, path, nullptr)) {
+    return false;
+  }
+  if (context.report) {
+    context.report->addBytesRead(LoadPhase::FileIo, out->size());
+  }
+  return true;
+}
+
+// Paths of the external buffers and images of document, as tinygltf gives
+// them to its FsCallbacks when baseDir is the directory of the file
+std::vector<std::string> getExternalFilePaths(
+    const nlohmann::json &document, const std::string &baseDir)
+{
+  std::vector<std::string> paths;
+  for (const auto *key : {"buffers", "images"}) {
+    const auto it = document.find(key);
+    if (it == document.end() || !it->is_array()) {
+      continue;
+    }
+    for (const auto &resource : *it) {
+      const auto uri = resource.find("uri");
+      if (uri == resource.end() || !uri->is_string()) {
+        continue;
+      }
+      const auto &str = uri->get_ref<const std::string &>();
+      if (str.compare(0, 5, "data:") == 0) {
+        continue;
+      }
+      // Same as tinygltf's JoinPath
+      const auto path = baseDir.empty() || baseDir.back() == '/'
+                            ? baseDir + str
+                            : baseDir + "/" + str;
+      paths.push_back(tinygltf::ExpandFilePath(path, nullptr));
+    }
+  }
+  return paths;
+}
+
+// External files read by tinygltf for readGltfFile
+struct ExternalFileContext
+{
+  FilePrefetcher *prefetcher; // Files read ahead, if not null
+  LoadReport *report; // Of the reads, if not null
+};
+
+bool externalFileExists(const std::string &path, void *userData)
+{
+  const auto &context = *static_cast<ExternalFileContext *>(userData);
+  return (context.prefetcher && context.prefetcher->contains(path)) ||
+         tinygltf::FileExists(path, nullptr);
+}
+
+bool readExternalFile(std::vector<unsigned char> *out, std::string *err,
+    const std::string &path, void *userData)
+{
+  const auto &context = *static_cast<ExternalFileContext *>(userData);
+  // Waiting for a prefetched file counts as reading it
+  LoadReport::Scope scope{context.report, LoadPhase::FileIo};
+  if (!(context.prefetcher && context.prefetcher->take(path, *out)) &&
+      !tinygltf::ReadWholeFile(out, err, path, nullptr)) {
+    return false;
+  }
+  if (context.report) {
+    context.report->addBytesRead(LoadPhase::FileIo, out->size());
+  }
+  return true;
+}
+
+const std::string MESHOPT_EXTENSION = "EXT_meshopt_compression";
+
+// 1-byte data URI given to buffers and images that tinygltf must not read.
+// Fallback buffers of EXT_meshopt_compression may have no uri, which tinygltf
+// only accepts for the BIN chunk of GLB files, and resources deferred by
+// readGltfFile are read later.
+const std::string PLACEHOLDER_URI = "data:application/octet-stream;base64,AA==";
+
+// Give PLACEHOLDER_URI to fallback buffers without uri. The first buffer
+// of GLB files is the BIN chunk. Return true if document was changed.
+bool patchMeshoptFallbackBuffers(nlohmann::json &document, bool isGlb)
+{
+  const auto jsonBuffers = document.find("buffers");
+  if (jsonBuffers == document.end() || !jsonBuffers->is_array()) {
+    return false;
+  }
+  auto patched = false;
+  for (size_t i = isGlb ? 1 : 0; i < jsonBuffers->size(); ++i) {
+    auto &buffer = (*jsonBuffers)[i];
+    const auto extensions = buffer.find("extensions");
+    if (buffer.count("uri") || extensions == buffer.end() ||
+        !extensions->count(MESHOPT_EXTENSION)) {
+      continue;
+    }
+    buffer["uri"] = PLACEHOLDER_URI;
+    buffer["byteLength"] = 1;
+    patched = true;
+  }
+  return patched;
+}
+
+// Parse the node array of json with parseGltfNodes into nodes, and set
+// jsonWithoutNodes to json with an empty node array, left to tinygltf. It
+// stays empty if json has no node array. Return false and fill err if the
+// nodes are invalid.
+bool extractNodes(const char *json, size_t length,
+    std::vector<tinygltf::Node> &nodes, std::string &jsonWithoutNodes,
+    std::string &err)
+{
+  TRACE_ZONE("Parse nodes");
+  size_t nodesBegin, nodesEnd;
+  if (!findJsonMember(json, length, "nodes", nodesBegin, nodesEnd)) {
+    return true;
+  }
+  if (!parseGltfNodes(json + nodesBegin, nodesEnd - nodesBegin, nodes, err)) {
+    return false;
+  }
+  jsonWithoutNodes.reserve(length - (nodesEnd - nodesBegin) + 2);
+  jsonWithoutNodes.assign(json, nodesBegin)
+      .append("[]")
+      .append(json + nodesEnd, length - nodesEnd);
+  return true;
+}
+
+// Restore what patchMeshoptFallbackBuffers replaced, with empty data
+void clearMeshoptFallbackBuffers(tinygltf::Model &model)
+{
+  for (auto &buffer : model.buffers) {
+    if (buffer.uri == PLACEHOLDER_URI) {
+      buffer.uri.clear();
+      buffer.data = std::vector<unsigned char>();
+    }
+  }
+}
+
+const nlohmann::json &getJsonArray(
+    const nlohmann::json &object, const char *name)
+{
+  static const nlohmann::json EMPTY_ARRAY = nlohmann::json::array();
+  const auto it = object.find(name);
+  return it != object.end() && it->is_array() ? *it : EMPTY_ARRAY;
+}
+
+// Index in member name of object, -1 if it has none
+int getJsonIndex(const nlohmann::json &object, const char *name)
+{
+  const auto it = object.find(name);
+  return it != object.end() && it->is_number_integer() ? it->get<int>() : -1;
+}
+
+void markUsed(std::vector<char> &used, int index)
+{
+  if (index >= 0 && size_t(index) < used.size()) {
+    used[index] = 1;
+  }
+}
+
+// Mark the indices of the members of object, e.g. the accessors of
+// primitive attributes
+void markUsedMembers(const nlohmann::json &object, std::vector<char> &used)
+{
+  if (!object.is_object()) {
+    return;
+  }
+  for (const auto &index : object) {
+    if (index.is_number_integer()) {
+      markUsed(used, index.get<int>());
+    }
+  }
+}
+
+// Mark the textures of the texture infos of a material, e.g.
+// "baseColorTexture", including those of its extensions
+void markMaterialTextures(
+    const nlohmann::json &object, std::vector<char> &usedTextures)
+{
+  for (auto it = object.begin(); it != object.end(); ++it) {
+    if (!it->is_object()) {
+      continue;
+    }
+    if (endsWith(it.key(), "Texture")) {
+      markUsed(usedTextures, getJsonIndex(*it, "index"));
+    } else {
+      markMaterialTextures(*it, usedTextures);
+    }
+  }
+}
+
+// Find the buffers, bufferViews and images read by the default scene of
+// document, whose nodes were extracted in nodes (see extractNodes): its node
+// trees, their meshes, skins and materials, and the animations of these
+// nodes. Everything is used if document has no scene.
+void findDefaultSceneResources(const nlohmann::json &document,
+    const std::vector<tinygltf::Node> &nodes, std::vector<char> &usedBuffers,
+    std::vector<char> &usedBufferViews, std::vector<char> &usedImages)
+{
+  const auto &scenes = getJsonArray(document, "scenes");
+  const auto &meshes = getJsonArray(document, "meshes");
+  const auto &skins = getJsonArray(document, "skins");
+  const auto &materials = getJsonArray(document, "materials");
+  const auto &textures = getJsonArray(document, "textures");
+  const auto &images = getJsonArray(document, "images");
+  const auto &accessors = getJsonArray(document, "accessors");
+  const auto &bufferViews = getJsonArray(document, "bufferViews");
+  const auto &buffers = getJsonArray(document, "buffers");
+
+  // The viewer shows the first scene if there is no default one
+  const auto sceneIdx = std::max(getJsonIndex(document, "scene"), 0);
+  if (size_t(sceneIdx) >= scenes.size()) {
+    usedBuffers.assign(buffers.size(), 1);
+    usedBufferViews.assign(bufferViews.size(), 1);
+    usedImages.assign(images.size(), 1);
+    return;
+  }
+  usedBuffers.assign(buffers.size(), 0);
+  usedBufferViews.assign(bufferViews.size(), 0);
+  usedImages.assign(images.size(), 0);
+
+  std::vector<char> usedNodes(nodes.size(), 0);
+  std::vector<char> usedMeshes(meshes.size(), 0);
+  std::vector<char> usedMaterials(materials.size(), 0);
+  std::vector<char> usedTextures(textures.size(), 0);
+  std::vector<char> usedAccessors(accessors.size(), 0);
+
+  std::vector<int> nodeStack;
+  const auto pushNodes = [&](const nlohmann::json &nodeIndices) {
+    for (const auto &nodeIdx : nodeIndices) {
+      if (nodeIdx.is_number_integer()) {
+        nodeStack.push_back(nodeIdx.get<int>());
+      }
+    }
+  };
+  pushNodes(getJsonArray(scenes[sceneIdx], "nodes"));
+  while (!nodeStack.empty()) {
+    const auto nodeIdx = nodeStack.back();
+    nodeStack.pop_back();
+    if (nodeIdx < 0 || size_t(nodeIdx) >= nodes.size() || usedNodes[nodeIdx]) {
+      continue;
+    }
+    usedNodes[nodeIdx] = 1;
+    const auto &node = nodes[nodeIdx];
+    nodeStack.insert(end(nodeStack), begin(node.children), end(node.children));
+    markUsed(usedMeshes, node.mesh);
+    if (node.skin >= 0 && size_t(node.skin) < skins.size()) {
+      const auto &skin = skins[node.skin];
+      markUsed(usedAccessors, getJsonIndex(skin, "inverseBindMatrices"));
+      pushNodes(getJsonArray(skin, "joints"));
+    }
+    const auto instancing = node.extensions.find("EXT_mesh_gpu_instancing");
+    if (instancing != end(node.extensions)) {
+      const auto &attributes = instancing->second.Get("attributes");
+      for (const auto &name : attributes.Keys()) {
+        const auto &accessorIdx = attributes.Get(name);
+        if (accessorIdx.IsNumber()) {
+          markUsed(usedAccessors, accessorIdx.GetNumberAsInt());
+        }
+      }
+    }
+  }
+
+  for (size_t meshIdx = 0; meshIdx < meshes.size(); ++meshIdx) {
+    if (!usedMeshes[meshIdx]) {
+      continue;
+    }
+    // Materials of KHR_materials_variants mappings are deferred
+    for (const auto &primitive : getJsonArray(meshes[meshIdx], "primitives")) {
+      markUsed(usedAccessors, getJsonIndex(primitive, "indices"));
+      markUsed(usedMaterials, getJsonIndex(primitive, "material"));
+      const auto attributes = primitive.find("attributes");
+      if (attributes != primitive.end()) {
+        markUsedMembers(*attributes, usedAccessors);
+      }
+      for (const auto &target : getJsonArray(primitive, "targets")) {
+        markUsedMembers(target, usedAccessors);
+      }
+    }
+  }
+
+  for (const auto &animation : getJsonArray(document, "animations")) {
+    const auto &samplers = getJsonArray(animation, "samplers");
+    for (const auto &channel : getJsonArray(animation, "channels")) {
+      const auto target = channel.find("target");
+      const auto samplerIdx = getJsonIndex(channel, "sampler");
+      if (target == channel.end() || samplerIdx < 0 ||
+          size_t(samplerIdx) >= samplers.size()) {
+        continue;
+      }
+      const auto nodeIdx = getJsonIndex(*target, "node");
+      if (nodeIdx >= 0 && size_t(nodeIdx) < nodes.size() &&
+          usedNodes[nodeIdx]) {
+        markUsed(usedAccessors, getJsonIndex(samplers[samplerIdx], "input"));
+        markUsed(usedAccessors, getJsonIndex(samplers[samplerIdx], "output"));
+      }
+    }
+  }
+
+  for (size_t materialIdx = 0; materialIdx < materials.size();
+       ++materialIdx) {
+    if (usedMaterials[materialIdx]) {
+      markMaterialTextures(materials[materialIdx], usedTextures);
+    }
+  }
+  for (size_t textureIdx = 0; textureIdx < textures.size(); ++textureIdx) {
+    if (!usedTextures[textureIdx]) {
+      continue;
+    }
+    const auto &texture = textures[textureIdx];
+    markUsed(usedImages, getJsonIndex(texture, "source"));
+    // KHR_texture_basisu and other image formats have their own source
+    const auto extensions = texture.find("extensions");
+    if (extensions != texture.end() && extensions->is_object()) {
+      for (const auto &extension : *extensions) {
+        markUsed(usedImages, getJsonIndex(extension, "source"));
+      }
+    }
+  }
+
+  for (size_t accessorIdx = 0; accessorIdx < accessors.size();
+       ++accessorIdx) {
+    if (!usedAccessors[accessorIdx]) {
+      continue;
+    }
+    const auto &accessor = accessors[accessorIdx];
+    markUsed(usedBufferViews, getJsonIndex(accessor, "bufferView"));
+    const auto sparse = accessor.find("sparse");
+    if (sparse != accessor.end()) {
+      for (const auto name : {"indices", "values"}) {
+        const auto member = sparse->find(name);
+        if (member != sparse->end()) {
+          markUsed(usedBufferViews, getJsonIndex(*member, "bufferView"));
+        }
+      }
+    }
+  }
+  for (size_t imageIdx = 0; imageIdx < images.size(); ++imageIdx) {
+    if (usedImages[imageIdx]) {
+      markUsed(usedBufferViews, getJsonIndex(images[imageIdx], "bufferView"));
+    }
+  }
+  for (size_t viewIdx = 0; viewIdx < bufferViews.size(); ++viewIdx) {
+    if (!usedBufferViews[viewIdx]) {
+      continue;
+    }
+    const auto &bufferView = bufferViews[viewIdx];
+    markUsed(usedBuffers, getJsonIndex(bufferView, "buffer"));
+    const auto extensions = bufferView.find("extensions");
+    if (extensions != bufferView.end()) {
+      const auto meshopt = extensions->find(MESHOPT_EXTENSION);
+      if (meshopt != extensions->end()) {
+        markUsed(usedBuffers, getJsonIndex(*meshopt, "buffer"));
+      }
+    }
+  }
+}
+
+// What deferUnusedResources replaced in a JSON document, indexed like its
+// arrays. Uris are empty for resources read by tinygltf.
+struct DeferredUris
+{
+  std::vector<std::string> buffers;
+  std::vector<size_t> bufferLengths;
+  std::vector<std::string> images;
+};
+
+bool isExternalUri(const nlohmann::json &object)
+{
+  const auto uri = object.find("uri");
+  return uri != object.end() && uri->is_string() &&
+         !tinygltf::IsDataURI(uri->get<std::string>());
+}
+
+// Give PLACEHOLDER_URI to the external buffers and images of document that
+// its default scene does not use (see findDefaultSceneResources), moving
+// their uris to deferredUris. Return true if document was changed.
+bool deferUnusedResources(nlohmann::json &document,
+    const std::vector<tinygltf::Node> &nodes, DeferredUris &deferredUris)
+{
+  TRACE_ZONE("Find default scene resources");
+  std::vector<char> usedBuffers;
+  std::vector<char> usedBufferViews;
+  std::vector<char> usedImages;
+  findDefaultSceneResources(
+      document, nodes, usedBuffers, usedBufferViews, usedImages);
+
+  auto patched = false;
+  deferredUris.buffers.assign(usedBuffers.size(), std::string());
+  deferredUris.bufferLengths.assign(usedBuffers.size(), 0);
+  for (size_t bufferIdx = 0; bufferIdx < usedBuffers.size(); ++bufferIdx) {
+    auto &buffer = document["buffers"][bufferIdx];
+    const auto byteLength = buffer.find("byteLength");
+    if (usedBuffers[bufferIdx] || !isExternalUri(buffer) ||
+        byteLength == buffer.end() || !byteLength->is_number_unsigned()) {
+      continue;
+    }
+    deferredUris.buffers[bufferIdx] = buffer["uri"].get<std::string>();
+    deferredUris.bufferLengths[bufferIdx] = byteLength->get<size_t>();
+    buffer["uri"] = PLACEHOLDER_URI;
+    buffer["byteLength"] = 1;
+    patched = true;
+  }
+  deferredUris.images.assign(usedImages.size(), std::string());
+  for (size_t imageIdx = 0; imageIdx < usedImages.size(); ++imageIdx) {
+    auto &image = document["images"][imageIdx];
+    if (usedImages[imageIdx] || !isExternalUri(image)) {
+      continue;
+    }
+    deferredUris.images[imageIdx] = image["uri"].get<std::string>();
+    image["uri"] = PLACEHOLDER_URI;
+    patched = true;
+  }
+  return patched;
+}
+
+// Image loader skipping the images deferred by readGltfFile, the others are
+// given to load
+struct DeferredImageFilter
+{
+  const std::vector<std::string> *deferredUris;
+  tinygltf::LoadImageDataFunction load;
+  void *userData;
+
+  static bool loadImageData(tinygltf::Image *image, const int imageIdx,
+      std::string *err, std::string *warn, int reqWidth, int reqHeight,
+      const unsigned char *bytes, int size, void *userData)
+  {
+    const auto &filter = *static_cast<const DeferredImageFilter *>(userData);
+    const auto &uris = *filter.deferredUris;
+    if (size_t(imageIdx) < uris.size() && !uris[imageIdx].empty()) {
+      return true;
+    }
+    return filter.load(image, imageIdx, err, warn, reqWidth, reqHeight, bytes,
+        size, filter.userData);
+  }
+};
+
+} // namespace
+
+bool loadImageData(tinygltf::Image *image, const int imageIdx,
+    std::string *err, std::string *warn, int reqWidth, int reqHeight,
+    const unsigned char *bytes, int size, void *userData)
+{
+  if (!isKtx2(bytes, size_t(size))) {
+    return tinygltf::LoadImageData(image, imageIdx, err, warn, reqWidth,
+        reqHeight, bytes, size, userData);
+  }
+  Ktx2Image ktx2;
+  std::string ktx2Err;
+  if (!parseKtx2(bytes, size_t(size), ktx2, ktx2Err)) {
+    if (err) {
+      *err += "image[" + std::to_string(imageIdx) + "]: " + ktx2Err + "\n";
+    }
+    return false;
+  }
+  image->width = int(ktx2.width);
+  image->height = int(ktx2.height);
+  image->component = 4;
+  image->bits = 8;
+  image->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+  image->mimeType = "image/ktx2";
+  image->as_is = true;
+  image->image.assign(bytes, bytes + size);
+  return true;
+}
+
+void ParallelImageDecoder::install(tinygltf::TinyGLTF &loader)
+{
+  m_encodedImages.clear();
+  loader.SetImageLoader(&ParallelImageDecoder::storeEncodedImage, this);
+}
+
+bool ParallelImageDecoder::storeEncodedImage(tinygltf::Image *image,
+    const int imageIdx, std::string *err, std::string *warn, int reqWidth,
+    int reqHeight, const unsigned char *bytes, int size, void *userData)
+{
+  auto &self = *static_cast<ParallelImageDecoder *>(userData);
+  if (size_t(imageIdx) >= self.m_encodedImages.size()) {
+    self.m_encodedImages.resize(imageIdx + 1);
+  }
+  auto &encodedImage = self.m_encodedImages[imageIdx];
+  encodedImage.reqWidth = reqWidth;
+  encodedImage.reqHeight = reqHeight;
+  encodedImage.bytes.assign(bytes, bytes + size);
+  return true;
+}
+
+bool ParallelImageDecoder::decode(tinygltf::Model &model, size_t threadCount,
+    std::string &err, std::string &warn)
+{
+  TRACE_ZONE("Decode images");
+  const auto imageCount = std::min(m_encodedImages.size(), model.images.size());
+  // Each task writes its own messages, concatenated in image order at the end
+  std::vector<std::string> errors(imageCount);
+  std::vector<std::string> warnings(imageCount);
+  std::vector<char> results(imageCount, true);
+
+  const auto decodeImage = [&](size_t imageIdx) {
+    auto &encodedImage = m_encodedImages[imageIdx];
+    if (encodedImage.bytes.empty()) {
+      return; // Not referenced through a data URI / bufferView / file
+    }
+    TRACE_ZONE("Decode image");
+    results[imageIdx] = loadImageData(&model.images[imageIdx],
+        int(imageIdx), &errors[imageIdx], &warnings[imageIdx],
+        encodedImage.reqWidth, encodedImage.reqHeight,
+        encodedImage.bytes.data(), int(encodedImage.bytes.size()), nullptr);
+    encodedImage.bytes = std::vector<unsigned char>();
+  };
+  if (threadCount) {
+    parallelFor(imageCount, threadCount, decodeImage);
+  } else {
+    // One job per image, stolen one at a time to balance uneven images
+    getJobSystem().parallelFor(imageCount, 1, [&](size_t begin, size_t end) {
+      for (auto imageIdx = begin; imageIdx < end; ++imageIdx) {
+        decodeImage(imageIdx);
+      }
+    });
+  }
+  m_encodedImages.clear();
+
+  for (size_t i = 0; i < imageCount; ++i) {
+    err += errors[i];
+    warn += warnings[i];
+  }
+  return std::all_of(begin(results), end(results), [](char r) { return r; });
+}
+
+bool readGltfFile(const fs::path &path, tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers, std::string &err, std::string &warn,
+    ParallelImageDecoder *imageDecoder, DeferredResources *deferred,
+    size_t maxPrefetchedFiles, LoadReport *report)
+{
+  TRACE_ZONE("Parse glTF file");
+  std::vector<unsigned char> bytes;
+  {
+    LoadReport::Scope scope{report, LoadPhase::FileIo};
+    if (!tinygltf::ReadWholeFile(&bytes, &err, path.string(), nullptr)) {
+      return false;
+    }
+  }
+  if (report) {
+    report->addBytesRead(LoadPhase::FileIo, bytes.size());
+  }
+  const auto isGlb = path.extension() == ".glb";
+
+  // Invalid GLB headers are left to tinygltf
+  size_t jsonOffset = 0;
+  size_t jsonLength = bytes.size();
+  size_t length = bytes.size();
+  if (isGlb) {
+    jsonLength = 0;
+    if (bytes.size() >= 20 && readUint32(bytes.data()) == GLB_MAGIC &&
+        readUint32(bytes.data() + 16) == GLB_CHUNK_JSON) {
+      length = std::min(size_t(readUint32(bytes.data() + 8)), bytes.size());
+      jsonOffset = 20;
+      jsonLength =
+          std::min(size_t(readUint32(bytes.data() + 12)), length - jsonOffset);
+    }
+  }
+
+  // Nodes are parsed without DOM (see gltf_sax.hpp), tinygltf parses the
+  // rest of the JSON
+  const auto json = reinterpret_cast<const char *>(bytes.data()) + jsonOffset;
+  std::vector<tinygltf::Node> nodes;
+  std::string patchedJson; // Given to tinygltf instead of json if not empty
+  if (!extractNodes(json, jsonLength, nodes, patchedJson, err)) {
+    return false;
+  }
+  const auto hasNodes = !patchedJson.empty();
+
+  // The JSON is only parsed twice if it mentions EXT_meshopt_compression,
+  // if resources are deferred or if external files are prefetched
+  const auto hasMeshopt =
+      std::search(json, json + jsonLength, begin(MESHOPT_EXTENSION),
+          end(MESHOPT_EXTENSION)) != json + jsonLength;
+  const auto baseDir = path.parent_path().string();
+  DeferredUris deferredUris;
+  // Reads the files tinygltf asks for one at a time, after the JSON
+  std::unique_ptr<FilePrefetcher> prefetcher;
+  if (hasMeshopt || deferred || maxPrefetchedFiles) {
+    nlohmann::json document;
+    try {
+      document = hasNodes ? nlohmann::json::parse(patchedJson)
+                          : nlohmann::json::parse(json, json + jsonLength);
+    } catch (const std::exception &e) {
+      err = std::string("Unable to parse JSON: ") + e.what();
+      return false;
+    }
+    auto patched = hasMeshopt && patchMeshoptFallbackBuffers(document, isGlb);
+    if (deferred && deferUnusedResources(document, nodes, deferredUris)) {
+      patched = true;
+    }
+    if (patched) {
+      patchedJson = document.dump();
+    }
+    // Deferred resources have a data URI by now
+    if (maxPrefetchedFiles) {
+      prefetcher = std::make_unique<FilePrefetcher>(
+          getExternalFilePaths(document, baseDir), maxPrefetchedFiles);
+    }
+  }
+  if (!patchedJson.empty()) {
+    if (isGlb) {
+      // Same header and BIN chunk, chunks are padded to 4 bytes
+      patchedJson.resize((patchedJson.size() + 3) & ~size_t(3), ' ');
+      const auto binChunkOffset = 20 + ((jsonLength + 3) & ~size_t(3));
+      std::vector<unsigned char> glb(begin(bytes), begin(bytes) + 20);
+      glb.insert(end(glb), begin(patchedJson), end(patchedJson));
+      if (binChunkOffset < length) {
+        glb.insert(
+            end(glb), begin(bytes) + binChunkOffset, begin(bytes) + length);
+      }
+      writeUint32(glb.data() + 8, uint32_t(glb.size()));
+      writeUint32(glb.data() + 12, uint32_t(patchedJson.size()));
+      bytes.swap(glb);
+    } else {
+      bytes.assign(begin(patchedJson), end(patchedJson));
+    }
+  }
+
+  tinygltf::TinyGLTF loader;
+  if (imageDecoder) {
+    imageDecoder->install(loader);
+  } else {
+    loader.SetImageLoader(&loadImageData, nullptr);
+  }
+  DeferredImageFilter imageFilter{&deferredUris.images,
+      imageDecoder ? &ParallelImageDecoder::storeEncodedImage : &loadImageData,
+      imageDecoder};
+  if (deferred) {
+    loader.SetImageLoader(&DeferredImageFilter::loadImageData, &imageFilter);
+  }
+  ExternalFileContext fileContext{
+      prefetcher && prefetcher->fileCount() ? prefetcher.get() : nullptr,
+      report};
+  if (fileContext.prefetcher || report) {
+    loader.SetFsCallbacks({&externalFileExists, &tinygltf::ExpandFilePath,
+        &readExternalFile, &tinygltf::WriteWholeFile, &fileContext});
+  }
+  const auto ret =
+      isGlb ? loader.LoadBinaryFromMemory(&model, &err, &warn, bytes.data(),
+                  (unsigned int)bytes.size(), baseDir)
+            : loader.LoadASCIIFromString(&model, &err, &warn,
+                  reinterpret_cast<const char *>(bytes.data()),
+                  (unsigned int)bytes.size(), baseDir);
+  if (!ret) {
+    return false;
+  }
+  if (hasNodes) {
+    model.nodes = std::move(nodes);
+  }
+  if (!deferred) {
+    clearMeshoptFallbackBuffers(model);
+    buffers = getBufferSpans(model);
+    return true;
+  }
+
+  // Restore the uris of deferred resources, then map deferred buffers
+  auto &bufferUris = deferredUris.buffers;
+  for (size_t i = 0; i < bufferUris.size() && i < model.buffers.size(); ++i) {
+    if (!bufferUris[i].empty()) {
+      model.buffers[i].uri = bufferUris[i];
+      model.buffers[i].data = std::vector<unsigned char>();
+    }
+  }
+  clearMeshoptFallbackBuffers(model);
+  *deferred = DeferredResources();
+  deferred->baseDirectory = path.parent_path();
+  deferred->images.assign(model.images.size(), 0);
+  auto &imageUris = deferredUris.images;
+  for (size_t i = 0; i < imageUris.size() && i < model.images.size(); ++i) {
+    if (!imageUris[i].empty()) {
+      model.images[i].uri = std::move(imageUris[i]);
+      deferred->images[i] = 1;
+      ++deferred->deferredImageCount;
+    }
+  }
+  buffers = getBufferSpans(model);
+  for (size_t i = 0; i < bufferUris.size() && i < model.buffers.size(); ++i) {
+    if (bufferUris[i].empty()) {
+      continue;
+    }
+    const auto bufferPath = deferred->baseDirectory / fs::path(bufferUris[i]);
+    MappedFile mapping;
+    try {
+      mapping = MappedFile(bufferPath);
+    } catch (const std::exception &e) {
+      err = e.what();
+      return false;
+    }
+    const auto byteLength = deferredUris.bufferLengths[i];
+    // Same check as tinygltf for the buffers it reads
+    if (mapping.size() != byteLength) {
+      err = "File size mismatch : " + bufferPath.string() +
+            ", requestedBytes " + std::to_string(byteLength) + ", but got " +
+            std::to_string(mapping.size());
+      return false;
+    }
+    buffers[i] = {mapping.data(), byteLength};
+    deferred->bufferMappings.push_back(std::move(mapping));
+    ++deferred->deferredBufferCount;
+  }
+  return true;
+}
+
+bool findGlbDefaultSceneRanges(const char *json, size_t length,
+    std::vector<std::pair<size_t, size_t>> &ranges, std::string &err)
+{
+  std::vector<tinygltf::Node> nodes;
+  std::string jsonWithoutNodes;
+  if (!extractNodes(json, length, nodes, jsonWithoutNodes, err)) {
+    return false;
+  }
+  nlohmann::json document;
+  try {
+    document = !jsonWithoutNodes.empty()
+                   ? nlohmann::json::parse(jsonWithoutNodes)
+                   : nlohmann::json::parse(json, json + length);
+  } catch (const std::exception &e) {
+    err = std::string("Unable to parse JSON: ") + e.what();
+    return false;
+  }
+  std::vector<char> usedBuffers;
+  std::vector<char> usedBufferViews;
+  std::vector<char> usedImages;
+  findDefaultSceneResources(
+      document, nodes, usedBuffers, usedBufferViews, usedImages);
+  // tinygltf decodes every image of the BIN chunk, used or not
+  const auto &images = getJsonArray(document, "images");
+  for (const auto &image : images) {
+    markUsed(usedBufferViews, getJsonIndex(image, "bufferView"));
+  }
+
+  ranges.clear();
+  const auto &buffers = getJsonArray(document, "buffers");
+  if (buffers.empty() || buffers[0].count("uri")) {
+    return true; // No BIN chunk
+  }
+  const auto addRange = [&](const nlohmann::json &view) {
+    const auto byteOffset = view.find("byteOffset");
+    const auto byteLength = view.find("byteLength");
+    if (getJsonIndex(view, "buffer") != 0 || byteLength == view.end() ||
+        !byteLength->is_number_unsigned()) {
+      return;
+    }
+    const auto first = byteOffset != view.end() &&
+                               byteOffset->is_number_unsigned()
+                           ? byteOffset->get<size_t>()
+                           : size_t(0);
+    ranges.emplace_back(first, first + byteLength->get<size_t>());
+  };
+  const auto &bufferViews = getJsonArray(document, "bufferViews");
+  for (size_t viewIdx = 0; viewIdx < bufferViews.size(); ++viewIdx) {
+    if (!usedBufferViews[viewIdx]) {
+      continue;
+    }
+    // Compressed views are read from the buffer of their extension, their
+    // own buffer is a fallback
+    const auto &bufferView = bufferViews[viewIdx];
+    const auto extensions = bufferView.find("extensions");
+    if (extensions != bufferView.end()) {
+      const auto meshopt = extensions->find(MESHOPT_EXTENSION);
+      if (meshopt != extensions->end()) {
+        addRange(*meshopt);
+        continue;
+      }
+    }
+    addRange(bufferView);
+  }
+  return true;
+}
+
+bool loadDeferredImage(tinygltf::Model &model, DeferredResources &deferred,
+    size_t imageIdx, std::string &err, std::string &warn)
+{
+  if (!deferred.isImageDeferred(imageIdx) || imageIdx >= model.images.size()) {
+    return true;
+  }
+  TRACE_ZONE("Load deferred image");
+  deferred.images[imageIdx] = 0;
+  auto &image = model.images[imageIdx];
+  MappedFile mapping;
+  try {
+    mapping = MappedFile(deferred.baseDirectory / fs::path(image.uri));
+  } catch (const std::exception &e) {
+    err += std::string(e.what()) + "\n";
+    return false;
+  }
+  if (mapping.empty()) {
+    err += "Image file is empty : " + image.uri + "\n";
+    return false;
+  }
+  return loadImageData(&image, int(imageIdx), &err, &warn, 0, 0,
+      mapping.data(), int(mapping.size()), nullptr);
+}
+
+bool loadMappedGlbFile(const fs::path &path, tinygltf::Model &model,
+    MappedFile &mapping, std::vector<BufferSpan> &buffers, std::string &err,
+    std::string &warn, ParallelImageDecoder *imageDecoder,
+    LoadReport *report)
+{
+  TRACE_ZONE("Parse glTF file");
+  try {
+    LoadReport::Scope scope{report, LoadPhase::FileIo};
+    mapping = MappedFile{path};
+  } catch (const std::runtime_error &e) {
+    err = e.what();
+    return false;
+  }
+  // Pages are read as they are touched, by the parser or the uploads
+  if (report) {
+    report->addBytesRead(LoadPhase::FileIo, mapping.size());
+  }
+
+  const auto bytes = mapping.data();
+  const auto size = mapping.size();
+  if (size < 20 || readUint32(bytes) != GLB_MAGIC ||
+      readUint32(bytes + 8) > size) {
+    err = "Invalid glTF binary file " + path.string();
+    return false;
+  }
+  const size_t length = readUint32(bytes + 8);
+
+  const auto jsonLength = size_t(readUint32(bytes + 12));
+  if (readUint32(bytes + 16) != GLB_CHUNK_JSON || 20 + jsonLength > length) {
+    err = "Invalid JSON chunk in glTF binary file " + path.string();
+    return false;
+  }
+  const auto json = reinterpret_cast<const char *>(bytes + 20);
+
+  MappedGlbFsContext context;
+  context.report = report;
+  // Chunks are 4-byte aligned, the BIN chunk is optional
+  const auto binChunkOffset = 20 + ((jsonLength + 3) & ~size_t(3));
+  if (binChunkOffset + 8 <= length &&
+      readUint32(bytes + binChunkOffset + 4) == GLB_CHUNK_BIN) {
+    const size_t binLength = readUint32(bytes + binChunkOffset);
+    if (binChunkOffset + 8 + binLength > length) {
+      err = "Invalid BIN chunk in glTF binary file " + path.string();
+      return false;
+    }
+    context.binChunk = {bytes + binChunkOffset + 8, binLength};
+  }
+
+  // Only the rest of the JSON is parsed in a DOM, see readGltfFile
+  std::vector<tinygltf::Node> nodes;
+  std::string jsonWithoutNodes;
+  if (!extractNodes(json, jsonLength, nodes, jsonWithoutNodes, err)) {
+    return false;
+  }
+  const auto hasNodes = !jsonWithoutNodes.empty();
+
+  nlohmann::json document;
+  try {
+    document = hasNodes ? nlohmann::json::parse(jsonWithoutNodes)
+                        : nlohmann::json::parse(json, json + jsonLength);
+  } catch (const std::exception &e) {
+    err = std::string("Unable to parse JSON chunk: ") + e.what();
+    return false;
+  }
+  std::string().swap(jsonWithoutNodes);
+
+  patchMeshoptFallbackBuffers(document, true);
+
+  // Redirect the buffer stored in the BIN chunk (the first one, without uri)
+  // and images stored in bufferViews of that buffer to our FsCallbacks
+  auto &jsonBuffers = document["buffers"];
+  const auto hasBinChunkBuffer = jsonBuffers.is_array() &&
+                                 !jsonBuffers.empty() &&
+                                 !jsonBuffers[0].count("uri");
+  size_t binChunkBufferLength = 0;
+  if (hasBinChunkBuffer) {
+    binChunkBufferLength = jsonBuffers[0]["byteLength"].get<size_t>();
+    if (binChunkBufferLength > context.binChunk.size) {
+      err = "Buffer byteLength exceeds BIN chunk size in " + path.string();
+      return false;
+    }
+    jsonBuffers[0]["uri"] = GLB_BIN_CHUNK_URI;
+    jsonBuffers[0]["byteLength"] = 1;
+
+    auto &jsonImages = document["images"];
+    const auto &jsonBufferViews = document["bufferViews"];
+    if (jsonImages.is_array()) {
+      for (auto &image : jsonImages) {
+        if (!image.count("bufferView")) {
+          continue;
+        }
+        const auto viewIdx = image["bufferView"].get<size_t>();
+        const auto &bufferView = jsonBufferViews.at(viewIdx);
+        if (bufferView.value("buffer", -1) != 0) {
+          continue;
+        }
+        const auto offset = bufferView.value("byteOffset", size_t(0));
+        const auto viewLength = bufferView["byteLength"].get<size_t>();
+        if (offset + viewLength > binChunkBufferLength) {
+          err = "Image bufferView out of BIN chunk in " + path.string();
+          return false;
+        }
+        const auto uri = GLB_BUFFER_VIEW_URI_PREFIX + std::to_string(viewIdx);
+        context.imageRanges[uri] = {offset, viewLength};
+        image.erase("bufferView");
+        image["uri"] = uri;
+      }
+    }
+  }
+
+  tinygltf::TinyGLTF loader;
+  loader.SetFsCallbacks({&mappedGlbFileExists, &tinygltf::ExpandFilePath,
+      &mappedGlbReadWholeFile, &tinygltf::WriteWholeFile, &context});
+  if (imageDecoder) {
+    imageDecoder->install(loader);
+  } else {
+    loader.SetImageLoader(&loadImageData, nullptr);
+  }
+
+  const auto patchedJson = document.dump();
+  document = nlohmann::json(); // Release the DOM before tinygltf builds its own
+  if (!loader.LoadASCIIFromString(&model, &err, &warn, patchedJson.c_str(),
+          (unsigned int)patchedJson.size(), path.parent_path().string())) {
+    return false;
+  }
+  if (hasNodes) {
+    model.nodes = std::move(nodes);
+  }
+
+  // Restore what the JSON chunk actually says
+  if (hasBinChunkBuffer) {
+    model.buffers[0].uri.clear();
+    model.buffers[0].data = std::vector<unsigned char>();
+    for (auto &image : model.images) {
+      const auto pos = image.uri.find(GLB_BUFFER_VIEW_URI_PREFIX);
+      if (pos == 0) {
+        image.bufferView =
+            std::stoi(image.uri.substr(GLB_BUFFER_VIEW_URI_PREFIX.size()));
+        image.uri.clear();
+      }
+    }
+  }
+
+  clearMeshoptFallbackBuffers(model);
+
+  buffers = getBufferSpans(model);
+  if (hasBinChunkBuffer) {
+    buffers[0] = {context.binChunk.data, binChunkBufferLength};
+  }
+
+  return true;
+}
+
+size_t releaseModelBuffers(const fs::path &path, tinygltf::Model &model,
+    std::vector<MappedFile> &mappings, std::vector<BufferSpan> &buffers)
+{
+  TRACE_ZONE("Release model buffers");
+  size_t releasedBytes = 0;
+  for (size_t bufferIdx = 0; bufferIdx < model.buffers.size(); ++bufferIdx) {
+    auto &buffer = model.buffers[bufferIdx];
+    if (buffer.data.empty() || tinygltf::IsDataURI(buffer.uri)) {
+      continue;
+    }
+    // Without uri, only the first buffer of a .glb is read from the file,
+    // others hold decoded EXT_meshopt_compression bufferViews
+    const auto isBinChunk = buffer.uri.empty();
+    if (isBinChunk && (bufferIdx != 0 || path.extension() != ".glb")) {
+      continue;
+    }
+
+    MappedFile mapping;
+    try {
+      mapping = MappedFile(
+          isBinChunk ? path : path.parent_path() / fs::path(buffer.uri));
+    } catch (const std::exception &e) {
+      std::cerr << "Warning: keeping buffer " << bufferIdx << ": " << e.what()
+                << std::endl;
+      continue;
+    }
+    size_t offset = 0;
+    auto availableSize = mapping.size();
+    if (isBinChunk) {
+      // Same layout as checked by readGltfFile
+      const auto bytes = mapping.data();
+      if (mapping.size() < 20 || readUint32(bytes) != GLB_MAGIC) {
+        continue;
+      }
+      offset = 20 + ((size_t(readUint32(bytes + 12)) + 3) & ~size_t(3));
+      if (offset + 8 > mapping.size() ||
+          readUint32(bytes + offset + 4) != GLB_CHUNK_BIN) {
+        continue;
+      }
+      availableSize =
+          std::min(size_t(readUint32(bytes + offset)), mapping.size() - offset);
+      offset += 8;
+    }
+    // The file changed since it was loaded
+    if (availableSize < buffer.data.size()) {
+      continue;
+    }
+
+    buffers[bufferIdx] = {mapping.data() + offset, buffer.data.size()};
+    releasedBytes += buffer.data.capacity();
+    std::vector<unsigned char>{}.swap(buffer.data);
+    mappings.push_back(std::move(mapping));
+  }
+  return releasedBytes;
+}
+
+namespace
+{
+
+// Conversion of normalized integers to float as specified by glTF
+float normalizeComponent(int8_t value)
+{
+  return std::max(value / 127.f, -1.f);
+}
+
+float normalizeComponent(uint8_t value) { return value / 255.f; }
+
+float normalizeComponent(int16_t value)
+{
+  return std::max(value / 32767.f, -1.f);
+}
+
+float normalizeComponent(uint16_t value) { return value / 65535.f; }
+
+float normalizeComponent(uint32_t value)
+{
+  return float(value / 4294967295.);
+}
+
+float normalizeComponent(float value) { return value; }
+
+// Decode count elements of accessorComponents components of type T,
+// byteStride bytes apart, into componentCount floats each
+template <typename T, bool normalized>
+void convertToFloats(const unsigned char *data, size_t byteStride,
+    size_t count, size_t accessorComponents, size_t componentCount,
+    float *out)
+{
+  const auto readComponents = std::min(componentCount, accessorComponents);
+  for (size_t i = 0; i < count; ++i) {
+    const auto *element = data + i * byteStride;
+    auto *outElement = out + i * componentCount;
+    for (size_t c = 0; c < readComponents; ++c) {
+      T value;
+      std::memcpy(&value, element + c * sizeof(T), sizeof(T));
+      outElement[c] = normalized ? normalizeComponent(value) : float(value);
+    }
+    std::fill(outElement + readComponents, outElement + componentCount, 0.f);
+  }
+}
+
+template <typename T>
+void convertToUints(
+    const unsigned char *data, size_t byteStride, size_t count, uint32_t *out)
+{
+  if (std::is_same<T, uint32_t>::value && byteStride == sizeof(uint32_t)) {
+    std::memcpy(out, data, count * sizeof(uint32_t));
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    T value;
+    std::memcpy(&value, data + i * byteStride, sizeof(value));
+    out[i] = uint32_t(value);
+  }
+}
+
+// Same as convertToFloats for elements of N components read whole, N being
+// known at compile time the inner loop is unrolled and the outer one can be
+// vectorized
+template <typename T, bool normalized, size_t N>
+void convertWholeToFloats(const unsigned char *data, size_t byteStride,
+    size_t count, size_t, size_t, float *out)
+{
+  for (size_t i = 0; i < count; ++i) {
+    T element[N];
+    std::memcpy(element, data + i * byteStride, sizeof(element));
+    for (size_t c = 0; c < N; ++c) {
+      out[i * N + c] =
+          normalized ? normalizeComponent(element[c]) : float(element[c]);
+    }
+  }
+}
+
+using FloatConverter = decltype(&convertToFloats<float, false>);
+
+// Converters of accessors of T components: partial reads any number of
+// components, whole reads all componentCount components of each element
+template <typename T, bool normalized>
+void getFloatConverters(
+    size_t componentCount, FloatConverter &partial, FloatConverter &whole)
+{
+  partial = &convertToFloats<T, normalized>;
+  switch (componentCount) {
+  case 1:
+    whole = &convertWholeToFloats<T, normalized, 1>;
+    break;
+  case 2:
+    whole = &convertWholeToFloats<T, normalized, 2>;
+    break;
+  case 3:
+    whole = &convertWholeToFloats<T, normalized, 3>;
+    break;
+  case 4:
+    whole = &convertWholeToFloats<T, normalized, 4>;
+    break;
+  default:
+    whole = partial;
+  }
+}
+
+template <typename T>
+void getFloatConverters(bool normalized, size_t componentCount,
+    FloatConverter &partial, FloatConverter &whole)
+{
+  if (normalized) {
+    getFloatConverters<T, true>(componentCount, partial, whole);
+  } else {
+    getFloatConverters<T, false>(componentCount, partial, whole);
+  }
+}
+
+} // namespace
+
+AccessorView::AccessorView(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const tinygltf::Accessor &accessor) :
+    m_nCount(accessor.count),
+    m_nComponents(
+        size_t(tinygltf::GetNumComponentsInType(uint32_t(accessor.type)))),
+    m_isFloat(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
+{
+  switch (accessor.componentType) {
+  case TINYGLTF_COMPONENT_TYPE_BYTE:
+    getFloatConverters<int8_t>(accessor.normalized, m_nComponents,
+        m_floatConverter, m_wholeFloatConverter);
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    getFloatConverters<uint8_t>(accessor.normalized, m_nComponents,
+        m_floatConverter, m_wholeFloatConverter);
+    m_uintConverter = &convertToUints<uint8_t>;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_SHORT:
+    getFloatConverters<int16_t>(accessor.normalized, m_nComponents,
+        m_floatConverter, m_wholeFloatConverter);
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    getFloatConverters<uint16_t>(accessor.normalized, m_nComponents,
+        m_floatConverter, m_wholeFloatConverter);
+    m_uintConverter = &convertToUints<uint16_t>;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+    getFloatConverters<uint32_t>(accessor.normalized, m_nComponents,
+        m_floatConverter, m_wholeFloatConverter);
+    m_uintConverter = &convertToUints<uint32_t>;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_FLOAT:
+    getFloatConverters<float, false>(
+        m_nComponents, m_floatConverter, m_wholeFloatConverter);
+    break;
+  default:
+    return;
+  }
+  m_nElementSize = m_nComponents * size_t(tinygltf::GetComponentSizeInBytes(
+                                       uint32_t(accessor.componentType)));
+
+  // Accessors without bufferView are initialized with zeros (sparse
+  // accessors then substitute some elements)
+  if (accessor.bufferView >= 0) {
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto byteStride = accessor.ByteStride(bufferView);
+    const auto *data = buffers[bufferView.buffer].data;
+    if (byteStride > 0 && data) {
+      m_pData = data + bufferView.byteOffset + accessor.byteOffset;
+      m_nByteStride = size_t(byteStride);
+    }
+  }
+
+  const auto &sparse = accessor.sparse;
+  if (!sparse.isSparse || sparse.count <= 0 ||
+      sparse.indices.bufferView < 0 || sparse.values.bufferView < 0) {
+    return;
+  }
+  const auto &indicesView = model.bufferViews[sparse.indices.bufferView];
+  const auto &valuesView = model.bufferViews[sparse.values.bufferView];
+  const auto *indices = buffers[indicesView.buffer].data;
+  const auto *values = buffers[valuesView.buffer].data;
+  switch (sparse.indices.componentType) {
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    m_sparseIndexConverter = &convertToUints<uint8_t>;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    m_sparseIndexConverter = &convertToUints<uint16_t>;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+    m_sparseIndexConverter = &convertToUints<uint32_t>;
+    break;
+  }
+  if (!indices || !values || !m_sparseIndexConverter) {
+    return;
+  }
+  m_nSparseCount = size_t(sparse.count);
+  m_nSparseIndexSize = size_t(tinygltf::GetComponentSizeInBytes(
+      uint32_t(sparse.indices.componentType)));
+  m_pSparseIndices =
+      indices + indicesView.byteOffset + sparse.indices.byteOffset;
+  m_pSparseValues = values + valuesView.byteOffset + sparse.values.byteOffset;
+}
+
+template <typename Substitute>
+void AccessorView::forEachSparseElement(
+    size_t first, size_t count, const Substitute &substitute) const
+{
+  const auto readIndex = [&](size_t i) {
+    uint32_t index;
+    m_sparseIndexConverter(
+        m_pSparseIndices + i * m_nSparseIndexSize, 0, 1, &index);
+    return size_t(index);
+  };
+
+  // Indices are strictly increasing: find the first one in the range
+  size_t i = 0;
+  size_t last = m_nSparseCount;
+  while (i < last) {
+    const auto middle = i + (last - i) / 2;
+    if (readIndex(middle) < first) {
+      i = middle + 1;
+    } else {
+      last = middle;
+    }
+  }
+  // Values are tightly packed
+  for (; i < m_nSparseCount; ++i) {
+    const auto index = readIndex(i);
+    if (index >= first + count) {
+      break;
+    }
+    substitute(index - first, m_pSparseValues + i * m_nElementSize);
+  }
+}
+
+void AccessorView::readFloats(
+    size_t first, size_t count, size_t componentCount, float *out) const
+{
+  const auto converter = componentCount == m_nComponents
+                             ? m_wholeFloatConverter
+                             : m_floatConverter;
+  if (!m_pData) {
+    std::fill(out, out + count * componentCount, 0.f);
+  } else if (m_isFloat && m_nComponents == componentCount &&
+             m_nByteStride == m_nElementSize) {
+    // Fast path: tightly packed floats with the requested layout
+    std::memcpy(out, m_pData + first * m_nByteStride, count * m_nElementSize);
+  } else {
+    converter(m_pData + first * m_nByteStride, m_nByteStride, count,
+        m_nComponents, componentCount, out);
+  }
+
+  if (m_nSparseCount) {
+    forEachSparseElement(
+        first, count, [&](size_t element, const unsigned char *values) {
+          converter(values, m_nElementSize, 1, m_nComponents, componentCount,
+              out + element * componentCount);
+        });
+  }
+}
+
+void AccessorView::readUints(size_t first, size_t count, uint32_t *out) const
+{
+  if (!m_uintConverter) {
+    std::cerr << "Unsupported index componentType" << std::endl;
+    std::fill(out, out + count, 0u);
+    return;
+  }
+  if (!m_pData) {
+    std::fill(out, out + count, 0u);
+  } else {
+    m_uintConverter(m_pData + first * m_nByteStride, m_nByteStride, count, out);
+  }
+
+  if (m_nSparseCount) {
+    forEachSparseElement(
+        first, count, [&](size_t element, const unsigned char *values) {
+          m_uintConverter(values, m_nElementSize, 1, out + element);
+        });
+  }
+}
+
+void readAccessorAsFloats(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const tinygltf::Accessor &accessor,
+    size_t componentCount, float *out)
+{
+  AccessorView{model, buffers, accessor}.readFloats(
+      0, accessor.count, componentCount, out);
+}
+
+void readAccessorAsUints(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const tinygltf::Accessor &accessor,
+    uint32_t *out)
+{
+  AccessorView{model, buffers, accessor}.readUints(0, accessor.count, out);
+}
 
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix)
@@ -35,119 +1449,135 @@ glm::mat4 getLocalToWorldMatrix(
                                                  node.scale[1], node.scale[2]));
 };
 
-void computeSceneBounds(
-    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax)
+void computeSceneBounds(const tinygltf::Model &model, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax, bool exactBounds)
+{
+  computeSceneBounds(
+      model, getBufferSpans(model), bboxMin, bboxMax, exactBounds);
+}
+
+void computeSceneBounds(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax, bool exactBounds)
 {
-  // Compute scene bounding box
-  // todo refactor with scene drawing
-  // todo need a visitScene generic function that takes a accept() functor
+  TRACE_ZONE("Compute scene bounds");
+  // Vertices of a POSITION accessor transformed by a node matrix, large
+  // accessors are split so that a single huge mesh uses all threads
+  struct BoundsTask
+  {
+    const glm::mat4 *modelMatrix;
+    const tinygltf::Accessor *accessor;
+    bool useAccessorBounds;
+    size_t first;
+    size_t count;
+  };
+  const size_t verticesPerTask = size_t(1) << 16;
+
+  const SceneHierarchy hierarchy{model, buffers};
+  std::vector<BoundsTask> tasks;
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    const auto &modelMatrix = hierarchy.worldMatrix(flatIdx);
+    const auto &mesh = model.meshes[hierarchy.mesh(flatIdx)];
+    for (const auto &primitive : mesh.primitives) {
+      const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+      if (positionAttrIdxIt == end(primitive.attributes)) {
+        continue;
+      }
+      const auto &positionAccessor =
+          model.accessors[(*positionAttrIdxIt).second];
+      if (positionAccessor.type != TINYGLTF_TYPE_VEC3) {
+        std::cerr << "Position accessor with type != VEC3, skipping"
+                  << std::endl;
+        continue;
+      }
+
+      // min and max are required by the spec for POSITION accessors
+      if (!exactBounds && positionAccessor.minValues.size() == 3 &&
+          positionAccessor.maxValues.size() == 3) {
+        tasks.push_back({&modelMatrix, &positionAccessor, true, 0, 0});
+        continue;
+      }
+      for (size_t first = 0; first < positionAccessor.count;
+           first += verticesPerTask) {
+        tasks.push_back({&modelMatrix, &positionAccessor, false, first,
+            std::min(verticesPerTask, positionAccessor.count - first)});
+      }
+    }
+  }
+
   bboxMin = glm::vec3(std::numeric_limits<float>::max());
   bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
-  if (model.defaultScene >= 0) {
-    const std::function<void(int, const glm::mat4 &)> updateBounds =
-        [&](int nodeIdx, const glm::mat4 &parentMatrix) {
-          const auto &node = model.nodes[nodeIdx];
-          const glm::mat4 modelMatrix =
-              getLocalToWorldMatrix(node, parentMatrix);
-          if (node.mesh >= 0) {
-            const auto &mesh = model.meshes[node.mesh];
-            for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
-              const auto &primitive = mesh.primitives[pIdx];
-              const auto positionAttrIdxIt =
-                  primitive.attributes.find("POSITION");
-              if (positionAttrIdxIt == end(primitive.attributes)) {
-                continue;
-              }
-              const auto &positionAccessor =
-                  model.accessors[(*positionAttrIdxIt).second];
-              if (positionAccessor.type != 3) {
-                std::cerr << "Position accessor with type != VEC3, skipping"
-                          << std::endl;
-                continue;
-              }
-              const auto &positionBufferView =
-                  model.bufferViews[positionAccessor.bufferView];
-              const auto byteOffset =
-                  positionAccessor.byteOffset + positionBufferView.byteOffset;
-              const auto &positionBuffer =
-                  model.buffers[positionBufferView.buffer];
-              const auto positionByteStride =
-                  positionBufferView.byteStride ? positionBufferView.byteStride
-                                                : 3 * sizeof(float);
-
-              if (primitive.indices >= 0) {
-                const auto &indexAccessor = model.accessors[primitive.indices];
-                const auto &indexBufferView =
-                    model.bufferViews[indexAccessor.bufferView];
-                const auto indexByteOffset =
-                    indexAccessor.byteOffset + indexBufferView.byteOffset;
-                const auto &indexBuffer = model.buffers[indexBufferView.buffer];
-                auto indexByteStride = indexBufferView.byteStride;
-
-                switch (indexAccessor.componentType) {
-                default:
-                  std::cerr
-                      << "Primitive index accessor with bad componentType "
-                      << indexAccessor.componentType << ", skipping it."
-                      << std::endl;
-                  continue;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint8_t);
-                  break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint16_t);
-                  break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint32_t);
-                  break;
-                }
-
-                for (size_t i = 0; i < indexAccessor.count; ++i) {
-                  uint32_t index = 0;
-                  switch (indexAccessor.componentType) {
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                    index = *((const uint8_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                    index = *((const uint16_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                    index = *((const uint32_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  }
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * index]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
-                }
-              } else {
-                for (size_t i = 0; i < positionAccessor.count; ++i) {
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * i]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
-                }
-              }
-            }
+  std::mutex boundsMutex;
+
+  auto &jobSystem = getJobSystem();
+  jobSystem.parallelFor(tasks.size(), jobSystem.getGrainSize(tasks.size()),
+      [&](size_t begin, size_t end) {
+        auto localMin = glm::vec3(std::numeric_limits<float>::max());
+        auto localMax = glm::vec3(std::numeric_limits<float>::lowest());
+        std::vector<float> decodedPositions;
+        for (size_t taskIdx = begin; taskIdx < end; ++taskIdx) {
+          const auto &task = tasks[taskIdx];
+          const auto &accessor = *task.accessor;
+          const auto &modelMatrix = *task.modelMatrix;
+
+          if (task.useAccessorBounds) {
+            const auto &minValues = accessor.minValues;
+            const auto &maxValues = accessor.maxValues;
+            extendBoundsWithBox(
+                glm::vec3(minValues[0], minValues[1], minValues[2]),
+                glm::vec3(maxValues[0], maxValues[1], maxValues[2]),
+                modelMatrix, localMin, localMax);
+            continue;
           }
-          for (const auto childNodeIdx : node.children) {
-            updateBounds(childNodeIdx, modelMatrix);
+
+          const AccessorView positions{model, buffers, accessor};
+          if (const auto *data = positions.floatData()) {
+            const auto byteStride = positions.byteStride();
+            extendBoundsWithPositions(data + task.first * byteStride,
+                task.count, byteStride, modelMatrix, localMin, localMax);
+            continue;
           }
-        };
-    for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
-      updateBounds(nodeIdx, glm::mat4(1));
+
+          // Quantized or sparse positions, decode the range first
+          decodedPositions.resize(3 * task.count);
+          positions.readFloats(
+              task.first, task.count, 3, decodedPositions.data());
+          extendBoundsWithPositions(
+              (const unsigned char *)decodedPositions.data(), task.count,
+              3 * sizeof(float), modelMatrix, localMin, localMax);
+        }
+
+        std::lock_guard<std::mutex> lock(boundsMutex);
+        bboxMin = glm::min(bboxMin, localMin);
+        bboxMax = glm::max(bboxMax, localMax);
+      });
+}
+
+size_t removeUnusedMeshes(tinygltf::Model &model)
+{
+  std::vector<int> meshRemap(model.meshes.size(), -1);
+  for (const auto &node : model.nodes) {
+    if (node.mesh >= 0) {
+      meshRemap[node.mesh] = 0;
+    }
+  }
+  size_t usedCount = 0;
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    if (meshRemap[meshIdx] < 0) {
+      continue;
+    }
+    meshRemap[meshIdx] = int(usedCount);
+    if (usedCount != meshIdx) {
+      model.meshes[usedCount] = std::move(model.meshes[meshIdx]);
+    }
+    ++usedCount;
+  }
+  const auto removedCount = model.meshes.size() - usedCount;
+  model.meshes.resize(usedCount);
+  for (auto &node : model.nodes) {
+    if (node.mesh >= 0) {
+      node.mesh = meshRemap[node.mesh];
     }
   }
-}
\ No newline at end of file
+  return removedCount;
+}
@@ -1,10 +1,253 @@
 #pragma once
 
+#include "filesystem.hpp"
+#include "load_report.hpp"
+#include "mapped_file.hpp"
+
 #include <glm/glm.hpp>
 #include <tiny_gltf.h>
 
+#include <string>
+#include <utility>
+#include <vector>
+
+// Read-only view on the bytes of a glTF buffer. It either points to
+// tinygltf::Buffer::data or directly into a memory mapped GLB file.
+struct BufferSpan
+{
+  const unsigned char *data = nullptr;
+  size_t size = 0;
+};
+
+// Views on model.buffers[i].data for each buffer of the model
+std::vector<BufferSpan> getBufferSpans(const tinygltf::Model &model);
+
+// Bytes of the buffers and images held by model in the heap. Memory mapped
+// GLB chunks are not counted.
+size_t getModelHeapBytes(const tinygltf::Model &model);
+
+// Image loader for tinygltf: images in a KTX2 container (KHR_texture_basisu)
+// are kept as is in image->image, with as_is and the size of their level 0,
+// so that their levels can be uploaded without being decoded (see
+// ImageTexture). Other images are decoded by tinygltf::LoadImageData.
+bool loadImageData(tinygltf::Image *image, const int imageIdx,
+    std::string *err, std::string *warn, int reqWidth, int reqHeight,
+    const unsigned char *bytes, int size, void *userData);
+
+// Image loader for tinygltf that only copies the encoded bytes of images
+// while parsing, so that they can all be decoded in parallel afterwards.
+class ParallelImageDecoder
+{
+public:
+  // Make loader defer image decoding to this object
+  void install(tinygltf::TinyGLTF &loader);
+
+  // Decode images collected during parsing into model.images using
+  // threadCount threads, or the jobs of getJobSystem() if 0: pixels are then
+  // allocated by pinned workers, on their NUMA node (see ThreadPinning).
+  // Results do not depend on the number of threads.
+  bool decode(tinygltf::Model &model, size_t threadCount, std::string &err,
+      std::string &warn);
+
+  // Image loader installed by install(), userData is the decoder
+  static bool storeEncodedImage(tinygltf::Image *image, const int imageIdx,
+      std::string *err, std::string *warn, int reqWidth, int reqHeight,
+      const unsigned char *bytes, int size, void *userData);
+
+private:
+  struct EncodedImage
+  {
+    int reqWidth = 0;
+    int reqHeight = 0;
+    std::vector<unsigned char> bytes;
+  };
+  std::vector<EncodedImage> m_encodedImages; // Indexed by image index
+};
+
+// Load a .glb file by memory mapping it. Only the JSON chunk is parsed by
+// tinygltf: the BIN chunk is never copied and the returned buffers[0] points
+// into the mapping, which must outlive every use of the spans. Images stored
+// in bufferViews are decoded as usual. Other buffers (external .bin files or
+// data URIs) are loaded by tinygltf and the span points into model.buffers,
+// fallback buffers of EXT_meshopt_compression are empty as in readGltfFile.
+// Return false and fill err on failure, like tinygltf::TinyGLTF loaders.
+// If imageDecoder is not null it is installed on the tinygltf loader.
+// If report is not null, the mapping and the external files read count as
+// its file I/O.
+bool loadMappedGlbFile(const fs::path &path, tinygltf::Model &model,
+    MappedFile &mapping, std::vector<BufferSpan> &buffers, std::string &err,
+    std::string &warn, ParallelImageDecoder *imageDecoder = nullptr,
+    LoadReport *report = nullptr);
+
+// External buffers and images of a model that readGltfFile did not load
+// because its default scene does not use them, e.g. those of other scenes or
+// of material variants
+struct DeferredResources
+{
+  fs::path baseDirectory; // Of the glTF file, uris are relative to it
+  // Deferred buffer files are memory mapped instead of read: their spans
+  // point into these mappings and their pages are only read when accessed
+  std::vector<MappedFile> bufferMappings;
+  // Indexed by image, not 0 while the image file has not been read (see
+  // loadDeferredImage)
+  std::vector<char> images;
+  size_t deferredBufferCount = 0;
+  size_t deferredImageCount = 0;
+
+  bool isImageDeferred(size_t imageIdx) const
+  {
+    return imageIdx < images.size() && images[imageIdx];
+  }
+};
+
+// Load a .gltf or .glb file read in memory with tinygltf, buffers pointing
+// into model.buffers. Buffers holding the decoded data of
+// EXT_meshopt_compression bufferViews may have no uri: they are kept empty (see
+// decodeCompressedBufferViews). Return false and fill err on failure.
+// If deferred is not null, only the external buffers and images used by the
+// default scene (its node trees, their meshes, skins, materials, textures and
+// animations) are read, the others are described in deferred.
+// If maxPrefetchedFiles is not 0, the external files read by tinygltf are
+// read ahead, up to maxPrefetchedFiles at a time (see FilePrefetcher).
+// If report is not null, the files read count as its file I/O.
+bool readGltfFile(const fs::path &path, tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers, std::string &err, std::string &warn,
+    ParallelImageDecoder *imageDecoder = nullptr,
+    DeferredResources *deferred = nullptr, size_t maxPrefetchedFiles = 0,
+    LoadReport *report = nullptr);
+
+// Byte ranges [first, second) of the BIN chunk of a .glb, whose JSON chunk
+// is json, read to show its default scene: the bufferViews of buffer 0 read
+// by its meshes, skins and animations as readGltfFile finds them, and those
+// of every image, which tinygltf decodes whether used or not. Ranges are in
+// the order of the bufferViews and may overlap. Return false and fill err if
+// json cannot be parsed.
+bool findGlbDefaultSceneRanges(const char *json, size_t length,
+    std::vector<std::pair<size_t, size_t>> &ranges, std::string &err);
+
+// Read and decode image imageIdx of model if readGltfFile deferred it, from
+// a memory mapping of its file. Return false and fill err on failure, the
+// image is then no longer deferred and stays empty.
+bool loadDeferredImage(tinygltf::Model &model, DeferredResources &deferred,
+    size_t imageIdx, std::string &err, std::string &warn);
+
+// Release the heap copy of each buffer of model, loaded from path, that can
+// be read again from the file: external buffer files and the BIN chunk of a
+// .glb are memory mapped in mappings, which must outlive buffers, and their
+// spans point into them. Their pages are only loaded if read again, e.g. when
+// picking. Buffers of data URIs and buffers holding decoded
+// EXT_meshopt_compression bufferViews stay in the heap. Return the number of
+// bytes released.
+size_t releaseModelBuffers(const fs::path &path, tinygltf::Model &model,
+    std::vector<MappedFile> &mappings, std::vector<BufferSpan> &buffers);
+
+// Typed view on the elements of an accessor read through buffers, shared by
+// every pass decoding accessors. The conversion of its component type is
+// chosen once by the constructor, not per component: tightly packed floats
+// are copied, other ranges go through a loop specialized for the type,
+// normalization and, up to 4, the component count. Sparse
+// elements are substituted in the ranges they fall in, so that several jobs
+// can each read a range of the same accessor.
+class AccessorView
+{
+public:
+  AccessorView(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers,
+      const tinygltf::Accessor &accessor);
+
+  size_t size() const { return m_nCount; }
+
+  size_t componentCount() const { return m_nComponents; }
+
+  // Bytes of the float elements of a dense accessor, m_nByteStride apart, to
+  // be read in place. nullptr if the accessor is sparse, has no bufferView
+  // or integer components.
+  const unsigned char *floatData() const
+  {
+    return m_isFloat && !m_nSparseCount ? m_pData : nullptr;
+  }
+
+  // Bytes of the elements of a dense accessor of any component type,
+  // m_nByteStride apart. nullptr if the accessor is sparse or has no
+  // bufferView.
+  const unsigned char *denseData() const
+  {
+    return !m_nSparseCount ? m_pData : nullptr;
+  }
+
+  size_t byteStride() const { return m_nByteStride; }
+
+  // Decode the first componentCount components of the elements [first, first
+  // + count) as floats, applying glTF normalization rules to integer
+  // components, into out[0 : count * componentCount]. Missing components are
+  // set to 0, as are elements of accessors without bufferView.
+  void readFloats(
+      size_t first, size_t count, size_t componentCount, float *out) const;
+
+  // Decode the elements [first, first + count) of a scalar integer accessor
+  // into out[0 : count]
+  void readUints(size_t first, size_t count, uint32_t *out) const;
+
+private:
+  using FloatConverter = void (*)(const unsigned char *data, size_t byteStride,
+      size_t count, size_t accessorComponents, size_t componentCount,
+      float *out);
+  using UintConverter = void (*)(const unsigned char *data, size_t byteStride,
+      size_t count, uint32_t *out);
+
+  // Call substitute(element, values) for the sparse elements in [first, first
+  // + count), values pointing to their tightly packed components
+  template <typename Substitute>
+  void forEachSparseElement(
+      size_t first, size_t count, const Substitute &substitute) const;
+
+  const unsigned char *m_pData = nullptr; // Element 0, nullptr if no view
+  size_t m_nCount = 0;
+  size_t m_nComponents = 0;
+  size_t m_nByteStride = 0;
+  size_t m_nElementSize = 0;
+  bool m_isFloat = false;
+  FloatConverter m_floatConverter = nullptr;
+  // Specialized on the component count, used when reading all components
+  FloatConverter m_wholeFloatConverter = nullptr;
+  UintConverter m_uintConverter = nullptr;
+  // Sparse elements, none for dense accessors
+  size_t m_nSparseCount = 0;
+  size_t m_nSparseIndexSize = 0;
+  const unsigned char *m_pSparseIndices = nullptr;
+  const unsigned char *m_pSparseValues = nullptr;
+  UintConverter m_sparseIndexConverter = nullptr;
+};
+
+// Decode the first componentCount components of each element of accessor as
+// floats, applying glTF normalization rules to integer components, into
+// out[0 : accessor.count * componentCount]. Missing components are set to 0.
+// Sparse accessors are supported.
+void readAccessorAsFloats(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const tinygltf::Accessor &accessor,
+    size_t componentCount, float *out);
+
+// Decode the elements of a scalar integer accessor (e.g. indices) into
+// out[0 : accessor.count]. Sparse accessors are supported.
+void readAccessorAsUints(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const tinygltf::Accessor &accessor,
+    uint32_t *out);
+
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix);
 
-void computeSceneBounds(
-    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
\ No newline at end of file
+// Remove the meshes no node uses and remap the meshes of nodes, return the
+// number of removed meshes
+size_t removeUnusedMeshes(tinygltf::Model &model);
+
+// Compute the bounding box of the default scene. By default the min and max
+// of POSITION accessors are transformed, which is fast but gives a larger box
+// than the geometry under rotations. If exactBounds is true, or if an
+// accessor has no min/max, every position of the accessor is transformed.
+void computeSceneBounds(const tinygltf::Model &model, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax, bool exactBounds = false);
+
+// Same as above, but read accessor data through buffers (see BufferSpan)
+void computeSceneBounds(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax, bool exactBounds = false);
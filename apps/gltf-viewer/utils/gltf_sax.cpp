@@ -0,0 +1,724 @@
+#include "gltf_sax.hpp"
+
+#include <clocale>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+
+// Index of the first byte of json[i : length] that is not a whitespace
+size_t skipWhitespace(const char *json, size_t length, size_t i)
+{
+  while (i < length && (json[i] == ' ' || json[i] == '\t' ||
+                           json[i] == '\n' || json[i] == '\r')) {
+    ++i;
+  }
+  return i;
+}
+
+// Index following the string starting at json[i] (a quote), length if it is
+// not terminated
+size_t skipString(const char *json, size_t length, size_t i)
+{
+  for (++i; i < length; ++i) {
+    if (json[i] == '\\') {
+      ++i;
+    } else if (json[i] == '"') {
+      return i + 1;
+    }
+  }
+  return length;
+}
+
+// Index following the value starting at json[i], without validating it
+size_t skipValue(const char *json, size_t length, size_t i)
+{
+  size_t depth = 0;
+  while (i < length) {
+    const auto c = json[i];
+    if (c == '"') {
+      i = skipString(json, length, i);
+      if (!depth) {
+        return i;
+      }
+      continue;
+    }
+    if (c == '{' || c == '[') {
+      ++depth;
+    } else if (c == '}' || c == ']') {
+      if (!depth) {
+        return i; // End of the enclosing container
+      }
+      if (!--depth) {
+        return i + 1;
+      }
+    } else if (!depth && (c == ',' || c == ' ' || c == '\t' || c == '\n' ||
+                             c == '\r')) {
+      return i; // End of a number or literal
+    }
+    ++i;
+  }
+  return length;
+}
+
+// Reader of a JSON value calling the methods of Handler for each event, like
+// the SAX parser of nlohmann::json but without its per-character input
+// adapter: runs of plain characters are copied at once and integers are
+// parsed without strtod. Handler methods return false to stop parsing.
+template <typename Handler> class JsonSaxReader
+{
+public:
+  // Containers deeper than this are rejected rather than overflowing the
+  // stack
+  static const size_t MAX_DEPTH = 512;
+
+  JsonSaxReader(const char *json, size_t length, Handler &handler,
+      std::string &err) :
+      m_json(json), m_nLength(length), m_handler(handler), m_err(err)
+  {
+  }
+
+  bool parse()
+  {
+    skipWhitespace();
+    if (!parseValue(0)) {
+      return false;
+    }
+    skipWhitespace();
+    return m_i == m_nLength || error("unexpected data after the value");
+  }
+
+private:
+  bool error(const char *message)
+  {
+    if (m_err.empty()) {
+      m_err = std::string("JSON error at byte ") + std::to_string(m_i) +
+              ": " + message;
+    }
+    return false;
+  }
+
+  char peek() const { return m_i < m_nLength ? m_json[m_i] : '\0'; }
+
+  void skipWhitespace() { m_i = ::skipWhitespace(m_json, m_nLength, m_i); }
+
+  bool parseValue(size_t depth)
+  {
+    if (depth > MAX_DEPTH) {
+      return error("too deeply nested");
+    }
+    switch (peek()) {
+    case '{':
+      return parseObject(depth);
+    case '[':
+      return parseArray(depth);
+    case '"':
+      return parseString(m_string) && m_handler.string(m_string);
+    case 't':
+      return parseLiteral("true") && m_handler.boolean(true);
+    case 'f':
+      return parseLiteral("false") && m_handler.boolean(false);
+    case 'n':
+      return parseLiteral("null") && m_handler.null();
+    default:
+      return parseNumber();
+    }
+  }
+
+  bool parseObject(size_t depth)
+  {
+    ++m_i;
+    if (!m_handler.startContainer(true)) {
+      return false;
+    }
+    skipWhitespace();
+    if (peek() == '}') {
+      ++m_i;
+      return m_handler.endContainer();
+    }
+    for (;;) {
+      if (peek() != '"') {
+        return error("expected a key");
+      }
+      if (!parseString(m_key) || !m_handler.key(m_key)) {
+        return false;
+      }
+      skipWhitespace();
+      if (peek() != ':') {
+        return error("expected ':'");
+      }
+      ++m_i;
+      skipWhitespace();
+      if (!parseValue(depth + 1)) {
+        return false;
+      }
+      skipWhitespace();
+      const auto c = peek();
+      ++m_i;
+      if (c == '}') {
+        return m_handler.endContainer();
+      }
+      if (c != ',') {
+        --m_i;
+        return error("expected ',' or '}'");
+      }
+      skipWhitespace();
+    }
+  }
+
+  bool parseArray(size_t depth)
+  {
+    ++m_i;
+    if (!m_handler.startContainer(false)) {
+      return false;
+    }
+    skipWhitespace();
+    if (peek() == ']') {
+      ++m_i;
+      return m_handler.endContainer();
+    }
+    for (;;) {
+      if (!parseValue(depth + 1)) {
+        return false;
+      }
+      skipWhitespace();
+      const auto c = peek();
+      ++m_i;
+      if (c == ']') {
+        return m_handler.endContainer();
+      }
+      if (c != ',') {
+        --m_i;
+        return error("expected ',' or ']'");
+      }
+      skipWhitespace();
+    }
+  }
+
+  bool parseLiteral(const char *literal)
+  {
+    const auto size = std::strlen(literal);
+    if (m_nLength - m_i < size || std::memcmp(m_json + m_i, literal, size)) {
+      return error("invalid literal");
+    }
+    m_i += size;
+    return true;
+  }
+
+  // Four hexadecimal digits of a \u escape sequence
+  bool parseHex(uint32_t &value)
+  {
+    if (m_nLength - m_i < 4) {
+      return error("truncated escape sequence");
+    }
+    value = 0;
+    for (size_t end = m_i + 4; m_i < end; ++m_i) {
+      const auto c = m_json[m_i];
+      value <<= 4;
+      if (c >= '0' && c <= '9') {
+        value |= uint32_t(c - '0');
+      } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        value |= uint32_t((c | 0x20) - 'a' + 10);
+      } else {
+        return error("invalid escape sequence");
+      }
+    }
+    return true;
+  }
+
+  void appendUtf8(std::string &out, uint32_t codePoint)
+  {
+    if (codePoint < 0x80) {
+      out += char(codePoint);
+    } else if (codePoint < 0x800) {
+      out += char(0xC0 | (codePoint >> 6));
+      out += char(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+      out += char(0xE0 | (codePoint >> 12));
+      out += char(0x80 | ((codePoint >> 6) & 0x3F));
+      out += char(0x80 | (codePoint & 0x3F));
+    } else {
+      out += char(0xF0 | (codePoint >> 18));
+      out += char(0x80 | ((codePoint >> 12) & 0x3F));
+      out += char(0x80 | ((codePoint >> 6) & 0x3F));
+      out += char(0x80 | (codePoint & 0x3F));
+    }
+  }
+
+  bool parseString(std::string &out)
+  {
+    out.clear();
+    ++m_i;
+    for (;;) {
+      const auto begin = m_i;
+      while (m_i < m_nLength && m_json[m_i] != '"' && m_json[m_i] != '\\' &&
+             (unsigned char)m_json[m_i] >= 0x20) {
+        ++m_i;
+      }
+      out.append(m_json + begin, m_i - begin);
+      if (m_i >= m_nLength) {
+        return error("unterminated string");
+      }
+      const auto c = m_json[m_i++];
+      if (c == '"') {
+        return true;
+      }
+      if (c != '\\') {
+        --m_i;
+        return error("control character in string");
+      }
+      if (m_i >= m_nLength) {
+        return error("unterminated string");
+      }
+      switch (m_json[m_i++]) {
+      case '"':
+        out += '"';
+        break;
+      case '\\':
+        out += '\\';
+        break;
+      case '/':
+        out += '/';
+        break;
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'n':
+        out += '\n';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'u': {
+        uint32_t codePoint;
+        if (!parseHex(codePoint)) {
+          return false;
+        }
+        // Characters out of the BMP are escaped as surrogate pairs
+        if (codePoint >= 0xD800 && codePoint < 0xDC00) {
+          uint32_t low;
+          if (m_nLength - m_i < 2 || m_json[m_i] != '\\' ||
+              m_json[m_i + 1] != 'u') {
+            return error("unpaired surrogate");
+          }
+          m_i += 2;
+          if (!parseHex(low)) {
+            return false;
+          }
+          if (low < 0xDC00 || low >= 0xE000) {
+            return error("unpaired surrogate");
+          }
+          codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+        } else if (codePoint >= 0xDC00 && codePoint < 0xE000) {
+          return error("unpaired surrogate");
+        }
+        appendUtf8(out, codePoint);
+        break;
+      }
+      default:
+        --m_i;
+        return error("invalid escape sequence");
+      }
+    }
+  }
+
+  bool parseNumber()
+  {
+    const auto begin = m_i;
+    const auto isNegative = peek() == '-';
+    if (isNegative) {
+      ++m_i;
+    }
+    const auto isDigit = [&]() { return peek() >= '0' && peek() <= '9'; };
+    if (!isDigit()) {
+      return error("unexpected character");
+    }
+    // Integers are accumulated while they fit in 64 bits
+    uint64_t magnitude = 0;
+    auto isInteger = true;
+    if (peek() == '0') {
+      ++m_i;
+    } else {
+      for (; isDigit(); ++m_i) {
+        const auto digit = uint64_t(peek() - '0');
+        if (magnitude > (UINT64_MAX - digit) / 10) {
+          isInteger = false;
+        }
+        magnitude = magnitude * 10 + digit;
+      }
+    }
+    if (peek() == '.') {
+      isInteger = false;
+      ++m_i;
+      if (!isDigit()) {
+        return error("expected a digit");
+      }
+      while (isDigit()) {
+        ++m_i;
+      }
+    }
+    if (peek() == 'e' || peek() == 'E') {
+      isInteger = false;
+      ++m_i;
+      if (peek() == '+' || peek() == '-') {
+        ++m_i;
+      }
+      if (!isDigit()) {
+        return error("expected a digit");
+      }
+      while (isDigit()) {
+        ++m_i;
+      }
+    }
+
+    if (isInteger && (!isNegative || magnitude <= uint64_t(INT64_MAX))) {
+      const auto value =
+          isNegative ? -int64_t(magnitude) : int64_t(magnitude);
+      return m_handler.number(double(value), value, true);
+    }
+    // Like nlohmann::json, strtod is given the decimal point of the locale
+    m_number.assign(m_json + begin, m_i - begin);
+    const auto decimalPoint = *std::localeconv()->decimal_point;
+    if (decimalPoint != '.') {
+      const auto pos = m_number.find('.');
+      if (pos != std::string::npos) {
+        m_number[pos] = decimalPoint;
+      }
+    }
+    return m_handler.number(std::strtod(m_number.c_str(), nullptr), 0, false);
+  }
+
+  const char *m_json;
+  size_t m_nLength;
+  Handler &m_handler;
+  std::string &m_err;
+  size_t m_i = 0;
+  // Reused by each key, string and number
+  std::string m_key;
+  std::string m_string;
+  std::string m_number;
+};
+
+// Builds a tinygltf::Value from the events of a JSON value, with the rules of
+// tinygltf (ParseJsonAsValue): nulls, empty objects and empty arrays are
+// dropped, integers become int.
+class ValueBuilder
+{
+public:
+  bool isActive() const { return !m_frames.empty(); }
+
+  void start(bool isObject)
+  {
+    m_frames.emplace_back();
+    m_frames.back().isObject = isObject;
+  }
+
+  void setKey(std::string &key) { m_frames.back().key = std::move(key); }
+
+  void add(tinygltf::Value &&value)
+  {
+    if (value.Type() == tinygltf::NULL_TYPE) {
+      return;
+    }
+    auto &frame = m_frames.back();
+    if (frame.isObject) {
+      frame.object.emplace(std::move(frame.key), std::move(value));
+    } else {
+      frame.array.push_back(std::move(value));
+    }
+  }
+
+  // Close the current object or array. Return true if it is the root value,
+  // which is then moved to root.
+  bool end(tinygltf::Value &root)
+  {
+    auto frame = std::move(m_frames.back());
+    m_frames.pop_back();
+    tinygltf::Value value;
+    if (frame.isObject && !frame.object.empty()) {
+      value = tinygltf::Value(std::move(frame.object));
+    } else if (!frame.isObject && !frame.array.empty()) {
+      value = tinygltf::Value(std::move(frame.array));
+    }
+    if (m_frames.empty()) {
+      root = std::move(value);
+      return true;
+    }
+    add(std::move(value));
+    return false;
+  }
+
+private:
+  struct Frame
+  {
+    bool isObject = false;
+    std::string key; // Of the next member of an object
+    tinygltf::Value::Object object;
+    tinygltf::Value::Array array;
+  };
+  std::vector<Frame> m_frames;
+};
+
+// Events of JsonSaxReader to a node array. Depth is the number of open
+// containers: 1 in the array, 2 in a node, 3 in the value of a member of a
+// node...
+class NodeArrayHandler
+{
+public:
+  NodeArrayHandler(std::vector<tinygltf::Node> &nodes, std::string &err) :
+      m_nodes(nodes), m_err(err)
+  {
+  }
+
+  bool null() { return scalar(tinygltf::Value()); }
+
+  bool boolean(bool value) { return scalar(tinygltf::Value(value)); }
+
+  // Most values are numbers of arrays or indices, they do not go through
+  // tinygltf::Value. Integers become int, as in tinygltf.
+  bool number(double value, int64_t integer, bool isInteger)
+  {
+    const auto intValue = int(integer);
+    if (m_depth == 3 && !m_builder.isActive()) {
+      if (m_member == Member::Numbers) {
+        m_numbers.push_back(value);
+      } else if (m_member == Member::Children && isInteger) {
+        m_children.push_back(intValue);
+      }
+      return true;
+    }
+    if (m_depth == 2 && isInteger) {
+      auto &node = m_nodes.back();
+      if (m_key == "mesh") {
+        node.mesh = intValue;
+        return true;
+      } else if (m_key == "skin") {
+        node.skin = intValue;
+        return true;
+      } else if (m_key == "camera") {
+        node.camera = intValue;
+        return true;
+      }
+    }
+    return scalar(
+        isInteger ? tinygltf::Value(intValue) : tinygltf::Value(value));
+  }
+
+  bool string(std::string &value)
+  {
+    if (m_depth == 2 && m_key == "name") {
+      m_nodes.back().name = std::move(value);
+      return true;
+    }
+    return scalar(tinygltf::Value(std::move(value)));
+  }
+
+  bool startContainer(bool isObject)
+  {
+    if (m_depth == 0 && isObject) {
+      return fail("nodes is not an array");
+    }
+    if (m_depth == 1) {
+      if (!isObject) {
+        return fail("nodes does not contain objects");
+      }
+      m_nodes.emplace_back();
+      m_hasMatrix = false;
+    } else if (m_depth == 2) {
+      startMember(isObject);
+    } else if (m_builder.isActive()) {
+      m_builder.start(isObject);
+    } else if (m_member == Member::Extensions && m_depth == 3 && isObject) {
+      m_builder.start(true);
+    }
+    ++m_depth;
+    return true;
+  }
+
+  bool endContainer()
+  {
+    --m_depth;
+    if (m_builder.isActive()) {
+      endValue();
+    }
+    if (m_depth == 2) {
+      // Arrays are allocated once, with their size
+      if (m_member == Member::Numbers) {
+        m_pNumbers->assign(begin(m_numbers), end(m_numbers));
+      } else if (m_member == Member::Children) {
+        m_nodes.back().children.assign(begin(m_children), end(m_children));
+      }
+      m_member = Member::None;
+    } else if (m_depth == 1) {
+      // Matrix and TRS are exclusive, the matrix wins
+      auto &node = m_nodes.back();
+      if (m_hasMatrix) {
+        node.rotation.clear();
+        node.scale.clear();
+        node.translation.clear();
+      }
+    }
+    return true;
+  }
+
+  bool key(std::string &key)
+  {
+    if (m_depth == 2) {
+      m_key = std::move(key);
+    } else if (m_builder.isActive()) {
+      m_builder.setKey(key);
+    } else if (m_member == Member::Extensions && m_depth == 3) {
+      m_extensionKey = std::move(key);
+    }
+    return true;
+  }
+
+private:
+  // Value of the member of the current node being parsed
+  enum class Member
+  {
+    None,
+    Numbers, // matrix, rotation, scale, translation, weights
+    Children,
+    Extras,
+    Extensions,
+    Ignored
+  };
+
+  bool fail(const std::string &message)
+  {
+    m_err = message;
+    return false;
+  }
+
+  bool scalar(tinygltf::Value &&value)
+  {
+    if (m_depth == 0) {
+      return fail("nodes is not an array");
+    }
+    if (m_depth == 1) {
+      return fail("nodes does not contain objects");
+    }
+    auto &node = m_nodes.back();
+    if (m_depth == 2) {
+      if (m_key == "extras") {
+        node.extras = std::move(value);
+      }
+    } else if (m_builder.isActive()) {
+      m_builder.add(std::move(value));
+    }
+    return true;
+  }
+
+  // Close a container of extras or of an extension
+  void endValue()
+  {
+    tinygltf::Value value;
+    if (!m_builder.end(value)) {
+      return;
+    }
+    auto &node = m_nodes.back();
+    if (m_member == Member::Extras) {
+      node.extras = std::move(value);
+    } else if (value.Type() == tinygltf::NULL_TYPE) {
+      // Extensions stay objects when they are empty
+      node.extensions[m_extensionKey] =
+          tinygltf::Value(tinygltf::Value::Object());
+    } else {
+      node.extensions[m_extensionKey] = std::move(value);
+    }
+  }
+
+  void startMember(bool isObject)
+  {
+    auto &node = m_nodes.back();
+    m_member = Member::Ignored;
+    if (m_key == "extras") {
+      m_member = Member::Extras;
+      m_builder.start(isObject);
+    } else if (isObject) {
+      if (m_key == "extensions") {
+        m_member = Member::Extensions;
+      }
+    } else if (m_key == "children") {
+      m_member = Member::Children;
+      m_children.clear();
+    } else {
+      m_pNumbers = m_key == "matrix"        ? &node.matrix
+                   : m_key == "rotation"    ? &node.rotation
+                   : m_key == "scale"       ? &node.scale
+                   : m_key == "translation" ? &node.translation
+                   : m_key == "weights"     ? &node.weights
+                                            : nullptr;
+      if (m_pNumbers) {
+        m_member = Member::Numbers;
+        m_numbers.clear();
+        m_hasMatrix |= m_pNumbers == &node.matrix;
+      }
+    }
+  }
+
+  std::vector<tinygltf::Node> &m_nodes;
+  std::string &m_err;
+  size_t m_depth = 0;
+  std::string m_key; // Of the current member of the current node
+  Member m_member = Member::None;
+  std::vector<double> *m_pNumbers = nullptr; // Of the current member
+  std::vector<double> m_numbers;
+  std::vector<int> m_children;
+  bool m_hasMatrix = false;
+  std::string m_extensionKey;
+  ValueBuilder m_builder; // Active in extras and in each extension
+};
+
+} // namespace
+
+bool findJsonMember(const char *json, size_t length, const std::string &name,
+    size_t &valueBegin, size_t &valueEnd)
+{
+  auto i = skipWhitespace(json, length, 0);
+  if (i >= length || json[i] != '{') {
+    return false;
+  }
+  i = skipWhitespace(json, length, i + 1);
+  while (i < length && json[i] == '"') {
+    const auto keyEnd = skipString(json, length, i);
+    // Keys with escape sequences are not unescaped
+    const auto isName = keyEnd - i == name.size() + 2 &&
+                        !std::memcmp(json + i + 1, name.data(), name.size());
+    i = skipWhitespace(json, length, keyEnd);
+    if (i >= length || json[i] != ':') {
+      return false;
+    }
+    i = skipWhitespace(json, length, i + 1);
+    const auto end = skipValue(json, length, i);
+    if (isName) {
+      valueBegin = i;
+      valueEnd = end;
+      return end > i;
+    }
+    i = skipWhitespace(json, length, end);
+    if (i >= length || json[i] != ',') {
+      return false;
+    }
+    i = skipWhitespace(json, length, i + 1);
+  }
+  return false;
+}
+
+bool parseGltfNodes(const char *json, size_t length,
+    std::vector<tinygltf::Node> &nodes, std::string &err)
+{
+  nodes.clear();
+  NodeArrayHandler handler(nodes, err);
+  return JsonSaxReader<NodeArrayHandler>(json, length, handler, err).parse();
+}
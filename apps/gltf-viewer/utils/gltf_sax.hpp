@@ -0,0 +1,26 @@
+#pragma once
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Import of the node array of glTF JSON without building a DOM. Exports of
+// large scene graphs have hundreds of thousands of nodes, which tinygltf
+// parses into a nlohmann::json DOM (a map and a few vectors per node) before
+// copying them into tinygltf::Node. Here a streaming reader fills the nodes
+// directly as it tokenizes the array, and the rest of the document is left
+// to tinygltf with an empty node array (see readGltfFile).
+
+// Find the value of the member name of the top-level object of json, without
+// parsing the other values. Return false if json is not an object or has no
+// such member, else set [valueBegin, valueEnd) to the bytes of the value.
+bool findJsonMember(const char *json, size_t length, const std::string &name,
+    size_t &valueBegin, size_t &valueEnd);
+
+// Parse a JSON array of glTF nodes into nodes, as tinygltf would (extensions
+// and extras are converted to tinygltf::Value). Return false and fill err if
+// it is not valid JSON or not an array of objects.
+bool parseGltfNodes(const char *json, size_t length,
+    std::vector<tinygltf::Node> &nodes, std::string &err);
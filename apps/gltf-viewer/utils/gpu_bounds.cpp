@@ -0,0 +1,193 @@
+#include "gpu_bounds.hpp"
+#include "tracing.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+
+// Shader storage bindings of reduce_bounds.cs.glsl
+const GLuint POSITIONS_BINDING =
+    GeometryArena::VERTEX_STORAGE_BINDING + GeometryArena::POSITION;
+const GLuint DRAW_BOUNDS_BINDING = 2; // As in cull_draws.cs.glsl
+const GLuint RANGES_BINDING = 14;
+const GLuint RESULTS_BINDING = 15;
+
+// Scene box header of the results, 8 uints
+const size_t SCENE_BOUNDS_SIZE = 8 * sizeof(GLuint);
+
+// Inverse of toOrderedUint in reduce_bounds.cs.glsl
+float fromOrderedUint(GLuint value)
+{
+  const auto bits = (value & 0x80000000u) ? value & 0x7FFFFFFFu : ~value;
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+} // namespace
+
+GpuBounds::~GpuBounds() { release(); }
+
+GpuBounds &GpuBounds::operator=(GpuBounds &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_ranges, rvalue.m_ranges);
+    m_rangeBuffer = std::move(rvalue.m_rangeBuffer);
+    m_resultBuffer = std::move(rvalue.m_resultBuffer);
+    m_readbackBuffer = std::move(rvalue.m_readbackBuffer);
+    std::swap(m_fence, rvalue.m_fence);
+    std::swap(m_hasReduced, rvalue.m_hasReduced);
+  }
+  return *this;
+}
+
+void GpuBounds::build(const std::vector<Range> &ranges)
+{
+  release();
+  m_hasReduced = false;
+  m_ranges.clear();
+  m_ranges.reserve(ranges.size());
+  for (const auto &range : ranges) {
+    m_ranges.push_back(
+        {range.firstVertex, range.vertexCount, range.draw, 0, glm::mat4(1)});
+  }
+  if (m_ranges.empty()) {
+    m_rangeBuffer = GLBuffer();
+    m_resultBuffer = GLBuffer();
+    m_readbackBuffer = GLBuffer();
+    return;
+  }
+  const auto resultSize =
+      SCENE_BOUNDS_SIZE + m_ranges.size() * 2 * sizeof(glm::vec4);
+  m_rangeBuffer = GLBuffer(m_ranges.size() * sizeof(GpuRange), nullptr,
+      GL_DYNAMIC_STORAGE_BIT);
+  m_resultBuffer = GLBuffer(resultSize, nullptr, 0);
+  m_readbackBuffer =
+      GLBuffer(resultSize, nullptr, GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+}
+
+void GpuBounds::reduce(const GLProgram &program, const GeometryArena &arena,
+    const std::vector<glm::mat4> &matrices, GLuint drawBoundsBuffer)
+{
+  if (m_ranges.empty()) {
+    return;
+  }
+  TRACE_ZONE("Reduce bounds");
+  for (size_t i = 0; i < m_ranges.size(); ++i) {
+    m_ranges[i].matrix = matrices[i];
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_rangeBuffer.glId());
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+      m_ranges.size() * sizeof(GpuRange), m_ranges.data());
+  // Empty scene box: the largest ordered uint for the min, the smallest
+  // for the max
+  const GLuint emptyMin = ~GLuint(0), emptyMax = 0;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_resultBuffer.glId());
+  glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0,
+      SCENE_BOUNDS_SIZE / 2, GL_RED_INTEGER, GL_UNSIGNED_INT, &emptyMin);
+  glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI,
+      SCENE_BOUNDS_SIZE / 2, SCENE_BOUNDS_SIZE / 2, GL_RED_INTEGER,
+      GL_UNSIGNED_INT, &emptyMax);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  program.use();
+  program.getUniform<GLint>("uWritesDrawBounds")
+      .set(drawBoundsBuffer != 0);
+  arena.bindStreamStorage(POSITIONS_BINDING, GeometryArena::POSITION);
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, DRAW_BOUNDS_BINDING, drawBoundsBuffer);
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, RANGES_BINDING, m_rangeBuffer.glId());
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, RESULTS_BINDING, m_resultBuffer.glId());
+  // The pre-passes writing posed vertices only make them visible to vertex
+  // attributes
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  glDispatchCompute(GLuint(m_ranges.size()), 1, 1);
+  // Read by the culling pass and by requestReadback
+  glMemoryBarrier(
+      GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+  for (const auto binding : {POSITIONS_BINDING, DRAW_BOUNDS_BINDING,
+           RANGES_BINDING, RESULTS_BINDING}) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+  }
+  m_hasReduced = true;
+}
+
+void GpuBounds::requestReadback()
+{
+  if (m_fence || !m_hasReduced) {
+    return;
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, m_resultBuffer.glId());
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_readbackBuffer.glId());
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+      SCENE_BOUNDS_SIZE + m_ranges.size() * 2 * sizeof(glm::vec4));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  // Submitted now so that the results are ready by the next frame
+  glFlush();
+}
+
+bool GpuBounds::poll(std::vector<glm::vec3> &bboxMins,
+    std::vector<glm::vec3> &bboxMaxs, glm::vec3 &sceneMin,
+    glm::vec3 &sceneMax)
+{
+  if (!m_fence) {
+    return false;
+  }
+  const auto status = glClientWaitSync(m_fence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    return false;
+  }
+  glDeleteSync(m_fence);
+  m_fence = nullptr;
+  if (status == GL_WAIT_FAILED) {
+    std::cerr << "Error: GpuBounds - glClientWaitSync failed" << std::endl;
+    return false;
+  }
+
+  const auto resultSize =
+      SCENE_BOUNDS_SIZE + m_ranges.size() * 2 * sizeof(glm::vec4);
+  const auto *data = static_cast<const unsigned char *>(
+      m_readbackBuffer.map(0, resultSize, GL_MAP_READ_BIT));
+  if (!data) {
+    return false;
+  }
+  GLuint sceneBounds[8];
+  std::memcpy(sceneBounds, data, SCENE_BOUNDS_SIZE);
+  for (glm::length_t c = 0; c < 3; ++c) {
+    sceneMin[c] = fromOrderedUint(sceneBounds[c]);
+    sceneMax[c] = fromOrderedUint(sceneBounds[4 + c]);
+  }
+  // Left as cleared if no range has vertices
+  if (sceneBounds[0] == ~GLuint(0)) {
+    sceneMin = glm::vec3(std::numeric_limits<float>::max());
+    sceneMax = glm::vec3(std::numeric_limits<float>::lowest());
+  }
+  std::vector<glm::vec4> rangeBounds(2 * m_ranges.size());
+  std::memcpy(rangeBounds.data(), data + SCENE_BOUNDS_SIZE,
+      rangeBounds.size() * sizeof(glm::vec4));
+  m_readbackBuffer.unmap();
+
+  bboxMins.resize(m_ranges.size());
+  bboxMaxs.resize(m_ranges.size());
+  for (size_t i = 0; i < m_ranges.size(); ++i) {
+    bboxMins[i] = glm::vec3(rangeBounds[2 * i]);
+    bboxMaxs[i] = glm::vec3(rangeBounds[2 * i + 1]);
+  }
+  return true;
+}
+
+void GpuBounds::release()
+{
+  if (m_fence) {
+    glDeleteSync(m_fence);
+    m_fence = nullptr;
+  }
+}
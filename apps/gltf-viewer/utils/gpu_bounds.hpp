@@ -0,0 +1,103 @@
+#pragma once
+
+#include "geometry_arena.hpp"
+#include "gl_objects.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <utility>
+#include <vector>
+
+// World space bounds of ranges of vertices of a GeometryArena, e.g. of the
+// draws of skinned and morphed meshes once posed by their pre-passes, or of
+// primitives without POSITION bounds, reduced on the GPU from the vertices
+// the draws read (see reduce_bounds.cs.glsl) instead of walking them on the
+// CPU.
+//
+// reduce() writes the box of each range in the DrawBounds of its draw read
+// by IndirectDrawList::cull, so that culling on the GPU needs no readback.
+// The boxes and the box of all ranges are only read back for the CPU on
+// request (see requestReadback), guarded by a fence that poll() tests
+// without waiting: they lag the vertices by the frames the GPU is behind.
+class GpuBounds
+{
+public:
+  // Draw of the ranges that have no DrawBounds
+  static constexpr GLuint NO_DRAW = ~GLuint(0);
+
+  struct Range
+  {
+    GLuint firstVertex;
+    GLuint vertexCount;
+    // Index of its DrawBounds in the drawBoundsBuffer given to reduce()
+    GLuint draw = NO_DRAW;
+  };
+
+  GpuBounds() = default;
+
+  // Delete the fence of the pending readback
+  ~GpuBounds();
+
+  // Non-copyable class:
+  GpuBounds(const GpuBounds &) = delete;
+  GpuBounds &operator=(const GpuBounds &) = delete;
+
+  GpuBounds(GpuBounds &&rvalue) { *this = std::move(rvalue); }
+
+  GpuBounds &operator=(GpuBounds &&rvalue);
+
+  // Allocate the buffers of ranges, previous results are discarded
+  void build(const std::vector<Range> &ranges);
+
+  bool empty() const { return m_ranges.empty(); }
+
+  size_t rangeCount() const { return m_ranges.size(); }
+
+  // Bound the vertices of each range of arena transformed by its matrix
+  // (stored positions to world space, see ArenaPrimitive::positionMatrix),
+  // writing the DrawBounds of drawBoundsBuffer if it is not 0. program is
+  // reduce_bounds.cs.glsl, compiled with QUANTIZED_VERTICES for quantized
+  // arenas, and with SUBGROUP_ARITHMETIC if
+  // getGLExtensions().shaderSubgroupArithmetic is true. This binds program.
+  void reduce(const GLProgram &program, const GeometryArena &arena,
+      const std::vector<glm::mat4> &matrices, GLuint drawBoundsBuffer = 0);
+
+  // True once reduce() has been called since build()
+  bool hasReduced() const { return m_hasReduced; }
+
+  // Start the readback of the results of the last reduce(), unless one is
+  // pending
+  void requestReadback();
+
+  // True from requestReadback() until poll() returns the results
+  bool isPending() const { return m_fence != nullptr; }
+
+  // If the GPU is done with the pending readback, set the box of each range
+  // (empty, min > max, for ranges without vertex) and the box of all of
+  // them, then return true. Never waits.
+  bool poll(std::vector<glm::vec3> &bboxMins, std::vector<glm::vec3> &bboxMaxs,
+      glm::vec3 &sceneMin, glm::vec3 &sceneMax);
+
+private:
+  // Per range data, matches Range in reduce_bounds.cs.glsl
+  struct GpuRange
+  {
+    GLuint firstVertex;
+    GLuint vertexCount;
+    GLuint draw;
+    GLuint padding;
+    glm::mat4 matrix;
+  };
+
+  void release();
+
+  std::vector<GpuRange> m_ranges; // Matrices of the last reduce()
+  GLBuffer m_rangeBuffer;
+  // Scene box as 8 ordered uints, then a min and a max vec4 per range
+  GLBuffer m_resultBuffer;
+  GLBuffer m_readbackBuffer; // Copy of m_resultBuffer
+  GLsync m_fence = nullptr;
+  bool m_hasReduced = false;
+};
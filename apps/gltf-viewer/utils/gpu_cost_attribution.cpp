@@ -0,0 +1,120 @@
+#include "gpu_cost_attribution.hpp"
+
+#include <algorithm>
+
+void GpuCostAttribution::build(CostBuckets buckets,
+    const SceneHierarchy &hierarchy, const std::vector<uint32_t> &drawNodes,
+    const std::vector<uint32_t> &drawMaterials)
+{
+  release();
+  m_buckets = buckets;
+  m_nNodeCount = hierarchy.size();
+
+  // Keys of the buckets by increasing value
+  auto &keyBuckets = m_keyBuckets;
+  if (buckets == CostBuckets::TopLevelNodes) {
+    // Parents come before their children in the flat hierarchy
+    std::vector<uint32_t> nodeRoots(hierarchy.size());
+    for (size_t i = 0; i < hierarchy.size(); ++i) {
+      const auto parent = hierarchy.parent(i);
+      nodeRoots[i] = parent >= 0 ? nodeRoots[parent] : uint32_t(i);
+    }
+    keyBuckets.assign(hierarchy.size(), NO_BUCKET);
+    m_drawBuckets.reserve(drawNodes.size());
+    for (const auto node : drawNodes) {
+      const auto root = nodeRoots[node];
+      if (keyBuckets[root] == NO_BUCKET) {
+        keyBuckets[root] = 0;
+      }
+      m_drawBuckets.push_back(root);
+    }
+  } else if (buckets == CostBuckets::Materials) {
+    for (const auto material : drawMaterials) {
+      if (material >= keyBuckets.size()) {
+        keyBuckets.resize(material + 1, NO_BUCKET);
+      }
+      keyBuckets[material] = 0;
+    }
+    m_drawBuckets = drawMaterials;
+  }
+  for (size_t key = 0; key < keyBuckets.size(); ++key) {
+    if (keyBuckets[key] != NO_BUCKET) {
+      keyBuckets[key] = uint32_t(m_bucketKeys.size());
+      m_bucketKeys.push_back(uint32_t(key));
+    }
+  }
+  for (auto &bucket : m_drawBuckets) {
+    bucket = keyBuckets[bucket];
+  }
+  m_bucketTimes.assign(m_bucketKeys.size(), -1.f);
+
+  for (auto &query : m_queries) {
+    glGenQueries(1, &query.start);
+    glGenQueries(1, &query.end);
+  }
+}
+
+void GpuCostAttribution::beginFrame()
+{
+  m_nTimedBucket = NO_BUCKET;
+  if (m_bucketKeys.empty()) {
+    return;
+  }
+  // Queries are made in order, the next one is the oldest
+  auto &query = m_queries[m_nNextQuery];
+  if (query.bucket != NO_BUCKET) {
+    GLint isAvailable = 0;
+    glGetQueryObjectiv(query.end, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+    if (!isAvailable) {
+      return;
+    }
+    GLuint64 startTime = 0, endTime = 0;
+    glGetQueryObjectui64v(query.start, GL_QUERY_RESULT, &startTime);
+    glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &endTime);
+    m_bucketTimes[query.bucket] = float(endTime - startTime) * 1e-6f;
+    m_fMaxTime =
+        *std::max_element(begin(m_bucketTimes), end(m_bucketTimes));
+    query.bucket = NO_BUCKET;
+  }
+  m_nTimedBucket = m_nNextBucket;
+}
+
+void GpuCostAttribution::beginQuery()
+{
+  if (m_nTimedBucket != NO_BUCKET) {
+    glQueryCounter(m_queries[m_nNextQuery].start, GL_TIMESTAMP);
+  }
+}
+
+void GpuCostAttribution::endQuery()
+{
+  if (m_nTimedBucket == NO_BUCKET) {
+    return;
+  }
+  auto &query = m_queries[m_nNextQuery];
+  glQueryCounter(query.end, GL_TIMESTAMP);
+  query.bucket = m_nTimedBucket;
+  m_nNextQuery = (m_nNextQuery + 1) % (QUERY_LATENCY + 1);
+  m_nNextBucket = (m_nNextBucket + 1) % uint32_t(m_bucketKeys.size());
+  m_nTimedBucket = NO_BUCKET;
+}
+
+void GpuCostAttribution::release()
+{
+  for (auto &query : m_queries) {
+    if (query.start) {
+      glDeleteQueries(1, &query.start);
+      glDeleteQueries(1, &query.end);
+    }
+    query = Query{};
+  }
+  m_nNodeCount = 0;
+  m_drawBuckets.clear();
+  m_bucketKeys.clear();
+  m_keyBuckets.clear();
+  m_bucketTimes.clear();
+  m_fMaxTime = 0.f;
+  m_nNextQuery = 0;
+  m_nNextBucket = 0;
+  m_nTimedBucket = NO_BUCKET;
+}
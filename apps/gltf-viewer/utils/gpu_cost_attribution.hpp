@@ -0,0 +1,123 @@
+#pragma once
+
+#include "scene_hierarchy.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Draws grouped in a bucket by GpuCostAttribution
+enum class CostBuckets
+{
+  None,
+  // The subtree of each root node of the scene
+  TopLevelNodes,
+  // The primitives of each material, and of the default material
+  Materials
+};
+
+// Attribution of the GPU time of the main pass to buckets of draws, for
+// draws made one by one. Each frame times a single bucket, in round-robin:
+// its opaque draws are drawn together between beginQuery() and endQuery(),
+// whose GL_TIMESTAMP queries, which unlike the GL_TIME_ELAPSED queries of
+// Profiler can be placed inside its scopes, are read QUERY_LATENCY frames
+// later. The CPU never waits for a result, a frame whose queries are not
+// free times no bucket.
+//
+// Timing a bucket draws it after the other opaque draws, which may reject
+// its fragments earlier than in its place, unless the depth pre-pass did.
+// An instance serves a single view drawn every frame (the window).
+class GpuCostAttribution
+{
+public:
+  static const size_t QUERY_LATENCY = 3;
+  static constexpr uint32_t NO_BUCKET = 0xFFFFFFFF;
+
+  GpuCostAttribution() = default;
+
+  ~GpuCostAttribution() { release(); }
+
+  // Non-copyable class:
+  GpuCostAttribution(const GpuCostAttribution &) = delete;
+  GpuCostAttribution &operator=(const GpuCostAttribution &) = delete;
+
+  // True if build() was called for these numbers of nodes and draws
+  bool isBuiltFor(size_t nodeCount, size_t drawCount) const
+  {
+    return m_nNodeCount == nodeCount && m_drawBuckets.size() == drawCount;
+  }
+
+  // Group the draws of hierarchy in buckets, drawNodes[i] being the flat
+  // index of the node of draw i and drawMaterials[i] its material plus one.
+  // Previous times are discarded.
+  void build(CostBuckets buckets, const SceneHierarchy &hierarchy,
+      const std::vector<uint32_t> &drawNodes,
+      const std::vector<uint32_t> &drawMaterials);
+
+  // Read the results available without waiting, and choose the bucket timed
+  // by this frame
+  void beginFrame();
+
+  // True if drawIdx belongs to the bucket timed by this frame
+  bool isTimed(size_t drawIdx) const
+  {
+    return m_nTimedBucket != NO_BUCKET &&
+           m_drawBuckets[drawIdx] == m_nTimedBucket;
+  }
+
+  // Time the draw commands of the timed bucket between these calls, at most
+  // once a frame
+  void beginQuery();
+  void endQuery();
+
+  CostBuckets buckets() const { return m_buckets; }
+
+  size_t bucketCount() const { return m_bucketKeys.size(); }
+
+  // Flat index of the root node of bucket, or its material plus one
+  uint32_t bucketKey(size_t bucket) const { return m_bucketKeys[bucket]; }
+
+  // Last GPU time of bucket in milliseconds, negative until measured
+  float bucketTime(size_t bucket) const { return m_bucketTimes[bucket]; }
+
+  // Last GPU time of the bucket of key (see bucketKey), negative if there is
+  // none or until measured
+  float keyTime(uint32_t key) const
+  {
+    return key < m_keyBuckets.size() && m_keyBuckets[key] != NO_BUCKET
+               ? m_bucketTimes[m_keyBuckets[key]]
+               : -1.f;
+  }
+
+  // Time of the bucket of drawIdx over the time of the most expensive
+  // bucket, 0 until measured
+  float heat(size_t drawIdx) const
+  {
+    const auto time = m_bucketTimes[m_drawBuckets[drawIdx]];
+    return m_fMaxTime > 0.f && time > 0.f ? time / m_fMaxTime : 0.f;
+  }
+
+private:
+  struct Query
+  {
+    GLuint start = 0;
+    GLuint end = 0;
+    uint32_t bucket = NO_BUCKET; // Timed by the pending query
+  };
+
+  void release();
+
+  CostBuckets m_buckets = CostBuckets::None;
+  size_t m_nNodeCount = 0;
+  std::vector<uint32_t> m_drawBuckets;
+  std::vector<uint32_t> m_bucketKeys;
+  std::vector<uint32_t> m_keyBuckets;
+  std::vector<float> m_bucketTimes;
+  float m_fMaxTime = 0.f;
+  Query m_queries[QUERY_LATENCY + 1];
+  size_t m_nNextQuery = 0;
+  uint32_t m_nNextBucket = 0;
+  uint32_t m_nTimedBucket = NO_BUCKET;
+};
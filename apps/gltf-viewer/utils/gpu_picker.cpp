@@ -0,0 +1,115 @@
+#include "gpu_picker.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+GpuPicker::~GpuPicker() { release(); }
+
+GpuPicker &GpuPicker::operator=(GpuPicker &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    m_idBuffer = std::move(rvalue.m_idBuffer);
+    m_depthBuffer = std::move(rvalue.m_depthBuffer);
+    m_framebuffer = std::move(rvalue.m_framebuffer);
+    m_pixelBuffer = std::move(rvalue.m_pixelBuffer);
+    std::swap(m_fence, rvalue.m_fence);
+  }
+  return *this;
+}
+
+glm::mat4 GpuPicker::getPixelMatrix(
+    double x, double y, size_t width, size_t height)
+{
+  // The center of the pixel in normalized device coordinates goes to the
+  // origin, its half size to 1
+  const auto ndcX = float(2. * (std::floor(x) + 0.5) / double(width) - 1.);
+  const auto ndcY = float(2. * (std::floor(y) + 0.5) / double(height) - 1.);
+  glm::mat4 pixelMatrix(1);
+  pixelMatrix[0][0] = float(width);
+  pixelMatrix[1][1] = float(height);
+  pixelMatrix[3][0] = -float(width) * ndcX;
+  pixelMatrix[3][1] = -float(height) * ndcY;
+  return pixelMatrix;
+}
+
+void GpuPicker::begin()
+{
+  if (!m_framebuffer.glId()) {
+    // Floating point depth fits both depth conventions
+    m_idBuffer = GLRenderbuffer(GL_R32UI, 1, 1);
+    m_depthBuffer = GLRenderbuffer(GL_DEPTH_COMPONENT32F, 1, 1);
+    m_framebuffer = GLFramebuffer::create();
+    m_framebuffer.attachRenderbuffer(GL_COLOR_ATTACHMENT0, m_idBuffer.glId());
+    m_framebuffer.attachRenderbuffer(GL_DEPTH_ATTACHMENT, m_depthBuffer.glId());
+    m_framebuffer.setReadBuffer(GL_COLOR_ATTACHMENT0);
+    m_pixelBuffer = GLBuffer(sizeof(GLuint) + sizeof(float), nullptr,
+        GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+  }
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_previousDrawFramebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &m_previousReadFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, m_previousViewport);
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer.glId());
+  glViewport(0, 0, 1, 1);
+  const GLuint background = NO_DRAW;
+  glClearBufferuiv(GL_COLOR, 0, &background);
+  glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void GpuPicker::end()
+{
+  if (m_fence) {
+    glDeleteSync(m_fence);
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer.glId());
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffer.glId());
+  glReadPixels(0, 0, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  glReadPixels(0, 0, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT,
+      (GLvoid *)sizeof(GLuint));
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  // Submitted now so that the result is ready by the next frame
+  glFlush();
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(m_previousDrawFramebuffer));
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(m_previousReadFramebuffer));
+  glViewport(m_previousViewport[0], m_previousViewport[1],
+      m_previousViewport[2], m_previousViewport[3]);
+}
+
+bool GpuPicker::poll(GLuint &drawId, float &depth)
+{
+  if (!m_fence) {
+    return false;
+  }
+  const auto status = glClientWaitSync(m_fence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    return false;
+  }
+  glDeleteSync(m_fence);
+  m_fence = nullptr;
+  if (status == GL_WAIT_FAILED) {
+    std::cerr << "Error: GpuPicker - glClientWaitSync failed" << std::endl;
+    return false;
+  }
+
+  const auto *data = static_cast<const unsigned char *>(
+      m_pixelBuffer.map(0, sizeof(GLuint) + sizeof(float), GL_MAP_READ_BIT));
+  if (!data) {
+    return false;
+  }
+  std::memcpy(&drawId, data, sizeof(GLuint));
+  std::memcpy(&depth, data + sizeof(GLuint), sizeof(float));
+  m_pixelBuffer.unmap();
+  return true;
+}
+
+void GpuPicker::release()
+{
+  if (m_fence) {
+    glDeleteSync(m_fence);
+    m_fence = nullptr;
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "gl_objects.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <utility>
+
+// Picking of the draw seen through a pixel on the GPU, without waiting for
+// it. A pick draws the identifiers of the draws crossing the pixel (the
+// caller culls them with the frustum of getPixelMatrix() * projMatrix) in a
+// 1x1 framebuffer: an R32UI color buffer and a depth buffer keeping the
+// nearest one. The identifier and the depth are then copied to a pixel pack
+// buffer guarded by a fence, which poll() reads once the GPU is done,
+// normally one frame later.
+//
+// Unlike an identifier buffer written by the main pass, this costs nothing
+// in frames without picks and needs no change to the scene programs.
+class GpuPicker
+{
+public:
+  // Identifier of the background, draws write their index + 1
+  static const GLuint NO_DRAW = 0;
+
+  GpuPicker() = default;
+
+  // Delete the fence of the pending pick
+  ~GpuPicker();
+
+  // Non-copyable class:
+  GpuPicker(const GpuPicker &) = delete;
+  GpuPicker &operator=(const GpuPicker &) = delete;
+
+  GpuPicker(GpuPicker &&rvalue) { *this = std::move(rvalue); }
+
+  GpuPicker &operator=(GpuPicker &&rvalue);
+
+  // Projection of the pixel (x, y) of a width x height viewport, measured
+  // from its lower left corner, on the whole clip space: the projection of
+  // a pick is getPixelMatrix(...) * projMatrix
+  static glm::mat4 getPixelMatrix(
+      double x, double y, size_t width, size_t height);
+
+  // Bind the framebuffer in a 1x1 viewport and clear it with the current
+  // clear depth, the draws of the pick follow with the current depth test
+  void begin();
+
+  // Start the readback of the pick, then bind the framebuffers and the
+  // viewport bound before begin() again
+  void end();
+
+  // True from end() until poll() returns the result
+  bool isPending() const { return m_fence != nullptr; }
+
+  // If the GPU is done with the pending pick, set drawId and the window
+  // space depth of the nearest fragment, then return true. Never waits.
+  bool poll(GLuint &drawId, float &depth);
+
+private:
+  void release();
+
+  GLRenderbuffer m_idBuffer;
+  GLRenderbuffer m_depthBuffer;
+  GLFramebuffer m_framebuffer;
+  GLBuffer m_pixelBuffer; // Identifier then depth
+  GLsync m_fence = nullptr;
+  GLint m_previousDrawFramebuffer = 0;
+  GLint m_previousReadFramebuffer = 0;
+  GLint m_previousViewport[4] = {};
+};
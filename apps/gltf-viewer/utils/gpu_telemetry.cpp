@@ -0,0 +1,442 @@
+#include "gpu_telemetry.hpp"
+#include "filesystem.hpp"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <type_traits>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#endif
+
+// Source of the samples, called on the sampling thread only
+class GpuTelemetry::Backend
+{
+public:
+  virtual ~Backend() = default;
+
+  virtual void sample(GpuTelemetrySample &sample) = 0;
+};
+
+namespace
+{
+
+#ifdef __linux__
+
+// Subset of nvml.h, whose ABI is stable across drivers
+using nvmlReturn_t = int;
+using nvmlDevice_t = struct nvmlDevice_st *;
+const nvmlReturn_t NVML_SUCCESS = 0;
+const int NVML_CLOCK_GRAPHICS = 0;
+const int NVML_CLOCK_MEM = 2;
+const int NVML_TEMPERATURE_GPU = 0;
+const unsigned int NVML_DEVICE_NAME_BUFFER_SIZE = 96;
+
+struct nvmlUtilization_t
+{
+  unsigned int gpu;
+  unsigned int memory;
+};
+
+struct nvmlMemory_t
+{
+  unsigned long long total;
+  unsigned long long free;
+  unsigned long long used;
+};
+
+class NvmlBackend : public GpuTelemetry::Backend
+{
+public:
+  // Load NVML and pick the device named in renderer, m_device is null if
+  // it is not available
+  explicit NvmlBackend(const std::string &renderer)
+  {
+    // Never closed, as libEGL in HeadlessGLContext
+    auto library = dlopen("libnvidia-ml.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!library) {
+      return;
+    }
+    const auto load = [&](auto &function, const char *name) {
+      function = reinterpret_cast<std::decay_t<decltype(function)>>(
+          dlsym(library, name));
+      return function != nullptr;
+    };
+    if (!load(m_init, "nvmlInit_v2") || !load(m_shutdown, "nvmlShutdown") ||
+        !load(m_getCount, "nvmlDeviceGetCount_v2") ||
+        !load(m_getHandle, "nvmlDeviceGetHandleByIndex_v2") ||
+        !load(m_getName, "nvmlDeviceGetName") ||
+        !load(m_getClock, "nvmlDeviceGetClockInfo") ||
+        !load(m_getTemperature, "nvmlDeviceGetTemperature") ||
+        !load(m_getPower, "nvmlDeviceGetPowerUsage") ||
+        !load(m_getUtilization, "nvmlDeviceGetUtilizationRates") ||
+        !load(m_getMemory, "nvmlDeviceGetMemoryInfo") ||
+        m_init() != NVML_SUCCESS) {
+      return;
+    }
+    m_isInitialized = true;
+    // Missing from old drivers
+    load(m_getThrottleReasons, "nvmlDeviceGetCurrentClocksThrottleReasons");
+
+    unsigned int count = 0;
+    if (m_getCount(&count) != NVML_SUCCESS) {
+      return;
+    }
+    for (unsigned int i = 0; i < count; ++i) {
+      nvmlDevice_t device = nullptr;
+      char name[NVML_DEVICE_NAME_BUFFER_SIZE] = {};
+      if (m_getHandle(i, &device) != NVML_SUCCESS ||
+          m_getName(device, name, NVML_DEVICE_NAME_BUFFER_SIZE) !=
+              NVML_SUCCESS) {
+        continue;
+      }
+      const auto isRenderer = renderer.find(name) != std::string::npos;
+      if (!m_device || isRenderer) {
+        m_device = device;
+        m_deviceName = name;
+      }
+      if (isRenderer) {
+        break;
+      }
+    }
+  }
+
+  ~NvmlBackend() override
+  {
+    if (m_isInitialized) {
+      m_shutdown();
+    }
+  }
+
+  bool isAvailable() const { return m_device != nullptr; }
+
+  const std::string &deviceName() const { return m_deviceName; }
+
+  void sample(GpuTelemetrySample &sample) override
+  {
+    unsigned int value = 0;
+    if (m_getClock(m_device, NVML_CLOCK_GRAPHICS, &value) == NVML_SUCCESS) {
+      sample.graphicsClock = float(value);
+    }
+    if (m_getClock(m_device, NVML_CLOCK_MEM, &value) == NVML_SUCCESS) {
+      sample.memoryClock = float(value);
+    }
+    if (m_getTemperature(m_device, NVML_TEMPERATURE_GPU, &value) ==
+        NVML_SUCCESS) {
+      sample.temperature = float(value);
+    }
+    if (m_getPower(m_device, &value) == NVML_SUCCESS) {
+      sample.power = 1e-3f * float(value); // Milliwatts
+    }
+    nvmlUtilization_t utilization;
+    if (m_getUtilization(m_device, &utilization) == NVML_SUCCESS) {
+      sample.utilization = float(utilization.gpu);
+    }
+    nvmlMemory_t memory;
+    if (m_getMemory(m_device, &memory) == NVML_SUCCESS) {
+      sample.memoryUsedBytes = int64_t(memory.used);
+      sample.memoryTotalBytes = int64_t(memory.total);
+    }
+    unsigned long long reasons = 0;
+    if (m_getThrottleReasons &&
+        m_getThrottleReasons(m_device, &reasons) == NVML_SUCCESS) {
+      sample.throttleReasons = reasons;
+    }
+  }
+
+private:
+  nvmlReturn_t (*m_init)() = nullptr;
+  nvmlReturn_t (*m_shutdown)() = nullptr;
+  nvmlReturn_t (*m_getCount)(unsigned int *) = nullptr;
+  nvmlReturn_t (*m_getHandle)(unsigned int, nvmlDevice_t *) = nullptr;
+  nvmlReturn_t (*m_getName)(nvmlDevice_t, char *, unsigned int) = nullptr;
+  nvmlReturn_t (*m_getClock)(nvmlDevice_t, int, unsigned int *) = nullptr;
+  nvmlReturn_t (*m_getTemperature)(nvmlDevice_t, int, unsigned int *) =
+      nullptr;
+  nvmlReturn_t (*m_getPower)(nvmlDevice_t, unsigned int *) = nullptr;
+  nvmlReturn_t (*m_getUtilization)(nvmlDevice_t, nvmlUtilization_t *) =
+      nullptr;
+  nvmlReturn_t (*m_getMemory)(nvmlDevice_t, nvmlMemory_t *) = nullptr;
+  nvmlReturn_t (*m_getThrottleReasons)(
+      nvmlDevice_t, unsigned long long *) = nullptr;
+
+  bool m_isInitialized = false;
+  nvmlDevice_t m_device = nullptr;
+  std::string m_deviceName;
+};
+
+// Read the integer of a sysfs file, false if it is missing
+bool readSysfsValue(const fs::path &path, int64_t &value)
+{
+  std::ifstream file(path);
+  return bool(file >> value);
+}
+
+// amdgpu exposes the same counters as AMD SMI in sysfs
+class AmdgpuBackend : public GpuTelemetry::Backend
+{
+public:
+  AmdgpuBackend()
+  {
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator("/sys/class/drm", ec)) {
+      const auto name = entry.path().filename().string();
+      // cardN, not its connectors (cardN-DP-1...)
+      if (name.rfind("card", 0) != 0 ||
+          name.find('-') != std::string::npos) {
+        continue;
+      }
+      const auto device = entry.path() / "device";
+      std::ifstream vendor(device / "vendor");
+      std::string vendorId;
+      if (!(vendor >> vendorId) || vendorId != "0x1002" ||
+          !fs::exists(device / "gpu_busy_percent", ec)) {
+        continue;
+      }
+      m_device = device;
+      m_deviceName = "AMD " + name;
+      for (const auto &hwmon :
+          fs::directory_iterator(device / "hwmon", ec)) {
+        m_hwmon = hwmon.path();
+        break;
+      }
+      break;
+    }
+  }
+
+  bool isAvailable() const { return !m_device.empty(); }
+
+  const std::string &deviceName() const { return m_deviceName; }
+
+  void sample(GpuTelemetrySample &sample) override
+  {
+    int64_t value = 0;
+    if (readSysfsValue(m_device / "gpu_busy_percent", value)) {
+      sample.utilization = float(value);
+    }
+    if (readSysfsValue(m_device / "mem_info_vram_used", value)) {
+      sample.memoryUsedBytes = value;
+    }
+    if (readSysfsValue(m_device / "mem_info_vram_total", value)) {
+      sample.memoryTotalBytes = value;
+    }
+    if (m_hwmon.empty()) {
+      return;
+    }
+    if (readSysfsValue(m_hwmon / "freq1_input", value)) {
+      sample.graphicsClock = 1e-6f * float(value); // Hertz
+    }
+    if (readSysfsValue(m_hwmon / "freq2_input", value)) {
+      sample.memoryClock = 1e-6f * float(value);
+    }
+    if (readSysfsValue(m_hwmon / "temp1_input", value)) {
+      sample.temperature = 1e-3f * float(value); // Millidegrees
+    }
+    // Microwatts, averaged by older kernels, instantaneous by newer ones
+    if (readSysfsValue(m_hwmon / "power1_average", value) ||
+        readSysfsValue(m_hwmon / "power1_input", value)) {
+      sample.power = 1e-6f * float(value);
+    }
+  }
+
+private:
+  fs::path m_device;
+  fs::path m_hwmon;
+  std::string m_deviceName;
+};
+
+#endif
+
+// Means and extrema of the reported values, a field being reported if
+// non-negative
+struct Summary
+{
+  double sum = 0.;
+  size_t count = 0;
+  float min = -1.f;
+  float max = -1.f;
+
+  void add(float value)
+  {
+    if (value < 0.f) {
+      return;
+    }
+    sum += value;
+    min = count ? std::min(min, value) : value;
+    max = count ? std::max(max, value) : value;
+    ++count;
+  }
+
+  float mean() const { return count ? float(sum / double(count)) : -1.f; }
+};
+
+} // namespace
+
+std::string getThrottleReasonNames(uint64_t throttleReasons)
+{
+  // nvmlClocksThrottleReasons bits, idle (0x1) is not a throttle
+  const std::pair<uint64_t, const char *> names[] = {
+      {0x2, "application clocks"}, {0x4, "power cap"},
+      {0x8, "hardware slowdown"}, {0x10, "sync boost"},
+      {0x20, "thermal"}, {0x40, "hardware thermal"},
+      {0x80, "power brake"}, {0x100, "display clocks"}};
+  std::string result;
+  for (const auto &[bit, name] : names) {
+    if (throttleReasons & bit) {
+      result += (result.empty() ? "" : ", ") + std::string(name);
+    }
+  }
+  return result;
+}
+
+GpuTelemetry::GpuTelemetry(const std::string &renderer, double period)
+{
+#ifdef __linux__
+  if (auto nvml = std::make_unique<NvmlBackend>(renderer);
+      nvml->isAvailable()) {
+    m_sourceName = "NVML";
+    m_deviceName = nvml->deviceName();
+    m_backend = std::move(nvml);
+  } else if (auto amdgpu = std::make_unique<AmdgpuBackend>();
+             amdgpu->isAvailable()) {
+    m_sourceName = "amdgpu";
+    m_deviceName = amdgpu->deviceName();
+    m_backend = std::move(amdgpu);
+  }
+#else
+  (void)renderer;
+#endif
+  if (m_backend) {
+    m_thread = std::thread([this, period]() { run(period); });
+  }
+}
+
+GpuTelemetry::~GpuTelemetry()
+{
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_isStopping = true;
+  }
+  m_stopCondition.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+void GpuTelemetry::run(double period)
+{
+  const auto interval = std::chrono::duration<double>(period);
+  auto nextTime = std::chrono::steady_clock::now();
+  for (;;) {
+    GpuTelemetrySample sample;
+    m_backend->sample(sample);
+    addSample(sample);
+
+    nextTime += std::chrono::duration_cast<std::chrono::nanoseconds>(interval);
+    std::unique_lock<std::mutex> lock{m_mutex};
+    if (m_stopCondition.wait_until(
+            lock, nextTime, [&]() { return m_isStopping; })) {
+      return;
+    }
+  }
+}
+
+void GpuTelemetry::addSample(const GpuTelemetrySample &sample)
+{
+  std::lock_guard<std::mutex> lock{m_mutex};
+  m_lastSample = sample;
+  m_hasSample = true;
+  if (m_isSummarizing) {
+    m_statsSamples.push_back(sample);
+  }
+  const std::pair<History *, float> values[] = {
+      {&m_clockHistory, sample.graphicsClock},
+      {&m_temperatureHistory, sample.temperature},
+      {&m_powerHistory, sample.power},
+      {&m_utilizationHistory, sample.utilization}};
+  for (const auto &[history, value] : values) {
+    history->values[history->offset] = std::max(value, 0.f);
+    history->offset = (history->offset + 1) % HISTORY_SIZE;
+  }
+}
+
+GpuTelemetrySample GpuTelemetry::lastSample() const
+{
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return m_lastSample;
+}
+
+void GpuTelemetry::beginStats()
+{
+  std::lock_guard<std::mutex> lock{m_mutex};
+  m_isSummarizing = true;
+  m_statsSamples.clear();
+}
+
+GpuTelemetryStats GpuTelemetry::stats() const
+{
+  std::lock_guard<std::mutex> lock{m_mutex};
+  GpuTelemetryStats stats;
+  if (!m_hasSample) {
+    return stats;
+  }
+  const auto &samples = m_statsSamples.empty()
+                            ? std::vector<GpuTelemetrySample>{m_lastSample}
+                            : m_statsSamples;
+  Summary clock, temperature, power, utilization;
+  for (const auto &sample : samples) {
+    clock.add(sample.graphicsClock);
+    temperature.add(sample.temperature);
+    power.add(sample.power);
+    utilization.add(sample.utilization);
+    stats.maxMemoryUsedBytes =
+        std::max(stats.maxMemoryUsedBytes, sample.memoryUsedBytes);
+    stats.throttleReasons |= sample.throttleReasons;
+  }
+  stats.sampleCount = samples.size();
+  stats.meanGraphicsClock = clock.mean();
+  stats.minGraphicsClock = clock.min;
+  stats.meanTemperature = temperature.mean();
+  stats.maxTemperature = temperature.max;
+  stats.meanPower = power.mean();
+  stats.maxPower = power.max;
+  stats.meanUtilization = utilization.mean();
+  return stats;
+}
+
+void GpuTelemetry::drawGUI() const
+{
+  if (!m_backend) {
+    ImGui::Text("GPU telemetry: no NVML nor amdgpu device");
+    return;
+  }
+  std::lock_guard<std::mutex> lock{m_mutex};
+  const auto &sample = m_lastSample;
+  ImGui::Text("%s (%s)", m_deviceName.c_str(), m_sourceName.c_str());
+  ImGui::Text("%.0f MHz, memory %.0f MHz, %.0f C, %.1f W, %.0f%% busy",
+      sample.graphicsClock, sample.memoryClock, sample.temperature,
+      sample.power, sample.utilization);
+  if (sample.memoryUsedBytes >= 0) {
+    ImGui::Text("Video memory: %lld / %lld MB",
+        (long long)(sample.memoryUsedBytes >> 20),
+        (long long)(sample.memoryTotalBytes >> 20));
+  }
+  const auto reasons = getThrottleReasonNames(sample.throttleReasons);
+  if (!reasons.empty()) {
+    ImGui::Text("Throttled: %s", reasons.c_str());
+  }
+  const std::pair<const History *, const char *> graphs[] = {
+      {&m_clockHistory, "Clock MHz"},
+      {&m_temperatureHistory, "Temperature C"}, {&m_powerHistory, "Power W"},
+      {&m_utilizationHistory, "Utilization %"}};
+  for (const auto &[history, label] : graphs) {
+    const auto &values = history->values;
+    const auto maxValue = *std::max_element(begin(values), end(values));
+    ImGui::PlotLines(label, values.data(), int(values.size()),
+        int(history->offset), nullptr, 0.f, std::max(maxValue, 1e-3f),
+        ImVec2(0, 40));
+  }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Hardware state of the GPU when it was sampled. Values the driver does not
+// report are negative.
+struct GpuTelemetrySample
+{
+  float graphicsClock = -1.f; // MHz
+  float memoryClock = -1.f; // MHz
+  float temperature = -1.f; // Celsius
+  float power = -1.f; // Watts
+  float utilization = -1.f; // Percent of the time the GPU was busy
+  int64_t memoryUsedBytes = -1;
+  int64_t memoryTotalBytes = -1;
+  // Reasons of the clocks being below their maximum, as NVML
+  // nvmlClocksThrottleReasons bits, 0 if none or unknown
+  uint64_t throttleReasons = 0;
+};
+
+// Summary of the samples taken over a range of frames, the means and
+// extrema of values that were never reported are negative
+struct GpuTelemetryStats
+{
+  size_t sampleCount = 0;
+  float meanGraphicsClock = -1.f;
+  float minGraphicsClock = -1.f;
+  float meanTemperature = -1.f;
+  float maxTemperature = -1.f;
+  float meanPower = -1.f;
+  float maxPower = -1.f;
+  float meanUtilization = -1.f;
+  int64_t maxMemoryUsedBytes = -1;
+  uint64_t throttleReasons = 0; // Of any sample
+};
+
+// Names of the throttle reasons of a sample ("power cap", "thermal"...),
+// separated by commas, empty if none
+std::string getThrottleReasonNames(uint64_t throttleReasons);
+
+// Telemetry of the GPU the viewer renders with, to correlate frame times with
+// the state of the hardware (clocks dropping as it heats up...). A
+// background thread samples it every period seconds, so that slow driver
+// queries never delay a frame.
+//
+// NVML is loaded at runtime from the NVIDIA driver, its device is the one
+// whose name is in the GL_RENDERER string, the first one otherwise. Without
+// NVML, the first AMD GPU is read from the sysfs files of amdgpu, as AMD SMI
+// does (no throttle reasons). Neither needs a build dependency, and both
+// are only available on Linux.
+class GpuTelemetry
+{
+public:
+  // Number of samples in the graphs, as Profiler::HISTORY_SIZE
+  static const size_t HISTORY_SIZE = 120;
+
+  // renderer is the GL_RENDERER string of the context
+  GpuTelemetry(const std::string &renderer, double period = 0.1);
+
+  // Stop the sampling thread
+  ~GpuTelemetry();
+
+  GpuTelemetry(const GpuTelemetry &) = delete;
+  GpuTelemetry &operator=(const GpuTelemetry &) = delete;
+
+  // False if no telemetry source was found, nothing is sampled then
+  bool isAvailable() const { return m_backend != nullptr; }
+
+  // "NVML" or "amdgpu", empty if unavailable
+  const std::string &sourceName() const { return m_sourceName; }
+
+  // Name of the sampled device
+  const std::string &deviceName() const { return m_deviceName; }
+
+  GpuTelemetrySample lastSample() const;
+
+  // Summarize the samples taken from now on
+  void beginStats();
+
+  // Of the samples since beginStats(), the last sample alone if none was
+  // taken since
+  GpuTelemetryStats stats() const;
+
+  // Draw the last sample and the graphs of the history in the current ImGui
+  // window
+  void drawGUI() const;
+
+  class Backend;
+
+private:
+  struct History
+  {
+    std::array<float, HISTORY_SIZE> values = {};
+    size_t offset = 0; // Index of the oldest value
+  };
+
+  void run(double period);
+
+  void addSample(const GpuTelemetrySample &sample);
+
+  std::unique_ptr<Backend> m_backend;
+  std::string m_sourceName;
+  std::string m_deviceName;
+
+  mutable std::mutex m_mutex;
+  // Guarded by m_mutex:
+  bool m_isStopping = false;
+  bool m_hasSample = false;
+  GpuTelemetrySample m_lastSample;
+  bool m_isSummarizing = false; // Once beginStats() is called
+  std::vector<GpuTelemetrySample> m_statsSamples;
+  History m_clockHistory;
+  History m_temperatureHistory;
+  History m_powerHistory;
+  History m_utilizationHistory;
+
+  std::condition_variable m_stopCondition;
+  std::thread m_thread;
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a hash of size bytes. Pass a previous result as hash to combine
+// several ranges.
+inline uint64_t fnv1a64(
+    const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+  const auto *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
@@ -0,0 +1,326 @@
+#include "headless_context.hpp"
+#include "gl_debug_output.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<EGL/egl.h>)
+#define GLMLV_HAS_EGL 1
+#endif
+
+#ifdef GLMLV_HAS_EGL
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <dlfcn.h>
+
+// EGL_KHR_create_context_no_error, missing from older headers
+#ifndef EGL_CONTEXT_OPENGL_NO_ERROR_KHR
+#define EGL_CONTEXT_OPENGL_NO_ERROR_KHR 0x31B3
+#endif
+
+namespace
+{
+
+// EGL entry points, resolved from libEGL at runtime
+struct EGLFunctions
+{
+  decltype(&eglGetProcAddress) getProcAddress = nullptr;
+  decltype(&eglGetError) getError = nullptr;
+  decltype(&eglGetDisplay) getDisplay = nullptr;
+  decltype(&eglInitialize) initialize = nullptr;
+  decltype(&eglTerminate) terminate = nullptr;
+  decltype(&eglQueryString) queryString = nullptr;
+  decltype(&eglBindAPI) bindAPI = nullptr;
+  decltype(&eglChooseConfig) chooseConfig = nullptr;
+  decltype(&eglCreateContext) createContext = nullptr;
+  decltype(&eglDestroyContext) destroyContext = nullptr;
+  decltype(&eglMakeCurrent) makeCurrent = nullptr;
+  PFNEGLQUERYDEVICESEXTPROC queryDevicesEXT = nullptr;
+  PFNEGLQUERYDEVICESTRINGEXTPROC queryDeviceStringEXT = nullptr;
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplayEXT = nullptr;
+
+  bool loaded = false;
+
+  EGLFunctions()
+  {
+    // Never closed: the library must outlive every context
+    auto library = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!library) {
+      return;
+    }
+    const auto load = [&](auto &function, const char *name) {
+      function = reinterpret_cast<std::decay_t<decltype(function)>>(
+          dlsym(library, name));
+      return function != nullptr;
+    };
+    loaded = load(getProcAddress, "eglGetProcAddress") &&
+             load(getError, "eglGetError") &&
+             load(getDisplay, "eglGetDisplay") &&
+             load(initialize, "eglInitialize") &&
+             load(terminate, "eglTerminate") &&
+             load(queryString, "eglQueryString") &&
+             load(bindAPI, "eglBindAPI") &&
+             load(chooseConfig, "eglChooseConfig") &&
+             load(createContext, "eglCreateContext") &&
+             load(destroyContext, "eglDestroyContext") &&
+             load(makeCurrent, "eglMakeCurrent");
+    if (!loaded) {
+      return;
+    }
+    // Extension functions, may be null
+    queryDevicesEXT = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(
+        getProcAddress("eglQueryDevicesEXT"));
+    queryDeviceStringEXT = reinterpret_cast<PFNEGLQUERYDEVICESTRINGEXTPROC>(
+        getProcAddress("eglQueryDeviceStringEXT"));
+    getPlatformDisplayEXT = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+        getProcAddress("eglGetPlatformDisplayEXT"));
+  }
+
+  bool hasExtension(EGLDisplay display, const char *name) const
+  {
+    const auto extensions = queryString(display, EGL_EXTENSIONS);
+    if (!extensions) {
+      return false;
+    }
+    const std::string list = std::string(" ") + extensions + " ";
+    return list.find(std::string(" ") + name + " ") != std::string::npos;
+  }
+};
+
+const EGLFunctions &getEGL()
+{
+  static const EGLFunctions egl;
+  return egl;
+}
+
+// Devices of EGL_EXT_device_enumeration, in its order, GPU devices only if
+// gpuOnly is set
+std::vector<EGLDeviceEXT> getDevices(const EGLFunctions &egl, bool gpuOnly)
+{
+  std::vector<EGLDeviceEXT> devices;
+  EGLint deviceCount = 0;
+  if (!egl.queryDevicesEXT ||
+      !egl.queryDevicesEXT(0, nullptr, &deviceCount) || deviceCount <= 0) {
+    return devices;
+  }
+  devices.resize(deviceCount);
+  egl.queryDevicesEXT(deviceCount, devices.data(), &deviceCount);
+  devices.resize(deviceCount);
+  if (!gpuOnly || !egl.queryDeviceStringEXT) {
+    return devices;
+  }
+  const auto isSoftware = [&](EGLDeviceEXT device) {
+    const auto extensions = egl.queryDeviceStringEXT(device, EGL_EXTENSIONS);
+    if (!extensions) {
+      return false;
+    }
+    const std::string list = std::string(" ") + extensions + " ";
+    return list.find(" EGL_MESA_device_software ") != std::string::npos;
+  };
+  devices.erase(
+      std::remove_if(begin(devices), end(devices), isSoftware), end(devices));
+  return devices;
+}
+
+// Candidate displays, by order of preference: GPU devices, then Mesa
+// surfaceless platform, then the default display (which may need X11). Only
+// the display of GPU device if it is not negative.
+std::vector<EGLDisplay> getCandidateDisplays(
+    const EGLFunctions &egl, int device)
+{
+  std::vector<EGLDisplay> displays;
+  if (device >= 0) {
+    const auto devices = getDevices(egl, true);
+    if (egl.getPlatformDisplayEXT && size_t(device) < devices.size()) {
+      displays.emplace_back(egl.getPlatformDisplayEXT(
+          EGL_PLATFORM_DEVICE_EXT, devices[device], nullptr));
+    }
+    return displays;
+  }
+  if (egl.getPlatformDisplayEXT) {
+    for (const auto device : getDevices(egl, false)) {
+      displays.emplace_back(egl.getPlatformDisplayEXT(
+          EGL_PLATFORM_DEVICE_EXT, device, nullptr));
+    }
+    if (egl.hasExtension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")) {
+      displays.emplace_back(egl.getPlatformDisplayEXT(
+          EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr));
+    }
+  }
+  displays.emplace_back(egl.getDisplay(EGL_DEFAULT_DISPLAY));
+  return displays;
+}
+
+// Create a context on display sharing the objects of shareContext, return
+// EGL_NO_CONTEXT on failure
+EGLContext createContext(const EGLFunctions &egl, EGLDisplay display,
+    EGLContext shareContext = EGL_NO_CONTEXT)
+{
+  if (!egl.hasExtension(display, "EGL_KHR_surfaceless_context") ||
+      !egl.bindAPI(EGL_OPENGL_API)) {
+    return EGL_NO_CONTEXT;
+  }
+
+  // No surface is ever created, so any surface type is fine
+  const EGLint configAttribs[] = {EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE,
+      EGL_OPENGL_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+      EGL_NONE};
+  EGLConfig config;
+  EGLint configCount = 0;
+  if (!egl.chooseConfig(display, configAttribs, &config, 1, &configCount) ||
+      configCount == 0) {
+    return EGL_NO_CONTEXT;
+  }
+
+  // Same version, profile, debug and no error flags than GLFWHandle (see
+  // setGLDebugOutputMode()). Like GLFW, the no error flag is only given if
+  // the display supports it.
+  const auto isNoError =
+      getGLDebugOutputMode() == GLDebugOutputMode::NoError &&
+      egl.hasExtension(display, "EGL_KHR_create_context_no_error");
+  std::vector<EGLint> contextAttribs = {EGL_CONTEXT_MAJOR_VERSION, 4,
+      EGL_CONTEXT_MINOR_VERSION, 4, EGL_CONTEXT_OPENGL_PROFILE_MASK,
+      EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_CONTEXT_OPENGL_DEBUG,
+      getGLDebugOutputMode() == GLDebugOutputMode::Full ? EGL_TRUE : EGL_FALSE};
+  if (isNoError) {
+    contextAttribs.insert(
+        end(contextAttribs), {EGL_CONTEXT_OPENGL_NO_ERROR_KHR, EGL_TRUE});
+  }
+  contextAttribs.push_back(EGL_NONE);
+  return egl.createContext(
+      display, config, shareContext, contextAttribs.data());
+}
+
+} // namespace
+
+bool HeadlessGLContext::isAvailable() { return getEGL().loaded; }
+
+size_t HeadlessGLContext::getDeviceCount()
+{
+  const auto &egl = getEGL();
+  return egl.loaded ? getDevices(egl, true).size() : 0;
+}
+
+HeadlessGLContext::HeadlessGLContext(int device)
+{
+  const auto &egl = getEGL();
+  if (!egl.loaded) {
+    throw std::runtime_error("Unable to load libEGL.");
+  }
+
+  for (const auto display : getCandidateDisplays(egl, device)) {
+    EGLint major = 0, minor = 0;
+    if (display == EGL_NO_DISPLAY ||
+        !egl.initialize(display, &major, &minor)) {
+      continue;
+    }
+    const auto context = createContext(egl, display);
+    if (context != EGL_NO_CONTEXT &&
+        egl.makeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+      m_pDisplay = display;
+      m_pContext = context;
+      return;
+    }
+    if (context != EGL_NO_CONTEXT) {
+      egl.destroyContext(display, context);
+    }
+    egl.terminate(display);
+  }
+
+  if (device >= 0) {
+    throw std::runtime_error("Unable to create an EGL context on GPU " +
+                             std::to_string(device) + " (error " +
+                             std::to_string(egl.getError()) + ").");
+  }
+  throw std::runtime_error("Unable to create an EGL context (error " +
+                           std::to_string(egl.getError()) + ").");
+}
+
+HeadlessGLContext::HeadlessGLContext(void *display, void *context) :
+    m_pDisplay(display), m_pContext(context), m_ownsDisplay(false)
+{
+}
+
+HeadlessGLContext::~HeadlessGLContext()
+{
+  const auto &egl = getEGL();
+  if (m_ownsDisplay) {
+    egl.makeCurrent(
+        m_pDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+  egl.destroyContext(m_pDisplay, m_pContext);
+  if (m_ownsDisplay) {
+    egl.terminate(m_pDisplay);
+  }
+}
+
+std::unique_ptr<HeadlessGLContext> HeadlessGLContext::createShared(
+    const HeadlessGLContext &shareContext)
+{
+  const auto &egl = getEGL();
+  const auto context =
+      createContext(egl, shareContext.m_pDisplay, shareContext.m_pContext);
+  if (context == EGL_NO_CONTEXT) {
+    throw std::runtime_error("Unable to create a shared EGL context (error " +
+                             std::to_string(egl.getError()) + ").");
+  }
+  return std::unique_ptr<HeadlessGLContext>(
+      new HeadlessGLContext(shareContext.m_pDisplay, context));
+}
+
+void HeadlessGLContext::makeCurrent() const
+{
+  const auto &egl = getEGL();
+  if (!egl.makeCurrent(
+          m_pDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, m_pContext)) {
+    throw std::runtime_error("Unable to make the EGL context current (error " +
+                             std::to_string(egl.getError()) + ").");
+  }
+}
+
+void HeadlessGLContext::doneCurrent() const
+{
+  getEGL().makeCurrent(
+      m_pDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void *HeadlessGLContext::getProcAddress(const char *name)
+{
+  return reinterpret_cast<void *>(getEGL().getProcAddress(name));
+}
+
+#else
+
+bool HeadlessGLContext::isAvailable() { return false; }
+
+size_t HeadlessGLContext::getDeviceCount() { return 0; }
+
+HeadlessGLContext::HeadlessGLContext(int)
+{
+  throw std::runtime_error("EGL is not supported on this platform.");
+}
+
+HeadlessGLContext::HeadlessGLContext(void *display, void *context) :
+    m_pDisplay(display), m_pContext(context), m_ownsDisplay(false)
+{
+}
+
+HeadlessGLContext::~HeadlessGLContext() = default;
+
+std::unique_ptr<HeadlessGLContext> HeadlessGLContext::createShared(
+    const HeadlessGLContext &)
+{
+  throw std::runtime_error("EGL is not supported on this platform.");
+}
+
+void HeadlessGLContext::makeCurrent() const {}
+
+void HeadlessGLContext::doneCurrent() const {}
+
+void *HeadlessGLContext::getProcAddress(const char *) { return nullptr; }
+
+#endif
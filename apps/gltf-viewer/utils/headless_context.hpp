@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+// OpenGL context without window nor display server, created with EGL on a
+// GPU device (EGL_EXT_platform_device) or on Mesa's surfaceless platform. The
+// context has no default framebuffer: everything must be rendered in
+// framebuffer objects (see ImageRenderer).
+//
+// libEGL is loaded at runtime so the viewer does not depend on it: on systems
+// without EGL isAvailable() is false and GLFWHandle falls back to an
+// invisible GLFW window.
+class HeadlessGLContext
+{
+public:
+  // Return true if libEGL has been found on this system
+  static bool isAvailable();
+
+  // Number of GPU devices of EGL_EXT_device_enumeration, software devices
+  // (EGL_MESA_device_software) excluded, 0 without EGL
+  static size_t getDeviceCount();
+
+  // Create an OpenGL 4.4 core profile context and make it current on the
+  // calling thread, on GPU device if it is not negative (less than
+  // getDeviceCount()), else on the first display that works. Throw
+  // std::runtime_error on failure.
+  explicit HeadlessGLContext(int device = -1);
+
+  ~HeadlessGLContext();
+
+  // Non-copyable class:
+  HeadlessGLContext(const HeadlessGLContext &) = delete;
+  HeadlessGLContext &operator=(const HeadlessGLContext &) = delete;
+
+  // Create a context on the display of shareContext, sharing its objects
+  // and current on no thread. Throw std::runtime_error on failure.
+  static std::unique_ptr<HeadlessGLContext> createShared(
+      const HeadlessGLContext &shareContext);
+
+  // Make the context current on the calling thread, or release it. Throw
+  // std::runtime_error on failure.
+  void makeCurrent() const;
+  void doneCurrent() const;
+
+  // Address of an OpenGL function, to be given to gladLoadGLLoader
+  static void *getProcAddress(const char *name);
+
+private:
+  HeadlessGLContext(void *display, void *context);
+
+  void *m_pDisplay = nullptr; // EGLDisplay
+  void *m_pContext = nullptr; // EGLContext
+  // Shared contexts leave the display to the context they share with
+  bool m_ownsDisplay = true;
+};
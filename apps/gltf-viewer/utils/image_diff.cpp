@@ -0,0 +1,277 @@
+#include "image_diff.hpp"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GLTF_VIEWER_IMAGE_DIFF_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GLTF_VIEWER_IMAGE_DIFF_NEON
+#endif
+
+namespace
+{
+
+// Minimal 16 wide unsigned byte vector and sums of its bytes, one
+// implementation per instruction set
+#if defined(GLTF_VIEWER_IMAGE_DIFF_SSE2)
+
+struct Bytes16
+{
+  __m128i v;
+};
+
+struct Sums
+{
+  __m128i v;
+};
+
+Bytes16 load(const unsigned char *ptr)
+{
+  return {_mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr))};
+}
+Bytes16 set1(unsigned char x) { return {_mm_set1_epi8(char(x))}; }
+Bytes16 absDiff(Bytes16 a, Bytes16 b)
+{
+  return {_mm_or_si128(_mm_subs_epu8(a.v, b.v), _mm_subs_epu8(b.v, a.v))};
+}
+Bytes16 subSat(Bytes16 a, Bytes16 b) { return {_mm_subs_epu8(a.v, b.v)}; }
+Bytes16 max(Bytes16 a, Bytes16 b) { return {_mm_max_epu8(a.v, b.v)}; }
+bool isZero(Bytes16 a)
+{
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(a.v, _mm_setzero_si128())) ==
+         0xFFFF;
+}
+void store(unsigned char *out, Bytes16 a)
+{
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), a.v);
+}
+Sums zeroSums() { return {_mm_setzero_si128()}; }
+Sums add(Sums sums, Bytes16 a)
+{
+  return {_mm_add_epi64(sums.v, _mm_sad_epu8(a.v, _mm_setzero_si128()))};
+}
+uint64_t total(Sums sums)
+{
+  uint64_t values[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(values), sums.v);
+  return values[0] + values[1];
+}
+
+#elif defined(GLTF_VIEWER_IMAGE_DIFF_NEON)
+
+struct Bytes16
+{
+  uint8x16_t v;
+};
+
+struct Sums
+{
+  uint64x2_t v;
+};
+
+Bytes16 load(const unsigned char *ptr) { return {vld1q_u8(ptr)}; }
+Bytes16 set1(unsigned char x) { return {vdupq_n_u8(x)}; }
+Bytes16 absDiff(Bytes16 a, Bytes16 b) { return {vabdq_u8(a.v, b.v)}; }
+Bytes16 subSat(Bytes16 a, Bytes16 b) { return {vqsubq_u8(a.v, b.v)}; }
+Bytes16 max(Bytes16 a, Bytes16 b) { return {vmaxq_u8(a.v, b.v)}; }
+bool isZero(Bytes16 a)
+{
+  const auto halves = vorr_u8(vget_low_u8(a.v), vget_high_u8(a.v));
+  return vget_lane_u64(vreinterpret_u64_u8(halves), 0) == 0;
+}
+void store(unsigned char *out, Bytes16 a) { vst1q_u8(out, a.v); }
+Sums zeroSums() { return {vdupq_n_u64(0)}; }
+Sums add(Sums sums, Bytes16 a)
+{
+  return {vpadalq_u32(sums.v, vpaddlq_u16(vpaddlq_u8(a.v)))};
+}
+uint64_t total(Sums sums)
+{
+  return vgetq_lane_u64(sums.v, 0) + vgetq_lane_u64(sums.v, 1);
+}
+
+#else
+
+struct Bytes16
+{
+  unsigned char v[16];
+};
+
+struct Sums
+{
+  uint64_t v;
+};
+
+template <typename F> Bytes16 apply(Bytes16 a, Bytes16 b, F f)
+{
+  Bytes16 result;
+  for (size_t i = 0; i < 16; ++i) {
+    result.v[i] = f(a.v[i], b.v[i]);
+  }
+  return result;
+}
+Bytes16 load(const unsigned char *ptr)
+{
+  Bytes16 result;
+  std::memcpy(result.v, ptr, sizeof(result.v));
+  return result;
+}
+Bytes16 set1(unsigned char x)
+{
+  Bytes16 result;
+  std::memset(result.v, x, sizeof(result.v));
+  return result;
+}
+Bytes16 absDiff(Bytes16 a, Bytes16 b)
+{
+  return apply(a, b, [](unsigned char x, unsigned char y) {
+    return (unsigned char)(x < y ? y - x : x - y);
+  });
+}
+Bytes16 subSat(Bytes16 a, Bytes16 b)
+{
+  return apply(a, b, [](unsigned char x, unsigned char y) {
+    return (unsigned char)(x < y ? 0 : x - y);
+  });
+}
+Bytes16 max(Bytes16 a, Bytes16 b)
+{
+  return apply(a, b,
+      [](unsigned char x, unsigned char y) { return x < y ? y : x; });
+}
+bool isZero(Bytes16 a)
+{
+  return std::all_of(
+      std::begin(a.v), std::end(a.v), [](unsigned char x) { return !x; });
+}
+void store(unsigned char *out, Bytes16 a)
+{
+  std::memcpy(out, a.v, sizeof(a.v));
+}
+Sums zeroSums() { return {0}; }
+Sums add(Sums sums, Bytes16 a)
+{
+  for (const auto x : a.v) {
+    sums.v += x;
+  }
+  return sums;
+}
+uint64_t total(Sums sums) { return sums.v; }
+
+#endif
+
+size_t horizontalMax(Bytes16 a)
+{
+  unsigned char values[16];
+  store(values, a);
+  return *std::max_element(std::begin(values), std::end(values));
+}
+
+// True if a component of pixel differs from reference by more than
+// tolerance
+bool isPixelDifferent(const unsigned char *pixel,
+    const unsigned char *reference, size_t numComponents, size_t tolerance)
+{
+  for (size_t c = 0; c < numComponents; ++c) {
+    const auto difference = pixel[c] < reference[c]
+                                ? size_t(reference[c] - pixel[c])
+                                : size_t(pixel[c] - reference[c]);
+    if (difference > tolerance) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+ImageDiff compareImages(size_t width, size_t height, size_t numComponents,
+    const unsigned char *pixels, const unsigned char *reference, bool flipY,
+    size_t tolerance)
+{
+  ImageDiff diff;
+  const auto rowSize = width * numComponents;
+  const auto tolerances =
+      set1((unsigned char)std::min(tolerance, size_t(255)));
+  auto maxDifferences = set1(0);
+  auto sums = zeroSums();
+  uint64_t tailSum = 0;
+  for (size_t y = 0; y < height; ++y) {
+    const auto *row = pixels + (flipY ? height - 1 - y : y) * rowSize;
+    const auto *referenceRow = reference + y * rowSize;
+
+    // 16 pixels are numComponents vectors
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+      const auto *block = row + x * numComponents;
+      const auto *referenceBlock = referenceRow + x * numComponents;
+      auto isBlockDifferent = false;
+      for (size_t i = 0; i < numComponents; ++i) {
+        const auto differences =
+            absDiff(load(block + 16 * i), load(referenceBlock + 16 * i));
+        maxDifferences = max(maxDifferences, differences);
+        sums = add(sums, differences);
+        isBlockDifferent =
+            isBlockDifferent || !isZero(subSat(differences, tolerances));
+      }
+      if (!isBlockDifferent) {
+        continue;
+      }
+      for (size_t i = 0; i < 16; ++i) {
+        if (isPixelDifferent(block + i * numComponents,
+                referenceBlock + i * numComponents, numComponents,
+                tolerance)) {
+          ++diff.differingPixels;
+        }
+      }
+    }
+    for (; x < width; ++x) {
+      const auto *pixel = row + x * numComponents;
+      const auto *referencePixel = referenceRow + x * numComponents;
+      for (size_t c = 0; c < numComponents; ++c) {
+        const auto difference = pixel[c] < referencePixel[c]
+                                    ? size_t(referencePixel[c] - pixel[c])
+                                    : size_t(pixel[c] - referencePixel[c]);
+        diff.maxDifference = std::max(diff.maxDifference, difference);
+        tailSum += difference;
+      }
+      if (isPixelDifferent(
+              pixel, referencePixel, numComponents, tolerance)) {
+        ++diff.differingPixels;
+      }
+    }
+  }
+  diff.maxDifference =
+      std::max(diff.maxDifference, horizontalMax(maxDifferences));
+  const auto componentCount = height * rowSize;
+  if (componentCount) {
+    diff.meanDifference =
+        double(total(sums) + tailSum) / double(componentCount);
+  }
+  return diff;
+}
+
+bool readPng(const fs::path &path, size_t numComponents, size_t &width,
+    size_t &height, std::vector<unsigned char> &pixels, std::string &err)
+{
+  int imageWidth = 0, imageHeight = 0, channels = 0;
+  auto *data = stbi_load(path.string().c_str(), &imageWidth, &imageHeight,
+      &channels, int(numComponents));
+  if (!data) {
+    err = "Cannot read " + path.string() + ": " + stbi_failure_reason();
+    return false;
+  }
+  width = size_t(imageWidth);
+  height = size_t(imageHeight);
+  pixels.assign(data, data + width * height * numComponents);
+  stbi_image_free(data);
+  return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Comparison of an 8-bit image with a reference, for golden image checks.
+// Components differing by at most tolerance are equal: rasterization and
+// filtering vary slightly between drivers, and differences of a few levels
+// are not visible. A pixel differs if any of its components does.
+struct ImageDiff
+{
+  size_t differingPixels = 0;
+  size_t maxDifference = 0; // Of a component, in levels
+  double meanDifference = 0.; // Of all components, in levels
+};
+
+// Compare pixels[0 : width * height * numComponents] with reference, of the
+// same layout but top row first. If flipY is true, pixels are bottom row
+// first (images read with glReadPixels). The kernel is vectorized with
+// SSE2 or NEON when available, 16 pixels at a time: blocks whose
+// components are all within tolerance, most of them when images match, are
+// only summed.
+ImageDiff compareImages(size_t width, size_t height, size_t numComponents,
+    const unsigned char *pixels, const unsigned char *reference, bool flipY,
+    size_t tolerance);
+
+// Read the PNG file path as an 8-bit image of numComponents components, top
+// row first. Return false and fill err on failure.
+bool readPng(const fs::path &path, size_t numComponents, size_t &width,
+    size_t &height, std::vector<unsigned char> &pixels, std::string &err);
@@ -1,78 +1,382 @@
 #include "images.hpp"
+#include "log.hpp"
+#include "sync_watchdog.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <glad/glad.h>
-#include <iostream>
 
 void renderToImage(size_t width, size_t height, size_t numComponents,
-    unsigned char *outPixels, std::function<void()> drawScene)
+    void *outPixels, std::function<void()> drawScene, size_t samples,
+    const GLProgram *fxaaProgram, GLenum pixelType)
 {
-  GLint previousTextureObject = 0;
-  GLint previousFramebufferObject = 0;
+  ImageRenderer renderer{
+      width, height, numComponents, 1, samples, fxaaProgram, pixelType};
+  renderer.render(drawScene);
+  renderer.readPixels(outPixels);
+}
 
-  // Save previous GL state that we will change in order to put it back after
-  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTextureObject);
-  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebufferObject);
-
-  GLuint textureObject = 0;
-
-  glGenTextures(1, &textureObject);
+ImageRenderer::ImageRenderer(size_t width, size_t height,
+    size_t numComponents, size_t maxPendingImages, size_t samples,
+    const GLProgram *fxaaProgram, GLenum pixelType,
+    const GLProgram *yuvProgram) :
+    m_nWidth(width),
+    m_nHeight(height),
+    m_nComponents(numComponents),
+    m_fxaaProgram(fxaaProgram),
+    m_pixelType(yuvProgram ? GL_UNSIGNED_BYTE : pixelType),
+    m_yuvProgram(yuvProgram)
+{
+  GLint maxSamples = 0;
+  glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+  if (samples > 1 && maxSamples > 1) {
+    m_nSamples = std::min(samples, size_t(maxSamples));
+  }
+  if (m_fxaaProgram) {
+    m_emptyVertexArray = GLVertexArray::create();
+  }
+  allocate(width, height);
 
-  glBindTexture(GL_TEXTURE_2D, textureObject);
+  // I420 frames are written by words of 4 bytes
+  const auto pixelBufferSize =
+      m_yuvProgram ? (imageSize() + 3) / 4 * 4 : imageSize();
+  for (size_t i = 0; i < std::max(maxPendingImages, size_t(1)); ++i) {
+    m_pixelBuffers.emplace_back(pixelBufferSize, nullptr, GL_MAP_READ_BIT);
+    m_pixelBufferSizes.push_back(pixelBufferSize);
+  }
+}
 
-  // Lets avoid warnings
+void ImageRenderer::allocate(size_t width, size_t height)
+{
+  assert(!m_yuvProgram || (width % 2 == 0 && height % 2 == 0));
+  m_nWidth = width;
+  m_nHeight = height;
   const auto w = GLsizei(width);
   const auto h = GLsizei(height);
+  // Color of the size of the components so that the readback is a plain
+  // copy, without conversion
+  const auto colorFormat =
+      m_pixelType == GL_HALF_FLOAT ? GL_RGBA16F : GL_RGBA8;
+  m_colorTexture = GLTexture(1, colorFormat, w, h);
+  m_framebuffer = GLFramebuffer::create();
+  m_framebuffer.attachTexture(GL_COLOR_ATTACHMENT0, m_colorTexture.glId());
+  m_framebuffer.setDrawBuffer(GL_COLOR_ATTACHMENT0);
+  m_framebuffer.setReadBuffer(GL_COLOR_ATTACHMENT0);
 
-  // if we want better quality, we can use multisampling, but for testing
-  // purpose it is useless todo replace with glTexStorage2DMultisample (in that
-  // case need to todo glBlitFramebuffer in another one in order to be able to
-  // glGetTexImage)
-  // https://stackoverflow.com/questions/14019910/how-does-glteximage2dmultisample-work
-  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, w, h);
-
-  GLuint depthTexture;
-  glGenTextures(1, &depthTexture);
+  if (m_nSamples) {
+    // Renderbuffers since they are only resolved, m_framebuffer needs no
+    // depth
+    const auto sampleCount = GLsizei(m_nSamples);
+    m_multisampleColorBuffer =
+        GLRenderbuffer(colorFormat, w, h, sampleCount);
+    m_multisampleDepthBuffer =
+        GLRenderbuffer(GL_DEPTH_COMPONENT32F, w, h, sampleCount);
+    m_multisampleFramebuffer = GLFramebuffer::create();
+    m_multisampleFramebuffer.attachRenderbuffer(
+        GL_COLOR_ATTACHMENT0, m_multisampleColorBuffer.glId());
+    m_multisampleFramebuffer.attachRenderbuffer(
+        GL_DEPTH_ATTACHMENT, m_multisampleDepthBuffer.glId());
+    m_multisampleFramebuffer.setDrawBuffer(GL_COLOR_ATTACHMENT0);
+    m_multisampleFramebuffer.setReadBuffer(GL_COLOR_ATTACHMENT0);
+    assert(m_multisampleFramebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+  } else {
+    m_depthTexture = GLTexture(1, GL_DEPTH_COMPONENT32F, w, h);
+    m_framebuffer.attachTexture(GL_DEPTH_ATTACHMENT, m_depthTexture.glId());
+  }
 
-  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  const auto framebufferStatus = m_framebuffer.status();
+  assert(framebufferStatus == GL_FRAMEBUFFER_COMPLETE);
+  (void)framebufferStatus;
 
-  glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, w, h);
+  if (m_fxaaProgram) {
+    // FXAA samples the resolved image between texels
+    m_colorTexture.setParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    m_colorTexture.setParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    m_colorTexture.setParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    m_colorTexture.setParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    m_filteredTexture = GLTexture(1, colorFormat, w, h);
+    m_filteredFramebuffer = GLFramebuffer::create();
+    m_filteredFramebuffer.attachTexture(
+        GL_COLOR_ATTACHMENT0, m_filteredTexture.glId());
+    m_filteredFramebuffer.setDrawBuffer(GL_COLOR_ATTACHMENT0);
+    m_filteredFramebuffer.setReadBuffer(GL_COLOR_ATTACHMENT0);
+    assert(m_filteredFramebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+  }
+}
 
-  glBindTexture(GL_TEXTURE_2D, previousTextureObject);
+void ImageRenderer::resize(size_t width, size_t height)
+{
+  // Pending images are in the pixel buffers, they do not need the targets
+  if (width != m_nWidth || height != m_nHeight) {
+    allocate(width, height);
+  }
+}
 
-  GLuint framebufferObject = 0;
-  glGenFramebuffers(1, &framebufferObject);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebufferObject);
+ImageRenderer::~ImageRenderer()
+{
+  for (const auto &image : m_pendingImages) {
+    glDeleteSync(image.fence);
+  }
+}
 
-  glFramebufferTexture(
-      GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textureObject, 0);
-  glFramebufferTexture(
-      GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+void ImageRenderer::render(const std::function<void()> &drawScene)
+{
+  if (m_pendingImages.size() == m_pixelBuffers.size()) {
+    // All pixel buffers are in use, drop the oldest image
+    std::vector<unsigned char> discarded(pendingImageSize());
+    readPixels(discarded.data());
+  }
 
-  GLenum drawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-  glDrawBuffers(1, drawBuffers);
+  // The next pixel buffer is not pending, it is grown if the images were
+  // resized past it
+  const auto pixelBufferIdx = m_nextPixelBufferIdx;
+  m_nextPixelBufferIdx = (m_nextPixelBufferIdx + 1) % m_pixelBuffers.size();
+  const auto pixelBufferSize =
+      m_yuvProgram ? (imageSize() + 3) / 4 * 4 : imageSize();
+  if (m_pixelBufferSizes[pixelBufferIdx] < pixelBufferSize) {
+    m_pixelBuffers[pixelBufferIdx] =
+        GLBuffer(pixelBufferSize, nullptr, GL_MAP_READ_BIT);
+    m_pixelBufferSizes[pixelBufferIdx] = pixelBufferSize;
+  }
 
-  const auto framebufferStatus = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
-  assert(framebufferStatus == GL_FRAMEBUFFER_COMPLETE);
+  const auto &drawFramebuffer =
+      m_nSamples ? m_multisampleFramebuffer : m_framebuffer;
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer.glId());
 
   drawScene();
 
+#ifndef NDEBUG
   GLint currentlyBoundFBO = 0;
   glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &currentlyBoundFBO);
-  if (currentlyBoundFBO != framebufferObject) {
-    // Display a warning on clog
+  if (GLuint(currentlyBoundFBO) != drawFramebuffer.glId()) {
     // It may not be an error because the drawScene() function might have render
     // to the framebuffer but unbound it after.
-    std::clog
-        << "Warning: renderToImage - GL_DRAW_FRAMEBUFFER_BINDING has "
-           "changed during drawScene. It might lead to unexpected behavior."
-        << std::endl;
+    logMessage(LogLevel::Warning,
+        "Warning: renderToImage - GL_DRAW_FRAMEBUFFER_BINDING has changed "
+        "during drawScene. It might lead to unexpected behavior.");
+  }
+#endif
+
+  if (m_nSamples) {
+    m_multisampleFramebuffer.blit(m_framebuffer.glId(), 0, 0,
+        GLint(m_nWidth), GLint(m_nHeight), GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  }
+  if (m_fxaaProgram) {
+    applyFxaa();
+  }
+
+  // Start the copy in the pixel buffer, the call returns before it is done
+  if (m_yuvProgram) {
+    convertToYuv(m_pixelBuffers[pixelBufferIdx]);
+    m_pendingImages.push_back({pixelBufferIdx,
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), imageSize()});
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return;
+  }
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER,
+      m_fxaaProgram ? m_filteredFramebuffer.glId() : m_framebuffer.glId());
+  glPixelStorei(GL_PACK_ALIGNMENT, 1); // Rows of RGB images are not padded
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[pixelBufferIdx].glId());
+  glReadPixels(0, 0, GLsizei(m_nWidth), GLsizei(m_nHeight),
+      m_nComponents == 3 ? GL_RGB : GL_RGBA, m_pixelType, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_pendingImages.push_back({pixelBufferIdx,
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), imageSize()});
+
+  // Back to the defaults
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool ImageRenderer::readPixels(void *outPixels)
+{
+  if (m_pendingImages.empty()) {
+    return false;
+  }
+  const auto image = m_pendingImages.front();
+  m_pendingImages.pop_front();
+
+  SyncScope sync{"ImageRenderer::readPixels"};
+  // The first wait flushes the commands so that the fence is signaled
+  GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+  const GLuint64 timeout = 1000000000; // 1 second
+  for (;;) {
+    const auto status = glClientWaitSync(image.fence, flags, timeout);
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+      break;
+    }
+    if (status == GL_WAIT_FAILED) {
+      logMessage(
+          LogLevel::Error, "Error: renderToImage - glClientWaitSync failed");
+      break;
+    }
+    flags = 0;
+  }
+  glDeleteSync(image.fence);
+
+  const auto &pixelBuffer = m_pixelBuffers[image.pixelBufferIdx];
+  const auto *pixels = pixelBuffer.map(0, image.size, GL_MAP_READ_BIT);
+  if (pixels) {
+    std::memcpy(outPixels, pixels, image.size);
+    pixelBuffer.unmap();
+  }
+
+  return pixels != nullptr;
+}
+
+bool ImageRenderer::isPendingImageReady() const
+{
+  if (m_pendingImages.empty()) {
+    return false;
   }
+  // A failed wait is reported by readPixels()
+  return glClientWaitSync(m_pendingImages.front().fence, 0, 0) !=
+         GL_TIMEOUT_EXPIRED;
+}
+
+void ImageRenderer::applyFxaa() const
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_filteredFramebuffer.glId());
+  glViewport(0, 0, GLsizei(m_nWidth), GLsizei(m_nHeight));
+  GLboolean isDepthTested = GL_FALSE;
+  glGetBooleanv(GL_DEPTH_TEST, &isDepthTested);
+  glDisable(GL_DEPTH_TEST);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_colorTexture.glId());
+  m_fxaaProgram->use();
+  m_emptyVertexArray.bind();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  if (isDepthTested) {
+    glEnable(GL_DEPTH_TEST);
+  }
+}
+
+void ImageRenderer::convertToYuv(const GLBuffer &pixelBuffer) const
+{
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D,
+      m_fxaaProgram ? m_filteredTexture.glId() : m_colorTexture.glId());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, pixelBuffer.glId());
+  m_yuvProgram->use();
+  m_yuvProgram->getUniform<GLint>("uWidth").set(GLint(m_nWidth));
+  m_yuvProgram->getUniform<GLint>("uHeight").set(GLint(m_nHeight));
+  const auto wordCount = (imageSize() + 3) / 4;
+  glDispatchCompute(GLuint((wordCount + 63) / 64), 1, 1);
+  // The buffer is mapped once the fence is signaled
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+RenderTarget::RenderTarget(size_t width, size_t height, GLenum depthFormat) :
+    m_nWidth(width),
+    m_nHeight(height),
+    m_colorBuffer(GL_RGBA8, GLsizei(width), GLsizei(height)),
+    m_depthBuffer(depthFormat, GLsizei(width), GLsizei(height)),
+    m_framebuffer(GLFramebuffer::create())
+{
+  const auto depthAttachment =
+      depthFormat == GL_DEPTH24_STENCIL8 || depthFormat == GL_DEPTH32F_STENCIL8
+          ? GL_DEPTH_STENCIL_ATTACHMENT
+          : GL_DEPTH_ATTACHMENT;
+  m_framebuffer.attachRenderbuffer(GL_COLOR_ATTACHMENT0, m_colorBuffer.glId());
+  m_framebuffer.attachRenderbuffer(depthAttachment, m_depthBuffer.glId());
+  m_framebuffer.setReadBuffer(GL_COLOR_ATTACHMENT0);
+
+  const auto framebufferStatus = m_framebuffer.status();
+  assert(framebufferStatus == GL_FRAMEBUFFER_COMPLETE);
+  (void)framebufferStatus;
+}
+
+void RenderTarget::blitColor(GLuint drawFramebuffer) const
+{
+  m_framebuffer.blit(drawFramebuffer, 0, 0, GLint(m_nWidth), GLint(m_nHeight),
+      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+}
+
+void RenderTarget::upscaleColor(
+    size_t width, size_t height, GLuint drawFramebuffer) const
+{
+  GLFramebuffer::blit(m_framebuffer.glId(), drawFramebuffer, 0, 0,
+      GLint(width), GLint(height), 0, 0, GLint(m_nWidth), GLint(m_nHeight),
+      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+}
+
+void renderTiledImage(size_t width, size_t height, size_t numComponents,
+    size_t tileSize, const std::function<void(const glm::mat4 &)> &drawTile,
+    const std::function<void(const unsigned char *, size_t)> &writeRows,
+    size_t samples)
+{
+  const auto columnCount = (width + tileSize - 1) / tileSize;
+  const auto rowCount = (height + tileSize - 1) / tileSize;
+
+  ImageRenderer renderer{tileSize, tileSize, numComponents, 2, samples};
+  std::vector<unsigned char> tilePixels(renderer.imageSize());
+  std::vector<unsigned char> stripPixels(width * tileSize * numComponents);
 
-  glBindTexture(GL_TEXTURE_2D, textureObject);
-  glGetTexImage(GL_TEXTURE_2D, 0, numComponents == 3 ? GL_RGB : GL_RGBA,
-      GL_UNSIGNED_BYTE, outPixels);
+  // Tiles are indexed from the top left corner. Edge tiles extend beyond the
+  // image and are cropped.
+  const auto getTileOrigin = [&](size_t tileIdx) {
+    const auto column = tileIdx % columnCount;
+    const auto row = tileIdx / columnCount;
+    // Lower left corner in window coordinates, can be negative on the last
+    // row
+    return glm::ivec2(int(column * tileSize),
+        int(height) - int((row + 1) * tileSize));
+  };
 
-  glBindTexture(GL_TEXTURE_2D, previousTextureObject);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFramebufferObject);
-}
\ No newline at end of file
+  const auto readOldestTile = [&](size_t tileIdx) {
+    renderer.readPixels(tilePixels.data());
+    const auto origin = getTileOrigin(tileIdx);
+    const auto firstRow = size_t(std::max(-origin.y, 0));
+    const auto columns = std::min(tileSize, width - size_t(origin.x));
+    for (auto y = firstRow; y < tileSize; ++y) {
+      std::memcpy(stripPixels.data() +
+                      ((y - firstRow) * width + origin.x) * numComponents,
+          tilePixels.data() + y * tileSize * numComponents,
+          columns * numComponents);
+    }
+    if (tileIdx % columnCount + 1 == columnCount) {
+      writeRows(stripPixels.data(), tileSize - firstRow);
+    }
+  };
+
+  const auto tileCount = columnCount * rowCount;
+  for (size_t tileIdx = 0; tileIdx < tileCount; ++tileIdx) {
+    if (renderer.pendingImageCount() == renderer.maxPendingImageCount()) {
+      readOldestTile(tileIdx - renderer.pendingImageCount());
+    }
+
+    // Map the clip space of the tile to [-1, 1]
+    const auto origin = getTileOrigin(tileIdx);
+    const auto scale = glm::vec2(width, height) / float(tileSize);
+    const auto offset =
+        (glm::vec2(width, height) - 2.f * glm::vec2(origin)) / float(tileSize) -
+        1.f;
+    glm::mat4 tileMatrix(1);
+    tileMatrix[0][0] = scale.x;
+    tileMatrix[1][1] = scale.y;
+    tileMatrix[3][0] = offset.x;
+    tileMatrix[3][1] = offset.y;
+
+    renderer.render([&]() { drawTile(tileMatrix); });
+  }
+  for (auto tileIdx = tileCount - renderer.pendingImageCount();
+       tileIdx < tileCount; ++tileIdx) {
+    readOldestTile(tileIdx);
+  }
+}
+
+size_t getMaxTileSize(size_t maxTileSize)
+{
+  GLint maxTextureSize = 0;
+  GLint maxViewportDims[2] = {0, 0};
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewportDims);
+  return std::min({maxTileSize, size_t(maxTextureSize),
+      size_t(maxViewportDims[0]), size_t(maxViewportDims[1])});
+}
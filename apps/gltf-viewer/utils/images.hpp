@@ -1,30 +1,224 @@
 #pragma once
 
+#include "gl_objects.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <deque>
 #include <functional>
+#include <vector>
 
+// Prefer encoding with flipY (see writePng) to flipping pixels in place
 template <typename ComponentType>
 void flipImageYAxis(
     size_t width, size_t height, size_t numComponent, ComponentType *pixels)
 {
-  auto *pFirstLine = pixels;
-  auto *pLastLine = pixels + (height - 1) * width * numComponent;
-
-  while (pFirstLine < pLastLine) {
-    for (size_t x = 0; x < width * numComponent; ++x)
-      std::swap(pFirstLine[x], pLastLine[x]);
-    pFirstLine += width * numComponent;
-    pLastLine -= width * numComponent;
+  const auto rowSize = width * numComponent;
+  for (size_t y = 0; y < height / 2; ++y) {
+    auto *pRow = pixels + y * rowSize;
+    std::swap_ranges(pRow, pRow + rowSize, pixels + (height - 1 - y) * rowSize);
   }
 }
 
 void renderToImage(size_t width, size_t height, size_t numComponents,
-    unsigned char *outPixels, std::function<void()> drawScene);
+    void *outPixels, std::function<void()> drawScene, size_t samples = 0,
+    const GLProgram *fxaaProgram = nullptr,
+    GLenum pixelType = GL_UNSIGNED_BYTE);
 // Setup GL state in order to render in texture, call drawScene() then get the
 // texture from the GPU and store it on outPixels[0 : width * height *
-// numComponent]. Then restore the previous GL state.
+// numComponent] (of pixelType components). Then bind the default framebuffer
+// again: the previous bindings are not queried, so this must be called with
+// the default framebuffer bound.
 //
 // For this to work, drawScene must render on the currently bound
 // GL_DRAW_FRAMEBUFFER.
 // It means that if drawScene change GL_DRAW_FRAMEBUFFER, in must restore it
 // before doing final rendering (for example for deferred rendering,
-// GL_DRAW_FRAMEBUFFER must be restored before the shading pass).
\ No newline at end of file
+// GL_DRAW_FRAMEBUFFER must be restored before the shading pass).
+//
+// This function waits for the GPU to finish the image, use ImageRenderer to
+// overlap rendering with the processing of previous images. samples,
+// fxaaProgram and pixelType are those of ImageRenderer.
+
+// Offscreen renderer of images with asynchronous readback, kept from image
+// to image: its targets are only reallocated when the size of the images
+// changes (see resize()).
+//
+// render() draws in an RGBA8 framebuffer (RGBA16F for GL_HALF_FLOAT images)
+// and starts copying the image to a pixel pack buffer, guarded by a fence.
+// It does not wait for the GPU, so the CPU can encode the previous image
+// while the GPU renders and transfers the next one. readPixels() waits for
+// the oldest pending image and copies it out in the same layout as
+// renderToImage (bottom row first). Each pending image keeps the size it was
+// rendered with.
+//
+// Images are anti-aliased on the GPU, at a fraction of the cost of
+// supersampling: multisampled framebuffers are resolved by a blit before
+// the copy, and FXAA can then filter the resolved image. Video frames can
+// be converted to I420 on the GPU too, halving the bytes read back.
+class ImageRenderer
+{
+public:
+  // Images are read with numComponents components (3 or 4). At most
+  // maxPendingImages images are in flight, render() waits for the oldest one
+  // beyond that. With samples > 1, images are drawn with that many samples
+  // per pixel (at most GL_MAX_SAMPLES). With fxaaProgram (fxaa.fs.glsl with
+  // fullscreen.vs.glsl), which must outlive the renderer, images are then
+  // filtered with FXAA. Components are GL_UNSIGNED_BYTE, or GL_HALF_FLOAT
+  // for HDR images, which are neither clamped nor quantized to 8 bits. With
+  // yuvProgram (rgb_to_yuv.cs.glsl), which must outlive the renderer too,
+  // images of even width and height are read as 8-bit I420 frames, top row
+  // first, of width * height * 3 / 2 bytes, whatever numComponents and
+  // pixelType.
+  ImageRenderer(size_t width, size_t height, size_t numComponents,
+      size_t maxPendingImages = 2, size_t samples = 0,
+      const GLProgram *fxaaProgram = nullptr,
+      GLenum pixelType = GL_UNSIGNED_BYTE,
+      const GLProgram *yuvProgram = nullptr);
+
+  // Delete the fences of the pending images
+  ~ImageRenderer();
+
+  ImageRenderer(const ImageRenderer &) = delete;
+  ImageRenderer &operator=(const ImageRenderer &) = delete;
+
+  // Render the next images at width x height, reallocating the targets if
+  // the size changes. Pending images are kept. With yuvProgram, width and
+  // height must be even.
+  void resize(size_t width, size_t height);
+
+  // Same contract as renderToImage for drawScene. If maxPendingImages images
+  // are already pending, the oldest one is read in a discarded buffer, call
+  // readPixels() first to keep it.
+  void render(const std::function<void()> &drawScene);
+
+  // Number of images rendered but not read yet
+  size_t pendingImageCount() const { return m_pendingImages.size(); }
+
+  // Size in bytes of the oldest pending image, 0 if there is none
+  size_t pendingImageSize() const
+  {
+    return m_pendingImages.empty() ? 0 : m_pendingImages.front().size;
+  }
+
+  // Wait for the oldest pending image and copy it in outPixels[0 :
+  // pendingImageSize()]. Return false if there is no pending image.
+  bool readPixels(void *outPixels);
+
+  // True if the GPU is done with the oldest pending image, readPixels()
+  // then copies it without waiting. Never waits.
+  bool isPendingImageReady() const;
+
+  // Of the next images, in bytes
+  size_t imageSize() const
+  {
+    if (m_yuvProgram) {
+      return m_nWidth * m_nHeight * 3 / 2;
+    }
+    return m_nWidth * m_nHeight * m_nComponents *
+           (m_pixelType == GL_HALF_FLOAT ? 2 : 1);
+  }
+
+  size_t width() const { return m_nWidth; }
+
+  size_t height() const { return m_nHeight; }
+
+  size_t maxPendingImageCount() const { return m_pixelBuffers.size(); }
+
+  // Samples per pixel of the framebuffer of drawScene, 0 if not multisampled
+  size_t sampleCount() const { return m_nSamples; }
+
+private:
+  struct PendingImage
+  {
+    size_t pixelBufferIdx;
+    GLsync fence;
+    size_t size; // In bytes
+  };
+
+  // Create the targets of width x height images
+  void allocate(size_t width, size_t height);
+
+  // Filter the resolved image in m_filteredFramebuffer
+  void applyFxaa() const;
+
+  // Convert the final image to I420 in pixelBuffer
+  void convertToYuv(const GLBuffer &pixelBuffer) const;
+
+  size_t m_nWidth;
+  size_t m_nHeight;
+  size_t m_nComponents;
+  size_t m_nSamples = 0;
+  const GLProgram *m_fxaaProgram;
+  GLenum m_pixelType;
+  const GLProgram *m_yuvProgram;
+
+  GLTexture m_colorTexture;
+  GLTexture m_depthTexture; // Only without multisampling
+  GLFramebuffer m_framebuffer;
+  // Drawn by drawScene with multisampling, then resolved in m_framebuffer
+  GLRenderbuffer m_multisampleColorBuffer;
+  GLRenderbuffer m_multisampleDepthBuffer;
+  GLFramebuffer m_multisampleFramebuffer;
+  // Read back with FXAA
+  GLTexture m_filteredTexture;
+  GLFramebuffer m_filteredFramebuffer;
+  GLVertexArray m_emptyVertexArray; // Of the FXAA triangle
+  // Grown when the images are larger than them
+  std::vector<GLBuffer> m_pixelBuffers;
+  std::vector<size_t> m_pixelBufferSizes;
+  size_t m_nextPixelBufferIdx = 0;
+  std::deque<PendingImage> m_pendingImages;
+};
+
+// Offscreen framebuffer with an RGBA8 color buffer and a depth buffer of any
+// format, to render in a window with a depth format its default framebuffer
+// does not have (e.g. GL_DEPTH_COMPONENT32F). The color is then blitted to
+// the window.
+class RenderTarget
+{
+public:
+  RenderTarget(size_t width, size_t height, GLenum depthFormat);
+
+  GLuint framebuffer() const { return m_framebuffer.glId(); }
+
+  // Copy the color buffer at the same place in drawFramebuffer
+  void blitColor(GLuint drawFramebuffer = 0) const;
+
+  // Stretch the lower left width x height part of the color buffer over
+  // drawFramebuffer, of the size of the target, with bilinear filtering
+  void upscaleColor(
+      size_t width, size_t height, GLuint drawFramebuffer = 0) const;
+
+private:
+  size_t m_nWidth;
+  size_t m_nHeight;
+
+  // Renderbuffers since they are never sampled
+  GLRenderbuffer m_colorBuffer;
+  GLRenderbuffer m_depthBuffer;
+  GLFramebuffer m_framebuffer;
+};
+
+// Render a width x height image of any size in tiles of tileSize x tileSize
+// pixels, so that GPU memory does not depend on the image size. Tiles are
+// drawn with samples samples per pixel like ImageRenderer, but without FXAA
+// which would show their seams.
+//
+// Each tile is rendered with a sub-frustum of the projection:
+// drawTile(tileMatrix) must render like drawScene for renderToImage, in a
+// tileSize x tileSize viewport, with the projection matrix tileMatrix *
+// projMatrix. Tiles are rendered by rows from the top of the image, and
+// writeRows(pixels, rowCount) is called on each row of tiles once it is read
+// back, with pixels[0 : width * rowCount * numComponents] bottom row first
+// like glReadPixels. Readback of a tile overlaps rendering of the next one.
+void renderTiledImage(size_t width, size_t height, size_t numComponents,
+    size_t tileSize, const std::function<void(const glm::mat4 &)> &drawTile,
+    const std::function<void(const unsigned char *, size_t)> &writeRows,
+    size_t samples = 0);
+
+// Largest tile size supported by the GL implementation, at most maxTileSize
+size_t getMaxTileSize(size_t maxTileSize);
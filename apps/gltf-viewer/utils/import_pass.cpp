@@ -0,0 +1,284 @@
+#include "import_pass.hpp"
+#include "bounds.hpp"
+#include "job_system.hpp"
+#include "tracing.hpp"
+#include "vertex_normals.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstring>
+#include <limits>
+#include <map>
+
+namespace
+{
+
+// What a job found for a primitive, applied to the model once every job is
+// done since accessors and buffers may be shared between meshes
+struct PrimitiveResult
+{
+  tinygltf::Primitive *primitive = nullptr;
+  bool hasBounds = false;
+  glm::vec3 localMin;
+  glm::vec3 localMax;
+  std::vector<float> normals;
+  // Indices without the degenerate triangles, empty if there are none
+  std::vector<uint32_t> indices;
+};
+
+size_t getTriangleCount(const tinygltf::Primitive &primitive, size_t count)
+{
+  switch (primitive.mode) {
+  case TINYGLTF_MODE_TRIANGLES:
+    return count / 3;
+  case TINYGLTF_MODE_TRIANGLE_STRIP:
+  case TINYGLTF_MODE_TRIANGLE_FAN:
+    return count > 2 ? count - 2 : 0;
+  default:
+    return 0;
+  }
+}
+
+// Read the indices of a TRIANGLES primitive into indices and remove its
+// triangles with repeated indices or positions, or an exactly zero area.
+// positions has the vertexCount vertices of the primitive, byteStride apart.
+// Return the number of removed triangles. indices is left empty if there are
+// none, or if every triangle is degenerate since an accessor of no element
+// is not valid glTF.
+size_t removeDegenerateTriangles(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const tinygltf::Primitive &primitive, const unsigned char *positions,
+    size_t byteStride, size_t vertexCount, std::vector<uint32_t> &indices)
+{
+  const auto &accessor = model.accessors[primitive.indices];
+  indices.resize(accessor.count - accessor.count % 3);
+  AccessorView{model, buffers, accessor}.readUints(
+      0, indices.size(), indices.data());
+  const auto position = [&](uint32_t vertex) {
+    glm::vec3 result;
+    std::memcpy(&result, positions + vertex * byteStride, sizeof(result));
+    return result;
+  };
+  size_t keptCount = 0;
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const auto a = indices[i];
+    const auto b = indices[i + 1];
+    const auto c = indices[i + 2];
+    // Indices out of range are left to the checks of the renderer
+    auto isDegenerate = a == b || b == c || a == c;
+    if (!isDegenerate && a < vertexCount && b < vertexCount &&
+        c < vertexCount) {
+      const auto pa = position(a);
+      isDegenerate =
+          glm::cross(position(b) - pa, position(c) - pa) == glm::vec3(0);
+    }
+    if (!isDegenerate) {
+      indices[keptCount++] = a;
+      indices[keptCount++] = b;
+      indices[keptCount++] = c;
+    }
+  }
+  const auto removedCount = (indices.size() - keptCount) / 3;
+  if (!removedCount || !keptCount) {
+    indices.clear();
+    return 0;
+  }
+  indices.resize(keptCount);
+  return removedCount;
+}
+
+// Store indices in a new accessor of model for each primitive, in a single
+// new buffer. Primitives sharing their index and position accessors share
+// the new accessor.
+void addIndexAccessors(tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers,
+    const std::vector<tinygltf::Primitive *> &primitives,
+    const std::vector<std::vector<uint32_t>> &indices)
+{
+  if (primitives.empty()) {
+    return;
+  }
+  tinygltf::Buffer buffer;
+  std::map<std::pair<int, int>, int> addedAccessors;
+  for (size_t i = 0; i < primitives.size(); ++i) {
+    auto &primitive = *primitives[i];
+    const auto key =
+        std::make_pair(primitive.indices, primitive.attributes.at("POSITION"));
+    const auto it = addedAccessors.find(key);
+    if (it != addedAccessors.end()) {
+      primitive.indices = it->second;
+      continue;
+    }
+
+    const auto componentType =
+        model.accessors[primitive.indices].componentType ==
+                TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT
+            ? TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT
+            : TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+    tinygltf::BufferView bufferView;
+    bufferView.buffer = int(model.buffers.size());
+    bufferView.byteOffset = buffer.data.size();
+    bufferView.target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
+    if (componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
+      bufferView.byteLength = indices[i].size() * sizeof(uint32_t);
+      const auto bytes =
+          reinterpret_cast<const unsigned char *>(indices[i].data());
+      buffer.data.insert(
+          end(buffer.data), bytes, bytes + bufferView.byteLength);
+    } else {
+      const std::vector<uint16_t> shortIndices(
+          begin(indices[i]), end(indices[i]));
+      bufferView.byteLength = shortIndices.size() * sizeof(uint16_t);
+      const auto bytes =
+          reinterpret_cast<const unsigned char *>(shortIndices.data());
+      buffer.data.insert(
+          end(buffer.data), bytes, bytes + bufferView.byteLength);
+    }
+    // Keep the next view aligned for either component type
+    buffer.data.resize((buffer.data.size() + 3) & ~size_t(3));
+
+    tinygltf::Accessor accessor;
+    accessor.bufferView = int(model.bufferViews.size());
+    accessor.componentType = componentType;
+    accessor.type = TINYGLTF_TYPE_SCALAR;
+    accessor.count = indices[i].size();
+    model.bufferViews.push_back(bufferView);
+    primitive.indices = int(model.accessors.size());
+    addedAccessors[key] = primitive.indices;
+    model.accessors.push_back(accessor);
+  }
+  model.buffers.push_back(std::move(buffer));
+  const auto &data = model.buffers.back().data;
+  buffers.push_back({data.data(), data.size()});
+}
+
+} // namespace
+
+ImportPassResult runImportPass(tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers, const ImportPassOptions &options)
+{
+  TRACE_ZONE("Import pass");
+  ImportPassResult result;
+  std::vector<std::vector<PrimitiveResult>> meshResults(model.meshes.size());
+  std::vector<size_t> vertexCounts(model.meshes.size(), 0);
+  std::vector<size_t> triangleCounts(model.meshes.size(), 0);
+  std::vector<size_t> degenerateCounts(model.meshes.size(), 0);
+  if (options.hashContent) {
+    result.hashes.meshes.resize(model.meshes.size());
+    result.hashes.images.resize(model.images.size());
+  }
+
+  auto &jobSystem = getJobSystem();
+  jobSystem.parallelFor(model.meshes.size(), 1, [&](size_t begin, size_t end) {
+    std::vector<float> positions;
+    for (auto meshIdx = begin; meshIdx < end; ++meshIdx) {
+      auto &mesh = model.meshes[meshIdx];
+      for (auto &primitive : mesh.primitives) {
+        PrimitiveResult primitiveResult;
+        primitiveResult.primitive = &primitive;
+        const auto it = primitive.attributes.find("POSITION");
+        if (it == primitive.attributes.end()) {
+          continue;
+        }
+        const auto &accessor = model.accessors[it->second];
+        vertexCounts[meshIdx] += accessor.count;
+        triangleCounts[meshIdx] += getTriangleCount(primitive,
+            primitive.indices >= 0 ? model.accessors[primitive.indices].count
+                                   : accessor.count);
+
+        // Quantized positions keep their min and max in the integer range
+        // of their components, which decoding does not give back
+        const auto needsBounds =
+            accessor.count && accessor.type == TINYGLTF_TYPE_VEC3 &&
+            accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT &&
+            (accessor.minValues.size() != 3 ||
+                accessor.maxValues.size() != 3);
+        const auto needsNormals = options.generateNormals &&
+                                  isMissingNormals(model, buffers, primitive);
+        const auto needsIndices = options.removeDegenerateTriangles &&
+                                  primitive.mode == TINYGLTF_MODE_TRIANGLES &&
+                                  primitive.indices >= 0 && accessor.count;
+        if (!needsBounds && !needsNormals && !needsIndices) {
+          continue;
+        }
+
+        const AccessorView view{model, buffers, accessor};
+        const unsigned char *data = view.floatData();
+        auto byteStride = view.byteStride();
+        if (!data || needsNormals) {
+          positions.resize(3 * accessor.count);
+          view.readFloats(0, accessor.count, 3, positions.data());
+          data = reinterpret_cast<const unsigned char *>(positions.data());
+          byteStride = 3 * sizeof(float);
+        }
+        if (needsBounds) {
+          primitiveResult.hasBounds = true;
+          primitiveResult.localMin =
+              glm::vec3(std::numeric_limits<float>::max());
+          primitiveResult.localMax =
+              glm::vec3(std::numeric_limits<float>::lowest());
+          extendBoundsWithPositions(data, accessor.count, byteStride,
+              glm::mat4(1), primitiveResult.localMin,
+              primitiveResult.localMax);
+        }
+        if (needsNormals) {
+          computePrimitiveNormals(model, buffers, primitive,
+              positions.data(), primitiveResult.normals);
+        }
+        if (needsIndices) {
+          degenerateCounts[meshIdx] += removeDegenerateTriangles(model,
+              buffers, primitive, data, byteStride, accessor.count,
+              primitiveResult.indices);
+        }
+        meshResults[meshIdx].push_back(std::move(primitiveResult));
+      }
+      if (options.hashContent) {
+        result.hashes.meshes[meshIdx] =
+            computeMeshContentHash(model, buffers, mesh);
+      }
+    }
+  });
+  if (options.hashContent) {
+    jobSystem.parallelFor(
+        model.images.size(), 1, [&](size_t begin, size_t end) {
+          for (auto i = begin; i < end; ++i) {
+            result.hashes.images[i] = computeImageContentHash(model.images[i]);
+          }
+        });
+  }
+
+  std::vector<tinygltf::Primitive *> normalPrimitives;
+  std::vector<std::vector<float>> normals;
+  std::vector<tinygltf::Primitive *> indexedPrimitives;
+  std::vector<std::vector<uint32_t>> indices;
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    result.vertexCount += vertexCounts[meshIdx];
+    result.triangleCount += triangleCounts[meshIdx];
+    result.degenerateTriangleCount += degenerateCounts[meshIdx];
+    for (auto &primitiveResult : meshResults[meshIdx]) {
+      const auto &attributes = primitiveResult.primitive->attributes;
+      auto &accessor = model.accessors[attributes.at("POSITION")];
+      // Once per accessor, even if shared
+      if (primitiveResult.hasBounds && (accessor.minValues.size() != 3 ||
+                                           accessor.maxValues.size() != 3)) {
+        const auto &localMin = primitiveResult.localMin;
+        const auto &localMax = primitiveResult.localMax;
+        accessor.minValues = {localMin.x, localMin.y, localMin.z};
+        accessor.maxValues = {localMax.x, localMax.y, localMax.z};
+        ++result.boundedAccessorCount;
+      }
+      if (!primitiveResult.normals.empty()) {
+        normalPrimitives.push_back(primitiveResult.primitive);
+        normals.push_back(std::move(primitiveResult.normals));
+      }
+      if (!primitiveResult.indices.empty()) {
+        indexedPrimitives.push_back(primitiveResult.primitive);
+        indices.push_back(std::move(primitiveResult.indices));
+      }
+    }
+  }
+  result.normalCount =
+      addNormalAttributes(model, buffers, normalPrimitives, normals);
+  addIndexAccessors(model, buffers, indexedPrimitives, indices);
+  return result;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "content_hashes.hpp"
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <vector>
+
+// Single pass over the geometry of a parsed model doing what separate
+// analyses would each do with another read of every vertex: each mesh is one
+// job of the job system, whose positions are read once and used while they
+// are in cache to
+// - fill the missing min and max of float POSITION accessors, so that
+// computeSceneBounds transforms their boxes instead of reading their vertices
+// again,
+// - generate the missing normals (see generateMissingNormals),
+// - hash the mesh for deduplicateModel (see computeContentHashes),
+// - remove the degenerate triangles of indexed triangle lists (repeated
+// indices or positions, or no area), which cost vertex work and triangle
+// setup without ever covering a sample,
+// - count vertices and triangles.
+struct ImportPassOptions
+{
+  bool generateNormals = true;
+  bool hashContent = false;
+  bool removeDegenerateTriangles = true;
+};
+
+struct ImportPassResult
+{
+  // POSITION accessors whose min and max were computed
+  size_t boundedAccessorCount = 0;
+  // Primitives that got normals
+  size_t normalCount = 0;
+  // Of the meshes, not of their instances
+  size_t vertexCount = 0;
+  size_t triangleCount = 0;
+  size_t degenerateTriangleCount = 0; // Removed, counted in triangleCount
+  // Hashes of the meshes before normals are generated, and of the images,
+  // empty unless options.hashContent is set
+  ModelContentHashes hashes;
+};
+
+// Generated normals are stored as by generateMissingNormals, in a new buffer
+// of model which buffers gets a span on. So are the indices left once
+// degenerate triangles are removed, in new accessors of 16-bit indices (32
+// bits if the original ones are), the original accessors stay in the model.
+ImportPassResult runImportPass(tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers, const ImportPassOptions &options);
@@ -0,0 +1,392 @@
+#include "impostors.hpp"
+#include "gl_objects.hpp"
+#include "mapped_file.hpp"
+#include "sync_watchdog.hpp"
+#include "tracing.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+
+const char IMPOSTOR_CACHE_MAGIC[8] = {'G', 'L', 'T', 'F', 'I', 'M', 'P', 'O'};
+// Increment each time the layout of the file or the baking changes
+const uint32_t IMPOSTOR_CACHE_VERSION = 1;
+
+struct Header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint64_t sourceKey;
+  uint32_t gridSize;
+  uint32_t viewSize;
+  uint64_t count; // Followed by count CachedImpostor, then the layers
+};
+
+struct CachedImpostor
+{
+  uint32_t primitive;
+  float sphere[4];
+};
+
+// Bytes of the first level of a layer of one of the arrays
+const size_t LAYER_BYTES =
+    ImpostorAtlas::LAYER_SIZE * ImpostorAtlas::LAYER_SIZE * 4;
+
+// Down to a texel per view, so that the levels never mix views
+GLsizei getLevelCount()
+{
+  GLsizei levelCount = 1;
+  while ((ImpostorAtlas::VIEW_SIZE >> levelCount) > 0) {
+    ++levelCount;
+  }
+  return levelCount;
+}
+
+float signNotZero(float value) { return value >= 0.f ? 1.f : -1.f; }
+
+// Unit vector of a point of [-1, 1]^2 of the octahedral map of the sphere,
+// as decodeOctahedral of impostor.vs.glsl
+glm::vec3 decodeOctahedral(const glm::vec2 &e)
+{
+  glm::vec3 n(e, 1.f - std::abs(e.x) - std::abs(e.y));
+  if (n.z < 0.f) {
+    n = glm::vec3((1.f - std::abs(n.y)) * signNotZero(n.x),
+        (1.f - std::abs(n.x)) * signNotZero(n.y), n.z);
+  }
+  return glm::normalize(n);
+}
+
+// View and orthographic projection of the view along direction of a sphere,
+// as getImpostorFrame of impostor.vs.glsl. Depths go from 0 at the front of
+// the sphere to 1 at its back, inside the clip volume whatever the clip
+// control.
+glm::mat4 getViewProjMatrix(const glm::vec3 &direction, const glm::vec4 &sphere)
+{
+  const auto reference = std::abs(direction.y) < 0.999f ? glm::vec3(0, 1, 0)
+                                                        : glm::vec3(0, 0, 1);
+  const auto right = glm::normalize(glm::cross(reference, direction));
+  const auto up = glm::cross(direction, right);
+  const auto center = glm::vec3(sphere);
+  const auto radius = std::max(sphere.w, 1e-6f);
+  glm::mat4 rows(glm::vec4(right / radius, -glm::dot(right, center) / radius),
+      glm::vec4(up / radius, -glm::dot(up, center) / radius),
+      glm::vec4(-direction / (2.f * radius),
+          (radius + glm::dot(direction, center)) / (2.f * radius)),
+      glm::vec4(0, 0, 0, 1));
+  return glm::transpose(rows);
+}
+
+} // namespace
+
+ImpostorAtlas &ImpostorAtlas::operator=(ImpostorAtlas &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_impostors, rvalue.m_impostors);
+    std::swap(m_layers, rvalue.m_layers);
+    std::swap(m_colors, rvalue.m_colors);
+    std::swap(m_normals, rvalue.m_normals);
+    std::swap(m_memory, rvalue.m_memory);
+  }
+  return *this;
+}
+
+glm::vec3 ImpostorAtlas::getViewDirection(size_t x, size_t y)
+{
+  return decodeOctahedral(
+      (glm::vec2(float(x), float(y)) + 0.5f) / float(GRID_SIZE) * 2.f -
+      1.f);
+}
+
+void ImpostorAtlas::bake(const GLProgram &program, const GeometryArena &arena,
+    const std::vector<ArenaPrimitive> &primitives,
+    const std::vector<glm::vec3> &boundsMin,
+    const std::vector<glm::vec3> &boundsMax,
+    const std::vector<uint32_t> &impostorPrimitives)
+{
+  TRACE_ZONE("Bake impostors");
+  std::vector<Impostor> impostors;
+  for (const auto primitiveIdx : impostorPrimitives) {
+    if (impostors.size() == MAX_IMPOSTORS) {
+      break;
+    }
+    const auto &bboxMin = boundsMin[primitiveIdx];
+    const auto &bboxMax = boundsMax[primitiveIdx];
+    impostors.push_back({primitiveIdx,
+        glm::vec4(0.5f * (bboxMin + bboxMax),
+            0.5f * glm::distance(bboxMin, bboxMax))});
+  }
+  allocate(std::move(impostors));
+  if (m_impostors.empty()) {
+    return;
+  }
+
+  GLint drawFramebuffer = 0, depthFunc = GL_LESS;
+  GLint viewport[4];
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+
+  const GLRenderbuffer depth(
+      GL_DEPTH_COMPONENT32F, GLsizei(LAYER_SIZE), GLsizei(LAYER_SIZE));
+  auto framebuffer = GLFramebuffer::create();
+  framebuffer.attachRenderbuffer(GL_DEPTH_ATTACHMENT, depth.glId());
+  const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  framebuffer.setDrawBuffers(2, drawBuffers);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer.glId());
+  glDepthFunc(GL_LESS);
+
+  program.use();
+  const auto viewProjMatrix = program.getUniform<glm::mat4>("uViewProjMatrix");
+  const auto viewDirection = program.getUniform<glm::vec3>("uViewDirection");
+  arena.bind();
+  for (size_t layer = 0; layer < m_impostors.size(); ++layer) {
+    const auto &impostor = m_impostors[layer];
+    framebuffer.attachTextureLayer(
+        GL_COLOR_ATTACHMENT0, m_colors, 0, GLint(layer));
+    framebuffer.attachTextureLayer(
+        GL_COLOR_ATTACHMENT1, m_normals, 0, GLint(layer));
+    glViewport(0, 0, GLsizei(LAYER_SIZE), GLsizei(LAYER_SIZE));
+    // Uncovered texels are 0, so that the levels average premultiplied
+    // colors and normals
+    const GLfloat clearColor[4] = {0.f, 0.f, 0.f, 0.f};
+    const GLfloat clearDepth = 1.f;
+    glClearBufferfv(GL_COLOR, 0, clearColor);
+    glClearBufferfv(GL_COLOR, 1, clearColor);
+    glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+
+    const auto &primitive = primitives[impostor.primitive];
+    GeometryArena::setMaterialId(primitive.materialID);
+    for (size_t y = 0; y < GRID_SIZE; ++y) {
+      for (size_t x = 0; x < GRID_SIZE; ++x) {
+        const auto direction = getViewDirection(x, y);
+        glViewport(GLint(x * VIEW_SIZE), GLint(y * VIEW_SIZE),
+            GLsizei(VIEW_SIZE), GLsizei(VIEW_SIZE));
+        viewProjMatrix.set(getViewProjMatrix(direction, impostor.sphere) *
+                           primitive.positionMatrix());
+        viewDirection.set(direction);
+        glDrawElementsBaseVertex(primitive.mode,
+            GLsizei(primitive.indexCount), arena.indexType(),
+            arena.indexOffset(primitive.firstIndex),
+            primitive.baseVertex);
+      }
+    }
+  }
+  glBindVertexArray(0);
+
+  glDepthFunc(GLenum(depthFunc));
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(drawFramebuffer));
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  for (const auto texture : {m_colors, m_normals}) {
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+bool ImpostorAtlas::readCache(const fs::path &cachePath, uint64_t sourceKey,
+    const std::vector<uint32_t> &impostorPrimitives)
+{
+  TRACE_ZONE("Read impostor cache");
+  std::error_code errorCode;
+  if (!fs::exists(cachePath, errorCode)) {
+    return false;
+  }
+  MappedFile file;
+  try {
+    file = MappedFile{cachePath};
+  } catch (const std::runtime_error &) {
+    return false;
+  }
+  if (file.size() < sizeof(Header)) {
+    return false;
+  }
+  const auto &header = *reinterpret_cast<const Header *>(file.data());
+  const auto count =
+      std::min(impostorPrimitives.size(), size_t(MAX_IMPOSTORS));
+  if (std::memcmp(header.magic, IMPOSTOR_CACHE_MAGIC, sizeof(header.magic)) !=
+          0 ||
+      header.version != IMPOSTOR_CACHE_VERSION ||
+      header.headerSize != sizeof(Header) || header.sourceKey != sourceKey ||
+      header.gridSize != GRID_SIZE || header.viewSize != VIEW_SIZE ||
+      header.count != count ||
+      file.size() != sizeof(Header) + count * sizeof(CachedImpostor) +
+                         2 * count * LAYER_BYTES) {
+    return false;
+  }
+  const auto cached = reinterpret_cast<const CachedImpostor *>(
+      file.data() + sizeof(Header));
+  std::vector<Impostor> impostors(count);
+  for (size_t i = 0; i < count; ++i) {
+    if (cached[i].primitive != impostorPrimitives[i]) {
+      return false;
+    }
+    impostors[i] = {cached[i].primitive, glm::make_vec4(cached[i].sphere)};
+  }
+
+  allocate(std::move(impostors));
+  const auto layers = file.data() + sizeof(Header) +
+                      count * sizeof(CachedImpostor);
+  const auto size = GLsizei(LAYER_SIZE);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_colors);
+  glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, size, size,
+      GLsizei(count), GL_RGBA, GL_UNSIGNED_BYTE, layers);
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_normals);
+  glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, size, size,
+      GLsizei(count), GL_RGBA, GL_UNSIGNED_BYTE, layers + count * LAYER_BYTES);
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  return true;
+}
+
+bool ImpostorAtlas::writeCache(
+    const fs::path &cachePath, uint64_t sourceKey, std::string &err) const
+{
+  TRACE_ZONE("Write impostor cache");
+  Header header{};
+  std::memcpy(header.magic, IMPOSTOR_CACHE_MAGIC, sizeof(header.magic));
+  header.version = IMPOSTOR_CACHE_VERSION;
+  header.headerSize = sizeof(Header);
+  header.sourceKey = sourceKey;
+  header.gridSize = uint32_t(GRID_SIZE);
+  header.viewSize = uint32_t(VIEW_SIZE);
+  header.count = m_impostors.size();
+  std::vector<CachedImpostor> cached(m_impostors.size());
+  for (size_t i = 0; i < m_impostors.size(); ++i) {
+    cached[i].primitive = m_impostors[i].primitive;
+    std::memcpy(cached[i].sphere, glm::value_ptr(m_impostors[i].sphere),
+        sizeof(cached[i].sphere));
+  }
+  std::vector<unsigned char> colors(m_impostors.size() * LAYER_BYTES);
+  std::vector<unsigned char> normals(colors.size());
+  {
+    SyncScope sync{"ImpostorAtlas::writeCache"};
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_colors);
+    glGetTexImage(
+        GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, colors.data());
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_normals);
+    glGetTexImage(
+        GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, normals.data());
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  }
+
+  std::error_code errorCode;
+  fs::create_directories(cachePath.parent_path(), errorCode);
+  auto tmpPath = cachePath;
+  tmpPath += ".tmp";
+  {
+    std::ofstream out(tmpPath.string(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+      err = "Unable to open " + tmpPath.string() + " for writing";
+      return false;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(cached.data()),
+        std::streamsize(cached.size() * sizeof(CachedImpostor)));
+    out.write(reinterpret_cast<const char *>(colors.data()),
+        std::streamsize(colors.size()));
+    out.write(reinterpret_cast<const char *>(normals.data()),
+        std::streamsize(normals.size()));
+    if (!out) {
+      err = "Unable to write " + tmpPath.string();
+      return false;
+    }
+  }
+  fs::rename(tmpPath, cachePath, errorCode);
+  if (errorCode) {
+    err = "Unable to rename " + tmpPath.string() + ": " + errorCode.message();
+    fs::remove(tmpPath, errorCode);
+    return false;
+  }
+  return true;
+}
+
+void ImpostorAtlas::bind(const GLProgram &program) const
+{
+  glm::vec4 spheres[MAX_IMPOSTORS];
+  for (size_t i = 0; i < m_impostors.size(); ++i) {
+    spheres[i] = m_impostors[i].sphere;
+  }
+  const auto location = program.getUniformLocation("uImpostorSpheres");
+  if (location >= 0) {
+    glProgramUniform4fv(program.glId(), location,
+        GLsizei(m_impostors.size()), glm::value_ptr(spheres[0]));
+  }
+  glActiveTexture(GL_TEXTURE0 + COLOR_UNIT);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_colors);
+  glActiveTexture(GL_TEXTURE0 + NORMAL_UNIT);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_normals);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void ImpostorAtlas::unbind() const
+{
+  glActiveTexture(GL_TEXTURE0 + COLOR_UNIT);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  glActiveTexture(GL_TEXTURE0 + NORMAL_UNIT);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void ImpostorAtlas::allocate(std::vector<Impostor> impostors)
+{
+  release();
+  m_impostors = std::move(impostors);
+  if (m_impostors.empty()) {
+    return;
+  }
+  uint32_t primitiveCount = 0;
+  for (const auto &impostor : m_impostors) {
+    primitiveCount = std::max(primitiveCount, impostor.primitive + 1);
+  }
+  m_layers.assign(primitiveCount, -1);
+  for (size_t layer = 0; layer < m_impostors.size(); ++layer) {
+    m_layers[m_impostors[layer].primitive] = int(layer);
+  }
+
+  const auto levelCount = getLevelCount();
+  const auto size = GLsizei(LAYER_SIZE);
+  for (auto *texture : {&m_colors, &m_normals}) {
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, *texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount, GL_RGBA8, size, size,
+        GLsizei(m_impostors.size()));
+    glTexParameteri(
+        GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(
+        GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(
+        GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  m_memory = TrackedGLMemory(GLMemoryCategory::Textures,
+      2 * getTextureByteSize(GL_RGBA8, LAYER_SIZE, LAYER_SIZE,
+              size_t(levelCount), m_impostors.size()));
+}
+
+void ImpostorAtlas::release()
+{
+  for (auto *texture : {&m_colors, &m_normals}) {
+    if (*texture) {
+      glDeleteTextures(1, texture);
+      *texture = 0;
+    }
+  }
+  m_memory = TrackedGLMemory();
+  m_impostors.clear();
+  m_layers.clear();
+}
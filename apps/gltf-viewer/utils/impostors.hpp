@@ -0,0 +1,114 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "geometry_arena.hpp"
+#include "gl_memory.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Octahedral impostors of the primitives drawn by many instances (see
+// InstancedDrawList::drawImpostors), drawn instead of their instances once
+// they cover a few pixels.
+//
+// The impostor of a primitive is a layer of two texture arrays holding
+// GRID_SIZE x GRID_SIZE views of it, taken by orthographic cameras around
+// its bounding sphere along the directions of an octahedral map of the
+// sphere (see getViewDirection): its base color and coverage, and its
+// object space normals. An instance drawn as an impostor is a single quad,
+// textured with the view whose direction is the closest to the direction
+// of the camera in the space of the primitive and lit by the lights of the
+// scene (see impostor.vs.glsl and impostor.fs.glsl).
+class ImpostorAtlas
+{
+public:
+  static const size_t GRID_SIZE = 8; // Views per side of a layer
+  static const size_t VIEW_SIZE = 32; // Pixels per side of a view
+  static const size_t LAYER_SIZE = GRID_SIZE * VIEW_SIZE;
+  static const size_t MAX_IMPOSTORS = 64; // uImpostorSpheres of impostor.vs
+  // Primitives drawn by fewer instances get no impostor
+  static const size_t MIN_INSTANCES = 16;
+  // After the units of EnvironmentLighting
+  static const GLuint COLOR_UNIT = 20;
+  static const GLuint NORMAL_UNIT = 21;
+
+  ImpostorAtlas() = default;
+
+  ~ImpostorAtlas() { release(); }
+
+  // Non-copyable class:
+  ImpostorAtlas(const ImpostorAtlas &) = delete;
+  ImpostorAtlas &operator=(const ImpostorAtlas &) = delete;
+
+  ImpostorAtlas(ImpostorAtlas &&rvalue) { *this = std::move(rvalue); }
+  ImpostorAtlas &operator=(ImpostorAtlas &&rvalue);
+
+  // Object space direction from the center of a primitive to the camera of
+  // the view (x, y) of its layer
+  static glm::vec3 getViewDirection(size_t x, size_t y);
+
+  // Bake the impostors of the primitives of index impostorPrimitives in
+  // primitives (at most MAX_IMPOSTORS), whose object space bounds are
+  // boundsMin and boundsMax, indexed like primitives. program is
+  // impostor_bake.vs.glsl with impostor_bake.fs.glsl, the materials of the
+  // primitives must be bound (see MaterialBuffer::bind).
+  void bake(const GLProgram &program, const GeometryArena &arena,
+      const std::vector<ArenaPrimitive> &primitives,
+      const std::vector<glm::vec3> &boundsMin,
+      const std::vector<glm::vec3> &boundsMax,
+      const std::vector<uint32_t> &impostorPrimitives);
+
+  // Read the impostors of impostorPrimitives from cachePath (see
+  // writeCache), written for the same source. Return false without
+  // changing the atlas if it is missing, stale, or was written for other
+  // primitives.
+  bool readCache(const fs::path &cachePath, uint64_t sourceKey,
+      const std::vector<uint32_t> &impostorPrimitives);
+
+  // Write the first level of the layers in cachePath, with the key of the
+  // source of the scene (see computeSceneCacheKey). The file is written in a
+  // temporary file renamed at the end.
+  bool writeCache(const fs::path &cachePath, uint64_t sourceKey,
+      std::string &err) const;
+
+  // Layer of the impostor of an arena primitive, -1 if it has none
+  int layer(uint32_t primitive) const
+  {
+    return primitive < m_layers.size() ? m_layers[primitive] : -1;
+  }
+
+  size_t size() const { return m_impostors.size(); }
+
+  bool empty() const { return m_impostors.empty(); }
+
+  // Bind the layers and set the bounding spheres of the impostors in
+  // program, using impostor.vs.glsl
+  void bind(const GLProgram &program) const;
+
+  // Unbind what bind() bound
+  void unbind() const;
+
+private:
+  struct Impostor
+  {
+    uint32_t primitive; // In the arena primitives
+    glm::vec4 sphere; // Object space center and radius
+  };
+
+  // Create the layers of impostors and index them by primitive
+  void allocate(std::vector<Impostor> impostors);
+
+  void release();
+
+  std::vector<Impostor> m_impostors; // By layer
+  std::vector<int> m_layers; // By arena primitive
+  GLuint m_colors = 0; // RGBA8, base color and coverage
+  GLuint m_normals = 0; // RGBA8, normal * 0.5 + 0.5 and coverage
+  TrackedGLMemory m_memory;
+};
@@ -0,0 +1,344 @@
+#include "index_optimizer.hpp"
+#include "job_system.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace
+{
+
+const uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+
+// Scores of "Linear-speed vertex cache optimisation" (Tom Forsyth, 2006)
+const float LAST_TRIANGLE_SCORE = 0.75f;
+const float CACHE_DECAY_POWER = 1.5f;
+const float VALENCE_BOOST_SCALE = 2.f;
+const float VALENCE_BOOST_POWER = 0.5f;
+
+float getVertexScore(int cachePosition, uint32_t remainingTriangles)
+{
+  if (remainingTriangles == 0) {
+    return -1.f; // No triangle left to draw with this vertex
+  }
+  auto score = 0.f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3) {
+      // Vertices of the last triangle, used on purpose so that the next
+      // triangle does not share a single vertex with it
+      score = LAST_TRIANGLE_SCORE;
+    } else {
+      const auto scale = 1.f / (VERTEX_CACHE_SIZE - 3);
+      score = std::pow(1.f - (cachePosition - 3) * scale, CACHE_DECAY_POWER);
+    }
+  }
+  // Vertices with few triangles left are finished first
+  return score + VALENCE_BOOST_SCALE *
+                     std::pow(float(remainingTriangles), -VALENCE_BOOST_POWER);
+}
+
+// Misses of each triangle of indices in a FIFO cache
+std::vector<uint8_t> computeTriangleMisses(const uint32_t *indices,
+    size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+  // A vertex is in the cache if less than cacheSize vertices were inserted
+  // since its own insertion
+  std::vector<size_t> insertionTimes(vertexCount, 0);
+  auto time = cacheSize + 1;
+  std::vector<uint8_t> misses(indexCount / 3, 0);
+  for (size_t i = 0; i < indexCount / 3 * 3; ++i) {
+    const auto v = indices[i];
+    if (time - insertionTimes[v] > cacheSize) {
+      insertionTimes[v] = time++;
+      ++misses[i / 3];
+    }
+  }
+  return misses;
+}
+
+} // namespace
+
+float computeAcmr(const uint32_t *indices, size_t indexCount,
+    size_t vertexCount, size_t cacheSize)
+{
+  const auto misses =
+      computeTriangleMisses(indices, indexCount, vertexCount, cacheSize);
+  if (misses.empty()) {
+    return 0.f;
+  }
+  return float(std::accumulate(begin(misses), end(misses), size_t(0))) /
+         misses.size();
+}
+
+void optimizeVertexCache(
+    uint32_t *indices, size_t indexCount, size_t vertexCount)
+{
+  const auto triangleCount = indexCount / 3;
+  if (triangleCount < 2) {
+    return;
+  }
+
+  // Triangles of each vertex, remaining ones first
+  std::vector<uint32_t> remainingTriangles(vertexCount, 0);
+  for (size_t i = 0; i < triangleCount * 3; ++i) {
+    ++remainingTriangles[indices[i]];
+  }
+  std::vector<size_t> triangleOffsets(vertexCount + 1, 0);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    triangleOffsets[v + 1] = triangleOffsets[v] + remainingTriangles[v];
+  }
+  std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+  {
+    auto offsets = triangleOffsets;
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+      vertexTriangles[offsets[indices[i]]++] = uint32_t(i / 3);
+    }
+  }
+
+  std::vector<int> cachePositions(vertexCount, -1);
+  std::vector<float> vertexScores(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    vertexScores[v] = getVertexScore(-1, remainingTriangles[v]);
+  }
+  std::vector<float> triangleScores(triangleCount);
+  auto bestTriangle = INVALID_INDEX;
+  for (size_t t = 0; t < triangleCount; ++t) {
+    const auto tri = indices + 3 * t;
+    triangleScores[t] =
+        vertexScores[tri[0]] + vertexScores[tri[1]] + vertexScores[tri[2]];
+    if (bestTriangle == INVALID_INDEX ||
+        triangleScores[t] > triangleScores[bestTriangle]) {
+      bestTriangle = uint32_t(t);
+    }
+  }
+
+  std::vector<uint8_t> isEmitted(triangleCount, 0);
+  std::vector<uint32_t> output;
+  output.reserve(triangleCount * 3);
+  std::vector<uint32_t> cache, nextCache;
+  size_t nextInputTriangle = 0;
+  while (output.size() < triangleCount * 3) {
+    // Dead end: continue with the next triangle of the input order
+    if (bestTriangle == INVALID_INDEX) {
+      while (isEmitted[nextInputTriangle]) {
+        ++nextInputTriangle;
+      }
+      bestTriangle = uint32_t(nextInputTriangle);
+    }
+
+    const auto tri = indices + 3 * bestTriangle;
+    isEmitted[bestTriangle] = 1;
+    output.insert(end(output), tri, tri + 3);
+    for (size_t c = 0; c < 3; ++c) {
+      // Move the triangle out of the remaining triangles of its vertices
+      const auto v = tri[c];
+      const auto first = begin(vertexTriangles) + triangleOffsets[v];
+      const auto last = first + remainingTriangles[v];
+      std::iter_swap(std::find(first, last, bestTriangle), last - 1);
+      --remainingTriangles[v];
+    }
+
+    // Vertices of the triangle go to the front of the LRU cache
+    nextCache.assign(tri, tri + 3);
+    for (const auto v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2]) {
+        nextCache.push_back(v);
+      }
+    }
+    std::swap(cache, nextCache);
+    for (size_t i = 0; i < cache.size(); ++i) {
+      const auto v = cache[i];
+      cachePositions[v] = i < VERTEX_CACHE_SIZE ? int(i) : -1;
+      vertexScores[v] =
+          getVertexScore(cachePositions[v], remainingTriangles[v]);
+    }
+
+    // The next triangle is the best one using a vertex of the cache
+    bestTriangle = INVALID_INDEX;
+    auto bestScore = -std::numeric_limits<float>::max();
+    for (const auto v : cache) {
+      const auto first = begin(vertexTriangles) + triangleOffsets[v];
+      for (auto it = first; it != first + remainingTriangles[v]; ++it) {
+        const auto t = indices + 3 * *it;
+        triangleScores[*it] =
+            vertexScores[t[0]] + vertexScores[t[1]] + vertexScores[t[2]];
+        if (cachePositions[v] >= 0 && triangleScores[*it] > bestScore) {
+          bestScore = triangleScores[*it];
+          bestTriangle = *it;
+        }
+      }
+    }
+    if (cache.size() > VERTEX_CACHE_SIZE) {
+      cache.resize(VERTEX_CACHE_SIZE);
+    }
+  }
+
+  std::copy(begin(output), end(output), indices);
+}
+
+void optimizeOverdraw(uint32_t *indices, size_t indexCount,
+    const float *positions, size_t vertexCount, float threshold)
+{
+  const auto triangleCount = indexCount / 3;
+  if (triangleCount < 2) {
+    return;
+  }
+
+  const auto misses = computeTriangleMisses(
+      indices, indexCount, vertexCount, VERTEX_CACHE_SIZE);
+  const auto acmr =
+      float(std::accumulate(begin(misses), end(misses), size_t(0))) /
+      triangleCount;
+
+  // A cluster starts where every vertex misses the cache, or once the
+  // current cluster is large enough for the misses of a cold cache to raise
+  // its ACMR by at most threshold
+  auto minClusterSize = triangleCount;
+  if (threshold > 1.f && acmr > 0.f) {
+    minClusterSize = std::min(minClusterSize,
+        size_t(std::ceil(VERTEX_CACHE_SIZE / ((threshold - 1.f) * acmr))));
+  }
+  std::vector<size_t> clusterStarts;
+  for (size_t t = 0; t < triangleCount; ++t) {
+    if (t == 0 || misses[t] == 3 ||
+        t - clusterStarts.back() >= minClusterSize) {
+      clusterStarts.push_back(t);
+    }
+  }
+  clusterStarts.push_back(triangleCount);
+  const auto clusterCount = clusterStarts.size() - 1;
+  if (clusterCount < 2) {
+    return;
+  }
+
+  const auto position = [&](uint32_t v) {
+    return glm::vec3(
+        positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]);
+  };
+  std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0));
+  std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0));
+  auto meshCentroid = glm::vec3(0);
+  auto meshArea = 0.f;
+  for (size_t k = 0; k < clusterCount; ++k) {
+    auto area = 0.f;
+    for (auto t = clusterStarts[k]; t < clusterStarts[k + 1]; ++t) {
+      const auto p0 = position(indices[3 * t]);
+      const auto p1 = position(indices[3 * t + 1]);
+      const auto p2 = position(indices[3 * t + 2]);
+      const auto normal = glm::cross(p1 - p0, p2 - p0);
+      const auto triangleArea = glm::length(normal);
+      clusterCentroids[k] += triangleArea * (p0 + p1 + p2) / 3.f;
+      clusterNormals[k] += normal;
+      area += triangleArea;
+    }
+    meshCentroid += clusterCentroids[k];
+    meshArea += area;
+    if (area > 0.f) {
+      clusterCentroids[k] /= area;
+    }
+  }
+  if (meshArea > 0.f) {
+    meshCentroid /= meshArea;
+  }
+
+  // Clusters facing away from the center of the mesh come first
+  std::vector<float> sortKeys(clusterCount);
+  for (size_t k = 0; k < clusterCount; ++k) {
+    const auto length = glm::length(clusterNormals[k]);
+    sortKeys[k] = length > 0.f ? glm::dot(clusterCentroids[k] - meshCentroid,
+                                     clusterNormals[k] / length)
+                               : 0.f;
+  }
+  std::vector<size_t> order(clusterCount);
+  std::iota(begin(order), end(order), 0);
+  std::stable_sort(begin(order), end(order),
+      [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+  std::vector<uint32_t> output;
+  output.reserve(triangleCount * 3);
+  for (const auto k : order) {
+    output.insert(end(output), indices + 3 * clusterStarts[k],
+        indices + 3 * clusterStarts[k + 1]);
+  }
+  std::copy(begin(output), end(output), indices);
+}
+
+std::vector<uint32_t> optimizeVertexFetch(
+    uint32_t *indices, size_t indexCount, size_t vertexCount)
+{
+  std::vector<uint32_t> remap(vertexCount, INVALID_INDEX);
+  uint32_t nextVertex = 0;
+  for (size_t i = 0; i < indexCount; ++i) {
+    auto &newIndex = remap[indices[i]];
+    if (newIndex == INVALID_INDEX) {
+      newIndex = nextVertex++;
+    }
+    indices[i] = newIndex;
+  }
+  for (auto &newIndex : remap) {
+    if (newIndex == INVALID_INDEX) {
+      newIndex = nextVertex++;
+    }
+  }
+  return remap;
+}
+
+std::vector<OptimizedIndices> optimizeModelIndices(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers)
+{
+  std::vector<const tinygltf::Primitive *> primitives;
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      primitives.push_back(&primitive);
+    }
+  }
+
+  std::vector<OptimizedIndices> optimized(primitives.size());
+  getJobSystem().parallelFor(
+      primitives.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+        std::vector<float> positions;
+        for (auto i = beginIdx; i < endIdx; ++i) {
+          const auto &primitive = *primitives[i];
+          const auto it = primitive.attributes.find("POSITION");
+          if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+              it == end(primitive.attributes)) {
+            continue;
+          }
+          const auto &accessor = model.accessors[it->second];
+          const auto vertexCount = accessor.count;
+          std::vector<uint32_t> indices;
+          if (primitive.indices >= 0) {
+            const auto &indexAccessor = model.accessors[primitive.indices];
+            indices.resize(indexAccessor.count);
+            readAccessorAsUints(model, buffers, indexAccessor, indices.data());
+          } else {
+            indices.resize(vertexCount);
+            std::iota(begin(indices), end(indices), 0);
+          }
+          // Partial triangles and invalid indices are left as they are
+          if (indices.size() < 6 || indices.size() % 3 != 0 ||
+              std::any_of(begin(indices), end(indices),
+                  [&](uint32_t index) { return index >= vertexCount; })) {
+            continue;
+          }
+          positions.resize(3 * vertexCount);
+          readAccessorAsFloats(model, buffers, accessor, 3, positions.data());
+
+          auto &result = optimized[i];
+          result.acmrBefore =
+              computeAcmr(indices.data(), indices.size(), vertexCount);
+          optimizeVertexCache(indices.data(), indices.size(), vertexCount);
+          optimizeOverdraw(indices.data(), indices.size(), positions.data(),
+              vertexCount);
+          result.vertexRemap =
+              optimizeVertexFetch(indices.data(), indices.size(), vertexCount);
+          result.acmrAfter =
+              computeAcmr(indices.data(), indices.size(), vertexCount);
+          result.indices = std::move(indices);
+        }
+      });
+  return optimized;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Size of the post-transform vertex cache simulated by the optimizations
+const size_t VERTEX_CACHE_SIZE = 32;
+
+// Index buffer of a triangle primitive reordered for rendering, along with a
+// new order of its vertices. Empty if the primitive was not optimized.
+struct OptimizedIndices
+{
+  // Triangles of the primitive, referencing the reordered vertices
+  std::vector<uint32_t> indices;
+  // vertexRemap[i] is the new index of vertex i of the primitive
+  std::vector<uint32_t> vertexRemap;
+  // Average cache miss ratio (see computeAcmr) of the original indices and of
+  // indices
+  float acmrBefore = 0.f;
+  float acmrAfter = 0.f;
+};
+
+// Average number of cache misses per triangle of a FIFO post-transform cache
+// of cacheSize vertices: from 0.5 for ideal grids to 3 without any reuse
+float computeAcmr(const uint32_t *indices, size_t indexCount,
+    size_t vertexCount, size_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorder triangles so that consecutive triangles share vertices, with the
+// linear-speed vertex cache optimization of Tom Forsyth
+void optimizeVertexCache(
+    uint32_t *indices, size_t indexCount, size_t vertexCount);
+
+// Reorder clusters of triangles so that triangles facing outwards, which
+// likely occlude the others, are drawn first (after Sander et al., "Fast
+// triangle reordering for vertex locality and reduced overdraw"). Clusters
+// start where every vertex of a triangle misses the cache anyway, and once
+// they are large enough for the cold cache at their start to raise their ACMR
+// by at most threshold, so that the vertex cache optimization of indices is
+// mostly kept.
+void optimizeOverdraw(uint32_t *indices, size_t indexCount,
+    const float *positions, size_t vertexCount, float threshold = 1.05f);
+
+// Number vertices in the order of their first use by indices, unused ones
+// last, cutting cache misses of vertex fetches. Return the remap table (see
+// OptimizedIndices::vertexRemap) and rewrite indices with it.
+std::vector<uint32_t> optimizeVertexFetch(
+    uint32_t *indices, size_t indexCount, size_t vertexCount);
+
+// Run the three optimizations above on every triangle primitive of model, in
+// mesh order (see GeometryArena::layoutPrimitives), in parallel with the job
+// system
+std::vector<OptimizedIndices> optimizeModelIndices(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers);
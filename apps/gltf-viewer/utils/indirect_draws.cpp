@@ -0,0 +1,865 @@
+#include "indirect_draws.hpp"
+#include "bounds.hpp"
+#include "gl_extensions.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <tuple>
+
+namespace
+{
+
+// Cone of the draws that are never culled as back-facing
+const glm::vec4 NO_CONE = glm::vec4(0, 0, 1, 2);
+
+// Node of the draws that updateTransforms() leaves as they are
+const GLuint NO_NODE = ~GLuint(0);
+
+const GLuint GROUP_SIZE = 64; // local_size_x of update_draw_transforms.cs.glsl
+
+// local_size_x of cull_triangles.cs.glsl, one triangle per invocation
+const GLuint TRIANGLE_GROUP_SIZE = 128;
+
+// Work groups per row of the dispatches of cullTriangles(), the minimum
+// GL_MAX_COMPUTE_WORK_GROUP_COUNT
+const GLuint MAX_GROUP_ROW = 65535;
+
+IndirectDrawList::DrawSource getDrawSource(const ArenaPrimitive &primitive,
+    GLuint node, const glm::vec3 &bboxMin, const glm::vec3 &bboxMax)
+{
+  return {bboxMin, node, bboxMax, 0, glm::vec4(primitive.positionScale, 0),
+      glm::vec4(primitive.positionOffset, 0)};
+}
+
+// True if matrix is a rotation times a uniform positive scale, which keeps
+// normal cones
+bool isSimilarity(const glm::mat3 &matrix)
+{
+  const auto scale = glm::length(matrix[0]);
+  const auto tolerance = 1e-3f * scale;
+  return scale > 0.f && glm::determinant(matrix) > 0.f &&
+         std::abs(glm::length(matrix[1]) - scale) <= tolerance &&
+         std::abs(glm::length(matrix[2]) - scale) <= tolerance &&
+         std::abs(glm::dot(matrix[0], matrix[1])) <= tolerance * scale &&
+         std::abs(glm::dot(matrix[0], matrix[2])) <= tolerance * scale &&
+         std::abs(glm::dot(matrix[1], matrix[2])) <= tolerance * scale;
+}
+
+} // namespace
+
+IndirectDrawList &IndirectDrawList::operator=(IndirectDrawList &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_modes, rvalue.m_modes);
+    std::swap(m_isTransparent, rvalue.m_isTransparent);
+    std::swap(m_commands, rvalue.m_commands);
+    std::swap(m_transforms, rvalue.m_transforms);
+    std::swap(m_bounds, rvalue.m_bounds);
+    std::swap(m_materialIds, rvalue.m_materialIds);
+    std::swap(m_triangleDraws, rvalue.m_triangleDraws);
+    std::swap(m_sources, rvalue.m_sources);
+    std::swap(m_movingSources, rvalue.m_movingSources);
+    std::swap(m_nodeSourceOffsets, rvalue.m_nodeSourceOffsets);
+    std::swap(m_nodeSources, rvalue.m_nodeSources);
+    std::swap(m_updatedSources, rvalue.m_updatedSources);
+    std::swap(m_batches, rvalue.m_batches);
+    std::swap(m_uploadedDraws, rvalue.m_uploadedDraws);
+    std::swap(m_commandBuffer, rvalue.m_commandBuffer);
+    std::swap(m_transformBuffer, rvalue.m_transformBuffer);
+    std::swap(m_drawIdBuffer, rvalue.m_drawIdBuffer);
+    std::swap(m_materialIdBuffer, rvalue.m_materialIdBuffer);
+    std::swap(m_boundsBuffer, rvalue.m_boundsBuffer);
+    std::swap(m_culledCommandBuffer, rvalue.m_culledCommandBuffer);
+    std::swap(m_drawCountBuffer, rvalue.m_drawCountBuffer);
+    std::swap(
+        m_newlyVisibleCommandBuffer, rvalue.m_newlyVisibleCommandBuffer);
+    std::swap(
+        m_newlyVisibleDrawCountBuffer, rvalue.m_newlyVisibleDrawCountBuffer);
+    std::swap(m_visibilityBuffer, rvalue.m_visibilityBuffer);
+    std::swap(m_sourceBuffer, rvalue.m_sourceBuffer);
+    std::swap(m_geometryBuffer, rvalue.m_geometryBuffer);
+    std::swap(m_triangleDrawBuffer, rvalue.m_triangleDrawBuffer);
+    std::swap(m_culledIndexBuffer, rvalue.m_culledIndexBuffer);
+    std::swap(
+        m_culledTriangleCountBuffer, rvalue.m_culledTriangleCountBuffer);
+    std::swap(m_culledTriangleReadbackBuffer,
+        rvalue.m_culledTriangleReadbackBuffer);
+    std::swap(m_culledTriangleFence, rvalue.m_culledTriangleFence);
+    std::swap(m_nCulledTriangleCount, rvalue.m_nCulledTriangleCount);
+    std::swap(m_areTrianglesCulled, rvalue.m_areTrianglesCulled);
+    std::swap(m_memory, rvalue.m_memory);
+    std::swap(m_updateData, rvalue.m_updateData);
+    std::swap(m_isVertexPulling, rvalue.m_isVertexPulling);
+    std::swap(m_isTriangleCulling, rvalue.m_isTriangleCulling);
+  }
+  return *this;
+}
+
+void IndirectDrawList::clear()
+{
+  release();
+  m_modes.clear();
+  m_isTransparent.clear();
+  m_commands.clear();
+  m_transforms.clear();
+  m_bounds.clear();
+  m_materialIds.clear();
+  m_triangleDraws.clear();
+  m_sources.clear();
+  m_movingSources.clear();
+  m_nodeSourceOffsets.clear();
+  m_nodeSources.clear();
+  m_updatedSources.clear();
+  m_batches.clear();
+  m_uploadedDraws.clear();
+}
+
+void IndirectDrawList::add(const ArenaPrimitive &primitive,
+    const glm::mat4 &modelMatrix, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax, bool isTransparent,
+    const MovingNode *movingNode)
+{
+  if (!primitive.indexCount) {
+    return;
+  }
+
+  DrawElementsIndirectCommand command;
+  command.count = primitive.indexCount;
+  command.instanceCount = 1;
+  command.firstIndex = primitive.firstIndex;
+  command.baseVertex = primitive.baseVertex;
+  command.baseInstance = 0; // Set by upload()
+
+  m_modes.push_back(primitive.mode);
+  m_isTransparent.push_back(isTransparent ? 1 : 0);
+  m_commands.push_back(command);
+  m_transforms.push_back({modelMatrix * primitive.positionMatrix(),
+      glm::transpose(glm::inverse(modelMatrix))});
+  m_bounds.push_back(
+      {bboxMin, 0, bboxMax, 0, NO_CONE}); // Batch set by upload()
+  m_materialIds.push_back(primitive.materialID);
+  m_triangleDraws.push_back({NO_TRIANGLES, 0});
+  m_sources.push_back(movingNode
+                          ? getDrawSource(primitive, movingNode->node,
+                                movingNode->bboxMin, movingNode->bboxMax)
+                          : getDrawSource(primitive, NO_NODE, glm::vec3(0),
+                                glm::vec3(0)));
+}
+
+void IndirectDrawList::addMeshlets(const ArenaPrimitive &primitive,
+    const std::vector<Meshlet> &meshlets, const glm::mat4 &modelMatrix,
+    bool isTransparent, bool isSingleSided, int movingNode)
+{
+  // The cones of moving meshlets would have to move with them
+  const auto hasCones = isSingleSided && movingNode < 0 &&
+                        isSimilarity(glm::mat3(modelMatrix));
+  const auto node = movingNode >= 0 ? GLuint(movingNode) : NO_NODE;
+  // Moving nodes may mirror their meshlets, which flips their front faces
+  const GLuint isCullingBackFaces = isSingleSided && movingNode < 0 &&
+                                    glm::determinant(modelMatrix) > 0.f;
+  const DrawTransform transform = {modelMatrix * primitive.positionMatrix(),
+      glm::transpose(glm::inverse(modelMatrix))};
+  for (const auto &meshlet : meshlets) {
+    if (meshlet.firstIndex > primitive.indexCount ||
+        meshlet.indexCount > primitive.indexCount - meshlet.firstIndex) {
+      continue; // From a stale scene cache
+    }
+    DrawElementsIndirectCommand command;
+    command.count = meshlet.indexCount;
+    command.instanceCount = 1;
+    command.firstIndex = primitive.firstIndex + meshlet.firstIndex;
+    command.baseVertex = primitive.baseVertex;
+    command.baseInstance = 0; // Set by upload()
+
+    DrawBounds bounds = {glm::vec3(std::numeric_limits<float>::max()), 0,
+        glm::vec3(std::numeric_limits<float>::lowest()), 0, NO_CONE};
+    extendBoundsWithBox(meshlet.bboxMin, meshlet.bboxMax, modelMatrix,
+        bounds.bboxMin, bounds.bboxMax);
+    if (hasCones && meshlet.coneCutoff <= 1.f) {
+      bounds.cone = glm::vec4(
+          glm::normalize(glm::mat3(modelMatrix) * meshlet.coneAxis),
+          meshlet.coneCutoff);
+    }
+
+    m_modes.push_back(primitive.mode);
+    m_isTransparent.push_back(isTransparent ? 1 : 0);
+    m_commands.push_back(command);
+    m_transforms.push_back(transform);
+    m_bounds.push_back(bounds);
+    m_materialIds.push_back(primitive.materialID);
+    m_triangleDraws.push_back({0, isCullingBackFaces});
+    m_sources.push_back(
+        getDrawSource(primitive, node, meshlet.bboxMin, meshlet.bboxMax));
+  }
+}
+
+void IndirectDrawList::upload()
+{
+  release();
+  m_batches.clear();
+  m_movingSources.clear();
+  m_nodeSourceOffsets.clear();
+  m_nodeSources.clear();
+  m_updatedSources.clear();
+  if (m_commands.empty()) {
+    return;
+  }
+
+  // Meshlets of triangles whose command fits in a work group of
+  // cull_triangles.cs.glsl
+  std::vector<uint8_t> isTriangleCulled(m_commands.size(), 0);
+  if (m_isTriangleCulling) {
+    for (size_t i = 0; i < m_commands.size(); ++i) {
+      isTriangleCulled[i] = m_triangleDraws[i].firstIndex != NO_TRIANGLES &&
+                            m_modes[i] == GL_TRIANGLES &&
+                            m_commands[i].count <= 3 * TRIANGLE_GROUP_SIZE;
+    }
+  }
+
+  // Group commands by transparency, mode then triangle culling, keeping the
+  // scene order inside each group
+  std::vector<size_t> order(m_commands.size());
+  std::iota(begin(order), end(order), 0);
+  std::stable_sort(begin(order), end(order), [&](size_t lhs, size_t rhs) {
+    return std::make_tuple(
+               m_isTransparent[lhs], m_modes[lhs], isTriangleCulled[lhs]) <
+           std::make_tuple(
+               m_isTransparent[rhs], m_modes[rhs], isTriangleCulled[rhs]);
+  });
+
+  std::vector<DrawElementsIndirectCommand> commands;
+  std::vector<DrawTransform> transforms;
+  std::vector<DrawBounds> bounds;
+  std::vector<GLuint> materialIds;
+  std::vector<TriangleDraw> triangleDraws;
+  std::vector<DrawSource> sources;
+  std::vector<GLenum> modes;
+  std::vector<uint8_t> isTransparent;
+  m_uploadedDraws.resize(order.size());
+  commands.reserve(order.size());
+  transforms.reserve(order.size());
+  bounds.reserve(order.size());
+  materialIds.reserve(order.size());
+  triangleDraws.reserve(order.size());
+  sources.reserve(order.size());
+  modes.reserve(order.size());
+  isTransparent.reserve(order.size());
+  // Triangle culled draws write their kept indices to their own range of
+  // the culled indices, their index count
+  GLuint culledIndexCount = 0;
+  // GPU copy of triangleDraws, NO_TRIANGLES for the draws not culled
+  std::vector<TriangleDraw> uploadedTriangleDraws;
+  uploadedTriangleDraws.reserve(order.size());
+  for (const auto i : order) {
+    if (m_batches.empty() || m_batches.back().mode != m_modes[i] ||
+        m_batches.back().isTransparent != bool(m_isTransparent[i]) ||
+        m_batches.back().isTriangleCulled != bool(isTriangleCulled[i])) {
+      m_batches.push_back({m_modes[i], bool(m_isTransparent[i]),
+          bool(isTriangleCulled[i]), commands.size(), 0});
+    }
+    ++m_batches.back().count;
+    m_uploadedDraws[i] = GLuint(commands.size());
+    commands.push_back(m_commands[i]);
+    commands.back().baseInstance = GLuint(transforms.size());
+    transforms.push_back(m_transforms[i]);
+    bounds.push_back(m_bounds[i]);
+    bounds.back().batch = GLuint(m_batches.size() - 1);
+    bounds.back().batchBegin = GLuint(m_batches.back().begin);
+    materialIds.push_back(m_materialIds[i]);
+    triangleDraws.push_back(m_triangleDraws[i]);
+    uploadedTriangleDraws.push_back({NO_TRIANGLES, 0});
+    if (isTriangleCulled[i]) {
+      triangleDraws.back().firstIndex = culledIndexCount;
+      uploadedTriangleDraws.back() = triangleDraws.back();
+      culledIndexCount += m_commands[i].count;
+    }
+    sources.push_back(m_sources[i]);
+    sources.back().draw = GLuint(sources.size() - 1);
+    modes.push_back(m_modes[i]);
+    isTransparent.push_back(m_isTransparent[i]);
+  }
+  m_commands = std::move(commands);
+  m_transforms = std::move(transforms);
+  m_bounds = std::move(bounds);
+  m_materialIds = std::move(materialIds);
+  m_triangleDraws = std::move(triangleDraws);
+  m_sources = std::move(sources);
+  m_modes = std::move(modes);
+  m_isTransparent = std::move(isTransparent);
+
+  for (const auto &source : m_sources) {
+    if (source.node != NO_NODE) {
+      m_movingSources.push_back(source);
+    }
+  }
+  // Moving draws grouped by node, counted then placed
+  for (const auto &source : m_movingSources) {
+    if (source.node + 2 > m_nodeSourceOffsets.size()) {
+      m_nodeSourceOffsets.resize(source.node + 2, 0);
+    }
+    ++m_nodeSourceOffsets[source.node + 1];
+  }
+  std::partial_sum(begin(m_nodeSourceOffsets), end(m_nodeSourceOffsets),
+      begin(m_nodeSourceOffsets));
+  m_nodeSources.resize(m_movingSources.size());
+  auto nextSources = m_nodeSourceOffsets;
+  for (size_t i = 0; i < m_movingSources.size(); ++i) {
+    m_nodeSources[nextSources[m_movingSources[i].node]++] = GLuint(i);
+  }
+
+  std::vector<GLuint> drawIds(m_commands.size());
+  std::iota(begin(drawIds), end(drawIds), 0);
+  std::vector<DrawGeometry> geometries;
+  geometries.reserve(m_commands.size());
+  for (size_t i = 0; i < m_commands.size(); ++i) {
+    geometries.push_back({m_commands[i].firstIndex, m_commands[i].baseVertex,
+        m_materialIds[i], m_modes[i]});
+  }
+
+  GLuint buffers[11];
+  glGenBuffers(11, buffers);
+  m_commandBuffer = buffers[0];
+  m_transformBuffer = buffers[1];
+  m_drawIdBuffer = buffers[2];
+  m_boundsBuffer = buffers[3];
+  m_culledCommandBuffer = buffers[4];
+  m_drawCountBuffer = buffers[5];
+  m_newlyVisibleCommandBuffer = buffers[6];
+  m_newlyVisibleDrawCountBuffer = buffers[7];
+  m_visibilityBuffer = buffers[8];
+  m_materialIdBuffer = buffers[9];
+  m_geometryBuffer = buffers[10];
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+  glBufferStorage(GL_DRAW_INDIRECT_BUFFER,
+      m_commands.size() * sizeof(DrawElementsIndirectCommand),
+      m_commands.data(), 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_transformBuffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      m_transforms.size() * sizeof(DrawTransform), m_transforms.data(), 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glBindBuffer(GL_ARRAY_BUFFER, m_drawIdBuffer);
+  glBufferStorage(
+      GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint), drawIds.data(), 0);
+  glBindBuffer(GL_ARRAY_BUFFER, m_materialIdBuffer);
+  glBufferStorage(GL_ARRAY_BUFFER, m_materialIds.size() * sizeof(GLuint),
+      m_materialIds.data(), 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  // Only accessed by the GPU
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_geometryBuffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      geometries.size() * sizeof(DrawGeometry), geometries.data(), 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_boundsBuffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      m_bounds.size() * sizeof(DrawBounds), m_bounds.data(), 0);
+  for (const auto buffer :
+      {m_culledCommandBuffer, m_newlyVisibleCommandBuffer}) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+        m_commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, 0);
+  }
+  for (const auto buffer : {m_drawCountBuffer, m_newlyVisibleDrawCountBuffer}) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+        m_batches.size() * sizeof(GLuint), nullptr, 0);
+  }
+  // Everything is drawn by the first PreviouslyVisible phase
+  const std::vector<GLuint> visibility(m_commands.size(), 1);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visibilityBuffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      visibility.size() * sizeof(GLuint), visibility.data(), 0);
+  if (!m_movingSources.empty()) {
+    glGenBuffers(1, &m_sourceBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sourceBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+        m_movingSources.size() * sizeof(DrawSource), m_movingSources.data(),
+        0);
+  }
+  size_t triangleCullingBytes = 0;
+  if (culledIndexCount) {
+    triangleCullingBytes =
+        uploadedTriangleDraws.size() * sizeof(TriangleDraw) +
+        (culledIndexCount + 2) * sizeof(GLuint);
+    GLuint triangleBuffers[4];
+    glGenBuffers(4, triangleBuffers);
+    m_triangleDrawBuffer = triangleBuffers[0];
+    m_culledIndexBuffer = triangleBuffers[1];
+    m_culledTriangleCountBuffer = triangleBuffers[2];
+    m_culledTriangleReadbackBuffer = triangleBuffers[3];
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_triangleDrawBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+        uploadedTriangleDraws.size() * sizeof(TriangleDraw),
+        uploadedTriangleDraws.data(), 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_culledIndexBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+        culledIndexCount * sizeof(GLuint), nullptr, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_culledTriangleCountBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_culledTriangleReadbackBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr,
+        GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  m_memory = TrackedGLMemory(GLMemoryCategory::Buffers,
+      3 * m_commands.size() * sizeof(DrawElementsIndirectCommand) +
+          m_transforms.size() * sizeof(DrawTransform) +
+          m_bounds.size() * sizeof(DrawBounds) +
+          m_movingSources.size() * sizeof(DrawSource) +
+          geometries.size() * sizeof(DrawGeometry) +
+          triangleCullingBytes +
+          (drawIds.size() + m_materialIds.size() + visibility.size() +
+              2 * m_batches.size()) *
+              sizeof(GLuint));
+}
+
+void IndirectDrawList::updateTransforms(const GLProgram &program,
+    GLuint worldMatrixBuffer, const std::vector<uint32_t> &updatedNodes) const
+{
+  m_updatedSources.clear();
+  if (!m_sourceBuffer) {
+    return;
+  }
+  for (const auto node : updatedNodes) {
+    if (size_t(node) + 1 >= m_nodeSourceOffsets.size()) {
+      break;
+    }
+    m_updatedSources.insert(end(m_updatedSources),
+        begin(m_nodeSources) + m_nodeSourceOffsets[node],
+        begin(m_nodeSources) + m_nodeSourceOffsets[node + 1]);
+  }
+  if (m_updatedSources.empty()) {
+    return;
+  }
+
+  program.use();
+  program.getUniform<GLuint>("uSourceCount")
+      .set(GLuint(m_updatedSources.size()));
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_transformBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_sourceBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_boundsBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, worldMatrixBuffer);
+  GLint alignment = 0;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  m_updateData.beginFrame();
+  const auto size = m_updatedSources.size() * sizeof(GLuint);
+  const auto allocation = m_updateData.upload(m_updatedSources.data(), size,
+      std::max(size_t(alignment), sizeof(GLuint)));
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, allocation.buffer,
+      GLintptr(allocation.offset), GLsizeiptr(size));
+
+  glDispatchCompute(
+      GLuint((m_updatedSources.size() + GROUP_SIZE - 1) / GROUP_SIZE), 1, 1);
+  m_updateData.endFrame();
+  // Read by the vertex shaders and by cull()
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  for (GLuint binding = 0; binding <= 4; ++binding) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+  }
+}
+
+void IndirectDrawList::draw(const GeometryArena &arena, DrawSet set) const
+{
+  submit(arena, m_commandBuffer, 0, set);
+}
+
+void IndirectDrawList::cull(const GLProgram &cullProgram,
+    const glm::mat4 &viewProjMatrix, const glm::vec3 &cameraPosition,
+    CullPhase phase,
+    const DepthPyramid *depthPyramid) const
+{
+  if (m_batches.empty()) {
+    return;
+  }
+
+  const auto isNewlyVisible = phase == CullPhase::NewlyVisible;
+  const auto commandBuffer =
+      isNewlyVisible ? m_newlyVisibleCommandBuffer : m_culledCommandBuffer;
+  const auto drawCountBuffer =
+      isNewlyVisible ? m_newlyVisibleDrawCountBuffer : m_drawCountBuffer;
+  m_areTrianglesCulled[isNewlyVisible] = false;
+
+  if (getGLExtensions().indirectParameters) {
+    const GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCountBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0,
+        m_batches.size() * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT,
+        &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  }
+
+  const auto frustum = extractFrustum(viewProjMatrix);
+  cullProgram.use();
+  cullProgram.getUniform<GLuint>("uDrawCount").set(GLuint(m_commands.size()));
+  if (const auto planes = cullProgram.findUniform("uFrustumPlanes")) {
+    glUniform4fv(planes->location, 6, &frustum.planes[0].x);
+  }
+  cullProgram.getUniform<glm::vec3>("uCameraPosition").set(cameraPosition);
+  cullProgram.getUniform<GLuint>("uPhase").set(GLuint(phase));
+  cullProgram.getUniform<glm::mat4>("uViewProjMatrix").set(viewProjMatrix);
+  GLint texture = 0;
+  if (depthPyramid) {
+    cullProgram.getUniform<glm::vec2>("uDepthPyramidSize")
+        .set(glm::vec2(float(depthPyramid->width()),
+            float(depthPyramid->height())));
+    cullProgram.getUniform<GLint>("uDepthPyramidLevelCount")
+        .set(GLint(depthPyramid->levelCount()));
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    glBindTexture(GL_TEXTURE_2D, depthPyramid->texture());
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_commandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_boundsBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, commandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, drawCountBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_visibilityBuffer);
+
+  const GLuint groupSize = 64; // local_size_x of cull_draws.cs.glsl
+  glDispatchCompute(
+      GLuint((m_commands.size() + groupSize - 1) / groupSize), 1, 1);
+  // The visibility is read by the next cull()
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+  for (GLuint binding = 1; binding <= 5; ++binding) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+  }
+  if (depthPyramid) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+  }
+}
+
+void IndirectDrawList::cullTriangles(const GLProgram &program,
+    const GeometryArena &arena, const glm::mat4 &viewProjMatrix,
+    CullPhase phase) const
+{
+  if (!m_culledIndexBuffer) {
+    return;
+  }
+
+  const auto isNewlyVisible = phase == CullPhase::NewlyVisible;
+  const auto compact = getGLExtensions().indirectParameters;
+  // Counted from the first phase of the frame
+  if (!isNewlyVisible) {
+    const GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_culledTriangleCountBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0,
+        sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  }
+
+  GLint viewport[4] = {};
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  GLint sampleCount = 0;
+  glGetIntegerv(GL_SAMPLES, &sampleCount);
+  program.use();
+  program.getUniform<GLuint>("uDrawCount").set(GLuint(m_commands.size()));
+  program.getUniform<glm::mat4>("uViewProjMatrix").set(viewProjMatrix);
+  program.getUniform<glm::vec2>("uViewportSize")
+      .set(glm::vec2(float(viewport[2]), float(viewport[3])));
+  program.getUniform<GLuint>("uPixelCenterSamples")
+      .set(GLuint(sampleCount <= 1));
+  program.getUniform<GLuint>("uShortIndices")
+      .set(GLuint(arena.indexType() == GL_UNSIGNED_SHORT));
+  arena.bindVertexStorage();
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_transformBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_triangleDrawBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_boundsBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3,
+      isNewlyVisible ? m_newlyVisibleCommandBuffer : m_culledCommandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4,
+      compact ? (isNewlyVisible ? m_newlyVisibleDrawCountBuffer
+                                : m_drawCountBuffer)
+              : 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_culledIndexBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_culledTriangleCountBuffer);
+
+  const auto groupCount = GLuint(m_commands.size());
+  glDispatchCompute(std::min(groupCount, MAX_GROUP_ROW),
+      (groupCount + MAX_GROUP_ROW - 1) / MAX_GROUP_ROW, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT |
+                  GL_BUFFER_UPDATE_BARRIER_BIT);
+  m_areTrianglesCulled[isNewlyVisible] = true;
+
+  for (GLuint binding = 0; binding <= 6; ++binding) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+  }
+  arena.bindVertexStorage(false);
+
+  // Once per frame, unless the last count is still being read back
+  if (phase != CullPhase::PreviouslyVisible && !m_culledTriangleFence) {
+    glBindBuffer(GL_COPY_READ_BUFFER, m_culledTriangleCountBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_culledTriangleReadbackBuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+        sizeof(GLuint));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_culledTriangleFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+}
+
+size_t IndirectDrawList::culledTriangleCount() const
+{
+  if (!m_culledTriangleFence) {
+    return m_nCulledTriangleCount;
+  }
+  const auto status = glClientWaitSync(m_culledTriangleFence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    return m_nCulledTriangleCount;
+  }
+  glDeleteSync(m_culledTriangleFence);
+  m_culledTriangleFence = nullptr;
+  if (status == GL_WAIT_FAILED) {
+    std::cerr << "Error: IndirectDrawList - glClientWaitSync failed"
+              << std::endl;
+    return m_nCulledTriangleCount;
+  }
+
+  glBindBuffer(GL_COPY_READ_BUFFER, m_culledTriangleReadbackBuffer);
+  if (const auto *count = static_cast<const GLuint *>(glMapBufferRange(
+          GL_COPY_READ_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT))) {
+    m_nCulledTriangleCount = *count;
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  return m_nCulledTriangleCount;
+}
+
+void IndirectDrawList::drawCulled(
+    const GeometryArena &arena, CullPhase phase, DrawSet set) const
+{
+  const auto compact = getGLExtensions().indirectParameters;
+  if (phase == CullPhase::NewlyVisible) {
+    submit(arena, m_newlyVisibleCommandBuffer,
+        compact ? m_newlyVisibleDrawCountBuffer : 0, set,
+        m_areTrianglesCulled[1]);
+  } else {
+    submit(arena, m_culledCommandBuffer, compact ? m_drawCountBuffer : 0,
+        set, m_areTrianglesCulled[0]);
+  }
+}
+
+void IndirectDrawList::submit(const GeometryArena &arena,
+    GLuint commandBuffer, GLuint countBuffer, DrawSet set,
+    bool isTriangleCulled) const
+{
+  if (m_batches.empty()) {
+    return;
+  }
+
+  if (m_isVertexPulling) {
+    arena.bindIndices();
+    arena.bindVertexStorage();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,
+        GeometryArena::MATERIAL_ID_STORAGE_BINDING, m_materialIdBuffer);
+  } else {
+    arena.bindDrawIdBuffer(m_drawIdBuffer);
+    arena.bindMaterialIdBuffer(m_materialIdBuffer);
+    arena.bind();
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_transformBuffer);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+  if (countBuffer) {
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, countBuffer);
+  }
+
+  const auto &extensions = getGLExtensions();
+  for (size_t i = 0; i < m_batches.size(); ++i) {
+    const auto &batch = m_batches[i];
+    if (set != DrawSet::All &&
+        batch.isTransparent != (set == DrawSet::Transparent)) {
+      continue;
+    }
+    const auto offset =
+        (const GLvoid *)(batch.begin * sizeof(DrawElementsIndirectCommand));
+    // The culled indices replace those of the arena in the bound VAO
+    const auto readsCulledIndices = isTriangleCulled && batch.isTriangleCulled;
+    if (readsCulledIndices) {
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_culledIndexBuffer);
+    }
+    const auto indexType =
+        readsCulledIndices ? GLenum(GL_UNSIGNED_INT) : arena.indexType();
+    if (countBuffer) {
+      extensions.multiDrawElementsIndirectCount(batch.mode, indexType,
+          offset, GLintptr(i * sizeof(GLuint)), GLsizei(batch.count), 0);
+    } else {
+      glMultiDrawElementsIndirect(
+          batch.mode, indexType, offset, GLsizei(batch.count), 0);
+    }
+    if (readsCulledIndices) {
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.indexBuffer());
+    }
+  }
+
+  if (countBuffer) {
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glBindVertexArray(0);
+  if (m_isVertexPulling) {
+    arena.bindVertexStorage(false);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,
+        GeometryArena::MATERIAL_ID_STORAGE_BINDING, 0);
+  } else {
+    arena.bindDrawIdBuffer(0);
+    arena.bindMaterialIdBuffer(0);
+  }
+}
+
+void IndirectDrawList::capture(
+    const GeometryArena &arena, FrameCapture &capture, DrawSet set) const
+{
+  // Read size bytes at offset of buffer, less if it is smaller
+  const auto readBuffer = [](GLuint buffer, size_t offset, size_t size) {
+    std::vector<uint8_t> data;
+    if (!buffer) {
+      return data;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    GLint64 bufferSize = 0;
+    glGetBufferParameteri64v(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &bufferSize);
+    data.resize(std::min(size, size_t(std::max(bufferSize - GLint64(offset),
+                                   GLint64(0)))));
+    glGetBufferSubData(GL_COPY_READ_BUFFER, GLintptr(offset),
+        GLsizeiptr(data.size()), data.data());
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    return data;
+  };
+
+  // The VAO bound by submit()
+  arena.bindDrawIdBuffer(m_drawIdBuffer);
+  arena.bindMaterialIdBuffer(m_materialIdBuffer);
+  arena.bind();
+  capture.attributes.clear();
+  capture.bindings.clear();
+  GLint locationCount = 0;
+  glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &locationCount);
+  for (GLuint location = 0; location < GLuint(locationCount); ++location) {
+    const auto getAttribute = [&](GLenum name) {
+      GLint value = 0;
+      glGetVertexAttribiv(location, name, &value);
+      return value;
+    };
+    if (!getAttribute(GL_VERTEX_ATTRIB_ARRAY_ENABLED)) {
+      continue;
+    }
+    FrameCapture::Attribute attribute;
+    attribute.location = location;
+    attribute.size = getAttribute(GL_VERTEX_ATTRIB_ARRAY_SIZE);
+    attribute.type = GLenum(getAttribute(GL_VERTEX_ATTRIB_ARRAY_TYPE));
+    attribute.isNormalized =
+        GLuint(getAttribute(GL_VERTEX_ATTRIB_ARRAY_NORMALIZED));
+    attribute.isInteger = GLuint(getAttribute(GL_VERTEX_ATTRIB_ARRAY_INTEGER));
+    attribute.relativeOffset =
+        GLuint(getAttribute(GL_VERTEX_ATTRIB_RELATIVE_OFFSET));
+    attribute.binding = GLuint(getAttribute(GL_VERTEX_ATTRIB_BINDING));
+    capture.attributes.push_back(attribute);
+
+    // Interleaved attributes share their binding
+    const auto &bindings = capture.bindings;
+    if (std::any_of(begin(bindings), end(bindings),
+            [&](const FrameCapture::Binding &binding) {
+              return binding.index == attribute.binding;
+            })) {
+      continue;
+    }
+    GLint buffer = 0, stride = 0, divisor = 0;
+    GLint64 offset = 0;
+    glGetIntegeri_v(GL_VERTEX_BINDING_BUFFER, attribute.binding, &buffer);
+    glGetIntegeri_v(GL_VERTEX_BINDING_STRIDE, attribute.binding, &stride);
+    glGetIntegeri_v(GL_VERTEX_BINDING_DIVISOR, attribute.binding, &divisor);
+    glGetInteger64i_v(GL_VERTEX_BINDING_OFFSET, attribute.binding, &offset);
+    // The vertices of the arena, or one element per draw for the ids
+    const auto elementCount =
+        divisor ? m_commands.size() : arena.vertexCount();
+    FrameCapture::Binding binding;
+    binding.index = attribute.binding;
+    binding.stride = GLuint(stride);
+    binding.divisor = GLuint(divisor);
+    binding.data = readBuffer(
+        GLuint(buffer), size_t(offset), elementCount * size_t(stride));
+    capture.bindings.push_back(std::move(binding));
+  }
+  capture.indexType = arena.indexType();
+  capture.indices = readBuffer(
+      arena.indexBuffer(), 0, arena.indexCount() * arena.indexSize());
+  glBindVertexArray(0);
+  arena.bindDrawIdBuffer(0);
+  arena.bindMaterialIdBuffer(0);
+
+  capture.commands = readBuffer(m_commandBuffer, 0,
+      m_commands.size() * sizeof(DrawElementsIndirectCommand));
+  capture.drawTransforms = readBuffer(
+      m_transformBuffer, 0, m_transforms.size() * sizeof(DrawTransform));
+  capture.batches.clear();
+  for (const auto &batch : m_batches) {
+    if (set != DrawSet::All &&
+        batch.isTransparent != (set == DrawSet::Transparent)) {
+      continue;
+    }
+    capture.batches.push_back(
+        {batch.mode, GLuint(batch.begin), GLuint(batch.count)});
+  }
+}
+
+void IndirectDrawList::bindVisibilityResolve(
+    const GeometryArena &arena, bool bind) const
+{
+  arena.bindVertexStorage(bind);
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, 0, bind ? m_transformBuffer : 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_GEOMETRY_BINDING,
+      bind ? m_geometryBuffer : 0);
+}
+
+void IndirectDrawList::release()
+{
+  if (m_commandBuffer) {
+    const GLuint buffers[] = {m_commandBuffer, m_transformBuffer,
+        m_drawIdBuffer, m_boundsBuffer, m_culledCommandBuffer,
+        m_drawCountBuffer, m_newlyVisibleCommandBuffer,
+        m_newlyVisibleDrawCountBuffer, m_visibilityBuffer,
+        m_materialIdBuffer, m_geometryBuffer};
+    glDeleteBuffers(11, buffers);
+  }
+  if (m_sourceBuffer) {
+    glDeleteBuffers(1, &m_sourceBuffer);
+  }
+  if (m_triangleDrawBuffer) {
+    const GLuint buffers[] = {m_triangleDrawBuffer, m_culledIndexBuffer,
+        m_culledTriangleCountBuffer, m_culledTriangleReadbackBuffer};
+    glDeleteBuffers(4, buffers);
+  }
+  if (m_culledTriangleFence) {
+    glDeleteSync(m_culledTriangleFence);
+  }
+  m_commandBuffer = 0;
+  m_transformBuffer = 0;
+  m_drawIdBuffer = 0;
+  m_boundsBuffer = 0;
+  m_culledCommandBuffer = 0;
+  m_drawCountBuffer = 0;
+  m_newlyVisibleCommandBuffer = 0;
+  m_newlyVisibleDrawCountBuffer = 0;
+  m_visibilityBuffer = 0;
+  m_materialIdBuffer = 0;
+  m_geometryBuffer = 0;
+  m_sourceBuffer = 0;
+  m_triangleDrawBuffer = 0;
+  m_culledIndexBuffer = 0;
+  m_culledTriangleCountBuffer = 0;
+  m_culledTriangleReadbackBuffer = 0;
+  m_culledTriangleFence = nullptr;
+  m_nCulledTriangleCount = 0;
+  m_areTrianglesCulled[0] = false;
+  m_areTrianglesCulled[1] = false;
+  m_memory = TrackedGLMemory();
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+#include "depth_pyramid.hpp"
+#include "frame_capture.hpp"
+#include "frustum.hpp"
+#include "geometry_arena.hpp"
+#include "meshlets.hpp"
+#include "ring_buffer.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Layout of the commands read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+// List of draws of primitives stored in a GeometryArena, submitted with one
+// glMultiDrawElementsIndirect per primitive mode, opaque and transparent draws
+// apart (see DrawSet).
+//
+// Each draw has model and normal matrices stored in a shader storage buffer
+// (binding 0, see forward_indirect.vs.glsl). The draw index is given to the
+// vertex shader by the GeometryArena::DRAW_ID_LOCATION instanced attribute:
+// its buffer contains 0, 1, ..., drawCount - 1 and each command uses its
+// index as baseInstance, so the attribute fetched for a draw is its index.
+// This does not require ARB_shader_draw_parameters. The material of each
+// draw (see ArenaPrimitive::materialID) is given the same way by the
+// GeometryArena::MATERIAL_ID_LOCATION attribute, so draws of different
+// materials share a command buffer.
+//
+// cull() removes the draws outside of the view frustum in a compute pass
+// (cull_draws.cs.glsl) reading the world bounds of each draw, so that culling
+// costs nothing per draw on the CPU. With ARB_indirect_parameters the visible
+// commands are compacted and their count is read by
+// glMultiDrawElementsIndirectCount.
+//
+// Occlusion culling is done in two phases (see CullPhase) so that draws
+// appearing from behind occluders are drawn in the frame where they appear.
+// Each draw keeps its visibility of the previous frame on the GPU.
+//
+// Large primitives can be added as one draw per meshlet (see addMeshlets),
+// which are also culled when they face away from the camera. With
+// setTriangleCulling, cullTriangles() then culls their triangles one by one
+// after cull(): those facing away from the camera or too small to cover a
+// pixel center are left out of a copy of the indices of each kept meshlet,
+// which drawCulled() draws instead of the indices of the arena. Meshlets are
+// small enough for a work group to test all of their triangles.
+//
+// With vertex pulling (see setVertexPulling), the vertex shader fetches the
+// vertices from the streams of the GeometryArena bound as storage buffers,
+// and the draw index from gl_BaseInstanceARB: the VAO of the draws only
+// holds the index buffer, and no attribute is sourced per draw.
+//
+// Draws of animated nodes can follow the world matrices of a
+// GpuTransformHierarchy: updateTransforms() rewrites their matrices and
+// bounds in a compute pass, so that neither is computed per draw on the CPU.
+// Only the draws of the nodes that moved are rewritten, their indices are
+// the only per frame upload.
+class IndirectDrawList
+{
+public:
+  // Per draw data, matches DrawTransform in forward_indirect.vs.glsl
+  struct DrawTransform
+  {
+    glm::mat4 modelMatrix;
+    glm::mat4 normalMatrix;
+  };
+
+  // Per draw bounds, matches DrawBounds in cull_draws.cs.glsl
+  struct DrawBounds
+  {
+    glm::vec3 bboxMin;
+    GLuint batch;
+    glm::vec3 bboxMax;
+    GLuint batchBegin;
+    // World space normal cone, axis and cutoff (see Meshlet), a cutoff
+    // above 1 never culls
+    glm::vec4 cone;
+  };
+
+  // Per draw triangle culling, matches TriangleDraw in
+  // cull_triangles.cs.glsl
+  struct TriangleDraw
+  {
+    GLuint firstIndex; // In the culled indices, NO_TRIANGLES if not culled
+    GLuint isSingleSided;
+  };
+
+  static const GLuint NO_TRIANGLES = ~GLuint(0);
+
+  // Per draw geometry, matches DrawGeometry in visibility_resolve.fs.glsl
+  struct DrawGeometry
+  {
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint materialID;
+    GLenum mode;
+  };
+
+  // Shader storage binding of the DrawGeometry buffer, see
+  // bindVisibilityResolve
+  static const GLuint DRAW_GEOMETRY_BINDING = 13;
+
+  // Node of a GpuTransformHierarchy moving a draw, with the object space
+  // bounds of the draw, never culled if they are empty (min > max)
+  struct MovingNode
+  {
+    GLuint node;
+    glm::vec3 bboxMin;
+    glm::vec3 bboxMax;
+  };
+
+  // Per moving draw data, matches DrawSource in update_draw_transforms.cs.glsl
+  struct DrawSource
+  {
+    glm::vec3 bboxMin;
+    GLuint node;
+    glm::vec3 bboxMax;
+    GLuint draw; // Index of the draw after upload()
+    glm::vec4 positionScale; // See ArenaPrimitive::positionMatrix
+    glm::vec4 positionOffset;
+  };
+
+  IndirectDrawList() = default;
+
+  ~IndirectDrawList() { release(); }
+
+  // Non-copyable class:
+  IndirectDrawList(const IndirectDrawList &) = delete;
+  IndirectDrawList &operator=(const IndirectDrawList &) = delete;
+
+  IndirectDrawList(IndirectDrawList &&rvalue) { *this = std::move(rvalue); }
+
+  IndirectDrawList &operator=(IndirectDrawList &&rvalue);
+
+  // Remove all draws, upload() must be called again before draw()
+  void clear();
+
+  // Add a draw of primitive with modelMatrix, whose world space bounds are
+  // [bboxMin, bboxMax]. isTransparent is true if its material is blended.
+  // If movingNode is not null, updateTransforms() replaces the matrix and
+  // bounds by those of the node.
+  void add(const ArenaPrimitive &primitive, const glm::mat4 &modelMatrix,
+      const glm::vec3 &bboxMin, const glm::vec3 &bboxMax,
+      bool isTransparent = false, const MovingNode *movingNode = nullptr);
+
+  // Add a draw per meshlet of primitive (see buildMeshlets) instead of a
+  // single draw. Meshlets facing away from the camera are culled if
+  // isSingleSided, as glTF specifies for single-sided materials, and if
+  // modelMatrix keeps angles and orientation. If movingNode is not -1, the
+  // meshlets follow that node of a GpuTransformHierarchy as in add(), and
+  // are never culled as back-facing.
+  void addMeshlets(const ArenaPrimitive &primitive,
+      const std::vector<Meshlet> &meshlets, const glm::mat4 &modelMatrix,
+      bool isTransparent, bool isSingleSided, int movingNode = -1);
+
+  // Create GL buffers for the draws added so far
+  void upload();
+
+  // Recompute the matrices and bounds of the moving draws of updatedNodes
+  // (flat indices in increasing order, see
+  // GpuTransformHierarchy::updatedNodes) from worldMatrixBuffer (see
+  // GpuTransformHierarchy::worldMatrixBuffer), for the next draw() and
+  // cull(). program is update_draw_transforms.cs.glsl. This binds program.
+  void updateTransforms(const GLProgram &program, GLuint worldMatrixBuffer,
+      const std::vector<uint32_t> &updatedNodes) const;
+
+  // Number of draws updateTransforms() may update
+  size_t movingDrawCount() const { return m_movingSources.size(); }
+
+  // Number of draws updated by the last updateTransforms()
+  size_t updatedDrawCount() const { return m_updatedSources.size(); }
+
+  // Draws submitted by draw() and drawCulled()
+  enum class DrawSet
+  {
+    All,
+    Opaque,
+    Transparent
+  };
+
+  // Pull vertices from storage buffers in the next draws, the program must
+  // be compiled with VERTEX_PULLING (see vertex_attributes.glsl). Requires
+  // getGLExtensions().shaderDrawParameters.
+  void setVertexPulling(bool enabled) { m_isVertexPulling = enabled; }
+
+  bool isVertexPulling() const { return m_isVertexPulling; }
+
+  // Let cullTriangles() cull the triangles of the meshlets of the next
+  // upload(). Not for the visibility buffer, whose triangle ids index the
+  // indices of the arena.
+  void setTriangleCulling(bool enabled) { m_isTriangleCulling = enabled; }
+
+  bool isTriangleCulling() const { return m_isTriangleCulling; }
+
+  // Submit the draws of set. The program using forward_indirect.vs.glsl
+  // must be bound.
+  void draw(const GeometryArena &arena, DrawSet set = DrawSet::All) const;
+
+  enum class CullPhase
+  {
+    // Only keep the draws inside the view frustum
+    Frustum,
+    // Keep the draws inside the view frustum that were visible in the
+    // previous frame, their depth is then used to build a DepthPyramid
+    PreviouslyVisible,
+    // Test every draw inside the frustum against the DepthPyramid, remember
+    // the result for the next frame and keep the visible draws that
+    // PreviouslyVisible did not keep
+    NewlyVisible
+  };
+
+  // Cull the draws on the GPU for the next drawCulled(phase), viewProjMatrix
+  // transforms world space to clip space and cameraPosition is the world
+  // space position of the camera. cullProgram is cull_draws.cs.glsl,
+  // compiled with COMPACT_DRAWS iff getGLExtensions().indirectParameters is
+  // true and with OCCLUSION_CULLING for phases other than Frustum.
+  // depthPyramid is only read by NewlyVisible. This binds cullProgram.
+  void cull(const GLProgram &cullProgram, const glm::mat4 &viewProjMatrix,
+      const glm::vec3 &cameraPosition, CullPhase phase = CullPhase::Frustum,
+      const DepthPyramid *depthPyramid = nullptr) const;
+
+  // Cull the triangles of the meshlets kept by the last cull(phase), for
+  // the viewport and samples of the bound draw framebuffer. The commands of
+  // the meshlets then draw their visible triangles. program is
+  // cull_triangles.cs.glsl, compiled with COMPACT_DRAWS as cullProgram and
+  // with QUANTIZED_VERTICES if arena has quantized vertices. This binds
+  // program. Does nothing without setTriangleCulling.
+  void cullTriangles(const GLProgram &program, const GeometryArena &arena,
+      const glm::mat4 &viewProjMatrix,
+      CullPhase phase = CullPhase::Frustum) const;
+
+  // Triangles culled by cullTriangles() in the last frame whose count was
+  // read back, a few frames ago since readbacks never wait for the GPU.
+  // Frames start with a Frustum or PreviouslyVisible phase.
+  size_t culledTriangleCount() const;
+
+  // Same as draw(), but only submit the draws kept by the last cull(phase)
+  void drawCulled(const GeometryArena &arena,
+      CullPhase phase = CullPhase::Frustum, DrawSet set = DrawSet::All) const;
+
+  // Fill the draws of capture with those of set as draw() submits them:
+  // the attributes of the VAO of arena and the contents of their buffers,
+  // the indices, every command (culling is not captured) and the
+  // transforms. Reads the buffers back, for a frame capture only. Not with
+  // vertex pulling.
+  void capture(const GeometryArena &arena, FrameCapture &capture,
+      DrawSet set = DrawSet::All) const;
+
+  // Bind the buffers read by visibility_resolve.fs.glsl to find the
+  // triangles written in a visibility buffer by the draws (with
+  // setVertexPulling): the matrices and DrawGeometry of the draws, the
+  // vertex streams and indices of arena. Unbind them if bind is false.
+  void bindVisibilityResolve(
+      const GeometryArena &arena, bool bind = true) const;
+
+  size_t drawCount() const { return m_transforms.size(); }
+
+  // Index after upload() of the draw added at index drawIdx (drawCount()
+  // before adding it), e.g. in boundsBuffer()
+  GLuint uploadedDrawIndex(size_t drawIdx) const
+  {
+    return m_uploadedDraws[drawIdx];
+  }
+
+  // DrawBounds of the draws read by cull(), written by the GPU only (see
+  // updateTransforms and GpuBounds::reduce)
+  GLuint boundsBuffer() const { return m_boundsBuffer; }
+
+  // Number of glMultiDrawElementsIndirect calls issued by draw()
+  size_t batchCount() const { return m_batches.size(); }
+
+private:
+  // Draws sharing the same mode, transparency and triangle culling, a range
+  // of m_commands
+  struct Batch
+  {
+    GLenum mode;
+    bool isTransparent;
+    bool isTriangleCulled;
+    size_t begin;
+    size_t count;
+  };
+
+  void release();
+
+  // Submit the batches of set reading commands from commandBuffer, and their
+  // counts from countBuffer if it is not 0. The triangle culled batches read
+  // the culled indices if isTriangleCulled.
+  void submit(const GeometryArena &arena, GLuint commandBuffer,
+      GLuint countBuffer, DrawSet set, bool isTriangleCulled = false) const;
+
+  std::vector<GLenum> m_modes; // One per command before upload()
+  std::vector<uint8_t> m_isTransparent; // One per command before upload()
+  std::vector<DrawElementsIndirectCommand> m_commands;
+  std::vector<DrawTransform> m_transforms;
+  std::vector<DrawBounds> m_bounds;
+  std::vector<GLuint> m_materialIds;
+  // One per command, the firstIndex of meshlets is 0 before upload()
+  std::vector<TriangleDraw> m_triangleDraws;
+  // One per command before upload(), node is NO_NODE for static draws
+  std::vector<DrawSource> m_sources;
+  std::vector<DrawSource> m_movingSources; // Built by upload()
+  // Indices in m_movingSources of the draws of node n, in
+  // [m_nodeSourceOffsets[n], m_nodeSourceOffsets[n + 1]) of m_nodeSources
+  std::vector<GLuint> m_nodeSourceOffsets;
+  std::vector<GLuint> m_nodeSources;
+  mutable std::vector<GLuint> m_updatedSources; // Of updateTransforms()
+  std::vector<Batch> m_batches;
+  std::vector<GLuint> m_uploadedDraws; // Built by upload()
+
+  GLuint m_commandBuffer = 0;
+  GLuint m_transformBuffer = 0;
+  GLuint m_drawIdBuffer = 0;
+  GLuint m_materialIdBuffer = 0;
+  GLuint m_boundsBuffer = 0;
+  // Outputs of cull(), the NewlyVisible phase has its own since it runs
+  // while the draws of the PreviouslyVisible phase may still be pending
+  GLuint m_culledCommandBuffer = 0;
+  GLuint m_drawCountBuffer = 0; // One GLuint per batch
+  GLuint m_newlyVisibleCommandBuffer = 0;
+  GLuint m_newlyVisibleDrawCountBuffer = 0;
+  GLuint m_visibilityBuffer = 0; // One GLuint per draw, initially 1
+  GLuint m_sourceBuffer = 0; // m_movingSources, 0 if there are none
+  GLuint m_geometryBuffer = 0; // One DrawGeometry per draw
+  // Outputs of cullTriangles(), 0 without triangle culled draws
+  GLuint m_triangleDrawBuffer = 0; // One TriangleDraw per draw
+  GLuint m_culledIndexBuffer = 0; // 32-bit indices
+  GLuint m_culledTriangleCountBuffer = 0;
+  GLuint m_culledTriangleReadbackBuffer = 0;
+  mutable GLsync m_culledTriangleFence = nullptr;
+  mutable size_t m_nCulledTriangleCount = 0;
+  // Per phase buffer (PreviouslyVisible and Frustum share one), true if
+  // cullTriangles() ran since the last cull()
+  mutable bool m_areTrianglesCulled[2] = {};
+  TrackedGLMemory m_memory; // Of all buffers
+  mutable RingBuffer m_updateData; // m_updatedSources
+  bool m_isVertexPulling = false;
+  bool m_isTriangleCulling = false;
+};
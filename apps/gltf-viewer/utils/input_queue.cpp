@@ -0,0 +1,117 @@
+#include "input_queue.hpp"
+#include "glfw.hpp"
+
+#include <utility>
+
+namespace
+{
+
+glm::dvec2 getCursorPosition(GLFWwindow *window)
+{
+  glm::dvec2 position;
+  glfwGetCursorPos(window, &position.x, &position.y);
+  return position;
+}
+
+} // namespace
+
+InputQueue::InputQueue(GLFWwindow *window) : m_pWindow(window)
+{
+  if (!m_pWindow) {
+    return;
+  }
+  m_pPreviousUserPointer = glfwGetWindowUserPointer(m_pWindow);
+  glfwSetWindowUserPointer(m_pWindow, this);
+  m_previousKeyCallback = glfwSetKeyCallback(m_pWindow, onKey);
+  m_previousMouseButtonCallback =
+      glfwSetMouseButtonCallback(m_pWindow, onMouseButton);
+  m_previousCursorPositionCallback =
+      glfwSetCursorPosCallback(m_pWindow, onCursorPosition);
+  m_previousScrollCallback = glfwSetScrollCallback(m_pWindow, onScroll);
+  m_previousFramebufferSizeCallback =
+      glfwSetFramebufferSizeCallback(m_pWindow, onFramebufferSize);
+}
+
+InputQueue::~InputQueue()
+{
+  if (!m_pWindow) {
+    return;
+  }
+  glfwSetKeyCallback(m_pWindow, m_previousKeyCallback);
+  glfwSetMouseButtonCallback(m_pWindow, m_previousMouseButtonCallback);
+  glfwSetCursorPosCallback(m_pWindow, m_previousCursorPositionCallback);
+  glfwSetScrollCallback(m_pWindow, m_previousScrollCallback);
+  glfwSetFramebufferSizeCallback(
+      m_pWindow, m_previousFramebufferSizeCallback);
+  glfwSetWindowUserPointer(m_pWindow, m_pPreviousUserPointer);
+}
+
+std::vector<InputEvent> InputQueue::takeEvents()
+{
+  std::vector<InputEvent> events;
+  std::swap(events, m_events);
+  return events;
+}
+
+void InputQueue::onKey(
+    GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+  auto &queue = *static_cast<InputQueue *>(glfwGetWindowUserPointer(window));
+  queue.push(InputEvent::Type::Key, key, action, getCursorPosition(window));
+  if (queue.m_previousKeyCallback) {
+    queue.m_previousKeyCallback(window, key, scancode, action, mods);
+  }
+}
+
+void InputQueue::onMouseButton(
+    GLFWwindow *window, int button, int action, int mods)
+{
+  auto &queue = *static_cast<InputQueue *>(glfwGetWindowUserPointer(window));
+  queue.push(InputEvent::Type::MouseButton, button, action,
+      getCursorPosition(window));
+  if (queue.m_previousMouseButtonCallback) {
+    queue.m_previousMouseButtonCallback(window, button, action, mods);
+  }
+}
+
+void InputQueue::onCursorPosition(GLFWwindow *window, double x, double y)
+{
+  auto &queue = *static_cast<InputQueue *>(glfwGetWindowUserPointer(window));
+  queue.push(InputEvent::Type::CursorPosition, 0, 0, glm::dvec2(x, y));
+  if (queue.m_previousCursorPositionCallback) {
+    queue.m_previousCursorPositionCallback(window, x, y);
+  }
+}
+
+void InputQueue::onScroll(GLFWwindow *window, double x, double y)
+{
+  auto &queue = *static_cast<InputQueue *>(glfwGetWindowUserPointer(window));
+  queue.push(InputEvent::Type::Scroll, 0, 0, getCursorPosition(window));
+  queue.m_events.back().scrollOffset = glm::dvec2(x, y);
+  if (queue.m_previousScrollCallback) {
+    queue.m_previousScrollCallback(window, x, y);
+  }
+}
+
+void InputQueue::onFramebufferSize(GLFWwindow *window, int width, int height)
+{
+  auto &queue = *static_cast<InputQueue *>(glfwGetWindowUserPointer(window));
+  queue.push(
+      InputEvent::Type::FramebufferSize, 0, 0, getCursorPosition(window));
+  queue.m_events.back().framebufferSize = glm::ivec2(width, height);
+  if (queue.m_previousFramebufferSizeCallback) {
+    queue.m_previousFramebufferSizeCallback(window, width, height);
+  }
+}
+
+void InputQueue::push(InputEvent::Type type, int code, int action,
+    const glm::dvec2 &cursorPosition)
+{
+  InputEvent event;
+  event.type = type;
+  event.time = glfwGetTime();
+  event.code = code;
+  event.action = action;
+  event.cursorPosition = cursorPosition;
+  m_events.push_back(event);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct GLFWwindow;
+
+// Keyboard, mouse or resize event of a window, as received by a GLFW
+// callback
+struct InputEvent
+{
+  enum class Type
+  {
+    Key,
+    MouseButton,
+    CursorPosition,
+    Scroll,
+    FramebufferSize
+  };
+
+  Type type = Type::Key;
+  double time = 0.; // glfwGetTime() when the event was received
+  int code = 0; // GLFW key or mouse button
+  int action = 0; // GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT
+  glm::dvec2 cursorPosition = glm::dvec2(0); // When the event was received
+  glm::dvec2 scrollOffset = glm::dvec2(0); // Of Scroll events
+  // Of FramebufferSize events, in pixels, 0 x 0 when the window is minimized
+  glm::ivec2 framebufferSize = glm::ivec2(0);
+};
+
+// Events of a window recorded by GLFW callbacks while events are polled or
+// waited for, so that consumers see every cursor position at the rate of
+// the mouse and how long keys were held, rather than the state of the
+// window once per frame.
+//
+// The callbacks installed before the queue, like those of ImGui, keep being
+// called, and are installed back when the queue is destroyed. The queue
+// holds the user pointer of the window for its lifetime.
+class InputQueue
+{
+public:
+  // window may be null (headless), no event is then recorded
+  explicit InputQueue(GLFWwindow *window);
+
+  ~InputQueue();
+
+  InputQueue(const InputQueue &) = delete;
+  InputQueue &operator=(const InputQueue &) = delete;
+
+  // Events received since the last call, oldest first
+  std::vector<InputEvent> takeEvents();
+
+private:
+  using KeyCallback = void (*)(GLFWwindow *, int, int, int, int);
+  using MouseButtonCallback = void (*)(GLFWwindow *, int, int, int);
+  using CursorPositionCallback = void (*)(GLFWwindow *, double, double);
+  using ScrollCallback = void (*)(GLFWwindow *, double, double);
+  using FramebufferSizeCallback = void (*)(GLFWwindow *, int, int);
+
+  static void onKey(
+      GLFWwindow *window, int key, int scancode, int action, int mods);
+  static void onMouseButton(
+      GLFWwindow *window, int button, int action, int mods);
+  static void onCursorPosition(GLFWwindow *window, double x, double y);
+  static void onScroll(GLFWwindow *window, double x, double y);
+  static void onFramebufferSize(GLFWwindow *window, int width, int height);
+
+  void push(InputEvent::Type type, int code, int action,
+      const glm::dvec2 &cursorPosition);
+
+  GLFWwindow *m_pWindow = nullptr;
+  void *m_pPreviousUserPointer = nullptr;
+  KeyCallback m_previousKeyCallback = nullptr;
+  MouseButtonCallback m_previousMouseButtonCallback = nullptr;
+  CursorPositionCallback m_previousCursorPositionCallback = nullptr;
+  ScrollCallback m_previousScrollCallback = nullptr;
+  FramebufferSizeCallback m_previousFramebufferSizeCallback = nullptr;
+  std::vector<InputEvent> m_events;
+};
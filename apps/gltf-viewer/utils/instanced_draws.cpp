@@ -0,0 +1,218 @@
+#include "instanced_draws.hpp"
+#include "impostors.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// Draws written by each job of InstancedDrawList::writeInstances, at least
+const size_t MIN_DRAWS_PER_JOB = 4096;
+
+// Phase in [0, 1) of the vertex animation of the instances of a node: the
+// golden ratio sequence spreads the phases of consecutive nodes evenly
+float getInstancePhase(uint32_t matrix)
+{
+  const auto phase = double(matrix) * 0.6180339887498949;
+  return float(phase - std::floor(phase));
+}
+
+} // namespace
+
+void InstancedDrawList::build(const std::vector<uint32_t> &drawPrimitives,
+    const std::vector<uint32_t> &drawMatrices)
+{
+  m_batches.clear();
+  m_draws.clear();
+  if (drawPrimitives.empty()) {
+    return;
+  }
+
+  // Counting sort of the draws by primitive, keeping the scene order inside
+  // each batch
+  const auto primitiveCount =
+      size_t(*std::max_element(begin(drawPrimitives), end(drawPrimitives))) +
+      1;
+  std::vector<size_t> offsets(primitiveCount + 1, 0);
+  for (const auto primitiveIdx : drawPrimitives) {
+    ++offsets[primitiveIdx + 1];
+  }
+  for (size_t primitiveIdx = 0; primitiveIdx < primitiveCount;
+       ++primitiveIdx) {
+    const auto count = offsets[primitiveIdx + 1];
+    if (count) {
+      m_batches.push_back(
+          {uint32_t(primitiveIdx), offsets[primitiveIdx], count});
+    }
+    offsets[primitiveIdx + 1] += offsets[primitiveIdx];
+  }
+  m_draws.resize(drawPrimitives.size());
+  for (size_t drawIdx = 0; drawIdx < drawPrimitives.size(); ++drawIdx) {
+    m_draws[offsets[drawPrimitives[drawIdx]]++] = {
+        uint32_t(drawIdx), drawMatrices[drawIdx]};
+  }
+}
+
+template <typename IsBatchDrawn, typename GetTransform>
+RingBuffer::Allocation InstancedDrawList::writeInstances(
+    const std::vector<uint8_t> &isDrawVisible, IsBatchDrawn &&isBatchDrawn,
+    GetTransform &&getTransform, RingBuffer &ring,
+    std::vector<size_t> &firstInstances) const
+{
+  // Chunks of m_draws count their visible draws, then write them from the
+  // offset of the chunk: the instances keep the order of m_draws, so the
+  // chunk holding the first draw of a batch also sets its first instance
+  auto &jobSystem = getJobSystem();
+  const auto chunkSize =
+      jobSystem.getGrainSize(m_draws.size(), MIN_DRAWS_PER_JOB);
+  const auto chunkCount = (m_draws.size() + chunkSize - 1) / chunkSize;
+  std::vector<uint8_t> isDrawn(m_batches.size());
+  for (size_t batchIdx = 0; batchIdx < m_batches.size(); ++batchIdx) {
+    isDrawn[batchIdx] = isBatchDrawn(batchIdx);
+  }
+  // Calls f(chunkIdx, batchIdx, i) for each draw i of the drawn batches
+  const auto forEachChunk = [&](auto &&f) {
+    jobSystem.parallelFor(chunkCount, 1, [&](size_t first, size_t last) {
+      for (auto chunkIdx = first; chunkIdx < last; ++chunkIdx) {
+        const auto firstDraw = chunkIdx * chunkSize;
+        const auto lastDraw = std::min(m_draws.size(), firstDraw + chunkSize);
+        // Batches cover m_draws, in order and without gap
+        const auto batch = std::upper_bound(begin(m_batches), end(m_batches),
+            firstDraw,
+            [](size_t i, const Batch &batch) { return i < batch.begin; });
+        auto batchIdx = size_t(batch - begin(m_batches)) - 1;
+        for (auto i = firstDraw; i < lastDraw; ++i) {
+          while (i >= m_batches[batchIdx].begin + m_batches[batchIdx].count) {
+            ++batchIdx;
+          }
+          f(chunkIdx, batchIdx, i);
+        }
+      }
+    });
+  };
+
+  std::vector<size_t> chunkInstances(chunkCount + 1, 0);
+  forEachChunk([&](size_t chunkIdx, size_t batchIdx, size_t i) {
+    if (isDrawn[batchIdx] && isDrawVisible[m_draws[i].drawIdx]) {
+      ++chunkInstances[chunkIdx + 1];
+    }
+  });
+  for (size_t chunkIdx = 0; chunkIdx < chunkCount; ++chunkIdx) {
+    chunkInstances[chunkIdx + 1] += chunkInstances[chunkIdx];
+  }
+  const auto instanceCount = chunkInstances.back();
+  firstInstances.assign(m_batches.size() + 1, instanceCount);
+  if (!instanceCount) {
+    return {0, 0, nullptr};
+  }
+
+  const auto allocation = ring.allocate(
+      instanceCount * sizeof(InstanceTransform), sizeof(glm::vec4));
+  const auto instances = static_cast<InstanceTransform *>(allocation.data);
+  forEachChunk([&](size_t chunkIdx, size_t batchIdx, size_t i) {
+    auto &instanceIdx = chunkInstances[chunkIdx];
+    if (i == m_batches[batchIdx].begin) {
+      firstInstances[batchIdx] = instanceIdx;
+    }
+    if (isDrawn[batchIdx] && isDrawVisible[m_draws[i].drawIdx]) {
+      instances[instanceIdx++] = getTransform(batchIdx, m_draws[i]);
+    }
+  });
+  return allocation;
+}
+
+size_t InstancedDrawList::draw(const GeometryArena &arena,
+    const std::vector<ArenaPrimitive> &primitives,
+    const std::vector<glm::mat4> &worldMatrices,
+    const std::vector<glm::mat3> &normalMatrices,
+    const std::vector<uint8_t> &isDrawVisible, RingBuffer &ring,
+    const std::function<void(uint32_t)> &beginBatch) const
+{
+  std::vector<size_t> firstInstances;
+  const auto allocation = writeInstances(
+      isDrawVisible,
+      [&](size_t batchIdx) {
+        return primitives[m_batches[batchIdx].primitive].indexCount != 0;
+      },
+      [&](size_t batchIdx, const Draw &draw) {
+        const auto &primitive = primitives[m_batches[batchIdx].primitive];
+        auto normalMatrix = glm::mat4(normalMatrices[draw.matrix]);
+        normalMatrix[3].x = getInstancePhase(draw.matrix);
+        return InstanceTransform{
+            worldMatrices[draw.matrix] * primitive.positionMatrix(),
+            normalMatrix};
+      },
+      ring, firstInstances);
+  if (!allocation.buffer) {
+    return 0;
+  }
+
+  arena.bindInstanceBuffer(allocation.buffer, allocation.offset);
+  arena.bind();
+  size_t drawCallCount = 0;
+  for (size_t batchIdx = 0; batchIdx < m_batches.size(); ++batchIdx) {
+    const auto firstInstance = firstInstances[batchIdx];
+    const auto instanceCount = firstInstances[batchIdx + 1] - firstInstance;
+    if (!instanceCount) {
+      continue;
+    }
+    const auto &primitive = primitives[m_batches[batchIdx].primitive];
+    GeometryArena::setMaterialId(primitive.materialID);
+    if (beginBatch) {
+      beginBatch(m_batches[batchIdx].primitive);
+    }
+    glDrawElementsInstancedBaseVertexBaseInstance(primitive.mode,
+        GLsizei(primitive.indexCount), arena.indexType(),
+        arena.indexOffset(primitive.firstIndex),
+        GLsizei(instanceCount), primitive.baseVertex, GLuint(firstInstance));
+    ++drawCallCount;
+  }
+  glBindVertexArray(0);
+  arena.bindInstanceBuffer(0);
+  return drawCallCount;
+}
+
+size_t InstancedDrawList::drawImpostors(const GeometryArena &arena,
+    const ImpostorAtlas &impostors,
+    const std::vector<glm::mat4> &worldMatrices,
+    const std::vector<glm::mat3> &normalMatrices,
+    const std::vector<uint8_t> &isDrawVisible, RingBuffer &ring) const
+{
+  std::vector<size_t> firstInstances;
+  const auto allocation = writeInstances(
+      isDrawVisible,
+      [&](size_t batchIdx) {
+        return impostors.layer(m_batches[batchIdx].primitive) >= 0;
+      },
+      [&](size_t, const Draw &draw) {
+        return InstanceTransform{worldMatrices[draw.matrix],
+            glm::mat4(normalMatrices[draw.matrix])};
+      },
+      ring, firstInstances);
+  if (!allocation.buffer) {
+    return 0;
+  }
+
+  arena.bindInstanceBuffer(allocation.buffer, allocation.offset);
+  // The quads are generated from gl_VertexID, the layer of their impostor
+  // takes the place of the material
+  arena.bind();
+  size_t drawCallCount = 0;
+  for (size_t batchIdx = 0; batchIdx < m_batches.size(); ++batchIdx) {
+    const auto firstInstance = firstInstances[batchIdx];
+    const auto instanceCount = firstInstances[batchIdx + 1] - firstInstance;
+    if (!instanceCount) {
+      continue;
+    }
+    GeometryArena::setMaterialId(
+        GLuint(impostors.layer(m_batches[batchIdx].primitive)));
+    glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4,
+        GLsizei(instanceCount), GLuint(firstInstance));
+    ++drawCallCount;
+  }
+  glBindVertexArray(0);
+  arena.bindInstanceBuffer(0);
+  return drawCallCount;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "geometry_arena.hpp"
+#include "ring_buffer.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class ImpostorAtlas;
+
+// Draws of primitives stored in a GeometryArena, grouped by primitive so that
+// the draws of a primitive are submitted with a single instanced draw call.
+//
+// Scenes often reference the same mesh from many nodes (or from the instances
+// of EXT_mesh_gpu_instancing, see SceneHierarchy): build() groups their draws
+// once. Each draw() then writes the transforms of the visible draws of each
+// group in the frame region of a RingBuffer, chunks of the draws in parallel
+// on the job system straight into the mapped region, sourced by the instanced
+// attributes of forward.vs.glsl compiled with INSTANCED (see
+// GeometryArena::bindInstanceBuffer), and draws each group with
+// glDrawElementsInstancedBaseVertexBaseInstance, setting the material of
+// its primitive (see GeometryArena::setMaterialId).
+class InstancedDrawList
+{
+public:
+  // Per instance attributes, matches the INSTANCED attributes of
+  // forward.vs.glsl
+  struct InstanceTransform
+  {
+    glm::mat4 modelMatrix;
+    // World space normal matrix. Its last column is free, draw() stores the
+    // phase of the vertex animation of the instance in its x.
+    glm::mat4 normalMatrix;
+  };
+
+  // Group the draws by primitive: draw i draws the primitive of index
+  // drawPrimitives[i] in the arena primitives with the world matrix of index
+  // drawMatrices[i]
+  void build(const std::vector<uint32_t> &drawPrimitives,
+      const std::vector<uint32_t> &drawMatrices);
+
+  // Draw the draws i with isDrawVisible[i] != 0, primitives, worldMatrices
+  // and their normalMatrices (see SceneHierarchy::normalMatrix) are indexed
+  // by the indices given to build(). The program using
+  // forward.vs.glsl with INSTANCED must be bound. The instance transforms
+  // are allocated in the current frame of ring. beginBatch, if set, is
+  // called with the primitive of each batch before its draw call (e.g. to
+  // set its clip, see VertexAnimations::setPrimitive). Return the number of
+  // draw calls.
+  size_t draw(const GeometryArena &arena,
+      const std::vector<ArenaPrimitive> &primitives,
+      const std::vector<glm::mat4> &worldMatrices,
+      const std::vector<glm::mat3> &normalMatrices,
+      const std::vector<uint8_t> &isDrawVisible, RingBuffer &ring,
+      const std::function<void(uint32_t)> &beginBatch = nullptr) const;
+
+  // Draw the draws i with isDrawVisible[i] != 0 as the impostors of their
+  // primitive in impostors, skipping the primitives without one: a quad per
+  // draw, whose instance model matrix is its world matrix. The program using
+  // impostor.vs.glsl must be bound with the impostors (see
+  // ImpostorAtlas::bind). Return the number of draw calls.
+  size_t drawImpostors(const GeometryArena &arena,
+      const ImpostorAtlas &impostors,
+      const std::vector<glm::mat4> &worldMatrices,
+      const std::vector<glm::mat3> &normalMatrices,
+      const std::vector<uint8_t> &isDrawVisible, RingBuffer &ring) const;
+
+  size_t drawCount() const { return m_draws.size(); }
+
+  // Maximum number of draw calls issued by draw()
+  size_t batchCount() const { return m_batches.size(); }
+
+  // Primitive of a batch and its number of draws
+  uint32_t batchPrimitive(size_t batchIdx) const
+  {
+    return m_batches[batchIdx].primitive;
+  }
+  size_t batchDrawCount(size_t batchIdx) const
+  {
+    return m_batches[batchIdx].count;
+  }
+
+private:
+  // Draws of the same primitive, a range of m_draws
+  struct Batch
+  {
+    uint32_t primitive;
+    size_t begin;
+    size_t count;
+  };
+
+  // A draw of a batch
+  struct Draw
+  {
+    uint32_t drawIdx; // Index given to build()
+    uint32_t matrix;
+  };
+
+  // Write the transforms getTransform(batchIdx, draw) of the visible draws
+  // of the batches with isBatchDrawn(batchIdx) in the current frame of ring,
+  // batch after batch. firstInstances gets the first instance of each batch
+  // then the instance count. Return a null buffer if no draw is written.
+  template <typename IsBatchDrawn, typename GetTransform>
+  RingBuffer::Allocation writeInstances(
+      const std::vector<uint8_t> &isDrawVisible, IsBatchDrawn &&isBatchDrawn,
+      GetTransform &&getTransform, RingBuffer &ring,
+      std::vector<size_t> &firstInstances) const;
+
+  std::vector<Batch> m_batches;
+  std::vector<Draw> m_draws; // Sorted by batch
+};
@@ -0,0 +1,221 @@
+#include "job_system.hpp"
+#include "parallel.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+namespace
+{
+
+// Job system, pool and queue of the calling thread if it is a worker
+thread_local const JobSystem *tls_jobSystem = nullptr;
+thread_local const void *tls_pool = nullptr;
+thread_local size_t tls_queueIndex = 0;
+
+// Set by BackgroundJobScope
+thread_local bool tls_isBackground = false;
+
+JobSystem::Options g_jobSystemOptions;
+
+} // namespace
+
+JobSystem::JobSystem(const Options &options)
+{
+  const auto threadCount =
+      options.threadCount ? options.threadCount : getHardwareThreadCount();
+  startPool(m_framePool, threadCount - 1, 1, options.pinning);
+  startPool(m_backgroundPool, options.backgroundThreadCount, threadCount,
+      options.pinning);
+}
+
+JobSystem::~JobSystem()
+{
+  for (auto *pPool : {&m_framePool, &m_backgroundPool}) {
+    {
+      std::lock_guard<std::mutex> lock(pPool->sleepMutex);
+      pPool->stop = true;
+    }
+    pPool->sleepCondition.notify_all();
+  }
+  for (auto *pPool : {&m_framePool, &m_backgroundPool}) {
+    for (auto &worker : pPool->workers) {
+      worker.join();
+    }
+  }
+}
+
+void JobSystem::startPool(
+    Pool &pool, size_t workerCount, size_t firstSlot, ThreadPinning pinning)
+{
+  pool.queues.resize(workerCount + 1);
+  for (auto &queue : pool.queues) {
+    queue = std::make_unique<Queue>();
+  }
+
+  pool.workers.reserve(workerCount);
+  for (size_t i = 1; i <= workerCount; ++i) {
+    const auto slot = firstSlot + i - 1;
+    pool.workers.emplace_back([this, &pool, i, slot, pinning]() {
+      workerLoop(pool, i, slot, pinning);
+    });
+  }
+}
+
+void JobSystem::run(JobCounter &counter, std::function<void()> job)
+{
+  counter.pending.fetch_add(1);
+  pushJob(getPool(), {std::move(job), &counter});
+}
+
+void JobSystem::run(std::function<void()> job)
+{
+  pushJob(getPool(), {std::move(job), nullptr});
+}
+
+void JobSystem::pushJob(Pool &pool, Job job)
+{
+  {
+    auto &queue = *pool.queues[getQueueIndex(pool)];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back(std::move(job));
+  }
+  {
+    // Taking the lock avoids a lost wake up between the check of a worker
+    // and its wait
+    std::lock_guard<std::mutex> lock(pool.sleepMutex);
+    pool.queuedJobCount.fetch_add(1);
+  }
+  pool.sleepCondition.notify_one();
+}
+
+void JobSystem::wait(JobCounter &counter)
+{
+  auto &pool = getPool();
+  Job job;
+  while (counter.pending.load() > 0) {
+    if (popJob(pool, job, false)) {
+      job.function();
+      job.counter->pending.fetch_sub(1);
+    } else {
+      // Remaining jobs of counter are running on other threads
+      std::this_thread::yield();
+    }
+  }
+}
+
+JobSystem::Pool &JobSystem::getPool() const
+{
+  if (tls_jobSystem == this) {
+    return tls_pool == &m_backgroundPool ? m_backgroundPool : m_framePool;
+  }
+  return tls_isBackground && !m_backgroundPool.workers.empty()
+             ? m_backgroundPool
+             : m_framePool;
+}
+
+size_t JobSystem::getQueueIndex(const Pool &pool) const
+{
+  return tls_jobSystem == this && tls_pool == &pool ? tls_queueIndex : 0;
+}
+
+bool JobSystem::popJob(Pool &pool, Job &job, bool withDetached)
+{
+  const auto ownIndex = getQueueIndex(pool);
+  auto &queues = pool.queues;
+  const auto canRun = [&](const Job &job) {
+    return withDetached || job.counter;
+  };
+  {
+    // Most recent job of our queue, its data is likely in cache
+    auto &queue = *queues[ownIndex];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    const auto it = std::find_if(rbegin(queue.jobs), rend(queue.jobs), canRun);
+    if (it != rend(queue.jobs)) {
+      job = std::move(*it);
+      queue.jobs.erase(std::next(it).base());
+      pool.queuedJobCount.fetch_sub(1);
+      return true;
+    }
+  }
+  // Steal the oldest job of another queue, which is the largest range for
+  // parallelFor
+  for (size_t i = 1; i < queues.size(); ++i) {
+    auto &queue = *queues[(ownIndex + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    const auto it = std::find_if(begin(queue.jobs), end(queue.jobs), canRun);
+    if (it != end(queue.jobs)) {
+      job = std::move(*it);
+      queue.jobs.erase(it);
+      pool.queuedJobCount.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+void JobSystem::workerLoop(
+    Pool &pool, size_t queueIndex, size_t slot, ThreadPinning pinning)
+{
+  tls_jobSystem = this;
+  tls_pool = &pool;
+  tls_queueIndex = queueIndex;
+  const auto isBackground = &pool == &m_backgroundPool;
+  TRACE_THREAD_NAME(((isBackground ? "Background worker " : "Worker ") +
+                     std::to_string(queueIndex))
+                        .c_str());
+  if (!pinCurrentThread(pinning, slot) && queueIndex == 1 && !isBackground) {
+    std::cerr << "Warning: unable to pin the job system threads"
+              << std::endl;
+  }
+  if (isBackground) {
+    lowerCurrentThreadPriority();
+  }
+
+  Job job;
+  for (;;) {
+    if (popJob(pool, job, true)) {
+      job.function();
+      if (job.counter) {
+        job.counter->pending.fetch_sub(1);
+      }
+      job.function = nullptr; // Release captured state now
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(pool.sleepMutex);
+    pool.sleepCondition.wait(
+        lock, [&]() { return pool.stop || pool.queuedJobCount.load() > 0; });
+    if (pool.stop) {
+      return;
+    }
+  }
+}
+
+BackgroundJobScope::BackgroundJobScope() : m_wasBackground(tls_isBackground)
+{
+  tls_isBackground = true;
+}
+
+BackgroundJobScope::~BackgroundJobScope()
+{
+  tls_isBackground = m_wasBackground;
+}
+
+JobSystem &getJobSystem()
+{
+  static JobSystem jobSystem{g_jobSystemOptions};
+  return jobSystem;
+}
+
+void setJobSystemOptions(const JobSystem::Options &options)
+{
+  g_jobSystemOptions = options;
+}
+
+void setJobSystemThreadCount(size_t threadCount)
+{
+  g_jobSystemOptions.threadCount = threadCount;
+}
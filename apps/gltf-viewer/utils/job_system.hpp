@@ -0,0 +1,199 @@
+#pragma once
+
+#include "thread_affinity.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small work-stealing job system for scene-wide CPU passes.
+//
+// Each worker thread owns a queue of jobs: it runs its own jobs in LIFO order
+// and steals the oldest jobs of other queues when its queue is empty. Jobs
+// pushed by threads that are not workers (main thread, loader thread) go to a
+// shared queue. Waiting for a JobCounter runs pending jobs instead of
+// blocking, so the calling thread takes part in the work and jobs can spawn
+// and wait for other jobs.
+//
+// Jobs pushed under a BackgroundJobScope (asset loading, decoding) run on a
+// separate pool of background workers if there are any, with a lower
+// priority, so that loading never delays the jobs of a frame. Each pool only
+// runs its own jobs. Workers can be pinned to CPUs or NUMA nodes.
+//
+// Jobs must not throw.
+class JobSystem
+{
+public:
+  // Number of jobs of a group that are not finished
+  struct JobCounter
+  {
+    std::atomic<size_t> pending{0};
+  };
+
+  struct Options
+  {
+    // Threads running frame jobs: threadCount - 1 workers and the thread
+    // calling wait(). 0 means one thread per hardware thread.
+    size_t threadCount = 0;
+    // Workers running background jobs, none to run them on the frame
+    // workers
+    size_t backgroundThreadCount = 0;
+    // Frame workers take the slots 1 to threadCount - 1 (slot 0 is left to
+    // the main thread, which is not pinned), background workers the next
+    // ones
+    ThreadPinning pinning = ThreadPinning::None;
+  };
+
+  explicit JobSystem(const Options &options);
+
+  explicit JobSystem(size_t threadCount = 0) :
+      JobSystem(Options{threadCount, 0, ThreadPinning::None})
+  {
+  }
+
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  // Number of threads running the jobs of the calling thread, waiting
+  // thread included
+  size_t threadCount() const { return getPool().workers.size() + 1; }
+
+  size_t backgroundThreadCount() const
+  {
+    return m_backgroundPool.workers.size();
+  }
+
+  // Queue job, counter is decremented when it is finished. Jobs of
+  // background workers, and of a BackgroundJobScope, are background jobs.
+  void run(JobCounter &counter, std::function<void()> job);
+
+  // Queue a detached job, with no counter, run by a worker only: wait()
+  // never runs it, since it may last long (e.g. a coroutine loading a file,
+  // see tasks.hpp) and would block the waiting thread. The pool of the
+  // calling thread must have workers.
+  void run(std::function<void()> job);
+
+  // Run jobs of the pool of the calling thread until all jobs of counter
+  // are finished
+  void wait(JobCounter &counter);
+
+  // Call f(begin, end) on sub-ranges of [0, count) of at most grainSize
+  // elements, in parallel. Ranges are split recursively so that idle threads
+  // steal large ranges first.
+  template <typename Function>
+  void parallelFor(size_t count, size_t grainSize, Function &&f)
+  {
+    grainSize = grainSize ? grainSize : 1;
+    if (count <= grainSize || getPool().workers.empty()) {
+      if (count) {
+        f(size_t(0), count);
+      }
+      return;
+    }
+    JobCounter counter;
+    parallelForRange(counter, 0, count, grainSize, f);
+    wait(counter);
+  }
+
+  // Grain size giving about 4 ranges per thread, at least minGrainSize
+  size_t getGrainSize(size_t count, size_t minGrainSize = 1) const
+  {
+    const auto grainSize = count / (4 * threadCount());
+    return grainSize > minGrainSize ? grainSize : minGrainSize;
+  }
+
+private:
+  struct Job
+  {
+    std::function<void()> function;
+    JobCounter *counter; // nullptr for detached jobs
+  };
+
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  struct Pool
+  {
+    std::vector<std::unique_ptr<Queue>> queues; // [0] is shared
+    std::vector<std::thread> workers;
+
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<size_t> queuedJobCount{0};
+    bool stop = false;
+  };
+
+  template <typename Function>
+  void parallelForRange(JobCounter &counter, size_t begin, size_t end,
+      size_t grainSize, Function &f)
+  {
+    while (end - begin > grainSize) {
+      const auto middle = begin + (end - begin) / 2;
+      run(counter, [this, &counter, middle, end, grainSize, &f]() {
+        parallelForRange(counter, middle, end, grainSize, f);
+      });
+      end = middle;
+    }
+    f(begin, end);
+  }
+
+  void startPool(Pool &pool, size_t workerCount, size_t firstSlot,
+      ThreadPinning pinning);
+
+  // Pool of the calling thread: its own pool for workers, the background
+  // pool in a BackgroundJobScope if it has workers, the frame pool otherwise
+  Pool &getPool() const;
+
+  // Index of the queue of the calling thread in pool (0 for non worker
+  // threads)
+  size_t getQueueIndex(const Pool &pool) const;
+
+  void pushJob(Pool &pool, Job job);
+
+  // Pop a job from the queue of the calling thread or steal one, skipping
+  // detached jobs unless withDetached is true
+  bool popJob(Pool &pool, Job &job, bool withDetached);
+
+  void workerLoop(Pool &pool, size_t queueIndex, size_t slot,
+      ThreadPinning pinning);
+
+  // Mutable since the pool of a thread is picked by const getters
+  mutable Pool m_framePool;
+  mutable Pool m_backgroundPool;
+};
+
+// While alive, jobs pushed by the calling thread are background jobs. Used
+// by the threads loading assets, whose parallel passes then never take
+// frame workers.
+class BackgroundJobScope
+{
+public:
+  BackgroundJobScope();
+  ~BackgroundJobScope();
+
+  BackgroundJobScope(const BackgroundJobScope &) = delete;
+  BackgroundJobScope &operator=(const BackgroundJobScope &) = delete;
+
+private:
+  bool m_wasBackground;
+};
+
+// Job system shared by the application, created on first use with the
+// options given to setJobSystemOptions (default: one frame thread per
+// hardware thread, no background worker, no pinning)
+JobSystem &getJobSystem();
+
+// Must be called before the first call to getJobSystem() to have an effect
+void setJobSystemOptions(const JobSystem::Options &options);
+
+void setJobSystemThreadCount(size_t threadCount);
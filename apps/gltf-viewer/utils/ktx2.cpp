@@ -0,0 +1,351 @@
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+
+const unsigned char KTX2_IDENTIFIER[12] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+// Identifier, 9 header fields, then the offsets and lengths of the data
+// format descriptor, key/value data and supercompression global data
+const size_t KTX2_LEVEL_INDEX_OFFSET = 12 + 9 * 4 + 4 * 4 + 2 * 8;
+const size_t KTX2_LEVEL_INDEX_ENTRY_SIZE = 3 * 8;
+
+template <typename T> T read(const unsigned char *bytes)
+{
+  T value;
+  std::memcpy(&value, bytes, sizeof(value)); // KTX2 is little endian
+  return value;
+}
+
+template <typename T> void write(std::vector<unsigned char> &bytes, T value)
+{
+  const auto offset = bytes.size();
+  bytes.resize(offset + sizeof(value));
+  std::memcpy(bytes.data() + offset, &value, sizeof(value));
+}
+
+void pad(std::vector<unsigned char> &bytes, size_t alignment)
+{
+  bytes.resize((bytes.size() + alignment - 1) / alignment * alignment, 0);
+}
+
+size_t getBlockCount(uint32_t size, uint32_t level, uint32_t blockSize)
+{
+  const auto levelSize = std::max(size >> level, 1u);
+  return (levelSize + blockSize - 1) / blockSize;
+}
+
+// Channels of the uncompressed formats that can be written, false for others
+bool getChannelLayout(uint32_t vkFormat, uint32_t &channelCount,
+    uint32_t &channelSize, bool &isFloat)
+{
+  switch (vkFormat) {
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+    channelCount = 4;
+    channelSize = 1;
+    isFloat = false;
+    return true;
+  case VK_FORMAT_R16G16_SFLOAT:
+    channelCount = 2;
+    channelSize = 2;
+    isFloat = true;
+    return true;
+  case VK_FORMAT_R16G16B16A16_SFLOAT:
+    channelCount = 4;
+    channelSize = 2;
+    isFloat = true;
+    return true;
+  }
+  return false;
+}
+
+} // namespace
+
+bool isKtx2(const unsigned char *bytes, size_t size)
+{
+  return size >= sizeof(KTX2_IDENTIFIER) &&
+         std::memcmp(bytes, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0;
+}
+
+bool parseKtx2(const unsigned char *bytes, size_t size, Ktx2Image &image,
+    std::string &err, bool allowCubeMaps)
+{
+  if (!isKtx2(bytes, size) || size < KTX2_LEVEL_INDEX_OFFSET) {
+    err = "Invalid KTX2 header";
+    return false;
+  }
+  const auto header = bytes + sizeof(KTX2_IDENTIFIER);
+  image.vkFormat = read<uint32_t>(header);
+  image.width = read<uint32_t>(header + 8);
+  image.height = read<uint32_t>(header + 12);
+  const auto depth = read<uint32_t>(header + 16);
+  const auto layerCount = read<uint32_t>(header + 20);
+  image.faceCount = read<uint32_t>(header + 24);
+  const auto levelCount = std::max(read<uint32_t>(header + 28), 1u);
+  image.supercompression =
+      Ktx2Image::Supercompression(read<uint32_t>(header + 32));
+
+  const auto isCubeMap =
+      allowCubeMaps && image.faceCount == 6 && image.width == image.height;
+  if (image.width == 0 || image.height == 0 || depth != 0 ||
+      layerCount > 1 || (image.faceCount != 1 && !isCubeMap)) {
+    err = allowCubeMaps ? "Only 2D KTX2 textures and cube maps are supported"
+                        : "Only 2D KTX2 textures are supported";
+    return false;
+  }
+  if (levelCount > 32 || size < KTX2_LEVEL_INDEX_OFFSET +
+                                    levelCount * KTX2_LEVEL_INDEX_ENTRY_SIZE) {
+    err = "Invalid KTX2 level index";
+    return false;
+  }
+
+  uint32_t blockWidth = 1, blockHeight = 1;
+  const auto blockSize =
+      getKtx2BlockSize(image.vkFormat, blockWidth, blockHeight);
+  image.levels.resize(levelCount);
+  for (uint32_t level = 0; level < levelCount; ++level) {
+    const auto entry =
+        bytes + KTX2_LEVEL_INDEX_OFFSET + level * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+    const auto offset = read<uint64_t>(entry);
+    const auto length = read<uint64_t>(entry + 8);
+    if (offset > size || length > size - offset) {
+      err = "KTX2 level " + std::to_string(level) + " is out of the file";
+      return false;
+    }
+    // Sizes can only be checked before supercompression
+    if (blockSize &&
+        image.supercompression == Ktx2Image::Supercompression::None &&
+        length != getBlockCount(image.width, level, blockWidth) *
+                      getBlockCount(image.height, level, blockHeight) *
+                      blockSize * image.faceCount) {
+      err = "Invalid size of KTX2 level " + std::to_string(level);
+      return false;
+    }
+    image.levels[level] = {bytes + offset, size_t(length)};
+  }
+
+  // Entries are a length, a NUL terminated key then the value, padded to 4
+  // bytes
+  const auto kvdOffset = read<uint32_t>(header + 44);
+  const auto kvdLength = read<uint32_t>(header + 48);
+  if (kvdOffset > size || kvdLength > size - kvdOffset) {
+    err = "KTX2 key/value data is out of the file";
+    return false;
+  }
+  image.keyValues.clear();
+  for (size_t pos = 0; pos + 4 <= kvdLength;) {
+    const auto length = read<uint32_t>(bytes + kvdOffset + pos);
+    pos += 4;
+    if (length > kvdLength - pos) {
+      err = "Invalid KTX2 key/value data";
+      return false;
+    }
+    const auto entry = reinterpret_cast<const char *>(bytes + kvdOffset + pos);
+    const auto keyLength = std::find(entry, entry + length, '\0') - entry;
+    if (size_t(keyLength) < length) {
+      std::string value(entry + keyLength + 1, length - keyLength - 1);
+      if (!value.empty() && value.back() == '\0') {
+        value.pop_back();
+      }
+      image.keyValues.emplace_back(std::string(entry, keyLength), value);
+    }
+    pos += (size_t(length) + 3) / 4 * 4;
+  }
+  return true;
+}
+
+bool encodeKtx2(uint32_t vkFormat, uint32_t width, uint32_t height,
+    uint32_t faceCount, const std::vector<std::vector<unsigned char>> &levels,
+    const std::vector<std::pair<std::string, std::string>> &keyValues,
+    std::vector<unsigned char> &bytes, std::string &err)
+{
+  uint32_t channelCount = 0, channelSize = 0;
+  auto isFloat = false;
+  const auto isCompressed = vkFormat == VK_FORMAT_BC5_UNORM_BLOCK ||
+                            vkFormat == VK_FORMAT_BC7_UNORM_BLOCK;
+  if (!isCompressed &&
+      !getChannelLayout(vkFormat, channelCount, channelSize, isFloat)) {
+    err = "Unsupported KTX2 format " + std::to_string(vkFormat);
+    return false;
+  }
+  uint32_t blockWidth, blockHeight;
+  const auto blockSize =
+      uint32_t(getKtx2BlockSize(vkFormat, blockWidth, blockHeight));
+  const auto levelCount = uint32_t(levels.size());
+  const size_t headerSize =
+      KTX2_LEVEL_INDEX_OFFSET + levelCount * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+
+  // Basic data format descriptor: a block header, then a sample per channel,
+  // or per compressed plane of BC5 and BC7 blocks
+  std::vector<unsigned char> dfd;
+  const uint32_t sampleCount =
+      isCompressed ? (vkFormat == VK_FORMAT_BC5_UNORM_BLOCK ? 2 : 1)
+                   : channelCount;
+  const uint32_t dfdBlockSize = 24 + 16 * sampleCount;
+  const uint32_t transfer = vkFormat == VK_FORMAT_R8G8B8A8_SRGB ? 2 : 1;
+  // RGBSDA color model, or the BC5 and BC7 ones
+  const uint32_t colorModel =
+      isCompressed ? (vkFormat == VK_FORMAT_BC5_UNORM_BLOCK ? 132 : 134) : 1;
+  write<uint32_t>(dfd, 4 + dfdBlockSize);
+  write<uint32_t>(dfd, 0); // Khronos vendor, basic descriptor type
+  write<uint32_t>(dfd, 2 | dfdBlockSize << 16); // Version 2
+  // BT.709 primaries, straight alpha
+  write<uint32_t>(dfd, colorModel | 1 << 8 | transfer << 16);
+  write<uint32_t>(dfd, (blockWidth - 1) | (blockHeight - 1) << 8);
+  write<uint32_t>(dfd, blockSize); // Bytes of plane 0
+  write<uint32_t>(dfd, 0);
+  if (isCompressed) {
+    // 64 bits of red then green for BC5, 128 bits of color for BC7
+    const uint32_t bitLength = 128 / sampleCount;
+    for (uint32_t c = 0; c < sampleCount; ++c) {
+      write<uint32_t>(dfd, c * bitLength | (bitLength - 1) << 16 | c << 24);
+      write<uint32_t>(dfd, 0);
+      write<uint32_t>(dfd, 0);
+      write<uint32_t>(dfd, 0xFFFFFFFFu);
+    }
+  }
+  const uint32_t channelIds[] = {0, 1, 2, 15}; // R, G, B, A
+  for (uint32_t c = 0; c < channelCount; ++c) {
+    const uint32_t bitLength = channelSize * 8;
+    // Float and signed qualifiers, sRGB alpha is linear
+    auto channelType = channelIds[c] | (isFloat ? 0xC0u : 0u);
+    if (transfer == 2 && c == 3) {
+      channelType |= 0x10u;
+    }
+    write<uint32_t>(
+        dfd, c * bitLength | (bitLength - 1) << 16 | channelType << 24);
+    write<uint32_t>(dfd, 0); // Sample position
+    // Range of the values: [-1, 1] as floats for float channels
+    write<uint32_t>(dfd, isFloat ? 0xBF800000u : 0u);
+    write<uint32_t>(dfd, isFloat ? 0x3F800000u : (1u << bitLength) - 1);
+  }
+
+  // Keys must be sorted
+  auto sortedKeyValues = keyValues;
+  std::sort(begin(sortedKeyValues), end(sortedKeyValues));
+  std::vector<unsigned char> kvd;
+  for (const auto &keyValue : sortedKeyValues) {
+    const auto &key = keyValue.first;
+    const auto &value = keyValue.second;
+    write<uint32_t>(kvd, uint32_t(key.size() + value.size() + 2));
+    kvd.insert(end(kvd), begin(key), end(key));
+    kvd.push_back(0);
+    kvd.insert(end(kvd), begin(value), end(value));
+    kvd.push_back(0);
+    pad(kvd, 4);
+  }
+
+  bytes.assign(KTX2_IDENTIFIER, KTX2_IDENTIFIER + sizeof(KTX2_IDENTIFIER));
+  write<uint32_t>(bytes, vkFormat);
+  write<uint32_t>(bytes, isCompressed ? 1 : channelSize); // typeSize
+  write<uint32_t>(bytes, width);
+  write<uint32_t>(bytes, height);
+  write<uint32_t>(bytes, 0); // pixelDepth
+  write<uint32_t>(bytes, 0); // layerCount
+  write<uint32_t>(bytes, faceCount);
+  write<uint32_t>(bytes, levelCount);
+  write<uint32_t>(bytes, 0); // No supercompression
+  const auto dfdOffset = uint32_t(headerSize);
+  const auto kvdOffset = uint32_t(dfdOffset + dfd.size());
+  write<uint32_t>(bytes, dfdOffset);
+  write<uint32_t>(bytes, uint32_t(dfd.size()));
+  write<uint32_t>(bytes, kvd.empty() ? 0 : kvdOffset);
+  write<uint32_t>(bytes, uint32_t(kvd.size()));
+  write<uint64_t>(bytes, 0); // No supercompression global data
+  write<uint64_t>(bytes, 0);
+  bytes.resize(headerSize); // Level index, filled below
+  bytes.insert(end(bytes), begin(dfd), end(dfd));
+  bytes.insert(end(bytes), begin(kvd), end(kvd));
+
+  // Levels are stored from the smallest, each aligned to a block and to 4
+  // bytes
+  const size_t alignment = std::max(blockSize, 4u);
+  for (auto level = levelCount; level-- > 0;) {
+    const auto &data = levels[level];
+    if (data.size() != getBlockCount(width, level, blockWidth) *
+                           getBlockCount(height, level, blockHeight) *
+                           blockSize * faceCount) {
+      err = "Invalid size of KTX2 level " + std::to_string(level);
+      return false;
+    }
+    pad(bytes, alignment);
+    const auto entry = KTX2_LEVEL_INDEX_OFFSET +
+                       level * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+    const uint64_t entryValues[] = {bytes.size(), data.size(), data.size()};
+    std::memcpy(bytes.data() + entry, entryValues, sizeof(entryValues));
+    bytes.insert(end(bytes), begin(data), end(data));
+  }
+  return true;
+}
+
+bool writeKtx2(const fs::path &path, uint32_t vkFormat, uint32_t width,
+    uint32_t height, uint32_t faceCount,
+    const std::vector<std::vector<unsigned char>> &levels,
+    const std::vector<std::pair<std::string, std::string>> &keyValues,
+    std::string &err)
+{
+  std::vector<unsigned char> bytes;
+  if (!encodeKtx2(vkFormat, width, height, faceCount, levels, keyValues,
+          bytes, err)) {
+    err = "Cannot write KTX2 file " + path.string() + ": " + err;
+    return false;
+  }
+  std::ofstream out(path.string(), std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(bytes.data()),
+      std::streamsize(bytes.size()));
+  if (!out) {
+    err = "Cannot write KTX2 file " + path.string();
+    return false;
+  }
+  return true;
+}
+
+size_t getKtx2BlockSize(
+    uint32_t vkFormat, uint32_t &blockWidth, uint32_t &blockHeight)
+{
+  blockWidth = blockHeight = 1;
+  if (vkFormat == VK_FORMAT_R8G8B8A8_UNORM ||
+      vkFormat == VK_FORMAT_R8G8B8A8_SRGB ||
+      vkFormat == VK_FORMAT_R16G16_SFLOAT) {
+    return 4;
+  }
+  if (vkFormat == VK_FORMAT_R16G16B16A16_SFLOAT) {
+    return 8;
+  }
+
+  blockWidth = blockHeight = 4;
+  if (vkFormat >= VK_FORMAT_BC1_RGB_UNORM_BLOCK &&
+      vkFormat <= VK_FORMAT_BC7_SRGB_BLOCK) {
+    // BC1 (4 variants) and BC4 (2 variants) use 64-bit blocks
+    const auto idx = vkFormat - VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    return idx < 4 || idx == 8 || idx == 9 ? 8 : 16;
+  }
+  if (vkFormat >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK &&
+      vkFormat <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK) {
+    // ETC2 RGB8 and RGB8A1 (4 variants) and EAC R11 (2 variants) use 64-bit
+    // blocks
+    const auto idx = vkFormat - VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK;
+    return idx < 4 || idx == 6 || idx == 7 ? 8 : 16;
+  }
+  if (vkFormat >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK &&
+      vkFormat <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK) {
+    // UNORM and SRGB variants of each footprint, always 128-bit blocks
+    static const uint32_t footprints[][2] = {{4, 4}, {5, 4}, {5, 5}, {6, 5},
+        {6, 6}, {8, 5}, {8, 6}, {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10},
+        {12, 10}, {12, 12}};
+    const auto &footprint =
+        footprints[(vkFormat - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2];
+    blockWidth = footprint[0];
+    blockHeight = footprint[1];
+    return 16;
+  }
+
+  blockWidth = blockHeight = 1;
+  return 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Reader of KTX 2.0 textures (https://registry.khronos.org/KTX/specs/2.0/),
+// the container of KHR_texture_basisu images and of the caches of
+// EnvironmentLighting. The container is read in place: levels point into the
+// bytes given to parseKtx2.
+struct Ktx2Image
+{
+  struct Level
+  {
+    const unsigned char *data;
+    size_t size;
+  };
+
+  enum class Supercompression : uint32_t
+  {
+    None = 0,
+    BasisLZ = 1,
+    Zstd = 2,
+    Zlib = 3
+  };
+
+  uint32_t vkFormat = 0; // VkFormat of the levels, 0 for Basis Universal
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t faceCount = 1; // 6 for cube maps
+  Supercompression supercompression = Supercompression::None;
+  // From level 0, the largest. A single level if the file asks for mipmaps
+  // to be generated. The faces of a cube map follow each other in each
+  // level, in the order of GL_TEXTURE_CUBE_MAP_POSITIVE_X and next.
+  std::vector<Level> levels;
+  // Key/value data, values without their terminating NUL
+  std::vector<std::pair<std::string, std::string>> keyValues;
+
+  // Levels are ETC1S or UASTC data that must be transcoded by the Basis
+  // Universal transcoder before use
+  bool isBasisUniversal() const { return vkFormat == 0; }
+};
+
+const uint32_t VK_FORMAT_R8G8B8A8_UNORM = 37;
+const uint32_t VK_FORMAT_R8G8B8A8_SRGB = 43;
+const uint32_t VK_FORMAT_R16G16_SFLOAT = 83;
+const uint32_t VK_FORMAT_R16G16B16A16_SFLOAT = 97;
+const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+const uint32_t VK_FORMAT_BC5_UNORM_BLOCK = 141;
+const uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+const uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+const uint32_t VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK = 147;
+const uint32_t VK_FORMAT_EAC_R11G11_SNORM_BLOCK = 156;
+const uint32_t VK_FORMAT_ASTC_4x4_UNORM_BLOCK = 157;
+const uint32_t VK_FORMAT_ASTC_12x12_SRGB_BLOCK = 184;
+
+// Return true if bytes start with the KTX 2.0 identifier
+bool isKtx2(const unsigned char *bytes, size_t size);
+
+// Parse the header, level index and key/value data of a 2D texture, or of a
+// cube map if allowCubeMaps is set. Return false and fill err if the file is
+// invalid, or is an array or a 3D texture.
+bool parseKtx2(const unsigned char *bytes, size_t size, Ktx2Image &image,
+    std::string &err, bool allowCubeMaps = false);
+
+// Encode a 2D texture or a cube map (faceCount 6) without supercompression
+// into bytes, with the levels and key/value pairs laid out as in Ktx2Image.
+// vkFormat must be one of the uncompressed VK_FORMAT_* above,
+// VK_FORMAT_BC5_UNORM_BLOCK or VK_FORMAT_BC7_UNORM_BLOCK. Return false and
+// fill err on failure.
+bool encodeKtx2(uint32_t vkFormat, uint32_t width, uint32_t height,
+    uint32_t faceCount, const std::vector<std::vector<unsigned char>> &levels,
+    const std::vector<std::pair<std::string, std::string>> &keyValues,
+    std::vector<unsigned char> &bytes, std::string &err);
+
+// Write the file encoded by encodeKtx2
+bool writeKtx2(const fs::path &path, uint32_t vkFormat, uint32_t width,
+    uint32_t height, uint32_t faceCount,
+    const std::vector<std::vector<unsigned char>> &levels,
+    const std::vector<std::pair<std::string, std::string>> &keyValues,
+    std::string &err);
+
+// Size of the blocks of vkFormat: 1x1 pixel for uncompressed formats. Return
+// 0 if the format is not one of the VK_FORMAT_* above or within their ranges
+// (BC1 to BC7, ETC2 and EAC, ASTC).
+size_t getKtx2BlockSize(
+    uint32_t vkFormat, uint32_t &blockWidth, uint32_t &blockHeight);
@@ -0,0 +1,177 @@
+#include "lights.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+const char *LIGHTS_EXTENSION = "KHR_lights_punctual";
+
+// local_size of assign_lights.cs.glsl
+const size_t ASSIGN_GROUP_SIZE = 64;
+
+const size_t CLUSTER_COUNT = size_t(LightClusters::GRID_WIDTH) *
+                             LightClusters::GRID_HEIGHT *
+                             LightClusters::GRID_DEPTH;
+
+// Logarithmic slices spend most of their resolution near the near plane, a
+// closer one than this fraction of the far plane (reversed-Z allows tiny
+// ones) is moved away, the first slice still starts at the eye
+const float MIN_CLUSTER_NEAR_RATIO = 1e-3f;
+
+size_t getLightsAlignment()
+{
+  GLint alignment = 0;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return std::max(size_t(alignment), sizeof(glm::vec4));
+}
+
+} // namespace
+
+SceneLights::SceneLights(
+    const tinygltf::Model &model, const SceneHierarchy &hierarchy)
+{
+  std::vector<Light> localLights;
+  for (size_t flatIdx = 0; flatIdx < hierarchy.size(); ++flatIdx) {
+    // Instances of EXT_mesh_gpu_instancing share the node of their parent,
+    // only the node itself carries its light
+    const auto parent = hierarchy.parent(flatIdx);
+    if (parent >= 0 && hierarchy.node(parent) == hierarchy.node(flatIdx)) {
+      continue;
+    }
+    const auto &node = model.nodes[hierarchy.node(flatIdx)];
+    const auto extension = node.extensions.find(LIGHTS_EXTENSION);
+    if (extension == end(node.extensions) ||
+        !extension->second.Has("light")) {
+      continue;
+    }
+    const auto lightIdx =
+        int(extension->second.Get("light").GetNumberAsInt());
+    if (lightIdx < 0 || size_t(lightIdx) >= model.lights.size()) {
+      continue;
+    }
+
+    const auto &light = model.lights[lightIdx];
+    auto color = glm::vec3(1);
+    for (size_t c = 0; c < 3 && c < light.color.size(); ++c) {
+      color[c] = float(light.color[c]);
+    }
+    color *= float(light.intensity);
+    const auto maxComponent = std::max({color.r, color.g, color.b});
+    if (maxComponent <= 0.f) {
+      continue;
+    }
+
+    // Lights point down -z in the space of their node
+    ViewLight local{glm::vec3(0), 0.f, glm::vec3(0, 0, -1), 0.f, color, 1.f};
+    if (light.type == "directional") {
+      m_lights.push_back({uint32_t(flatIdx), local});
+      continue;
+    }
+    local.range = light.range > 0.
+                      ? float(light.range)
+                      : std::sqrt(maxComponent / LIGHT_CUTOFF);
+    if (light.type == "spot") {
+      // Angular attenuation recommended by the extension
+      const auto cosInner = float(std::cos(light.spot.innerConeAngle));
+      const auto cosOuter = float(std::cos(light.spot.outerConeAngle));
+      local.spotScale = 1.f / std::max(cosInner - cosOuter, 1e-3f);
+      local.spotOffset = -cosOuter * local.spotScale;
+    } else if (light.type != "point") {
+      continue;
+    }
+    localLights.push_back({uint32_t(flatIdx), local});
+  }
+  m_nDirectionalCount = m_lights.size();
+  m_lights.insert(end(m_lights), begin(localLights), end(localLights));
+}
+
+glm::vec3 SceneLights::getDirection(
+    const SceneHierarchy &hierarchy, size_t idx) const
+{
+  const auto &light = m_lights[idx];
+  return glm::normalize(glm::mat3(hierarchy.worldMatrix(light.node)) *
+                        light.light.direction);
+}
+
+void SceneLights::computeViewLights(const SceneHierarchy &hierarchy,
+    const glm::mat4 &viewMatrix, std::vector<ViewLight> &lights) const
+{
+  lights.resize(m_lights.size());
+  for (size_t i = 0; i < m_lights.size(); ++i) {
+    const auto &light = m_lights[i];
+    const auto mvMatrix = viewMatrix * hierarchy.worldMatrix(light.node);
+    auto &viewLight = lights[i];
+    viewLight = light.light;
+    viewLight.position = glm::vec3(mvMatrix[3]);
+    viewLight.direction =
+        glm::normalize(glm::mat3(mvMatrix) * light.light.direction);
+  }
+}
+
+void LightClusters::update(const SceneLights &lights,
+    const SceneHierarchy &hierarchy, const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, float zNear, float zFar,
+    const GLProgram *assignProgram, RingBuffer &ring)
+{
+  lights.computeViewLights(hierarchy, viewMatrix, m_viewLights);
+  const auto directionalCount = lights.directionalCount();
+  const auto localCount = m_viewLights.size() - directionalCount;
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const auto width = float(std::max(viewport[2], 1));
+  const auto height = float(std::max(viewport[3], 1));
+  zNear = std::max(zNear, MIN_CLUSTER_NEAR_RATIO * zFar);
+  const auto sliceScale = GRID_DEPTH / std::log(zFar / zNear);
+
+  m_uniforms.reset(sizeof(Uniforms), 1);
+  m_uniforms.block<Uniforms>(0) = {
+      {GRID_WIDTH, GRID_HEIGHT, GRID_DEPTH, MAX_CLUSTER_LIGHTS},
+      {GLuint(directionalCount), GLuint(localCount), 0, 0},
+      {float(viewport[0]), float(viewport[1]), GRID_WIDTH / width,
+          GRID_HEIGHT / height},
+      {sliceScale, -std::log(zNear) * sliceScale, zNear, zFar},
+      {1.f / projMatrix[0][0], 1.f / projMatrix[1][1],
+          projMatrix[2][0] / projMatrix[0][0],
+          projMatrix[2][1] / projMatrix[1][1]}};
+  m_uniforms.upload(ring);
+  m_uniforms.bind(UNIFORMS_BINDING, 0);
+
+  // Scenes without lights still bind a valid range
+  const SceneLights::ViewLight noLight{};
+  const auto lightsSize =
+      std::max(m_viewLights.size(), size_t(1)) * sizeof(noLight);
+  const auto allocation =
+      ring.upload(m_viewLights.empty() ? &noLight : m_viewLights.data(),
+          lightsSize, getLightsAlignment());
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHTS_BINDING,
+      allocation.buffer, GLintptr(allocation.offset), GLsizeiptr(lightsSize));
+
+  if (!assignProgram) {
+    return;
+  }
+  if (!m_clusterBuffer.glId()) {
+    m_clusterBuffer = GLBuffer{
+        CLUSTER_COUNT * (MAX_CLUSTER_LIGHTS + 1) * sizeof(GLuint), nullptr, 0};
+  }
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, CLUSTERS_BINDING, m_clusterBuffer.glId());
+  // Fragment shaders do not read the clusters without local lights
+  if (!localCount) {
+    return;
+  }
+  assignProgram->use();
+  glDispatchCompute(
+      GLuint((CLUSTER_COUNT + ASSIGN_GROUP_SIZE - 1) / ASSIGN_GROUP_SIZE), 1,
+      1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void LightClusters::unbind() const
+{
+  glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORMS_BINDING, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHTS_BINDING, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTERS_BINDING, 0);
+}
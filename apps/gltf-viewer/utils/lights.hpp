@@ -0,0 +1,138 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "ring_buffer.hpp"
+#include "scene_hierarchy.hpp"
+#include "shaders.hpp"
+#include "uniform_buffer.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Punctual lights (KHR_lights_punctual) of the nodes of a SceneHierarchy.
+//
+// Lights without a range get one from their intensity: the distance where
+// their inverse square falloff drops below LIGHT_CUTOFF, so that every local
+// light only reaches a bounded part of the scene and can be assigned to the
+// clusters it touches (see LightClusters).
+class SceneLights
+{
+public:
+  // Radiance under which a light without range is ignored
+  static constexpr float LIGHT_CUTOFF = 1e-3f;
+
+  // Light of lights.glsl, std430 layout. Positions and directions are in
+  // view space. Point lights have no cone: spotScale is 0 and spotOffset 1.
+  struct ViewLight
+  {
+    glm::vec3 position;
+    float range;
+    glm::vec3 direction; // Pointing away from the light
+    float spotScale;
+    glm::vec3 color; // Multiplied by the intensity
+    float spotOffset;
+  };
+
+  SceneLights() = default;
+
+  // Find the lights of model attached to the nodes of hierarchy
+  SceneLights(const tinygltf::Model &model, const SceneHierarchy &hierarchy);
+
+  bool empty() const { return m_lights.empty(); }
+
+  size_t lightCount() const { return m_lights.size(); }
+
+  // Directional lights come first, they light the whole scene
+  size_t directionalCount() const { return m_nDirectionalCount; }
+
+  // World space direction of the directional light idx (below
+  // directionalCount()), pointing away from the light
+  glm::vec3 getDirection(const SceneHierarchy &hierarchy, size_t idx) const;
+
+  // Transform the lights by the world matrices of their nodes in hierarchy
+  // and viewMatrix, in the order of lights.glsl: directional ones first
+  void computeViewLights(const SceneHierarchy &hierarchy,
+      const glm::mat4 &viewMatrix, std::vector<ViewLight> &lights) const;
+
+private:
+  struct Light
+  {
+    uint32_t node; // Flat index in the hierarchy
+    ViewLight light; // In the local space of the node
+  };
+
+  std::vector<Light> m_lights;
+  size_t m_nDirectionalCount = 0;
+};
+
+// Clustered forward lighting: the view frustum is split in a grid of
+// GRID_WIDTH x GRID_HEIGHT screen tiles times GRID_DEPTH depth slices
+// (froxels), exponentially distributed between the near and far planes. A
+// compute pass (assign_lights.cs.glsl) lists the local lights whose sphere
+// of influence overlaps each cluster, and fragment shaders including
+// lights.glsl only loop over the lights of their cluster, plus the
+// directional ones. The cost of a fragment follows the density of lights
+// around it, not their total count.
+//
+// Each cluster owns a fixed slot of MAX_CLUSTER_LIGHTS indices in the
+// cluster buffer, lights beyond it are dropped for that cluster.
+class LightClusters
+{
+public:
+  static const GLuint UNIFORMS_BINDING = 2; // ClusterUniforms block
+  static const GLuint LIGHTS_BINDING = 15;
+  static const GLuint CLUSTERS_BINDING = 16;
+
+  static const uint32_t GRID_WIDTH = 16;
+  static const uint32_t GRID_HEIGHT = 9;
+  static const uint32_t GRID_DEPTH = 24;
+  static const uint32_t MAX_CLUSTER_LIGHTS = 127;
+
+  // ClusterUniforms block of lights.glsl, std140 layout
+  struct Uniforms
+  {
+    glm::uvec4 grid; // Cluster counts, then MAX_CLUSTER_LIGHTS
+    glm::uvec4 lightCounts; // Directional, then local lights
+    // Viewport origin in pixels, then clusters per pixel
+    glm::vec4 viewport;
+    // Slice of a view depth d: log(d) * x + y. Depths of the near and far
+    // planes of the clusters.
+    glm::vec4 depthSlices;
+    // View position at depth 1 of NDC (x, y): (x, y) * xy + zw
+    glm::vec4 ndcToView;
+  };
+
+  LightClusters() = default;
+
+  // Non-copyable class:
+  LightClusters(const LightClusters &) = delete;
+  LightClusters &operator=(const LightClusters &) = delete;
+
+  LightClusters(LightClusters &&) = default;
+  LightClusters &operator=(LightClusters &&) = default;
+
+  // Upload the lights seen with viewMatrix to the current region of ring and
+  // assign them to the clusters of the current viewport with assignProgram
+  // (assign_lights.cs.glsl), between view depths zNear and zFar. projMatrix
+  // must be a perspective projection, possibly restricted to a tile. Buffers
+  // are bound, the program is not restored. Without assignProgram, the
+  // lights are only uploaded for passes culling them on their own (see
+  // GBuffer).
+  void update(const SceneLights &lights, const SceneHierarchy &hierarchy,
+      const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix, float zNear,
+      float zFar, const GLProgram *assignProgram, RingBuffer &ring);
+
+  // Unbind the buffers bound by update()
+  void unbind() const;
+
+private:
+  std::vector<SceneLights::ViewLight> m_viewLights;
+  UniformBuffer m_uniforms;
+  // Per cluster, its light count then its light indices
+  GLBuffer m_clusterBuffer;
+};
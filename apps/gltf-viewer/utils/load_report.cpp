@@ -0,0 +1,351 @@
+#include "load_report.hpp"
+#include "hash.hpp"
+#include "shared_cache.hpp"
+
+#include <imgui.h>
+#include <json.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <ctime>
+#endif
+
+namespace
+{
+
+const char *const PHASE_NAMES[] = {"File I/O", "JSON parse", "Buffer decode",
+    "Image decode", "Upload", "Shader compile", "Bounds"};
+static_assert(std::size(PHASE_NAMES) == size_t(LoadPhase::Count));
+
+// Keys of the phases in report files
+const char *const PHASE_KEYS[] = {"fileIo", "jsonParse", "bufferDecode",
+    "imageDecode", "upload", "shaderCompile", "bounds"};
+static_assert(std::size(PHASE_KEYS) == size_t(LoadPhase::Count));
+
+const char *const CACHE_RESULT_NAMES[] = {"unused", "hit", "miss"};
+
+// Innermost scope of the thread
+thread_local LoadReport::Scope *t_pCurrentScope = nullptr;
+
+double getMilliseconds(std::chrono::steady_clock::duration duration)
+{
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Size with a unit of at most 4 digits, e.g. "512 KiB"
+std::string formatBytes(uint64_t byteCount)
+{
+  const char *const units[] = {"B", "KiB", "MiB", "GiB"};
+  size_t unit = 0;
+  while (unit + 1 < std::size(units) && byteCount >= 10000) {
+    byteCount >>= 10;
+    ++unit;
+  }
+  return std::to_string(byteCount) + " " + units[unit];
+}
+
+// Change of a time since the previous report, e.g. "+12%"
+std::string formatChange(double time, double previousTime)
+{
+  if (previousTime <= 0.) {
+    return time > 0. ? "new" : "";
+  }
+  const auto percent = 100. * (time - previousTime) / previousTime;
+  return (percent >= 0. ? "+" : "") + std::to_string(int(percent)) + "%";
+}
+
+} // namespace
+
+const char *getLoadPhaseName(LoadPhase phase)
+{
+  return PHASE_NAMES[size_t(phase)];
+}
+
+LoadReport::Scope::Scope(LoadReport *report, LoadPhase phase) :
+    m_report(report && !report->isFinished() ? report : nullptr),
+    m_phase(phase),
+    m_startCpuTime(0.),
+    m_parent(nullptr)
+{
+  if (!m_report) {
+    return;
+  }
+  m_start = std::chrono::steady_clock::now();
+  m_startCpuTime = getProcessCpuTime();
+  m_parent = t_pCurrentScope;
+  t_pCurrentScope = this;
+}
+
+LoadReport::Scope::~Scope()
+{
+  if (!m_report) {
+    return;
+  }
+  t_pCurrentScope = m_parent;
+  const auto wallTime =
+      getMilliseconds(std::chrono::steady_clock::now() - m_start);
+  const auto cpuTime = getProcessCpuTime() - m_startCpuTime;
+  if (m_parent) {
+    m_parent->m_nestedWallTime += wallTime;
+    m_parent->m_nestedCpuTime += cpuTime;
+  }
+  std::lock_guard<std::mutex> lock(m_report->m_mutex);
+  if (const auto stats = m_report->getPhase(m_phase)) {
+    stats->wallTime += wallTime - m_nestedWallTime;
+    stats->cpuTime += cpuTime - m_nestedCpuTime;
+    ++stats->scopeCount;
+  }
+}
+
+LoadReport::LoadReport() :
+    m_nThreadCount(std::max(size_t(std::thread::hardware_concurrency()),
+        size_t(1)))
+{
+}
+
+void LoadReport::start()
+{
+  m_startTime = std::chrono::steady_clock::now();
+}
+
+void LoadReport::finish()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_isFinished) {
+    m_totalTime =
+        getMilliseconds(std::chrono::steady_clock::now() - m_startTime);
+    m_isFinished = true;
+  }
+}
+
+void LoadReport::addBytesRead(LoadPhase phase, uint64_t byteCount)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (const auto stats = getPhase(phase)) {
+    stats->bytesRead += byteCount;
+  }
+}
+
+void LoadReport::addBytesDecoded(LoadPhase phase, uint64_t byteCount)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (const auto stats = getPhase(phase)) {
+    stats->bytesDecoded += byteCount;
+  }
+}
+
+void LoadReport::addBytesUploaded(LoadPhase phase, uint64_t byteCount)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (const auto stats = getPhase(phase)) {
+    stats->bytesUploaded += byteCount;
+  }
+}
+
+void LoadReport::setCacheResult(LoadCacheResult result)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_isFinished) {
+    m_cacheResult = result;
+  }
+}
+
+LoadPhaseStats *LoadReport::getPhase(LoadPhase phase)
+{
+  return m_isFinished ? nullptr : &m_phases[size_t(phase)];
+}
+
+void LoadReport::print(std::ostream &out, const LoadReport *previous) const
+{
+  out << "Load report: " << std::fixed << std::setprecision(1)
+      << m_totalTime << " ms";
+  if (previous) {
+    out << " (" << formatChange(m_totalTime, previous->m_totalTime)
+        << " since the previous load)";
+  }
+  out << ", scene cache " << CACHE_RESULT_NAMES[size_t(m_cacheResult)]
+      << std::endl;
+  out << std::left << std::setw(16) << "Phase" << std::right << std::setw(11)
+      << "wall ms" << std::setw(11) << "CPU ms" << std::setw(8) << "util"
+      << std::setw(11) << "read" << std::setw(11) << "decoded"
+      << std::setw(11) << "uploaded";
+  if (previous) {
+    out << std::setw(9) << "change";
+  }
+  out << std::endl;
+  for (size_t i = 0; i < m_phases.size(); ++i) {
+    const auto &stats = m_phases[i];
+    out << std::left << std::setw(16) << PHASE_NAMES[i] << std::right
+        << std::setprecision(1) << std::setw(11) << stats.wallTime
+        << std::setw(11) << stats.cpuTime << std::setw(7)
+        << std::setprecision(0)
+        << 100. * stats.getThreadUtilization(m_nThreadCount) << "%"
+        << std::setw(11) << formatBytes(stats.bytesRead) << std::setw(11)
+        << formatBytes(stats.bytesDecoded) << std::setw(11)
+        << formatBytes(stats.bytesUploaded);
+    if (previous) {
+      out << std::setw(9)
+          << formatChange(stats.wallTime, previous->m_phases[i].wallTime);
+    }
+    out << std::endl;
+  }
+  out << std::defaultfloat;
+}
+
+void LoadReport::drawGUI(const LoadReport *previous) const
+{
+  ImGui::Text("Loaded in %.1f ms, scene cache %s", m_totalTime,
+      CACHE_RESULT_NAMES[size_t(m_cacheResult)]);
+  if (previous) {
+    ImGui::Text("Previous load: %.1f ms (%s)", previous->m_totalTime,
+        formatChange(m_totalTime, previous->m_totalTime).c_str());
+  }
+  ImGui::Columns(previous ? 8 : 7, "Load phases");
+  for (const auto *header :
+      {"Phase", "wall ms", "CPU ms", "util", "read", "decoded", "uploaded"}) {
+    ImGui::Text("%s", header);
+    ImGui::NextColumn();
+  }
+  if (previous) {
+    ImGui::Text("change");
+    ImGui::NextColumn();
+  }
+  ImGui::Separator();
+  for (size_t i = 0; i < m_phases.size(); ++i) {
+    const auto &stats = m_phases[i];
+    ImGui::Text("%s", PHASE_NAMES[i]);
+    ImGui::NextColumn();
+    ImGui::Text("%.1f", stats.wallTime);
+    ImGui::NextColumn();
+    ImGui::Text("%.1f", stats.cpuTime);
+    ImGui::NextColumn();
+    ImGui::Text(
+        "%.0f%%", 100. * stats.getThreadUtilization(m_nThreadCount));
+    ImGui::NextColumn();
+    for (const auto byteCount :
+        {stats.bytesRead, stats.bytesDecoded, stats.bytesUploaded}) {
+      ImGui::Text("%s", formatBytes(byteCount).c_str());
+      ImGui::NextColumn();
+    }
+    if (previous) {
+      ImGui::Text("%s",
+          formatChange(stats.wallTime, previous->m_phases[i].wallTime)
+              .c_str());
+      ImGui::NextColumn();
+    }
+  }
+  ImGui::Columns(1);
+}
+
+bool LoadReport::read(const fs::path &path, std::string &err)
+{
+  std::ifstream file{path.string()};
+  if (!file) {
+    err = "unable to open " + path.string();
+    return false;
+  }
+  try {
+    nlohmann::json document;
+    file >> document;
+    m_totalTime = document.at("totalMs").get<double>();
+    m_nThreadCount =
+        std::max(document.at("threads").get<size_t>(), size_t(1));
+    const auto cacheResult = document.at("sceneCache").get<std::string>();
+    for (size_t i = 0; i < std::size(CACHE_RESULT_NAMES); ++i) {
+      if (cacheResult == CACHE_RESULT_NAMES[i]) {
+        m_cacheResult = LoadCacheResult(i);
+      }
+    }
+    const auto &phases = document.at("phases");
+    for (size_t i = 0; i < m_phases.size(); ++i) {
+      const auto entry = phases.find(PHASE_KEYS[i]);
+      if (entry == phases.end()) {
+        continue;
+      }
+      auto &stats = m_phases[i];
+      stats.wallTime = entry->at("wallMs").get<double>();
+      stats.cpuTime = entry->at("cpuMs").get<double>();
+      stats.bytesRead = entry->at("bytesRead").get<uint64_t>();
+      stats.bytesDecoded = entry->at("bytesDecoded").get<uint64_t>();
+      stats.bytesUploaded = entry->at("bytesUploaded").get<uint64_t>();
+      stats.scopeCount = entry->at("scopes").get<size_t>();
+    }
+  } catch (const std::exception &e) {
+    err = "invalid load report " + path.string() + ": " + e.what();
+    return false;
+  }
+  m_isFinished = true;
+  return true;
+}
+
+bool LoadReport::write(const fs::path &path, std::string &err) const
+{
+  auto phases = nlohmann::json::object();
+  for (size_t i = 0; i < m_phases.size(); ++i) {
+    const auto &stats = m_phases[i];
+    phases[PHASE_KEYS[i]] = {{"wallMs", stats.wallTime},
+        {"cpuMs", stats.cpuTime}, {"bytesRead", stats.bytesRead},
+        {"bytesDecoded", stats.bytesDecoded},
+        {"bytesUploaded", stats.bytesUploaded},
+        {"scopes", stats.scopeCount}};
+  }
+  const nlohmann::json document = {{"totalMs", m_totalTime},
+      {"threads", m_nThreadCount},
+      {"sceneCache", CACHE_RESULT_NAMES[size_t(m_cacheResult)]},
+      {"phases", phases}};
+
+  std::error_code errorCode;
+  fs::create_directories(path.parent_path(), errorCode);
+  std::ofstream file{path.string()};
+  if (!file || !(file << document.dump(2) << std::endl)) {
+    err = "unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
+
+#ifdef _WIN32
+
+double getProcessCpuTime()
+{
+  FILETIME creationTime, exitTime, kernelTime, userTime;
+  if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime,
+          &kernelTime, &userTime)) {
+    return 0.;
+  }
+  // In units of 100 ns
+  const auto toTicks = [](const FILETIME &time) {
+    return (uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+  };
+  return double(toTicks(kernelTime) + toTicks(userTime)) * 1e-4;
+}
+
+#else
+
+double getProcessCpuTime()
+{
+  timespec time;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time)) {
+    return 0.;
+  }
+  return double(time.tv_sec) * 1e3 + double(time.tv_nsec) * 1e-6;
+}
+
+#endif
+
+fs::path getLoadReportPath(
+    const fs::path &sourcePath, const fs::path &reportDirectory)
+{
+  const auto path = fs::absolute(sourcePath).string();
+  return getCacheEntryPath(
+      reportDirectory, fnv1a64(path.data(), path.size()), ".loadreport");
+}
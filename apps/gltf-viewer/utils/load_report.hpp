@@ -0,0 +1,147 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// Phases of the load of a model measured by LoadReport
+enum class LoadPhase
+{
+  FileIo, // Files read, fetched or mapped, including the scene cache
+  JsonParse, // glTF JSON and tinygltf, which decodes images without
+             // parallel decoders
+  BufferDecode, // EXT_meshopt_compression bufferViews
+  ImageDecode, // By parallel decoders
+  Upload, // Buffers and textures created on the GPU
+  ShaderCompile, // Scene programs and material permutations
+  Bounds, // Scene bounds
+  Count
+};
+
+const char *getLoadPhaseName(LoadPhase phase);
+
+enum class LoadCacheResult
+{
+  Unused, // No scene cache
+  Hit,
+  Miss
+};
+
+// Measures of a phase, times in milliseconds
+struct LoadPhaseStats
+{
+  double wallTime = 0.;
+  // CPU time of the process during wallTime, every thread included
+  double cpuTime = 0.;
+  uint64_t bytesRead = 0;
+  uint64_t bytesDecoded = 0;
+  uint64_t bytesUploaded = 0;
+  size_t scopeCount = 0;
+
+  // Share of the hardware threads busy during the phase
+  double getThreadUtilization(size_t threadCount) const
+  {
+    return wallTime > 0. && threadCount ? cpuTime / (wallTime * threadCount)
+                                        : 0.;
+  }
+};
+
+// Time and bytes of each phase of the load of a model, from start() to
+// finish(), so that a slow model tells what it waits for without attaching
+// a profiler (see --profile-load).
+//
+// Phases are measured by scopes, which may run on any thread and as many
+// times as needed, e.g. once per frame for uploads. A scope nested in
+// another one on the same thread is not counted in the outer one: the files
+// read by the JSON parser count as file I/O only. Phases running at the
+// same time on different threads share the CPU time of the process.
+// Scopes and bytes are ignored once the report is finished, so that model
+// reloads and shader reloads do not change it.
+//
+// Reports are written in JSON files (see getLoadReportPath) to compare a
+// load with the previous one of the same file.
+class LoadReport
+{
+public:
+  // Measure phase until destroyed, nothing if report is null
+  class Scope
+  {
+  public:
+    Scope(LoadReport *report, LoadPhase phase);
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    LoadReport *m_report;
+    LoadPhase m_phase;
+    std::chrono::steady_clock::time_point m_start;
+    double m_startCpuTime;
+    Scope *m_parent; // Of the thread
+    // Time of the scopes nested in this one, in milliseconds
+    double m_nestedWallTime = 0.;
+    double m_nestedCpuTime = 0.;
+  };
+
+  LoadReport();
+
+  void start();
+  void finish();
+
+  bool isFinished() const { return m_isFinished; }
+
+  void addBytesRead(LoadPhase phase, uint64_t byteCount);
+  void addBytesDecoded(LoadPhase phase, uint64_t byteCount);
+  void addBytesUploaded(LoadPhase phase, uint64_t byteCount);
+  void setCacheResult(LoadCacheResult result);
+
+  const LoadPhaseStats &phase(LoadPhase phase) const
+  {
+    return m_phases[size_t(phase)];
+  }
+
+  LoadCacheResult cacheResult() const { return m_cacheResult; }
+
+  // From start() to finish(), in milliseconds
+  double totalTime() const { return m_totalTime; }
+
+  // Hardware threads the utilizations are relative to
+  size_t threadCount() const { return m_nThreadCount; }
+
+  // Print a table of the phases, with their change since previous if not
+  // null
+  void print(std::ostream &out, const LoadReport *previous = nullptr) const;
+
+  // Draw the same table in the current ImGui window
+  void drawGUI(const LoadReport *previous = nullptr) const;
+
+  bool read(const fs::path &path, std::string &err);
+  bool write(const fs::path &path, std::string &err) const;
+
+private:
+  LoadPhaseStats *getPhase(LoadPhase phase);
+
+  std::mutex m_mutex; // Of the phases, written by any thread
+  std::array<LoadPhaseStats, size_t(LoadPhase::Count)> m_phases;
+  LoadCacheResult m_cacheResult = LoadCacheResult::Unused;
+  std::chrono::steady_clock::time_point m_startTime;
+  double m_totalTime = 0.;
+  size_t m_nThreadCount = 1;
+  std::atomic<bool> m_isFinished{false};
+};
+
+// CPU time used by every thread of the process, in milliseconds
+double getProcessCpuTime();
+
+// Report of the loads of sourcePath in reportDirectory, named after the hash
+// of its absolute path
+fs::path getLoadReportPath(
+    const fs::path &sourcePath, const fs::path &reportDirectory);
@@ -0,0 +1,276 @@
+#include "log.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+
+const size_t RING_CAPACITY = 256; // Power of two
+// Beyond, the occurrences of a message are counted until the second ends
+const size_t MAX_REPEATS_PER_SECOND = 5;
+
+std::atomic<LogLevel> logLevel{LogLevel::Info};
+
+// Bounded multiple producer queue of "Bounded MPMC queue" (Vyukov): the
+// sequence of a slot tells whether it is free for the enqueue position
+// (sequence == position) or published for the dequeue position (sequence ==
+// position + 1), so producers only compete for the enqueue position and
+// never wait for each other.
+struct LogSlot
+{
+  std::atomic<size_t> sequence{0};
+  LogLevel level = LogLevel::Info;
+  size_t length = 0;
+  char text[MAX_LOG_MESSAGE_LENGTH + 1];
+};
+
+class Logger
+{
+public:
+  Logger()
+  {
+    for (size_t i = 0; i < RING_CAPACITY; ++i) {
+      m_ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_writer = std::thread([this]() { write(); });
+  }
+
+  ~Logger()
+  {
+    m_isStopping.store(true, std::memory_order_release);
+    m_wakeCondition.notify_one();
+    m_writer.join();
+  }
+
+  bool push(LogLevel level, const char *message, size_t length)
+  {
+    auto pos = m_enqueuePos.load(std::memory_order_relaxed);
+    LogSlot *slot = nullptr;
+    for (;;) {
+      slot = &m_ring[pos & (RING_CAPACITY - 1)];
+      const auto sequence = slot->sequence.load(std::memory_order_acquire);
+      const auto diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos);
+      if (diff == 0) {
+        if (m_enqueuePos.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false; // Full
+      } else {
+        pos = m_enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    slot->level = level;
+    slot->length = std::min(length, MAX_LOG_MESSAGE_LENGTH);
+    std::memcpy(slot->text, message, slot->length);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    // May be missed by a writer about to wait, which then wakes up by itself
+    m_wakeCondition.notify_one();
+    return true;
+  }
+
+  void flush()
+  {
+    const auto target = m_enqueuePos.load(std::memory_order_acquire);
+    m_wakeCondition.notify_one();
+    std::unique_lock<std::mutex> lock{m_flushMutex};
+    m_flushCondition.wait(lock, [&]() { return m_nWrittenPos >= target; });
+  }
+
+  void countDropped()
+  {
+    m_droppedCount.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  size_t droppedCount() const
+  {
+    return m_droppedCount.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Repeats
+  {
+    std::chrono::steady_clock::time_point windowStart;
+    size_t count = 0; // In the window
+    LogLevel level = LogLevel::Info;
+    std::string message; // Only kept once count exceeds the limit
+  };
+
+  void write()
+  {
+    for (;;) {
+      // Read before draining so that nothing queued before a stop is lost
+      const auto isStopping = m_isStopping.load(std::memory_order_acquire);
+      const auto now = std::chrono::steady_clock::now();
+      auto wroteMessages = false;
+      for (;;) {
+        auto &slot = m_ring[m_nDequeuePos & (RING_CAPACITY - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) !=
+            m_nDequeuePos + 1) {
+          break;
+        }
+        wroteMessages |=
+            writeMessage(slot.level, slot.text, slot.length, now);
+        slot.sequence.store(
+            m_nDequeuePos + RING_CAPACITY, std::memory_order_release);
+        ++m_nDequeuePos;
+      }
+      wroteMessages |= writeRepeats(now, isStopping);
+      if (wroteMessages) {
+        std::clog.flush();
+        std::cerr.flush();
+      }
+      {
+        std::lock_guard<std::mutex> lock{m_flushMutex};
+        m_nWrittenPos = m_nDequeuePos;
+      }
+      m_flushCondition.notify_all();
+      if (isStopping) {
+        return;
+      }
+
+      std::unique_lock<std::mutex> lock{m_wakeMutex};
+      m_wakeCondition.wait_for(lock, std::chrono::milliseconds(50), [&]() {
+        return m_isStopping.load(std::memory_order_acquire) ||
+               m_ring[m_nDequeuePos & (RING_CAPACITY - 1)].sequence.load(
+                   std::memory_order_acquire) == m_nDequeuePos + 1;
+      });
+    }
+  }
+
+  // Return false if the message is only counted
+  bool writeMessage(LogLevel level, const char *text, size_t length,
+      std::chrono::steady_clock::time_point now)
+  {
+    const auto key = fnv1a64(text, length, uint64_t(level));
+    auto &repeats = m_repeats[key];
+    if (!repeats.count) {
+      repeats.windowStart = now;
+    }
+    if (++repeats.count > MAX_REPEATS_PER_SECOND) {
+      if (repeats.message.empty()) {
+        repeats.level = level;
+        repeats.message.assign(text, length);
+      }
+      return false;
+    }
+    auto &stream = level >= LogLevel::Warning ? std::cerr : std::clog;
+    stream.write(text, std::streamsize(length));
+    stream.put('\n');
+    return true;
+  }
+
+  // Count the messages repeated beyond the limit in the windows that ended,
+  // or in every window if isStopping. Return true if anything was written.
+  bool writeRepeats(
+      std::chrono::steady_clock::time_point now, bool isStopping)
+  {
+    auto wroteMessages = false;
+    for (auto it = begin(m_repeats); it != end(m_repeats);) {
+      const auto &repeats = it->second;
+      if (!isStopping &&
+          now - repeats.windowStart < std::chrono::seconds(1)) {
+        ++it;
+        continue;
+      }
+      if (repeats.count > MAX_REPEATS_PER_SECOND) {
+        auto &stream =
+            repeats.level >= LogLevel::Warning ? std::cerr : std::clog;
+        stream << repeats.message << " (repeated "
+               << repeats.count - MAX_REPEATS_PER_SECOND
+               << " more times)\n";
+        wroteMessages = true;
+      }
+      it = m_repeats.erase(it);
+    }
+    return wroteMessages;
+  }
+
+  std::array<LogSlot, RING_CAPACITY> m_ring;
+  std::atomic<size_t> m_enqueuePos{0};
+  std::atomic<size_t> m_droppedCount{0};
+  size_t m_nDequeuePos = 0; // Writer only
+  // Writer only, by hash of the level and text of the messages
+  std::unordered_map<uint64_t, Repeats> m_repeats;
+
+  std::atomic<bool> m_isStopping{false};
+  std::mutex m_wakeMutex;
+  std::condition_variable m_wakeCondition;
+  std::mutex m_flushMutex;
+  std::condition_variable m_flushCondition;
+  size_t m_nWrittenPos = 0; // Guarded by m_flushMutex
+  std::thread m_writer;
+};
+
+Logger &getLogger()
+{
+  static Logger logger;
+  return logger;
+}
+
+} // namespace
+
+void setLogLevel(LogLevel level)
+{
+  logLevel.store(level, std::memory_order_relaxed);
+}
+
+LogLevel getLogLevel() { return logLevel.load(std::memory_order_relaxed); }
+
+bool isLogged(LogLevel level) { return level >= getLogLevel(); }
+
+void logMessage(LogLevel level, const char *message, size_t length)
+{
+  if (!isLogged(level)) {
+    return;
+  }
+  auto &logger = getLogger();
+  if (level == LogLevel::Error) {
+    // Waits for room rather than losing the error
+    while (!logger.push(level, message, length)) {
+      logger.flush();
+    }
+    logger.flush();
+    return;
+  }
+  if (!logger.push(level, message, length)) {
+    logger.countDropped();
+  }
+}
+
+void logFormat(LogLevel level, const char *format, ...)
+{
+  if (!isLogged(level)) {
+    return;
+  }
+  char message[MAX_LOG_MESSAGE_LENGTH + 1];
+  va_list args;
+  va_start(args, format);
+  const auto length = std::vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  if (length >= 0) {
+    logMessage(level, message,
+        std::min(size_t(length), sizeof(message) - 1));
+  }
+}
+
+void flushLog() { getLogger().flush(); }
+
+size_t getDroppedLogMessageCount()
+{
+  return getLogger().droppedCount();
+}
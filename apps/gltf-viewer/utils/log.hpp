@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Asynchronous log of the messages of the viewer, for the code that must not
+// wait for the console: shader compilation, the GL debug output callback
+// (called inside driver calls on the render thread), loader and worker
+// threads. Messages are copied in a bounded lock-free ring, from any number
+// of threads, and written by a single writer thread, Debug and Info on
+// std::clog, Warning and Error on std::cerr.
+//
+// A call never locks, allocates nor waits, except at Error level: errors
+// usually precede an exception or the exit of the process, so they are
+// written before the call returns, with the messages queued before them.
+// Messages are dropped if the ring is full, and a message repeated more than
+// a few times per second is only counted until the second ends.
+enum class LogLevel
+{
+  Debug,
+  Info,
+  Warning,
+  Error
+};
+
+// Messages below level are dropped by the caller, Info by default
+void setLogLevel(LogLevel level);
+
+LogLevel getLogLevel();
+
+bool isLogged(LogLevel level);
+
+// Queue a line, without its trailing newline. Messages longer than
+// MAX_LOG_MESSAGE_LENGTH are truncated.
+void logMessage(LogLevel level, const char *message, size_t length);
+
+inline void logMessage(LogLevel level, const std::string &message)
+{
+  logMessage(level, message.data(), message.size());
+}
+
+// printf-like logMessage, formatted on the stack
+void logFormat(LogLevel level, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+// Wait until the messages queued so far are written
+void flushLog();
+
+// Messages dropped because the ring was full
+size_t getDroppedLogMessageCount();
+
+const size_t MAX_LOG_MESSAGE_LENGTH = 1023;
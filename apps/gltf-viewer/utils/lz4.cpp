@@ -0,0 +1,202 @@
+#include "lz4.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+const size_t MIN_MATCH = 4;
+// The format ends blocks with literals: a match ends LAST_LITERALS bytes
+// before the end of the block at the latest, and starts MATCH_START_LIMIT
+// bytes before it
+const size_t LAST_LITERALS = 5;
+const size_t MATCH_START_LIMIT = 12;
+const size_t MAX_OFFSET = 65535;
+const int HASH_BITS = 16;
+const uint32_t NO_POSITION = ~uint32_t(0);
+
+uint32_t readUint32(const uint8_t *bytes)
+{
+  uint32_t value;
+  std::memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+uint32_t hashSequence(uint32_t sequence)
+{
+  return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Bytes after a length nibble of 15
+uint8_t *writeLength(uint8_t *out, size_t length)
+{
+  for (length -= 15; length >= 255; length -= 255) {
+    *out++ = 255;
+  }
+  *out++ = uint8_t(length);
+  return out;
+}
+
+// Write literals then a match of matchLength bytes at offset, or the literals
+// only, ending the block, if matchLength is 0
+uint8_t *writeSequence(uint8_t *out, const uint8_t *literals,
+    size_t literalLength, size_t offset, size_t matchLength)
+{
+  const auto token = out++;
+  *token = uint8_t(std::min(literalLength, size_t(15)) << 4);
+  if (literalLength >= 15) {
+    out = writeLength(out, literalLength);
+  }
+  std::memcpy(out, literals, literalLength);
+  out += literalLength;
+  if (!matchLength) {
+    return out;
+  }
+  *out++ = uint8_t(offset);
+  *out++ = uint8_t(offset >> 8);
+  const auto length = matchLength - MIN_MATCH;
+  *token |= uint8_t(std::min(length, size_t(15)));
+  if (length >= 15) {
+    out = writeLength(out, length);
+  }
+  return out;
+}
+
+} // namespace
+
+size_t compressLz4(
+    const uint8_t *src, size_t size, uint8_t *dst, bool highCompression)
+{
+  auto out = dst;
+  size_t anchor = 0; // First literal of the next sequence
+  if (size > MATCH_START_LIMIT) {
+    // Last position of each hash, and with high compression the previous
+    // position of the hash of each position of the window
+    std::vector<uint32_t> lastPositions(size_t(1) << HASH_BITS, NO_POSITION);
+    std::vector<uint32_t> previousPositions(
+        highCompression ? MAX_OFFSET + 1 : 0, NO_POSITION);
+    const auto insert = [&](size_t position) {
+      auto &last = lastPositions[hashSequence(readUint32(src + position))];
+      if (highCompression) {
+        previousPositions[position & MAX_OFFSET] = last;
+      }
+      last = uint32_t(position);
+    };
+    const auto matchEnd = size - LAST_LITERALS;
+    const auto maxAttempts =
+        highCompression ? LZ4_HIGH_COMPRESSION_ATTEMPTS : 1;
+    size_t missCount = 0; // Skips ahead in incompressible data
+    size_t position = 0;
+    while (position + MATCH_START_LIMIT <= size) {
+      const auto sequence = readUint32(src + position);
+      auto candidate = lastPositions[hashSequence(sequence)];
+      size_t bestLength = 0;
+      size_t bestOffset = 0;
+      for (auto attempt = 0; attempt < maxAttempts &&
+                             candidate != NO_POSITION &&
+                             position - candidate <= MAX_OFFSET;
+           ++attempt) {
+        if (readUint32(src + candidate) == sequence) {
+          auto length = MIN_MATCH;
+          while (position + length < matchEnd &&
+                 src[candidate + length] == src[position + length]) {
+            ++length;
+          }
+          if (length > bestLength) {
+            bestLength = length;
+            bestOffset = position - candidate;
+          }
+        }
+        if (!highCompression) {
+          break;
+        }
+        // Entries of the window are overwritten after MAX_OFFSET positions
+        const auto previous = previousPositions[candidate & MAX_OFFSET];
+        if (previous >= candidate) {
+          break;
+        }
+        candidate = previous;
+      }
+      insert(position);
+      if (!bestLength) {
+        position += 1 + (missCount++ >> 6);
+        continue;
+      }
+      out = writeSequence(
+          out, src + anchor, position - anchor, bestOffset, bestLength);
+      const auto end = position + bestLength;
+      if (highCompression) {
+        for (++position; position < end; ++position) {
+          insert(position);
+        }
+      } else {
+        insert(end - 2);
+      }
+      position = anchor = end;
+      missCount = 0;
+    }
+  }
+  out = writeSequence(out, src + anchor, size - anchor, 0, 0);
+  return size_t(out - dst);
+}
+
+bool decompressLz4(
+    const uint8_t *src, size_t size, uint8_t *dst, size_t dstSize)
+{
+  const auto srcEnd = src + size;
+  const auto dstEnd = dst + dstSize;
+  auto out = dst;
+  const auto readLength = [&](size_t &length) {
+    uint8_t byte;
+    do {
+      if (src == srcEnd) {
+        return false;
+      }
+      byte = *src++;
+      length += byte;
+    } while (byte == 255);
+    return true;
+  };
+  while (src < srcEnd) {
+    const auto token = *src++;
+    size_t literalLength = token >> 4;
+    if ((literalLength == 15 && !readLength(literalLength)) ||
+        size_t(srcEnd - src) < literalLength ||
+        size_t(dstEnd - out) < literalLength) {
+      return false;
+    }
+    std::memcpy(out, src, literalLength);
+    out += literalLength;
+    src += literalLength;
+    if (src == srcEnd) {
+      break; // The last sequence has no match
+    }
+    if (srcEnd - src < 2) {
+      return false;
+    }
+    const size_t offset = src[0] | (size_t(src[1]) << 8);
+    src += 2;
+    size_t matchLength = token & 15;
+    if (!offset || offset > size_t(out - dst) ||
+        (matchLength == 15 && !readLength(matchLength))) {
+      return false;
+    }
+    matchLength += MIN_MATCH;
+    if (size_t(dstEnd - out) < matchLength) {
+      return false;
+    }
+    const auto match = out - offset;
+    if (offset >= matchLength) {
+      std::memcpy(out, match, matchLength);
+    } else {
+      // The match repeats the bytes it is writing
+      for (size_t i = 0; i < matchLength; ++i) {
+        out[i] = match[i];
+      }
+    }
+    out += matchLength;
+  }
+  return out == dstEnd;
+}
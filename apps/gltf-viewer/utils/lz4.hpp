@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Compression of blocks in the LZ4 block format
+// (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), readable by
+// any LZ4 decoder given the size of the block: sequences of literals and of
+// matches of 4 bytes or more within the previous 64 KiB. Decoding is a copy
+// loop running at memory speed, which is why the scene cache chunks its data
+// with it (see SceneCacheCompression).
+//
+// The fast encoder keeps the last position of each 4-byte hash, as the
+// reference LZ4 encoder does. The high compression one follows chains of
+// every previous position of the hash, up to LZ4_HIGH_COMPRESSION_ATTEMPTS,
+// and keeps the longest match: about twice as slow to encode for smaller
+// blocks, as fast to decode.
+
+const int LZ4_HIGH_COMPRESSION_ATTEMPTS = 64;
+
+// Size of the buffer given to compressLz4 for size bytes, whatever they are
+inline size_t getLz4CompressBound(size_t size)
+{
+  return size + size / 255 + 16;
+}
+
+// Compress src[0 : size] into dst, of getLz4CompressBound(size) bytes, and
+// return the size of the block
+size_t compressLz4(const uint8_t *src, size_t size, uint8_t *dst,
+    bool highCompression = false);
+
+// Decompress the block src[0 : size] into dst[0 : dstSize]. Return false if
+// the block is invalid or does not decompress to exactly dstSize bytes.
+bool decompressLz4(
+    const uint8_t *src, size_t size, uint8_t *dst, size_t dstSize);
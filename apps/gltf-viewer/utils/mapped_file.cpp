@@ -0,0 +1,142 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const fs::path &path)
+{
+  const auto file = CreateFileW(path.wstring().c_str(), GENERIC_READ,
+      FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+      nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("Unable to open file " + path.string());
+  }
+  m_hFile = file;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize)) {
+    release();
+    throw std::runtime_error("Unable to get size of file " + path.string());
+  }
+  if (fileSize.QuadPart == 0) {
+    return;
+  }
+
+  m_hMapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!m_hMapping) {
+    release();
+    throw std::runtime_error("Unable to map file " + path.string());
+  }
+
+  m_pData = static_cast<const unsigned char *>(
+      MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+  if (!m_pData) {
+    release();
+    throw std::runtime_error("Unable to map file " + path.string());
+  }
+  m_nSize = size_t(fileSize.QuadPart);
+}
+
+void MappedFile::release()
+{
+  if (m_pData) {
+    UnmapViewOfFile(m_pData);
+  }
+  if (m_hMapping) {
+    CloseHandle(m_hMapping);
+  }
+  if (m_hFile) {
+    CloseHandle(m_hFile);
+  }
+  m_pData = nullptr;
+  m_nSize = 0;
+  m_hMapping = nullptr;
+  m_hFile = nullptr;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_pData, rvalue.m_pData);
+    std::swap(m_nSize, rvalue.m_nSize);
+    std::swap(m_hFile, rvalue.m_hFile);
+    std::swap(m_hMapping, rvalue.m_hMapping);
+  }
+  return *this;
+}
+
+#else
+
+MappedFile::MappedFile(const fs::path &path)
+{
+  const auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open file " + path.string());
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0) {
+    close(fd);
+    throw std::runtime_error("Unable to get size of file " + path.string());
+  }
+  if (fileStat.st_size == 0) {
+    close(fd);
+    return;
+  }
+
+  const auto size = size_t(fileStat.st_size);
+  const auto ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping keeps a reference on the file
+  if (ptr == MAP_FAILED) {
+    throw std::runtime_error("Unable to map file " + path.string());
+  }
+
+  // Buffer upload reads the file from start to end
+  madvise(ptr, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  // Where the kernel backs the page cache with transparent huge pages, large
+  // files take fewer TLB misses when decoded or pinned (MAP_HUGETLB only
+  // maps anonymous memory and hugetlbfs files)
+  const size_t hugePageSize = size_t(2) << 20;
+  if (size >= hugePageSize) {
+    madvise(ptr, size, MADV_HUGEPAGE);
+  }
+#endif
+
+  m_pData = static_cast<const unsigned char *>(ptr);
+  m_nSize = size;
+}
+
+void MappedFile::release()
+{
+  if (m_pData) {
+    munmap(const_cast<unsigned char *>(m_pData), m_nSize);
+  }
+  m_pData = nullptr;
+  m_nSize = 0;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_pData, rvalue.m_pData);
+    std::swap(m_nSize, rvalue.m_nSize);
+  }
+  return *this;
+}
+
+#endif
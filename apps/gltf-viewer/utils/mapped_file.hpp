@@ -0,0 +1,44 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstddef>
+#include <utility>
+
+// Read-only memory mapping of a whole file. Pages are loaded lazily by the OS
+// when they are first accessed, so mapping a file costs almost nothing and the
+// memory is shared with the page cache instead of being copied on the heap.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+
+  // Map the whole file, throw std::runtime_error on failure
+  explicit MappedFile(const fs::path &path);
+
+  ~MappedFile() { release(); }
+
+  // Non-copyable class:
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&rvalue) { *this = std::move(rvalue); }
+
+  MappedFile &operator=(MappedFile &&rvalue);
+
+  const unsigned char *data() const { return m_pData; }
+
+  size_t size() const { return m_nSize; }
+
+  bool empty() const { return m_nSize == 0; }
+
+private:
+  void release();
+
+  const unsigned char *m_pData = nullptr;
+  size_t m_nSize = 0;
+#ifdef _WIN32
+  void *m_hFile = nullptr;
+  void *m_hMapping = nullptr;
+#endif
+};
@@ -0,0 +1,390 @@
+#include "material_buffer.hpp"
+#include "gl_extensions.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <map>
+#include <tuple>
+
+namespace
+{
+
+// Textures sharing the same storage layout and sampler can be layers of a
+// texture array
+struct TextureLayout
+{
+  GLint width;
+  GLint height;
+  GLint internalFormat;
+  GLint levelCount;
+  GLuint sampler = 0;
+
+  bool operator<(const TextureLayout &rhs) const
+  {
+    return std::tie(width, height, internalFormat, levelCount, sampler) <
+           std::tie(rhs.width, rhs.height, rhs.internalFormat,
+               rhs.levelCount, rhs.sampler);
+  }
+};
+
+TextureLayout getTextureLayout(GLuint texture)
+{
+  TextureLayout layout{};
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &layout.width);
+  glGetTexLevelParameteriv(
+      GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &layout.height);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT,
+      &layout.internalFormat);
+  glGetTexParameteriv(
+      GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_LEVELS, &layout.levelCount);
+  return layout;
+}
+
+// Factors of the default material followed by those of the materials of
+// model, and the texture of each of their slots in model.textures (-1 if
+// none)
+void readMaterials(const tinygltf::Model &model,
+    std::vector<MaterialBuffer::MaterialData> &materials,
+    std::vector<std::array<int, MaterialBuffer::TEXTURE_SLOT_COUNT>>
+        &materialTextures)
+{
+  materials.assign(model.materials.size() + 1, {});
+  materialTextures.resize(materials.size());
+  materialTextures[0].fill(-1);
+  for (size_t i = 0; i < model.materials.size(); ++i) {
+    const auto &material = model.materials[i];
+    const auto &pbr = material.pbrMetallicRoughness;
+    auto &data = materials[i + 1];
+    for (size_t c = 0; c < 4 && c < pbr.baseColorFactor.size(); ++c) {
+      data.baseColorFactor[c] = float(pbr.baseColorFactor[c]);
+    }
+    for (size_t c = 0; c < 3 && c < material.emissiveFactor.size(); ++c) {
+      data.emissiveFactor[c] = float(material.emissiveFactor[c]);
+    }
+    if (material.alphaMode == "MASK") {
+      data.alphaCutoff = float(material.alphaCutoff);
+    }
+    data.metallicFactor = float(pbr.metallicFactor);
+    data.roughnessFactor = float(pbr.roughnessFactor);
+    data.normalScale = float(material.normalTexture.scale);
+    data.occlusionStrength = float(material.occlusionTexture.strength);
+
+    auto &slots = materialTextures[i + 1];
+    slots[MaterialBuffer::BASE_COLOR_TEXTURE] = pbr.baseColorTexture.index;
+    slots[MaterialBuffer::METALLIC_ROUGHNESS_TEXTURE] =
+        pbr.metallicRoughnessTexture.index;
+    slots[MaterialBuffer::NORMAL_TEXTURE] = material.normalTexture.index;
+    slots[MaterialBuffer::OCCLUSION_TEXTURE] =
+        material.occlusionTexture.index;
+    slots[MaterialBuffer::EMISSIVE_TEXTURE] = material.emissiveTexture.index;
+  }
+}
+
+} // namespace
+
+MaterialBuffer &MaterialBuffer::operator=(MaterialBuffer &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_buffer, rvalue.m_buffer);
+    std::swap(m_nMaterialCount, rvalue.m_nMaterialCount);
+    std::swap(m_nTextureCount, rvalue.m_nTextureCount);
+    std::swap(m_nDownscaledTextureCount, rvalue.m_nDownscaledTextureCount);
+    std::swap(m_isBindless, rvalue.m_isBindless);
+    std::swap(m_handles, rvalue.m_handles);
+    std::swap(m_samplers, rvalue.m_samplers);
+    std::swap(m_arrays, rvalue.m_arrays);
+    std::swap(m_arraySamplers, rvalue.m_arraySamplers);
+    std::swap(m_bufferMemory, rvalue.m_bufferMemory);
+    std::swap(m_arrayMemory, rvalue.m_arrayMemory);
+  }
+  return *this;
+}
+
+void MaterialBuffer::build(const tinygltf::Model &model,
+    const std::vector<GLuint> &textures, bool useBindless,
+    const SamplerSettings &samplerSettings)
+{
+  release();
+  m_isBindless = useBindless;
+  m_samplers = SamplerCache(samplerSettings);
+
+  std::vector<MaterialData> materials;
+  std::vector<std::array<int, TEXTURE_SLOT_COUNT>> materialTextures;
+  readMaterials(model, materials, materialTextures);
+  for (auto &slots : materialTextures) {
+    for (auto &textureIdx : slots) {
+      if (textureIdx < 0 || size_t(textureIdx) >= textures.size() ||
+          !textures[textureIdx]) {
+        textureIdx = -1;
+      }
+    }
+  }
+
+  // Reference of each texture of model.textures, (0, 0) if unused
+  std::vector<glm::uvec2> textureRefs(textures.size(), glm::uvec2(0));
+  std::vector<bool> isTextureUsed(textures.size(), false);
+  for (const auto &slots : materialTextures) {
+    for (const auto textureIdx : slots) {
+      if (textureIdx >= 0) {
+        isTextureUsed[textureIdx] = true;
+      }
+    }
+  }
+
+  if (useBindless) {
+    // A handle per texture and sampler pair, the sampler state is part of
+    // the handle
+    const auto &extensions = getGLExtensions();
+    std::map<std::pair<GLuint, GLuint>, GLuint64> handles;
+    for (size_t textureIdx = 0; textureIdx < textures.size(); ++textureIdx) {
+      if (!isTextureUsed[textureIdx]) {
+        continue;
+      }
+      const auto sampler =
+          m_samplers.get(getSamplerState(model, int(textureIdx)));
+      auto &handle = handles[{textures[textureIdx], sampler}];
+      if (!handle) {
+        handle =
+            extensions.getTextureSamplerHandle(textures[textureIdx], sampler);
+        extensions.makeTextureHandleResident(handle);
+        m_handles.push_back(handle);
+      }
+      textureRefs[textureIdx] =
+          glm::uvec2(GLuint(handle & 0xFFFFFFFF), GLuint(handle >> 32));
+    }
+    m_nTextureCount = m_handles.size();
+  } else {
+    // Textures are copied once even if several glTF textures share them
+    // with the same sampler state. References are the array index plus one
+    // and the layer, (0, 0) for dropped textures.
+    std::map<std::pair<GLuint, GLuint>, TextureLayout> textureLayouts;
+    std::vector<GLuint> textureSamplers(textures.size(), 0);
+    std::map<TextureLayout, size_t> layoutLayerCounts;
+    for (size_t textureIdx = 0; textureIdx < textures.size(); ++textureIdx) {
+      if (!isTextureUsed[textureIdx]) {
+        continue;
+      }
+      const auto texture = textures[textureIdx];
+      const auto sampler =
+          m_samplers.get(getSamplerState(model, int(textureIdx)));
+      textureSamplers[textureIdx] = sampler;
+      if (textureLayouts.count({texture, sampler})) {
+        continue;
+      }
+      auto layout = getTextureLayout(texture);
+      layout.sampler = sampler;
+      textureLayouts[{texture, sampler}] = layout;
+      ++layoutLayerCounts[layout];
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // The layouts shared by the most textures get the arrays, so that past
+    // MAX_TEXTURE_ARRAYS layouts only the rarest ones have none
+    std::vector<std::pair<TextureLayout, size_t>> layouts(
+        begin(layoutLayerCounts), end(layoutLayerCounts));
+    std::stable_sort(begin(layouts), end(layouts),
+        [](const auto &lhs, const auto &rhs) {
+          return lhs.second > rhs.second;
+        });
+    layouts.resize(std::min(layouts.size(), MAX_TEXTURE_ARRAYS));
+    // Layers of each array: a texture and its level copied to level 0
+    std::vector<std::pair<TextureLayout, std::vector<std::pair<GLuint, GLint>>>>
+        arrays;
+    std::map<TextureLayout, size_t> layoutToArray;
+    for (const auto &layoutCount : layouts) {
+      layoutToArray.emplace(layoutCount.first, arrays.size());
+      arrays.push_back({layoutCount.first, {}});
+    }
+
+    // The others become layers of an array of their format and sampler
+    // whose size is one of their levels, without their finer levels, rather
+    // than being dropped
+    const auto findDownscaledArray = [&](const TextureLayout &layout,
+                                         GLint &firstLevel) {
+      // The largest of them
+      auto bestArrayIdx = arrays.size();
+      for (size_t arrayIdx = 0; arrayIdx < arrays.size(); ++arrayIdx) {
+        const auto &arrayLayout = arrays[arrayIdx].first;
+        if (arrayLayout.internalFormat != layout.internalFormat ||
+            arrayLayout.sampler != layout.sampler) {
+          continue;
+        }
+        for (GLint level = 1; level < layout.levelCount; ++level) {
+          if ((layout.width >> level) == arrayLayout.width &&
+              (layout.height >> level) == arrayLayout.height &&
+              layout.levelCount - level >= arrayLayout.levelCount &&
+              (bestArrayIdx == arrays.size() || level < firstLevel)) {
+            bestArrayIdx = arrayIdx;
+            firstLevel = level;
+          }
+        }
+      }
+      return bestArrayIdx;
+    };
+    std::map<std::pair<GLuint, GLuint>, glm::uvec2> textureLayers;
+    size_t droppedCount = 0;
+    for (const auto &textureLayout : textureLayouts) {
+      const auto &layout = textureLayout.second;
+      auto firstLevel = GLint(0);
+      auto arrayIdx = arrays.size();
+      const auto it = layoutToArray.find(layout);
+      if (it != end(layoutToArray)) {
+        arrayIdx = it->second;
+      } else {
+        arrayIdx = findDownscaledArray(layout, firstLevel);
+      }
+      if (arrayIdx == arrays.size()) {
+        ++droppedCount;
+        textureLayers[textureLayout.first] = glm::uvec2(0);
+        continue;
+      }
+      if (firstLevel > 0) {
+        ++m_nDownscaledTextureCount;
+      }
+      auto &layers = arrays[arrayIdx].second;
+      textureLayers[textureLayout.first] =
+          glm::uvec2(GLuint(arrayIdx + 1), GLuint(layers.size()));
+      layers.emplace_back(textureLayout.first.first, firstLevel);
+    }
+
+    size_t arrayBytes = 0;
+    for (const auto &array : arrays) {
+      const auto &layout = array.first;
+      const auto &layers = array.second;
+      GLuint id = 0;
+      glGenTextures(1, &id);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+      glTexStorage3D(GL_TEXTURE_2D_ARRAY, layout.levelCount,
+          GLenum(layout.internalFormat), layout.width, layout.height,
+          GLsizei(layers.size()));
+      for (size_t layer = 0; layer < layers.size(); ++layer) {
+        const auto &source = layers[layer];
+        for (GLint level = 0; level < layout.levelCount; ++level) {
+          glCopyImageSubData(source.first, GL_TEXTURE_2D,
+              source.second + level, 0, 0, 0, id, GL_TEXTURE_2D_ARRAY, level,
+              0, 0, GLint(layer), std::max(layout.width >> level, 1),
+              std::max(layout.height >> level, 1), 1);
+        }
+      }
+      m_arrays.push_back(id);
+      m_arraySamplers.push_back(layout.sampler);
+      arrayBytes += getTextureByteSize(GLenum(layout.internalFormat),
+          size_t(layout.width), size_t(layout.height),
+          size_t(layout.levelCount), layers.size());
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    m_arrayMemory = TrackedGLMemory(GLMemoryCategory::Textures, arrayBytes);
+
+    for (size_t textureIdx = 0; textureIdx < textures.size(); ++textureIdx) {
+      if (isTextureUsed[textureIdx]) {
+        textureRefs[textureIdx] =
+            textureLayers[{textures[textureIdx], textureSamplers[textureIdx]}];
+      }
+    }
+    m_nTextureCount = textureLayers.size() - droppedCount;
+    if (droppedCount) {
+      std::cerr << "Warning: " << droppedCount
+                << " textures do not fit in " << MAX_TEXTURE_ARRAYS
+                << " texture arrays and are ignored" << std::endl;
+    }
+    if (m_nDownscaledTextureCount) {
+      std::cerr << "Warning: " << m_nDownscaledTextureCount
+                << " textures are downscaled to fit in "
+                << MAX_TEXTURE_ARRAYS << " texture arrays" << std::endl;
+    }
+  }
+
+  for (size_t i = 0; i < materials.size(); ++i) {
+    for (size_t slot = 0; slot < TEXTURE_SLOT_COUNT; ++slot) {
+      const auto textureIdx = materialTextures[i][slot];
+      if (textureIdx >= 0) {
+        materials[i].textures[slot] = textureRefs[textureIdx];
+      }
+    }
+  }
+
+  upload(materials);
+}
+
+void MaterialBuffer::buildVirtual(
+    const tinygltf::Model &model, const std::vector<glm::uvec2> &textureRefs)
+{
+  release();
+  std::vector<MaterialData> materials;
+  std::vector<std::array<int, TEXTURE_SLOT_COUNT>> materialTextures;
+  readMaterials(model, materials, materialTextures);
+  std::vector<bool> isTextureUsed(textureRefs.size(), false);
+  for (size_t i = 0; i < materials.size(); ++i) {
+    for (size_t slot = 0; slot < TEXTURE_SLOT_COUNT; ++slot) {
+      const auto textureIdx = materialTextures[i][slot];
+      if (textureIdx >= 0 && size_t(textureIdx) < textureRefs.size() &&
+          textureRefs[textureIdx].x) {
+        materials[i].textures[slot] = textureRefs[textureIdx];
+        isTextureUsed[textureIdx] = true;
+      }
+    }
+  }
+  m_nTextureCount =
+      size_t(std::count(isTextureUsed.begin(), isTextureUsed.end(), true));
+  upload(materials);
+}
+
+void MaterialBuffer::upload(const std::vector<MaterialData> &materials)
+{
+  glGenBuffers(1, &m_buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      materials.size() * sizeof(MaterialData), materials.data(), 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  m_bufferMemory = TrackedGLMemory(
+      GLMemoryCategory::Buffers, materials.size() * sizeof(MaterialData));
+  m_nMaterialCount = materials.size();
+}
+
+void MaterialBuffer::bind() const
+{
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIALS_BINDING, m_buffer);
+  if (!m_arrays.empty()) {
+    glBindTextures(0, GLsizei(m_arrays.size()), m_arrays.data());
+    glBindSamplers(0, GLsizei(m_arraySamplers.size()), m_arraySamplers.data());
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void MaterialBuffer::unbind() const
+{
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIALS_BINDING, 0);
+  if (!m_arrays.empty()) {
+    glBindTextures(0, GLsizei(m_arrays.size()), nullptr);
+    glBindSamplers(0, GLsizei(m_arraySamplers.size()), nullptr);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void MaterialBuffer::release()
+{
+  if (m_buffer) {
+    glDeleteBuffers(1, &m_buffer);
+  }
+  const auto &extensions = getGLExtensions();
+  for (const auto handle : m_handles) {
+    extensions.makeTextureHandleNonResident(handle);
+  }
+  if (!m_arrays.empty()) {
+    glDeleteTextures(GLsizei(m_arrays.size()), m_arrays.data());
+  }
+  m_buffer = 0;
+  m_nMaterialCount = 0;
+  m_nTextureCount = 0;
+  m_nDownscaledTextureCount = 0;
+  m_isBindless = false;
+  m_handles.clear();
+  m_samplers = SamplerCache();
+  m_arrays.clear();
+  m_arraySamplers.clear();
+  m_bufferMemory = TrackedGLMemory();
+  m_arrayMemory = TrackedGLMemory();
+}
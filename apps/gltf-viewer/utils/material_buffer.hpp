@@ -0,0 +1,132 @@
+#pragma once
+
+#include "gl_memory.hpp"
+#include "sampler_cache.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Parameters of the glTF materials of a model in one shader storage buffer
+// (binding MATERIALS_BINDING, see materials.glsl), indexed by the material
+// of each draw (see ArenaPrimitive::materialID). Draws of different
+// materials then need no state change, so that the whole scene can be
+// submitted by IndirectDrawList.
+//
+// With GL_ARB_bindless_texture, materials hold the handles of their textures,
+// made resident for the lifetime of the buffer. Otherwise the textures are
+// copied into texture arrays, one per size, format and sampler state, bound
+// to the first texture units with their sampler and materials hold their
+// array and layer, so that draws of different materials still need no
+// texture binding. Either way glTF samplers become the shared sampler
+// objects of a SamplerCache. Only MAX_TEXTURE_ARRAYS arrays are created, for
+// the layouts shared by the most textures. The other textures join an array
+// of their format and sampler whose size is one of their mip levels,
+// downscaled, or are dropped if there is none (their materials use their
+// factors only).
+class MaterialBuffer
+{
+public:
+  static const GLuint MATERIALS_BINDING = 6;
+  // Size of uTextureArrays in materials.glsl
+  static constexpr size_t MAX_TEXTURE_ARRAYS = 16;
+
+  // Textures of a material, in the order of MaterialData::textures
+  enum TextureSlot
+  {
+    BASE_COLOR_TEXTURE,
+    METALLIC_ROUGHNESS_TEXTURE,
+    NORMAL_TEXTURE,
+    OCCLUSION_TEXTURE,
+    EMISSIVE_TEXTURE,
+    TEXTURE_SLOT_COUNT
+  };
+
+  // Matches Material in materials.glsl (std430)
+  struct MaterialData
+  {
+    glm::vec4 baseColorFactor = glm::vec4(1);
+    glm::vec3 emissiveFactor = glm::vec3(0);
+    float alphaCutoff = 0.f; // 0 unless alphaMode is MASK
+    float metallicFactor = 1.f;
+    float roughnessFactor = 1.f;
+    float normalScale = 1.f;
+    float occlusionStrength = 1.f;
+    // Bindless handle, texture array index plus one and layer, or virtual
+    // texture plus one and wrap modes. (0, 0) if the material has no texture
+    // in this slot.
+    glm::uvec2 textures[TEXTURE_SLOT_COUNT] = {};
+    glm::uvec2 padding = glm::uvec2(0);
+  };
+
+  MaterialBuffer() = default;
+
+  ~MaterialBuffer() { release(); }
+
+  // Non-copyable class:
+  MaterialBuffer(const MaterialBuffer &) = delete;
+  MaterialBuffer &operator=(const MaterialBuffer &) = delete;
+
+  MaterialBuffer(MaterialBuffer &&rvalue) { *this = std::move(rvalue); }
+
+  MaterialBuffer &operator=(MaterialBuffer &&rvalue);
+
+  // Upload the default material (ID 0) followed by the materials of model.
+  // textures[i] is the GL texture of model.textures[i] (0 if it has none, or
+  // if textures is shorter), it must outlive the buffer with bindless
+  // textures. useBindless requires getGLExtensions().bindlessTexture.
+  // samplerSettings applies to every sampler.
+  void build(const tinygltf::Model &model, const std::vector<GLuint> &textures,
+      bool useBindless, const SamplerSettings &samplerSettings = {});
+
+  // Upload the materials of model for VirtualTextures: textureRefs[i] is the
+  // reference of model.textures[i] given by VirtualTextures::getTextureRefs,
+  // (0, 0) if it has no virtual texture. No texture is bound.
+  void buildVirtual(const tinygltf::Model &model,
+      const std::vector<glm::uvec2> &textureRefs);
+
+  // Bind the storage buffer, and the texture arrays and their samplers to
+  // units 0 to arrayCount() - 1
+  void bind() const;
+
+  // Unbind what bind() bound and make unit 0 active
+  void unbind() const;
+
+  size_t materialCount() const { return m_nMaterialCount; }
+
+  // Number of textures referenced by the materials
+  size_t textureCount() const { return m_nTextureCount; }
+
+  // Of them, textures in an array smaller than their size
+  size_t downscaledTextureCount() const { return m_nDownscaledTextureCount; }
+
+  bool isBindless() const { return m_isBindless; }
+
+  size_t arrayCount() const { return m_arrays.size(); }
+
+  // Number of distinct sampler objects
+  size_t samplerCount() const { return m_samplers.size(); }
+
+private:
+  void release();
+
+  // Create the storage buffer of materials
+  void upload(const std::vector<MaterialData> &materials);
+
+  GLuint m_buffer = 0;
+  size_t m_nMaterialCount = 0;
+  size_t m_nTextureCount = 0;
+  size_t m_nDownscaledTextureCount = 0;
+  bool m_isBindless = false;
+  // Resident handles, created with samplers of m_samplers
+  std::vector<GLuint64> m_handles;
+  SamplerCache m_samplers;
+  std::vector<GLuint> m_arrays;
+  std::vector<GLuint> m_arraySamplers; // Sampler of each array
+  TrackedGLMemory m_bufferMemory;
+  TrackedGLMemory m_arrayMemory;
+};
@@ -0,0 +1,63 @@
+#include "material_permutations.hpp"
+
+#include <algorithm>
+
+uint32_t getMaterialPermutationKey(const CompactModel &model, int materialIdx)
+{
+  const auto material = model.material(materialIdx);
+  if (!material) {
+    return 0;
+  }
+  uint32_t key = 0;
+  if (material->alphaMode == AlphaMode::Mask) {
+    key |= MATERIAL_ALPHA_MASK;
+  }
+  if (material->unlit) {
+    key |= MATERIAL_UNLIT;
+  }
+  if (material->baseColorTexture >= 0) {
+    key |= MATERIAL_BASE_COLOR_TEXTURE;
+  }
+  // Unlit materials only read their base color
+  if (material->metallicRoughnessTexture >= 0 && !material->unlit) {
+    key |= MATERIAL_METALLIC_ROUGHNESS_TEXTURE;
+  }
+  if (material->occlusionTexture >= 0 && !material->unlit) {
+    key |= MATERIAL_OCCLUSION_TEXTURE;
+  }
+  if (material->emissiveTexture >= 0 && !material->unlit) {
+    key |= MATERIAL_EMISSIVE_TEXTURE;
+  }
+  return key;
+}
+
+ShaderDefines getMaterialPermutationDefines(uint32_t key)
+{
+  static const std::pair<MaterialFeature, const char *> features[] = {
+      {MATERIAL_ALPHA_MASK, "ALPHA_MASK"}, {MATERIAL_UNLIT, "UNLIT"},
+      {MATERIAL_BASE_COLOR_TEXTURE, "HAS_BASE_COLOR_TEXTURE"},
+      {MATERIAL_METALLIC_ROUGHNESS_TEXTURE, "HAS_METALLIC_ROUGHNESS_TEXTURE"},
+      {MATERIAL_OCCLUSION_TEXTURE, "HAS_OCCLUSION_TEXTURE"},
+      {MATERIAL_EMISSIVE_TEXTURE, "HAS_EMISSIVE_TEXTURE"},
+      {MATERIAL_ALPHA_TO_COVERAGE, "ALPHA_TO_COVERAGE"}};
+  ShaderDefines defines{{"MATERIAL_PERMUTATION", ""}};
+  for (const auto &feature : features) {
+    if (key & feature.first) {
+      defines[feature.second] = "";
+    }
+  }
+  return defines;
+}
+
+MaterialPermutations::MaterialPermutations(const CompactModel &model)
+{
+  materialPermutations.resize(model.materialCount() + 1);
+  for (size_t i = 0; i < materialPermutations.size(); ++i) {
+    const auto key = getMaterialPermutationKey(model, int(i) - 1);
+    const auto it = std::find(begin(keys), end(keys), key);
+    materialPermutations[i] = uint32_t(it - begin(keys));
+    if (it == end(keys)) {
+      keys.push_back(key);
+    }
+  }
+}
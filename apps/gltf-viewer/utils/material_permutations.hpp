@@ -0,0 +1,53 @@
+#pragma once
+
+#include "compact_model.hpp"
+#include "shaders.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Shader permutations of materials
+//
+// Fragment shaders reading the Materials buffer (see materials.glsl) branch
+// on the textures and alpha mode of the material of each fragment. Compiled
+// with MATERIAL_PERMUTATION, they instead only keep the features enabled by
+// the defines of a permutation key, the features a set of materials use.
+// The materials of a scene fall in a few keys, whose programs are compiled
+// when the scene is loaded rather than when a material is first drawn.
+
+// Features of a permutation key
+enum MaterialFeature : uint32_t
+{
+  MATERIAL_ALPHA_MASK = 1 << 0,
+  MATERIAL_UNLIT = 1 << 1, // KHR_materials_unlit
+  MATERIAL_BASE_COLOR_TEXTURE = 1 << 2,
+  MATERIAL_METALLIC_ROUGHNESS_TEXTURE = 1 << 3,
+  MATERIAL_OCCLUSION_TEXTURE = 1 << 4,
+  MATERIAL_EMISSIVE_TEXTURE = 1 << 5,
+  // Never in the key of a material: with MATERIAL_ALPHA_MASK, the variant
+  // drawn on multisampled targets, writing the coverage of the fragment as
+  // alpha for GL_SAMPLE_ALPHA_TO_COVERAGE instead of discarding it
+  MATERIAL_ALPHA_TO_COVERAGE = 1 << 6
+};
+
+// Permutation key of material materialIdx of model, -1 for the default
+// material
+uint32_t getMaterialPermutationKey(const CompactModel &model, int materialIdx);
+
+// Defines of the variant of a permutation key: MATERIAL_PERMUTATION and a
+// define per feature (ALPHA_MASK, UNLIT, HAS_BASE_COLOR_TEXTURE,
+// ALPHA_TO_COVERAGE...)
+ShaderDefines getMaterialPermutationDefines(uint32_t key);
+
+// Permutation keys of the materials of a model
+struct MaterialPermutations
+{
+  std::vector<uint32_t> keys; // Distinct, in the order of the materials
+  // Index in keys of each material, indexed by material + 1 so that the
+  // default material comes first (as in RenderQueue keys)
+  std::vector<uint32_t> materialPermutations;
+
+  MaterialPermutations() = default;
+
+  explicit MaterialPermutations(const CompactModel &model);
+};
@@ -0,0 +1,91 @@
+#include "material_variants.hpp"
+
+namespace
+{
+
+const char *const VARIANTS_EXTENSION = "KHR_materials_variants";
+
+} // namespace
+
+MaterialVariants::MaterialVariants(const tinygltf::Model &model)
+{
+  const auto extension = model.extensions.find(VARIANTS_EXTENSION);
+  if (extension == end(model.extensions)) {
+    return;
+  }
+  const auto &variants = extension->second.Get("variants");
+  for (size_t i = 0; variants.IsArray() && i < variants.ArrayLen(); ++i) {
+    const auto &name = variants.Get(int(i)).Get("name");
+    m_names.push_back(name.IsString() ? name.Get<std::string>()
+                                      : "Variant " + std::to_string(i));
+  }
+  if (m_names.empty()) {
+    return;
+  }
+
+  const auto stride = m_names.size() + 1;
+  uint32_t primitiveIdx = 0;
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      const auto it = primitive.extensions.find(VARIANTS_EXTENSION);
+      if (it == end(primitive.extensions)) {
+        ++primitiveIdx;
+        continue;
+      }
+      const auto firstMaterial = m_materials.size();
+      const auto ownMaterial =
+          size_t(primitive.material) < model.materials.size()
+              ? primitive.material
+              : -1;
+      m_materials.resize(firstMaterial + stride, ownMaterial);
+      const auto &mappings = it->second.Get("mappings");
+      for (size_t i = 0; mappings.IsArray() && i < mappings.ArrayLen(); ++i) {
+        const auto &mapping = mappings.Get(int(i));
+        const auto &material = mapping.Get("material");
+        const auto &mappedVariants = mapping.Get("variants");
+        if (!material.IsNumber() || !mappedVariants.IsArray()) {
+          continue;
+        }
+        for (size_t j = 0; j < mappedVariants.ArrayLen(); ++j) {
+          const auto &variant = mappedVariants.Get(int(j));
+          const auto variantIdx =
+              variant.IsNumber() ? variant.GetNumberAsInt() : -1;
+          if (variantIdx >= 0 && size_t(variantIdx) < m_names.size()) {
+            // Invalid materials are the default one, as in the arena
+            const auto materialIdx = material.GetNumberAsInt();
+            m_materials[firstMaterial + 1 + variantIdx] =
+                size_t(materialIdx) < model.materials.size() ? materialIdx
+                                                             : -1;
+          }
+        }
+      }
+      m_primitives.push_back(primitiveIdx++);
+    }
+  }
+}
+
+size_t MaterialVariants::select(int variantIdx, CompactModel &compact,
+    std::vector<ArenaPrimitive> &primitives)
+{
+  if (variantIdx < -1 || variantIdx >= int(m_names.size())) {
+    return 0;
+  }
+  const auto stride = m_names.size() + 1;
+  const auto previous = size_t(m_nSelected + 1);
+  const auto next = size_t(variantIdx + 1);
+  m_nSelected = variantIdx;
+  size_t changedCount = 0;
+  for (size_t i = 0; i < m_primitives.size(); ++i) {
+    const auto material = m_materials[i * stride + next];
+    if (material == m_materials[i * stride + previous] ||
+        m_primitives[i] >= compact.primitiveCount()) {
+      continue;
+    }
+    compact.setMaterial(m_primitives[i], material);
+    if (m_primitives[i] < primitives.size()) {
+      primitives[m_primitives[i]].materialID = GLuint(material + 1);
+    }
+    ++changedCount;
+  }
+  return changedCount;
+}
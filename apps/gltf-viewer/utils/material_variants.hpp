@@ -0,0 +1,60 @@
+#pragma once
+
+#include "compact_model.hpp"
+#include "geometry_arena.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Material variants of a model (KHR_materials_variants)
+//
+// A primitive may map some variants to other materials, the primitives
+// without a mapping for the selected variant keep their own material. The
+// mappings are resolved once after import into a material per mapped
+// primitive and variant, so that selecting a variant only sets the materials
+// of the mapped primitives in the CompactModel and the ArenaPrimitive
+// material IDs read by the draws (see MaterialBuffer): draws are queued and
+// sorted with their new material in the next frame, no geometry is uploaded
+// again and textures are already bound by the material buffer.
+class MaterialVariants
+{
+public:
+  MaterialVariants() = default;
+
+  explicit MaterialVariants(const tinygltf::Model &model);
+
+  bool empty() const { return m_names.empty(); }
+
+  size_t variantCount() const { return m_names.size(); }
+
+  const std::string &name(size_t variantIdx) const
+  {
+    return m_names[variantIdx];
+  }
+
+  // Selected variant, -1 for the materials of the primitives
+  int selected() const { return m_nSelected; }
+
+  // Primitives mapping some variant to another material
+  size_t mappedPrimitiveCount() const { return m_primitives.size(); }
+
+  // Select variant variantIdx (-1 for none) and set the materials of the
+  // mapped primitives in compact and primitives (the arena primitives in mesh
+  // order, or empty before they are laid out). Return the number of
+  // primitives whose material changed.
+  size_t select(int variantIdx, CompactModel &compact,
+      std::vector<ArenaPrimitive> &primitives);
+
+private:
+  std::vector<std::string> m_names;
+  // Mapped primitives, in mesh order
+  std::vector<uint32_t> m_primitives;
+  // Per mapped primitive, its own material then its material for each
+  // variant, -1 for the default material
+  std::vector<int32_t> m_materials;
+  int m_nSelected = -1;
+};
@@ -0,0 +1,625 @@
+#include "mesh_compression.hpp"
+#include "job_system.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+
+// Formats of the meshoptimizer library, as specified by
+// https://github.com/KhronosGroup/glTF/tree/main/extensions/2.0/Vendor/EXT_meshopt_compression
+const unsigned char VERTEX_HEADER = 0xa0;
+const unsigned char INDEX_HEADER = 0xe0;
+const unsigned char SEQUENCE_HEADER = 0xd0;
+
+const size_t BYTE_GROUP_SIZE = 16;
+// Largest number of bytes read by decodeByteGroup
+const size_t BYTE_GROUP_DECODE_LIMIT = 24;
+const size_t VERTEX_BLOCK_SIZE_BYTES = 8192;
+const size_t VERTEX_BLOCK_MAX_SIZE = 256;
+const size_t VERTEX_TAIL_MAX_SIZE = 32;
+
+size_t getVertexBlockSize(size_t byteStride)
+{
+  const auto size =
+      (VERTEX_BLOCK_SIZE_BYTES / byteStride) & ~(BYTE_GROUP_SIZE - 1);
+  return std::min(size, VERTEX_BLOCK_MAX_SIZE);
+}
+
+unsigned char unzigzag8(unsigned char v)
+{
+  return -(v & 1) ^ (v >> 1);
+}
+
+// Decode 16 deltas of bitCount bits (0, 2, 4 or 8): deltas equal to the
+// largest value of bitCount bits are stored in a following byte
+const unsigned char *decodeByteGroup(
+    const unsigned char *data, unsigned char *out, unsigned bitCount)
+{
+  if (bitCount == 0) {
+    std::memset(out, 0, BYTE_GROUP_SIZE);
+    return data;
+  }
+  if (bitCount == 8) {
+    std::memcpy(out, data, BYTE_GROUP_SIZE);
+    return data + BYTE_GROUP_SIZE;
+  }
+  const auto sentinel = (1u << bitCount) - 1;
+  const auto valuesPerByte = 8 / bitCount;
+  auto extra = data + BYTE_GROUP_SIZE / valuesPerByte;
+  for (size_t i = 0; i < BYTE_GROUP_SIZE; ++i) {
+    const auto shift = 8 - bitCount * (1 + i % valuesPerByte);
+    const auto value = (data[i / valuesPerByte] >> shift) & sentinel;
+    out[i] = value == sentinel ? *extra++ : (unsigned char)value;
+  }
+  return extra;
+}
+
+// Decode count bytes, rounded up to BYTE_GROUP_SIZE, preceded by the 2-bit
+// modes of their groups
+const unsigned char *decodeBytes(const unsigned char *data,
+    const unsigned char *dataEnd, unsigned char *out, size_t count)
+{
+  const auto groupCount = count / BYTE_GROUP_SIZE;
+  const auto header = data;
+  const auto headerSize = (groupCount + 3) / 4;
+  if (size_t(dataEnd - data) < headerSize) {
+    return nullptr;
+  }
+  data += headerSize;
+  for (size_t groupIdx = 0; groupIdx < groupCount; ++groupIdx) {
+    if (size_t(dataEnd - data) < BYTE_GROUP_DECODE_LIMIT) {
+      return nullptr;
+    }
+    const auto mode = (header[groupIdx / 4] >> ((groupIdx % 4) * 2)) & 3;
+    data = decodeByteGroup(
+        data, out + groupIdx * BYTE_GROUP_SIZE, mode ? 1u << mode : 0u);
+  }
+  return data;
+}
+
+// Each byte of the vertices of a block is stored as deltas to the same byte
+// of the previous vertex, starting from lastVertex
+const unsigned char *decodeVertexBlock(const unsigned char *data,
+    const unsigned char *dataEnd, unsigned char *out, size_t count,
+    size_t byteStride, unsigned char *lastVertex)
+{
+  unsigned char deltas[VERTEX_BLOCK_MAX_SIZE];
+  const auto alignedCount =
+      (count + BYTE_GROUP_SIZE - 1) & ~(BYTE_GROUP_SIZE - 1);
+  for (size_t k = 0; k < byteStride; ++k) {
+    data = decodeBytes(data, dataEnd, deltas, alignedCount);
+    if (!data) {
+      return nullptr;
+    }
+    auto value = lastVertex[k];
+    for (size_t i = 0; i < count; ++i) {
+      value += unzigzag8(deltas[i]);
+      out[i * byteStride + k] = value;
+    }
+    lastVertex[k] = value;
+  }
+  return data;
+}
+
+uint32_t decodeVByte(const unsigned char *&data)
+{
+  const auto lead = *data++;
+  if (lead < 128) {
+    return lead;
+  }
+  // At most 4 more bytes, so that malformed data is never overrun
+  uint32_t result = lead & 127;
+  unsigned shift = 7;
+  for (int i = 0; i < 4; ++i) {
+    const auto group = *data++;
+    result |= uint32_t(group & 127) << shift;
+    shift += 7;
+    if (group < 128) {
+      break;
+    }
+  }
+  return result;
+}
+
+uint32_t decodeIndexDelta(const unsigned char *&data, uint32_t last)
+{
+  const auto v = decodeVByte(data);
+  return last + ((v >> 1) ^ -(v & 1));
+}
+
+void writeIndex(
+    unsigned char *out, size_t i, size_t byteStride, uint32_t index)
+{
+  if (byteStride == 2) {
+    const auto value = uint16_t(index);
+    std::memcpy(out + i * 2, &value, 2);
+  } else {
+    std::memcpy(out + i * 4, &index, 4);
+  }
+}
+
+// FIFOs of the index codec, wrapping around 16 entries. Pushing a vertex only
+// advances the FIFO if advance is true, so that the next push overwrites it.
+struct IndexFifos
+{
+  uint32_t edges[16][2];
+  uint32_t vertices[16];
+  size_t edgeOffset = 0;
+  size_t vertexOffset = 0;
+
+  IndexFifos()
+  {
+    std::memset(edges, -1, sizeof(edges));
+    std::memset(vertices, -1, sizeof(vertices));
+  }
+
+  void pushEdge(uint32_t a, uint32_t b)
+  {
+    edges[edgeOffset][0] = a;
+    edges[edgeOffset][1] = b;
+    edgeOffset = (edgeOffset + 1) & 15;
+  }
+
+  void pushVertex(uint32_t v, bool advance = true)
+  {
+    vertices[vertexOffset] = v;
+    vertexOffset = (vertexOffset + advance) & 15;
+  }
+
+  // Vertex pushed fifoIdx pushes before the last one
+  uint32_t vertex(size_t fifoIdx) const
+  {
+    return vertices[(vertexOffset - 1 - fifoIdx) & 15];
+  }
+
+  void pushTriangleEdges(uint32_t a, uint32_t b, uint32_t c)
+  {
+    pushEdge(b, a);
+    pushEdge(c, b);
+    pushEdge(a, c);
+  }
+};
+
+// Round to the nearest integer, halfway cases away from zero
+int roundSigned(float value)
+{
+  return int(value + (value >= 0.f ? 0.5f : -0.5f));
+}
+
+template <typename T>
+void decodeOctahedralFilter(unsigned char *data, size_t count)
+{
+  const auto maxValue = float((1 << (sizeof(T) * 8 - 1)) - 1);
+  for (size_t i = 0; i < count; ++i) {
+    T components[4];
+    std::memcpy(components, data + i * sizeof(T) * 4, sizeof(components));
+    auto x = float(components[0]);
+    auto y = float(components[1]);
+    // z holds the encoding of 1, from which the octahedron is unfolded
+    const auto z = float(components[2]) - std::abs(x) - std::abs(y);
+    const auto t = std::min(z, 0.f);
+    x += x >= 0.f ? t : -t;
+    y += y >= 0.f ? t : -t;
+    const auto scale = maxValue / std::sqrt(x * x + y * y + z * z);
+    components[0] = T(roundSigned(x * scale));
+    components[1] = T(roundSigned(y * scale));
+    components[2] = T(roundSigned(z * scale));
+    std::memcpy(data + i * sizeof(T) * 4, components, sizeof(components));
+  }
+}
+
+void decodeQuaternionFilter(unsigned char *data, size_t count)
+{
+  const auto scale = 1.f / std::sqrt(2.f);
+  for (size_t i = 0; i < count; ++i) {
+    int16_t components[4];
+    std::memcpy(components, data + i * 8, sizeof(components));
+    // The largest component is dropped, the others are in [-1/sqrt(2),
+    // 1/sqrt(2)] scaled by the value of w with its 2 low bits set
+    const auto componentScale = scale / float(components[3] | 3);
+    const auto x = float(components[0]) * componentScale;
+    const auto y = float(components[1]) * componentScale;
+    const auto z = float(components[2]) * componentScale;
+    const auto w = std::sqrt(std::max(1.f - x * x - y * y - z * z, 0.f));
+    const auto largestIdx = components[3] & 3;
+    components[(largestIdx + 1) & 3] = int16_t(roundSigned(x * 32767.f));
+    components[(largestIdx + 2) & 3] = int16_t(roundSigned(y * 32767.f));
+    components[(largestIdx + 3) & 3] = int16_t(roundSigned(z * 32767.f));
+    components[largestIdx] = int16_t(roundSigned(w * 32767.f));
+    std::memcpy(data + i * 8, components, sizeof(components));
+  }
+}
+
+void decodeExponentialFilter(unsigned char *data, size_t count)
+{
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t v;
+    std::memcpy(&v, data + i * 4, 4);
+    const auto mantissa = int32_t(v << 8) >> 8;
+    const auto exponent = int32_t(v) >> 24;
+    const auto value = std::ldexp(float(mantissa), exponent);
+    std::memcpy(data + i * 4, &value, 4);
+  }
+}
+
+enum class MeshoptMode
+{
+  Attributes,
+  Triangles,
+  Indices
+};
+
+// A bufferView with EXT_meshopt_compression
+struct CompressedView
+{
+  int viewIdx;
+  int buffer; // Of the compressed data
+  size_t byteOffset;
+  size_t byteLength;
+  size_t byteStride;
+  size_t count;
+  MeshoptMode mode;
+  MeshoptFilter filter;
+};
+
+const char *const MESHOPT_EXTENSION = "EXT_meshopt_compression";
+const char *const DRACO_EXTENSION = "KHR_draco_mesh_compression";
+
+size_t getSizeProperty(const tinygltf::Value &object, const char *name)
+{
+  const auto &value = object.Get(name);
+  return value.IsNumber() ? size_t(value.GetNumberAsInt()) : 0;
+}
+
+std::string getStringProperty(const tinygltf::Value &object, const char *name)
+{
+  const auto &value = object.Get(name);
+  return value.IsString() ? value.Get<std::string>() : std::string();
+}
+
+// Read the extension of bufferView, return false if it is invalid
+bool parseCompressedView(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, int viewIdx,
+    const tinygltf::Value &extension, CompressedView &view)
+{
+  if (!extension.IsObject()) {
+    return false;
+  }
+  view.viewIdx = viewIdx;
+  const auto &buffer = extension.Get("buffer");
+  view.buffer = buffer.IsNumber() ? int(buffer.GetNumberAsInt()) : -1;
+  view.byteOffset = getSizeProperty(extension, "byteOffset");
+  view.byteLength = getSizeProperty(extension, "byteLength");
+  view.byteStride = getSizeProperty(extension, "byteStride");
+  view.count = getSizeProperty(extension, "count");
+
+  const auto mode = getStringProperty(extension, "mode");
+  if (mode == "ATTRIBUTES") {
+    view.mode = MeshoptMode::Attributes;
+  } else if (mode == "TRIANGLES") {
+    view.mode = MeshoptMode::Triangles;
+  } else if (mode == "INDICES") {
+    view.mode = MeshoptMode::Indices;
+  } else {
+    return false;
+  }
+
+  const auto filter = extension.Has("filter")
+                          ? getStringProperty(extension, "filter")
+                          : std::string("NONE");
+  if (filter == "NONE") {
+    view.filter = MeshoptFilter::None;
+  } else if (filter == "OCTAHEDRAL" && (view.byteStride == 4 ||
+                                           view.byteStride == 8)) {
+    view.filter = MeshoptFilter::Octahedral;
+  } else if (filter == "QUATERNION" && view.byteStride == 8) {
+    view.filter = MeshoptFilter::Quaternion;
+  } else if (filter == "EXPONENTIAL" && view.byteStride % 4 == 0) {
+    view.filter = MeshoptFilter::Exponential;
+  } else {
+    return false;
+  }
+
+  if (view.mode == MeshoptMode::Attributes
+          ? view.byteStride % 4 != 0 || view.byteStride > 256
+          : view.byteStride != 2 && view.byteStride != 4) {
+    return false;
+  }
+  if (view.byteStride == 0 ||
+      (view.mode == MeshoptMode::Triangles && view.count % 3 != 0) ||
+      (view.mode != MeshoptMode::Attributes &&
+          view.filter != MeshoptFilter::None)) {
+    return false;
+  }
+
+  const auto &bufferView = model.bufferViews[viewIdx];
+  return view.buffer >= 0 && size_t(view.buffer) < buffers.size() &&
+         view.byteOffset + view.byteLength <= buffers[view.buffer].size &&
+         bufferView.buffer >= 0 &&
+         size_t(bufferView.buffer) < model.buffers.size() &&
+         view.count * view.byteStride <= bufferView.byteLength;
+}
+
+bool decodeCompressedView(const CompressedView &view,
+    const std::vector<BufferSpan> &buffers, unsigned char *out)
+{
+  const auto data = buffers[view.buffer].data + view.byteOffset;
+  switch (view.mode) {
+  case MeshoptMode::Attributes:
+    if (!decodeMeshoptAttributes(
+            out, view.count, view.byteStride, data, view.byteLength)) {
+      return false;
+    }
+    applyMeshoptFilter(view.filter, out, view.count, view.byteStride);
+    return true;
+  case MeshoptMode::Triangles:
+    return decodeMeshoptTriangles(
+        out, view.count, view.byteStride, data, view.byteLength);
+  case MeshoptMode::Indices:
+    return decodeMeshoptIndices(
+        out, view.count, view.byteStride, data, view.byteLength);
+  }
+  return false;
+}
+
+bool hasExtension(
+    const std::vector<std::string> &extensions, const std::string &name)
+{
+  return std::find(begin(extensions), end(extensions), name) !=
+         end(extensions);
+}
+
+} // namespace
+
+bool decodeMeshoptAttributes(unsigned char *out, size_t count,
+    size_t byteStride, const unsigned char *data, size_t size)
+{
+  if (byteStride == 0 || byteStride > 256 || byteStride % 4 != 0) {
+    return false;
+  }
+  const auto tailSize = std::max(byteStride, VERTEX_TAIL_MAX_SIZE);
+  if (size < 1 + tailSize || data[0] != VERTEX_HEADER) {
+    return false; // Only version 0 is specified by the extension
+  }
+  const auto dataEnd = data + size;
+  // The first vertex is stored at the end
+  unsigned char lastVertex[256];
+  std::memcpy(lastVertex, dataEnd - byteStride, byteStride);
+
+  const auto blockSize = getVertexBlockSize(byteStride);
+  ++data;
+  for (size_t offset = 0; offset < count; offset += blockSize) {
+    data = decodeVertexBlock(data, dataEnd, out + offset * byteStride,
+        std::min(blockSize, count - offset), byteStride, lastVertex);
+    if (!data) {
+      return false;
+    }
+  }
+  return size_t(dataEnd - data) == tailSize;
+}
+
+bool decodeMeshoptTriangles(unsigned char *out, size_t count,
+    size_t byteStride, const unsigned char *data, size_t size)
+{
+  // Header, a code per triangle and the 16 entries of the code table
+  if (count % 3 != 0 || (byteStride != 2 && byteStride != 4) ||
+      size < 1 + count / 3 + 16 || (data[0] & 0xf0) != INDEX_HEADER ||
+      (data[0] & 0x0f) > 1) {
+    return false;
+  }
+  const auto version = data[0] & 0x0f;
+  // Codes with an index in the vertex FIFO of at least this value encode the
+  // third vertex with a delta to the last free index
+  const int fifoIdxMax = version >= 1 ? 13 : 15;
+
+  IndexFifos fifos;
+  uint32_t next = 0; // Index of the next new vertex
+  uint32_t last = 0; // Last index stored explicitly
+  auto codes = data + 1;
+  auto extra = codes + count / 3;
+  // A triangle reads at most 16 bytes of extra data, so checking that the
+  // table is not reached is enough to stay within data
+  const auto codeTable = data + size - 16;
+  for (size_t i = 0; i < count; i += 3) {
+    if (extra > codeTable) {
+      return false;
+    }
+    const auto code = *codes++;
+    uint32_t a, b, c;
+    if (code < 0xf0) {
+      // Triangle sharing an edge of the edge FIFO
+      const size_t edgeIdx = code >> 4;
+      const auto &edge = fifos.edges[(fifos.edgeOffset - 1 - edgeIdx) & 15];
+      a = edge[0];
+      b = edge[1];
+      const int fifoIdx = code & 15;
+      if (fifoIdx < fifoIdxMax) {
+        c = fifoIdx == 0 ? next++ : fifos.vertex(fifoIdx);
+        fifos.pushVertex(c, fifoIdx == 0);
+      } else {
+        // 13 and 14 decode to last - 1 and last + 1
+        c = last = fifoIdx != 15 ? last + (fifoIdx - (fifoIdx ^ 3))
+                                 : decodeIndexDelta(extra, last);
+        fifos.pushVertex(c);
+      }
+      fifos.pushEdge(c, b);
+      fifos.pushEdge(a, c);
+    } else {
+      // Triangle without a shared edge, a is new unless stored explicitly
+      int fifoIdxA, fifoIdxB, fifoIdxC;
+      if (code < 0xfe) {
+        const auto tableCode = codeTable[code & 15];
+        fifoIdxA = 0;
+        fifoIdxB = tableCode >> 4;
+        fifoIdxC = tableCode & 15;
+      } else {
+        const auto auxCode = *extra++;
+        if (auxCode == 0) {
+          next = 0; // Restart of the vertex numbering
+        }
+        fifoIdxA = code == 0xfe ? 0 : 15;
+        fifoIdxB = auxCode >> 4;
+        fifoIdxC = auxCode & 15;
+      }
+      // 0 is a new vertex, 15 an explicit index, others are relative to the
+      // FIFO before the triangle is pushed, where 1 is the last vertex
+      const auto readVertex = [&](int fifoIdx) {
+        if (fifoIdx == 0) {
+          return next++;
+        }
+        return fifoIdx == 15 ? 0u : fifos.vertex(fifoIdx - 1);
+      };
+      a = readVertex(fifoIdxA);
+      b = readVertex(fifoIdxB);
+      c = readVertex(fifoIdxC);
+      if (fifoIdxA == 15) {
+        a = last = decodeIndexDelta(extra, last);
+      }
+      if (fifoIdxB == 15) {
+        b = last = decodeIndexDelta(extra, last);
+      }
+      if (fifoIdxC == 15) {
+        c = last = decodeIndexDelta(extra, last);
+      }
+      fifos.pushVertex(a);
+      fifos.pushVertex(b, fifoIdxB == 0 || fifoIdxB == 15);
+      fifos.pushVertex(c, fifoIdxC == 0 || fifoIdxC == 15);
+      fifos.pushTriangleEdges(a, b, c);
+    }
+    writeIndex(out, i + 0, byteStride, a);
+    writeIndex(out, i + 1, byteStride, b);
+    writeIndex(out, i + 2, byteStride, c);
+  }
+  // Extra data must end exactly at the code table
+  return extra == codeTable;
+}
+
+bool decodeMeshoptIndices(unsigned char *out, size_t count, size_t byteStride,
+    const unsigned char *data, size_t size)
+{
+  // Header, at least a byte per index and a 4-byte tail
+  if ((byteStride != 2 && byteStride != 4) || size < 1 + count + 4 ||
+      (data[0] & 0xf0) != SEQUENCE_HEADER || (data[0] & 0x0f) > 1) {
+    return false;
+  }
+  const auto dataEnd = data + size - 4;
+  ++data;
+  // Each index is a delta to one of the two last ones, given by its low bit
+  uint32_t last[2] = {0, 0};
+  for (size_t i = 0; i < count; ++i) {
+    // An index reads at most 5 bytes, the tail keeps reads within data
+    if (data >= dataEnd) {
+      return false;
+    }
+    const auto v = decodeVByte(data);
+    const auto baseline = v & 1;
+    const auto delta = v >> 1;
+    last[baseline] += (delta >> 1) ^ -(delta & 1);
+    writeIndex(out, i, byteStride, last[baseline]);
+  }
+  return data == dataEnd;
+}
+
+void applyMeshoptFilter(MeshoptFilter filter, unsigned char *data,
+    size_t count, size_t byteStride)
+{
+  switch (filter) {
+  case MeshoptFilter::None:
+    break;
+  case MeshoptFilter::Octahedral:
+    if (byteStride == 4) {
+      decodeOctahedralFilter<int8_t>(data, count);
+    } else {
+      decodeOctahedralFilter<int16_t>(data, count);
+    }
+    break;
+  case MeshoptFilter::Quaternion:
+    decodeQuaternionFilter(data, count);
+    break;
+  case MeshoptFilter::Exponential:
+    decodeExponentialFilter(data, count * (byteStride / 4));
+    break;
+  }
+}
+
+bool decodeCompressedBufferViews(tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers, std::string &err, std::string &warn)
+{
+  TRACE_ZONE("Decode compressed buffer views");
+  if (hasExtension(model.extensionsRequired, DRACO_EXTENSION)) {
+    err += std::string(DRACO_EXTENSION) + " is not supported\n";
+    return false;
+  }
+  if (hasExtension(model.extensionsUsed, DRACO_EXTENSION)) {
+    warn += std::string(DRACO_EXTENSION) +
+            " is not supported, uncompressed data is used\n";
+  }
+
+  std::vector<CompressedView> views;
+  for (size_t viewIdx = 0; viewIdx < model.bufferViews.size(); ++viewIdx) {
+    const auto &extensions = model.bufferViews[viewIdx].extensions;
+    const auto it = extensions.find(MESHOPT_EXTENSION);
+    if (it == end(extensions)) {
+      continue;
+    }
+    CompressedView view;
+    if (!parseCompressedView(model, buffers, int(viewIdx), it->second, view)) {
+      err += "Invalid " + std::string(MESHOPT_EXTENSION) + " in bufferView " +
+             std::to_string(viewIdx) + "\n";
+      return false;
+    }
+    // The uncompressed data may be provided too, then there is nothing to do
+    if (buffers[model.bufferViews[viewIdx].buffer].size == 0) {
+      views.push_back(view);
+    }
+  }
+  if (views.empty()) {
+    return true;
+  }
+
+  // Allocate fallback buffers to the end of their last bufferView, views are
+  // then decoded in place
+  std::vector<size_t> bufferSizes(model.buffers.size(), 0);
+  for (const auto &view : views) {
+    const auto &bufferView = model.bufferViews[view.viewIdx];
+    auto &size = bufferSizes[bufferView.buffer];
+    size = std::max(size, bufferView.byteOffset + bufferView.byteLength);
+  }
+  for (size_t bufferIdx = 0; bufferIdx < model.buffers.size(); ++bufferIdx) {
+    if (bufferSizes[bufferIdx]) {
+      auto &data = model.buffers[bufferIdx].data;
+      data.resize(bufferSizes[bufferIdx]);
+      buffers[bufferIdx] = {data.data(), data.size()};
+    }
+  }
+
+  std::vector<char> results(views.size(), true);
+  getJobSystem().parallelFor(
+      views.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+        for (auto i = beginIdx; i < endIdx; ++i) {
+          const auto &bufferView = model.bufferViews[views[i].viewIdx];
+          const auto out =
+              model.buffers[bufferView.buffer].data.data() +
+              bufferView.byteOffset;
+          results[i] = decodeCompressedView(views[i], buffers, out);
+        }
+      });
+
+  auto success = true;
+  for (size_t i = 0; i < views.size(); ++i) {
+    auto &bufferView = model.bufferViews[views[i].viewIdx];
+    if (!results[i]) {
+      err += "Failed to decode " + std::string(MESHOPT_EXTENSION) +
+             " bufferView " + std::to_string(views[i].viewIdx) + "\n";
+      success = false;
+    }
+    // The bufferView now holds plain data
+    bufferView.extensions.erase(MESHOPT_EXTENSION);
+  }
+  return success;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Decoders of the meshoptimizer codecs stored in bufferViews by
+// EXT_meshopt_compression. Each one writes count elements of byteStride bytes
+// to out and returns false if data is not a valid encoding of them.
+
+// ATTRIBUTES mode: byteStride is a multiple of 4, at most 256
+bool decodeMeshoptAttributes(unsigned char *out, size_t count,
+    size_t byteStride, const unsigned char *data, size_t size);
+
+// TRIANGLES mode: count is a multiple of 3, byteStride is 2 or 4
+bool decodeMeshoptTriangles(unsigned char *out, size_t count,
+    size_t byteStride, const unsigned char *data, size_t size);
+
+// INDICES mode: byteStride is 2 or 4
+bool decodeMeshoptIndices(unsigned char *out, size_t count, size_t byteStride,
+    const unsigned char *data, size_t size);
+
+enum class MeshoptFilter
+{
+  None,
+  Octahedral, // 4 or 8 bytes: octahedral xy and 1 in z, w is kept
+  Quaternion, // 8 bytes: 3 components, index of the largest and scale in w
+  Exponential // Multiple of 4 bytes: 24-bit mantissa, 8-bit exponent
+};
+
+// Turn count decoded elements of byteStride bytes back into the values of the
+// accessors of the bufferView, in place
+void applyMeshoptFilter(MeshoptFilter filter, unsigned char *data,
+    size_t count, size_t byteStride);
+
+// Decode every bufferView compressed with EXT_meshopt_compression in parallel
+// with the job system. Decoded data is written in place into the buffer of
+// the bufferView, which is allocated once when it has no data (fallback
+// buffers without uri, see readGltfFile) and buffers is updated to point to
+// it. Views whose buffer already holds the uncompressed data are not decoded.
+//
+// KHR_draco_mesh_compression is not supported: models requiring it fail to
+// load, the uncompressed fallback of other models is used.
+//
+// Return false and fill err on failure.
+bool decodeCompressedBufferViews(tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers, std::string &err, std::string &warn);
@@ -0,0 +1,391 @@
+#include "mesh_lods.hpp"
+#include "job_system.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <unordered_map>
+
+namespace
+{
+
+// Sum of squared distances to planes (the upper half of a symmetric 4x4
+// matrix), weighted by the area of the triangles of the planes
+struct Quadric
+{
+  double m[10] = {};
+  double weight = 0.;
+
+  void addPlane(const glm::dvec3 &n, double d, double w)
+  {
+    const double plane[4] = {n.x, n.y, n.z, d};
+    for (size_t i = 0, k = 0; i < 4; ++i) {
+      for (size_t j = i; j < 4; ++j, ++k) {
+        m[k] += w * plane[i] * plane[j];
+      }
+    }
+    weight += w;
+  }
+
+  Quadric &operator+=(const Quadric &other)
+  {
+    for (size_t k = 0; k < 10; ++k) {
+      m[k] += other.m[k];
+    }
+    weight += other.weight;
+    return *this;
+  }
+
+  double evaluate(const glm::dvec3 &p) const
+  {
+    const double x[4] = {p.x, p.y, p.z, 1.};
+    double result = 0.;
+    for (size_t i = 0, k = 0; i < 4; ++i) {
+      for (size_t j = i; j < 4; ++j, ++k) {
+        result += (i == j ? 1. : 2.) * m[k] * x[i] * x[j];
+      }
+    }
+    return result;
+  }
+};
+
+// Collapse of vertex from into vertex to, outdated if the stamp of from has
+// changed since it was computed
+struct Collapse
+{
+  double cost;
+  uint32_t from;
+  uint32_t to;
+  uint32_t stamp;
+
+  bool operator>(const Collapse &other) const { return cost > other.cost; }
+};
+
+class Simplifier
+{
+public:
+  Simplifier(const float *positions, size_t vertexCount,
+      const uint32_t *indices, size_t indexCount) :
+      m_positions(positions),
+      m_triangles(indices, indices + indexCount),
+      m_isTriangleRemoved(indexCount / 3, 0),
+      m_vertexTriangles(vertexCount),
+      m_quadrics(vertexCount),
+      m_isVertexLocked(vertexCount, 0),
+      m_isVertexRemoved(vertexCount, 0),
+      m_stamps(vertexCount, 0)
+  {
+    // Degenerate triangles are dropped, triangles are listed by vertex
+    std::unordered_map<uint64_t, uint32_t> edgeCounts;
+    edgeCounts.reserve(indexCount);
+    for (uint32_t t = 0; t < m_isTriangleRemoved.size(); ++t) {
+      const auto tri = &m_triangles[3 * t];
+      if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) {
+        m_isTriangleRemoved[t] = 1;
+        continue;
+      }
+      ++m_triangleCount;
+      for (size_t c = 0; c < 3; ++c) {
+        m_vertexTriangles[tri[c]].push_back(t);
+        ++edgeCounts[getEdgeKey(tri[c], tri[(c + 1) % 3])];
+      }
+
+      const auto p0 = position(tri[0]);
+      const auto cross =
+          glm::cross(position(tri[1]) - p0, position(tri[2]) - p0);
+      const auto doubleArea = glm::length(cross);
+      if (doubleArea > 0.) {
+        const auto n = cross / doubleArea;
+        for (size_t c = 0; c < 3; ++c) {
+          m_quadrics[tri[c]].addPlane(n, -glm::dot(n, p0), 0.5 * doubleArea);
+        }
+      }
+    }
+
+    // Border and non-manifold edges keep their vertices
+    for (uint32_t t = 0; t < m_isTriangleRemoved.size(); ++t) {
+      if (m_isTriangleRemoved[t]) {
+        continue;
+      }
+      const auto tri = &m_triangles[3 * t];
+      for (size_t c = 0; c < 3; ++c) {
+        const auto a = tri[c];
+        const auto b = tri[(c + 1) % 3];
+        if (edgeCounts[getEdgeKey(a, b)] != 2) {
+          m_isVertexLocked[a] = m_isVertexLocked[b] = 1;
+        }
+      }
+    }
+
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      pushBestCollapse(v);
+    }
+  }
+
+  size_t triangleCount() const { return m_triangleCount; }
+
+  float error() const { return m_error; }
+
+  // Collapse edges until at most targetCount triangles are left, return false
+  // if no valid collapse is left before
+  bool simplify(size_t targetCount)
+  {
+    while (m_triangleCount > targetCount) {
+      if (m_collapses.empty()) {
+        return false;
+      }
+      const auto collapse = m_collapses.top();
+      m_collapses.pop();
+      if (m_isVertexRemoved[collapse.from] || m_isVertexRemoved[collapse.to] ||
+          collapse.stamp != m_stamps[collapse.from] ||
+          !isCollapseValid(collapse.from, collapse.to)) {
+        continue;
+      }
+      applyCollapse(collapse);
+    }
+    return true;
+  }
+
+  std::vector<uint32_t> indices() const
+  {
+    std::vector<uint32_t> indices;
+    indices.reserve(3 * m_triangleCount);
+    for (size_t t = 0; t < m_isTriangleRemoved.size(); ++t) {
+      if (!m_isTriangleRemoved[t]) {
+        indices.insert(end(indices), begin(m_triangles) + 3 * t,
+            begin(m_triangles) + 3 * t + 3);
+      }
+    }
+    return indices;
+  }
+
+private:
+  static uint64_t getEdgeKey(uint32_t a, uint32_t b)
+  {
+    return (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+  }
+
+  glm::dvec3 position(uint32_t v) const
+  {
+    return glm::dvec3(
+        m_positions[3 * v], m_positions[3 * v + 1], m_positions[3 * v + 2]);
+  }
+
+  // Vertices sharing a triangle with v, v excluded, sorted
+  std::vector<uint32_t> getNeighbors(uint32_t v) const
+  {
+    std::vector<uint32_t> neighbors;
+    for (const auto t : m_vertexTriangles[v]) {
+      if (m_isTriangleRemoved[t]) {
+        continue;
+      }
+      for (size_t c = 0; c < 3; ++c) {
+        if (m_triangles[3 * t + c] != v) {
+          neighbors.push_back(m_triangles[3 * t + c]);
+        }
+      }
+    }
+    std::sort(begin(neighbors), end(neighbors));
+    neighbors.erase(
+        std::unique(begin(neighbors), end(neighbors)), end(neighbors));
+    return neighbors;
+  }
+
+  void pushBestCollapse(uint32_t from)
+  {
+    if (m_isVertexLocked[from] || m_isVertexRemoved[from]) {
+      return;
+    }
+    Collapse best{
+        std::numeric_limits<double>::max(), from, from, m_stamps[from]};
+    for (const auto to : getNeighbors(from)) {
+      auto quadric = m_quadrics[from];
+      quadric += m_quadrics[to];
+      const auto cost = quadric.evaluate(position(to));
+      if (cost < best.cost) {
+        best.cost = cost;
+        best.to = to;
+      }
+    }
+    if (best.to != from) {
+      m_collapses.push(best);
+    }
+  }
+
+  bool isCollapseValid(uint32_t from, uint32_t to) const
+  {
+    // The vertices shared by the neighborhoods of from and to must be the
+    // opposite vertices of the collapsed triangles, otherwise the collapse
+    // creates non-manifold edges
+    size_t sharedTriangleCount = 0;
+    for (const auto t : m_vertexTriangles[from]) {
+      if (m_isTriangleRemoved[t]) {
+        continue;
+      }
+      const auto tri = &m_triangles[3 * t];
+      const auto hasTo = tri[0] == to || tri[1] == to || tri[2] == to;
+      if (hasTo) {
+        ++sharedTriangleCount;
+        continue;
+      }
+
+      // Other triangles must not flip nor become degenerate
+      glm::dvec3 p[3];
+      glm::dvec3 q[3];
+      for (size_t c = 0; c < 3; ++c) {
+        p[c] = position(tri[c]);
+        q[c] = tri[c] == from ? position(to) : p[c];
+      }
+      const auto before = glm::cross(p[1] - p[0], p[2] - p[0]);
+      const auto after = glm::cross(q[1] - q[0], q[2] - q[0]);
+      if (glm::dot(before, after) <=
+          0.25 * glm::length(before) * glm::length(after)) {
+        return false;
+      }
+    }
+    if (sharedTriangleCount == 0) {
+      return false;
+    }
+
+    const auto fromNeighbors = getNeighbors(from);
+    const auto toNeighbors = getNeighbors(to);
+    std::vector<uint32_t> shared;
+    std::set_intersection(begin(fromNeighbors), end(fromNeighbors),
+        begin(toNeighbors), end(toNeighbors), std::back_inserter(shared));
+    return shared.size() == sharedTriangleCount;
+  }
+
+  void applyCollapse(const Collapse &collapse)
+  {
+    const auto from = collapse.from;
+    const auto to = collapse.to;
+    for (const auto t : m_vertexTriangles[from]) {
+      if (m_isTriangleRemoved[t]) {
+        continue;
+      }
+      const auto tri = &m_triangles[3 * t];
+      if (tri[0] == to || tri[1] == to || tri[2] == to) {
+        m_isTriangleRemoved[t] = 1;
+        --m_triangleCount;
+        continue;
+      }
+      std::replace(tri, tri + 3, from, to);
+      m_vertexTriangles[to].push_back(t);
+    }
+    m_vertexTriangles[from].clear();
+    m_isVertexRemoved[from] = 1;
+
+    auto &triangles = m_vertexTriangles[to];
+    triangles.erase(std::remove_if(begin(triangles), end(triangles),
+                        [&](uint32_t t) { return m_isTriangleRemoved[t]; }),
+        end(triangles));
+
+    m_quadrics[to] += m_quadrics[from];
+    if (m_quadrics[to].weight > 0.) {
+      const auto distance =
+          std::sqrt(std::max(collapse.cost, 0.) / m_quadrics[to].weight);
+      m_error = std::max(m_error, float(distance));
+    }
+
+    // Costs around to have changed
+    auto neighbors = getNeighbors(to);
+    neighbors.push_back(to);
+    for (const auto v : neighbors) {
+      ++m_stamps[v];
+      pushBestCollapse(v);
+    }
+  }
+
+  const float *m_positions;
+  std::vector<uint32_t> m_triangles;
+  std::vector<uint8_t> m_isTriangleRemoved;
+  size_t m_triangleCount = 0;
+  std::vector<std::vector<uint32_t>> m_vertexTriangles;
+  std::vector<Quadric> m_quadrics;
+  std::vector<uint8_t> m_isVertexLocked;
+  std::vector<uint8_t> m_isVertexRemoved;
+  std::vector<uint32_t> m_stamps;
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>>
+      m_collapses;
+  float m_error = 0.f; // Maximum error of the collapses so far
+};
+
+} // namespace
+
+MeshLodChain buildMeshLodChain(const float *positions, size_t vertexCount,
+    const uint32_t *indices, size_t indexCount, size_t minTriangleCount,
+    size_t maxLevelCount)
+{
+  MeshLodChain chain;
+  if (indexCount / 3 / 2 < minTriangleCount ||
+      std::any_of(indices, indices + indexCount,
+          [&](uint32_t index) { return index >= vertexCount; })) {
+    return chain;
+  }
+
+  Simplifier simplifier{positions, vertexCount, indices, indexCount / 3 * 3};
+  auto previousCount = simplifier.triangleCount();
+  while (chain.size() < maxLevelCount) {
+    const auto targetCount = previousCount / 2;
+    if (targetCount < minTriangleCount) {
+      break;
+    }
+    const auto reached = simplifier.simplify(targetCount);
+    // A stuck simplification still gives a level if it removed enough
+    if (reached || 4 * simplifier.triangleCount() <= 3 * previousCount) {
+      chain.push_back({simplifier.indices(), simplifier.error()});
+      previousCount = simplifier.triangleCount();
+    }
+    if (!reached) {
+      break;
+    }
+  }
+  return chain;
+}
+
+std::vector<MeshLodChain> buildModelLods(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, size_t minTriangleCount)
+{
+  std::vector<const tinygltf::Primitive *> primitives;
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      primitives.push_back(&primitive);
+    }
+  }
+
+  std::vector<MeshLodChain> lods(primitives.size());
+  // Primitives vary a lot in size, each one is a job
+  getJobSystem().parallelFor(
+      primitives.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;
+        for (auto i = beginIdx; i < endIdx; ++i) {
+          const auto &primitive = *primitives[i];
+          const auto it = primitive.attributes.find("POSITION");
+          if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+              it == end(primitive.attributes)) {
+            continue;
+          }
+          const auto &accessor = model.accessors[it->second];
+          positions.resize(3 * accessor.count);
+          readAccessorAsFloats(model, buffers, accessor, 3, positions.data());
+          if (primitive.indices >= 0) {
+            const auto &indexAccessor = model.accessors[primitive.indices];
+            indices.resize(indexAccessor.count);
+            readAccessorAsUints(model, buffers, indexAccessor, indices.data());
+          } else {
+            indices.resize(accessor.count);
+            std::iota(begin(indices), end(indices), 0);
+          }
+          lods[i] = buildMeshLodChain(positions.data(), accessor.count,
+              indices.data(), indices.size(), minTriangleCount);
+        }
+      });
+  return lods;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A simplified version of a triangle primitive. Its indices reference the
+// vertices of the primitive, so that levels share its vertex data.
+struct MeshLod
+{
+  std::vector<uint32_t> indices;
+  // Object space distance between the level and the original surface,
+  // estimated by the quadric error of the simplification
+  float error = 0.f;
+};
+
+// Levels of detail of a primitive, from the finest to the coarsest. The
+// primitive itself is not part of its levels.
+using MeshLodChain = std::vector<MeshLod>;
+
+// Simplify a triangle list by half-edge collapses ordered by quadric error
+// (Garland and Heckbert), so that vertices are never moved nor created. A
+// level is emitted each time the triangle count halves, until it goes below
+// minTriangleCount, maxLevelCount levels are emitted or no collapse is left.
+//
+// Vertices of border and non-manifold edges are never removed. Vertices split
+// along attribute seams (same position, different normals or UVs) form
+// borders too, so seams are kept intact.
+MeshLodChain buildMeshLodChain(const float *positions, size_t vertexCount,
+    const uint32_t *indices, size_t indexCount, size_t minTriangleCount = 128,
+    size_t maxLevelCount = 8);
+
+// LOD chains of every primitive of model, in mesh order (see
+// GeometryArena::layoutPrimitives). Primitives that are not triangle lists get
+// an empty chain, as well as small ones (see buildMeshLodChain). Primitives
+// are simplified in parallel with the job system.
+std::vector<MeshLodChain> buildModelLods(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, size_t minTriangleCount = 128);
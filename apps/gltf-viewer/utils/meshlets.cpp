@@ -0,0 +1,190 @@
+#include "meshlets.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace
+{
+
+// Normal cones wider than this are not worth testing, a meshlet facing away
+// from the camera then hides little of the ones around it
+const float MIN_CONE_COS = 0.1f;
+
+// Bounds and normal cone of the triangles indices[0 : indexCount]
+void computeMeshletBounds(const float *positions, const uint32_t *indices,
+    size_t indexCount, Meshlet &meshlet)
+{
+  const auto getPosition = [&](uint32_t index) {
+    return glm::vec3(positions[3 * index], positions[3 * index + 1],
+        positions[3 * index + 2]);
+  };
+
+  meshlet.bboxMin = glm::vec3(std::numeric_limits<float>::max());
+  meshlet.bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+  std::vector<glm::vec3> normals;
+  normals.reserve(indexCount / 3);
+  auto normalSum = glm::vec3(0);
+  for (size_t i = 0; i + 2 < indexCount; i += 3) {
+    const glm::vec3 triangle[] = {getPosition(indices[i]),
+        getPosition(indices[i + 1]), getPosition(indices[i + 2])};
+    for (const auto &position : triangle) {
+      meshlet.bboxMin = glm::min(meshlet.bboxMin, position);
+      meshlet.bboxMax = glm::max(meshlet.bboxMax, position);
+    }
+    // Degenerate triangles are never rasterized
+    const auto normal =
+        glm::cross(triangle[1] - triangle[0], triangle[2] - triangle[0]);
+    const auto length = glm::length(normal);
+    if (length > 0.f) {
+      normals.push_back(normal / length);
+      normalSum += normals.back();
+    }
+  }
+
+  meshlet.coneAxis = glm::vec3(0, 0, 1);
+  meshlet.coneCutoff = 2.f;
+  const auto sumLength = glm::length(normalSum);
+  if (normals.empty() || sumLength <= 0.f) {
+    return;
+  }
+  const auto axis = normalSum / sumLength;
+  auto minCos = 1.f;
+  for (const auto &normal : normals) {
+    minCos = std::min(minCos, glm::dot(normal, axis));
+  }
+  if (minCos >= MIN_CONE_COS) {
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = std::sqrt(1.f - minCos * minCos);
+  }
+}
+
+} // namespace
+
+std::vector<Meshlet> buildMeshlets(const float *positions, size_t vertexCount,
+    const uint32_t *indices, size_t indexCount, size_t maxVertices,
+    size_t maxTriangles)
+{
+  std::vector<Meshlet> meshlets;
+  // Index of the last meshlet using each vertex
+  std::vector<uint32_t> vertexMeshlets(
+      vertexCount, std::numeric_limits<uint32_t>::max());
+  size_t firstIndex = 0;
+  size_t meshletVertexCount = 0;
+  const auto finishMeshlet = [&](size_t endIndex) {
+    Meshlet meshlet;
+    meshlet.firstIndex = uint32_t(firstIndex);
+    meshlet.indexCount = uint32_t(endIndex - firstIndex);
+    computeMeshletBounds(
+        positions, indices + firstIndex, endIndex - firstIndex, meshlet);
+    meshlets.push_back(meshlet);
+    firstIndex = endIndex;
+    meshletVertexCount = 0;
+  };
+
+  const auto triangleEnd = indexCount - indexCount % 3;
+  for (size_t i = 0; i < triangleEnd; i += 3) {
+    const auto a = indices[i];
+    const auto b = indices[i + 1];
+    const auto c = indices[i + 2];
+    auto meshletIdx = uint32_t(meshlets.size());
+    const auto countNewVertices = [&]() {
+      return size_t(vertexMeshlets[a] != meshletIdx) +
+             size_t(vertexMeshlets[b] != meshletIdx && b != a) +
+             size_t(vertexMeshlets[c] != meshletIdx && c != a && c != b);
+    };
+    if (i > firstIndex &&
+        ((i - firstIndex) / 3 == maxTriangles ||
+            meshletVertexCount + countNewVertices() > maxVertices)) {
+      finishMeshlet(i);
+      meshletIdx = uint32_t(meshlets.size());
+    }
+    meshletVertexCount += countNewVertices();
+    vertexMeshlets[a] = meshletIdx;
+    vertexMeshlets[b] = meshletIdx;
+    vertexMeshlets[c] = meshletIdx;
+  }
+  if (triangleEnd > firstIndex) {
+    finishMeshlet(triangleEnd);
+  }
+  return meshlets;
+}
+
+std::vector<std::vector<Meshlet>> buildModelMeshlets(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers,
+    const std::vector<OptimizedIndices> &optimizedIndices,
+    size_t minTriangleCount)
+{
+  std::vector<uint8_t> isMeshSkinned(model.meshes.size(), 0);
+  for (const auto &node : model.nodes) {
+    if (node.mesh >= 0 && node.skin >= 0 &&
+        size_t(node.mesh) < model.meshes.size()) {
+      isMeshSkinned[node.mesh] = 1;
+    }
+  }
+  std::vector<const tinygltf::Primitive *> primitives;
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    for (const auto &primitive : model.meshes[meshIdx].primitives) {
+      primitives.push_back(isMeshSkinned[meshIdx] || !primitive.targets.empty()
+                               ? nullptr
+                               : &primitive);
+    }
+  }
+
+  std::vector<std::vector<Meshlet>> meshlets(primitives.size());
+  getJobSystem().parallelFor(
+      primitives.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+        std::vector<float> positions;
+        std::vector<float> remappedPositions;
+        std::vector<uint32_t> indices;
+        for (auto i = beginIdx; i < endIdx; ++i) {
+          if (!primitives[i]) {
+            continue;
+          }
+          const auto &primitive = *primitives[i];
+          const auto it = primitive.attributes.find("POSITION");
+          if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+              it == end(primitive.attributes)) {
+            continue;
+          }
+          const auto &accessor = model.accessors[it->second];
+          const auto vertexCount = accessor.count;
+          const auto hasOptimized = i < optimizedIndices.size() &&
+                                    !optimizedIndices[i].indices.empty();
+          const auto *optimized =
+              hasOptimized ? &optimizedIndices[i] : nullptr;
+          if (optimized) {
+            indices = optimized->indices;
+          } else if (primitive.indices >= 0) {
+            const auto &indexAccessor = model.accessors[primitive.indices];
+            indices.resize(indexAccessor.count);
+            readAccessorAsUints(model, buffers, indexAccessor, indices.data());
+          } else {
+            indices.resize(vertexCount);
+            std::iota(begin(indices), end(indices), 0);
+          }
+          if (indices.size() / 3 < minTriangleCount ||
+              std::any_of(begin(indices), end(indices),
+                  [&](uint32_t index) { return index >= vertexCount; })) {
+            continue;
+          }
+          positions.resize(3 * vertexCount);
+          readAccessorAsFloats(model, buffers, accessor, 3, positions.data());
+          // Optimized indices reference the reordered vertices
+          const auto *meshletPositions = positions.data();
+          if (optimized && optimized->vertexRemap.size() == vertexCount) {
+            remappedPositions.resize(positions.size());
+            for (size_t v = 0; v < vertexCount; ++v) {
+              const auto newIdx = optimized->vertexRemap[v];
+              std::copy_n(&positions[3 * v], 3, &remappedPositions[3 * newIdx]);
+            }
+            meshletPositions = remappedPositions.data();
+          }
+          meshlets[i] = buildMeshlets(
+              meshletPositions, vertexCount, indices.data(), indices.size());
+        }
+      });
+  return meshlets;
+}
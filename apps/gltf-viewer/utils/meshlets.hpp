@@ -0,0 +1,58 @@
+#pragma once
+
+#include "gltf.hpp"
+#include "index_optimizer.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A run of consecutive triangles of a primitive using few vertices, culled
+// on its own: the triangles of a large primitive are split in meshlets that
+// are drawn as separate indirect draws (see IndirectDrawList::addMeshlets),
+// so that the parts of a single huge mesh outside of the view, hidden or
+// facing away from the camera are skipped.
+struct Meshlet
+{
+  uint32_t firstIndex; // Relative to the first index of the primitive
+  uint32_t indexCount;
+  // Object space bounds of the triangles
+  glm::vec3 bboxMin;
+  glm::vec3 bboxMax;
+  // Normal cone of the triangles: every triangle normal n has dot(n,
+  // coneAxis) >= sqrt(1 - coneCutoff^2), so the meshlet faces away from a
+  // viewpoint v if dot(c - v, coneAxis) >= coneCutoff * (|c - v| + r) + r,
+  // for any sphere (c, r) enclosing it. coneCutoff is 2 (never culled) if
+  // the cone is too wide.
+  glm::vec3 coneAxis;
+  float coneCutoff;
+};
+
+// Triangles of meshoptimizer's recommended meshlet size, which keeps the
+// per-draw overhead small against the triangles culled
+const size_t MESHLET_MAX_VERTICES = 64;
+const size_t MESHLET_MAX_TRIANGLES = 124;
+
+// Split a triangle list in meshlets of at most maxVertices distinct vertices
+// and maxTriangles triangles, in index order: the triangles are not moved,
+// so indices ordered for the vertex cache (see optimizeVertexCache) give
+// compact meshlets.
+std::vector<Meshlet> buildMeshlets(const float *positions, size_t vertexCount,
+    const uint32_t *indices, size_t indexCount,
+    size_t maxVertices = MESHLET_MAX_VERTICES,
+    size_t maxTriangles = MESHLET_MAX_TRIANGLES);
+
+// Meshlets of every triangle primitive of model with at least
+// minTriangleCount triangles, in mesh order (see
+// GeometryArena::layoutPrimitives), over the indices the arena stores: those
+// of optimizedIndices where they are not empty (see optimizeModelIndices),
+// else those of the primitive. Other primitives get no meshlet, as well as
+// skinned and morphed ones, whose vertices move. Primitives are split in
+// parallel with the job system.
+std::vector<std::vector<Meshlet>> buildModelMeshlets(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers,
+    const std::vector<OptimizedIndices> &optimizedIndices,
+    size_t minTriangleCount = 4 * MESHLET_MAX_TRIANGLES);
@@ -0,0 +1,341 @@
+#include "microbenchmark.hpp"
+#include "bounds.hpp"
+#include "compact_model.hpp"
+#include "gltf.hpp"
+#include "images.hpp"
+#include "job_system.hpp"
+#include "mesh_compression.hpp"
+#include "transform_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+
+// Vertices of the synthetic mesh, 12 MB of positions
+const size_t SYNTHETIC_VERTEX_COUNT = size_t(1) << 20;
+// Nodes instancing the synthetic mesh
+const size_t SYNTHETIC_NODE_COUNT = 16;
+// Size of the synthetic RGBA8 image, 4K UHD
+const size_t IMAGE_WIDTH = 3840;
+const size_t IMAGE_HEIGHT = 2160;
+
+// A root node with SYNTHETIC_NODE_COUNT children translated, rotated and
+// scaled, each instancing a mesh of SYNTHETIC_VERTEX_COUNT positions
+tinygltf::Model createSyntheticModel()
+{
+  tinygltf::Model model;
+  tinygltf::Buffer buffer;
+  buffer.data.resize(SYNTHETIC_VERTEX_COUNT * 3 * sizeof(float));
+  for (size_t i = 0; i < SYNTHETIC_VERTEX_COUNT; ++i) {
+    // Points on a helix, so that every coordinate varies
+    const auto t = float(i) / float(SYNTHETIC_VERTEX_COUNT);
+    const float position[3] = {
+        std::cos(100.f * t), 2.f * t - 1.f, std::sin(100.f * t)};
+    std::memcpy(buffer.data.data() + i * sizeof(position), position,
+        sizeof(position));
+  }
+  model.buffers.push_back(std::move(buffer));
+
+  tinygltf::BufferView bufferView;
+  bufferView.buffer = 0;
+  bufferView.byteLength = model.buffers[0].data.size();
+  model.bufferViews.push_back(bufferView);
+
+  tinygltf::Accessor accessor;
+  accessor.bufferView = 0;
+  accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+  accessor.type = TINYGLTF_TYPE_VEC3;
+  accessor.count = SYNTHETIC_VERTEX_COUNT;
+  accessor.minValues = {-1., -1., -1.};
+  accessor.maxValues = {1., 1., 1.};
+  model.accessors.push_back(accessor);
+
+  tinygltf::Primitive primitive;
+  primitive.attributes["POSITION"] = 0;
+  tinygltf::Mesh mesh;
+  mesh.primitives.push_back(primitive);
+  model.meshes.push_back(mesh);
+
+  tinygltf::Node root;
+  for (size_t i = 0; i < SYNTHETIC_NODE_COUNT; ++i) {
+    tinygltf::Node node;
+    node.mesh = 0;
+    node.translation = {double(i), 0., -double(i)};
+    node.rotation = {0., std::sin(0.1 * double(i)), 0.,
+        std::cos(0.1 * double(i))};
+    node.scale = {1., 1. + 0.1 * double(i), 1.};
+    root.children.push_back(int(model.nodes.size() + 1));
+    model.nodes.push_back(node);
+  }
+  model.nodes.insert(begin(model.nodes), root);
+
+  tinygltf::Scene scene;
+  scene.nodes = {0};
+  model.scenes.push_back(scene);
+  model.defaultScene = 0;
+  return model;
+}
+
+// Reference for extendBoundsWithPositions, one point at a time with glm
+void extendBoundsScalar(const unsigned char *data, size_t count,
+    size_t byteStride, const glm::mat4 &matrix, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax)
+{
+  for (size_t i = 0; i < count; ++i) {
+    glm::vec3 position;
+    std::memcpy(&position, data + i * byteStride, sizeof(position));
+    const auto transformed = glm::vec3(matrix * glm::vec4(position, 1));
+    bboxMin = glm::min(bboxMin, transformed);
+    bboxMax = glm::max(bboxMax, transformed);
+  }
+}
+
+void runSceneMicrobenchmarks(Microbenchmarks &benchmarks,
+    const std::string &fixture, const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers)
+{
+  const glm::mat4 parentMatrix(1);
+  benchmarks.run("getLocalToWorldMatrix/" + fixture, [&]() {
+    for (const auto &node : model.nodes) {
+      doNotOptimize(getLocalToWorldMatrix(node, parentMatrix));
+    }
+  });
+
+  // Traversal of the primitives as the render loop does it, through
+  // tinygltf and through a CompactModel
+  benchmarks.run("positionLookup/tinygltf/" + fixture, [&]() {
+    for (const auto &mesh : model.meshes) {
+      for (const auto &primitive : mesh.primitives) {
+        const auto it = primitive.attributes.find("POSITION");
+        doNotOptimize(it == end(primitive.attributes) ? -1 : it->second);
+      }
+    }
+  });
+  benchmarks.run("CompactModel/build/" + fixture,
+      [&]() { doNotOptimize(CompactModel{model}.primitiveCount()); });
+  const CompactModel compact{model};
+  benchmarks.run("positionLookup/compact/" + fixture, [&]() {
+    for (size_t meshIdx = 0; meshIdx < compact.meshCount(); ++meshIdx) {
+      for (size_t pIdx = 0; pIdx < compact.mesh(meshIdx).primitiveCount;
+           ++pIdx) {
+        doNotOptimize(compact.primitive(meshIdx, pIdx)
+                          .attribute(VertexAttribute::Position));
+      }
+    }
+  });
+
+  for (const auto exactBounds : {false, true}) {
+    const auto name = std::string("computeSceneBounds/") +
+                      (exactBounds ? "exact/" : "accessor/") + fixture;
+    benchmarks.run(name, [&]() {
+      glm::vec3 bboxMin, bboxMax;
+      computeSceneBounds(model, buffers, bboxMin, bboxMax, exactBounds);
+      doNotOptimize(bboxMin);
+      doNotOptimize(bboxMax);
+    });
+  }
+}
+
+void runBoundsKernelMicrobenchmarks(Microbenchmarks &benchmarks,
+    const tinygltf::Model &model)
+{
+  const auto *data = model.buffers[0].data.data();
+  const auto byteCount = model.buffers[0].data.size();
+  const auto count = SYNTHETIC_VERTEX_COUNT;
+  const auto stride = 3 * sizeof(float);
+  const auto matrix = getLocalToWorldMatrix(model.nodes[1], glm::mat4(1));
+
+  using Kernel = void (*)(const unsigned char *, size_t, size_t,
+      const glm::mat4 &, glm::vec3 &, glm::vec3 &);
+  const std::pair<const char *, Kernel> kernels[] = {
+      {"scalar", extendBoundsScalar}, {"simd", extendBoundsWithPositions}};
+  for (const auto &kernel : kernels) {
+    benchmarks.run(std::string("extendBoundsWithPositions/") + kernel.first +
+                       "/1-thread",
+        [&]() {
+          auto bboxMin = glm::vec3(std::numeric_limits<float>::max());
+          auto bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+          kernel.second(data, count, stride, matrix, bboxMin, bboxMax);
+          doNotOptimize(bboxMin);
+          doNotOptimize(bboxMax);
+        },
+        byteCount);
+  }
+
+  auto &jobSystem = getJobSystem();
+  const auto parallelName =
+      "parallel-" + std::to_string(jobSystem.threadCount());
+  benchmarks.run("extendBoundsWithPositions/simd/" + parallelName,
+      [&]() {
+        jobSystem.parallelFor(count, jobSystem.getGrainSize(count, 4096),
+            [&](size_t begin, size_t end) {
+              auto bboxMin = glm::vec3(std::numeric_limits<float>::max());
+              auto bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+              extendBoundsWithPositions(data + begin * stride, end - begin,
+                  stride, matrix, bboxMin, bboxMax);
+              doNotOptimize(bboxMin);
+              doNotOptimize(bboxMax);
+            });
+      },
+      byteCount);
+}
+
+// Matrices and boxes of the transform kernels, as many as the nodes and
+// draws of a large scene
+const size_t TRANSFORM_COUNT = 4096;
+
+void runTransformKernelMicrobenchmarks(
+    Microbenchmarks &benchmarks, const tinygltf::Model &model)
+{
+  const auto parentMatrix =
+      getLocalToWorldMatrix(model.nodes[1], glm::mat4(1));
+  std::vector<glm::mat4> localMatrices(TRANSFORM_COUNT);
+  std::vector<glm::vec3> localMins(TRANSFORM_COUNT);
+  std::vector<glm::vec3> localMaxs(TRANSFORM_COUNT);
+  for (size_t i = 0; i < TRANSFORM_COUNT; ++i) {
+    const auto &node = model.nodes[1 + i % SYNTHETIC_NODE_COUNT];
+    localMatrices[i] = getLocalToWorldMatrix(node, glm::mat4(1));
+    localMins[i] = glm::vec3(-float(i % 7), -1.f, -2.f);
+    localMaxs[i] = glm::vec3(float(i % 5), 3.f, 1.f);
+  }
+  std::vector<glm::mat4> worldMatrices(TRANSFORM_COUNT);
+  std::vector<glm::vec3> worldMins(TRANSFORM_COUNT);
+  std::vector<glm::vec3> worldMaxs(TRANSFORM_COUNT);
+  const auto matrixBytes = 2 * TRANSFORM_COUNT * sizeof(glm::mat4);
+  const auto boxBytes = 4 * TRANSFORM_COUNT * sizeof(glm::vec3);
+
+  benchmarks.run("multiplyMatrices/scalar",
+      [&]() {
+        for (size_t i = 0; i < TRANSFORM_COUNT; ++i) {
+          worldMatrices[i] = parentMatrix * localMatrices[i];
+        }
+        doNotOptimize(worldMatrices.back());
+      },
+      matrixBytes);
+  benchmarks.run("multiplyMatrices/simd",
+      [&]() {
+        multiplyMatrices(parentMatrix, localMatrices.data(), TRANSFORM_COUNT,
+            worldMatrices.data());
+        doNotOptimize(worldMatrices.back());
+      },
+      matrixBytes);
+
+  // extendBoundsWithBox is the scalar path the kernel replaces
+  benchmarks.run("transformBoxes/scalar",
+      [&]() {
+        for (size_t i = 0; i < TRANSFORM_COUNT; ++i) {
+          worldMins[i] = glm::vec3(std::numeric_limits<float>::max());
+          worldMaxs[i] = glm::vec3(std::numeric_limits<float>::lowest());
+          extendBoundsWithBox(localMins[i], localMaxs[i], parentMatrix,
+              worldMins[i], worldMaxs[i]);
+        }
+        doNotOptimize(worldMins.back());
+        doNotOptimize(worldMaxs.back());
+      },
+      boxBytes);
+  benchmarks.run("transformBoxes/simd",
+      [&]() {
+        transformBoxes(parentMatrix, localMins.data(), localMaxs.data(),
+            TRANSFORM_COUNT, worldMins.data(), worldMaxs.data());
+        doNotOptimize(worldMins.back());
+        doNotOptimize(worldMaxs.back());
+      },
+      boxBytes);
+}
+
+void runImageMicrobenchmarks(Microbenchmarks &benchmarks)
+{
+  const auto rowSize = IMAGE_WIDTH * 4;
+  std::vector<unsigned char> pixels(rowSize * IMAGE_HEIGHT);
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = (unsigned char)(i * 7);
+  }
+  // Each byte is read and written once
+  const auto byteCount = 2 * pixels.size();
+
+  benchmarks.run("flipImageYAxis/4k-rgba8/1-thread",
+      [&]() {
+        flipImageYAxis(IMAGE_WIDTH, IMAGE_HEIGHT, 4, pixels.data());
+        doNotOptimize(pixels.front());
+      },
+      byteCount);
+
+  // Rows pairs are independent, so they are swapped in parallel
+  auto &jobSystem = getJobSystem();
+  const auto pairCount = IMAGE_HEIGHT / 2;
+  benchmarks.run("flipImageYAxis/4k-rgba8/parallel-" +
+                     std::to_string(jobSystem.threadCount()),
+      [&]() {
+        jobSystem.parallelFor(pairCount, jobSystem.getGrainSize(pairCount),
+            [&](size_t begin, size_t end) {
+              for (auto y = begin; y < end; ++y) {
+                auto *pRow = pixels.data() + y * rowSize;
+                std::swap_ranges(pRow, pRow + rowSize,
+                    pixels.data() + (IMAGE_HEIGHT - 1 - y) * rowSize);
+              }
+            });
+        doNotOptimize(pixels.front());
+      },
+      byteCount);
+}
+
+} // namespace
+
+void Microbenchmarks::print(std::ostream &out) const
+{
+  size_t nameWidth = 4;
+  for (const auto &result : m_results) {
+    nameWidth = std::max(nameWidth, result.name.size());
+  }
+  out << std::left << std::setw(int(nameWidth)) << "Name" << std::right
+      << std::setw(14) << "ns/iter" << std::setw(14) << "min ns/iter"
+      << std::setw(12) << "iterations" << std::setw(10) << "GB/s"
+      << std::endl;
+  for (const auto &result : m_results) {
+    out << std::left << std::setw(int(nameWidth)) << result.name
+        << std::right << std::fixed << std::setprecision(1) << std::setw(14)
+        << result.nanoseconds << std::setw(14) << result.minNanoseconds
+        << std::setw(12) << result.iterations << std::setw(10);
+    if (result.bytesPerIteration) {
+      out << std::setprecision(2)
+          << double(result.bytesPerIteration) / result.nanoseconds;
+    } else {
+      out << "-";
+    }
+    out << std::endl;
+  }
+}
+
+bool runKernelMicrobenchmarks(
+    Microbenchmarks &benchmarks, const fs::path &model, std::string &err)
+{
+  const auto syntheticModel = createSyntheticModel();
+  runSceneMicrobenchmarks(benchmarks, "synthetic", syntheticModel,
+      getBufferSpans(syntheticModel));
+  runBoundsKernelMicrobenchmarks(benchmarks, syntheticModel);
+  runTransformKernelMicrobenchmarks(benchmarks, syntheticModel);
+  runImageMicrobenchmarks(benchmarks);
+
+  if (model.empty()) {
+    return true;
+  }
+  tinygltf::Model assetModel;
+  std::vector<BufferSpan> buffers;
+  std::string warn;
+  if (!readGltfFile(model, assetModel, buffers, err, warn) ||
+      !decodeCompressedBufferViews(assetModel, buffers, err, warn)) {
+    return false;
+  }
+  if (assetModel.defaultScene < 0 && !assetModel.scenes.empty()) {
+    assetModel.defaultScene = 0;
+  }
+  runSceneMicrobenchmarks(
+      benchmarks, model.stem().string(), assetModel, buffers);
+  return true;
+}
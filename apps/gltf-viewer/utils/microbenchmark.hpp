@@ -0,0 +1,106 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Timing of the CPU kernels of utils/ on fixtures, without GL context (see
+// the microbench command). Each benchmark is a function running one
+// iteration of a kernel: the iteration count is doubled until a run lasts
+// the minimum time, then REPETITION_COUNT runs of that count are timed and
+// the median is kept.
+
+struct MicrobenchmarkResult
+{
+  std::string name;
+  size_t iterations = 0; // Per repetition
+  double nanoseconds = 0.; // Per iteration, median of the repetitions
+  double minNanoseconds = 0.; // Fastest repetition
+  size_t bytesPerIteration = 0; // 0 if not meaningful
+};
+
+// Keep the compiler from removing the computation of value
+template <typename T> void doNotOptimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  const volatile auto *p = reinterpret_cast<const volatile char *>(&value);
+  (void)*p;
+#endif
+}
+
+class Microbenchmarks
+{
+public:
+  static const size_t REPETITION_COUNT = 5;
+
+  // Only benchmarks whose name contains filter are run, all if empty
+  Microbenchmarks(double minSeconds, const std::string &filter) :
+      m_minSeconds(minSeconds), m_filter(filter)
+  {
+  }
+
+  template <typename Function>
+  void run(const std::string &name, Function &&iteration,
+      size_t bytesPerIteration = 0)
+  {
+    if (name.find(m_filter) == std::string::npos) {
+      return;
+    }
+    const auto time = [&](size_t count) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < count; ++i) {
+        iteration();
+      }
+      return std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+    };
+
+    size_t count = 1;
+    while (time(count) < m_minSeconds && count < (size_t(1) << 40)) {
+      count *= 2;
+    }
+    std::vector<double> seconds;
+    for (size_t i = 0; i < REPETITION_COUNT; ++i) {
+      seconds.push_back(time(count));
+    }
+    std::sort(begin(seconds), end(seconds));
+
+    MicrobenchmarkResult result;
+    result.name = name;
+    result.iterations = count;
+    result.nanoseconds = 1e9 * seconds[REPETITION_COUNT / 2] / double(count);
+    result.minNanoseconds = 1e9 * seconds.front() / double(count);
+    result.bytesPerIteration = bytesPerIteration;
+    m_results.push_back(result);
+  }
+
+  const std::vector<MicrobenchmarkResult> &results() const
+  {
+    return m_results;
+  }
+
+  // Name, time per iteration and throughput of each result
+  void print(std::ostream &out) const;
+
+private:
+  double m_minSeconds;
+  std::string m_filter;
+  std::vector<MicrobenchmarkResult> m_results;
+};
+
+// Benchmark getLocalToWorldMatrix, primitive traversal with and without
+// CompactModel, computeSceneBounds and its SIMD kernel against a scalar
+// loop, the transform kernels against glm, and flipImageYAxis, on synthetic
+// fixtures and on the model if not empty. Multi-threaded variants use the job
+// system.
+// Return false and fill err if the model cannot be loaded.
+bool runKernelMicrobenchmarks(Microbenchmarks &benchmarks,
+    const fs::path &model, std::string &err);
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <system_error>
+
+struct ModelCacheStats
+{
+  size_t hits = 0;
+  size_t misses = 0; // Loads, including failed ones and modified models
+  size_t evictions = 0;
+  // Of the cached models
+  size_t modelCount = 0;
+  size_t gpuBytes = 0;
+  size_t hostBytes = 0;
+};
+
+// Models loaded with their GPU resources, kept between the requests of the
+// batch and server modes within budgets of models, GPU memory and host
+// memory, 0 meaning no limit. The least recently used models are evicted
+// once a load exceeds a budget, the model just loaded is always kept.
+//
+// A model is identified by its path and modification time: a model modified
+// since it was loaded is loaded again.
+template <typename Model> class ModelCache
+{
+public:
+  ModelCache(size_t maxModelCount, size_t gpuBudget, size_t hostBudget) :
+      m_nMaxModelCount(maxModelCount),
+      m_nGpuBudget(gpuBudget),
+      m_nHostBudget(hostBudget)
+  {
+  }
+
+  ModelCache(const ModelCache &) = delete;
+  ModelCache &operator=(const ModelCache &) = delete;
+
+  // Cached model of path, else load(gpuBytes, hostBytes) returning the model
+  // (nullptr on failure) and setting its sizes. Return nullptr if the model
+  // can't be loaded.
+  template <typename Loader> Model *get(const fs::path &path, Loader load)
+  {
+    std::error_code ec;
+    const auto writeTime = fs::last_write_time(path, ec);
+    const auto it = std::find_if(begin(m_entries), end(m_entries),
+        [&](const Entry &entry) { return entry.path == path; });
+    if (it != end(m_entries)) {
+      if (!ec && it->writeTime == writeTime) {
+        ++m_stats.hits;
+        m_entries.splice(begin(m_entries), m_entries, it);
+        return m_entries.front().model.get();
+      }
+      remove(it);
+    }
+
+    ++m_stats.misses;
+    if (ec) {
+      return nullptr;
+    }
+    Entry entry{path, writeTime, nullptr, 0, 0};
+    entry.model = load(entry.gpuBytes, entry.hostBytes);
+    if (!entry.model) {
+      return nullptr;
+    }
+    m_stats.gpuBytes += entry.gpuBytes;
+    m_stats.hostBytes += entry.hostBytes;
+    ++m_stats.modelCount;
+    m_entries.push_front(std::move(entry));
+    while (m_entries.size() > 1 && isOverBudget()) {
+      remove(std::prev(end(m_entries)));
+      ++m_stats.evictions;
+    }
+    return m_entries.front().model.get();
+  }
+
+  const ModelCacheStats &stats() const { return m_stats; }
+
+private:
+  struct Entry
+  {
+    fs::path path;
+    fs::file_time_type writeTime;
+    std::unique_ptr<Model> model;
+    size_t gpuBytes;
+    size_t hostBytes;
+  };
+
+  bool isOverBudget() const
+  {
+    return (m_nMaxModelCount && m_stats.modelCount > m_nMaxModelCount) ||
+           (m_nGpuBudget && m_stats.gpuBytes > m_nGpuBudget) ||
+           (m_nHostBudget && m_stats.hostBytes > m_nHostBudget);
+  }
+
+  void remove(typename std::list<Entry>::iterator it)
+  {
+    m_stats.gpuBytes -= it->gpuBytes;
+    m_stats.hostBytes -= it->hostBytes;
+    --m_stats.modelCount;
+    m_entries.erase(it);
+  }
+
+  size_t m_nMaxModelCount;
+  size_t m_nGpuBudget;
+  size_t m_nHostBudget;
+  std::list<Entry> m_entries; // Most recently used first
+  ModelCacheStats m_stats;
+};
@@ -0,0 +1,70 @@
+#include "monotonic_arena.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+void *MonotonicArena::allocate(size_t size, size_t alignment)
+{
+  if (!m_blocks.empty()) {
+    auto &block = m_blocks.back();
+    const auto address = reinterpret_cast<size_t>(block.data.get());
+    const auto offset =
+        ((address + m_nOffset + alignment - 1) & ~(alignment - 1)) - address;
+    if (offset + size <= block.size) {
+      m_nOffset = offset + size;
+      return block.data.get() + offset;
+    }
+  }
+  // new[] aligns on the largest fundamental alignment, which arena objects
+  // do not exceed
+  const auto blockSize = std::max(size, m_nBlockSize);
+  m_blocks.push_back({std::make_unique<unsigned char[]>(blockSize), blockSize});
+  m_nOffset = size;
+  return m_blocks.back().data.get();
+}
+
+size_t MonotonicArena::capacity() const
+{
+  size_t byteCount = 0;
+  for (const auto &block : m_blocks) {
+    byteCount += block.size;
+  }
+  return byteCount;
+}
+
+size_t MonotonicArena::usedBytes() const
+{
+  size_t byteCount = m_nOffset;
+  for (size_t i = 0; i + 1 < m_blocks.size(); ++i) {
+    byteCount += m_blocks[i].size;
+  }
+  return byteCount;
+}
+
+void MonotonicArena::reset()
+{
+  if (m_blocks.size() > 1) {
+    const auto blockSize = capacity();
+    m_blocks.clear();
+    m_blocks.push_back(
+        {std::make_unique<unsigned char[]>(blockSize), blockSize});
+  }
+  m_nOffset = 0;
+}
+
+StringInterner::StringInterner() { intern(std::string_view()); }
+
+uint32_t StringInterner::intern(std::string_view str)
+{
+  const auto it = m_ids.find(str);
+  if (it != end(m_ids)) {
+    return (*it).second;
+  }
+  auto chars = static_cast<char *>(m_arena.allocate(str.size() + 1, 1));
+  std::memcpy(chars, str.data(), str.size());
+  chars[str.size()] = '\0';
+  const auto id = uint32_t(m_strings.size());
+  m_strings.emplace_back(chars, str.size());
+  m_ids.emplace(m_strings.back(), id);
+  return id;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Allocator handing out memory from large blocks and freeing it all at once
+// when destroyed. Allocation is a pointer bump and destruction frees a few
+// blocks instead of every object, so it only holds trivially destructible
+// objects. Blocks never move: pointers stay valid when the arena is moved.
+class MonotonicArena
+{
+public:
+  static const size_t DEFAULT_BLOCK_SIZE = size_t(64) << 10;
+
+  explicit MonotonicArena(size_t blockSize = DEFAULT_BLOCK_SIZE) :
+      m_nBlockSize(blockSize)
+  {
+  }
+
+  // Non-copyable class:
+  MonotonicArena(const MonotonicArena &) = delete;
+  MonotonicArena &operator=(const MonotonicArena &) = delete;
+
+  MonotonicArena(MonotonicArena &&rvalue) { *this = std::move(rvalue); }
+
+  MonotonicArena &operator=(MonotonicArena &&rvalue)
+  {
+    std::swap(m_blocks, rvalue.m_blocks);
+    std::swap(m_nOffset, rvalue.m_nOffset);
+    std::swap(m_nBlockSize, rvalue.m_nBlockSize);
+    return *this;
+  }
+
+  // size bytes aligned on alignment, a power of two. Allocations larger than
+  // the block size get a block of their own.
+  void *allocate(size_t size, size_t alignment);
+
+  // count value-initialized objects of type T
+  template <typename T> T *allocateArray(size_t count)
+  {
+    static_assert(std::is_trivially_destructible<T>::value,
+        "Destructors of arena objects are never called");
+    const auto array = static_cast<T *>(
+        allocate(count * sizeof(T), alignof(T)));
+    for (size_t i = 0; i < count; ++i) {
+      new (array + i) T();
+    }
+    return array;
+  }
+
+  // Bytes of the blocks allocated so far
+  size_t capacity() const;
+
+  // Bytes handed out since the last reset, padding included
+  size_t usedBytes() const;
+
+  // Free every allocation at once but keep the memory. Blocks added since
+  // the previous reset are merged into a single block of the total
+  // capacity, so that an arena reset every frame stops allocating once it
+  // has grown to the largest frame.
+  void reset();
+
+private:
+  struct Block
+  {
+    std::unique_ptr<unsigned char[]> data;
+    size_t size;
+  };
+
+  std::vector<Block> m_blocks; // The last one is being filled
+  size_t m_nOffset = 0; // In the last block
+  size_t m_nBlockSize = DEFAULT_BLOCK_SIZE;
+};
+
+// Standard allocator of a MonotonicArena, for the containers of transient
+// data (e.g. those of a frame, whose arena is reset by the next one).
+// Deallocation does nothing: the memory is reclaimed by reset() or the
+// destruction of the arena, which must outlive the containers.
+template <typename T> class ArenaAllocator
+{
+public:
+  using value_type = T;
+
+  explicit ArenaAllocator(MonotonicArena &arena) : m_arena(&arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : m_arena(other.arena())
+  {
+  }
+
+  T *allocate(size_t count)
+  {
+    return static_cast<T *>(m_arena->allocate(count * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *, size_t) {}
+
+  MonotonicArena *arena() const { return m_arena; }
+
+  template <typename U> bool operator==(const ArenaAllocator<U> &other) const
+  {
+    return m_arena == other.arena();
+  }
+
+private:
+  MonotonicArena *m_arena;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Set of strings stored once in a MonotonicArena of its own, identified by
+// the order of their first interning. Equal strings get the same identifier,
+// so that they can be compared as integers.
+class StringInterner
+{
+public:
+  // Identifier of the empty string
+  static const uint32_t EMPTY = 0;
+
+  StringInterner();
+
+  uint32_t intern(std::string_view str);
+
+  // Null-terminated string of an identifier returned by intern()
+  const char *get(uint32_t id) const { return m_strings[id].data(); }
+
+  size_t size() const { return m_strings.size(); }
+
+  // Bytes of the characters of the strings
+  size_t capacity() const { return m_arena.capacity(); }
+
+private:
+  MonotonicArena m_arena;
+  std::vector<std::string_view> m_strings; // Indexed by identifier
+  std::unordered_map<std::string_view, uint32_t> m_ids;
+};
@@ -0,0 +1,318 @@
+#include "morphing.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+
+// Storage buffer bindings of morph_targets.cs.glsl
+const GLuint BASE_POSITIONS_BINDING = 8;
+const GLuint BASE_NORMALS_BINDING = 9;
+const GLuint VERTEX_DELTAS_BINDING = 10;
+const GLuint DELTAS_BINDING = 11;
+const GLuint WEIGHTS_BINDING = 12;
+const GLuint POSITIONS_BINDING = 13;
+const GLuint NORMALS_BINDING = 14;
+
+size_t getWeightsAlignment()
+{
+  GLint alignment = 0;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return std::max(size_t(alignment), sizeof(float));
+}
+
+} // namespace
+
+SceneMorphs &SceneMorphs::operator=(SceneMorphs &&rvalue)
+{
+  if (this != &rvalue) {
+    std::swap(m_weights, rvalue.m_weights);
+    std::swap(m_blendedWeights, rvalue.m_blendedWeights);
+    std::swap(m_morphedRanges, rvalue.m_morphedRanges);
+    std::swap(m_meshRanges, rvalue.m_meshRanges);
+    std::swap(m_vertexDeltas, rvalue.m_vertexDeltas);
+    std::swap(m_deltas, rvalue.m_deltas);
+    std::swap(m_nDeltaCount, rvalue.m_nDeltaCount);
+    std::swap(m_vertexDeltaBuffer, rvalue.m_vertexDeltaBuffer);
+    std::swap(m_deltaBuffer, rvalue.m_deltaBuffer);
+    std::swap(m_baseBuffers, rvalue.m_baseBuffers);
+    std::swap(m_hasBuffers, rvalue.m_hasBuffers);
+    std::swap(m_prepassData, rvalue.m_prepassData);
+    std::swap(m_nBlendedMeshCount, rvalue.m_nBlendedMeshCount);
+  }
+  return *this;
+}
+
+void SceneMorphs::build(const tinygltf::Model &model,
+    const SceneHierarchy &hierarchy,
+    const std::vector<ArenaPrimitive> &primitives,
+    const std::vector<size_t> &meshToPrimitives)
+{
+  *this = SceneMorphs();
+
+  auto &nodeRanges = m_weights.m_nodeRanges;
+  auto &values = m_weights.m_values;
+  nodeRanges.assign(hierarchy.size(), {0, 0});
+  m_meshRanges.assign(model.meshes.size(), -1);
+  GLuint baseVertexCount = 0;
+  for (size_t flatIdx = 0; flatIdx < hierarchy.size(); ++flatIdx) {
+    const auto meshIdx = hierarchy.mesh(flatIdx);
+    if (meshIdx < 0) {
+      continue;
+    }
+    const auto &mesh = model.meshes[meshIdx];
+    size_t targetCount = 0;
+    for (const auto &primitive : mesh.primitives) {
+      targetCount = std::max(targetCount, primitive.targets.size());
+    }
+    if (!targetCount) {
+      continue;
+    }
+
+    // Default weights of the node, else of its mesh, else null ones
+    const auto &node = model.nodes[hierarchy.node(flatIdx)];
+    const auto &defaults =
+        node.weights.size() == targetCount ? node.weights : mesh.weights;
+    nodeRanges[flatIdx] = {values.size(), targetCount};
+    for (size_t t = 0; t < targetCount; ++t) {
+      values.push_back(t < defaults.size() ? float(defaults[t]) : 0.f);
+    }
+
+    if (m_meshRanges[meshIdx] >= 0) {
+      continue;
+    }
+    // Primitives of a mesh are contiguous in the arena
+    const auto firstPrimitive = meshToPrimitives[meshIdx];
+    const auto &first = primitives[firstPrimitive];
+    const auto &last =
+        primitives[firstPrimitive + mesh.primitives.size() - 1];
+    const auto firstVertex = GLuint(first.baseVertex);
+    const auto endVertex = GLuint(last.baseVertex) + last.vertexCount;
+    m_meshRanges[meshIdx] = int(m_morphedRanges.size());
+    m_morphedRanges.push_back({flatIdx, firstVertex, endVertex - firstVertex,
+        baseVertexCount, m_blendedWeights.size()});
+    m_blendedWeights.resize(m_blendedWeights.size() + targetCount, 0.f);
+    baseVertexCount += endVertex - firstVertex;
+  }
+  // Vertices of primitives without targets have no delta
+  m_vertexDeltas.assign(baseVertexCount, glm::uvec2(0));
+}
+
+void SceneMorphs::decodePrimitive(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, size_t meshIdx,
+    const tinygltf::Primitive &primitive,
+    const ArenaPrimitive &arenaPrimitive,
+    const std::vector<uint32_t> *vertexRemap)
+{
+  if (empty() || primitive.targets.empty() || m_meshRanges[meshIdx] < 0) {
+    return;
+  }
+  const auto &range = m_morphedRanges[m_meshRanges[meshIdx]];
+  const auto vertexCount = size_t(arenaPrimitive.vertexCount);
+
+  // Deltas of each target, null for missing attributes
+  const auto targetCount = primitive.targets.size();
+  std::vector<float> positionDeltas(targetCount * vertexCount * 3, 0.f);
+  std::vector<float> normalDeltas(targetCount * vertexCount * 3, 0.f);
+  for (size_t t = 0; t < targetCount; ++t) {
+    const auto &target = primitive.targets[t];
+    const std::pair<const char *, float *> attributes[] = {
+        {"POSITION", positionDeltas.data() + t * vertexCount * 3},
+        {"NORMAL", normalDeltas.data() + t * vertexCount * 3}};
+    for (const auto &attribute : attributes) {
+      const auto it = target.find(attribute.first);
+      if (it == end(target)) {
+        continue;
+      }
+      const auto &accessor = model.accessors[it->second];
+      if (accessor.count != vertexCount) {
+        std::cerr << "Warning: morph target " << t << " of mesh " << meshIdx
+                  << " has " << accessor.count << " " << attribute.first
+                  << " deltas for " << vertexCount
+                  << " vertices, they are ignored" << std::endl;
+        continue;
+      }
+      readAccessorAsFloats(model, buffers, accessor, 3, attribute.second);
+    }
+  }
+
+  // Only the non null deltas of each vertex are kept
+  const auto firstBaseVertex = range.firstBaseVertex +
+                               GLuint(arenaPrimitive.baseVertex) -
+                               range.firstVertex;
+  for (size_t v = 0; v < vertexCount; ++v) {
+    const auto dst = vertexRemap && vertexRemap->size() == vertexCount
+                         ? (*vertexRemap)[v]
+                         : v;
+    auto &vertexDeltas = m_vertexDeltas[firstBaseVertex + dst];
+    vertexDeltas = glm::uvec2(GLuint(m_deltas.size() / 2), 0);
+    for (size_t t = 0; t < targetCount; ++t) {
+      const auto *p = positionDeltas.data() + (t * vertexCount + v) * 3;
+      const auto *n = normalDeltas.data() + (t * vertexCount + v) * 3;
+      const auto position = glm::vec3(p[0], p[1], p[2]);
+      const auto normal = glm::vec3(n[0], n[1], n[2]);
+      if (position == glm::vec3(0) && normal == glm::vec3(0)) {
+        continue;
+      }
+      m_deltas.emplace_back(position, glm::uintBitsToFloat(GLuint(t)));
+      m_deltas.emplace_back(normal, 0.f);
+      ++vertexDeltas.y;
+    }
+    m_nDeltaCount += vertexDeltas.y;
+  }
+}
+
+void MorphWeights::set(size_t flatIdx, const float *weights, size_t count)
+{
+  if (flatIdx >= m_nodeRanges.size()) {
+    return;
+  }
+  const auto &range = m_nodeRanges[flatIdx];
+  std::copy(weights, weights + std::min(count, range.second),
+      m_values.begin() + range.first);
+}
+
+void MorphWeights::setValues(const std::vector<float> &values)
+{
+  std::copy(begin(values),
+      begin(values) + std::min(values.size(), m_values.size()),
+      begin(m_values));
+}
+
+void SceneMorphs::createBuffers(const GeometryArena &arena)
+{
+  // Buffers are never empty so that they can always be bound
+  if (m_vertexDeltas.empty()) {
+    m_vertexDeltas.emplace_back(0);
+  }
+  if (m_deltas.empty()) {
+    m_deltas.assign(2, glm::vec4(0));
+  }
+  m_vertexDeltaBuffer =
+      GLBuffer(m_vertexDeltas.size() * sizeof(glm::uvec2),
+          m_vertexDeltas.data(), 0, GLMemoryCategory::Geometry);
+  m_deltaBuffer = GLBuffer(m_deltas.size() * sizeof(glm::vec4),
+      m_deltas.data(), 0, GLMemoryCategory::Geometry);
+  const auto baseVertexCount = m_vertexDeltas.size();
+  std::vector<glm::uvec2>().swap(m_vertexDeltas);
+  std::vector<glm::vec4>().swap(m_deltas);
+
+  const GeometryArena::Stream streams[] = {
+      GeometryArena::POSITION, GeometryArena::NORMAL};
+  const auto vertexSize = 3 * sizeof(float);
+  for (size_t i = 0; i < 2; ++i) {
+    m_baseBuffers[i] = GLBuffer(baseVertexCount * vertexSize, nullptr, 0,
+        GLMemoryCategory::Geometry);
+    glBindBuffer(GL_COPY_READ_BUFFER, arena.vertexBuffer(streams[i]));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_baseBuffers[i].glId());
+    for (const auto &range : m_morphedRanges) {
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+          GLintptr(arena.vertexBufferOffset(streams[i]) +
+                   range.firstVertex * vertexSize),
+          GLintptr(range.firstBaseVertex * vertexSize),
+          GLsizeiptr(range.vertexCount * vertexSize));
+    }
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+bool SceneMorphs::blendVertices(const GeometryArena &arena,
+    const GLProgram &blendProgram, SceneSkins *skins)
+{
+  m_nBlendedMeshCount = 0;
+  if (empty()) {
+    return false;
+  }
+  // Base vertices are copied before the arena and the bind pose are
+  // overwritten by the first blend
+  if (!m_hasBuffers) {
+    createBuffers(arena);
+    if (skins) {
+      skins->copyBindPose(arena);
+    }
+    m_hasBuffers = true;
+  }
+
+  // Weights of the meshes to blend, packed in a single array
+  std::vector<float> weights;
+  std::vector<std::pair<size_t, GLuint>> blends; // (range, first weight)
+  for (size_t rangeIdx = 0; rangeIdx < m_morphedRanges.size(); ++rangeIdx) {
+    auto &range = m_morphedRanges[rangeIdx];
+    const auto &nodeWeights = m_weights.m_nodeRanges[range.node];
+    const auto first = m_weights.m_values.begin() + nodeWeights.first;
+    const auto last = first + nodeWeights.second;
+    const auto blended = m_blendedWeights.begin() + range.firstBlendedWeight;
+    if (range.isBlended && std::equal(first, last, blended)) {
+      continue;
+    }
+    std::copy(first, last, blended);
+    range.isBlended = true;
+    blends.emplace_back(rangeIdx, GLuint(weights.size()));
+    weights.insert(end(weights), first, last);
+  }
+  m_nBlendedMeshCount = blends.size();
+  if (blends.empty()) {
+    return false;
+  }
+
+  // The weights region is fenced right after the dispatches reading it
+  m_prepassData.beginFrame();
+  const auto weightsSize = weights.size() * sizeof(float);
+  const auto allocation = m_prepassData.upload(
+      weights.data(), weightsSize, getWeightsAlignment());
+
+  blendProgram.use();
+  const auto vertexCount = blendProgram.getUniform<GLuint>("uVertexCount");
+  const auto firstBaseVertex =
+      blendProgram.getUniform<GLuint>("uFirstBaseVertex");
+  const auto firstWeight = blendProgram.getUniform<GLuint>("uFirstWeight");
+  const auto firstOutputVertex =
+      blendProgram.getUniform<GLuint>("uFirstOutputVertex");
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BASE_POSITIONS_BINDING,
+      m_baseBuffers[0].glId());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BASE_NORMALS_BINDING,
+      m_baseBuffers[1].glId());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VERTEX_DELTAS_BINDING,
+      m_vertexDeltaBuffer.glId());
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, DELTAS_BINDING, m_deltaBuffer.glId());
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, WEIGHTS_BINDING,
+      allocation.buffer, GLintptr(allocation.offset),
+      GLsizeiptr(weightsSize));
+  const GLuint groupSize = 64; // local_size_x of morph_targets.cs.glsl
+  for (const auto &blend : blends) {
+    const auto &range = m_morphedRanges[blend.first];
+    // Skinned meshes are blended into their bind pose
+    const auto bindPoseVertex =
+        skins ? skins->findBindPoseVertex(range.firstVertex) : -1;
+    auto outputVertex = range.firstVertex;
+    if (bindPoseVertex >= 0) {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, POSITIONS_BINDING,
+          skins->bindPoseBuffer(0));
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NORMALS_BINDING,
+          skins->bindPoseBuffer(1));
+      outputVertex = GLuint(bindPoseVertex);
+    } else {
+      arena.bindStreamStorage(POSITIONS_BINDING, GeometryArena::POSITION);
+      arena.bindStreamStorage(NORMALS_BINDING, GeometryArena::NORMAL);
+    }
+    vertexCount.set(range.vertexCount);
+    firstBaseVertex.set(range.firstBaseVertex);
+    firstWeight.set(blend.second);
+    firstOutputVertex.set(outputVertex);
+    glDispatchCompute((range.vertexCount + groupSize - 1) / groupSize, 1, 1);
+  }
+  // The blended vertices are read as vertex attributes, or by the skinning
+  // pre-pass
+  glMemoryBarrier(
+      GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+  m_prepassData.endFrame();
+
+  for (GLuint binding = BASE_POSITIONS_BINDING; binding <= NORMALS_BINDING;
+       ++binding) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+  }
+  return true;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "geometry_arena.hpp"
+#include "gl_objects.hpp"
+#include "gltf.hpp"
+#include "ring_buffer.hpp"
+#include "scene_hierarchy.hpp"
+#include "shaders.hpp"
+#include "skinning.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Morph target weights of the nodes of a SceneHierarchy, a range of values()
+// per node. Copyable, so that they can be computed on another thread (see
+// PoseSimulation).
+class MorphWeights
+{
+public:
+  // Number of weights of a node (flat index in the hierarchy), 0 if its mesh
+  // has no morph targets
+  size_t weightCount(size_t flatIdx) const
+  {
+    return flatIdx < m_nodeRanges.size() ? m_nodeRanges[flatIdx].second : 0;
+  }
+
+  // Set the weights of a node, count is clamped to weightCount(flatIdx)
+  void set(size_t flatIdx, const float *weights, size_t count);
+
+  // Weights of all nodes
+  const std::vector<float> &values() const { return m_values; }
+
+  // Set the weights of all nodes to values of the same hierarchy
+  void setValues(const std::vector<float> &values);
+
+private:
+  friend class SceneMorphs;
+
+  // (first, count) ranges of m_values of each node
+  std::vector<std::pair<size_t, size_t>> m_nodeRanges;
+  std::vector<float> m_values;
+};
+
+// Morph targets of the meshes of a glTF model, blended into the float
+// vertices of a GeometryArena by a compute pre-pass (morph_targets.cs.glsl).
+//
+// Deltas are sparse: only the (vertex, target) pairs with a non null position
+// or normal delta are stored, grouped by vertex, so that a vertex moved by a
+// few of 50 targets only reads those few. Each vertex of a morphed mesh sums
+// its deltas weighted by the weights of its node over its base vertex (copied
+// from the arena before the first blend) and the result overwrites the
+// POSITION and NORMAL streams of the arena, which every later pass then
+// reads. Meshes skinned by the skinning pre-pass are blended into the bind
+// pose of SceneSkins instead, which skins them afterwards.
+//
+// A mesh is only blended again when the weights of its node change. A mesh
+// drawn by several nodes is blended with the weights of the first one.
+// Tangent and texture coordinate targets are ignored.
+class SceneMorphs
+{
+public:
+  SceneMorphs() = default;
+
+  // Non-copyable class:
+  SceneMorphs(const SceneMorphs &) = delete;
+  SceneMorphs &operator=(const SceneMorphs &) = delete;
+
+  SceneMorphs(SceneMorphs &&rvalue) { *this = std::move(rvalue); }
+
+  SceneMorphs &operator=(SceneMorphs &&rvalue);
+
+  // Find the meshes of model with morph targets drawn by the nodes of
+  // hierarchy, and set the weights of their nodes to the default ones of the
+  // node or of its mesh. primitives and meshToPrimitives are computed by
+  // GeometryArena::layoutPrimitives.
+  void build(const tinygltf::Model &model, const SceneHierarchy &hierarchy,
+      const std::vector<ArenaPrimitive> &primitives,
+      const std::vector<size_t> &meshToPrimitives);
+
+  bool empty() const { return m_morphedRanges.empty(); }
+
+  size_t meshCount() const { return m_morphedRanges.size(); }
+
+  // Number of (vertex, target) deltas decoded so far
+  size_t deltaCount() const { return m_nDeltaCount; }
+
+  // Decode the targets of a glTF primitive of mesh meshIdx whose vertices
+  // are at arenaPrimitive, vertexRemap as in GeometryArena::uploadPrimitive.
+  // Deltas are kept in memory until the first blendVertices().
+  void decodePrimitive(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers, size_t meshIdx,
+      const tinygltf::Primitive &primitive,
+      const ArenaPrimitive &arenaPrimitive,
+      const std::vector<uint32_t> *vertexRemap = nullptr);
+
+  // Morph target weights of the nodes, changes take effect on the next
+  // blendVertices()
+  const MorphWeights &weights() const { return m_weights; }
+  MorphWeights &weights() { return m_weights; }
+
+  // Blend the meshes whose weights changed since their last blend with
+  // blendProgram (morph_targets.cs.glsl). All meshes must be uploaded. If
+  // skins is not null, meshes it skins with SceneSkins::skinVertices are
+  // blended into its bind pose. Return true if some mesh was blended.
+  bool blendVertices(const GeometryArena &arena,
+      const GLProgram &blendProgram, SceneSkins *skins = nullptr);
+
+  // Number of meshes blended by the last blendVertices()
+  size_t blendedMeshCount() const { return m_nBlendedMeshCount; }
+
+private:
+  // Vertices of a mesh with morph targets
+  struct MorphedRange
+  {
+    size_t node; // Flat index of the node whose weights are blended
+    GLuint firstVertex; // In the arena
+    GLuint vertexCount;
+    // In m_baseBuffers and m_vertexDeltas
+    GLuint firstBaseVertex;
+    // Weights of the last blend, in m_blendedWeights
+    size_t firstBlendedWeight;
+    bool isBlended = false;
+  };
+
+  // Create the GPU buffers from the decoded deltas and copy the base
+  // vertices from the arena
+  void createBuffers(const GeometryArena &arena);
+
+  MorphWeights m_weights;
+  std::vector<float> m_blendedWeights;
+  std::vector<MorphedRange> m_morphedRanges;
+  std::vector<int> m_meshRanges; // Index in m_morphedRanges of each mesh
+
+  // (first delta, delta count) of each base vertex, then the deltas: two
+  // vec4 per delta, (position delta, target index bits) and (normal delta,
+  // 0). Released once uploaded.
+  std::vector<glm::uvec2> m_vertexDeltas;
+  std::vector<glm::vec4> m_deltas;
+  size_t m_nDeltaCount = 0;
+
+  GLBuffer m_vertexDeltaBuffer;
+  GLBuffer m_deltaBuffer;
+  // Positions and normals of the morphed ranges without morphing
+  GLBuffer m_baseBuffers[2];
+  bool m_hasBuffers = false;
+  RingBuffer m_prepassData; // Weights read by the pre-pass
+  size_t m_nBlendedMeshCount = 0;
+};
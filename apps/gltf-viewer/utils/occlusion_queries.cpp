@@ -0,0 +1,154 @@
+#include "occlusion_queries.hpp"
+
+#include <algorithm>
+#include <limits>
+
+void OcclusionQueries::build(
+    const SceneHierarchy &hierarchy, const std::vector<uint32_t> &drawNodes)
+{
+  release();
+  m_nNodeCount = hierarchy.size();
+
+  // Parents come before their children in the flat hierarchy
+  std::vector<size_t> subtreeDrawCounts(hierarchy.size(), 0);
+  for (const auto node : drawNodes) {
+    ++subtreeDrawCounts[node];
+  }
+  for (size_t i = hierarchy.size(); i-- > 0;) {
+    const auto parent = hierarchy.parent(i);
+    if (parent >= 0) {
+      subtreeDrawCounts[parent] += subtreeDrawCounts[i];
+    }
+  }
+
+  // Groups are the largest subtrees small enough
+  std::vector<int> nodeGroups(hierarchy.size(), -1);
+  for (size_t i = 0; i < hierarchy.size(); ++i) {
+    const auto parent = hierarchy.parent(i);
+    if (parent >= 0 && nodeGroups[parent] >= 0) {
+      nodeGroups[i] = nodeGroups[parent];
+    } else if (subtreeDrawCounts[i] >= MIN_GROUP_DRAWS &&
+               subtreeDrawCounts[i] <= MAX_GROUP_DRAWS) {
+      nodeGroups[i] = int(m_groups.size());
+      m_groups.emplace_back();
+    }
+  }
+  m_drawGroups.reserve(drawNodes.size());
+  for (const auto node : drawNodes) {
+    m_drawGroups.push_back(nodeGroups[node]);
+  }
+  for (auto &group : m_groups) {
+    glGenQueries(1, &group.query);
+  }
+}
+
+void OcclusionQueries::beginFrame(const std::vector<glm::vec3> &drawBoundsMin,
+    const std::vector<glm::vec3> &drawBoundsMax)
+{
+  ++m_nFrameIdx;
+  for (auto &group : m_groups) {
+    group.bboxMin = glm::vec3(std::numeric_limits<float>::max());
+    group.bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+    group.hasBounds = true;
+  }
+  for (size_t drawIdx = 0; drawIdx < m_drawGroups.size(); ++drawIdx) {
+    if (m_drawGroups[drawIdx] < 0) {
+      continue;
+    }
+    auto &group = m_groups[m_drawGroups[drawIdx]];
+    // Unbounded draws have infinite bounds
+    if (drawBoundsMax[drawIdx].x == std::numeric_limits<float>::max()) {
+      group.hasBounds = false;
+    }
+    group.bboxMin = glm::min(group.bboxMin, drawBoundsMin[drawIdx]);
+    group.bboxMax = glm::max(group.bboxMax, drawBoundsMax[drawIdx]);
+  }
+}
+
+void OcclusionQueries::setGroup(int group)
+{
+  if (group == m_currentGroup) {
+    return;
+  }
+  if (m_isConditional) {
+    glEndConditionalRender();
+    m_isConditional = false;
+  }
+  m_currentGroup = group;
+  if (group < 0) {
+    return;
+  }
+  auto &current = m_groups[group];
+  current.lastDrawnFrame = m_nFrameIdx;
+  // Older results are of another view of the group
+  if (current.lastQueriedFrame + 1 == m_nFrameIdx) {
+    glBeginConditionalRender(current.query, GL_QUERY_NO_WAIT);
+    m_isConditional = true;
+  }
+}
+
+void OcclusionQueries::drawBoxes(const GLProgram &program,
+    const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix, bool reversedZ)
+{
+  setGroup(-1);
+  m_nTestedGroupCount = 0;
+
+  // The corners of the near plane are its farthest points from the eye, the
+  // near plane may clip the boxes closer than them
+  const auto inverseProjMatrix = glm::inverse(projMatrix);
+  const auto nearDepth = reversedZ ? 1.f : -1.f;
+  auto nearDistance = 0.f;
+  for (const auto corner : {glm::vec2(-1, -1), glm::vec2(1, -1),
+           glm::vec2(-1, 1), glm::vec2(1, 1)}) {
+    const auto position = inverseProjMatrix * glm::vec4(corner, nearDepth, 1);
+    nearDistance =
+        std::max(nearDistance, glm::length(glm::vec3(position) / position.w));
+  }
+
+  // Boxes are drawn relative to the eye, like the draws
+  const auto eye = glm::vec3(glm::inverse(viewMatrix)[3]);
+  program.use();
+  program.getUniform<glm::mat4>("uViewProjMatrix")
+      .set(projMatrix * glm::mat4(glm::mat3(viewMatrix)));
+  const auto bboxMin = program.getUniform<glm::vec3>("uBboxMin");
+  const auto bboxMax = program.getUniform<glm::vec3>("uBboxMax");
+  if (!m_emptyVertexArray.glId()) {
+    m_emptyVertexArray = GLVertexArray::create();
+  }
+  m_emptyVertexArray.bind();
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_FALSE);
+  // Faces of a box touching the surfaces of its draws are not hidden by them
+  glDepthFunc(reversedZ ? GL_GEQUAL : GL_LEQUAL);
+  for (auto &group : m_groups) {
+    if (group.lastDrawnFrame != m_nFrameIdx || !group.hasBounds) {
+      continue;
+    }
+    const auto distance = glm::length(glm::max(
+        glm::max(group.bboxMin - eye, eye - group.bboxMax), glm::vec3(0)));
+    if (distance <= nearDistance) {
+      continue;
+    }
+    bboxMin.set(group.bboxMin - eye);
+    bboxMax.set(group.bboxMax - eye);
+    glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, group.query);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+    group.lastQueriedFrame = m_nFrameIdx;
+    ++m_nTestedGroupCount;
+  }
+  glDepthFunc(reversedZ ? GL_GREATER : GL_LESS);
+  glDepthMask(GL_TRUE);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void OcclusionQueries::release()
+{
+  setGroup(-1);
+  for (const auto &group : m_groups) {
+    glDeleteQueries(1, &group.query);
+  }
+  m_groups.clear();
+  m_drawGroups.clear();
+  m_nNodeCount = 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "scene_hierarchy.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Occlusion culling of groups of draws with occlusion queries, for draws
+// made one by one on GPUs where the compute culling of IndirectDrawList is
+// not available. The nodes holding between MIN_GROUP_DRAWS and
+// MAX_GROUP_DRAWS draws in their subtree (the sub-assemblies of CAD models)
+// make groups, tested with the bounding box of their draws.
+//
+// After the draws of a frame, drawBoxes() draws the box of each group in an
+// occlusion query, with color and depth writes masked. The next frame draws
+// the group after setGroup(), under glBeginConditionalRender with
+// GL_QUERY_NO_WAIT: the CPU never waits for a result, a group revealed by
+// the camera appears one frame late at most, and results not available yet
+// draw the group. Boxes the near plane may clip are not tested.
+//
+// Results are those of the view of the previous frame, an instance serves
+// a single view drawn every frame (the window).
+class OcclusionQueries
+{
+public:
+  static const size_t MIN_GROUP_DRAWS = 4;
+  static const size_t MAX_GROUP_DRAWS = 256;
+
+  OcclusionQueries() = default;
+
+  ~OcclusionQueries() { release(); }
+
+  // Non-copyable class:
+  OcclusionQueries(const OcclusionQueries &) = delete;
+  OcclusionQueries &operator=(const OcclusionQueries &) = delete;
+
+  // True if build() was called for these numbers of nodes and draws
+  bool isBuiltFor(size_t nodeCount, size_t drawCount) const
+  {
+    return m_nNodeCount == nodeCount && m_drawGroups.size() == drawCount;
+  }
+
+  // Group the draws of hierarchy, drawNodes[i] being the flat index of the
+  // node of draw i. Previous results are discarded.
+  void build(
+      const SceneHierarchy &hierarchy, const std::vector<uint32_t> &drawNodes);
+
+  // Group of draw drawIdx, -1 if it belongs to none
+  int group(size_t drawIdx) const { return m_drawGroups[drawIdx]; }
+
+  size_t groupCount() const { return m_groups.size(); }
+
+  // Groups whose box was tested by the last drawBoxes()
+  size_t testedGroupCount() const { return m_nTestedGroupCount; }
+
+  // Start a frame: the box of each group bounds drawBoundsMin/Max of its
+  // draws (see ViewerApplication::Scene), groups with unbounded draws are
+  // never culled
+  void beginFrame(const std::vector<glm::vec3> &drawBoundsMin,
+      const std::vector<glm::vec3> &drawBoundsMax);
+
+  // The following draw commands are skipped if the box of group was hidden
+  // in the previous frame, -1 draws them unconditionally
+  void setGroup(int group);
+
+  // Test the boxes of the groups drawn this frame against the depth buffer
+  // of the bound draw framebuffer, with program (occlusion_box.vs.glsl).
+  // Color and depth writes are enabled afterwards, the depth function is
+  // GL_LESS, or GL_GREATER if reversedZ is set.
+  void drawBoxes(const GLProgram &program, const glm::mat4 &viewMatrix,
+      const glm::mat4 &projMatrix, bool reversedZ);
+
+private:
+  struct Group
+  {
+    GLuint query = 0;
+    glm::vec3 bboxMin = glm::vec3(0);
+    glm::vec3 bboxMax = glm::vec3(0);
+    bool hasBounds = false;
+    // Frames are counted from 1, 0 for never
+    size_t lastDrawnFrame = 0;
+    size_t lastQueriedFrame = 0;
+  };
+
+  void release();
+
+  size_t m_nNodeCount = 0;
+  std::vector<int> m_drawGroups;
+  std::vector<Group> m_groups;
+  size_t m_nFrameIdx = 0;
+  int m_currentGroup = -1;
+  bool m_isConditional = false; // Conditional rendering is active
+  size_t m_nTestedGroupCount = 0;
+  GLVertexArray m_emptyVertexArray; // Boxes have no vertex attributes
+};
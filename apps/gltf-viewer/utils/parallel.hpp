@@ -0,0 +1,44 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+inline size_t getHardwareThreadCount()
+{
+  const auto count = std::thread::hardware_concurrency();
+  return count ? count : 1;
+}
+
+// Call f(i) for each i in [0, count) using threadCount threads, the calling
+// thread included. Indices are handed out one at a time so that uneven tasks
+// (e.g. images of different sizes) are balanced between threads.
+template <typename Function>
+void parallelFor(size_t count, size_t threadCount, Function &&f)
+{
+  threadCount = std::min(std::max(threadCount, size_t(1)), count);
+  if (threadCount <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      f(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> nextIndex{0};
+  const auto worker = [&]() {
+    for (auto i = nextIndex++; i < count; i = nextIndex++) {
+      f(i);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(threadCount - 1);
+  for (size_t i = 1; i < threadCount; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
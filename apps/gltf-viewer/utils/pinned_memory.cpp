@@ -0,0 +1,75 @@
+#include "pinned_memory.hpp"
+#include "gl_extensions.hpp"
+#include "sync_watchdog.hpp"
+
+#include <cstdint>
+#include <iostream>
+
+PinnedMemory::PinnedMemory(const void *data, size_t size)
+{
+  if (!getGLExtensions().pinnedMemory || !data || !size) {
+    return;
+  }
+  const auto address = reinterpret_cast<uintptr_t>(data);
+  const auto begin = address / PAGE_SIZE * PAGE_SIZE;
+  const auto end = (address + size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+  // Errors of previous commands must not be taken for a failure to pin
+  while (glGetError() != GL_NO_ERROR) {
+  }
+  glGenBuffers(1, &m_buffer);
+  glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, m_buffer);
+  glBufferData(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD,
+      GLsizeiptr(end - begin), reinterpret_cast<const void *>(begin),
+      GL_STREAM_READ);
+  glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, 0);
+  if (glGetError() != GL_NO_ERROR) {
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+    return;
+  }
+  m_pBegin = reinterpret_cast<const unsigned char *>(begin);
+  m_nSize = end - begin;
+  m_memory = TrackedGLMemory(GLMemoryCategory::Buffers, m_nSize);
+}
+
+PinnedMemory &PinnedMemory::operator=(PinnedMemory &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_buffer, rvalue.m_buffer);
+    std::swap(m_pBegin, rvalue.m_pBegin);
+    std::swap(m_nSize, rvalue.m_nSize);
+    std::swap(m_memory, rvalue.m_memory);
+  }
+  return *this;
+}
+
+void PinnedMemory::release()
+{
+  if (m_buffer) {
+    // The pages are unpinned with the buffer, which must not happen while
+    // copies read them
+    const auto fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    {
+      SyncScope sync{"PinnedMemory::release"};
+      GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+      const GLuint64 timeout = 1000000000; // 1 second
+      GLenum status = GL_TIMEOUT_EXPIRED;
+      do {
+        status = glClientWaitSync(fence, flags, timeout);
+        flags = 0;
+      } while (status == GL_TIMEOUT_EXPIRED);
+      if (status == GL_WAIT_FAILED) {
+        std::cerr << "Error: PinnedMemory - glClientWaitSync failed"
+                  << std::endl;
+      }
+    }
+    glDeleteSync(fence);
+    glDeleteBuffers(1, &m_buffer);
+  }
+  m_buffer = 0;
+  m_pBegin = nullptr;
+  m_nSize = 0;
+  m_memory = TrackedGLMemory();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "gl_memory.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <utility>
+
+// Buffer object aliasing host memory with GL_AMD_pinned_memory: the pages
+// covering the memory are pinned and the GPU reads them in place, so that
+// data already in its GPU layout, e.g. vertex streams in the BIN chunk of a
+// memory mapped .glb, is copied to device buffers by the GPU without a copy
+// of the CPU into a staging buffer.
+//
+// The memory must outlive the PinnedMemory, which waits for the commands
+// reading it when released.
+class PinnedMemory
+{
+public:
+  // Pages are rounded to 4 KiB, the alignment the extension requires
+  static const size_t PAGE_SIZE = 4096;
+
+  PinnedMemory() = default;
+
+  // Pin the pages covering [data, data + size). buffer() is 0 if the
+  // driver cannot pin them (e.g. without the extension, or pages it refuses
+  // to pin such as those of some read-only mappings).
+  PinnedMemory(const void *data, size_t size);
+
+  ~PinnedMemory() { release(); }
+
+  // Non-copyable class:
+  PinnedMemory(const PinnedMemory &) = delete;
+  PinnedMemory &operator=(const PinnedMemory &) = delete;
+
+  PinnedMemory(PinnedMemory &&rvalue) { *this = std::move(rvalue); }
+
+  PinnedMemory &operator=(PinnedMemory &&rvalue);
+
+  GLuint buffer() const { return m_buffer; }
+
+  // True if [data, data + size) is in the pinned pages
+  bool contains(const void *data, size_t size) const
+  {
+    const auto bytes = static_cast<const unsigned char *>(data);
+    return m_buffer && bytes >= m_pBegin &&
+           size <= m_nSize - size_t(bytes - m_pBegin);
+  }
+
+  // Offset in buffer() of data, which contains() the memory
+  size_t offset(const void *data) const
+  {
+    return size_t(static_cast<const unsigned char *>(data) - m_pBegin);
+  }
+
+  // Wait for the commands reading the memory and unpin it
+  void release();
+
+private:
+  GLuint m_buffer = 0;
+  const unsigned char *m_pBegin = nullptr; // First pinned page
+  size_t m_nSize = 0;
+  // Pinned pages stay resident, counted as buffers of the GPU
+  TrackedGLMemory m_memory;
+};
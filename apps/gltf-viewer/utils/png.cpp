@@ -0,0 +1,567 @@
+#include "png.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace
+{
+
+// Strips are at least this size so that the compression ratio stays close
+// to a sequential encoder
+const size_t MIN_STRIP_BYTES = 256 * 1024;
+
+const size_t WINDOW_SIZE = 32768;
+const size_t MIN_MATCH = 3;
+const size_t MAX_MATCH = 258;
+const size_t MAX_CHAIN_LENGTH = 32;
+const size_t HASH_BITS = 15;
+
+const uint32_t ADLER_MODULO = 65521;
+
+struct Crc32Table
+{
+  std::array<uint32_t, 256> values;
+
+  Crc32Table()
+  {
+    for (uint32_t i = 0; i < 256; ++i) {
+      auto c = i;
+      for (auto k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      values[i] = c;
+    }
+  }
+};
+
+uint32_t computeCrc32(const unsigned char *data, size_t size)
+{
+  static const Crc32Table table;
+  auto crc = ~0u;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+struct Adler32
+{
+  uint32_t s1 = 1;
+  uint32_t s2 = 0;
+
+  void update(const unsigned char *data, size_t size)
+  {
+    while (size) {
+      // Largest n such that s2 doesn't overflow before the modulo
+      const auto blockSize = std::min(size, size_t(5552));
+      for (size_t i = 0; i < blockSize; ++i) {
+        s1 += data[i];
+        s2 += s1;
+      }
+      s1 %= ADLER_MODULO;
+      s2 %= ADLER_MODULO;
+      data += blockSize;
+      size -= blockSize;
+    }
+  }
+
+  // Checksum of the concatenation of this data and of size bytes whose
+  // checksum is next
+  void combine(const Adler32 &next, size_t size)
+  {
+    const auto length = uint64_t(size % ADLER_MODULO);
+    const auto newS2 = (uint64_t(s2) + next.s2 +
+                           length * ((s1 + ADLER_MODULO - 1) % ADLER_MODULO)) %
+                       ADLER_MODULO;
+    s1 = (s1 + next.s1 + ADLER_MODULO - 1) % ADLER_MODULO;
+    s2 = uint32_t(newS2);
+  }
+
+  uint32_t value() const { return (s2 << 16) | s1; }
+
+  static Adler32 fromValue(uint32_t value)
+  {
+    Adler32 adler;
+    adler.s1 = value & 0xFFFF;
+    adler.s2 = value >> 16;
+    return adler;
+  }
+};
+
+void appendUint32(std::vector<unsigned char> &out, uint32_t value)
+{
+  out.push_back((unsigned char)(value >> 24));
+  out.push_back((unsigned char)(value >> 16));
+  out.push_back((unsigned char)(value >> 8));
+  out.push_back((unsigned char)value);
+}
+
+// Append a chunk whose data is already in out[dataOffset:], preceded by 8
+// bytes reserved for length and type
+void finishChunk(
+    std::vector<unsigned char> &out, size_t chunkOffset, const char *type)
+{
+  const auto dataSize = out.size() - chunkOffset - 8;
+  auto *header = out.data() + chunkOffset;
+  header[0] = (unsigned char)(dataSize >> 24);
+  header[1] = (unsigned char)(dataSize >> 16);
+  header[2] = (unsigned char)(dataSize >> 8);
+  header[3] = (unsigned char)dataSize;
+  std::memcpy(header + 4, type, 4);
+  appendUint32(out, computeCrc32(header + 4, dataSize + 4));
+}
+
+size_t beginChunk(std::vector<unsigned char> &out)
+{
+  const auto chunkOffset = out.size();
+  out.resize(out.size() + 8);
+  return chunkOffset;
+}
+
+// Bits are packed from the least significant bit, as specified by deflate
+class BitWriter
+{
+public:
+  explicit BitWriter(std::vector<unsigned char> &out) : m_out(out) {}
+
+  void write(uint32_t bits, uint32_t bitCount)
+  {
+    m_bits |= uint64_t(bits) << m_bitCount;
+    m_bitCount += bitCount;
+    while (m_bitCount >= 8) {
+      m_out.push_back((unsigned char)m_bits);
+      m_bits >>= 8;
+      m_bitCount -= 8;
+    }
+  }
+
+  void alignToByte()
+  {
+    if (m_bitCount) {
+      write(0, 8 - m_bitCount);
+    }
+  }
+
+private:
+  std::vector<unsigned char> &m_out;
+  uint64_t m_bits = 0;
+  uint32_t m_bitCount = 0;
+};
+
+// Fixed Huffman codes of deflate, bit reversed to be written LSB first
+struct FixedHuffmanCodes
+{
+  std::array<uint16_t, 288> literalCodes;
+  std::array<uint8_t, 288> literalLengths;
+  std::array<uint8_t, 30> distanceCodes;
+
+  static uint32_t reverseBits(uint32_t code, uint32_t length)
+  {
+    uint32_t reversed = 0;
+    for (uint32_t i = 0; i < length; ++i) {
+      reversed |= ((code >> i) & 1) << (length - 1 - i);
+    }
+    return reversed;
+  }
+
+  FixedHuffmanCodes()
+  {
+    for (uint32_t symbol = 0; symbol < 288; ++symbol) {
+      uint32_t code, length;
+      if (symbol < 144) {
+        code = 0x30 + symbol, length = 8;
+      } else if (symbol < 256) {
+        code = 0x190 + symbol - 144, length = 9;
+      } else if (symbol < 280) {
+        code = symbol - 256, length = 7;
+      } else {
+        code = 0xC0 + symbol - 280, length = 8;
+      }
+      literalCodes[symbol] = uint16_t(reverseBits(code, length));
+      literalLengths[symbol] = uint8_t(length);
+    }
+    for (uint32_t symbol = 0; symbol < 30; ++symbol) {
+      distanceCodes[symbol] = uint8_t(reverseBits(symbol, 5));
+    }
+  }
+};
+
+const uint16_t LENGTH_BASES[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19,
+    23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LENGTH_EXTRA_BITS[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2,
+    2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DISTANCE_BASES[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49,
+    65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+const uint8_t DISTANCE_EXTRA_BITS[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5,
+    6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Compress data in a single fixed Huffman block. If last is false, the block
+// is followed by an empty stored block (sync flush) so that the output ends
+// on a byte boundary and the next strip can be appended.
+void deflateStrip(const unsigned char *data, size_t size, bool last,
+    std::vector<unsigned char> &out)
+{
+  static const FixedHuffmanCodes codes;
+
+  BitWriter writer(out);
+  writer.write(last ? 1 : 0, 1); // BFINAL
+  writer.write(1, 2); // BTYPE = fixed Huffman
+
+  const auto writeLiteral = [&](uint32_t symbol) {
+    writer.write(codes.literalCodes[symbol], codes.literalLengths[symbol]);
+  };
+
+  const auto hash = [&](size_t i) {
+    const auto value = uint32_t(data[i]) | (uint32_t(data[i + 1]) << 8) |
+                       (uint32_t(data[i + 2]) << 16);
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+  };
+
+  // head[h] is the last position + 1 with hash h, prev[i % WINDOW_SIZE] the
+  // previous position + 1 with the same hash as i (0 means none)
+  std::vector<uint32_t> head(size_t(1) << HASH_BITS, 0);
+  std::vector<uint32_t> prev(WINDOW_SIZE, 0);
+  const auto insert = [&](size_t i) {
+    const auto h = hash(i);
+    prev[i % WINDOW_SIZE] = head[h];
+    head[h] = uint32_t(i + 1);
+  };
+
+  size_t i = 0;
+  while (i + MIN_MATCH <= size) {
+    const auto maxLength = std::min(MAX_MATCH, size - i);
+    size_t bestLength = 0, bestDistance = 0;
+    auto candidate = head[hash(i)];
+    for (size_t chain = 0; candidate && chain < MAX_CHAIN_LENGTH; ++chain) {
+      const auto position = size_t(candidate - 1);
+      if (i - position > WINDOW_SIZE) {
+        break;
+      }
+      if (data[position + bestLength] == data[i + bestLength]) {
+        size_t length = 0;
+        while (length < maxLength &&
+               data[position + length] == data[i + length]) {
+          ++length;
+        }
+        if (length > bestLength) {
+          bestLength = length;
+          bestDistance = i - position;
+          if (length == maxLength) {
+            break;
+          }
+        }
+      }
+      const auto next = prev[position % WINDOW_SIZE];
+      if (next >= candidate) {
+        break; // Entry overwritten by a more recent position
+      }
+      candidate = next;
+    }
+
+    if (bestLength < MIN_MATCH) {
+      insert(i);
+      writeLiteral(data[i]);
+      ++i;
+      continue;
+    }
+
+    auto lengthCode = 0;
+    while (lengthCode < 28 && LENGTH_BASES[lengthCode + 1] <= bestLength) {
+      ++lengthCode;
+    }
+    writeLiteral(257 + lengthCode);
+    writer.write(uint32_t(bestLength - LENGTH_BASES[lengthCode]),
+        LENGTH_EXTRA_BITS[lengthCode]);
+    auto distanceCode = 0;
+    while (distanceCode < 29 &&
+           DISTANCE_BASES[distanceCode + 1] <= bestDistance) {
+      ++distanceCode;
+    }
+    writer.write(codes.distanceCodes[distanceCode], 5);
+    writer.write(uint32_t(bestDistance - DISTANCE_BASES[distanceCode]),
+        DISTANCE_EXTRA_BITS[distanceCode]);
+
+    const auto end = i + bestLength;
+    for (; i < end; ++i) {
+      if (i + MIN_MATCH <= size) {
+        insert(i);
+      }
+    }
+  }
+  for (; i < size; ++i) {
+    writeLiteral(data[i]);
+  }
+  writeLiteral(256); // End of block
+
+  if (!last) {
+    writer.write(0, 3); // Empty stored block
+    writer.alignToByte();
+    out.push_back(0x00);
+    out.push_back(0x00);
+    out.push_back(0xFF);
+    out.push_back(0xFF);
+  } else {
+    writer.alignToByte();
+  }
+}
+
+unsigned char paethPredictor(int a, int b, int c)
+{
+  const auto p = a + b - c;
+  const auto pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return (unsigned char)a;
+  }
+  return (unsigned char)(pb <= pc ? b : c);
+}
+
+// Filter row into out[0 : rowSize + 1] (filter type first) with the filter
+// minimizing the sum of absolute values, like most encoders. prevRow is a row
+// of zeros for the first row.
+void filterRow(const unsigned char *row, const unsigned char *prevRow,
+    size_t rowSize, size_t bpp, unsigned char *out, unsigned char *scratch)
+{
+  auto bestCost = std::numeric_limits<size_t>::max();
+  for (auto filter = 0; filter < 5; ++filter) {
+    auto *filtered = filter == 0 ? out + 1 : scratch;
+    for (size_t x = 0; x < rowSize; ++x) {
+      const int a = x >= bpp ? row[x - bpp] : 0;
+      const int b = prevRow[x];
+      const int c = x >= bpp ? prevRow[x - bpp] : 0;
+      int predictor = 0;
+      switch (filter) {
+      case 1:
+        predictor = a;
+        break;
+      case 2:
+        predictor = b;
+        break;
+      case 3:
+        predictor = (a + b) / 2;
+        break;
+      case 4:
+        predictor = paethPredictor(a, b, c);
+        break;
+      }
+      filtered[x] = (unsigned char)(row[x] - predictor);
+    }
+    size_t cost = 0;
+    for (size_t x = 0; x < rowSize; ++x) {
+      cost += std::abs(int((signed char)filtered[x]));
+    }
+    if (cost < bestCost) {
+      bestCost = cost;
+      out[0] = (unsigned char)filter;
+      if (filtered != out + 1) {
+        std::memcpy(out + 1, filtered, rowSize);
+      }
+    }
+  }
+}
+
+void appendHeader(std::vector<unsigned char> &out, size_t width,
+    size_t height, size_t numComponents)
+{
+  static const unsigned char signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+  out.insert(end(out), std::begin(signature), std::end(signature));
+
+  static const unsigned char colorTypes[] = {0, 4, 2, 6};
+  const auto chunkOffset = beginChunk(out);
+  appendUint32(out, uint32_t(width));
+  appendUint32(out, uint32_t(height));
+  out.push_back(8); // Bit depth
+  out.push_back(colorTypes[numComponents - 1]);
+  out.push_back(0); // Compression
+  out.push_back(0); // Filter
+  out.push_back(0); // Interlace
+  finishChunk(out, chunkOffset, "IHDR");
+}
+
+// The zlib stream ends with the checksum of the whole filtered image
+void appendFooter(std::vector<unsigned char> &out, uint32_t adler)
+{
+  auto chunkOffset = beginChunk(out);
+  appendUint32(out, adler);
+  finishChunk(out, chunkOffset, "IDAT");
+
+  chunkOffset = beginChunk(out);
+  finishChunk(out, chunkOffset, "IEND");
+}
+
+// Filter and compress rows [0, rowCount) of the image, getRow(y) being the
+// address of row y, in IDAT chunks appended to out. prevRow is the row above
+// row 0 (null at the top of the image). isFirst and isLast tell if these rows
+// start and end the zlib stream, whose checksum is updated in adler.
+template <typename GetRow>
+void appendRows(size_t rowSize, size_t numComponents, size_t rowCount,
+    const GetRow &getRow, const unsigned char *prevRow, bool isFirst,
+    bool isLast, uint32_t &adler, std::vector<unsigned char> &out)
+{
+  auto &jobSystem = getJobSystem();
+  const auto minStripRows =
+      std::max(size_t(1), MIN_STRIP_BYTES / std::max(rowSize, size_t(1)));
+  const auto stripRows = jobSystem.getGrainSize(rowCount, minStripRows);
+  const auto stripCount =
+      std::max(size_t(1), (rowCount + stripRows - 1) / stripRows);
+
+  struct Strip
+  {
+    std::vector<unsigned char> chunk; // IDAT chunk
+    Adler32 adler;
+    size_t filteredSize = 0;
+  };
+  std::vector<Strip> strips(stripCount);
+
+  jobSystem.parallelFor(stripCount, 1, [&](size_t begin, size_t end) {
+    const std::vector<unsigned char> zeros(rowSize, 0);
+    std::vector<unsigned char> filtered, scratch(rowSize);
+    for (auto stripIdx = begin; stripIdx < end; ++stripIdx) {
+      auto &strip = strips[stripIdx];
+      const auto firstRow = stripIdx * stripRows;
+      const auto lastRow = std::min(rowCount, firstRow + stripRows);
+
+      filtered.resize((lastRow - firstRow) * (rowSize + 1));
+      for (auto y = firstRow; y < lastRow; ++y) {
+        const auto *above = y ? getRow(y - 1) : prevRow;
+        filterRow(getRow(y), above ? above : zeros.data(), rowSize,
+            numComponents, filtered.data() + (y - firstRow) * (rowSize + 1),
+            scratch.data());
+      }
+      strip.adler.update(filtered.data(), filtered.size());
+      strip.filteredSize = filtered.size();
+
+      const auto chunkOffset = beginChunk(strip.chunk);
+      if (isFirst && stripIdx == 0) {
+        strip.chunk.push_back(0x78); // Deflate with a 32K window
+        strip.chunk.push_back(0x01); // Fastest compression level
+      }
+      deflateStrip(filtered.data(), filtered.size(),
+          isLast && stripIdx + 1 == stripCount, strip.chunk);
+      finishChunk(strip.chunk, chunkOffset, "IDAT");
+    }
+  });
+
+  auto streamAdler = Adler32::fromValue(adler);
+  size_t size = 0;
+  for (const auto &strip : strips) {
+    size += strip.chunk.size();
+  }
+  out.reserve(out.size() + size);
+  for (const auto &strip : strips) {
+    out.insert(end(out), begin(strip.chunk), end(strip.chunk));
+    streamAdler.combine(strip.adler, strip.filteredSize);
+  }
+  adler = streamAdler.value();
+}
+
+} // namespace
+
+std::vector<unsigned char> encodePng(size_t width, size_t height,
+    size_t numComponents, const unsigned char *pixels, bool flipY)
+{
+  const auto rowSize = width * numComponents;
+  const auto getRow = [&](size_t y) {
+    return pixels + (flipY ? height - 1 - y : y) * rowSize;
+  };
+
+  std::vector<unsigned char> png;
+  appendHeader(png, width, height, numComponents);
+  auto adler = Adler32().value();
+  appendRows(rowSize, numComponents, height, getRow, nullptr, true, true,
+      adler, png);
+  appendFooter(png, adler);
+  return png;
+}
+
+bool writePng(const fs::path &path, size_t width, size_t height,
+    size_t numComponents, const unsigned char *pixels, bool flipY,
+    std::string &err)
+{
+  const auto png = encodePng(width, height, numComponents, pixels, flipY);
+  std::ofstream file(path.string(), std::ios::binary);
+  if (!file || !file.write((const char *)png.data(), png.size())) {
+    err = "unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
+
+bool PngWriter::open(const fs::path &path, size_t width, size_t height,
+    size_t numComponents, std::string &err)
+{
+  m_path = path;
+  m_file.open(path.string(), std::ios::binary);
+  if (!m_file) {
+    err = "unable to open " + path.string();
+    return false;
+  }
+  m_nWidth = width;
+  m_nHeight = height;
+  m_nComponents = numComponents;
+  m_nWrittenRows = 0;
+  m_adler = Adler32().value();
+  m_lastRow.clear();
+
+  std::vector<unsigned char> header;
+  appendHeader(header, width, height, numComponents);
+  return write(header, err);
+}
+
+bool PngWriter::writeRows(const unsigned char *pixels, size_t rowCount,
+    bool flipY, std::string &err)
+{
+  if (m_nWrittenRows + rowCount > m_nHeight) {
+    err = "too many rows written in " + m_path.string();
+    return false;
+  }
+  const auto rowSize = m_nWidth * m_nComponents;
+  const auto getRow = [&](size_t y) {
+    return pixels + (flipY ? rowCount - 1 - y : y) * rowSize;
+  };
+
+  std::vector<unsigned char> chunks;
+  appendRows(rowSize, m_nComponents, rowCount, getRow,
+      m_lastRow.empty() ? nullptr : m_lastRow.data(), m_nWrittenRows == 0,
+      m_nWrittenRows + rowCount == m_nHeight, m_adler, chunks);
+  m_nWrittenRows += rowCount;
+  if (rowCount) {
+    m_lastRow.assign(getRow(rowCount - 1), getRow(rowCount - 1) + rowSize);
+  }
+  return write(chunks, err);
+}
+
+bool PngWriter::close(std::string &err)
+{
+  if (m_nWrittenRows != m_nHeight) {
+    err = "missing rows in " + m_path.string();
+    m_file.close();
+    return false;
+  }
+  std::vector<unsigned char> footer;
+  appendFooter(footer, m_adler);
+  if (!write(footer, err)) {
+    return false;
+  }
+  m_file.close();
+  if (!m_file) {
+    err = "unable to write " + m_path.string();
+    return false;
+  }
+  return true;
+}
+
+bool PngWriter::write(const std::vector<unsigned char> &bytes, std::string &err)
+{
+  if (!m_file.write((const char *)bytes.data(), bytes.size())) {
+    err = "unable to write " + m_path.string();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Parallel PNG encoder for 8-bit images.
+//
+// The image is split in strips of rows encoded in parallel with the job
+// system: each strip is filtered and compressed in an independent deflate
+// block ending with a sync flush, so the strips can be concatenated in a
+// single zlib stream. Each strip has its own IDAT chunk so that CRCs are
+// also computed in parallel. Compression is a bit weaker than a sequential
+// encoder because matches can't cross strips.
+//
+// If flipY is true, rows are read from the last one to the first one, which
+// turns the images read with glReadPixels (bottom row first) upside up at no
+// cost.
+
+// Encode pixels[0 : width * height * numComponents] (1 to 4 components)
+std::vector<unsigned char> encodePng(size_t width, size_t height,
+    size_t numComponents, const unsigned char *pixels, bool flipY = false);
+
+// Encode pixels (see encodePng) in the file path. Return false and fill err
+// on failure.
+bool writePng(const fs::path &path, size_t width, size_t height,
+    size_t numComponents, const unsigned char *pixels, bool flipY,
+    std::string &err);
+
+// Streaming version of writePng: rows are encoded a few at a time, so the
+// whole image never needs to be in memory (see renderTiledImage).
+class PngWriter
+{
+public:
+  // Start writing a width x height image in path
+  bool open(const fs::path &path, size_t width, size_t height,
+      size_t numComponents, std::string &err);
+
+  // Encode the next rowCount rows of the image, given by pixels[0 : rowCount
+  // * width * numComponents] (bottom row first if flipY is true)
+  bool writeRows(const unsigned char *pixels, size_t rowCount, bool flipY,
+      std::string &err);
+
+  // Finish the file, every row of the image must have been written
+  bool close(std::string &err);
+
+private:
+  bool write(const std::vector<unsigned char> &bytes, std::string &err);
+
+  fs::path m_path;
+  std::ofstream m_file;
+  size_t m_nWidth = 0;
+  size_t m_nHeight = 0;
+  size_t m_nComponents = 0;
+  size_t m_nWrittenRows = 0;
+  uint32_t m_adler = 1; // Checksum of the zlib stream written so far
+  std::vector<unsigned char> m_lastRow; // Row above the next written row
+};
@@ -0,0 +1,536 @@
+#include "point_clouds.hpp"
+#include "frustum.hpp"
+#include "gl_extensions.hpp"
+#include "tracing.hpp"
+
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <queue>
+
+namespace
+{
+
+// Layout of the Node struct of rasterize_points.cs.glsl: a range of points,
+// the first invocation rasterizing them and the matrix of their instance
+struct GpuNode
+{
+  uint32_t firstPoint;
+  uint32_t pointCount;
+  uint32_t firstInvocation;
+  uint32_t instance;
+  float spacing;
+  uint32_t padding[3];
+};
+
+// Octree node waiting to be drawn by PointClouds::drawPoints, refined in
+// decreasing order of the spacing of its points on screen
+struct Candidate
+{
+  float pixelSpacing;
+  uint32_t instance; // In the culled instances
+  uint32_t node;
+
+  bool operator<(const Candidate &other) const
+  {
+    return pixelSpacing < other.pixelSpacing;
+  }
+};
+
+size_t getStorageAlignment()
+{
+  GLint alignment = 0;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return std::max(size_t(alignment), size_t(16));
+}
+
+bool isLineMode(int mode)
+{
+  return mode == TINYGLTF_MODE_LINE || mode == TINYGLTF_MODE_LINE_LOOP ||
+         mode == TINYGLTF_MODE_LINE_STRIP;
+}
+
+} // namespace
+
+bool PointClouds::hasAtomicInt64()
+{
+  return hasGLExtension("GL_ARB_gpu_shader_int64") &&
+         hasGLExtension("GL_NV_shader_atomic_int64");
+}
+
+PointClouds &PointClouds::operator=(PointClouds &&rvalue)
+{
+  if (this != &rvalue) {
+    std::swap(m_nodes, rvalue.m_nodes);
+    std::swap(m_clouds, rvalue.m_clouds);
+    std::swap(m_lineSets, rvalue.m_lineSets);
+    std::swap(m_meshPrimitives, rvalue.m_meshPrimitives);
+    std::swap(m_cloudInstances, rvalue.m_cloudInstances);
+    std::swap(m_lineInstances, rvalue.m_lineInstances);
+    std::swap(m_points, rvalue.m_points);
+    std::swap(m_lineVertices, rvalue.m_lineVertices);
+    std::swap(m_nPointCount, rvalue.m_nPointCount);
+    std::swap(m_nSegmentCount, rvalue.m_nSegmentCount);
+    std::swap(m_pointBuffer, rvalue.m_pointBuffer);
+    std::swap(m_lineVertexBuffer, rvalue.m_lineVertexBuffer);
+    std::swap(m_pixelBuffer, rvalue.m_pixelBuffer);
+    std::swap(m_nPixelCount, rvalue.m_nPixelCount);
+    std::swap(m_emptyVertexArray, rvalue.m_emptyVertexArray);
+    std::swap(m_nDrawnPointCount, rvalue.m_nDrawnPointCount);
+    std::swap(m_nDrawnNodeCount, rvalue.m_nDrawnNodeCount);
+    std::swap(m_nDrawnSegmentCount, rvalue.m_nDrawnSegmentCount);
+  }
+  return *this;
+}
+
+void PointClouds::build(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers)
+{
+  TRACE_ZONE("Build point clouds");
+  *this = PointClouds();
+  m_meshPrimitives.resize(model.meshes.size());
+
+  std::vector<float> positions;
+  std::vector<float> colors;
+  std::vector<uint32_t> indices;
+  std::vector<Point> vertices;
+  std::vector<uint64_t> cells;
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    const auto &mesh = model.meshes[meshIdx];
+    auto &meshPrimitives = m_meshPrimitives[meshIdx];
+    meshPrimitives.assign(mesh.primitives.size(), -1);
+    for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+      const auto &primitive = mesh.primitives[pIdx];
+      const auto isPoints = primitive.mode == TINYGLTF_MODE_POINTS;
+      const auto positionIt = primitive.attributes.find("POSITION");
+      if ((!isPoints && !isLineMode(primitive.mode)) ||
+          positionIt == end(primitive.attributes)) {
+        continue;
+      }
+      const auto &positionAccessor = model.accessors[positionIt->second];
+      const auto vertexCount = positionAccessor.count;
+      if (!vertexCount) {
+        continue;
+      }
+      positions.resize(vertexCount * 3);
+      readAccessorAsFloats(
+          model, buffers, positionAccessor, 3, positions.data());
+      colors.assign(vertexCount * 4, 1.f);
+      const auto colorIt = primitive.attributes.find("COLOR_0");
+      if (colorIt != end(primitive.attributes) &&
+          model.accessors[colorIt->second].count == vertexCount) {
+        const auto &colorAccessor = model.accessors[colorIt->second];
+        readAccessorAsFloats(model, buffers, colorAccessor, 4, colors.data());
+        // RGB colors are read with an alpha of 0
+        if (colorAccessor.type == TINYGLTF_TYPE_VEC3) {
+          for (size_t v = 0; v < vertexCount; ++v) {
+            colors[4 * v + 3] = 1.f;
+          }
+        }
+      }
+      glm::vec4 baseColorFactor(1);
+      if (primitive.material >= 0 &&
+          size_t(primitive.material) < model.materials.size()) {
+        const auto &factor = model.materials[primitive.material]
+                                 .pbrMetallicRoughness.baseColorFactor;
+        for (size_t i = 0; i < 4 && i < factor.size(); ++i) {
+          baseColorFactor[int(i)] = float(factor[i]);
+        }
+      }
+      vertices.resize(vertexCount);
+      auto boundsMin = glm::vec3(std::numeric_limits<float>::max());
+      auto boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+      for (size_t v = 0; v < vertexCount; ++v) {
+        const auto color = glm::make_vec4(&colors[4 * v]) * baseColorFactor;
+        vertices[v] = {glm::make_vec3(&positions[3 * v]),
+            glm::packUnorm4x8(glm::clamp(color, 0.f, 1.f))};
+        boundsMin = glm::min(boundsMin, vertices[v].position);
+        boundsMax = glm::max(boundsMax, vertices[v].position);
+      }
+
+      if (isPoints) {
+        meshPrimitives[pIdx] = int(m_clouds.size());
+        // Octrees are cubes, so that the spacing of a node is the same
+        // along every axis
+        const auto extent = boundsMax - boundsMin;
+        const auto size =
+            std::max(std::max(std::max(extent.x, extent.y), extent.z), 1e-6f);
+        const auto root = buildNode(
+            vertices, 0, vertices.size(), boundsMin, size, 0, cells);
+        m_clouds.push_back({root, boundsMin, boundsMax});
+        m_nPointCount += vertexCount;
+        continue;
+      }
+
+      indices.resize(primitive.indices >= 0
+                         ? model.accessors[primitive.indices].count
+                         : vertexCount);
+      if (primitive.indices >= 0) {
+        readAccessorAsUints(model, buffers, model.accessors[primitive.indices],
+            indices.data());
+      } else {
+        std::iota(begin(indices), end(indices), 0);
+      }
+      LineSet lineSet{uint32_t(m_lineVertices.size() / 2), 0, boundsMin,
+          boundsMax};
+      const auto addSegment = [&](uint32_t a, uint32_t b) {
+        if (a < vertexCount && b < vertexCount) {
+          m_lineVertices.push_back(vertices[a]);
+          m_lineVertices.push_back(vertices[b]);
+          ++lineSet.segmentCount;
+        }
+      };
+      if (primitive.mode == TINYGLTF_MODE_LINE) {
+        for (size_t i = 0; i + 1 < indices.size(); i += 2) {
+          addSegment(indices[i], indices[i + 1]);
+        }
+      } else {
+        for (size_t i = 0; i + 1 < indices.size(); ++i) {
+          addSegment(indices[i], indices[i + 1]);
+        }
+        if (primitive.mode == TINYGLTF_MODE_LINE_LOOP && indices.size() > 2) {
+          addSegment(indices.back(), indices.front());
+        }
+      }
+      meshPrimitives[pIdx] = -2 - int(m_lineSets.size());
+      m_lineSets.push_back(lineSet);
+      m_nSegmentCount += lineSet.segmentCount;
+    }
+  }
+}
+
+uint32_t PointClouds::buildNode(std::vector<Point> &points, size_t first,
+    size_t last, const glm::vec3 &boundsMin, float size, size_t depth,
+    std::vector<uint64_t> &cells)
+{
+  const auto nodeIdx = uint32_t(m_nodes.size());
+  m_nodes.emplace_back();
+  const auto isLeaf = last - first <= MAX_NODE_POINTS || depth >= MAX_DEPTH;
+  auto keptEnd = last;
+  if (!isLeaf) {
+    // The first point of each cell of the grid stays in the node, moved to
+    // the front of the range
+    const auto gridSize = uint32_t(NODE_GRID_SIZE);
+    cells.assign(NODE_GRID_SIZE * NODE_GRID_SIZE * NODE_GRID_SIZE / 64, 0);
+    const auto cellScale = float(NODE_GRID_SIZE) / size;
+    keptEnd = first;
+    for (auto i = first; i < last; ++i) {
+      const auto cell = glm::min(
+          glm::uvec3(glm::max(
+              (points[i].position - boundsMin) * cellScale, glm::vec3(0))),
+          glm::uvec3(gridSize - 1));
+      const auto cellIdx = (cell.z * gridSize + cell.y) * gridSize + cell.x;
+      const auto bit = uint64_t(1) << (cellIdx % 64);
+      if (!(cells[cellIdx / 64] & bit)) {
+        cells[cellIdx / 64] |= bit;
+        std::swap(points[i], points[keptEnd++]);
+      }
+    }
+  }
+  {
+    // Children are appended to m_nodes, the node is only referenced here
+    auto &node = m_nodes[nodeIdx];
+    node.boundsMin = boundsMin;
+    node.size = size;
+    node.firstPoint = uint32_t(m_points.size());
+    node.pointCount = uint32_t(keptEnd - first);
+    // n points sampling the surface of the cube are about size / sqrt(n)
+    // apart
+    node.spacing = size / std::sqrt(float(std::max(node.pointCount, 1u)));
+    std::fill(std::begin(node.children), std::end(node.children), 0);
+  }
+  m_points.insert(
+      end(m_points), begin(points) + first, begin(points) + keptEnd);
+  if (isLeaf) {
+    return nodeIdx;
+  }
+
+  // The other points are split in the octants of the cube along x, y then
+  // z: octant k is in [bounds[k], bounds[k + 1]), the bits of k telling
+  // whether it is in the upper half along x (4), y (2) and z (1)
+  const auto center = boundsMin + 0.5f * size;
+  const auto split = [&](size_t begin, size_t end, int axis) {
+    return size_t(std::partition(points.begin() + begin,
+                      points.begin() + end,
+                      [&](const Point &point) {
+                        return point.position[axis] < center[axis];
+                      }) -
+                  points.begin());
+  };
+  size_t bounds[9];
+  bounds[0] = keptEnd;
+  bounds[8] = last;
+  bounds[4] = split(bounds[0], bounds[8], 0);
+  for (size_t k = 0; k < 8; k += 4) {
+    bounds[k + 2] = split(bounds[k], bounds[k + 4], 1);
+  }
+  for (size_t k = 0; k < 8; k += 2) {
+    bounds[k + 1] = split(bounds[k], bounds[k + 2], 2);
+  }
+  const auto halfSize = 0.5f * size;
+  for (size_t k = 0; k < 8; ++k) {
+    if (bounds[k + 1] == bounds[k]) {
+      continue;
+    }
+    const auto octant = glm::vec3(float((k >> 2) & 1), float((k >> 1) & 1),
+        float(k & 1));
+    const auto child = buildNode(points, bounds[k], bounds[k + 1],
+        boundsMin + halfSize * octant, halfSize, depth + 1, cells);
+    m_nodes[nodeIdx].children[k] = child;
+  }
+  return nodeIdx;
+}
+
+void PointClouds::setInstances(const SceneHierarchy &hierarchy)
+{
+  m_cloudInstances.clear();
+  m_lineInstances.clear();
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    const auto meshIdx = hierarchy.mesh(flatIdx);
+    if (meshIdx < 0 || size_t(meshIdx) >= m_meshPrimitives.size()) {
+      continue;
+    }
+    for (const auto index : m_meshPrimitives[meshIdx]) {
+      if (index >= 0) {
+        m_cloudInstances.push_back({flatIdx, uint32_t(index)});
+      } else if (index <= -2) {
+        m_lineInstances.push_back({flatIdx, uint32_t(-2 - index)});
+      }
+    }
+  }
+}
+
+void PointClouds::upload()
+{
+  if (!m_points.empty()) {
+    m_pointBuffer = GLBuffer(m_points.size() * sizeof(Point), m_points.data(),
+        0, GLMemoryCategory::Geometry);
+  }
+  if (!m_lineVertices.empty()) {
+    m_lineVertexBuffer = GLBuffer(m_lineVertices.size() * sizeof(Point),
+        m_lineVertices.data(), 0, GLMemoryCategory::Geometry);
+  }
+  m_points = {};
+  m_lineVertices = {};
+  m_emptyVertexArray = GLVertexArray::create();
+}
+
+size_t PointClouds::gpuBytes() const
+{
+  // Each pixel holds a depth and a color
+  return (m_nPointCount + 2 * m_nSegmentCount) * sizeof(Point) +
+         m_nPixelCount * 2 * sizeof(GLuint);
+}
+
+size_t PointClouds::draw(const Programs &programs,
+    const SceneHierarchy &hierarchy, const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, const Settings &settings,
+    RingBuffer &ring) const
+{
+  TRACE_ZONE("Draw point clouds");
+  m_nDrawnPointCount = 0;
+  m_nDrawnNodeCount = 0;
+  m_nDrawnSegmentCount = 0;
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  if (viewport[2] <= 0 || viewport[3] <= 0) {
+    return 0;
+  }
+  // Pixels covered by a length of one at a distance of one, as with levels
+  // of detail
+  const auto pixelsPerUnit = 0.5f * projMatrix[1][1] * float(viewport[3]);
+  const auto viewProjMatrix = projMatrix * viewMatrix;
+
+  m_emptyVertexArray.bind();
+  if (!m_cloudInstances.empty() && m_pointBuffer.glId()) {
+    m_nDrawnPointCount = drawPoints(programs, hierarchy, viewMatrix,
+        viewProjMatrix, pixelsPerUnit, viewport, settings, ring);
+  }
+  if (!m_lineInstances.empty() && m_lineVertexBuffer.glId()) {
+    drawLines(programs, hierarchy, viewProjMatrix, viewport, settings);
+  }
+  glBindVertexArray(0);
+  return m_nDrawnPointCount;
+}
+
+size_t PointClouds::drawPoints(const Programs &programs,
+    const SceneHierarchy &hierarchy, const glm::mat4 &viewMatrix,
+    const glm::mat4 &viewProjMatrix, float pixelsPerUnit,
+    const GLint viewport[4], const Settings &settings, RingBuffer &ring) const
+{
+  // Octree nodes are culled and refined in the space of their instance
+  const auto eye = glm::vec3(glm::inverse(viewMatrix)[3]);
+  std::vector<glm::mat4> modelViewProjMatrices;
+  std::vector<Frustum> frustums;
+  std::vector<glm::vec3> eyes;
+  std::vector<uint32_t> clouds;
+  std::priority_queue<Candidate> candidates;
+  const auto getPixelSpacing = [&](uint32_t instance, uint32_t nodeIdx) {
+    const auto &node = m_nodes[nodeIdx];
+    const auto &localEye = eyes[instance];
+    const auto nodeMax = node.boundsMin + glm::vec3(node.size);
+    const auto distance = glm::length(glm::max(
+        glm::max(node.boundsMin - localEye, localEye - nodeMax),
+        glm::vec3(0)));
+    return node.spacing * pixelsPerUnit /
+           std::max(distance, 1e-3f * node.size);
+  };
+  for (const auto &instance : m_cloudInstances) {
+    const auto &worldMatrix = hierarchy.worldMatrix(instance.node);
+    const auto modelViewProjMatrix = viewProjMatrix * worldMatrix;
+    const auto frustum = extractFrustum(modelViewProjMatrix);
+    const auto &cloud = m_clouds[instance.index];
+    if (!intersectsBox(frustum, cloud.boundsMin, cloud.boundsMax)) {
+      continue;
+    }
+    const auto instanceIdx = uint32_t(modelViewProjMatrices.size());
+    modelViewProjMatrices.push_back(modelViewProjMatrix);
+    frustums.push_back(frustum);
+    eyes.push_back(glm::vec3(glm::inverse(worldMatrix) * glm::vec4(eye, 1)));
+    candidates.push(
+        {getPixelSpacing(instanceIdx, cloud.root), instanceIdx, cloud.root});
+  }
+
+  // The coarsest nodes come first, so that the budget is spent on the
+  // points that fill the most pixels. A node whose points are less than a
+  // pixel apart needs no finer child.
+  std::vector<GpuNode> nodes;
+  size_t invocationCount = 0;
+  while (!candidates.empty()) {
+    const auto candidate = candidates.top();
+    candidates.pop();
+    const auto &node = m_nodes[candidate.node];
+    if (invocationCount + node.pointCount > settings.pointBudget) {
+      break;
+    }
+    nodes.push_back({node.firstPoint, node.pointCount,
+        uint32_t(invocationCount), candidate.instance, node.spacing, {}});
+    invocationCount += node.pointCount;
+    if (candidate.pixelSpacing <= 1.f) {
+      continue;
+    }
+    const auto &frustum = frustums[candidate.instance];
+    for (const auto childIdx : node.children) {
+      if (!childIdx) {
+        continue;
+      }
+      const auto &child = m_nodes[childIdx];
+      if (intersectsBox(frustum, child.boundsMin,
+              child.boundsMin + glm::vec3(child.size))) {
+        candidates.push({getPixelSpacing(candidate.instance, childIdx),
+            candidate.instance, childIdx});
+      }
+    }
+  }
+  m_nDrawnNodeCount = nodes.size();
+  if (!invocationCount) {
+    return 0;
+  }
+
+  const auto alignment = getStorageAlignment();
+  const auto nodeBytes = nodes.size() * sizeof(GpuNode);
+  const auto nodeAllocation = ring.upload(nodes.data(), nodeBytes, alignment);
+  const auto matrixBytes = modelViewProjMatrices.size() * sizeof(glm::mat4);
+  const auto matrixAllocation =
+      ring.upload(modelViewProjMatrices.data(), matrixBytes, alignment);
+  const auto width = size_t(viewport[2]);
+  const auto height = size_t(viewport[3]);
+  allocatePixels(width, height);
+  const GLuint emptyPixel = 0xFFFFFFFF;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_pixelBuffer.glId());
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+      GL_UNSIGNED_INT, &emptyPixel);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, POINTS_BINDING, m_pointBuffer.glId());
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, NODES_BINDING,
+      nodeAllocation.buffer, GLintptr(nodeAllocation.offset),
+      GLsizeiptr(nodeBytes));
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, INSTANCES_BINDING,
+      matrixAllocation.buffer, GLintptr(matrixAllocation.offset),
+      GLsizeiptr(matrixBytes));
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, PIXELS_BINDING, m_pixelBuffer.glId());
+
+  // Workgroups are laid out in rows of at most 65535, the minimum
+  // GL_MAX_COMPUTE_WORK_GROUP_COUNT
+  const auto groupCount =
+      (invocationCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+  const auto rowSize = std::min(groupCount, size_t(65535));
+  const auto rowCount = (groupCount + rowSize - 1) / rowSize;
+  const auto rasterize = [&](const GLProgram &program) {
+    program.use();
+    program.getUniform<GLuint>("uNodeCount").set(GLuint(nodes.size()));
+    program.getUniform<GLuint>("uInvocationCount")
+        .set(GLuint(invocationCount));
+    program.getUniform<glm::vec2>("uViewportSize")
+        .set(glm::vec2(float(width), float(height)));
+    program.getUniform<float>("uPixelsPerUnit").set(pixelsPerUnit);
+    program.getUniform<float>("uMaxPointSize").set(settings.maxPointSize);
+    glDispatchCompute(GLuint(rowSize), GLuint(rowCount), 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  };
+  rasterize(programs.rasterize);
+  if (!programs.atomicInt64) {
+    rasterize(programs.rasterizeColors);
+  }
+
+  programs.resolve.use();
+  programs.resolve.getUniform<glm::vec4>("uViewport")
+      .set(glm::vec4(float(viewport[0]), float(viewport[1]), float(width),
+          float(height)));
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  for (const auto binding :
+      {POINTS_BINDING, NODES_BINDING, INSTANCES_BINDING, PIXELS_BINDING}) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+  }
+  return invocationCount;
+}
+
+void PointClouds::drawLines(const Programs &programs,
+    const SceneHierarchy &hierarchy, const glm::mat4 &viewProjMatrix,
+    const GLint viewport[4], const Settings &settings) const
+{
+  const auto &program = programs.lines;
+  program.use();
+  const auto modelViewProjMatrix =
+      program.getUniform<glm::mat4>("uModelViewProjMatrix");
+  const auto firstSegment = program.getUniform<GLuint>("uFirstSegment");
+  program.getUniform<glm::vec2>("uViewportSize")
+      .set(glm::vec2(float(viewport[2]), float(viewport[3])));
+  program.getUniform<float>("uLineWidth").set(settings.lineWidth);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LINE_VERTICES_BINDING,
+      m_lineVertexBuffer.glId());
+  for (const auto &instance : m_lineInstances) {
+    const auto &lineSet = m_lineSets[instance.index];
+    const auto matrix =
+        viewProjMatrix * hierarchy.worldMatrix(instance.node);
+    if (!lineSet.segmentCount ||
+        !intersectsBox(
+            extractFrustum(matrix), lineSet.boundsMin, lineSet.boundsMax)) {
+      continue;
+    }
+    modelViewProjMatrix.set(matrix);
+    firstSegment.set(lineSet.firstSegment);
+    glDrawArraysInstanced(
+        GL_TRIANGLE_STRIP, 0, 4, GLsizei(lineSet.segmentCount));
+    m_nDrawnSegmentCount += lineSet.segmentCount;
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LINE_VERTICES_BINDING, 0);
+}
+
+void PointClouds::allocatePixels(size_t width, size_t height) const
+{
+  if (width * height <= m_nPixelCount) {
+    return;
+  }
+  m_nPixelCount = width * height;
+  m_pixelBuffer = GLBuffer(m_nPixelCount * 2 * sizeof(GLuint), nullptr, 0,
+      GLMemoryCategory::RenderTargets);
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "gltf.hpp"
+#include "ring_buffer.hpp"
+#include "scene_hierarchy.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// POINTS and LINES primitives of a glTF model (LiDAR scans, wiring), drawn
+// apart from the triangle paths, which would be vertex and fill-rate bound
+// on tens of millions of elements. The GeometryArena keeps no geometry for
+// them (see GeometryArena::layoutPrimitives).
+//
+// The points of a primitive are split in an octree by nested subsampling:
+// a node keeps the first point falling in each cell of a grid of
+// NODE_GRID_SIZE^3 cells over its cube and gives the others to its
+// children, until at most MAX_NODE_POINTS points are left. Each frame, the
+// nodes are refined from the roots by decreasing projected point spacing
+// until the point budget is spent, and the points of the selected nodes are
+// rasterized by a compute shader (rasterize_points.cs.glsl): each point
+// covers a square of pixels as wide as the spacing of its node, so that
+// coarse nodes leave no holes, and keeps the closest depth of each pixel
+// with atomics. With 64-bit atomics the depth and color of a pixel are
+// packed in one value written by a single atomicMin, otherwise a first pass
+// writes the depths and a second one the colors of the points at those
+// depths. resolve_points.fs.glsl then writes the pixels in the framebuffer
+// with their depth, so that points are depth tested against the triangles.
+//
+// Lines are split in segments stored in a storage buffer, each drawn as an
+// instanced quad lineWidth pixels wide (thick_lines.vs.glsl).
+//
+// Points and lines are unlit: COLOR_0 times the base color factor of their
+// material. Strips and loops are converted to line lists.
+class PointClouds
+{
+public:
+  // Points of a node above which it is split in children
+  static const size_t MAX_NODE_POINTS = 16384;
+  // Cells per side of the grid subsampling the points of inner nodes
+  static const size_t NODE_GRID_SIZE = 64;
+  // Depth of the deepest nodes, whose points are never split (e.g. copies
+  // of the same point)
+  static const size_t MAX_DEPTH = 24;
+  // local_size_x of rasterize_points.cs.glsl
+  static const GLuint WORKGROUP_SIZE = 256;
+  // Storage buffer bindings of the shaders
+  static const GLuint POINTS_BINDING = 0;
+  static const GLuint NODES_BINDING = 1;
+  static const GLuint INSTANCES_BINDING = 2;
+  static const GLuint PIXELS_BINDING = 3;
+  static const GLuint LINE_VERTICES_BINDING = 4;
+
+  struct Programs
+  {
+    // rasterize_points.cs.glsl, with ATOMIC_INT64 if atomicInt64 is set
+    GLProgram rasterize;
+    // rasterize_points.cs.glsl with COLOR_PASS, only used without 64-bit
+    // atomics
+    GLProgram rasterizeColors;
+    bool atomicInt64 = false;
+    GLProgram resolve; // fullscreen.vs.glsl with resolve_points.fs.glsl
+    GLProgram lines; // thick_lines.vs.glsl with thick_lines.fs.glsl
+  };
+
+  struct Settings
+  {
+    size_t pointBudget = 10000000; // Points rasterized per draw() call
+    float maxPointSize = 8.f; // Of adaptive points, in pixels
+    float lineWidth = 2.f; // In pixels
+  };
+
+  // True if rasterize_points.cs.glsl can pack pixels in 64-bit atomics
+  // (GL_ARB_gpu_shader_int64 and GL_NV_shader_atomic_int64)
+  static bool hasAtomicInt64();
+
+  PointClouds() = default;
+
+  // Non-copyable class:
+  PointClouds(const PointClouds &) = delete;
+  PointClouds &operator=(const PointClouds &) = delete;
+
+  PointClouds(PointClouds &&rvalue) { *this = std::move(rvalue); }
+
+  PointClouds &operator=(PointClouds &&rvalue);
+
+  // Build the octrees and segments of the POINTS and LINES primitives of
+  // model, without any GL call so that it can run on a loader thread
+  void build(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers);
+
+  // Draw the primitives built by build() with the nodes of hierarchy using
+  // their mesh, which can change without building them again
+  void setInstances(const SceneHierarchy &hierarchy);
+
+  // Create the GPU buffers and release the built points and segments
+  void upload();
+
+  bool empty() const { return m_clouds.empty() && m_lineSets.empty(); }
+
+  size_t pointCount() const { return m_nPointCount; }
+
+  size_t segmentCount() const { return m_nSegmentCount; }
+
+  // Draw the instances in the bound framebuffer, whose viewport is the
+  // current one, with the current depth test. Return the number of points
+  // rasterized.
+  size_t draw(const Programs &programs, const SceneHierarchy &hierarchy,
+      const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix,
+      const Settings &settings, RingBuffer &ring) const;
+
+  // Points, octree nodes and segments drawn by the last draw()
+  size_t drawnPointCount() const { return m_nDrawnPointCount; }
+  size_t drawnNodeCount() const { return m_nDrawnNodeCount; }
+  size_t drawnSegmentCount() const { return m_nDrawnSegmentCount; }
+
+  // Bytes of the GPU buffers
+  size_t gpuBytes() const;
+
+private:
+  // Layout of the Point struct of rasterize_points.cs.glsl
+  struct Point
+  {
+    glm::vec3 position; // Object space
+    uint32_t color; // Linear RGBA8
+  };
+
+  struct OctreeNode
+  {
+    glm::vec3 boundsMin; // Of its cube
+    float size; // Of a side of its cube
+    // Mean distance between its points, assuming they sample surfaces
+    float spacing;
+    uint32_t firstPoint; // In m_points
+    uint32_t pointCount;
+    uint32_t children[8]; // In m_nodes, 0 if none (a root is no child)
+  };
+
+  // Octree of a POINTS primitive
+  struct Cloud
+  {
+    uint32_t root; // In m_nodes
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+  };
+
+  // Segments of a LINES, LINE_LOOP or LINE_STRIP primitive, two Points each
+  // in m_lineVertices
+  struct LineSet
+  {
+    uint32_t firstSegment;
+    uint32_t segmentCount;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+  };
+
+  // Node of a cloud whose world matrix is that of a node of the hierarchy
+  struct Instance
+  {
+    uint32_t node; // Flat index in the hierarchy
+    uint32_t index; // In m_clouds or m_lineSets
+  };
+
+  // Append the octree node of points[first, last), in the cube of side size
+  // at boundsMin, and its children. Return its index in m_nodes.
+  uint32_t buildNode(std::vector<Point> &points, size_t first, size_t last,
+      const glm::vec3 &boundsMin, float size, size_t depth,
+      std::vector<uint64_t> &cells);
+
+  // Steps of draw(): rasterize the points of the selected octree nodes and
+  // resolve them, return their number, then draw the visible segments
+  size_t drawPoints(const Programs &programs, const SceneHierarchy &hierarchy,
+      const glm::mat4 &viewMatrix, const glm::mat4 &viewProjMatrix,
+      float pixelsPerUnit, const GLint viewport[4], const Settings &settings,
+      RingBuffer &ring) const;
+
+  void drawLines(const Programs &programs, const SceneHierarchy &hierarchy,
+      const glm::mat4 &viewProjMatrix, const GLint viewport[4],
+      const Settings &settings) const;
+
+  // Allocate the pixels of a width x height viewport if they do not fit
+  void allocatePixels(size_t width, size_t height) const;
+
+  std::vector<OctreeNode> m_nodes;
+  std::vector<Cloud> m_clouds;
+  std::vector<LineSet> m_lineSets;
+  // Index in m_clouds (if >= 0) or m_lineSets (-2 - index) of each primitive
+  // of each mesh, -1 for other primitives
+  std::vector<std::vector<int>> m_meshPrimitives;
+  std::vector<Instance> m_cloudInstances;
+  std::vector<Instance> m_lineInstances;
+  // Points of the nodes and vertices of the segments, released by upload()
+  std::vector<Point> m_points;
+  std::vector<Point> m_lineVertices;
+  size_t m_nPointCount = 0;
+  size_t m_nSegmentCount = 0;
+
+  GLBuffer m_pointBuffer;
+  GLBuffer m_lineVertexBuffer;
+  // Depth and color of each pixel, cleared by each draw() call
+  mutable GLBuffer m_pixelBuffer;
+  mutable size_t m_nPixelCount = 0;
+  mutable GLVertexArray m_emptyVertexArray;
+
+  mutable size_t m_nDrawnPointCount = 0;
+  mutable size_t m_nDrawnNodeCount = 0;
+  mutable size_t m_nDrawnSegmentCount = 0;
+};
@@ -0,0 +1,76 @@
+#include "pose_simulation.hpp"
+
+#include <chrono>
+
+PoseSimulation::PoseSimulation(const SceneHierarchy &hierarchy,
+    const SceneAnimations &animations, const SceneSkins &skins,
+    const MorphWeights &weights) :
+    m_hierarchy(hierarchy),
+    m_animations(animations),
+    m_skins(skins),
+    m_weights(weights),
+    m_thread([this]() { run(); })
+{
+}
+
+PoseSimulation::~PoseSimulation()
+{
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_isStopping = true;
+  }
+  m_condition.notify_one();
+  m_thread.join();
+}
+
+void PoseSimulation::request(size_t animationIdx, double time)
+{
+  if (animationIdx == m_nLastAnimation && time == m_lastTime) {
+    return;
+  }
+  m_nLastAnimation = animationIdx;
+  m_lastTime = time;
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_nRequestedAnimation = animationIdx;
+    m_requestedTime = time;
+    m_hasRequest = true;
+  }
+  m_condition.notify_one();
+}
+
+void PoseSimulation::run()
+{
+  for (;;) {
+    size_t animationIdx = 0;
+    double time = 0.;
+    {
+      std::unique_lock<std::mutex> lock{m_mutex};
+      m_condition.wait(lock, [&]() { return m_hasRequest || m_isStopping; });
+      if (m_isStopping) {
+        return;
+      }
+      animationIdx = m_nRequestedAnimation;
+      time = m_requestedTime;
+      m_hasRequest = false;
+    }
+
+    const auto startTime = std::chrono::steady_clock::now();
+    m_animations.apply(animationIdx, time, m_hierarchy, m_weights);
+    m_hierarchy.update();
+
+    // Slots are reused, so their vectors keep their allocations
+    auto &pose = m_poses.writeSlot();
+    pose.animation = animationIdx;
+    pose.time = time;
+    pose.worldMatrices = m_hierarchy.worldMatrices();
+    pose.worldOrigins = m_hierarchy.worldOrigins();
+    m_skins.computePalettes(m_hierarchy, pose.palettes);
+    pose.weights = m_weights.values();
+    m_poses.publish();
+
+    m_poseTime = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime)
+                     .count();
+  }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "animation.hpp"
+#include "morphing.hpp"
+#include "scene_hierarchy.hpp"
+#include "skinning.hpp"
+#include "triple_buffer.hpp"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Animation of a scene evaluated on a dedicated thread, so that sampling,
+// transform propagation and joint matrices do not serialize with GL
+// submission on the render thread.
+//
+// The thread works on its own copies of the hierarchy, the animations and
+// the morph target weights. The render loop requests the pose of its next
+// frame, then picks up at the start of that frame the last pose the thread
+// published, through a TripleBuffer: neither thread waits for the other,
+// a frame finding no new pose keeps the previous one.
+class PoseSimulation
+{
+public:
+  // Pose of the scene at a time of an animation
+  struct Pose
+  {
+    size_t animation = 0;
+    double time = 0.;
+    std::vector<glm::mat4> worldMatrices; // See SceneHierarchy
+    std::vector<glm::dvec3> worldOrigins;
+    std::vector<glm::mat4> palettes; // See SceneSkins::computePalettes
+    std::vector<float> weights; // See MorphWeights::values
+  };
+
+  // Start the thread with copies of hierarchy, animations and weights.
+  // Joint matrices are computed with skins, which must outlive the
+  // simulation and not be rebuilt.
+  PoseSimulation(const SceneHierarchy &hierarchy,
+      const SceneAnimations &animations, const SceneSkins &skins,
+      const MorphWeights &weights);
+
+  // Stop the thread once its current pose is computed
+  ~PoseSimulation();
+
+  PoseSimulation(const PoseSimulation &) = delete;
+  PoseSimulation &operator=(const PoseSimulation &) = delete;
+
+  // Ask for the pose of an animation at time seconds (see
+  // SceneAnimations::apply). A request replaces the previous one if the
+  // thread has not started it, requesting the last requested pose again
+  // does nothing.
+  void request(size_t animationIdx, double time);
+
+  // Take the last pose published by the thread if there is a new one since
+  // the last call and return true, pose() then returns it
+  bool acquire() { return m_poses.acquire(); }
+
+  // Last acquired pose
+  const Pose &pose() const { return m_poses.readSlot(); }
+
+  // Duration of the computation of the last published pose, in milliseconds
+  double poseTime() const { return m_poseTime.load(); }
+
+private:
+  void run();
+
+  SceneHierarchy m_hierarchy;
+  SceneAnimations m_animations;
+  const SceneSkins &m_skins;
+  MorphWeights m_weights;
+  TripleBuffer<Pose> m_poses;
+  std::atomic<double> m_poseTime{0.};
+
+  // Last request, on the render thread
+  size_t m_nLastAnimation = 0;
+  double m_lastTime = -1.;
+
+  // Pending request, only locked to hand it over
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  size_t m_nRequestedAnimation = 0;
+  double m_requestedTime = 0.;
+  bool m_hasRequest = false;
+  bool m_isStopping = false;
+
+  std::thread m_thread; // Started last, once the members above are set
+};
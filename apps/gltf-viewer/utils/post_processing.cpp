@@ -0,0 +1,246 @@
+#include "post_processing.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+
+GLuint getDispatchSize(size_t size, size_t groupSize)
+{
+  return GLuint((size + groupSize - 1) / groupSize);
+}
+
+size_t getHalfSize(size_t size) { return std::max(size / 2, size_t(1)); }
+
+size_t getBloomLevelCount(size_t width, size_t height)
+{
+  size_t levelCount = 1;
+  while (levelCount < PostProcessing::BLOOM_LEVEL_COUNT &&
+         (std::max(getHalfSize(width), getHalfSize(height)) >> levelCount) >
+             0) {
+    ++levelCount;
+  }
+  return levelCount;
+}
+
+} // namespace
+
+PostProcessing::PostProcessing(
+    size_t width, size_t height, GLenum depthFormat) :
+    m_nWidth(width),
+    m_nHeight(height),
+    m_colorBuffer(
+        GL_RGBA16F, GLsizei(width), GLsizei(height), SAMPLE_COUNT),
+    m_depthBuffer(depthFormat, GLsizei(width), GLsizei(height), SAMPLE_COUNT),
+    m_framebuffer(GLFramebuffer::create()),
+    m_colorFramebuffer(GLFramebuffer::create()),
+    m_outputFramebuffer(GLFramebuffer::create()),
+    m_nBloomLevels(getBloomLevelCount(width, height))
+{
+  m_framebuffer.attachRenderbuffer(GL_COLOR_ATTACHMENT0, m_colorBuffer.glId());
+  m_framebuffer.attachRenderbuffer(GL_DEPTH_ATTACHMENT, m_depthBuffer.glId());
+  m_framebuffer.setDrawBuffer(GL_COLOR_ATTACHMENT0);
+  m_framebuffer.setReadBuffer(GL_COLOR_ATTACHMENT0);
+  assert(m_framebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+
+  // Attached by process()
+  m_colorFramebuffer.setDrawBuffer(GL_COLOR_ATTACHMENT0);
+  m_outputFramebuffer.setReadBuffer(GL_COLOR_ATTACHMENT0);
+
+  ExposureData exposure = {};
+  m_exposure = GLBuffer(sizeof(exposure), &exposure, 0);
+}
+
+void PostProcessing::process(const Programs &programs,
+    const Settings &settings, float deltaTime, Profiler &profiler,
+    TexturePool &pool, GLuint drawFramebuffer)
+{
+  const auto width = GLint(m_nWidth);
+  const auto height = GLint(m_nHeight);
+  GLint texture0 = 0, texture1 = 0;
+  glActiveTexture(GL_TEXTURE1);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture1);
+  glActiveTexture(GL_TEXTURE0);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_exposure.glId());
+
+  auto &graph = m_frameGraph;
+  // Bloom samples the frame and its levels with bilinear filtering, one
+  // level at a time
+  TransientTextureDesc colorDesc;
+  colorDesc.internalFormat = GL_RGBA16F;
+  colorDesc.width = width;
+  colorDesc.height = height;
+  colorDesc.minFilter = GL_LINEAR;
+  colorDesc.magFilter = GL_LINEAR;
+  auto bloomDesc = colorDesc;
+  bloomDesc.width = GLsizei(getHalfSize(m_nWidth));
+  bloomDesc.height = GLsizei(getHalfSize(m_nHeight));
+  bloomDesc.levelCount = GLsizei(m_nBloomLevels);
+  bloomDesc.minFilter = GL_LINEAR_MIPMAP_NEAREST;
+  TransientTextureDesc outputDesc;
+  outputDesc.width = width;
+  outputDesc.height = height;
+  FrameGraph::Resource color = 0, bloom = 0, output = 0;
+
+  graph.addPass(
+      "Resolve",
+      [&](FrameGraph::Builder &builder) {
+        color = builder.create("Color", colorDesc);
+      },
+      [&]() {
+        Profiler::GPUScope scope{profiler, "Resolve"};
+        m_colorFramebuffer.attachTexture(
+            GL_COLOR_ATTACHMENT0, graph.texture(color));
+        m_framebuffer.blit(m_colorFramebuffer.glId(), 0, 0, width, height,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      });
+
+  if (settings.autoExposure) {
+    // Writes the exposure buffer, read by the next frames
+    graph.addPass(
+        "Exposure",
+        [&](FrameGraph::Builder &builder) {
+          builder.read(color);
+          builder.keep();
+        },
+        [&]() {
+          Profiler::GPUScope scope{profiler, "Exposure"};
+          // The first frame is exposed for itself, then the exposure adapts
+          // exponentially
+          const auto adaptation =
+              m_hasExposure
+                  ? 1.f - std::exp(-std::max(deltaTime, 0.f) *
+                                   settings.adaptationRate)
+                  : 1.f;
+          m_hasExposure = true;
+          programs.exposure.use();
+          programs.exposure.getUniform<float>("uAdaptation").set(adaptation);
+          glBindTexture(GL_TEXTURE_2D, graph.texture(color));
+          // 16 x 16 invocations of 2 x 2 pixels per group
+          glDispatchCompute(getDispatchSize(m_nWidth, 32),
+              getDispatchSize(m_nHeight, 32), 1);
+        });
+  }
+
+  graph.addPass(
+      "Bloom",
+      [&](FrameGraph::Builder &builder) {
+        builder.read(color);
+        bloom = builder.create("Bloom", bloomDesc);
+      },
+      [&]() {
+        Profiler::GPUScope scope{profiler, "Bloom"};
+        const auto colorTexture = graph.texture(color);
+        const auto bloomTexture = graph.texture(bloom);
+        programs.downsampleBloom.use();
+        const auto sourceLevel =
+            programs.downsampleBloom.getUniform<GLint>("uSourceLevel");
+        programs.downsampleBloom.getUniform<float>("uThreshold")
+            .set(settings.bloomThreshold);
+        programs.downsampleBloom.getUniform<GLint>("uAutoExposure")
+            .set(GLint(settings.autoExposure));
+        programs.downsampleBloom.getUniform<float>("uExposureCompensation")
+            .set(settings.exposureCompensation);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        for (size_t level = 0; level < m_nBloomLevels; ++level) {
+          // Level 0 is filtered from the frame, the others from the level
+          // above them
+          if (level == 0) {
+            glBindTexture(GL_TEXTURE_2D, colorTexture);
+            sourceLevel.set(-1);
+          } else {
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+            glBindTexture(GL_TEXTURE_2D, bloomTexture);
+            sourceLevel.set(GLint(level - 1));
+          }
+          glBindImageTexture(0, bloomTexture, GLint(level), GL_FALSE, 0,
+              GL_WRITE_ONLY, GL_RGBA16F);
+          glDispatchCompute(
+              getDispatchSize(
+                  std::max(getHalfSize(m_nWidth) >> level, size_t(1)), 8),
+              getDispatchSize(
+                  std::max(getHalfSize(m_nHeight) >> level, size_t(1)), 8),
+              1);
+        }
+        programs.upsampleBloom.use();
+        const auto upsampleLevel =
+            programs.upsampleBloom.getUniform<GLint>("uSourceLevel");
+        glBindTexture(GL_TEXTURE_2D, bloomTexture);
+        for (auto level = m_nBloomLevels - 1; level > 0; --level) {
+          glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT |
+                          GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+          upsampleLevel.set(GLint(level));
+          glBindImageTexture(0, bloomTexture, GLint(level - 1), GL_FALSE, 0,
+              GL_READ_WRITE, GL_RGBA16F);
+          glDispatchCompute(
+              getDispatchSize(
+                  std::max(getHalfSize(m_nWidth) >> (level - 1), size_t(1)),
+                  8),
+              getDispatchSize(
+                  std::max(getHalfSize(m_nHeight) >> (level - 1), size_t(1)),
+                  8),
+              1);
+        }
+      });
+
+  // Bloom is only drawn if it is added to the frame
+  const auto hasBloom = settings.bloomIntensity > 0.f;
+  graph.addPass(
+      "Tone mapping",
+      [&](FrameGraph::Builder &builder) {
+        builder.read(color);
+        if (hasBloom) {
+          builder.read(bloom);
+        }
+        output = builder.create("Output", outputDesc);
+      },
+      [&]() {
+        Profiler::GPUScope scope{profiler, "Tone mapping"};
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        const auto &program = programs.toneMapping;
+        program.use();
+        program.getUniform<GLint>("uAutoExposure")
+            .set(GLint(settings.autoExposure));
+        program.getUniform<float>("uExposureCompensation")
+            .set(settings.exposureCompensation);
+        program.getUniform<float>("uBloomIntensity")
+            .set(hasBloom ? settings.bloomIntensity : 0.f);
+        program.getUniform<float>("uSaturation").set(settings.saturation);
+        program.getUniform<float>("uContrast").set(settings.contrast);
+        glBindTexture(GL_TEXTURE_2D, graph.texture(color));
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, hasBloom ? graph.texture(bloom) : 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindImageTexture(0, graph.texture(output), 0, GL_FALSE, 0,
+            GL_WRITE_ONLY, GL_RGBA8);
+        glDispatchCompute(
+            getDispatchSize(m_nWidth, 8), getDispatchSize(m_nHeight, 8), 1);
+      });
+
+  graph.addPass(
+      "Present",
+      [&](FrameGraph::Builder &builder) {
+        builder.read(output);
+        builder.keep();
+      },
+      [&]() {
+        glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+        m_outputFramebuffer.attachTexture(
+            GL_COLOR_ATTACHMENT0, graph.texture(output));
+        m_outputFramebuffer.blit(drawFramebuffer, 0, 0, width, height,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      });
+
+  graph.execute(pool);
+
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, GLuint(texture1));
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, GLuint(texture0));
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+}
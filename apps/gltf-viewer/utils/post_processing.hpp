@@ -0,0 +1,99 @@
+#pragma once
+
+#include "frame_graph.hpp"
+#include "gl_objects.hpp"
+#include "profiler.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// HDR post-processing of the frames of the window, in compute passes that
+// each read the frame once:
+// - exposure.cs.glsl builds the luminance histogram of the frame and, in its
+// last work group, reduces it to the average luminance the exposure adapts
+// to, so that auto-exposure is a single dispatch,
+// - bloom.cs.glsl filters the pixels brighter than the threshold down the
+// BLOOM_LEVEL_COUNT levels of a half resolution mip chain, then adds each
+// level to the one above it on the way back up,
+// - tone_mapping.cs.glsl exposes the frame, adds the bloom, tone maps and
+// grades it, and encodes it to sRGB in the GL_RGBA8 image blitted to the
+// window.
+//
+// The scene is drawn in framebuffer(), whose attachments are 4x multisampled
+// GL_RGBA16F color and depth renderbuffers, resolved by process(). The
+// steps are the passes of a FrameGraph, whose textures (the resolved frame,
+// the bloom chain and the tone mapped frame) are transient: bloom is culled
+// when it is not added to the frame.
+class PostProcessing
+{
+public:
+  static const size_t HISTOGRAM_BIN_COUNT = 64; // BIN_COUNT of exposure.cs
+  static const size_t BLOOM_LEVEL_COUNT = 6;
+  static const GLsizei SAMPLE_COUNT = 4;
+
+  // Programs of each step
+  struct Programs
+  {
+    GLProgram exposure; // exposure.cs.glsl
+    GLProgram downsampleBloom; // bloom.cs.glsl with DOWNSAMPLE
+    GLProgram upsampleBloom; // bloom.cs.glsl
+    GLProgram toneMapping; // tone_mapping.cs.glsl
+  };
+
+  struct Settings
+  {
+    bool autoExposure = true;
+    float exposureCompensation = 0.f; // In stops
+    float adaptationRate = 2.f; // Of the auto-exposure, per second
+    float bloomThreshold = 1.f; // Exposed luminance
+    float bloomIntensity = 0.05f;
+    float saturation = 1.f;
+    float contrast = 1.f;
+  };
+
+  // For a width x height window, drawn with a depth buffer of depthFormat
+  PostProcessing(size_t width, size_t height, GLenum depthFormat);
+
+  GLuint framebuffer() const { return m_framebuffer.glId(); }
+
+  // Post-process the frame drawn in framebuffer() into drawFramebuffer, of
+  // the window size, deltaTime seconds after the previous one, with
+  // transient textures of pool. Each step is measured by a GPU scope of
+  // profiler, which must not be in one.
+  void process(const Programs &programs, const Settings &settings,
+      float deltaTime, Profiler &profiler, TexturePool &pool,
+      GLuint drawFramebuffer = 0);
+
+  // Passes of the last process()
+  const FrameGraph &frameGraph() const { return m_frameGraph; }
+
+private:
+  // Exposure buffer of exposure.cs.glsl and tone_mapping.cs.glsl, std430
+  // layout
+  struct ExposureData
+  {
+    float averageLogLuminance; // Adapted, log2
+    uint32_t finishedGroupCount; // Of the current dispatch
+    uint32_t padding[2];
+    uint32_t histogram[HISTOGRAM_BIN_COUNT]; // Of the current dispatch
+  };
+
+  size_t m_nWidth;
+  size_t m_nHeight;
+  bool m_hasExposure = false; // Set by the first auto-exposure
+
+  GLRenderbuffer m_colorBuffer;
+  GLRenderbuffer m_depthBuffer;
+  GLFramebuffer m_framebuffer;
+
+  // Of the transient textures of the frame resolved for sampling and tone
+  // mapped
+  GLFramebuffer m_colorFramebuffer;
+  GLFramebuffer m_outputFramebuffer;
+  size_t m_nBloomLevels; // At most BLOOM_LEVEL_COUNT, down to 1 x 1
+  GLBuffer m_exposure;
+  FrameGraph m_frameGraph;
+};
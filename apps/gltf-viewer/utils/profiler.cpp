@@ -0,0 +1,341 @@
+#include "profiler.hpp"
+#include "gl_extensions.hpp"
+#include "sync_watchdog.hpp"
+
+#include <imgui.h>
+
+#include <algorithm>
+
+namespace
+{
+
+// In the order of Pass::statistics
+const GLenum PIPELINE_STATISTIC_TARGETS[Profiler::PIPELINE_STATISTIC_COUNT] =
+    {GL_VERTICES_SUBMITTED_ARB, GL_CLIPPING_INPUT_PRIMITIVES_ARB,
+        GL_CLIPPING_OUTPUT_PRIMITIVES_ARB, GL_FRAGMENT_SHADER_INVOCATIONS_ARB};
+
+const char
+    *const PIPELINE_STATISTIC_LABELS[Profiler::PIPELINE_STATISTIC_COUNT] = {
+        "Vertices", "Clip in", "Clip out", "Fragments"};
+
+// Read the results of queries once all of them are available
+template <size_t N>
+bool readQueryResults(const std::array<GLuint, N> &queries, GLuint64 *results)
+{
+  for (const auto query : queries) {
+    GLint isAvailable = GL_FALSE;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+    if (!isAvailable) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < N; ++i) {
+    glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &results[i]);
+  }
+  return true;
+}
+
+} // namespace
+
+Profiler::CPUScope::CPUScope(Profiler &profiler, const char *name) :
+    m_profiler(profiler),
+    m_passIdx(profiler.getPass(name)),
+    m_start(std::chrono::steady_clock::now()),
+    m_startAllocations(getThreadAllocations().count),
+    m_previousSyncPass(setSyncPass(name))
+{
+}
+
+Profiler::CPUScope::~CPUScope()
+{
+  setSyncPass(m_previousSyncPass);
+  const auto duration = std::chrono::steady_clock::now() - m_start;
+  auto &pass = m_profiler.m_passes[m_passIdx];
+  pass.cpuHistory.push(
+      std::chrono::duration<float, std::milli>(duration).count());
+  pass.allocations = getThreadAllocations().count - m_startAllocations;
+}
+
+Profiler::GPUScope::GPUScope(Profiler &profiler, const char *name)
+{
+  auto &pass = profiler.m_passes[profiler.getPass(name)];
+  const auto slot = profiler.m_frameIdx % QUERY_LATENCY;
+  if (pass.isQueryPending[slot]) {
+    return; // Results are late, skip this frame rather than stalling
+  }
+  if (!pass.queries[slot]) {
+    glGenQueries(GLsizei(pass.queries.size()), pass.queries.data());
+  }
+  m_query = pass.queries[slot];
+  pass.isQueryPending[slot] = true;
+  glBeginQuery(GL_TIME_ELAPSED, m_query);
+}
+
+Profiler::GPUScope::~GPUScope()
+{
+  if (m_query) {
+    glEndQuery(GL_TIME_ELAPSED);
+  }
+}
+
+Profiler::StatisticsScope::StatisticsScope(
+    Profiler &profiler, const char *name)
+{
+  if (!profiler.m_hasPipelineStatistics) {
+    return;
+  }
+  auto &pass = profiler.m_passes[profiler.getPass(name)];
+  const auto slot = profiler.m_frameIdx % QUERY_LATENCY;
+  if (pass.areStatisticsPending[slot]) {
+    return;
+  }
+  if (!pass.statisticsQueries[0][0]) {
+    for (auto &queries : pass.statisticsQueries) {
+      glGenQueries(GLsizei(queries.size()), queries.data());
+    }
+  }
+  const auto &queries = pass.statisticsQueries[slot];
+  for (size_t i = 0; i < PIPELINE_STATISTIC_COUNT; ++i) {
+    glBeginQuery(PIPELINE_STATISTIC_TARGETS[i], queries[i]);
+  }
+  pass.areStatisticsPending[slot] = true;
+  m_isCounting = true;
+}
+
+Profiler::StatisticsScope::~StatisticsScope()
+{
+  if (m_isCounting) {
+    for (const auto target : PIPELINE_STATISTIC_TARGETS) {
+      glEndQuery(target);
+    }
+  }
+}
+
+void Profiler::History::push(float value)
+{
+  values[offset] = value;
+  offset = (offset + 1) % values.size();
+  last = value;
+}
+
+Profiler::~Profiler()
+{
+  for (auto &pass : m_passes) {
+    if (pass.queries[0]) {
+      glDeleteQueries(GLsizei(pass.queries.size()), pass.queries.data());
+    }
+    if (pass.statisticsQueries[0][0]) {
+      for (auto &queries : pass.statisticsQueries) {
+        glDeleteQueries(GLsizei(queries.size()), queries.data());
+      }
+    }
+  }
+}
+
+void Profiler::beginFrame()
+{
+  const auto allocations = getThreadAllocations();
+  if (m_hasFrameStart) {
+    m_frameAllocations = {allocations.count - m_frameStartAllocations.count,
+        allocations.bytes - m_frameStartAllocations.bytes};
+    m_allocationHistory.push(float(m_frameAllocations.count));
+  }
+  m_frameStartAllocations = allocations;
+  m_hasFrameStart = true;
+
+  for (auto &pass : m_passes) {
+    // Oldest queries first so that history is in order
+    for (size_t i = 1; i <= QUERY_LATENCY; ++i) {
+      const auto slot = (m_frameIdx + i) % QUERY_LATENCY;
+      if (!pass.isQueryPending[slot]) {
+        continue;
+      }
+      GLint isAvailable = GL_FALSE;
+      glGetQueryObjectiv(
+          pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+      if (!isAvailable) {
+        break;
+      }
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &nanoseconds);
+      pass.gpuHistory.push(float(nanoseconds) * 1e-6f);
+      pass.isQueryPending[slot] = false;
+    }
+    for (size_t i = 1; i <= QUERY_LATENCY; ++i) {
+      const auto slot = (m_frameIdx + i) % QUERY_LATENCY;
+      if (!pass.areStatisticsPending[slot]) {
+        continue;
+      }
+      if (!readQueryResults(
+              pass.statisticsQueries[slot], pass.statistics.data())) {
+        break;
+      }
+      pass.hasStatistics = true;
+      pass.areStatisticsPending[slot] = false;
+    }
+  }
+  ++m_frameIdx;
+}
+
+bool Profiler::enablePipelineStatistics(bool enabled)
+{
+  m_hasPipelineStatistics =
+      enabled && getGLExtensions().pipelineStatisticsQuery;
+  return m_hasPipelineStatistics == enabled;
+}
+
+void Profiler::drawGUI()
+{
+  const auto columnCount = isAllocationCountingCompiled() ? 4 : 3;
+  ImGui::Columns(columnCount, "Profiler timings");
+  ImGui::Text("Pass");
+  ImGui::NextColumn();
+  ImGui::Text("CPU ms");
+  ImGui::NextColumn();
+  ImGui::Text("GPU ms");
+  ImGui::NextColumn();
+  if (isAllocationCountingCompiled()) {
+    ImGui::Text("Allocs");
+    ImGui::NextColumn();
+  }
+  ImGui::Separator();
+  for (const auto &pass : m_passes) {
+    ImGui::Text("%s", pass.name.c_str());
+    ImGui::NextColumn();
+    if (pass.cpuHistory.last >= 0.f) {
+      ImGui::Text("%.3f", pass.cpuHistory.last);
+    }
+    ImGui::NextColumn();
+    if (pass.gpuHistory.last >= 0.f) {
+      ImGui::Text("%.3f", pass.gpuHistory.last);
+    }
+    ImGui::NextColumn();
+    if (isAllocationCountingCompiled()) {
+      if (pass.cpuHistory.last >= 0.f) {
+        ImGui::Text("%llu", (unsigned long long)pass.allocations);
+      }
+      ImGui::NextColumn();
+    }
+  }
+  ImGui::Columns(1);
+
+  if (isAllocationCountingCompiled()) {
+    ImGui::Text("Heap allocations: %llu per frame (%llu bytes)",
+        (unsigned long long)m_frameAllocations.count,
+        (unsigned long long)m_frameAllocations.bytes);
+    const auto &values = m_allocationHistory.values;
+    const auto maxValue = *std::max_element(begin(values), end(values));
+    ImGui::PlotLines("Allocations", values.data(), int(values.size()),
+        int(m_allocationHistory.offset), nullptr, 0.f,
+        std::max(maxValue, 1.f), ImVec2(0, 40));
+  } else {
+    ImGui::Text("Heap allocations: not counted");
+  }
+
+  const auto syncStats = getSyncStats();
+  ImGui::Text("GPU syncs: %llu, stalls over %.0f ms: %llu (%.1f ms), "
+              "implicit: %llu",
+      (unsigned long long)syncStats.syncCount, getSyncStallThreshold(),
+      (unsigned long long)syncStats.stallCount, syncStats.stallTime,
+      (unsigned long long)syncStats.implicitSyncCount);
+  if (syncStats.maxStallTag) {
+    ImGui::Text("Longest stall: %.1f ms in %s (%s)", syncStats.maxStallTime,
+        syncStats.maxStallTag,
+        syncStats.maxStallPass ? syncStats.maxStallPass : "no pass");
+  }
+
+  if (getGLExtensions().pipelineStatisticsQuery) {
+    auto hasPipelineStatistics = m_hasPipelineStatistics;
+    if (ImGui::Checkbox("Pipeline statistics", &hasPipelineStatistics)) {
+      enablePipelineStatistics(hasPipelineStatistics);
+    }
+  } else {
+    ImGui::Text("Pipeline statistics: not supported");
+  }
+  if (m_hasPipelineStatistics) {
+    ImGui::Columns(
+        int(PIPELINE_STATISTIC_COUNT) + 2, "Profiler pipeline statistics");
+    ImGui::Text("Pass");
+    ImGui::NextColumn();
+    for (const auto label : PIPELINE_STATISTIC_LABELS) {
+      ImGui::Text("%s", label);
+      ImGui::NextColumn();
+    }
+    ImGui::Text("Culled tris");
+    ImGui::NextColumn();
+    ImGui::Separator();
+    for (const auto &pass : m_passes) {
+      if (!pass.hasStatistics) {
+        continue;
+      }
+      ImGui::Text("%s", pass.name.c_str());
+      ImGui::NextColumn();
+      for (const auto count : pass.statistics) {
+        ImGui::Text("%llu", (unsigned long long)count);
+        ImGui::NextColumn();
+      }
+      if (pass.hasCulledTriangles) {
+        ImGui::Text("%zu", pass.culledTriangles);
+      } else {
+        ImGui::Text("-");
+      }
+      ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+  }
+
+  for (const auto &pass : m_passes) {
+    const struct
+    {
+      const char *label;
+      const History &history;
+    } graphs[] = {{"CPU", pass.cpuHistory}, {"GPU", pass.gpuHistory}};
+    for (const auto &graph : graphs) {
+      if (graph.history.last < 0.f) {
+        continue;
+      }
+      const auto &values = graph.history.values;
+      const auto maxValue = *std::max_element(begin(values), end(values));
+      const auto label = pass.name + " " + graph.label;
+      ImGui::PlotLines(label.c_str(), values.data(), int(values.size()),
+          int(graph.history.offset), nullptr, 0.f, std::max(maxValue, 1e-3f),
+          ImVec2(0, 40));
+    }
+  }
+}
+
+float Profiler::getCPUTime(const char *name) const
+{
+  const auto passIdx = findPass(name);
+  return passIdx < m_passes.size() ? m_passes[passIdx].cpuHistory.last : -1.f;
+}
+
+void Profiler::setCulledTriangles(const char *name, size_t count)
+{
+  auto &pass = m_passes[getPass(name)];
+  pass.culledTriangles = count;
+  pass.hasCulledTriangles = true;
+}
+
+float Profiler::getGPUTime(const char *name) const
+{
+  const auto passIdx = findPass(name);
+  return passIdx < m_passes.size() ? m_passes[passIdx].gpuHistory.last : -1.f;
+}
+
+size_t Profiler::findPass(const char *name) const
+{
+  const auto it = std::find_if(begin(m_passes), end(m_passes),
+      [&](const Pass &pass) { return pass.name == name; });
+  return size_t(it - begin(m_passes));
+}
+
+size_t Profiler::getPass(const char *name)
+{
+  const auto passIdx = findPass(name);
+  if (passIdx == m_passes.size()) {
+    m_passes.emplace_back();
+    m_passes.back().name = name;
+  }
+  return passIdx;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "allocation_counter.hpp"
+
+#include <glad/glad.h>
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Per pass CPU and GPU timings of the frame, with a rolling history.
+//
+// GPU times are measured with GL_TIME_ELAPSED queries. Each pass has
+// QUERY_LATENCY queries used in turn and results are only read when
+// available, a few frames later, so measuring never stalls the pipeline.
+// As for any GL_TIME_ELAPSED query, GPU scopes cannot be nested.
+//
+// Once enabled, statistics scopes count the vertices submitted, the
+// primitives entering and leaving clipping and the fragment shader
+// invocations of a pass (GL_ARB_pipeline_statistics_query), read the same
+// way. They can be nested in GPU scopes but not in each other: comparing
+// primitives to fragments tells geometry-bound passes from fill-bound ones.
+// Passes culling triangles on the GPU report the triangles they removed
+// next to their statistics (see setCulledTriangles).
+//
+// CPU scopes name the pass of the stalls of the sync watchdog (see
+// SyncScope), whose counters are drawn with the timings. They also count the
+// heap allocations of the pass, and the profiler those of the thread calling
+// beginFrame() per frame, when allocations are counted (see
+// allocation_counter.hpp).
+//
+// Usage:
+//   profiler.beginFrame();
+//   {
+//     Profiler::Scope scope{profiler, "Scene"}; // CPU and GPU
+//     drawScene();
+//   }
+//   {
+//     Profiler::CPUScope scope{profiler, "Upload"}; // CPU only
+//     upload();
+//   }
+//   {
+//     Profiler::StatisticsScope scope{profiler, "Shadows"};
+//     drawShadows();
+//   }
+class Profiler
+{
+public:
+  // Number of frames in history graphs
+  static const size_t HISTORY_SIZE = 120;
+  // Number of queries per pass in flight
+  static const size_t QUERY_LATENCY = 3;
+  // Vertices, clipping input and output primitives, fragment invocations
+  static const size_t PIPELINE_STATISTIC_COUNT = 4;
+
+  class CPUScope
+  {
+  public:
+    CPUScope(Profiler &profiler, const char *name);
+    ~CPUScope();
+
+    CPUScope(const CPUScope &) = delete;
+    CPUScope &operator=(const CPUScope &) = delete;
+
+  private:
+    Profiler &m_profiler;
+    size_t m_passIdx;
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_startAllocations; // Of the thread
+    const char *m_previousSyncPass; // Restored at the end of the scope
+  };
+
+  class GPUScope
+  {
+  public:
+    GPUScope(Profiler &profiler, const char *name);
+    ~GPUScope();
+
+    GPUScope(const GPUScope &) = delete;
+    GPUScope &operator=(const GPUScope &) = delete;
+
+  private:
+    GLuint m_query = 0; // 0 if no query is available this frame
+  };
+
+  // Does nothing unless pipeline statistics are enabled
+  class StatisticsScope
+  {
+  public:
+    StatisticsScope(Profiler &profiler, const char *name);
+    ~StatisticsScope();
+
+    StatisticsScope(const StatisticsScope &) = delete;
+    StatisticsScope &operator=(const StatisticsScope &) = delete;
+
+  private:
+    bool m_isCounting = false;
+  };
+
+  // Measure both CPU and GPU time of a pass
+  class Scope
+  {
+  public:
+    Scope(Profiler &profiler, const char *name) :
+        m_cpuScope(profiler, name), m_gpuScope(profiler, name)
+    {
+    }
+
+  private:
+    CPUScope m_cpuScope;
+    GPUScope m_gpuScope;
+  };
+
+  Profiler() = default;
+
+  ~Profiler();
+
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  // Start a new frame and collect GPU results of previous frames
+  void beginFrame();
+
+  // Draw the timings table and graphs in the current ImGui window, with a
+  // checkbox enabling pipeline statistics
+  void drawGUI();
+
+  // Return false if the context has no pipeline statistics queries, which
+  // then stay disabled
+  bool enablePipelineStatistics(bool enabled);
+
+  bool hasPipelineStatistics() const { return m_hasPipelineStatistics; }
+
+  // Set the triangles culled before the draws of the statistics scope name
+  // last counted
+  void setCulledTriangles(const char *name, size_t count);
+
+  // Last measured times in milliseconds, negative if never measured
+  float getCPUTime(const char *name) const;
+  float getGPUTime(const char *name) const;
+
+  // Heap allocations of the last complete frame of the thread calling
+  // beginFrame(), 0 if not counted
+  AllocationCounts getFrameAllocations() const { return m_frameAllocations; }
+
+private:
+  struct History
+  {
+    std::array<float, HISTORY_SIZE> values = {};
+    size_t offset = 0; // Index of the oldest value
+    float last = -1.f;
+
+    void push(float value);
+  };
+
+  struct Pass
+  {
+    std::string name;
+    std::array<GLuint, QUERY_LATENCY> queries = {};
+    std::array<bool, QUERY_LATENCY> isQueryPending = {};
+    History cpuHistory;
+    History gpuHistory;
+    uint64_t allocations = 0; // Of the last scope
+    std::array<std::array<GLuint, PIPELINE_STATISTIC_COUNT>, QUERY_LATENCY>
+        statisticsQueries = {};
+    std::array<bool, QUERY_LATENCY> areStatisticsPending = {};
+    // Last counts, in the order of PIPELINE_STATISTIC_COUNT
+    std::array<GLuint64, PIPELINE_STATISTIC_COUNT> statistics = {};
+    bool hasStatistics = false; // Once counted
+    size_t culledTriangles = 0;
+    bool hasCulledTriangles = false; // Once set
+  };
+
+  size_t findPass(const char *name) const; // m_passes.size() if not found
+  size_t getPass(const char *name); // Add the pass if not found
+
+  std::vector<Pass> m_passes;
+  size_t m_frameIdx = 0;
+  bool m_hasFrameStart = false; // Once beginFrame() is called
+  AllocationCounts m_frameStartAllocations;
+  AllocationCounts m_frameAllocations;
+  History m_allocationHistory;
+  bool m_hasPipelineStatistics = false;
+};
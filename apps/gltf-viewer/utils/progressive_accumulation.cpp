@@ -0,0 +1,80 @@
+#include "progressive_accumulation.hpp"
+
+#include "temporal_antialiasing.hpp"
+
+#include <cassert>
+
+ProgressiveAccumulation::ProgressiveAccumulation(
+    size_t width, size_t height, GLenum depthFormat, size_t frameCount) :
+    m_nWidth(width),
+    m_nHeight(height),
+    m_nFrameCount(frameCount),
+    m_color(1, GL_RGBA8, GLsizei(width), GLsizei(height)),
+    m_depthBuffer(depthFormat, GLsizei(width), GLsizei(height)),
+    m_framebuffer(GLFramebuffer::create()),
+    m_average(1, GL_RGBA32F, GLsizei(width), GLsizei(height)),
+    m_averageFramebuffer(GLFramebuffer::create()),
+    m_emptyVertexArray(GLVertexArray::create())
+{
+  // Only read with texelFetch, but the texture must be complete
+  m_color.setParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  m_color.setParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  m_framebuffer.attachTexture(GL_COLOR_ATTACHMENT0, m_color.glId());
+  m_framebuffer.attachRenderbuffer(GL_DEPTH_ATTACHMENT, m_depthBuffer.glId());
+  m_framebuffer.setDrawBuffer(GL_COLOR_ATTACHMENT0);
+  assert(m_framebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+
+  m_averageFramebuffer.attachTexture(GL_COLOR_ATTACHMENT0, m_average.glId());
+  m_averageFramebuffer.setDrawBuffer(GL_COLOR_ATTACHMENT0);
+  m_averageFramebuffer.setReadBuffer(GL_COLOR_ATTACHMENT0);
+  assert(m_averageFramebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+}
+
+glm::mat4 ProgressiveAccumulation::jitter(const glm::mat4 &projMatrix) const
+{
+  // The first frame is centered on the pixels, like the window without
+  // accumulation. The sequence does not repeat, whatever the frame count.
+  if (!m_nAccumulatedCount) {
+    return projMatrix;
+  }
+  return getJitteredProjection(projMatrix,
+      getHaltonJitter(m_nAccumulatedCount), m_nWidth, m_nHeight);
+}
+
+void ProgressiveAccumulation::accumulate(
+    const GLProgram &accumulateProgram, GLuint drawFramebuffer)
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_averageFramebuffer.glId());
+  glViewport(0, 0, GLsizei(m_nWidth), GLsizei(m_nHeight));
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_color.glId());
+  accumulateProgram.use();
+
+  // The average of n frames and frame n + 1 make the average of n + 1
+  // frames with the weight 1 / (n + 1) of the frame
+  const auto weight = 1.f / float(m_nAccumulatedCount + 1);
+  glBlendColor(0.f, 0.f, 0.f, weight);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+  GLboolean isDepthTested = GL_FALSE;
+  glGetBooleanv(GL_DEPTH_TEST, &isDepthTested);
+  glDisable(GL_DEPTH_TEST);
+  m_emptyVertexArray.bind();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+  if (isDepthTested) {
+    glEnable(GL_DEPTH_TEST);
+  }
+  glDisable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ZERO);
+
+  ++m_nAccumulatedCount;
+  present(drawFramebuffer);
+}
+
+void ProgressiveAccumulation::present(GLuint drawFramebuffer) const
+{
+  m_averageFramebuffer.blit(drawFramebuffer, 0, 0, GLint(m_nWidth),
+      GLint(m_nHeight), GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+}
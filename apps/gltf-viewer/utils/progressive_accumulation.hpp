@@ -0,0 +1,65 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Progressive accumulation of the frames of the window while nothing moves:
+// each frame is drawn in framebuffer() with a projection jittered by a
+// sub-pixel offset of the Halton (2, 3) sequence, then averaged with the
+// previous ones in a floating point buffer (accumulate.fs.glsl), so that the
+// image converges to frameCount() samples per pixel. Any change must reset()
+// the average, its next frame is drawn without jitter and replaces it, so
+// that interaction costs a single fullscreen pass more than drawing the
+// window directly.
+//
+// Once converged, the average only has to be presented, the scene needs not
+// be drawn again.
+class ProgressiveAccumulation
+{
+public:
+  // For a width x height window, drawn with a depth buffer of depthFormat
+  ProgressiveAccumulation(
+      size_t width, size_t height, GLenum depthFormat, size_t frameCount);
+
+  GLuint framebuffer() const { return m_framebuffer.glId(); }
+
+  size_t frameCount() const { return m_nFrameCount; }
+
+  size_t accumulatedCount() const { return m_nAccumulatedCount; }
+
+  bool isConverged() const { return m_nAccumulatedCount >= m_nFrameCount; }
+
+  // Restart from the next frame
+  void reset() { m_nAccumulatedCount = 0; }
+
+  // Projection of the next frame drawn in framebuffer()
+  glm::mat4 jitter(const glm::mat4 &projMatrix) const;
+
+  // Average the frame drawn in framebuffer() with the previous ones with
+  // accumulateProgram, then present()
+  void accumulate(
+      const GLProgram &accumulateProgram, GLuint drawFramebuffer = 0);
+
+  // Copy the average to drawFramebuffer, of the window size
+  void present(GLuint drawFramebuffer = 0) const;
+
+private:
+  size_t m_nWidth;
+  size_t m_nHeight;
+  size_t m_nFrameCount;
+  size_t m_nAccumulatedCount = 0;
+
+  GLTexture m_color;
+  GLRenderbuffer m_depthBuffer;
+  GLFramebuffer m_framebuffer;
+
+  // GL_RGBA32F so that the average of many frames keeps their precision
+  GLTexture m_average;
+  GLFramebuffer m_averageFramebuffer;
+  GLVertexArray m_emptyVertexArray;
+};
@@ -0,0 +1,152 @@
+#include "pvs.hpp"
+
+#include <utility>
+
+namespace
+{
+
+// Kinds of runs, in the 2 high bits of control bytes
+const uint8_t ZERO_RUN = 0;
+const uint8_t ONE_RUN = 1;
+const uint8_t LITERAL_RUN = 2;
+const size_t MAX_RUN_LENGTH = 64;
+
+} // namespace
+
+PotentiallyVisibleSets::PotentiallyVisibleSets(const Grid &grid,
+    size_t drawCount, std::vector<CellSet> cellSets,
+    std::vector<uint8_t> data) :
+    m_grid(grid),
+    m_drawCount(drawCount),
+    m_cellSets(std::move(cellSets)),
+    m_data(std::move(data))
+{
+}
+
+int64_t PotentiallyVisibleSets::findCell(const glm::vec3 &position) const
+{
+  if (m_cellSets.empty() || m_grid.cellSize <= 0.f) {
+    return -1;
+  }
+  const auto cell = glm::floor((position - m_grid.origin) / m_grid.cellSize);
+  if (glm::any(glm::lessThan(cell, glm::vec3(0))) ||
+      glm::any(glm::greaterThanEqual(cell, glm::vec3(m_grid.cellCounts)))) {
+    return -1;
+  }
+  const auto &counts = m_grid.cellCounts;
+  const auto x = int64_t(cell.x), y = int64_t(cell.y), z = int64_t(cell.z);
+  return x + int64_t(counts.x) * (y + int64_t(counts.y) * z);
+}
+
+const std::vector<uint32_t> *PotentiallyVisibleSets::findVisibleDraws(
+    const glm::vec3 &position) const
+{
+  const auto cell = findCell(position);
+  if (cell < 0 || size_t(cell) >= m_cellSets.size()) {
+    return nullptr;
+  }
+  if (cell != m_decodedCell) {
+    const auto &set = m_cellSets[size_t(cell)];
+    m_decodedCell = -1;
+    if (!set.size || size_t(set.offset) + set.size > m_data.size() ||
+        !decodeSet(m_data.data() + set.offset, set.size, m_drawCount,
+            m_decodedDraws)) {
+      return nullptr;
+    }
+    m_decodedCell = cell;
+  }
+  return &m_decodedDraws;
+}
+
+std::vector<uint8_t> PotentiallyVisibleSets::encodeSet(
+    const std::vector<uint8_t> &isVisible)
+{
+  std::vector<uint8_t> bits((isVisible.size() + 7) / 8, 0);
+  for (size_t i = 0; i < isVisible.size(); ++i) {
+    if (isVisible[i]) {
+      bits[i / 8] |= uint8_t(1u << (i % 8));
+    }
+  }
+
+  std::vector<uint8_t> encoded;
+  const auto addControl = [&](uint8_t kind, size_t length) {
+    encoded.push_back(uint8_t(kind << 6 | (length - 1)));
+  };
+  size_t literalBegin = 0, literalLength = 0;
+  const auto flushLiterals = [&]() {
+    if (literalLength) {
+      addControl(LITERAL_RUN, literalLength);
+      encoded.insert(end(encoded), begin(bits) + literalBegin,
+          begin(bits) + literalBegin + literalLength);
+      literalLength = 0;
+    }
+  };
+  for (size_t i = 0; i < bits.size();) {
+    // Runs of at least 2 bytes are worth a control byte
+    const auto value = bits[i];
+    size_t runLength = 1;
+    if (value == 0x00 || value == 0xFF) {
+      while (i + runLength < bits.size() && bits[i + runLength] == value &&
+             runLength < MAX_RUN_LENGTH) {
+        ++runLength;
+      }
+    }
+    if (runLength >= 2) {
+      flushLiterals();
+      addControl(value ? ONE_RUN : ZERO_RUN, runLength);
+    } else {
+      if (!literalLength) {
+        literalBegin = i;
+      }
+      if (++literalLength == MAX_RUN_LENGTH) {
+        flushLiterals();
+      }
+    }
+    i += runLength;
+  }
+  flushLiterals();
+  return encoded;
+}
+
+bool PotentiallyVisibleSets::decodeSet(const uint8_t *data, size_t size,
+    size_t drawCount, std::vector<uint32_t> &draws)
+{
+  draws.clear();
+  const auto byteCount = (drawCount + 7) / 8;
+  size_t byteIdx = 0;
+  const auto addByte = [&](uint8_t value) {
+    for (uint32_t bit = 0; value && bit < 8; ++bit) {
+      const auto drawIdx = 8 * byteIdx + bit;
+      if ((value >> bit & 1) && drawIdx < drawCount) {
+        draws.push_back(uint32_t(drawIdx));
+      }
+    }
+    ++byteIdx;
+  };
+  for (size_t i = 0; i < size;) {
+    const auto kind = data[i] >> 6;
+    const auto length = size_t(data[i] & 0x3F) + 1;
+    ++i;
+    if (byteIdx + length > byteCount) {
+      return false;
+    }
+    if (kind == LITERAL_RUN) {
+      if (i + length > size) {
+        return false;
+      }
+      for (size_t j = 0; j < length; ++j) {
+        addByte(data[i + j]);
+      }
+      i += length;
+    } else if (kind == ZERO_RUN) {
+      byteIdx += length;
+    } else if (kind == ONE_RUN) {
+      for (size_t j = 0; j < length; ++j) {
+        addByte(0xFF);
+      }
+    } else {
+      return false;
+    }
+  }
+  return byteIdx == byteCount;
+}
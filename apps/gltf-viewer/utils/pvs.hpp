@@ -0,0 +1,83 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Potentially visible sets of the draws of a static scene, baked offline per
+// cell of a uniform grid over the scene (see bakePotentiallyVisibleSets in
+// gltf-optimize) and stored in the scene cache.
+//
+// The set of a cell is a bitset over the draws (in drawBoundsMin/Max order),
+// run-length encoded (see encodeSet): sets of walkthroughs are mostly made
+// of long runs of hidden draws. Cells with the same set share its bytes.
+// Cells without a set (e.g. inside walls, where the bake has no viewpoint)
+// leave every draw potentially visible.
+//
+// At runtime the cell of the camera is found in constant time and its set
+// selects the draws left to frustum culling. The draws of the last cell are
+// kept decoded, so that frames in the same cell only cost the lookup.
+class PotentiallyVisibleSets
+{
+public:
+  struct Grid
+  {
+    glm::vec3 origin = glm::vec3(0); // Min corner of the first cell
+    float cellSize = 0.f;
+    glm::uvec3 cellCounts = glm::uvec3(0);
+  };
+
+  // Encoded set of a cell, in data()
+  struct CellSet
+  {
+    uint32_t offset = 0;
+    uint32_t size = 0; // 0 for cells without a set
+  };
+
+  PotentiallyVisibleSets() = default;
+
+  // cellSets has one element per cell, x first then y then z
+  PotentiallyVisibleSets(const Grid &grid, size_t drawCount,
+      std::vector<CellSet> cellSets, std::vector<uint8_t> data);
+
+  bool empty() const { return m_cellSets.empty(); }
+
+  const Grid &grid() const { return m_grid; }
+
+  size_t drawCount() const { return m_drawCount; }
+
+  const std::vector<CellSet> &cellSets() const { return m_cellSets; }
+
+  const std::vector<uint8_t> &data() const { return m_data; }
+
+  // Index of the cell containing position, -1 if it is outside the grid
+  int64_t findCell(const glm::vec3 &position) const;
+
+  // Sorted draws of the set of the cell containing position, null if
+  // position is outside the grid or its cell has no set. The result is
+  // valid until the next call. Not thread safe.
+  const std::vector<uint32_t> *findVisibleDraws(
+      const glm::vec3 &position) const;
+
+  // Run-length encoding of the bitset of isVisible (one byte per draw, non
+  // zero for visible draws): a control byte, whose 2 high bits are the kind
+  // of run and 6 low bits its length in bytes minus 1, is followed by the
+  // bytes of literal runs. Runs of 0x00 and 0xFF bytes have no payload.
+  static std::vector<uint8_t> encodeSet(const std::vector<uint8_t> &isVisible);
+
+  // Decode the set encoded in [data, data + size) by encodeSet into the
+  // sorted list of its draws. Return false if it is invalid.
+  static bool decodeSet(const uint8_t *data, size_t size, size_t drawCount,
+      std::vector<uint32_t> &draws);
+
+private:
+  Grid m_grid;
+  size_t m_drawCount = 0;
+  std::vector<CellSet> m_cellSets;
+  std::vector<uint8_t> m_data;
+  // Draws of the set of m_decodedCell, -1 if none is decoded
+  mutable int64_t m_decodedCell = -1;
+  mutable std::vector<uint32_t> m_decodedDraws;
+};
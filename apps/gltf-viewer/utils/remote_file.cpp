@@ -0,0 +1,626 @@
+#include "remote_file.hpp"
+#include "aws_signature.hpp"
+#include "gltf.hpp"
+#include "hash.hpp"
+#include "shared_cache.hpp"
+#include "tcp_socket.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+// Granularity of the local copy and of its record of fetched bytes
+const uint64_t CHUNK_SIZE = uint64_t(1) << 20;
+// Adjacent missing chunks are fetched by a single request up to this count
+const uint64_t MAX_REQUEST_CHUNKS = 8;
+// A server silent for this long fails the fetch rather than hanging the
+// viewer: connecting, sending a request, or receiving any of its response
+const int REQUEST_TIMEOUT_MS = 30000;
+
+const uint32_t GLB_MAGIC = 0x46546C67; // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+const uint64_t GLB_HEADER_SIZE = 20; // File header and JSON chunk header
+const uint64_t GLB_CHUNK_HEADER_SIZE = 8;
+
+const uint32_t RECORD_MAGIC = 0x4B484347; // "GCHK"
+const uint32_t RECORD_VERSION = 1;
+
+bool startsWith(const std::string &str, const char *prefix)
+{
+  return str.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+uint32_t readUint32(const char *bytes)
+{
+  uint32_t value;
+  std::memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+struct HttpUrl
+{
+  bool isTls = false; // https://
+  std::string authority; // "host[:port]", the Host header
+  std::string host;
+  std::string port;
+  std::string path;
+  // Requests of s3:// URIs with credentials are signed
+  bool isSigned = false;
+  AwsCredentials credentials;
+  std::string region;
+};
+
+// Resolve s3://bucket/key to the http:// or https:// URL of the object, on
+// the endpoint of GLMLV_S3_ENDPOINT if set (path-style), on AWS otherwise
+bool resolveS3Uri(const std::string &uri, HttpUrl &url, std::string &httpUri,
+    std::string &err)
+{
+  const size_t bucketBegin = 5;
+  const auto keyBegin = uri.find('/', bucketBegin) + 1;
+  if (keyBegin == 0 || keyBegin == bucketBegin + 1 || keyBegin == uri.size()) {
+    err = "expected s3://bucket/key, got " + uri;
+    return false;
+  }
+  const auto bucket = uri.substr(bucketBegin, keyBegin - 1 - bucketBegin);
+  const auto key = encodeAwsUri(uri.substr(keyBegin), true);
+  url.region = getAwsEnvironmentRegion();
+  const auto endpoint = std::getenv("GLMLV_S3_ENDPOINT");
+  if (endpoint && *endpoint) {
+    httpUri = endpoint;
+    if (httpUri.back() == '/') {
+      httpUri.pop_back();
+    }
+    httpUri += "/" + encodeAwsUri(bucket, false) + "/" + key;
+  } else if (bucket.find('.') != std::string::npos) {
+    // The wildcard certificate of the virtual hosts has a single level
+    httpUri = "https://s3." + url.region + ".amazonaws.com/" + bucket + "/" +
+              key;
+  } else {
+    httpUri =
+        "https://" + bucket + ".s3." + url.region + ".amazonaws.com/" + key;
+  }
+  url.isSigned = getAwsEnvironmentCredentials(url.credentials);
+  if (url.isSigned && !isAwsSigningSupported()) {
+    err = "signing s3 requests needs a viewer built with OpenSSL "
+          "(GLMLV_USE_OPENSSL), unset AWS_ACCESS_KEY_ID to read public "
+          "objects";
+    return false;
+  }
+  return true;
+}
+
+// Resolve uri, http://, https:// or s3://, to the URL requested
+bool parseHttpUrl(const std::string &uri, HttpUrl &url, std::string &err)
+{
+  std::string httpUri;
+  if (startsWith(uri, "s3://")) {
+    if (!resolveS3Uri(uri, url, httpUri, err)) {
+      return false;
+    }
+  } else {
+    httpUri = uri.substr(0, uri.find('#'));
+  }
+  url.isTls = startsWith(httpUri, "https://");
+  if (url.isTls && !TlsSession::isSupported()) {
+    err = "https needs a viewer built with OpenSSL (GLMLV_USE_OPENSSL), "
+          "fetch " +
+          httpUri + " through a proxy terminating TLS on an http:// URL";
+    return false;
+  }
+  if (!url.isTls && !startsWith(httpUri, "http://")) {
+    err = "unsupported URI " + httpUri;
+    return false;
+  }
+  const size_t authorityBegin = url.isTls ? 8 : 7;
+  const auto pathBegin = httpUri.find('/', authorityBegin);
+  url.authority = httpUri.substr(authorityBegin,
+      pathBegin == std::string::npos ? std::string::npos
+                                     : pathBegin - authorityBegin);
+  url.path =
+      pathBegin == std::string::npos ? "/" : httpUri.substr(pathBegin);
+  // The port follows the last colon, unless it is in an IPv6 address
+  const auto colon = url.authority.rfind(':');
+  const auto bracket = url.authority.rfind(']');
+  if (colon != std::string::npos &&
+      (bracket == std::string::npos || bracket < colon)) {
+    url.host = url.authority.substr(0, colon);
+    url.port = url.authority.substr(colon + 1);
+  } else {
+    url.host = url.authority;
+    url.port = url.isTls ? "443" : "80";
+  }
+  if (url.host.size() >= 2 && url.host.front() == '[' &&
+      url.host.back() == ']') {
+    url.host = url.host.substr(1, url.host.size() - 2);
+  }
+  if (url.host.empty() || url.port.empty()) {
+    err = "no host in " + httpUri;
+    return false;
+  }
+  return true;
+}
+
+// Response to a range request
+struct RangeResponse
+{
+  int status = 0; // 0 if the connection failed before the status line
+  uint64_t fileSize = 0; // From Content-Range
+  std::string validator; // ETag, or Last-Modified without one
+  std::vector<char> body;
+  bool keepAlive = true;
+};
+
+// Request bytes [first, last] of url on stream and read the response
+bool getRange(SocketStream &stream, const HttpUrl &url, uint64_t first,
+    uint64_t last, RangeResponse &response, std::string &err)
+{
+  std::map<std::string, std::string> headers{{"host", url.authority},
+      {"range",
+          "bytes=" + std::to_string(first) + "-" + std::to_string(last)}};
+  if (url.isSigned &&
+      !signAwsGetRequest(url.credentials, url.region, "s3", url.path,
+          std::time(nullptr), headers, err)) {
+    return false;
+  }
+  stream << "GET " << url.path << " HTTP/1.1\r\n";
+  for (const auto &header : headers) {
+    stream << header.first << ": " << header.second << "\r\n";
+  }
+  stream << "\r\n" << std::flush;
+  const auto readLine = [&](std::string &line) {
+    if (!std::getline(stream, line)) {
+      return false;
+    }
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    return true;
+  };
+
+  std::string line;
+  if (!readLine(line) || !startsWith(line, "HTTP/") || line.size() < 12) {
+    err = "connection closed without a response";
+    return false;
+  }
+  response.status = std::atoi(line.c_str() + 9);
+  response.keepAlive = !startsWith(line, "HTTP/1.0");
+  auto contentLength = uint64_t(-1);
+  uint64_t rangeFirst = 0;
+  uint64_t rangeLast = 0;
+  auto isChunked = false;
+  std::string lastModified;
+  while (readLine(line) && !line.empty()) {
+    const auto colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    auto name = line.substr(0, colon);
+    std::transform(begin(name), end(name), begin(name),
+        [](unsigned char c) { return char(std::tolower(c)); });
+    const auto valueBegin = line.find_first_not_of(' ', colon + 1);
+    const auto value = valueBegin == std::string::npos
+                           ? std::string()
+                           : line.substr(valueBegin);
+    if (name == "content-length") {
+      contentLength = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (name == "content-range") {
+      unsigned long long rangeValues[3] = {};
+      if (std::sscanf(value.c_str(), "bytes %llu-%llu/%llu", &rangeValues[0],
+              &rangeValues[1], &rangeValues[2]) == 3) {
+        rangeFirst = rangeValues[0];
+        rangeLast = rangeValues[1];
+        response.fileSize = rangeValues[2];
+      }
+    } else if (name == "etag") {
+      response.validator = value;
+    } else if (name == "last-modified") {
+      lastModified = value;
+    } else if (name == "transfer-encoding") {
+      isChunked = value != "identity";
+    } else if (name == "connection") {
+      response.keepAlive = value != "close";
+    }
+  }
+  if (response.validator.empty()) {
+    response.validator = lastModified;
+  }
+
+  if (response.status != 206) {
+    response.keepAlive = false;
+    err = response.status == 200
+              ? "the server does not answer range requests"
+              : "HTTP status " + std::to_string(response.status);
+    return false;
+  }
+  if (isChunked || contentLength == uint64_t(-1)) {
+    response.keepAlive = false;
+    err = "the response has no Content-Length";
+    return false;
+  }
+  if (rangeFirst != first || rangeLast < rangeFirst ||
+      rangeLast - rangeFirst + 1 != contentLength ||
+      rangeLast >= response.fileSize) {
+    response.keepAlive = false;
+    err = "unexpected Content-Range";
+    return false;
+  }
+  response.body.resize(size_t(contentLength));
+  stream.read(response.body.data(), std::streamsize(contentLength));
+  if (uint64_t(stream.gcount()) != contentLength) {
+    response.keepAlive = false;
+    err = "connection closed in the middle of a response";
+    return false;
+  }
+  return true;
+}
+
+// Connection of a fetching thread to the server of url, opened again when
+// the server closes it
+class RangeClient
+{
+public:
+  explicit RangeClient(const HttpUrl &url) : m_url(url) {}
+
+  bool get(uint64_t first, uint64_t last, RangeResponse &response,
+      std::string &err)
+  {
+    // The server may have closed a kept-alive connection since its last
+    // response: the request is sent again once on a new one
+    for (auto attempt = 0; attempt < 2; ++attempt) {
+      const auto isReused = m_stream != nullptr;
+      if (!m_stream) {
+        const auto socket = connectTcp(
+            m_url.host + ":" + m_url.port, err, REQUEST_TIMEOUT_MS);
+        if (socket < 0) {
+          return false;
+        }
+        std::unique_ptr<TlsSession> pTls;
+        if (m_url.isTls) {
+          pTls = TlsSession::connect(socket, m_url.host, err);
+          if (!pTls) {
+            closeSocket(socket);
+            return false;
+          }
+        }
+        m_stream = std::make_unique<SocketStream>(socket, std::move(pTls));
+      }
+      response = RangeResponse();
+      const auto isRead =
+          getRange(*m_stream, m_url, first, last, response, err);
+      const auto hasTimedOut = !isRead && m_stream->hasTimedOut();
+      if (hasTimedOut) {
+        err = "no response from " + m_url.authority + " in " +
+              std::to_string(REQUEST_TIMEOUT_MS / 1000) + " s";
+      }
+      if (!isRead || !response.keepAlive) {
+        m_stream.reset();
+      }
+      if (isRead || !isReused || response.status || hasTimedOut) {
+        return isRead;
+      }
+    }
+    return false;
+  }
+
+private:
+  HttpUrl m_url;
+  std::unique_ptr<SocketStream> m_stream;
+};
+
+// Chunks of a local copy that hold the bytes of the remote file, written
+// next to the copy in "<copy>.chunks"
+struct ChunkRecord
+{
+  uint64_t fileSize = 0;
+  std::string validator;
+  std::vector<char> chunks;
+};
+
+fs::path getRecordPath(const fs::path &localPath)
+{
+  auto recordPath = localPath;
+  recordPath += ".chunks";
+  return recordPath;
+}
+
+bool readChunkRecord(const fs::path &path, ChunkRecord &record)
+{
+  std::ifstream file(path, std::ios::binary);
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint32_t validatorSize = 0;
+  uint64_t chunkCount = 0;
+  file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  file.read(reinterpret_cast<char *>(&version), sizeof(version));
+  file.read(reinterpret_cast<char *>(&record.fileSize), sizeof(uint64_t));
+  file.read(reinterpret_cast<char *>(&validatorSize), sizeof(validatorSize));
+  if (!file || magic != RECORD_MAGIC || version != RECORD_VERSION ||
+      validatorSize > 4096) {
+    return false;
+  }
+  record.validator.resize(validatorSize);
+  file.read(record.validator.data(), validatorSize);
+  file.read(reinterpret_cast<char *>(&chunkCount), sizeof(chunkCount));
+  if (!file ||
+      chunkCount != (record.fileSize + CHUNK_SIZE - 1) / CHUNK_SIZE) {
+    return false;
+  }
+  record.chunks.resize(size_t(chunkCount));
+  file.read(record.chunks.data(), std::streamsize(chunkCount));
+  return bool(file);
+}
+
+bool writeChunkRecord(
+    const fs::path &path, const ChunkRecord &record, std::string &err)
+{
+  const auto tmpPath = getTemporaryCachePath(path);
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    const auto validatorSize = uint32_t(record.validator.size());
+    const auto chunkCount = uint64_t(record.chunks.size());
+    file.write(reinterpret_cast<const char *>(&RECORD_MAGIC),
+        sizeof(RECORD_MAGIC));
+    file.write(reinterpret_cast<const char *>(&RECORD_VERSION),
+        sizeof(RECORD_VERSION));
+    file.write(reinterpret_cast<const char *>(&record.fileSize),
+        sizeof(record.fileSize));
+    file.write(
+        reinterpret_cast<const char *>(&validatorSize), sizeof(validatorSize));
+    file.write(record.validator.data(), validatorSize);
+    file.write(reinterpret_cast<const char *>(&chunkCount), sizeof(chunkCount));
+    file.write(record.chunks.data(), std::streamsize(chunkCount));
+    if (!file) {
+      err = "unable to write " + tmpPath.string();
+      return false;
+    }
+  }
+  std::error_code errorCode;
+  fs::rename(tmpPath, path, errorCode);
+  if (errorCode) {
+    fs::remove(tmpPath, errorCode);
+    err = "unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
+
+// Fetch the chunks of record overlapping byteRanges that the local copy at
+// localPath lacks, in requests of up to MAX_REQUEST_CHUNKS adjacent chunks
+// shared by connectionCount threads
+bool fetchChunks(const HttpUrl &url, const fs::path &localPath,
+    const std::vector<std::pair<uint64_t, uint64_t>> &byteRanges,
+    size_t connectionCount, ChunkRecord &record, RemoteFetchStats &stats,
+    std::string &err)
+{
+  const auto chunkCount = uint64_t(record.chunks.size());
+  std::vector<char> isNeeded(record.chunks.size(), 0);
+  for (const auto &range : byteRanges) {
+    const auto last = std::min((range.second + CHUNK_SIZE - 1) / CHUNK_SIZE,
+        chunkCount);
+    for (auto chunk = range.first / CHUNK_SIZE; chunk < last; ++chunk) {
+      isNeeded[chunk] = 1;
+    }
+  }
+  // Chunks [first, second) of each request
+  std::vector<std::pair<uint64_t, uint64_t>> requests;
+  for (uint64_t chunk = 0; chunk < chunkCount; ++chunk) {
+    if (!isNeeded[chunk]) {
+      continue;
+    }
+    stats.neededBytes +=
+        std::min(CHUNK_SIZE, record.fileSize - chunk * CHUNK_SIZE);
+    if (record.chunks[chunk]) {
+      continue;
+    }
+    if (!requests.empty() && requests.back().second == chunk &&
+        chunk - requests.back().first < MAX_REQUEST_CHUNKS) {
+      requests.back().second = chunk + 1;
+    } else {
+      requests.emplace_back(chunk, chunk + 1);
+    }
+  }
+  if (requests.empty()) {
+    return true;
+  }
+
+  std::atomic<size_t> nextRequest{0};
+  std::atomic<bool> hasFailed{false};
+  std::mutex mutex; // Of err, stats and record.chunks
+  const auto fetch = [&]() {
+    RangeClient client{url};
+    std::fstream file(
+        localPath, std::ios::in | std::ios::out | std::ios::binary);
+    RangeResponse response;
+    for (auto requestIdx = nextRequest++;
+         requestIdx < requests.size() && !hasFailed;
+         requestIdx = nextRequest++) {
+      const auto &request = requests[requestIdx];
+      const auto first = request.first * CHUNK_SIZE;
+      const auto last =
+          std::min(request.second * CHUNK_SIZE, record.fileSize) - 1;
+      std::string requestErr;
+      auto isFetched = client.get(first, last, response, requestErr);
+      if (isFetched && (response.fileSize != record.fileSize ||
+                           response.validator != record.validator)) {
+        isFetched = false;
+        requestErr = "the file changed while it was fetched";
+      }
+      if (isFetched) {
+        file.seekp(std::streamoff(first));
+        file.write(
+            response.body.data(), std::streamsize(response.body.size()));
+        file.flush();
+        isFetched = bool(file);
+        if (!isFetched) {
+          requestErr = "unable to write " + localPath.string();
+        }
+      }
+      std::lock_guard<std::mutex> lock{mutex};
+      if (!isFetched) {
+        if (!hasFailed.exchange(true)) {
+          err = requestErr;
+        }
+        return;
+      }
+      std::fill(begin(record.chunks) + request.first,
+          begin(record.chunks) + request.second, 1);
+      ++stats.requestCount;
+      stats.fetchedBytes += response.body.size();
+    }
+  };
+  const auto threadCount =
+      std::clamp(connectionCount, size_t(1), requests.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; ++i) {
+    threads.emplace_back(fetch);
+  }
+  fetch();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return !hasFailed;
+}
+
+} // namespace
+
+bool isRemoteUri(const std::string &path)
+{
+  return startsWith(path, "http://") || startsWith(path, "https://") ||
+         startsWith(path, "s3://");
+}
+
+fs::path getRemoteCachePath(
+    const std::string &uri, const fs::path &cacheDirectory)
+{
+  return getCacheEntryPath(
+      cacheDirectory, fnv1a64(uri.data(), uri.size()), ".glb");
+}
+
+bool fetchRemoteGlb(const std::string &uri, const fs::path &localPath,
+    size_t connectionCount, RemoteFetchStats &stats, std::string &err)
+{
+  HttpUrl url;
+  if (!parseHttpUrl(uri, url, err)) {
+    return false;
+  }
+  // Viewers of the same file fetch it one at a time
+  const CacheEntryLock lock{localPath};
+  const auto recordPath = getRecordPath(localPath);
+  ChunkRecord record;
+  std::error_code errorCode;
+  const auto hasRecord =
+      readChunkRecord(recordPath, record) &&
+      fs::file_size(localPath, errorCode) == record.fileSize && !errorCode;
+
+  // The GLB header is enough to check a record, the first chunk holds the
+  // JSON chunk of most files otherwise
+  RangeClient client{url};
+  RangeResponse header;
+  const auto headerSize = hasRecord ? GLB_HEADER_SIZE : CHUNK_SIZE;
+  if (!client.get(0, headerSize - 1, header, err)) {
+    return false;
+  }
+  ++stats.requestCount;
+  stats.fetchedBytes += header.body.size();
+  stats.fileSize = header.fileSize;
+  if (!hasRecord || record.fileSize != header.fileSize ||
+      record.validator != header.validator) {
+    record.fileSize = header.fileSize;
+    record.validator = header.validator;
+    record.chunks.assign(
+        size_t((header.fileSize + CHUNK_SIZE - 1) / CHUNK_SIZE), 0);
+    // A sparse file of the size of the remote one, renamed over the previous
+    // copy rather than truncating it: viewers mapping the previous copy keep
+    // reading it (see loadMappedGlbFile)
+    const auto tmpPath = getTemporaryCachePath(localPath);
+    std::ofstream(tmpPath, std::ios::binary | std::ios::trunc);
+    fs::resize_file(tmpPath, header.fileSize, errorCode);
+    if (!errorCode) {
+      fs::rename(tmpPath, localPath, errorCode);
+    }
+    if (errorCode) {
+      fs::remove(tmpPath, errorCode);
+      err = "unable to create " + localPath.string();
+      return false;
+    }
+  }
+  const auto &bytes = header.body;
+  if (bytes.size() < GLB_HEADER_SIZE || readUint32(bytes.data()) != GLB_MAGIC ||
+      readUint32(bytes.data() + 16) != GLB_CHUNK_JSON) {
+    err = "not a binary glTF file";
+    return false;
+  }
+  const uint64_t jsonLength = readUint32(bytes.data() + 12);
+  const auto binChunkOffset =
+      GLB_HEADER_SIZE + ((jsonLength + 3) & ~uint64_t(3));
+  if (binChunkOffset > record.fileSize) {
+    err = "truncated binary glTF file";
+    return false;
+  }
+  {
+    std::fstream file(
+        localPath, std::ios::in | std::ios::out | std::ios::binary);
+    file.write(bytes.data(), std::streamsize(bytes.size()));
+    if (!file) {
+      err = "unable to write " + localPath.string();
+      return false;
+    }
+    if (bytes.size() == std::min(CHUNK_SIZE, record.fileSize)) {
+      record.chunks[0] = 1;
+    }
+  }
+
+  // The JSON chunk is needed again with the BIN ranges, where it is counted
+  RemoteFetchStats jsonStats;
+  auto isFetched = fetchChunks(url, localPath, {{0, binChunkOffset}},
+      connectionCount, record, jsonStats, err);
+  stats.fetchedBytes += jsonStats.fetchedBytes;
+  stats.requestCount += jsonStats.requestCount;
+  std::vector<std::pair<uint64_t, uint64_t>> ranges{{0, binChunkOffset}};
+  if (isFetched) {
+    std::string json(size_t(jsonLength), '\0');
+    std::ifstream file(localPath, std::ios::binary);
+    file.seekg(std::streamoff(GLB_HEADER_SIZE));
+    file.read(json.data(), std::streamsize(json.size()));
+    std::vector<std::pair<size_t, size_t>> binRanges;
+    if (!file) {
+      err = "unable to read " + localPath.string();
+      isFetched = false;
+    } else {
+      isFetched =
+          findGlbDefaultSceneRanges(json.data(), json.size(), binRanges, err);
+    }
+    const auto binOffset = binChunkOffset + GLB_CHUNK_HEADER_SIZE;
+    for (const auto &range : binRanges) {
+      ranges.emplace_back(
+          std::min(binOffset + range.first, record.fileSize),
+          std::min(binOffset + range.second, record.fileSize));
+    }
+  }
+  if (isFetched) {
+    isFetched = fetchChunks(
+        url, localPath, ranges, connectionCount, record, stats, err);
+  }
+
+  // Whatever was fetched is kept for the next views
+  std::string recordErr;
+  if (!writeChunkRecord(recordPath, record, recordErr)) {
+    std::cerr << "Warning: " << recordErr << std::endl;
+  }
+  return isFetched;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Remote .glb files, viewed without downloading them first: the JSON chunk
+// is fetched with HTTP range requests, then the ranges of the BIN chunk read
+// by the default scene (see findGlbDefaultSceneRanges) in parallel range
+// requests. They are written in a sparse local copy of the file, at their
+// offsets, which the loaders read like any other .glb: ranges of the other
+// scenes stay holes. The copy is kept in a cache directory with the chunks it
+// holds, so that the next views only fetch what they lack.
+//
+// Accepted URIs:
+// - http[s]://host[:port]/path, the server must answer range requests with
+// 206 and a Content-Length,
+// - s3://bucket/key, fetched from the path-style endpoint of the
+// GLMLV_S3_ENDPOINT environment variable (e.g. "http://localhost:9000"), or
+// from AWS in the region of AWS_REGION. Requests are signed with the
+// credentials of AWS_ACCESS_KEY_ID, AWS_SECRET_ACCESS_KEY and
+// AWS_SESSION_TOKEN if set (see aws_signature.hpp), anonymous otherwise.
+// TLS and signatures need a viewer built with OpenSSL (GLMLV_USE_OPENSSL):
+// without it, only anonymous http:// requests are supported.
+
+// True if path is a URI fetched by fetchRemoteGlb rather than a file path
+bool isRemoteUri(const std::string &path);
+
+// Local copy of uri in cacheDirectory
+fs::path getRemoteCachePath(
+    const std::string &uri, const fs::path &cacheDirectory);
+
+struct RemoteFetchStats
+{
+  uint64_t fileSize = 0;
+  uint64_t neededBytes = 0; // Chunks read by the default scene
+  uint64_t fetchedBytes = 0; // By this call, the others were cached
+  size_t requestCount = 0;
+};
+
+// Fetch what the default scene of the .glb at uri reads into its local copy
+// localPath (see getRemoteCachePath), with up to connectionCount parallel
+// connections. The copy starts over if the size or the ETag of the remote
+// file changed. Return false and fill err on failure, the chunks fetched
+// until then are kept.
+bool fetchRemoteGlb(const std::string &uri, const fs::path &localPath,
+    size_t connectionCount, RemoteFetchStats &stats, std::string &err);
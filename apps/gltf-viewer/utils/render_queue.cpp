@@ -0,0 +1,172 @@
+#include "render_queue.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+// Radix sort digits
+const size_t DIGIT_BITS = 8;
+const size_t DIGIT_COUNT = 64 / DIGIT_BITS;
+const size_t BIN_COUNT = size_t(1) << DIGIT_BITS;
+
+// Below, sort(JobSystem &) sorts on the calling thread
+const size_t MIN_PARALLEL_CHUNK_SIZE = 16384;
+
+uint64_t getMask(unsigned bits) { return (uint64_t(1) << bits) - 1; }
+
+size_t getBin(uint64_t key, size_t digit)
+{
+  return (key >> (digit * DIGIT_BITS)) & (BIN_COUNT - 1);
+}
+
+} // namespace
+
+uint64_t RenderQueue::makeKey(Pass pass, uint32_t program, uint32_t material,
+    uint32_t geometry, float viewDepth)
+{
+  // The bits of a positive float sort like its value, the top DEPTH_BITS
+  // keep enough precision to order draws
+  uint32_t depthBits = 0;
+  const auto depth = std::max(viewDepth, 0.f);
+  std::memcpy(&depthBits, &depth, sizeof(depthBits));
+  uint64_t depthKey = depthBits >> (32 - DEPTH_BITS);
+  if (pass == Pass::Transparent) {
+    depthKey = ~depthKey & getMask(DEPTH_BITS); // Back to front
+  }
+
+  auto key = uint64_t(pass) & getMask(PASS_BITS);
+  key = (key << PROGRAM_BITS) | (program & getMask(PROGRAM_BITS));
+  key = (key << MATERIAL_BITS) | (material & getMask(MATERIAL_BITS));
+  key = (key << GEOMETRY_BITS) | (geometry & getMask(GEOMETRY_BITS));
+  return (key << DEPTH_BITS) | depthKey;
+}
+
+void RenderQueue::append(const RenderQueue &bucket, uint32_t indexOffset)
+{
+  m_items.reserve(m_items.size() + bucket.size());
+  for (const auto &item : bucket.m_items) {
+    m_items.push_back({item.key, item.index + indexOffset});
+  }
+}
+
+void RenderQueue::sort()
+{
+  // Histograms of every digit in a single pass over the keys
+  auto &histograms = m_histograms;
+  histograms.assign(DIGIT_COUNT * BIN_COUNT, 0);
+  for (const auto &item : m_items) {
+    for (size_t digit = 0; digit < DIGIT_COUNT; ++digit) {
+      ++histograms[digit * BIN_COUNT + getBin(item.key, digit)];
+    }
+  }
+
+  m_scratch.resize(m_items.size());
+  for (size_t digit = 0; digit < DIGIT_COUNT; ++digit) {
+    const auto histogram = histograms.data() + digit * BIN_COUNT;
+    // All keys in the same bin, the order does not change
+    if (std::find(histogram, histogram + BIN_COUNT, m_items.size()) !=
+        histogram + BIN_COUNT) {
+      continue;
+    }
+    size_t offset = 0;
+    for (size_t bin = 0; bin < BIN_COUNT; ++bin) {
+      const auto count = histogram[bin];
+      histogram[bin] = offset;
+      offset += count;
+    }
+    for (const auto &item : m_items) {
+      m_scratch[histogram[getBin(item.key, digit)]++] = item;
+    }
+    std::swap(m_items, m_scratch);
+  }
+}
+
+void RenderQueue::sort(JobSystem &jobSystem)
+{
+  const auto chunkCount = std::min(
+      jobSystem.threadCount(), m_items.size() / MIN_PARALLEL_CHUNK_SIZE);
+  if (chunkCount <= 1) {
+    sort();
+    return;
+  }
+  const auto chunkSize = (m_items.size() + chunkCount - 1) / chunkCount;
+  const auto forEachChunk = [&](auto &&f) {
+    jobSystem.parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+      for (auto chunk = begin; chunk < end; ++chunk) {
+        f(chunk, chunk * chunkSize,
+            std::min(m_items.size(), (chunk + 1) * chunkSize));
+      }
+    });
+  };
+
+  // Histograms of every digit, to skip the digits shared by all keys
+  auto &chunkHistograms = m_chunkHistograms;
+  chunkHistograms.assign(chunkCount * DIGIT_COUNT * BIN_COUNT, 0);
+  forEachChunk([&](size_t chunk, size_t begin, size_t end) {
+    const auto histograms =
+        chunkHistograms.data() + chunk * DIGIT_COUNT * BIN_COUNT;
+    for (auto i = begin; i < end; ++i) {
+      for (size_t digit = 0; digit < DIGIT_COUNT; ++digit) {
+        ++histograms[digit * BIN_COUNT + getBin(m_items[i].key, digit)];
+      }
+    }
+  });
+  auto &histograms = m_histograms;
+  histograms.assign(DIGIT_COUNT * BIN_COUNT, 0);
+  for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+    for (size_t i = 0; i < histograms.size(); ++i) {
+      histograms[i] += chunkHistograms[chunk * histograms.size() + i];
+    }
+  }
+
+  // Offsets of the bins of each chunk for the current digit. The chunks of
+  // the first pass already have theirs, later passes count them again as
+  // the previous one moved the items.
+  auto &offsets = m_offsets;
+  offsets.resize(chunkCount * BIN_COUNT);
+  m_scratch.resize(m_items.size());
+  auto isFirstPass = true;
+  for (size_t digit = 0; digit < DIGIT_COUNT; ++digit) {
+    const auto histogram = histograms.data() + digit * BIN_COUNT;
+    if (std::find(histogram, histogram + BIN_COUNT, m_items.size()) !=
+        histogram + BIN_COUNT) {
+      continue;
+    }
+    if (isFirstPass) {
+      for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        std::copy_n(chunkHistograms.data() +
+                        (chunk * DIGIT_COUNT + digit) * BIN_COUNT,
+            BIN_COUNT, offsets.data() + chunk * BIN_COUNT);
+      }
+      isFirstPass = false;
+    } else {
+      std::fill(begin(offsets), end(offsets), 0);
+      forEachChunk([&](size_t chunk, size_t begin, size_t end) {
+        const auto counts = offsets.data() + chunk * BIN_COUNT;
+        for (auto i = begin; i < end; ++i) {
+          ++counts[getBin(m_items[i].key, digit)];
+        }
+      });
+    }
+    // The items of a bin are placed chunk after chunk, which keeps the sort
+    // stable
+    size_t offset = 0;
+    for (size_t bin = 0; bin < BIN_COUNT; ++bin) {
+      for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        const auto count = offsets[chunk * BIN_COUNT + bin];
+        offsets[chunk * BIN_COUNT + bin] = offset;
+        offset += count;
+      }
+    }
+    forEachChunk([&](size_t chunk, size_t begin, size_t end) {
+      const auto binOffsets = offsets.data() + chunk * BIN_COUNT;
+      for (auto i = begin; i < end; ++i) {
+        m_scratch[binOffsets[getBin(m_items[i].key, digit)]++] = m_items[i];
+      }
+    });
+    std::swap(m_items, m_scratch);
+  }
+}
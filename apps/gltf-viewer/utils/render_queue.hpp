@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// Draw items collected during a scene traversal and sorted by a 64-bit key,
+// so that draws sharing the same state are submitted together.
+//
+// From the most to the least significant bits, a key holds the pass, the
+// program, the material, the geometry and the view depth of the item (see
+// makeKey). Opaque and masked items are sorted front to back within each
+// state and transparent ones back to front. Indices larger than their field
+// are truncated: the order is then less coherent but every item is kept.
+//
+// sort() is a least significant digit radix sort, whose passes are skipped
+// when every key has the same digit (e.g. scenes with a single program).
+//
+// Large scenes fill a queue per range of draws in parallel, each pushed to
+// by a single job, then append() them in order into the queue submitted on
+// the GL thread, sorted with sort(JobSystem &).
+class RenderQueue
+{
+public:
+  enum class Pass
+  {
+    Opaque = 0,
+    // Alpha tested (MASK materials), drawn together after the opaque items
+    // whose shaders never discard
+    Masked = 1,
+    Transparent = 2
+  };
+
+  struct Item
+  {
+    uint64_t key;
+    uint32_t index; // Given to push(), e.g. the index of a draw
+  };
+
+  static const unsigned PASS_BITS = 2;
+  static const unsigned PROGRAM_BITS = 6;
+  static const unsigned MATERIAL_BITS = 14;
+  static const unsigned GEOMETRY_BITS = 18;
+  static const unsigned DEPTH_BITS = 24;
+
+  // Key of an item. material should be 0 for primitives without material.
+  // viewDepth is the distance along the view direction, negative values are
+  // sorted as 0.
+  static uint64_t makeKey(Pass pass, uint32_t program, uint32_t material,
+      uint32_t geometry, float viewDepth);
+
+  static Pass getPass(uint64_t key)
+  {
+    return Pass(key >> (64 - PASS_BITS));
+  }
+
+  static uint32_t getProgram(uint64_t key)
+  {
+    return getField(
+        key, MATERIAL_BITS + GEOMETRY_BITS + DEPTH_BITS, PROGRAM_BITS);
+  }
+
+  static uint32_t getMaterial(uint64_t key)
+  {
+    return getField(key, GEOMETRY_BITS + DEPTH_BITS, MATERIAL_BITS);
+  }
+
+  void clear() { m_items.clear(); }
+
+  void push(uint64_t key, uint32_t index) { m_items.push_back({key, index}); }
+
+  // Push the items of bucket, their index offset by indexOffset
+  void append(const RenderQueue &bucket, uint32_t indexOffset);
+
+  // Sort the items by key, keeping the push order of equal keys
+  void sort();
+
+  // Same, each pass histograms then scatters contiguous chunks of the items
+  // in parallel. Small queues are sorted by the calling thread.
+  void sort(JobSystem &jobSystem);
+
+  const std::vector<Item> &items() const { return m_items; }
+
+  size_t size() const { return m_items.size(); }
+
+private:
+  static uint32_t getField(uint64_t key, unsigned shift, unsigned bits)
+  {
+    return uint32_t((key >> shift) & ((uint64_t(1) << bits) - 1));
+  }
+
+  std::vector<Item> m_items;
+  std::vector<Item> m_scratch; // Keeps its capacity from one sort to the next
+  // Same, counts of the bins of the digits
+  std::vector<size_t> m_histograms;
+  std::vector<size_t> m_chunkHistograms;
+  std::vector<size_t> m_offsets;
+};
@@ -0,0 +1,220 @@
+#include "render_server.hpp"
+
+#include <json.hpp>
+
+bool parseRenderRequest(const std::string &line, size_t defaultWidth,
+    size_t defaultHeight, RenderRequest &request, std::string &err)
+{
+  request = RenderRequest();
+  nlohmann::json document;
+  try {
+    document = nlohmann::json::parse(line);
+  } catch (const std::exception &e) {
+    err = std::string("invalid JSON: ") + e.what();
+    return false;
+  }
+  if (!document.is_object()) {
+    err = "expected an object";
+    return false;
+  }
+
+  auto &job = request.job;
+  try {
+    if (document.count("id")) {
+      // Kept in JSON, formatRenderResponse echoes it with its type
+      request.id = document["id"].dump();
+    }
+    if (document.count("stats") && document["stats"].get<bool>()) {
+      request.stats = true;
+      return true;
+    }
+    if (!document.count("model")) {
+      err = "request without model";
+      return false;
+    }
+    job.model = document["model"].get<std::string>();
+    if (document.count("output")) {
+      job.output = document["output"].get<std::string>();
+    }
+    if (document.count("format") &&
+        document["format"].get<std::string>() != "png") {
+      err = "unsupported format, expected png";
+      return false;
+    }
+    if (document.count("vs") || document.count("fs")) {
+      err = "shaders are set when the server starts";
+      return false;
+    }
+    job.width = document.count("width") ? document["width"].get<size_t>()
+                                        : defaultWidth;
+    job.height = document.count("height") ? document["height"].get<size_t>()
+                                          : defaultHeight;
+    if (document.count("lookat")) {
+      job.lookat = document["lookat"].get<std::vector<float>>();
+      if (job.lookat.size() != 9) {
+        err = "lookat must have 9 numbers";
+        return false;
+      }
+    }
+  } catch (const std::exception &e) {
+    err = std::string("invalid request: ") + e.what();
+    return false;
+  }
+  if (!job.width || !job.height) {
+    err = "empty image";
+    return false;
+  }
+  return true;
+}
+
+std::string formatRenderRequest(const std::string &id, const BatchJob &job)
+{
+  auto request = nlohmann::json::object();
+  if (!id.empty()) {
+    request["id"] = nlohmann::json::parse(id);
+  }
+  request["model"] = job.model.string();
+  if (!job.output.empty()) {
+    request["output"] = job.output.string();
+  }
+  request["width"] = job.width;
+  request["height"] = job.height;
+  if (!job.lookat.empty()) {
+    request["lookat"] = job.lookat;
+  }
+  return request.dump();
+}
+
+std::string formatRenderResponse(const std::string &id,
+    const std::string &error, const fs::path &output,
+    const std::vector<unsigned char> &png)
+{
+  auto response = nlohmann::json::object();
+  response["id"] =
+      id.empty() ? nlohmann::json() : nlohmann::json::parse(id);
+  response["ok"] = error.empty();
+  if (!error.empty()) {
+    response["error"] = error;
+  } else if (!output.empty()) {
+    response["output"] = output.string();
+  } else {
+    response["image"] = encodeBase64(png.data(), png.size());
+  }
+  return response.dump();
+}
+
+std::string formatModelCacheResponse(
+    const std::string &id, const ModelCacheStats &stats)
+{
+  auto response = nlohmann::json::object();
+  response["id"] =
+      id.empty() ? nlohmann::json() : nlohmann::json::parse(id);
+  response["ok"] = true;
+  response["cache"] = {{"hits", stats.hits}, {"misses", stats.misses},
+      {"evictions", stats.evictions}, {"models", stats.modelCount},
+      {"gpuBytes", stats.gpuBytes}, {"hostBytes", stats.hostBytes}};
+  return response.dump();
+}
+
+std::string encodeBase64(const unsigned char *data, size_t size)
+{
+  static const char alphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string text;
+  text.reserve((size + 2) / 3 * 4);
+  for (size_t i = 0; i < size; i += 3) {
+    const auto remaining = size - i;
+    const uint32_t bits = (uint32_t(data[i]) << 16) |
+                          (remaining > 1 ? uint32_t(data[i + 1]) << 8 : 0) |
+                          (remaining > 2 ? uint32_t(data[i + 2]) : 0);
+    text += alphabet[(bits >> 18) & 63];
+    text += alphabet[(bits >> 12) & 63];
+    text += remaining > 1 ? alphabet[(bits >> 6) & 63] : '=';
+    text += remaining > 2 ? alphabet[bits & 63] : '=';
+  }
+  return text;
+}
+
+bool decodeBase64(const std::string &text, std::vector<unsigned char> &data)
+{
+  data.clear();
+  if (text.size() % 4) {
+    return false;
+  }
+  data.reserve(text.size() / 4 * 3);
+  const auto decode = [](char c) {
+    if (c >= 'A' && c <= 'Z') {
+      return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+      return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9') {
+      return c - '0' + 52;
+    }
+    return c == '+' ? 62 : c == '/' ? 63 : -1;
+  };
+  for (size_t i = 0; i < text.size(); i += 4) {
+    // Padding only ends the text
+    const auto isLast = i + 4 == text.size();
+    const auto padding = isLast ? (text[i + 3] == '=') + (text[i + 2] == '=')
+                                : 0;
+    uint32_t bits = 0;
+    for (size_t j = 0; j < 4; ++j) {
+      const auto value = j < 4 - size_t(padding) ? decode(text[i + j]) : 0;
+      if (value < 0) {
+        return false;
+      }
+      bits = (bits << 6) | uint32_t(value);
+    }
+    data.push_back((unsigned char)(bits >> 16));
+    if (padding < 2) {
+      data.push_back((unsigned char)(bits >> 8));
+    }
+    if (padding < 1) {
+      data.push_back((unsigned char)bits);
+    }
+  }
+  return true;
+}
+
+LineReader::LineReader(std::istream &stream) :
+    m_stream(stream), m_thread([this]() { run(); })
+{
+}
+
+LineReader::~LineReader() { m_thread.join(); }
+
+bool LineReader::pop(std::string &line, bool wait)
+{
+  std::unique_lock<std::mutex> lock{m_mutex};
+  if (wait) {
+    m_condition.wait(lock, [&]() { return !m_lines.empty() || m_isEnded; });
+  }
+  if (m_lines.empty()) {
+    return false;
+  }
+  line = std::move(m_lines.front());
+  m_lines.pop_front();
+  return true;
+}
+
+void LineReader::run()
+{
+  std::string line;
+  while (std::getline(m_stream, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      m_lines.push_back(std::move(line));
+    }
+    m_condition.notify_one();
+  }
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_isEnded = true;
+  }
+  m_condition.notify_one();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "batch_jobs.hpp"
+#include "model_cache.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Requests and responses of the render server (batch --serve), one JSON
+// object per line.
+//
+// A request has the keys of a JSON batch job (see loadBatchJobs) except "vs"
+// and "fs", the programs being compiled at startup, plus an optional "id"
+// echoed in its response and an optional "format" ("png", the only one
+// supported). Without "output", the image is returned in the response.
+// Relative paths are relative to the working directory of the server.
+// {"id": ..., "stats": true} asks for the statistics of the model cache
+// instead of an image.
+//
+// A response is {"id": ..., "ok": true, "output": path} for an image written
+// in a file, {"id": ..., "ok": true, "image": base64 png} for an image
+// returned inline, or {"id": ..., "ok": false, "error": message}. Responses
+// come in the order images are finished, not in the order of requests. A
+// statistics request is answered with {"id": ..., "ok": true, "cache":
+// ModelCacheStats} right away.
+
+struct RenderRequest
+{
+  std::string id;
+  bool stats = false; // If set, job is empty
+  BatchJob job; // output is empty for an inline image
+};
+
+// Parse a request line. Return false and fill err if it is not a valid
+// request, id is then set if the line has one.
+bool parseRenderRequest(const std::string &line, size_t defaultWidth,
+    size_t defaultHeight, RenderRequest &request, std::string &err);
+
+// Request line of job, without the final newline, parsed back by
+// parseRenderRequest. id is JSON (a quoted string for a string), omitted if
+// empty. The shaders and the reference of job are not sent.
+std::string formatRenderRequest(const std::string &id, const BatchJob &job);
+
+// Response line of a request, without the final newline. Without error, png
+// is the encoded image if it was not written in output.
+std::string formatRenderResponse(const std::string &id,
+    const std::string &error, const fs::path &output = {},
+    const std::vector<unsigned char> &png = {});
+
+// Response line of a statistics request
+std::string formatModelCacheResponse(
+    const std::string &id, const ModelCacheStats &stats);
+
+std::string encodeBase64(const unsigned char *data, size_t size);
+
+// Return false if text is not base64
+bool decodeBase64(const std::string &text, std::vector<unsigned char> &data);
+
+// Lines of a stream read by a thread, so that the render loop can tell
+// whether a request is waiting without blocking on the stream
+class LineReader
+{
+public:
+  // Start reading stream, which must outlive the reader
+  explicit LineReader(std::istream &stream);
+
+  // Wait for the end of the stream
+  ~LineReader();
+
+  LineReader(const LineReader &) = delete;
+  LineReader &operator=(const LineReader &) = delete;
+
+  // Take the oldest line read and return true. If there is none, wait for
+  // the next one if wait is true, else return false. Return false at the
+  // end of the stream once every line has been taken.
+  bool pop(std::string &line, bool wait);
+
+private:
+  void run();
+
+  std::istream &m_stream;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<std::string> m_lines;
+  bool m_isEnded = false;
+
+  std::thread m_thread; // Started last, once the members above are set
+};
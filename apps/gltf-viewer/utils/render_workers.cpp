@@ -0,0 +1,651 @@
+#include "render_workers.hpp"
+#include "image_diff.hpp"
+#include "render_server.hpp"
+#include "tcp_socket.hpp"
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+RenderWorkerPool::RenderWorkerPool(size_t maxPendingRequests) :
+    m_maxPendingRequests(std::max(maxPendingRequests, size_t(1)))
+{
+#ifndef _WIN32
+  // A worker exiting must fail the writes of its requests, not kill us
+  std::signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+#ifdef _WIN32
+
+RenderWorkerPool::RenderWorkerPool(
+    const std::vector<std::vector<std::string>> &, size_t) :
+    m_maxPendingRequests(0)
+{
+  throw std::runtime_error("Render workers are not supported on Windows.");
+}
+
+std::unique_ptr<RenderWorkerPool> RenderWorkerPool::connect(
+    const std::vector<std::string> &, size_t)
+{
+  throw std::runtime_error("Render workers are not supported on Windows.");
+}
+
+RenderWorkerPool::~RenderWorkerPool() = default;
+
+void RenderWorkerPool::writeLocked(Worker &, const std::string &) {}
+
+void RenderWorkerPool::closeInputLocked(Worker &) {}
+
+bool RenderWorkerPool::receive(std::string &, size_t &) { return false; }
+
+bool RenderWorkerPool::wait() { return false; }
+
+#else
+
+RenderWorkerPool::RenderWorkerPool(
+    const std::vector<std::vector<std::string>> &commands,
+    size_t maxPendingRequests) :
+    RenderWorkerPool(maxPendingRequests)
+{
+  for (const auto &command : commands) {
+    // Ends of the parent are not inherited, dup2 gives the ends of the
+    // child without FD_CLOEXEC
+    int inputPipe[2], outputPipe[2];
+    if (pipe(inputPipe) != 0) {
+      wait();
+      throw std::runtime_error("Unable to create the pipes of a worker.");
+    }
+    if (pipe(outputPipe) != 0) {
+      close(inputPipe[0]);
+      close(inputPipe[1]);
+      wait();
+      throw std::runtime_error("Unable to create the pipes of a worker.");
+    }
+    for (const auto fd :
+        {inputPipe[0], inputPipe[1], outputPipe[0], outputPipe[1]}) {
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, inputPipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, outputPipe[1], STDOUT_FILENO);
+    std::vector<char *> argv;
+    for (const auto &argument : command) {
+      argv.push_back(const_cast<char *>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+    pid_t pid = -1;
+    const auto error =
+        posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(inputPipe[0]);
+    close(outputPipe[1]);
+    if (error) {
+      close(inputPipe[1]);
+      close(outputPipe[0]);
+      wait();
+      throw std::runtime_error(
+          "Unable to start the worker " + command.front() + ".");
+    }
+    Worker worker;
+    for (const auto &argument : command) {
+      worker.name += (worker.name.empty() ? "" : " ") + argument;
+    }
+    worker.pid = pid;
+    worker.input = inputPipe[1];
+    worker.output = outputPipe[0];
+    m_workers.push_back(std::move(worker));
+  }
+}
+
+std::unique_ptr<RenderWorkerPool> RenderWorkerPool::connect(
+    const std::vector<std::string> &addresses, size_t maxPendingRequests)
+{
+  std::unique_ptr<RenderWorkerPool> pool{
+      new RenderWorkerPool(maxPendingRequests)};
+  for (const auto &address : addresses) {
+    std::string err;
+    const auto socket = connectTcp(address, err);
+    if (socket < 0) {
+      throw std::runtime_error("Unable to reach a server: " + err + ".");
+    }
+    Worker worker;
+    worker.name = address;
+    worker.input = socket;
+    worker.output = socket;
+    pool->m_workers.push_back(std::move(worker));
+  }
+  return pool;
+}
+
+RenderWorkerPool::~RenderWorkerPool()
+{
+  if (!m_isWaited) {
+    wait();
+  }
+}
+
+void RenderWorkerPool::writeLocked(Worker &worker, const std::string &request)
+{
+  // With the lock held since receive() closes the input of a worker that
+  // exits. A failed write is such an exit, which receive() accounts for.
+  const auto line = request + '\n';
+  for (size_t offset = 0; offset < line.size();) {
+    const auto count =
+        write(worker.input, line.data() + offset, line.size() - offset);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      break;
+    }
+    offset += size_t(count);
+  }
+}
+
+void RenderWorkerPool::closeInputLocked(Worker &worker)
+{
+  if (worker.input < 0) {
+    return;
+  }
+  // The socket of a server is also its output: only its sending direction
+  // is closed while responses are awaited
+  if (worker.pid < 0) {
+    closeSocket(worker.input, worker.output >= 0);
+  } else {
+    close(worker.input);
+  }
+  worker.input = -1;
+}
+
+bool RenderWorkerPool::receive(std::string &response, size_t &workerIdx)
+{
+  for (;;) {
+    for (workerIdx = 0; workerIdx < m_workers.size(); ++workerIdx) {
+      auto &worker = m_workers[workerIdx];
+      const auto lineEnd = worker.buffer.find('\n');
+      if (lineEnd == std::string::npos) {
+        continue;
+      }
+      response = worker.buffer.substr(0, lineEnd);
+      worker.buffer.erase(0, lineEnd + 1);
+      {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        if (worker.pendingRequestCount) {
+          --worker.pendingRequestCount;
+        }
+      }
+      m_condition.notify_all();
+      return true;
+    }
+
+    std::vector<pollfd> fds;
+    for (const auto &worker : m_workers) {
+      if (worker.output >= 0) {
+        fds.push_back({worker.output, POLLIN, 0});
+      }
+    }
+    if (fds.empty()) {
+      return false;
+    }
+    if (poll(fds.data(), nfds_t(fds.size()), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    for (const auto &fd : fds) {
+      if (!fd.revents) {
+        continue;
+      }
+      workerIdx = 0;
+      while (m_workers[workerIdx].output != fd.fd) {
+        ++workerIdx;
+      }
+      auto &worker = m_workers[workerIdx];
+      char chunk[4096];
+      const auto count = read(worker.output, chunk, sizeof(chunk));
+      if (count > 0) {
+        worker.buffer.append(chunk, size_t(count));
+        continue;
+      }
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      // Exited, or about to, or disconnected: its requests in flight are
+      // lost. Expected once its input is closed and every request answered.
+      worker.buffer.clear();
+      auto isExpected = false;
+      {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        isExpected = worker.input < 0 && !worker.pendingRequestCount;
+        m_lostRequestCount += worker.pendingRequestCount;
+        worker.pendingRequestCount = 0;
+        // The socket of a server is both
+        if (worker.pid >= 0) {
+          closeInputLocked(worker);
+        }
+        worker.input = -1;
+        close(worker.output);
+        worker.output = -1;
+      }
+      m_condition.notify_all();
+      if (!isExpected) {
+        response.clear();
+        return true;
+      }
+    }
+  }
+}
+
+bool RenderWorkerPool::wait()
+{
+  closeInputs();
+  for (auto &worker : m_workers) {
+    if (worker.output >= 0) {
+      close(worker.output);
+      worker.output = -1;
+    }
+    if (worker.pid < 0) {
+      continue;
+    }
+    int status = 0;
+    while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      m_isSucceeded = false;
+    }
+  }
+  m_isWaited = true;
+  return m_isSucceeded;
+}
+
+#endif
+
+size_t RenderWorkerPool::pendingRequestCount(size_t worker) const
+{
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return m_workers[worker].pendingRequestCount;
+}
+
+bool RenderWorkerPool::isAvailableLocked(const Worker &worker) const
+{
+  return worker.input >= 0 &&
+         worker.pendingRequestCount < m_maxPendingRequests;
+}
+
+bool RenderWorkerPool::isAvailable(size_t worker) const
+{
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return isAvailableLocked(m_workers[worker]);
+}
+
+bool RenderWorkerPool::submit(size_t workerIdx, const std::string &request)
+{
+  std::lock_guard<std::mutex> lock{m_mutex};
+  auto &worker = m_workers[workerIdx];
+  if (!isAvailableLocked(worker)) {
+    return false;
+  }
+  ++worker.pendingRequestCount;
+  writeLocked(worker, request);
+  return true;
+}
+
+bool RenderWorkerPool::submit(
+    const std::string &request, const std::string &key)
+{
+  std::unique_lock<std::mutex> lock{m_mutex};
+  const auto isAvailable = [&](const Worker &worker) {
+    return isAvailableLocked(worker);
+  };
+  const auto isExited = [](const Worker &worker) { return worker.input < 0; };
+  m_condition.wait(lock, [&]() {
+    return std::any_of(begin(m_workers), end(m_workers), isAvailable) ||
+           std::all_of(begin(m_workers), end(m_workers), isExited);
+  });
+
+  // Least loaded worker, or the last worker of key if it has at most one
+  // more request in flight
+  auto leastLoaded = m_workers.size();
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    if (isAvailable(m_workers[i]) &&
+        (leastLoaded == m_workers.size() ||
+            m_workers[i].pendingRequestCount <
+                m_workers[leastLoaded].pendingRequestCount)) {
+      leastLoaded = i;
+    }
+  }
+  if (leastLoaded == m_workers.size()) {
+    return false;
+  }
+  auto workerIdx = leastLoaded;
+  const auto it = key.empty() ? end(m_keyWorkers) : m_keyWorkers.find(key);
+  if (it != end(m_keyWorkers) && isAvailable(m_workers[it->second]) &&
+      m_workers[it->second].pendingRequestCount <=
+          m_workers[leastLoaded].pendingRequestCount + 1) {
+    workerIdx = it->second;
+  }
+  if (!key.empty()) {
+    m_keyWorkers[key] = workerIdx;
+  }
+  auto &worker = m_workers[workerIdx];
+  ++worker.pendingRequestCount;
+  writeLocked(worker, request);
+  return true;
+}
+
+void RenderWorkerPool::closeInputs()
+{
+  std::lock_guard<std::mutex> lock{m_mutex};
+  for (auto &worker : m_workers) {
+    closeInputLocked(worker);
+  }
+  m_condition.notify_all();
+}
+
+size_t RenderWorkerPool::lostRequestCount() const
+{
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return m_lostRequestCount;
+}
+
+std::vector<std::vector<std::string>> getDeviceWorkerCommands(
+    const std::string &executable, const std::vector<std::string> &arguments,
+    size_t deviceCount)
+{
+  std::vector<std::vector<std::string>> commands;
+  for (size_t device = 0; device < deviceCount; ++device) {
+    commands.emplace_back();
+    auto &command = commands.back();
+    command.push_back(executable);
+    command.insert(end(command), begin(arguments), end(arguments));
+    command.push_back("--device");
+    command.push_back(std::to_string(device));
+  }
+  return commands;
+}
+
+int runBatchOnWorkers(RenderWorkerPool &workers,
+    const std::vector<BatchJob> &jobs, const WorkerBatchOptions &options)
+{
+  for (const auto &job : jobs) {
+    if (!job.vertexShader.empty() || !job.fragmentShader.empty()) {
+      std::cerr << "Error: " << job.output
+                << " has its own shaders, which workers do not compile"
+                << std::endl;
+      return -1;
+    }
+  }
+
+  // Jobs waiting to be sent, by model, and the model of each worker
+  std::map<fs::path, std::deque<size_t>> modelJobs;
+  for (size_t jobIdx = 0; jobIdx < jobs.size(); ++jobIdx) {
+    modelJobs[jobs[jobIdx].model].push_back(jobIdx);
+  }
+  std::map<fs::path, size_t> modelWorkerCounts;
+  std::vector<fs::path> workerModels(workers.workerCount());
+  const auto setWorkerModel = [&](size_t worker, const fs::path &model) {
+    if (!workerModels[worker].empty()) {
+      --modelWorkerCounts[workerModels[worker]];
+    }
+    workerModels[worker] = model;
+    if (!model.empty()) {
+      ++modelWorkerCounts[model];
+    }
+  };
+  const auto takeJob = [&](size_t worker, size_t &jobIdx) {
+    auto it = modelJobs.find(workerModels[worker]);
+    if (it == end(modelJobs) || it->second.empty()) {
+      // A model of no other worker, else when idle the one with most jobs
+      it = std::find_if(begin(modelJobs), end(modelJobs), [&](auto &entry) {
+        return !entry.second.empty() && !modelWorkerCounts[entry.first];
+      });
+      if (it == end(modelJobs) && !workers.pendingRequestCount(worker)) {
+        it = std::max_element(begin(modelJobs), end(modelJobs),
+            [](const auto &lhs, const auto &rhs) {
+              return lhs.second.size() < rhs.second.size();
+            });
+      }
+      if (it == end(modelJobs) || it->second.empty()) {
+        return false;
+      }
+      setWorkerModel(worker, it->first);
+    }
+    jobIdx = it->second.front();
+    it->second.pop_front();
+    return true;
+  };
+
+  std::vector<BatchJobResult> results(jobs.size());
+  std::vector<size_t> retryCounts(jobs.size(), 0);
+  std::vector<std::vector<size_t>> workerJobs(workers.workerCount());
+  std::vector<size_t> workerImageCounts(workers.workerCount(), 0);
+  auto unfinishedCount = jobs.size();
+  const auto retry = [&](size_t jobIdx, const std::string &error) {
+    const auto &job = jobs[jobIdx];
+    if (retryCounts[jobIdx] == options.retryCount) {
+      std::cerr << "Error: " << job.output << ": " << error << std::endl;
+      --unfinishedCount;
+      return;
+    }
+    ++retryCounts[jobIdx];
+    std::cerr << "Warning: " << job.output << ": " << error << ", retrying"
+              << std::endl;
+    modelJobs[job.model].push_front(jobIdx);
+  };
+
+  const size_t numComponents = 3;
+  const auto finish = [&](size_t jobIdx, const nlohmann::json &response) {
+    const auto &job = jobs[jobIdx];
+    auto &result = results[jobIdx];
+    if (options.inlineImages) {
+      std::vector<unsigned char> png;
+      if (!decodeBase64(response.at("image").get<std::string>(), png)) {
+        std::cerr << "Error: " << job.output << ": invalid image"
+                  << std::endl;
+        return;
+      }
+      std::ofstream file{job.output, std::ios::binary};
+      if (!file.write(reinterpret_cast<const char *>(png.data()),
+              std::streamsize(png.size()))) {
+        std::cerr << "Error: unable to write " << job.output << std::endl;
+        return;
+      }
+    }
+    result.isRendered = true;
+    if (job.reference.empty()) {
+      return;
+    }
+    // Read back from its file, written by the worker or above
+    size_t width = 0, height = 0;
+    std::vector<unsigned char> pixels;
+    std::string err;
+    if (!readPng(job.output, numComponents, width, height, pixels, err) ||
+        !compareWithReference(job, numComponents, pixels.data(), false,
+            options.referenceTolerance, options.referenceMaxDifferingPixels,
+            result, err)) {
+      std::cerr << "Error: " << err << std::endl;
+    }
+  };
+
+  const auto startTime = std::chrono::steady_clock::now();
+  std::vector<size_t> order(workers.workerCount());
+  std::iota(begin(order), end(order), 0);
+  while (unfinishedCount) {
+    // One job at a time to the least loaded worker that takes one
+    for (auto isSubmitted = true; isSubmitted;) {
+      isSubmitted = false;
+      std::stable_sort(begin(order), end(order), [&](size_t lhs, size_t rhs) {
+        return workers.pendingRequestCount(lhs) <
+               workers.pendingRequestCount(rhs);
+      });
+      for (const auto worker : order) {
+        size_t jobIdx = 0;
+        if (!workers.isAvailable(worker) || !takeJob(worker, jobIdx)) {
+          continue;
+        }
+        auto job = jobs[jobIdx];
+        if (options.inlineImages) {
+          job.output.clear();
+        }
+        workers.submit(
+            worker, formatRenderRequest(std::to_string(jobIdx), job));
+        workerJobs[worker].push_back(jobIdx);
+        isSubmitted = true;
+        break;
+      }
+    }
+    const auto isPending = std::any_of(begin(workerJobs), end(workerJobs),
+        [](const std::vector<size_t> &pending) { return !pending.empty(); });
+    std::string line;
+    size_t worker = 0;
+    if (!isPending || !workers.receive(line, worker)) {
+      break;
+    }
+
+    auto &pendingJobs = workerJobs[worker];
+    if (line.empty()) {
+      std::cerr << "Error: worker " << workers.workerName(worker)
+                << " exited" << std::endl;
+      setWorkerModel(worker, {});
+      for (const auto jobIdx : pendingJobs) {
+        retry(jobIdx, "lost by its worker");
+      }
+      pendingJobs.clear();
+      continue;
+    }
+    try {
+      const auto response = nlohmann::json::parse(line);
+      const auto jobIdx = response.at("id").get<size_t>();
+      const auto it = std::find(begin(pendingJobs), end(pendingJobs), jobIdx);
+      if (it == end(pendingJobs)) {
+        continue;
+      }
+      pendingJobs.erase(it);
+      if (!response.at("ok").get<bool>()) {
+        retry(jobIdx, response.at("error").get<std::string>());
+        continue;
+      }
+      --unfinishedCount;
+      ++workerImageCounts[worker];
+      finish(jobIdx, response);
+    } catch (const std::exception &e) {
+      std::cerr << "Error: invalid response of " << workers.workerName(worker)
+                << ": " << e.what() << std::endl;
+    }
+  }
+  workers.closeInputs();
+  const auto isSucceeded = workers.wait();
+  const auto seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - startTime)
+                           .count();
+  const auto getThroughput = [&](size_t imageCount) {
+    return double(imageCount) / std::max(seconds, 1e-6);
+  };
+
+  const auto renderedCount = std::count_if(begin(results), end(results),
+      [](const BatchJobResult &result) { return result.isRendered; });
+  const auto comparedCount = std::count_if(begin(results), end(results),
+      [](const BatchJobResult &result) { return result.hasReference; });
+  const auto referenceCount = std::count_if(begin(jobs), end(jobs),
+      [](const BatchJob &job) { return !job.reference.empty(); });
+  const auto matchingCount = std::count_if(begin(results), end(results),
+      [](const BatchJobResult &result) { return result.isMatching; });
+  std::clog << "Rendered " << renderedCount << " / " << jobs.size()
+            << " images in " << seconds << " s ("
+            << getThroughput(size_t(renderedCount)) << " images/s) on "
+            << workers.workerCount() << " workers";
+  if (comparedCount) {
+    std::clog << ", " << matchingCount << " / " << comparedCount
+              << " matching their reference";
+  }
+  std::clog << std::endl;
+  for (size_t worker = 0; worker < workers.workerCount(); ++worker) {
+    std::clog << "  " << workers.workerName(worker) << ": "
+              << workerImageCounts[worker] << " images ("
+              << getThroughput(workerImageCounts[worker]) << " images/s)"
+              << std::endl;
+  }
+  if (!options.report.empty()) {
+    std::string err;
+    if (!writeBatchResults(options.report, jobs, results, err)) {
+      std::cerr << "Error: " << err << std::endl;
+      return -1;
+    }
+    std::clog << "Wrote batch results " << options.report << std::endl;
+  }
+  return isSucceeded && size_t(renderedCount) == jobs.size() &&
+                 matchingCount == referenceCount
+             ? 0
+             : -1;
+}
+
+int serveOnWorkers(RenderWorkerPool &workers, std::istream &requests,
+    std::ostream &responses, size_t defaultWidth, size_t defaultHeight)
+{
+  std::mutex responseMutex;
+  const auto respond = [&](const std::string &response) {
+    std::lock_guard<std::mutex> lock{responseMutex};
+    responses << response << std::endl;
+  };
+  std::thread receiver([&]() {
+    std::string response;
+    size_t worker = 0;
+    while (workers.receive(response, worker)) {
+      if (response.empty()) {
+        std::cerr << "Error: worker " << workers.workerName(worker)
+                  << " exited" << std::endl;
+        continue;
+      }
+      respond(response);
+    }
+  });
+
+  std::string line;
+  while (std::getline(requests, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    RenderRequest request;
+    std::string err;
+    if (!parseRenderRequest(
+            line, defaultWidth, defaultHeight, request, err)) {
+      respond(formatRenderResponse(request.id, err));
+      continue;
+    }
+    if (!workers.submit(line, request.job.model.string())) {
+      respond(formatRenderResponse(request.id, "no render worker left"));
+    }
+  }
+  workers.closeInputs();
+  receiver.join();
+  const auto isSucceeded = workers.wait();
+  if (const auto lostCount = workers.lostRequestCount()) {
+    std::cerr << "Error: " << lostCount
+              << " requests lost by workers that exited" << std::endl;
+    return -1;
+  }
+  return isSucceeded ? 0 : -1;
+}
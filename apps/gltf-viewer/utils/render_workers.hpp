@@ -0,0 +1,151 @@
+#pragma once
+
+#include "batch_jobs.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Render servers (batch --serve, see render_server.hpp) used as workers:
+// child processes, typically one per GPU of the machine (batch --gpus), or
+// servers of other machines reached over TCP (batch --servers), each with
+// its own context, model cache and pipeline.
+//
+// runBatchOnWorkers picks the worker of each job itself. submit() picks the
+// least loaded worker, preferring the last worker given the same model since
+// its model cache keeps it loaded. Requests are then sent from one thread
+// and responses received from another: submit() waits for a worker to have
+// room, which only receive() frees.
+//
+// Workers are started with posix_spawnp and reached with POSIX sockets, not
+// supported on Windows.
+class RenderWorkerPool
+{
+public:
+  // Start one worker per command line, whose first argument is the
+  // executable. Each worker has at most maxPendingRequests requests in
+  // flight. Throw std::runtime_error on failure.
+  RenderWorkerPool(const std::vector<std::vector<std::string>> &commands,
+      size_t maxPendingRequests = 4);
+
+  // Connect to the servers at addresses ("host:port", see batch --serve
+  // --listen). Throw std::runtime_error if one cannot be reached.
+  static std::unique_ptr<RenderWorkerPool> connect(
+      const std::vector<std::string> &addresses,
+      size_t maxPendingRequests = 4);
+
+  // Close the inputs of the workers if needed and wait for their exit
+  ~RenderWorkerPool();
+
+  RenderWorkerPool(const RenderWorkerPool &) = delete;
+  RenderWorkerPool &operator=(const RenderWorkerPool &) = delete;
+
+  size_t workerCount() const { return m_workers.size(); }
+
+  // Command or address of a worker
+  const std::string &workerName(size_t worker) const
+  {
+    return m_workers[worker].name;
+  }
+
+  size_t pendingRequestCount(size_t worker) const;
+
+  // True if worker has not exited and has room for a request
+  bool isAvailable(size_t worker) const;
+
+  // Send request, a line without newline, to worker if it is available and
+  // return true, else return false
+  bool submit(size_t worker, const std::string &request);
+
+  // Send request to the least loaded worker once one has room. key is the
+  // model of the request, empty if none. Return false if every worker has
+  // exited.
+  bool submit(const std::string &request, const std::string &key);
+
+  // Close the inputs of the workers: they exit, or close their connection,
+  // once their pending requests are answered. Nothing can be submitted
+  // afterwards.
+  void closeInputs();
+
+  // Wait for the next response line of any worker, set worker and return
+  // true. response is empty if worker has exited: its requests in flight
+  // are lost (see lostRequestCount()). Return false once every worker has
+  // exited.
+  bool receive(std::string &response, size_t &worker);
+
+  size_t lostRequestCount() const;
+
+  // Wait for the exit of the workers, return true if they all succeeded
+  bool wait();
+
+private:
+  struct Worker
+  {
+    std::string name;
+    int pid = -1; // -1 for servers reached over TCP
+    int input = -1; // Write end of the standard input, or socket
+    int output = -1; // Read end of the standard output, or socket
+    std::string buffer; // Output read after the last full line
+    size_t pendingRequestCount = 0;
+  };
+
+  explicit RenderWorkerPool(size_t maxPendingRequests);
+
+  bool isAvailableLocked(const Worker &worker) const;
+  void writeLocked(Worker &worker, const std::string &request);
+  void closeInputLocked(Worker &worker);
+
+  std::vector<Worker> m_workers;
+  size_t m_maxPendingRequests;
+  // Of the inputs, the pending counts and the members below
+  mutable std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::unordered_map<std::string, size_t> m_keyWorkers; // Of submit(key)
+  size_t m_lostRequestCount = 0;
+  bool m_isWaited = false;
+  bool m_isSucceeded = true;
+};
+
+// Command lines of workers rendering on each GPU of HeadlessGLContext:
+// arguments, the server options of the batch command without executable,
+// followed by --device i
+std::vector<std::vector<std::string>> getDeviceWorkerCommands(
+    const std::string &executable, const std::vector<std::string> &arguments,
+    size_t deviceCount);
+
+struct WorkerBatchOptions
+{
+  // See ViewerOptions::referenceTolerance
+  size_t referenceTolerance = 8;
+  float referenceMaxDifferingPixels = 0.001f;
+  fs::path report; // See writeBatchResults, none if empty
+  // Times a job failed or lost by a worker is sent again
+  size_t retryCount = 2;
+  // Images are returned in the responses and written by the coordinator,
+  // for workers which do not share its file system
+  bool inlineImages = false;
+};
+
+// Render jobs on workers as ViewerApplication::runBatch does, then compare
+// the images with their reference. Jobs are model-affine: a worker takes
+// the jobs of its current model, then of a model no other worker has, and
+// only when it is idle shares the model with the most jobs left, so that
+// large models are loaded by few workers. Results are reported as they
+// come, then the throughput of each worker. Load and GPU times are not
+// measured. Jobs must use the shaders of the workers. Return 0 if every
+// image is rendered and matches its reference, -1 otherwise.
+int runBatchOnWorkers(RenderWorkerPool &workers,
+    const std::vector<BatchJob> &jobs, const WorkerBatchOptions &options);
+
+// Forward requests to workers and their responses, in the order they come,
+// until the end of requests: a render server over several GPUs or servers.
+// Invalid requests are answered without reaching a worker, statistics are
+// those of the worker answering.
+int serveOnWorkers(RenderWorkerPool &workers, std::istream &requests,
+    std::ostream &responses, size_t defaultWidth, size_t defaultHeight);
@@ -0,0 +1,144 @@
+#include "ring_buffer.hpp"
+#include "sync_watchdog.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+
+// Initial size of a region, grown as frames need more
+const size_t MIN_REGION_SIZE = 64 * 1024;
+
+size_t alignUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+RingBuffer &RingBuffer::operator=(RingBuffer &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_buffer, rvalue.m_buffer);
+    std::swap(m_data, rvalue.m_data);
+    std::swap(m_nRegionSize, rvalue.m_nRegionSize);
+    std::swap(m_nRegion, rvalue.m_nRegion);
+    std::swap(m_nOffset, rvalue.m_nOffset);
+    std::swap(m_nFrameSize, rvalue.m_nFrameSize);
+    std::swap(m_nStallCount, rvalue.m_nStallCount);
+    std::swap(m_fences, rvalue.m_fences);
+    std::swap(m_retiredBuffers, rvalue.m_retiredBuffers);
+  }
+  return *this;
+}
+
+void RingBuffer::beginFrame()
+{
+  m_nRegion = (m_nRegion + 1) % m_fences.size();
+  m_nOffset = 0;
+  auto &fence = m_fences[m_nRegion];
+  if (!fence) {
+    return;
+  }
+  auto status = glClientWaitSync(fence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    ++m_nStallCount;
+    SyncScope sync{"RingBuffer::beginFrame"};
+    // The first wait flushes the commands so that the fence is signaled
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    const GLuint64 timeout = 1000000000; // 1 second
+    do {
+      status = glClientWaitSync(fence, flags, timeout);
+      flags = 0;
+    } while (status == GL_TIMEOUT_EXPIRED);
+  }
+  if (status == GL_WAIT_FAILED) {
+    std::cerr << "Error: RingBuffer - glClientWaitSync failed" << std::endl;
+  }
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+RingBuffer::Allocation RingBuffer::allocate(size_t size, size_t alignment)
+{
+  const auto regionBegin = m_nRegion * m_nRegionSize;
+  auto offset = alignUp(regionBegin + m_nOffset, alignment) - regionBegin;
+  if (!m_buffer.glId() || offset + size > m_nRegionSize) {
+    // Regions are multiples of the largest alignment so that region starts
+    // keep the alignment of the buffer
+    const auto needed = alignUp(m_nOffset + size + alignment, 256);
+    createBuffer(std::max({needed, 2 * m_nRegionSize, MIN_REGION_SIZE}));
+    return allocate(size, alignment);
+  }
+  m_nOffset = offset + size;
+  const auto bufferOffset = regionBegin + offset;
+  return {m_buffer.glId(), bufferOffset, m_data + bufferOffset};
+}
+
+RingBuffer::Allocation RingBuffer::upload(
+    const void *data, size_t size, size_t alignment)
+{
+  const auto allocation = allocate(size, alignment);
+  std::memcpy(allocation.data, data, size);
+  return allocation;
+}
+
+void RingBuffer::endFrame()
+{
+  auto &fence = m_fences[m_nRegion];
+  if (m_buffer.glId() && !fence) {
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+  m_nFrameSize = m_nOffset;
+  m_retiredBuffers.clear();
+}
+
+void RingBuffer::reserve(size_t regionSize)
+{
+  if (regionSize > m_nRegionSize) {
+    createBuffer(alignUp(regionSize, 256));
+  }
+}
+
+void RingBuffer::createBuffer(size_t regionSize)
+{
+  // Allocations of the current frame may still be bound, the buffer is
+  // deleted once the frame is submitted. Pending frames keep reading the
+  // previous buffer, so the fences of its regions are not needed anymore.
+  if (m_buffer.glId()) {
+    m_retiredBuffers.push_back(std::move(m_buffer));
+  }
+  for (auto &fence : m_fences) {
+    if (fence) {
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+  }
+
+  const GLbitfield flags =
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  m_nRegionSize = regionSize;
+  m_nOffset = 0;
+  const auto size = m_fences.size() * m_nRegionSize;
+  m_buffer = GLBuffer(size, nullptr, flags);
+  m_data = static_cast<unsigned char *>(m_buffer.map(0, size, flags));
+}
+
+void RingBuffer::release()
+{
+  for (auto &fence : m_fences) {
+    if (fence) {
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+  }
+  // Deleting a buffer unmaps it
+  m_buffer = GLBuffer();
+  m_data = nullptr;
+  m_nRegionSize = 0;
+  m_nOffset = 0;
+  m_retiredBuffers.clear();
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "gl_objects.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Persistently mapped buffer for the data written by the CPU for a frame and
+// read by the GPU in the same frame: uniform blocks, instance attributes,
+// staging data copied to other buffers...
+//
+// The buffer is split in frameCount regions (FRAME_COUNT by default) used in
+// turn by successive frames. endFrame() places a fence after the commands of
+// the frame, beginFrame() waits on the fence of the region it reuses, which
+// the GPU has normally passed since it was placed frameCount - 1 frames
+// earlier. Callers with several "frames" per displayed frame (e.g. one per
+// view) need as many times more regions to not wait on the GPU. The
+// mapping is coherent: writes need no flush and no upload call can make the
+// driver wait for pending draws.
+//
+// A frame allocating more than a region moves to a buffer with larger
+// regions. The previous buffer is deleted by endFrame(), the GL keeps it
+// alive until the commands reading it are complete.
+class RingBuffer
+{
+public:
+  static const size_t FRAME_COUNT = 3;
+
+  struct Allocation
+  {
+    GLuint buffer;
+    size_t offset; // In buffer
+    void *data; // Mapped, write only
+  };
+
+  explicit RingBuffer(size_t frameCount = FRAME_COUNT) :
+      m_nRegion(frameCount - 1), m_fences(frameCount, nullptr)
+  {
+  }
+
+  ~RingBuffer() { release(); }
+
+  // Non-copyable class:
+  RingBuffer(const RingBuffer &) = delete;
+  RingBuffer &operator=(const RingBuffer &) = delete;
+
+  RingBuffer(RingBuffer &&rvalue) : RingBuffer(rvalue.m_fences.size())
+  {
+    *this = std::move(rvalue);
+  }
+
+  RingBuffer &operator=(RingBuffer &&rvalue);
+
+  // Move to the next region, waiting for the GPU to finish reading it
+  void beginFrame();
+
+  // size bytes of the current region, valid until the GPU is done with the
+  // commands submitted before the next endFrame(). alignment must be a power
+  // of two.
+  Allocation allocate(size_t size, size_t alignment);
+
+  // Allocate and copy size bytes of data
+  Allocation upload(const void *data, size_t size, size_t alignment);
+
+  // Fence the commands reading the current region
+  void endFrame();
+
+  // Make regions at least regionSize bytes, between endFrame() and
+  // beginFrame(), so that frames of known size do not grow them one by one
+  void reserve(size_t regionSize);
+
+  size_t regionSize() const { return m_nRegionSize; }
+
+  // Bytes allocated by the last frame
+  size_t frameSize() const { return m_nFrameSize; }
+
+  // Number of beginFrame() calls that had to wait for the GPU
+  size_t stallCount() const { return m_nStallCount; }
+
+private:
+  void release();
+
+  // Replace the buffer by one with regions of regionSize bytes
+  void createBuffer(size_t regionSize);
+
+  GLBuffer m_buffer;
+  unsigned char *m_data = nullptr;
+  size_t m_nRegionSize = 0;
+  size_t m_nRegion; // The first frame uses region 0
+  size_t m_nOffset = 0; // In the current region
+  size_t m_nFrameSize = 0;
+  size_t m_nStallCount = 0;
+  std::vector<GLsync> m_fences; // One per region
+  // Replaced during the current frame, deleted by endFrame()
+  std::vector<GLBuffer> m_retiredBuffers;
+};
@@ -0,0 +1,73 @@
+#include "sampler_cache.hpp"
+#include "gl_extensions.hpp"
+
+#include <algorithm>
+#include <tuple>
+
+bool SamplerState::operator<(const SamplerState &rhs) const
+{
+  return std::tie(minFilter, magFilter, wrapS, wrapT) <
+         std::tie(rhs.minFilter, rhs.magFilter, rhs.wrapS, rhs.wrapT);
+}
+
+SamplerState getSamplerState(const tinygltf::Model &model, int textureIdx)
+{
+  SamplerState state;
+  if (textureIdx < 0 || size_t(textureIdx) >= model.textures.size()) {
+    return state;
+  }
+  const auto samplerIdx = model.textures[textureIdx].sampler;
+  if (samplerIdx < 0 || size_t(samplerIdx) >= model.samplers.size()) {
+    return state;
+  }
+  const auto &sampler = model.samplers[samplerIdx];
+  if (sampler.minFilter != -1) {
+    state.minFilter = sampler.minFilter;
+  }
+  if (sampler.magFilter != -1) {
+    state.magFilter = sampler.magFilter;
+  }
+  state.wrapS = sampler.wrapS;
+  state.wrapT = sampler.wrapT;
+  return state;
+}
+
+SamplerCache &SamplerCache::operator=(SamplerCache &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_settings, rvalue.m_settings);
+    std::swap(m_samplers, rvalue.m_samplers);
+  }
+  return *this;
+}
+
+GLuint SamplerCache::get(const SamplerState &state)
+{
+  auto &id = m_samplers[state];
+  if (id) {
+    return id;
+  }
+  glGenSamplers(1, &id);
+  glSamplerParameteri(id, GL_TEXTURE_MIN_FILTER, state.minFilter);
+  glSamplerParameteri(id, GL_TEXTURE_MAG_FILTER, state.magFilter);
+  glSamplerParameteri(id, GL_TEXTURE_WRAP_S, state.wrapS);
+  glSamplerParameteri(id, GL_TEXTURE_WRAP_T, state.wrapT);
+  if (m_settings.lodBias != 0.f) {
+    glSamplerParameterf(id, GL_TEXTURE_LOD_BIAS, m_settings.lodBias);
+  }
+  const auto &extensions = getGLExtensions();
+  if (m_settings.maxAnisotropy > 1.f && extensions.textureFilterAnisotropic) {
+    glSamplerParameterf(id, GL_TEXTURE_MAX_ANISOTROPY_EXT,
+        std::min(m_settings.maxAnisotropy, extensions.maxTextureAnisotropy));
+  }
+  return id;
+}
+
+void SamplerCache::release()
+{
+  for (const auto &sampler : m_samplers) {
+    glDeleteSamplers(1, &sampler.second);
+  }
+  m_samplers.clear();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <tiny_gltf.h>
+
+#include <map>
+#include <utility>
+
+// Filters and wraps of a glTF sampler, with the defaults of the viewer for
+// the parameters it leaves undefined
+struct SamplerState
+{
+  GLint minFilter = GL_LINEAR_MIPMAP_LINEAR;
+  GLint magFilter = GL_LINEAR;
+  GLint wrapS = GL_REPEAT;
+  GLint wrapT = GL_REPEAT;
+
+  bool operator<(const SamplerState &rhs) const;
+};
+
+// State of the sampler of model.textures[textureIdx], the default state if it
+// has none
+SamplerState getSamplerState(const tinygltf::Model &model, int textureIdx);
+
+// Overrides applied to every sampler of a SamplerCache
+struct SamplerSettings
+{
+  // Maximum anisotropy of minification, clamped to the limit of the driver.
+  // 1 disables anisotropic filtering, as without
+  // GL_EXT_texture_filter_anisotropic.
+  float maxAnisotropy = 1.f;
+  // Added to the level of detail of every texture fetch, positive values
+  // sample coarser levels
+  float lodBias = 0.f;
+};
+
+// GL sampler objects, one per distinct SamplerState: glTF samplers with the
+// same parameters, or textures of different glTF samplers with the same
+// parameters, share them. Textures then carry no sampling state of their
+// own, samplers are bound to their units (glBindSamplers) or combined with
+// them in bindless handles.
+class SamplerCache
+{
+public:
+  SamplerCache() = default;
+
+  explicit SamplerCache(const SamplerSettings &settings) :
+      m_settings(settings)
+  {
+  }
+
+  ~SamplerCache() { release(); }
+
+  // Non-copyable class:
+  SamplerCache(const SamplerCache &) = delete;
+  SamplerCache &operator=(const SamplerCache &) = delete;
+
+  SamplerCache(SamplerCache &&rvalue) { *this = std::move(rvalue); }
+
+  SamplerCache &operator=(SamplerCache &&rvalue);
+
+  // Sampler object of state, created on first use
+  GLuint get(const SamplerState &state);
+
+  // Number of sampler objects
+  size_t size() const { return m_samplers.size(); }
+
+  const SamplerSettings &settings() const { return m_settings; }
+
+private:
+  void release();
+
+  SamplerSettings m_settings;
+  std::map<SamplerState, GLuint> m_samplers;
+};
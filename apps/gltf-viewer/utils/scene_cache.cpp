@@ -0,0 +1,1042 @@
+#include "scene_cache.hpp"
+#include "hash.hpp"
+#include "job_system.hpp"
+#include "lz4.hpp"
+#include "scene_hierarchy.hpp"
+#include "shared_cache.hpp"
+#include "tracing.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace
+{
+
+const char SCENE_CACHE_MAGIC[8] = {'G', 'L', 'T', 'F', 'C', 'A', 'C', 'H'};
+// Increment each time the layout of the file changes
+const uint32_t SCENE_CACHE_VERSION = 9;
+// Alignment of every blob in the data section, enough for any vertex format
+const uint64_t SCENE_CACHE_DATA_ALIGNMENT = 16;
+// Compressed chunks are written this many at a time, compressed in parallel
+const size_t SCENE_CACHE_CHUNK_BATCH = 64;
+
+const char *const TEXTURE_BASISU_EXTENSION = "KHR_texture_basisu";
+
+// Range of records of a section, relative to the start of the file
+struct Section
+{
+  uint64_t offset = 0;
+  uint64_t count = 0;
+};
+
+struct Header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint64_t sourceKey;
+  float bboxMin[3];
+  float bboxMax[3];
+  Section bufferViews;
+  Section accessors;
+  Section attributes;
+  Section primitives;
+  Section meshes;
+  Section nodes;
+  Section images;
+  Section textures;
+  Section lods;
+  Section optimizedIndices;
+  Section meshlets;
+  Section pvsGrids; // 0 or 1 record
+  Section pvsCells;
+  Section dataChunks; // Of a compressed data section, none otherwise
+  Section data; // count is the size in bytes, once decompressed
+  uint32_t compression; // SceneCacheCompression
+  uint32_t padding;
+};
+
+struct CachedBufferView
+{
+  uint64_t byteOffset; // In data section
+  uint64_t byteLength;
+  uint32_t byteStride;
+  int32_t target;
+};
+
+struct CachedAccessor
+{
+  int32_t bufferView;
+  int32_t componentType;
+  int32_t type;
+  int32_t normalized;
+  uint64_t byteOffset;
+  uint64_t count;
+  int32_t minMaxCount; // Only stored for scalar and vector accessors
+  float minValues[4];
+  float maxValues[4];
+};
+
+struct CachedAttribute
+{
+  char name[28];
+  int32_t accessor;
+};
+
+struct CachedPrimitive
+{
+  int32_t mode;
+  int32_t indices;
+  uint32_t firstAttribute;
+  uint32_t attributeCount;
+};
+
+struct CachedMesh
+{
+  uint32_t firstPrimitive;
+  uint32_t primitiveCount;
+};
+
+struct CachedNode
+{
+  float worldMatrix[16];
+  int32_t mesh;
+  int32_t padding;
+};
+
+struct CachedImage
+{
+  int32_t width;
+  int32_t height;
+  int32_t component;
+  int32_t bits;
+  int32_t pixelType;
+  int32_t asIs; // Not 0 for KTX2 containers kept as is (see loadImageData)
+  uint64_t byteOffset; // In data section
+  uint64_t byteLength;
+};
+
+struct CachedTexture
+{
+  int32_t source;
+  int32_t basisuSource; // KHR_texture_basisu source, -1 if absent
+};
+
+// A level of the LOD chain of a primitive. Levels are stored coarsest first:
+// the coarsest level of every primitive, then the next finer ones, and so on,
+// at the start of the data section, so that the levels a viewer uploads
+// first (see ViewerOptions::coarseFirstUpload) are read first.
+struct CachedLod
+{
+  uint32_t primitive; // In mesh order
+  uint32_t indexCount;
+  float error;
+  uint32_t level; // In the chain of the primitive, 0 is the finest
+  uint64_t byteOffset; // In data section, indices are uint32_t
+};
+
+// Optimized indices of a primitive, and the remap table of its vertices
+struct CachedOptimizedIndices
+{
+  uint32_t primitive; // In mesh order
+  uint32_t indexCount;
+  uint32_t vertexCount;
+  float acmrBefore;
+  float acmrAfter;
+  uint32_t padding;
+  uint64_t indicesOffset; // In data section, indices are uint32_t
+  uint64_t vertexRemapOffset; // Same
+};
+
+// A meshlet of a primitive, meshlets of a primitive are consecutive and in
+// index order
+struct CachedMeshlet
+{
+  uint32_t primitive; // In mesh order
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  float bboxMin[3];
+  float bboxMax[3];
+  float coneAxis[3];
+  float coneCutoff;
+  uint32_t padding;
+};
+
+// Grid of the potentially visible sets, whose encoded sets are a blob of
+// the data section
+struct CachedPvsGrid
+{
+  float origin[3];
+  float cellSize;
+  uint32_t cellCounts[3];
+  uint32_t drawCount;
+  uint64_t byteOffset; // In data section
+  uint64_t byteLength;
+};
+
+// Chunk of SCENE_CACHE_CHUNK_SIZE bytes of the data section, the last one
+// may be smaller
+struct CachedDataChunk
+{
+  uint64_t offset; // In the file
+  // Compressed, the chunk is stored as is if it does not compress
+  uint32_t byteLength;
+  uint32_t padding;
+};
+
+// Encoded set of a cell, relative to the blob of the sets
+using CachedPvsCell = PotentiallyVisibleSets::CellSet;
+static_assert(sizeof(CachedPvsCell) == 2 * sizeof(uint32_t),
+    "CellSet is stored as it is");
+
+uint64_t alignOffset(uint64_t offset, uint64_t alignment)
+{
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+template <typename T>
+Section makeSection(const std::vector<T> &records, uint64_t &fileOffset)
+{
+  fileOffset = alignOffset(fileOffset, 8);
+  Section section{fileOffset, records.size()};
+  fileOffset += records.size() * sizeof(T);
+  return section;
+}
+
+void writePadding(std::ofstream &out, uint64_t offset)
+{
+  static const char zeros[SCENE_CACHE_DATA_ALIGNMENT] = {};
+  const auto position = uint64_t(out.tellp());
+  out.write(zeros, std::streamsize(offset - position));
+}
+
+template <typename T>
+void writeSection(
+    std::ofstream &out, const Section &section, const std::vector<T> &records)
+{
+  writePadding(out, section.offset);
+  out.write(reinterpret_cast<const char *>(records.data()),
+      std::streamsize(records.size() * sizeof(T)));
+}
+
+// Writes the blobs of the data section of a cache in out, in the order of
+// their offsets: as is from dataOffset, or compressed in chunks whose records
+// are stored in chunks
+class DataWriter
+{
+public:
+  DataWriter(std::ofstream &out, uint64_t dataOffset,
+      SceneCacheCompression compression,
+      std::vector<CachedDataChunk> &chunks) :
+      m_out(out),
+      m_dataOffset(dataOffset),
+      m_compression(compression),
+      m_chunks(chunks)
+  {
+  }
+
+  // Write size bytes at offset in the data section, after the previous ones
+  void write(uint64_t offset, const void *bytes, uint64_t size)
+  {
+    if (m_compression == SceneCacheCompression::None) {
+      writePadding(m_out, m_dataOffset + offset);
+      m_out.write(static_cast<const char *>(bytes), std::streamsize(size));
+      return;
+    }
+    append(nullptr, offset - m_pendingOffset - m_pending.size());
+    append(static_cast<const uint8_t *>(bytes), size);
+  }
+
+  // Write the last chunks of a section of dataSize bytes
+  void finish(uint64_t dataSize)
+  {
+    if (m_compression != SceneCacheCompression::None) {
+      append(nullptr, dataSize - m_pendingOffset - m_pending.size());
+      flush();
+    }
+  }
+
+private:
+  // Append size bytes, zeros if bytes is null, to the pending chunks
+  void append(const uint8_t *bytes, uint64_t size)
+  {
+    const auto batchSize = SCENE_CACHE_CHUNK_BATCH * SCENE_CACHE_CHUNK_SIZE;
+    while (size) {
+      const auto count =
+          size_t(std::min(size, uint64_t(batchSize - m_pending.size())));
+      if (bytes) {
+        m_pending.insert(end(m_pending), bytes, bytes + count);
+        bytes += count;
+      } else {
+        m_pending.resize(m_pending.size() + count, 0);
+      }
+      size -= count;
+      if (m_pending.size() == batchSize) {
+        flush();
+      }
+    }
+  }
+
+  // Compress the pending chunks in parallel and write them in order
+  void flush()
+  {
+    const auto chunkCount = (m_pending.size() + SCENE_CACHE_CHUNK_SIZE - 1) /
+                            SCENE_CACHE_CHUNK_SIZE;
+    std::vector<std::vector<uint8_t>> compressed(chunkCount);
+    getJobSystem().parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+      for (auto i = begin; i < end; ++i) {
+        const auto chunk = m_pending.data() + i * SCENE_CACHE_CHUNK_SIZE;
+        const auto chunkSize = std::min(size_t(SCENE_CACHE_CHUNK_SIZE),
+            m_pending.size() - i * SCENE_CACHE_CHUNK_SIZE);
+        auto &bytes = compressed[i];
+        bytes.resize(getLz4CompressBound(chunkSize));
+        bytes.resize(compressLz4(chunk, chunkSize, bytes.data(),
+            m_compression == SceneCacheCompression::Lz4High));
+        if (bytes.size() >= chunkSize) {
+          bytes.assign(chunk, chunk + chunkSize);
+        }
+      }
+    });
+    if (m_chunks.empty()) {
+      writePadding(m_out, m_dataOffset);
+    }
+    for (const auto &bytes : compressed) {
+      m_chunks.push_back(
+          {uint64_t(m_out.tellp()), uint32_t(bytes.size()), 0});
+      m_out.write(reinterpret_cast<const char *>(bytes.data()),
+          std::streamsize(bytes.size()));
+    }
+    m_pendingOffset += m_pending.size();
+    m_pending.clear();
+  }
+
+  std::ofstream &m_out;
+  uint64_t m_dataOffset;
+  SceneCacheCompression m_compression;
+  std::vector<CachedDataChunk> &m_chunks;
+  // Bytes of the data section from m_pendingOffset, not compressed yet
+  std::vector<uint8_t> m_pending;
+  uint64_t m_pendingOffset = 0;
+};
+
+template <typename T>
+const T *getSection(const MappedFile &mapping, const Section &section)
+{
+  if (section.offset % alignof(T) != 0 || section.offset > mapping.size() ||
+      section.count > (mapping.size() - section.offset) / sizeof(T)) {
+    return nullptr;
+  }
+  return reinterpret_cast<const T *>(mapping.data() + section.offset);
+}
+
+bool isRangeValid(uint64_t offset, uint64_t length, uint64_t size)
+{
+  return offset <= size && length <= size - offset;
+}
+
+// Decompress the chunks of the data section of the cache of header, mapped
+// in mapping, into data in parallel
+bool decompressData(const MappedFile &mapping, const Header &header,
+    std::vector<unsigned char> &data)
+{
+  TRACE_ZONE("Decompress scene cache");
+  const auto chunks = getSection<CachedDataChunk>(mapping, header.dataChunks);
+  if (!chunks || header.dataChunks.count !=
+                     (header.data.count + SCENE_CACHE_CHUNK_SIZE - 1) /
+                         SCENE_CACHE_CHUNK_SIZE) {
+    return false;
+  }
+  data.resize(size_t(header.data.count));
+  std::atomic<bool> isValid{true};
+  getJobSystem().parallelFor(size_t(header.dataChunks.count), 1,
+      [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; ++i) {
+          const auto &chunk = chunks[i];
+          const auto offset = i * uint64_t(SCENE_CACHE_CHUNK_SIZE);
+          const auto size = std::min(
+              uint64_t(SCENE_CACHE_CHUNK_SIZE), header.data.count - offset);
+          if (!isRangeValid(chunk.offset, chunk.byteLength, mapping.size()) ||
+              chunk.byteLength > size) {
+            isValid = false;
+            continue;
+          }
+          const auto bytes = mapping.data() + chunk.offset;
+          if (chunk.byteLength == size) {
+            std::memcpy(data.data() + offset, bytes, size_t(size));
+          } else if (!decompressLz4(bytes, chunk.byteLength,
+                         data.data() + offset, size_t(size))) {
+            isValid = false;
+          }
+        }
+      });
+  return isValid;
+}
+
+} // namespace
+
+uint64_t computeSceneCacheKey(const fs::path &sourcePath)
+{
+  std::error_code errorCode;
+  const uint64_t fileSize = fs::file_size(sourcePath, errorCode);
+  const int64_t writeTime =
+      fs::last_write_time(sourcePath, errorCode).time_since_epoch().count();
+
+  auto hash = fnv1a64(&fileSize, sizeof(fileSize));
+  hash = fnv1a64(&writeTime, sizeof(writeTime), hash);
+  hash = fnv1a64(&SCENE_CACHE_VERSION, sizeof(SCENE_CACHE_VERSION), hash);
+
+  // First bytes contain the JSON of .gltf files and the JSON chunk of .glb
+  // files, which changes with almost any edit of the asset
+  std::ifstream in(sourcePath.string(), std::ios::binary);
+  std::vector<char> head(64 * 1024);
+  in.read(head.data(), std::streamsize(head.size()));
+  return fnv1a64(head.data(), size_t(in.gcount()), hash);
+}
+
+fs::path getSceneCachePath(uint64_t sourceKey, const fs::path &cacheDirectory)
+{
+  if (!cacheDirectory.empty()) {
+    return getCacheEntryPath(cacheDirectory, sourceKey, ".gltfcache");
+  }
+  std::error_code errorCode;
+  return getCacheEntryPath(fs::temp_directory_path(errorCode) / "gltf-viewer",
+      sourceKey, ".gltfcache");
+}
+
+bool canWriteSceneCache(const tinygltf::Model &model)
+{
+  if (model.defaultScene < 0 || !model.animations.empty() ||
+      !model.skins.empty() || !model.lights.empty() ||
+      model.extensions.count("KHR_materials_variants")) {
+    return false;
+  }
+  for (const auto &accessor : model.accessors) {
+    if (accessor.sparse.isSparse || accessor.bufferView < 0) {
+      return false;
+    }
+  }
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      if (!primitive.targets.empty()) {
+        return false;
+      }
+      for (const auto &attribute : primitive.attributes) {
+        if (attribute.first.size() >= sizeof(CachedAttribute::name)) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool writeSceneCache(const fs::path &cachePath, uint64_t sourceKey,
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax,
+    const DerivedGeometry &derived, std::string &err,
+    SceneCacheCompression compression)
+{
+  TRACE_ZONE("Write scene cache");
+  if (!canWriteSceneCache(model)) {
+    err = "Model cannot be stored in a scene cache";
+    return false;
+  }
+
+  size_t primitiveCount = 0;
+  for (const auto &mesh : model.meshes) {
+    primitiveCount += mesh.primitives.size();
+  }
+  uint64_t dataSize = 0;
+  // Levels of detail lead the data, coarsest first
+  const auto &lods = derived.lods;
+  std::vector<CachedLod> cachedLods;
+  std::vector<const MeshLod *> lodSources;
+  size_t maxLevelCount = 0;
+  for (size_t i = 0; i < lods.size() && i < primitiveCount; ++i) {
+    maxLevelCount = std::max(maxLevelCount, lods[i].size());
+  }
+  for (size_t rank = 0; rank < maxLevelCount; ++rank) {
+    for (size_t primitiveIdx = 0;
+         primitiveIdx < lods.size() && primitiveIdx < primitiveCount;
+         ++primitiveIdx) {
+      const auto &chain = lods[primitiveIdx];
+      if (rank >= chain.size()) {
+        continue;
+      }
+      const auto level = chain.size() - 1 - rank;
+      const auto &lod = chain[level];
+      dataSize = alignOffset(dataSize, SCENE_CACHE_DATA_ALIGNMENT);
+      cachedLods.push_back({uint32_t(primitiveIdx),
+          uint32_t(lod.indices.size()), lod.error, uint32_t(level),
+          dataSize});
+      lodSources.push_back(&lod);
+      dataSize += lod.indices.size() * sizeof(uint32_t);
+    }
+  }
+
+  // Keep only accessors and bufferViews used by mesh primitives, remapped to
+  // compact indices
+  std::vector<int> accessorRemap(model.accessors.size(), -1);
+  std::vector<int> bufferViewRemap(model.bufferViews.size(), -1);
+  std::vector<CachedBufferView> bufferViews;
+  std::vector<int> bufferViewSources;
+  std::vector<CachedAccessor> accessors;
+
+  const auto addAccessor = [&](int accessorIdx) {
+    if (accessorRemap[accessorIdx] >= 0) {
+      return accessorRemap[accessorIdx];
+    }
+    const auto &accessor = model.accessors[accessorIdx];
+    auto &viewIdx = bufferViewRemap[accessor.bufferView];
+    if (viewIdx < 0) {
+      const auto &bufferView = model.bufferViews[accessor.bufferView];
+      viewIdx = int(bufferViews.size());
+      dataSize = alignOffset(dataSize, SCENE_CACHE_DATA_ALIGNMENT);
+      bufferViews.push_back({dataSize, bufferView.byteLength,
+          uint32_t(bufferView.byteStride), int32_t(bufferView.target)});
+      bufferViewSources.push_back(accessor.bufferView);
+      dataSize += bufferView.byteLength;
+    }
+    CachedAccessor cached = {};
+    cached.bufferView = viewIdx;
+    cached.componentType = accessor.componentType;
+    cached.type = accessor.type;
+    cached.normalized = accessor.normalized;
+    cached.byteOffset = accessor.byteOffset;
+    cached.count = accessor.count;
+    if (accessor.minValues.size() == accessor.maxValues.size() &&
+        accessor.minValues.size() <= 4) {
+      cached.minMaxCount = int32_t(accessor.minValues.size());
+      for (size_t i = 0; i < accessor.minValues.size(); ++i) {
+        cached.minValues[i] = float(accessor.minValues[i]);
+        cached.maxValues[i] = float(accessor.maxValues[i]);
+      }
+    }
+    accessorRemap[accessorIdx] = int(accessors.size());
+    accessors.push_back(cached);
+    return accessorRemap[accessorIdx];
+  };
+
+  std::vector<CachedAttribute> attributes;
+  std::vector<CachedPrimitive> primitives;
+  std::vector<CachedMesh> meshes;
+  for (const auto &mesh : model.meshes) {
+    meshes.push_back(
+        {uint32_t(primitives.size()), uint32_t(mesh.primitives.size())});
+    for (const auto &primitive : mesh.primitives) {
+      CachedPrimitive cached = {};
+      cached.mode = primitive.mode;
+      cached.indices =
+          primitive.indices >= 0 ? addAccessor(primitive.indices) : -1;
+      cached.firstAttribute = uint32_t(attributes.size());
+      cached.attributeCount = uint32_t(primitive.attributes.size());
+      for (const auto &attribute : primitive.attributes) {
+        CachedAttribute cachedAttribute = {};
+        std::strncpy(cachedAttribute.name, attribute.first.c_str(),
+            sizeof(cachedAttribute.name) - 1);
+        cachedAttribute.accessor = addAccessor(attribute.second);
+        attributes.push_back(cachedAttribute);
+      }
+      primitives.push_back(cached);
+    }
+  }
+
+  // Flatten the default scene
+  std::vector<CachedNode> nodes;
+  const SceneHierarchy hierarchy{model, buffers};
+  for (const auto flatIdx : hierarchy.meshNodes()) {
+    CachedNode cached = {};
+    std::memcpy(cached.worldMatrix,
+        glm::value_ptr(hierarchy.worldMatrix(flatIdx)),
+        sizeof(cached.worldMatrix));
+    cached.mesh = hierarchy.mesh(flatIdx);
+    nodes.push_back(cached);
+  }
+
+  std::vector<CachedImage> images;
+  for (const auto &image : model.images) {
+    dataSize = alignOffset(dataSize, SCENE_CACHE_DATA_ALIGNMENT);
+    images.push_back({image.width, image.height, image.component, image.bits,
+        image.pixel_type, image.as_is ? 1 : 0, dataSize,
+        image.image.size()});
+    dataSize += image.image.size();
+  }
+
+  std::vector<CachedTexture> textures;
+  for (const auto &texture : model.textures) {
+    const auto basisu = texture.extensions.find(TEXTURE_BASISU_EXTENSION);
+    const auto hasBasisuSource = basisu != end(texture.extensions) &&
+                                 basisu->second.Has("source");
+    textures.push_back({texture.source,
+        hasBasisuSource
+            ? int32_t(basisu->second.Get("source").GetNumberAsInt())
+            : -1});
+  }
+
+  const auto &optimizedIndices = derived.optimizedIndices;
+  std::vector<CachedOptimizedIndices> cachedOptimizedIndices;
+  for (size_t primitiveIdx = 0; primitiveIdx < optimizedIndices.size() &&
+                                primitiveIdx < primitives.size();
+       ++primitiveIdx) {
+    const auto &optimized = optimizedIndices[primitiveIdx];
+    if (optimized.indices.empty()) {
+      continue;
+    }
+    CachedOptimizedIndices cached = {};
+    cached.primitive = uint32_t(primitiveIdx);
+    cached.indexCount = uint32_t(optimized.indices.size());
+    cached.vertexCount = uint32_t(optimized.vertexRemap.size());
+    cached.acmrBefore = optimized.acmrBefore;
+    cached.acmrAfter = optimized.acmrAfter;
+    dataSize = alignOffset(dataSize, SCENE_CACHE_DATA_ALIGNMENT);
+    cached.indicesOffset = dataSize;
+    dataSize += optimized.indices.size() * sizeof(uint32_t);
+    dataSize = alignOffset(dataSize, SCENE_CACHE_DATA_ALIGNMENT);
+    cached.vertexRemapOffset = dataSize;
+    dataSize += optimized.vertexRemap.size() * sizeof(uint32_t);
+    cachedOptimizedIndices.push_back(cached);
+  }
+
+  const auto &meshlets = derived.meshlets;
+  std::vector<CachedMeshlet> cachedMeshlets;
+  for (size_t primitiveIdx = 0;
+       primitiveIdx < meshlets.size() && primitiveIdx < primitives.size();
+       ++primitiveIdx) {
+    for (const auto &meshlet : meshlets[primitiveIdx]) {
+      CachedMeshlet cached = {};
+      cached.primitive = uint32_t(primitiveIdx);
+      cached.firstIndex = meshlet.firstIndex;
+      cached.indexCount = meshlet.indexCount;
+      std::memcpy(cached.bboxMin, glm::value_ptr(meshlet.bboxMin),
+          sizeof(cached.bboxMin));
+      std::memcpy(cached.bboxMax, glm::value_ptr(meshlet.bboxMax),
+          sizeof(cached.bboxMax));
+      std::memcpy(cached.coneAxis, glm::value_ptr(meshlet.coneAxis),
+          sizeof(cached.coneAxis));
+      cached.coneCutoff = meshlet.coneCutoff;
+      cachedMeshlets.push_back(cached);
+    }
+  }
+
+  const auto &pvs = derived.pvs;
+  std::vector<CachedPvsGrid> pvsGrids;
+  if (!pvs.empty()) {
+    CachedPvsGrid cached = {};
+    std::memcpy(cached.origin, glm::value_ptr(pvs.grid().origin),
+        sizeof(cached.origin));
+    cached.cellSize = pvs.grid().cellSize;
+    std::memcpy(cached.cellCounts, glm::value_ptr(pvs.grid().cellCounts),
+        sizeof(cached.cellCounts));
+    cached.drawCount = uint32_t(pvs.drawCount());
+    dataSize = alignOffset(dataSize, SCENE_CACHE_DATA_ALIGNMENT);
+    cached.byteOffset = dataSize;
+    cached.byteLength = pvs.data().size();
+    dataSize += pvs.data().size();
+    pvsGrids.push_back(cached);
+  }
+
+  Header header = {};
+  std::memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+  header.version = SCENE_CACHE_VERSION;
+  header.headerSize = sizeof(Header);
+  header.sourceKey = sourceKey;
+
+  std::memcpy(header.bboxMin, glm::value_ptr(bboxMin), sizeof(header.bboxMin));
+  std::memcpy(header.bboxMax, glm::value_ptr(bboxMax), sizeof(header.bboxMax));
+
+  uint64_t fileOffset = sizeof(Header);
+  header.bufferViews = makeSection(bufferViews, fileOffset);
+  header.accessors = makeSection(accessors, fileOffset);
+  header.attributes = makeSection(attributes, fileOffset);
+  header.primitives = makeSection(primitives, fileOffset);
+  header.meshes = makeSection(meshes, fileOffset);
+  header.nodes = makeSection(nodes, fileOffset);
+  header.images = makeSection(images, fileOffset);
+  header.textures = makeSection(textures, fileOffset);
+  header.lods = makeSection(cachedLods, fileOffset);
+  header.optimizedIndices = makeSection(cachedOptimizedIndices, fileOffset);
+  header.meshlets = makeSection(cachedMeshlets, fileOffset);
+  header.pvsGrids = makeSection(pvsGrids, fileOffset);
+  header.pvsCells = makeSection(pvs.cellSets(), fileOffset);
+  // Records of the chunks, written once they are compressed
+  std::vector<CachedDataChunk> dataChunks;
+  if (compression != SceneCacheCompression::None) {
+    dataChunks.resize(size_t((dataSize + SCENE_CACHE_CHUNK_SIZE - 1) /
+                             SCENE_CACHE_CHUNK_SIZE));
+  }
+  header.dataChunks = makeSection(dataChunks, fileOffset);
+  header.data = {alignOffset(fileOffset, SCENE_CACHE_DATA_ALIGNMENT), dataSize};
+  header.compression = uint32_t(compression);
+
+  std::error_code errorCode;
+  fs::create_directories(cachePath.parent_path(), errorCode);
+
+  const auto tmpPath = getTemporaryCachePath(cachePath);
+  {
+    std::ofstream out(tmpPath.string(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+      err = "Unable to open " + tmpPath.string() + " for writing";
+      fs::remove(tmpPath, errorCode);
+      return false;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeSection(out, header.bufferViews, bufferViews);
+    writeSection(out, header.accessors, accessors);
+    writeSection(out, header.attributes, attributes);
+    writeSection(out, header.primitives, primitives);
+    writeSection(out, header.meshes, meshes);
+    writeSection(out, header.nodes, nodes);
+    writeSection(out, header.images, images);
+    writeSection(out, header.textures, textures);
+    writeSection(out, header.lods, cachedLods);
+    writeSection(out, header.optimizedIndices, cachedOptimizedIndices);
+    writeSection(out, header.meshlets, cachedMeshlets);
+    writeSection(out, header.pvsGrids, pvsGrids);
+    writeSection(out, header.pvsCells, pvs.cellSets());
+    writeSection(out, header.dataChunks, dataChunks);
+
+    dataChunks.clear();
+    DataWriter data{out, header.data.offset, compression, dataChunks};
+    for (size_t i = 0; i < cachedLods.size(); ++i) {
+      data.write(cachedLods[i].byteOffset, lodSources[i]->indices.data(),
+          cachedLods[i].indexCount * sizeof(uint32_t));
+    }
+    for (size_t i = 0; i < bufferViews.size(); ++i) {
+      const auto &bufferView = model.bufferViews[bufferViewSources[i]];
+      data.write(bufferViews[i].byteOffset,
+          buffers[bufferView.buffer].data + bufferView.byteOffset,
+          bufferView.byteLength);
+    }
+    for (size_t i = 0; i < images.size(); ++i) {
+      data.write(images[i].byteOffset, model.images[i].image.data(),
+          images[i].byteLength);
+    }
+    for (const auto &cached : cachedOptimizedIndices) {
+      const auto &optimized = optimizedIndices[cached.primitive];
+      data.write(cached.indicesOffset, optimized.indices.data(),
+          cached.indexCount * sizeof(uint32_t));
+      data.write(cached.vertexRemapOffset, optimized.vertexRemap.data(),
+          cached.vertexCount * sizeof(uint32_t));
+    }
+    for (const auto &cached : pvsGrids) {
+      data.write(cached.byteOffset, pvs.data().data(), cached.byteLength);
+    }
+    data.finish(dataSize);
+    if (!dataChunks.empty()) {
+      out.seekp(std::streamoff(header.dataChunks.offset));
+      writeSection(out, header.dataChunks, dataChunks);
+    }
+    if (!out) {
+      err = "Unable to write " + tmpPath.string();
+      out.close(); // Before its removal, which fails on open files on Windows
+      fs::remove(tmpPath, errorCode);
+      return false;
+    }
+  }
+
+  fs::rename(tmpPath, cachePath, errorCode);
+  if (errorCode) {
+    err = "Unable to rename " + tmpPath.string() + ": " + errorCode.message();
+    fs::remove(tmpPath, errorCode);
+    return false;
+  }
+  return true;
+}
+
+bool readSceneCache(const fs::path &cachePath, uint64_t sourceKey,
+    tinygltf::Model &model, MappedFile &mapping,
+    std::vector<BufferSpan> &buffers, glm::vec3 &bboxMin, glm::vec3 &bboxMax,
+    DerivedGeometry &derived)
+{
+  TRACE_ZONE("Read scene cache");
+  std::error_code errorCode;
+  if (!fs::exists(cachePath, errorCode)) {
+    return false;
+  }
+  try {
+    mapping = MappedFile{cachePath};
+  } catch (const std::runtime_error &) {
+    return false;
+  }
+
+  if (mapping.size() < sizeof(Header)) {
+    return false;
+  }
+  const auto &header = *reinterpret_cast<const Header *>(mapping.data());
+  const auto isCompressed =
+      header.compression != uint32_t(SceneCacheCompression::None);
+  if (std::memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != SCENE_CACHE_VERSION ||
+      header.headerSize != sizeof(Header) || header.sourceKey != sourceKey ||
+      header.compression > uint32_t(SceneCacheCompression::Lz4High) ||
+      (!isCompressed && !isRangeValid(header.data.offset, header.data.count,
+                            mapping.size()))) {
+    return false;
+  }
+
+  const auto bufferViews =
+      getSection<CachedBufferView>(mapping, header.bufferViews);
+  const auto accessors = getSection<CachedAccessor>(mapping, header.accessors);
+  const auto attributes =
+      getSection<CachedAttribute>(mapping, header.attributes);
+  const auto primitives =
+      getSection<CachedPrimitive>(mapping, header.primitives);
+  const auto meshes = getSection<CachedMesh>(mapping, header.meshes);
+  const auto nodes = getSection<CachedNode>(mapping, header.nodes);
+  const auto images = getSection<CachedImage>(mapping, header.images);
+  const auto textures = getSection<CachedTexture>(mapping, header.textures);
+  const auto cachedLods = getSection<CachedLod>(mapping, header.lods);
+  const auto cachedOptimizedIndices =
+      getSection<CachedOptimizedIndices>(mapping, header.optimizedIndices);
+  const auto cachedMeshlets =
+      getSection<CachedMeshlet>(mapping, header.meshlets);
+  const auto pvsGrids = getSection<CachedPvsGrid>(mapping, header.pvsGrids);
+  const auto pvsCells = getSection<CachedPvsCell>(mapping, header.pvsCells);
+  if (!bufferViews || !accessors || !attributes || !primitives || !meshes ||
+      !nodes || !images || !textures || !cachedLods ||
+      !cachedOptimizedIndices || !cachedMeshlets || !pvsGrids || !pvsCells ||
+      header.pvsGrids.count > 1) {
+    return false;
+  }
+
+  model = tinygltf::Model{};
+  model.asset.version = "2.0";
+  model.buffers.resize(1);
+  auto data = mapping.data() + header.data.offset;
+  if (isCompressed) {
+    if (!decompressData(mapping, header, model.buffers[0].data)) {
+      return false;
+    }
+    data = model.buffers[0].data.data();
+  }
+
+  model.bufferViews.resize(header.bufferViews.count);
+  for (size_t i = 0; i < model.bufferViews.size(); ++i) {
+    const auto &cached = bufferViews[i];
+    if (!isRangeValid(cached.byteOffset, cached.byteLength, header.data.count)) {
+      return false;
+    }
+    auto &bufferView = model.bufferViews[i];
+    bufferView.buffer = 0;
+    bufferView.byteOffset = cached.byteOffset;
+    bufferView.byteLength = cached.byteLength;
+    bufferView.byteStride = cached.byteStride;
+    bufferView.target = cached.target;
+  }
+
+  model.accessors.resize(header.accessors.count);
+  for (size_t i = 0; i < model.accessors.size(); ++i) {
+    const auto &cached = accessors[i];
+    if (cached.bufferView < 0 ||
+        uint64_t(cached.bufferView) >= header.bufferViews.count ||
+        cached.minMaxCount < 0 ||
+        size_t(cached.minMaxCount) > std::size(cached.minValues)) {
+      return false;
+    }
+    auto &accessor = model.accessors[i];
+    accessor.bufferView = cached.bufferView;
+    accessor.componentType = cached.componentType;
+    accessor.type = cached.type;
+    accessor.normalized = cached.normalized != 0;
+    accessor.byteOffset = cached.byteOffset;
+    accessor.count = cached.count;
+    accessor.minValues.assign(
+        cached.minValues, cached.minValues + cached.minMaxCount);
+    accessor.maxValues.assign(
+        cached.maxValues, cached.maxValues + cached.minMaxCount);
+  }
+
+  const auto isAccessorValid = [&](int32_t idx) {
+    return idx >= 0 && uint64_t(idx) < header.accessors.count;
+  };
+
+  model.meshes.resize(header.meshes.count);
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    const auto &cachedMesh = meshes[meshIdx];
+    if (uint64_t(cachedMesh.firstPrimitive) + cachedMesh.primitiveCount >
+        header.primitives.count) {
+      return false;
+    }
+    auto &mesh = model.meshes[meshIdx];
+    mesh.primitives.resize(cachedMesh.primitiveCount);
+    for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+      const auto &cached = primitives[cachedMesh.firstPrimitive + pIdx];
+      if (uint64_t(cached.firstAttribute) + cached.attributeCount >
+              header.attributes.count ||
+          (cached.indices >= 0 && !isAccessorValid(cached.indices))) {
+        return false;
+      }
+      auto &primitive = mesh.primitives[pIdx];
+      primitive.mode = cached.mode;
+      primitive.indices = cached.indices;
+      for (size_t a = 0; a < cached.attributeCount; ++a) {
+        const auto &attribute = attributes[cached.firstAttribute + a];
+        if (!isAccessorValid(attribute.accessor)) {
+          return false;
+        }
+        const auto nameLength = strnlen(attribute.name, sizeof(attribute.name));
+        primitive.attributes[std::string(attribute.name, nameLength)] =
+            attribute.accessor;
+      }
+    }
+  }
+
+  model.scenes.resize(1);
+  model.defaultScene = 0;
+  model.nodes.resize(header.nodes.count);
+  for (size_t i = 0; i < model.nodes.size(); ++i) {
+    const auto &cached = nodes[i];
+    if (cached.mesh < 0 || uint64_t(cached.mesh) >= header.meshes.count) {
+      return false;
+    }
+    auto &node = model.nodes[i];
+    node.mesh = cached.mesh;
+    node.matrix.assign(cached.worldMatrix, cached.worldMatrix + 16);
+    model.scenes[0].nodes.push_back(int(i));
+  }
+
+  model.images.resize(header.images.count);
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    const auto &cached = images[i];
+    if (!isRangeValid(cached.byteOffset, cached.byteLength, header.data.count)) {
+      return false;
+    }
+    auto &image = model.images[i];
+    image.width = cached.width;
+    image.height = cached.height;
+    image.component = cached.component;
+    image.bits = cached.bits;
+    image.pixel_type = cached.pixelType;
+    if (cached.asIs) {
+      image.as_is = true;
+      image.mimeType = "image/ktx2";
+    }
+    image.image.assign(
+        data + cached.byteOffset, data + cached.byteOffset + cached.byteLength);
+  }
+
+  model.textures.resize(header.textures.count);
+  for (size_t i = 0; i < model.textures.size(); ++i) {
+    auto &texture = model.textures[i];
+    texture.source = textures[i].source;
+    if (textures[i].basisuSource >= 0) {
+      tinygltf::Value::Object basisu;
+      basisu["source"] = tinygltf::Value(textures[i].basisuSource);
+      texture.extensions[TEXTURE_BASISU_EXTENSION] =
+          tinygltf::Value(std::move(basisu));
+    }
+  }
+
+  // Blobs of uint32_t in the data section
+  const auto getUints = [&](uint64_t byteOffset,
+                            uint64_t count) -> const uint32_t * {
+    if (byteOffset % alignof(uint32_t) != 0 ||
+        !isRangeValid(
+            byteOffset, count * sizeof(uint32_t), header.data.count)) {
+      return nullptr;
+    }
+    return reinterpret_cast<const uint32_t *>(data + byteOffset);
+  };
+
+  auto &lods = derived.lods;
+  lods.clear();
+  if (header.lods.count) {
+    lods.resize(header.primitives.count);
+  }
+  for (size_t i = 0; i < header.lods.count; ++i) {
+    const auto &cached = cachedLods[i];
+    const auto indices = getUints(cached.byteOffset, cached.indexCount);
+    if (cached.primitive >= header.primitives.count || !indices ||
+        cached.level >= header.lods.count) {
+      return false;
+    }
+    auto &chain = lods[cached.primitive];
+    if (chain.size() <= cached.level) {
+      chain.resize(cached.level + 1);
+    }
+    chain[cached.level] = {
+        std::vector<uint32_t>(indices, indices + cached.indexCount),
+        cached.error};
+  }
+  // Every level of a chain is stored
+  for (const auto &chain : lods) {
+    for (const auto &lod : chain) {
+      if (lod.indices.empty()) {
+        return false;
+      }
+    }
+  }
+
+  auto &optimizedIndices = derived.optimizedIndices;
+  optimizedIndices.clear();
+  if (header.optimizedIndices.count) {
+    optimizedIndices.resize(header.primitives.count);
+  }
+  for (size_t i = 0; i < header.optimizedIndices.count; ++i) {
+    const auto &cached = cachedOptimizedIndices[i];
+    const auto indices = getUints(cached.indicesOffset, cached.indexCount);
+    const auto vertexRemap =
+        getUints(cached.vertexRemapOffset, cached.vertexCount);
+    if (cached.primitive >= header.primitives.count || !indices ||
+        !vertexRemap) {
+      return false;
+    }
+    auto &optimized = optimizedIndices[cached.primitive];
+    optimized.indices.assign(indices, indices + cached.indexCount);
+    optimized.vertexRemap.assign(vertexRemap, vertexRemap + cached.vertexCount);
+    optimized.acmrBefore = cached.acmrBefore;
+    optimized.acmrAfter = cached.acmrAfter;
+  }
+
+  auto &meshlets = derived.meshlets;
+  meshlets.clear();
+  if (header.meshlets.count) {
+    meshlets.resize(header.primitives.count);
+  }
+  for (size_t i = 0; i < header.meshlets.count; ++i) {
+    const auto &cached = cachedMeshlets[i];
+    if (cached.primitive >= header.primitives.count) {
+      return false;
+    }
+    Meshlet meshlet;
+    meshlet.firstIndex = cached.firstIndex;
+    meshlet.indexCount = cached.indexCount;
+    meshlet.bboxMin = glm::make_vec3(cached.bboxMin);
+    meshlet.bboxMax = glm::make_vec3(cached.bboxMax);
+    meshlet.coneAxis = glm::make_vec3(cached.coneAxis);
+    meshlet.coneCutoff = cached.coneCutoff;
+    meshlets[cached.primitive].push_back(meshlet);
+  }
+
+  derived.pvs = PotentiallyVisibleSets();
+  if (header.pvsGrids.count) {
+    const auto &cached = pvsGrids[0];
+    PotentiallyVisibleSets::Grid grid;
+    grid.origin = glm::make_vec3(cached.origin);
+    grid.cellSize = cached.cellSize;
+    grid.cellCounts = glm::make_vec3(cached.cellCounts);
+    if (!isRangeValid(cached.byteOffset, cached.byteLength,
+            header.data.count) ||
+        header.pvsCells.count != uint64_t(grid.cellCounts.x) *
+                                     grid.cellCounts.y * grid.cellCounts.z) {
+      return false;
+    }
+    // Sets out of the blob are rejected by findVisibleDraws
+    const auto sets = data + cached.byteOffset;
+    derived.pvs = PotentiallyVisibleSets(grid, cached.drawCount,
+        {pvsCells, pvsCells + header.pvsCells.count},
+        {sets, sets + cached.byteLength});
+  }
+
+  buffers = {BufferSpan{data, size_t(header.data.count)}};
+  bboxMin = glm::make_vec3(header.bboxMin);
+  bboxMax = glm::make_vec3(header.bboxMax);
+  touchCacheEntry(cachePath);
+  return true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "gltf.hpp"
+#include "index_optimizer.hpp"
+#include "mapped_file.hpp"
+#include "mesh_lods.hpp"
+#include "meshlets.hpp"
+#include "pvs.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary scene cache (.gltfcache)
+//
+// The cache stores what the viewer needs to render the default scene of a glTF
+// file, ready to be uploaded:
+// - the bufferViews referenced by mesh primitives, packed in a single aligned
+// data blob,
+// - accessors and mesh primitives,
+// - mesh nodes flattened to world matrices (no hierarchy),
+// - the scene bounds,
+// - decoded images,
+// - the geometry derived from primitives at import, if any, and the
+// potentially visible sets baked offline (see DerivedGeometry).
+// Reading a cache memory maps it and rebuilds a tinygltf::Model whose single
+// buffer points into the mapping, so no JSON is parsed, no image decoded and
+// vertex data is uploaded straight from the file.
+//
+// Files are versioned and keyed by computeSceneCacheKey(source), a cache is
+// ignored when the key does not match.
+//
+// The data section is either stored as is, and mapped, or in chunks of
+// SCENE_CACHE_CHUNK_SIZE bytes compressed independently (see lz4.hpp) and
+// indexed by a section of their offsets. Compressed chunks are decompressed
+// in parallel on the job system into the heap, where the model buffer
+// points instead. The section is often smaller than the source file then,
+// which matters more than the decompression when reading from network
+// disks.
+
+// Bytes of the data section per compressed chunk
+const uint32_t SCENE_CACHE_CHUNK_SIZE = 256 * 1024;
+
+enum class SceneCacheCompression : uint32_t
+{
+  None = 0, // Data mapped as is
+  Lz4 = 1, // Fast, the default
+  Lz4High = 2, // Smaller and slower to write, as fast to read (archives)
+};
+
+// Geometry computed from the primitives of a model at import, in mesh order.
+// Each vector is either empty or has one element per primitive. Levels of
+// detail index the reordered vertices of optimizedIndices when both are
+// present. Potentially visible sets are over the draws of the scene instead.
+struct DerivedGeometry
+{
+  std::vector<MeshLodChain> lods; // See buildModelLods
+  std::vector<OptimizedIndices> optimizedIndices; // See optimizeModelIndices
+  // See buildModelMeshlets, over optimizedIndices when present. Kept after
+  // upload for buildIndirectDraws.
+  std::vector<std::vector<Meshlet>> meshlets;
+  // Baked by gltf-optimize --pvs only, empty otherwise
+  PotentiallyVisibleSets pvs;
+};
+
+// Key identifying the content of a source file: hash of its size, last write
+// time and first bytes. Computing it does not read the whole file.
+uint64_t computeSceneCacheKey(const fs::path &sourcePath);
+
+// Default location of the cache of a source file: the entry of its sourceKey
+// (see computeSceneCacheKey) in cacheDirectory, shared by the viewer
+// processes whatever the path of the file (see shared_cache.hpp). The
+// directory of the asset may be read-only: an empty cacheDirectory is the
+// "gltf-viewer" directory of the temporary directory.
+fs::path getSceneCachePath(uint64_t sourceKey, const fs::path &cacheDirectory);
+
+// Return false if the model cannot be represented in the cache (sparse
+// accessors, animations, skins, morph targets, lights or material variants
+// are not supported)
+bool canWriteSceneCache(const tinygltf::Model &model);
+
+// Write the cache of the default scene of model, whose bounds are [bboxMin,
+// bboxMax] (see computeSceneBounds), along with its derived geometry. The
+// file is written in a temporary file renamed at the end so that readers never
+// see partial files.
+bool writeSceneCache(const fs::path &cachePath, uint64_t sourceKey,
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax,
+    const DerivedGeometry &derived, std::string &err,
+    SceneCacheCompression compression = SceneCacheCompression::Lz4);
+
+// Read a cache written by writeSceneCache. Return false if the file does not
+// exist, is invalid or if its key differs from sourceKey. On success, model
+// and buffers are filled (buffers[0] points into mapping, or into
+// model.buffers[0].data if the data is compressed) as well as the scene
+// bounds and the derived geometry stored in the cache.
+bool readSceneCache(const fs::path &cachePath, uint64_t sourceKey,
+    tinygltf::Model &model, MappedFile &mapping,
+    std::vector<BufferSpan> &buffers, glm::vec3 &bboxMin, glm::vec3 &bboxMax,
+    DerivedGeometry &derived);
@@ -0,0 +1,396 @@
+#include "scene_hierarchy.hpp"
+#include "job_system.hpp"
+#include "transform_kernels.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+
+// Tolerance of the uniform scale test, relative to the scale
+const float UNIFORM_SCALE_TOLERANCE = 1e-4f;
+
+// True if the columns of matrix are orthogonal with the same length
+bool isUniformScale(const glm::mat3 &matrix)
+{
+  const auto scale2 = glm::dot(matrix[0], matrix[0]);
+  const auto tolerance = UNIFORM_SCALE_TOLERANCE * scale2;
+  return scale2 > 0.f &&
+         std::abs(glm::dot(matrix[1], matrix[1]) - scale2) <= tolerance &&
+         std::abs(glm::dot(matrix[2], matrix[2]) - scale2) <= tolerance &&
+         std::abs(glm::dot(matrix[0], matrix[1])) <= tolerance &&
+         std::abs(glm::dot(matrix[0], matrix[2])) <= tolerance &&
+         std::abs(glm::dot(matrix[1], matrix[2])) <= tolerance;
+}
+
+// Local transforms of the instances of a node
+struct InstanceTransforms
+{
+  std::vector<float> translations; // vec3, empty if not given
+  std::vector<float> rotations; // Quaternions x, y, z, w
+  std::vector<float> scales;
+  size_t count = 0;
+};
+
+// Decode the EXT_mesh_gpu_instancing attributes of node, return false if the
+// node has no mesh, no instances or invalid attributes
+bool readInstanceTransforms(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const tinygltf::Node &node,
+    InstanceTransforms &instances)
+{
+  const auto it = node.extensions.find("EXT_mesh_gpu_instancing");
+  if (node.mesh < 0 || it == end(node.extensions) || !it->second.IsObject()) {
+    return false;
+  }
+  const auto &attributes = it->second.Get("attributes");
+  if (!attributes.IsObject()) {
+    return false;
+  }
+
+  instances = InstanceTransforms{};
+  auto hasCount = false;
+  const auto readAttribute = [&](const char *name, int type,
+                                 size_t componentCount,
+                                 std::vector<float> &values) {
+    const auto &value = attributes.Get(name);
+    if (!value.IsNumber()) {
+      return true;
+    }
+    const auto accessorIdx = int(value.GetNumberAsInt());
+    if (accessorIdx < 0 || size_t(accessorIdx) >= model.accessors.size()) {
+      return false;
+    }
+    const auto &accessor = model.accessors[accessorIdx];
+    // Every attribute must have the same count
+    if (accessor.type != type ||
+        (hasCount && accessor.count != instances.count)) {
+      return false;
+    }
+    hasCount = true;
+    instances.count = accessor.count;
+    values.resize(accessor.count * componentCount);
+    readAccessorAsFloats(
+        model, buffers, accessor, componentCount, values.data());
+    return true;
+  };
+  return readAttribute("TRANSLATION", TINYGLTF_TYPE_VEC3, 3,
+             instances.translations) &&
+         readAttribute(
+             "ROTATION", TINYGLTF_TYPE_VEC4, 4, instances.rotations) &&
+         readAttribute("SCALE", TINYGLTF_TYPE_VEC3, 3, instances.scales) &&
+         instances.count > 0;
+}
+
+} // namespace
+
+SceneHierarchy::SceneHierarchy(const tinygltf::Model &model) :
+    SceneHierarchy(model, getBufferSpans(model))
+{
+}
+
+SceneHierarchy::SceneHierarchy(
+    const tinygltf::Model &model, const std::vector<BufferSpan> &buffers)
+{
+  if (model.defaultScene < 0 ||
+      size_t(model.defaultScene) >= model.scenes.size()) {
+    return;
+  }
+
+  m_nodeToFlatIndex.assign(model.nodes.size(), -1);
+
+  // Breadth first traversal, m_nodes is used as the queue. Instances are
+  // pushed after the children of their node: instanceOf[idx] is the index in
+  // instances of the transforms of instance idx (-1 for glTF nodes) and
+  // instanceIndices[idx] its index in these transforms.
+  std::vector<InstanceTransforms> instances;
+  std::vector<int> instanceOf;
+  std::vector<size_t> instanceIndices;
+  const auto pushNode = [&](int nodeIdx, int parentIdx) {
+    if (m_nodeToFlatIndex[nodeIdx] >= 0) {
+      return; // Invalid glTF, a node cannot have several parents
+    }
+    m_nodeToFlatIndex[nodeIdx] = int(m_nodes.size());
+    m_nodes.push_back(nodeIdx);
+    m_parents.push_back(parentIdx);
+    instanceOf.push_back(-1);
+    instanceIndices.push_back(0);
+  };
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    pushNode(nodeIdx, -1);
+  }
+  for (size_t idx = 0; idx < m_nodes.size(); ++idx) {
+    if (instanceOf[idx] >= 0) {
+      continue; // Instances have no children
+    }
+    const auto &node = model.nodes[m_nodes[idx]];
+    for (const auto childIdx : node.children) {
+      pushNode(childIdx, int(idx));
+    }
+    InstanceTransforms nodeInstances;
+    if (!readInstanceTransforms(model, buffers, node, nodeInstances)) {
+      continue;
+    }
+    for (size_t i = 0; i < nodeInstances.count; ++i) {
+      m_nodes.push_back(m_nodes[idx]);
+      m_parents.push_back(int(idx));
+      instanceOf.push_back(int(instances.size()));
+      instanceIndices.push_back(i);
+    }
+    instances.emplace_back(std::move(nodeInstances));
+  }
+
+  const auto count = m_nodes.size();
+
+  // Breadth first order sorts nodes by depth
+  std::vector<size_t> depths(count, 0);
+  m_levelOffsets.push_back(0);
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (m_parents[idx] >= 0) {
+      depths[idx] = depths[m_parents[idx]] + 1;
+    }
+    if (depths[idx] + 1 > m_levelOffsets.size()) {
+      m_levelOffsets.push_back(idx);
+    }
+  }
+  m_levelOffsets.push_back(count);
+  m_meshes.resize(count);
+  m_translations.assign(count, glm::vec3(0));
+  m_rotations.assign(count, glm::quat(1, 0, 0, 0));
+  m_scales.assign(count, glm::vec3(1));
+  m_localMatrices.assign(count, glm::mat4(1));
+  m_hasLocalMatrix.assign(count, 0);
+  m_localOrigins.assign(count, glm::dvec3(0));
+  m_worldMatrices.resize(count);
+  m_worldOrigins.resize(count);
+  m_normalMatrices.resize(count);
+  m_hasUniformScale.resize(count);
+  m_isDirty.assign(count, 1);
+  m_dirtyNodes.resize(count);
+  std::iota(begin(m_dirtyNodes), end(m_dirtyNodes), uint32_t(0));
+  m_hasDirtyNodes = true;
+
+  // The mesh of an instanced node is drawn by its instances
+  for (size_t idx = 0; idx < count; ++idx) {
+    m_meshes[idx] = model.nodes[m_nodes[idx]].mesh;
+    if (instanceOf[idx] >= 0) {
+      m_meshes[m_parents[idx]] = -1;
+    }
+  }
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (m_meshes[idx] >= 0) {
+      m_meshNodes.push_back(uint32_t(idx));
+    }
+  }
+
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (instanceOf[idx] >= 0) {
+      const auto &transforms = instances[instanceOf[idx]];
+      const auto i = instanceIndices[idx];
+      if (!transforms.translations.empty()) {
+        m_translations[idx] = glm::make_vec3(&transforms.translations[3 * i]);
+        m_localOrigins[idx] = glm::dvec3(m_translations[idx]);
+      }
+      if (!transforms.rotations.empty()) {
+        const auto rotation = &transforms.rotations[4 * i];
+        m_rotations[idx] =
+            glm::quat(rotation[3], rotation[0], rotation[1], rotation[2]);
+      }
+      if (!transforms.scales.empty()) {
+        m_scales[idx] = glm::make_vec3(&transforms.scales[3 * i]);
+      }
+      continue;
+    }
+
+    const auto &node = model.nodes[m_nodes[idx]];
+    // https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md#transformations
+    if (node.matrix.size() == 16) {
+      for (size_t i = 0; i < 16; ++i) {
+        glm::value_ptr(m_localMatrices[idx])[i] = float(node.matrix[i]);
+      }
+      m_localOrigins[idx] =
+          glm::dvec3(node.matrix[12], node.matrix[13], node.matrix[14]);
+      m_hasLocalMatrix[idx] = 1;
+      continue;
+    }
+    if (node.translation.size() == 3) {
+      m_localOrigins[idx] = glm::dvec3(node.translation[0],
+          node.translation[1], node.translation[2]);
+      m_translations[idx] = glm::vec3(m_localOrigins[idx]);
+    }
+    if (node.rotation.size() == 4) {
+      // glTF order is x, y, z, w and glm::quat prototype is w, x, y, z
+      m_rotations[idx] = glm::quat(float(node.rotation[3]),
+          float(node.rotation[0]), float(node.rotation[1]),
+          float(node.rotation[2]));
+    }
+    if (node.scale.size() == 3) {
+      m_scales[idx] = glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
+    }
+  }
+
+  update();
+}
+
+int SceneHierarchy::findNode(int nodeIdx) const
+{
+  if (nodeIdx < 0 || size_t(nodeIdx) >= m_nodeToFlatIndex.size()) {
+    return -1;
+  }
+  return m_nodeToFlatIndex[nodeIdx];
+}
+
+void SceneHierarchy::setTranslation(size_t idx, const glm::vec3 &translation)
+{
+  m_translations[idx] = translation;
+  m_localOrigins[idx] = glm::dvec3(translation);
+  m_hasLocalMatrix[idx] = 0;
+  markDirty(idx);
+}
+
+void SceneHierarchy::setRotation(size_t idx, const glm::quat &rotation)
+{
+  m_rotations[idx] = rotation;
+  m_hasLocalMatrix[idx] = 0;
+  markDirty(idx);
+}
+
+void SceneHierarchy::setScale(size_t idx, const glm::vec3 &scale)
+{
+  m_scales[idx] = scale;
+  m_hasLocalMatrix[idx] = 0;
+  markDirty(idx);
+}
+
+void SceneHierarchy::setLocalMatrix(size_t idx, const glm::mat4 &localMatrix)
+{
+  m_localMatrices[idx] = localMatrix;
+  m_localOrigins[idx] = glm::dvec3(glm::vec3(localMatrix[3]));
+  m_hasLocalMatrix[idx] = 1;
+  markDirty(idx);
+}
+
+void SceneHierarchy::updateRange(size_t begin, size_t end)
+{
+  for (size_t idx = begin; idx < end; ++idx) {
+    const auto parentIdx = m_parents[idx];
+    // Parents are in previous levels, so their flag is final here
+    if (parentIdx >= 0 && m_isDirty[parentIdx]) {
+      m_isDirty[idx] = 1;
+    }
+    if (m_isDirty[idx] && !m_hasLocalMatrix[idx]) {
+      const auto T = glm::translate(glm::mat4(1), m_translations[idx]);
+      const auto TR = T * glm::mat4_cast(m_rotations[idx]);
+      m_localMatrices[idx] = glm::scale(TR, m_scales[idx]);
+    }
+  }
+
+  // Siblings are contiguous in breadth first order: the world matrices of a
+  // run of dirty siblings are computed in one batch
+  for (size_t idx = begin; idx < end;) {
+    if (!m_isDirty[idx]) {
+      ++idx;
+      continue;
+    }
+    const auto parentIdx = m_parents[idx];
+    auto runEnd = idx + 1;
+    while (runEnd < end && m_isDirty[runEnd] &&
+           m_parents[runEnd] == parentIdx) {
+      ++runEnd;
+    }
+    if (parentIdx >= 0) {
+      multiplyMatrices(m_worldMatrices[parentIdx], &m_localMatrices[idx],
+          runEnd - idx, &m_worldMatrices[idx]);
+    } else {
+      std::copy(&m_localMatrices[idx], &m_localMatrices[0] + runEnd,
+          &m_worldMatrices[idx]);
+    }
+    for (; idx < runEnd; ++idx) {
+      if (parentIdx >= 0) {
+        // The far translations are added in double, rotations and scales
+        // stay in float
+        m_worldOrigins[idx] =
+            m_worldOrigins[parentIdx] +
+            glm::dmat3(glm::mat3(m_worldMatrices[parentIdx])) *
+                m_localOrigins[idx];
+      } else {
+        m_worldOrigins[idx] = m_localOrigins[idx];
+      }
+      m_worldMatrices[idx][3] = glm::vec4(glm::vec3(m_worldOrigins[idx]), 1);
+      updateNormalMatrix(idx);
+    }
+  }
+}
+
+void SceneHierarchy::updateNormalMatrix(size_t idx)
+{
+  const auto matrix = glm::mat3(m_worldMatrices[idx]);
+  const auto hasUniformScale = isUniformScale(matrix);
+  m_hasUniformScale[idx] = hasUniformScale ? 1 : 0;
+  m_normalMatrices[idx] =
+      hasUniformScale ? matrix : glm::transpose(glm::inverse(matrix));
+}
+
+bool SceneHierarchy::update()
+{
+  if (!m_hasDirtyNodes) {
+    return false;
+  }
+
+  // Nodes of a level only depend on the previous level, so each level is
+  // split between threads
+  auto &jobSystem = getJobSystem();
+  for (size_t level = 0; level + 1 < m_levelOffsets.size(); ++level) {
+    const auto levelBegin = m_levelOffsets[level];
+    const auto levelSize = m_levelOffsets[level + 1] - levelBegin;
+    jobSystem.parallelFor(levelSize, jobSystem.getGrainSize(levelSize, 1024),
+        [&](size_t begin, size_t end) {
+          updateRange(levelBegin + begin, levelBegin + end);
+        });
+  }
+
+  // The flags left by updateRange are those of the recomputed nodes
+  m_changedNodes.swap(m_dirtyNodes);
+  m_dirtyNodes.clear();
+  std::sort(begin(m_changedNodes), end(m_changedNodes));
+  m_updatedNodes.clear();
+  for (size_t idx = 0; idx < m_isDirty.size(); ++idx) {
+    if (m_isDirty[idx]) {
+      m_updatedNodes.push_back(uint32_t(idx));
+      m_isDirty[idx] = 0;
+    }
+  }
+  m_hasDirtyNodes = false;
+  return true;
+}
+
+void SceneHierarchy::setWorldMatrices(
+    const std::vector<glm::mat4> &worldMatrices,
+    const std::vector<glm::dvec3> *worldOrigins)
+{
+  if (worldMatrices.size() != m_worldMatrices.size()) {
+    return;
+  }
+  if (worldOrigins && worldOrigins->size() == m_worldOrigins.size()) {
+    std::copy(begin(*worldOrigins), end(*worldOrigins),
+        begin(m_worldOrigins));
+  } else {
+    for (size_t idx = 0; idx < worldMatrices.size(); ++idx) {
+      m_worldOrigins[idx] = glm::dvec3(glm::vec3(worldMatrices[idx][3]));
+    }
+  }
+  // Only the normal matrices of the nodes that moved are recomputed
+  m_changedNodes.clear();
+  m_updatedNodes.clear();
+  for (size_t idx = 0; idx < worldMatrices.size(); ++idx) {
+    if (worldMatrices[idx] != m_worldMatrices[idx]) {
+      m_worldMatrices[idx] = worldMatrices[idx];
+      updateNormalMatrix(idx);
+      m_updatedNodes.push_back(uint32_t(idx));
+    }
+  }
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Transform hierarchy of the default scene of a glTF model, flattened once at
+// load time so that it can be traversed without recursion.
+//
+// Nodes are stored in breadth first order, so a parent always comes before
+// its children, with their local transform in float SoA arrays
+// (translations, rotations, scales) and their world matrices in a contiguous
+// array. update() recomputes world matrices in a linear pass, only for nodes
+// whose transform changed and their descendants. Each depth level is split
+// between the threads of the job system. The normal matrix of each node is
+// kept next to its world matrix and recomputed with it, so that drawing
+// inverts no matrix.
+//
+// World translations are also accumulated in double precision from the
+// double translations of the glTF file (see worldOrigin), so that models
+// with large coordinates (e.g. georeferenced ones, millions of meters from
+// the origin) can be drawn relative to the camera without float jitter.
+//
+// Indices used by this class are flat indices (in [0, size())), use
+// findNode() to get the flat index of a glTF node.
+//
+// The instances of a node with the EXT_mesh_gpu_instancing extension are
+// flattened as extra children of the node, one per instance, with the
+// instance transform as local transform. The mesh moves to the instances:
+// the node itself has no mesh and node() of an instance is the node.
+class SceneHierarchy
+{
+public:
+  SceneHierarchy() = default;
+
+  // Flatten the default scene of model (empty if there is none)
+  explicit SceneHierarchy(const tinygltf::Model &model);
+
+  // Same as above, but read instance transforms through buffers (see
+  // BufferSpan)
+  SceneHierarchy(
+      const tinygltf::Model &model, const std::vector<BufferSpan> &buffers);
+
+  size_t size() const { return m_parents.size(); }
+
+  bool empty() const { return m_parents.empty(); }
+
+  // Flat index of the parent of a node, -1 for root nodes
+  int parent(size_t idx) const { return m_parents[idx]; }
+
+  // Index of the node in model.nodes (of the instanced node for instances)
+  int node(size_t idx) const { return m_nodes[idx]; }
+
+  // Index of the mesh of the node in model.meshes, -1 if it has none
+  int mesh(size_t idx) const { return m_meshes[idx]; }
+
+  // Flat indices of nodes having a mesh
+  const std::vector<uint32_t> &meshNodes() const { return m_meshNodes; }
+
+  // Flat index of model.nodes[nodeIdx], -1 if it is not in the scene
+  int findNode(int nodeIdx) const;
+
+  const glm::mat4 &worldMatrix(size_t idx) const
+  {
+    return m_worldMatrices[idx];
+  }
+
+  const std::vector<glm::mat4> &worldMatrices() const
+  {
+    return m_worldMatrices;
+  }
+
+  // Translation of the world matrix in double precision, the translation
+  // of worldMatrix(idx) is its float rounding
+  const glm::dvec3 &worldOrigin(size_t idx) const
+  {
+    return m_worldOrigins[idx];
+  }
+
+  const std::vector<glm::dvec3> &worldOrigins() const
+  {
+    return m_worldOrigins;
+  }
+
+  // Normal matrix of the world matrix up to a positive factor, which
+  // shaders remove by normalizing normals: the 3x3 part of the world matrix
+  // if hasUniformScale(idx), its inverse transpose otherwise
+  const glm::mat3 &normalMatrix(size_t idx) const
+  {
+    return m_normalMatrices[idx];
+  }
+
+  const std::vector<glm::mat3> &normalMatrices() const
+  {
+    return m_normalMatrices;
+  }
+
+  // True if the world matrix is a rotation, possibly mirrored, times a
+  // uniform scale: its 3x3 part then transforms normals as well
+  bool hasUniformScale(size_t idx) const
+  {
+    return m_hasUniformScale[idx] != 0;
+  }
+
+  const glm::vec3 &translation(size_t idx) const
+  {
+    return m_translations[idx];
+  }
+
+  const glm::quat &rotation(size_t idx) const { return m_rotations[idx]; }
+
+  const glm::vec3 &scale(size_t idx) const { return m_scales[idx]; }
+
+  // Local matrix as of the last update()
+  const glm::mat4 &localMatrix(size_t idx) const
+  {
+    return m_localMatrices[idx];
+  }
+
+  // True if the local transform is a matrix of the glTF file, which TRS
+  // values do not describe
+  bool hasLocalMatrix(size_t idx) const { return m_hasLocalMatrix[idx] != 0; }
+
+  // Index of the first node of each depth level, followed by size(): the
+  // parents of level l are in level l - 1
+  const std::vector<size_t> &levelOffsets() const { return m_levelOffsets; }
+
+  // Setters of the local transform, they take effect on the next update().
+  // Setting a TRS component of a node defined by a matrix in the glTF file
+  // replaces its matrix by its TRS values.
+  void setTranslation(size_t idx, const glm::vec3 &translation);
+  void setRotation(size_t idx, const glm::quat &rotation);
+  void setScale(size_t idx, const glm::vec3 &scale);
+  void setLocalMatrix(size_t idx, const glm::mat4 &localMatrix);
+
+  // Recompute world matrices of modified nodes and of their descendants.
+  // Return true if any world matrix changed.
+  bool update();
+
+  // Flat indices of the nodes whose local transform was set before the last
+  // update() that returned true, in increasing order
+  const std::vector<uint32_t> &changedNodes() const { return m_changedNodes; }
+
+  // Flat indices of the nodes whose world matrix was recomputed by the last
+  // update() that returned true (the changed nodes and their descendants),
+  // or replaced by the last setWorldMatrices(), in increasing order. Lets
+  // copies of the world matrices (e.g. on the GPU, see GpuTransformHierarchy)
+  // be updated in proportion to what moved rather than to the scene size.
+  const std::vector<uint32_t> &updatedNodes() const { return m_updatedNodes; }
+
+  // Replace the world matrices by those of a copy of this hierarchy updated
+  // elsewhere (e.g. on another thread, see PoseSimulation), with its world
+  // origins if they are given (else those of the float matrices). Local
+  // transforms are left as they are.
+  void setWorldMatrices(const std::vector<glm::mat4> &worldMatrices,
+      const std::vector<glm::dvec3> *worldOrigins = nullptr);
+
+private:
+  // Update world matrices of nodes [begin, end) of a single level
+  void updateRange(size_t begin, size_t end);
+
+  // Recompute the normal matrix of a node from its world matrix
+  void updateNormalMatrix(size_t idx);
+
+  void markDirty(size_t idx)
+  {
+    if (!m_isDirty[idx]) {
+      m_isDirty[idx] = 1;
+      m_dirtyNodes.push_back(uint32_t(idx));
+    }
+    m_hasDirtyNodes = true;
+  }
+
+  std::vector<int> m_parents;
+  std::vector<int> m_nodes;
+  std::vector<int> m_meshes;
+  std::vector<uint32_t> m_meshNodes;
+  std::vector<int> m_nodeToFlatIndex; // Indexed by glTF node
+  // Index of the first node of each depth level, followed by size()
+  std::vector<size_t> m_levelOffsets;
+
+  std::vector<glm::vec3> m_translations;
+  std::vector<glm::quat> m_rotations;
+  std::vector<glm::vec3> m_scales;
+  // Local matrices, computed from TRS unless m_hasLocalMatrix is set
+  std::vector<glm::mat4> m_localMatrices;
+  std::vector<uint8_t> m_hasLocalMatrix;
+  // Translations of the local transforms in double precision
+  std::vector<glm::dvec3> m_localOrigins;
+
+  std::vector<glm::mat4> m_worldMatrices;
+  std::vector<glm::dvec3> m_worldOrigins;
+  std::vector<glm::mat3> m_normalMatrices;
+  std::vector<uint8_t> m_hasUniformScale;
+  std::vector<uint8_t> m_isDirty;
+  std::vector<uint32_t> m_dirtyNodes; // Set since the last update()
+  bool m_hasDirtyNodes = false;
+  std::vector<uint32_t> m_changedNodes;
+  std::vector<uint32_t> m_updatedNodes;
+};
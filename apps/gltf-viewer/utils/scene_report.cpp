@@ -0,0 +1,387 @@
+#include "scene_report.hpp"
+#include "textures.hpp"
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <utility>
+
+#include <json.hpp>
+
+namespace
+{
+
+enum BufferViewUse : uint8_t
+{
+  UNUSED,
+  INDICES,
+  VERTICES,
+  ANIMATION
+};
+
+std::string getObjectPath(const char *array, size_t idx)
+{
+  return std::string(array) + "[" + std::to_string(idx) + "]";
+}
+
+void addIssue(SceneReport &report, const char *type, std::string object,
+    std::string message)
+{
+  report.issues.push_back({type, std::move(object), std::move(message)});
+}
+
+bool isPowerOfTwo(int size) { return size > 0 && !(size & (size - 1)); }
+
+size_t getTriangleCount(int mode, size_t indexCount)
+{
+  switch (mode) {
+  case TINYGLTF_MODE_TRIANGLES:
+    return indexCount / 3;
+  case TINYGLTF_MODE_TRIANGLE_STRIP:
+  case TINYGLTF_MODE_TRIANGLE_FAN:
+    return indexCount > 2 ? indexCount - 2 : 0;
+  default:
+    return 0;
+  }
+}
+
+// Vertices of primitive, 0 if it has no position
+size_t getVertexCount(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  const auto it = primitive.attributes.find("POSITION");
+  if (it == end(primitive.attributes) || it->second < 0 ||
+      size_t(it->second) >= model.accessors.size()) {
+    return 0;
+  }
+  return model.accessors[it->second].count;
+}
+
+// Indices drawn by primitive, its vertices if it is not indexed
+size_t getIndexCount(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  if (primitive.indices >= 0 &&
+      size_t(primitive.indices) < model.accessors.size()) {
+    return model.accessors[primitive.indices].count;
+  }
+  return getVertexCount(model, primitive);
+}
+
+void markBufferView(const tinygltf::Model &model, int accessorIdx,
+    BufferViewUse use, std::vector<BufferViewUse> &uses)
+{
+  if (accessorIdx < 0 || size_t(accessorIdx) >= model.accessors.size()) {
+    return;
+  }
+  const auto bufferView = model.accessors[accessorIdx].bufferView;
+  if (bufferView >= 0 && size_t(bufferView) < uses.size() &&
+      (uses[bufferView] == UNUSED || use < uses[bufferView])) {
+    uses[bufferView] = use;
+  }
+}
+
+void reportBytes(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, SceneReport &report)
+{
+  std::vector<BufferViewUse> uses(model.bufferViews.size(), UNUSED);
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      markBufferView(model, primitive.indices, INDICES, uses);
+      for (const auto &attribute : primitive.attributes) {
+        markBufferView(model, attribute.second, VERTICES, uses);
+      }
+      for (const auto &target : primitive.targets) {
+        for (const auto &attribute : target) {
+          markBufferView(model, attribute.second, VERTICES, uses);
+        }
+      }
+    }
+  }
+  for (const auto &animation : model.animations) {
+    for (const auto &sampler : animation.samplers) {
+      markBufferView(model, sampler.input, ANIMATION, uses);
+      markBufferView(model, sampler.output, ANIMATION, uses);
+    }
+  }
+  for (const auto &skin : model.skins) {
+    markBufferView(model, skin.inverseBindMatrices, ANIMATION, uses);
+  }
+  for (size_t i = 0; i < model.bufferViews.size(); ++i) {
+    const auto byteLength = model.bufferViews[i].byteLength;
+    switch (uses[i]) {
+    case INDICES:
+      report.indexBytes += byteLength;
+      break;
+    case VERTICES:
+      report.vertexBytes += byteLength;
+      break;
+    case ANIMATION:
+      report.animationBytes += byteLength;
+      break;
+    default:
+      report.otherBytes += byteLength;
+    }
+  }
+  for (const auto &buffer : buffers) {
+    report.bufferBytes += buffer.size;
+  }
+}
+
+void reportMeshes(const tinygltf::Model &model, SceneReport &report)
+{
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    const auto &primitives = model.meshes[meshIdx].primitives;
+    report.primitiveCount += primitives.size();
+    for (size_t pIdx = 0; pIdx < primitives.size(); ++pIdx) {
+      const auto &primitive = primitives[pIdx];
+      const auto vertexCount = getVertexCount(model, primitive);
+      report.vertexCount += vertexCount;
+      const auto object = getObjectPath("meshes", meshIdx) +
+                          getObjectPath(".primitives", pIdx);
+      if (primitive.indices < 0 &&
+          getTriangleCount(primitive.mode, vertexCount)) {
+        addIssue(report, "unindexed-primitive", object,
+            std::to_string(vertexCount) +
+                " vertices drawn without indices, shared vertices are "
+                "transformed again");
+        continue;
+      }
+      if (primitive.indices >= 0 &&
+          size_t(primitive.indices) < model.accessors.size() &&
+          model.accessors[primitive.indices].componentType ==
+              TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT &&
+          vertexCount <= 65536) {
+        addIssue(report, "wide-indices", object,
+            "32-bit indices of " + std::to_string(vertexCount) +
+                " vertices would fit in 16 bits");
+      }
+    }
+  }
+}
+
+void reportImages(const tinygltf::Model &model,
+    const SceneReportLimits &limits, SceneReport &report)
+{
+  for (size_t imageIdx = 0; imageIdx < model.images.size(); ++imageIdx) {
+    const auto &image = model.images[imageIdx];
+    report.imageBytes += image.image.size();
+    const auto object = getObjectPath("images", imageIdx);
+    const auto size =
+        std::to_string(image.width) + "x" + std::to_string(image.height);
+    if (image.width <= 0 || image.height <= 0) {
+      continue; // Not loaded
+    }
+    if (uint32_t(std::max(image.width, image.height)) > limits.maxImageSize) {
+      addIssue(report, "huge-image", object,
+          size + " pixels, more than " + std::to_string(limits.maxImageSize));
+    }
+    if (!isPowerOfTwo(image.width) || !isPowerOfTwo(image.height)) {
+      addIssue(report, "non-power-of-two-image", object,
+          size + " pixels, mipmaps of odd sizes are filtered unevenly");
+    }
+    if (isKtx2Image(image)) {
+      report.textureBytes += image.image.size();
+      continue;
+    }
+    // Expanded to 4 components, mipmaps add a third
+    const auto levelBytes = size_t(image.width) * size_t(image.height) * 4 *
+                            size_t(std::max(image.bits, 8) / 8);
+    report.textureBytes += levelBytes + levelBytes / 3;
+    addIssue(report, "uncompressed-image", object,
+        size + " pixels uploaded uncompressed, KTX2 would take " +
+            "4 to 8 times less memory");
+  }
+}
+
+// Tell materials apart by a few members first, those with the same key are
+// then compared fully
+using MaterialKey = std::tuple<std::string, bool, int, int, int,
+    std::vector<double>>;
+
+MaterialKey getMaterialKey(const tinygltf::Material &material)
+{
+  const auto &pbr = material.pbrMetallicRoughness;
+  return MaterialKey{material.alphaMode, material.doubleSided,
+      pbr.baseColorTexture.index, pbr.metallicRoughnessTexture.index,
+      material.normalTexture.index, pbr.baseColorFactor};
+}
+
+void reportMaterials(const tinygltf::Model &model, SceneReport &report)
+{
+  std::map<MaterialKey, std::vector<size_t>> materialsByKey;
+  for (size_t materialIdx = 0; materialIdx < model.materials.size();
+       ++materialIdx) {
+    auto material = model.materials[materialIdx];
+    material.name.clear();
+    auto &candidates = materialsByKey[getMaterialKey(material)];
+    const auto duplicate = std::find_if(
+        begin(candidates), end(candidates), [&](size_t candidateIdx) {
+          auto candidate = model.materials[candidateIdx];
+          candidate.name.clear();
+          return candidate == material;
+        });
+    if (duplicate == end(candidates)) {
+      candidates.push_back(materialIdx);
+      continue;
+    }
+    addIssue(report, "redundant-material",
+        getObjectPath("materials", materialIdx),
+        "Same as " + getObjectPath("materials", *duplicate) +
+            ", their draws are sorted and batched apart");
+  }
+}
+
+void reportScenes(const tinygltf::Model &model,
+    const SceneReportLimits &limits, SceneReport &report)
+{
+  // Roots of the scenes, or of the node trees if the model has no scene
+  std::vector<int> roots;
+  for (const auto &scene : model.scenes) {
+    roots.insert(end(roots), begin(scene.nodes), end(scene.nodes));
+  }
+  if (model.scenes.empty()) {
+    std::vector<bool> isChild(model.nodes.size(), false);
+    for (const auto &node : model.nodes) {
+      for (const auto childIdx : node.children) {
+        if (childIdx >= 0 && size_t(childIdx) < isChild.size()) {
+          isChild[childIdx] = true;
+        }
+      }
+    }
+    for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+      if (!isChild[nodeIdx]) {
+        roots.push_back(int(nodeIdx));
+      }
+    }
+  }
+  std::vector<std::pair<int, size_t>> nodeStack; // Node and depth
+  std::vector<bool> isVisited(model.nodes.size(), false);
+  int deepestNode = -1;
+  for (const auto root : roots) {
+    nodeStack.emplace_back(root, 1);
+    while (!nodeStack.empty()) {
+      const auto nodeIdx = nodeStack.back().first;
+      const auto depth = nodeStack.back().second;
+      nodeStack.pop_back();
+      // Nodes of several scenes are only reached once
+      if (nodeIdx < 0 || size_t(nodeIdx) >= model.nodes.size() ||
+          isVisited[nodeIdx]) {
+        continue;
+      }
+      isVisited[nodeIdx] = true;
+      if (depth > report.hierarchyDepth) {
+        report.hierarchyDepth = depth;
+        deepestNode = nodeIdx;
+      }
+      for (const auto childIdx : model.nodes[nodeIdx].children) {
+        nodeStack.emplace_back(childIdx, depth + 1);
+      }
+    }
+  }
+  if (report.hierarchyDepth > limits.maxHierarchyDepth) {
+    addIssue(report, "deep-hierarchy", getObjectPath("nodes", deepestNode),
+        "At depth " + std::to_string(report.hierarchyDepth) +
+            ", more than " + std::to_string(limits.maxHierarchyDepth) +
+            " matrices are multiplied to place it");
+  }
+
+  // Draws of the default scene
+  const auto sceneIdx = model.defaultScene >= 0 ? model.defaultScene : 0;
+  if (size_t(sceneIdx) >= model.scenes.size()) {
+    return;
+  }
+  std::vector<int> stack = model.scenes[sceneIdx].nodes;
+  std::fill(begin(isVisited), end(isVisited), false);
+  while (!stack.empty()) {
+    const auto nodeIdx = stack.back();
+    stack.pop_back();
+    if (nodeIdx < 0 || size_t(nodeIdx) >= model.nodes.size() ||
+        isVisited[nodeIdx]) {
+      continue;
+    }
+    isVisited[nodeIdx] = true;
+    const auto &node = model.nodes[nodeIdx];
+    if (node.mesh >= 0 && size_t(node.mesh) < model.meshes.size()) {
+      for (const auto &primitive : model.meshes[node.mesh].primitives) {
+        ++report.drawCount;
+        report.triangleCount += getTriangleCount(
+            primitive.mode, getIndexCount(model, primitive));
+      }
+    }
+    stack.insert(end(stack), begin(node.children), end(node.children));
+  }
+  if (report.drawCount > limits.maxDrawCount) {
+    addIssue(report, "excessive-draws", getObjectPath("scenes", sceneIdx),
+        std::to_string(report.drawCount) + " draws, more than " +
+            std::to_string(limits.maxDrawCount) +
+            ": merge static nodes or instance repeated meshes");
+  }
+}
+
+} // namespace
+
+SceneReport buildSceneReport(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const SceneReportLimits &limits)
+{
+  SceneReport report;
+  report.sceneCount = model.scenes.size();
+  report.nodeCount = model.nodes.size();
+  report.meshCount = model.meshes.size();
+  report.materialCount = model.materials.size();
+  report.textureCount = model.textures.size();
+  report.imageCount = model.images.size();
+  report.animationCount = model.animations.size();
+  report.skinCount = model.skins.size();
+  report.lightCount = model.lights.size();
+  report.cameraCount = model.cameras.size();
+  reportBytes(model, buffers, report);
+  reportMeshes(model, report);
+  reportImages(model, limits, report);
+  reportMaterials(model, report);
+  reportScenes(model, limits, report);
+  return report;
+}
+
+bool buildSceneReport(const fs::path &path, const SceneReportLimits &limits,
+    SceneReport &report, std::string &err)
+{
+  tinygltf::Model model;
+  std::vector<BufferSpan> buffers;
+  std::string warn;
+  if (!readGltfFile(path, model, buffers, err, warn)) {
+    return false;
+  }
+  report = buildSceneReport(model, buffers, limits);
+  report.model = path;
+  return true;
+}
+
+void writeSceneReport(std::ostream &out, const SceneReport &report)
+{
+  nlohmann::json counts = {{"scenes", report.sceneCount},
+      {"nodes", report.nodeCount}, {"meshes", report.meshCount},
+      {"primitives", report.primitiveCount},
+      {"materials", report.materialCount}, {"textures", report.textureCount},
+      {"images", report.imageCount}, {"animations", report.animationCount},
+      {"skins", report.skinCount}, {"lights", report.lightCount},
+      {"cameras", report.cameraCount}, {"draws", report.drawCount},
+      {"triangles", report.triangleCount}, {"vertices", report.vertexCount},
+      {"hierarchyDepth", report.hierarchyDepth}};
+  nlohmann::json bytes = {{"indices", report.indexBytes},
+      {"vertices", report.vertexBytes}, {"animation", report.animationBytes},
+      {"otherBufferViews", report.otherBytes},
+      {"buffers", report.bufferBytes}, {"images", report.imageBytes},
+      {"textures", report.textureBytes}};
+  auto issueCounts = nlohmann::json::object();
+  auto issues = nlohmann::json::array();
+  for (const auto &issue : report.issues) {
+    issueCounts[issue.type] = issueCounts.value(issue.type, 0) + 1;
+    issues.push_back({{"type", issue.type}, {"object", issue.object},
+        {"message", issue.message}});
+  }
+  const nlohmann::json document = {{"model", report.model.generic_string()},
+      {"counts", counts}, {"bytes", bytes}, {"issueCounts", issueCounts},
+      {"issues", issues}};
+  out << document.dump(2) << "\n";
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Statistics of a glTF model and lint of what makes it slow to load or draw,
+// written as JSON by the report command for asset gates. Only the metadata of
+// the model is read: no accessor is decoded and nothing is uploaded.
+
+// Thresholds of the issues of a SceneReport
+struct SceneReportLimits
+{
+  uint32_t maxImageSize = 4096; // Of both dimensions of an image
+  size_t maxHierarchyDepth = 32; // Of the node trees of the scenes
+  size_t maxDrawCount = 4096; // Of the default scene
+};
+
+// Performance issue of a model
+struct SceneIssue
+{
+  // Kind of issue: "unindexed-primitive", "wide-indices", "huge-image",
+  // "non-power-of-two-image", "uncompressed-image", "deep-hierarchy",
+  // "excessive-draws" or "redundant-material"
+  std::string type;
+  std::string object; // Path in the glTF document, e.g. "meshes[2]"
+  std::string message;
+};
+
+struct SceneReport
+{
+  fs::path model;
+
+  size_t sceneCount = 0;
+  size_t nodeCount = 0;
+  size_t meshCount = 0;
+  size_t primitiveCount = 0;
+  size_t materialCount = 0;
+  size_t textureCount = 0;
+  size_t imageCount = 0;
+  size_t animationCount = 0;
+  size_t skinCount = 0;
+  size_t lightCount = 0;
+  size_t cameraCount = 0;
+  // Primitives of the mesh nodes of the default scene (instanced nodes count
+  // once), their triangles, and the vertices of every primitive
+  size_t drawCount = 0;
+  size_t triangleCount = 0;
+  size_t vertexCount = 0;
+  size_t hierarchyDepth = 0; // Of the deepest node of a scene, roots are 1
+
+  // Bytes of the bufferViews by use (a bufferView counts once, in the first
+  // of these categories that reads it), the other bufferViews and the buffers
+  size_t indexBytes = 0;
+  size_t vertexBytes = 0; // Attributes and morph targets
+  size_t animationBytes = 0; // Keyframes and inverse bind matrices
+  size_t otherBytes = 0;
+  size_t bufferBytes = 0;
+  // Bytes of the images as loaded (decoded pixels or KTX2 containers), and
+  // as textures with their mipmaps
+  size_t imageBytes = 0;
+  size_t textureBytes = 0;
+
+  std::vector<SceneIssue> issues;
+};
+
+// Report the statistics and issues of model, whose buffers are buffers
+SceneReport buildSceneReport(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const SceneReportLimits &limits = {});
+
+// Load the glTF file path and report it in report. Return false and fill
+// err if it cannot be loaded.
+bool buildSceneReport(const fs::path &path, const SceneReportLimits &limits,
+    SceneReport &report, std::string &err);
+
+// Write report as a JSON object: "model", "counts", "bytes", "issueCounts"
+// (per type) and "issues"
+void writeSceneReport(std::ostream &out, const SceneReport &report);
@@ -0,0 +1,252 @@
+#include "scene_tree_panel.hpp"
+
+#include <imgui.h>
+
+#include <cstdint>
+
+bool SceneTreePanel::isOutdated(const SceneHierarchy &hierarchy) const
+{
+  return hierarchy.size() != m_isExpanded.size() ||
+         hierarchy.levelOffsets() != m_levelOffsets;
+}
+
+void SceneTreePanel::reset(const SceneHierarchy &hierarchy,
+    const std::vector<uint32_t> &drawCounts,
+    const std::vector<uint64_t> &triangleCounts)
+{
+  const auto nodeCount = hierarchy.size();
+  m_levelOffsets = hierarchy.levelOffsets();
+  m_childOffsets.assign(nodeCount + 2, 0);
+  for (size_t i = 0; i < nodeCount; ++i) {
+    const auto parent = hierarchy.parent(i);
+    ++m_childOffsets[(parent >= 0 ? size_t(parent) : nodeCount) + 1];
+  }
+  for (size_t i = 1; i < m_childOffsets.size(); ++i) {
+    m_childOffsets[i] += m_childOffsets[i - 1];
+  }
+  // Children keep the order of their flat indices
+  m_children.resize(nodeCount);
+  auto next = m_childOffsets;
+  for (size_t i = 0; i < nodeCount; ++i) {
+    const auto parent = hierarchy.parent(i);
+    m_children[next[parent >= 0 ? size_t(parent) : nodeCount]++] =
+        uint32_t(i);
+  }
+
+  // Parents are in the level before their children, so that going through
+  // the nodes backward sums the children before their parent
+  m_drawCounts.assign(nodeCount, 0);
+  m_triangleCounts.assign(nodeCount, 0);
+  for (size_t i = 0; i < nodeCount && i < drawCounts.size(); ++i) {
+    m_drawCounts[i] = drawCounts[i];
+  }
+  for (size_t i = 0; i < nodeCount && i < triangleCounts.size(); ++i) {
+    m_triangleCounts[i] = triangleCounts[i];
+  }
+  for (auto i = nodeCount; i-- > 0;) {
+    const auto parent = hierarchy.parent(i);
+    if (parent >= 0) {
+      m_drawCounts[parent] += m_drawCounts[i];
+      m_triangleCounts[parent] += m_triangleCounts[i];
+    }
+  }
+  m_gpuTimes.assign(nodeCount, -1.f);
+  m_isExpanded.assign(nodeCount, 0);
+  m_areRowsListed = false;
+  m_nIsolated = -1;
+  m_sampledNodes.clear();
+  m_nNextSample = 0;
+  m_nSampleFrame = 0;
+}
+
+void SceneTreePanel::drawGUI(const SceneHierarchy &hierarchy,
+    const tinygltf::Model &model, bool canIsolate,
+    const GpuCostAttribution *costAttribution)
+{
+  if (!m_areRowsListed) {
+    listRows();
+  }
+  if (!canIsolate) {
+    m_nIsolated = -1;
+    m_sampledNodes.clear();
+    m_nNextSample = 0;
+    ImGui::TextWrapped(
+        "Subtrees can only be isolated without indirect draws");
+  } else if (isSampling()) {
+    ImGui::Text("Sampling GPU costs: %zu / %zu", m_nNextSample,
+        m_sampledNodes.size());
+    ImGui::SameLine();
+    if (ImGui::Button("Stop")) {
+      m_sampledNodes.clear();
+      m_nNextSample = 0;
+    }
+  } else if (ImGui::Button("Sample GPU costs of the listed nodes")) {
+    m_sampledNodes.clear();
+    for (const auto &row : m_rows) {
+      m_sampledNodes.push_back(row.node);
+    }
+    m_nNextSample = 0;
+    m_nSampleFrame = 0;
+  }
+  if (m_nIsolated >= 0) {
+    ImGui::SameLine();
+    if (ImGui::Button("Show all")) {
+      m_nIsolated = -1;
+    }
+  }
+
+  const auto hasAttributedTimes =
+      costAttribution &&
+      costAttribution->buckets() == CostBuckets::TopLevelNodes;
+  ImGui::BeginChild("Scene tree nodes", ImVec2(0, 300), true);
+  ImGui::Columns(hasAttributedTimes ? 5 : 4, "Scene tree columns");
+  ImGui::Text("Node");
+  ImGui::NextColumn();
+  ImGui::Text("Triangles");
+  ImGui::NextColumn();
+  ImGui::Text("Draws");
+  ImGui::NextColumn();
+  ImGui::Text("GPU ms");
+  ImGui::NextColumn();
+  if (hasAttributedTimes) {
+    ImGui::Text("Attributed ms");
+    ImGui::NextColumn();
+  }
+  ImGui::Separator();
+
+  // Expansion changes list the rows again on the next call
+  const auto indent = ImGui::GetStyle().IndentSpacing;
+  ImGuiListClipper clipper(int(m_rows.size()));
+  while (clipper.Step()) {
+    for (auto i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+      const auto row = m_rows[size_t(i)];
+      const auto childCount =
+          m_childOffsets[row.node + 1] - m_childOffsets[row.node];
+      ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_NoTreePushOnOpen |
+                                 ImGuiTreeNodeFlags_OpenOnArrow;
+      if (!childCount) {
+        flags |= ImGuiTreeNodeFlags_Leaf;
+      }
+      if (int(row.node) == isolated()) {
+        flags |= ImGuiTreeNodeFlags_Selected;
+      }
+      if (row.depth) {
+        ImGui::Indent(float(row.depth) * indent);
+      }
+      const auto nodeIdx = hierarchy.node(row.node);
+      const auto meshIdx = hierarchy.mesh(row.node);
+      const auto *name =
+          nodeIdx >= 0 && size_t(nodeIdx) < model.nodes.size() &&
+                  !model.nodes[nodeIdx].name.empty()
+              ? model.nodes[nodeIdx].name.c_str()
+              : nullptr;
+      const auto id = reinterpret_cast<void *>(uintptr_t(row.node));
+      ImGui::SetNextItemOpen(m_isExpanded[row.node] != 0);
+      bool isOpen;
+      if (name && meshIdx >= 0) {
+        isOpen = ImGui::TreeNodeEx(id, flags, "%s (mesh %d)", name, meshIdx);
+      } else if (name) {
+        isOpen = ImGui::TreeNodeEx(id, flags, "%s", name);
+      } else if (meshIdx >= 0) {
+        isOpen = ImGui::TreeNodeEx(
+            id, flags, "Node %d (mesh %d)", nodeIdx, meshIdx);
+      } else {
+        isOpen = ImGui::TreeNodeEx(id, flags, "Node %d", nodeIdx);
+      }
+      // Clicks on the arrow only expand
+      const auto labelX =
+          ImGui::GetItemRectMin().x + ImGui::GetTreeNodeToLabelSpacing();
+      if (canIsolate && !isSampling() && ImGui::IsItemClicked() &&
+          ImGui::GetMousePos().x >= labelX) {
+        m_nIsolated = m_nIsolated == int(row.node) ? -1 : int(row.node);
+      }
+      if (row.depth) {
+        ImGui::Unindent(float(row.depth) * indent);
+      }
+      if (childCount && isOpen != (m_isExpanded[row.node] != 0)) {
+        m_isExpanded[row.node] = isOpen ? 1 : 0;
+        m_areRowsListed = false;
+      }
+      ImGui::NextColumn();
+      ImGui::Text("%llu", (unsigned long long)m_triangleCounts[row.node]);
+      ImGui::NextColumn();
+      ImGui::Text("%u", m_drawCounts[row.node]);
+      ImGui::NextColumn();
+      if (m_gpuTimes[row.node] >= 0.f) {
+        ImGui::Text("%.3f", m_gpuTimes[row.node]);
+      } else {
+        ImGui::TextDisabled("-");
+      }
+      ImGui::NextColumn();
+      if (hasAttributedTimes) {
+        const auto time = costAttribution->keyTime(row.node);
+        if (time >= 0.f) {
+          ImGui::Text("%.3f", time);
+        } else {
+          ImGui::TextDisabled("-");
+        }
+        ImGui::NextColumn();
+      }
+    }
+  }
+  ImGui::Columns(1);
+  ImGui::EndChild();
+}
+
+void SceneTreePanel::addGpuSample(float milliseconds)
+{
+  if (!isSampling() || ++m_nSampleFrame < SAMPLE_FRAME_COUNT) {
+    return;
+  }
+  const auto node = m_sampledNodes[m_nNextSample];
+  if (node < m_gpuTimes.size()) {
+    m_gpuTimes[node] = milliseconds;
+  }
+  m_nSampleFrame = 0;
+  if (++m_nNextSample == m_sampledNodes.size()) {
+    m_sampledNodes.clear();
+    m_nNextSample = 0;
+  }
+}
+
+void SceneTreePanel::getSubtree(
+    size_t node, std::vector<uint8_t> &isInSubtree) const
+{
+  isInSubtree.assign(m_isExpanded.size(), 0);
+  if (node >= isInSubtree.size()) {
+    return;
+  }
+  std::vector<uint32_t> stack = {uint32_t(node)};
+  while (!stack.empty()) {
+    const auto idx = stack.back();
+    stack.pop_back();
+    isInSubtree[idx] = 1;
+    for (auto i = m_childOffsets[idx]; i < m_childOffsets[idx + 1]; ++i) {
+      stack.push_back(m_children[i]);
+    }
+  }
+}
+
+void SceneTreePanel::listRows()
+{
+  m_rows.clear();
+  const auto rootParent = m_isExpanded.size();
+  std::vector<Row> stack;
+  for (auto i = m_childOffsets[rootParent + 1];
+       i-- > m_childOffsets[rootParent];) {
+    stack.push_back({m_children[i], 0});
+  }
+  while (!stack.empty()) {
+    const auto row = stack.back();
+    stack.pop_back();
+    m_rows.push_back(row);
+    if (!m_isExpanded[row.node]) {
+      continue;
+    }
+    for (auto i = m_childOffsets[row.node + 1];
+         i-- > m_childOffsets[row.node];) {
+      stack.push_back({m_children[i], row.depth + 1});
+    }
+  }
+  m_areRowsListed = true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "gpu_cost_attribution.hpp"
+#include "scene_hierarchy.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// GUI tree of the nodes of a SceneHierarchy, to find expensive subtrees. The
+// rows of the expanded nodes are listed once per expansion change, and only
+// those in the scrolled region are submitted to ImGui (ImGuiListClipper),
+// so that hierarchies of 100k nodes cost about as much as small ones.
+//
+// Each row shows the triangles and draws of the subtree of its node,
+// summed once by reset(), and its GPU cost once sampled: sampling isolates
+// the subtree of each listed row in turn for SAMPLE_FRAME_COUNT frames and
+// keeps the GPU time of the scene pass of the last one. Clicking a row
+// isolates its subtree, clicking it again shows the whole scene. The GPU
+// times attributed to top-level nodes by a GpuCostAttribution are shown
+// next to the sampled ones.
+class SceneTreePanel
+{
+public:
+  // Frames a subtree is isolated for when sampling, so that the GPU time of
+  // the last one was measured with the subtree alone (see
+  // Profiler::QUERY_LATENCY)
+  static const size_t SAMPLE_FRAME_COUNT = 5;
+
+  // True if hierarchy is not the one of the last reset()
+  bool isOutdated(const SceneHierarchy &hierarchy) const;
+
+  // Build the tree, collapsed, of hierarchy whose flat node i draws
+  // drawCounts[i] primitives of triangleCounts[i] triangles. Isolation and
+  // GPU costs are cleared.
+  void reset(const SceneHierarchy &hierarchy,
+      const std::vector<uint32_t> &drawCounts,
+      const std::vector<uint64_t> &triangleCounts);
+
+  // Draw the rows of the nodes of hierarchy, named after model.nodes, in the
+  // current ImGui window, with a button sampling the GPU costs if
+  // canIsolate (else rows cannot be isolated). costAttribution, if not null,
+  // gives the times of the roots with CostBuckets::TopLevelNodes.
+  void drawGUI(const SceneHierarchy &hierarchy, const tinygltf::Model &model,
+      bool canIsolate,
+      const GpuCostAttribution *costAttribution = nullptr);
+
+  // Flat index of the node whose subtree is drawn alone: the sampled node
+  // while sampling, else the one clicked, -1 if none
+  int isolated() const
+  {
+    return m_nNextSample < m_sampledNodes.size()
+               ? int(m_sampledNodes[m_nNextSample])
+               : m_nIsolated;
+  }
+
+  bool isSampling() const { return m_nNextSample < m_sampledNodes.size(); }
+
+  // Give the GPU time of the scene pass of the last frame, in milliseconds,
+  // while sampling
+  void addGpuSample(float milliseconds);
+
+  // Flags of the nodes of the subtree of node, by flat index
+  void getSubtree(size_t node, std::vector<uint8_t> &isInSubtree) const;
+
+private:
+  struct Row
+  {
+    uint32_t node; // Flat index
+    uint32_t depth;
+  };
+
+  // List the rows of the expanded nodes, depth first
+  void listRows();
+
+  // Of the hierarchy the tree was built for
+  std::vector<size_t> m_levelOffsets;
+  // Children of node i are m_children[m_childOffsets[i], m_childOffsets[i +
+  // 1]), those of "node" size() are the roots
+  std::vector<uint32_t> m_childOffsets;
+  std::vector<uint32_t> m_children;
+  // Of the subtree of each node
+  std::vector<uint32_t> m_drawCounts;
+  std::vector<uint64_t> m_triangleCounts;
+  std::vector<float> m_gpuTimes; // Negative if not sampled
+  std::vector<uint8_t> m_isExpanded;
+  std::vector<Row> m_rows;
+  bool m_areRowsListed = false;
+  int m_nIsolated = -1;
+  // Rows listed when sampling started, the next one to sample and its frames
+  // isolated so far
+  std::vector<uint32_t> m_sampledNodes;
+  size_t m_nNextSample = 0;
+  size_t m_nSampleFrame = 0;
+};
@@ -0,0 +1,135 @@
+#include "screenshots.hpp"
+#include "png.hpp"
+#include "sync_watchdog.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Screenshots are read as RGB, bottom row first
+const size_t NUM_COMPONENTS = 3;
+
+} // namespace
+
+ScreenshotCapture::ScreenshotCapture(
+    size_t samples, const GLProgram *fxaaProgram) :
+    m_nSamples(samples), m_fxaaProgram(fxaaProgram)
+{
+}
+
+ScreenshotCapture::~ScreenshotCapture() { finish(); }
+
+bool ScreenshotCapture::captureWindow(
+    size_t width, size_t height, const fs::path &path)
+{
+  if (m_pendingCaptures.size() >= MAX_PENDING_CAPTURES) {
+    return false;
+  }
+  const auto size = width * height * NUM_COMPONENTS;
+  GLBuffer pixelBuffer(size, nullptr, GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1); // Rows of RGB images are not padded
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer.glId());
+  glReadPixels(0, 0, GLsizei(width), GLsizei(height), GL_RGB,
+      GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  const auto fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  m_pendingCaptures.push_back(
+      {path, width, height, std::move(pixelBuffer), fence});
+  return true;
+}
+
+bool ScreenshotCapture::captureRender(size_t width, size_t height,
+    const std::function<void()> &drawScene, const fs::path &path)
+{
+  if (m_pendingCaptures.size() >= MAX_PENDING_CAPTURES) {
+    return false;
+  }
+  // Its pixel buffers are enough for every pending capture
+  if (!m_renderer) {
+    m_renderer = std::make_unique<ImageRenderer>(width, height,
+        NUM_COMPONENTS, MAX_PENDING_CAPTURES, m_nSamples, m_fxaaProgram);
+  }
+  m_renderer->resize(width, height);
+  m_renderer->render(drawScene);
+  // Submitted now so that the image is ready in a frame or two
+  glFlush();
+  m_pendingCaptures.push_back({path, width, height, GLBuffer(), nullptr});
+  return true;
+}
+
+void ScreenshotCapture::poll()
+{
+  while (!m_pendingCaptures.empty() && encodeOldestCapture(false)) {
+  }
+  while (!m_encodings.empty() &&
+         m_encodings.front().wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready) {
+    m_encodings.front().get();
+    m_encodings.pop_front();
+  }
+}
+
+void ScreenshotCapture::finish()
+{
+  while (!m_pendingCaptures.empty()) {
+    encodeOldestCapture(true);
+  }
+  while (!m_encodings.empty()) {
+    m_encodings.front().get();
+    m_encodings.pop_front();
+  }
+}
+
+bool ScreenshotCapture::encodeOldestCapture(bool wait)
+{
+  auto &capture = m_pendingCaptures.front();
+  auto pixels = std::make_shared<std::vector<unsigned char>>(
+      capture.width * capture.height * NUM_COMPONENTS);
+  if (!capture.fence) {
+    if (!wait && !m_renderer->isPendingImageReady()) {
+      return false;
+    }
+    m_renderer->readPixels(pixels->data());
+  } else {
+    SyncScope sync{"ScreenshotCapture::encodeOldestCapture"};
+    const auto timeout = wait ? GLuint64(1000000000) : GLuint64(0);
+    const auto status = glClientWaitSync(
+        capture.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+    if (status == GL_TIMEOUT_EXPIRED && !wait) {
+      return false;
+    }
+    glDeleteSync(capture.fence);
+    if (status == GL_WAIT_FAILED) {
+      std::cerr << "Error: ScreenshotCapture - glClientWaitSync failed"
+                << std::endl;
+    }
+    const auto *data =
+        capture.pixelBuffer.map(0, pixels->size(), GL_MAP_READ_BIT);
+    if (data) {
+      std::memcpy(pixels->data(), data, pixels->size());
+      capture.pixelBuffer.unmap();
+    }
+  }
+
+  m_encodings.emplace_back(std::async(std::launch::async,
+      [path = capture.path, width = capture.width, height = capture.height,
+          pixels]() {
+        std::string err;
+        if (!writePng(path, width, height, NUM_COMPONENTS, pixels->data(),
+                true, err)) {
+          std::cerr << "Error: " << err << std::endl;
+          return false;
+        }
+        std::clog << "Wrote screenshot " << path << std::endl;
+        return true;
+      }));
+  m_pendingCaptures.pop_front();
+  return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "gl_objects.hpp"
+#include "images.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+
+// Screenshots of the interactive viewer taken without stalling a frame,
+// unlike renderToImage, which allocates its targets and waits for the GPU.
+// A capture either copies the color of the window as drawn so far, or
+// renders the scene offscreen at another size with an ImageRenderer kept
+// from capture to capture. In both cases the pixels are copied to a pixel
+// pack buffer guarded by a fence, which poll() reads once the GPU is done,
+// normally a frame or two later, then encodes to PNG on a worker thread.
+class ScreenshotCapture
+{
+public:
+  // At most this many captures wait for the GPU, others are dropped
+  static constexpr size_t MAX_PENDING_CAPTURES = 4;
+
+  // Offscreen captures are drawn with samples samples per pixel and filtered
+  // with fxaaProgram if not null, as for ImageRenderer
+  ScreenshotCapture(size_t samples, const GLProgram *fxaaProgram);
+
+  // Wait for the pending captures to be written
+  ~ScreenshotCapture();
+
+  ScreenshotCapture(const ScreenshotCapture &) = delete;
+  ScreenshotCapture &operator=(const ScreenshotCapture &) = delete;
+
+  // Start copying the width x height color of the back buffer of the window
+  // to the PNG file path. Return false if too many captures are pending.
+  bool captureWindow(size_t width, size_t height, const fs::path &path);
+
+  // Render a width x height image with drawScene (same contract as for
+  // renderToImage) and start copying it to the PNG file path. Return false
+  // if too many captures are pending.
+  bool captureRender(size_t width, size_t height,
+      const std::function<void()> &drawScene, const fs::path &path);
+
+  // Hand the captures the GPU is done with to the encoding workers, in
+  // order, and forget the written ones. Never waits.
+  void poll();
+
+  // Number of captures read back or encoded
+  size_t pendingCount() const
+  {
+    return m_pendingCaptures.size() + m_encodings.size();
+  }
+
+  // Wait for every pending capture to be written
+  void finish();
+
+private:
+  struct PendingCapture
+  {
+    fs::path path;
+    size_t width;
+    size_t height;
+    // Of window captures, offscreen ones are pending in m_renderer
+    GLBuffer pixelBuffer;
+    GLsync fence;
+  };
+
+  // Copy the oldest capture out of its pixel buffer, waiting for the GPU if
+  // wait is set, and encode it on a worker. Return false if it is not ready.
+  bool encodeOldestCapture(bool wait);
+
+  size_t m_nSamples;
+  const GLProgram *m_fxaaProgram;
+  std::unique_ptr<ImageRenderer> m_renderer; // Created by the first render
+  std::deque<PendingCapture> m_pendingCaptures;
+  std::deque<std::future<bool>> m_encodings;
+};
@@ -1,15 +1,26 @@
 #pragma once
 
 #include "filesystem.hpp"
+#include "hash.hpp"
+#include "log.hpp"
+#include "shared_cache.hpp"
+#include "tracing.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
 #include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
-
+#include <unordered_set>
+#include <vector>
 
 class GLShader
 {
@@ -19,7 +30,12 @@ class GLShader
 public:
   GLShader(GLenum type) : m_GLId(glCreateShader(type)) {}
 
-  ~GLShader() { glDeleteShader(m_GLId); }
+  ~GLShader()
+  {
+    if (m_GLId) {
+      glDeleteShader(m_GLId);
+    }
+  }
 
   GLShader(const GLShader &) = delete;
 
@@ -81,24 +97,126 @@ inline std::string loadShaderSource(const fs::path &filepath)
   return buffer.str();
 }
 
+// Shader variants
+//
+// A variant of a shader is its source with a block of #define directives
+// inserted after the #version line, so that features can be compiled out
+// with #ifdef instead of being branched on uniforms. Values are optional:
+// {"HAS_TEXCOORDS", ""} gives "#define HAS_TEXCOORDS".
+using ShaderDefines = std::map<std::string, std::string>;
+
+// Key identifying a variant, "NAME=VALUE;..." sorted by name
+inline std::string getShaderVariantKey(const ShaderDefines &defines)
+{
+  std::string key;
+  for (const auto &define : defines) {
+    key += define.first;
+    if (!define.second.empty()) {
+      key += "=" + define.second;
+    }
+    key += ";";
+  }
+  return key;
+}
+
+namespace detail
+{
+
+// Append the source of filepath to output, replacing each
+// #include "relative/path" line by the included file. Each file is only
+// included once. #line directives keep the line numbers of the compiler
+// messages right, the number of the source string is the include depth.
+inline void appendShaderSource(const fs::path &filepath,
+    std::unordered_set<std::string> &included, size_t depth,
+    std::string &output)
+{
+  if (!included.emplace(fs::absolute(filepath).lexically_normal().string())
+           .second) {
+    return;
+  }
+  std::istringstream input(loadShaderSource(filepath));
+  std::string line;
+  size_t lineNumber = 0;
+  while (std::getline(input, line)) {
+    ++lineNumber;
+    const auto begin = line.find_first_not_of(" \t");
+    if (begin == std::string::npos || line.compare(begin, 8, "#include")) {
+      output += line + "\n";
+      continue;
+    }
+    const auto open = line.find('"', begin);
+    const auto close =
+        open == std::string::npos ? open : line.find('"', open + 1);
+    if (close == std::string::npos) {
+      throw std::runtime_error("Invalid #include in " + filepath.string() +
+                               ":" + std::to_string(lineNumber));
+    }
+    const auto includePath =
+        filepath.parent_path() / line.substr(open + 1, close - open - 1);
+    output += "#line 1 " + std::to_string(depth + 1) + "\n";
+    appendShaderSource(includePath, included, depth + 1, output);
+    output += "#line " + std::to_string(lineNumber + 1) + " " +
+              std::to_string(depth) + "\n";
+  }
+}
+
+} // namespace detail
+
+// Load the source of a shader variant: #include directives resolved and
+// defines inserted after the #version line (see ShaderDefines)
+inline std::string loadShaderSource(
+    const fs::path &filepath, const ShaderDefines &defines)
+{
+  std::unordered_set<std::string> included;
+  std::string source;
+  detail::appendShaderSource(filepath, included, 0, source);
+  if (defines.empty()) {
+    return source;
+  }
+
+  std::string defineBlock;
+  for (const auto &define : defines) {
+    defineBlock += "#define " + define.first;
+    if (!define.second.empty()) {
+      defineBlock += " " + define.second;
+    }
+    defineBlock += "\n";
+  }
+
+  // #version must remain the first directive of the shader
+  size_t lineNumber = 1;
+  for (size_t pos = 0; pos < source.size(); ++lineNumber) {
+    const auto end = std::min(source.find('\n', pos), source.size());
+    const auto begin = source.find_first_not_of(" \t", pos);
+    if (begin < end && !source.compare(begin, 8, "#version")) {
+      source.insert(std::min(end + 1, source.size()),
+          defineBlock + "#line " + std::to_string(lineNumber + 1) + " 0\n");
+      return source;
+    }
+    pos = end + 1;
+  }
+  return defineBlock + "#line 1 0\n" + source;
+}
+
 template <typename StringType>
 GLShader compileShader(GLenum type, StringType &&src)
 {
+  TRACE_ZONE("Compile shader");
   GLShader shader(type);
   shader.setSource(std::forward<StringType>(src));
   if (!shader.compile()) {
-    std::cerr << shader.getInfoLog() << std::endl;
+    logMessage(LogLevel::Error, shader.getInfoLog());
     throw std::runtime_error(shader.getInfoLog());
   }
   return shader;
 }
 
-// Load and compile a shader according to the following naming convention:
+// Type of a shader according to the following naming convention:
 // *.vs.glsl -> vertex shader
 // *.fs.glsl -> fragment shader
 // *.gs.glsl -> geometry shader
 // *.cs.glsl -> compute shader
-inline GLShader loadShader(const fs::path &shaderPath)
+inline std::pair<GLenum, std::string> getShaderType(const fs::path &shaderPath)
 {
   static auto extToShaderType =
       std::unordered_map<std::string, std::pair<GLenum, std::string>>(
@@ -113,21 +231,167 @@ inline GLShader loadShader(const fs::path &shaderPath)
     std::cerr << "Unrecognized shader extension " << ext << std::endl;
     throw std::runtime_error("Unrecognized shader extension " + ext.string());
   }
+  return (*it).second;
+}
+
+// Compile the shader of shaderPath (see getShaderType) whose content is
+// source
+inline GLShader loadShader(
+    const fs::path &shaderPath, const std::string &source)
+{
+  const auto type = getShaderType(shaderPath);
 
-  std::clog << "Compiling " << (*it).second.second << " shader " << shaderPath
-            << "\n";
+  logMessage(LogLevel::Info,
+      "Compiling " + type.second + " shader " + shaderPath.string());
 
-  GLShader shader{(*it).second.first};
-  shader.setSource(loadShaderSource(shaderPath));
+  GLShader shader{type.first};
+  shader.setSource(source);
   shader.compile();
   if (!shader.getCompileStatus()) {
-    std::cerr << "Shader compilation error:" << shader.getInfoLog()
-              << std::endl;
+    logMessage(
+        LogLevel::Error, "Shader compilation error:" + shader.getInfoLog());
     throw std::runtime_error("Shader compilation error:" + shader.getInfoLog());
   }
   return shader;
 }
 
+// Load and compile a shader (see getShaderType)
+inline GLShader loadShader(const fs::path &shaderPath)
+{
+  return loadShader(shaderPath, loadShaderSource(shaderPath));
+}
+
+namespace detail
+{
+
+// GL type of the uniforms that can be set from a T
+template <typename T> struct UniformType;
+template <> struct UniformType<float>
+{
+  static constexpr GLenum value = GL_FLOAT;
+};
+template <> struct UniformType<GLint>
+{
+  static constexpr GLenum value = GL_INT;
+};
+template <> struct UniformType<GLuint>
+{
+  static constexpr GLenum value = GL_UNSIGNED_INT;
+};
+template <> struct UniformType<glm::vec2>
+{
+  static constexpr GLenum value = GL_FLOAT_VEC2;
+};
+template <> struct UniformType<glm::vec3>
+{
+  static constexpr GLenum value = GL_FLOAT_VEC3;
+};
+template <> struct UniformType<glm::vec4>
+{
+  static constexpr GLenum value = GL_FLOAT_VEC4;
+};
+template <> struct UniformType<glm::mat3>
+{
+  static constexpr GLenum value = GL_FLOAT_MAT3;
+};
+template <> struct UniformType<glm::mat4>
+{
+  static constexpr GLenum value = GL_FLOAT_MAT4;
+};
+
+template <typename T> inline bool isUniformTypeCompatible(GLenum type)
+{
+  return type == UniformType<T>::value;
+}
+
+// Booleans and samplers are set as integers
+template <> inline bool isUniformTypeCompatible<GLint>(GLenum type)
+{
+  switch (type) {
+  case GL_INT:
+  case GL_BOOL:
+  case GL_SAMPLER_1D:
+  case GL_SAMPLER_2D:
+  case GL_SAMPLER_3D:
+  case GL_SAMPLER_CUBE:
+  case GL_SAMPLER_2D_SHADOW:
+  case GL_SAMPLER_2D_ARRAY:
+    return true;
+  }
+  return false;
+}
+
+inline void setProgramUniform(GLuint program, GLint location, float value)
+{
+  glProgramUniform1f(program, location, value);
+}
+inline void setProgramUniform(GLuint program, GLint location, GLint value)
+{
+  glProgramUniform1i(program, location, value);
+}
+inline void setProgramUniform(GLuint program, GLint location, GLuint value)
+{
+  glProgramUniform1ui(program, location, value);
+}
+inline void setProgramUniform(
+    GLuint program, GLint location, const glm::vec2 &value)
+{
+  glProgramUniform2fv(program, location, 1, glm::value_ptr(value));
+}
+inline void setProgramUniform(
+    GLuint program, GLint location, const glm::vec3 &value)
+{
+  glProgramUniform3fv(program, location, 1, glm::value_ptr(value));
+}
+inline void setProgramUniform(
+    GLuint program, GLint location, const glm::vec4 &value)
+{
+  glProgramUniform4fv(program, location, 1, glm::value_ptr(value));
+}
+inline void setProgramUniform(
+    GLuint program, GLint location, const glm::mat3 &value)
+{
+  glProgramUniformMatrix3fv(
+      program, location, 1, GL_FALSE, glm::value_ptr(value));
+}
+inline void setProgramUniform(
+    GLuint program, GLint location, const glm::mat4 &value)
+{
+  glProgramUniformMatrix4fv(
+      program, location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+} // namespace detail
+
+// Uniform of a program resolved once (see GLProgram::getUniform), set with
+// glProgramUniform* so that the program does not need to be bound. Setting
+// a uniform that is not active in the program does nothing.
+template <typename T> class GLUniform
+{
+public:
+  GLUniform() = default;
+
+  GLUniform(GLuint program, GLint location) :
+      m_program(program), m_location(location)
+  {
+  }
+
+  explicit operator bool() const { return m_location >= 0; }
+
+  GLint location() const { return m_location; }
+
+  void set(const T &value) const
+  {
+    if (m_location >= 0) {
+      detail::setProgramUniform(m_program, m_location, value);
+    }
+  }
+
+private:
+  GLuint m_program = 0;
+  GLint m_location = -1;
+};
+
 class GLProgram
 {
   GLuint m_GLId;
@@ -136,18 +400,31 @@ class GLProgram
 public:
   GLProgram() : m_GLId(glCreateProgram()) {}
 
-  ~GLProgram() { glDeleteProgram(m_GLId); }
+  ~GLProgram()
+  {
+    if (m_GLId) {
+      glDeleteProgram(m_GLId);
+    }
+  }
 
   GLProgram(const GLProgram &) = delete;
 
   GLProgram &operator=(const GLProgram &) = delete;
 
-  GLProgram(GLProgram &&rvalue) : m_GLId(rvalue.m_GLId) { rvalue.m_GLId = 0; }
+  GLProgram(GLProgram &&rvalue) :
+      m_GLId(rvalue.m_GLId),
+      m_uniforms(std::move(rvalue.m_uniforms)),
+      m_uniformBlocks(std::move(rvalue.m_uniformBlocks))
+  {
+    rvalue.m_GLId = 0;
+  }
 
   GLProgram &operator=(GLProgram &&rvalue)
   {
     this->~GLProgram();
     m_GLId = rvalue.m_GLId;
+    m_uniforms = std::move(rvalue.m_uniforms);
+    m_uniformBlocks = std::move(rvalue.m_uniformBlocks);
     rvalue.m_GLId = 0;
     return *this;
   }
@@ -162,7 +439,11 @@ public:
   bool link()
   {
     glLinkProgram(m_GLId);
-    return getLinkStatus();
+    if (!getLinkStatus()) {
+      return false;
+    }
+    introspect();
+    return true;
   }
 
   bool getLinkStatus() const
@@ -201,6 +482,114 @@ public:
   {
     glBindAttribLocation(m_GLId, index, name);
   }
+
+  // Active uniforms of the default block and active uniform blocks, queried
+  // once by introspect() so that lookups don't go through the driver
+  struct UniformInfo
+  {
+    GLint location;
+    GLenum type;
+    GLint size; // Array size, 1 for non-array uniforms
+  };
+
+  struct UniformBlockInfo
+  {
+    GLuint index;
+    GLint dataSize; // Minimum size of the buffer range bound to the block
+  };
+
+  // Query the active uniforms and uniform blocks of the linked program.
+  // Called by link() and ProgramBuilder, programs linked otherwise (eg. with
+  // glProgramBinary) must call it before the lookups.
+  void introspect()
+  {
+    m_uniforms.clear();
+    m_uniformBlocks.clear();
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(m_GLId, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(m_GLId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<GLchar> name(std::max(maxLength, 1));
+    for (GLint i = 0; i < count; ++i) {
+      GLsizei length = 0;
+      UniformInfo info;
+      glGetActiveUniform(m_GLId, GLuint(i), GLsizei(name.size()), &length,
+          &info.size, &info.type, name.data());
+      std::string uniformName(name.data(), length);
+      info.location = glGetUniformLocation(m_GLId, uniformName.c_str());
+      if (info.location < 0) {
+        continue; // Member of a uniform block
+      }
+      // Arrays are reported as "name[0]", also look them up as "name"
+      const auto bracket = uniformName.find('[');
+      if (bracket != std::string::npos) {
+        uniformName.resize(bracket);
+      }
+      m_uniforms.emplace(std::move(uniformName), info);
+    }
+
+    count = maxLength = 0;
+    glGetProgramiv(m_GLId, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(m_GLId, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+    name.resize(std::max(maxLength, 1));
+    for (GLint i = 0; i < count; ++i) {
+      GLsizei length = 0;
+      glGetActiveUniformBlockName(
+          m_GLId, GLuint(i), GLsizei(name.size()), &length, name.data());
+      UniformBlockInfo info;
+      info.index = GLuint(i);
+      glGetActiveUniformBlockiv(m_GLId, info.index,
+          GL_UNIFORM_BLOCK_DATA_SIZE, &info.dataSize);
+      m_uniformBlocks.emplace(std::string(name.data(), length), info);
+    }
+  }
+
+  // Return nullptr if the uniform is not active
+  const UniformInfo *findUniform(const std::string &name) const
+  {
+    const auto it = m_uniforms.find(name);
+    return it != end(m_uniforms) ? &it->second : nullptr;
+  }
+
+  // Return nullptr if the uniform block is not active
+  const UniformBlockInfo *findUniformBlock(const std::string &name) const
+  {
+    const auto it = m_uniformBlocks.find(name);
+    return it != end(m_uniformBlocks) ? &it->second : nullptr;
+  }
+
+  // Handle on the uniform name, which is inactive if the uniform is missing
+  // or is not of type T (the latter is also reported as a warning)
+  template <typename T> GLUniform<T> getUniform(const std::string &name) const
+  {
+    const auto info = findUniform(name);
+    if (!info) {
+      return {};
+    }
+    if (!detail::isUniformTypeCompatible<T>(info->type)) {
+      std::cerr << "Warning: uniform " << name << " has GL type 0x" << std::hex
+                << info->type << std::dec << ", ignored" << std::endl;
+      return {};
+    }
+    return {m_GLId, info->location};
+  }
+
+  // Assign the uniform block name to a binding point, return false if the
+  // block is not active or is smaller than minDataSize
+  bool bindUniformBlock(
+      const std::string &name, GLuint binding, GLint minDataSize = 0) const
+  {
+    const auto info = findUniformBlock(name);
+    if (!info || info->dataSize < minDataSize) {
+      return false;
+    }
+    glUniformBlockBinding(m_GLId, info->index, binding);
+    return true;
+  }
+
+private:
+  std::unordered_map<std::string, UniformInfo> m_uniforms;
+  std::unordered_map<std::string, UniformBlockInfo> m_uniformBlocks;
 };
 
 inline GLProgram buildProgram(std::initializer_list<GLShader> shaders)
@@ -211,7 +600,7 @@ inline GLProgram buildProgram(std::initializer_list<GLShader> shaders)
   }
 
   if (!program.link()) {
-    std::cerr << program.getInfoLog() << std::endl;
+    logMessage(LogLevel::Error, program.getInfoLog());
     throw std::runtime_error(program.getInfoLog());
   }
 
@@ -244,17 +633,283 @@ template <typename CSrc> GLProgram buildComputeProgram(CSrc &&src)
   ;
 }
 
-inline GLProgram compileProgram(std::vector<fs::path> shaderPaths)
+// Program binary cache
+//
+// If a cache directory is set, compileProgram stores linked programs with
+// glGetProgramBinary and loads them back with glProgramBinary on the next
+// launches. Cache files are keyed by the hash of the shader sources and of
+// the GL vendor, renderer and version strings, so that editing a shader or
+// updating the driver invalidates them. Programs are compiled as usual when
+// the cache file is missing or rejected by the driver.
+
+// Directory of program binaries, the cache is disabled if empty (default)
+inline fs::path &getProgramCacheDirectory()
 {
-  GLProgram program;
-  for (const auto &path : shaderPaths) {
-    auto shader = loadShader(path);
-    program.attachShader(shader);
+  static fs::path directory;
+  return directory;
+}
+
+inline void setProgramCacheDirectory(const fs::path &directory)
+{
+  getProgramCacheDirectory() = directory;
+}
+
+namespace detail
+{
+
+const char PROGRAM_BINARY_MAGIC[4] = {'G', 'L', 'P', 'B'};
+const uint32_t PROGRAM_BINARY_VERSION = 1;
+
+inline uint64_t computeProgramKey(const std::vector<fs::path> &shaderPaths,
+    const std::vector<std::string> &sources)
+{
+  auto hash = fnv1a64(&PROGRAM_BINARY_VERSION, sizeof(PROGRAM_BINARY_VERSION));
+  for (const auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+    const auto *str = (const char *)glGetString(name);
+    const std::string value = str ? str : "";
+    hash = fnv1a64(value.data(), value.size() + 1, hash);
+  }
+  for (size_t i = 0; i < shaderPaths.size(); ++i) {
+    const auto type = getShaderType(shaderPaths[i]).first;
+    hash = fnv1a64(&type, sizeof(type), hash);
+    hash = fnv1a64(sources[i].data(), sources[i].size() + 1, hash);
   }
-  program.link();
+  return hash;
+}
+
+// Return false if the file is missing or invalid, or if the driver rejects
+// the binary
+inline bool loadProgramBinary(
+    const fs::path &path, uint64_t key, GLProgram &program)
+{
+  std::ifstream in(path.string(), std::ios::binary);
+  char magic[4];
+  uint32_t version = 0, format = 0, size = 0;
+  uint64_t fileKey = 0;
+  if (!in.read(magic, sizeof(magic)) ||
+      !std::equal(magic, magic + 4, PROGRAM_BINARY_MAGIC) ||
+      !in.read((char *)&version, sizeof(version)) ||
+      version != PROGRAM_BINARY_VERSION ||
+      !in.read((char *)&fileKey, sizeof(fileKey)) || fileKey != key ||
+      !in.read((char *)&format, sizeof(format)) ||
+      !in.read((char *)&size, sizeof(size))) {
+    return false;
+  }
+  std::vector<char> binary(size);
+  if (!in.read(binary.data(), size)) {
+    return false;
+  }
+  glProgramBinary(program.glId(), format, binary.data(), GLsizei(size));
   if (!program.getLinkStatus()) {
-    std::cerr << "Program link error:" << program.getInfoLog() << std::endl;
-    throw std::runtime_error("Program link error:" + program.getInfoLog());
+    return false;
   }
-  return program;
+  touchCacheEntry(path);
+  return true;
+}
+
+// Failures are reported as warnings, the program is still usable
+inline void storeProgramBinary(
+    const fs::path &path, uint64_t key, const GLProgram &program)
+{
+  GLint size = 0;
+  glGetProgramiv(program.glId(), GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0) {
+    return;
+  }
+  std::vector<char> binary(size);
+  GLenum format = 0;
+  glGetProgramBinary(program.glId(), size, nullptr, &format, binary.data());
+
+  // Written in a temporary file so that readers never see partial files
+  std::error_code errorCode;
+  fs::create_directories(path.parent_path(), errorCode);
+  const auto tmpPath = getTemporaryCachePath(path);
+  {
+    std::ofstream out(tmpPath.string(), std::ios::binary | std::ios::trunc);
+    const auto fileSize = uint32_t(size);
+    const auto fileFormat = uint32_t(format);
+    out.write(PROGRAM_BINARY_MAGIC, sizeof(PROGRAM_BINARY_MAGIC));
+    out.write((const char *)&PROGRAM_BINARY_VERSION,
+        sizeof(PROGRAM_BINARY_VERSION));
+    out.write((const char *)&key, sizeof(key));
+    out.write((const char *)&fileFormat, sizeof(fileFormat));
+    out.write((const char *)&fileSize, sizeof(fileSize));
+    out.write(binary.data(), size);
+    if (!out) {
+      std::cerr << "Warning: unable to write " << tmpPath << std::endl;
+      return;
+    }
+  }
+  fs::rename(tmpPath, path, errorCode);
+  if (errorCode) {
+    std::cerr << "Warning: unable to rename " << tmpPath << ": "
+              << errorCode.message() << std::endl;
+    fs::remove(tmpPath, errorCode);
+  }
+}
+
+} // namespace detail
+
+// Compile and link several programs at once.
+//
+// Every shader is submitted, then every program linked, before the first
+// status query, so that drivers compiling on their own threads (see
+// GL_KHR_parallel_shader_compile, enabled by loadGLExtensions) build all the
+// programs concurrently instead of one after another. Programs found in the
+// program binary cache are not compiled, and a shader variant shared by
+// several programs is only compiled once.
+class ProgramBuilder
+{
+public:
+  // Queue a program made of the variants defines of the shaders of
+  // shaderPaths (see getShaderType and loadShaderSource), return its index
+  // in the result of build()
+  size_t add(std::vector<fs::path> shaderPaths, ShaderDefines defines = {})
+  {
+    m_programs.emplace_back();
+    m_programs.back().shaderPaths = std::move(shaderPaths);
+    m_programs.back().defines = std::move(defines);
+    return m_programs.size() - 1;
+  }
+
+  // Build every queued program, throw std::runtime_error on the first
+  // compilation or link error
+  std::vector<GLProgram> build()
+  {
+    TRACE_ZONE("Build programs");
+    const auto &cacheDirectory = getProgramCacheDirectory();
+    GLint binaryFormatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormatCount);
+    const auto useCache = !cacheDirectory.empty() && binaryFormatCount > 0;
+
+    // Compiled variants, by path and variant key
+    std::unordered_map<std::string, size_t> shaderIndices;
+    const auto variantKey = [](const fs::path &path,
+                                const ShaderDefines &defines) {
+      return path.string() + "\n" + getShaderVariantKey(defines);
+    };
+
+    for (auto &pending : m_programs) {
+      std::vector<std::string> sources;
+      for (const auto &path : pending.shaderPaths) {
+        sources.emplace_back(loadShaderSource(path, pending.defines));
+      }
+
+      if (useCache) {
+        pending.cacheKey =
+            detail::computeProgramKey(pending.shaderPaths, sources);
+        pending.cachePath = getCacheEntryPath(
+            cacheDirectory, pending.cacheKey, ".glprogram");
+        if (detail::loadProgramBinary(
+                pending.cachePath, pending.cacheKey, pending.program)) {
+          if (isLogged(LogLevel::Info)) {
+            std::string message = "Loaded program";
+            for (const auto &path : pending.shaderPaths) {
+              message += " " + path.filename().string();
+            }
+            logMessage(LogLevel::Info,
+                message + " from " + pending.cachePath.string());
+          }
+          pending.isLinked = true;
+          continue;
+        }
+      }
+
+      for (size_t i = 0; i < pending.shaderPaths.size(); ++i) {
+        const auto &path = pending.shaderPaths[i];
+        const auto inserted = shaderIndices.emplace(
+            variantKey(path, pending.defines), m_shaders.size());
+        pending.shaderIndices.emplace_back(inserted.first->second);
+        if (!inserted.second) {
+          continue;
+        }
+        const auto type = getShaderType(path);
+        if (isLogged(LogLevel::Info)) {
+          auto message =
+              "Compiling " + type.second + " shader " + path.string();
+          if (!pending.defines.empty()) {
+            message += " (" + getShaderVariantKey(pending.defines) + ")";
+          }
+          logMessage(LogLevel::Info, message);
+        }
+        m_shaders.emplace_back(type.first);
+        m_shaders.back().setSource(sources[i]);
+        glCompileShader(m_shaders.back().glId());
+      }
+    }
+
+    // Linking waits for the compilation of the shaders on the driver side
+    for (auto &pending : m_programs) {
+      if (pending.isLinked) {
+        continue;
+      }
+      for (const auto index : pending.shaderIndices) {
+        pending.program.attachShader(m_shaders[index]);
+      }
+      if (useCache) {
+        glProgramParameteri(pending.program.glId(),
+            GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+      }
+      glLinkProgram(pending.program.glId());
+    }
+
+    std::vector<GLProgram> programs;
+    for (auto &pending : m_programs) {
+      if (!pending.isLinked) {
+        checkProgram(pending);
+        if (useCache) {
+          detail::storeProgramBinary(
+              pending.cachePath, pending.cacheKey, pending.program);
+        }
+      }
+      pending.program.introspect();
+      programs.emplace_back(std::move(pending.program));
+    }
+    m_programs.clear();
+    m_shaders.clear();
+    return programs;
+  }
+
+private:
+  struct PendingProgram
+  {
+    std::vector<fs::path> shaderPaths;
+    ShaderDefines defines;
+    std::vector<size_t> shaderIndices; // In m_shaders
+    GLProgram program;
+    bool isLinked = false; // Loaded from the cache
+    uint64_t cacheKey = 0;
+    fs::path cachePath;
+  };
+
+  void checkProgram(const PendingProgram &pending) const
+  {
+    for (size_t i = 0; i < pending.shaderIndices.size(); ++i) {
+      const auto &shader = m_shaders[pending.shaderIndices[i]];
+      if (!shader.getCompileStatus()) {
+        logMessage(LogLevel::Error, "Shader compilation error in " +
+                                        pending.shaderPaths[i].string() + ":" +
+                                        shader.getInfoLog());
+        throw std::runtime_error(
+            "Shader compilation error:" + shader.getInfoLog());
+      }
+    }
+    if (!pending.program.getLinkStatus()) {
+      logMessage(LogLevel::Error,
+          "Program link error:" + pending.program.getInfoLog());
+      throw std::runtime_error(
+          "Program link error:" + pending.program.getInfoLog());
+    }
+  }
+
+  std::vector<PendingProgram> m_programs;
+  std::vector<GLShader> m_shaders; // Variants compiled by build()
+};
+
+inline GLProgram compileProgram(
+    std::vector<fs::path> shaderPaths, ShaderDefines defines = {})
+{
+  ProgramBuilder builder;
+  builder.add(std::move(shaderPaths), std::move(defines));
+  return std::move(builder.build().front());
 }
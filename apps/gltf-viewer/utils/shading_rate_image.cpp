@@ -0,0 +1,117 @@
+#include "shading_rate_image.hpp"
+#include "gl_extensions.hpp"
+
+#include <cassert>
+#include <string>
+
+namespace
+{
+
+// In the order of ShadingRateImage::Rate
+const GLenum PALETTE[ShadingRateImage::RATE_COUNT] = {
+    GL_SHADING_RATE_1_INVOCATION_PER_PIXEL_NV,
+    GL_SHADING_RATE_1_INVOCATION_PER_2X2_PIXELS_NV,
+    GL_SHADING_RATE_1_INVOCATION_PER_4X4_PIXELS_NV};
+
+} // namespace
+
+ShaderDefines ShadingRateImage::getShaderDefines()
+{
+  const auto &texelSize = getGLExtensions().shadingRateTexelSize;
+  return {{"TILE_WIDTH", std::to_string(texelSize[0])},
+      {"TILE_HEIGHT", std::to_string(texelSize[1])}};
+}
+
+void ShadingRateImage::update(const GLProgram &program, size_t width,
+    size_t height, float varianceThreshold)
+{
+  const auto &texelSize = getGLExtensions().shadingRateTexelSize;
+  const auto tileCountX = (width + size_t(texelSize[0]) - 1) / texelSize[0];
+  const auto tileCountY = (height + size_t(texelSize[1]) - 1) / texelSize[1];
+  if (width != m_nWidth || height != m_nHeight) {
+    m_nWidth = width;
+    m_nHeight = height;
+    m_frame = GLTexture(1, GL_RGBA8, GLsizei(width), GLsizei(height));
+    // Only read with texelFetch, but the textures must be complete
+    m_frame.setParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    m_frame.setParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    m_frameFramebuffer = GLFramebuffer::create();
+    m_frameFramebuffer.attachTexture(GL_COLOR_ATTACHMENT0, m_frame.glId());
+    m_frameFramebuffer.setDrawBuffer(GL_COLOR_ATTACHMENT0);
+    assert(m_frameFramebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+    m_rates = GLTexture(
+        1, GL_R8UI, GLsizei(tileCountX), GLsizei(tileCountY));
+    m_rates.setParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    m_rates.setParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    m_emptyVertexArray = GLVertexArray::create();
+  }
+
+  // Resolves the samples of the window if it has some
+  GLint drawFramebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_frameFramebuffer.glId());
+  glBlitFramebuffer(0, 0, GLint(width), GLint(height), 0, 0, GLint(width),
+      GLint(height), GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(drawFramebuffer));
+
+  program.use();
+  program.getUniform<float>("uVarianceThreshold").set(varianceThreshold);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_frame.glId());
+  glBindImageTexture(
+      0, m_rates.glId(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8UI);
+  glDispatchCompute(GLuint(tileCountX), GLuint(tileCountY), 1);
+  // The rates are fetched by the rasterizer of the next frame, and by
+  // drawRates
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8UI);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool ShadingRateImage::bind(bool bind) const
+{
+  const auto &extensions = getGLExtensions();
+  if (!bind) {
+    glDisable(GL_SHADING_RATE_IMAGE_NV);
+    extensions.bindShadingRateImage(0);
+    return false;
+  }
+  GLint viewport[4] = {};
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  if (!m_rates.glId() || size_t(viewport[2]) != m_nWidth ||
+      size_t(viewport[3]) != m_nHeight) {
+    return false;
+  }
+  extensions.shadingRateImagePalette(0, 0, RATE_COUNT, PALETTE);
+  extensions.bindShadingRateImage(m_rates.glId());
+  glEnable(GL_SHADING_RATE_IMAGE_NV);
+  return true;
+}
+
+void ShadingRateImage::drawRates(const GLProgram &program) const
+{
+  if (!m_rates.glId()) {
+    return;
+  }
+  program.use();
+  const auto &texelSize = getGLExtensions().shadingRateTexelSize;
+  program.getUniform<glm::vec2>("uTileSize")
+      .set(glm::vec2(float(texelSize[0]), float(texelSize[1])));
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_rates.glId());
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  GLboolean isDepthTested = GL_FALSE;
+  glGetBooleanv(GL_DEPTH_TEST, &isDepthTested);
+  glDisable(GL_DEPTH_TEST);
+  m_emptyVertexArray.bind();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+  if (isDepthTested) {
+    glEnable(GL_DEPTH_TEST);
+  }
+  glDisable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ZERO);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
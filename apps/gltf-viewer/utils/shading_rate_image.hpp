@@ -0,0 +1,76 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Variable rate shading of the main pass of the window with
+// GL_NV_shading_rate_image: each tile of the window (16 x 16 pixels on
+// current GPUs, see GLExtensions::shadingRateTexelSize) has a Rate in a
+// GL_R8UI image, and its fragments are shaded once per 1x1, 2x2 or 4x4
+// pixels. Coverage and depth keep their samples, so that edges stay sharp.
+//
+// The rates follow the previous frame of the window: update() copies it
+// and shading_rate.cs.glsl computes the variance of the luminance of each
+// tile, in a work group per tile. Tiles of low variance (sky, flat walls)
+// are shaded coarsely, which saves fill rate where it shows the least. The
+// frame is read after post-processing, in the display encoding, so that
+// the threshold is perceptual.
+class ShadingRateImage
+{
+public:
+  // Indices in the palette of rates, written by shading_rate.cs.glsl
+  enum Rate : uint8_t
+  {
+    FULL_RATE = 0, // 1x1
+    HALF_RATE = 1, // 2x2
+    QUARTER_RATE = 2, // 4x4
+    RATE_COUNT
+  };
+
+  struct Settings
+  {
+    // Shade the main pass with the rates, otherwise it is shaded at full
+    // rate but the rates are still updated
+    bool enabled = true;
+    // Luminance variance of a tile below which it is shaded per 2x2 pixels,
+    // per 4x4 pixels below a quarter of it. Luminance is in [0, 1].
+    float varianceThreshold = 1e-3f;
+    // Blend the rates over the window, see drawRates
+    bool showRates = false;
+  };
+
+  ShadingRateImage() = default;
+
+  // Defines of shading_rate.cs.glsl: its work groups cover a tile
+  static ShaderDefines getShaderDefines();
+
+  // Compute the rates of the next frames from the frame of the window, of
+  // width x height pixels in the default framebuffer, with program
+  // (shading_rate.cs.glsl). The image is reallocated when the window is
+  // resized.
+  void update(const GLProgram &program, size_t width, size_t height,
+      float varianceThreshold);
+
+  // Shade the next draws with the rates if the viewport has the size of
+  // the last update(), return true if so. bind(false) shades them at full
+  // rate again.
+  bool bind(bool bind = true) const;
+
+  // Blend the rates over the bound framebuffer with program
+  // (fullscreen.vs.glsl and shading_rate.fs.glsl): 2x2 tiles are tinted
+  // yellow, 4x4 ones red
+  void drawRates(const GLProgram &program) const;
+
+private:
+  size_t m_nWidth = 0;
+  size_t m_nHeight = 0;
+  GLTexture m_frame; // Copy of the window read by update()
+  GLFramebuffer m_frameFramebuffer;
+  GLTexture m_rates; // A texel per tile
+  GLVertexArray m_emptyVertexArray;
+};
@@ -0,0 +1,554 @@
+#include "shadow_atlas.hpp"
+#include "frustum.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+// Tile size over the screen height covered by the sphere of influence of a
+// light, and relative change of that coverage ignored around the current
+// size, so that lights near a threshold keep their tile
+const float TILE_COVERAGE_SCALE = 0.5f;
+const float TILE_SIZE_HYSTERESIS = 1.25f;
+
+// Near plane of the views over the range of their light
+const float NEAR_RATIO = 0.01f;
+// Added to the field of view of the views against aliasing at their edges
+// and gaps between the faces of point lights. Wider spot light cones are
+// drawn as point lights.
+const float FOV_MARGIN = glm::radians(5.f);
+const float MAX_SPOT_FOV = glm::radians(120.f);
+
+// Moves below this fraction of the range of a light, or turns above this
+// cosine, keep its map
+const float MIN_MOVE_RATIO = 1e-3f;
+const float MIN_LIGHT_COSINE = 0.99999f;
+
+// Priority of stale lights without a map over those with an outdated one
+const float NO_MAP_PRIORITY = 4.f;
+
+// Same depth offset as CascadedShadowMaps
+const float SLOPE_OFFSET = 2.f;
+const float UNITS_OFFSET = 4.f;
+
+size_t getViewsAlignment()
+{
+  GLint alignment = 0;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return std::max(size_t(alignment), sizeof(glm::vec4));
+}
+
+bool isUnbounded(const glm::vec3 &bboxMax)
+{
+  return bboxMax.x == std::numeric_limits<float>::max();
+}
+
+// Largest power of two tile size below size
+GLsizei getTileSize(float size)
+{
+  GLsizei tileSize = ShadowAtlas::MIN_TILE_SIZE;
+  while (tileSize < ShadowAtlas::MAX_TILE_SIZE && 2.f * tileSize <= size) {
+    tileSize *= 2;
+  }
+  return tileSize;
+}
+
+// Directions and up vectors of the faces of a cube
+const glm::vec3 CUBE_DIRECTIONS[ShadowAtlas::MAX_VIEW_COUNT] = {
+    {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+const glm::vec3 CUBE_UPS[ShadowAtlas::MAX_VIEW_COUNT] = {
+    {0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
+
+} // namespace
+
+ShadowAtlas &ShadowAtlas::operator=(ShadowAtlas &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_texture, rvalue.m_texture);
+    std::swap(m_textureMemory, rvalue.m_textureMemory);
+    std::swap(m_framebuffer, rvalue.m_framebuffer);
+    std::swap(m_lights, rvalue.m_lights);
+    std::swap(m_isZeroToOneDepth, rvalue.m_isZeroToOneDepth);
+    std::swap(m_freeTiles, rvalue.m_freeTiles);
+    std::swap(m_drawBoundsMin, rvalue.m_drawBoundsMin);
+    std::swap(m_drawBoundsMax, rvalue.m_drawBoundsMax);
+    std::swap(m_isDrawReady, rvalue.m_isDrawReady);
+    std::swap(m_nPoseVersion, rvalue.m_nPoseVersion);
+    std::swap(m_nDrawnCount, rvalue.m_nDrawnCount);
+    std::swap(m_nTotalDrawnCount, rvalue.m_nTotalDrawnCount);
+  }
+  return *this;
+}
+
+void ShadowAtlas::update(const SceneLights &lights,
+    const SceneHierarchy &hierarchy, const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, float viewportHeight, bool zeroToOneDepth)
+{
+  m_nDrawnCount = 0;
+  if (lights.lightCount() != m_lights.size() ||
+      zeroToOneDepth != m_isZeroToOneDepth) {
+    m_lights.assign(lights.lightCount(), Light{});
+    m_freeTiles.clear();
+    m_isZeroToOneDepth = zeroToOneDepth;
+  }
+
+  std::vector<SceneLights::ViewLight> worldLights;
+  lights.computeViewLights(hierarchy, glm::mat4(1), worldLights);
+  const auto frustum = extractFrustum(projMatrix * viewMatrix);
+  const auto pixelsPerUnit = 0.5f * projMatrix[1][1] * viewportHeight;
+  for (size_t i = lights.directionalCount(); i < m_lights.size(); ++i) {
+    const auto &worldLight = worldLights[i];
+    auto &light = m_lights[i];
+    if (worldLight.range <= 0.f) {
+      continue;
+    }
+    auto fieldOfView = glm::radians(90.f) + FOV_MARGIN;
+    size_t viewCount = MAX_VIEW_COUNT;
+    if (worldLight.spotScale != 0.f) {
+      const auto cosOuter = -worldLight.spotOffset / worldLight.spotScale;
+      const auto spotFov =
+          2.f * std::acos(glm::clamp(cosOuter, -1.f, 1.f)) + FOV_MARGIN;
+      if (spotFov <= MAX_SPOT_FOV) {
+        fieldOfView = spotFov;
+        viewCount = 1;
+      }
+    }
+
+    const auto hasMoved =
+        !light.isLocal || viewCount != light.viewCount ||
+        fieldOfView != light.fieldOfView || worldLight.range != light.range ||
+        glm::distance(worldLight.position, light.position) >
+            MIN_MOVE_RATIO * worldLight.range ||
+        (viewCount == 1 && glm::dot(worldLight.direction, light.direction) <
+                               MIN_LIGHT_COSINE);
+    if (hasMoved) {
+      if (viewCount != light.viewCount) {
+        freeTiles(light);
+      }
+      light.isLocal = true;
+      light.viewCount = viewCount;
+      light.position = worldLight.position;
+      light.direction = worldLight.direction;
+      light.range = worldLight.range;
+      light.fieldOfView = fieldOfView;
+      light.isStale = true;
+      const auto zNear = NEAR_RATIO * light.range;
+      const auto projection =
+          zeroToOneDepth ? glm::perspectiveRH_ZO(
+                               fieldOfView, 1.f, zNear, light.range)
+                         : glm::perspectiveRH_NO(
+                               fieldOfView, 1.f, zNear, light.range);
+      for (size_t v = 0; v < viewCount; ++v) {
+        const auto direction =
+            viewCount == 1 ? light.direction : CUBE_DIRECTIONS[v];
+        const auto up = viewCount != 1 ? CUBE_UPS[v]
+                        : std::abs(direction.y) < 0.99f ? glm::vec3(0, 1, 0)
+                                                        : glm::vec3(1, 0, 0);
+        light.viewProjMatrices[v] =
+            projection *
+            glm::lookAt(light.position, light.position + direction, up);
+      }
+    }
+
+    // Pixels covered by the sphere of influence, all of them from inside
+    if (!intersectsBox(frustum, light.position - light.range,
+            light.position + light.range)) {
+      light.importance = 0.f;
+      continue;
+    }
+    const auto depth = -(viewMatrix * glm::vec4(light.position, 1)).z;
+    light.importance =
+        depth <= light.range
+            ? viewportHeight
+            : std::min(2.f * light.range * pixelsPerUnit / depth,
+                  viewportHeight);
+
+    const auto size = TILE_COVERAGE_SCALE * light.importance;
+    if (!light.wantedSize ||
+        size * TILE_SIZE_HYSTERESIS < float(light.wantedSize) ||
+        size >= 2.f * TILE_SIZE_HYSTERESIS * float(light.wantedSize)) {
+      const auto wantedSize = getTileSize(size);
+      if (wantedSize != light.wantedSize) {
+        light.wantedSize = wantedSize;
+        light.isStale = true;
+      }
+    }
+    if (light.isStale) {
+      ++light.staleFrameCount;
+    }
+  }
+}
+
+void ShadowAtlas::invalidate()
+{
+  for (auto &light : m_lights) {
+    light.isStale = true;
+  }
+  m_drawBoundsMin.clear();
+  m_drawBoundsMax.clear();
+  m_isDrawReady.clear();
+}
+
+void ShadowAtlas::invalidateChangedDraws(
+    const std::vector<glm::vec3> &boundsMin,
+    const std::vector<glm::vec3> &boundsMax,
+    const std::vector<uint8_t> &isDrawReady, size_t poseVersion)
+{
+  if (boundsMin.size() != m_drawBoundsMin.size()) {
+    for (auto &light : m_lights) {
+      light.isStale = true;
+    }
+    m_drawBoundsMin = boundsMin;
+    m_drawBoundsMax = boundsMax;
+    m_isDrawReady = isDrawReady;
+    m_nPoseVersion = poseVersion;
+    return;
+  }
+
+  const auto hasPoseChanged = poseVersion != m_nPoseVersion;
+  m_nPoseVersion = poseVersion;
+  const auto invalidate = [&](const glm::vec3 &bboxMin,
+                              const glm::vec3 &bboxMax) {
+    const auto isUnboundedDraw = isUnbounded(bboxMax);
+    for (auto &light : m_lights) {
+      if (!light.isLocal || light.isStale) {
+        continue;
+      }
+      const auto nearest = glm::clamp(light.position, bboxMin, bboxMax);
+      if (isUnboundedDraw ||
+          glm::distance(nearest, light.position) <= light.range) {
+        light.isStale = true;
+      }
+    }
+  };
+  for (size_t i = 0; i < boundsMin.size(); ++i) {
+    const auto hasMoved = boundsMin[i] != m_drawBoundsMin[i] ||
+                          boundsMax[i] != m_drawBoundsMax[i];
+    const auto hasChanged = hasMoved || isDrawReady[i] != m_isDrawReady[i] ||
+                            (hasPoseChanged && isUnbounded(boundsMax[i]));
+    if (!hasChanged) {
+      continue;
+    }
+    if (m_isDrawReady[i]) {
+      invalidate(m_drawBoundsMin[i], m_drawBoundsMax[i]);
+    }
+    if (isDrawReady[i]) {
+      invalidate(boundsMin[i], boundsMax[i]);
+    }
+    m_drawBoundsMin[i] = boundsMin[i];
+    m_drawBoundsMax[i] = boundsMax[i];
+    m_isDrawReady[i] = isDrawReady[i];
+  }
+}
+
+std::vector<size_t> ShadowAtlas::scheduleUpdates(size_t budget)
+{
+  std::vector<std::pair<float, size_t>> candidates;
+  for (size_t i = 0; i < m_lights.size(); ++i) {
+    const auto &light = m_lights[i];
+    if (light.isLocal && light.isStale && light.importance > 0.f) {
+      const auto priority = light.importance * float(light.staleFrameCount) *
+                            (light.hasMap ? 1.f : NO_MAP_PRIORITY);
+      candidates.emplace_back(priority, i);
+    }
+  }
+  std::sort(begin(candidates), end(candidates),
+      [](const auto &lhs, const auto &rhs) { return lhs.first > rhs.first; });
+
+  // Lights that do not fit leave their views to the next ones
+  std::vector<size_t> scheduled;
+  size_t viewCount = 0;
+  for (const auto &candidate : candidates) {
+    const auto lightViewCount = m_lights[candidate.second].viewCount;
+    if (!budget ||
+        (!scheduled.empty() && viewCount + lightViewCount > budget)) {
+      continue;
+    }
+    scheduled.push_back(candidate.second);
+    viewCount += lightViewCount;
+  }
+  return scheduled;
+}
+
+size_t ShadowAtlas::getLevel(GLsizei size) const
+{
+  size_t level = 0;
+  for (auto levelSize = ATLAS_SIZE; levelSize > size; levelSize /= 2) {
+    ++level;
+  }
+  return level;
+}
+
+bool ShadowAtlas::allocateTile(GLsizei size, glm::ivec2 &origin)
+{
+  const auto level = getLevel(size);
+  auto splitLevel = level;
+  while (m_freeTiles[splitLevel].empty()) {
+    if (!splitLevel) {
+      return false;
+    }
+    --splitLevel;
+  }
+  for (; splitLevel < level; ++splitLevel) {
+    const auto parent = m_freeTiles[splitLevel].back();
+    m_freeTiles[splitLevel].pop_back();
+    const auto half = ATLAS_SIZE >> (splitLevel + 1);
+    auto &children = m_freeTiles[splitLevel + 1];
+    children.push_back(parent + glm::ivec2(half, half));
+    children.push_back(parent + glm::ivec2(0, half));
+    children.push_back(parent + glm::ivec2(half, 0));
+    children.push_back(parent);
+  }
+  origin = m_freeTiles[level].back();
+  m_freeTiles[level].pop_back();
+  return true;
+}
+
+void ShadowAtlas::freeTile(GLsizei size, const glm::ivec2 &origin)
+{
+  auto level = getLevel(size);
+  auto tile = origin;
+  // Merge with the 3 siblings while they are all free
+  while (level) {
+    const auto parentSize = 2 * (ATLAS_SIZE >> level);
+    const auto parent = tile / parentSize * parentSize;
+    auto &tiles = m_freeTiles[level];
+    size_t freeSiblingCount = 0;
+    for (const auto &freeTile : tiles) {
+      if (freeTile / parentSize * parentSize == parent) {
+        ++freeSiblingCount;
+      }
+    }
+    if (freeSiblingCount < 3) {
+      break;
+    }
+    tiles.erase(std::remove_if(begin(tiles), end(tiles),
+                    [&](const glm::ivec2 &freeTile) {
+                      return freeTile / parentSize * parentSize == parent;
+                    }),
+        end(tiles));
+    tile = parent;
+    --level;
+  }
+  m_freeTiles[level].push_back(tile);
+}
+
+void ShadowAtlas::freeTiles(Light &light)
+{
+  for (const auto &tile : light.tiles) {
+    freeTile(light.tileSize, tile);
+  }
+  light.tiles.clear();
+  light.hasMap = false;
+  light.isStale = true;
+}
+
+bool ShadowAtlas::allocate(size_t lightIdx)
+{
+  auto &light = m_lights[lightIdx];
+  if (!light.tiles.empty() && light.tileSize == light.wantedSize) {
+    return true;
+  }
+  if (m_freeTiles.empty()) {
+    m_freeTiles.resize(getLevel(MIN_TILE_SIZE) + 1);
+    m_freeTiles[0].push_back(glm::ivec2(0));
+  }
+  freeTiles(light);
+
+  const auto allocateTiles = [&](GLsizei size) {
+    for (size_t v = 0; v < light.viewCount; ++v) {
+      glm::ivec2 origin;
+      if (!allocateTile(size, origin)) {
+        freeTiles(light);
+        return false;
+      }
+      light.tileSize = size;
+      light.tiles.push_back(origin);
+    }
+    return true;
+  };
+
+  // Shrink down to a quarter of the wanted size first, then take the tiles
+  // of less important lights, least important first
+  std::vector<size_t> victims;
+  for (size_t i = 0; i < m_lights.size(); ++i) {
+    if (i != lightIdx && !m_lights[i].tiles.empty() &&
+        m_lights[i].importance < light.importance) {
+      victims.push_back(i);
+    }
+  }
+  std::sort(begin(victims), end(victims), [&](size_t lhs, size_t rhs) {
+    return m_lights[lhs].importance < m_lights[rhs].importance;
+  });
+  const auto minSize = std::max(light.wantedSize / 4, MIN_TILE_SIZE);
+  for (size_t nextVictim = 0;; ++nextVictim) {
+    for (auto size = light.wantedSize; size >= minSize; size /= 2) {
+      if (allocateTiles(size)) {
+        return true;
+      }
+    }
+    if (nextVictim == victims.size()) {
+      return false;
+    }
+    freeTiles(m_lights[victims[nextVictim]]);
+  }
+}
+
+float ShadowAtlas::texelsPerUnit(size_t light) const
+{
+  const auto &shadowLight = m_lights[light];
+  return float(shadowLight.tileSize) /
+         (2.f * std::tan(0.5f * shadowLight.fieldOfView));
+}
+
+void ShadowAtlas::beginView(size_t light, size_t view)
+{
+  if (!m_texture) {
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexStorage2D(
+        GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, ATLAS_SIZE, ATLAS_SIZE);
+    m_textureMemory = TrackedGLMemory(GLMemoryCategory::RenderTargets,
+        getTextureByteSize(
+            GL_DEPTH_COMPONENT32F, ATLAS_SIZE, ATLAS_SIZE, 1, 1));
+    // Bilinear depth comparisons, lights.glsl keeps them inside the tiles
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(
+        GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_framebuffer = GLFramebuffer::create();
+    m_framebuffer.setDrawBuffer(GL_NONE);
+    m_framebuffer.attachTexture(GL_DEPTH_ATTACHMENT, m_texture);
+    assert(m_framebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+  }
+
+  m_nCurrentLight = light;
+  m_nCurrentView = view;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_drawFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, m_viewport);
+  glGetIntegerv(GL_DEPTH_FUNC, &m_depthFunc);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer.glId());
+  const auto &shadowLight = m_lights[light];
+  const auto &tile = shadowLight.tiles[view];
+  glViewport(tile.x, tile.y, shadowLight.tileSize, shadowLight.tileSize);
+  // Only clear the tile
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(tile.x, tile.y, shadowLight.tileSize, shadowLight.tileSize);
+  const GLfloat clearDepth = 1.f;
+  glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+  glDisable(GL_SCISSOR_TEST);
+  glDepthFunc(GL_LESS);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(SLOPE_OFFSET, UNITS_OFFSET);
+}
+
+void ShadowAtlas::endView()
+{
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glDepthFunc(GLenum(m_depthFunc));
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(m_drawFramebuffer));
+  glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+  ++m_nDrawnCount;
+  ++m_nTotalDrawnCount;
+
+  auto &light = m_lights[m_nCurrentLight];
+  light.drawnMatrices[m_nCurrentView] =
+      light.viewProjMatrices[m_nCurrentView];
+  if (m_nCurrentView + 1 == light.viewCount) {
+    light.hasMap = true;
+    light.isStale = false;
+    light.staleFrameCount = 0;
+  }
+}
+
+void ShadowAtlas::bind(
+    const glm::mat4 &viewMatrix, bool isEnabled, RingBuffer &ring)
+{
+  // Clip space to texture coordinates and depths, as CascadedShadowMaps
+  auto clipToTexture = glm::translate(glm::mat4(1), glm::vec3(0.5f));
+  clipToTexture = glm::scale(clipToTexture, glm::vec3(0.5f));
+  if (m_isZeroToOneDepth) {
+    clipToTexture[2] = glm::vec4(0, 0, 1, 0);
+    clipToTexture[3].z = 0.f;
+  }
+  const auto invViewMatrix = glm::inverse(viewMatrix);
+
+  m_views.clear();
+  m_lightViews.assign(std::max(m_lights.size(), size_t(1)), glm::uvec2(0));
+  for (size_t i = 0; isEnabled && m_texture && i < m_lights.size(); ++i) {
+    const auto &light = m_lights[i];
+    if (!light.hasMap) {
+      continue;
+    }
+    m_lightViews[i] = glm::uvec2(m_views.size(), light.viewCount);
+    const auto tileScale = float(light.tileSize) / ATLAS_SIZE;
+    const auto halfTexel = 0.5f / ATLAS_SIZE;
+    const auto texelSize =
+        2.f * std::tan(0.5f * light.fieldOfView) / float(light.tileSize);
+    for (size_t v = 0; v < light.viewCount; ++v) {
+      const auto tileMin = glm::vec2(light.tiles[v]) / float(ATLAS_SIZE);
+      auto tileToAtlas =
+          glm::translate(glm::mat4(1), glm::vec3(tileMin, 0.f));
+      tileToAtlas = glm::scale(tileToAtlas, glm::vec3(tileScale, tileScale, 1));
+      m_views.push_back(GpuView{tileToAtlas * clipToTexture *
+                                    light.drawnMatrices[v] * invViewMatrix,
+          glm::vec4(tileMin + halfTexel, tileMin + tileScale - halfTexel),
+          glm::vec4(texelSize, 0, 0, 0)});
+    }
+  }
+
+  // Without views, still bind a valid range
+  const GpuView noView{};
+  const auto viewsSize = std::max(m_views.size(), size_t(1)) * sizeof(noView);
+  const auto alignment = getViewsAlignment();
+  const auto viewsAllocation = ring.upload(
+      m_views.empty() ? &noView : m_views.data(), viewsSize, alignment);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, VIEWS_BINDING,
+      viewsAllocation.buffer, GLintptr(viewsAllocation.offset),
+      GLsizeiptr(viewsSize));
+  const auto lightsSize = m_lightViews.size() * sizeof(glm::uvec2);
+  const auto lightsAllocation =
+      ring.upload(m_lightViews.data(), lightsSize, alignment);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHTS_BINDING,
+      lightsAllocation.buffer, GLintptr(lightsAllocation.offset),
+      GLsizeiptr(lightsSize));
+
+  glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void ShadowAtlas::unbind() const
+{
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHTS_BINDING, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VIEWS_BINDING, 0);
+  glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+size_t ShadowAtlas::shadowedLightCount() const
+{
+  return size_t(std::count_if(begin(m_lights), end(m_lights),
+      [](const Light &light) { return light.hasMap; }));
+}
+
+void ShadowAtlas::release()
+{
+  if (m_texture) {
+    glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+  }
+  m_textureMemory = TrackedGLMemory();
+}
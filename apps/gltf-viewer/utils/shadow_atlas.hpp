@@ -0,0 +1,195 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "lights.hpp"
+#include "ring_buffer.hpp"
+#include "scene_hierarchy.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Shadow maps of the local lights of a scene (spot and point lights of
+// KHR_lights_punctual), in square tiles of a single depth texture sampled by
+// lights.glsl (see getLocalShadow). A spot light has one view along its
+// cone, a point light one view per face of a cube.
+//
+// Scenes with hundreds of lights can neither afford a map per light nor
+// draw them all each frame:
+// - tiles are sized by the pixels the sphere of influence of their light
+// covers on screen, in powers of two between MIN_TILE_SIZE and
+// MAX_TILE_SIZE, and allocated by splitting the atlas in quarters. When it
+// is full, the least important lights lose their tiles,
+// - maps are cached: a light is only drawn again when it moves, when a
+// draw within its range changes (see invalidateChangedDraws) or when its
+// tile size changes,
+// - scheduleUpdates picks the stale lights drawn in a frame within a budget
+// of views, by importance (screen coverage) times the frames they waited.
+// Lights off screen keep their map but are not drawn. A light shades with
+// its last drawn map, so moving lights lag by the frames they wait.
+class ShadowAtlas
+{
+public:
+  static const GLsizei ATLAS_SIZE = 4096;
+  static constexpr GLsizei MIN_TILE_SIZE = 64;
+  static const GLsizei MAX_TILE_SIZE = 1024;
+  static const size_t MAX_VIEW_COUNT = 6;
+  // After the texture of AmbientOcclusion
+  static const GLuint TEXTURE_UNIT = 23;
+  static const GLuint LIGHTS_BINDING = 22; // LightShadows buffer
+  static const GLuint VIEWS_BINDING = 23; // ShadowViews buffer
+
+  // ShadowView of lights.glsl, std430 layout
+  struct GpuView
+  {
+    // View space to the atlas texture coordinates and depth
+    glm::mat4 viewToShadow;
+    glm::vec4 rect; // Min and max texture coordinates of the tile
+    // x: world size of a texel at distance 1 from the light
+    glm::vec4 texel;
+  };
+
+  ShadowAtlas() = default;
+
+  ~ShadowAtlas() { release(); }
+
+  // Non-copyable class:
+  ShadowAtlas(const ShadowAtlas &) = delete;
+  ShadowAtlas &operator=(const ShadowAtlas &) = delete;
+
+  ShadowAtlas(ShadowAtlas &&rvalue) { *this = std::move(rvalue); }
+  ShadowAtlas &operator=(ShadowAtlas &&rvalue);
+
+  // Follow the local lights of lights placed by hierarchy, sized for the
+  // view of viewMatrix and projMatrix (a perspective projection) in a
+  // viewport of viewportHeight pixels. Lights that moved or whose tile size
+  // changed become stale. zeroToOneDepth is true if the clip control maps
+  // depths to [0, 1] (see ViewerOptions::reversedZ).
+  void update(const SceneLights &lights, const SceneHierarchy &hierarchy,
+      const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix,
+      float viewportHeight, bool zeroToOneDepth);
+
+  // Mark stale the lights reaching the old or new bounds of a draw that
+  // moved or became ready since the last call, as
+  // CascadedShadowMaps::invalidateChangedDraws
+  void invalidateChangedDraws(const std::vector<glm::vec3> &boundsMin,
+      const std::vector<glm::vec3> &boundsMax,
+      const std::vector<uint8_t> &isDrawReady, size_t poseVersion);
+
+  // Mark all lights stale and forget the draws
+  void invalidate();
+
+  // Stale lights on screen to draw this frame, by decreasing priority, with
+  // at most budget views in total. The first one is drawn whatever its view
+  // count, so that point lights are drawn with budgets below 6.
+  std::vector<size_t> scheduleUpdates(size_t budget);
+
+  // Allocate the tiles of light (in SceneLights order) at its size, freeing
+  // those of less important lights if the atlas is full. Return false if
+  // it cannot have any.
+  bool allocate(size_t light);
+
+  size_t viewCount(size_t light) const { return m_lights[light].viewCount; }
+
+  // World space to clip space of a view of light
+  const glm::mat4 &lightViewProjMatrix(size_t light, size_t view) const
+  {
+    return m_lights[light].viewProjMatrices[view];
+  }
+
+  // Position of light and texels per world unit at distance 1 from it, to
+  // choose levels of detail
+  const glm::vec3 &lightPosition(size_t light) const
+  {
+    return m_lights[light].position;
+  }
+  float texelsPerUnit(size_t light) const;
+
+  // Bind the tile of a view of light, allocated by allocate(), as depth
+  // only draw framebuffer and clear it, as CascadedShadowMaps::beginCascade
+  void beginView(size_t light, size_t view);
+
+  // Restore the state saved by beginView. The light is up to date once its
+  // last view is drawn.
+  void endView();
+
+  // Upload the views of the lights seen with viewMatrix to the current
+  // region of ring and bind them with the atlas. Without isEnabled, shaders
+  // see no shadowed local light.
+  void bind(const glm::mat4 &viewMatrix, bool isEnabled, RingBuffer &ring);
+
+  // Unbind what bind() bound
+  void unbind() const;
+
+  // Views drawn since the last update(), and since the creation
+  size_t drawnViewCount() const { return m_nDrawnCount; }
+  size_t totalDrawnViewCount() const { return m_nTotalDrawnCount; }
+  // Lights with an up to date or cached map
+  size_t shadowedLightCount() const;
+
+private:
+  struct Light
+  {
+    bool isLocal = false; // False for directional lights, never shadowed
+    size_t viewCount = 0; // 1 for spot lights, 6 for point lights
+    glm::vec3 position = glm::vec3(0);
+    glm::vec3 direction = glm::vec3(0);
+    float range = 0.f;
+    float fieldOfView = 0.f; // Of each view, in radians
+    // Screen coverage in pixels, 0 off screen
+    float importance = 0.f;
+    GLsizei wantedSize = 0;
+    std::array<glm::mat4, MAX_VIEW_COUNT> viewProjMatrices;
+    // Tiles, empty without allocation, and the matrices of their maps
+    GLsizei tileSize = 0;
+    std::vector<glm::ivec2> tiles;
+    std::array<glm::mat4, MAX_VIEW_COUNT> drawnMatrices;
+    bool hasMap = false;
+    bool isStale = true;
+    size_t staleFrameCount = 0;
+  };
+
+  // Quarter tiles of size until one is free, return false if none is
+  bool allocateTile(GLsizei size, glm::ivec2 &origin);
+  // Give a tile back, merging it with its free siblings
+  void freeTile(GLsizei size, const glm::ivec2 &origin);
+  void freeTiles(Light &light);
+  // Level of the tiles of size in m_freeTiles
+  size_t getLevel(GLsizei size) const;
+
+  void release();
+
+  GLuint m_texture = 0;
+  TrackedGLMemory m_textureMemory;
+  GLFramebuffer m_framebuffer;
+
+  std::vector<Light> m_lights;
+  bool m_isZeroToOneDepth = false;
+  // Origins of the free tiles of each size, from ATLAS_SIZE down to
+  // MIN_TILE_SIZE
+  std::vector<std::vector<glm::ivec2>> m_freeTiles;
+
+  // Draws as of the last invalidateChangedDraws
+  std::vector<glm::vec3> m_drawBoundsMin;
+  std::vector<glm::vec3> m_drawBoundsMax;
+  std::vector<uint8_t> m_isDrawReady;
+  size_t m_nPoseVersion = 0;
+
+  std::vector<GpuView> m_views;
+  std::vector<glm::uvec2> m_lightViews; // First view and count per light
+
+  // Saved by beginView
+  size_t m_nCurrentLight = 0;
+  size_t m_nCurrentView = 0;
+  GLint m_drawFramebuffer = 0;
+  GLint m_viewport[4] = {};
+  GLint m_depthFunc = GL_LESS;
+
+  size_t m_nDrawnCount = 0;
+  size_t m_nTotalDrawnCount = 0;
+};
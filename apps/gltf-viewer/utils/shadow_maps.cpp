@@ -0,0 +1,327 @@
+#include "shadow_maps.hpp"
+#include "frustum.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+// Half size of the region of a cascade over the radius of its slice, and
+// fraction of the depth range of the scene added on both sides: the camera
+// and the scene move that much before the cascade is drawn again
+const float REGION_MARGIN = 1.5f;
+const float DEPTH_MARGIN = 0.25f;
+
+// Blend of logarithmic (1) and uniform (0) splits of the view depth range
+const float SPLIT_LAMBDA = 0.8f;
+// Same lower bound of the near plane as LightClusters
+const float MIN_NEAR_RATIO = 1e-3f;
+
+// Below this cosine between the cached and the current light directions,
+// every cascade is drawn again
+const float MIN_LIGHT_COSINE = 0.99999f;
+
+// Depth offset of the shadow casters, in addition to the normal offset of
+// lights.glsl
+const float SLOPE_OFFSET = 2.f;
+const float UNITS_OFFSET = 4.f;
+
+bool isUnbounded(const glm::vec3 &bboxMax)
+{
+  return bboxMax.x == std::numeric_limits<float>::max();
+}
+
+} // namespace
+
+CascadedShadowMaps &CascadedShadowMaps::operator=(
+    CascadedShadowMaps &&rvalue)
+{
+  if (this != &rvalue) {
+    release();
+    std::swap(m_texture, rvalue.m_texture);
+    std::swap(m_textureMemory, rvalue.m_textureMemory);
+    std::swap(m_framebuffer, rvalue.m_framebuffer);
+    std::swap(m_uniforms, rvalue.m_uniforms);
+    std::swap(m_lightViewMatrix, rvalue.m_lightViewMatrix);
+    std::swap(m_lightDirection, rvalue.m_lightDirection);
+    std::swap(m_isZeroToOneDepth, rvalue.m_isZeroToOneDepth);
+    std::swap(m_cascades, rvalue.m_cascades);
+    std::swap(m_cascadeDepths, rvalue.m_cascadeDepths);
+    std::swap(m_drawBoundsMin, rvalue.m_drawBoundsMin);
+    std::swap(m_drawBoundsMax, rvalue.m_drawBoundsMax);
+    std::swap(m_isDrawReady, rvalue.m_isDrawReady);
+    std::swap(m_nPoseVersion, rvalue.m_nPoseVersion);
+    std::swap(m_nDrawnCount, rvalue.m_nDrawnCount);
+    std::swap(m_nTotalDrawnCount, rvalue.m_nTotalDrawnCount);
+  }
+  return *this;
+}
+
+void CascadedShadowMaps::update(const glm::vec3 &lightDirection,
+    const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix, float zNear,
+    float zFar, const glm::vec3 &sceneMin, const glm::vec3 &sceneMax,
+    bool zeroToOneDepth)
+{
+  m_nDrawnCount = 0;
+  const auto direction = glm::normalize(lightDirection);
+  if (glm::dot(direction, m_lightDirection) < MIN_LIGHT_COSINE ||
+      zeroToOneDepth != m_isZeroToOneDepth) {
+    m_lightDirection = direction;
+    m_isZeroToOneDepth = zeroToOneDepth;
+    const auto up = std::abs(direction.y) < 0.99f ? glm::vec3(0, 1, 0)
+                                                   : glm::vec3(1, 0, 0);
+    m_lightViewMatrix = glm::lookAt(glm::vec3(0), direction, up);
+    for (auto &cascade : m_cascades) {
+      cascade.halfSize = 0.f; // Fitted again below
+    }
+  }
+
+  // Depth range of the scene along the light
+  auto sceneDepthMin = std::numeric_limits<float>::max();
+  auto sceneDepthMax = std::numeric_limits<float>::lowest();
+  for (size_t corner = 0; corner < 8; ++corner) {
+    const auto position = glm::vec3(corner & 1 ? sceneMax.x : sceneMin.x,
+        corner & 2 ? sceneMax.y : sceneMin.y,
+        corner & 4 ? sceneMax.z : sceneMin.z);
+    const auto depth = -(m_lightViewMatrix * glm::vec4(position, 1)).z;
+    sceneDepthMin = std::min(sceneDepthMin, depth);
+    sceneDepthMax = std::max(sceneDepthMax, depth);
+  }
+
+  // Slices of the view frustum, whose corners at view depth d are d times
+  // those at depth 1 (see LightClusters::Uniforms::ndcToView)
+  zNear = std::max(zNear, MIN_NEAR_RATIO * zFar);
+  const auto invViewMatrix = glm::inverse(viewMatrix);
+  const auto ndcScale =
+      glm::vec2(1.f / projMatrix[0][0], 1.f / projMatrix[1][1]);
+  const auto ndcOffset = glm::vec2(projMatrix[2][0] / projMatrix[0][0],
+      projMatrix[2][1] / projMatrix[1][1]);
+  auto sliceNear = zNear;
+  for (size_t c = 0; c < CASCADE_COUNT; ++c) {
+    const auto ratio = float(c + 1) / CASCADE_COUNT;
+    const auto sliceFar =
+        SPLIT_LAMBDA * zNear * std::pow(zFar / zNear, ratio) +
+        (1.f - SPLIT_LAMBDA) * (zNear + (zFar - zNear) * ratio);
+    m_cascadeDepths[c] = sliceFar;
+
+    glm::vec3 corners[8];
+    auto center = glm::vec3(0);
+    for (size_t corner = 0; corner < 8; ++corner) {
+      const auto depth = corner & 4 ? sliceFar : sliceNear;
+      const auto ndc =
+          glm::vec2(corner & 1 ? 1.f : -1.f, corner & 2 ? 1.f : -1.f);
+      const auto viewPosition =
+          glm::vec4((ndc * ndcScale + ndcOffset) * depth, -depth, 1);
+      corners[corner] = glm::vec3(invViewMatrix * viewPosition);
+      center += corners[corner] / 8.f;
+    }
+    auto radius = 0.f;
+    for (const auto &corner : corners) {
+      radius = std::max(radius, glm::distance(corner, center));
+    }
+    sliceNear = sliceFar;
+
+    auto &cascade = m_cascades[c];
+    const auto lightCenter =
+        glm::vec2(m_lightViewMatrix * glm::vec4(center, 1));
+    const auto offset = glm::abs(lightCenter - cascade.center) + radius;
+    if (offset.x <= cascade.halfSize && offset.y <= cascade.halfSize &&
+        radius * REGION_MARGIN * REGION_MARGIN >= cascade.halfSize &&
+        sceneDepthMin >= cascade.depthMin &&
+        sceneDepthMax <= cascade.depthMax) {
+      continue;
+    }
+
+    // The region moves by whole texels, so that the texels of the scene
+    // keep their place in the shadow map
+    cascade.isStale = true;
+    cascade.halfSize = radius * REGION_MARGIN;
+    const auto texelSize = 2.f * cascade.halfSize / MAP_SIZE;
+    cascade.center = glm::floor(lightCenter / texelSize) * texelSize;
+    const auto depthMargin =
+        DEPTH_MARGIN * std::max(sceneDepthMax - sceneDepthMin, 1e-3f);
+    cascade.depthMin = sceneDepthMin - depthMargin;
+    cascade.depthMax = sceneDepthMax + depthMargin;
+    const auto left = cascade.center.x - cascade.halfSize;
+    const auto right = cascade.center.x + cascade.halfSize;
+    const auto bottom = cascade.center.y - cascade.halfSize;
+    const auto top = cascade.center.y + cascade.halfSize;
+    const auto projection =
+        zeroToOneDepth ? glm::orthoRH_ZO(left, right, bottom, top,
+                             cascade.depthMin, cascade.depthMax)
+                       : glm::orthoRH_NO(left, right, bottom, top,
+                             cascade.depthMin, cascade.depthMax);
+    cascade.viewProjMatrix = projection * m_lightViewMatrix;
+  }
+}
+
+void CascadedShadowMaps::invalidate()
+{
+  for (auto &cascade : m_cascades) {
+    cascade.isStale = true;
+  }
+  m_drawBoundsMin.clear();
+  m_drawBoundsMax.clear();
+  m_isDrawReady.clear();
+}
+
+void CascadedShadowMaps::invalidateChangedDraws(
+    const std::vector<glm::vec3> &boundsMin,
+    const std::vector<glm::vec3> &boundsMax,
+    const std::vector<uint8_t> &isDrawReady, size_t poseVersion)
+{
+  // A new scene changes everything
+  if (boundsMin.size() != m_drawBoundsMin.size()) {
+    for (auto &cascade : m_cascades) {
+      cascade.isStale = true;
+    }
+    m_drawBoundsMin = boundsMin;
+    m_drawBoundsMax = boundsMax;
+    m_isDrawReady = isDrawReady;
+    m_nPoseVersion = poseVersion;
+    return;
+  }
+
+  const auto hasPoseChanged = poseVersion != m_nPoseVersion;
+  m_nPoseVersion = poseVersion;
+  Frustum frustums[CASCADE_COUNT];
+  for (size_t c = 0; c < CASCADE_COUNT; ++c) {
+    frustums[c] = extractFrustum(m_cascades[c].viewProjMatrix);
+  }
+  const auto invalidate = [&](const glm::vec3 &bboxMin,
+                              const glm::vec3 &bboxMax) {
+    for (size_t c = 0; c < CASCADE_COUNT; ++c) {
+      auto &cascade = m_cascades[c];
+      if (!cascade.isStale &&
+          (isUnbounded(bboxMax) ||
+              intersectsBox(frustums[c], bboxMin, bboxMax))) {
+        cascade.isStale = true;
+      }
+    }
+  };
+  for (size_t i = 0; i < boundsMin.size(); ++i) {
+    const auto hasMoved = boundsMin[i] != m_drawBoundsMin[i] ||
+                          boundsMax[i] != m_drawBoundsMax[i];
+    const auto hasChanged = hasMoved || isDrawReady[i] != m_isDrawReady[i] ||
+                            (hasPoseChanged && isUnbounded(boundsMax[i]));
+    if (!hasChanged) {
+      continue;
+    }
+    // Its old shadow is drawn over as well
+    if (m_isDrawReady[i]) {
+      invalidate(m_drawBoundsMin[i], m_drawBoundsMax[i]);
+    }
+    if (isDrawReady[i]) {
+      invalidate(boundsMin[i], boundsMax[i]);
+    }
+    m_drawBoundsMin[i] = boundsMin[i];
+    m_drawBoundsMax[i] = boundsMax[i];
+    m_isDrawReady[i] = isDrawReady[i];
+  }
+}
+
+void CascadedShadowMaps::beginCascade(size_t cascade)
+{
+  if (!m_texture) {
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, MAP_SIZE,
+        MAP_SIZE, GLsizei(CASCADE_COUNT));
+    m_textureMemory = TrackedGLMemory(GLMemoryCategory::RenderTargets,
+        getTextureByteSize(
+            GL_DEPTH_COMPONENT32F, MAP_SIZE, MAP_SIZE, 1, CASCADE_COUNT));
+    // Bilinear depth comparisons, outside of the maps is lit
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(
+        GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(
+        GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    const GLfloat border[4] = {1.f, 1.f, 1.f, 1.f};
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE,
+        GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    m_framebuffer = GLFramebuffer::create();
+    m_framebuffer.setDrawBuffer(GL_NONE);
+  }
+
+  m_nCurrentCascade = cascade;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_drawFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, m_viewport);
+  glGetIntegerv(GL_DEPTH_FUNC, &m_depthFunc);
+  m_framebuffer.attachTextureLayer(
+      GL_DEPTH_ATTACHMENT, m_texture, 0, GLint(cascade));
+  assert(m_framebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer.glId());
+  glViewport(0, 0, MAP_SIZE, MAP_SIZE);
+  const GLfloat clearDepth = 1.f;
+  glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+  glDepthFunc(GL_LESS);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(SLOPE_OFFSET, UNITS_OFFSET);
+}
+
+void CascadedShadowMaps::endCascade()
+{
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glDepthFunc(GLenum(m_depthFunc));
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(m_drawFramebuffer));
+  glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+  m_cascades[m_nCurrentCascade].isStale = false;
+  ++m_nDrawnCount;
+  ++m_nTotalDrawnCount;
+}
+
+void CascadedShadowMaps::bind(
+    const glm::mat4 &viewMatrix, bool isEnabled, RingBuffer &ring)
+{
+  // Clip space to texture coordinates and depths
+  auto clipToTexture = glm::translate(glm::mat4(1), glm::vec3(0.5f));
+  clipToTexture = glm::scale(clipToTexture, glm::vec3(0.5f));
+  if (m_isZeroToOneDepth) {
+    clipToTexture[2] = glm::vec4(0, 0, 1, 0);
+    clipToTexture[3].z = 0.f;
+  }
+  const auto invViewMatrix = glm::inverse(viewMatrix);
+
+  m_uniforms.reset(sizeof(Uniforms), 1);
+  auto &uniforms = m_uniforms.block<Uniforms>(0);
+  for (size_t c = 0; c < CASCADE_COUNT; ++c) {
+    const auto &cascade = m_cascades[c];
+    uniforms.viewToShadow[c] =
+        clipToTexture * cascade.viewProjMatrix * invViewMatrix;
+    uniforms.cascadeDepths[c] = m_cascadeDepths[c];
+    uniforms.texelSizes[c] = 2.f * cascade.halfSize / MAP_SIZE;
+  }
+  uniforms.info = glm::uvec4(isEnabled && m_texture ? 1 : 0, 0, 0, 0);
+  m_uniforms.upload(ring);
+  m_uniforms.bind(UNIFORMS_BINDING, 0);
+
+  glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void CascadedShadowMaps::unbind() const
+{
+  glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORMS_BINDING, 0);
+  glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void CascadedShadowMaps::release()
+{
+  if (m_texture) {
+    glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+  }
+  m_textureMemory = TrackedGLMemory();
+}
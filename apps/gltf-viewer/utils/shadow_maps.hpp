@@ -0,0 +1,157 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "ring_buffer.hpp"
+#include "uniform_buffer.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Cascaded shadow maps of a directional light, cached between frames: the
+// view frustum is split in CASCADE_COUNT depth slices, each covered by an
+// orthographic shadow map along the light, in the layers of a depth texture
+// array sampled by lights.glsl (see getShadow).
+//
+// The shadow map of a cascade covers a square region of light space
+// REGION_MARGIN times larger than the bounding sphere of its slice, snapped
+// to its texels, over the depth range of the whole scene. It is only drawn
+// again when the slice leaves that region (or shrinks well below it), when
+// the light turns, or when a draw inside it changes (see
+// invalidateChangedDraws). A static scene seen by a camera moving within the
+// margins draws no shadow map at all.
+class CascadedShadowMaps
+{
+public:
+  static const size_t CASCADE_COUNT = 4;
+  static const GLsizei MAP_SIZE = 2048;
+  static const GLuint UNIFORMS_BINDING = 3; // ShadowUniforms block
+  // After the texture arrays of MaterialBuffer
+  static const GLuint TEXTURE_UNIT = 16;
+
+  // ShadowUniforms block of lights.glsl, std140 layout
+  struct Uniforms
+  {
+    // View space to the texture coordinates and depth of each cascade
+    glm::mat4 viewToShadow[CASCADE_COUNT];
+    glm::vec4 cascadeDepths; // Far view depth of each cascade
+    glm::vec4 texelSizes; // World size of a texel of each cascade
+    glm::uvec4 info; // x: 1 if the first directional light is shadowed
+  };
+
+  CascadedShadowMaps() = default;
+
+  ~CascadedShadowMaps() { release(); }
+
+  // Non-copyable class:
+  CascadedShadowMaps(const CascadedShadowMaps &) = delete;
+  CascadedShadowMaps &operator=(const CascadedShadowMaps &) = delete;
+
+  CascadedShadowMaps(CascadedShadowMaps &&rvalue)
+  {
+    *this = std::move(rvalue);
+  }
+  CascadedShadowMaps &operator=(CascadedShadowMaps &&rvalue);
+
+  // Split the view frustum of viewMatrix and projMatrix (a perspective
+  // projection) between view depths zNear and zFar, for a light going along
+  // the world space lightDirection over the scene bounds [sceneMin,
+  // sceneMax]. Cascades whose region does not hold their slice anymore are
+  // fitted again and become stale. zeroToOneDepth is true if the clip
+  // control maps depths to [0, 1] (see ViewerOptions::reversedZ).
+  void update(const glm::vec3 &lightDirection, const glm::mat4 &viewMatrix,
+      const glm::mat4 &projMatrix, float zNear, float zFar,
+      const glm::vec3 &sceneMin, const glm::vec3 &sceneMax,
+      bool zeroToOneDepth);
+
+  // Mark stale the cascades containing the old or new bounds of a draw that
+  // moved or became ready since the last call. Unbounded draws (skinned and
+  // morphed ones) also change when poseVersion does (see Scene::poseVersion).
+  void invalidateChangedDraws(const std::vector<glm::vec3> &boundsMin,
+      const std::vector<glm::vec3> &boundsMax,
+      const std::vector<uint8_t> &isDrawReady, size_t poseVersion);
+
+  // Mark all cascades stale and forget the draws, whose indices no longer
+  // match (see ViewerApplication::switchScene)
+  void invalidate();
+
+  bool isStale(size_t cascade) const { return m_cascades[cascade].isStale; }
+
+  // World space to clip space of the shadow map of cascade
+  const glm::mat4 &lightViewProjMatrix(size_t cascade) const
+  {
+    return m_cascades[cascade].viewProjMatrix;
+  }
+
+  // Texels of the shadow map of cascade per world unit
+  float texelsPerUnit(size_t cascade) const
+  {
+    return MAP_SIZE / (2.f * m_cascades[cascade].halfSize);
+  }
+
+  // Bind the layer of cascade as depth only draw framebuffer and clear it,
+  // with a standard depth test and a slope scaled depth offset. The draw
+  // framebuffer, viewport and depth function are saved.
+  void beginCascade(size_t cascade);
+
+  // Restore the state saved by beginCascade, the cascade is up to date
+  void endCascade();
+
+  // Upload the uniforms of the cascades seen with viewMatrix to the current
+  // region of ring and bind them with the shadow maps. Without isEnabled,
+  // shaders see no shadowed light.
+  void bind(const glm::mat4 &viewMatrix, bool isEnabled, RingBuffer &ring);
+
+  // Unbind what bind() bound
+  void unbind() const;
+
+  // Cascades drawn since the last update(), and since the creation
+  size_t drawnCascadeCount() const { return m_nDrawnCount; }
+  size_t totalDrawnCascadeCount() const { return m_nTotalDrawnCount; }
+
+private:
+  struct Cascade
+  {
+    bool isStale = true;
+    // Region of light space: center and half size of the square, depth
+    // range along the light
+    glm::vec2 center = glm::vec2(0);
+    float halfSize = 0.f;
+    float depthMin = 0.f;
+    float depthMax = 0.f;
+    glm::mat4 viewProjMatrix = glm::mat4(1);
+  };
+
+  void release();
+
+  GLuint m_texture = 0;
+  TrackedGLMemory m_textureMemory;
+  GLFramebuffer m_framebuffer;
+  UniformBuffer m_uniforms;
+
+  // World to light space, rotating -z to the light direction
+  glm::mat4 m_lightViewMatrix = glm::mat4(1);
+  glm::vec3 m_lightDirection = glm::vec3(0);
+  bool m_isZeroToOneDepth = false;
+  Cascade m_cascades[CASCADE_COUNT];
+  float m_cascadeDepths[CASCADE_COUNT] = {};
+
+  // Draws as of the last invalidateChangedDraws
+  std::vector<glm::vec3> m_drawBoundsMin;
+  std::vector<glm::vec3> m_drawBoundsMax;
+  std::vector<uint8_t> m_isDrawReady;
+  size_t m_nPoseVersion = 0;
+
+  // Saved by beginCascade
+  size_t m_nCurrentCascade = 0;
+  GLint m_drawFramebuffer = 0;
+  GLint m_viewport[4] = {};
+  GLint m_depthFunc = GL_LESS;
+
+  size_t m_nDrawnCount = 0;
+  size_t m_nTotalDrawnCount = 0;
+};
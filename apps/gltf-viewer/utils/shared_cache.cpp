@@ -0,0 +1,182 @@
+#include "shared_cache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+unsigned long getProcessId()
+{
+#ifdef _WIN32
+  return GetCurrentProcessId();
+#else
+  return (unsigned long)getpid();
+#endif
+}
+
+fs::path getLockPath(const fs::path &entryPath)
+{
+  auto lockPath = entryPath;
+  lockPath += ".lock";
+  return lockPath;
+}
+
+} // namespace
+
+fs::path getCacheEntryPath(
+    const fs::path &directory, uint64_t key, const std::string &extension)
+{
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+  return directory / (name + extension);
+}
+
+fs::path getTemporaryCachePath(const fs::path &path)
+{
+  static std::atomic<unsigned> counter{0};
+  char suffix[48];
+  std::snprintf(suffix, sizeof(suffix), ".%lu.%u.tmp", getProcessId(),
+      counter.fetch_add(1, std::memory_order_relaxed));
+  auto tmpPath = path;
+  tmpPath += suffix;
+  return tmpPath;
+}
+
+void touchCacheEntry(const fs::path &path)
+{
+  std::error_code errorCode;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), errorCode);
+}
+
+#ifdef _WIN32
+
+CacheEntryLock::CacheEntryLock(const fs::path &entryPath, bool wait)
+{
+  std::error_code errorCode;
+  fs::create_directories(entryPath.parent_path(), errorCode);
+  const auto file = CreateFileW(getLockPath(entryPath).wstring().c_str(),
+      GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+      nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  m_hFile = file;
+  OVERLAPPED overlapped = {};
+  const DWORD flags =
+      LOCKFILE_EXCLUSIVE_LOCK | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+  m_isLocked = LockFileEx(file, flags, 0, 1, 0, &overlapped) != 0;
+}
+
+void CacheEntryLock::release()
+{
+  if (m_hFile) {
+    // Closing the handle releases the lock
+    CloseHandle(m_hFile);
+    m_hFile = nullptr;
+  }
+  m_isLocked = false;
+}
+
+#else
+
+CacheEntryLock::CacheEntryLock(const fs::path &entryPath, bool wait)
+{
+  std::error_code errorCode;
+  fs::create_directories(entryPath.parent_path(), errorCode);
+  m_fd = open(
+      getLockPath(entryPath).string().c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+      0666);
+  if (m_fd < 0) {
+    return;
+  }
+  int result = 0;
+  do {
+    result = flock(m_fd, LOCK_EX | (wait ? 0 : LOCK_NB));
+  } while (result != 0 && errno == EINTR);
+  m_isLocked = result == 0;
+}
+
+void CacheEntryLock::release()
+{
+  if (m_fd >= 0) {
+    // Closing the file releases the lock
+    close(m_fd);
+    m_fd = -1;
+  }
+  m_isLocked = false;
+}
+
+#endif
+
+uintmax_t collectCacheGarbage(const fs::path &directory,
+    const std::vector<std::string> &extensions, uintmax_t maxBytes)
+{
+  struct Entry
+  {
+    fs::path path;
+    uintmax_t size;
+    fs::file_time_type lastUse;
+  };
+  std::vector<Entry> entries;
+  uintmax_t totalBytes = 0;
+  std::error_code errorCode;
+  for (fs::directory_iterator it{directory, errorCode}, itEnd;
+       !errorCode && it != itEnd; it.increment(errorCode)) {
+    const auto &path = it->path();
+    const auto extension = path.extension().string();
+    if (std::find(begin(extensions), end(extensions), extension) ==
+            end(extensions) ||
+        !fs::is_regular_file(it->status())) {
+      continue;
+    }
+    std::error_code entryError;
+    const auto size = fs::file_size(path, entryError);
+    const auto lastUse = fs::last_write_time(path, entryError);
+    if (entryError) {
+      continue;
+    }
+    entries.push_back({path, size, lastUse});
+    totalBytes += size;
+  }
+  if (totalBytes <= maxBytes) {
+    return 0;
+  }
+
+  std::sort(begin(entries), end(entries),
+      [](const Entry &lhs, const Entry &rhs) {
+        return lhs.lastUse < rhs.lastUse;
+      });
+  uintmax_t removedBytes = 0;
+  for (const auto &entry : entries) {
+    if (totalBytes - removedBytes <= maxBytes) {
+      break;
+    }
+    // Entries being written or waited for are kept. Readers keep mapping
+    // removed entries until they unmap them.
+    const CacheEntryLock lock{entry.path, false};
+    if (!lock.isLocked()) {
+      continue;
+    }
+    std::error_code removeError;
+    if (fs::remove(entry.path, removeError)) {
+      removedBytes += entry.size;
+      // A process opening it now locks a file that is no longer found by
+      // the others, at worst it produces the entry again
+      fs::remove(getLockPath(entry.path), removeError);
+    }
+  }
+  return removedBytes;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Entries of the cache directories shared by the viewer processes of a
+// machine (scene caches, program binaries):
+// - entries are named by the key of their content, so that every process
+// finds the entry of an asset whatever its path,
+// - they are written in a temporary file unique to the writer, then renamed,
+// so that readers only see complete entries and concurrent writers of the
+// same key do not write in the same file,
+// - a process producing an entry holds its CacheEntryLock, so that the other
+// processes wait for the entry instead of producing it again,
+// - collectCacheGarbage removes the least recently used entries beyond a
+// size.
+
+// Entry of key in directory, e.g. "0123456789abcdef.gltfcache"
+fs::path getCacheEntryPath(
+    const fs::path &directory, uint64_t key, const std::string &extension);
+
+// Path next to path, unique to this process and call, to write an entry
+// before renaming it to path
+fs::path getTemporaryCachePath(const fs::path &path);
+
+// Mark the entry of path as used now, for collectCacheGarbage. Errors are
+// ignored.
+void touchCacheEntry(const fs::path &path);
+
+// Exclusive lock of an entry between processes, advisory: only the processes
+// taking it wait. Held on "<entry>.lock", which is left in place, the
+// directory of the entry is created if needed.
+class CacheEntryLock
+{
+public:
+  CacheEntryLock() = default;
+
+  // Wait for the lock if wait is set, give up otherwise if it is held
+  explicit CacheEntryLock(const fs::path &entryPath, bool wait = true);
+
+  ~CacheEntryLock() { release(); }
+
+  CacheEntryLock(const CacheEntryLock &) = delete;
+  CacheEntryLock &operator=(const CacheEntryLock &) = delete;
+
+  // False if the lock file cannot be created (read-only directory...) or if
+  // the lock is held and not waited for
+  bool isLocked() const { return m_isLocked; }
+
+  void release();
+
+private:
+  bool m_isLocked = false;
+#ifdef _WIN32
+  void *m_hFile = nullptr;
+#else
+  int m_fd = -1;
+#endif
+};
+
+// Remove the least recently used entries of directory (by last write time,
+// see touchCacheEntry) whose extension is one of extensions until they take
+// at most maxBytes. Locked entries are kept. Return the number of bytes
+// removed.
+uintmax_t collectCacheGarbage(const fs::path &directory,
+    const std::vector<std::string> &extensions, uintmax_t maxBytes);
@@ -0,0 +1,51 @@
+#include "shared_context.hpp"
+
+#include <stdexcept>
+
+SharedGLContext::SharedGLContext(GLFWHandle &handle)
+{
+  if (handle.isHeadless()) {
+    m_pHeadlessContext =
+        HeadlessGLContext::createShared(*handle.headlessContext());
+    return;
+  }
+
+  // Other hints (version, profile, debug flag) are still those of the
+  // window of the handle
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  m_pWindow = glfwCreateWindow(1, 1, "Loader", nullptr, handle.window());
+  glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+  if (!m_pWindow) {
+    throw std::runtime_error("Unable to create a shared GLFW context.");
+  }
+}
+
+SharedGLContext::~SharedGLContext()
+{
+  if (m_pWindow) {
+    glfwDestroyWindow(m_pWindow);
+  }
+}
+
+void SharedGLContext::makeCurrent()
+{
+  if (m_pHeadlessContext) {
+    m_pHeadlessContext->makeCurrent();
+  } else {
+    glfwMakeContextCurrent(m_pWindow);
+  }
+  // Debug output state is per context
+  if (!m_hasDebugOutput) {
+    m_hasDebugOutput = true;
+    initGLDebugOutput();
+  }
+}
+
+void SharedGLContext::doneCurrent()
+{
+  if (m_pHeadlessContext) {
+    m_pHeadlessContext->doneCurrent();
+  } else {
+    glfwMakeContextCurrent(nullptr);
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "GLFWHandle.hpp"
+
+#include <memory>
+
+// Second OpenGL context sharing the objects of the context of a GLFWHandle
+// (buffers, textures, programs, sync objects), to issue GL commands from a
+// loader thread. It is a hidden 1x1 window for handles with a window, and
+// another EGL context on the same display for headless handles. Container
+// objects (vertex arrays, framebuffers) are not shared and must stay on the
+// thread of the handle.
+//
+// Commands of one context are only guaranteed to be visible to the other
+// through a fence: the writer calls glFenceSync then glFlush, the reader
+// calls glWaitSync on the fence before using the objects.
+class SharedGLContext
+{
+public:
+  // Must be called on the thread of handle, with its context current. Throw
+  // std::runtime_error on failure.
+  explicit SharedGLContext(GLFWHandle &handle);
+
+  // Must be called on the thread of the handle, with the context current on
+  // no thread
+  ~SharedGLContext();
+
+  // Non-copyable class:
+  SharedGLContext(const SharedGLContext &) = delete;
+  SharedGLContext &operator=(const SharedGLContext &) = delete;
+
+  // Make the context current on the calling thread, which must have no
+  // current context. Throw std::runtime_error on failure.
+  void makeCurrent();
+
+  void doneCurrent();
+
+private:
+  std::unique_ptr<HeadlessGLContext> m_pHeadlessContext;
+  GLFWwindow *m_pWindow = nullptr;
+  bool m_hasDebugOutput = false; // Set up by the first makeCurrent()
+};
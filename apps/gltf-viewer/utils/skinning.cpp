@@ -0,0 +1,304 @@
+#include "skinning.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+
+// Storage buffer bindings of skin_vertices.cs.glsl
+const GLuint BIND_POSITIONS_BINDING = 8;
+const GLuint BIND_NORMALS_BINDING = 9;
+const GLuint SKIN_VERTICES_BINDING = 10;
+const GLuint POSITIONS_BINDING = 11;
+const GLuint NORMALS_BINDING = 12;
+
+size_t getPaletteAlignment()
+{
+  GLint alignment = 0;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return std::max(size_t(alignment), sizeof(glm::vec4));
+}
+
+} // namespace
+
+SceneSkins &SceneSkins::operator=(SceneSkins &&rvalue)
+{
+  if (this != &rvalue) {
+    std::swap(m_vertexBuffer, rvalue.m_vertexBuffer);
+    std::swap(m_nodeSkins, rvalue.m_nodeSkins);
+    std::swap(m_joints, rvalue.m_joints);
+    std::swap(m_inverseBindMatrices, rvalue.m_inverseBindMatrices);
+    std::swap(m_palette, rvalue.m_palette);
+    std::swap(m_skinPalettes, rvalue.m_skinPalettes);
+    std::swap(m_skinnedRanges, rvalue.m_skinnedRanges);
+    std::swap(m_bindPoseBuffers, rvalue.m_bindPoseBuffers);
+    std::swap(m_hasBindPose, rvalue.m_hasBindPose);
+    std::swap(m_prepassData, rvalue.m_prepassData);
+  }
+  return *this;
+}
+
+void SceneSkins::build(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const SceneHierarchy &hierarchy,
+    const std::vector<ArenaPrimitive> &primitives,
+    const std::vector<size_t> &meshToPrimitives, size_t vertexCount)
+{
+  *this = SceneSkins();
+
+  for (const auto &skin : model.skins) {
+    const auto first = m_joints.size();
+    std::vector<glm::mat4> inverseBindMatrices(
+        skin.joints.size(), glm::mat4(1));
+    if (skin.inverseBindMatrices >= 0 && !skin.joints.empty()) {
+      const auto &accessor = model.accessors[skin.inverseBindMatrices];
+      if (accessor.count == skin.joints.size()) {
+        readAccessorAsFloats(model, buffers, accessor, 16,
+            &inverseBindMatrices.front()[0][0]);
+      }
+    }
+    for (size_t i = 0; i < skin.joints.size(); ++i) {
+      // Joints outside of the scene keep an identity joint matrix
+      const auto joint = hierarchy.findNode(skin.joints[i]);
+      m_joints.push_back(joint >= 0 ? uint32_t(joint) : uint32_t(-1));
+      m_inverseBindMatrices.push_back(inverseBindMatrices[i]);
+    }
+    m_skinPalettes.emplace_back(first, skin.joints.size());
+  }
+  // Never empty so that every skin has a palette to bind
+  m_palette.assign(std::max(m_joints.size(), size_t(1)), glm::mat4(1));
+
+  // Meshes are skinned if they have joints and weights
+  std::vector<bool> isMeshSkinned(model.meshes.size(), false);
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    for (const auto &primitive : model.meshes[meshIdx].primitives) {
+      if (primitive.attributes.count("JOINTS_0") &&
+          primitive.attributes.count("WEIGHTS_0")) {
+        isMeshSkinned[meshIdx] = true;
+      }
+    }
+  }
+
+  m_nodeSkins.assign(hierarchy.size(), -1);
+  std::vector<bool> isMeshInPrepass(model.meshes.size(), false);
+  size_t bindPoseVertexCount = 0;
+  size_t sharedMeshCount = 0;
+  for (size_t flatIdx = 0; flatIdx < hierarchy.size(); ++flatIdx) {
+    const auto meshIdx = hierarchy.mesh(flatIdx);
+    const auto skin = model.nodes[hierarchy.node(flatIdx)].skin;
+    if (meshIdx < 0 || !isMeshSkinned[meshIdx] || skin < 0 ||
+        size_t(skin) >= m_skinPalettes.size()) {
+      continue;
+    }
+    m_nodeSkins[flatIdx] = skin;
+
+    // Primitives of a mesh are contiguous in the arena
+    const auto firstPrimitive = meshToPrimitives[meshIdx];
+    const auto primitiveCount = model.meshes[meshIdx].primitives.size();
+    if (isMeshInPrepass[meshIdx] || !primitiveCount) {
+      sharedMeshCount += primitiveCount ? 1 : 0;
+      continue;
+    }
+    isMeshInPrepass[meshIdx] = true;
+    const auto &first = primitives[firstPrimitive];
+    const auto &last = primitives[firstPrimitive + primitiveCount - 1];
+    const auto firstVertex = GLuint(first.baseVertex);
+    const auto endVertex = GLuint(last.baseVertex) + last.vertexCount;
+    m_skinnedRanges.push_back({skin, firstVertex, endVertex - firstVertex,
+        GLuint(bindPoseVertexCount)});
+    bindPoseVertexCount += endVertex - firstVertex;
+  }
+  if (sharedMeshCount) {
+    std::cerr << "Warning: " << sharedMeshCount
+              << " meshes are skinned by several nodes, the skinning "
+                 "pre-pass only skins them with their first node"
+              << std::endl;
+  }
+
+  if (empty()) {
+    return;
+  }
+  // Vertices of primitives without skin keep null weights
+  const std::vector<SkinVertex> zeros(std::max(vertexCount, size_t(1)),
+      SkinVertex{{0, 0, 0, 0}, {0, 0, 0, 0}});
+  m_vertexBuffer = GLBuffer(zeros.size() * sizeof(SkinVertex), zeros.data(),
+      GL_DYNAMIC_STORAGE_BIT, GLMemoryCategory::Geometry);
+  // Allocated now, filled by the first skinVertices()
+  for (auto &buffer : m_bindPoseBuffers) {
+    buffer = GLBuffer(
+        std::max(bindPoseVertexCount, size_t(1)) * 3 * sizeof(float),
+        nullptr, 0, GLMemoryCategory::Geometry);
+  }
+}
+
+size_t SceneSkins::uploadPrimitive(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const tinygltf::Primitive &primitive,
+    const ArenaPrimitive &arenaPrimitive,
+    const std::vector<uint32_t> *vertexRemap) const
+{
+  const auto joints = primitive.attributes.find("JOINTS_0");
+  const auto weights = primitive.attributes.find("WEIGHTS_0");
+  if (empty() || joints == end(primitive.attributes) ||
+      weights == end(primitive.attributes)) {
+    return 0;
+  }
+  const auto &jointsAccessor = model.accessors[joints->second];
+  const auto &weightsAccessor = model.accessors[weights->second];
+  const auto vertexCount = size_t(arenaPrimitive.vertexCount);
+  if (jointsAccessor.count != vertexCount ||
+      weightsAccessor.count != vertexCount) {
+    return 0;
+  }
+
+  // Joint indices are integers, read exactly as floats
+  std::vector<float> jointValues(vertexCount * 4);
+  std::vector<float> weightValues(vertexCount * 4);
+  readAccessorAsFloats(model, buffers, jointsAccessor, 4, jointValues.data());
+  readAccessorAsFloats(
+      model, buffers, weightsAccessor, 4, weightValues.data());
+
+  std::vector<SkinVertex> vertices(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    const auto dst = vertexRemap && vertexRemap->size() == vertexCount
+                         ? (*vertexRemap)[v]
+                         : v;
+    auto &vertex = vertices[dst];
+    for (size_t c = 0; c < 4; ++c) {
+      vertex.joints[c] = uint16_t(jointValues[v * 4 + c]);
+      vertex.weights[c] = uint16_t(std::lround(
+          65535.f * glm::clamp(weightValues[v * 4 + c], 0.f, 1.f)));
+    }
+  }
+
+  const auto byteSize = vertexCount * sizeof(SkinVertex);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_vertexBuffer.glId());
+  glBufferSubData(GL_COPY_WRITE_BUFFER,
+      GLintptr(arenaPrimitive.baseVertex * sizeof(SkinVertex)),
+      GLsizeiptr(byteSize), vertices.data());
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return byteSize;
+}
+
+void SceneSkins::computePalettes(
+    const SceneHierarchy &hierarchy, std::vector<glm::mat4> &palette) const
+{
+  // Same size as m_palette, which is never empty
+  palette.resize(m_palette.size(), glm::mat4(1));
+  auto &jobSystem = getJobSystem();
+  jobSystem.parallelFor(m_joints.size(),
+      jobSystem.getGrainSize(m_joints.size(), 256),
+      [&](size_t beginIdx, size_t endIdx) {
+        for (auto i = beginIdx; i < endIdx; ++i) {
+          if (m_joints[i] != uint32_t(-1)) {
+            palette[i] =
+                hierarchy.worldMatrix(m_joints[i]) * m_inverseBindMatrices[i];
+          }
+        }
+      });
+}
+
+void SceneSkins::setPalettes(const std::vector<glm::mat4> &palette)
+{
+  if (palette.size() == m_palette.size()) {
+    std::copy(begin(palette), end(palette), begin(m_palette));
+  }
+}
+
+void SceneSkins::uploadPalettes(
+    RingBuffer &ring, std::vector<PaletteRange> &ranges) const
+{
+  const auto alignment = getPaletteAlignment();
+  ranges.resize(m_skinPalettes.size());
+  for (size_t skinIdx = 0; skinIdx < m_skinPalettes.size(); ++skinIdx) {
+    const auto &palette = m_skinPalettes[skinIdx];
+    // Skins without joints still bind a valid range
+    const auto size = std::max(palette.second, size_t(1)) * sizeof(glm::mat4);
+    const auto allocation = ring.upload(
+        m_palette.data() + std::min(palette.first, m_palette.size() - 1),
+        size, alignment);
+    ranges[skinIdx] = {allocation.buffer, allocation.offset, size};
+  }
+}
+
+void SceneSkins::skinVertices(
+    const GeometryArena &arena, const GLProgram &skinProgram)
+{
+  if (m_skinnedRanges.empty()) {
+    return;
+  }
+
+  // The bind pose is copied once, the arena then holds skinned vertices
+  copyBindPose(arena);
+
+  // The palettes region is fenced right after the dispatches reading it
+  m_prepassData.beginFrame();
+  std::vector<PaletteRange> ranges;
+  uploadPalettes(m_prepassData, ranges);
+
+  skinProgram.use();
+  const auto firstVertex = skinProgram.getUniform<GLuint>("uFirstVertex");
+  const auto vertexCount = skinProgram.getUniform<GLuint>("uVertexCount");
+  const auto firstBindPoseVertex =
+      skinProgram.getUniform<GLuint>("uFirstBindPoseVertex");
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BIND_POSITIONS_BINDING,
+      m_bindPoseBuffers[0].glId());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BIND_NORMALS_BINDING,
+      m_bindPoseBuffers[1].glId());
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, SKIN_VERTICES_BINDING, vertexBuffer());
+  arena.bindStreamStorage(POSITIONS_BINDING, GeometryArena::POSITION);
+  arena.bindStreamStorage(NORMALS_BINDING, GeometryArena::NORMAL);
+  const GLuint groupSize = 64; // local_size_x of skin_vertices.cs.glsl
+  for (const auto &range : m_skinnedRanges) {
+    ranges[range.skin].bind();
+    firstVertex.set(range.firstVertex);
+    vertexCount.set(range.vertexCount);
+    firstBindPoseVertex.set(range.firstBindPoseVertex);
+    glDispatchCompute((range.vertexCount + groupSize - 1) / groupSize, 1, 1);
+  }
+  // The skinned vertices are read as vertex attributes
+  glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+  m_prepassData.endFrame();
+
+  for (GLuint binding = JOINT_MATRICES_BINDING; binding <= NORMALS_BINDING;
+       ++binding) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+  }
+}
+
+void SceneSkins::copyBindPose(const GeometryArena &arena)
+{
+  if (m_hasBindPose || m_skinnedRanges.empty()) {
+    return;
+  }
+  const GeometryArena::Stream streams[] = {
+      GeometryArena::POSITION, GeometryArena::NORMAL};
+  const auto vertexSize = 3 * sizeof(float);
+  for (size_t i = 0; i < 2; ++i) {
+    glBindBuffer(GL_COPY_READ_BUFFER, arena.vertexBuffer(streams[i]));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_bindPoseBuffers[i].glId());
+    for (const auto &range : m_skinnedRanges) {
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+          GLintptr(arena.vertexBufferOffset(streams[i]) +
+                   range.firstVertex * vertexSize),
+          GLintptr(range.firstBindPoseVertex * vertexSize),
+          GLsizeiptr(range.vertexCount * vertexSize));
+    }
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  m_hasBindPose = true;
+}
+
+int SceneSkins::findBindPoseVertex(GLuint firstVertex) const
+{
+  for (const auto &range : m_skinnedRanges) {
+    if (range.firstVertex == firstVertex) {
+      return int(range.firstBindPoseVertex);
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "geometry_arena.hpp"
+#include "gl_objects.hpp"
+#include "gltf.hpp"
+#include "ring_buffer.hpp"
+#include "scene_hierarchy.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Skins of a glTF model: the joint matrices of each skin and the joints and
+// weights of the vertices of a GeometryArena.
+//
+// The joint matrices of all skins are computed once per frame in a single
+// array by updatePalettes(), one palette (a range of the array) per skin. A
+// joint matrix is the world matrix of the joint times its inverse bind
+// matrix, so skinned vertices come out in world space and skinned nodes are
+// drawn with an identity model matrix (the glTF spec ignores their
+// transform).
+//
+// Vertices are skinned by either:
+// - forward.vs.glsl compiled with SKINNED, reading the palette of the skin
+// of the draw bound at JOINT_MATRICES_BINDING (see PaletteRange) and the
+// joints and weights attributes (see GeometryArena::bindSkinBuffer),
+// - or skinVertices(), a compute pre-pass overwriting the POSITION and
+// NORMAL streams of the arena with the skinned vertices of the frame. Every
+// program and every view of the frame then draws them as is.
+class SceneSkins
+{
+public:
+  // Storage buffer binding of the palette read by skinning.glsl
+  static const GLuint JOINT_MATRICES_BINDING = 7;
+
+  // Joints and weights of a vertex, weights are normalized 16-bit integers.
+  // Vertices of primitives without skin have null weights.
+  struct SkinVertex
+  {
+    uint16_t joints[4];
+    uint16_t weights[4];
+  };
+
+  // Range of the palette of a skin in a buffer (see uploadPalettes)
+  struct PaletteRange
+  {
+    GLuint buffer = 0;
+    size_t offset = 0;
+    size_t size = 0;
+
+    void bind() const
+    {
+      glBindBufferRange(GL_SHADER_STORAGE_BUFFER, JOINT_MATRICES_BINDING,
+          buffer, GLintptr(offset), GLsizeiptr(size));
+    }
+  };
+
+  SceneSkins() = default;
+
+  // Non-copyable class:
+  SceneSkins(const SceneSkins &) = delete;
+  SceneSkins &operator=(const SceneSkins &) = delete;
+
+  SceneSkins(SceneSkins &&rvalue) { *this = std::move(rvalue); }
+
+  SceneSkins &operator=(SceneSkins &&rvalue);
+
+  // Read the skins of model and the skin of the nodes of hierarchy, then
+  // allocate the skin vertex buffer of an arena holding primitives (see
+  // GeometryArena::layoutPrimitives). Nodes are skinned if their mesh has
+  // joints and weights.
+  void build(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers, const SceneHierarchy &hierarchy,
+      const std::vector<ArenaPrimitive> &primitives,
+      const std::vector<size_t> &meshToPrimitives, size_t vertexCount);
+
+  bool empty() const { return m_skinPalettes.empty(); }
+
+  size_t skinCount() const { return m_skinPalettes.size(); }
+
+  size_t jointCount() const { return m_palette.size(); }
+
+  // Skin of a node (flat index in the hierarchy), -1 if it is not skinned
+  int nodeSkin(size_t flatIdx) const { return m_nodeSkins[flatIdx]; }
+
+  // Write the joints and weights of a glTF primitive at the vertices of
+  // arenaPrimitive, vertexRemap as in GeometryArena::uploadPrimitive. Return
+  // the number of bytes uploaded.
+  size_t uploadPrimitive(const tinygltf::Model &model,
+      const std::vector<BufferSpan> &buffers,
+      const tinygltf::Primitive &primitive,
+      const ArenaPrimitive &arenaPrimitive,
+      const std::vector<uint32_t> *vertexRemap = nullptr) const;
+
+  GLuint vertexBuffer() const { return m_vertexBuffer.glId(); }
+
+  // Recompute the joint matrices from the world matrices of hierarchy
+  void updatePalettes(const SceneHierarchy &hierarchy)
+  {
+    computePalettes(hierarchy, m_palette);
+  }
+
+  // Compute the joint matrices of all skins into palette, without changing
+  // the skins: it can run on another thread while they are drawn
+  void computePalettes(const SceneHierarchy &hierarchy,
+      std::vector<glm::mat4> &palette) const;
+
+  // Set the joint matrices of all skins to palette, computed by
+  // computePalettes()
+  void setPalettes(const std::vector<glm::mat4> &palette);
+
+  // Copy the palettes in the current frame of ring, ranges receives the
+  // range of each skin
+  void uploadPalettes(
+      RingBuffer &ring, std::vector<PaletteRange> &ranges) const;
+
+  // Skin the vertices of the meshes of skinned nodes with skinProgram
+  // (skin_vertices.cs.glsl) into the arena. The first call copies their
+  // bind pose (see copyBindPose), so all meshes must be uploaded. A mesh
+  // drawn by several skinned nodes is skinned with the skin of the first
+  // one.
+  void skinVertices(const GeometryArena &arena, const GLProgram &skinProgram);
+
+  // Copy the bind pose of the meshes skinned by skinVertices() from the
+  // arena, once: later calls do nothing
+  void copyBindPose(const GeometryArena &arena);
+
+  // First vertex in bindPoseBuffer() of the mesh whose vertices start at
+  // firstVertex in the arena, -1 if skinVertices() does not skin it. The
+  // bind pose can be rewritten there (e.g. by morph targets) after
+  // copyBindPose().
+  int findBindPoseVertex(GLuint firstVertex) const;
+
+  // Float positions (stream 0) or normals (stream 1) of the bind pose
+  GLuint bindPoseBuffer(size_t stream) const
+  {
+    return m_bindPoseBuffers[stream].glId();
+  }
+
+  // Bytes of palettes uploaded by the last skinVertices()
+  size_t prepassFrameSize() const { return m_prepassData.frameSize(); }
+
+private:
+  // Vertices of a mesh skinned by skinVertices()
+  struct SkinnedRange
+  {
+    int skin;
+    GLuint firstVertex; // In the arena
+    GLuint vertexCount;
+    GLuint firstBindPoseVertex; // In m_bindPoseBuffers
+  };
+
+  GLBuffer m_vertexBuffer;
+  std::vector<int> m_nodeSkins;
+  // Flat index of the joints of all skins and their inverse bind matrices
+  std::vector<uint32_t> m_joints;
+  std::vector<glm::mat4> m_inverseBindMatrices;
+  std::vector<glm::mat4> m_palette; // Joint matrices of all skins
+  // Range of the palette of each skin in m_palette
+  std::vector<std::pair<size_t, size_t>> m_skinPalettes;
+
+  std::vector<SkinnedRange> m_skinnedRanges;
+  // Positions and normals of the skinned ranges, copied by the first
+  // skinVertices()
+  GLBuffer m_bindPoseBuffers[2];
+  bool m_hasBindPose = false;
+  RingBuffer m_prepassData; // Palettes read by the pre-pass
+};
@@ -0,0 +1,395 @@
+#include "static_batching.hpp"
+
+#include "job_system.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <string>
+
+namespace
+{
+
+// A primitive of a static node, placed in world space by matrix
+struct PlacedPrimitive
+{
+  const tinygltf::Primitive *primitive;
+  glm::mat4 matrix;
+  size_t vertexCount;
+  glm::vec3 center; // Of its world bounds
+  uint32_t mortonCode; // Of center
+};
+
+// Primitives merged in one, sharing a material and the components of their
+// attributes
+struct Batch
+{
+  int material = -1;
+  std::vector<std::pair<std::string, size_t>> attributes; // Components
+  std::vector<PlacedPrimitive> primitives;
+};
+
+// Vertices and indices of a batch, attributes in Batch::attributes order
+struct BatchGeometry
+{
+  std::vector<std::vector<float>> attributes;
+  std::vector<uint32_t> indices;
+  size_t vertexCount = 0;
+};
+
+// Spread the 10 lowest bits of x 3 bits apart
+uint32_t spreadBits(uint32_t x)
+{
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x30000ff;
+  x = (x | (x << 8)) & 0x300f00f;
+  x = (x | (x << 4)) & 0x30c30c3;
+  x = (x | (x << 2)) & 0x9249249;
+  return x;
+}
+
+// Morton code of p in the box [bboxMin, bboxMax], 10 bits per axis
+uint32_t getMortonCode(
+    const glm::vec3 &p, const glm::vec3 &bboxMin, const glm::vec3 &bboxMax)
+{
+  const auto extent = glm::max(bboxMax - bboxMin, glm::vec3(1e-20f));
+  const auto cell = glm::clamp((p - bboxMin) / extent, 0.f, 1.f) * 1023.f;
+  return spreadBits(uint32_t(cell.x)) | (spreadBits(uint32_t(cell.y)) << 1) |
+         (spreadBits(uint32_t(cell.z)) << 2);
+}
+
+// True if every primitive of the mesh of a static node can be batched
+bool canBatchMesh(const tinygltf::Model &model, const tinygltf::Mesh &mesh,
+    size_t maxBatchVertices)
+{
+  for (const auto &primitive : mesh.primitives) {
+    const auto it = primitive.attributes.find("POSITION");
+    // Primitive extensions (e.g. material variants) would not survive the
+    // merge
+    if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+        it == end(primitive.attributes) || !primitive.targets.empty() ||
+        !primitive.extensions.empty()) {
+      return false;
+    }
+    const auto vertexCount = model.accessors[it->second].count;
+    if (!vertexCount || vertexCount > maxBatchVertices) {
+      return false;
+    }
+    for (const auto &attribute : primitive.attributes) {
+      if (model.accessors[attribute.second].count != vertexCount) {
+        return false;
+      }
+    }
+  }
+  return !mesh.primitives.empty();
+}
+
+BatchGeometry buildBatchGeometry(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers, const Batch &batch)
+{
+  BatchGeometry geometry;
+  geometry.attributes.resize(batch.attributes.size());
+  std::vector<uint32_t> indices;
+  for (const auto &placed : batch.primitives) {
+    const auto &primitive = *placed.primitive;
+    const auto vertexCount = placed.vertexCount;
+    if (primitive.indices >= 0) {
+      const auto &indexAccessor = model.accessors[primitive.indices];
+      indices.resize(indexAccessor.count);
+      readAccessorAsUints(model, buffers, indexAccessor, indices.data());
+    } else {
+      indices.resize(vertexCount);
+      std::iota(begin(indices), end(indices), 0);
+    }
+    indices.resize(indices.size() - indices.size() % 3);
+    // Invalid indices are clamped, the batch must stay drawable
+    for (auto &index : indices) {
+      index = std::min(index, uint32_t(vertexCount - 1));
+    }
+
+    const auto &matrix = placed.matrix;
+    const auto normalMatrix = glm::inverseTranspose(glm::mat3(matrix));
+    // Mirroring matrices flip the winding of triangles and the bitangents
+    const auto isMirrored = glm::determinant(glm::mat3(matrix)) < 0.f;
+    for (size_t i = 0; i < batch.attributes.size(); ++i) {
+      const auto &name = batch.attributes[i].first;
+      const auto componentCount = batch.attributes[i].second;
+      auto &values = geometry.attributes[i];
+      const auto first = values.size();
+      values.resize(first + vertexCount * componentCount);
+      readAccessorAsFloats(model, buffers,
+          model.accessors[primitive.attributes.at(name)], componentCount,
+          values.data() + first);
+      const auto isPosition = name == "POSITION";
+      const auto isNormal = name == "NORMAL";
+      const auto isTangent = name == "TANGENT" && componentCount == 4;
+      if (!isPosition && !isNormal && !isTangent) {
+        continue;
+      }
+      for (auto *v = values.data() + first; v < values.data() + values.size();
+           v += componentCount) {
+        const glm::vec3 value{v[0], v[1], v[2]};
+        glm::vec3 result;
+        if (isPosition) {
+          result = glm::vec3(matrix * glm::vec4(value, 1.f));
+        } else {
+          result = isNormal ? normalMatrix * value : glm::mat3(matrix) * value;
+          const auto length = glm::length(result);
+          result = length > 0.f ? result / length : value;
+          if (isTangent && isMirrored) {
+            v[3] = -v[3];
+          }
+        }
+        v[0] = result.x;
+        v[1] = result.y;
+        v[2] = result.z;
+      }
+    }
+
+    const auto baseVertex = uint32_t(geometry.vertexCount);
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      geometry.indices.push_back(baseVertex + indices[i]);
+      geometry.indices.push_back(
+          baseVertex + indices[isMirrored ? i + 2 : i + 1]);
+      geometry.indices.push_back(
+          baseVertex + indices[isMirrored ? i + 1 : i + 2]);
+    }
+    geometry.vertexCount += vertexCount;
+  }
+  return geometry;
+}
+
+// Append a view of size bytes of data to buffer, aligned on 4 bytes, and
+// return its index
+int addBufferView(tinygltf::Model &model, int bufferIdx,
+    tinygltf::Buffer &buffer, const void *data, size_t size, int target)
+{
+  buffer.data.resize((buffer.data.size() + 3) & ~size_t(3));
+  tinygltf::BufferView bufferView;
+  bufferView.buffer = bufferIdx;
+  bufferView.byteOffset = buffer.data.size();
+  bufferView.byteLength = size;
+  bufferView.target = target;
+  const auto bytes = static_cast<const unsigned char *>(data);
+  buffer.data.insert(end(buffer.data), bytes, bytes + size);
+  model.bufferViews.push_back(bufferView);
+  return int(model.bufferViews.size() - 1);
+}
+
+} // namespace
+
+StaticBatches batchStaticNodes(tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers, bool keepInstances,
+    size_t maxBatchVertices)
+{
+  StaticBatches result;
+  if (model.defaultScene < 0 ||
+      size_t(model.defaultScene) >= model.scenes.size()) {
+    return result;
+  }
+
+  std::vector<bool> isAnimated(model.nodes.size(), false);
+  for (const auto &animation : model.animations) {
+    for (const auto &channel : animation.channels) {
+      if (channel.target_node >= 0 &&
+          size_t(channel.target_node) < model.nodes.size()) {
+        isAnimated[channel.target_node] = true;
+      }
+    }
+  }
+  // Nodes also drawn by other scenes keep their mesh
+  std::vector<bool> isInOtherScene(model.nodes.size(), false);
+  std::vector<int> nodeStack;
+  for (size_t sceneIdx = 0; sceneIdx < model.scenes.size(); ++sceneIdx) {
+    if (int(sceneIdx) == model.defaultScene) {
+      continue;
+    }
+    nodeStack = model.scenes[sceneIdx].nodes;
+    while (!nodeStack.empty()) {
+      const auto nodeIdx = nodeStack.back();
+      nodeStack.pop_back();
+      if (nodeIdx >= 0 && size_t(nodeIdx) < model.nodes.size() &&
+          !isInOtherScene[nodeIdx]) {
+        isInOtherScene[nodeIdx] = true;
+        const auto &children = model.nodes[nodeIdx].children;
+        nodeStack.insert(end(nodeStack), begin(children), end(children));
+      }
+    }
+  }
+  std::vector<size_t> meshUseCounts(model.meshes.size(), 0);
+  for (const auto &node : model.nodes) {
+    if (node.mesh >= 0) {
+      ++meshUseCounts[node.mesh];
+    }
+  }
+
+  // Static mesh nodes of the default scene, with their world matrix
+  std::vector<std::pair<int, glm::mat4>> staticNodes;
+  const auto visit = [&](int nodeIdx, const glm::mat4 &parentMatrix,
+                         bool isParentAnimated, const auto &visit) -> void {
+    const auto &node = model.nodes[nodeIdx];
+    const auto matrix = getLocalToWorldMatrix(node, parentMatrix);
+    const auto isNodeAnimated = isParentAnimated || isAnimated[nodeIdx];
+    if (!isNodeAnimated && !isInOtherScene[nodeIdx] && node.mesh >= 0 &&
+        node.skin < 0 && node.weights.empty() &&
+        !node.extensions.count("EXT_mesh_gpu_instancing") &&
+        !(keepInstances && meshUseCounts[node.mesh] > 1) &&
+        canBatchMesh(model, model.meshes[node.mesh], maxBatchVertices)) {
+      staticNodes.emplace_back(nodeIdx, matrix);
+    }
+    for (const auto childIdx : node.children) {
+      visit(childIdx, matrix, isNodeAnimated, visit);
+    }
+  };
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    visit(nodeIdx, glm::mat4(1), false, visit);
+  }
+
+  // Primitives by material and attributes, with the world bounds of their
+  // centers
+  std::map<std::string, Batch> batchesByKey;
+  glm::vec3 centersMin(std::numeric_limits<float>::max());
+  glm::vec3 centersMax(std::numeric_limits<float>::lowest());
+  for (const auto &staticNode : staticNodes) {
+    const auto &node = model.nodes[staticNode.first];
+    for (const auto &primitive : model.meshes[node.mesh].primitives) {
+      auto key = std::to_string(primitive.material);
+      std::vector<std::pair<std::string, size_t>> attributes;
+      for (const auto &attribute : primitive.attributes) {
+        const auto componentCount = size_t(tinygltf::GetNumComponentsInType(
+            model.accessors[attribute.second].type));
+        attributes.emplace_back(attribute.first, componentCount);
+        key += ' ' + attribute.first + ':' + std::to_string(componentCount);
+      }
+      auto &batch = batchesByKey[key];
+      batch.material = primitive.material;
+      batch.attributes = std::move(attributes);
+
+      const auto &positions =
+          model.accessors[primitive.attributes.at("POSITION")];
+      // Accessors min/max are required for positions, the node origin
+      // stands for them otherwise
+      auto center = glm::vec3(staticNode.second[3]);
+      if (positions.minValues.size() == 3 && positions.maxValues.size() == 3) {
+        const glm::vec3 localCenter{
+            0.5 * (positions.minValues[0] + positions.maxValues[0]),
+            0.5 * (positions.minValues[1] + positions.maxValues[1]),
+            0.5 * (positions.minValues[2] + positions.maxValues[2])};
+        center = glm::vec3(staticNode.second * glm::vec4(localCenter, 1.f));
+      }
+      centersMin = glm::min(centersMin, center);
+      centersMax = glm::max(centersMax, center);
+      batch.primitives.push_back(
+          {&primitive, staticNode.second, positions.count, center, 0});
+    }
+  }
+  if (staticNodes.empty()) {
+    return result;
+  }
+
+  // Cut each material along the Morton order of the centers
+  std::vector<Batch> batches;
+  for (auto &keyAndBatch : batchesByKey) {
+    auto &primitives = keyAndBatch.second.primitives;
+    for (auto &placed : primitives) {
+      placed.mortonCode =
+          getMortonCode(placed.center, centersMin, centersMax);
+    }
+    std::stable_sort(begin(primitives), end(primitives),
+        [](const PlacedPrimitive &lhs, const PlacedPrimitive &rhs) {
+          return lhs.mortonCode < rhs.mortonCode;
+        });
+    size_t vertexCount = maxBatchVertices;
+    for (const auto &placed : primitives) {
+      if (vertexCount + placed.vertexCount > maxBatchVertices) {
+        batches.emplace_back();
+        batches.back().material = keyAndBatch.second.material;
+        batches.back().attributes = keyAndBatch.second.attributes;
+        vertexCount = 0;
+      }
+      batches.back().primitives.push_back(placed);
+      vertexCount += placed.vertexCount;
+    }
+  }
+  std::vector<BatchGeometry> geometries(batches.size());
+  getJobSystem().parallelFor(
+      batches.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+        for (auto i = beginIdx; i < endIdx; ++i) {
+          geometries[i] = buildBatchGeometry(model, buffers, batches[i]);
+        }
+      });
+
+  // One buffer holds every batch, a view per attribute and for the indices
+  const auto bufferIdx = int(model.buffers.size());
+  tinygltf::Buffer buffer;
+  auto &sceneNodes = model.scenes[model.defaultScene].nodes;
+  for (size_t i = 0; i < batches.size(); ++i) {
+    const auto &batch = batches[i];
+    const auto &geometry = geometries[i];
+    tinygltf::Primitive primitive;
+    primitive.material = batch.material;
+    primitive.mode = TINYGLTF_MODE_TRIANGLES;
+    for (size_t a = 0; a < batch.attributes.size(); ++a) {
+      const auto &values = geometry.attributes[a];
+      const auto componentCount = batch.attributes[a].second;
+      tinygltf::Accessor accessor;
+      accessor.bufferView = addBufferView(model, bufferIdx, buffer,
+          values.data(), values.size() * sizeof(float),
+          TINYGLTF_TARGET_ARRAY_BUFFER);
+      accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+      accessor.type = componentCount == 1
+                          ? TINYGLTF_TYPE_SCALAR
+                          : TINYGLTF_TYPE_VEC2 + int(componentCount) - 2;
+      accessor.count = geometry.vertexCount;
+      if (batch.attributes[a].first == "POSITION") {
+        accessor.minValues.assign(3, std::numeric_limits<double>::max());
+        accessor.maxValues.assign(3, std::numeric_limits<double>::lowest());
+        for (size_t v = 0; v < values.size(); ++v) {
+          auto &min = accessor.minValues[v % 3];
+          auto &max = accessor.maxValues[v % 3];
+          min = std::min(min, double(values[v]));
+          max = std::max(max, double(values[v]));
+        }
+      }
+      primitive.attributes[batch.attributes[a].first] =
+          int(model.accessors.size());
+      model.accessors.push_back(std::move(accessor));
+    }
+
+    tinygltf::Accessor indices;
+    indices.bufferView =
+        addBufferView(model, bufferIdx, buffer, geometry.indices.data(),
+            geometry.indices.size() * sizeof(uint32_t),
+            TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+    indices.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+    indices.type = TINYGLTF_TYPE_SCALAR;
+    indices.count = geometry.indices.size();
+    primitive.indices = int(model.accessors.size());
+    model.accessors.push_back(std::move(indices));
+
+    tinygltf::Mesh mesh;
+    mesh.name = "Static batch " + std::to_string(i);
+    mesh.primitives.push_back(std::move(primitive));
+    tinygltf::Node node;
+    node.name = mesh.name;
+    node.mesh = int(model.meshes.size());
+    model.meshes.push_back(std::move(mesh));
+    sceneNodes.push_back(int(model.nodes.size()));
+    model.nodes.push_back(std::move(node));
+    result.primitiveCount += batch.primitives.size();
+  }
+  model.buffers.push_back(std::move(buffer));
+  const auto &data = model.buffers.back().data;
+  buffers.push_back({data.data(), data.size()});
+
+  for (const auto &staticNode : staticNodes) {
+    model.nodes[staticNode.first].mesh = -1;
+  }
+  removeUnusedMeshes(model);
+  result.nodeCount = staticNodes.size();
+  result.batchCount = batches.size();
+  return result;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <vector>
+
+// Static batching of the default scene of a model, at load time.
+//
+// Exported CAD scenes often have thousands of small nodes that never move
+// and share a few materials, each of them costing a draw and its matrices.
+// The triangle primitives of the static nodes (neither animated, below an
+// animated node, skinned, morphed nor in another scene of the model) are
+// transformed to world space and merged by material and set of attributes
+// into batches, each drawn by a new root node of the default scene with an
+// identity transform, while the batched nodes lose their mesh.
+//
+// So that batches are still culled, those of a material are cut along the
+// Morton order of the centers of their primitives, at most maxBatchVertices
+// vertices each: every batch covers a compact region of the scene, whose
+// bounds are those of its node. Primitives larger than that are left alone.
+
+// Primitives merged by batchStaticNodes
+struct StaticBatches
+{
+  size_t nodeCount = 0; // Nodes that lost their mesh
+  size_t primitiveCount = 0; // Primitives of these nodes
+  size_t batchCount = 0; // Draws replacing them
+};
+
+// Batch the static nodes of the default scene of model (see above). The
+// merged vertices, as floats, and their indices are stored in a new buffer of
+// model without uri, which buffers gets a span on, so the scene cache keeps
+// the batches. Meshes that no node uses any more are removed. With
+// keepInstances, meshes used by several nodes are left to instanced draws.
+StaticBatches batchStaticNodes(tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers, bool keepInstances,
+    size_t maxBatchVertices = 65536);
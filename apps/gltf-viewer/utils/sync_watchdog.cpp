@@ -0,0 +1,112 @@
+#include "sync_watchdog.hpp"
+#include "log.hpp"
+
+#include <atomic>
+#include <cctype>
+#include <mutex>
+
+namespace
+{
+
+std::atomic<float> stallThreshold{10.f};
+std::atomic<uint64_t> syncCount{0};
+std::atomic<uint64_t> implicitSyncCount{0};
+
+// Stalls, under stallMutex
+std::mutex stallMutex;
+uint64_t stallCount = 0;
+double stallTime = 0.;
+float maxStallTime = 0.f;
+const char *maxStallTag = nullptr;
+const char *maxStallPass = nullptr;
+
+thread_local const char *currentPass = nullptr;
+
+// Case insensitive search of word, in lower case, in message[0 : length]
+bool containsWord(const char *message, size_t length, const char *word)
+{
+  for (size_t i = 0; i < length; ++i) {
+    size_t j = 0;
+    while (word[j] && i + j < length &&
+           std::tolower((unsigned char)message[i + j]) == word[j]) {
+      ++j;
+    }
+    if (!word[j]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+void setSyncStallThreshold(float milliseconds)
+{
+  stallThreshold.store(milliseconds, std::memory_order_relaxed);
+}
+
+float getSyncStallThreshold()
+{
+  return stallThreshold.load(std::memory_order_relaxed);
+}
+
+const char *setSyncPass(const char *pass)
+{
+  const auto previous = currentPass;
+  currentPass = pass;
+  return previous;
+}
+
+const char *getSyncPass() { return currentPass; }
+
+void watchGLPerformanceMessage(const char *message, size_t length)
+{
+  // Drivers word them differently: "stalled on", "stalling", "is
+  // synchronized with 3D rendering", "wait for idle"...
+  if (!containsWord(message, length, "stall") &&
+      !containsWord(message, length, "synchroniz") &&
+      !containsWord(message, length, "wait")) {
+    return;
+  }
+  implicitSyncCount.fetch_add(1, std::memory_order_relaxed);
+  // The pass is only known when the debug output is synchronous
+  logFormat(LogLevel::Warning, "Warning: implicit GPU sync in %s: %.*s",
+      currentPass ? currentPass : "unknown pass", int(length), message);
+}
+
+SyncStats getSyncStats()
+{
+  SyncStats stats;
+  stats.syncCount = syncCount.load(std::memory_order_relaxed);
+  stats.implicitSyncCount = implicitSyncCount.load(std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(stallMutex);
+  stats.stallCount = stallCount;
+  stats.stallTime = stallTime;
+  stats.maxStallTime = maxStallTime;
+  stats.maxStallTag = maxStallTag;
+  stats.maxStallPass = maxStallPass;
+  return stats;
+}
+
+SyncScope::~SyncScope()
+{
+  syncCount.fetch_add(1, std::memory_order_relaxed);
+  const auto milliseconds = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - m_start)
+                                .count();
+  if (milliseconds <= getSyncStallThreshold()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(stallMutex);
+    ++stallCount;
+    stallTime += milliseconds;
+    if (milliseconds > maxStallTime) {
+      maxStallTime = milliseconds;
+      maxStallTag = m_tag;
+      maxStallPass = currentPass;
+    }
+  }
+  logFormat(LogLevel::Warning, "Warning: GPU stall of %.1f ms in %s (%s)",
+      milliseconds, m_tag, currentPass ? currentPass : "no pass");
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Watchdog of the points where the CPU waits for the GPU, to find the hidden
+// stalls behind long frames.
+//
+// Explicit sync points (fence waits, maps of buffers written by the GPU,
+// blocking query results, texture reads, glFinish) are measured by a
+// SyncScope tagged with the call site. Implicit ones are the performance
+// messages of the debug output (see initGLDebugOutput) telling that the
+// driver stalled or synchronized a command. A wait longer than the stall
+// threshold, or an implicit sync, is logged as a warning with its tag and
+// the pass of the thread (see setSyncPass), which Profiler CPU scopes set.
+//
+// Counting never locks, stalls are recorded under a lock since they have
+// waited anyway. Deliberate waits, such as those of FramePacer, are not
+// watched, nor are the maps of buffers whose fence was polled as signaled
+// (e.g. GpuPicker::poll), which cannot wait.
+struct SyncStats
+{
+  uint64_t syncCount = 0; // Explicit sync points passed
+  uint64_t stallCount = 0; // Of them, longer than the threshold
+  uint64_t implicitSyncCount = 0;
+  double stallTime = 0.; // Total, in milliseconds
+  // Longest stall, tag and pass are null if none
+  float maxStallTime = 0.f;
+  const char *maxStallTag = nullptr;
+  const char *maxStallPass = nullptr;
+};
+
+// Waits longer than this are stalls, 10 ms by default
+void setSyncStallThreshold(float milliseconds);
+
+float getSyncStallThreshold();
+
+// Set the pass of the current thread, a string literal or null, and return
+// the previous one
+const char *setSyncPass(const char *pass);
+
+const char *getSyncPass();
+
+// Count a performance message of the debug output if it reports an implicit
+// sync. Never locks nor allocates, for the debug callback.
+void watchGLPerformanceMessage(const char *message, size_t length);
+
+SyncStats getSyncStats();
+
+// Measure the wait of an explicit sync point, tag being a string literal
+// naming it
+class SyncScope
+{
+public:
+  explicit SyncScope(const char *tag) :
+      m_tag(tag), m_start(std::chrono::steady_clock::now())
+  {
+  }
+
+  ~SyncScope();
+
+  SyncScope(const SyncScope &) = delete;
+  SyncScope &operator=(const SyncScope &) = delete;
+
+private:
+  const char *m_tag;
+  std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+
+// Allocated width or height of a render target that follows the size of the
+// window, for a viewport of size texels and a target allocated with
+// capacity texels (0 if not allocated yet). The first allocation fits size
+// exactly. A larger size grows the target to the next power of two, and a
+// size under a quarter of capacity shrinks it back to size, so that a
+// drag-resize reallocates a few times rather than at every frame. Returns
+// capacity when the target can be kept, only the lower left size texels of
+// it are then used.
+inline size_t getTargetCapacity(size_t size, size_t capacity)
+{
+  if (!capacity) {
+    return size;
+  }
+  if (size > capacity) {
+    size_t grownCapacity = 1;
+    while (grownCapacity < size) {
+      grownCapacity *= 2;
+    }
+    return grownCapacity;
+  }
+  return 4 * size < capacity ? size : capacity;
+}
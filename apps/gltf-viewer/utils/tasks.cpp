@@ -0,0 +1,29 @@
+#include "tasks.hpp"
+#include "tracing.hpp"
+
+#include <chrono>
+
+size_t GLTaskQueue::drain(double seconds)
+{
+  TRACE_ZONE("GL tasks");
+  const auto deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(seconds));
+  size_t resumedCount = 0;
+  // Tasks scheduled again while draining run again if time is left
+  do {
+    std::coroutine_handle<> task;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_tasks.empty()) {
+        break;
+      }
+      task = m_tasks.front();
+      m_tasks.pop_front();
+    }
+    task.resume();
+    ++resumedCount;
+  } while (std::chrono::steady_clock::now() < deadline);
+  return resumedCount;
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "job_system.hpp"
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+// Coroutines for asset loading: a Task<T> is straight-line code moving
+// between the job system (co_await resumeOnJobSystem()) and the GL thread
+// (co_await glTasks.schedule()), e.g. parse a file on a worker, then upload
+// it slice by slice on the GL thread, without callbacks nor blocking the
+// GL thread.
+//
+// Tasks are lazy: they run when awaited by another task, or from start() on
+// the calling thread until their first suspension. Their owner polls
+// isReady() and must not destroy them while they run (see
+// GLTaskQueue::drainUntilReady). Exceptions are rethrown by get() and
+// co_await.
+
+class TaskPromiseBase
+{
+public:
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  // Resume the awaiting task, if any, else only publish the result
+  struct FinalAwaiter
+  {
+    bool await_ready() noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> handle) noexcept
+    {
+      auto &promise = handle.promise();
+      // The owner may destroy the task once it is ready
+      const auto continuation = promise.m_continuation;
+      promise.m_isReady.store(true, std::memory_order_release);
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() { m_exception = std::current_exception(); }
+
+  std::coroutine_handle<> m_continuation;
+  std::atomic<bool> m_isReady{false};
+  std::exception_ptr m_exception;
+};
+
+template <typename T> class TaskPromise : public TaskPromiseBase
+{
+public:
+  void return_value(T value) { m_value = std::move(value); }
+
+  T result()
+  {
+    if (m_exception) {
+      std::rethrow_exception(m_exception);
+    }
+    return std::move(*m_value);
+  }
+
+private:
+  std::optional<T> m_value;
+};
+
+template <> class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+  void return_void() {}
+
+  void result()
+  {
+    if (m_exception) {
+      std::rethrow_exception(m_exception);
+    }
+  }
+};
+
+template <typename T = void> class Task
+{
+public:
+  struct promise_type : TaskPromise<T>
+  {
+    Task get_return_object()
+    {
+      return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+  };
+
+  Task() = default;
+
+  Task(Task &&rvalue) noexcept :
+      m_handle(std::exchange(rvalue.m_handle, nullptr))
+  {
+  }
+
+  Task &operator=(Task &&rvalue) noexcept
+  {
+    if (this != &rvalue) {
+      if (m_handle) {
+        m_handle.destroy();
+      }
+      m_handle = std::exchange(rvalue.m_handle, nullptr);
+    }
+    return *this;
+  }
+
+  ~Task()
+  {
+    if (m_handle) {
+      m_handle.destroy();
+    }
+  }
+
+  // Run the task on the calling thread until its first suspension
+  void start() { m_handle.resume(); }
+
+  bool isReady() const
+  {
+    return m_handle.promise().m_isReady.load(std::memory_order_acquire);
+  }
+
+  // Result of a ready task
+  T get() { return m_handle.promise().result(); }
+
+  // Run the task, resume the awaiting one with its result once finished
+  auto operator co_await() &&noexcept
+  {
+    struct Awaiter
+    {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept { return false; }
+
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<> continuation) noexcept
+      {
+        handle.promise().m_continuation = continuation;
+        return handle;
+      }
+
+      T await_resume() { return handle.promise().result(); }
+    };
+    return Awaiter{m_handle};
+  }
+
+private:
+  explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle)
+  {
+  }
+
+  std::coroutine_handle<promise_type> m_handle;
+};
+
+// Awaitable resuming the task as a detached background job of
+// getJobSystem() (see BackgroundJobScope). Without worker to run it (a
+// single thread, no background worker), the task goes on inline.
+inline auto resumeOnJobSystem()
+{
+  struct Awaiter
+  {
+    bool await_ready() const
+    {
+      BackgroundJobScope background;
+      return getJobSystem().threadCount() <= 1;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) const
+    {
+      BackgroundJobScope background;
+      getJobSystem().run([handle]() { handle.resume(); });
+    }
+
+    void await_resume() const {}
+  };
+  return Awaiter{};
+}
+
+// Tasks resumed on the GL thread by drain(), called once per frame by its
+// loop within a time budget. A task uploading data in slices schedules
+// itself again after each one.
+class GLTaskQueue
+{
+public:
+  // Awaitable resuming the task from the next drain(), from any thread
+  auto schedule()
+  {
+    struct Awaiter
+    {
+      GLTaskQueue &queue;
+
+      bool await_ready() const { return false; }
+
+      void await_suspend(std::coroutine_handle<> handle) const
+      {
+        std::lock_guard<std::mutex> lock(queue.m_mutex);
+        queue.m_tasks.push_back(handle);
+      }
+
+      void await_resume() const {}
+    };
+    return Awaiter{*this};
+  }
+
+  // Resume the scheduled tasks in order until seconds have elapsed, at
+  // least one. Return the number of tasks resumed.
+  size_t drain(double seconds);
+
+  // Drain until task is ready, for the owner of a task before its
+  // destruction
+  template <typename T> void drainUntilReady(const Task<T> &task)
+  {
+    while (!task.isReady()) {
+      if (!drain(1e-3)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  bool empty() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_tasks.empty();
+  }
+
+private:
+  mutable std::mutex m_mutex;
+  std::deque<std::coroutine_handle<>> m_tasks;
+};
@@ -0,0 +1,270 @@
+#include "tcp_socket.hpp"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+int connectTcp(const std::string &, std::string &err, int)
+{
+  err = "TCP sockets are not supported on Windows";
+  return -1;
+}
+
+int listenTcp(uint16_t, std::string &err)
+{
+  err = "TCP sockets are not supported on Windows";
+  return -1;
+}
+
+int acceptTcp(int) { return -1; }
+
+void closeSocket(int, bool) {}
+
+#else
+
+namespace
+{
+
+// Lines are small and answered one by one, they are not delayed to be
+// merged
+void disableNagle(int socket)
+{
+  const int enable = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+}
+
+// Writes to a closed connection fail rather than killing the process
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+// Connect socket to address, waiting at most timeoutMs if positive. Return
+// 0, or the errno of the failure, ETIMEDOUT on timeout.
+int connectWithTimeout(int socket, const addrinfo &address, int timeoutMs)
+{
+  if (timeoutMs <= 0) {
+    return connect(socket, address.ai_addr, address.ai_addrlen) == 0 ? 0
+                                                                      : errno;
+  }
+  const auto flags = fcntl(socket, F_GETFL);
+  fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+  auto error = 0;
+  if (connect(socket, address.ai_addr, address.ai_addrlen) != 0) {
+    error = errno;
+  }
+  if (error == EINPROGRESS) {
+    pollfd request = {socket, POLLOUT, 0};
+    auto ready = 0;
+    do {
+      ready = poll(&request, 1, timeoutMs);
+    } while (ready < 0 && errno == EINTR);
+    if (ready == 0) {
+      error = ETIMEDOUT;
+    } else if (ready < 0) {
+      error = errno;
+    } else {
+      socklen_t size = sizeof(error);
+      getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &size);
+    }
+  }
+  fcntl(socket, F_SETFL, flags);
+  return error;
+}
+
+// Sends and receives on socket fail with EAGAIN after timeoutMs
+void setIoTimeout(int socket, int timeoutMs)
+{
+  timeval timeout = {};
+  timeout.tv_sec = timeoutMs / 1000;
+  timeout.tv_usec = (timeoutMs % 1000) * 1000;
+  setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+bool isTimeout(int error) { return error == EAGAIN || error == EWOULDBLOCK; }
+
+} // namespace
+
+int connectTcp(const std::string &address, std::string &err, int timeoutMs)
+{
+  const auto colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    err = "expected host:port, got " + address;
+    return -1;
+  }
+  const auto host = address.substr(0, colon);
+  const auto port = address.substr(colon + 1);
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  if (const auto error =
+          getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses)) {
+    err = "unable to resolve " + address + ": " + gai_strerror(error);
+    return -1;
+  }
+  auto socket = -1;
+  auto hasTimedOut = false;
+  for (auto it = addresses; it && socket < 0; it = it->ai_next) {
+    socket = ::socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+    if (socket < 0) {
+      continue;
+    }
+    const auto error = connectWithTimeout(socket, *it, timeoutMs);
+    if (error != 0) {
+      hasTimedOut = hasTimedOut || error == ETIMEDOUT;
+      close(socket);
+      socket = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (socket < 0) {
+    err = (hasTimedOut ? "timed out connecting to " : "unable to connect to ") +
+          address;
+    return -1;
+  }
+  disableNagle(socket);
+  if (timeoutMs > 0) {
+    setIoTimeout(socket, timeoutMs);
+  }
+  return socket;
+}
+
+int listenTcp(uint16_t port, std::string &err)
+{
+  const auto socket = ::socket(AF_INET6, SOCK_STREAM, 0);
+  if (socket < 0) {
+    err = "unable to create a socket";
+    return -1;
+  }
+  // IPv4 clients too, and no wait for the port of a previous server
+  const int enable = 1, disable = 0;
+  setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  setsockopt(socket, IPPROTO_IPV6, IPV6_V6ONLY, &disable, sizeof(disable));
+  sockaddr_in6 address = {};
+  address.sin6_family = AF_INET6;
+  address.sin6_addr = in6addr_any;
+  address.sin6_port = htons(port);
+  if (bind(socket, reinterpret_cast<const sockaddr *>(&address),
+          sizeof(address)) != 0 ||
+      listen(socket, 8) != 0) {
+    close(socket);
+    err = "unable to listen on port " + std::to_string(port);
+    return -1;
+  }
+  return socket;
+}
+
+int acceptTcp(int listener)
+{
+  for (;;) {
+    const auto socket = accept(listener, nullptr, nullptr);
+    if (socket >= 0) {
+      disableNagle(socket);
+      return socket;
+    }
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+}
+
+void closeSocket(int socket, bool writeOnly)
+{
+  if (writeOnly) {
+    shutdown(socket, SHUT_WR);
+  } else {
+    close(socket);
+  }
+}
+
+#endif
+
+SocketStream::SocketStream(int socket, std::unique_ptr<TlsSession> pTls) :
+    std::iostream(nullptr),
+    m_socket(socket),
+    m_pTls(std::move(pTls)),
+    m_buffer(socket, m_pTls.get())
+{
+  rdbuf(&m_buffer);
+}
+
+SocketStream::~SocketStream()
+{
+  m_buffer.pubsync();
+  m_pTls.reset();
+  closeSocket(m_socket);
+}
+
+SocketStream::Buffer::Buffer(int socket, TlsSession *tls) :
+    m_socket(socket), m_tls(tls), m_input(4096), m_output(4096)
+{
+  setg(m_input.data(), m_input.data(), m_input.data());
+  setp(m_output.data(), m_output.data() + m_output.size());
+}
+
+SocketStream::Buffer::int_type SocketStream::Buffer::underflow()
+{
+#ifndef _WIN32
+  for (;;) {
+    const auto count =
+        m_tls ? m_tls->receive(m_input.data(), m_input.size())
+              : recv(m_socket, m_input.data(), m_input.size(), 0);
+    if (count > 0) {
+      setg(m_input.data(), m_input.data(), m_input.data() + count);
+      return traits_type::to_int_type(m_input.front());
+    }
+    if (count == 0 || errno != EINTR) {
+      m_hasTimedOut = count < 0 && isTimeout(errno);
+      return traits_type::eof();
+    }
+  }
+#else
+  return traits_type::eof();
+#endif
+}
+
+SocketStream::Buffer::int_type SocketStream::Buffer::overflow(int_type c)
+{
+  if (sync() != 0) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int SocketStream::Buffer::sync()
+{
+#ifndef _WIN32
+  for (auto data = pbase(); data < pptr();) {
+    const auto size = size_t(pptr() - data);
+    const auto count = m_tls ? m_tls->send(data, size)
+                             : send(m_socket, data, size, SEND_FLAGS);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      m_hasTimedOut = count < 0 && isTimeout(errno);
+      return -1;
+    }
+    data += count;
+  }
+#endif
+  setp(m_output.data(), m_output.data() + m_output.size());
+  return 0;
+}
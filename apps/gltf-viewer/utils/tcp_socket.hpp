@@ -0,0 +1,74 @@
+#pragma once
+
+#include "tls_session.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Blocking TCP sockets of the render servers listening for coordinators
+// (batch --serve --listen) and of the coordinators connecting to them (batch
+// --servers, see RenderWorkerPool::connect), and of the range requests of
+// remote files (see fetchRemoteGlb). Sockets are file descriptors, POSIX
+// only: the functions fail on Windows.
+
+// Connect to address, "host:port". Return the socket, or -1 and fill err.
+// If timeoutMs is positive, connecting and every send and receive on the
+// socket fail after timeoutMs milliseconds without progress (see
+// SocketStream::hasTimedOut); they wait forever otherwise.
+int connectTcp(
+    const std::string &address, std::string &err, int timeoutMs = 0);
+
+// Listen on port of every interface. Return the socket, or -1 and fill err.
+int listenTcp(uint16_t port, std::string &err);
+
+// Wait for a connection on listener, return its socket or -1 on failure
+int acceptTcp(int listener);
+
+// Close the socket, or only its sending direction if writeOnly is true: the
+// peer then reads the end of the stream
+void closeSocket(int socket, bool writeOnly = false);
+
+// Buffered stream on a connected socket, closed with the stream, through
+// pTls if not null
+class SocketStream : public std::iostream
+{
+public:
+  explicit SocketStream(int socket, std::unique_ptr<TlsSession> pTls = {});
+
+  ~SocketStream();
+
+  SocketStream(const SocketStream &) = delete;
+  SocketStream &operator=(const SocketStream &) = delete;
+
+  // Whether the stream failed on a timeout of the socket, see connectTcp
+  bool hasTimedOut() const { return m_buffer.hasTimedOut(); }
+
+private:
+  class Buffer : public std::streambuf
+  {
+  public:
+    Buffer(int socket, TlsSession *tls);
+
+    bool hasTimedOut() const { return m_hasTimedOut; }
+
+  protected:
+    int_type underflow() override;
+    int_type overflow(int_type c) override;
+    int sync() override;
+
+  private:
+    int m_socket;
+    TlsSession *m_tls;
+    std::vector<char> m_input;
+    std::vector<char> m_output;
+    bool m_hasTimedOut = false;
+  };
+
+  int m_socket;
+  std::unique_ptr<TlsSession> m_pTls;
+  Buffer m_buffer;
+};
@@ -0,0 +1,172 @@
+#include "temporal_antialiasing.hpp"
+#include "target_capacity.hpp"
+
+#include <cassert>
+
+namespace
+{
+
+// Element index of the Halton sequence of base, in [0, 1)
+float getHalton(size_t index, size_t base)
+{
+  auto result = 0.f;
+  auto fraction = 1.f;
+  for (; index; index /= base) {
+    fraction /= float(base);
+    result += fraction * float(index % base);
+  }
+  return result;
+}
+
+} // namespace
+
+glm::vec2 getHaltonJitter(size_t index)
+{
+  return glm::vec2(getHalton(index, 2), getHalton(index, 3)) - 0.5f;
+}
+
+glm::mat4 getJitteredProjection(const glm::mat4 &projMatrix,
+    const glm::vec2 &jitter, size_t width, size_t height)
+{
+  // Offset clip space positions by the jitter in NDC, scaled by w
+  const auto offset = 2.f * jitter / glm::vec2(float(width), float(height));
+  glm::mat4 jitterMatrix(1);
+  jitterMatrix[3][0] = offset.x;
+  jitterMatrix[3][1] = offset.y;
+  return jitterMatrix * projMatrix;
+}
+
+TemporalAntiAliasing::TemporalAntiAliasing(
+    size_t width, size_t height, bool reversedZ) :
+    m_reversedZ(reversedZ), m_emptyVertexArray(GLVertexArray::create())
+{
+  resize(width, height);
+}
+
+void TemporalAntiAliasing::resize(size_t width, size_t height)
+{
+  m_nWidth = width;
+  m_nHeight = height;
+  m_hasHistory = false;
+  const auto capacityWidth = getTargetCapacity(width, m_nCapacityWidth);
+  const auto capacityHeight = getTargetCapacity(height, m_nCapacityHeight);
+  if (capacityWidth != m_nCapacityWidth ||
+      capacityHeight != m_nCapacityHeight) {
+    allocate(capacityWidth, capacityHeight);
+  }
+}
+
+void TemporalAntiAliasing::allocate(size_t width, size_t height)
+{
+  m_nCapacityWidth = width;
+  m_nCapacityHeight = height;
+  m_color = GLTexture(1, GL_RGBA8, GLsizei(width), GLsizei(height));
+  m_motionVectors = GLTexture(1, GL_RG16F, GLsizei(width), GLsizei(height));
+  m_depth =
+      GLTexture(1, GL_DEPTH_COMPONENT32F, GLsizei(width), GLsizei(height));
+  m_framebuffer = GLFramebuffer::create();
+  // Only read with texelFetch, but the textures must be complete
+  for (const auto *texture : {&m_color, &m_motionVectors, &m_depth}) {
+    texture->setParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    texture->setParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+  m_framebuffer.attachTexture(GL_COLOR_ATTACHMENT0, m_color.glId());
+  m_framebuffer.attachTexture(
+      GL_COLOR_ATTACHMENT0 + MOTION_VECTORS_LOCATION, m_motionVectors.glId());
+  m_framebuffer.attachTexture(GL_DEPTH_ATTACHMENT, m_depth.glId());
+  GLenum drawBuffers[MOTION_VECTORS_LOCATION + 1] = {GL_COLOR_ATTACHMENT0};
+  for (GLuint i = 1; i < MOTION_VECTORS_LOCATION; ++i) {
+    drawBuffers[i] = GL_NONE;
+  }
+  drawBuffers[MOTION_VECTORS_LOCATION] =
+      GL_COLOR_ATTACHMENT0 + MOTION_VECTORS_LOCATION;
+  m_framebuffer.setDrawBuffers(MOTION_VECTORS_LOCATION + 1, drawBuffers);
+  assert(m_framebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+
+  for (size_t i = 0; i < 2; ++i) {
+    // The history is sampled between texels when reprojected
+    auto &history = m_history[i];
+    history = GLTexture(1, GL_RGBA16F, GLsizei(width), GLsizei(height));
+    history.setParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    history.setParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    history.setParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    history.setParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    m_historyFramebuffers[i] = GLFramebuffer::create();
+    m_historyFramebuffers[i].attachTexture(
+        GL_COLOR_ATTACHMENT0, history.glId());
+    m_historyFramebuffers[i].setDrawBuffer(GL_COLOR_ATTACHMENT0);
+    m_historyFramebuffers[i].setReadBuffer(GL_COLOR_ATTACHMENT0);
+    assert(m_historyFramebuffers[i].status() == GL_FRAMEBUFFER_COMPLETE);
+  }
+}
+
+glm::mat4 TemporalAntiAliasing::jitter(const glm::mat4 &projMatrix)
+{
+  m_previousJitter = m_jitter;
+  // The sequence starts at 1, its element 0 is (0, 0)
+  m_jitter = getHaltonJitter(m_nFrameIdx++ % JITTER_PHASE_COUNT + 1);
+  return getJitteredProjection(projMatrix, m_jitter, m_nWidth, m_nHeight);
+}
+
+void TemporalAntiAliasing::clearMotionVectors() const
+{
+  const GLfloat noMotion[4] = {NO_MOTION, NO_MOTION, 0.f, 0.f};
+  glClearBufferfv(GL_COLOR, MOTION_VECTORS_LOCATION, noMotion);
+}
+
+void TemporalAntiAliasing::resolve(const GLProgram &resolveProgram,
+    const glm::mat4 &viewProjMatrix, GLuint drawFramebuffer)
+{
+  const auto readIdx = m_nHistoryIdx;
+  const auto writeIdx = 1 - m_nHistoryIdx;
+  glBindFramebuffer(
+      GL_DRAW_FRAMEBUFFER, m_historyFramebuffers[writeIdx].glId());
+  glViewport(0, 0, GLsizei(m_nWidth), GLsizei(m_nHeight));
+
+  const GLuint textures[] = {m_color.glId(), m_motionVectors.glId(),
+      m_depth.glId(), m_history[readIdx].glId()};
+  for (GLuint unit = 0; unit < 4; ++unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, textures[unit]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  // From the NDC of this frame to the clip space of the previous one, both
+  // jittered like the motion vectors
+  const auto reprojectionMatrix =
+      (m_hasHistory ? m_previousViewProjMatrix : viewProjMatrix) *
+      glm::inverse(viewProjMatrix);
+  const auto jitterDelta = (m_jitter - m_previousJitter) /
+                           glm::vec2(float(m_nWidth), float(m_nHeight));
+  resolveProgram.use();
+  resolveProgram.getUniform<glm::mat4>("uReprojectionMatrix")
+      .set(reprojectionMatrix);
+  resolveProgram.getUniform<glm::vec2>("uJitterDelta").set(jitterDelta);
+  resolveProgram.getUniform<glm::vec2>("uDepthToNdc")
+      .set(m_reversedZ ? glm::vec2(1, 0) : glm::vec2(2, -1));
+  resolveProgram.getUniform<float>("uHistoryWeight")
+      .set(m_hasHistory ? 0.9f : 0.f);
+  const auto size = glm::vec2(float(m_nWidth), float(m_nHeight));
+  resolveProgram.getUniform<glm::vec2>("uSize").set(size);
+  resolveProgram.getUniform<glm::vec2>("uHistoryScale")
+      .set(size /
+           glm::vec2(float(m_nCapacityWidth), float(m_nCapacityHeight)));
+
+  GLboolean isDepthTested = GL_FALSE;
+  glGetBooleanv(GL_DEPTH_TEST, &isDepthTested);
+  glDisable(GL_DEPTH_TEST);
+  m_emptyVertexArray.bind();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+  if (isDepthTested) {
+    glEnable(GL_DEPTH_TEST);
+  }
+
+  m_historyFramebuffers[writeIdx].blit(drawFramebuffer, 0, 0,
+      GLint(m_nWidth), GLint(m_nHeight), GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+
+  m_nHistoryIdx = writeIdx;
+  m_previousViewProjMatrix = viewProjMatrix;
+  m_hasHistory = true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Sub-pixel offset of element index (from 1) of the Halton (2, 3) sequence,
+// in [-0.5, 0.5) pixels
+glm::vec2 getHaltonJitter(size_t index);
+
+// projMatrix with its clip space offset by jitter pixels in a width x height
+// viewport
+glm::mat4 getJitteredProjection(const glm::mat4 &projMatrix,
+    const glm::vec2 &jitter, size_t width, size_t height);
+
+// Temporal anti-aliasing (TAA) of the frames of the window: each frame is
+// drawn with a projection jittered by a sub-pixel offset of the Halton (2, 3)
+// sequence, then blended with the history of the previous frames
+// (taa_resolve.fs.glsl), so that JITTER_PHASE_COUNT frames of a still image
+// amount to as many samples per pixel. Shader aliasing is filtered too,
+// unlike with MSAA.
+//
+// The scene is drawn in framebuffer(), whose attachments are:
+// - GL_RGBA8: color,
+// - GL_RG16F: motion vectors at MOTION_VECTORS_LOCATION, written by the
+// scene programs compiled with TAA from their matrices of the previous frame
+// (see motion_vectors.glsl), in [-1, 1] texture coordinates from the previous
+// position to the current one. Pixels they do not cover keep NO_MOTION and
+// are reprojected from their depth with the camera motion.
+// - GL_DEPTH_COMPONENT32F: depth.
+//
+// The resolve reprojects the history by the motion vectors and clamps it to
+// the colors around the pixel, so that it does not ghost where the scene
+// was hidden in the previous frame. It writes the next history, in
+// GL_RGBA16F, which is then blitted to the window.
+class TemporalAntiAliasing
+{
+public:
+  static const size_t JITTER_PHASE_COUNT = 8;
+  // Fragment output of the motion vectors in the scene programs
+  static const GLuint MOTION_VECTORS_LOCATION = 2;
+  static constexpr float NO_MOTION = 1e4f; // Clear value of motion vectors
+
+  // For a width x height window, reversedZ if the scene is drawn with
+  // reversed depths and [0, 1] clip space depths (see
+  // ViewerOptions::reversedZ)
+  TemporalAntiAliasing(size_t width, size_t height, bool reversedZ);
+
+  // Follow a resize of the window and drop the history. The textures are
+  // reallocated when the window outgrows them, in the growth buckets of
+  // getTargetCapacity: the scene is drawn in the lower left width x height
+  // part of framebuffer().
+  void resize(size_t width, size_t height);
+
+  GLuint framebuffer() const { return m_framebuffer.glId(); }
+
+  // Advance to the next jitter phase and return projMatrix jittered by it.
+  // The frame must then be drawn with this projection.
+  glm::mat4 jitter(const glm::mat4 &projMatrix);
+
+  // Clear the motion vectors of framebuffer(), which must be bound, to
+  // NO_MOTION. glClear clears them to the clear color, call this after.
+  void clearMotionVectors() const;
+
+  // Blend the frame drawn in framebuffer() with the view projection matrix
+  // viewProjMatrix (jittered) into the history with resolveProgram
+  // (taa_resolve.fs.glsl with fullscreen.vs.glsl), then blit it to
+  // drawFramebuffer, which is bound. The texture bindings of units 0 to 3
+  // are not restored.
+  void resolve(const GLProgram &resolveProgram,
+      const glm::mat4 &viewProjMatrix, GLuint drawFramebuffer = 0);
+
+  // Drop the history, e.g. when the scene changes entirely
+  void reset() { m_hasHistory = false; }
+
+private:
+  // Create width x height textures
+  void allocate(size_t width, size_t height);
+
+  size_t m_nWidth = 0;
+  size_t m_nHeight = 0;
+  // Of the textures
+  size_t m_nCapacityWidth = 0;
+  size_t m_nCapacityHeight = 0;
+  bool m_reversedZ;
+
+  size_t m_nFrameIdx = 0;
+  glm::vec2 m_jitter{0}; // Of the current frame, in pixels
+  glm::vec2 m_previousJitter{0};
+  glm::mat4 m_previousViewProjMatrix{1};
+  bool m_hasHistory = false;
+
+  GLTexture m_color;
+  GLTexture m_motionVectors;
+  GLTexture m_depth;
+  GLFramebuffer m_framebuffer;
+  // Read and written alternately by the resolve
+  GLTexture m_history[2];
+  GLFramebuffer m_historyFramebuffers[2];
+  size_t m_nHistoryIdx = 0; // Of the last written history
+  GLVertexArray m_emptyVertexArray; // Of the resolve triangle
+};
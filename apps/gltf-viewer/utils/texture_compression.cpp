@@ -0,0 +1,369 @@
+#include "texture_compression.hpp"
+#include "job_system.hpp"
+#include "ktx2.hpp"
+#include "tracing.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+
+// Interpolation weights of the 4-bit indices of BC7, out of 64
+const int BC7_WEIGHTS[16] = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Appends bits to a zeroed block, from its least significant bit
+class BlockWriter
+{
+public:
+  explicit BlockWriter(uint8_t *block) : m_pBlock(block) {}
+
+  void write(uint32_t value, size_t bitCount)
+  {
+    for (size_t i = 0; i < bitCount; ++i, ++m_nBit) {
+      if ((value >> i) & 1) {
+        m_pBlock[m_nBit / 8] |= uint8_t(1 << (m_nBit % 8));
+      }
+    }
+  }
+
+private:
+  uint8_t *m_pBlock;
+  size_t m_nBit = 0;
+};
+
+// 7-bit endpoint and shared p-bit of mode 6 closest to color. Alpha errors
+// weigh more, so that opaque texels stay exactly opaque.
+void quantizeEndpoint(const glm::vec4 &color, glm::ivec4 &endpoint, int &pBit)
+{
+  const auto weights = glm::vec4(1.f, 1.f, 1.f, 4.f);
+  auto bestError = std::numeric_limits<float>::max();
+  for (int p = 0; p < 2; ++p) {
+    const auto quantized = glm::clamp(
+        glm::ivec4(glm::round((color - float(p)) / 2.f)), 0, 127);
+    const auto difference = glm::vec4(quantized * 2 + p) - color;
+    const auto error = glm::dot(weights * difference, difference);
+    if (error < bestError) {
+      bestError = error;
+      endpoint = quantized;
+      pBit = p;
+    }
+  }
+}
+
+// Encode the R or G channel of texels in a BC4 block
+void encodeBc4Block(const uint8_t texels[64], size_t channel, uint8_t block[8])
+{
+  uint8_t minValue = 255, maxValue = 0;
+  for (size_t i = 0; i < 16; ++i) {
+    minValue = std::min(minValue, texels[4 * i + channel]);
+    maxValue = std::max(maxValue, texels[4 * i + channel]);
+  }
+  std::fill(block, block + 8, uint8_t(0));
+  block[0] = maxValue;
+  block[1] = minValue;
+  if (minValue == maxValue) {
+    return; // Every index selects the first endpoint
+  }
+
+  // With the first endpoint greater, indices 2 to 7 interpolate them
+  int palette[8] = {maxValue, minValue};
+  for (int i = 2; i < 8; ++i) {
+    palette[i] = ((8 - i) * maxValue + (i - 1) * minValue + 3) / 7;
+  }
+  uint64_t indices = 0;
+  for (size_t i = 0; i < 16; ++i) {
+    const int value = texels[4 * i + channel];
+    uint64_t bestIndex = 0;
+    for (int index = 1; index < 8; ++index) {
+      if (std::abs(palette[index] - value) <
+          std::abs(palette[bestIndex] - value)) {
+        bestIndex = uint64_t(index);
+      }
+    }
+    indices |= bestIndex << (3 * i);
+  }
+  for (size_t i = 0; i < 6; ++i) {
+    block[2 + i] = uint8_t(indices >> (8 * i));
+  }
+}
+
+// sRGB decoding of 8-bit values, to linear values in [0, 1]
+const float *getSrgbToLinearTable()
+{
+  static const auto table = []() {
+    std::vector<float> values(256);
+    for (size_t i = 0; i < values.size(); ++i) {
+      const auto c = float(i) / 255.f;
+      values[i] =
+          c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return values;
+  }();
+  return table.data();
+}
+
+float linearToSrgb(float c)
+{
+  return c <= 0.0031308f ? c * 12.92f
+                         : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+}
+
+uint8_t toUnorm8(float value)
+{
+  return uint8_t(std::lround(glm::clamp(value, 0.f, 1.f) * 255.f));
+}
+
+// Compress the level of width x height texels, blocks in rows. Texels of
+// partial blocks repeat the last row or column.
+std::vector<unsigned char> compressLevel(const std::vector<uint8_t> &texels,
+    uint32_t width, uint32_t height, bool isNormalMap)
+{
+  const auto blockCountX = (width + 3) / 4;
+  const auto blockCountY = (height + 3) / 4;
+  std::vector<unsigned char> blocks(size_t(blockCountX) * blockCountY * 16);
+  uint8_t blockTexels[64];
+  for (uint32_t by = 0; by < blockCountY; ++by) {
+    for (uint32_t bx = 0; bx < blockCountX; ++bx) {
+      for (uint32_t y = 0; y < 4; ++y) {
+        for (uint32_t x = 0; x < 4; ++x) {
+          const auto sourceX = std::min(4 * bx + x, width - 1);
+          const auto sourceY = std::min(4 * by + y, height - 1);
+          std::memcpy(blockTexels + 4 * (4 * y + x),
+              texels.data() + 4 * (size_t(sourceY) * width + sourceX), 4);
+        }
+      }
+      auto *block = blocks.data() + 16 * (size_t(by) * blockCountX + bx);
+      if (isNormalMap) {
+        encodeBc5Block(blockTexels, block);
+      } else {
+        encodeBc7Block(blockTexels, block);
+      }
+    }
+  }
+  return blocks;
+}
+
+// Replace the pixels of image by a KTX2 container of its compressed
+// mipmaps, return false if it cannot be encoded
+bool compressImage(tinygltf::Image &image, ImageUsage usage)
+{
+  const auto width = uint32_t(image.width);
+  const auto height = uint32_t(image.height);
+  const auto isNormalMap = usage == ImageUsage::Normal;
+  std::vector<std::vector<unsigned char>> levels;
+  std::vector<uint8_t> texels(
+      begin(image.image), begin(image.image) + size_t(width) * height * 4);
+  for (uint32_t level = 0;; ++level) {
+    const auto levelWidth = std::max(width >> level, 1u);
+    const auto levelHeight = std::max(height >> level, 1u);
+    levels.push_back(
+        compressLevel(texels, levelWidth, levelHeight, isNormalMap));
+    if (levelWidth == 1 && levelHeight == 1) {
+      break;
+    }
+    texels = downsampleImage(texels.data(), levelWidth, levelHeight, usage);
+  }
+
+  std::vector<unsigned char> bytes;
+  std::string err;
+  if (!encodeKtx2(isNormalMap ? VK_FORMAT_BC5_UNORM_BLOCK
+                              : VK_FORMAT_BC7_UNORM_BLOCK,
+          width, height, 1, levels, {}, bytes, err)) {
+    return false;
+  }
+  // As loadImageData describes KTX2 images
+  image.image.swap(bytes);
+  image.mimeType = "image/ktx2";
+  image.as_is = true;
+  return true;
+}
+
+} // namespace
+
+void encodeBc7Block(const uint8_t texels[64], uint8_t block[16])
+{
+  glm::vec4 colors[16];
+  auto mean = glm::vec4(0.f);
+  auto minColor = glm::vec4(255.f);
+  auto maxColor = glm::vec4(0.f);
+  for (size_t i = 0; i < 16; ++i) {
+    colors[i] = glm::vec4(texels[4 * i], texels[4 * i + 1],
+        texels[4 * i + 2], texels[4 * i + 3]);
+    mean += colors[i];
+    minColor = glm::min(minColor, colors[i]);
+    maxColor = glm::max(maxColor, colors[i]);
+  }
+  mean /= 16.f;
+
+  // Principal axis of the texels by power iteration on their covariance,
+  // from the diagonal of their bounding box
+  glm::mat4 covariance(0.f);
+  for (const auto &color : colors) {
+    const auto centered = color - mean;
+    covariance += glm::outerProduct(centered, centered);
+  }
+  auto axis = maxColor - minColor;
+  for (int i = 0; i < 8; ++i) {
+    const auto next = covariance * axis;
+    const auto scale = glm::max(glm::max(std::abs(next.x), std::abs(next.y)),
+        glm::max(std::abs(next.z), std::abs(next.w)));
+    if (scale <= 0.f) {
+      break;
+    }
+    axis = next / scale;
+  }
+
+  // Endpoints bound the projections of the texels on the axis
+  glm::vec4 endpoints[2] = {mean, mean};
+  const auto axisLength2 = glm::dot(axis, axis);
+  if (axisLength2 > 0.f) {
+    auto minT = std::numeric_limits<float>::max();
+    auto maxT = std::numeric_limits<float>::lowest();
+    for (const auto &color : colors) {
+      const auto t = glm::dot(color - mean, axis) / axisLength2;
+      minT = std::min(minT, t);
+      maxT = std::max(maxT, t);
+    }
+    endpoints[0] = glm::clamp(mean + minT * axis, 0.f, 255.f);
+    endpoints[1] = glm::clamp(mean + maxT * axis, 0.f, 255.f);
+  }
+  glm::ivec4 quantized[2];
+  int pBits[2];
+  glm::ivec4 palette[16];
+  for (size_t e = 0; e < 2; ++e) {
+    quantizeEndpoint(endpoints[e], quantized[e], pBits[e]);
+  }
+  const auto e0 = quantized[0] * 2 + pBits[0];
+  const auto e1 = quantized[1] * 2 + pBits[1];
+  for (size_t i = 0; i < 16; ++i) {
+    palette[i] = ((64 - BC7_WEIGHTS[i]) * e0 + BC7_WEIGHTS[i] * e1 + 32) / 64;
+  }
+
+  uint32_t indices[16];
+  for (size_t i = 0; i < 16; ++i) {
+    const auto color = glm::ivec4(colors[i]);
+    auto bestError = std::numeric_limits<int>::max();
+    for (uint32_t index = 0; index < 16; ++index) {
+      const auto difference = palette[index] - color;
+      const auto error = difference.x * difference.x +
+                         difference.y * difference.y +
+                         difference.z * difference.z +
+                         difference.w * difference.w;
+      if (error < bestError) {
+        bestError = error;
+        indices[i] = index;
+      }
+    }
+  }
+  // The most significant bit of the first index is implicitly 0
+  if (indices[0] >= 8) {
+    std::swap(quantized[0], quantized[1]);
+    std::swap(pBits[0], pBits[1]);
+    for (auto &index : indices) {
+      index = 15 - index;
+    }
+  }
+
+  std::fill(block, block + 16, uint8_t(0));
+  BlockWriter writer{block};
+  writer.write(1 << 6, 7); // Mode 6
+  for (int c = 0; c < 4; ++c) {
+    writer.write(uint32_t(quantized[0][c]), 7);
+    writer.write(uint32_t(quantized[1][c]), 7);
+  }
+  writer.write(uint32_t(pBits[0]), 1);
+  writer.write(uint32_t(pBits[1]), 1);
+  writer.write(indices[0], 3);
+  for (size_t i = 1; i < 16; ++i) {
+    writer.write(indices[i], 4);
+  }
+}
+
+void encodeBc5Block(const uint8_t texels[64], uint8_t block[16])
+{
+  encodeBc4Block(texels, 0, block);
+  encodeBc4Block(texels, 1, block + 8);
+}
+
+std::vector<uint8_t> downsampleImage(
+    const uint8_t *texels, uint32_t width, uint32_t height, ImageUsage usage)
+{
+  const auto *srgbToLinear = getSrgbToLinearTable();
+  const auto levelWidth = std::max(width / 2, 1u);
+  const auto levelHeight = std::max(height / 2, 1u);
+  std::vector<uint8_t> level(size_t(levelWidth) * levelHeight * 4);
+  for (uint32_t y = 0; y < levelHeight; ++y) {
+    for (uint32_t x = 0; x < levelWidth; ++x) {
+      // 2x2 texels, plus the last row or column of odd sized levels so that
+      // no texel is skipped
+      const auto lastX = x == levelWidth - 1 ? width - 1
+                                             : std::min(2 * x + 1, width - 1);
+      const auto lastY = y == levelHeight - 1
+                             ? height - 1
+                             : std::min(2 * y + 1, height - 1);
+      auto sum = glm::vec4(0.f);
+      for (auto sourceY = 2 * y; sourceY <= lastY; ++sourceY) {
+        for (auto sourceX = 2 * x; sourceX <= lastX; ++sourceX) {
+          const auto *texel = texels + 4 * (size_t(sourceY) * width + sourceX);
+          auto value =
+              glm::vec4(texel[0], texel[1], texel[2], texel[3]) / 255.f;
+          if (usage == ImageUsage::Color) {
+            value = glm::vec4(srgbToLinear[texel[0]], srgbToLinear[texel[1]],
+                srgbToLinear[texel[2]], value.w);
+          } else if (usage == ImageUsage::Normal) {
+            value = glm::vec4(glm::vec3(value) * 2.f - 1.f, value.w);
+          }
+          sum += value;
+        }
+      }
+      auto average = sum / float((lastX - 2 * x + 1) * (lastY - 2 * y + 1));
+      if (usage == ImageUsage::Color) {
+        average = glm::vec4(linearToSrgb(average.x), linearToSrgb(average.y),
+            linearToSrgb(average.z), average.w);
+      } else if (usage == ImageUsage::Normal) {
+        const auto length = glm::length(glm::vec3(average));
+        const auto normal = length > 0.f ? glm::vec3(average) / length
+                                         : glm::vec3(0.f, 0.f, 1.f);
+        average = glm::vec4(normal * 0.5f + 0.5f, average.w);
+      }
+      auto *out = level.data() + 4 * (size_t(y) * levelWidth + x);
+      for (int c = 0; c < 4; ++c) {
+        out[c] = toUnorm8(average[c]);
+      }
+    }
+  }
+  return level;
+}
+
+size_t compressModelImages(
+    tinygltf::Model &model, const std::vector<ImageUsage> &usages)
+{
+  TRACE_ZONE("Compress images");
+  // Decoded by tinygltf, KTX2 images are kept as is
+  std::vector<size_t> images;
+  for (size_t imageIdx = 0; imageIdx < model.images.size(); ++imageIdx) {
+    const auto &image = model.images[imageIdx];
+    if (!image.as_is && image.bits == 8 && image.component == 4 &&
+        image.width > 0 && image.height > 0 &&
+        image.image.size() >= size_t(image.width) * image.height * 4) {
+      images.push_back(imageIdx);
+    }
+  }
+
+  std::vector<char> isCompressed(images.size(), 0);
+  getJobSystem().parallelFor(
+      images.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+        for (auto i = beginIdx; i < endIdx; ++i) {
+          const auto imageIdx = images[i];
+          isCompressed[i] = compressImage(model.images[imageIdx],
+              imageIdx < usages.size() ? usages[imageIdx] : ImageUsage::Data);
+        }
+      });
+  return size_t(std::count(begin(isCompressed), end(isCompressed), 1));
+}
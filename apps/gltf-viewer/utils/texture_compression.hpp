@@ -0,0 +1,38 @@
+#pragma once
+
+#include "textures.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Real-time block compression of decoded images: BC7 and BC5 textures take
+// 4 times less memory than RGBA8 ones and are sampled with less bandwidth.
+// The encoders favor speed over quality, a single pass without search.
+
+// Compress 4x4 RGBA8 texels, in rows, into a 16-byte BC7 block. Mode 6 is
+// always used: the endpoints bound the texels along their principal axis
+// and each texel takes the nearest of the 16 interpolated colors.
+void encodeBc7Block(const uint8_t texels[64], uint8_t block[16]);
+
+// Compress the red and green channels of 4x4 RGBA8 texels, in rows, into a
+// 16-byte BC5 block: two BC4 blocks whose endpoints are the extremes of the
+// channel
+void encodeBc5Block(const uint8_t texels[64], uint8_t block[16]);
+
+// Next mipmap level of an RGBA8 image of width x height texels, of size
+// max(width / 2, 1) x max(height / 2, 1). Texels are filtered as by
+// downsample_texture.cs.glsl for images of this usage.
+std::vector<uint8_t> downsampleImage(
+    const uint8_t *texels, uint32_t width, uint32_t height, ImageUsage usage);
+
+// Replace the decoded 8-bit images of model by KTX2 images holding all their
+// mipmaps, in BC5 for normal maps (whose z is not stored) and in BC7
+// otherwise. Images are compressed in parallel by the job system, one per
+// job. ImageTexture then uploads them as they are and scene caches store
+// them compressed. Colors keep their sRGB encoding, as in RGBA8 textures.
+// usages comes from getImageUsages. Return the number of compressed images.
+size_t compressModelImages(
+    tinygltf::Model &model, const std::vector<ImageUsage> &usages);
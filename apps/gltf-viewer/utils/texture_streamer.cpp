@@ -0,0 +1,380 @@
+#include "texture_streamer.hpp"
+#include "job_system.hpp"
+#include "ktx2.hpp"
+#include "textures.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+GLsizei getLevelSize(GLsizei size) { return std::max(size / 2, 1); }
+
+// Average 2x2 texels of src in dst, a level half its size. The last row and
+// column of odd sizes are repeated.
+template <typename T>
+void downsample(const T *src, GLsizei srcWidth, GLsizei srcHeight, T *dst,
+    GLsizei dstWidth, GLsizei dstHeight, int components)
+{
+  for (GLsizei y = 0; y < dstHeight; ++y) {
+    const auto y0 = std::min(2 * y, srcHeight - 1);
+    const auto y1 = std::min(2 * y + 1, srcHeight - 1);
+    for (GLsizei x = 0; x < dstWidth; ++x) {
+      const auto x0 = std::min(2 * x, srcWidth - 1);
+      const auto x1 = std::min(2 * x + 1, srcWidth - 1);
+      for (int c = 0; c < components; ++c) {
+        const auto texel = [&](GLsizei sx, GLsizei sy) {
+          return uint32_t(src[(size_t(sy) * srcWidth + sx) * components + c]);
+        };
+        const auto sum =
+            texel(x0, y0) + texel(x1, y0) + texel(x0, y1) + texel(x1, y1);
+        dst[(size_t(y) * dstWidth + x) * components + c] = T((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+} // namespace
+
+void TextureStreamer::reset(const tinygltf::Model &model,
+    const std::vector<size_t> &imagesToStream, size_t budget,
+    std::string &err)
+{
+  release();
+  m_images.resize(model.images.size());
+  m_nBudget = budget;
+
+  std::vector<std::string> errors(imagesToStream.size());
+  getJobSystem().parallelFor(
+      imagesToStream.size(), 1, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; ++i) {
+          const auto &source = model.images[imagesToStream[i]];
+          auto &image = m_images[imagesToStream[i]];
+          auto components = 4;
+          auto bytesPerComponent = 1;
+
+          if (isKtx2Image(source)) {
+            Ktx2Image ktx2;
+            if (!canUploadKtx2Image(source) ||
+                !parseKtx2(source.image.data(), source.image.size(), ktx2,
+                    errors[i])) {
+              if (errors[i].empty()) {
+                errors[i] = "KTX2 image cannot be uploaded";
+              }
+              continue;
+            }
+            image.internalFormat = getKtx2InternalFormat(ktx2.vkFormat);
+            image.isCompressed = image.internalFormat != GL_RGBA8 &&
+                                 image.internalFormat != GL_SRGB8_ALPHA8;
+            image.format = GL_RGBA;
+            image.type = GL_UNSIGNED_BYTE;
+            auto width = GLsizei(ktx2.width), height = GLsizei(ktx2.height);
+            for (const auto &level : ktx2.levels) {
+              image.levels.push_back({level.data, level.size, width, height});
+              width = getLevelSize(width);
+              height = getLevelSize(height);
+            }
+          } else {
+            // Pixels decoded by stb_image
+            static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+            static const GLenum internalFormats8[] = {
+                GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+            static const GLenum internalFormats16[] = {
+                GL_R16, GL_RG16, GL_RGB16, GL_RGBA16};
+            components = source.component;
+            bytesPerComponent = source.bits == 16 ? 2 : 1;
+            const auto size = size_t(source.width) * source.height *
+                              components * bytesPerComponent;
+            if (source.width <= 0 || source.height <= 0 || components < 1 ||
+                components > 4 || (source.bits != 8 && source.bits != 16) ||
+                source.image.size() < size) {
+              errors[i] = "Invalid image pixels";
+              continue;
+            }
+            image.internalFormat = (bytesPerComponent == 2
+                                        ? internalFormats16
+                                        : internalFormats8)[components - 1];
+            image.format = formats[components - 1];
+            image.type =
+                bytesPerComponent == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+            image.levels.push_back(
+                {source.image.data(), size, source.width, source.height});
+          }
+
+          // Uncompressed images without their full mip chain get the
+          // missing levels computed from their last one
+          if (!image.isCompressed) {
+            const auto pixelSize = size_t(components) * bytesPerComponent;
+            auto width = image.levels.back().width;
+            auto height = image.levels.back().height;
+            std::vector<Level> generated;
+            size_t generatedSize = 0;
+            while (width > 1 || height > 1) {
+              width = getLevelSize(width);
+              height = getLevelSize(height);
+              const auto size = size_t(width) * height * pixelSize;
+              generated.push_back({nullptr, size, width, height});
+              generatedSize += size;
+            }
+            image.generatedLevels.resize(generatedSize);
+            auto data = image.generatedLevels.data();
+            for (auto &level : generated) {
+              const auto &previous = image.levels.back();
+              level.data = data;
+              if (bytesPerComponent == 2) {
+                downsample((const uint16_t *)previous.data, previous.width,
+                    previous.height, (uint16_t *)data, level.width,
+                    level.height, components);
+              } else {
+                downsample(previous.data, previous.width, previous.height,
+                    data, level.width, level.height, components);
+              }
+              data += level.size;
+              image.levels.push_back(level);
+            }
+          }
+
+          image.tailLevel = image.levels.size() - 1;
+          for (size_t level = 0; level < image.levels.size(); ++level) {
+            if (uint32_t(std::max(image.levels[level].width,
+                    image.levels[level].height)) <= TAIL_SIZE) {
+              image.tailLevel = level;
+              break;
+            }
+          }
+          image.residentLevel = image.levels.size();
+        }
+      });
+
+  for (size_t i = 0; i < imagesToStream.size(); ++i) {
+    if (!errors[i].empty()) {
+      err += "image[" + std::to_string(imagesToStream[i]) + "]: " + errors[i] +
+             "\n";
+      m_images[imagesToStream[i]] = StreamedImage{};
+    } else {
+      ++m_nImageCount;
+      m_stats.levelCount += m_images[imagesToStream[i]].levels.size();
+    }
+  }
+}
+
+void TextureStreamer::release()
+{
+  for (const auto &image : m_images) {
+    if (image.texture) {
+      glDeleteTextures(1, &image.texture);
+    }
+  }
+  m_images.clear();
+  m_nImageCount = 0;
+  m_nFrame = 1;
+  m_stats = Stats{};
+}
+
+void TextureStreamer::request(size_t imageIdx, float pixelSize)
+{
+  if (imageIdx >= m_images.size() || m_images[imageIdx].levels.empty()) {
+    return;
+  }
+  auto &image = m_images[imageIdx];
+  image.requestedPixels = std::max(image.requestedPixels, pixelSize);
+  image.lastRequestFrame = m_nFrame;
+}
+
+void TextureStreamer::update(size_t uploadBudget)
+{
+  // Missing tails first, then requested levels by decreasing coverage
+  std::vector<StreamedImage *> queue;
+  for (auto &image : m_images) {
+    if (image.levels.empty()) {
+      continue;
+    }
+    const auto isRequested = image.lastRequestFrame == m_nFrame;
+    if (image.residentLevel > image.tailLevel ||
+        (isRequested &&
+            image.residentLevel >
+                getWantedLevel(image, image.requestedPixels))) {
+      queue.push_back(&image);
+    }
+  }
+  std::stable_sort(begin(queue), end(queue),
+      [](const StreamedImage *lhs, const StreamedImage *rhs) {
+        const auto lhsTail = lhs->residentLevel > lhs->tailLevel;
+        const auto rhsTail = rhs->residentLevel > rhs->tailLevel;
+        if (lhsTail != rhsTail) {
+          return lhsTail;
+        }
+        return lhs->requestedPixels > rhs->requestedPixels;
+      });
+
+  // Each pass adds a level to each image so that the bandwidth of a frame
+  // goes first to the coarse levels of the most visible images
+  size_t uploadedBytes = 0;
+  for (auto progress = true; progress && uploadedBytes < uploadBudget;) {
+    progress = false;
+    for (const auto image : queue) {
+      if (uploadedBytes >= uploadBudget) {
+        break;
+      }
+      if (image->residentLevel > image->tailLevel) {
+        // Tails are small and ignore the budget
+        for (auto level = image->tailLevel; level < image->residentLevel;
+             ++level) {
+          uploadedBytes += image->levels[level].size;
+        }
+        setResidentLevel(*image, image->tailLevel);
+        progress = true;
+        continue;
+      }
+      const auto wantedLevel =
+          image->lastRequestFrame == m_nFrame
+              ? getWantedLevel(*image, image->requestedPixels)
+              : image->tailLevel;
+      if (image->residentLevel <= wantedLevel) {
+        continue;
+      }
+      const auto level = image->residentLevel - 1;
+      if (!makeRoom(image->levels[level].size, *image)) {
+        continue;
+      }
+      uploadedBytes += image->levels[level].size;
+      setResidentLevel(*image, level);
+      progress = true;
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_stats.residentLevelCount = 0;
+  m_stats.fullyResidentCount = 0;
+  m_stats.requestedCount = 0;
+  m_stats.pendingLevelCount = 0;
+  for (auto &image : m_images) {
+    if (image.levels.empty()) {
+      continue;
+    }
+    m_stats.residentLevelCount += image.levels.size() - image.residentLevel;
+    m_stats.fullyResidentCount += image.residentLevel == 0 ? 1 : 0;
+    if (image.lastRequestFrame == m_nFrame) {
+      ++m_stats.requestedCount;
+      const auto wantedLevel = getWantedLevel(image, image.requestedPixels);
+      if (image.residentLevel > wantedLevel) {
+        m_stats.pendingLevelCount += image.residentLevel - wantedLevel;
+      }
+    }
+    image.requestedPixels = 0.f;
+  }
+  ++m_nFrame;
+}
+
+size_t TextureStreamer::getWantedLevel(
+    const StreamedImage &image, float pixelSize)
+{
+  const auto largestSize =
+      float(std::max(image.levels[0].width, image.levels[0].height));
+  if (pixelSize >= largestSize) {
+    return 0;
+  }
+  if (pixelSize <= 0.f) {
+    return image.tailLevel;
+  }
+  // Level l has largestSize / 2^l texels along the largest axis
+  const auto level = size_t(std::floor(std::log2(largestSize / pixelSize)));
+  return std::min(level, image.tailLevel);
+}
+
+void TextureStreamer::setResidentLevel(StreamedImage &image, size_t level)
+{
+  const auto levelCount = image.levels.size();
+  const auto getByteSize = [&](size_t firstLevel) {
+    size_t byteSize = 0;
+    for (auto l = firstLevel; l < levelCount; ++l) {
+      byteSize += image.levels[l].size;
+    }
+    return byteSize;
+  };
+
+  GLuint texture = 0;
+  if (level < levelCount) {
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, GLsizei(levelCount - level),
+        image.internalFormat, image.levels[level].width,
+        image.levels[level].height);
+    // Rows of 1 to 3 components are not 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (auto l = level; l < levelCount; ++l) {
+      const auto &source = image.levels[l];
+      const auto dstLevel = GLint(l - level);
+      if (l >= image.residentLevel) {
+        glCopyImageSubData(image.texture, GL_TEXTURE_2D,
+            GLint(l - image.residentLevel), 0, 0, 0, texture, GL_TEXTURE_2D,
+            dstLevel, 0, 0, 0, source.width, source.height, 1);
+      } else if (image.isCompressed) {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, dstLevel, 0, 0, source.width,
+            source.height, image.internalFormat, GLsizei(source.size),
+            source.data);
+      } else {
+        glTexSubImage2D(GL_TEXTURE_2D, dstLevel, 0, 0, source.width,
+            source.height, image.format, image.type, source.data);
+      }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  }
+  if (image.texture) {
+    glDeleteTextures(1, &image.texture);
+  }
+
+  m_stats.residentBytes =
+      m_stats.residentBytes - getByteSize(image.residentLevel) +
+      getByteSize(level);
+  image.texture = texture;
+  image.textureMemory =
+      texture ? TrackedGLMemory(GLMemoryCategory::Textures, getByteSize(level))
+              : TrackedGLMemory();
+  image.residentLevel = level;
+}
+
+bool TextureStreamer::makeRoom(size_t byteSize, const StreamedImage &skipped)
+{
+  if (m_stats.residentBytes + byteSize <= m_nBudget) {
+    return true;
+  }
+
+  // Least recently requested first, then least covered
+  const auto isLessImportant = [](const StreamedImage &lhs,
+                                   const StreamedImage &rhs) {
+    if (lhs.lastRequestFrame != rhs.lastRequestFrame) {
+      return lhs.lastRequestFrame < rhs.lastRequestFrame;
+    }
+    return lhs.requestedPixels < rhs.requestedPixels;
+  };
+  std::vector<StreamedImage *> victims;
+  for (auto &image : m_images) {
+    if (&image != &skipped && image.residentLevel < image.tailLevel &&
+        isLessImportant(image, skipped)) {
+      victims.push_back(&image);
+    }
+  }
+  std::sort(begin(victims), end(victims),
+      [&](const StreamedImage *lhs, const StreamedImage *rhs) {
+        return isLessImportant(*lhs, *rhs);
+      });
+
+  for (const auto victim : victims) {
+    // Drop the finest levels of the victim, down to its tail
+    auto level = victim->residentLevel;
+    size_t freedBytes = 0;
+    while (level < victim->tailLevel &&
+           m_stats.residentBytes - freedBytes + byteSize > m_nBudget) {
+      freedBytes += victim->levels[level].size;
+      ++level;
+    }
+    m_stats.evictedLevelCount += level - victim->residentLevel;
+    setResidentLevel(*victim, level);
+    if (m_stats.residentBytes + byteSize <= m_nBudget) {
+      return true;
+    }
+  }
+  return false;
+}
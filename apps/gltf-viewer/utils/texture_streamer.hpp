@@ -0,0 +1,138 @@
+#pragma once
+
+#include "gl_memory.hpp"
+
+#include <glad/glad.h>
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Streams the mip levels of glTF images into textures under a VRAM budget.
+//
+// The levels of each image stay in memory: the levels of KTX2 images (see
+// ImageTexture), or a box filtered chain computed from the decoded pixels.
+// The texture of an image holds its coarsest levels, from residentLevel() to
+// the last one, so that it can be sampled at any time. Textures are
+// immutable: adding or dropping levels creates a texture of the new size
+// that copies the levels both share with glCopyImageSubData, so texture()
+// changes.
+//
+// Each frame, request() is called for the images of the visible draws with
+// the number of pixels they cover, then update() uploads the missing levels:
+// the tail of every image first (levels up to TAIL_SIZE texels), then one
+// level at a time by decreasing screen coverage. Finer levels of the least
+// recently requested images are evicted while the budget is exceeded.
+class TextureStreamer
+{
+public:
+  // Largest size of the levels that are always resident
+  static const uint32_t TAIL_SIZE = 64;
+
+  struct Stats
+  {
+    size_t residentBytes = 0;
+    size_t residentLevelCount = 0;
+    size_t levelCount = 0;
+    size_t fullyResidentCount = 0; // Images with all their levels
+    size_t requestedCount = 0; // Images requested by the last frame
+    // Levels missing for the requests of the last frame
+    size_t pendingLevelCount = 0;
+    size_t evictedLevelCount = 0; // Since reset()
+  };
+
+  TextureStreamer() = default;
+
+  ~TextureStreamer() { release(); }
+
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+  TextureStreamer(TextureStreamer &&rvalue) { *this = std::move(rvalue); }
+
+  TextureStreamer &operator=(TextureStreamer &&rvalue)
+  {
+    std::swap(m_images, rvalue.m_images);
+    std::swap(m_nImageCount, rvalue.m_nImageCount);
+    std::swap(m_nBudget, rvalue.m_nBudget);
+    std::swap(m_nFrame, rvalue.m_nFrame);
+    std::swap(m_stats, rvalue.m_stats);
+    return *this;
+  }
+
+  // Stream imagesToStream, indices of model.images whose pixels or KTX2
+  // container must outlive the streamer. Errors are reported in err and the
+  // image is skipped (texture() returns 0). CPU mip chains are computed on
+  // the job system.
+  void reset(const tinygltf::Model &model,
+      const std::vector<size_t> &imagesToStream, size_t budget,
+      std::string &err);
+
+  void release();
+
+  // Ask for the levels of imageIdx that cover pixelSize pixels along its
+  // largest axis, the largest request of a frame wins
+  void request(size_t imageIdx, float pixelSize);
+
+  // Upload missing levels until uploadBudget bytes are uploaded and evict
+  // levels over the budget, then start a new frame of requests
+  void update(size_t uploadBudget);
+
+  // Texture of imageIdx, 0 if it is not streamed
+  GLuint texture(size_t imageIdx) const
+  {
+    return imageIdx < m_images.size() ? m_images[imageIdx].texture : 0;
+  }
+
+  size_t budget() const { return m_nBudget; }
+
+  size_t imageCount() const { return m_nImageCount; }
+
+  const Stats &stats() const { return m_stats; }
+
+private:
+  struct Level
+  {
+    const unsigned char *data;
+    size_t size;
+    GLsizei width;
+    GLsizei height;
+  };
+
+  struct StreamedImage
+  {
+    std::vector<Level> levels; // From the largest
+    // Storage of the levels computed from the decoded pixels
+    std::vector<unsigned char> generatedLevels;
+    GLenum internalFormat = 0;
+    GLenum format = 0; // Of uncompressed levels
+    GLenum type = 0;
+    bool isCompressed = false;
+    GLuint texture = 0;
+    TrackedGLMemory textureMemory; // Of the resident levels
+    size_t residentLevel = 0; // levels.size() if none
+    size_t tailLevel = 0; // First level always resident
+    float requestedPixels = 0.f; // This frame
+    uint64_t lastRequestFrame = 0;
+  };
+
+  // Level of image covering pixelSize pixels, 0 if pixelSize is too large
+  static size_t getWantedLevel(const StreamedImage &image, float pixelSize);
+
+  // Recreate the texture of image with levels [level, levels.size())
+  void setResidentLevel(StreamedImage &image, size_t level);
+
+  // Evict levels of images less important than skipped (requested less
+  // recently, or with less coverage) until byteSize more bytes fit in the
+  // budget. Return false if they do not.
+  bool makeRoom(size_t byteSize, const StreamedImage &skipped);
+
+  std::vector<StreamedImage> m_images; // One per model image
+  size_t m_nImageCount = 0;
+  size_t m_nBudget = 0;
+  uint64_t m_nFrame = 1;
+  Stats m_stats;
+};
@@ -0,0 +1,307 @@
+#include "textures.hpp"
+#include "gl_extensions.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+GLsizei getLevelSize(uint32_t size, size_t level)
+{
+  return GLsizei(std::max(size >> level, 1u));
+}
+
+size_t getFullMipmapLevelCount(uint32_t width, uint32_t height)
+{
+  size_t levelCount = 1;
+  while ((std::max(width, height) >> levelCount) > 0) {
+    ++levelCount;
+  }
+  return levelCount;
+}
+
+// local_size of downsample_texture.cs.glsl
+const GLuint DOWNSAMPLE_GROUP_SIZE = 8;
+
+// Generate the levels after level 0 of texture, bound to GL_TEXTURE_2D
+void generateMipmaps(GLuint texture, GLenum internalFormat, uint32_t width,
+    uint32_t height, size_t levelCount, ImageUsage usage,
+    const GLProgram *program)
+{
+  // Only RGBA8 can be written as an image of this size
+  if (!program || internalFormat != GL_RGBA8) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+    return;
+  }
+  GLint activeTexture = GL_TEXTURE0;
+  glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+  program->use();
+  program->getUniform<GLint>("uSource").set(activeTexture - GL_TEXTURE0);
+  program->getUniform<GLint>("uUsage").set(GLint(usage));
+  const auto sourceLevel = program->getUniform<GLint>("uSourceLevel");
+  for (size_t level = 1; level < levelCount; ++level) {
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    sourceLevel.set(GLint(level - 1));
+    glBindImageTexture(0, texture, GLint(level), GL_FALSE, 0, GL_WRITE_ONLY,
+        GL_RGBA8);
+    glDispatchCompute(GLuint(getLevelSize(width, level) +
+                             DOWNSAMPLE_GROUP_SIZE - 1) /
+                          DOWNSAMPLE_GROUP_SIZE,
+        GLuint(getLevelSize(height, level) + DOWNSAMPLE_GROUP_SIZE - 1) /
+            DOWNSAMPLE_GROUP_SIZE,
+        1);
+  }
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+}
+
+// Return false and fill err if the levels of image cannot be uploaded
+bool checkKtx2Image(const Ktx2Image &image, std::string &err)
+{
+  if (image.isBasisUniversal()) {
+    err = "Basis Universal KTX2 textures are not supported";
+    return false;
+  }
+  if (image.supercompression != Ktx2Image::Supercompression::None) {
+    err = "Supercompressed KTX2 textures are not supported";
+    return false;
+  }
+  uint32_t blockWidth, blockHeight;
+  if (!getKtx2BlockSize(image.vkFormat, blockWidth, blockHeight) ||
+      !getKtx2InternalFormat(image.vkFormat)) {
+    err = "KTX2 format " + std::to_string(image.vkFormat) +
+          " is not supported by the GL context";
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+GLenum getKtx2InternalFormat(uint32_t vkFormat)
+{
+  const auto &extensions = getGLExtensions();
+  if (vkFormat == VK_FORMAT_R8G8B8A8_UNORM) {
+    return GL_RGBA8;
+  }
+  if (vkFormat == VK_FORMAT_R8G8B8A8_SRGB) {
+    return GL_SRGB8_ALPHA8;
+  }
+  if (vkFormat >= VK_FORMAT_BC1_RGB_UNORM_BLOCK &&
+      vkFormat <= VK_FORMAT_BC7_SRGB_BLOCK) {
+    // In VkFormat order: BC1 RGB, BC1 RGBA, BC2 and BC3 in UNORM and SRGB
+    // variants, then BC4 and BC5 in UNORM and SNORM, then BC6H and BC7
+    static const GLenum formats[] = {GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+        GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+        GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,
+        GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
+        GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT,
+        GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+        GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, GL_COMPRESSED_RED_RGTC1,
+        GL_COMPRESSED_SIGNED_RED_RGTC1, GL_COMPRESSED_RG_RGTC2,
+        GL_COMPRESSED_SIGNED_RG_RGTC2, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT,
+        GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, GL_COMPRESSED_RGBA_BPTC_UNORM,
+        GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM};
+    const auto idx = vkFormat - VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    if (idx < 8 && !(idx % 2 ? extensions.textureCompressionS3tcSrgb
+                             : extensions.textureCompressionS3tc)) {
+      return 0;
+    }
+    return formats[idx];
+  }
+  if (vkFormat >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK &&
+      vkFormat <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK) {
+    static const GLenum formats[] = {GL_COMPRESSED_RGB8_ETC2,
+        GL_COMPRESSED_SRGB8_ETC2, GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2,
+        GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2,
+        GL_COMPRESSED_RGBA8_ETC2_EAC, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC,
+        GL_COMPRESSED_R11_EAC, GL_COMPRESSED_SIGNED_R11_EAC,
+        GL_COMPRESSED_RG11_EAC, GL_COMPRESSED_SIGNED_RG11_EAC};
+    return formats[vkFormat - VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK];
+  }
+  if (vkFormat >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK &&
+      vkFormat <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK &&
+      extensions.textureCompressionAstc) {
+    const auto idx = vkFormat - VK_FORMAT_ASTC_4x4_UNORM_BLOCK;
+    return (idx % 2 ? GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR
+                    : GL_COMPRESSED_RGBA_ASTC_4x4_KHR) +
+           idx / 2;
+  }
+  return 0;
+}
+
+std::vector<ImageUsage> getImageUsages(const tinygltf::Model &model)
+{
+  // Images without usage are read as Data
+  std::vector<int> usages(model.images.size(), -1);
+  const auto addUsage = [&](int textureIdx, ImageUsage usage) {
+    if (textureIdx < 0 || size_t(textureIdx) >= model.textures.size()) {
+      return;
+    }
+    const auto imageIdx = model.textures[textureIdx].source;
+    if (imageIdx < 0 || size_t(imageIdx) >= usages.size()) {
+      return;
+    }
+    auto &imageUsage = usages[imageIdx];
+    imageUsage = imageUsage < 0 || imageUsage == int(usage)
+                     ? int(usage)
+                     : int(ImageUsage::Data);
+  };
+  for (const auto &material : model.materials) {
+    const auto &pbr = material.pbrMetallicRoughness;
+    addUsage(pbr.baseColorTexture.index, ImageUsage::Color);
+    addUsage(material.emissiveTexture.index, ImageUsage::Color);
+    addUsage(material.normalTexture.index, ImageUsage::Normal);
+    addUsage(pbr.metallicRoughnessTexture.index, ImageUsage::Data);
+    addUsage(material.occlusionTexture.index, ImageUsage::Data);
+  }
+
+  std::vector<ImageUsage> imageUsages(usages.size(), ImageUsage::Data);
+  for (size_t imageIdx = 0; imageIdx < usages.size(); ++imageIdx) {
+    if (usages[imageIdx] >= 0) {
+      imageUsages[imageIdx] = ImageUsage(usages[imageIdx]);
+    }
+  }
+  return imageUsages;
+}
+
+bool isKtx2Image(const tinygltf::Image &image)
+{
+  return image.as_is && isKtx2(image.image.data(), image.image.size());
+}
+
+bool canUploadKtx2Image(const tinygltf::Image &image)
+{
+  Ktx2Image ktx2;
+  std::string err;
+  return isKtx2Image(image) &&
+         parseKtx2(image.image.data(), image.image.size(), ktx2, err) &&
+         checkKtx2Image(ktx2, err);
+}
+
+ImageTexture &ImageTexture::operator=(ImageTexture &&rvalue)
+{
+  std::swap(m_texture, rvalue.m_texture);
+  std::swap(m_nByteSize, rvalue.m_nByteSize);
+  std::swap(m_memory, rvalue.m_memory);
+  std::swap(m_isCompressed, rvalue.m_isCompressed);
+  return *this;
+}
+
+bool ImageTexture::create(const tinygltf::Image &image, std::string &err,
+    GLuint unpackBuffer, size_t unpackOffset, ImageUsage usage,
+    const GLProgram *mipmapProgram)
+{
+  release();
+
+  // Pointer to the bytes of image.image at data, an offset in the unpack
+  // buffer if there is one
+  const auto getPixels = [&](const unsigned char *data) -> const void * {
+    if (!unpackBuffer) {
+      return data;
+    }
+    return reinterpret_cast<const void *>(
+        unpackOffset + size_t(data - image.image.data()));
+  };
+
+  if (isKtx2Image(image)) {
+    Ktx2Image ktx2;
+    if (!parseKtx2(image.image.data(), image.image.size(), ktx2, err) ||
+        !checkKtx2Image(ktx2, err)) {
+      return false;
+    }
+    const auto internalFormat = getKtx2InternalFormat(ktx2.vkFormat);
+    m_isCompressed = internalFormat != GL_RGBA8 &&
+                     internalFormat != GL_SRGB8_ALPHA8;
+    // Uncompressed files without mipmaps get them generated, as decoded
+    // images
+    const auto generateMipmaps = !m_isCompressed && ktx2.levels.size() == 1;
+    const auto levelCount =
+        generateMipmaps ? getFullMipmapLevelCount(ktx2.width, ktx2.height)
+                        : ktx2.levels.size();
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexStorage2D(GL_TEXTURE_2D, GLsizei(levelCount), internalFormat,
+        GLsizei(ktx2.width), GLsizei(ktx2.height));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+    for (size_t level = 0; level < ktx2.levels.size(); ++level) {
+      const auto width = getLevelSize(ktx2.width, level);
+      const auto height = getLevelSize(ktx2.height, level);
+      const auto &data = ktx2.levels[level];
+      if (m_isCompressed) {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, GLint(level), 0, 0, width,
+            height, internalFormat, GLsizei(data.size), getPixels(data.data));
+      } else {
+        glTexSubImage2D(GL_TEXTURE_2D, GLint(level), 0, 0, width, height,
+            GL_RGBA, GL_UNSIGNED_BYTE, getPixels(data.data));
+      }
+      m_nByteSize += data.size;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (generateMipmaps) {
+      ::generateMipmaps(m_texture, internalFormat, ktx2.width, ktx2.height,
+          levelCount, usage, mipmapProgram);
+      for (size_t level = 1; level < levelCount; ++level) {
+        m_nByteSize += size_t(getLevelSize(ktx2.width, level)) *
+                       getLevelSize(ktx2.height, level) * 4;
+      }
+    }
+    m_memory = TrackedGLMemory(GLMemoryCategory::Textures, m_nByteSize);
+    return true;
+  }
+
+  // Pixels decoded by stb_image
+  static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+  static const GLenum internalFormats8[] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+  static const GLenum internalFormats16[] = {
+      GL_R16, GL_RG16, GL_RGB16, GL_RGBA16};
+  const auto bytesPerComponent = image.bits == 16 ? 2 : 1;
+  const auto pixelSize = size_t(image.component) * bytesPerComponent;
+  if (image.width <= 0 || image.height <= 0 || image.component < 1 ||
+      image.component > 4 || (image.bits != 8 && image.bits != 16) ||
+      image.image.size() < size_t(image.width) * image.height * pixelSize) {
+    err = "Invalid image pixels";
+    return false;
+  }
+  const auto width = uint32_t(image.width);
+  const auto height = uint32_t(image.height);
+  const auto levelCount = getFullMipmapLevelCount(width, height);
+
+  const auto internalFormat =
+      (image.bits == 16 ? internalFormats16
+                        : internalFormats8)[image.component - 1];
+
+  glGenTextures(1, &m_texture);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+  glTexStorage2D(GL_TEXTURE_2D, GLsizei(levelCount), internalFormat,
+      image.width, image.height);
+  // Rows of 1 to 3 components are not 4-byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height,
+      formats[image.component - 1],
+      image.bits == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE,
+      getPixels(image.image.data()));
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  generateMipmaps(m_texture, internalFormat, width, height, levelCount, usage,
+      mipmapProgram);
+  for (size_t level = 0; level < levelCount; ++level) {
+    m_nByteSize += size_t(getLevelSize(width, level)) *
+                   getLevelSize(height, level) * pixelSize;
+  }
+  m_memory = TrackedGLMemory(GLMemoryCategory::Textures, m_nByteSize);
+  return true;
+}
+
+void ImageTexture::release()
+{
+  if (m_texture) {
+    glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+  }
+  m_nByteSize = 0;
+  m_memory = TrackedGLMemory();
+  m_isCompressed = false;
+}
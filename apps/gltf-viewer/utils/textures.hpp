@@ -0,0 +1,89 @@
+#pragma once
+
+#include "gl_memory.hpp"
+#include "ktx2.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+// How materials read the texels of an image, which decides how its mipmaps
+// are filtered. Values are the uUsage of downsample_texture.cs.glsl.
+enum class ImageUsage
+{
+  Data = 0, // Averaged as they are (metallic-roughness, occlusion)
+  Color = 1, // sRGB colors (base color, emissive) averaged in linear space
+  Normal = 2 // Tangent space normals, renormalized once averaged
+};
+
+// Usage of each image of model by its materials, Data for images used in
+// several ways or by none
+std::vector<ImageUsage> getImageUsages(const tinygltf::Model &model);
+
+// Internal format of vkFormat (see Ktx2Image) if the current context can
+// sample it, 0 otherwise
+GLenum getKtx2InternalFormat(uint32_t vkFormat);
+
+// Return true if image holds a KTX2 container kept as is by loadImageData
+bool isKtx2Image(const tinygltf::Image &image);
+
+// Return true if the levels of the KTX2 image can be uploaded as they are:
+// no Basis Universal transcoding, no supercompression and a format the
+// current context supports (see getKtx2InternalFormat)
+bool canUploadKtx2Image(const tinygltf::Image &image);
+
+// Immutable 2D texture of a glTF image.
+//
+// Images decoded by stb_image are uploaded to level 0 and their mipmaps are
+// generated. The levels of KTX2 images are uploaded as they are, in their
+// GPU format, so that compressed images are never decoded (see also
+// compressModelImages).
+class ImageTexture
+{
+public:
+  ImageTexture() = default;
+
+  ~ImageTexture() { release(); }
+
+  // Non-copyable class:
+  ImageTexture(const ImageTexture &) = delete;
+  ImageTexture &operator=(const ImageTexture &) = delete;
+
+  ImageTexture(ImageTexture &&rvalue) { *this = std::move(rvalue); }
+
+  ImageTexture &operator=(ImageTexture &&rvalue);
+
+  // Create the texture of image, return false and fill err if it cannot be
+  // created (e.g. canUploadKtx2Image is false). The texture is left bound to
+  // GL_TEXTURE_2D. If unpackBuffer is not 0, a copy of image.image at
+  // unpackOffset in that buffer (e.g. a staging RingBuffer) is uploaded
+  // instead, so that the driver copies it without blocking the caller.
+  // Mipmaps of RGBA8 textures are generated by mipmapProgram
+  // (downsample_texture.cs.glsl) filtering texels according to usage if it
+  // is not null, by glGenerateMipmap otherwise. mipmapProgram is left in
+  // use.
+  bool create(const tinygltf::Image &image, std::string &err,
+      GLuint unpackBuffer = 0, size_t unpackOffset = 0,
+      ImageUsage usage = ImageUsage::Data,
+      const GLProgram *mipmapProgram = nullptr);
+
+  GLuint texture() const { return m_texture; }
+
+  // Storage of all levels, in bytes
+  size_t byteSize() const { return m_nByteSize; }
+
+  bool isCompressed() const { return m_isCompressed; }
+
+private:
+  void release();
+
+  GLuint m_texture = 0;
+  size_t m_nByteSize = 0;
+  TrackedGLMemory m_memory; // Of m_nByteSize
+  bool m_isCompressed = false;
+};
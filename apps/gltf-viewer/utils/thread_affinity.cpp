@@ -0,0 +1,141 @@
+#include "thread_affinity.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#endif
+
+namespace
+{
+
+thread_local int tls_numaNode = -1;
+
+#ifdef __linux__
+
+// CPUs of a sysfs list, e.g. "0-3,8-11"
+std::vector<int> parseCpuList(const std::string &list)
+{
+  std::vector<int> cpus;
+  std::stringstream stream{list};
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    const auto dash = range.find('-');
+    try {
+      const auto first = std::stoi(range.substr(0, dash));
+      const auto last = dash == std::string::npos
+                            ? first
+                            : std::stoi(range.substr(dash + 1));
+      for (auto cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    } catch (const std::exception &) {
+    }
+  }
+  return cpus;
+}
+
+std::vector<std::vector<int>> readNumaNodeCpus()
+{
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+
+  std::vector<std::vector<int>> nodes;
+  for (auto node = 0;; ++node) {
+    std::ifstream file{"/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist"};
+    std::string list;
+    if (!file || !std::getline(file, list)) {
+      break;
+    }
+    std::vector<int> cpus;
+    for (const auto cpu : parseCpuList(list)) {
+      if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+    // Nodes without CPU of the process (memory only, or excluded by the
+    // affinity of the process) get no thread
+    if (!cpus.empty()) {
+      nodes.push_back(std::move(cpus));
+    }
+  }
+  if (nodes.empty()) {
+    nodes.emplace_back();
+    for (auto cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        nodes.back().push_back(cpu);
+      }
+    }
+  }
+  return nodes;
+}
+
+#endif
+
+} // namespace
+
+const std::vector<std::vector<int>> &getNumaNodeCpus()
+{
+#ifdef __linux__
+  static const auto nodes = readNumaNodeCpus();
+#else
+  static const std::vector<std::vector<int>> nodes = {{0}};
+#endif
+  return nodes;
+}
+
+bool pinCurrentThread(ThreadPinning pinning, size_t slot)
+{
+  if (pinning == ThreadPinning::None) {
+    return true;
+  }
+#ifdef __linux__
+  const auto &nodes = getNumaNodeCpus();
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  auto node = 0;
+  if (pinning == ThreadPinning::NumaNodes) {
+    node = int(slot % nodes.size());
+    for (const auto cpu : nodes[node]) {
+      CPU_SET(cpu, &cpus);
+    }
+  } else {
+    size_t cpuCount = 0;
+    for (const auto &nodeCpus : nodes) {
+      cpuCount += nodeCpus.size();
+    }
+    auto index = slot % cpuCount;
+    while (index >= nodes[node].size()) {
+      index -= nodes[node].size();
+      ++node;
+    }
+    CPU_SET(nodes[node][index], &cpus);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    return false;
+  }
+  tls_numaNode = node;
+  return true;
+#else
+  (void)slot;
+  return false;
+#endif
+}
+
+int getCurrentNumaNode() { return tls_numaNode; }
+
+void lowerCurrentThreadPriority()
+{
+#ifdef __linux__
+  // Linux threads have their own nice value, set through their thread id
+  setpriority(PRIO_PROCESS, id_t(syscall(SYS_gettid)), 10);
+#endif
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Placement of the worker threads of the job system on the CPUs, for
+// machines with several sockets where threads moved between sockets read
+// their data across the interconnect. Memory is placed on the NUMA node of
+// the thread that first writes it (first-touch policy of Linux): data
+// decoded by a pinned worker, e.g. images, stays local to its node.
+enum class ThreadPinning
+{
+  None, // Threads run anywhere
+  Cores, // Worker i runs on the i-th CPU, filling a NUMA node first
+  NumaNodes // Worker i runs on any CPU of node i modulo the node count
+};
+
+// CPUs the process may run on, by NUMA node. A single node with every CPU
+// of the process on systems without NUMA information (and only CPU 0 of a
+// single node on platforms other than Linux).
+const std::vector<std::vector<int>> &getNumaNodeCpus();
+
+// Pin the calling thread to the CPUs of slot, a worker index, for pinning.
+// Return false if the thread could not be pinned (not supported on this
+// platform). Does nothing for ThreadPinning::None.
+bool pinCurrentThread(ThreadPinning pinning, size_t slot);
+
+// NUMA node the calling thread was pinned to by pinCurrentThread, -1 if it
+// is not pinned to a single node
+int getCurrentNumaNode();
+
+// Lower the scheduling priority of the calling thread (nice value), so that
+// background work yields the CPU to the frame threads. Linux only.
+void lowerCurrentThreadPriority();
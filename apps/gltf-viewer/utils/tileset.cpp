@@ -0,0 +1,351 @@
+#include "tileset.hpp"
+#include "bounds.hpp"
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+
+// Rotation turning the y-up glTF contents z-up, as 3D Tiles specify
+const glm::mat4 Y_UP_TO_Z_UP = glm::mat4(glm::vec4(1, 0, 0, 0),
+    glm::vec4(0, 0, 1, 0), glm::vec4(0, -1, 0, 0), glm::vec4(0, 0, 0, 1));
+
+glm::mat4 readMatrix(const nlohmann::json &json)
+{
+  const auto values = json.get<std::vector<float>>();
+  if (values.size() != 16) {
+    throw std::runtime_error("transform must have 16 numbers");
+  }
+  glm::mat4 matrix;
+  for (size_t i = 0; i < 16; ++i) {
+    matrix[i / 4][i % 4] = values[i];
+  }
+  return matrix;
+}
+
+// World bounds of the bounding volume of a tile whose world transform is
+// matrix
+void readBoundingVolume(const nlohmann::json &json, const glm::mat4 &matrix,
+    glm::vec3 &bboxMin, glm::vec3 &bboxMax)
+{
+  bboxMin = glm::vec3(std::numeric_limits<float>::max());
+  bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+  if (json.count("box")) {
+    const auto box = json["box"].get<std::vector<float>>();
+    if (box.size() != 12) {
+      throw std::runtime_error("box must have 12 numbers");
+    }
+    // The box is the image of [-1, 1]^3 by its half axes
+    const auto boxMatrix =
+        glm::mat4(glm::vec4(box[3], box[4], box[5], 0),
+            glm::vec4(box[6], box[7], box[8], 0),
+            glm::vec4(box[9], box[10], box[11], 0),
+            glm::vec4(box[0], box[1], box[2], 1));
+    extendBoundsWithBox(
+        glm::vec3(-1), glm::vec3(1), matrix * boxMatrix, bboxMin, bboxMax);
+  } else if (json.count("sphere")) {
+    const auto sphere = json["sphere"].get<std::vector<float>>();
+    if (sphere.size() != 4) {
+      throw std::runtime_error("sphere must have 4 numbers");
+    }
+    const auto center = glm::vec3(sphere[0], sphere[1], sphere[2]);
+    extendBoundsWithBox(center - glm::vec3(sphere[3]),
+        center + glm::vec3(sphere[3]), matrix, bboxMin, bboxMax);
+  } else {
+    throw std::runtime_error(
+        "only box and sphere bounding volumes are supported");
+  }
+}
+
+} // namespace
+
+bool Tileset::load(const fs::path &path, std::string &err)
+{
+  std::ifstream file{path.string(), std::ios::binary};
+  if (!file) {
+    err = "unable to open " + path.string();
+    return false;
+  }
+
+  std::vector<Tile> tiles;
+  try {
+    nlohmann::json document;
+    file >> document;
+    const auto &asset = document.at("asset");
+    const auto upMatrix = asset.count("gltfUpAxis") &&
+                                  asset["gltfUpAxis"].get<std::string>() == "Z"
+                              ? glm::mat4(1)
+                              : Y_UP_TO_Z_UP;
+
+    // Tiles are numbered in the order they are queued, breadth first
+    struct QueuedTile
+    {
+      const nlohmann::json *json;
+      glm::mat4 parentMatrix;
+      bool isParentAdditive;
+    };
+    std::deque<QueuedTile> queue{{&document.at("root"), glm::mat4(1), false}};
+    while (!queue.empty()) {
+      const auto queued = queue.front();
+      queue.pop_front();
+      const auto &json = *queued.json;
+
+      Tile tile;
+      auto matrix = queued.parentMatrix;
+      if (json.count("transform")) {
+        matrix = matrix * readMatrix(json["transform"]);
+      }
+      tile.contentMatrix = matrix * upMatrix;
+      readBoundingVolume(
+          json.at("boundingVolume"), matrix, tile.bboxMin, tile.bboxMax);
+      tile.geometricError = json.at("geometricError").get<float>();
+      tile.isAdditive = queued.isParentAdditive;
+      if (json.count("refine")) {
+        const auto refine = json["refine"].get<std::string>();
+        if (refine != "ADD" && refine != "REPLACE") {
+          throw std::runtime_error("unknown refine " + refine);
+        }
+        tile.isAdditive = refine == "ADD";
+      }
+      if (json.count("content")) {
+        const auto &content = json["content"];
+        // "url" is the name of 3D Tiles 0.0
+        const auto uri = content.count("uri")
+                             ? content["uri"].get<std::string>()
+                             : content.at("url").get<std::string>();
+        tile.content = path.parent_path() / uri;
+        if (tile.content.extension() == ".json") {
+          throw std::runtime_error(
+              "external tilesets are not supported (" + uri + ")");
+        }
+      }
+
+      tile.firstChild = uint32_t(tiles.size() + 1 + queue.size());
+      tile.childCount = 0;
+      if (json.count("children")) {
+        for (const auto &child : json["children"]) {
+          queue.push_back({&child, matrix, tile.isAdditive});
+          ++tile.childCount;
+        }
+      }
+      tiles.push_back(std::move(tile));
+    }
+  } catch (const std::exception &e) {
+    err = "invalid tileset " + path.string() + ": " + e.what();
+    return false;
+  }
+
+  m_tiles = std::move(tiles);
+  m_states.clear();
+  for (const auto &tile : m_tiles) {
+    m_states.push_back({tile.content.empty() ? ContentState::None
+                                             : ContentState::Unloaded,
+        0, 0, 0});
+  }
+  m_usage = {};
+  m_nFrame = 0;
+  return true;
+}
+
+void Tileset::setLoading(size_t idx)
+{
+  m_states[idx].state = ContentState::Loading;
+}
+
+void Tileset::setLoaded(size_t idx, size_t gpuBytes, size_t hostBytes)
+{
+  auto &state = m_states[idx];
+  state.state = ContentState::Loaded;
+  state.gpuBytes = gpuBytes;
+  state.hostBytes = hostBytes;
+  m_usage.gpuBytes += gpuBytes;
+  m_usage.hostBytes += hostBytes;
+  ++m_usage.contentCount;
+}
+
+void Tileset::setFailed(size_t idx)
+{
+  m_states[idx].state = ContentState::Failed;
+}
+
+void Tileset::setUnloaded(size_t idx)
+{
+  auto &state = m_states[idx];
+  if (state.state == ContentState::Loaded) {
+    m_usage.gpuBytes -= state.gpuBytes;
+    m_usage.hostBytes -= state.hostBytes;
+    --m_usage.contentCount;
+  }
+  state = {ContentState::Unloaded, 0, 0, state.lastUsedFrame};
+}
+
+void Tileset::select(const glm::mat4 &viewProjMatrix, const glm::vec3 &eye,
+    float pixelsPerUnit, float maxPixelError, Selection &selection)
+{
+  ++m_nFrame;
+  selection.draws.clear();
+  selection.requests.clear();
+  selection.prefetches.clear();
+  selectRoot(viewProjMatrix, eye, pixelsPerUnit, maxPixelError, selection);
+  for (const auto &request : m_requests) {
+    selection.requests.push_back(request.second);
+  }
+}
+
+void Tileset::prefetch(const glm::mat4 &viewProjMatrix, const glm::vec3 &eye,
+    float pixelsPerUnit, float maxPixelError, Selection &selection)
+{
+  // The draws of the prediction are not those of the frame
+  m_prefetchSelection.draws.clear();
+  selectRoot(viewProjMatrix, eye, pixelsPerUnit, maxPixelError,
+      m_prefetchSelection);
+  for (const auto &request : m_requests) {
+    const auto isRequested = [&](const std::vector<uint32_t> &tiles) {
+      return std::find(begin(tiles), end(tiles), request.second) !=
+             end(tiles);
+    };
+    if (!isRequested(selection.requests) &&
+        !isRequested(selection.prefetches)) {
+      selection.prefetches.push_back(request.second);
+    }
+  }
+}
+
+std::vector<uint32_t> Tileset::evict(size_t gpuBudget, size_t hostBudget) const
+{
+  std::vector<uint32_t> candidates;
+  for (size_t idx = 0; idx < m_states.size(); ++idx) {
+    const auto &state = m_states[idx];
+    if (state.state == ContentState::Loaded && state.lastUsedFrame < m_nFrame) {
+      candidates.push_back(uint32_t(idx));
+    }
+  }
+  std::sort(begin(candidates), end(candidates),
+      [&](uint32_t lhs, uint32_t rhs) {
+        return m_states[lhs].lastUsedFrame < m_states[rhs].lastUsedFrame;
+      });
+
+  auto gpuBytes = m_usage.gpuBytes;
+  auto hostBytes = m_usage.hostBytes;
+  std::vector<uint32_t> evicted;
+  for (const auto idx : candidates) {
+    if ((!gpuBudget || gpuBytes <= gpuBudget) &&
+        (!hostBudget || hostBytes <= hostBudget)) {
+      break;
+    }
+    gpuBytes -= m_states[idx].gpuBytes;
+    hostBytes -= m_states[idx].hostBytes;
+    evicted.push_back(idx);
+  }
+  return evicted;
+}
+
+void Tileset::selectRoot(const glm::mat4 &viewProjMatrix,
+    const glm::vec3 &eye, float pixelsPerUnit, float maxPixelError,
+    Selection &selection)
+{
+  m_frustum = extractFrustum(viewProjMatrix);
+  m_eye = eye;
+  m_requests.clear();
+  if (m_tiles.empty()) {
+    return;
+  }
+  selectTile(0, pixelsPerUnit, maxPixelError, selection);
+
+  // Coarse tiles first: they cover more of the view and are the fallback of
+  // their children
+  std::stable_sort(begin(m_requests), end(m_requests),
+      [](const std::pair<float, uint32_t> &lhs,
+          const std::pair<float, uint32_t> &rhs) {
+        return lhs.first > rhs.first;
+      });
+}
+
+bool Tileset::selectTile(size_t idx, float pixelsPerUnit, float maxPixelError,
+    Selection &selection)
+{
+  const auto &tile = m_tiles[idx];
+  auto &state = m_states[idx];
+  if (!intersectsBox(m_frustum, tile.bboxMin, tile.bboxMax)) {
+    return true;
+  }
+
+  const auto error = getScreenError(idx, pixelsPerUnit);
+  // Draw the content, or request it. Return true unless it is missing.
+  const auto useContent = [&]() {
+    state.lastUsedFrame = m_nFrame;
+    switch (state.state) {
+    case ContentState::Loaded:
+      selection.draws.push_back(uint32_t(idx));
+      return true;
+    case ContentState::Unloaded:
+      m_requests.emplace_back(error, uint32_t(idx));
+      return false;
+    case ContentState::Loading:
+      return false;
+    default:
+      return true;
+    }
+  };
+
+  if (!tile.childCount || error <= maxPixelError) {
+    return useContent();
+  }
+  if (tile.isAdditive) {
+    const auto isCovered = useContent();
+    for (size_t i = 0; i < tile.childCount; ++i) {
+      selectTile(tile.firstChild + i, pixelsPerUnit, maxPixelError, selection);
+    }
+    return isCovered;
+  }
+
+  const auto firstDraw = selection.draws.size();
+  auto areChildrenCovered = true;
+  for (size_t i = 0; i < tile.childCount; ++i) {
+    if (!selectTile(
+            tile.firstChild + i, pixelsPerUnit, maxPixelError, selection)) {
+      areChildrenCovered = false;
+    }
+  }
+  // A loaded tile stays cached while its children are drawn, zooming out
+  // draws it again
+  state.lastUsedFrame = m_nFrame;
+  if (areChildrenCovered) {
+    return true;
+  }
+  // Drawn instead of its children until they are loaded, which are still
+  // requested
+  if (state.state == ContentState::Loaded) {
+    selection.draws.resize(firstDraw);
+    selection.draws.push_back(uint32_t(idx));
+    return true;
+  }
+  if (state.state == ContentState::Unloaded) {
+    m_requests.emplace_back(error, uint32_t(idx));
+  }
+  // The parent is drawn instead if it can be
+  return false;
+}
+
+float Tileset::getScreenError(size_t idx, float pixelsPerUnit) const
+{
+  const auto &tile = m_tiles[idx];
+  const auto closest = glm::clamp(m_eye, tile.bboxMin, tile.bboxMax);
+  const auto distance = glm::length(closest - m_eye);
+  if (distance <= 0.f) {
+    return std::numeric_limits<float>::max();
+  }
+  return tile.geometricError * pixelsPerUnit / distance;
+}
+
+float getPixelsPerUnit(float fovY, size_t height)
+{
+  return float(height) / (2.f * std::tan(0.5f * fovY));
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "frustum.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Hierarchy of glTF tiles of a scene too large to be loaded at once, read
+// from a tileset file following the tileset.json of 3D Tiles 1.0. The
+// supported subset is:
+//   {"asset": {"version": "1.0", "gltfUpAxis": "Y"},
+//    "root": {
+//      "boundingVolume": {"box": [cx, cy, cz, xx, xy, xz, yx, yy, yz, zx, zy,
+//        zz]} or {"sphere": [cx, cy, cz, radius]},
+//      "geometricError": 10, "refine": "REPLACE" or "ADD",
+//      "transform": [16 numbers, column-major], "content": {"uri": "a.glb"},
+//      "children": [...]}}
+// Regions and external tilesets are not supported. Content URIs are relative
+// to the tileset file. As in 3D Tiles, glTF contents are y-up and are turned
+// z-up unless asset.gltfUpAxis is "Z".
+//
+// Each frame, select() picks the tiles whose geometric error is small enough
+// for the camera and tells which contents to load, then prefetch() adds the
+// contents that predicted cameras will need. Loaded contents are
+// evicted least recently used first to stay within memory budgets (see
+// evict()). Loading and drawing the contents is left to the caller.
+class Tileset
+{
+public:
+  enum class ContentState
+  {
+    None, // The tile has no content
+    Unloaded,
+    Loading,
+    Loaded,
+    Failed // Never requested again
+  };
+
+  struct Tile
+  {
+    fs::path content; // Empty if none
+    // World transform of the content, including the up axis conversion
+    glm::mat4 contentMatrix;
+    // World bounds of the bounding volume
+    glm::vec3 bboxMin;
+    glm::vec3 bboxMax;
+    float geometricError;
+    bool isAdditive; // ADD refinement, else REPLACE
+    uint32_t firstChild; // Children are consecutive
+    uint32_t childCount;
+  };
+
+  // Tiles to draw and contents to load for a camera
+  struct Selection
+  {
+    std::vector<uint32_t> draws; // Tiles with loaded contents
+    // Tiles whose content should be loaded, most important first
+    std::vector<uint32_t> requests;
+    // Tiles the predicted cameras need beyond requests, to load after them
+    std::vector<uint32_t> prefetches;
+  };
+
+  // Sizes of the loaded contents
+  struct MemoryUsage
+  {
+    size_t gpuBytes = 0;
+    size_t hostBytes = 0;
+    size_t contentCount = 0;
+  };
+
+  bool load(const fs::path &path, std::string &err);
+
+  size_t tileCount() const { return m_tiles.size(); }
+  const Tile &tile(size_t idx) const { return m_tiles[idx]; }
+
+  // World bounds of the root tile
+  const glm::vec3 &bboxMin() const { return m_tiles.front().bboxMin; }
+  const glm::vec3 &bboxMax() const { return m_tiles.front().bboxMax; }
+
+  ContentState state(size_t idx) const { return m_states[idx].state; }
+
+  // Set by the caller as it loads contents. Loaded contents have their sizes
+  // counted until setUnloaded.
+  void setLoading(size_t idx);
+  void setLoaded(size_t idx, size_t gpuBytes, size_t hostBytes);
+  void setFailed(size_t idx);
+  void setUnloaded(size_t idx);
+
+  // Select the tiles to draw seen from eye through viewProjMatrix, refining
+  // tiles whose geometric error projects to more than maxPixelError pixels.
+  // pixelsPerUnit is the height of the viewport in pixels divided by the
+  // height of the view frustum at distance 1 (see getPixelsPerUnit).
+  //
+  // A REPLACE tile is drawn instead of its children until they can all be
+  // drawn, so that nothing disappears while children load. Selected tiles
+  // count as used by this frame for evict().
+  void select(const glm::mat4 &viewProjMatrix, const glm::vec3 &eye,
+      float pixelsPerUnit, float maxPixelError, Selection &selection);
+
+  // Add to selection.prefetches the contents missing for a camera the last
+  // select() predicted to be at eye through viewProjMatrix. The tiles used
+  // by the prediction count as used by this frame for evict(), so that they
+  // are kept rather than the contents that are merely close.
+  void prefetch(const glm::mat4 &viewProjMatrix, const glm::vec3 &eye,
+      float pixelsPerUnit, float maxPixelError, Selection &selection);
+
+  // Loaded tiles to unload, least recently used first, until the contents
+  // fit in the budgets (0 meaning no limit). Tiles used by the last
+  // select() are kept even above the budgets.
+  std::vector<uint32_t> evict(size_t gpuBudget, size_t hostBudget) const;
+
+  const MemoryUsage &memoryUsage() const { return m_usage; }
+
+private:
+  struct TileState
+  {
+    ContentState state;
+    size_t gpuBytes;
+    size_t hostBytes;
+    uint64_t lastUsedFrame;
+  };
+
+  // Select the tiles from the root and sort m_requests
+  void selectRoot(const glm::mat4 &viewProjMatrix, const glm::vec3 &eye,
+      float pixelsPerUnit, float maxPixelError, Selection &selection);
+
+  // Return true if the area of tile idx is covered by the draws added
+  bool selectTile(size_t idx, float pixelsPerUnit, float maxPixelError,
+      Selection &selection);
+
+  float getScreenError(size_t idx, float pixelsPerUnit) const;
+
+  std::vector<Tile> m_tiles; // Root first, breadth first
+  std::vector<TileState> m_states;
+  MemoryUsage m_usage;
+  uint64_t m_nFrame = 0; // Incremented by select()
+
+  // State of the select() call
+  Frustum m_frustum;
+  glm::vec3 m_eye;
+  std::vector<std::pair<float, uint32_t>> m_requests; // Screen error, tile
+  Selection m_prefetchSelection; // Of the prefetch() call
+};
+
+// Pixels per unit of length at distance 1 of a perspective projection of
+// vertical field of view fovY in a viewport of height pixels
+float getPixelsPerUnit(float fovY, size_t height);
@@ -0,0 +1,176 @@
+#include "tls_session.hpp"
+
+#ifdef GLMLV_USE_OPENSSL
+
+#include <cerrno>
+#include <csignal>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+struct TlsSession::Impl
+{
+  SSL *ssl = nullptr;
+
+  ~Impl()
+  {
+    if (ssl) {
+      SSL_shutdown(ssl);
+      SSL_free(ssl);
+    }
+  }
+};
+
+namespace
+{
+
+// Shared by the sessions, created on first use
+SSL_CTX *getContext()
+{
+  static SSL_CTX *const context = []() {
+    const auto context = SSL_CTX_new(TLS_client_method());
+    if (context) {
+      SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+      SSL_CTX_set_verify(context, SSL_VERIFY_PEER, nullptr);
+      SSL_CTX_set_default_verify_paths(context);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+      // Servers closing without a close_notify end the stream like plain
+      // sockets: responses are delimited by their Content-Length
+      SSL_CTX_set_options(context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+    }
+    return context;
+  }();
+  return context;
+}
+
+std::string getErrorString()
+{
+  char message[256] = "unknown error";
+  if (const auto error = ERR_get_error()) {
+    ERR_error_string_n(error, message, sizeof(message));
+  }
+  ERR_clear_error();
+  return message;
+}
+
+// Result of SSL_read or SSL_write as the result of recv or send
+long getResult(SSL *ssl, int result)
+{
+  if (result > 0) {
+    return result;
+  }
+  const auto systemError = errno;
+  const auto error = SSL_get_error(ssl, result);
+  ERR_clear_error();
+  if (error == SSL_ERROR_ZERO_RETURN) {
+    return 0;
+  }
+  if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+    // The socket is blocking: it timed out, unless interrupted
+    errno = systemError == EINTR ? EINTR : EAGAIN;
+  } else if (error == SSL_ERROR_SYSCALL && systemError != 0) {
+    errno = systemError;
+  } else {
+    errno = EIO;
+  }
+  return -1;
+}
+
+} // namespace
+
+bool TlsSession::isSupported() { return true; }
+
+std::unique_ptr<TlsSession> TlsSession::connect(
+    int socket, const std::string &host, std::string &err)
+{
+#ifndef _WIN32
+  // A server closing the connection must fail the writes, not kill us
+  std::signal(SIGPIPE, SIG_IGN);
+#endif
+  const auto context = getContext();
+  if (!context) {
+    err = "unable to initialize TLS: " + getErrorString();
+    return nullptr;
+  }
+  // The certificate names host, or holds its address
+  const auto isAddress = host.find(':') != std::string::npos ||
+                         host.find_first_not_of("0123456789.") ==
+                             std::string::npos;
+  auto pImpl = std::make_unique<Impl>();
+  pImpl->ssl = SSL_new(context);
+  if (!pImpl->ssl || !SSL_set_fd(pImpl->ssl, socket) ||
+      !(isAddress ? X509_VERIFY_PARAM_set1_ip_asc(
+                        SSL_get0_param(pImpl->ssl), host.c_str())
+                  : SSL_set1_host(pImpl->ssl, host.c_str()))) {
+    err = "unable to create a TLS session: " + getErrorString();
+    return nullptr;
+  }
+  if (!isAddress) {
+    SSL_set_tlsext_host_name(pImpl->ssl, host.c_str()); // Virtual hosts
+  }
+  if (SSL_connect(pImpl->ssl) != 1) {
+    const auto verifyResult = SSL_get_verify_result(pImpl->ssl);
+    err = "TLS handshake with " + host + " failed: " +
+          (verifyResult != X509_V_OK
+                  ? X509_verify_cert_error_string(verifyResult)
+                  : getErrorString());
+    ERR_clear_error();
+    // The session is freed without a close_notify on a broken connection
+    SSL_set_quiet_shutdown(pImpl->ssl, 1);
+    return nullptr;
+  }
+  return std::unique_ptr<TlsSession>(new TlsSession(std::move(pImpl)));
+}
+
+long TlsSession::receive(char *data, size_t size)
+{
+  ERR_clear_error();
+  return getResult(m_pImpl->ssl, SSL_read(m_pImpl->ssl, data, int(size)));
+}
+
+long TlsSession::send(const char *data, size_t size)
+{
+  ERR_clear_error();
+  return getResult(m_pImpl->ssl, SSL_write(m_pImpl->ssl, data, int(size)));
+}
+
+#else
+
+#include <cerrno>
+
+struct TlsSession::Impl
+{
+};
+
+bool TlsSession::isSupported() { return false; }
+
+std::unique_ptr<TlsSession> TlsSession::connect(
+    int, const std::string &, std::string &err)
+{
+  err = "TLS is not supported, build the viewer with OpenSSL "
+        "(GLMLV_USE_OPENSSL)";
+  return nullptr;
+}
+
+long TlsSession::receive(char *, size_t)
+{
+  errno = EIO;
+  return -1;
+}
+
+long TlsSession::send(const char *, size_t)
+{
+  errno = EIO;
+  return -1;
+}
+
+#endif
+
+TlsSession::TlsSession(std::unique_ptr<Impl> pImpl) :
+    m_pImpl(std::move(pImpl))
+{
+}
+
+TlsSession::~TlsSession() = default;
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Client side of a TLS connection on a connected TCP socket, for the
+// https:// range requests of remote files (see SocketStream). It is
+// implemented with OpenSSL if the viewer is built with it
+// (GLMLV_USE_OPENSSL), connections fail otherwise.
+class TlsSession
+{
+public:
+  // Whether TLS is compiled in
+  static bool isSupported();
+
+  // Handshake with host on socket, whose certificate must be valid for host
+  // and signed by the certificate authorities of the system. Return null and
+  // fill err on failure: the socket is left open.
+  static std::unique_ptr<TlsSession> connect(
+      int socket, const std::string &host, std::string &err);
+
+  ~TlsSession();
+
+  TlsSession(const TlsSession &) = delete;
+  TlsSession &operator=(const TlsSession &) = delete;
+
+  // Like recv and send on the socket: the count of bytes, 0 at the end of
+  // the stream, or -1 with errno set, EAGAIN on a timeout of the socket
+  long receive(char *data, size_t size);
+  long send(const char *data, size_t size);
+
+private:
+  struct Impl;
+
+  explicit TlsSession(std::unique_ptr<Impl> pImpl);
+
+  std::unique_ptr<Impl> m_pImpl;
+};
@@ -0,0 +1,253 @@
+#include "tracing.hpp"
+
+#include <json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+
+// Times in nanoseconds since the creation of the tracer
+struct TraceEvent
+{
+  const char *name;
+  int64_t start;
+  int64_t duration;
+};
+
+// Events of a thread, only locked by writeTrace besides the thread
+struct ThreadTrack
+{
+  std::mutex mutex;
+  std::string name;
+  size_t id = 0; // From 1, the GPU track is 0
+  std::vector<TraceEvent> events;
+};
+
+struct PendingGPUZone
+{
+  const char *name;
+  GLuint startQuery;
+  GLuint endQuery;
+  bool isEnded;
+};
+
+struct Tracer
+{
+  std::atomic<bool> isRecording{false};
+  const std::chrono::steady_clock::time_point origin =
+      std::chrono::steady_clock::now();
+
+  std::mutex tracksMutex;
+  std::vector<std::unique_ptr<ThreadTrack>> tracks;
+
+  // Only accessed by the thread of the GL context. GL timestamps are put on
+  // the CPU clock by a pair of times read at the first GPU zone.
+  bool hasGPUOrigin = false;
+  GLint64 gpuOrigin = 0;
+  int64_t gpuOriginCPUTime = 0;
+  std::deque<PendingGPUZone> pendingGPUZones; // In creation order
+  size_t firstPendingGPUZoneIdx = 0; // Index of pendingGPUZones.front()
+  std::vector<GLuint> freeQueries;
+  std::vector<TraceEvent> gpuEvents;
+};
+
+Tracer &getTracer()
+{
+  static Tracer tracer;
+  return tracer;
+}
+
+int64_t getTraceTime()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - getTracer().origin)
+      .count();
+}
+
+ThreadTrack &getThreadTrack()
+{
+  thread_local ThreadTrack *pTrack = nullptr;
+  if (!pTrack) {
+    auto &tracer = getTracer();
+    std::lock_guard<std::mutex> lock{tracer.tracksMutex};
+    tracer.tracks.emplace_back(std::make_unique<ThreadTrack>());
+    pTrack = tracer.tracks.back().get();
+    pTrack->id = tracer.tracks.size();
+  }
+  return *pTrack;
+}
+
+GLuint getFreeQuery()
+{
+  auto &freeQueries = getTracer().freeQueries;
+  if (freeQueries.empty()) {
+    freeQueries.resize(64);
+    glGenQueries(GLsizei(freeQueries.size()), freeQueries.data());
+  }
+  const auto query = freeQueries.back();
+  freeQueries.pop_back();
+  return query;
+}
+
+void collectGPUTraceZones(bool wait)
+{
+  auto &tracer = getTracer();
+  auto &pendingZones = tracer.pendingGPUZones;
+  while (!pendingZones.empty() && pendingZones.front().isEnded) {
+    const auto &zone = pendingZones.front();
+    GLint isAvailable = GL_FALSE;
+    if (!wait) {
+      glGetQueryObjectiv(
+          zone.endQuery, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+      if (!isAvailable) {
+        break;
+      }
+    }
+    GLint64 start = 0;
+    GLint64 end = 0;
+    glGetQueryObjecti64v(zone.startQuery, GL_QUERY_RESULT, &start);
+    glGetQueryObjecti64v(zone.endQuery, GL_QUERY_RESULT, &end);
+    tracer.gpuEvents.push_back({zone.name,
+        start - tracer.gpuOrigin + tracer.gpuOriginCPUTime, end - start});
+    tracer.freeQueries.push_back(zone.startQuery);
+    tracer.freeQueries.push_back(zone.endQuery);
+    pendingZones.pop_front();
+    ++tracer.firstPendingGPUZoneIdx;
+  }
+}
+
+void writeEvent(std::ostream &out, size_t trackId, const TraceEvent &event)
+{
+  out << ",\n{\"name\":" << nlohmann::json(event.name).dump()
+      << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << trackId
+      << ",\"ts\":" << double(event.start) * 1e-3
+      << ",\"dur\":" << double(event.duration) * 1e-3 << "}";
+}
+
+void writeTrackName(std::ostream &out, size_t trackId, const std::string &name)
+{
+  out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+      << trackId << ",\"args\":{\"name\":" << nlohmann::json(name).dump()
+      << "}}";
+}
+
+} // namespace
+
+void startTracing()
+{
+  getTracer().isRecording = true;
+}
+
+bool isTracing()
+{
+  return getTracer().isRecording;
+}
+
+void setTraceThreadName(const char *name)
+{
+  auto &track = getThreadTrack();
+  std::lock_guard<std::mutex> lock{track.mutex};
+  track.name = name;
+}
+
+TraceZone::TraceZone(const char *name) : m_name(name)
+{
+  if (isTracing()) {
+    m_start = getTraceTime();
+  }
+}
+
+TraceZone::~TraceZone()
+{
+  if (m_start < 0) {
+    return;
+  }
+  const auto end = getTraceTime();
+  auto &track = getThreadTrack();
+  std::lock_guard<std::mutex> lock{track.mutex};
+  track.events.push_back({m_name, m_start, end - m_start});
+}
+
+GPUTraceZone::GPUTraceZone(const char *name) : m_zoneIdx(SIZE_MAX)
+{
+  if (!isTracing()) {
+    return;
+  }
+  auto &tracer = getTracer();
+  if (!tracer.hasGPUOrigin) {
+    glGetInteger64v(GL_TIMESTAMP, &tracer.gpuOrigin);
+    tracer.gpuOriginCPUTime = getTraceTime();
+    tracer.hasGPUOrigin = true;
+  }
+  const auto startQuery = getFreeQuery();
+  glQueryCounter(startQuery, GL_TIMESTAMP);
+  m_zoneIdx =
+      tracer.firstPendingGPUZoneIdx + tracer.pendingGPUZones.size();
+  tracer.pendingGPUZones.push_back({name, startQuery, getFreeQuery(), false});
+}
+
+GPUTraceZone::~GPUTraceZone()
+{
+  if (m_zoneIdx == SIZE_MAX) {
+    return;
+  }
+  auto &tracer = getTracer();
+  auto &zone =
+      tracer.pendingGPUZones[m_zoneIdx - tracer.firstPendingGPUZoneIdx];
+  glQueryCounter(zone.endQuery, GL_TIMESTAMP);
+  zone.isEnded = true;
+}
+
+void collectGPUTraceZones()
+{
+  collectGPUTraceZones(false);
+}
+
+bool writeTrace(const fs::path &path, std::string &err)
+{
+  auto &tracer = getTracer();
+  tracer.isRecording = false;
+  collectGPUTraceZones(true);
+
+  std::ofstream file{path.string()};
+  if (!file) {
+    err = "unable to open " + path.string();
+    return false;
+  }
+  // The first element is the process name, others start with a comma
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+       << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+       << "\"args\":{\"name\":\"gltf-viewer\"}}";
+  if (!tracer.gpuEvents.empty()) {
+    writeTrackName(file, 0, "GPU");
+    for (const auto &event : tracer.gpuEvents) {
+      writeEvent(file, 0, event);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> tracksLock{tracer.tracksMutex};
+    for (const auto &track : tracer.tracks) {
+      std::lock_guard<std::mutex> lock{track->mutex};
+      writeTrackName(file, track->id,
+          track->name.empty() ? "Thread " + std::to_string(track->id)
+                              : track->name);
+      for (const auto &event : track->events) {
+        writeEvent(file, track->id, event);
+      }
+    }
+  }
+  file << "\n]}\n";
+
+  if (!file) {
+    err = "unable to write " + path.string();
+    return false;
+  }
+  return true;
+}
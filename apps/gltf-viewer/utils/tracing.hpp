@@ -0,0 +1,91 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <string>
+
+// Timeline instrumentation of loading and frames, written as a Chrome trace
+// (chrome://tracing or Perfetto) with one track per named thread and one for
+// the GPU.
+//
+// Zones are scopes timed with TRACE_ZONE("name"), on any thread, and with
+// TRACE_GPU_ZONE("name") on the thread of the GL context: its GL_TIMESTAMP
+// queries are read by collectGPUTraceZones() once available, and put on the
+// CPU clock so that GPU zones line up with the CPU zones that issued them.
+// Names must be string literals.
+//
+// The macros compile to nothing unless GLMLV_ENABLE_TRACING is defined (CMake
+// option of the same name). Zones are then only recorded between
+// startTracing() and writeTrace(), at the cost of a clock read and an
+// uncontended lock per zone.
+#ifdef GLMLV_ENABLE_TRACING
+#define GLMLV_TRACE_CONCAT_(a, b) a##b
+#define GLMLV_TRACE_CONCAT(a, b) GLMLV_TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) TraceZone GLMLV_TRACE_CONCAT(zone, __LINE__){name}
+#define TRACE_GPU_ZONE(name)                                                   \
+  GPUTraceZone GLMLV_TRACE_CONCAT(gpuZone, __LINE__){name}
+#define TRACE_THREAD_NAME(name) setTraceThreadName(name)
+#else
+#define TRACE_ZONE(name)
+#define TRACE_GPU_ZONE(name)
+#define TRACE_THREAD_NAME(name)
+#endif
+
+// True if the zones of the macros are compiled
+constexpr bool isTracingCompiled()
+{
+#ifdef GLMLV_ENABLE_TRACING
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Start recording zones
+void startTracing();
+
+bool isTracing();
+
+// Name of the track of the calling thread
+void setTraceThreadName(const char *name);
+
+class TraceZone
+{
+public:
+  explicit TraceZone(const char *name);
+  ~TraceZone();
+
+  TraceZone(const TraceZone &) = delete;
+  TraceZone &operator=(const TraceZone &) = delete;
+
+private:
+  const char *m_name;
+  int64_t m_start = -1; // Nanoseconds, negative if not recording
+};
+
+// Created and destroyed on the thread of the GL context. Timestamps may be
+// nested in other GPU zones and in Profiler scopes, unlike elapsed times.
+class GPUTraceZone
+{
+public:
+  explicit GPUTraceZone(const char *name);
+  ~GPUTraceZone();
+
+  GPUTraceZone(const GPUTraceZone &) = delete;
+  GPUTraceZone &operator=(const GPUTraceZone &) = delete;
+
+private:
+  size_t m_zoneIdx; // In the pending GPU zones, SIZE_MAX if not recording
+};
+
+// Read the GPU zones whose queries are available, without waiting. Called
+// once per frame on the thread of the GL context.
+void collectGPUTraceZones();
+
+// Stop recording, wait for the GPU zones and write every zone in a Chrome
+// trace file. Must be called with the GL context current if GPU zones were
+// recorded.
+bool writeTrace(const fs::path &path, std::string &err);
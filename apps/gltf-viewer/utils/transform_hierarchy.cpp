@@ -0,0 +1,165 @@
+#include "transform_hierarchy.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+// Storage buffer bindings of propagate_transforms.cs.glsl
+const GLuint TRANSFORMS_BINDING = 1;
+const GLuint PARENTS_BINDING = 2;
+const GLuint LOCAL_MATRICES_BINDING = 3;
+const GLuint WORLD_MATRICES_BINDING = 4;
+const GLuint NODES_BINDING = 5;
+
+const GLuint GROUP_SIZE = 64; // local_size_x of propagate_transforms.cs.glsl
+
+size_t getTransformAlignment()
+{
+  GLint alignment = 0;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return std::max(size_t(alignment), sizeof(glm::vec4));
+}
+
+GLuint getGroupCount(size_t count)
+{
+  return GLuint((count + GROUP_SIZE - 1) / GROUP_SIZE);
+}
+
+} // namespace
+
+void GpuTransformHierarchy::build(
+    const SceneHierarchy &hierarchy, const std::vector<uint32_t> &dynamicNodes)
+{
+  clear();
+  const auto nodeCount = hierarchy.size();
+  if (!nodeCount) {
+    return;
+  }
+
+  m_isDynamic.assign(nodeCount, 0);
+  for (const auto idx : dynamicNodes) {
+    m_isDynamic[idx] = 1;
+  }
+  m_isMoving = m_isDynamic;
+  // Parents come first
+  std::vector<GLint> parents(nodeCount);
+  std::vector<glm::mat4> localMatrices(nodeCount);
+  for (size_t idx = 0; idx < nodeCount; ++idx) {
+    parents[idx] = hierarchy.parent(idx);
+    localMatrices[idx] = hierarchy.localMatrix(idx);
+    if (parents[idx] >= 0 && m_isMoving[parents[idx]]) {
+      m_isMoving[idx] = 1;
+    }
+  }
+
+  m_levelOffsets = hierarchy.levelOffsets();
+
+  m_parentBuffer = GLBuffer(parents.size() * sizeof(GLint), parents.data(), 0);
+  m_localMatrixBuffer = GLBuffer(
+      localMatrices.size() * sizeof(glm::mat4), localMatrices.data(), 0);
+  m_worldMatrixBuffer = GLBuffer(nodeCount * sizeof(glm::mat4),
+      hierarchy.worldMatrices().data(), 0);
+}
+
+void GpuTransformHierarchy::clear()
+{
+  m_isDynamic.clear();
+  m_isMoving.clear();
+  m_levelOffsets.clear();
+  m_transforms.clear();
+  m_updatedNodes.clear();
+  m_parentBuffer = GLBuffer();
+  m_localMatrixBuffer = GLBuffer();
+  m_worldMatrixBuffer = GLBuffer();
+}
+
+void GpuTransformHierarchy::update(
+    const SceneHierarchy &hierarchy, const GLProgram &program)
+{
+  TRACE_ZONE("Propagate transforms");
+  m_transforms.clear();
+  m_updatedNodes.clear();
+  if (empty()) {
+    return;
+  }
+
+  // The other nodes keep their local matrices on the GPU
+  for (const auto idx : hierarchy.changedNodes()) {
+    if (idx >= m_isDynamic.size() || !m_isDynamic[idx] ||
+        hierarchy.hasLocalMatrix(idx)) {
+      continue;
+    }
+    const auto &rotation = hierarchy.rotation(idx);
+    m_transforms.push_back({hierarchy.translation(idx), GLuint(idx),
+        glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w),
+        hierarchy.scale(idx), 0.f});
+  }
+  // Nodes below the dynamic ones are the only ones moving on the GPU
+  for (const auto idx : hierarchy.updatedNodes()) {
+    if (idx < m_isMoving.size() && m_isMoving[idx]) {
+      m_updatedNodes.push_back(idx);
+    }
+  }
+  if (m_updatedNodes.empty()) {
+    return;
+  }
+
+  program.use();
+  const auto pass = program.getUniform<GLuint>("uPass");
+  const auto firstNode = program.getUniform<GLuint>("uFirstNode");
+  const auto nodeCount = program.getUniform<GLuint>("uNodeCount");
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, PARENTS_BINDING, m_parentBuffer.glId());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LOCAL_MATRICES_BINDING,
+      m_localMatrixBuffer.glId());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WORLD_MATRICES_BINDING,
+      m_worldMatrixBuffer.glId());
+
+  // The region is fenced after the dispatches reading it
+  m_transformData.beginFrame();
+  if (!m_transforms.empty()) {
+    const auto size = m_transforms.size() * sizeof(NodeTransform);
+    const auto allocation = m_transformData.upload(
+        m_transforms.data(), size, getTransformAlignment());
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, TRANSFORMS_BINDING,
+        allocation.buffer, GLintptr(allocation.offset), GLsizeiptr(size));
+    pass.set(0);
+    nodeCount.set(GLuint(m_transforms.size()));
+    glDispatchCompute(getGroupCount(m_transforms.size()), 1, 1);
+  }
+
+  // Updated nodes are sorted, so those of a level are a contiguous range of
+  // the list
+  const auto size = m_updatedNodes.size() * sizeof(uint32_t);
+  const auto allocation = m_transformData.upload(
+      m_updatedNodes.data(), size, getTransformAlignment());
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, NODES_BINDING,
+      allocation.buffer, GLintptr(allocation.offset), GLsizeiptr(size));
+  pass.set(1);
+  size_t first = 0;
+  for (size_t level = 0;
+       level + 1 < m_levelOffsets.size() && first < m_updatedNodes.size();
+       ++level) {
+    const auto levelEnd = std::lower_bound(begin(m_updatedNodes) + first,
+        end(m_updatedNodes), m_levelOffsets[level + 1]);
+    const auto last = size_t(levelEnd - begin(m_updatedNodes));
+    if (last == first) {
+      continue;
+    }
+    // Each level reads the matrices written by the previous dispatch
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    firstNode.set(GLuint(first));
+    nodeCount.set(GLuint(last - first));
+    glDispatchCompute(getGroupCount(last - first), 1, 1);
+    first = last;
+  }
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  m_transformData.endFrame();
+
+  for (GLuint binding = TRANSFORMS_BINDING; binding <= NODES_BINDING;
+       ++binding) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+  }
+}
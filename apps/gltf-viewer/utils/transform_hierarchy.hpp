@@ -0,0 +1,84 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "ring_buffer.hpp"
+#include "scene_hierarchy.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// World matrices of a SceneHierarchy computed on the GPU, for the draws of
+// an IndirectDrawList that follow animated nodes (see
+// IndirectDrawList::updateTransforms).
+//
+// The local matrix of every node is uploaded once. Each update() uploads
+// only the translation, rotation and scale of the dynamic nodes set since
+// the previous one (see SceneHierarchy::changedNodes), 48 bytes per node,
+// which a first dispatch of propagate_transforms.cs.glsl turns into their
+// local matrices. Nodes are in breadth first order, so a depth level is a
+// contiguous range whose parents are all in the previous level: one dispatch
+// per level computes the world matrices of its nodes that the CPU hierarchy
+// recomputed (see SceneHierarchy::updatedNodes) from those of their
+// parents, listed in 4 bytes per node. What is uploaded and computed is
+// proportional to what moved, not to the size of the scene.
+class GpuTransformHierarchy
+{
+public:
+  // Local transform of a dynamic node, matches NodeTransform in
+  // propagate_transforms.cs.glsl
+  struct NodeTransform
+  {
+    glm::vec3 translation;
+    GLuint node; // Flat index
+    glm::vec4 rotation; // Quaternion as x, y, z, w
+    glm::vec3 scale;
+    float padding;
+  };
+
+  // Upload hierarchy with its local and world matrices of the last
+  // SceneHierarchy::update(). dynamicNodes are the flat indices of the nodes
+  // whose translation, rotation or scale change (see
+  // SceneAnimations::animatedNodes).
+  void build(const SceneHierarchy &hierarchy,
+      const std::vector<uint32_t> &dynamicNodes);
+
+  void clear();
+
+  bool empty() const { return m_levelOffsets.empty(); }
+
+  // True if node idx or one of its ancestors is dynamic
+  bool isMoving(size_t idx) const { return m_isMoving[idx] != 0; }
+
+  // Upload the local transforms of the dynamic nodes changed by the last
+  // update of hierarchy and recompute the world matrices below them. program is
+  // propagate_transforms.cs.glsl. Nodes defined by a matrix in the glTF file
+  // keep it until their TRS is set (see SceneHierarchy::hasLocalMatrix).
+  // This binds program.
+  void update(const SceneHierarchy &hierarchy, const GLProgram &program);
+
+  // One mat4 per node, in flat index order
+  GLuint worldMatrixBuffer() const { return m_worldMatrixBuffer.glId(); }
+
+  // Flat indices of the nodes whose world matrix the last update()
+  // recomputed, in increasing order
+  const std::vector<uint32_t> &updatedNodes() const { return m_updatedNodes; }
+
+private:
+  std::vector<uint8_t> m_isDynamic; // Per node
+  std::vector<uint8_t> m_isMoving; // Per node
+  std::vector<size_t> m_levelOffsets; // See SceneHierarchy::levelOffsets
+  // Filled by update()
+  std::vector<NodeTransform> m_transforms;
+  std::vector<uint32_t> m_updatedNodes;
+
+  GLBuffer m_parentBuffer; // One GLint per node, -1 for roots
+  GLBuffer m_localMatrixBuffer;
+  GLBuffer m_worldMatrixBuffer;
+  // NodeTransform of the changed dynamic nodes, then the updated nodes
+  RingBuffer m_transformData;
+};
@@ -0,0 +1,80 @@
+#include "transform_kernels.hpp"
+#include "float4.hpp"
+
+namespace
+{
+
+using namespace simd;
+
+// Columns of a matrix, glm is column major
+struct Columns
+{
+  Float4 c[4];
+};
+
+Columns loadColumns(const glm::mat4 &matrix)
+{
+  return {{load(&matrix[0][0]), load(&matrix[1][0]), load(&matrix[2][0]),
+      load(&matrix[3][0])}};
+}
+
+// lhs * (x, y, z, w)
+Float4 transform(const Columns &lhs, float x, float y, float z, float w)
+{
+  return lhs.c[0] * set1(x) + lhs.c[1] * set1(y) + lhs.c[2] * set1(z) +
+         lhs.c[3] * set1(w);
+}
+
+void multiply(const Columns &lhs, const glm::mat4 &rhs, glm::mat4 &out)
+{
+  // Computed before storing, out may be rhs
+  Float4 result[4];
+  for (int col = 0; col < 4; ++col) {
+    result[col] =
+        transform(lhs, rhs[col][0], rhs[col][1], rhs[col][2], rhs[col][3]);
+  }
+  for (int col = 0; col < 4; ++col) {
+    store(&out[col][0], result[col]);
+  }
+}
+
+} // namespace
+
+void multiplyMatrices(const glm::mat4 &lhs, const glm::mat4 *rhs, size_t count,
+    glm::mat4 *out)
+{
+  const auto columns = loadColumns(lhs);
+  for (size_t i = 0; i < count; ++i) {
+    multiply(columns, rhs[i], out[i]);
+  }
+}
+
+void multiplyMatrices(const glm::mat4 *lhs, const glm::mat4 *rhs, size_t count,
+    glm::mat4 *out)
+{
+  for (size_t i = 0; i < count; ++i) {
+    multiply(loadColumns(lhs[i]), rhs[i], out[i]);
+  }
+}
+
+void transformBoxes(const glm::mat4 &matrix, const glm::vec3 *localMins,
+    const glm::vec3 *localMaxs, size_t count, glm::vec3 *worldMins,
+    glm::vec3 *worldMaxs)
+{
+  const auto columns = loadColumns(matrix);
+  const Columns absColumns = {
+      {abs(columns.c[0]), abs(columns.c[1]), abs(columns.c[2]), set1(0.f)}};
+  for (size_t i = 0; i < count; ++i) {
+    const auto center = 0.5f * (localMins[i] + localMaxs[i]);
+    const auto extent = 0.5f * (localMaxs[i] - localMins[i]);
+    const auto worldCenter =
+        transform(columns, center.x, center.y, center.z, 1.f);
+    const auto worldExtent =
+        transform(absColumns, extent.x, extent.y, extent.z, 0.f);
+    float worldMin[4], worldMax[4];
+    store(worldMin, worldCenter - worldExtent);
+    store(worldMax, worldCenter + worldExtent);
+    worldMins[i] = glm::vec3(worldMin[0], worldMin[1], worldMin[2]);
+    worldMaxs[i] = glm::vec3(worldMax[0], worldMax[1], worldMax[2]);
+  }
+}
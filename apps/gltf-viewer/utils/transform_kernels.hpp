@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Batched kernels of the transform paths run every frame (hierarchy updates,
+// culling bounds), vectorized with SSE2 or NEON when available (see
+// float4.hpp): each column of a matrix is a 4 wide vector, so that a matrix
+// product or a box transform is a few multiply-adds instead of the scalar
+// loops glm compiles its packed types to. Arrays are read and written with
+// unaligned accesses, glm::mat4 arrays need no particular alignment.
+
+// out[i] = lhs * rhs[i] for i in [0, count), e.g. the world matrices of the
+// children of a node from its world matrix and their local matrices. out may
+// be rhs.
+void multiplyMatrices(const glm::mat4 &lhs, const glm::mat4 *rhs, size_t count,
+    glm::mat4 *out);
+
+// out[i] = lhs[i] * rhs[i] for i in [0, count). out may be lhs or rhs.
+void multiplyMatrices(const glm::mat4 *lhs, const glm::mat4 *rhs, size_t count,
+    glm::mat4 *out);
+
+// Axis aligned box [worldMins[i], worldMaxs[i]] enclosing the local box
+// [localMins[i], localMaxs[i]] transformed by matrix, for i in [0, count).
+// Same box as extendBoundsWithBox from an empty box (see bounds.hpp), up to
+// rounding, from the transformed center and the extents transformed by the
+// absolute matrix rather than from the 8 corners. The boxes of empty local
+// boxes are meaningless.
+void transformBoxes(const glm::mat4 &matrix, const glm::vec3 *localMins,
+    const glm::vec3 *localMaxs, size_t count, glm::vec3 *worldMins,
+    glm::vec3 *worldMaxs);
@@ -0,0 +1,182 @@
+#include "transparency.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+
+// Header of the TransparencyNodes buffer of transparency.glsl: the node
+// count padded to a node
+const size_t NODES_HEADER_SIZE = 4 * sizeof(GLuint);
+const size_t NODE_SIZE = 4 * sizeof(GLuint);
+
+} // namespace
+
+void TransparencyBuffer::bindOpaquePass(RingBuffer &ring)
+{
+  m_uniforms.reset(sizeof(Uniforms), 1);
+  m_uniforms.block<Uniforms>(0) = {glm::uvec4(0), glm::ivec4(0)};
+  m_uniforms.upload(ring);
+  m_uniforms.bind(UNIFORMS_BINDING, 0);
+}
+
+void TransparencyBuffer::begin(OitMode mode, bool reversedZ, RingBuffer &ring)
+{
+  assert(mode != OitMode::None);
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_drawFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, m_viewport);
+  const auto width = size_t(std::max(m_viewport[2], 1));
+  const auto height = size_t(std::max(m_viewport[3], 1));
+  const auto depthFormat =
+      GLFramebuffer::getDrawDepthFormat(GLuint(m_drawFramebuffer));
+  if (width != m_nWidth || height != m_nHeight ||
+      depthFormat != m_depthFormat || mode != m_mode) {
+    allocate(width, height, depthFormat, mode);
+  }
+
+  // Also resolves multisampled depth buffers
+  const auto x0 = m_viewport[0];
+  const auto y0 = m_viewport[1];
+  GLFramebuffer::blit(GLuint(m_drawFramebuffer), m_framebuffer.glId(), x0,
+      y0, x0 + GLint(width), y0 + GLint(height), 0, 0, GLint(width),
+      GLint(height), GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer.glId());
+  glViewport(0, 0, GLsizei(width), GLsizei(height));
+  glDepthMask(GL_FALSE);
+
+  const auto nodeCapacity = width * height * NODES_PER_PIXEL;
+  m_uniforms.reset(sizeof(Uniforms), 1);
+  m_uniforms.block<Uniforms>(0) = {
+      glm::uvec4(GLuint(mode), GLuint(nodeCapacity), GLuint(width),
+          reversedZ ? 1 : 0),
+      glm::ivec4(x0, y0, 0, 0)};
+  m_uniforms.upload(ring);
+  m_uniforms.bind(UNIFORMS_BINDING, 0);
+
+  if (mode == OitMode::WeightedBlended) {
+    // Accumulated colors add up, revealages multiply
+    const GLfloat zero[4] = {};
+    const GLfloat one[4] = {1.f, 1.f, 1.f, 1.f};
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glClearBufferfv(GL_COLOR, 1, one);
+    glEnable(GL_BLEND);
+    glBlendFunci(0, GL_ONE, GL_ONE);
+    glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+    return;
+  }
+
+  const GLuint empty = ~GLuint(0);
+  const GLuint zero = 0;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_heads.glId());
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+      GL_UNSIGNED_INT, &empty);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_nodes.glId());
+  glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(GLuint),
+      GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HEADS_BINDING, m_heads.glId());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_BINDING, m_nodes.glId());
+}
+
+void TransparencyBuffer::resolve(const GLProgram &resolveProgram)
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(m_drawFramebuffer));
+  glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+  if (m_mode == OitMode::WeightedBlended) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_accumulation.glId());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_revealage.glId());
+  } else {
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, m_depth.glId());
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  // Over the opaque draws, whatever their depth. Only the color of the first
+  // draw buffer is composited, others (e.g. the motion vectors of
+  // TemporalAntiAliasing) are kept.
+  GLint maxDrawBuffers = 0;
+  glGetIntegerv(GL_MAX_DRAW_BUFFERS, &maxDrawBuffers);
+  for (GLuint i = 1; i < GLuint(maxDrawBuffers); ++i) {
+    glColorMaski(i, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  }
+  GLboolean isDepthTested = GL_FALSE;
+  glGetBooleanv(GL_DEPTH_TEST, &isDepthTested);
+  glDisable(GL_DEPTH_TEST);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+  resolveProgram.use();
+  m_emptyVertexArray.bind();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDisable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ZERO);
+  if (isDepthTested) {
+    glEnable(GL_DEPTH_TEST);
+  }
+  glDepthMask(GL_TRUE);
+
+  for (GLuint unit = 0; unit < 3; ++unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HEADS_BINDING, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_BINDING, 0);
+}
+
+void TransparencyBuffer::allocate(
+    size_t width, size_t height, GLenum depthFormat, OitMode mode)
+{
+  m_nWidth = width;
+  m_nHeight = height;
+  m_depthFormat = depthFormat;
+  m_mode = mode;
+  const auto w = GLsizei(width);
+  const auto h = GLsizei(height);
+  m_depth = GLTexture(1, depthFormat, w, h);
+  // Only read with texelFetch
+  m_depth.setParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  m_depth.setParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  const auto depthAttachment =
+      depthFormat == GL_DEPTH24_STENCIL8 || depthFormat == GL_DEPTH32F_STENCIL8
+          ? GL_DEPTH_STENCIL_ATTACHMENT
+          : GL_DEPTH_ATTACHMENT;
+  m_framebuffer = GLFramebuffer::create();
+  m_framebuffer.attachTexture(depthAttachment, m_depth.glId());
+
+  // Each mode only allocates its own storage
+  m_accumulation = GLTexture();
+  m_revealage = GLTexture();
+  m_heads = GLBuffer();
+  m_nodes = GLBuffer();
+  if (mode == OitMode::WeightedBlended) {
+    m_accumulation = GLTexture(1, GL_RGBA16F, w, h);
+    m_revealage = GLTexture(1, GL_R16F, w, h);
+    for (const auto *texture : {&m_accumulation, &m_revealage}) {
+      texture->setParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      texture->setParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    m_framebuffer.attachTexture(GL_COLOR_ATTACHMENT0, m_accumulation.glId());
+    m_framebuffer.attachTexture(GL_COLOR_ATTACHMENT1, m_revealage.glId());
+    const GLenum drawBuffers[] = {
+        GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    m_framebuffer.setDrawBuffers(2, drawBuffers);
+  } else {
+    // Fragments are only written to the lists
+    m_framebuffer.setDrawBuffer(GL_NONE);
+    const auto pixelCount = width * height;
+    m_heads = GLBuffer(pixelCount * sizeof(GLuint), nullptr, 0);
+    m_nodes = GLBuffer(
+        NODES_HEADER_SIZE + pixelCount * NODES_PER_PIXEL * NODE_SIZE,
+        nullptr, 0);
+  }
+  assert(m_framebuffer.status() == GL_FRAMEBUFFER_COMPLETE);
+  if (!m_emptyVertexArray.glId()) {
+    m_emptyVertexArray = GLVertexArray::create();
+  }
+}
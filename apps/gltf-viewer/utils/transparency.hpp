@@ -0,0 +1,110 @@
+#pragma once
+
+#include "gl_objects.hpp"
+#include "ring_buffer.hpp"
+#include "shaders.hpp"
+#include "uniform_buffer.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// How the draws of BLEND materials are blended
+enum class OitMode
+{
+  // Drawn unblended with the opaque draws
+  None,
+  // Weighted blended order-independent transparency: approximate, at a
+  // constant cost per fragment
+  WeightedBlended,
+  // Per-pixel linked lists of fragments sorted by the resolve pass: exact
+  // up to their capacity
+  LinkedList
+};
+
+// Order-independent transparency (OIT): the transparent draws of a frame are
+// drawn after the opaque ones, in any order, by scene programs compiled with
+// OIT (see transparency.glsl). A single resolve pass
+// (transparency_resolve.fs.glsl) then composites them over the opaque draws,
+// so they need no depth sort.
+//
+// - WeightedBlended: premultiplied colors and coverages are accumulated with
+// weights decreasing with depth in GL_RGBA16F and GL_R16F attachments.
+// - LinkedList: fragments are appended to per-pixel lists in shader storage
+// buffers, holding NODES_PER_PIXEL fragments per pixel on average (the
+// fragments beyond are dropped). The resolve pass sorts the nearest ones.
+//
+// The depth of the opaque draws is copied from the caller's framebuffer, so
+// that transparent fragments are tested against it without writing it.
+class TransparencyBuffer
+{
+public:
+  static const GLuint UNIFORMS_BINDING = 5; // TransparencyUniforms block
+  // After ClusterLights
+  static const GLuint HEADS_BINDING = 17;
+  static const GLuint NODES_BINDING = 18;
+  static const size_t NODES_PER_PIXEL = 4;
+
+  // TransparencyUniforms block of transparency.glsl, std140 layout
+  struct Uniforms
+  {
+    // x: OitMode of the transparent pass, 0 during the opaque one, y: node
+    // capacity, z: width of the heads, w: 1 with reversed depths
+    glm::uvec4 info;
+    glm::ivec4 viewport; // Origin of the viewport of the caller
+  };
+
+  TransparencyBuffer() = default;
+
+  // Non-copyable class:
+  TransparencyBuffer(const TransparencyBuffer &) = delete;
+  TransparencyBuffer &operator=(const TransparencyBuffer &) = delete;
+
+  TransparencyBuffer(TransparencyBuffer &&) = default;
+  TransparencyBuffer &operator=(TransparencyBuffer &&) = default;
+
+  // Upload the uniforms of the opaque pass to the current region of ring
+  // and bind them
+  void bindOpaquePass(RingBuffer &ring);
+
+  // Start the transparent pass of mode (not OitMode::None): remember the
+  // draw framebuffer and the viewport, copy the depth of the draw
+  // framebuffer in the viewport, then bind a framebuffer sized as the
+  // viewport with that depth and clear it. The viewport moves to its origin.
+  // Depth writes are disabled and blending is set up for mode. The uniforms
+  // of the pass are uploaded to the current region of ring. reversedZ is
+  // true if nearer depths are greater.
+  void begin(OitMode mode, bool reversedZ, RingBuffer &ring);
+
+  // Composite the transparent fragments over the framebuffer bound before
+  // begin(), which is bound again with its viewport, with resolveProgram
+  // (transparency_resolve compiled for the mode). Depth writes and blending
+  // are restored, the program and the texture bindings of units 0 to 2 are
+  // not.
+  void resolve(const GLProgram &resolveProgram);
+
+private:
+  // Create the depth copy of a width x height viewport whose depth buffer
+  // has depthFormat, and the attachments or lists of mode
+  void allocate(
+      size_t width, size_t height, GLenum depthFormat, OitMode mode);
+
+  size_t m_nWidth = 0;
+  size_t m_nHeight = 0;
+  GLenum m_depthFormat = 0;
+  OitMode m_mode = OitMode::None; // Of the allocated storage
+
+  // Saved by begin()
+  GLint m_drawFramebuffer = 0;
+  GLint m_viewport[4] = {};
+
+  GLTexture m_accumulation;
+  GLTexture m_revealage;
+  GLTexture m_depth; // Same format as the copied depth buffer
+  GLFramebuffer m_framebuffer;
+  GLBuffer m_heads;
+  GLBuffer m_nodes;
+  UniformBuffer m_uniforms;
+  GLVertexArray m_emptyVertexArray; // Of the resolve triangle
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Single producer, single consumer handoff of the latest value of T, without
+// locks: the producer fills writeSlot() then publish()es it, the consumer
+// acquire()s the last published value and reads it in readSlot(). Neither
+// side ever waits for the other, the producer may publish several values
+// between two acquisitions (the intermediate ones are dropped).
+//
+// The three slots are owned in turn by the producer (back), the consumer
+// (front) and the handoff (middle). publish() swaps back and middle,
+// acquire() swaps front and middle if the middle slot was published since
+// the last acquisition. Slots are reused, so their allocations are kept
+// from one value to the next.
+template <typename T> class TripleBuffer
+{
+public:
+  TripleBuffer() = default;
+
+  TripleBuffer(const TripleBuffer &) = delete;
+  TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+  // Slot of the next value, owned by the producer until publish()
+  T &writeSlot() { return m_slots[m_nBack]; }
+
+  // Hand writeSlot() to the consumer, the producer gets another slot
+  void publish()
+  {
+    const auto middle = m_middle.exchange(
+        uint8_t(m_nBack | FRESH_BIT), std::memory_order_acq_rel);
+    m_nBack = uint8_t(middle & INDEX_MASK);
+  }
+
+  // Take the last published value if there is a new one since the last call
+  // and return true, readSlot() then returns it
+  bool acquire()
+  {
+    if (!(m_middle.load(std::memory_order_relaxed) & FRESH_BIT)) {
+      return false;
+    }
+    const auto middle = m_middle.exchange(m_nFront, std::memory_order_acq_rel);
+    m_nFront = uint8_t(middle & INDEX_MASK);
+    return true;
+  }
+
+  // Last acquired value, owned by the consumer
+  const T &readSlot() const { return m_slots[m_nFront]; }
+
+private:
+  static const uint8_t INDEX_MASK = 3;
+  // Set in m_middle when its slot was published and not acquired yet
+  static const uint8_t FRESH_BIT = 4;
+
+  T m_slots[3];
+  uint8_t m_nBack = 0; // Producer only
+  std::atomic<uint8_t> m_middle{1};
+  uint8_t m_nFront = 2; // Consumer only
+};
@@ -0,0 +1,28 @@
+#include "uniform_buffer.hpp"
+
+void UniformBuffer::reset(size_t blockSize, size_t count)
+{
+  GLint alignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  m_nAlignment = alignment > 0 ? size_t(alignment) : size_t(256);
+
+  m_nBlockSize = blockSize;
+  m_nStride = (blockSize + m_nAlignment - 1) / m_nAlignment * m_nAlignment;
+  m_nBlocks = count;
+  // Keeps its capacity from one frame to the next
+  m_data.resize(m_nStride * count);
+}
+
+void UniformBuffer::upload(RingBuffer &ring)
+{
+  const auto allocation =
+      ring.upload(m_data.data(), m_data.size(), m_nAlignment);
+  m_buffer = allocation.buffer;
+  m_nOffset = allocation.offset;
+}
+
+void UniformBuffer::bind(GLuint binding, size_t index) const
+{
+  glBindBufferRange(GL_UNIFORM_BUFFER, binding, m_buffer,
+      GLintptr(m_nOffset + index * m_nStride), GLsizeiptr(m_nBlockSize));
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ring_buffer.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+// Array of uniform blocks sharing the same std140 layout, filled on the CPU
+// then uploaded with a single call.
+//
+// Each block starts at a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT so
+// that it can be bound alone with glBindBufferRange: a draw then only costs
+// one bind instead of one glUniform* call per uniform.
+//
+// The blocks are copied to a RingBuffer region, so that the upload never
+// waits for draws reading the blocks of previous frames.
+class UniformBuffer
+{
+public:
+  // Discard the blocks and make room for count blocks of blockSize bytes
+  void reset(size_t blockSize, size_t count);
+
+  size_t blockCount() const { return m_nBlocks; }
+
+  // CPU copy of the block index, valid until the next reset(). T must match
+  // the std140 layout of the block.
+  template <typename T> T &block(size_t index)
+  {
+    return *reinterpret_cast<T *>(m_data.data() + index * m_nStride);
+  }
+
+  // Copy the blocks to the current frame region of ring, they can be bound
+  // until the frame ends
+  void upload(RingBuffer &ring);
+
+  // Bind the block index to the uniform block binding point
+  void bind(GLuint binding, size_t index) const;
+
+private:
+  std::vector<unsigned char> m_data;
+  size_t m_nBlockSize = 0;
+  size_t m_nStride = 0; // Block size rounded up to the offset alignment
+  size_t m_nBlocks = 0;
+  size_t m_nAlignment = 256; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+  // Location of the last upload()
+  GLuint m_buffer = 0;
+  size_t m_nOffset = 0;
+};
@@ -0,0 +1,396 @@
+#include "vertex_animations.hpp"
+#include "mapped_file.hpp"
+#include "tracing.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+
+const char VERTEX_ANIMATION_MAGIC[8] = {'G', 'L', 'T', 'F', 'V', 'A', 'N', 'I'};
+// Increment each time the layout of the file or the baking changes
+const uint32_t VERTEX_ANIMATION_VERSION = 1;
+
+struct Header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint64_t sourceKey;
+  uint64_t clipCount; // Followed by clipCount CachedClip
+  uint64_t wordCount; // Then the words of the frames
+};
+
+struct CachedClip
+{
+  uint32_t mesh;
+  uint32_t primitive;
+  uint32_t animation;
+  uint32_t vertexCount;
+  uint32_t frameCount;
+  float duration;
+  float boundsMin[3];
+  float boundsMax[3];
+  uint64_t offset;
+};
+
+uint32_t quantizeUnorm16(float value)
+{
+  return uint32_t(std::round(glm::clamp(value, 0.f, 1.f) * 65535.f));
+}
+
+uint32_t quantizeSnorm16(float value)
+{
+  return uint32_t(uint16_t(
+      int16_t(std::round(glm::clamp(value, -1.f, 1.f) * 32767.f))));
+}
+
+// Same as in GeometryArena
+glm::vec2 encodeOctahedral(const glm::vec3 &normal)
+{
+  const auto l1Norm =
+      std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  if (l1Norm == 0.f) {
+    return glm::vec2(0);
+  }
+  auto p = glm::vec2(normal) / l1Norm;
+  if (normal.z < 0.f) {
+    p = (1.f - glm::abs(glm::vec2(p.y, p.x))) *
+        glm::vec2(p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f);
+  }
+  return p;
+}
+
+} // namespace
+
+void VertexAnimations::addClip(Clip clip, const std::vector<float> &positions,
+    const std::vector<float> &normals)
+{
+  const auto vertexCount = size_t(clip.frameCount) * clip.vertexCount;
+  clip.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+  clip.boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+  for (size_t v = 0; v < vertexCount; ++v) {
+    const auto p = glm::make_vec3(positions.data() + 3 * v);
+    clip.boundsMin = glm::min(clip.boundsMin, p);
+    clip.boundsMax = glm::max(clip.boundsMax, p);
+  }
+  if (!vertexCount) {
+    clip.boundsMin = clip.boundsMax = glm::vec3(0);
+  }
+  // Flat dimensions keep a unit scale, as in the arena
+  auto scale = clip.boundsMax - clip.boundsMin;
+  for (glm::length_t c = 0; c < 3; ++c) {
+    if (scale[c] <= 0.f) {
+      scale[c] = 1.f;
+    }
+  }
+
+  clip.offset = m_data.size();
+  m_data.resize(m_data.size() + vertexCount * WORDS_PER_VERTEX);
+  auto *words = m_data.data() + clip.offset;
+  for (size_t v = 0; v < vertexCount; ++v, words += WORDS_PER_VERTEX) {
+    const auto p =
+        (glm::make_vec3(positions.data() + 3 * v) - clip.boundsMin) / scale;
+    const auto n = encodeOctahedral(glm::make_vec3(normals.data() + 3 * v));
+    words[0] = quantizeUnorm16(p.x) | quantizeUnorm16(p.y) << 16;
+    words[1] = quantizeUnorm16(p.z);
+    words[2] = quantizeSnorm16(n.x) | quantizeSnorm16(n.y) << 16;
+  }
+  m_clips.push_back(clip);
+}
+
+bool VertexAnimations::read(
+    const fs::path &path, uint64_t sourceKey, std::string &err)
+{
+  TRACE_ZONE("Read vertex animations");
+  std::error_code errorCode;
+  if (!fs::exists(path, errorCode)) {
+    return false;
+  }
+  MappedFile file;
+  try {
+    file = MappedFile{path};
+  } catch (const std::runtime_error &e) {
+    err = e.what();
+    return false;
+  }
+  if (file.size() < sizeof(Header)) {
+    err = "Invalid vertex animations " + path.string();
+    return false;
+  }
+  const auto &header = *reinterpret_cast<const Header *>(file.data());
+  if (std::memcmp(header.magic, VERTEX_ANIMATION_MAGIC,
+          sizeof(header.magic)) != 0 ||
+      header.version != VERTEX_ANIMATION_VERSION ||
+      header.headerSize != sizeof(Header) || header.sourceKey != sourceKey) {
+    return false;
+  }
+  const auto maxCount = file.size() / sizeof(uint32_t);
+  if (header.clipCount > maxCount || header.wordCount > maxCount ||
+      file.size() != sizeof(Header) +
+                         header.clipCount * sizeof(CachedClip) +
+                         header.wordCount * sizeof(uint32_t)) {
+    err = "Invalid vertex animations " + path.string();
+    return false;
+  }
+
+  const auto cached =
+      reinterpret_cast<const CachedClip *>(file.data() + sizeof(Header));
+  std::vector<Clip> clips(header.clipCount);
+  for (size_t i = 0; i < clips.size(); ++i) {
+    const auto &c = cached[i];
+    const auto wordCount =
+        uint64_t(c.frameCount) * c.vertexCount * WORDS_PER_VERTEX;
+    if (c.offset > header.wordCount ||
+        wordCount > header.wordCount - c.offset) {
+      err = "Invalid vertex animations " + path.string();
+      return false;
+    }
+    clips[i] = {c.mesh, c.primitive, c.animation, c.vertexCount,
+        c.frameCount, c.duration, glm::make_vec3(c.boundsMin),
+        glm::make_vec3(c.boundsMax), c.offset};
+  }
+  const auto words = reinterpret_cast<const uint32_t *>(
+      file.data() + sizeof(Header) + clips.size() * sizeof(CachedClip));
+  *this = VertexAnimations();
+  m_clips = std::move(clips);
+  m_data.assign(words, words + header.wordCount);
+  return true;
+}
+
+bool VertexAnimations::write(
+    const fs::path &path, uint64_t sourceKey, std::string &err) const
+{
+  TRACE_ZONE("Write vertex animations");
+  Header header{};
+  std::memcpy(header.magic, VERTEX_ANIMATION_MAGIC, sizeof(header.magic));
+  header.version = VERTEX_ANIMATION_VERSION;
+  header.headerSize = sizeof(Header);
+  header.sourceKey = sourceKey;
+  header.clipCount = m_clips.size();
+  header.wordCount = m_data.size();
+  std::vector<CachedClip> cached(m_clips.size());
+  for (size_t i = 0; i < m_clips.size(); ++i) {
+    const auto &clip = m_clips[i];
+    auto &c = cached[i];
+    c.mesh = clip.mesh;
+    c.primitive = clip.primitive;
+    c.animation = clip.animation;
+    c.vertexCount = clip.vertexCount;
+    c.frameCount = clip.frameCount;
+    c.duration = clip.duration;
+    std::memcpy(c.boundsMin, glm::value_ptr(clip.boundsMin),
+        sizeof(c.boundsMin));
+    std::memcpy(c.boundsMax, glm::value_ptr(clip.boundsMax),
+        sizeof(c.boundsMax));
+    c.offset = clip.offset;
+  }
+
+  std::error_code errorCode;
+  if (path.has_parent_path()) {
+    fs::create_directories(path.parent_path(), errorCode);
+  }
+  auto tmpPath = path;
+  tmpPath += ".tmp";
+  {
+    std::ofstream out(tmpPath.string(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+      err = "Unable to open " + tmpPath.string() + " for writing";
+      return false;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(cached.data()),
+        std::streamsize(cached.size() * sizeof(CachedClip)));
+    out.write(reinterpret_cast<const char *>(m_data.data()),
+        std::streamsize(m_data.size() * sizeof(uint32_t)));
+    if (!out) {
+      err = "Unable to write " + tmpPath.string();
+      return false;
+    }
+  }
+  fs::rename(tmpPath, path, errorCode);
+  if (errorCode) {
+    err = "Unable to rename " + tmpPath.string() + ": " + errorCode.message();
+    fs::remove(tmpPath, errorCode);
+    return false;
+  }
+  return true;
+}
+
+size_t VertexAnimations::allocate(const std::vector<ArenaPrimitive> &primitives,
+    const std::vector<size_t> &meshToPrimitives)
+{
+  m_primitiveClips.clear();
+  m_buffer = GLBuffer();
+  uint64_t wordCount = 0;
+  for (size_t clipIdx = 0; clipIdx < m_clips.size(); ++clipIdx) {
+    const auto &clip = m_clips[clipIdx];
+    if (clip.mesh >= meshToPrimitives.size()) {
+      continue;
+    }
+    // Primitives of a mesh are contiguous in the arena
+    const auto primitiveIdx = meshToPrimitives[clip.mesh] + clip.primitive;
+    const auto endIdx = clip.mesh + 1 < meshToPrimitives.size()
+                            ? meshToPrimitives[clip.mesh + 1]
+                            : primitives.size();
+    if (primitiveIdx >= endIdx ||
+        primitives[primitiveIdx].vertexCount != clip.vertexCount ||
+        !clip.frameCount) {
+      continue;
+    }
+    m_primitiveClips.push_back(
+        {uint32_t(primitiveIdx), uint32_t(clipIdx), wordCount});
+    wordCount += uint64_t(clip.frameCount) * clip.vertexCount *
+                 WORDS_PER_VERTEX;
+  }
+  std::sort(begin(m_primitiveClips), end(m_primitiveClips),
+      [&](const PrimitiveClip &lhs, const PrimitiveClip &rhs) {
+        return std::make_pair(lhs.primitive, m_clips[lhs.clip].animation) <
+               std::make_pair(rhs.primitive, m_clips[rhs.clip].animation);
+      });
+  if (!m_primitiveClips.empty()) {
+    m_buffer = GLBuffer(wordCount * sizeof(uint32_t), nullptr,
+        GL_DYNAMIC_STORAGE_BIT, GLMemoryCategory::Geometry);
+  }
+  return m_primitiveClips.size();
+}
+
+size_t VertexAnimations::uploadPrimitive(
+    uint32_t primitiveIdx, const std::vector<uint32_t> *vertexRemap) const
+{
+  auto it = std::lower_bound(begin(m_primitiveClips), end(m_primitiveClips),
+      primitiveIdx, [](const PrimitiveClip &primitiveClip, uint32_t idx) {
+        return primitiveClip.primitive < idx;
+      });
+  if (it == end(m_primitiveClips) || it->primitive != primitiveIdx) {
+    return 0;
+  }
+  size_t byteSize = 0;
+  std::vector<uint32_t> words;
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer.glId());
+  for (; it != end(m_primitiveClips) && it->primitive == primitiveIdx; ++it) {
+    const auto &clip = m_clips[it->clip];
+    const auto vertexCount = size_t(clip.vertexCount);
+    const auto frameWordCount = vertexCount * WORDS_PER_VERTEX;
+    const auto *data = m_data.data() + clip.offset;
+    words.resize(clip.frameCount * frameWordCount);
+    for (size_t frame = 0; frame < clip.frameCount; ++frame) {
+      for (size_t v = 0; v < vertexCount; ++v) {
+        const auto dst = vertexRemap && vertexRemap->size() == vertexCount
+                             ? (*vertexRemap)[v]
+                             : v;
+        std::copy_n(data + frame * frameWordCount + v * WORDS_PER_VERTEX,
+            WORDS_PER_VERTEX,
+            words.data() + frame * frameWordCount + dst * WORDS_PER_VERTEX);
+      }
+    }
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+        GLintptr(it->offset * sizeof(uint32_t)),
+        GLsizeiptr(words.size() * sizeof(uint32_t)), words.data());
+    byteSize += words.size() * sizeof(uint32_t);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return byteSize;
+}
+
+void VertexAnimations::growPrimitiveBounds(std::vector<glm::vec3> &boundsMin,
+    std::vector<glm::vec3> &boundsMax) const
+{
+  for (const auto &primitiveClip : m_primitiveClips) {
+    const auto &clip = m_clips[primitiveClip.clip];
+    auto &bboxMin = boundsMin[primitiveClip.primitive];
+    auto &bboxMax = boundsMax[primitiveClip.primitive];
+    // Primitives without bounds have an empty box
+    if (glm::any(glm::greaterThan(bboxMin, bboxMax))) {
+      bboxMin = clip.boundsMin;
+      bboxMax = clip.boundsMax;
+    } else {
+      bboxMin = glm::min(bboxMin, clip.boundsMin);
+      bboxMax = glm::max(bboxMax, clip.boundsMax);
+    }
+  }
+}
+
+const VertexAnimations::PrimitiveClip *VertexAnimations::findPrimitiveClip(
+    uint32_t primitiveIdx, int animation) const
+{
+  if (animation < 0) {
+    return nullptr;
+  }
+  const auto it = std::lower_bound(begin(m_primitiveClips),
+      end(m_primitiveClips), std::make_pair(primitiveIdx, uint32_t(animation)),
+      [&](const PrimitiveClip &primitiveClip,
+          const std::pair<uint32_t, uint32_t> &key) {
+        return std::make_pair(primitiveClip.primitive,
+                   m_clips[primitiveClip.clip].animation) < key;
+      });
+  return it != end(m_primitiveClips) && it->primitive == primitiveIdx &&
+                 m_clips[it->clip].animation == uint32_t(animation)
+             ? &*it
+             : nullptr;
+}
+
+void VertexAnimations::setPrimitive(const GLProgram &program,
+    uint32_t primitiveIdx, const ArenaPrimitive &primitive, int animation,
+    double time) const
+{
+  const auto *primitiveClip = findPrimitiveClip(primitiveIdx, animation);
+  if (!primitiveClip) {
+    program.getUniform<GLuint>("uVertexAnimationFrameCount").set(0);
+    return;
+  }
+  const auto &clip = m_clips[primitiveClip->clip];
+  // Loops over the duration, as SceneAnimations::apply
+  auto frame = 0.;
+  if (clip.duration > 0.f) {
+    const auto loopTime = std::fmod(time, double(clip.duration));
+    frame = (loopTime < 0. ? loopTime + clip.duration : loopTime) /
+            clip.duration * clip.frameCount;
+  }
+  // The positions of the clip are normalized in its bounds, those of the
+  // arena by the quantization of the primitive
+  auto scale = clip.boundsMax - clip.boundsMin;
+  for (glm::length_t c = 0; c < 3; ++c) {
+    if (scale[c] <= 0.f) {
+      scale[c] = 1.f;
+    }
+  }
+  program.getUniform<GLuint>("uVertexAnimationOffset")
+      .set(GLuint(primitiveClip->offset));
+  program.getUniform<GLint>("uVertexAnimationBaseVertex")
+      .set(primitive.baseVertex);
+  program.getUniform<GLuint>("uVertexAnimationVertexCount")
+      .set(clip.vertexCount);
+  program.getUniform<GLuint>("uVertexAnimationFrameCount")
+      .set(clip.frameCount);
+  program.getUniform<float>("uVertexAnimationFrame").set(float(frame));
+  program.getUniform<glm::vec3>("uVertexAnimationScale")
+      .set(scale / primitive.positionScale);
+  program.getUniform<glm::vec3>("uVertexAnimationBias")
+      .set((clip.boundsMin - primitive.positionOffset) /
+           primitive.positionScale);
+}
+
+void VertexAnimations::bind() const
+{
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, STORAGE_BINDING, m_buffer.glId());
+}
+
+void VertexAnimations::unbind() const
+{
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, STORAGE_BINDING, 0);
+}
+
+fs::path getVertexAnimationsPath(const fs::path &sourcePath)
+{
+  auto path = sourcePath;
+  path += ".vat";
+  return path;
+}
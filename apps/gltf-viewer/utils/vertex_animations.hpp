@@ -0,0 +1,144 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "geometry_arena.hpp"
+#include "gl_objects.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Animations of skinned meshes baked offline into the frames of their
+// vertices (see bakeVertexAnimations in gltf-optimize), so that instances of
+// a skinned mesh are animated by the vertex shader alone: a crowd of
+// animated characters then costs about as much as static instances, with
+// neither palettes nor skinning passes.
+//
+// A clip holds the frames of an animation of a primitive of a mesh, posed by
+// the first node skinning the mesh, in the space of that node. Frames are
+// sampled at a fixed rate over the duration of the animation, which loops:
+// the last frame blends back into the first one. A vertex of a frame is
+// WORDS_PER_VERTEX words: its position as normalized 16-bit integers in the
+// bounds of the clip and its normal octahedral encoded in two normalized
+// 16-bit integers, as the quantized vertices of GeometryArena.
+//
+// The clips are stored next to the glTF file (see
+// getVertexAnimationsPath), keyed by its computeSceneCacheKey. The viewer
+// uploads those of the primitives of an arena to a storage buffer, their
+// vertices in the order of the arena, read by forward.vs.glsl compiled with
+// INSTANCED and VERTEX_ANIMATIONS. Each instance plays the clip of the
+// animation of the scene with its own phase (see InstancedDrawList::draw),
+// blending the two frames around its time.
+class VertexAnimations
+{
+public:
+  static const size_t WORDS_PER_VERTEX = 3;
+  // After ShadowAtlas::VIEWS_BINDING
+  static const GLuint STORAGE_BINDING = 24;
+
+  struct Clip
+  {
+    uint32_t mesh = 0;
+    uint32_t primitive = 0; // In the mesh
+    uint32_t animation = 0;
+    uint32_t vertexCount = 0;
+    uint32_t frameCount = 0;
+    float duration = 0.f; // In seconds
+    // Bounds of the positions of every frame
+    glm::vec3 boundsMin = glm::vec3(0);
+    glm::vec3 boundsMax = glm::vec3(0);
+    uint64_t offset = 0; // First word of the first frame in data()
+  };
+
+  VertexAnimations() = default;
+
+  // Non-copyable class:
+  VertexAnimations(const VertexAnimations &) = delete;
+  VertexAnimations &operator=(const VertexAnimations &) = delete;
+
+  VertexAnimations(VertexAnimations &&) = default;
+  VertexAnimations &operator=(VertexAnimations &&) = default;
+
+  // Append a clip whose frames are frameCount * vertexCount positions and
+  // normals (3 floats each, frame after frame), its offset and bounds are
+  // set here
+  void addClip(Clip clip, const std::vector<float> &positions,
+      const std::vector<float> &normals);
+
+  bool empty() const { return m_clips.empty(); }
+
+  const std::vector<Clip> &clips() const { return m_clips; }
+
+  const std::vector<uint32_t> &data() const { return m_data; }
+
+  // Read the clips written by write() for the same source. Return false if
+  // the file is missing, stale or invalid, err is only set in the latter
+  // case.
+  bool read(const fs::path &path, uint64_t sourceKey, std::string &err);
+
+  // Write the clips in path, with the key of the source glTF file (see
+  // computeSceneCacheKey), through a temporary file renamed at the end
+  bool write(
+      const fs::path &path, uint64_t sourceKey, std::string &err) const;
+
+  // Allocate the storage buffer of the clips of primitives, the primitives
+  // of mesh m starting at meshToPrimitives[m]. Clips whose vertex count
+  // differs from their arena primitive are skipped. Return the number of
+  // clips allocated.
+  size_t allocate(const std::vector<ArenaPrimitive> &primitives,
+      const std::vector<size_t> &meshToPrimitives);
+
+  // Upload the clips of an arena primitive in the order of its arena
+  // vertices, vertexRemap as in GeometryArena::uploadPrimitive. Return the
+  // number of bytes uploaded.
+  size_t uploadPrimitive(uint32_t primitiveIdx,
+      const std::vector<uint32_t> *vertexRemap = nullptr) const;
+
+  // True if an arena primitive has a clip of animation
+  bool isAnimated(uint32_t primitiveIdx, int animation) const
+  {
+    return findPrimitiveClip(primitiveIdx, animation) != nullptr;
+  }
+
+  // Grow the bounds of each arena primitive with the bounds of its clips,
+  // boundsMin and boundsMax being indexed like the arena primitives
+  void growPrimitiveBounds(std::vector<glm::vec3> &boundsMin,
+      std::vector<glm::vec3> &boundsMax) const;
+
+  // Set the uniforms of program (forward.vs.glsl with VERTEX_ANIMATIONS) to
+  // play the clip of animation of an arena primitive at time seconds, or to
+  // draw its bind pose if it has none
+  void setPrimitive(const GLProgram &program, uint32_t primitiveIdx,
+      const ArenaPrimitive &primitive, int animation, double time) const;
+
+  // Bind the storage buffer of the clips at STORAGE_BINDING
+  void bind() const;
+
+  void unbind() const;
+
+private:
+  // Clip uploaded for an arena primitive
+  struct PrimitiveClip
+  {
+    uint32_t primitive; // In the arena
+    uint32_t clip;
+    uint64_t offset; // First word in m_buffer
+  };
+
+  const PrimitiveClip *findPrimitiveClip(
+      uint32_t primitiveIdx, int animation) const;
+
+  std::vector<Clip> m_clips;
+  std::vector<uint32_t> m_data;
+  // Sorted by primitive, then by animation
+  std::vector<PrimitiveClip> m_primitiveClips;
+  GLBuffer m_buffer;
+};
+
+// Default location of the clips baked for sourcePath, next to it
+fs::path getVertexAnimationsPath(const fs::path &sourcePath);
@@ -0,0 +1,159 @@
+#include "vertex_normals.hpp"
+#include "job_system.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+void computeSmoothNormals(const float *positions, size_t vertexCount,
+    const uint32_t *indices, size_t indexCount, float *normals)
+{
+  const auto getPosition = [&](uint32_t index) {
+    return glm::vec3(positions[3 * index], positions[3 * index + 1],
+        positions[3 * index + 2]);
+  };
+
+  // The cross product of two edges is the normal scaled by twice the area
+  std::fill(normals, normals + 3 * vertexCount, 0.f);
+  for (size_t i = 0; i + 2 < indexCount; i += 3) {
+    const uint32_t triangle[] = {indices[i], indices[i + 1], indices[i + 2]};
+    const auto p0 = getPosition(triangle[0]);
+    const auto normal = glm::cross(
+        getPosition(triangle[1]) - p0, getPosition(triangle[2]) - p0);
+    for (const auto index : triangle) {
+      normals[3 * index] += normal.x;
+      normals[3 * index + 1] += normal.y;
+      normals[3 * index + 2] += normal.z;
+    }
+  }
+
+  for (size_t v = 0; v < vertexCount; ++v) {
+    auto *normal = normals + 3 * v;
+    const auto length2 =
+        normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2];
+    if (length2 > 0.f) {
+      const auto scale = 1.f / std::sqrt(length2);
+      normal[0] *= scale;
+      normal[1] *= scale;
+      normal[2] *= scale;
+    } else {
+      normal[0] = 0.f;
+      normal[1] = 0.f;
+      normal[2] = 1.f;
+    }
+  }
+}
+
+bool isMissingNormals(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const tinygltf::Primitive &primitive)
+{
+  const auto it = primitive.attributes.find("POSITION");
+  if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+      it == end(primitive.attributes) ||
+      primitive.attributes.count("NORMAL")) {
+    return false;
+  }
+  const auto &accessor = model.accessors[it->second];
+  return accessor.bufferView >= 0 && accessor.count &&
+         buffers[model.bufferViews[accessor.bufferView].buffer].data;
+}
+
+void computePrimitiveNormals(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const tinygltf::Primitive &primitive, const float *positions,
+    std::vector<float> &normals)
+{
+  normals.clear();
+  const auto vertexCount =
+      model.accessors[primitive.attributes.at("POSITION")].count;
+  std::vector<uint32_t> indices;
+  if (primitive.indices >= 0) {
+    const auto &indexAccessor = model.accessors[primitive.indices];
+    indices.resize(indexAccessor.count);
+    readAccessorAsUints(model, buffers, indexAccessor, indices.data());
+  } else {
+    indices.resize(vertexCount);
+    std::iota(begin(indices), end(indices), 0);
+  }
+  if (std::any_of(begin(indices), end(indices),
+          [&](uint32_t index) { return index >= vertexCount; })) {
+    return;
+  }
+  normals.resize(3 * vertexCount);
+  computeSmoothNormals(positions, vertexCount, indices.data(), indices.size(),
+      normals.data());
+}
+
+size_t generateMissingNormals(
+    tinygltf::Model &model, std::vector<BufferSpan> &buffers)
+{
+  std::vector<tinygltf::Primitive *> primitives;
+  for (auto &mesh : model.meshes) {
+    for (auto &primitive : mesh.primitives) {
+      if (isMissingNormals(model, buffers, primitive)) {
+        primitives.push_back(&primitive);
+      }
+    }
+  }
+  if (primitives.empty()) {
+    return 0;
+  }
+
+  std::vector<std::vector<float>> normals(primitives.size());
+  getJobSystem().parallelFor(
+      primitives.size(), 1, [&](size_t beginIdx, size_t endIdx) {
+        std::vector<float> positions;
+        for (auto i = beginIdx; i < endIdx; ++i) {
+          const auto &primitive = *primitives[i];
+          const auto &accessor =
+              model.accessors[primitive.attributes.at("POSITION")];
+          positions.resize(3 * accessor.count);
+          readAccessorAsFloats(model, buffers, accessor, 3, positions.data());
+          computePrimitiveNormals(
+              model, buffers, primitive, positions.data(), normals[i]);
+        }
+      });
+  return addNormalAttributes(model, buffers, primitives, normals);
+}
+
+size_t addNormalAttributes(tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers,
+    const std::vector<tinygltf::Primitive *> &primitives,
+    const std::vector<std::vector<float>> &normals)
+{
+  // One buffer holds the normals of every primitive, a view each
+  tinygltf::Buffer buffer;
+  size_t generatedCount = 0;
+  for (size_t i = 0; i < primitives.size(); ++i) {
+    if (normals[i].empty()) {
+      continue;
+    }
+    tinygltf::BufferView bufferView;
+    bufferView.buffer = int(model.buffers.size());
+    bufferView.byteOffset = buffer.data.size();
+    bufferView.byteLength = normals[i].size() * sizeof(float);
+    bufferView.target = TINYGLTF_TARGET_ARRAY_BUFFER;
+    const auto bytes =
+        reinterpret_cast<const unsigned char *>(normals[i].data());
+    buffer.data.insert(end(buffer.data), bytes, bytes + bufferView.byteLength);
+
+    tinygltf::Accessor accessor;
+    accessor.bufferView = int(model.bufferViews.size());
+    accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+    accessor.type = TINYGLTF_TYPE_VEC3;
+    accessor.count = normals[i].size() / 3;
+    model.bufferViews.push_back(bufferView);
+    primitives[i]->attributes["NORMAL"] = int(model.accessors.size());
+    model.accessors.push_back(accessor);
+    ++generatedCount;
+  }
+  if (generatedCount) {
+    model.buffers.push_back(std::move(buffer));
+    const auto &data = model.buffers.back().data;
+    buffers.push_back({data.data(), data.size()});
+  }
+  return generatedCount;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Area weighted smooth normals of a triangle list: each vertex gets the
+// normalized sum of the normals of its triangles scaled by their area (the
+// cross product of two edges). positions and normals hold 3 floats per
+// vertex. Vertices of no triangle, or of degenerate ones only, get (0, 0, 1).
+// Indices must be smaller than vertexCount.
+void computeSmoothNormals(const float *positions, size_t vertexCount,
+    const uint32_t *indices, size_t indexCount, float *normals);
+
+// Add a NORMAL attribute to the triangle primitives of model that have none,
+// which forward.vs.glsl would otherwise read as zero vectors. Normals are
+// computed by computeSmoothNormals, one primitive per job of the job system,
+// and stored in a new buffer of model without uri, which buffers gets a span
+// on. Generated accessors are ordinary ones, so the scene cache keeps them.
+//
+// The glTF specification asks for flat normals, which would split the
+// vertices shared by several triangles: smooth normals keep the indices and
+// the vertex count of the primitives.
+//
+// Return the number of primitives that got normals.
+size_t generateMissingNormals(
+    tinygltf::Model &model, std::vector<BufferSpan> &buffers);
+
+// Pieces of generateMissingNormals, for passes that already read the
+// positions (see runImportPass).
+
+// True if primitive is a triangle list without NORMAL attribute whose
+// positions are loaded
+bool isMissingNormals(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const tinygltf::Primitive &primitive);
+
+// Smooth normals of primitive, a primitive isMissingNormals, from its
+// positions decoded as 3 floats per vertex. normals is left empty if an
+// index is out of range.
+void computePrimitiveNormals(const tinygltf::Model &model,
+    const std::vector<BufferSpan> &buffers,
+    const tinygltf::Primitive &primitive, const float *positions,
+    std::vector<float> &normals);
+
+// Add normals[i] as the NORMAL attribute of primitives[i], except empty ones,
+// and return the number of primitives that got normals
+size_t addNormalAttributes(tinygltf::Model &model,
+    std::vector<BufferSpan> &buffers,
+    const std::vector<tinygltf::Primitive *> &primitives,
+    const std::vector<std::vector<float>> &normals);
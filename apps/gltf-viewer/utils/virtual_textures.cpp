@@ -0,0 +1,789 @@
+#include "virtual_textures.hpp"
+#include "material_buffer.hpp"
+#include "sampler_cache.hpp"
+#include "texture_compression.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+
+// Frame count of the slots of tails, never evicted
+const uint64_t TAIL_FRAME = std::numeric_limits<uint64_t>::max();
+
+// Wrap mode of a sampler as read by wrapCoordinate in materials.glsl
+uint32_t getWrapCode(GLenum wrap)
+{
+  switch (wrap) {
+  case GL_CLAMP_TO_EDGE:
+    return 1;
+  case GL_MIRRORED_REPEAT:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+void appendError(std::string &err, const std::string &message)
+{
+  if (!err.empty()) {
+    err += '\n';
+  }
+  err += message;
+}
+
+} // namespace
+
+VirtualTextures &VirtualTextures::operator=(VirtualTextures &&rvalue)
+{
+  if (this == &rvalue) {
+    return *this;
+  }
+  release();
+  // Jobs loading pages hold a pointer to the object
+  if (rvalue.m_loadCounter) {
+    getJobSystem().wait(*rvalue.m_loadCounter);
+  }
+  std::swap(m_textures, rvalue.m_textures);
+  std::swap(m_imageTextures, rvalue.m_imageTextures);
+  std::swap(m_caches, rvalue.m_caches);
+  std::swap(m_cacheMemory, rvalue.m_cacheMemory);
+  std::swap(m_pageTable, rvalue.m_pageTable);
+  std::swap(m_nDirtyBegin, rvalue.m_nDirtyBegin);
+  std::swap(m_nDirtyEnd, rvalue.m_nDirtyEnd);
+  std::swap(m_textureBuffer, rvalue.m_textureBuffer);
+  std::swap(m_pageTableBuffer, rvalue.m_pageTableBuffer);
+  std::swap(m_nBudget, rvalue.m_nBudget);
+  std::swap(m_feedbackBuffer, rvalue.m_feedbackBuffer);
+  std::swap(m_feedbackSize, rvalue.m_feedbackSize);
+  std::swap(m_hasFeedback, rvalue.m_hasFeedback);
+  std::swap(m_readbacks, rvalue.m_readbacks);
+  std::swap(m_nNextReadback, rvalue.m_nNextReadback);
+  std::swap(m_requests, rvalue.m_requests);
+  std::swap(m_loads, rvalue.m_loads);
+  std::swap(m_loadCounter, rvalue.m_loadCounter);
+  std::swap(m_nFrame, rvalue.m_nFrame);
+  std::swap(m_nFeedbackFrame, rvalue.m_nFeedbackFrame);
+  std::swap(m_stats, rvalue.m_stats);
+  return *this;
+}
+
+bool VirtualTextures::loadTexture(const tinygltf::Model &model,
+    size_t imageIdx, ImageUsage usage, Texture &texture, std::string &err)
+{
+  const auto &image = model.images[imageIdx];
+  texture.imageIdx = imageIdx;
+  texture.levels.clear();
+
+  // RGBA8 texels of level 0 whose next levels are computed here
+  std::vector<uint8_t> texels;
+  uint32_t width, height;
+  if (isKtx2Image(image)) {
+    Ktx2Image ktx2;
+    if (!canUploadKtx2Image(image) ||
+        !parseKtx2(image.image.data(), image.image.size(), ktx2, err)) {
+      err = "KTX2 image cannot be uploaded as is";
+      return false;
+    }
+    uint32_t blockWidth, blockHeight;
+    getKtx2BlockSize(ktx2.vkFormat, blockWidth, blockHeight);
+    texture.internalFormat = getKtx2InternalFormat(ktx2.vkFormat);
+    const bool isRgba8 = texture.internalFormat == GL_RGBA8 ||
+                         texture.internalFormat == GL_SRGB8_ALPHA8;
+    if (!isRgba8 && (blockWidth != 4 || blockHeight != 4)) {
+      err = "KTX2 format " + std::to_string(ktx2.vkFormat) +
+            " has no 4x4 blocks";
+      return false;
+    }
+    width = ktx2.width;
+    height = ktx2.height;
+    if (!isRgba8 || ktx2.levels.size() > 1) {
+      for (uint32_t level = 0; level < ktx2.levels.size(); ++level) {
+        const auto levelWidth = std::max(width >> level, 1u);
+        const auto levelHeight = std::max(height >> level, 1u);
+        texture.levels.push_back(
+            {ktx2.levels[level].data, levelWidth, levelHeight, 0});
+        if (std::max(levelWidth, levelHeight) <= PAGE_SIZE) {
+          return true;
+        }
+      }
+      err = "KTX2 image has no level of at most " +
+            std::to_string(PAGE_SIZE) + " texels";
+      texture.levels.clear();
+      return false;
+    }
+    // The single level of a KTX2 image asking for mipmaps
+    texels.assign(ktx2.levels[0].data,
+        ktx2.levels[0].data + size_t(width) * height * 4);
+  } else {
+    const size_t bytesPerComponent = image.bits == 16 ? 2 : 1;
+    if (image.width <= 0 || image.height <= 0 || image.component < 1 ||
+        image.component > 4 || (image.bits != 8 && image.bits != 16) ||
+        image.image.size() < size_t(image.width) * image.height *
+                                 image.component * bytesPerComponent) {
+      err = "Invalid image pixels";
+      return false;
+    }
+    width = uint32_t(image.width);
+    height = uint32_t(image.height);
+    texture.internalFormat = GL_RGBA8;
+    // Missing components read as by the R8, RG8 and RGB8 textures of
+    // ImageTexture, 16-bit components keep their most significant byte
+    const size_t texelCount = size_t(width) * height;
+    texels.resize(texelCount * 4);
+    for (size_t i = 0; i < texelCount; ++i) {
+      for (size_t c = 0; c < 4; ++c) {
+        uint8_t value = c == 3 ? 255 : 0;
+        if (c < size_t(image.component)) {
+          const auto offset =
+              (i * image.component + c) * bytesPerComponent;
+          value = image.image[offset + bytesPerComponent - 1];
+        }
+        texels[i * 4 + c] = value;
+      }
+    }
+  }
+
+  std::vector<std::vector<uint8_t>> levels;
+  levels.push_back(std::move(texels));
+  std::vector<glm::uvec2> sizes = {glm::uvec2(width, height)};
+  while (std::max(sizes.back().x, sizes.back().y) > PAGE_SIZE) {
+    const auto size = sizes.back();
+    levels.push_back(
+        downsampleImage(levels.back().data(), size.x, size.y, usage));
+    sizes.emplace_back(std::max(size.x / 2, 1u), std::max(size.y / 2, 1u));
+  }
+  size_t byteCount = 0;
+  for (const auto &level : levels) {
+    byteCount += level.size();
+  }
+  texture.convertedLevels.resize(byteCount);
+  size_t offset = 0;
+  for (size_t level = 0; level < levels.size(); ++level) {
+    std::copy(levels[level].begin(), levels[level].end(),
+        texture.convertedLevels.begin() + offset);
+    texture.levels.push_back({texture.convertedLevels.data() + offset,
+        sizes[level].x, sizes[level].y, 0});
+    offset += levels[level].size();
+  }
+  return true;
+}
+
+void VirtualTextures::reset(const tinygltf::Model &model,
+    const std::vector<size_t> &imagesToVirtualize,
+    const std::vector<ImageUsage> &usages, size_t cacheBudget,
+    std::string &err)
+{
+  TRACE_ZONE("Reset virtual textures");
+  release();
+  m_nBudget = cacheBudget;
+  m_imageTextures.assign(model.images.size(), size_t(-1));
+  m_loadCounter = std::make_unique<JobSystem::JobCounter>();
+
+  std::vector<Texture> textures(imagesToVirtualize.size());
+  std::vector<std::string> errors(imagesToVirtualize.size());
+  getJobSystem().parallelFor(
+      textures.size(), 1, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; ++i) {
+          const auto imageIdx = imagesToVirtualize[i];
+          const auto usage =
+              imageIdx < usages.size() ? usages[imageIdx] : ImageUsage::Data;
+          loadTexture(model, imageIdx, usage, textures[i], errors[i]);
+        }
+      });
+
+  // A cache per internal format
+  std::vector<size_t> cacheTextureCounts;
+  for (size_t i = 0; i < textures.size(); ++i) {
+    auto &texture = textures[i];
+    if (texture.levels.empty()) {
+      continue;
+    }
+    const auto it = std::find_if(m_caches.begin(), m_caches.end(),
+        [&](const PageCache &cache) {
+          return cache.internalFormat == texture.internalFormat;
+        });
+    if (it == m_caches.end() && m_caches.size() == MAX_PAGE_CACHES) {
+      errors[i] = "More than " + std::to_string(MAX_PAGE_CACHES) +
+                  " texture formats to page";
+      texture.levels.clear();
+      continue;
+    }
+    texture.cache = size_t(it - m_caches.begin());
+    if (it == m_caches.end()) {
+      PageCache cache;
+      cache.internalFormat = texture.internalFormat;
+      cache.blockSize = cache.internalFormat == GL_RGBA8 ||
+                                cache.internalFormat == GL_SRGB8_ALPHA8
+                            ? 1
+                            : 4;
+      cache.blockBytes = getTextureByteSize(
+          cache.internalFormat, cache.blockSize, cache.blockSize);
+      m_caches.push_back(std::move(cache));
+      cacheTextureCounts.push_back(0);
+    }
+    ++cacheTextureCounts[texture.cache];
+  }
+
+  // The budget is shared by the caches in proportion of their textures, each
+  // cache holding at least the tails of its textures and as many pages
+  size_t textureCount = 0;
+  for (const auto count : cacheTextureCounts) {
+    textureCount += count;
+  }
+  GLint maxTextureSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  const auto maxSlotsPerRow = uint32_t(maxTextureSize) / SLOT_SIZE;
+  size_t cacheBytes = 0;
+  for (size_t c = 0; c < m_caches.size(); ++c) {
+    auto &cache = m_caches[c];
+    const auto slotBytes =
+        getTextureByteSize(cache.internalFormat, SLOT_SIZE, SLOT_SIZE);
+    const auto slotCount = std::max(
+        cacheBudget / textureCount * cacheTextureCounts[c] / slotBytes,
+        2 * cacheTextureCounts[c]);
+    cache.slotsPerRow = std::min(
+        uint32_t(std::ceil(std::sqrt(double(slotCount)))), maxSlotsPerRow);
+    const auto size = GLsizei(cache.slotsPerRow * SLOT_SIZE);
+    glGenTextures(1, &cache.texture);
+    glBindTexture(GL_TEXTURE_2D, cache.texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, cache.internalFormat, size, size);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    cacheBytes += getTextureByteSize(cache.internalFormat, size, size);
+
+    const size_t slots = size_t(cache.slotsPerRow) * cache.slotsPerRow;
+    cache.slotPages.assign(slots, NO_PAGE);
+    cache.slotFrames.assign(slots, 0);
+    cache.freeSlots.resize(slots);
+    for (size_t slot = 0; slot < slots; ++slot) {
+      cache.freeSlots[slot] = uint32_t(slots - 1 - slot);
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  m_cacheMemory = TrackedGLMemory(GLMemoryCategory::Textures, cacheBytes);
+
+  // Pages of the textures whose tail has a slot
+  uint32_t pageCount = 0;
+  for (size_t i = 0; i < textures.size(); ++i) {
+    auto &texture = textures[i];
+    if (texture.levels.empty()) {
+      if (!errors[i].empty()) {
+        appendError(err, "Image " + std::to_string(imagesToVirtualize[i]) +
+                             " is not paged: " + errors[i]);
+      }
+      continue;
+    }
+    auto &cache = m_caches[texture.cache];
+    if (cache.tailCount == cache.slotPages.size()) {
+      appendError(err, "Image " + std::to_string(imagesToVirtualize[i]) +
+                           " is not paged: its page cache is full");
+      continue;
+    }
+    ++cache.tailCount;
+    for (auto &level : texture.levels) {
+      level.firstPage = pageCount;
+      const auto count = getPageCount(level);
+      pageCount += count.x * count.y;
+    }
+    m_imageTextures[texture.imageIdx] = m_textures.size();
+    m_textures.push_back(std::move(texture));
+  }
+
+  // Tails, sampled until finer pages are loaded
+  std::vector<std::vector<unsigned char>> tails(m_textures.size());
+  getJobSystem().parallelFor(
+      tails.size(), 1, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; ++i) {
+          readPage(m_textures[i].levels.back().firstPage, tails[i]);
+        }
+      });
+  m_pageTable.resize(pageCount);
+  for (size_t i = 0; i < m_textures.size(); ++i) {
+    const auto &texture = m_textures[i];
+    auto &cache = m_caches[texture.cache];
+    const auto slot = cache.freeSlots.back();
+    cache.freeSlots.pop_back();
+    const auto &tail = texture.levels.back();
+    cache.slotPages[slot] = tail.firstPage;
+    cache.slotFrames[slot] = TAIL_FRAME;
+    writeSlot(cache, slot, tails[i]);
+    std::fill(m_pageTable.begin() + texture.levels[0].firstPage,
+        m_pageTable.begin() + tail.firstPage + 1,
+        makeEntry(slot, uint32_t(texture.levels.size() - 1)));
+  }
+
+  std::vector<GpuTexture> gpuTextures(m_textures.size());
+  for (size_t i = 0; i < m_textures.size(); ++i) {
+    const auto &texture = m_textures[i];
+    auto &gpuTexture = gpuTextures[i];
+    gpuTexture.firstPage = texture.levels[0].firstPage;
+    gpuTexture.width = texture.levels[0].width;
+    gpuTexture.height = texture.levels[0].height;
+    gpuTexture.tailLevel = uint32_t(texture.levels.size() - 1);
+    gpuTexture.cache = uint32_t(texture.cache);
+    gpuTexture.slotsPerRow = m_caches[texture.cache].slotsPerRow;
+  }
+  if (!m_textures.empty()) {
+    // No feedback is written until the first update()
+    const FeedbackHeader header = {};
+    m_feedbackBuffer = GLBuffer(
+        sizeof(FeedbackHeader), &header, GL_DYNAMIC_STORAGE_BIT);
+    m_textureBuffer = GLBuffer(gpuTextures.size() * sizeof(GpuTexture),
+        gpuTextures.data(), 0);
+    m_pageTableBuffer = GLBuffer(m_pageTable.size() * sizeof(uint32_t),
+        m_pageTable.data(), GL_DYNAMIC_STORAGE_BIT);
+  }
+
+  m_stats.pageCount = pageCount;
+  for (const auto &cache : m_caches) {
+    m_stats.slotCount += cache.slotPages.size();
+  }
+  m_stats.residentPageCount = m_textures.size();
+  m_stats.cacheBytes = cacheBytes;
+}
+
+void VirtualTextures::release()
+{
+  if (m_loadCounter) {
+    getJobSystem().wait(*m_loadCounter);
+  }
+  for (auto &readback : m_readbacks) {
+    if (readback.fence) {
+      glDeleteSync(readback.fence);
+    }
+    readback = Readback();
+  }
+  for (const auto &cache : m_caches) {
+    glDeleteTextures(1, &cache.texture);
+  }
+  m_textures.clear();
+  m_imageTextures.clear();
+  m_caches.clear();
+  m_cacheMemory = TrackedGLMemory();
+  m_pageTable.clear();
+  m_nDirtyBegin = m_nDirtyEnd = 0;
+  m_textureBuffer = GLBuffer();
+  m_pageTableBuffer = GLBuffer();
+  m_feedbackBuffer = GLBuffer();
+  m_feedbackSize = glm::uvec2(0);
+  m_hasFeedback = false;
+  m_nNextReadback = 0;
+  m_requests.clear();
+  m_loads.clear();
+  m_nFrame = 1;
+  m_nFeedbackFrame = 0;
+  m_stats = Stats();
+}
+
+std::vector<glm::uvec2> VirtualTextures::getTextureRefs(
+    const tinygltf::Model &model, const std::vector<int> &textureImages) const
+{
+  std::vector<glm::uvec2> refs(model.textures.size(), glm::uvec2(0));
+  for (size_t i = 0; i < refs.size() && i < textureImages.size(); ++i) {
+    const auto imageIdx = textureImages[i];
+    if (imageIdx < 0 || size_t(imageIdx) >= m_imageTextures.size() ||
+        m_imageTextures[imageIdx] == size_t(-1)) {
+      continue;
+    }
+    const auto sampler = getSamplerState(model, int(i));
+    refs[i] = glm::uvec2(m_imageTextures[imageIdx] + 1,
+        getWrapCode(sampler.wrapS) | (getWrapCode(sampler.wrapT) << 2));
+  }
+  return refs;
+}
+
+void VirtualTextures::update(size_t uploadBudget, size_t width, size_t height)
+{
+  if (empty()) {
+    return;
+  }
+  TRACE_ZONE("Update virtual textures");
+
+  // Copy the feedback of the last frame, overwriting the oldest readback if
+  // it is still in flight
+  if (m_hasFeedback) {
+    auto &readback = m_readbacks[m_nNextReadback];
+    if (readback.fence) {
+      glDeleteSync(readback.fence);
+    }
+    readback.pageCount = size_t(m_feedbackSize.x) * m_feedbackSize.y;
+    glBindBuffer(GL_COPY_READ_BUFFER, m_feedbackBuffer.glId());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer.glId());
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+        sizeof(FeedbackHeader), 0, readback.pageCount * sizeof(uint32_t));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    m_nNextReadback = (m_nNextReadback + 1) % FEEDBACK_LATENCY;
+    m_hasFeedback = false;
+  }
+
+  // Read the finished readbacks, from the oldest
+  for (size_t i = 0; i < FEEDBACK_LATENCY; ++i) {
+    auto &readback = m_readbacks[(m_nNextReadback + i) % FEEDBACK_LATENCY];
+    if (!readback.fence) {
+      continue;
+    }
+    const auto status = glClientWaitSync(readback.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      break;
+    }
+    glDeleteSync(readback.fence);
+    readback.fence = nullptr;
+    if (status == GL_WAIT_FAILED) {
+      continue;
+    }
+    const auto size = readback.pageCount * sizeof(uint32_t);
+    const auto pages = static_cast<const uint32_t *>(
+        readback.buffer.map(0, size, GL_MAP_READ_BIT));
+    if (pages) {
+      readFeedback(pages, readback.pageCount);
+      readback.buffer.unmap();
+    }
+  }
+
+  finishLoads();
+  startLoads(uploadBudget);
+
+  if (m_nDirtyBegin < m_nDirtyEnd) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_pageTableBuffer.glId());
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+        GLintptr(m_nDirtyBegin * sizeof(uint32_t)),
+        GLsizeiptr((m_nDirtyEnd - m_nDirtyBegin) * sizeof(uint32_t)),
+        m_pageTable.data() + m_nDirtyBegin);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    m_nDirtyBegin = m_nDirtyEnd = 0;
+  }
+
+  clearFeedback(width, height);
+  ++m_nFrame;
+}
+
+void VirtualTextures::bind() const
+{
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, TEXTURES_BINDING, m_textureBuffer.glId());
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, PAGE_TABLE_BINDING, m_pageTableBuffer.glId());
+  glBindBufferBase(
+      GL_SHADER_STORAGE_BUFFER, FEEDBACK_BINDING, m_feedbackBuffer.glId());
+  GLuint textures[MAX_PAGE_CACHES] = {};
+  for (size_t i = 0; i < m_caches.size(); ++i) {
+    textures[i] = m_caches[i].texture;
+  }
+  glBindTextures(0, GLsizei(MAX_PAGE_CACHES), textures);
+  // The filtering of the caches, not that of sampler objects
+  glBindSamplers(0, GLsizei(MAX_PAGE_CACHES), nullptr);
+}
+
+void VirtualTextures::unbind() const
+{
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TEXTURES_BINDING, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PAGE_TABLE_BINDING, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FEEDBACK_BINDING, 0);
+  glBindTextures(0, GLsizei(MAX_PAGE_CACHES), nullptr);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void VirtualTextures::locatePage(uint32_t page, size_t &textureIdx,
+    uint32_t &level, uint32_t &x, uint32_t &y) const
+{
+  const auto texture = std::upper_bound(m_textures.begin(), m_textures.end(),
+                           page,
+                           [](uint32_t page, const Texture &texture) {
+                             return page < texture.levels[0].firstPage;
+                           }) -
+                       1;
+  textureIdx = size_t(texture - m_textures.begin());
+  level = uint32_t(texture->levels.size() - 1);
+  while (texture->levels[level].firstPage > page) {
+    --level;
+  }
+  const auto &pageLevel = texture->levels[level];
+  const auto pageCount = getPageCount(pageLevel);
+  const auto idx = page - pageLevel.firstPage;
+  x = idx % pageCount.x;
+  y = idx / pageCount.x;
+}
+
+glm::uvec2 VirtualTextures::getPageCount(const Level &level)
+{
+  return (glm::uvec2(level.width, level.height) + PAGE_SIZE - 1u) / PAGE_SIZE;
+}
+
+void VirtualTextures::readPage(
+    uint32_t page, std::vector<unsigned char> &data) const
+{
+  size_t textureIdx;
+  uint32_t level, x, y;
+  locatePage(page, textureIdx, level, x, y);
+  const auto &texture = m_textures[textureIdx];
+  const auto &cache = m_caches[texture.cache];
+  const auto &source = texture.levels[level];
+
+  // In blocks: the border of compressed pages is a block
+  const auto blockSize = cache.blockSize;
+  const auto blockBytes = cache.blockBytes;
+  const auto slotBlocks = SLOT_SIZE / blockSize;
+  const auto borderBlocks = int64_t(PAGE_BORDER / blockSize);
+  const auto pageBlocks = int64_t(PAGE_SIZE / blockSize);
+  const auto levelBlocksX = int64_t((source.width + blockSize - 1) / blockSize);
+  const auto levelBlocksY =
+      int64_t((source.height + blockSize - 1) / blockSize);
+
+  // Blocks out of the level repeat its edges
+  data.resize(size_t(slotBlocks) * slotBlocks * blockBytes);
+  for (uint32_t blockY = 0; blockY < slotBlocks; ++blockY) {
+    const auto sourceY = std::clamp(
+        int64_t(y) * pageBlocks + blockY - borderBlocks, int64_t(0),
+        levelBlocksY - 1);
+    for (uint32_t blockX = 0; blockX < slotBlocks; ++blockX) {
+      const auto sourceX = std::clamp(
+          int64_t(x) * pageBlocks + blockX - borderBlocks, int64_t(0),
+          levelBlocksX - 1);
+      std::memcpy(data.data() + (size_t(blockY) * slotBlocks + blockX) *
+                                    blockBytes,
+          source.data + size_t(sourceY * levelBlocksX + sourceX) * blockBytes,
+          blockBytes);
+    }
+  }
+}
+
+void VirtualTextures::writeSlot(const PageCache &cache, uint32_t slot,
+    const std::vector<unsigned char> &data) const
+{
+  const auto x = GLint(slot % cache.slotsPerRow * SLOT_SIZE);
+  const auto y = GLint(slot / cache.slotsPerRow * SLOT_SIZE);
+  glBindTexture(GL_TEXTURE_2D, cache.texture);
+  if (cache.blockSize > 1) {
+    glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, SLOT_SIZE, SLOT_SIZE,
+        cache.internalFormat, GLsizei(data.size()), data.data());
+  } else {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, SLOT_SIZE, SLOT_SIZE, GL_RGBA,
+        GL_UNSIGNED_BYTE, data.data());
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void VirtualTextures::fillEntries(size_t textureIdx, uint32_t topLevel,
+    uint32_t x, uint32_t y, uint32_t minLevel, uint32_t entry)
+{
+  const auto &texture = m_textures[textureIdx];
+  for (uint32_t level = topLevel + 1; level-- > 0;) {
+    const auto &pageLevel = texture.levels[level];
+    const auto pageCount = getPageCount(pageLevel);
+    const auto shift = topLevel - level;
+    const auto endX = std::min((x + 1) << shift, pageCount.x);
+    const auto endY = std::min((y + 1) << shift, pageCount.y);
+    for (auto pageY = y << shift; pageY < endY; ++pageY) {
+      for (auto pageX = x << shift; pageX < endX; ++pageX) {
+        const auto page = pageLevel.firstPage + pageY * pageCount.x + pageX;
+        if ((m_pageTable[page] >> 24) < minLevel) {
+          continue;
+        }
+        m_pageTable[page] = entry;
+        if (m_nDirtyBegin == m_nDirtyEnd) {
+          m_nDirtyBegin = page;
+          m_nDirtyEnd = page + 1;
+        } else {
+          m_nDirtyBegin = std::min(m_nDirtyBegin, page);
+          m_nDirtyEnd = std::max(m_nDirtyEnd, page + 1);
+        }
+      }
+    }
+  }
+}
+
+uint32_t VirtualTextures::allocateSlot(PageCache &cache)
+{
+  if (!cache.freeSlots.empty()) {
+    const auto slot = cache.freeSlots.back();
+    cache.freeSlots.pop_back();
+    return slot;
+  }
+  uint32_t slot = NO_PAGE;
+  for (uint32_t i = 0; i < cache.slotFrames.size(); ++i) {
+    if (cache.slotFrames[i] < m_nFeedbackFrame &&
+        (slot == NO_PAGE || cache.slotFrames[i] < cache.slotFrames[slot])) {
+      slot = i;
+    }
+  }
+  if (slot == NO_PAGE) {
+    return NO_PAGE;
+  }
+
+  // Pages that sampled the evicted one sample its parent again
+  size_t textureIdx;
+  uint32_t level, x, y;
+  locatePage(cache.slotPages[slot], textureIdx, level, x, y);
+  const auto &parentLevel = m_textures[textureIdx].levels[level + 1];
+  const auto parentEntry =
+      m_pageTable[parentLevel.firstPage +
+                  (y >> 1) * getPageCount(parentLevel).x + (x >> 1)];
+  fillEntries(textureIdx, level, x, y, level, parentEntry);
+  cache.slotPages[slot] = NO_PAGE;
+  ++m_stats.evictedPageCount;
+  --m_stats.residentPageCount;
+  return slot;
+}
+
+void VirtualTextures::readFeedback(const uint32_t *pages, size_t count)
+{
+  std::vector<uint32_t> wanted;
+  for (size_t i = 0; i < count; ++i) {
+    if (pages[i] < m_pageTable.size()) {
+      wanted.push_back(pages[i]);
+    }
+  }
+  std::sort(wanted.begin(), wanted.end());
+  wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+  m_nFeedbackFrame = m_nFrame;
+
+  // The next level finer than the resident one toward each wanted page, so
+  // that coarse pages come first and evicted children are loaded again
+  std::vector<std::pair<uint32_t, uint32_t>> requests; // Level and page
+  size_t pendingCount = 0;
+  for (const auto page : wanted) {
+    const auto entry = m_pageTable[page];
+    size_t textureIdx;
+    uint32_t level, x, y;
+    locatePage(page, textureIdx, level, x, y);
+    const auto &texture = m_textures[textureIdx];
+    auto &cache = m_caches[texture.cache];
+    const auto slot = entry & 0xFFFFFF;
+    if (cache.slotFrames[slot] != TAIL_FRAME) {
+      cache.slotFrames[slot] = m_nFrame;
+    }
+    const auto residentLevel = entry >> 24;
+    if (residentLevel <= level) {
+      continue;
+    }
+    ++pendingCount;
+    const auto nextLevel = residentLevel - 1;
+    const auto shift = nextLevel - level;
+    const auto &pageLevel = texture.levels[nextLevel];
+    requests.emplace_back(nextLevel,
+        pageLevel.firstPage + (y >> shift) * getPageCount(pageLevel).x +
+            (x >> shift));
+  }
+  std::sort(requests.begin(), requests.end(),
+      [](const std::pair<uint32_t, uint32_t> &a,
+          const std::pair<uint32_t, uint32_t> &b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+      });
+  requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+
+  m_requests.clear();
+  for (const auto &request : requests) {
+    m_requests.push_back(request.second);
+  }
+  m_stats.requestedPageCount = wanted.size();
+  m_stats.pendingPageCount = pendingCount;
+}
+
+void VirtualTextures::finishLoads()
+{
+  if (m_loads.empty() || m_loadCounter->pending.load() > 0) {
+    return;
+  }
+  for (const auto &load : m_loads) {
+    size_t textureIdx;
+    uint32_t level, x, y;
+    locatePage(load.page, textureIdx, level, x, y);
+    auto &cache = m_caches[m_textures[textureIdx].cache];
+    const auto slot = allocateSlot(cache);
+    if (slot == NO_PAGE) {
+      // Requested again by a later feedback if it is still needed
+      continue;
+    }
+    writeSlot(cache, slot, load.data);
+    cache.slotPages[slot] = load.page;
+    cache.slotFrames[slot] = m_nFrame;
+    fillEntries(textureIdx, level, x, y, level, makeEntry(slot, level));
+    ++m_stats.loadedPageCount;
+    ++m_stats.residentPageCount;
+  }
+  m_loads.clear();
+}
+
+void VirtualTextures::startLoads(size_t uploadBudget)
+{
+  if (!m_loads.empty()) {
+    return;
+  }
+  size_t byteCount = 0;
+  size_t requestCount = 0;
+  for (; requestCount < m_requests.size() && byteCount < uploadBudget;
+       ++requestCount) {
+    const auto page = m_requests[requestCount];
+    size_t textureIdx;
+    uint32_t level, x, y;
+    locatePage(page, textureIdx, level, x, y);
+    if ((m_pageTable[page] >> 24) <= level) {
+      continue; // Loaded since it was requested
+    }
+    const auto &cache = m_caches[m_textures[textureIdx].cache];
+    byteCount +=
+        getTextureByteSize(cache.internalFormat, SLOT_SIZE, SLOT_SIZE);
+    m_loads.push_back({page, {}});
+  }
+  m_requests.erase(m_requests.begin(), m_requests.begin() + requestCount);
+
+  // m_loads is not resized until the jobs are finished. Pages are read by
+  // the background workers, if any, not to delay the jobs of the frame.
+  BackgroundJobScope background;
+  for (size_t i = 0; i < m_loads.size(); ++i) {
+    getJobSystem().run(*m_loadCounter,
+        [this, i]() { readPage(m_loads[i].page, m_loads[i].data); });
+  }
+}
+
+void VirtualTextures::clearFeedback(size_t width, size_t height)
+{
+  const glm::uvec2 size((width + FEEDBACK_DIVISOR - 1) / FEEDBACK_DIVISOR,
+      (height + FEEDBACK_DIVISOR - 1) / FEEDBACK_DIVISOR);
+  const auto pageCount = size_t(size.x) * size.y;
+  if (size != m_feedbackSize) {
+    m_feedbackSize = size;
+    m_feedbackBuffer =
+        GLBuffer(sizeof(FeedbackHeader) + pageCount * sizeof(uint32_t),
+            nullptr, GL_DYNAMIC_STORAGE_BIT);
+    for (auto &readback : m_readbacks) {
+      if (readback.fence) {
+        glDeleteSync(readback.fence);
+      }
+      readback = Readback();
+      readback.buffer = GLBuffer(pageCount * sizeof(uint32_t), nullptr,
+          GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+    }
+  }
+
+  // 37 is prime with FEEDBACK_DIVISOR^2, so that the offset visits every
+  // pixel of the blocks
+  const auto offsetIdx =
+      uint32_t(m_nFrame * 37 % (FEEDBACK_DIVISOR * FEEDBACK_DIVISOR));
+  FeedbackHeader header = {};
+  header.offset = glm::uvec2(
+      offsetIdx % FEEDBACK_DIVISOR, offsetIdx / FEEDBACK_DIVISOR);
+  header.size = size;
+  header.slot = uint32_t(m_nFrame % MaterialBuffer::TEXTURE_SLOT_COUNT);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_feedbackBuffer.glId());
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), &header);
+  const auto noPage = NO_PAGE;
+  if (pageCount) {
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI,
+        sizeof(FeedbackHeader), pageCount * sizeof(uint32_t), GL_RED_INTEGER,
+        GL_UNSIGNED_INT, &noPage);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  m_hasFeedback = pageCount > 0;
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "gl_memory.hpp"
+#include "gl_objects.hpp"
+#include "job_system.hpp"
+#include "textures.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Virtual texturing of glTF images: the texture memory is a fixed set of page
+// caches, whatever the number and size of the images.
+//
+// The mip levels of each image are split in pages of PAGE_SIZE texels. Pages
+// are copied with a border of PAGE_BORDER texels (one block of compressed
+// formats) in the slots of a page cache, a 2D texture per internal format,
+// so that KTX2 images (see compressModelImages) are paged in their GPU
+// format. Levels of decoded images are converted to RGBA8 and box filtered
+// on the CPU. The tail of an image, its first level of at most PAGE_SIZE
+// texels, takes a slot for the lifetime of the caches.
+//
+// A page table, a storage buffer with an entry per page of every level,
+// gives the slot and level of the finest resident page covering each page,
+// so that shaders sample a single page (see materials.glsl with
+// VIRTUAL_TEXTURES). Levels are not blended: a texel is read from the
+// nearest level with bilinear filtering.
+//
+// Fragment shaders write the pages they want to a feedback buffer, one pixel
+// per FEEDBACK_DIVISOR x FEEDBACK_DIVISOR block whose offset changes each
+// frame, for one material texture slot per frame. update() reads the
+// feedback back FEEDBACK_LATENCY frames later without waiting, loads the
+// pages the next level finer than the resident ones on the job system, then
+// copies them to least recently seen slots and updates the page table.
+class VirtualTextures
+{
+public:
+  // Texels of a page along each axis, without its border
+  static const uint32_t PAGE_SIZE = 128;
+  static const uint32_t PAGE_BORDER = 4;
+  static const uint32_t SLOT_SIZE = PAGE_SIZE + 2 * PAGE_BORDER;
+  static const uint32_t FEEDBACK_DIVISOR = 8;
+  // Feedback buffers read back in flight
+  static const size_t FEEDBACK_LATENCY = 3;
+  // Size of uPageCaches in materials.glsl, bound to the first texture units
+  static const size_t MAX_PAGE_CACHES = 4;
+  // Storage buffer bindings of materials.glsl
+  static const GLuint TEXTURES_BINDING = 19;
+  static const GLuint PAGE_TABLE_BINDING = 20;
+  static const GLuint FEEDBACK_BINDING = 21;
+
+  struct Stats
+  {
+    size_t pageCount = 0; // Of every level of every texture
+    size_t slotCount = 0; // Of every cache
+    size_t residentPageCount = 0; // Tails included
+    size_t requestedPageCount = 0; // By the last feedback read back
+    size_t pendingPageCount = 0; // Requested but not resident
+    size_t loadedPageCount = 0; // Since reset()
+    size_t evictedPageCount = 0; // Since reset()
+    size_t cacheBytes = 0;
+  };
+
+  VirtualTextures() = default;
+
+  ~VirtualTextures() { release(); }
+
+  // Non-copyable class:
+  VirtualTextures(const VirtualTextures &) = delete;
+  VirtualTextures &operator=(const VirtualTextures &) = delete;
+
+  VirtualTextures(VirtualTextures &&rvalue) { *this = std::move(rvalue); }
+
+  VirtualTextures &operator=(VirtualTextures &&rvalue);
+
+  // Page imagesToVirtualize, indices of model.images whose pixels or KTX2
+  // container must outlive the textures, in page caches of cacheBudget bytes
+  // in total. usages[i] is the usage of model.images[i] (see
+  // getImageUsages), filtering the levels computed from decoded pixels.
+  // Errors are reported in err and the image is skipped (its materials use
+  // their factors only).
+  void reset(const tinygltf::Model &model,
+      const std::vector<size_t> &imagesToVirtualize,
+      const std::vector<ImageUsage> &usages, size_t cacheBudget,
+      std::string &err);
+
+  void release();
+
+  // References of model.textures for MaterialBuffer::buildVirtual: virtual
+  // texture plus one and wrap modes, (0, 0) for textures without a virtual
+  // texture. textureImages[i] is the image of model.textures[i], -1 if none.
+  std::vector<glm::uvec2> getTextureRefs(const tinygltf::Model &model,
+      const std::vector<int> &textureImages) const;
+
+  // Read the feedback of past frames, copy the pages loaded since the last
+  // call and load the next ones, until uploadBudget bytes are loaded, then
+  // clear the feedback of the next frame, drawn at most width x height
+  void update(size_t uploadBudget, size_t width, size_t height);
+
+  // Bind the buffers and the page caches, to units 0 to MAX_PAGE_CACHES - 1
+  void bind() const;
+
+  // Unbind what bind() bound and make unit 0 active
+  void unbind() const;
+
+  bool empty() const { return m_textures.empty(); }
+
+  size_t textureCount() const { return m_textures.size(); }
+
+  size_t cacheCount() const { return m_caches.size(); }
+
+  size_t budget() const { return m_nBudget; }
+
+  const Stats &stats() const { return m_stats; }
+
+private:
+  // Layout of VirtualTexture in materials.glsl (std430)
+  struct GpuTexture
+  {
+    uint32_t firstPage; // Entry of page (0, 0) of level 0 in the page table
+    uint32_t width;
+    uint32_t height;
+    uint32_t tailLevel;
+    uint32_t cache;
+    uint32_t slotsPerRow; // Of its cache
+    uint32_t padding[2];
+  };
+
+  // Start of the PageFeedback buffer of materials.glsl (std430), followed by
+  // a page per feedback pixel
+  struct FeedbackHeader
+  {
+    glm::uvec2 offset; // Of the pixels writing feedback in their block
+    glm::uvec2 size; // Feedback pixels
+    uint32_t slot; // Material texture slot writing feedback
+    uint32_t padding[3];
+  };
+
+  struct Level
+  {
+    const unsigned char *data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t firstPage; // In the page table
+  };
+
+  struct Texture
+  {
+    std::vector<Level> levels; // From level 0 to the tail
+    // Storage of the RGBA8 levels of decoded images
+    std::vector<unsigned char> convertedLevels;
+    size_t imageIdx = 0;
+    GLenum internalFormat = 0;
+    size_t cache = 0;
+  };
+
+  struct PageCache
+  {
+    GLenum internalFormat = 0;
+    GLuint texture = 0;
+    uint32_t blockSize = 1; // Texels of a block along each axis
+    size_t blockBytes = 4;
+    uint32_t slotsPerRow = 0;
+    // Page of each slot and its last frame seen by the feedback, NO_PAGE for
+    // free slots
+    std::vector<uint32_t> slotPages;
+    std::vector<uint64_t> slotFrames;
+    std::vector<uint32_t> freeSlots;
+    size_t tailCount = 0; // Slots taken for good by tails
+  };
+
+  // Page being loaded by a job
+  struct PageLoad
+  {
+    uint32_t page;
+    std::vector<unsigned char> data; // The blocks of a slot
+  };
+
+  static constexpr uint32_t NO_PAGE = 0xFFFFFFFF;
+
+  // Entry of the page table: slot of the page of level, which covers the
+  // page of the entry
+  static uint32_t makeEntry(uint32_t slot, uint32_t level)
+  {
+    return slot | (level << 24);
+  }
+
+  // Levels of model.images[imageIdx] from level 0 to the tail, without
+  // their pages. Return false and fill err if it cannot be paged.
+  static bool loadTexture(const tinygltf::Model &model, size_t imageIdx,
+      ImageUsage usage, Texture &texture, std::string &err);
+
+  // Texture and level of a page, and its coordinates in the level
+  void locatePage(uint32_t page, size_t &textureIdx, uint32_t &level,
+      uint32_t &x, uint32_t &y) const;
+
+  // Pages of level along each axis
+  static glm::uvec2 getPageCount(const Level &level);
+
+  // Copy the page with its border in the blocks of a slot
+  void readPage(uint32_t page, std::vector<unsigned char> &data) const;
+
+  // Copy data in slot of cache
+  void writeSlot(const PageCache &cache, uint32_t slot,
+      const std::vector<unsigned char> &data) const;
+
+  // Set entry in the page table for the pages of level of textureIdx under
+  // page (x, y) of level topLevel (included) whose entry refers to a level
+  // of at least minLevel
+  void fillEntries(size_t textureIdx, uint32_t topLevel, uint32_t x,
+      uint32_t y, uint32_t minLevel, uint32_t entry);
+
+  // Take a free slot, or the least recently seen one of a page not seen by
+  // the last feedback, evicting its page. Return NO_PAGE if every slot is
+  // in use.
+  uint32_t allocateSlot(PageCache &cache);
+
+  // Request the pages of a feedback read back
+  void readFeedback(const uint32_t *pages, size_t count);
+
+  // Copy the loaded pages and start loading the next requests
+  void finishLoads();
+  void startLoads(size_t uploadBudget);
+
+  void clearFeedback(size_t width, size_t height);
+
+  std::vector<Texture> m_textures;
+  std::vector<size_t> m_imageTextures; // Texture of each image, or -1
+  std::vector<PageCache> m_caches;
+  TrackedGLMemory m_cacheMemory;
+  std::vector<uint32_t> m_pageTable; // Mirror of m_pageTableBuffer
+  uint32_t m_nDirtyBegin = 0; // Range of entries to upload
+  uint32_t m_nDirtyEnd = 0;
+  GLBuffer m_textureBuffer;
+  GLBuffer m_pageTableBuffer;
+  size_t m_nBudget = 0;
+
+  GLBuffer m_feedbackBuffer;
+  glm::uvec2 m_feedbackSize = glm::uvec2(0);
+  bool m_hasFeedback = false; // Cleared by the last update()
+  struct Readback
+  {
+    GLBuffer buffer;
+    size_t pageCount = 0;
+    GLsync fence = nullptr;
+  };
+  Readback m_readbacks[FEEDBACK_LATENCY];
+  size_t m_nNextReadback = 0;
+
+  // Pages to load, by decreasing level
+  std::vector<uint32_t> m_requests;
+  std::vector<PageLoad> m_loads;
+  std::unique_ptr<JobSystem::JobCounter> m_loadCounter;
+  uint64_t m_nFrame = 1;
+  uint64_t m_nFeedbackFrame = 0; // Frame of the last feedback read back
+  Stats m_stats;
+};